@@ -35,6 +35,7 @@
 #include <net/if_arp.h>
 #include <sys/ioctl.h>
 #include <linux/filter.h>
+#include <linux/if_packet.h>
 
 #include <misc/debug.h>
 #include <misc/byteorder.h>
@@ -283,6 +284,27 @@ int BArpProbe_Init (BArpProbe *o, const char *ifname, uint32_t addr, BReactor *r
         goto fail0;
     }
     
+    // set socket filter, before binding so that nothing else is queued
+    {
+        struct sock_filter filter[] = {
+            BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE), // A <- packet type
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, PACKET_OUTGOING, 5, 0),    // packet type = outgoing ?
+            BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 6),                         // A <- ARP opcode
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARP_OPCODE_REPLY, 0, 3),   // ARP opcode = reply ?
+            BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 14),                        // A <- ARP sender IP
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntoh32(addr), 0, 1),       // ARP sender IP = probed address ?
+            BPF_STMT(BPF_RET + BPF_K, 65535),                              // return all
+            BPF_STMT(BPF_RET + BPF_K, 0)                                   // ignore
+        };
+        struct sock_fprog fprog = {
+            .len = sizeof(filter) / sizeof(filter[0]),
+            .filter = filter
+        };
+        if (setsockopt(BDatagram_GetFd(&o->dgram), SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+            BLog(BLOG_NOTICE, "not using socket filter");
+        }
+    }
+    
     // bind dgram
     BAddr bind_addr;
     BAddr_InitPacket(&bind_addr, hton16(ETHERTYPE_ARP), if_index, BADDR_PACKET_HEADER_TYPE_ETHERNET, BADDR_PACKET_PACKET_TYPE_HOST, if_mac);
@@ -313,7 +335,7 @@ int BArpProbe_Init (BArpProbe *o, const char *ifname, uint32_t addr, BReactor *r
     PacketRecvInterface_Receiver_Init(o->recv_if, (PacketRecvInterface_handler_done)recv_if_handler_done, o);
     
     // init timer
-    BTimer_Init(&o->timer, 0, (BTimer_handler)timer_handler, o);
+    BTimer_InitCoarse(&o->timer, 0, (BTimer_handler)timer_handler, o);
     
     // receive first packet
     PacketRecvInterface_Receiver_Recv(o->recv_if, (uint8_t *)&o->recv_packet);
@@ -0,0 +1,177 @@
+/**
+ * @file BAllocStats.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <misc/balloc.h>
+#include <misc/maxalign.h>
+#include <misc/batomic.h>
+
+#include "BAllocStats.h"
+
+// precedes memory from BAllocStats_Alloc
+union header {
+    struct {
+        size_t size;
+        int category;
+    } h;
+    bmax_align_t align;
+};
+
+// in the order of the BALLOCSTATS_* values
+static const char *category_names[BALLOCSTATS_NUM_CATEGORIES] = {
+    "flow",
+    "peers",
+    "lwip",
+    "ncdvalmem",
+    "stringindex",
+};
+
+static struct {
+    uint64_t current;
+    uint64_t peak;
+} categories[BALLOCSTATS_NUM_CATEGORIES];
+
+void BAllocStats_Add (int category, size_t bytes)
+{
+    ASSERT(category >= 0 && category < BALLOCSTATS_NUM_CATEGORIES)
+    
+    uint64_t current = batomic_add_uint64(&categories[category].current, bytes);
+    
+    // raise the peak unless another thread raised it above us meanwhile
+    uint64_t peak = batomic_load_uint64_relaxed(&categories[category].peak);
+    while (current > peak) {
+        if (batomic_cas_uint64(&categories[category].peak, &peak, current)) {
+            break;
+        }
+    }
+}
+
+void BAllocStats_Remove (int category, size_t bytes)
+{
+    ASSERT(category >= 0 && category < BALLOCSTATS_NUM_CATEGORIES)
+    
+    batomic_add_uint64(&categories[category].current, -(uint64_t)bytes);
+}
+
+void * BAllocStats_Alloc (int category, size_t bytes)
+{
+    ASSERT(category >= 0 && category < BALLOCSTATS_NUM_CATEGORIES)
+    
+    size_t total = bytes;
+    if (!BSizeAdd(&total, sizeof(union header))) {
+        return NULL;
+    }
+    
+    union header *hdr = (union header *)BAlloc(total);
+    if (!hdr) {
+        return NULL;
+    }
+    
+    hdr->h.size = bytes;
+    hdr->h.category = category;
+    BAllocStats_Add(category, bytes);
+    
+    return hdr + 1;
+}
+
+void * BAllocStats_Realloc (void *m, size_t bytes)
+{
+    ASSERT(m)
+    
+    size_t total = bytes;
+    if (!BSizeAdd(&total, sizeof(union header))) {
+        return NULL;
+    }
+    
+    union header *hdr = (union header *)BRealloc((union header *)m - 1, total);
+    if (!hdr) {
+        return NULL;
+    }
+    
+    BAllocStats_Remove(hdr->h.category, hdr->h.size);
+    BAllocStats_Add(hdr->h.category, bytes);
+    hdr->h.size = bytes;
+    
+    return hdr + 1;
+}
+
+void BAllocStats_Free (void *m)
+{
+    if (!m) {
+        return;
+    }
+    
+    union header *hdr = (union header *)m - 1;
+    
+    BAllocStats_Remove(hdr->h.category, hdr->h.size);
+    BFree(hdr);
+}
+
+const char * BAllocStats_CategoryName (int category)
+{
+    ASSERT(category >= 0 && category < BALLOCSTATS_NUM_CATEGORIES)
+    
+    return category_names[category];
+}
+
+void BAllocStats_Get (int category, size_t *out_current, size_t *out_peak)
+{
+    ASSERT(category >= 0 && category < BALLOCSTATS_NUM_CATEGORIES)
+    
+    *out_current = (size_t)batomic_load_uint64_relaxed(&categories[category].current);
+    *out_peak = (size_t)batomic_load_uint64_relaxed(&categories[category].peak);
+}
+
+void BAllocStats_Print (BAllocStats_print_func func, void *user)
+{
+    char line[128];
+    
+    func(user, "# HELP badvpn_memory_bytes Memory currently used by a subsystem.");
+    func(user, "# TYPE badvpn_memory_bytes gauge");
+    for (int i = 0; i < BALLOCSTATS_NUM_CATEGORIES; i++) {
+        size_t current;
+        size_t peak;
+        BAllocStats_Get(i, &current, &peak);
+        snprintf(line, sizeof(line), "badvpn_memory_bytes{category=\"%s\"} %"PRIu64, category_names[i], (uint64_t)current);
+        func(user, line);
+    }
+    
+    func(user, "# HELP badvpn_memory_peak_bytes Most memory ever used by a subsystem.");
+    func(user, "# TYPE badvpn_memory_peak_bytes gauge");
+    for (int i = 0; i < BALLOCSTATS_NUM_CATEGORIES; i++) {
+        size_t current;
+        size_t peak;
+        BAllocStats_Get(i, &current, &peak);
+        snprintf(line, sizeof(line), "badvpn_memory_peak_bytes{category=\"%s\"} %"PRIu64, category_names[i], (uint64_t)peak);
+        func(user, line);
+    }
+}
@@ -0,0 +1,135 @@
+/**
+ * @file BAllocStats.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * Accounting of memory by the subsystem using it.
+ * 
+ * Each category keeps the number of bytes currently accounted to it and the
+ * highest that number has been. Memory is accounted either by allocating it
+ * with {@link BAllocStats_Alloc}, which keeps the category and size in front
+ * of the block, or, where the size is known when the memory is released, by
+ * calling {@link BAllocStats_Add} and {@link BAllocStats_Remove} around an
+ * existing allocation. Accounting is always on and thread-safe; it costs one
+ * atomic add per allocation and release.
+ */
+
+#ifndef BADVPN_BALLOCSTATS_H
+#define BADVPN_BALLOCSTATS_H
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+
+enum {
+    BALLOCSTATS_FLOW,
+    BALLOCSTATS_PEERS,
+    BALLOCSTATS_LWIP,
+    BALLOCSTATS_NCDVALMEM,
+    BALLOCSTATS_STRINGINDEX,
+    BALLOCSTATS_NUM_CATEGORIES
+};
+
+/**
+ * Function receiving the lines of a memory report.
+ * 
+ * @param user as in {@link BAllocStats_Print}
+ * @param line line of text, without a newline
+ */
+typedef void (*BAllocStats_print_func) (void *user, const char *line);
+
+/**
+ * Accounts memory to a category.
+ * 
+ * @param category category, BALLOCSTATS_*
+ * @param bytes number of bytes
+ */
+void BAllocStats_Add (int category, size_t bytes);
+
+/**
+ * Stops accounting memory to a category.
+ * 
+ * @param category category, BALLOCSTATS_*
+ * @param bytes number of bytes, as previously passed to {@link BAllocStats_Add}
+ */
+void BAllocStats_Remove (int category, size_t bytes);
+
+/**
+ * Allocates memory accounted to a category.
+ * 
+ * @param category category, BALLOCSTATS_*
+ * @param bytes number of bytes to allocate
+ * @return a non-NULL pointer to the memory, or NULL on failure.
+ *         The memory must be freed using {@link BAllocStats_Free}.
+ */
+void * BAllocStats_Alloc (int category, size_t bytes);
+
+/**
+ * Changes the size of memory allocated with {@link BAllocStats_Alloc}.
+ * On success, the memory may be moved to a different address.
+ * 
+ * @param m memory from {@link BAllocStats_Alloc}. Must not be NULL.
+ * @param bytes new size
+ * @return new pointer to the memory, or NULL on failure, in which case
+ *         the memory is left intact
+ */
+void * BAllocStats_Realloc (void *m, size_t bytes);
+
+/**
+ * Frees memory allocated with {@link BAllocStats_Alloc}.
+ * 
+ * @param m memory to free. May be NULL; in this case, this function does nothing.
+ */
+void BAllocStats_Free (void *m);
+
+/**
+ * Returns the name of a category, for reports.
+ * 
+ * @param category category, BALLOCSTATS_*
+ */
+const char * BAllocStats_CategoryName (int category);
+
+/**
+ * Returns the memory accounted to a category.
+ * Memory accounted in parallel may or may not be included.
+ * 
+ * @param category category, BALLOCSTATS_*
+ * @param out_current receives the number of bytes accounted now
+ * @param out_peak receives the highest number of bytes accounted at any time
+ */
+void BAllocStats_Get (int category, size_t *out_current, size_t *out_peak);
+
+/**
+ * Reports the memory of all categories in the Prometheus text format,
+ * as the gauges badvpn_memory_bytes and badvpn_memory_peak_bytes.
+ * 
+ * @param func function receiving the lines
+ * @param user value passed to func
+ */
+void BAllocStats_Print (BAllocStats_print_func func, void *user);
+
+#endif
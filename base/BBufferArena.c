@@ -0,0 +1,199 @@
+/**
+ * @file BBufferArena.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+
+#ifndef BADVPN_USE_WINAPI
+#include <sys/mman.h>
+#endif
+
+#include <misc/maxalign.h>
+#include <base/BAllocStats.h>
+
+#include "BBufferArena.h"
+
+#define BBUFFERARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// four classes per power of two, from 64 bytes to 32MiB
+#define BBUFFERARENA_NUM_CLASSES 80
+
+// precedes every buffer in the arena; a free buffer holds the next free
+// buffer of its class after the header
+union header {
+    int class_index;
+    bmax_align_t align;
+};
+
+static struct {
+    char *base;
+    size_t size;
+    size_t used;
+    int hugetlb;
+    union header *free_lists[BBUFFERARENA_NUM_CLASSES];
+} arena;
+
+static size_t class_size (int c)
+{
+    return ((size_t)64 << (c / 4)) + (c % 4) * ((size_t)16 << (c / 4));
+}
+
+static int find_class (size_t bytes)
+{
+    for (int c = 0; c < BBUFFERARENA_NUM_CLASSES; c++) {
+        if (class_size(c) >= bytes) {
+            return c;
+        }
+    }
+    
+    return -1;
+}
+
+int BBufferArena_Enable (size_t size)
+{
+    ASSERT(!arena.base)
+    ASSERT(size > 0)
+    
+#ifdef BADVPN_USE_WINAPI
+    return 0;
+#else
+    // use whole huge pages
+    if (size > SIZE_MAX - 2 * BBUFFERARENA_HUGE_PAGE_SIZE) {
+        return 0;
+    }
+    size = (size + BBUFFERARENA_HUGE_PAGE_SIZE - 1) / BBUFFERARENA_HUGE_PAGE_SIZE * BBUFFERARENA_HUGE_PAGE_SIZE;
+    
+    // try reserved huge pages
+    void *map = MAP_FAILED;
+    int hugetlb = 1;
+#ifdef MAP_HUGETLB
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    
+    if (map == MAP_FAILED) {
+        hugetlb = 0;
+        
+        // map normal pages with room to align them to a huge page
+        char *raw = (char *)mmap(NULL, size + BBUFFERARENA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == (char *)MAP_FAILED) {
+            return 0;
+        }
+        
+        // unmap what is outside the aligned part
+        size_t head = (BBUFFERARENA_HUGE_PAGE_SIZE - (uintptr_t)raw % BBUFFERARENA_HUGE_PAGE_SIZE) % BBUFFERARENA_HUGE_PAGE_SIZE;
+        if (head > 0) {
+            munmap(raw, head);
+        }
+        if (head < BBUFFERARENA_HUGE_PAGE_SIZE) {
+            munmap(raw + head + size, BBUFFERARENA_HUGE_PAGE_SIZE - head);
+        }
+        map = raw + head;
+        
+        // ask for transparent huge pages; without them the arena still
+        // keeps packet buffers together
+#ifdef MADV_HUGEPAGE
+        madvise(map, size, MADV_HUGEPAGE);
+#endif
+    }
+    
+    arena.base = (char *)map;
+    arena.size = size;
+    arena.used = 0;
+    arena.hugetlb = hugetlb;
+    for (int c = 0; c < BBUFFERARENA_NUM_CLASSES; c++) {
+        arena.free_lists[c] = NULL;
+    }
+    
+    return 1;
+#endif
+}
+
+int BBufferArena_IsHugeTLB (void)
+{
+    ASSERT(arena.base)
+    
+    return arena.hugetlb;
+}
+
+void * BBufferArena_Alloc (size_t bytes)
+{
+    if (!arena.base || bytes > SIZE_MAX - sizeof(union header)) {
+        return BAllocStats_Alloc(BALLOCSTATS_FLOW, bytes);
+    }
+    
+    int c = find_class(sizeof(union header) + bytes);
+    if (c < 0) {
+        return BAllocStats_Alloc(BALLOCSTATS_FLOW, bytes);
+    }
+    
+    union header *h = arena.free_lists[c];
+    if (h) {
+        // reuse a free buffer of the class
+        arena.free_lists[c] = *(union header **)(h + 1);
+    } else {
+        // carve a new buffer, or fall back if the arena is full
+        size_t size = class_size(c);
+        if (size > arena.size - arena.used) {
+            return BAllocStats_Alloc(BALLOCSTATS_FLOW, bytes);
+        }
+        h = (union header *)(arena.base + arena.used);
+        arena.used += size;
+    }
+    
+    h->class_index = c;
+    BAllocStats_Add(BALLOCSTATS_FLOW, class_size(c));
+    
+    return h + 1;
+}
+
+void * BBufferArena_AllocArray (size_t count, size_t bytes)
+{
+    if (bytes > 0 && count > SIZE_MAX / bytes) {
+        return NULL;
+    }
+    
+    return BBufferArena_Alloc(count * bytes);
+}
+
+void BBufferArena_Free (void *m)
+{
+    // buffers outside the arena came from BAllocStats_Alloc
+    if (!arena.base || (char *)m < arena.base || (char *)m >= arena.base + arena.size) {
+        BAllocStats_Free(m);
+        return;
+    }
+    
+    union header *h = (union header *)m - 1;
+    ASSERT(h->class_index >= 0 && h->class_index < BBUFFERARENA_NUM_CLASSES)
+    
+    BAllocStats_Remove(BALLOCSTATS_FLOW, class_size(h->class_index));
+    
+    // keep on the free list of its class
+    *(union header **)(h + 1) = arena.free_lists[h->class_index];
+    arena.free_lists[h->class_index] = h;
+}
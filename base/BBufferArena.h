@@ -0,0 +1,102 @@
+/**
+ * @file BBufferArena.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Optional arena for packet buffers, backed by huge pages.
+ * 
+ * Once enabled, buffers of the flow framework are carved contiguously out of
+ * one mapping, using reserved huge pages (MAP_HUGETLB) if the system has them,
+ * and otherwise normal pages aligned for transparent huge pages. This keeps
+ * hot packet memory in few TLB entries. Buffer sizes are rounded up to one of
+ * four size classes per power of two, and released buffers are kept on a free
+ * list of their class. Allocations which do not fit into the arena any more
+ * come from {@link BAllocStats_Alloc}.
+ * 
+ * Until enabled, the functions are equivalent to {@link BAllocStats_Alloc}
+ * and {@link BAllocStats_Free}. Either way the buffers are accounted to
+ * BALLOCSTATS_FLOW. The arena cannot be disabled again, and must only be used
+ * from a single thread once enabled.
+ */
+
+#ifndef BADVPN_BBUFFERARENA_H
+#define BADVPN_BBUFFERARENA_H
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+
+/**
+ * Enables the arena.
+ * Must not have been enabled before.
+ * 
+ * @param size size of the arena in bytes, rounded up to whole huge pages; must be >0
+ * @return 1 on success, 0 on failure
+ */
+int BBufferArena_Enable (size_t size) WARN_UNUSED;
+
+/**
+ * Returns whether the arena is backed by reserved huge pages, as opposed
+ * to transparent huge pages, which the kernel may or may not provide.
+ * The arena must be enabled.
+ * 
+ * @return 1 for reserved huge pages, 0 for transparent huge pages
+ */
+int BBufferArena_IsHugeTLB (void);
+
+/**
+ * Allocates a buffer.
+ * 
+ * @param bytes number of bytes to allocate
+ * @return a non-NULL pointer to the buffer, or NULL on failure.
+ *         The buffer can be freed using {@link BBufferArena_Free}.
+ */
+void * BBufferArena_Alloc (size_t bytes);
+
+/**
+ * Allocates a buffer for an array.
+ * A check is first done to make sure the multiplication doesn't overflow;
+ * otherwise, this is equivalent to {@link BBufferArena_Alloc}(count * bytes).
+ * 
+ * @param count number of elements
+ * @param bytes size of one array element
+ * @return a non-NULL pointer to the buffer, or NULL on failure.
+ *         The buffer can be freed using {@link BBufferArena_Free}.
+ */
+void * BBufferArena_AllocArray (size_t count, size_t bytes);
+
+/**
+ * Frees a buffer.
+ * 
+ * @param m buffer to free. Must have been obtained with {@link BBufferArena_Alloc}
+ *          or {@link BBufferArena_AllocArray}. May be NULL; in this case, this
+ *          function does nothing.
+ */
+void BBufferArena_Free (void *m);
+
+#endif
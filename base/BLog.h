@@ -57,6 +57,7 @@
 
 typedef void (*_BLog_log_func) (int channel, int level, const char *msg);
 typedef void (*_BLog_free_func) (void);
+typedef void (*_BLog_trace_func) (int channel, int level, const char *fmt, va_list vl);
 
 struct _BLog_channel {
     const char *name;
@@ -70,6 +71,8 @@ struct _BLog_global {
     struct _BLog_channel channels[BLOG_NUM_CHANNELS];
     _BLog_log_func log_func;
     _BLog_free_func free_func;
+    // if set, BLog_LogToChannel passes unformatted messages here
+    _BLog_trace_func trace_func;
     BMutex mutex;
 #ifndef NDEBUG
     int logging;
@@ -144,6 +147,7 @@ void BLog_Init (_BLog_log_func log_func, _BLog_free_func free_func)
     
     blog_global.log_func = log_func;
     blog_global.free_func = free_func;
+    blog_global.trace_func = NULL;
 #ifndef NDEBUG
     blog_global.logging = 0;
 #endif
@@ -272,6 +276,19 @@ void BLog_Finish (int channel, int level)
     BMutex_Unlock(&blog_global.mutex);
 }
 
+static void BLog__Trace (int channel, int level, const char *fmt, va_list vl)
+{
+    BMutex_Lock(&blog_global.mutex);
+    
+#ifndef NDEBUG
+    ASSERT(!blog_global.logging)
+#endif
+    
+    blog_global.trace_func(channel, level, fmt, vl);
+    
+    BMutex_Unlock(&blog_global.mutex);
+}
+
 void BLog_LogToChannelVarArg (int channel, int level, const char *fmt, va_list vl)
 {
     ASSERT(blog_global.initialized)
@@ -282,6 +299,11 @@ void BLog_LogToChannelVarArg (int channel, int level, const char *fmt, va_list v
         return;
     }
     
+    if (blog_global.trace_func) {
+        BLog__Trace(channel, level, fmt, vl);
+        return;
+    }
+    
     BLog_Begin();
     BLog_AppendVarArg(fmt, vl);
     BLog_Finish(channel, level);
@@ -300,9 +322,13 @@ void BLog_LogToChannel (int channel, int level, const char *fmt, ...)
     va_list vl;
     va_start(vl, fmt);
     
-    BLog_Begin();
-    BLog_AppendVarArg(fmt, vl);
-    BLog_Finish(channel, level);
+    if (blog_global.trace_func) {
+        BLog__Trace(channel, level, fmt, vl);
+    } else {
+        BLog_Begin();
+        BLog_AppendVarArg(fmt, vl);
+        BLog_Finish(channel, level);
+    }
     
     va_end(vl);
 }
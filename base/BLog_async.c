@@ -0,0 +1,231 @@
+/**
+ * @file BLog_async.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include <misc/balloc.h>
+#include <structure/ChunkBuffer2Spsc.h>
+
+#include "BLog_async.h"
+
+struct message_header {
+    int channel;
+    int level;
+    uint64_t num_dropped_before;
+};
+
+#define MESSAGE_MTU ((int)(sizeof(struct message_header) + sizeof(blog_global.logbuf)))
+
+static struct {
+    _BLog_log_func log_func;
+    _BLog_free_func free_func;
+    struct ChunkBuffer2_block *buffer;
+    ChunkBuffer2Spsc buf;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int waiting;
+    int quitting;
+    // accessed by the logging threads, under the BLog mutex
+    uint64_t num_dropped;
+    int last_channel;
+} async_global;
+
+static void log_dropped (int channel, uint64_t num_dropped)
+{
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%" PRIu64 " log messages dropped", num_dropped);
+    async_global.log_func(channel, BLOG_WARNING, msg);
+}
+
+static void * thread_func (void *unused)
+{
+    while (1) {
+        // write out the messages
+        uint8_t *data;
+        int len;
+        while (ChunkBuffer2Spsc_Consumer_Peek(&async_global.buf, &data, &len)) {
+            ASSERT(len > (int)sizeof(struct message_header))
+            
+            struct message_header header;
+            memcpy(&header, data, sizeof(header));
+            
+            if (header.num_dropped_before > 0) {
+                log_dropped(header.channel, header.num_dropped_before);
+            }
+            async_global.log_func(header.channel, header.level, (const char *)(data + sizeof(header)));
+            
+            ChunkBuffer2Spsc_Consumer_Consume(&async_global.buf);
+        }
+        
+        // wait for more; the logging threads only signal when we say we're waiting
+        pthread_mutex_lock(&async_global.mutex);
+        __atomic_store_n(&async_global.waiting, 1, __ATOMIC_SEQ_CST);
+        int have;
+        while (!(have = ChunkBuffer2Spsc_Consumer_Peek(&async_global.buf, &data, &len)) && !async_global.quitting) {
+            pthread_cond_wait(&async_global.cond, &async_global.mutex);
+        }
+        __atomic_store_n(&async_global.waiting, 0, __ATOMIC_RELAXED);
+        int quitting = async_global.quitting;
+        pthread_mutex_unlock(&async_global.mutex);
+        
+        if (!have && quitting) {
+            break;
+        }
+    }
+    
+    return NULL;
+}
+
+static void async_log (int channel, int level, const char *msg)
+{
+    async_global.last_channel = channel;
+    
+    uint8_t *dest = ChunkBuffer2Spsc_Producer_GetDest(&async_global.buf);
+    if (!dest) {
+        async_global.num_dropped++;
+        return;
+    }
+    
+    struct message_header header;
+    header.channel = channel;
+    header.level = level;
+    header.num_dropped_before = async_global.num_dropped;
+    async_global.num_dropped = 0;
+    
+    size_t msg_len = strlen(msg);
+    ASSERT(msg_len < sizeof(blog_global.logbuf))
+    
+    memcpy(dest, &header, sizeof(header));
+    memcpy(dest + sizeof(header), msg, msg_len + 1);
+    ChunkBuffer2Spsc_Producer_Submit(&async_global.buf, sizeof(header) + msg_len + 1);
+    
+    // wake up the thread if it's waiting; the fence orders publishing the
+    // message before reading the flag, against the opposite in the thread
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&async_global.waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&async_global.mutex);
+        pthread_cond_signal(&async_global.cond);
+        pthread_mutex_unlock(&async_global.mutex);
+    }
+}
+
+static void async_free (void)
+{
+    // let the thread write out what's left and exit
+    pthread_mutex_lock(&async_global.mutex);
+    async_global.quitting = 1;
+    pthread_cond_signal(&async_global.cond);
+    pthread_mutex_unlock(&async_global.mutex);
+    
+    int res = pthread_join(async_global.thread, NULL);
+    B_USE(res)
+    ASSERT(res == 0)
+    
+    if (async_global.num_dropped > 0) {
+        log_dropped(async_global.last_channel, async_global.num_dropped);
+    }
+    
+    pthread_cond_destroy(&async_global.cond);
+    pthread_mutex_destroy(&async_global.mutex);
+    BFree(async_global.buffer);
+    
+    async_global.free_func();
+}
+
+int BLog_MakeAsync (int buffer_size)
+{
+    ASSERT(blog_global.initialized)
+    ASSERT(blog_global.log_func != async_log)
+    ASSERT(buffer_size >= 0)
+    
+    int num_blocks = ChunkBuffer2_calc_blocks(MESSAGE_MTU, 1);
+    if (num_blocks < 0) {
+        goto fail0;
+    }
+    if (buffer_size / (int)sizeof(struct ChunkBuffer2_block) > num_blocks) {
+        num_blocks = buffer_size / sizeof(struct ChunkBuffer2_block);
+    }
+    
+    if (!(async_global.buffer = (struct ChunkBuffer2_block *)BAllocArray(num_blocks, sizeof(async_global.buffer[0])))) {
+        goto fail0;
+    }
+    
+    ChunkBuffer2Spsc_Init(&async_global.buf, async_global.buffer, num_blocks, MESSAGE_MTU);
+    
+    if (pthread_mutex_init(&async_global.mutex, NULL) != 0) {
+        goto fail1;
+    }
+    
+    if (pthread_cond_init(&async_global.cond, NULL) != 0) {
+        goto fail2;
+    }
+    
+    async_global.waiting = 0;
+    async_global.quitting = 0;
+    async_global.num_dropped = 0;
+    async_global.last_channel = 0;
+    async_global.log_func = blog_global.log_func;
+    async_global.free_func = blog_global.free_func;
+    
+    // the thread must not take signals meant for the event loop
+    sigset_t all_signals;
+    sigset_t old_signals;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+    
+    int res = pthread_create(&async_global.thread, NULL, thread_func, NULL);
+    
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    
+    if (res != 0) {
+        goto fail3;
+    }
+    
+    // take over the backend
+    BMutex_Lock(&blog_global.mutex);
+    blog_global.log_func = async_log;
+    blog_global.free_func = async_free;
+    BMutex_Unlock(&blog_global.mutex);
+    
+    return 1;
+    
+fail3:
+    pthread_cond_destroy(&async_global.cond);
+fail2:
+    pthread_mutex_destroy(&async_global.mutex);
+fail1:
+    BFree(async_global.buffer);
+fail0:
+    return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file BLog_async.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Asynchronous BLog backend wrapper.
+ */
+
+#ifndef BADVPN_BLOG_ASYNC_H
+#define BADVPN_BLOG_ASYNC_H
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+
+// default buffer size for messages waiting to be logged
+#define BLOG_ASYNC_DEFAULT_BUFFER_SIZE 1048576
+
+/**
+ * Moves the already initialized logging backend to a separate thread.
+ * 
+ * Messages are copied into a ring buffer and written out by the thread,
+ * so the threads logging never wait for the output. If the buffer is
+ * full, messages are dropped; the number of dropped messages is logged
+ * with the next message which fits. {@link BLog_Free} writes out the
+ * remaining messages and stops the thread.
+ * 
+ * Must be called after one of the BLog_Init functions, before anything
+ * is logged from other threads.
+ * 
+ * @param buffer_size size of the buffer in bytes; rounded up to hold at
+ *                    least one message of the maximum length
+ * @return 1 on success, 0 on failure
+ */
+int BLog_MakeAsync (int buffer_size) WARN_UNUSED;
+
+#endif
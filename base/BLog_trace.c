@@ -0,0 +1,383 @@
+/**
+ * @file BLog_trace.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <misc/debug.h>
+#include <structure/OAHash.h>
+
+#include "BLog_trace_format.h"
+#include "BLog_trace.h"
+
+#include "BLog_trace_hash.h"
+#include <structure/OAHash_decl.h>
+
+#include "BLog_trace_hash.h"
+#include <structure/OAHash_impl.h>
+
+#define STRINGS_SIZE 262144
+#define INITIAL_FORMATS 256
+#define MIN_RING_SIZE (16 * sizeof(struct BLog_trace_record) + 16 * sizeof(blog_global.logbuf))
+
+static struct {
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+    struct BLog_trace_header *header;
+    char *strings;
+    uint8_t *ring;
+    BLogTrace__Hash formats;
+    uint8_t payload[sizeof(blog_global.logbuf)];
+} trace_global;
+
+static uint64_t get_time (void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int add_string (const char *str, uint32_t *out_off)
+{
+    struct BLog_trace_header *h = trace_global.header;
+    
+    size_t len = strlen(str) + 1;
+    if (len > h->strings_size - h->strings_used) {
+        return 0;
+    }
+    
+    memcpy(trace_global.strings + h->strings_used, str, len);
+    *out_off = h->strings_used;
+    h->strings_used += len;
+    
+    return 1;
+}
+
+static void write_record (int type, int channel, int level, uint32_t fmt, const void *payload, size_t payload_len)
+{
+    struct BLog_trace_header *h = trace_global.header;
+    
+    size_t size = sizeof(struct BLog_trace_record) + BLOG_TRACE_ALIGN(payload_len);
+    ASSERT(size <= h->ring_size / 2)
+    
+    uint64_t head = h->head;
+    uint64_t tail = h->tail;
+    
+    // records don't wrap, skip the end of the ring if needed
+    size_t offset = head % h->ring_size;
+    size_t pad = 0;
+    if (h->ring_size - offset < size) {
+        pad = h->ring_size - offset;
+    }
+    
+    // drop the oldest records to make room
+    while (head + pad + size - tail > h->ring_size) {
+        struct BLog_trace_frame *old = (struct BLog_trace_frame *)(trace_global.ring + tail % h->ring_size);
+        tail += old->size;
+    }
+    __atomic_store_n(&h->tail, tail, __ATOMIC_RELEASE);
+    
+    if (pad > 0) {
+        struct BLog_trace_frame *frame = (struct BLog_trace_frame *)(trace_global.ring + offset);
+        frame->size = pad;
+        frame->channel = 0;
+        frame->level = 0;
+        frame->type = BLOG_TRACE_RECORD_PAD;
+        head += pad;
+        offset = 0;
+    }
+    
+    struct BLog_trace_record *rec = (struct BLog_trace_record *)(trace_global.ring + offset);
+    rec->frame.size = size;
+    rec->frame.channel = channel;
+    rec->frame.level = level;
+    rec->frame.type = type;
+    rec->fmt = fmt;
+    rec->payload_len = payload_len;
+    rec->time = get_time();
+    memcpy(rec + 1, payload, payload_len);
+    
+    __atomic_store_n(&h->head, head + size, __ATOMIC_RELEASE);
+}
+
+static int put_slot (size_t *pos, uint64_t v)
+{
+    if (sizeof(trace_global.payload) - *pos < sizeof(v)) {
+        return 0;
+    }
+    memcpy(trace_global.payload + *pos, &v, sizeof(v));
+    *pos += sizeof(v);
+    return 1;
+}
+
+static int put_string (size_t *pos, const char *str, int prec)
+{
+    if (!str) {
+        str = "(null)";
+    }
+    
+    size_t len = (prec >= 0 ? strnlen(str, prec) : strlen(str));
+    
+    if (!put_slot(pos, len)) {
+        return 0;
+    }
+    if (sizeof(trace_global.payload) - *pos < BLOG_TRACE_ALIGN(len)) {
+        return 0;
+    }
+    memcpy(trace_global.payload + *pos, str, len);
+    memset(trace_global.payload + *pos + len, 0, BLOG_TRACE_ALIGN(len) - len);
+    *pos += BLOG_TRACE_ALIGN(len);
+    
+    return 1;
+}
+
+static uint64_t get_signed (int length, va_list *vl)
+{
+    switch (length) {
+        case BLOG_TRACE_LEN_L:
+            return (int64_t)va_arg(*vl, long);
+        case BLOG_TRACE_LEN_LL:
+            return (int64_t)va_arg(*vl, long long);
+        case BLOG_TRACE_LEN_J:
+            return (int64_t)va_arg(*vl, intmax_t);
+        case BLOG_TRACE_LEN_Z:
+            return (int64_t)va_arg(*vl, ssize_t);
+        case BLOG_TRACE_LEN_T:
+            return (int64_t)va_arg(*vl, ptrdiff_t);
+        default:
+            return (int64_t)va_arg(*vl, int);
+    }
+}
+
+static uint64_t get_unsigned (int length, va_list *vl)
+{
+    switch (length) {
+        case BLOG_TRACE_LEN_L:
+            return va_arg(*vl, unsigned long);
+        case BLOG_TRACE_LEN_LL:
+            return va_arg(*vl, unsigned long long);
+        case BLOG_TRACE_LEN_J:
+            return va_arg(*vl, uintmax_t);
+        case BLOG_TRACE_LEN_Z:
+            return va_arg(*vl, size_t);
+        case BLOG_TRACE_LEN_T:
+            return va_arg(*vl, ptrdiff_t);
+        default:
+            return va_arg(*vl, unsigned int);
+    }
+}
+
+// packs the arguments into trace_global.payload; returns 0 if they
+// don't fit or the format string is not supported
+static int pack_args (const char *fmt, va_list *vl, size_t *out_len)
+{
+    size_t pos = 0;
+    
+    for (const char *p = fmt; *p; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        
+        struct BLog_trace_spec spec;
+        if (!BLogTrace_ParseSpec(p, &spec)) {
+            return 0;
+        }
+        p += spec.len - 1;
+        
+        if (spec.width_star && !put_slot(&pos, (int64_t)va_arg(*vl, int))) {
+            return 0;
+        }
+        
+        int prec = spec.prec;
+        if (spec.prec_star) {
+            prec = va_arg(*vl, int);
+            if (!put_slot(&pos, (int64_t)prec)) {
+                return 0;
+            }
+        }
+        
+        int res = 1;
+        switch (spec.arg_class) {
+            case BLOG_TRACE_ARG_SIGNED:
+                res = put_slot(&pos, get_signed(spec.length, vl));
+                break;
+            case BLOG_TRACE_ARG_UNSIGNED:
+                res = put_slot(&pos, get_unsigned(spec.length, vl));
+                break;
+            case BLOG_TRACE_ARG_DOUBLE: {
+                double d = va_arg(*vl, double);
+                uint64_t v;
+                memcpy(&v, &d, sizeof(v));
+                res = put_slot(&pos, v);
+            } break;
+            case BLOG_TRACE_ARG_POINTER:
+                res = put_slot(&pos, (uintptr_t)va_arg(*vl, void *));
+                break;
+            case BLOG_TRACE_ARG_STRING:
+                res = put_string(&pos, va_arg(*vl, const char *), prec);
+                break;
+        }
+        if (!res) {
+            return 0;
+        }
+    }
+    
+    *out_len = pos;
+    return 1;
+}
+
+static void trace_log (int channel, int level, const char *msg)
+{
+    size_t len = strlen(msg) + 1;
+    ASSERT(len <= sizeof(trace_global.payload))
+    
+    write_record(BLOG_TRACE_RECORD_TEXT, channel, level, 0, msg, len);
+}
+
+static void trace_format (int channel, int level, const char *fmt, va_list vl)
+{
+    va_list vl_copy;
+    va_copy(vl_copy, vl);
+    
+    // look up the format string, adding it on first use
+    uint32_t fmt_off;
+    uint32_t *found = BLogTrace__Hash_Lookup(&trace_global.formats, fmt);
+    if (found) {
+        fmt_off = *found;
+    } else {
+        if (!add_string(fmt, &fmt_off)) {
+            goto text;
+        }
+        if (!BLogTrace__Hash_Insert(&trace_global.formats, fmt, fmt_off)) {
+            goto text;
+        }
+    }
+    
+    size_t len;
+    if (!pack_args(fmt, &vl_copy, &len)) {
+        goto text;
+    }
+    va_end(vl_copy);
+    
+    write_record(BLOG_TRACE_RECORD_FORMAT, channel, level, fmt_off, trace_global.payload, len);
+    return;
+    
+text:
+    va_end(vl_copy);
+    
+    // format it here instead
+    char *buf = (char *)trace_global.payload;
+    vsnprintf(buf, sizeof(trace_global.payload), fmt, vl);
+    write_record(BLOG_TRACE_RECORD_TEXT, channel, level, 0, buf, strlen(buf) + 1);
+}
+
+static void trace_free (void)
+{
+    BLogTrace__Hash_Free(&trace_global.formats);
+    munmap(trace_global.map, trace_global.map_size);
+    close(trace_global.fd);
+}
+
+int BLog_InitTrace (const char *path, size_t ring_size)
+{
+    ring_size &= ~(size_t)7;
+    if (ring_size < MIN_RING_SIZE) {
+        ring_size = MIN_RING_SIZE;
+    }
+    
+    size_t strings_offset = BLOG_TRACE_ALIGN(sizeof(struct BLog_trace_header));
+    size_t ring_offset = strings_offset + STRINGS_SIZE;
+    trace_global.map_size = ring_offset + ring_size;
+    
+    if ((trace_global.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+        goto fail0;
+    }
+    
+    if (ftruncate(trace_global.fd, trace_global.map_size) < 0) {
+        goto fail1;
+    }
+    
+    void *map = mmap(NULL, trace_global.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, trace_global.fd, 0);
+    if (map == MAP_FAILED) {
+        goto fail1;
+    }
+    trace_global.map = (uint8_t *)map;
+    
+    if (!BLogTrace__Hash_Init(&trace_global.formats, INITIAL_FORMATS)) {
+        goto fail2;
+    }
+    
+    struct BLog_trace_header *h = (struct BLog_trace_header *)trace_global.map;
+    h->num_channels = BLOG_NUM_CHANNELS;
+    h->strings_offset = strings_offset;
+    h->strings_size = STRINGS_SIZE;
+    h->strings_used = 0;
+    h->ring_offset = ring_offset;
+    h->ring_size = ring_size;
+    h->head = 0;
+    h->tail = 0;
+    
+    trace_global.header = h;
+    trace_global.strings = (char *)(trace_global.map + strings_offset);
+    trace_global.ring = trace_global.map + ring_offset;
+    
+    // channel names go first, in order
+    for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
+        uint32_t off;
+        if (!add_string(blog_channel_list[i].name, &off)) {
+            goto fail3;
+        }
+    }
+    
+    // written last so a reader never sees a half-initialized header
+    memcpy(h->magic, BLOG_TRACE_MAGIC, sizeof(h->magic));
+    
+    BLog_Init(trace_log, trace_free);
+    blog_global.trace_func = trace_format;
+    
+    return 1;
+    
+fail3:
+    BLogTrace__Hash_Free(&trace_global.formats);
+fail2:
+    munmap(trace_global.map, trace_global.map_size);
+fail1:
+    close(trace_global.fd);
+fail0:
+    return 0;
+}
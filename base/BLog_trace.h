@@ -0,0 +1,60 @@
+/**
+ * @file BLog_trace.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * BLog backend writing binary trace records into a memory-mapped ring file.
+ * 
+ * Messages logged with BLog_LogToChannel (the BLog macro) are not formatted;
+ * the record stores the format string, interned in the file, and the raw
+ * arguments. Other messages are stored as text. When the ring is full, the
+ * oldest records are overwritten. Use badvpn-blogdump to render a trace
+ * file as text; the file stays valid if the process crashes.
+ */
+
+#ifndef BADVPN_BLOG_TRACE_H
+#define BADVPN_BLOG_TRACE_H
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+
+#define BLOG_TRACE_DEFAULT_RING_SIZE 16777216
+
+/**
+ * Initializes the logger with the trace backend.
+ * The file is created or truncated.
+ * 
+ * @param path trace file to write
+ * @param ring_size size of the record ring in bytes
+ * @return 1 on success, 0 on failure
+ */
+int BLog_InitTrace (const char *path, size_t ring_size) WARN_UNUSED;
+
+#endif
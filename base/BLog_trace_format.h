@@ -0,0 +1,256 @@
+/**
+ * @file BLog_trace_format.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * On-disk format of BLog trace files, shared by the trace backend and
+ * badvpn-blogdump.
+ * 
+ * A trace file consists of a {@link BLog_trace_header}, a string area and a
+ * ring of records. The string area holds the channel names (NUL-terminated,
+ * in channel order, starting at offset 0) followed by every format string
+ * seen so far, each stored once. The ring holds records between the
+ * positions tail and head, which only ever grow; a position maps to ring
+ * offset (position % ring_size). Records never wrap around the end of the
+ * ring; the gap is filled with a padding record which may be shorter than
+ * a full record header.
+ * 
+ * A format record is followed by the arguments of its format string, in
+ * the order the conversion specifications consume them. Each argument takes
+ * one 8-byte slot, except %s arguments, which take a slot with the string
+ * length followed by the string bytes padded to 8 bytes.
+ * 
+ * All integers are in host byte order.
+ */
+
+#ifndef BADVPN_BLOG_TRACE_FORMAT_H
+#define BADVPN_BLOG_TRACE_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BLOG_TRACE_MAGIC "BLOGTRC1"
+
+#define BLOG_TRACE_RECORD_PAD 0
+#define BLOG_TRACE_RECORD_FORMAT 1
+#define BLOG_TRACE_RECORD_TEXT 2
+
+#define BLOG_TRACE_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+// length modifiers
+#define BLOG_TRACE_LEN_NONE 0
+#define BLOG_TRACE_LEN_HH 1
+#define BLOG_TRACE_LEN_H 2
+#define BLOG_TRACE_LEN_L 3
+#define BLOG_TRACE_LEN_LL 4
+#define BLOG_TRACE_LEN_J 5
+#define BLOG_TRACE_LEN_Z 6
+#define BLOG_TRACE_LEN_T 7
+
+// argument classes
+#define BLOG_TRACE_ARG_NONE 0
+#define BLOG_TRACE_ARG_SIGNED 1
+#define BLOG_TRACE_ARG_UNSIGNED 2
+#define BLOG_TRACE_ARG_DOUBLE 3
+#define BLOG_TRACE_ARG_POINTER 4
+#define BLOG_TRACE_ARG_STRING 5
+
+struct BLog_trace_header {
+    char magic[8];
+    uint64_t num_channels;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t strings_used;
+    uint64_t ring_offset;
+    uint64_t ring_size;
+    uint64_t head;
+    uint64_t tail;
+};
+
+struct BLog_trace_frame {
+    uint32_t size;
+    uint16_t channel;
+    uint8_t level;
+    uint8_t type;
+};
+
+struct BLog_trace_record {
+    struct BLog_trace_frame frame;
+    // offset of the format string in the string area (format records)
+    uint32_t fmt;
+    // number of payload bytes following the record
+    uint32_t payload_len;
+    // CLOCK_REALTIME, in nanoseconds
+    uint64_t time;
+};
+
+struct BLog_trace_spec {
+    // length of the conversion specification, including the '%'
+    size_t len;
+    int width_star;
+    int prec_star;
+    // precision, or -1 if not given as a number
+    int prec;
+    int length;
+    char conv;
+    int arg_class;
+};
+
+/**
+ * Parses a printf conversion specification.
+ * 
+ * @param s pointer to the '%' starting the specification
+ * @param out the specification is returned here
+ * @return 1 on success, 0 if the specification is not supported
+ *         (%n, wide characters and strings, long double)
+ */
+static int BLogTrace_ParseSpec (const char *s, struct BLog_trace_spec *out)
+{
+    const char *p = s + 1;
+    
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' || *p == '\'') {
+        p++;
+    }
+    
+    out->width_star = 0;
+    if (*p == '*') {
+        out->width_star = 1;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    
+    out->prec_star = 0;
+    out->prec = -1;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            out->prec_star = 1;
+            p++;
+        } else {
+            out->prec = 0;
+            while (*p >= '0' && *p <= '9') {
+                if (out->prec < 100000) {
+                    out->prec = 10 * out->prec + (*p - '0');
+                }
+                p++;
+            }
+        }
+    }
+    
+    out->length = BLOG_TRACE_LEN_NONE;
+    switch (*p) {
+        case 'h':
+            p++;
+            out->length = BLOG_TRACE_LEN_H;
+            if (*p == 'h') {
+                p++;
+                out->length = BLOG_TRACE_LEN_HH;
+            }
+            break;
+        case 'l':
+            p++;
+            out->length = BLOG_TRACE_LEN_L;
+            if (*p == 'l') {
+                p++;
+                out->length = BLOG_TRACE_LEN_LL;
+            }
+            break;
+        case 'q':
+            p++;
+            out->length = BLOG_TRACE_LEN_LL;
+            break;
+        case 'j':
+            p++;
+            out->length = BLOG_TRACE_LEN_J;
+            break;
+        case 'z':
+            p++;
+            out->length = BLOG_TRACE_LEN_Z;
+            break;
+        case 't':
+            p++;
+            out->length = BLOG_TRACE_LEN_T;
+            break;
+        case 'L':
+            return 0;
+    }
+    
+    out->conv = *p;
+    
+    switch (*p) {
+        case '%':
+            out->arg_class = BLOG_TRACE_ARG_NONE;
+            break;
+        case 'd':
+        case 'i':
+            out->arg_class = BLOG_TRACE_ARG_SIGNED;
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            out->arg_class = BLOG_TRACE_ARG_UNSIGNED;
+            break;
+        case 'c':
+            if (out->length != BLOG_TRACE_LEN_NONE) {
+                return 0;
+            }
+            out->arg_class = BLOG_TRACE_ARG_SIGNED;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            out->arg_class = BLOG_TRACE_ARG_DOUBLE;
+            break;
+        case 'p':
+            out->arg_class = BLOG_TRACE_ARG_POINTER;
+            break;
+        case 's':
+            if (out->length != BLOG_TRACE_LEN_NONE) {
+                return 0;
+            }
+            out->arg_class = BLOG_TRACE_ARG_STRING;
+            break;
+        default:
+            return 0;
+    }
+    
+    out->len = (p + 1) - s;
+    
+    return 1;
+}
+
+#endif
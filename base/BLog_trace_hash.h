@@ -0,0 +1,5 @@
+#define OAHASH_PARAM_NAME BLogTrace__Hash
+#define OAHASH_PARAM_KEY const char *
+#define OAHASH_PARAM_VALUE uint32_t
+#define OAHASH_PARAM_HASH(key) ((size_t)(uintptr_t)(key))
+#define OAHASH_PARAM_COMPARE_KEYS(key1, key2) ((key1) == (key2))
@@ -0,0 +1,224 @@
+/**
+ * @file BMetrics.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <misc/balloc.h>
+#include <base/BAllocStats.h>
+
+#include "BMetrics.h"
+
+struct metric_info {
+    const char *name;
+    const char *help;
+};
+
+static const struct metric_info counter_infos[] = {
+#define BMETRICS_COUNTER(id, name, help) { name, help },
+#define BMETRICS_HISTOGRAM(id, name, help)
+#include <base/BMetrics_list.h>
+#undef BMETRICS_COUNTER
+#undef BMETRICS_HISTOGRAM
+};
+
+static const struct metric_info histogram_infos[] = {
+#define BMETRICS_COUNTER(id, name, help)
+#define BMETRICS_HISTOGRAM(id, name, help) { name, help },
+#include <base/BMetrics_list.h>
+#undef BMETRICS_COUNTER
+#undef BMETRICS_HISTOGRAM
+};
+
+int bmetrics_enabled;
+BTHREADLOCAL struct _BMetrics_thread *bmetrics_thread;
+
+// blocks of all threads, only ever pushed to until BMetrics_Free
+static struct _BMetrics_thread *threads_list;
+
+// shared by the threads whose block could not be allocated; their
+// updates may then be lost, but are never torn
+static struct _BMetrics_thread fallback_thread;
+
+struct _BMetrics_thread * BMetrics__RegisterThread (void)
+{
+    ASSERT(!bmetrics_thread)
+    
+    struct _BMetrics_thread *t = (struct _BMetrics_thread *)BAlloc(sizeof(*t));
+    if (!t) {
+        bmetrics_thread = &fallback_thread;
+        return bmetrics_thread;
+    }
+    
+    memset(t, 0, sizeof(*t));
+    
+    // push to the list
+    void *head = batomic_load_ptr((void **)&threads_list);
+    do {
+        t->next = (struct _BMetrics_thread *)head;
+    } while (!batomic_cas_ptr((void **)&threads_list, &head, t));
+    
+    bmetrics_thread = t;
+    return t;
+}
+
+// iterates the blocks of all threads, the fallback block last
+static struct _BMetrics_thread * next_thread (struct _BMetrics_thread *t)
+{
+    if (t == &fallback_thread) {
+        return NULL;
+    }
+    
+    struct _BMetrics_thread *next = (t ? t->next : (struct _BMetrics_thread *)batomic_load_ptr((void **)&threads_list));
+    return (next ? next : &fallback_thread);
+}
+
+static void sum_threads (struct _BMetrics_thread *out)
+{
+    memset(out, 0, sizeof(*out));
+    
+    for (struct _BMetrics_thread *t = next_thread(NULL); t; t = next_thread(t)) {
+        for (int i = 0; i < BMETRICS_NUM_COUNTERS; i++) {
+            out->counters[i] += batomic_load_uint64_relaxed(&t->counters[i]);
+        }
+        for (int i = 0; i < BMETRICS_NUM_HISTOGRAMS; i++) {
+            for (int j = 0; j < BMETRICS_HISTOGRAM_BUCKETS; j++) {
+                out->histograms[i].buckets[j] += batomic_load_uint64_relaxed(&t->histograms[i].buckets[j]);
+            }
+            out->histograms[i].sum += batomic_load_uint64_relaxed(&t->histograms[i].sum);
+        }
+    }
+}
+
+void BMetrics_Enable (void)
+{
+    batomic_store_int_relaxed(&bmetrics_enabled, 1);
+}
+
+void BMetrics_Free (void)
+{
+    struct _BMetrics_thread *t = threads_list;
+    while (t) {
+        struct _BMetrics_thread *next = t->next;
+        BFree(t);
+        t = next;
+    }
+    
+    threads_list = NULL;
+    bmetrics_thread = NULL;
+}
+
+uint64_t BMetrics_ReadCounter (int counter)
+{
+    ASSERT(counter >= 0 && counter < BMETRICS_NUM_COUNTERS)
+    
+    uint64_t total = 0;
+    for (struct _BMetrics_thread *t = next_thread(NULL); t; t = next_thread(t)) {
+        total += batomic_load_uint64_relaxed(&t->counters[counter]);
+    }
+    
+    return total;
+}
+
+void BMetrics_ReadHistogram (int histogram, uint64_t *buckets)
+{
+    ASSERT(histogram >= 0 && histogram < BMETRICS_NUM_HISTOGRAMS)
+    
+    memset(buckets, 0, BMETRICS_HISTOGRAM_BUCKETS * sizeof(buckets[0]));
+    
+    for (struct _BMetrics_thread *t = next_thread(NULL); t; t = next_thread(t)) {
+        for (int j = 0; j < BMETRICS_HISTOGRAM_BUCKETS; j++) {
+            buckets[j] += batomic_load_uint64_relaxed(&t->histograms[histogram].buckets[j]);
+        }
+    }
+}
+
+void BMetrics_Print (BMetrics_print_func func, void *user)
+{
+    struct _BMetrics_thread *tot = (struct _BMetrics_thread *)BAlloc(sizeof(*tot));
+    if (!tot) {
+        return;
+    }
+    
+    sum_threads(tot);
+    
+    char line[256];
+    
+    for (int i = 0; i < BMETRICS_NUM_COUNTERS; i++) {
+        const struct metric_info *info = &counter_infos[i];
+        
+        snprintf(line, sizeof(line), "# HELP badvpn_%s %s", info->name, info->help);
+        func(user, line);
+        snprintf(line, sizeof(line), "# TYPE badvpn_%s counter", info->name);
+        func(user, line);
+        snprintf(line, sizeof(line), "badvpn_%s %"PRIu64, info->name, tot->counters[i]);
+        func(user, line);
+    }
+    
+    for (int i = 0; i < BMETRICS_NUM_HISTOGRAMS; i++) {
+        const struct metric_info *info = &histogram_infos[i];
+        struct _BMetrics_histogram *h = &tot->histograms[i];
+        
+        snprintf(line, sizeof(line), "# HELP badvpn_%s %s", info->name, info->help);
+        func(user, line);
+        snprintf(line, sizeof(line), "# TYPE badvpn_%s histogram", info->name);
+        func(user, line);
+        
+        // the last bucket has no upper bound, only report up to the last used one
+        int last = 0;
+        for (int j = 0; j < BMETRICS_HISTOGRAM_BUCKETS - 1; j++) {
+            if (h->buckets[j] > 0) {
+                last = j;
+            }
+        }
+        
+        uint64_t count = 0;
+        for (int j = 0; j <= last; j++) {
+            count += h->buckets[j];
+            uint64_t le = (j == 0 ? 0 : ((uint64_t)1 << j) - 1);
+            snprintf(line, sizeof(line), "badvpn_%s_bucket{le=\"%"PRIu64"\"} %"PRIu64, info->name, le, count);
+            func(user, line);
+        }
+        for (int j = last + 1; j < BMETRICS_HISTOGRAM_BUCKETS; j++) {
+            count += h->buckets[j];
+        }
+        
+        snprintf(line, sizeof(line), "badvpn_%s_bucket{le=\"+Inf\"} %"PRIu64, info->name, count);
+        func(user, line);
+        snprintf(line, sizeof(line), "badvpn_%s_sum %"PRIu64, info->name, h->sum);
+        func(user, line);
+        snprintf(line, sizeof(line), "badvpn_%s_count %"PRIu64, info->name, count);
+        func(user, line);
+    }
+    
+    BAllocStats_Print(func, user);
+    
+    BFree(tot);
+}
@@ -0,0 +1,255 @@
+/**
+ * @file BMetrics.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Runtime metrics: counters and histograms for the hot paths.
+ * 
+ * The metrics are listed in BMetrics_list.h. Every thread updates its own
+ * block of values, registered the first time the thread records something,
+ * so recording is a plain add without atomic read-modify-write. Nothing is
+ * recorded until {@link BMetrics_Enable} is called. Histograms have
+ * power-of-two buckets; bucket i > 0 counts values in [2^(i-1), 2^i - 1].
+ */
+
+#ifndef BADVPN_BMETRICS_H
+#define BADVPN_BMETRICS_H
+
+#include <stdint.h>
+
+#include <misc/batomic.h>
+#include <misc/bthreadlocal.h>
+#include <misc/bclz.h>
+
+#ifdef BADVPN_USE_WINAPI
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <misc/debug.h>
+
+#define BMETRICS_HISTOGRAM_BUCKETS 40
+
+enum {
+#define BMETRICS_COUNTER(id, name, help) BMETRICS_COUNTER_##id,
+#define BMETRICS_HISTOGRAM(id, name, help)
+#include <base/BMetrics_list.h>
+#undef BMETRICS_COUNTER
+#undef BMETRICS_HISTOGRAM
+    BMETRICS_NUM_COUNTERS
+};
+
+enum {
+#define BMETRICS_COUNTER(id, name, help)
+#define BMETRICS_HISTOGRAM(id, name, help) BMETRICS_HISTOGRAM_##id,
+#include <base/BMetrics_list.h>
+#undef BMETRICS_COUNTER
+#undef BMETRICS_HISTOGRAM
+    BMETRICS_NUM_HISTOGRAMS
+};
+
+struct _BMetrics_histogram {
+    uint64_t buckets[BMETRICS_HISTOGRAM_BUCKETS];
+    uint64_t sum;
+};
+
+struct _BMetrics_thread {
+    uint64_t counters[BMETRICS_NUM_COUNTERS];
+    struct _BMetrics_histogram histograms[BMETRICS_NUM_HISTOGRAMS];
+    struct _BMetrics_thread *next;
+};
+
+extern int bmetrics_enabled;
+extern BTHREADLOCAL struct _BMetrics_thread *bmetrics_thread;
+
+/**
+ * Function receiving the lines of a metrics report.
+ * 
+ * @param user as in {@link BMetrics_Print}
+ * @param line line of text, without a newline
+ */
+typedef void (*BMetrics_print_func) (void *user, const char *line);
+
+/**
+ * Starts recording metrics.
+ * Metrics cannot be disabled again.
+ */
+void BMetrics_Enable (void);
+
+/**
+ * Frees the blocks of all threads.
+ * No thread may record metrics after this is called.
+ */
+void BMetrics_Free (void);
+
+/**
+ * Reports the totals of all threads in the Prometheus text format,
+ * with names prefixed with "badvpn_", followed by the memory report
+ * of {@link BAllocStats_Print}.
+ * Values recorded in parallel may or may not be included.
+ * 
+ * @param func function receiving the lines
+ * @param user value passed to func
+ */
+void BMetrics_Print (BMetrics_print_func func, void *user);
+
+/**
+ * Returns the total of a counter over all threads.
+ * Values recorded in parallel may or may not be included.
+ * 
+ * @param counter counter ID, BMETRICS_COUNTER_*
+ */
+uint64_t BMetrics_ReadCounter (int counter);
+
+/**
+ * Returns the bucket counts of a histogram, totalled over all threads.
+ * Values recorded in parallel may or may not be included.
+ * 
+ * @param histogram histogram ID, BMETRICS_HISTOGRAM_*
+ * @param buckets receives BMETRICS_HISTOGRAM_BUCKETS counts
+ */
+void BMetrics_ReadHistogram (int histogram, uint64_t *buckets);
+
+struct _BMetrics_thread * BMetrics__RegisterThread (void);
+
+static struct _BMetrics_thread * BMetrics__Thread (void)
+{
+    struct _BMetrics_thread *t = bmetrics_thread;
+    if (!t) {
+        t = BMetrics__RegisterThread();
+    }
+    return t;
+}
+
+// only the owning thread writes to a block, so a relaxed load and store
+// is enough for the reader to never see a torn value
+static void BMetrics__Add (uint64_t *v, uint64_t n)
+{
+    batomic_store_uint64_relaxed(v, batomic_load_uint64_relaxed(v) + n);
+}
+
+/**
+ * Returns whether metrics are being recorded.
+ */
+static int BMetrics_Enabled (void)
+{
+    return batomic_load_int_relaxed(&bmetrics_enabled);
+}
+
+/**
+ * Returns the monotonic time in nanoseconds.
+ */
+static uint64_t BMetrics_Now (void)
+{
+#ifdef BADVPN_USE_WINAPI
+    LARGE_INTEGER count;
+    LARGE_INTEGER freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)((double)count.QuadPart * 1000000000.0 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Adds to a counter.
+ * 
+ * @param counter counter ID, BMETRICS_COUNTER_*
+ * @param n amount to add
+ */
+static void BMetrics_Count (int counter, uint64_t n)
+{
+    ASSERT(counter >= 0 && counter < BMETRICS_NUM_COUNTERS)
+    
+    if (!BMetrics_Enabled()) {
+        return;
+    }
+    
+    BMetrics__Add(&BMetrics__Thread()->counters[counter], n);
+}
+
+/**
+ * Records a value in a histogram.
+ * 
+ * @param histogram histogram ID, BMETRICS_HISTOGRAM_*
+ * @param value value to record
+ */
+static void BMetrics_Observe (int histogram, uint64_t value)
+{
+    ASSERT(histogram >= 0 && histogram < BMETRICS_NUM_HISTOGRAMS)
+    
+    if (!BMetrics_Enabled()) {
+        return;
+    }
+    
+    int bucket = (value == 0 ? 0 : 64 - bclz64(value));
+    if (bucket > BMETRICS_HISTOGRAM_BUCKETS - 1) {
+        bucket = BMETRICS_HISTOGRAM_BUCKETS - 1;
+    }
+    
+    struct _BMetrics_histogram *h = &BMetrics__Thread()->histograms[histogram];
+    BMetrics__Add(&h->buckets[bucket], 1);
+    BMetrics__Add(&h->sum, value);
+}
+
+/**
+ * Returns the start time of an interval for {@link BMetrics_ObserveSince},
+ * or 0 if metrics are not being recorded.
+ */
+static uint64_t BMetrics_Start (void)
+{
+    if (!BMetrics_Enabled()) {
+        return 0;
+    }
+    
+    return BMetrics_Now();
+}
+
+/**
+ * Records the time since start in a histogram.
+ * Does nothing if start is 0.
+ * 
+ * @param histogram histogram ID, BMETRICS_HISTOGRAM_*
+ * @param start value returned by {@link BMetrics_Start}
+ */
+static void BMetrics_ObserveSince (int histogram, uint64_t start)
+{
+    ASSERT(histogram >= 0 && histogram < BMETRICS_NUM_HISTOGRAMS)
+    
+    if (start == 0) {
+        return;
+    }
+    
+    BMetrics_Observe(histogram, BMetrics_Now() - start);
+}
+
+#endif
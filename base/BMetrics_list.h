@@ -0,0 +1,30 @@
+// List of metrics, included by BMetrics.h and BMetrics.c with these macros defined:
+// BMETRICS_COUNTER(id, name, help)
+// BMETRICS_HISTOGRAM(id, name, help)
+
+BMETRICS_COUNTER(REACTOR_ITERATIONS, "reactor_iterations_total", "Event loop iterations, one per wait for events.")
+BMETRICS_COUNTER(REACTOR_JOB_BUDGET_EXHAUSTED, "reactor_job_budget_exhausted_total", "Event loop iterations in which jobs were left over for the next one because the job budget ran out.")
+BMETRICS_COUNTER(TAP_WRITES, "tap_writes_total", "Packets written to the TUN/TAP device.")
+BMETRICS_COUNTER(TRACE_SAMPLES_DROPPED, "trace_samples_dropped_total", "Traced packets lost track of before the end of the data path.")
+BMETRICS_COUNTER(NCD_STATEMENTS, "ncd_statements_total", "NCD statements initialized by the interpreter.")
+BMETRICS_COUNTER(NCD_PROCESSES, "ncd_processes_total", "NCD processes created by the interpreter.")
+BMETRICS_COUNTER(THREADWORK_INLINE, "threadwork_inline_total", "Works run in the event loop because they were cheap and threads were idle.")
+BMETRICS_COUNTER(NCDVAL_ALLOCS, "ncdval_buffer_allocs_total", "Buffers allocated or grown for NCD value memory objects.")
+BMETRICS_HISTOGRAM(REACTOR_DISPATCH_NS, "reactor_dispatch_ns", "Time from a wait for events returning to the next wait, in nanoseconds.")
+BMETRICS_HISTOGRAM(REACTOR_HANDLER_NS, "reactor_handler_ns", "Time a handler dispatched by the reactor ran, with stall detection on, in nanoseconds.")
+BMETRICS_HISTOGRAM(REACTOR_STALL_NS, "reactor_stall_ns", "Time a handler dispatched by the reactor ran, for those over the stall threshold, in nanoseconds.")
+BMETRICS_HISTOGRAM(THREADWORK_WAIT_NS, "threadwork_queue_wait_ns", "Time works spend queued before a thread starts them, in nanoseconds.")
+BMETRICS_HISTOGRAM(SPPROTO_ENCODE_NS, "spproto_encode_ns", "Time to encode one SPProto packet, in nanoseconds.")
+BMETRICS_HISTOGRAM(SPPROTO_DECODE_NS, "spproto_decode_ns", "Time to decode one SPProto packet, in nanoseconds.")
+BMETRICS_HISTOGRAM(FAIRQUEUE_DEPTH, "fairqueue_depth", "Flows queued in a fair queue when it schedules a packet.")
+BMETRICS_HISTOGRAM(TAP_READ_BATCH, "tap_read_batch", "Packets read from the TUN/TAP device before it would block.")
+BMETRICS_HISTOGRAM(TRACE_SEND_SOURCE_NS, "trace_send_source_ns", "Time from reading a traced frame from the device to routing it to peers, in nanoseconds.")
+BMETRICS_HISTOGRAM(TRACE_SEND_SINK_NS, "trace_send_sink_ns", "Time from reading a traced frame from the device to it leaving the send buffer of a peer, in nanoseconds.")
+BMETRICS_HISTOGRAM(TRACE_SEND_ENCODE_QUEUE_NS, "trace_send_encode_queue_ns", "Time from reading a traced frame from the device to queuing its first fragment for SPProto encoding, in nanoseconds.")
+BMETRICS_HISTOGRAM(TRACE_SEND_ENCODE_DONE_NS, "trace_send_encode_done_ns", "Time from reading a traced frame from the device to its first fragment being encoded, in nanoseconds.")
+BMETRICS_HISTOGRAM(TRACE_SEND_DATAGRAM_NS, "trace_send_datagram_ns", "Time from reading a traced frame from the device to its first fragment being sent to the peer, in nanoseconds.")
+BMETRICS_HISTOGRAM(TRACE_RECV_DECODE_QUEUE_NS, "trace_recv_decode_queue_ns", "Time from receiving a traced datagram to queuing it for SPProto decoding, in nanoseconds.")
+BMETRICS_HISTOGRAM(TRACE_RECV_DECODE_DONE_NS, "trace_recv_decode_done_ns", "Time from receiving a traced datagram to it being decoded, in nanoseconds.")
+BMETRICS_HISTOGRAM(TRACE_RECV_ASSEMBLE_NS, "trace_recv_assemble_ns", "Time from receiving a traced datagram to completing the next frame from its fragments, in nanoseconds.")
+BMETRICS_HISTOGRAM(TRACE_RECV_DEVICE_NS, "trace_recv_device_ns", "Time from receiving a traced datagram to writing the frame to the device, in nanoseconds.")
+BMETRICS_HISTOGRAM(NCDVAL_MEM_BYTES, "ncdval_mem_bytes", "Buffer size of an NCD value memory object when it is freed, its peak size, in bytes.")
@@ -0,0 +1,159 @@
+/**
+ * @file BPacketTrace.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Sampled tracing of single packets through the data path.
+ * 
+ * Packets enter tracing in one of two directions, one sample in flight
+ * per direction. {@link BPacketTrace_Begin} is called for every packet
+ * entering a direction and starts a sample for every interval-th one,
+ * unless a sample is already in flight. A sample is followed by a key,
+ * the address of the packet data or of the object holding the packet;
+ * stages of the data path call {@link BPacketTrace_Stamp} with the key of
+ * the packet they are handling, and if it is the sample, the time since
+ * the sample began is recorded in a BMetrics histogram and the sample
+ * continues with the key the next stage will see.
+ * 
+ * A sample which has not reached the end after BPACKETTRACE_TIMEOUT_NS,
+ * or whose buffer is reused by a new packet, is dropped and counted in
+ * the trace_samples_dropped_total counter.
+ * 
+ * Tracing must only be used from a single thread once enabled. When
+ * not enabled, the functions only read and may be called from any thread.
+ */
+
+#ifndef BADVPN_BPACKETTRACE_H
+#define BADVPN_BPACKETTRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <base/BMetrics.h>
+
+#define BPACKETTRACE_SEND 0
+#define BPACKETTRACE_RECV 1
+#define BPACKETTRACE_NUM_DIRECTIONS 2
+
+#define BPACKETTRACE_NO_HISTOGRAM -1
+
+#define BPACKETTRACE_TIMEOUT_NS 1000000000
+
+struct _BPacketTrace_direction {
+    const void *key;
+    uint64_t start;
+    int countdown;
+};
+
+extern int bpackettrace_interval;
+extern struct _BPacketTrace_direction bpackettrace_directions[BPACKETTRACE_NUM_DIRECTIONS];
+
+/**
+ * Starts tracing.
+ * Tracing cannot be disabled again. Times are only recorded while
+ * metrics are, see {@link BMetrics_Enable}.
+ * 
+ * @param interval one out of this many packets is sampled; must be >0
+ */
+void BPacketTrace_Enable (int interval);
+
+/**
+ * Reports a packet entering a direction, possibly starting a sample.
+ * 
+ * @param direction BPACKETTRACE_SEND or BPACKETTRACE_RECV
+ * @param key key of the packet for the first stage; must not be NULL
+ */
+static void BPacketTrace_Begin (int direction, const void *key)
+{
+    ASSERT(direction >= 0 && direction < BPACKETTRACE_NUM_DIRECTIONS)
+    ASSERT(key)
+    
+    if (!bpackettrace_interval) {
+        return;
+    }
+    
+    struct _BPacketTrace_direction *d = &bpackettrace_directions[direction];
+    
+    // a new packet in the buffer of the sample means the sample was dropped
+    if (key == d->key) {
+        BMetrics_Count(BMETRICS_COUNTER_TRACE_SAMPLES_DROPPED, 1);
+        d->key = NULL;
+    }
+    
+    if (--d->countdown > 0) {
+        return;
+    }
+    d->countdown = bpackettrace_interval;
+    
+    uint64_t now = BMetrics_Now();
+    
+    // let the sample in flight finish, unless it's been lost
+    if (d->key) {
+        if (now - d->start < BPACKETTRACE_TIMEOUT_NS) {
+            return;
+        }
+        BMetrics_Count(BMETRICS_COUNTER_TRACE_SAMPLES_DROPPED, 1);
+    }
+    
+    d->key = key;
+    d->start = now;
+}
+
+/**
+ * Reports a packet reaching a stage.
+ * Does nothing unless the packet is the sample.
+ * 
+ * @param direction BPACKETTRACE_SEND or BPACKETTRACE_RECV
+ * @param key key of the packet at this stage; must not be NULL
+ * @param histogram histogram to record the time since the sample began in,
+ *                  BMETRICS_HISTOGRAM_*, or BPACKETTRACE_NO_HISTOGRAM to
+ *                  only hand over the key
+ * @param next_key key of the packet at the next stage, or NULL if this
+ *                 is the end of the data path
+ */
+static void BPacketTrace_Stamp (int direction, const void *key, int histogram, const void *next_key)
+{
+    ASSERT(direction >= 0 && direction < BPACKETTRACE_NUM_DIRECTIONS)
+    ASSERT(key)
+    ASSERT(histogram == BPACKETTRACE_NO_HISTOGRAM || (histogram >= 0 && histogram < BMETRICS_NUM_HISTOGRAMS))
+    
+    struct _BPacketTrace_direction *d = &bpackettrace_directions[direction];
+    
+    if (key != d->key) {
+        return;
+    }
+    
+    if (histogram != BPACKETTRACE_NO_HISTOGRAM) {
+        BMetrics_Observe(histogram, BMetrics_Now() - d->start);
+    }
+    
+    d->key = next_key;
+}
+
+#endif
@@ -0,0 +1,901 @@
+/**
+ * @file benchload.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Load generator and endpoints for the end-to-end benchmarks in run.sh:
+ * TCP bulk send into a discarding sink, TCP and UDP request-response with
+ * latency percentiles, and a minimal SOCKS5 server for tun2socks to use.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <misc/version.h>
+#include <misc/open_standard_streams.h>
+
+#define PROGRAM_NAME "benchload"
+
+#define MODE_TCP_SINK 1
+#define MODE_TCP_ECHO 2
+#define MODE_UDP_ECHO 3
+#define MODE_SOCKS 4
+#define MODE_TCP 5
+#define MODE_TCP_RR 6
+#define MODE_UDP_RR 7
+
+#define TCP_BUF_SIZE 65536
+#define UDP_TIMEOUT_MS 100
+#define MAX_SAMPLES 10000000
+
+struct {
+    int help;
+    int version;
+    int mode;
+    char *addr;
+    int streams;
+    double time;
+    int size;
+    int window;
+} options;
+
+struct sockaddr_storage addr;
+socklen_t addr_len;
+
+static volatile int stop_sending;
+
+struct samples {
+    uint64_t *v;
+    size_t n;
+    size_t cap;
+};
+
+static void print_help (const char *name);
+static void print_version (void);
+static int parse_arguments (int argc, char *argv[]);
+static int resolve_addr (const char *str, int socktype);
+static uint64_t now_ns (void);
+static int write_all (int fd, const uint8_t *data, size_t len);
+static int read_all (int fd, uint8_t *data, size_t len);
+static int listen_socket (int socktype);
+static void serve_tcp (void * (*func) (void *));
+static void * tcp_sink_thread (void *arg);
+static void * tcp_echo_thread (void *arg);
+static void * socks_thread (void *arg);
+static void run_udp_echo (void);
+static int run_tcp (void);
+static int run_tcp_rr (void);
+static int run_udp_rr (void);
+static void samples_add (struct samples *s, uint64_t v);
+static void print_result (const char *mode, double secs, uint64_t bytes, uint64_t packets, struct samples *s);
+
+int main (int argc, char *argv[])
+{
+    int res = 1;
+    
+    // open standard streams
+    open_standard_streams();
+    
+    // parse command-line arguments
+    if (!parse_arguments(argc, argv)) {
+        fprintf(stderr, "Error: Failed to parse arguments\n");
+        print_help(argv[0]);
+        goto fail0;
+    }
+    
+    // handle --help and --version
+    if (options.help) {
+        print_version();
+        print_help(argv[0]);
+        return 0;
+    }
+    if (options.version) {
+        print_version();
+        return 0;
+    }
+    
+    int socktype = (options.mode == MODE_UDP_ECHO || options.mode == MODE_UDP_RR ? SOCK_DGRAM : SOCK_STREAM);
+    if (!resolve_addr(options.addr, socktype)) {
+        fprintf(stderr, "%s: cannot resolve\n", options.addr);
+        goto fail0;
+    }
+    
+    switch (options.mode) {
+        case MODE_TCP_SINK:
+            serve_tcp(tcp_sink_thread);
+            break;
+        case MODE_TCP_ECHO:
+            serve_tcp(tcp_echo_thread);
+            break;
+        case MODE_SOCKS:
+            serve_tcp(socks_thread);
+            break;
+        case MODE_UDP_ECHO:
+            run_udp_echo();
+            break;
+        case MODE_TCP:
+            res = !run_tcp();
+            break;
+        case MODE_TCP_RR:
+            res = !run_tcp_rr();
+            break;
+        case MODE_UDP_RR:
+            res = !run_udp_rr();
+            break;
+    }
+    
+fail0:
+    return res;
+}
+
+void print_help (const char *name)
+{
+    printf(
+        "Usage:\n"
+        "    %s [--help] [--version]\n"
+        "    %s --tcp-sink <addr>\n"
+        "    %s --tcp-echo <addr>\n"
+        "    %s --udp-echo <addr>\n"
+        "    %s --socks-server <addr>\n"
+        "    %s --tcp <addr> [--streams <num>] [--time <seconds>]\n"
+        "    %s --tcp-rr <addr> [--size <bytes>] [--time <seconds>]\n"
+        "    %s --udp-rr <addr> [--size <bytes>] [--window <packets>] [--time <seconds>]\n"
+        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
+        name, name, name, name, name, name, name, name
+    );
+}
+
+void print_version (void)
+{
+    printf(GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION"\n"GLOBAL_COPYRIGHT_NOTICE"\n");
+}
+
+int parse_arguments (int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        int mode;
+    } modes[] = {
+        {"--tcp-sink", MODE_TCP_SINK},
+        {"--tcp-echo", MODE_TCP_ECHO},
+        {"--udp-echo", MODE_UDP_ECHO},
+        {"--socks-server", MODE_SOCKS},
+        {"--tcp", MODE_TCP},
+        {"--tcp-rr", MODE_TCP_RR},
+        {"--udp-rr", MODE_UDP_RR},
+    };
+    
+    if (argc <= 0) {
+        return 0;
+    }
+    
+    options.help = 0;
+    options.version = 0;
+    options.mode = -1;
+    options.addr = NULL;
+    options.streams = 1;
+    options.time = 10.0;
+    options.size = 64;
+    options.window = 64;
+    
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        
+        int mode = -1;
+        for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); j++) {
+            if (!strcmp(arg, modes[j].name)) {
+                mode = modes[j].mode;
+            }
+        }
+        
+        if (!strcmp(arg, "--help")) {
+            options.help = 1;
+        }
+        else if (!strcmp(arg, "--version")) {
+            options.version = 1;
+        }
+        else if (mode >= 0) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (options.mode >= 0) {
+                fprintf(stderr, "%s: can only do one operation\n", arg);
+                return 0;
+            }
+            options.mode = mode;
+            options.addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--streams")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.streams = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--time")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.time = atof(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.size = atoi(argv[i + 1])) < 16 || options.size > 65000) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--window")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.window = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            return 0;
+        }
+    }
+    
+    if (options.help || options.version) {
+        return 1;
+    }
+    
+    if (options.mode < 0) {
+        fprintf(stderr, "no operation specified\n");
+        return 0;
+    }
+    
+    return 1;
+}
+
+int resolve_addr (const char *str, int socktype)
+{
+    char host[128];
+    const char *port;
+    
+    if (str[0] == '[') {
+        const char *end = strchr(str, ']');
+        if (!end || end[1] != ':' || end - str - 1 >= (int)sizeof(host)) {
+            return 0;
+        }
+        memcpy(host, str + 1, end - str - 1);
+        host[end - str - 1] = '\0';
+        port = end + 2;
+    } else {
+        const char *colon = strrchr(str, ':');
+        if (!colon || colon - str >= (int)sizeof(host)) {
+            return 0;
+        }
+        memcpy(host, str, colon - str);
+        host[colon - str] = '\0';
+        port = colon + 1;
+    }
+    
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = socktype;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    
+    struct addrinfo *ai;
+    if (getaddrinfo(host, port, &hints, &ai) != 0) {
+        return 0;
+    }
+    
+    memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+    addr_len = ai->ai_addrlen;
+    freeaddrinfo(ai);
+    
+    return 1;
+}
+
+uint64_t now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int write_all (int fd, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t res = write(fd, data, len);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            return 0;
+        }
+        data += res;
+        len -= res;
+    }
+    
+    return 1;
+}
+
+int read_all (int fd, uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t res = read(fd, data, len);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            return 0;
+        }
+        data += res;
+        len -= res;
+    }
+    
+    return 1;
+}
+
+int listen_socket (int socktype)
+{
+    int fd = socket(addr.ss_family, socktype, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    
+    if (bind(fd, (struct sockaddr *)&addr, addr_len) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    
+    if (socktype == SOCK_STREAM && listen(fd, 128) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    
+    return fd;
+}
+
+void serve_tcp (void * (*func) (void *))
+{
+    int lfd = listen_socket(SOCK_STREAM);
+    if (lfd < 0) {
+        return;
+    }
+    
+    while (1) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, func, (void *)(intptr_t)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    
+    close(lfd);
+}
+
+void * tcp_sink_thread (void *arg)
+{
+    int fd = (intptr_t)arg;
+    
+    uint8_t *buf = (uint8_t *)malloc(TCP_BUF_SIZE);
+    if (buf) {
+        while (read(fd, buf, TCP_BUF_SIZE) > 0);
+        free(buf);
+    }
+    
+    close(fd);
+    return NULL;
+}
+
+void * tcp_echo_thread (void *arg)
+{
+    int fd = (intptr_t)arg;
+    
+    uint8_t *buf = (uint8_t *)malloc(TCP_BUF_SIZE);
+    if (buf) {
+        ssize_t res;
+        while ((res = read(fd, buf, TCP_BUF_SIZE)) > 0) {
+            if (!write_all(fd, buf, res)) {
+                break;
+            }
+        }
+        free(buf);
+    }
+    
+    close(fd);
+    return NULL;
+}
+
+struct relay {
+    int from;
+    int to;
+};
+
+static void * relay_thread (void *arg)
+{
+    struct relay *r = (struct relay *)arg;
+    
+    uint8_t *buf = (uint8_t *)malloc(TCP_BUF_SIZE);
+    if (buf) {
+        ssize_t res;
+        while ((res = read(r->from, buf, TCP_BUF_SIZE)) > 0) {
+            if (!write_all(r->to, buf, res)) {
+                break;
+            }
+        }
+        free(buf);
+    }
+    
+    shutdown(r->to, SHUT_WR);
+    return NULL;
+}
+
+void * socks_thread (void *arg)
+{
+    int fd = (intptr_t)arg;
+    int rfd = -1;
+    uint8_t buf[262];
+    
+    // method selection; accept no authentication and username/password,
+    // without checking the credentials
+    if (!read_all(fd, buf, 2) || buf[0] != 5 || !read_all(fd, buf + 2, buf[1])) {
+        goto out;
+    }
+    int method = 0xFF;
+    for (int i = 0; i < buf[1]; i++) {
+        if (buf[2 + i] == 0x00 && method == 0xFF) {
+            method = 0x00;
+        }
+        if (buf[2 + i] == 0x02) {
+            method = 0x02;
+        }
+    }
+    uint8_t reply[2] = {5, method};
+    if (!write_all(fd, reply, 2) || method == 0xFF) {
+        goto out;
+    }
+    if (method == 0x02) {
+        if (!read_all(fd, buf, 2) || !read_all(fd, buf, buf[1]) || !read_all(fd, buf, 1) || !read_all(fd, buf, buf[0])) {
+            goto out;
+        }
+        uint8_t auth_reply[2] = {1, 0};
+        if (!write_all(fd, auth_reply, 2)) {
+            goto out;
+        }
+    }
+    
+    // CONNECT request
+    if (!read_all(fd, buf, 4) || buf[0] != 5 || buf[1] != 1) {
+        goto out;
+    }
+    
+    struct sockaddr_storage dest;
+    socklen_t dest_len;
+    memset(&dest, 0, sizeof(dest));
+    
+    switch (buf[3]) {
+        case 1: {
+            struct sockaddr_in *sin = (struct sockaddr_in *)&dest;
+            if (!read_all(fd, buf, 6)) {
+                goto out;
+            }
+            sin->sin_family = AF_INET;
+            memcpy(&sin->sin_addr, buf, 4);
+            memcpy(&sin->sin_port, buf + 4, 2);
+            dest_len = sizeof(*sin);
+        } break;
+        case 4: {
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&dest;
+            if (!read_all(fd, buf, 18)) {
+                goto out;
+            }
+            sin6->sin6_family = AF_INET6;
+            memcpy(&sin6->sin6_addr, buf, 16);
+            memcpy(&sin6->sin6_port, buf + 16, 2);
+            dest_len = sizeof(*sin6);
+        } break;
+        default:
+            goto out;
+    }
+    
+    uint8_t conn_reply[10] = {5, 0, 0, 1, 0, 0, 0, 0, 0, 0};
+    
+    rfd = socket(dest.ss_family, SOCK_STREAM, 0);
+    if (rfd < 0 || connect(rfd, (struct sockaddr *)&dest, dest_len) < 0) {
+        conn_reply[1] = 5;
+        write_all(fd, conn_reply, sizeof(conn_reply));
+        goto out;
+    }
+    
+    int one = 1;
+    setsockopt(rfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    if (!write_all(fd, conn_reply, sizeof(conn_reply))) {
+        goto out;
+    }
+    
+    // relay both ways until both sides are finished
+    struct relay up = {fd, rfd};
+    struct relay down = {rfd, fd};
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, relay_thread, &up) != 0) {
+        goto out;
+    }
+    relay_thread(&down);
+    pthread_join(thread, NULL);
+    
+out:
+    if (rfd >= 0) {
+        close(rfd);
+    }
+    close(fd);
+    return NULL;
+}
+
+void run_udp_echo (void)
+{
+    int fd = listen_socket(SOCK_DGRAM);
+    if (fd < 0) {
+        return;
+    }
+    
+    uint8_t buf[65536];
+    
+    while (1) {
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        ssize_t res = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("recvfrom");
+            break;
+        }
+        sendto(fd, buf, res, 0, (struct sockaddr *)&from, from_len);
+    }
+    
+    close(fd);
+}
+
+static int connect_tcp (void)
+{
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    
+    if (connect(fd, (struct sockaddr *)&addr, addr_len) < 0) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    return fd;
+}
+
+struct tcp_stream {
+    int fd;
+    uint64_t bytes;
+    pthread_t thread;
+};
+
+static void * tcp_stream_thread (void *arg)
+{
+    struct tcp_stream *s = (struct tcp_stream *)arg;
+    
+    uint8_t *buf = (uint8_t *)calloc(1, TCP_BUF_SIZE);
+    if (!buf) {
+        return NULL;
+    }
+    
+    while (!stop_sending) {
+        ssize_t res = write(s->fd, buf, TCP_BUF_SIZE);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            break;
+        }
+        __atomic_add_fetch(&s->bytes, res, __ATOMIC_RELAXED);
+    }
+    
+    free(buf);
+    return NULL;
+}
+
+int run_tcp (void)
+{
+    int ok = 0;
+    
+    struct tcp_stream *streams = (struct tcp_stream *)calloc(options.streams, sizeof(streams[0]));
+    if (!streams) {
+        return 0;
+    }
+    
+    int num = 0;
+    for (; num < options.streams; num++) {
+        if ((streams[num].fd = connect_tcp()) < 0) {
+            goto out;
+        }
+    }
+    
+    uint64_t start = now_ns();
+    
+    for (int i = 0; i < num; i++) {
+        if (pthread_create(&streams[i].thread, NULL, tcp_stream_thread, &streams[i]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+    
+    struct timespec ts;
+    ts.tv_sec = (time_t)options.time;
+    ts.tv_nsec = (long)((options.time - ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+    
+    // count what was written until now; the sink reads everything, so
+    // only the socket buffers' worth is not yet delivered
+    uint64_t bytes = 0;
+    for (int i = 0; i < num; i++) {
+        bytes += __atomic_load_n(&streams[i].bytes, __ATOMIC_RELAXED);
+    }
+    double secs = (now_ns() - start) / 1e9;
+    
+    stop_sending = 1;
+    for (int i = 0; i < num; i++) {
+        shutdown(streams[i].fd, SHUT_RDWR);
+        pthread_join(streams[i].thread, NULL);
+    }
+    
+    print_result("tcp", secs, bytes, 0, NULL);
+    ok = 1;
+    
+out:
+    while (num > 0) {
+        close(streams[--num].fd);
+    }
+    free(streams);
+    return ok;
+}
+
+int run_tcp_rr (void)
+{
+    int fd = connect_tcp();
+    if (fd < 0) {
+        return 0;
+    }
+    
+    uint8_t *buf = (uint8_t *)calloc(1, options.size);
+    if (!buf) {
+        close(fd);
+        return 0;
+    }
+    
+    struct samples s = {NULL, 0, 0};
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)(options.time * 1e9);
+    uint64_t t;
+    
+    while ((t = now_ns()) < end) {
+        if (!write_all(fd, buf, options.size) || !read_all(fd, buf, options.size)) {
+            fprintf(stderr, "connection failed\n");
+            break;
+        }
+        samples_add(&s, now_ns() - t);
+    }
+    
+    double secs = (now_ns() - start) / 1e9;
+    print_result("tcp-rr", secs, (uint64_t)s.n * options.size, s.n, &s);
+    
+    free(s.v);
+    free(buf);
+    close(fd);
+    return 1;
+}
+
+int run_udp_rr (void)
+{
+    int fd = socket(addr.ss_family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return 0;
+    }
+    
+    if (connect(fd, (struct sockaddr *)&addr, addr_len) < 0) {
+        perror("connect");
+        close(fd);
+        return 0;
+    }
+    
+    uint8_t *buf = (uint8_t *)calloc(1, options.size);
+    if (!buf) {
+        close(fd);
+        return 0;
+    }
+    
+    // Each packet carries its send time. Up to window packets are kept in
+    // flight; if nothing comes back for a while, the outstanding ones are
+    // counted as lost and a new window is sent.
+    struct samples s = {NULL, 0, 0};
+    uint64_t sent = 0;
+    uint64_t lost = 0;
+    int in_flight = 0;
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)(options.time * 1e9);
+    uint64_t t;
+    
+    while ((t = now_ns()) < end) {
+        while (in_flight < options.window) {
+            memcpy(buf, &t, sizeof(t));
+            memcpy(buf + sizeof(t), &sent, sizeof(sent));
+            if (send(fd, buf, options.size, 0) < 0) {
+                if (errno == ECONNREFUSED || errno == ENOBUFS) {
+                    break;
+                }
+                perror("send");
+                goto out;
+            }
+            sent++;
+            in_flight++;
+        }
+        
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int res = poll(&pfd, 1, UDP_TIMEOUT_MS);
+        if (res < 0 && errno != EINTR) {
+            perror("poll");
+            goto out;
+        }
+        if (res <= 0) {
+            lost += in_flight;
+            in_flight = 0;
+            continue;
+        }
+        
+        while (1) {
+            ssize_t len = recv(fd, buf, options.size, MSG_DONTWAIT);
+            if (len < 0) {
+                break;
+            }
+            if (len >= (ssize_t)sizeof(uint64_t)) {
+                uint64_t sent_time;
+                memcpy(&sent_time, buf, sizeof(sent_time));
+                samples_add(&s, now_ns() - sent_time);
+            }
+            if (in_flight > 0) {
+                in_flight--;
+            }
+        }
+    }
+    
+    lost += in_flight;
+    
+    double secs = (now_ns() - start) / 1e9;
+    print_result("udp-rr", secs, (uint64_t)s.n * options.size, s.n, &s);
+    printf("sent=%"PRIu64" lost=%"PRIu64"\n", sent, lost);
+    
+out:
+    free(s.v);
+    free(buf);
+    close(fd);
+    return 1;
+}
+
+void samples_add (struct samples *s, uint64_t v)
+{
+    if (s->n == s->cap) {
+        if (s->cap >= MAX_SAMPLES) {
+            return;
+        }
+        size_t new_cap = (s->cap == 0 ? 4096 : 2 * s->cap);
+        uint64_t *new_v = (uint64_t *)realloc(s->v, new_cap * sizeof(new_v[0]));
+        if (!new_v) {
+            return;
+        }
+        s->v = new_v;
+        s->cap = new_cap;
+    }
+    
+    s->v[s->n++] = v;
+}
+
+static int compare_u64 (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void print_result (const char *mode, double secs, uint64_t bytes, uint64_t packets, struct samples *s)
+{
+    printf("mode=%s seconds=%.3f bytes=%"PRIu64" gbps=%.3f", mode, secs, bytes, bytes * 8 / secs / 1e9);
+    
+    if (packets > 0) {
+        printf(" pps=%.0f", packets / secs);
+    }
+    
+    if (s && s->n > 0) {
+        qsort(s->v, s->n, sizeof(s->v[0]), compare_u64);
+        printf(" p50_us=%.1f p99_us=%.1f", s->v[s->n / 2] / 1e3, s->v[s->n * 99 / 100] / 1e3);
+    }
+    
+    printf("\n");
+    fflush(stdout);
+}
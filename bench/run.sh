@@ -0,0 +1,259 @@
+#!/bin/sh
+#
+# End-to-end throughput and latency benchmarks.
+#
+# Builds throwaway network namespaces joined by veth pairs and pushes load
+# through the real programs:
+#
+#   direct     load client -> veth -> endpoints (baseline, no badvpn)
+#   tun2socks  load client -> TUN -> badvpn-tun2socks -> SOCKS5 -> endpoints
+#              TCP over SOCKS, UDP over badvpn-udpgw
+#   mesh       load client -> TAP -> badvpn-client -> UDP peer link
+#              -> badvpn-client -> TAP -> endpoints, with badvpn-server
+#              in a third namespace
+#
+# Every test prints one line of key=value pairs: gbps, pps, p50_us and
+# p99_us from badvpn-benchload, and cpu_ns_per_byte, the user+system CPU
+# time consumed by the badvpn processes of the scenario divided by the
+# bytes delivered.
+#
+# Requires root, iproute2 and a build with -DBUILD_BENCH=ON.
+#
+# Usage: run.sh [-b <build_dir>] [-t <seconds>] [scenario ...]
+#
+# Environment:
+#   STREAMS         parallel streams for the TCP bulk test (default 4)
+#   UDP_SIZE        UDP payload size for the bulk UDP test (default 1200)
+#   WINDOW          UDP packets in flight for the bulk UDP test (default 64)
+#   TUN2SOCKS_ARGS  extra arguments for badvpn-tun2socks
+#   UDPGW_ARGS      extra arguments for badvpn-udpgw
+#   SERVER_ARGS     extra arguments for badvpn-server
+#   CLIENT_ARGS     extra arguments for both badvpn-client instances
+#
+
+set -e
+
+BUILD_DIR=build
+TIME=10
+STREAMS=${STREAMS:-4}
+UDP_SIZE=${UDP_SIZE:-1200}
+WINDOW=${WINDOW:-64}
+
+while getopts "b:t:" opt; do
+    case "$opt" in
+        b) BUILD_DIR=$OPTARG ;;
+        t) TIME=$OPTARG ;;
+        *) echo "Usage: $0 [-b <build_dir>] [-t <seconds>] [scenario ...]" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+SCENARIOS=${*:-"direct tun2socks mesh"}
+
+BENCHLOAD=$BUILD_DIR/bench/badvpn-benchload
+TUN2SOCKS=$BUILD_DIR/tun2socks/badvpn-tun2socks
+UDPGW=$BUILD_DIR/udpgw/badvpn-udpgw
+SERVER=$BUILD_DIR/server/badvpn-server
+CLIENT=$BUILD_DIR/client/badvpn-client
+
+for prog in "$BENCHLOAD" "$TUN2SOCKS" "$UDPGW" "$SERVER" "$CLIENT"; do
+    if [ ! -x "$prog" ]; then
+        echo "$prog: not found, build with -DBUILD_BENCH=ON" >&2
+        exit 1
+    fi
+done
+
+CLK_TCK=$(getconf CLK_TCK)
+PIDS=
+NAMESPACES=
+
+# start <ns> <program> <args...>: runs in the background, pid in $LAST_PID
+start () {
+    ns=$1
+    shift
+    ip netns exec "$ns" "$@" >/dev/null 2>&1 &
+    LAST_PID=$!
+    PIDS="$PIDS $LAST_PID"
+}
+
+add_ns () {
+    ip netns add "$1"
+    ip -n "$1" link set lo up
+    NAMESPACES="$NAMESPACES $1"
+}
+
+# link <ns1> <addr1> <ns2> <addr2>: veth pair between two namespaces
+link () {
+    ip link add bvb-veth0 netns "$1" type veth peer name bvb-veth1 netns "$3"
+    ip -n "$1" link set bvb-veth0 name "bvb-$3"
+    ip -n "$3" link set bvb-veth1 name "bvb-$1"
+    ip -n "$1" addr add "$2" dev "bvb-$3"
+    ip -n "$3" addr add "$4" dev "bvb-$1"
+    ip -n "$1" link set "bvb-$3" up
+    ip -n "$3" link set "bvb-$1" up
+}
+
+cleanup () {
+    for pid in $PIDS; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    for ns in $NAMESPACES; do
+        ip netns del "$ns" 2>/dev/null || true
+    done
+    PIDS=
+    NAMESPACES=
+}
+
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# cpu_ticks <pid...>: sum of user and system time in clock ticks
+cpu_ticks () {
+    total=0
+    for pid in "$@"; do
+        ticks=$(awk '{ print $14 + $15 }' "/proc/$pid/stat")
+        total=$((total + ticks))
+    done
+    echo "$total"
+}
+
+# wait_ready <ns> <benchload args...>: retries a short probe until it works
+wait_ready () {
+    ns=$1
+    shift
+    for i in $(seq 50); do
+        if ip netns exec "$ns" "$BENCHLOAD" "$@" --time 0.2 2>/dev/null | grep -q "bytes=[1-9]"; then
+            return 0
+        fi
+        sleep 0.2
+    done
+    echo "endpoint did not become reachable: $*" >&2
+    exit 1
+}
+
+# endpoints <ns> <ip>: sink, echo and UDP echo on ports 9001-9003
+endpoints () {
+    start "$1" "$BENCHLOAD" --tcp-sink "$2:9001"
+    start "$1" "$BENCHLOAD" --tcp-echo "$2:9002"
+    start "$1" "$BENCHLOAD" --udp-echo "$2:9003"
+}
+
+# measure <scenario> <test> <ns> <pids> <benchload args...>
+measure () {
+    scenario=$1
+    test=$2
+    ns=$3
+    pids=$4
+    shift 4
+
+    before=$(cpu_ticks $pids)
+    out=$(ip netns exec "$ns" "$BENCHLOAD" "$@" --time "$TIME" | tr '\n' ' ' | sed 's/ *$//')
+    after=$(cpu_ticks $pids)
+
+    if [ -z "$pids" ]; then
+        echo "scenario=$scenario test=$test $out"
+        return
+    fi
+
+    bytes=$(echo "$out" | sed -n 's/.*bytes=\([0-9]*\).*/\1/p')
+    cpu=$(awk -v t=$((after - before)) -v hz="$CLK_TCK" -v b="${bytes:-0}" \
+        'BEGIN { if (b > 0) printf "%.3f", t / hz * 1e9 / b; else print "nan" }')
+
+    echo "scenario=$scenario test=$test $out cpu_ns_per_byte=$cpu"
+}
+
+# run_tests <scenario> <ns> <target_ip> <pids> [tcp/udp]
+run_tests () {
+    case "${5:-tcp udp}" in *tcp*)
+        measure "$1" tcp "$2" "$4" --tcp "$3:9001" --streams "$STREAMS"
+        measure "$1" tcp-rr "$2" "$4" --tcp-rr "$3:9002"
+    esac
+    case "${5:-tcp udp}" in *udp*)
+        measure "$1" udp "$2" "$4" --udp-rr "$3:9003" --size "$UDP_SIZE" --window "$WINDOW"
+        measure "$1" udp-rr "$2" "$4" --udp-rr "$3:9003" --window 1
+    esac
+}
+
+# Client namespace A reaches the endpoint namespace B over veth; the
+# endpoints live on 10.200.0.1, which A routes either over the veth
+# (direct) or into the TUN device of tun2socks.
+setup_ab () {
+    add_ns bvb-a
+    add_ns bvb-b
+    link bvb-a 10.201.0.1/24 bvb-b 10.201.0.2/24
+    ip -n bvb-b addr add 10.200.0.1/32 dev lo
+    endpoints bvb-b 10.200.0.1
+}
+
+scenario_direct () {
+    setup_ab
+    ip -n bvb-a route add 10.200.0.0/24 via 10.201.0.2
+    wait_ready bvb-a --tcp-rr 10.200.0.1:9002
+    run_tests direct bvb-a 10.200.0.1 ""
+}
+
+scenario_tun2socks () {
+    setup_ab
+    start bvb-b "$BENCHLOAD" --socks-server 10.201.0.2:1080
+    start bvb-b "$UDPGW" --listen-addr 127.0.0.1:7300 --loglevel warning $UDPGW_ARGS
+    udpgw_pid=$LAST_PID
+
+    ip -n bvb-a tuntap add dev bvb-tun mode tun
+    ip -n bvb-a addr add 10.199.0.1/24 dev bvb-tun
+    ip -n bvb-a link set bvb-tun up
+    ip -n bvb-a route add 10.200.0.0/24 dev bvb-tun
+    start bvb-a "$TUN2SOCKS" --tundev bvb-tun \
+        --netif-ipaddr 10.199.0.2 --netif-netmask 255.255.255.0 \
+        --socks-server-addr 10.201.0.2:1080 \
+        --udpgw-remote-server-addr 127.0.0.1:7300 \
+        --loglevel warning $TUN2SOCKS_ARGS
+    tun2socks_pid=$LAST_PID
+
+    wait_ready bvb-a --tcp-rr 10.200.0.1:9002
+    run_tests tun2socks-socks bvb-a 10.200.0.1 "$tun2socks_pid" tcp
+    wait_ready bvb-a --udp-rr 10.200.0.1:9003 --window 1
+    run_tests tun2socks-udpgw bvb-a 10.200.0.1 "$tun2socks_pid $udpgw_pid" udp
+}
+
+# Two clients in their own namespaces, each routed to the server namespace
+# over a separate veth, so that the peer link is forwarded by the server
+# namespace like it would be by a router.
+scenario_mesh () {
+    add_ns bvb-s
+    add_ns bvb-c1
+    add_ns bvb-c2
+    link bvb-c1 10.203.1.2/24 bvb-s 10.203.1.1/24
+    link bvb-c2 10.203.2.2/24 bvb-s 10.203.2.1/24
+    ip netns exec bvb-s sysctl -q -w net.ipv4.ip_forward=1
+    ip -n bvb-c1 route add 10.203.0.0/16 via 10.203.1.1
+    ip -n bvb-c2 route add 10.203.0.0/16 via 10.203.2.1
+
+    start bvb-s "$SERVER" --listen-addr 0.0.0.0:7000 --loglevel warning $SERVER_ARGS
+    server_pid=$LAST_PID
+
+    client_pids=
+    for n in 1 2; do
+        ip -n bvb-c$n tuntap add dev bvb-tap mode tap
+        ip -n bvb-c$n addr add 10.202.0.$n/24 dev bvb-tap
+        ip -n bvb-c$n link set bvb-tap up
+        start bvb-c$n "$CLIENT" --server-addr 10.203.$n.1:7000 --tapdev bvb-tap \
+            --scope bench --bind-addr 0.0.0.0:8000 --num-ports 4 \
+            --ext-addr 10.203.$n.2:8000 bench \
+            --transport-mode udp --encryption-mode none --hash-mode none \
+            --loglevel warning $CLIENT_ARGS
+        client_pids="$client_pids $LAST_PID"
+    done
+
+    endpoints bvb-c2 10.202.0.2
+    wait_ready bvb-c1 --tcp-rr 10.202.0.2:9002
+    run_tests mesh bvb-c1 10.202.0.2 "$server_pid$client_pids"
+}
+
+for scenario in $SCENARIOS; do
+    case "$scenario" in
+        direct|tun2socks|mesh) "scenario_$scenario" ;;
+        *) echo "$scenario: unknown scenario" >&2; exit 1 ;;
+    esac
+    cleanup
+done
@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <misc/version.h>
+#include <misc/open_standard_streams.h>
+#include <base/BLog_trace_format.h>
+
+#define PROGRAM_NAME "blogdump"
+
+#define MAX_SPEC_LEN 64
+
+struct {
+    int help;
+    int version;
+    int time;
+    char *file;
+} options;
+
+struct trace {
+    uint8_t *data;
+    size_t size;
+    struct BLog_trace_header header;
+    const char *strings;
+    const uint8_t *ring;
+    const char **channel_names;
+};
+
+struct payload {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+};
+
+// keep in sync with level numbers in BLog.h!
+static const char *level_names[] = { "?", "ERROR", "WARNING", "NOTICE", "INFO", "DEBUG" };
+
+static void print_help (const char *name);
+static void print_version (void);
+static int parse_arguments (int argc, char *argv[]);
+static int load_trace (struct trace *t, const char *file);
+static int dump_trace (struct trace *t);
+static int print_record (struct trace *t, const struct BLog_trace_record *rec, const uint8_t *payload);
+static int print_formatted (const char *fmt, struct payload *pl);
+static int get_slot (struct payload *pl, uint64_t *out);
+
+int main (int argc, char *argv[])
+{
+    int res = 1;
+    
+    // open standard streams
+    open_standard_streams();
+    
+    // parse command-line arguments
+    if (!parse_arguments(argc, argv)) {
+        fprintf(stderr, "Error: Failed to parse arguments\n");
+        print_help(argv[0]);
+        goto fail0;
+    }
+    
+    // handle --help and --version
+    if (options.help) {
+        print_version();
+        print_help(argv[0]);
+        return 0;
+    }
+    if (options.version) {
+        print_version();
+        return 0;
+    }
+    
+    struct trace t;
+    if (!load_trace(&t, options.file)) {
+        goto fail0;
+    }
+    
+    res = !dump_trace(&t);
+    
+    free(t.channel_names);
+    free(t.data);
+fail0:
+    return res;
+}
+
+void print_help (const char *name)
+{
+    printf(
+        "Usage:\n"
+        "    %s [--help] [--version]\n"
+        "    %s [--time] <trace_file>\n",
+        name, name
+    );
+}
+
+void print_version (void)
+{
+    printf(GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION"\n"GLOBAL_COPYRIGHT_NOTICE"\n");
+}
+
+int parse_arguments (int argc, char *argv[])
+{
+    if (argc <= 0) {
+        return 0;
+    }
+    
+    options.help = 0;
+    options.version = 0;
+    options.time = 0;
+    options.file = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (!strcmp(arg, "--help")) {
+            options.help = 1;
+        }
+        else if (!strcmp(arg, "--version")) {
+            options.version = 1;
+        }
+        else if (!strcmp(arg, "--time")) {
+            options.time = 1;
+        }
+        else if (arg[0] != '-' && !options.file) {
+            options.file = arg;
+        }
+        else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            return 0;
+        }
+    }
+    
+    if (options.help || options.version) {
+        return 1;
+    }
+    
+    if (!options.file) {
+        fprintf(stderr, "trace file not specified\n");
+        return 0;
+    }
+    
+    return 1;
+}
+
+int load_trace (struct trace *t, const char *file)
+{
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        fprintf(stderr, "%s: failed to open\n", file);
+        goto fail0;
+    }
+    
+    if (fseek(f, 0, SEEK_END) != 0) {
+        goto fail_read;
+    }
+    long size = ftell(f);
+    if (size < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        goto fail_read;
+    }
+    t->size = size;
+    
+    if (!(t->data = (uint8_t *)malloc(t->size > 0 ? t->size : 1))) {
+        fprintf(stderr, "%s: out of memory\n", file);
+        goto fail1;
+    }
+    
+    if (fread(t->data, 1, t->size, f) != t->size) {
+        free(t->data);
+        goto fail_read;
+    }
+    
+    fclose(f);
+    
+    struct BLog_trace_header *h = &t->header;
+    if (t->size < sizeof(*h)) {
+        goto fail_format;
+    }
+    memcpy(h, t->data, sizeof(*h));
+    
+    if (memcmp(h->magic, BLOG_TRACE_MAGIC, sizeof(h->magic))) {
+        goto fail_format;
+    }
+    if (h->strings_offset > t->size || h->strings_size > t->size - h->strings_offset ||
+        h->strings_used > h->strings_size ||
+        h->ring_offset > t->size || h->ring_size > t->size - h->ring_offset ||
+        h->ring_size % 8 != 0 || h->tail > h->head || h->head - h->tail > h->ring_size ||
+        h->num_channels > h->strings_used
+    ) {
+        goto fail_format;
+    }
+    
+    t->strings = (const char *)(t->data + h->strings_offset);
+    t->ring = t->data + h->ring_offset;
+    
+    // the string area must end with a terminated string
+    if (h->strings_used > 0 && t->strings[h->strings_used - 1] != '\0') {
+        goto fail_format;
+    }
+    
+    if (!(t->channel_names = (const char **)malloc((h->num_channels > 0 ? h->num_channels : 1) * sizeof(t->channel_names[0])))) {
+        fprintf(stderr, "%s: out of memory\n", file);
+        free(t->data);
+        goto fail0;
+    }
+    
+    size_t pos = 0;
+    for (uint64_t i = 0; i < h->num_channels; i++) {
+        if (pos >= h->strings_used) {
+            free(t->channel_names);
+            goto fail_format;
+        }
+        t->channel_names[i] = t->strings + pos;
+        pos += strlen(t->strings + pos) + 1;
+    }
+    
+    return 1;
+    
+fail_format:
+    fprintf(stderr, "%s: not a valid trace file\n", file);
+    free(t->data);
+    goto fail0;
+fail_read:
+    fprintf(stderr, "%s: failed to read\n", file);
+fail1:
+    fclose(f);
+fail0:
+    return 0;
+}
+
+int dump_trace (struct trace *t)
+{
+    uint64_t pos = t->header.tail;
+    
+    while (pos < t->header.head) {
+        size_t offset = pos % t->header.ring_size;
+        
+        struct BLog_trace_frame frame;
+        memcpy(&frame, t->ring + offset, sizeof(frame));
+        
+        if (frame.size < sizeof(frame) || frame.size % 8 != 0 || frame.size > t->header.ring_size - offset ||
+            frame.size > t->header.head - pos
+        ) {
+            fprintf(stderr, "corrupt record at position %" PRIu64 "\n", pos);
+            return 0;
+        }
+        
+        if (frame.type != BLOG_TRACE_RECORD_PAD) {
+            struct BLog_trace_record rec;
+            if (frame.size < sizeof(rec)) {
+                fprintf(stderr, "corrupt record at position %" PRIu64 "\n", pos);
+                return 0;
+            }
+            memcpy(&rec, t->ring + offset, sizeof(rec));
+            if (rec.payload_len > frame.size - sizeof(rec)) {
+                fprintf(stderr, "corrupt record at position %" PRIu64 "\n", pos);
+                return 0;
+            }
+            
+            if (!print_record(t, &rec, t->ring + offset + sizeof(rec))) {
+                fprintf(stderr, "bad record at position %" PRIu64 "\n", pos);
+            }
+        }
+        
+        pos += frame.size;
+    }
+    
+    return 1;
+}
+
+int print_record (struct trace *t, const struct BLog_trace_record *rec, const uint8_t *payload)
+{
+    if (options.time) {
+        printf("%" PRIu64 ".%06" PRIu64 " ", rec->time / 1000000000, rec->time % 1000000000 / 1000);
+    }
+    
+    const char *level_name = (rec->frame.level < sizeof(level_names) / sizeof(level_names[0]) ? level_names[rec->frame.level] : "?");
+    const char *channel_name = (rec->frame.channel < t->header.num_channels ? t->channel_names[rec->frame.channel] : "?");
+    printf("%s(%s): ", level_name, channel_name);
+    
+    int res = 1;
+    
+    switch (rec->frame.type) {
+        case BLOG_TRACE_RECORD_TEXT: {
+            printf("%.*s", (int)strnlen((const char *)payload, rec->payload_len), (const char *)payload);
+        } break;
+        
+        case BLOG_TRACE_RECORD_FORMAT: {
+            if (rec->fmt >= t->header.strings_used) {
+                res = 0;
+                break;
+            }
+            struct payload pl;
+            pl.data = payload;
+            pl.len = rec->payload_len;
+            pl.pos = 0;
+            res = print_formatted(t->strings + rec->fmt, &pl);
+        } break;
+        
+        default:
+            res = 0;
+    }
+    
+    printf("\n");
+    
+    return res;
+}
+
+int print_formatted (const char *fmt, struct payload *pl)
+{
+    for (const char *p = fmt; *p; p++) {
+        if (*p != '%') {
+            putchar(*p);
+            continue;
+        }
+        
+        struct BLog_trace_spec spec;
+        if (!BLogTrace_ParseSpec(p, &spec) || spec.len > MAX_SPEC_LEN) {
+            return 0;
+        }
+        
+        // rebuild the specification with the '*' values filled in
+        char spec_str[MAX_SPEC_LEN + 2 * 24];
+        size_t spec_len = 0;
+        int stars = 0;
+        for (size_t i = 0; i < spec.len; i++) {
+            if (p[i] != '*') {
+                spec_str[spec_len++] = p[i];
+                continue;
+            }
+            uint64_t v;
+            if (!get_slot(pl, &v)) {
+                return 0;
+            }
+            int value = (int)(int64_t)v;
+            if (stars++ == 0 && spec.width_star) {
+                spec_len += sprintf(spec_str + spec_len, "%d", value);
+            } else if (value >= 0) {
+                spec_len += sprintf(spec_str + spec_len, "%d", value);
+            } else {
+                // negative precision is taken as if omitted
+                spec_len--;
+            }
+        }
+        spec_str[spec_len] = '\0';
+        p += spec.len - 1;
+        
+        if (spec.arg_class == BLOG_TRACE_ARG_NONE) {
+            putchar('%');
+            continue;
+        }
+        
+        uint64_t v;
+        if (!get_slot(pl, &v)) {
+            return 0;
+        }
+        
+        switch (spec.arg_class) {
+            case BLOG_TRACE_ARG_SIGNED:
+                switch (spec.length) {
+                    case BLOG_TRACE_LEN_L: printf(spec_str, (long)v); break;
+                    case BLOG_TRACE_LEN_LL: printf(spec_str, (long long)v); break;
+                    case BLOG_TRACE_LEN_J: printf(spec_str, (intmax_t)v); break;
+                    case BLOG_TRACE_LEN_Z: printf(spec_str, (ssize_t)v); break;
+                    case BLOG_TRACE_LEN_T: printf(spec_str, (ptrdiff_t)v); break;
+                    default: printf(spec_str, (int)v); break;
+                }
+                break;
+            
+            case BLOG_TRACE_ARG_UNSIGNED:
+                switch (spec.length) {
+                    case BLOG_TRACE_LEN_L: printf(spec_str, (unsigned long)v); break;
+                    case BLOG_TRACE_LEN_LL: printf(spec_str, (unsigned long long)v); break;
+                    case BLOG_TRACE_LEN_J: printf(spec_str, (uintmax_t)v); break;
+                    case BLOG_TRACE_LEN_Z: printf(spec_str, (size_t)v); break;
+                    case BLOG_TRACE_LEN_T: printf(spec_str, (ptrdiff_t)v); break;
+                    default: printf(spec_str, (unsigned int)v); break;
+                }
+                break;
+            
+            case BLOG_TRACE_ARG_DOUBLE: {
+                double d;
+                memcpy(&d, &v, sizeof(d));
+                printf(spec_str, d);
+            } break;
+            
+            case BLOG_TRACE_ARG_POINTER:
+                printf(spec_str, (void *)(uintptr_t)v);
+                break;
+            
+            case BLOG_TRACE_ARG_STRING: {
+                if (v > pl->len - pl->pos) {
+                    return 0;
+                }
+                char *str = (char *)malloc(v + 1);
+                if (!str) {
+                    return 0;
+                }
+                memcpy(str, pl->data + pl->pos, v);
+                str[v] = '\0';
+                pl->pos += BLOG_TRACE_ALIGN(v) <= pl->len - pl->pos ? BLOG_TRACE_ALIGN(v) : pl->len - pl->pos;
+                printf(spec_str, str);
+                free(str);
+            } break;
+        }
+    }
+    
+    return 1;
+}
+
+int get_slot (struct payload *pl, uint64_t *out)
+{
+    if (pl->len - pl->pos < sizeof(*out)) {
+        return 0;
+    }
+    memcpy(out, pl->data + pl->pos, sizeof(*out));
+    pl->pos += sizeof(*out);
+    return 1;
+}
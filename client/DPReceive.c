@@ -34,7 +34,10 @@
 #include <protocol/dataproto.h>
 #include <misc/byteorder.h>
 #include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/lz4.h>
 #include <base/BLog.h>
+#include <base/BPacketTrace.h>
 
 #include <client/DPReceive.h>
 
@@ -65,37 +68,71 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
     
     int local = 0;
     DPReceivePeer *src_peer;
-    DPReceivePeer *relay_dest_peer = NULL;
+    DPRelaySink *relay_sinks[DATAPROTO_MAX_PEER_IDS];
+    int num_relay_sinks = 0;
     
-    // check header
-    if (data_len < sizeof(struct dataproto_header)) {
+    // check flags, which come first in either header
+    if (data_len < DATAPROTO_COMPACT_HEADER_LEN) {
         BLog(BLOG_WARNING, "no dataproto header");
         goto out;
     }
-    struct dataproto_header header;
-    memcpy(&header, data, sizeof(header));
-    data += sizeof(header);
-    data_len -= sizeof(header);
-    uint8_t flags = ltoh8(header.flags);
-    peerid_t from_id = ltoh16(header.from_id);
-    int num_ids = ltoh16(header.num_peer_ids);
-    
-    // check destination ID
-    if (!(num_ids == 0 || num_ids == 1)) {
-        BLog(BLOG_WARNING, "wrong number of destinations");
-        goto out;
-    }
-    peerid_t to_id = 0; // to remove warning
-    if (num_ids == 1) {
-        if (data_len < sizeof(struct dataproto_peer_id)) {
+    uint8_t flags = ltoh8(data[0]);
+    
+    peerid_t from_id;
+    int num_ids;
+    peerid_t to_ids[DATAPROTO_MAX_PEER_IDS];
+    
+    if ((flags & DATAPROTO_FLAGS_COMPACT)) {
+        // a compact header stands for a frame from the peer to just us
+        if (!device->have_peer_id) {
+            BLog(BLOG_INFO, "compact header but we don't have an ID");
+            goto out;
+        }
+        data += DATAPROTO_COMPACT_HEADER_LEN;
+        data_len -= DATAPROTO_COMPACT_HEADER_LEN;
+        from_id = peer->peer_id;
+        num_ids = 1;
+        to_ids[0] = device->peer_id;
+    } else {
+        // check header
+        if (data_len < sizeof(struct dataproto_header)) {
+            BLog(BLOG_WARNING, "no dataproto header");
+            goto out;
+        }
+        struct dataproto_header header;
+        memcpy(&header, data, sizeof(header));
+        data += sizeof(header);
+        data_len -= sizeof(header);
+        from_id = ltoh16(header.from_id);
+        num_ids = ltoh16(header.num_peer_ids);
+        
+        // check destination IDs
+        if (num_ids > DATAPROTO_MAX_PEER_IDS) {
+            BLog(BLOG_WARNING, "wrong number of destinations");
+            goto out;
+        }
+        if (data_len < num_ids * sizeof(struct dataproto_peer_id)) {
             BLog(BLOG_WARNING, "missing destination");
             goto out;
         }
-        struct dataproto_peer_id id;
-        memcpy(&id, data, sizeof(id));
-        to_id = ltoh16(id.id);
-        data += sizeof(id);
-        data_len -= sizeof(id);
+        for (int i = 0; i < num_ids; i++) {
+            struct dataproto_peer_id id;
+            memcpy(&id, data, sizeof(id));
+            to_ids[i] = ltoh16(id.id);
+            data += sizeof(id);
+            data_len -= sizeof(id);
+        }
+    }
+    
+    // decompress frame
+    if ((flags & DATAPROTO_FLAGS_COMPRESSED)) {
+        int frame_len = lz4_decompress_block(data, data_len, device->decompress_buf, device->device_mtu);
+        if (frame_len < 0) {
+            BLog(BLOG_WARNING, "bad compressed frame");
+            goto out;
+        }
+        data = device->decompress_buf;
+        data_len = frame_len;
     }
     
     // check remaining data
@@ -105,25 +142,40 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
     }
     
     // inform sink of received packet
-    if (peer->dp_sink) {
-        DataProtoSink_Received(peer->dp_sink, !!(flags & DATAPROTO_FLAGS_RECEIVING_KEEPALIVES));
+    DataProtoSink *dp_sink = (o->dp_sink ? o->dp_sink : peer->dp_sink);
+    if (dp_sink) {
+        DataProtoSink_Received(dp_sink, !!(flags & DATAPROTO_FLAGS_RECEIVING_KEEPALIVES), !!(flags & DATAPROTO_FLAGS_ACCEPTS_COMPRESSED),
+                               !!(flags & DATAPROTO_FLAGS_ACCEPTS_COMPACT));
+        
+        // a packet without destinations is a keep-alive
+        if (num_ids == 0) {
+            DataProtoSink_ReceivedKeepalive(dp_sink, data, data_len);
+        }
     }
     
-    if (num_ids == 1) {
+    if (num_ids > 0) {
         // find source peer
         if (!(src_peer = find_peer(device, from_id))) {
             BLog(BLOG_INFO, "source peer %d not known", (int)from_id);
             goto out;
         }
         
-        // is frame for device or another peer?
-        if (device->have_peer_id && to_id == device->peer_id) {
-            // let the frame decider analyze the frame
-            FrameDeciderPeer_Analyze(src_peer->decider_peer, data, data_len);
+        for (int i = 0; i < num_ids; i++) {
+            // each destination must appear once
+            for (int j = 0; j < i; j++) {
+                if (to_ids[j] == to_ids[i]) {
+                    BLog(BLOG_WARNING, "duplicate destination");
+                    goto out;
+                }
+            }
+            
+            // is frame for device or another peer?
+            if (device->have_peer_id && to_ids[i] == device->peer_id) {
+                // pass frame to device
+                local = 1;
+                continue;
+            }
             
-            // pass frame to device
-            local = 1;
-        } else {
             // check if relaying is allowed
             if (!peer->is_relay_client) {
                 BLog(BLOG_WARNING, "relaying not allowed");
@@ -137,10 +189,10 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
             }
             
             // find destination peer
-            DPReceivePeer *dest_peer = find_peer(device, to_id);
+            DPReceivePeer *dest_peer = find_peer(device, to_ids[i]);
             if (!dest_peer) {
                 BLog(BLOG_INFO, "relay destination peer not known");
-                goto out;
+                continue;
             }
             
             // destination cannot be source
@@ -149,31 +201,44 @@ static void receiver_recv_handler_send (DPReceiveReceiver *o, uint8_t *packet, i
                 goto out;
             }
             
-            relay_dest_peer = dest_peer;
+            relay_sinks[num_relay_sinks++] = &dest_peer->relay_sink;
+        }
+        
+        if (local && src_peer->decider_peer) {
+            // let the frame decider analyze the frame
+            FrameDeciderPeer_Analyze(src_peer->decider_peer, data, data_len);
         }
     }
     
-out:
     // accept packet
     PacketPassInterface_Done(&o->recv_if);
     
     // pass packet to device
     if (local) {
+        src_peer->frame_received = 1;
         o->device->output_func(o->device->output_func_user, data, data_len);
     }
     
-    // relay frame
-    if (relay_dest_peer) {
-        DPRelayRouter_SubmitFrame(&device->relay_router, &src_peer->relay_source, &relay_dest_peer->relay_sink, data, data_len, device->relay_flow_buffer_size, device->relay_flow_inactivity_time);
+    BPacketTrace_Stamp(BPACKETTRACE_RECV, packet, (local ? BMETRICS_HISTOGRAM_TRACE_RECV_DEVICE_NS : BPACKETTRACE_NO_HISTOGRAM), NULL);
+    
+    // relay frame, to all destinations at once
+    if (num_relay_sinks > 0) {
+        DPRelayRouter_SubmitFrame(&device->relay_router, &src_peer->relay_source, relay_sinks, num_relay_sinks, data, data_len, device->relay_flow_buffer_size, device->relay_flow_inactivity_time);
     }
+    return;
+    
+out:
+    // accept packet
+    PacketPassInterface_Done(&o->recv_if);
 }
 
-int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_output_func output_func, void *output_func_user, BReactor *reactor, int relay_flow_buffer_size, int relay_flow_inactivity_time)
+int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_output_func output_func, void *output_func_user, BReactor *reactor, int relay_flow_buffer_size, int relay_pool_size, int relay_codel_target, int relay_codel_interval, int relay_flow_inactivity_time)
 {
     ASSERT(device_mtu >= 0)
     ASSERT(device_mtu <= INT_MAX - DATAPROTO_MAX_OVERHEAD)
     ASSERT(output_func)
     ASSERT(relay_flow_buffer_size > 0)
+    ASSERT(relay_pool_size >= 0)
     
     // init arguments
     o->device_mtu = device_mtu;
@@ -186,10 +251,16 @@ int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_ou
     // remember packet MTU
     o->packet_mtu = DATAPROTO_MAX_OVERHEAD + o->device_mtu;
     
+    // allocate buffer for decompressed frames
+    if (!(o->decompress_buf = (uint8_t *)BAlloc(o->device_mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    
     // init relay router
-    if (!DPRelayRouter_Init(&o->relay_router, o->device_mtu, o->reactor)) {
+    if (!DPRelayRouter_Init(&o->relay_router, o->device_mtu, relay_pool_size, relay_codel_target, relay_codel_interval, o->reactor)) {
         BLog(BLOG_ERROR, "DPRelayRouter_Init failed");
-        goto fail0;
+        goto fail1;
     }
     
     // have no peer ID
@@ -201,6 +272,8 @@ int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_ou
     DebugObject_Init(&o->d_obj);
     return 1;
     
+fail1:
+    BFree(o->decompress_buf);
 fail0:
     return 0;
 }
@@ -212,6 +285,9 @@ void DPReceiveDevice_Free (DPReceiveDevice *o)
     
     // free relay router
     DPRelayRouter_Free(&o->relay_router);
+    
+    // free buffer for decompressed frames
+    BFree(o->decompress_buf);
 }
 
 void DPReceiveDevice_SetPeerID (DPReceiveDevice *o, peerid_t peer_id)
@@ -243,6 +319,9 @@ void DPReceivePeer_Init (DPReceivePeer *o, DPReceiveDevice *device, peerid_t pee
     // have no sink
     o->dp_sink = NULL;
     
+    // no frame received yet
+    o->frame_received = 0;
+    
     // insert to peers list
     LinkedList1_Append(&device->peers_list, &o->list_node);
     
@@ -289,6 +368,18 @@ void DPReceivePeer_DetachSink (DPReceivePeer *o)
     o->dp_sink = NULL;
 }
 
+int DPReceivePeer_TakeFrameReceived (DPReceivePeer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // report if a frame from the peer was passed to the device since the
+    // last call, and start over
+    int received = o->frame_received;
+    o->frame_received = 0;
+    
+    return received;
+}
+
 void DPReceiveReceiver_Init (DPReceiveReceiver *o, DPReceivePeer *peer)
 {
     DebugObject_Access(&peer->d_obj);
@@ -300,6 +391,9 @@ void DPReceiveReceiver_Init (DPReceiveReceiver *o, DPReceivePeer *peer)
     // remember device
     o->device = device;
     
+    // use the peer's sink
+    o->dp_sink = NULL;
+    
     // init receive interface
     PacketPassInterface_Init(&o->recv_if, device->packet_mtu, (PacketPassInterface_handler_send)receiver_recv_handler_send, o, BReactor_PendingGroup(device->reactor));
     
@@ -322,3 +416,10 @@ PacketPassInterface * DPReceiveReceiver_GetInput (DPReceiveReceiver *o)
     
     return &o->recv_if;
 }
+
+void DPReceiveReceiver_SetSink (DPReceiveReceiver *o, DataProtoSink *dp_sink)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->dp_sink = dp_sink;
+}
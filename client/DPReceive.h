@@ -55,6 +55,7 @@ typedef struct {
     int relay_flow_buffer_size;
     int relay_flow_inactivity_time;
     int packet_mtu;
+    uint8_t *decompress_buf;
     DPRelayRouter relay_router;
     int have_peer_id;
     peerid_t peer_id;
@@ -70,6 +71,7 @@ typedef struct {
     DPRelaySource relay_source;
     DPRelaySink relay_sink;
     DataProtoSink *dp_sink;
+    int frame_received;
     LinkedList1Node list_node;
     DebugObject d_obj;
     DebugCounter d_receivers_ctr;
@@ -78,11 +80,12 @@ typedef struct {
 typedef struct DPReceiveReceiver_s {
     DPReceivePeer *peer;
     DPReceiveDevice *device;
+    DataProtoSink *dp_sink;
     PacketPassInterface recv_if;
     DebugObject d_obj;
 } DPReceiveReceiver;
 
-int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_output_func output_func, void *output_func_user, BReactor *reactor, int relay_flow_buffer_size, int relay_flow_inactivity_time) WARN_UNUSED;
+int DPReceiveDevice_Init (DPReceiveDevice *o, int device_mtu, DPReceiveDevice_output_func output_func, void *output_func_user, BReactor *reactor, int relay_flow_buffer_size, int relay_pool_size, int relay_codel_target, int relay_codel_interval, int relay_flow_inactivity_time) WARN_UNUSED;
 void DPReceiveDevice_Free (DPReceiveDevice *o);
 void DPReceiveDevice_SetPeerID (DPReceiveDevice *o, peerid_t peer_id);
 
@@ -90,9 +93,11 @@ void DPReceivePeer_Init (DPReceivePeer *o, DPReceiveDevice *device, peerid_t pee
 void DPReceivePeer_Free (DPReceivePeer *o);
 void DPReceivePeer_AttachSink (DPReceivePeer *o, DataProtoSink *dp_sink);
 void DPReceivePeer_DetachSink (DPReceivePeer *o);
+int DPReceivePeer_TakeFrameReceived (DPReceivePeer *o);
 
 void DPReceiveReceiver_Init (DPReceiveReceiver *o, DPReceivePeer *peer);
 void DPReceiveReceiver_Free (DPReceiveReceiver *o);
 PacketPassInterface * DPReceiveReceiver_GetInput (DPReceiveReceiver *o);
+void DPReceiveReceiver_SetSink (DPReceiveReceiver *o, DataProtoSink *dp_sink);
 
 #endif
@@ -54,8 +54,11 @@ static struct DPRelay_flow * create_flow (DPRelaySource *src, DPRelaySink *sink,
     flow->src = src;
     flow->sink = sink;
     
+    // buffer frames in the shared pool, if there is one
+    RouteBufferPool *pool = (src->router->have_pool ? &src->router->pool : NULL);
+    
     // init DataProtoFlow
-    if (!DataProtoFlow_Init(&flow->dp_flow, &src->router->dp_source, src->source_id, sink->dest_id, num_packets, inactivity_time, flow, (DataProtoFlow_handler_inactivity)flow_inactivity_handler)) {
+    if (!DataProtoFlow_Init(&flow->dp_flow, &src->router->dp_source, src->source_id, sink->dest_id, DATAPROTO_PRIORITY_NORMAL, num_packets, pool, src->router->codel_target, src->router->codel_interval, inactivity_time, flow, (DataProtoFlow_handler_inactivity)flow_inactivity_handler)) {
         BLog(BLOG_ERROR, "relay flow %d->%d: DataProtoFlow_Init failed", (int)src->source_id, (int)sink->dest_id);
         goto fail1;
     }
@@ -89,8 +92,11 @@ static void free_flow (struct DPRelay_flow *flow)
     }
     
     // remove posible router reference
-    if (flow->src->router->current_flow == flow) {
-        flow->src->router->current_flow = NULL;
+    DPRelayRouter *router = flow->src->router;
+    for (int i = 0; i < router->num_current_flows; i++) {
+        if (router->current_flows[i] == flow) {
+            router->current_flows[i] = NULL;
+        }
     }
     
     // remove from sink list
@@ -130,24 +136,40 @@ static void router_dp_source_handler (DPRelayRouter *o, const uint8_t *frame, in
 {
     DebugObject_Access(&o->d_obj);
     
-    if (!o->current_flow) {
-        return;
+    // find the last flow the frame goes to
+    int last = o->num_current_flows - 1;
+    while (last >= 0 && !o->current_flows[last]) {
+        last--;
     }
     
-    // route frame to current flow
-    DataProtoFlow_Route(&o->current_flow->dp_flow, 0);
+    // route frame to current flows
+    for (int i = 0; i <= last; i++) {
+        if (o->current_flows[i]) {
+            DataProtoFlow_Route(&o->current_flows[i]->dp_flow, (i < last));
+        }
+    }
     
-    // set no current flow
-    o->current_flow = NULL;
+    // set no current flows
+    o->num_current_flows = 0;
 }
 
-int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor)
+int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, int pool_size, int codel_target, int codel_interval, BReactor *reactor)
 {
     ASSERT(frame_mtu >= 0)
     ASSERT(frame_mtu <= INT_MAX - DATAPROTO_MAX_OVERHEAD)
+    ASSERT(pool_size >= 0)
+    ASSERT(!(codel_target > 0) || codel_interval > 0)
     
     // init arguments
     o->frame_mtu = frame_mtu;
+    o->codel_target = codel_target;
+    o->codel_interval = codel_interval;
+    
+    // init pool, so that idle flows don't hold packets of their own
+    o->have_pool = (pool_size > 0);
+    if (o->have_pool) {
+        RouteBufferPool_Init(&o->pool, DATAPROTO_MAX_OVERHEAD + frame_mtu, pool_size);
+    }
     
     // init BufferWriter
     BufferWriter_Init(&o->writer, frame_mtu, BReactor_PendingGroup(reactor));
@@ -158,8 +180,8 @@ int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor)
         goto fail1;
     }
     
-    // have no current flow
-    o->current_flow = NULL;
+    // have no current flows
+    o->num_current_flows = 0;
     
     DebugCounter_Init(&o->d_ctr);
     DebugObject_Init(&o->d_obj);
@@ -167,6 +189,9 @@ int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor)
     
 fail1:
     BufferWriter_Free(&o->writer);
+    if (o->have_pool) {
+        RouteBufferPool_Free(&o->pool);
+    }
     return 0;
 }
 
@@ -174,22 +199,32 @@ void DPRelayRouter_Free (DPRelayRouter *o)
 {
     DebugObject_Free(&o->d_obj);
     DebugCounter_Free(&o->d_ctr);
-    ASSERT(!o->current_flow) // have no sources
+    
+    // have no sources, so current flows were removed
+    for (int i = 0; i < o->num_current_flows; i++) {
+        ASSERT(!o->current_flows[i])
+    }
     
     // free DataProtoSource
     DataProtoSource_Free(&o->dp_source);
     
     // free BufferWriter
     BufferWriter_Free(&o->writer);
+    
+    // free pool
+    if (o->have_pool) {
+        RouteBufferPool_Free(&o->pool);
+    }
 }
 
-void DPRelayRouter_SubmitFrame (DPRelayRouter *o, DPRelaySource *src, DPRelaySink *sink, uint8_t *data, int data_len, int num_packets, int inactivity_time)
+void DPRelayRouter_SubmitFrame (DPRelayRouter *o, DPRelaySource *src, DPRelaySink **sinks, int num_sinks, uint8_t *data, int data_len, int num_packets, int inactivity_time)
 {
     DebugObject_Access(&o->d_obj);
     DebugObject_Access(&src->d_obj);
-    DebugObject_Access(&sink->d_obj);
-    ASSERT(!o->current_flow)
+    ASSERT(o->num_current_flows == 0)
     ASSERT(src->router == o)
+    ASSERT(num_sinks > 0)
+    ASSERT(num_sinks <= DATAPROTO_MAX_PEER_IDS)
     ASSERT(data_len >= 0)
     ASSERT(data_len <= o->frame_mtu)
     ASSERT(num_packets > 0)
@@ -197,27 +232,32 @@ void DPRelayRouter_SubmitFrame (DPRelayRouter *o, DPRelaySource *src, DPRelaySin
     // get memory location
     uint8_t *out;
     if (!BufferWriter_StartPacket(&o->writer, &out)) {
-        BLog(BLOG_ERROR, "BufferWriter_StartPacket failed for frame %d->%d !?", (int)src->source_id, (int)sink->dest_id);
+        BLog(BLOG_ERROR, "BufferWriter_StartPacket failed for frame from %d !?", (int)src->source_id);
         return;
     }
     
-    // write frame
+    // write frame, once for all destinations
     memcpy(out, data, data_len);
     
     // submit frame
     BufferWriter_EndPacket(&o->writer, data_len);
     
-    // get a flow
+    // get flows
     // this comes _after_ writing the packet, in case flow initialization schedules jobs
-    struct DPRelay_flow *flow = source_find_flow(src, sink);
-    if (!flow) {
-        if (!(flow = create_flow(src, sink, num_packets, inactivity_time))) {
-            return;
+    for (int i = 0; i < num_sinks; i++) {
+        DPRelaySink *sink = sinks[i];
+        DebugObject_Access(&sink->d_obj);
+        
+        struct DPRelay_flow *flow = source_find_flow(src, sink);
+        if (!flow) {
+            if (!(flow = create_flow(src, sink, num_packets, inactivity_time))) {
+                continue;
+            }
         }
+        
+        // remember flow so we know where to route the frame in router_dp_source_handler
+        o->current_flows[o->num_current_flows++] = flow;
     }
-    
-    // remember flow so we know where to route the frame in router_dp_source_handler
-    o->current_flow = flow;
 }
 
 void DPRelaySource_Init (DPRelaySource *o, DPRelayRouter *router, peerid_t source_id, BReactor *reactor)
@@ -45,9 +45,14 @@ struct DPRelay_flow;
 
 typedef struct {
     int frame_mtu;
+    int have_pool;
+    RouteBufferPool pool;
+    int codel_target;
+    int codel_interval;
     BufferWriter writer;
     DataProtoSource dp_source;
-    struct DPRelay_flow *current_flow;
+    struct DPRelay_flow *current_flows[DATAPROTO_MAX_PEER_IDS];
+    int num_current_flows;
     DebugObject d_obj;
     DebugCounter d_ctr;
 } DPRelayRouter;
@@ -74,9 +79,9 @@ struct DPRelay_flow {
     LinkedList1Node sink_list_node;
 };
 
-int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, BReactor *reactor) WARN_UNUSED;
+int DPRelayRouter_Init (DPRelayRouter *o, int frame_mtu, int pool_size, int codel_target, int codel_interval, BReactor *reactor) WARN_UNUSED;
 void DPRelayRouter_Free (DPRelayRouter *o);
-void DPRelayRouter_SubmitFrame (DPRelayRouter *o, DPRelaySource *src, DPRelaySink *sink, uint8_t *data, int data_len, int num_packets, int inactivity_time);
+void DPRelayRouter_SubmitFrame (DPRelayRouter *o, DPRelaySource *src, DPRelaySink **sinks, int num_sinks, uint8_t *data, int data_len, int num_packets, int inactivity_time);
 
 void DPRelaySource_Init (DPRelaySource *o, DPRelayRouter *router, peerid_t source_id, BReactor *reactor);
 void DPRelaySource_Free (DPRelaySource *o);
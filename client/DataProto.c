@@ -33,15 +33,27 @@
 
 #include <protocol/dataproto.h>
 #include <misc/byteorder.h>
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/lz4.h>
 #include <base/BLog.h>
+#include <base/BPacketTrace.h>
 
 #include <client/DataProto.h>
 
 #include <generated/blog_channel_DataProto.h>
 
-static void monitor_handler (DataProtoSink *o);
+static void keepalive_timer_handler (DataProtoKeepaliveTimer *o);
+static void keepalive_due (DataProtoSink *o);
+static void fill_keepalive (DataProtoSink *o, uint8_t *data);
 static void refresh_up_job (DataProtoSink *o);
+static btime_t receive_timeout (DataProtoSink *o);
 static void receive_timer_handler (DataProtoSink *o);
+static int stage_packet (DataProtoSink *o, uint8_t *data, int data_len, const uint8_t *trace_data, struct PacketPassInterface_buf *out_bufs);
+static void stage_input_handler_send (DataProtoSink *o, uint8_t *data, int data_len);
+static void stage_input_handler_sendv (DataProtoSink *o, const struct PacketPassInterface_buf *bufs, int num_bufs);
+static void stage_input_handler_requestcancel (DataProtoSink *o);
+static void stage_output_handler_done (DataProtoSink *o);
 static void notifier_handler (DataProtoSink *o, uint8_t *data, int data_len);
 static void up_job_handler (DataProtoSink *o);
 static void flow_buffer_free (struct DataProtoFlow_buffer *b);
@@ -51,14 +63,66 @@ static void flow_buffer_schedule_detach (struct DataProtoFlow_buffer *b);
 static void flow_buffer_finish_detach (struct DataProtoFlow_buffer *b);
 static void flow_buffer_qflow_handler_busy (struct DataProtoFlow_buffer *b);
 
-void monitor_handler (DataProtoSink *o)
+void keepalive_timer_handler (DataProtoKeepaliveTimer *o)
 {
     DebugObject_Access(&o->d_obj);
+    ASSERT(o->num_sinks > 0)
+    
+    // restart timer
+    BReactor_SetTimer(o->reactor, &o->timer);
+    
+    // move to the next batch
+    o->cur_slot = (o->cur_slot + 1) % DATAPROTO_KEEPALIVE_TIMER_SLOTS;
+    
+    // the sinks in the batch are due; this only schedules sending,
+    // so sinks cannot go away while we are iterating
+    for (LinkedList1Node *n = LinkedList1_GetFirst(&o->slots[o->cur_slot]); n; n = LinkedList1Node_Next(n)) {
+        DataProtoSink *sink = UPPER_OBJECT(n, DataProtoSink, ka_timer_node);
+        keepalive_due(sink);
+    }
+}
+
+void keepalive_due (DataProtoSink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // recent data already tells the peer we are alive, but keep sending
+    // a keep-alive now and then to keep measuring the link
+    btime_t now = BReactor_GetTime(o->reactor);
+    if (o->ka_have_data && now - o->ka_last_data < o->ka_timer->keepalive_time / 2 && o->ka_skipped < DATAPROTO_KEEPALIVE_MAX_SKIP) {
+        o->ka_skipped++;
+        return;
+    }
+    
+    o->ka_skipped = 0;
     
     // send keep-alive
     PacketRecvBlocker_AllowBlockedPacket(&o->ka_blocker);
 }
 
+void fill_keepalive (DataProtoSink *o, uint8_t *data)
+{
+    uint32_t now = btime_gettime();
+    
+    struct dataproto_keepalive ka;
+    ka.seq = htol32(++o->ka_send_seq);
+    ka.time = htol32(now);
+    ka.recv_count = htol32(o->ka_recv_count);
+    
+    // echo the last keep-alive received
+    if (o->ka_have_recv) {
+        ka.echo_seq = htol32(o->ka_recv_seq);
+        ka.echo_time = htol32(o->ka_recv_peer_time);
+        ka.echo_delay = htol32(now - o->ka_recv_time);
+    } else {
+        ka.echo_seq = htol32(0);
+        ka.echo_time = htol32(0);
+        ka.echo_delay = htol32(DATAPROTO_KEEPALIVE_NO_ECHO);
+    }
+    
+    memcpy(data, &ka, sizeof(ka));
+}
+
 void refresh_up_job (DataProtoSink *o)
 {
     if (o->up != o->up_report) {
@@ -68,33 +132,231 @@ void refresh_up_job (DataProtoSink *o)
     }
 }
 
+btime_t receive_timeout (DataProtoSink *o)
+{
+    btime_t timeout = o->tolerance_time;
+    
+    // give keep-alives on slow or jittery links more time to arrive
+    if (o->quality.have_rtt) {
+        timeout += o->quality.rtt + 4 * (btime_t)o->quality.jitter;
+        if (timeout > 2 * o->tolerance_time) {
+            timeout = 2 * o->tolerance_time;
+        }
+    }
+    
+    return timeout;
+}
+
 void receive_timer_handler (DataProtoSink *o)
 {
     DebugObject_Access(&o->d_obj);
     
+    // if something was received since the timer was set, wait for the rest of the timeout
+    btime_t deadline = btime_add(o->last_receive, receive_timeout(o));
+    if (deadline > BReactor_GetTime(o->reactor)) {
+        BReactor_SetTimerAbsolute(o->reactor, &o->receive_timer, deadline);
+        return;
+    }
+    
     // consider down
     o->up = 0;
     
     refresh_up_job(o);
 }
 
+int stage_packet (DataProtoSink *o, uint8_t *data, int data_len, const uint8_t *trace_data, struct PacketPassInterface_buf *out_bufs)
+{
+    ASSERT(o->compress || o->compact)
+    ASSERT(data_len >= sizeof(struct dataproto_header))
+    
+    struct dataproto_header header;
+    memcpy(&header, data, sizeof(header));
+    int num_ids = ltoh16(header.num_peer_ids);
+    int head_len = sizeof(header) + num_ids * sizeof(struct dataproto_peer_id);
+    ASSERT(data_len >= head_len)
+    uint8_t *frame = data + head_len;
+    int frame_len = data_len - head_len;
+    
+    // keep-alives are sent as they are
+    if (num_ids == 0) {
+        return 0;
+    }
+    
+    // frames from us to just the peer at the other end of the link can
+    // leave out the header, once the peer accepts that
+    int compact = 0;
+    if (o->compact && o->compact_peer_accepts && num_ids == 1 && ltoh16(header.from_id) == o->compact_local_id) {
+        struct dataproto_peer_id id;
+        memcpy(&id, data + sizeof(header), sizeof(id));
+        compact = (ltoh16(id.id) == o->compact_peer_id);
+    }
+    int out_head_len = (compact ? DATAPROTO_COMPACT_HEADER_LEN : head_len);
+    
+    // compress frames once the peer accepts that, giving up as soon as it's
+    // clear that too little would be saved; incompressible frames are then
+    // sent as they are
+    int comp_len = -1;
+    if (o->compress && o->compress_peer_accepts && frame_len >= DATAPROTO_COMPRESS_MIN_FRAME && frame_len <= LZ4_MAX_INPUT) {
+        comp_len = lz4_compress_block(frame, frame_len, o->stage_buf + out_head_len, frame_len - frame_len / 16 - 1);
+        o->compression.frame_bytes += frame_len;
+        o->compression.sent_bytes += (comp_len < 0 ? frame_len : comp_len);
+    }
+    
+    if (!compact && comp_len < 0) {
+        return 0;
+    }
+    
+    o->stage_compressed = (comp_len >= 0);
+    o->stage_compact = compact;
+    
+    // write header; the notifier fills in the flags
+    if (compact) {
+        o->stage_buf[0] = 0;
+    } else {
+        memcpy(o->stage_buf, data, head_len);
+    }
+    
+    if (comp_len < 0) {
+        // the frame follows the compact header from where it is
+        o->stage_frame = trace_data + head_len;
+        out_bufs[0].data = o->stage_buf;
+        out_bufs[0].len = DATAPROTO_COMPACT_HEADER_LEN;
+        out_bufs[1].data = frame;
+        out_bufs[1].len = frame_len;
+        return 2;
+    }
+    
+    // the frame now continues in our buffer
+    o->stage_frame = o->stage_buf + out_head_len;
+    BPacketTrace_Stamp(BPACKETTRACE_SEND, trace_data + head_len, BPACKETTRACE_NO_HISTOGRAM, o->stage_frame);
+    
+    out_bufs[0].data = o->stage_buf;
+    out_bufs[0].len = out_head_len + comp_len;
+    return 1;
+}
+
+void stage_input_handler_send (DataProtoSink *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->compress || o->compact)
+    
+    o->stage_compressed = 0;
+    o->stage_compact = 0;
+    
+    struct PacketPassInterface_buf out_bufs[2];
+    int num_out = stage_packet(o, data, data_len, data, out_bufs);
+    if (num_out > 0) {
+        PacketPassInterface_Sender_SendV(PacketPassNotifier_GetInput(&o->notifier), out_bufs, num_out);
+        return;
+    }
+    
+    PacketPassInterface_Sender_Send(PacketPassNotifier_GetInput(&o->notifier), data, data_len);
+}
+
+void stage_input_handler_sendv (DataProtoSink *o, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->compress || o->compact)
+    ASSERT(num_bufs > 0)
+    
+    o->stage_compressed = 0;
+    o->stage_compact = 0;
+    
+    int data_len = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        data_len += bufs[i].len;
+    }
+    
+    // gather packets which the stage may change, and process them
+    if ((o->compress && o->compress_peer_accepts && data_len >= sizeof(struct dataproto_header) + DATAPROTO_COMPRESS_MIN_FRAME) ||
+        (o->compact && o->compact_peer_accepts)
+    ) {
+        int pos = 0;
+        for (int i = 0; i < num_bufs; i++) {
+            memcpy(o->stage_gather_buf + pos, bufs[i].data, bufs[i].len);
+            pos += bufs[i].len;
+        }
+        
+        struct PacketPassInterface_buf out_bufs[2];
+        int num_out = stage_packet(o, o->stage_gather_buf, data_len, bufs[0].data, out_bufs);
+        if (num_out > 0) {
+            PacketPassInterface_Sender_SendV(PacketPassNotifier_GetInput(&o->notifier), out_bufs, num_out);
+            return;
+        }
+    }
+    
+    PacketPassInterface_Sender_SendV(PacketPassNotifier_GetInput(&o->notifier), bufs, num_bufs);
+}
+
+void stage_input_handler_requestcancel (DataProtoSink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->compress || o->compact)
+    
+    PacketPassInterface_Sender_RequestCancel(PacketPassNotifier_GetInput(&o->notifier));
+}
+
+void stage_output_handler_done (DataProtoSink *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->compress || o->compact)
+    
+    PacketPassInterface_Done(&o->stage_input);
+}
+
 void notifier_handler (DataProtoSink *o, uint8_t *data, int data_len)
 {
     DebugObject_Access(&o->d_obj);
-    ASSERT(data_len >= sizeof(struct dataproto_header))
+    ASSERT(data_len >= DATAPROTO_COMPACT_HEADER_LEN)
     
-    int flags = 0;
+    // we can always decompress and take compact headers
+    int flags = DATAPROTO_FLAGS_ACCEPTS_COMPRESSED | DATAPROTO_FLAGS_ACCEPTS_COMPACT;
     
     // if we are receiving keepalives, set the flag
     if (BTimer_IsRunning(&o->receive_timer)) {
         flags |= DATAPROTO_FLAGS_RECEIVING_KEEPALIVES;
     }
     
+    // if the stage compressed the frame, set the flag
+    if (o->stage_compressed) {
+        flags |= DATAPROTO_FLAGS_COMPRESSED;
+    }
+    
+    // a compact header is just the flags
+    if (o->stage_compact) {
+        data[0] = hton8(flags | DATAPROTO_FLAGS_COMPACT);
+        
+        // the frame is leaving for the peer
+        BPacketTrace_Stamp(BPACKETTRACE_SEND, o->stage_frame, BMETRICS_HISTOGRAM_TRACE_SEND_SINK_NS, data);
+        
+        // remember when data was last sent, to skip keep-alives
+        o->ka_have_data = 1;
+        o->ka_last_data = BReactor_GetTime(o->reactor);
+        return;
+    }
+    
+    ASSERT(data_len >= sizeof(struct dataproto_header))
+    
     // modify existing packet here
     struct dataproto_header header;
     memcpy(&header, data, sizeof(header));
     header.flags = hton8(flags);
     memcpy(data, &header, sizeof(header));
+    
+    // the frame is leaving for the peer
+    uint8_t *frame = data + sizeof(header) + ltoh16(header.num_peer_ids) * sizeof(struct dataproto_peer_id);
+    BPacketTrace_Stamp(BPACKETTRACE_SEND, frame, BMETRICS_HISTOGRAM_TRACE_SEND_SINK_NS, data);
+    
+    // fill in keep-alives as they are sent, so that the echoed delay is right
+    if (ltoh16(header.num_peer_ids) == 0 && data_len == sizeof(header) + sizeof(struct dataproto_keepalive)) {
+        fill_keepalive(o, data + sizeof(header));
+    }
+    
+    // remember when data was last sent, to skip keep-alives
+    if (ltoh16(header.num_peer_ids) > 0) {
+        o->ka_have_data = 1;
+        o->ka_last_data = BReactor_GetTime(o->reactor);
+    }
 }
 
 void up_job_handler (DataProtoSink *o)
@@ -119,6 +381,8 @@ void source_router_handler (DataProtoSource *o, uint8_t *buf, int recv_len)
     o->current_buf = buf;
     o->current_recv_len = recv_len;
     
+    BPacketTrace_Stamp(BPACKETTRACE_SEND, buf + DATAPROTO_MAX_OVERHEAD, BMETRICS_HISTOGRAM_TRACE_SEND_SOURCE_NS, buf + DATAPROTO_MAX_OVERHEAD);
+    
     // call handler
     o->handler(o->user, buf + DATAPROTO_MAX_OVERHEAD, recv_len);
     return;
@@ -131,6 +395,11 @@ void flow_buffer_free (struct DataProtoFlow_buffer *b)
     // free route buffer
     RouteBuffer_Free(&b->rbuf);
     
+    // free CoDel
+    if (b->codel_target > 0) {
+        PacketPassCoDel_Free(&b->codel);
+    }
+    
     // free inactivity monitor
     if (b->inactivity_time >= 0) {
         PacketPassInactivityMonitor_Free(&b->monitor);
@@ -147,8 +416,8 @@ void flow_buffer_attach (struct DataProtoFlow_buffer *b, DataProtoSink *sink)
 {
     ASSERT(!b->sink)
     
-    // init queue flow
-    PacketPassFairQueueFlow_Init(&b->sink_qflow, &sink->queue);
+    // init queue flow in the queue of the flow's class
+    PacketPassFairQueueFlow_Init(&b->sink_qflow, &sink->class_queues[b->priority]);
     
     // connect to queue flow
     PacketPassConnector_ConnectOutput(&b->connector, PacketPassFairQueueFlow_GetInput(&b->sink_qflow));
@@ -224,13 +493,55 @@ void flow_buffer_qflow_handler_busy (struct DataProtoFlow_buffer *b)
     flow_buffer_finish_detach(b);
 }
 
-int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, btime_t keepalive_time, btime_t tolerance_time, DataProtoSink_handler handler, void *user)
+void DataProtoKeepaliveTimer_Init (DataProtoKeepaliveTimer *o, BReactor *reactor, btime_t keepalive_time)
+{
+    ASSERT(keepalive_time > 0)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->keepalive_time = keepalive_time;
+    
+    // init timer, ticking through all batches every keepalive_time
+    btime_t tick = keepalive_time / DATAPROTO_KEEPALIVE_TIMER_SLOTS;
+    BTimer_Init(&o->timer, (tick > 0 ? tick : 1), (BTimer_handler)keepalive_timer_handler, o);
+    
+    // init batches
+    for (int i = 0; i < DATAPROTO_KEEPALIVE_TIMER_SLOTS; i++) {
+        LinkedList1_Init(&o->slots[i]);
+    }
+    o->cur_slot = 0;
+    o->next_slot = 0;
+    
+    // set no sinks
+    o->num_sinks = 0;
+    
+    DebugCounter_Init(&o->d_ctr);
+    DebugObject_Init(&o->d_obj);
+}
+
+void DataProtoKeepaliveTimer_Free (DataProtoKeepaliveTimer *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Free(&o->d_ctr);
+    ASSERT(o->num_sinks == 0)
+}
+
+int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, DataProtoKeepaliveTimer *ka_timer, btime_t tolerance_time, int compress,
+                        int compact, peerid_t local_id, peerid_t peer_id, DataProtoSink_handler handler, void *user)
 {
     ASSERT(PacketPassInterface_HasCancel(output))
+    ASSERT(PacketPassInterface_HasSendV(output))
     ASSERT(PacketPassInterface_GetMTU(output) >= DATAPROTO_MAX_OVERHEAD)
+    ASSERT(PacketPassInterface_GetMTU(output) >= sizeof(struct dataproto_header) + sizeof(struct dataproto_keepalive))
+    ASSERT(compress == 0 || compress == 1)
+    ASSERT(compact == 0 || compact == 1)
     
     // init arguments
     o->reactor = reactor;
+    o->compress = compress;
+    o->compact = compact;
+    o->compact_local_id = local_id;
+    o->compact_peer_id = peer_id;
     o->handler = handler;
     o->user = user;
     
@@ -241,18 +552,47 @@ int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface
     PacketPassNotifier_Init(&o->notifier, output, BReactor_PendingGroup(o->reactor));
     PacketPassNotifier_SetHandler(&o->notifier, (PacketPassNotifier_handler_notify)notifier_handler, o);
     
-    // init monitor
-    PacketPassInactivityMonitor_Init(&o->monitor, PacketPassNotifier_GetInput(&o->notifier), o->reactor, keepalive_time, (PacketPassInactivityMonitor_handler)monitor_handler, o);
-    PacketPassInactivityMonitor_Force(&o->monitor);
-    
-    // init queue
-    if (!PacketPassFairQueue_Init(&o->queue, PacketPassInactivityMonitor_GetInput(&o->monitor), BReactor_PendingGroup(o->reactor), 1, 1)) {
-        BLog(BLOG_ERROR, "PacketPassFairQueue_Init failed");
-        goto fail1;
+    // init compression and compact header stage in front of the notifier
+    PacketPassInterface *queue_output = PacketPassNotifier_GetInput(&o->notifier);
+    if (o->compress || o->compact) {
+        if (!(o->stage_buf = (uint8_t *)BAlloc(PacketPassInterface_GetMTU(output)))) {
+            BLog(BLOG_ERROR, "BAlloc failed");
+            goto fail0;
+        }
+        if (!(o->stage_gather_buf = (uint8_t *)BAlloc(PacketPassInterface_GetMTU(output)))) {
+            BLog(BLOG_ERROR, "BAlloc failed");
+            BFree(o->stage_buf);
+            goto fail0;
+        }
+        PacketPassInterface_Init(&o->stage_input, PacketPassInterface_GetMTU(output), (PacketPassInterface_handler_send)stage_input_handler_send, o, BReactor_PendingGroup(o->reactor));
+        PacketPassInterface_EnableCancel(&o->stage_input, (PacketPassInterface_handler_requestcancel)stage_input_handler_requestcancel);
+        PacketPassInterface_EnableSendV(&o->stage_input, (PacketPassInterface_handler_sendv)stage_input_handler_sendv);
+        PacketPassInterface_Sender_Init(PacketPassNotifier_GetInput(&o->notifier), (PacketPassInterface_handler_done)stage_output_handler_done, o);
+        queue_output = &o->stage_input;
+    }
+    o->compress_peer_accepts = 0;
+    o->compact_peer_accepts = 0;
+    o->stage_compressed = 0;
+    o->stage_compact = 0;
+    o->compression.frame_bytes = 0;
+    o->compression.sent_bytes = 0;
+    
+    // init priority queue
+    PacketPassPriorityQueue_InitLevels(&o->queue, queue_output, BReactor_PendingGroup(o->reactor), 1, DATAPROTO_NUM_PRIORITIES);
+    
+    // init class queues, each fair among the flows of its class
+    int num_classes;
+    for (num_classes = 0; num_classes < DATAPROTO_NUM_PRIORITIES; num_classes++) {
+        PacketPassPriorityQueueFlow_Init(&o->class_qflows[num_classes], &o->queue, num_classes);
+        if (!PacketPassFairQueue_Init(&o->class_queues[num_classes], PacketPassPriorityQueueFlow_GetInput(&o->class_qflows[num_classes]), BReactor_PendingGroup(o->reactor), 1, 1)) {
+            BLog(BLOG_ERROR, "PacketPassFairQueue_Init failed");
+            PacketPassPriorityQueueFlow_Free(&o->class_qflows[num_classes]);
+            goto fail1;
+        }
     }
     
     // init keepalive queue flow
-    PacketPassFairQueueFlow_Init(&o->ka_qflow, &o->queue);
+    PacketPassFairQueueFlow_Init(&o->ka_qflow, &o->class_queues[DATAPROTO_PRIORITY_HIGH]);
     
     // init keepalive source
     DataProtoKeepaliveSource_Init(&o->ka_source, BReactor_PendingGroup(o->reactor));
@@ -266,7 +606,33 @@ int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface
         goto fail2;
     }
     
+    // join a batch of the keep-alive timer, spreading sinks over the batches
+    o->ka_timer = ka_timer;
+    o->ka_slot = ka_timer->next_slot;
+    ka_timer->next_slot = (ka_timer->next_slot + 1) % DATAPROTO_KEEPALIVE_TIMER_SLOTS;
+    LinkedList1_Append(&ka_timer->slots[o->ka_slot], &o->ka_timer_node);
+    if (ka_timer->num_sinks++ == 0) {
+        BReactor_SetTimer(o->reactor, &ka_timer->timer);
+    }
+    DebugCounter_Increment(&ka_timer->d_ctr);
+    
+    // set no data sent
+    o->ka_have_data = 0;
+    o->ka_skipped = 0;
+    
+    // send the first keep-alive right away
+    PacketRecvBlocker_AllowBlockedPacket(&o->ka_blocker);
+    
+    // init keep-alive measurement state
+    o->ka_send_seq = 0;
+    o->ka_have_recv = 0;
+    o->ka_recv_count = 0;
+    o->ka_have_echo = 0;
+    o->quality.have_rtt = 0;
+    o->quality.loss = 0;
+    
     // init receive timer
+    o->tolerance_time = tolerance_time;
     BTimer_Init(&o->receive_timer, tolerance_time, (BTimer_handler)receive_timer_handler, o);
     
     // init handler job
@@ -287,9 +653,18 @@ fail2:
     PacketRecvBlocker_Free(&o->ka_blocker);
     DataProtoKeepaliveSource_Free(&o->ka_source);
     PacketPassFairQueueFlow_Free(&o->ka_qflow);
-    PacketPassFairQueue_Free(&o->queue);
 fail1:
-    PacketPassInactivityMonitor_Free(&o->monitor);
+    while (num_classes-- > 0) {
+        PacketPassFairQueue_Free(&o->class_queues[num_classes]);
+        PacketPassPriorityQueueFlow_Free(&o->class_qflows[num_classes]);
+    }
+    PacketPassPriorityQueue_Free(&o->queue);
+    if (o->compress || o->compact) {
+        PacketPassInterface_Free(&o->stage_input);
+        BFree(o->stage_gather_buf);
+        BFree(o->stage_buf);
+    }
+fail0:
     PacketPassNotifier_Free(&o->notifier);
     return 0;
 }
@@ -300,7 +675,10 @@ void DataProtoSink_Free (DataProtoSink *o)
     DebugCounter_Free(&o->d_ctr);
     
     // allow freeing queue flows
-    PacketPassFairQueue_PrepareFree(&o->queue);
+    for (int i = 0; i < DATAPROTO_NUM_PRIORITIES; i++) {
+        PacketPassFairQueue_PrepareFree(&o->class_queues[i]);
+    }
+    PacketPassPriorityQueue_PrepareFree(&o->queue);
     
     // release detaching buffer
     if (o->detaching_buffer) {
@@ -314,6 +692,13 @@ void DataProtoSink_Free (DataProtoSink *o)
     // free receive timer
     BReactor_RemoveTimer(o->reactor, &o->receive_timer);
     
+    // leave keep-alive timer
+    DebugCounter_Decrement(&o->ka_timer->d_ctr);
+    LinkedList1_Remove(&o->ka_timer->slots[o->ka_slot], &o->ka_timer_node);
+    if (--o->ka_timer->num_sinks == 0) {
+        BReactor_RemoveTimer(o->reactor, &o->ka_timer->timer);
+    }
+    
     // free keepalive buffer
     SinglePacketBuffer_Free(&o->ka_buffer);
     
@@ -326,23 +711,44 @@ void DataProtoSink_Free (DataProtoSink *o)
     // free keepalive queue flow
     PacketPassFairQueueFlow_Free(&o->ka_qflow);
     
-    // free queue
-    PacketPassFairQueue_Free(&o->queue);
+    // free class queues
+    for (int i = 0; i < DATAPROTO_NUM_PRIORITIES; i++) {
+        PacketPassFairQueue_Free(&o->class_queues[i]);
+        PacketPassPriorityQueueFlow_Free(&o->class_qflows[i]);
+    }
     
-    // free monitor
-    PacketPassInactivityMonitor_Free(&o->monitor);
+    // free priority queue
+    PacketPassPriorityQueue_Free(&o->queue);
+    
+    // free compression and compact header stage
+    if (o->compress || o->compact) {
+        PacketPassInterface_Free(&o->stage_input);
+        BFree(o->stage_gather_buf);
+        BFree(o->stage_buf);
+    }
     
     // free notifier
     PacketPassNotifier_Free(&o->notifier);
 }
 
-void DataProtoSink_Received (DataProtoSink *o, int peer_receiving)
+void DataProtoSink_Received (DataProtoSink *o, int peer_receiving, int peer_accepts_compressed, int peer_accepts_compact)
 {
     ASSERT(peer_receiving == 0 || peer_receiving == 1)
+    ASSERT(peer_accepts_compressed == 0 || peer_accepts_compressed == 1)
+    ASSERT(peer_accepts_compact == 0 || peer_accepts_compact == 1)
     DebugObject_Access(&o->d_obj);
     
-    // reset receive timer
-    BReactor_SetTimer(o->reactor, &o->receive_timer);
+    // compress frames and use compact headers from now on if we're
+    // configured to and the peer accepts them
+    o->compress_peer_accepts = peer_accepts_compressed;
+    o->compact_peer_accepts = peer_accepts_compact;
+    
+    // remember the time instead of resetting the receive timer for every packet;
+    // the timer checks it when it expires
+    o->last_receive = BReactor_GetTime(o->reactor);
+    if (!BTimer_IsRunning(&o->receive_timer)) {
+        BReactor_SetTimerAfter(o->reactor, &o->receive_timer, receive_timeout(o));
+    }
     
     if (!peer_receiving) {
         // peer reports not receiving, consider down
@@ -357,6 +763,87 @@ void DataProtoSink_Received (DataProtoSink *o, int peer_receiving)
     refresh_up_job(o);
 }
 
+void DataProtoSink_ReceivedKeepalive (DataProtoSink *o, const uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // keep-alives from older peers carry no payload
+    if (data_len < sizeof(struct dataproto_keepalive)) {
+        return;
+    }
+    
+    struct dataproto_keepalive ka;
+    memcpy(&ka, data, sizeof(ka));
+    
+    uint32_t now = btime_gettime();
+    uint32_t seq = ltoh32(ka.seq);
+    uint32_t echo_seq = ltoh32(ka.echo_seq);
+    uint32_t echo_delay = ltoh32(ka.echo_delay);
+    uint32_t recv_count = ltoh32(ka.recv_count);
+    
+    // remember keep-alive so we can echo it
+    o->ka_have_recv = 1;
+    o->ka_recv_seq = seq;
+    o->ka_recv_peer_time = ltoh32(ka.time);
+    o->ka_recv_time = now;
+    o->ka_recv_count++;
+    
+    if (echo_delay == DATAPROTO_KEEPALIVE_NO_ECHO || echo_seq == 0 || echo_seq > o->ka_send_seq) {
+        return;
+    }
+    
+    // only use echoes of keep-alives newer than the last one measured
+    if (o->ka_have_echo && echo_seq <= o->ka_echo_seq) {
+        return;
+    }
+    
+    // compute round trip time, excluding the time the peer held the keep-alive
+    uint32_t rtt = now - ltoh32(ka.echo_time) - echo_delay;
+    if (rtt <= DATAPROTO_KEEPALIVE_MAX_RTT) {
+        // smooth like TCP does (RFC 6298), keeping the averages scaled
+        // by 8 and 4 so that small differences are not lost
+        if (!o->quality.have_rtt) {
+            o->quality.have_rtt = 1;
+            o->ka_srtt8 = 8 * rtt;
+            o->ka_rttvar4 = 2 * rtt;
+        } else {
+            int diff = (int)rtt - o->ka_srtt8 / 8;
+            o->ka_rttvar4 += (diff < 0 ? -diff : diff) - o->ka_rttvar4 / 4;
+            o->ka_srtt8 += diff;
+        }
+        o->quality.rtt = o->ka_srtt8 / 8;
+        o->quality.jitter = o->ka_rttvar4 / 4;
+    }
+    
+    // estimate loss from how many of our keep-alives sent since the last
+    // echo the peer reports having received
+    if (o->ka_have_echo) {
+        uint32_t sent = echo_seq - o->ka_echo_seq;
+        uint32_t got = recv_count - o->ka_echo_count;
+        int sample = (got >= sent ? 0 : (int)((uint64_t)(sent - got) * 1000 / sent));
+        o->quality.loss = (7 * o->quality.loss + sample) / 8;
+    }
+    
+    o->ka_have_echo = 1;
+    o->ka_echo_seq = echo_seq;
+    o->ka_echo_count = recv_count;
+}
+
+void DataProtoSink_GetQuality (DataProtoSink *o, struct DataProtoSink_quality *out)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    *out = o->quality;
+}
+
+void DataProtoSink_GetCompression (DataProtoSink *o, struct DataProtoSink_compression *out)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    *out = o->compression;
+}
+
 int DataProtoSource_Init (DataProtoSource *o, PacketRecvInterface *input, DataProtoSource_handler handler, void *user, BReactor *reactor)
 {
     ASSERT(PacketRecvInterface_GetMTU(input) <= INT_MAX - DATAPROTO_MAX_OVERHEAD)
@@ -393,11 +880,15 @@ void DataProtoSource_Free (DataProtoSource *o)
     PacketRouter_Free(&o->router);
 }
 
-int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t source_id, peerid_t dest_id, int num_packets, int inactivity_time, void *user,
+int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t source_id, peerid_t dest_id, int priority, int num_packets, RouteBufferPool *pool, int codel_target, int codel_interval, int inactivity_time, void *user,
                         DataProtoFlow_handler_inactivity handler_inactivity)
 {
     DebugObject_Access(&source->d_obj);
+    ASSERT(priority >= 0)
+    ASSERT(priority < DATAPROTO_NUM_PRIORITIES)
     ASSERT(num_packets > 0)
+    ASSERT(!pool || pool->mtu == DATAPROTO_MAX_OVERHEAD + source->frame_mtu)
+    ASSERT(!(codel_target > 0) || codel_interval > 0)
     ASSERT(!(inactivity_time >= 0) || handler_inactivity)
     
     // init arguments
@@ -419,12 +910,21 @@ int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t sour
     // set parent
     b->flow = o;
     
+    // remember priority
+    b->priority = priority;
+    
     // remember inactivity time
     b->inactivity_time = inactivity_time;
     
+    // remember CoDel target
+    b->codel_target = codel_target;
+    
     // init connector
     PacketPassConnector_Init(&b->connector, DATAPROTO_MAX_OVERHEAD + source->frame_mtu, BReactor_PendingGroup(source->reactor));
     
+    // accept header and frame separately, so frames routed to more flows are shared
+    PacketPassConnector_EnableSendV(&b->connector);
+    
     // init inactivity monitor
     PacketPassInterface *buf_out = PacketPassConnector_GetInput(&b->connector);
     if (b->inactivity_time >= 0) {
@@ -432,10 +932,22 @@ int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t sour
         buf_out = PacketPassInactivityMonitor_GetInput(&b->monitor);
     }
     
+    // init CoDel
+    if (b->codel_target > 0) {
+        if (!PacketPassCoDel_Init(&b->codel, buf_out, num_packets, codel_target, codel_interval, BReactor_PendingGroup(source->reactor))) {
+            BLog(BLOG_ERROR, "PacketPassCoDel_Init failed");
+            goto fail1;
+        }
+        buf_out = PacketPassCoDel_GetInput(&b->codel);
+    }
+    
     // init route buffer
-    if (!RouteBuffer_Init(&b->rbuf, DATAPROTO_MAX_OVERHEAD + source->frame_mtu, buf_out, num_packets)) {
+    if (pool) {
+        RouteBuffer_InitPool(&b->rbuf, pool, buf_out, num_packets);
+    }
+    else if (!RouteBuffer_Init(&b->rbuf, DATAPROTO_MAX_OVERHEAD + source->frame_mtu, buf_out, num_packets)) {
         BLog(BLOG_ERROR, "RouteBuffer_Init failed");
-        goto fail1;
+        goto fail2;
     }
     
     // set no sink
@@ -445,6 +957,10 @@ int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t sour
     DebugObject_Init(&o->d_obj);
     return 1;
     
+fail2:
+    if (b->codel_target > 0) {
+        PacketPassCoDel_Free(&b->codel);
+    }
 fail1:
     if (b->inactivity_time >= 0) {
         PacketPassInactivityMonitor_Free(&b->monitor);
@@ -483,36 +999,63 @@ void DataProtoFlow_Free (DataProtoFlow *o)
     }
 }
 
-void DataProtoFlow_Route (DataProtoFlow *o, int more)
+static void flow_route (DataProtoFlow *o, const peerid_t *dest_ids, int num_dest_ids, int more)
 {
-    DebugObject_Access(&o->d_obj);
-    PacketRouter_AssertRoute(&o->source->router);
-    ASSERT(o->source->current_buf)
-    ASSERT(more == 0 || more == 1)
     struct DataProtoFlow_buffer *b = o->b;
     
-    // write header. Don't set flags, it will be set in notifier_handler.
+    // write header right in front of the frame. Don't set flags, it will be set in notifier_handler.
+    int offset = DATAPROTO_MAX_OVERHEAD - sizeof(struct dataproto_header) - num_dest_ids * sizeof(struct dataproto_peer_id);
+    uint8_t *out = o->source->current_buf + offset;
     struct dataproto_header header;
-    struct dataproto_peer_id id;
     header.from_id = htol16(o->source_id);
-    header.num_peer_ids = htol16(1);
-    id.id = htol16(o->dest_id);
-    memcpy(o->source->current_buf, &header, sizeof(header));
-    memcpy(o->source->current_buf + sizeof(header), &id, sizeof(id));
+    header.num_peer_ids = htol16(num_dest_ids);
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    for (int i = 0; i < num_dest_ids; i++) {
+        struct dataproto_peer_id id;
+        id.id = htol16(dest_ids[i]);
+        memcpy(out, &id, sizeof(id));
+        out += sizeof(id);
+    }
     
     // route
     uint8_t *next_buf;
-    if (!PacketRouter_Route(&o->source->router, DATAPROTO_MAX_OVERHEAD + o->source->current_recv_len, &b->rbuf,
-                            &next_buf, DATAPROTO_MAX_OVERHEAD, (more ? o->source->current_recv_len : 0)
-    )) {
+    if (!PacketRouter_Route(&o->source->router, offset, DATAPROTO_MAX_OVERHEAD + o->source->current_recv_len, &b->rbuf, &next_buf, more)) {
         BLog(BLOG_NOTICE, "buffer full: %d->%d", (int)o->source_id, (int)o->dest_id);
         return;
     }
     
+    // start measuring the time the frame spends in the buffer
+    if (b->codel_target > 0) {
+        PacketPassCoDel_Enqueued(&b->codel);
+    }
+    
     // remember next buffer, or don't allow further routing if more==0
     o->source->current_buf = (more ? next_buf : NULL);
 }
 
+void DataProtoFlow_Route (DataProtoFlow *o, int more)
+{
+    DebugObject_Access(&o->d_obj);
+    PacketRouter_AssertRoute(&o->source->router);
+    ASSERT(o->source->current_buf)
+    ASSERT(more == 0 || more == 1)
+    
+    flow_route(o, &o->dest_id, 1, more);
+}
+
+void DataProtoFlow_RouteMulti (DataProtoFlow *o, const peerid_t *dest_ids, int num_dest_ids, int more)
+{
+    DebugObject_Access(&o->d_obj);
+    PacketRouter_AssertRoute(&o->source->router);
+    ASSERT(o->source->current_buf)
+    ASSERT(num_dest_ids > 0)
+    ASSERT(num_dest_ids <= DATAPROTO_MAX_PEER_IDS)
+    ASSERT(more == 0 || more == 1)
+    
+    flow_route(o, dest_ids, num_dest_ids, more);
+}
+
 void DataProtoFlow_Attach (DataProtoFlow *o, DataProtoSink *sink)
 {
     DebugObject_Access(&o->d_obj);
@@ -39,22 +39,115 @@
 #include <misc/debugcounter.h>
 #include <misc/debug.h>
 #include <base/DebugObject.h>
+#include <structure/LinkedList1.h>
 #include <system/BReactor.h>
 #include <flow/PacketPassFairQueue.h>
+#include <flow/PacketPassPriorityQueue.h>
 #include <flow/PacketPassNotifier.h>
 #include <flow/PacketRecvBlocker.h>
 #include <flow/SinglePacketBuffer.h>
 #include <flow/PacketPassConnector.h>
 #include <flow/PacketRouter.h>
 #include <flowextra/PacketPassInactivityMonitor.h>
+#include <flowextra/PacketPassCoDel.h>
 #include <client/DataProtoKeepaliveSource.h>
 
+/**
+ * Priority classes of frames sent to a {@link DataProtoSink}.
+ * A sink sends frames of a higher class before any frames of lower
+ * classes; flows within the same class share the sink fairly.
+ */
+#define DATAPROTO_PRIORITY_HIGH 0
+#define DATAPROTO_PRIORITY_NORMAL 1
+#define DATAPROTO_NUM_PRIORITIES 2
+
+/**
+ * Round-trip time samples above this many milliseconds are discarded.
+ */
+#define DATAPROTO_KEEPALIVE_MAX_RTT 60000
+
+/**
+ * Number of batches a {@link DataProtoKeepaliveTimer} spreads its sinks'
+ * keep-alives over.
+ */
+#define DATAPROTO_KEEPALIVE_TIMER_SLOTS 16
+
+/**
+ * A sink which keeps sending data still sends a keep-alive every this many
+ * keep-alive intervals, so that the quality of the link keeps being measured.
+ */
+#define DATAPROTO_KEEPALIVE_MAX_SKIP 6
+
+/**
+ * A sink which compresses only tries frames of at least this many bytes.
+ */
+#define DATAPROTO_COMPRESS_MIN_FRAME 128
+
 typedef void (*DataProtoSink_handler) (void *user, int up);
 typedef void (*DataProtoSource_handler) (void *user, const uint8_t *frame, int frame_len);
 typedef void (*DataProtoFlow_handler_inactivity) (void *user);
 
 struct DataProtoFlow_buffer;
 
+/**
+ * Link quality estimates of a {@link DataProtoSink}, measured with keep-alives.
+ */
+struct DataProtoSink_quality {
+    /**
+     * Whether the round-trip time has been measured. If 0, the other
+     * fields are undefined.
+     */
+    int have_rtt;
+    
+    /**
+     * Smoothed round-trip time, in milliseconds.
+     */
+    int rtt;
+    
+    /**
+     * Mean deviation of the round-trip time, in milliseconds.
+     */
+    int jitter;
+    
+    /**
+     * Estimated loss of packets sent to the peer, in thousandths.
+     */
+    int loss;
+};
+
+/**
+ * Compression counters of a {@link DataProtoSink}.
+ */
+struct DataProtoSink_compression {
+    /**
+     * Bytes of frames which compression was tried on.
+     */
+    uint64_t frame_bytes;
+    
+    /**
+     * Bytes those frames were sent as, whether compressed or not.
+     */
+    uint64_t sent_bytes;
+};
+
+/**
+ * Keep-alive timer shared by {@link DataProtoSink}'s.
+ * Sinks are spread over DATAPROTO_KEEPALIVE_TIMER_SLOTS batches; a single
+ * timer ticks through the batches, and the sinks in a batch are due to send
+ * their keep-alives together.
+ */
+typedef struct {
+    BReactor *reactor;
+    btime_t keepalive_time;
+    BTimer timer;
+    LinkedList1 slots[DATAPROTO_KEEPALIVE_TIMER_SLOTS];
+    int cur_slot;
+    int next_slot;
+    int num_sinks;
+    DebugObject d_obj;
+    DebugCounter d_ctr;
+} DataProtoKeepaliveTimer;
+
 /**
  * Frame destination.
  * Represents a peer as a destination for sending frames to.
@@ -62,14 +155,48 @@ struct DataProtoFlow_buffer;
 typedef struct {
     BReactor *reactor;
     int frame_mtu;
-    PacketPassFairQueue queue;
-    PacketPassInactivityMonitor monitor;
+    int compress;
+    int compact;
+    peerid_t compact_local_id;
+    peerid_t compact_peer_id;
+    PacketPassPriorityQueue queue;
+    PacketPassPriorityQueueFlow class_qflows[DATAPROTO_NUM_PRIORITIES];
+    PacketPassFairQueue class_queues[DATAPROTO_NUM_PRIORITIES];
+    PacketPassInterface stage_input;
+    uint8_t *stage_buf;
+    uint8_t *stage_gather_buf;
+    int compress_peer_accepts;
+    int compact_peer_accepts;
+    int stage_compressed;
+    int stage_compact;
+    const uint8_t *stage_frame;
+    struct DataProtoSink_compression compression;
     PacketPassNotifier notifier;
     DataProtoKeepaliveSource ka_source;
     PacketRecvBlocker ka_blocker;
     SinglePacketBuffer ka_buffer;
     PacketPassFairQueueFlow ka_qflow;
+    DataProtoKeepaliveTimer *ka_timer;
+    LinkedList1Node ka_timer_node;
+    int ka_slot;
+    int ka_have_data;
+    btime_t ka_last_data;
+    int ka_skipped;
+    uint32_t ka_send_seq;
+    int ka_have_recv;
+    uint32_t ka_recv_seq;
+    uint32_t ka_recv_peer_time;
+    uint32_t ka_recv_time;
+    uint32_t ka_recv_count;
+    int ka_have_echo;
+    uint32_t ka_echo_seq;
+    uint32_t ka_echo_count;
+    int ka_srtt8;
+    int ka_rttvar4;
+    struct DataProtoSink_quality quality;
+    btime_t tolerance_time;
     BTimer receive_timer;
+    btime_t last_receive;
     int up;
     int up_report;
     DataProtoSink_handler handler;
@@ -112,29 +239,68 @@ typedef struct {
 
 struct DataProtoFlow_buffer {
     DataProtoFlow *flow;
+    int priority;
     int inactivity_time;
+    int codel_target;
     RouteBuffer rbuf;
+    PacketPassCoDel codel;
     PacketPassInactivityMonitor monitor;
     PacketPassConnector connector;
     DataProtoSink *sink;
     PacketPassFairQueueFlow sink_qflow;
 };
 
+/**
+ * Initializes the keep-alive timer.
+ * The timer only runs while there are sinks using it.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param keepalive_time how often each sink is due to send a keep-alive. Must be >0.
+ */
+void DataProtoKeepaliveTimer_Init (DataProtoKeepaliveTimer *o, BReactor *reactor, btime_t keepalive_time);
+
+/**
+ * Frees the keep-alive timer.
+ * There must be no {@link DataProtoSink}'s using it.
+ * 
+ * @param o the object
+ */
+void DataProtoKeepaliveTimer_Free (DataProtoKeepaliveTimer *o);
+
 /**
  * Initializes the sink.
+ * Keep-alives are sent with priority DATAPROTO_PRIORITY_HIGH, right away and then
+ * whenever the sink is due on ka_timer. A due keep-alive is skipped if data was
+ * sent within the last half of the keep-alive time, but at most
+ * DATAPROTO_KEEPALIVE_MAX_SKIP times in a row.
+ * They are used to measure the quality of the link; see {@link DataProtoSink_GetQuality}.
  * 
  * @param o the object
  * @param reactor reactor we live in
- * @param output output interface. Must support cancel functionality. Its MTU must be
- *               >=DATAPROTO_MAX_OVERHEAD.
- * @param keepalive_time keepalive time
+ * @param output output interface. Must support cancel functionality and vectored sends.
+ *               Its MTU must be >=DATAPROTO_MAX_OVERHEAD and >=sizeof(struct dataproto_header) +
+ *               sizeof(struct dataproto_keepalive).
+ * @param ka_timer keep-alive timer to send keep-alives on. Must outlive the sink.
  * @param tolerance_time after how long of not having received anything from the peer
- *                       to consider the link down
+ *                       to consider the link down. Once the round-trip time is measured,
+ *                       it is extended by the round-trip time and four times its deviation,
+ *                       up to twice tolerance_time.
+ * @param compress whether to compress frames, once the peer has indicated that it
+ *                 accepts them. Only frames of at least DATAPROTO_COMPRESS_MIN_FRAME bytes
+ *                 are tried, and sent compressed only if that saves at least a sixteenth.
+ *                 Must be 0 or 1.
+ * @param compact whether to send frames from local_id to just peer_id with a compact
+ *                header (see DATAPROTO_FLAGS_COMPACT), once the peer has indicated
+ *                that it accepts them. Must be 0 or 1.
+ * @param local_id our peer ID, for compact headers
+ * @param peer_id ID of the peer at the other end of the link, for compact headers
  * @param handler up state handler
  * @param user value to pass to handler
  * @return 1 on success, 0 on failure
  */
-int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, btime_t keepalive_time, btime_t tolerance_time, DataProtoSink_handler handler, void *user) WARN_UNUSED;
+int DataProtoSink_Init (DataProtoSink *o, BReactor *reactor, PacketPassInterface *output, DataProtoKeepaliveTimer *ka_timer, btime_t tolerance_time, int compress,
+                        int compact, peerid_t local_id, peerid_t peer_id, DataProtoSink_handler handler, void *user) WARN_UNUSED;
 
 /**
  * Frees the sink.
@@ -151,8 +317,40 @@ void DataProtoSink_Free (DataProtoSink *o);
  * @param o the object
  * @param peer_receiving whether the DATAPROTO_FLAGS_RECEIVING_KEEPALIVES flag was set in the packet.
  *                       Must be 0 or 1.
+ * @param peer_accepts_compressed whether the DATAPROTO_FLAGS_ACCEPTS_COMPRESSED flag was set
+ *                                in the packet. Must be 0 or 1.
+ * @param peer_accepts_compact whether the DATAPROTO_FLAGS_ACCEPTS_COMPACT flag was set
+ *                             in the packet. Must be 0 or 1.
+ */
+void DataProtoSink_Received (DataProtoSink *o, int peer_receiving, int peer_accepts_compressed, int peer_accepts_compact);
+
+/**
+ * Notifies the sink that a keep-alive was received from the peer, after
+ * {@link DataProtoSink_Received} has been called for it.
+ * Must not be in freeing state.
+ * 
+ * @param o the object
+ * @param data keep-alive payload, following the header
+ * @param data_len length of the payload. Must be >=0. Payloads which are not a
+ *                 struct {@link dataproto_keepalive} carry no measurements.
  */
-void DataProtoSink_Received (DataProtoSink *o, int peer_receiving);
+void DataProtoSink_ReceivedKeepalive (DataProtoSink *o, const uint8_t *data, int data_len);
+
+/**
+ * Returns the quality of the link, as measured with keep-alives.
+ * 
+ * @param o the object
+ * @param out returns the estimates
+ */
+void DataProtoSink_GetQuality (DataProtoSink *o, struct DataProtoSink_quality *out);
+
+/**
+ * Returns the compression counters.
+ * 
+ * @param o the object
+ * @param out returns the counters
+ */
+void DataProtoSink_GetCompression (DataProtoSink *o, struct DataProtoSink_compression *out);
 
 /**
  * Initiazes the source.
@@ -184,7 +382,17 @@ void DataProtoSource_Free (DataProtoSource *o);
  * @param source_id source peer ID to encode in the headers (i.e. our ID)
  * @param dest_id destination peer ID to encode in the headers (i.e. ID if the peer this
  *                flow belongs to)
+ * @param priority priority class of the flow's frames in the sink it is attached to.
+ *                 Must be >=0 and <DATAPROTO_NUM_PRIORITIES, DATAPROTO_PRIORITY_HIGH
+ *                 being the highest.
  * @param num_packets number of packets the buffer should hold. Must be >0.
+ * @param pool if not NULL, the buffer takes packets from this pool as needed instead
+ *             of allocating num_packets packets of its own (see {@link RouteBufferPool}).
+ *             Its MTU must be DATAPROTO_MAX_OVERHEAD + frame MTU of source.
+ * @param codel_target if >0, frames which waited in the buffer for longer than this many
+ *                     milliseconds are dropped using CoDel (see {@link PacketPassCoDel}),
+ *                     so that the buffer does not add latency under sustained load.
+ * @param codel_interval CoDel interval in milliseconds, if codel_target >0. Must then be >0.
  * @param inactivity_time milliseconds of output inactivity after which to call the
  *                        inactivity handler; <0 to disable. Note that the flow is considered
  *                        active as long as its buffer is non-empty, even if is not attached to
@@ -193,7 +401,7 @@ void DataProtoSource_Free (DataProtoSource *o);
  * @param handler_inactivity inactivity handler, if inactivity_time >=0
  * @return 1 on success, 0 on failure
  */
-int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t source_id, peerid_t dest_id, int num_packets, int inactivity_time, void *user,
+int DataProtoFlow_Init (DataProtoFlow *o, DataProtoSource *source, peerid_t source_id, peerid_t dest_id, int priority, int num_packets, RouteBufferPool *pool, int codel_target, int codel_interval, int inactivity_time, void *user,
                         DataProtoFlow_handler_inactivity handler_inactivity) WARN_UNUSED;
 
 /**
@@ -216,6 +424,21 @@ void DataProtoFlow_Free (DataProtoFlow *o);
  */
 void DataProtoFlow_Route (DataProtoFlow *o, int more);
 
+/**
+ * Routes a frame from the flow's source to this flow, as a single packet
+ * addressed to the given destinations instead of the flow's destination.
+ * This is for sending a frame to multiple peers behind the same relay, which
+ * delivers it to each of them.
+ * Must be called from within the job context of the {@link DataProtoSource_handler} handler.
+ * Must not be called after a frame has been routed with more=0 for the current frame.
+ * 
+ * @param o the object
+ * @param dest_ids destination peer IDs to put into the packet
+ * @param num_dest_ids number of destination IDs. Must be >0 and <=DATAPROTO_MAX_PEER_IDS.
+ * @param more as in {@link DataProtoFlow_Route}
+ */
+void DataProtoFlow_RouteMulti (DataProtoFlow *o, const peerid_t *dest_ids, int num_dest_ids, int more);
+
 /**
  * Attaches the flow to a sink.
  * The flow must be in not attached state.
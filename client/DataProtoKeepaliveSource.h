@@ -39,7 +39,8 @@
 
 /**
  * A {@link PacketRecvInterface} source which provides DataProto keepalive packets.
- * These packets have no payload, no destination peers and flags zero.
+ * These packets have no destination peers and flags zero. Their payload is a
+ * struct {@link dataproto_keepalive} filled with zeros, for the sender to fill in.
  */
 typedef struct {
     DebugObject d_obj;
@@ -63,7 +64,8 @@ void DataProtoKeepaliveSource_Free (DataProtoKeepaliveSource *o);
 
 /**
  * Returns the output interface.
- * The MTU of the output interface will be sizeof(struct dataproto_header).
+ * The MTU of the output interface will be sizeof(struct dataproto_header) +
+ * sizeof(struct dataproto_keepalive).
  *
  * @param o the object
  * @return output interface
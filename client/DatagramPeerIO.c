@@ -27,6 +27,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <misc/balloc.h>
+
 #include <client/DatagramPeerIO.h>
 
 #include <generated/blog_channel_DatagramPeerIO.h>
@@ -35,46 +37,130 @@
 #define DATAGRAMPEERIO_MODE_CONNECT 1
 #define DATAGRAMPEERIO_MODE_BIND 2
 
+#define PMTUD_STATE_CONNECTING 1
+#define PMTUD_STATE_SEARCHING 2
+#define PMTUD_STATE_DONE 3
+
+#define PMTUD_PROBE_TIMEOUT 1000
+#define PMTUD_MAX_PROBES 3
+#define PMTUD_SEARCH_STEP 16
+#define PMTUD_INTERVAL 600000
+
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-static void init_io (DatagramPeerIO *o);
-static void free_io (DatagramPeerIO *o);
-static void dgram_handler (DatagramPeerIO *o, int event);
+static int datagram_size (DatagramPeerIO *o, int fragment_mtu);
+static int init_io (DatagramPeerIO *o, struct DatagramPeerIO_socket *sock);
+static void free_io (DatagramPeerIO *o, struct DatagramPeerIO_socket *sock);
+static void free_socket (DatagramPeerIO *o, struct DatagramPeerIO_socket *sock);
+static void dgram_handler (struct DatagramPeerIO_socket *sock, int event);
 static void reset_mode (DatagramPeerIO *o);
+static void start_sending (DatagramPeerIO *o);
+static void send_stripe_input_handler_send (DatagramPeerIO *o, uint8_t *data, int data_len);
+static void send_stripe_dispatch (DatagramPeerIO *o);
+static void send_stripe_output_handler_done (struct DatagramPeerIO_socket *sock);
 static void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_len);
+static void recv_probe_handler (DatagramPeerIO *o, fragmentproto_frameid probe_id, int probe_len);
+static void recv_probe_ack_handler (DatagramPeerIO *o, fragmentproto_frameid probe_id, int probe_len);
+static void pmtud_set_mtu (DatagramPeerIO *o, int mtu);
+static void pmtud_send_probe (DatagramPeerIO *o, int len);
+static void pmtud_begin (DatagramPeerIO *o);
+static void pmtud_next (DatagramPeerIO *o);
+static void pmtud_timer_handler (DatagramPeerIO *o);
+
+int datagram_size (DatagramPeerIO *o, int fragment_mtu)
+{
+    if (o->fec_group_size > 0) {
+        fragment_mtu += sizeof(struct fecproto_header);
+    }
+    
+    return spproto_carrier_mtu_for_payload_mtu(o->sp_params, fragment_mtu);
+}
 
-void init_io (DatagramPeerIO *o)
+int init_io (DatagramPeerIO *o, struct DatagramPeerIO_socket *sock)
 {
+    // enable kernel busy polling
+    if (o->busy_poll_usecs > 0 && !BDatagram_SetBusyPoll(&sock->dgram, o->busy_poll_usecs)) {
+        PeerLog(o, BLOG_WARNING, "BDatagram_SetBusyPoll failed");
+    }
+    
+    // disable fragmentation, so that probes find the path MTU
+    if (o->pmtud && !BDatagram_SetDontFragment(&sock->dgram)) {
+        PeerLog(o, BLOG_WARNING, "BDatagram_SetDontFragment failed");
+    }
+    
+    // hand trains of equal-size packets to the kernel at once
+    if (o->segment_offload && !BDatagram_SetSegmentOffload(&sock->dgram)) {
+        PeerLog(o, BLOG_WARNING, "BDatagram_SetSegmentOffload failed");
+    }
+    
+#ifdef BADVPN_USE_AF_XDP
+    // take our port past the kernel network stack
+    if (o->xdp && !BDatagram_SetXdp(&sock->dgram, o->xdp)) {
+        PeerLog(o, BLOG_WARNING, "BDatagram_SetXdp failed");
+    }
+#endif
+    
     // init dgram recv interface
-    BDatagram_RecvAsync_Init(&o->dgram, o->effective_socket_mtu);
+    if (!BDatagram_RecvAsync_Init2(&sock->dgram, o->effective_socket_mtu, DATAGRAMPEERIO_BATCH)) {
+        PeerLog(o, BLOG_ERROR, "BDatagram_RecvAsync_Init2 failed");
+        goto fail0;
+    }
     
     // connect source
-    PacketRecvConnector_ConnectInput(&o->recv_connector, BDatagram_RecvAsync_GetIf(&o->dgram));
+    PacketRecvConnector_ConnectInput(&sock->recv_connector, BDatagram_RecvAsync_GetIf(&sock->dgram));
     
     // init dgram send interface
-    BDatagram_SendAsync_Init(&o->dgram, o->effective_socket_mtu);
+    if (!BDatagram_SendAsync_Init2(&sock->dgram, o->effective_socket_mtu, DATAGRAMPEERIO_BATCH)) {
+        PeerLog(o, BLOG_ERROR, "BDatagram_SendAsync_Init2 failed");
+        goto fail1;
+    }
+    
+    if (o->num_sockets == 1) {
+        // connect sink
+        PacketPassConnector_ConnectOutput(&o->send_connector, BDatagram_SendAsync_GetIf(&sock->dgram));
+    } else {
+        // sink is used by the striping sender directly
+        PacketPassInterface_Sender_Init(BDatagram_SendAsync_GetIf(&sock->dgram), (PacketPassInterface_handler_done)send_stripe_output_handler_done, sock);
+    }
+    
+    return 1;
     
-    // connect sink
-    PacketPassConnector_ConnectOutput(&o->send_connector, BDatagram_SendAsync_GetIf(&o->dgram));
+fail1:
+    PacketRecvConnector_DisconnectInput(&sock->recv_connector);
+    BDatagram_RecvAsync_Free(&sock->dgram);
+fail0:
+    return 0;
 }
 
-void free_io (DatagramPeerIO *o)
+void free_io (DatagramPeerIO *o, struct DatagramPeerIO_socket *sock)
 {
     // disconnect sink
-    PacketPassConnector_DisconnectOutput(&o->send_connector);
+    if (o->num_sockets == 1) {
+        PacketPassConnector_DisconnectOutput(&o->send_connector);
+    }
     
     // free dgram send interface
-    BDatagram_SendAsync_Free(&o->dgram);
+    BDatagram_SendAsync_Free(&sock->dgram);
     
     // disconnect source
-    PacketRecvConnector_DisconnectInput(&o->recv_connector);
+    PacketRecvConnector_DisconnectInput(&sock->recv_connector);
     
     // free dgram recv interface
-    BDatagram_RecvAsync_Free(&o->dgram);
+    BDatagram_RecvAsync_Free(&sock->dgram);
 }
 
-void dgram_handler (DatagramPeerIO *o, int event)
+void free_socket (DatagramPeerIO *o, struct DatagramPeerIO_socket *sock)
 {
+    // free I/O
+    free_io(o, sock);
+    
+    // free datagram object
+    BDatagram_Free(&sock->dgram);
+}
+
+void dgram_handler (struct DatagramPeerIO_socket *sock, int event)
+{
+    DatagramPeerIO *o = sock->parent;
     DebugObject_Access(&o->d_obj);
     ASSERT(o->mode == DATAGRAMPEERIO_MODE_CONNECT || o->mode == DATAGRAMPEERIO_MODE_BIND)
     
@@ -98,19 +184,103 @@ void reset_mode (DatagramPeerIO *o)
         return;
     }
     
+    // stop path MTU discovery
+    if (o->pmtud) {
+        BReactor_RemoveTimer(o->reactor, &o->pmtud_timer);
+    }
+    
     // remove recv notifier handler
     PacketPassNotifier_SetHandler(&o->recv_notifier, NULL, NULL);
     
-    // free I/O
-    free_io(o);
+    // free sockets
+    for (int i = 0; i < o->num_active_sockets; i++) {
+        free_socket(o, &o->sockets[i]);
+    }
+    o->num_active_sockets = 0;
     
-    // free datagram object
-    BDatagram_Free(&o->dgram);
+    // drop the packet being sent, its socket is gone
+    if (o->num_sockets > 1 && o->send_stripe_busy >= 0) {
+        o->send_stripe_busy = -1;
+        o->send_stripe_data = NULL;
+        PacketPassInterface_Done(&o->send_stripe_input);
+    }
     
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_NONE;
 }
 
+void start_sending (DatagramPeerIO *o)
+{
+    ASSERT(o->mode == DATAGRAMPEERIO_MODE_CONNECT || o->mode == DATAGRAMPEERIO_MODE_BIND)
+    ASSERT(o->num_active_sockets > 0)
+    
+    // send the packet held while in default mode
+    if (o->num_sockets > 1 && o->send_stripe_data) {
+        send_stripe_dispatch(o);
+    }
+    
+    // start path MTU discovery from the initial size
+    if (o->pmtud) {
+        pmtud_set_mtu(o, o->pmtud_base_mtu);
+        pmtud_begin(o);
+    }
+}
+
+void send_stripe_input_handler_send (DatagramPeerIO *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->num_sockets > 1)
+    ASSERT(!o->send_stripe_data)
+    ASSERT(o->send_stripe_busy == -1)
+    
+    // remember packet
+    o->send_stripe_data = data;
+    o->send_stripe_data_len = data_len;
+    
+    // hold it in default mode
+    if (o->mode == DATAGRAMPEERIO_MODE_NONE) {
+        return;
+    }
+    
+    send_stripe_dispatch(o);
+}
+
+void send_stripe_dispatch (DatagramPeerIO *o)
+{
+    ASSERT(o->num_sockets > 1)
+    ASSERT(o->num_active_sockets > 0)
+    ASSERT(o->send_stripe_data)
+    ASSERT(o->send_stripe_busy == -1)
+    
+    // use the sockets in turn, sending a batch worth of datagrams through each,
+    // so that sockets flushing their batches don't reorder datagrams much
+    if (o->send_stripe_next >= o->num_active_sockets) {
+        o->send_stripe_next = 0;
+        o->send_stripe_count = 0;
+    }
+    o->send_stripe_busy = o->send_stripe_next;
+    if (++o->send_stripe_count == DATAGRAMPEERIO_BATCH) {
+        o->send_stripe_next = (o->send_stripe_next + 1) % o->num_active_sockets;
+        o->send_stripe_count = 0;
+    }
+    
+    PacketPassInterface_Sender_Send(BDatagram_SendAsync_GetIf(&o->sockets[o->send_stripe_busy].dgram), o->send_stripe_data, o->send_stripe_data_len);
+}
+
+void send_stripe_output_handler_done (struct DatagramPeerIO_socket *sock)
+{
+    DatagramPeerIO *o = sock->parent;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->send_stripe_busy == sock - o->sockets)
+    ASSERT(o->send_stripe_data)
+    
+    // packet was sent
+    o->send_stripe_busy = -1;
+    o->send_stripe_data = NULL;
+    
+    PacketPassInterface_Done(&o->send_stripe_input);
+}
+
 void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_len)
 {
     ASSERT(o->mode == DATAGRAMPEERIO_MODE_BIND)
@@ -119,7 +289,7 @@ void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_l
     // obtain addresses from last received packet
     BAddr addr;
     BIPAddr local_addr;
-    ASSERT_EXECUTE(BDatagram_GetLastReceiveAddrs(&o->dgram, &addr, &local_addr))
+    ASSERT_EXECUTE(BDatagram_GetLastReceiveAddrs(&o->sockets[0].dgram, &addr, &local_addr))
     
     // check address family just in case
     if (!BDatagram_AddressFamilySupported(addr.type)) {
@@ -128,7 +298,145 @@ void recv_decoder_notifier_handler (DatagramPeerIO *o, uint8_t *data, int data_l
     }
     
     // update addresses
-    BDatagram_SetSendAddrs(&o->dgram, addr, local_addr);
+    BDatagram_SetSendAddrs(&o->sockets[0].dgram, addr, local_addr);
+    
+    // further punch addresses are no longer needed
+    o->bind_have_peer_addr = 1;
+}
+
+void recv_probe_handler (DatagramPeerIO *o, fragmentproto_frameid probe_id, int probe_len)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // acknowledge probe
+    FragmentProtoDisassembler_SendProbeAck(&o->send_disassembler, probe_id, probe_len);
+}
+
+void recv_probe_ack_handler (DatagramPeerIO *o, fragmentproto_frameid probe_id, int probe_len)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // ignore unless it's for the outstanding probe
+    if (!o->pmtud || o->mode == DATAGRAMPEERIO_MODE_NONE || o->pmtud_state == PMTUD_STATE_DONE ||
+        probe_id != o->pmtud_probe_id || probe_len != o->pmtud_probe_len
+    ) {
+        return;
+    }
+    
+    BReactor_RemoveTimer(o->reactor, &o->pmtud_timer);
+    
+    // this size gets through
+    o->pmtud_lo = probe_len;
+    
+    if (o->pmtud_state == PMTUD_STATE_CONNECTING) {
+        o->pmtud_state = PMTUD_STATE_SEARCHING;
+    }
+    else if (o->pmtud_lo > o->pmtud_cur_mtu) {
+        // use larger packets right away
+        pmtud_set_mtu(o, o->pmtud_lo);
+    }
+    
+    pmtud_next(o);
+}
+
+void pmtud_set_mtu (DatagramPeerIO *o, int mtu)
+{
+    ASSERT(o->pmtud)
+    
+    o->pmtud_cur_mtu = mtu;
+    FragmentProtoDisassembler_SetOutputMTU(&o->send_disassembler, o->pmtud_cur_mtu);
+}
+
+void pmtud_send_probe (DatagramPeerIO *o, int len)
+{
+    ASSERT(o->pmtud)
+    ASSERT(len > FRAGMENTPROTO_MAX_HEADER_LEN(o->compact))
+    ASSERT(len <= o->fragment_mtu)
+    
+    o->pmtud_probe_id++;
+    o->pmtud_probe_len = len;
+    
+    FragmentProtoDisassembler_SendProbe(&o->send_disassembler, o->pmtud_probe_id, o->pmtud_probe_len);
+    
+    BReactor_SetTimerAfter(o->reactor, &o->pmtud_timer, PMTUD_PROBE_TIMEOUT);
+}
+
+void pmtud_begin (DatagramPeerIO *o)
+{
+    ASSERT(o->pmtud)
+    
+    // confirm that the smallest size gets through, so that lost probes
+    // are not mistaken for a small path MTU while the peer isn't reachable
+    o->pmtud_lo = o->pmtud_min_mtu;
+    o->pmtud_hi = o->fragment_mtu;
+    o->pmtud_state = PMTUD_STATE_CONNECTING;
+    o->pmtud_tries = 0;
+    
+    pmtud_send_probe(o, o->pmtud_min_mtu);
+}
+
+void pmtud_next (DatagramPeerIO *o)
+{
+    ASSERT(o->pmtud)
+    ASSERT(o->pmtud_state == PMTUD_STATE_SEARCHING)
+    
+    int len;
+    if (o->pmtud_lo < o->pmtud_cur_mtu && o->pmtud_cur_mtu <= o->pmtud_hi) {
+        // confirm the size in use first
+        len = o->pmtud_cur_mtu;
+    }
+    else if (o->pmtud_hi - o->pmtud_lo >= PMTUD_SEARCH_STEP) {
+        len = o->pmtud_lo + (o->pmtud_hi - o->pmtud_lo + 1) / 2;
+    }
+    else {
+        // done, search again later
+        if (o->pmtud_cur_mtu != o->pmtud_lo) {
+            pmtud_set_mtu(o, o->pmtud_lo);
+        }
+        PeerLog(o, BLOG_INFO, "path MTU discovery done, datagram size %d", datagram_size(o, o->pmtud_cur_mtu));
+        o->pmtud_state = PMTUD_STATE_DONE;
+        BReactor_SetTimerAfter(o->reactor, &o->pmtud_timer, PMTUD_INTERVAL);
+        return;
+    }
+    
+    o->pmtud_tries = 0;
+    pmtud_send_probe(o, len);
+}
+
+void pmtud_timer_handler (DatagramPeerIO *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->pmtud)
+    ASSERT(o->mode == DATAGRAMPEERIO_MODE_CONNECT || o->mode == DATAGRAMPEERIO_MODE_BIND)
+    
+    if (o->pmtud_state == PMTUD_STATE_DONE) {
+        pmtud_begin(o);
+        return;
+    }
+    
+    // retry a lost probe a few times
+    o->pmtud_tries++;
+    if (o->pmtud_tries < PMTUD_MAX_PROBES) {
+        pmtud_send_probe(o, o->pmtud_probe_len);
+        return;
+    }
+    
+    if (o->pmtud_state == PMTUD_STATE_CONNECTING) {
+        // peer not reachable (yet), keep trying
+        o->pmtud_tries = 0;
+        pmtud_send_probe(o, o->pmtud_min_mtu);
+        return;
+    }
+    
+    // this size doesn't get through
+    o->pmtud_hi = o->pmtud_probe_len - 1;
+    
+    if (o->pmtud_cur_mtu > o->pmtud_hi) {
+        PeerLog(o, BLOG_INFO, "datagram size %d does not get through, lowering", datagram_size(o, o->pmtud_cur_mtu));
+        pmtud_set_mtu(o, o->pmtud_lo);
+    }
+    
+    pmtud_next(o);
 }
 
 int DatagramPeerIO_Init (
@@ -136,11 +444,18 @@ int DatagramPeerIO_Init (
     BReactor *reactor,
     int payload_mtu,
     int socket_mtu,
+    int max_socket_mtu,
     struct spproto_security_params sp_params,
     btime_t latency,
     int num_frames,
+    int fec_group_size,
+    btime_t fec_flush_latency,
+    int compact,
+    int num_sockets,
     PacketPassInterface *recv_userif,
     int otp_warning_count,
+    int spproto_batch_size,
+    int spproto_window,
     BThreadWorkDispatcher *twd,
     void *user,
     BLog_logfunc logfunc,
@@ -151,8 +466,17 @@ int DatagramPeerIO_Init (
 {
     ASSERT(payload_mtu >= 0)
     ASSERT(socket_mtu >= 0)
+    ASSERT(max_socket_mtu < 0 || max_socket_mtu >= socket_mtu)
     spproto_assert_security_params(sp_params);
     ASSERT(num_frames > 0)
+    ASSERT(fec_group_size >= 0)
+    ASSERT(fec_group_size <= FECPROTO_MAX_GROUP_SIZE)
+    ASSERT(fec_group_size == 0 || fec_flush_latency >= 0)
+    ASSERT(compact == 0 || compact == 1)
+    ASSERT(num_sockets > 0)
+    ASSERT(num_sockets <= DATAGRAMPEERIO_MAX_SOCKETS)
+    ASSERT(spproto_batch_size > 0)
+    ASSERT(spproto_window > 0)
     ASSERT(PacketPassInterface_GetMTU(recv_userif) >= payload_mtu)
     if (SPPROTO_HAVE_OTP(sp_params)) {
         ASSERT(otp_warning_count > 0)
@@ -166,9 +490,16 @@ int DatagramPeerIO_Init (
     o->user = user;
     o->logfunc = logfunc;
     o->handler_error = handler_error;
+    o->pmtud = (max_socket_mtu >= 0);
+    o->fec_group_size = fec_group_size;
+    o->compact = compact;
+    o->num_sockets = num_sockets;
+    
+    // SPProto nonces can be compact when the sequence numbers are tracked
+    o->sp_params.compact = (o->compact && SPPROTO_HAVE_AEAD(o->sp_params) && SPPROTO_HAVE_REPLAY_WINDOW(o->sp_params));
     
     // check num frames (for FragmentProtoAssembler)
-    if (num_frames >= FPA_MAX_TIME) {
+    if (num_frames > FPA_MAX_FRAMES) {
         PeerLog(o, BLOG_ERROR, "num_frames is too big");
         goto fail0;
     }
@@ -179,11 +510,35 @@ int DatagramPeerIO_Init (
         goto fail0;
     }
     
+    // FECProto headers take space from FragmentProto packets
+    int fec_overhead = (o->fec_group_size > 0 ? sizeof(struct fecproto_header) : 0);
+    
     // calculate SPProto payload MTU
-    if ((o->spproto_payload_mtu = spproto_payload_mtu_for_carrier_mtu(o->sp_params, socket_mtu)) <= (int)sizeof(struct fragmentproto_chunk_header)) {
+    if ((o->spproto_payload_mtu = spproto_payload_mtu_for_carrier_mtu(o->sp_params, socket_mtu)) - fec_overhead <= (int)FRAGMENTPROTO_MAX_HEADER_LEN(o->compact)) {
         PeerLog(o, BLOG_ERROR, "socket MTU is too small");
         goto fail0;
     }
+    o->pmtud_base_mtu = o->spproto_payload_mtu - fec_overhead;
+    o->pmtud_min_mtu = o->pmtud_base_mtu;
+    
+    if (o->pmtud) {
+        // buffers are sized for the largest datagrams
+        if ((o->spproto_payload_mtu = spproto_payload_mtu_for_carrier_mtu(o->sp_params, max_socket_mtu)) < 0) {
+            PeerLog(o, BLOG_ERROR, "spproto_payload_mtu_for_carrier_mtu failed");
+            goto fail0;
+        }
+        
+        // calculate the smallest size to search from
+        if (socket_mtu > DATAGRAMPEERIO_PMTUD_MIN_SOCKET_MTU) {
+            int min_mtu = spproto_payload_mtu_for_carrier_mtu(o->sp_params, DATAGRAMPEERIO_PMTUD_MIN_SOCKET_MTU) - fec_overhead;
+            if (min_mtu > (int)FRAGMENTPROTO_MAX_HEADER_LEN(o->compact)) {
+                o->pmtud_min_mtu = min_mtu;
+            }
+        }
+    }
+    
+    // calculate FragmentProto packet MTU
+    o->fragment_mtu = o->spproto_payload_mtu - fec_overhead;
     
     // calculate effective socket MTU
     if ((o->effective_socket_mtu = spproto_carrier_mtu_for_payload_mtu(o->sp_params, o->spproto_payload_mtu)) < 0) {
@@ -194,70 +549,172 @@ int DatagramPeerIO_Init (
     // init receiving
     
     // init assembler
-    if (!FragmentProtoAssembler_Init(&o->recv_assembler, o->spproto_payload_mtu, recv_userif, num_frames, fragmentproto_max_chunks_for_frame(o->spproto_payload_mtu, o->payload_mtu),
-                                     BReactor_PendingGroup(o->reactor), o->user, o->logfunc
-    )) {
+    if (!FragmentProtoAssembler_Init(&o->recv_assembler, o->fragment_mtu, recv_userif, num_frames, o->compact, BReactor_PendingGroup(o->reactor), o->user, o->logfunc)) {
         PeerLog(o, BLOG_ERROR, "FragmentProtoAssembler_Init failed");
         goto fail0;
     }
+    FragmentProtoAssembler_SetProbeHandlers(&o->recv_assembler, (FragmentProtoAssembler_handler_probe)recv_probe_handler, (FragmentProtoAssembler_handler_probe)recv_probe_ack_handler, o);
+    PacketPassInterface *recv_output = FragmentProtoAssembler_GetInput(&o->recv_assembler);
+    
+    // init FEC decoder
+    if (o->fec_group_size > 0) {
+        if (!FECDecoder_Init(&o->recv_fec, recv_output, BReactor_PendingGroup(o->reactor), o->user, o->logfunc)) {
+            PeerLog(o, BLOG_ERROR, "FECDecoder_Init failed");
+            goto fail0a;
+        }
+        recv_output = FECDecoder_GetInput(&o->recv_fec);
+    }
     
     // init notifier
-    PacketPassNotifier_Init(&o->recv_notifier, FragmentProtoAssembler_GetInput(&o->recv_assembler), BReactor_PendingGroup(o->reactor));
+    PacketPassNotifier_Init(&o->recv_notifier, recv_output, BReactor_PendingGroup(o->reactor));
     
     // init decoder
-    if (!SPProtoDecoder_Init(&o->recv_decoder, PacketPassNotifier_GetInput(&o->recv_notifier), o->sp_params, 2, BReactor_PendingGroup(o->reactor), twd, o->user, o->logfunc)) {
+    if (!SPProtoDecoder_Init(&o->recv_decoder, PacketPassNotifier_GetInput(&o->recv_notifier), o->sp_params, 2, spproto_batch_size, spproto_window, BReactor_PendingGroup(o->reactor), twd, o->user, o->logfunc)) {
         PeerLog(o, BLOG_ERROR, "SPProtoDecoder_Init failed");
         goto fail1;
     }
     SPProtoDecoder_SetHandlers(&o->recv_decoder, handler_otp_ready, user);
     
-    // init connector
-    PacketRecvConnector_Init(&o->recv_connector, o->effective_socket_mtu, BReactor_PendingGroup(o->reactor));
+    // init queue merging packets from the sockets
+    if (o->num_sockets > 1) {
+        if (!PacketPassFairQueue_Init(&o->recv_queue, SPProtoDecoder_GetInput(&o->recv_decoder), BReactor_PendingGroup(o->reactor), 0, 1)) {
+            PeerLog(o, BLOG_ERROR, "PacketPassFairQueue_Init failed");
+            goto fail1a;
+        }
+    }
     
-    // init buffer
-    if (!SinglePacketBuffer_Init(&o->recv_buffer, PacketRecvConnector_GetOutput(&o->recv_connector), SPProtoDecoder_GetInput(&o->recv_decoder), BReactor_PendingGroup(o->reactor))) {
-        PeerLog(o, BLOG_ERROR, "SinglePacketBuffer_Init failed");
-        goto fail2;
+    // allocate sockets
+    if (!(o->sockets = (struct DatagramPeerIO_socket *)BAllocArray(o->num_sockets, sizeof(o->sockets[0])))) {
+        PeerLog(o, BLOG_ERROR, "BAllocArray failed");
+        goto fail1b;
+    }
+    
+    // init receiving for sockets
+    int num_init;
+    for (num_init = 0; num_init < o->num_sockets; num_init++) {
+        struct DatagramPeerIO_socket *sock = &o->sockets[num_init];
+        sock->parent = o;
+        
+        PacketPassInterface *sock_output = SPProtoDecoder_GetInput(&o->recv_decoder);
+        if (o->num_sockets > 1) {
+            PacketPassFairQueueFlow_Init(&sock->recv_qflow, &o->recv_queue);
+            sock_output = PacketPassFairQueueFlow_GetInput(&sock->recv_qflow);
+        }
+        
+        // init connector
+        PacketRecvConnector_Init(&sock->recv_connector, o->effective_socket_mtu, BReactor_PendingGroup(o->reactor));
+        
+        // init buffer
+        if (!SinglePacketBuffer_Init(&sock->recv_buffer, PacketRecvConnector_GetOutput(&sock->recv_connector), sock_output, BReactor_PendingGroup(o->reactor))) {
+            PeerLog(o, BLOG_ERROR, "SinglePacketBuffer_Init failed");
+            PacketRecvConnector_Free(&sock->recv_connector);
+            if (o->num_sockets > 1) {
+                PacketPassFairQueueFlow_Free(&sock->recv_qflow);
+            }
+            goto fail2;
+        }
     }
     
     // init sending base
     
     // init disassembler
-    FragmentProtoDisassembler_Init(&o->send_disassembler, o->reactor, o->payload_mtu, o->spproto_payload_mtu, -1, latency);
+    FragmentProtoDisassembler_Init(&o->send_disassembler, o->reactor, o->payload_mtu, o->fragment_mtu, -1, latency, o->compact);
+    FragmentProtoDisassembler_SetOutputMTU(&o->send_disassembler, o->pmtud_base_mtu);
+    PacketRecvInterface *send_input = FragmentProtoDisassembler_GetOutput(&o->send_disassembler);
+    
+    // init FEC encoder
+    if (o->fec_group_size > 0) {
+        if (!FECEncoder_Init(&o->send_fec, o->reactor, send_input, o->fec_group_size, fec_flush_latency)) {
+            PeerLog(o, BLOG_ERROR, "FECEncoder_Init failed");
+            goto fail3;
+        }
+        send_input = FECEncoder_GetOutput(&o->send_fec);
+    }
     
     // init encoder
-    if (!SPProtoEncoder_Init(&o->send_encoder, FragmentProtoDisassembler_GetOutput(&o->send_disassembler), o->sp_params, otp_warning_count, BReactor_PendingGroup(o->reactor), twd)) {
+    if (!SPProtoEncoder_Init(&o->send_encoder, send_input, o->sp_params, otp_warning_count, spproto_batch_size, spproto_window, BReactor_PendingGroup(o->reactor), twd)) {
         PeerLog(o, BLOG_ERROR, "SPProtoEncoder_Init failed");
-        goto fail3;
+        goto fail3a;
     }
     SPProtoEncoder_SetHandlers(&o->send_encoder, handler_otp_warning, user);
     
-    // init connector
-    PacketPassConnector_Init(&o->send_connector, o->effective_socket_mtu, BReactor_PendingGroup(o->reactor));
+    PacketPassInterface *send_output;
+    if (o->num_sockets == 1) {
+        // init connector
+        PacketPassConnector_Init(&o->send_connector, o->effective_socket_mtu, BReactor_PendingGroup(o->reactor));
+        send_output = PacketPassConnector_GetInput(&o->send_connector);
+    } else {
+        // init striping sender
+        PacketPassInterface_Init(&o->send_stripe_input, o->effective_socket_mtu, (PacketPassInterface_handler_send)send_stripe_input_handler_send, o, BReactor_PendingGroup(o->reactor));
+        o->send_stripe_next = 0;
+        o->send_stripe_count = 0;
+        o->send_stripe_busy = -1;
+        o->send_stripe_data = NULL;
+        send_output = &o->send_stripe_input;
+    }
     
     // init buffer
-    if (!SinglePacketBuffer_Init(&o->send_buffer, SPProtoEncoder_GetOutput(&o->send_encoder), PacketPassConnector_GetInput(&o->send_connector), BReactor_PendingGroup(o->reactor))) {
+    if (!SinglePacketBuffer_Init(&o->send_buffer, SPProtoEncoder_GetOutput(&o->send_encoder), send_output, BReactor_PendingGroup(o->reactor))) {
         PeerLog(o, BLOG_ERROR, "SinglePacketBuffer_Init failed");
         goto fail4;
     }
     
+    // set no busy polling
+    o->busy_poll_usecs = 0;
+    o->segment_offload = 0;
+#ifdef BADVPN_USE_AF_XDP
+    o->xdp = NULL;
+#endif
+    
+    // init path MTU discovery
+    if (o->pmtud) {
+        o->pmtud_cur_mtu = o->pmtud_base_mtu;
+        o->pmtud_probe_id = 0;
+        BTimer_Init(&o->pmtud_timer, 0, (BTimer_handler)pmtud_timer_handler, o);
+    }
+    
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_NONE;
+    o->num_active_sockets = 0;
     
     DebugObject_Init(&o->d_obj);
     return 1;
     
 fail4:
-    PacketPassConnector_Free(&o->send_connector);
+    if (o->num_sockets == 1) {
+        PacketPassConnector_Free(&o->send_connector);
+    } else {
+        PacketPassInterface_Free(&o->send_stripe_input);
+    }
     SPProtoEncoder_Free(&o->send_encoder);
+fail3a:
+    if (o->fec_group_size > 0) {
+        FECEncoder_Free(&o->send_fec);
+    }
 fail3:
     FragmentProtoDisassembler_Free(&o->send_disassembler);
-    SinglePacketBuffer_Free(&o->recv_buffer);
 fail2:
-    PacketRecvConnector_Free(&o->recv_connector);
+    while (num_init-- > 0) {
+        struct DatagramPeerIO_socket *sock = &o->sockets[num_init];
+        SinglePacketBuffer_Free(&sock->recv_buffer);
+        PacketRecvConnector_Free(&sock->recv_connector);
+        if (o->num_sockets > 1) {
+            PacketPassFairQueueFlow_Free(&sock->recv_qflow);
+        }
+    }
+    BFree(o->sockets);
+fail1b:
+    if (o->num_sockets > 1) {
+        PacketPassFairQueue_Free(&o->recv_queue);
+    }
+fail1a:
     SPProtoDecoder_Free(&o->recv_decoder);
 fail1:
     PacketPassNotifier_Free(&o->recv_notifier);
+    if (o->fec_group_size > 0) {
+        FECDecoder_Free(&o->recv_fec);
+    }
+fail0a:
     FragmentProtoAssembler_Free(&o->recv_assembler);
 fail0:
     return 0;
@@ -266,24 +723,52 @@ fail0:
 void DatagramPeerIO_Free (DatagramPeerIO *o)
 {
     DebugObject_Free(&o->d_obj);
-
+    
     // reset mode
     reset_mode(o);
     
     // free sending base
     SinglePacketBuffer_Free(&o->send_buffer);
-    PacketPassConnector_Free(&o->send_connector);
+    if (o->num_sockets == 1) {
+        PacketPassConnector_Free(&o->send_connector);
+    } else {
+        PacketPassInterface_Free(&o->send_stripe_input);
+    }
     SPProtoEncoder_Free(&o->send_encoder);
+    if (o->fec_group_size > 0) {
+        FECEncoder_Free(&o->send_fec);
+    }
     FragmentProtoDisassembler_Free(&o->send_disassembler);
     
+    // allow freeing queue flows
+    if (o->num_sockets > 1) {
+        PacketPassFairQueue_PrepareFree(&o->recv_queue);
+    }
+    
+    // free receiving for sockets
+    for (int i = 0; i < o->num_sockets; i++) {
+        struct DatagramPeerIO_socket *sock = &o->sockets[i];
+        SinglePacketBuffer_Free(&sock->recv_buffer);
+        PacketRecvConnector_Free(&sock->recv_connector);
+        if (o->num_sockets > 1) {
+            PacketPassFairQueueFlow_Free(&sock->recv_qflow);
+        }
+    }
+    BFree(o->sockets);
+    
     // free receiving
-    SinglePacketBuffer_Free(&o->recv_buffer);
-    PacketRecvConnector_Free(&o->recv_connector);
+    if (o->num_sockets > 1) {
+        PacketPassFairQueue_Free(&o->recv_queue);
+    }
     SPProtoDecoder_Free(&o->recv_decoder);
     PacketPassNotifier_Free(&o->recv_notifier);
+    if (o->fec_group_size > 0) {
+        FECDecoder_Free(&o->recv_fec);
+    }
     FragmentProtoAssembler_Free(&o->recv_assembler);
 }
 
+
 PacketPassInterface * DatagramPeerIO_GetSendInput (DatagramPeerIO *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -291,6 +776,33 @@ PacketPassInterface * DatagramPeerIO_GetSendInput (DatagramPeerIO *o)
     return FragmentProtoDisassembler_GetInput(&o->send_disassembler);
 }
 
+void DatagramPeerIO_SetBusyPoll (DatagramPeerIO *o, int usecs)
+{
+    ASSERT(usecs >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    o->busy_poll_usecs = usecs;
+}
+
+void DatagramPeerIO_SetSegmentOffload (DatagramPeerIO *o, int enabled)
+{
+    ASSERT(enabled == 0 || enabled == 1)
+    DebugObject_Access(&o->d_obj);
+    
+    o->segment_offload = enabled;
+}
+
+#ifdef BADVPN_USE_AF_XDP
+
+void DatagramPeerIO_SetXdp (DatagramPeerIO *o, BXdp *xdp)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->xdp = xdp;
+}
+
+#endif
+
 int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr)
 {
     DebugObject_Access(&o->d_obj);
@@ -304,25 +816,56 @@ int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr)
         goto fail0;
     }
     
-    // init dgram
-    if (!BDatagram_Init(&o->dgram, addr.type, o->reactor, o, (BDatagram_handler)dgram_handler)) {
-        PeerLog(o, BLOG_ERROR, "BDatagram_Init failed");
-        goto fail0;
+    // init sockets, each gets its own source port
+    int num_init;
+    for (num_init = 0; num_init < o->num_sockets; num_init++) {
+        struct DatagramPeerIO_socket *sock = &o->sockets[num_init];
+        
+        // init dgram
+        if (!BDatagram_Init(&sock->dgram, addr.type, o->reactor, sock, (BDatagram_handler)dgram_handler)) {
+            PeerLog(o, BLOG_ERROR, "BDatagram_Init failed");
+            goto fail1;
+        }
+        
+        // bind to a port chosen by the system, so that the port is
+        // known before sending, see DatagramPeerIO_GetLocalAddr
+        BAddr any_addr;
+        if (addr.type == BADDR_TYPE_IPV4) {
+            BAddr_InitIPv4(&any_addr, 0, 0);
+        } else {
+            uint8_t any_ip[16] = {0};
+            BAddr_InitIPv6(&any_addr, any_ip, 0);
+        }
+        if (!BDatagram_Bind(&sock->dgram, any_addr)) {
+            PeerLog(o, BLOG_ERROR, "BDatagram_Bind failed");
+            BDatagram_Free(&sock->dgram);
+            goto fail1;
+        }
+        
+        // set send address
+        BIPAddr local_addr;
+        BIPAddr_InitInvalid(&local_addr);
+        BDatagram_SetSendAddrs(&sock->dgram, addr, local_addr);
+        
+        // init I/O
+        if (!init_io(o, sock)) {
+            BDatagram_Free(&sock->dgram);
+            goto fail1;
+        }
     }
     
-    // set send address
-    BIPAddr local_addr;
-    BIPAddr_InitInvalid(&local_addr);
-    BDatagram_SetSendAddrs(&o->dgram, addr, local_addr);
-    
-    // init I/O
-    init_io(o);
-    
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_CONNECT;
+    o->num_active_sockets = o->num_sockets;
+    
+    start_sending(o);
     
     return 1;
     
+fail1:
+    while (num_init-- > 0) {
+        free_socket(o, &o->sockets[num_init]);
+    }
 fail0:
     return 0;
 }
@@ -335,35 +878,78 @@ int DatagramPeerIO_Bind (DatagramPeerIO *o, BAddr addr)
     // reset mode
     reset_mode(o);
     
+    // use a single socket
+    struct DatagramPeerIO_socket *sock = &o->sockets[0];
+    
     // init dgram
-    if (!BDatagram_Init(&o->dgram, addr.type, o->reactor, o, (BDatagram_handler)dgram_handler)) {
+    if (!BDatagram_Init(&sock->dgram, addr.type, o->reactor, sock, (BDatagram_handler)dgram_handler)) {
         PeerLog(o, BLOG_ERROR, "BDatagram_Init failed");
         goto fail0;
     }
     
     // bind dgram
-    if (!BDatagram_Bind(&o->dgram, addr)) {
+    if (!BDatagram_Bind(&sock->dgram, addr)) {
         PeerLog(o, BLOG_INFO, "BDatagram_Bind failed");
         goto fail1;
     }
     
     // init I/O
-    init_io(o);
+    if (!init_io(o, sock)) {
+        goto fail1;
+    }
     
     // set recv notifier handler
     PacketPassNotifier_SetHandler(&o->recv_notifier, (PacketPassNotifier_handler_notify)recv_decoder_notifier_handler, o);
     
+    // remember family for punch addresses
+    o->bind_addr_type = addr.type;
+    o->bind_have_peer_addr = 0;
+    
     // set mode
     o->mode = DATAGRAMPEERIO_MODE_BIND;
+    o->num_active_sockets = 1;
+    
+    start_sending(o);
     
     return 1;
     
 fail1:
-    BDatagram_Free(&o->dgram);
+    BDatagram_Free(&sock->dgram);
 fail0:
     return 0;
 }
 
+int DatagramPeerIO_GetLocalAddr (DatagramPeerIO *o, BAddr *addr)
+{
+    ASSERT(o->mode == DATAGRAMPEERIO_MODE_CONNECT)
+    DebugObject_Access(&o->d_obj);
+    
+    return BDatagram_GetLocalAddr(&o->sockets[0].dgram, addr);
+}
+
+int DatagramPeerIO_Punch (DatagramPeerIO *o, BAddr addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // only needed until the peer's address is known from a datagram
+    if (o->mode != DATAGRAMPEERIO_MODE_BIND || o->bind_have_peer_addr) {
+        return 0;
+    }
+    
+    // check address family
+    if (addr.type != o->bind_addr_type) {
+        return 0;
+    }
+    
+    // start sending to the address; this opens a NAT in front of
+    // us for datagrams from it
+    BIPAddr local_addr;
+    BIPAddr_InitInvalid(&local_addr);
+    BDatagram_SetSendAddrs(&o->sockets[0].dgram, addr, local_addr);
+    
+    return 1;
+}
+
 void DatagramPeerIO_SetEncryptionKey (DatagramPeerIO *o, uint8_t *encryption_key)
 {
     ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
@@ -397,6 +983,15 @@ void DatagramPeerIO_SetOTPSendSeed (DatagramPeerIO *o, uint16_t seed_id, uint8_t
     SPProtoEncoder_SetOTPSeed(&o->send_encoder, seed_id, key, iv);
 }
 
+void DatagramPeerIO_PrepareOTPSendSeed (DatagramPeerIO *o, uint8_t *key, uint8_t *iv)
+{
+    ASSERT(SPPROTO_HAVE_OTP(o->sp_params))
+    DebugObject_Access(&o->d_obj);
+    
+    // prepare sending seed
+    SPProtoEncoder_PrepareOTPSeed(&o->send_encoder, key, iv);
+}
+
 void DatagramPeerIO_RemoveOTPSendSeed (DatagramPeerIO *o)
 {
     ASSERT(SPPROTO_HAVE_OTP(o->sp_params))
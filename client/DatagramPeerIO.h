@@ -50,16 +50,35 @@
 #include <flow/SinglePacketBuffer.h>
 #include <flow/PacketRecvConnector.h>
 #include <flow/PacketPassNotifier.h>
+#include <flow/PacketPassFairQueue.h>
 #include <client/FragmentProtoDisassembler.h>
 #include <client/FragmentProtoAssembler.h>
 #include <client/SPProtoEncoder.h>
 #include <client/SPProtoDecoder.h>
+#include <flowextra/FECEncoder.h>
+#include <flowextra/FECDecoder.h>
+
+/**
+ * Maximum number of datagrams sent or received with one system call.
+ */
+#define DATAGRAMPEERIO_BATCH 16
+
+/**
+ * Maximum number of sockets used in connecting mode.
+ */
+#define DATAGRAMPEERIO_MAX_SOCKETS 16
+
+/**
+ * Smallest datagram size path MTU discovery will go down to, which any IPv4
+ * path should carry (576 bytes minus IP and UDP headers).
+ */
+#define DATAGRAMPEERIO_PMTUD_MIN_SOCKET_MTU 548
 
 /**
  * Callback function invoked when an error occurs with the peer connection.
  * The object has entered default state.
  * May be called from within a sending Send call.
- *
+ * 
  * @param user as in {@link DatagramPeerIO_SetHandlers}
  */
 typedef void (*DatagramPeerIO_handler_error) (void *user);
@@ -68,7 +87,7 @@ typedef void (*DatagramPeerIO_handler_error) (void *user);
  * Handler function invoked when the number of used OTPs has reached
  * the specified warning number in {@link DatagramPeerIO_SetOTPWarningHandler}.
  * May be called from within a sending Send call.
- *
+ * 
  * @param user as in {@link DatagramPeerIO_SetHandlers}
  */
 typedef void (*DatagramPeerIO_handler_otp_warning) (void *user);
@@ -82,21 +101,44 @@ typedef void (*DatagramPeerIO_handler_otp_ready) (void *user);
 
 /**
  * Object for comminicating with a peer using a datagram socket.
- *
+ * 
  * The user provides data for sending to the peer through {@link PacketPassInterface}.
  * Received data is provided to the user through {@link PacketPassInterface}.
- *
+ * 
  * The object has a logical state called a mode, which is one of the following:
  *     - default - nothing is send or received
  *     - connecting - an address was provided by the user for sending datagrams to.
- *                    Datagrams are being sent to that address through a socket,
- *                    and datagrams are being received on the same socket.
+ *                    Datagrams are being sent to that address through one or more
+ *                    sockets, and datagrams are being received on the same sockets.
+ *                    With multiple sockets, each has its own source port, and
+ *                    datagrams are spread over them in turn, so that the peer link
+ *                    is spread over receive queues and paths by RSS and ECMP.
  *     - binding - an address was provided by the user to bind a socket to.
  *                 Datagrams are being received on the socket. Datagrams are not being
  *                 sent initially. When a datagram is received, its source address is
- *                 used as a destination address for sending datagrams.
+ *                 used as a destination address for sending datagrams. Until then,
+ *                 the user may give an address to send to with {@link DatagramPeerIO_Punch},
+ *                 so that a NAT in front of the socket lets the peer's datagrams in.
+ * 
+ * If path MTU discovery is enabled, fragmentation of datagrams is disabled, and
+ * the largest datagram size which gets through to the peer is searched for by sending
+ * probes which the peer acknowledges. Frames are then split to fit that size.
+ * The search is repeated periodically, to pick up changes of the path.
+ * Probes from the peer are acknowledged whether discovery is enabled or not.
+ * 
+ * If forward error correction is enabled, FragmentProto packets are sent in FECProto
+ * groups, so that a single lost packet of a group can be recovered by the peer.
+ * The peer must have it enabled too.
  */
-typedef struct {
+struct DatagramPeerIO_socket {
+    struct DatagramPeerIO_s *parent;
+    PacketRecvConnector recv_connector;
+    SinglePacketBuffer recv_buffer;
+    PacketPassFairQueueFlow recv_qflow;
+    BDatagram dgram;
+};
+
+typedef struct DatagramPeerIO_s {
     DebugObject d_obj;
     BReactor *reactor;
     int payload_mtu;
@@ -105,26 +147,60 @@ typedef struct {
     BLog_logfunc logfunc;
     DatagramPeerIO_handler_error handler_error;
     int spproto_payload_mtu;
+    int fragment_mtu;
     int effective_socket_mtu;
+    int fec_group_size;
+    int compact;
+    int busy_poll_usecs;
+    int segment_offload;
+#ifdef BADVPN_USE_AF_XDP
+    BXdp *xdp;
+#endif
+    
+    // path MTU discovery
+    int pmtud;
+    int pmtud_min_mtu;
+    int pmtud_base_mtu;
+    int pmtud_cur_mtu;
+    int pmtud_lo;
+    int pmtud_hi;
+    int pmtud_state;
+    fragmentproto_frameid pmtud_probe_id;
+    int pmtud_probe_len;
+    int pmtud_tries;
+    BTimer pmtud_timer;
     
     // sending base
     FragmentProtoDisassembler send_disassembler;
+    FECEncoder send_fec;
     SPProtoEncoder send_encoder;
     SinglePacketBuffer send_buffer;
     PacketPassConnector send_connector;
     
+    // sending with multiple sockets
+    PacketPassInterface send_stripe_input;
+    int send_stripe_next;
+    int send_stripe_count;
+    int send_stripe_busy;
+    uint8_t *send_stripe_data;
+    int send_stripe_data_len;
+    
+    // sockets
+    int num_sockets;
+    int num_active_sockets;
+    struct DatagramPeerIO_socket *sockets;
+    
     // receiving
-    PacketRecvConnector recv_connector;
-    SinglePacketBuffer recv_buffer;
+    PacketPassFairQueue recv_queue;
     SPProtoDecoder recv_decoder;
     PacketPassNotifier recv_notifier;
+    FECDecoder recv_fec;
     FragmentProtoAssembler recv_assembler;
     
     // mode
     int mode;
-    
-    // datagram object
-    BDatagram dgram;
+    int bind_addr_type;
+    int bind_have_peer_addr;
 } DatagramPeerIO;
 
 /**
@@ -134,19 +210,37 @@ typedef struct {
  * {@link BNetwork_GlobalInit} must have been done.
  * {@link BSecurity_GlobalInitThreadSafe} must have been done if
  * {@link BThreadWorkDispatcher_UsingThreads}(twd) = 1.
- *
+ * 
  * @param o the object
  * @param reactor {@link BReactor} we live in
  * @param payload_mtu maximum payload size. Must be >=0.
  * @param socket_mtu maximum datagram size for the socket. Must be >=0. Must be large enough so it is possible to
  *                   send a FragmentProto chunk with one byte of data over SPProto, i.e. the following has to hold:
- *                   spproto_payload_mtu_for_carrier_mtu(sp_params, socket_mtu) > sizeof(struct fragmentproto_chunk_header)
+ *                   spproto_payload_mtu_for_carrier_mtu(sp_params, socket_mtu) > FRAGMENTPROTO_MAX_HEADER_LEN(compact)
+ *                   (plus sizeof(struct fecproto_header) with forward error correction).
+ *                   With path MTU discovery, this is the datagram size used until a size is found.
+ * @param max_socket_mtu if >=0, enables path MTU discovery, searching for a datagram size between
+ *                       {@link DATAGRAMPEERIO_PMTUD_MIN_SOCKET_MTU} (or socket_mtu if smaller) and this.
+ *                       Must then be >=socket_mtu. If <0, socket_mtu is used as a fixed datagram size.
  * @param sp_params SPProto security parameters
  * @param latency latency parameter to {@link FragmentProtoDisassembler_Init}.
  * @param num_frames num_frames parameter to {@link FragmentProtoAssembler_Init}. Must be >0.
+ * @param fec_group_size if >0, enables forward error correction, sending a parity packet
+ *                       after this many packets. Must be >=0 and <={@link FECPROTO_MAX_GROUP_SIZE}.
+ * @param fec_flush_latency with forward error correction, flush_latency parameter to
+ *                          {@link FECEncoder_Init}. Must then be >=0.
+ * @param compact whether to use compact FragmentProto chunk headers, and compact SPProto
+ *                nonces if sp_params has an AEAD encryption mode and a replay window.
+ *                sp_params.compact is ignored. Must be 0 or 1. The peer must use the same.
+ * @param num_sockets number of sockets to use in connecting mode.
+ *                    Must be >0 and <={@link DATAGRAMPEERIO_MAX_SOCKETS}.
  * @param recv_userif interface to pass received packets to the user. Its MTU must be >=payload_mtu.
  * @param otp_warning_count If using OTPs, after how many encoded packets to call the handler.
  *                          In this case, must be >0 and <=sp_params.otp_num.
+ * @param spproto_batch_size batch_size parameter to {@link SPProtoEncoder_Init} and
+ *                           {@link SPProtoDecoder_Init}. Must be >0.
+ * @param spproto_window window parameter to {@link SPProtoEncoder_Init} and
+ *                       {@link SPProtoDecoder_Init}. Must be >0.
  * @param twd thread work dispatcher
  * @param user value to pass to handlers
  * @param logfunc function which prepends the log prefix using {@link BLog_Append}
@@ -160,11 +254,18 @@ int DatagramPeerIO_Init (
     BReactor *reactor,
     int payload_mtu,
     int socket_mtu,
+    int max_socket_mtu,
     struct spproto_security_params sp_params,
     btime_t latency,
     int num_frames,
+    int fec_group_size,
+    btime_t fec_flush_latency,
+    int compact,
+    int num_sockets,
     PacketPassInterface *recv_userif,
     int otp_warning_count,
+    int spproto_batch_size,
+    int spproto_window,
     BThreadWorkDispatcher *twd,
     void *user,
     BLog_logfunc logfunc,
@@ -175,7 +276,7 @@ int DatagramPeerIO_Init (
 
 /**
  * Frees the object.
- *
+ * 
  * @param o the object
  */
 void DatagramPeerIO_Free (DatagramPeerIO *o);
@@ -184,17 +285,56 @@ void DatagramPeerIO_Free (DatagramPeerIO *o);
  * Returns an interface the user should use to send packets.
  * The OTP warning handler may be called from within Send calls
  * to the interface.
- *
+ * 
  * @param o the object
  * @return sending interface
  */
 PacketPassInterface * DatagramPeerIO_GetSendInput (DatagramPeerIO *o);
 
+/**
+ * Sets the SO_BUSY_POLL option on sockets the object uses (see
+ * {@link BDatagram_SetBusyPoll}). It is applied to sockets created by
+ * subsequent {@link DatagramPeerIO_Connect} and {@link DatagramPeerIO_Bind}
+ * calls. Failure to set the option is logged but not fatal.
+ * 
+ * @param o the object
+ * @param usecs polling time in microseconds, or 0 to not set the option
+ *              (the default). Must be >=0.
+ */
+void DatagramPeerIO_SetBusyPoll (DatagramPeerIO *o, int usecs);
+
+/**
+ * Sets whether sockets the object uses should use UDP segmentation and
+ * receive offload (see {@link BDatagram_SetSegmentOffload}). It is applied
+ * to sockets created by subsequent {@link DatagramPeerIO_Connect} and
+ * {@link DatagramPeerIO_Bind} calls. Failure to enable offload is logged
+ * but not fatal.
+ * 
+ * @param o the object
+ * @param enabled 1 to enable offload, 0 to not (the default)
+ */
+void DatagramPeerIO_SetSegmentOffload (DatagramPeerIO *o, int enabled);
+
+#ifdef BADVPN_USE_AF_XDP
+/**
+ * Sets an AF_XDP fast path for sockets the object uses (see
+ * {@link BDatagram_SetXdp}). It is applied to sockets created by subsequent
+ * {@link DatagramPeerIO_Connect} and {@link DatagramPeerIO_Bind} calls.
+ * Failure to use it is logged but not fatal.
+ * 
+ * @param o the object
+ * @param xdp XDP object, or NULL to not use XDP (the default). Must outlive
+ *            the object.
+ */
+void DatagramPeerIO_SetXdp (DatagramPeerIO *o, BXdp *xdp);
+#endif
+
 /**
  * Attempts to establish connection to the peer which has bound to an address.
+ * This opens num_sockets sockets, as in {@link DatagramPeerIO_Init}.
  * On success, the interface enters connecting mode.
  * On failure, the interface enters default mode.
- *
+ * 
  * @param o the object
  * @param addr address to send packets to
  * @return 1 on success, 0 on failure
@@ -205,7 +345,7 @@ int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr) WARN_UNUSED;
  * Attempts to establish connection to the peer by binding to an address.
  * On success, the interface enters connecting mode.
  * On failure, the interface enters default mode.
- *
+ * 
  * @param o the object
  * @param addr address to bind to. Must be supported according to
  *             {@link BDatagram_AddressFamilySupported}.
@@ -213,10 +353,34 @@ int DatagramPeerIO_Connect (DatagramPeerIO *o, BAddr addr) WARN_UNUSED;
  */
 int DatagramPeerIO_Bind (DatagramPeerIO *o, BAddr addr) WARN_UNUSED;
 
+/**
+ * Returns the local address of the socket used in connecting mode,
+ * or of the first one with multiple sockets.
+ * The interface must be in connecting mode.
+ * 
+ * @param o the object
+ * @param addr returns the local address. Its IP address may be the wildcard address.
+ * @return 1 on success, 0 on failure
+ */
+int DatagramPeerIO_GetLocalAddr (DatagramPeerIO *o, BAddr *addr) WARN_UNUSED;
+
+/**
+ * Starts sending datagrams to an address the peer may be reachable at,
+ * before we have received a datagram from it.
+ * This does nothing and fails if the interface is not in binding mode, if a
+ * datagram was already received, or if the address family does not match
+ * the bound address. May be called again to try another address.
+ * 
+ * @param o the object
+ * @param addr address to send datagrams to
+ * @return 1 if the address is being used, 0 if not
+ */
+int DatagramPeerIO_Punch (DatagramPeerIO *o, BAddr addr);
+
 /**
  * Sets the encryption key to use for sending and receiving.
  * Encryption must be enabled.
- *
+ * 
  * @param o the object
  * @param encryption_key key to use
  */
@@ -225,7 +389,7 @@ void DatagramPeerIO_SetEncryptionKey (DatagramPeerIO *o, uint8_t *encryption_key
 /**
  * Removed the encryption key to use for sending and receiving.
  * Encryption must be enabled.
- *
+ * 
  * @param o the object
  */
 void DatagramPeerIO_RemoveEncryptionKey (DatagramPeerIO *o);
@@ -233,7 +397,7 @@ void DatagramPeerIO_RemoveEncryptionKey (DatagramPeerIO *o);
 /**
  * Sets the OTP seed for sending.
  * OTPs must be enabled.
- *
+ * 
  * @param o the object
  * @param seed_id seed identifier
  * @param key OTP encryption key
@@ -241,10 +405,21 @@ void DatagramPeerIO_RemoveEncryptionKey (DatagramPeerIO *o);
  */
 void DatagramPeerIO_SetOTPSendSeed (DatagramPeerIO *o, uint16_t seed_id, uint8_t *key, uint8_t *iv);
 
+/**
+ * Starts generating the OTPs of a seed for sending, which is expected to be
+ * set with {@link DatagramPeerIO_SetOTPSendSeed} once the peer has confirmed it.
+ * OTPs must be enabled.
+ * 
+ * @param o the object
+ * @param key OTP encryption key
+ * @param iv OTP initialization vector
+ */
+void DatagramPeerIO_PrepareOTPSendSeed (DatagramPeerIO *o, uint8_t *key, uint8_t *iv);
+
 /**
  * Removes the OTP seed for sending of one is configured.
  * OTPs must be enabled.
- *
+ * 
  * @param o the object
  */
 void DatagramPeerIO_RemoveOTPSendSeed (DatagramPeerIO *o);
@@ -252,7 +427,7 @@ void DatagramPeerIO_RemoveOTPSendSeed (DatagramPeerIO *o);
 /**
  * Adds an OTP seed for reciving.
  * OTPs must be enabled.
- *
+ * 
  * @param o the object
  * @param seed_id seed identifier
  * @param key OTP encryption key
@@ -263,7 +438,7 @@ void DatagramPeerIO_AddOTPRecvSeed (DatagramPeerIO *o, uint16_t seed_id, uint8_t
 /**
  * Removes all OTP seeds for reciving.
  * OTPs must be enabled.
- *
+ * 
  * @param o the object
  */
 void DatagramPeerIO_RemoveOTPRecvSeeds (DatagramPeerIO *o);
@@ -0,0 +1,725 @@
+/**
+ * @file BBufferArena.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <misc/balloc.h>
+#include <misc/offset.h>
+
+#include <client/DatagramPeerIOGroup.h>
+
+#include <generated/blog_channel_DatagramPeerIOGroup.h>
+
+#define EVENT_ERROR 1
+#define EVENT_OTP_WARNING 2
+#define EVENT_OTP_READY 4
+
+struct init_args {
+    int payload_mtu;
+    int socket_mtu;
+    int max_socket_mtu;
+    struct spproto_security_params sp_params;
+    btime_t latency;
+    int num_frames;
+    int fec_group_size;
+    btime_t fec_flush_latency;
+    int compact;
+    int num_sockets;
+    PacketPassInterface *recv_userif;
+    int otp_warning_count;
+    int spproto_batch_size;
+    int spproto_window;
+};
+
+struct seed_args {
+    uint16_t seed_id;
+    uint8_t *key;
+    uint8_t *iv;
+};
+
+static int using_threads (DatagramPeerIOGroup *o)
+{
+#ifndef BADVPN_USE_WINAPI
+    return (o->num_threads > 0);
+#else
+    return 0;
+#endif
+}
+
+static void run_call (DatagramPeerIOThread *o, void (*func) (struct DatagramPeerIOGroup_io *io))
+{
+    DatagramPeerIOGroup *g = o->group;
+    
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(g)) {
+        // run in the thread of the object and wait for it
+        g->call_func = func;
+        g->call_io = o->io;
+        BReactorGroup_Thread_Post(&g->group, o->io->thread_index, &g->call_msg);
+        while (sem_wait(&g->call_sem) < 0);
+        return;
+    }
+#endif
+    
+    func(o->io);
+}
+
+static void clear_events (struct DatagramPeerIOGroup_io *io, int events)
+{
+#ifndef BADVPN_USE_WINAPI
+    __atomic_fetch_and(&io->events, ~events, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void report_event (struct DatagramPeerIOGroup_io *io, int event)
+{
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(io->group)) {
+        // remember the event, and post a message unless one is on its way
+        __atomic_fetch_or(&io->events, event, __ATOMIC_SEQ_CST);
+        if (!__atomic_exchange_n(&io->event_posted, 1, __ATOMIC_SEQ_CST)) {
+            BReactorMailbox_Thread_Post(&io->group->mailbox, &io->event_msg);
+        }
+        return;
+    }
+#endif
+    
+    DatagramPeerIOThread *o = io->owner;
+    
+    switch (event) {
+        case EVENT_ERROR:
+            o->handler_error(o->user);
+            return;
+        case EVENT_OTP_WARNING:
+            o->handler_otp_warning(o->user);
+            return;
+        case EVENT_OTP_READY:
+            o->handler_otp_ready(o->user);
+            return;
+        default: ASSERT(0);
+    }
+}
+
+static void pio_logfunc (struct DatagramPeerIOGroup_io *io)
+{
+    io->logfunc(io->user);
+}
+
+static void pio_handler_error (struct DatagramPeerIOGroup_io *io)
+{
+    report_event(io, EVENT_ERROR);
+}
+
+static void pio_handler_otp_warning (struct DatagramPeerIOGroup_io *io)
+{
+    report_event(io, EVENT_OTP_WARNING);
+}
+
+static void pio_handler_otp_ready (struct DatagramPeerIOGroup_io *io)
+{
+    report_event(io, EVENT_OTP_READY);
+}
+
+static void call_init (struct DatagramPeerIOGroup_io *io)
+{
+    DatagramPeerIOGroup *g = io->group;
+    struct init_args *a = io->call_args;
+    
+    BReactor *reactor = g->reactor;
+    BThreadWorkDispatcher *twd = g->twd;
+    PacketPassInterface *recv_if = a->recv_userif;
+    
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(g)) {
+        reactor = BReactorGroup_GetReactor(&g->group, io->thread_index);
+        twd = &g->thread_twds[io->thread_index];
+        
+        // pass received packets to the main thread
+        PacketPassThreadPipe_Sender_Init(&io->recv_pipe, BReactor_PendingGroup(reactor));
+        recv_if = PacketPassThreadPipe_Sender_GetInput(&io->recv_pipe);
+    }
+#endif
+    
+    // init DatagramPeerIO
+    if (!DatagramPeerIO_Init(
+        &io->pio, reactor, a->payload_mtu, a->socket_mtu, a->max_socket_mtu, a->sp_params,
+        a->latency, a->num_frames, a->fec_group_size, a->fec_flush_latency, a->compact, a->num_sockets, recv_if,
+        a->otp_warning_count, a->spproto_batch_size, a->spproto_window, twd, io,
+        (BLog_logfunc)pio_logfunc,
+        (DatagramPeerIO_handler_error)pio_handler_error,
+        (DatagramPeerIO_handler_otp_warning)pio_handler_otp_warning,
+        (DatagramPeerIO_handler_otp_ready)pio_handler_otp_ready
+    )) {
+        goto fail0;
+    }
+    
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(g)) {
+        // take packets to send from the main thread
+        PacketPassThreadPipe_Receiver_Init(&io->send_pipe, DatagramPeerIO_GetSendInput(&io->pio), BReactor_PendingGroup(reactor));
+    }
+#endif
+    
+    io->call_result = 1;
+    return;
+    
+fail0:
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(g)) {
+        PacketPassThreadPipe_Sender_Free(&io->recv_pipe);
+    }
+#endif
+    io->call_result = 0;
+}
+
+static void call_free (struct DatagramPeerIOGroup_io *io)
+{
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(io->group)) {
+        PacketPassThreadPipe_Receiver_Free(&io->send_pipe);
+    }
+#endif
+    
+    // free DatagramPeerIO
+    DatagramPeerIO_Free(&io->pio);
+    
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(io->group)) {
+        PacketPassThreadPipe_Sender_Free(&io->recv_pipe);
+        
+        // let the main thread free the pipes once the messages this thread
+        // posted about them have been delivered
+        BReactorMailbox_Thread_Post(&io->group->mailbox, &io->stopped_msg);
+    }
+#endif
+}
+
+static void call_set_busy_poll (struct DatagramPeerIOGroup_io *io)
+{
+    DatagramPeerIO_SetBusyPoll(&io->pio, *(int *)io->call_args);
+}
+
+static void call_set_segment_offload (struct DatagramPeerIOGroup_io *io)
+{
+    DatagramPeerIO_SetSegmentOffload(&io->pio, *(int *)io->call_args);
+}
+
+#ifdef BADVPN_USE_AF_XDP
+static void call_set_xdp (struct DatagramPeerIOGroup_io *io)
+{
+    DatagramPeerIO_SetXdp(&io->pio, (BXdp *)io->call_args);
+}
+#endif
+
+static void call_connect (struct DatagramPeerIOGroup_io *io)
+{
+    clear_events(io, EVENT_ERROR);
+    io->call_result = DatagramPeerIO_Connect(&io->pio, *(BAddr *)io->call_args);
+}
+
+static void call_bind (struct DatagramPeerIOGroup_io *io)
+{
+    clear_events(io, EVENT_ERROR);
+    io->call_result = DatagramPeerIO_Bind(&io->pio, *(BAddr *)io->call_args);
+}
+
+static void call_get_local_addr (struct DatagramPeerIOGroup_io *io)
+{
+    io->call_result = DatagramPeerIO_GetLocalAddr(&io->pio, (BAddr *)io->call_args);
+}
+
+static void call_punch (struct DatagramPeerIOGroup_io *io)
+{
+    io->call_result = DatagramPeerIO_Punch(&io->pio, *(BAddr *)io->call_args);
+}
+
+static void call_set_encryption_key (struct DatagramPeerIOGroup_io *io)
+{
+    DatagramPeerIO_SetEncryptionKey(&io->pio, (uint8_t *)io->call_args);
+}
+
+static void call_set_otp_send_seed (struct DatagramPeerIOGroup_io *io)
+{
+    struct seed_args *a = io->call_args;
+    
+    clear_events(io, EVENT_OTP_WARNING);
+    DatagramPeerIO_SetOTPSendSeed(&io->pio, a->seed_id, a->key, a->iv);
+}
+
+static void call_prepare_otp_send_seed (struct DatagramPeerIOGroup_io *io)
+{
+    struct seed_args *a = io->call_args;
+    
+    DatagramPeerIO_PrepareOTPSendSeed(&io->pio, a->key, a->iv);
+}
+
+static void call_add_otp_recv_seed (struct DatagramPeerIOGroup_io *io)
+{
+    struct seed_args *a = io->call_args;
+    
+    clear_events(io, EVENT_OTP_READY);
+    DatagramPeerIO_AddOTPRecvSeed(&io->pio, a->seed_id, a->key, a->iv);
+}
+
+#ifndef BADVPN_USE_WINAPI
+
+static void free_pipes (struct DatagramPeerIOGroup_io *io)
+{
+    PacketPassThreadPipe_Free(&io->recv_pipe);
+    PacketPassThreadPipe_Free(&io->send_pipe);
+}
+
+static void call_msg_handler (DatagramPeerIOGroup *o)
+{
+    o->call_func(o->call_io);
+    
+    // report to run_call
+    ASSERT_FORCE(sem_post(&o->call_sem) == 0)
+}
+
+static void event_msg_handler (struct DatagramPeerIOGroup_io *io)
+{
+    // allow posting again before looking at the events, so that none is missed
+    __atomic_store_n(&io->event_posted, 0, __ATOMIC_SEQ_CST);
+    int events = __atomic_exchange_n(&io->events, 0, __ATOMIC_SEQ_CST);
+    
+    // ignore events of an object being freed
+    if (!io->owner) {
+        return;
+    }
+    
+    DatagramPeerIOThread *o = io->owner;
+    DebugObject_Access(&o->d_obj);
+    
+    // the object has entered default mode, other events don't matter
+    if ((events & EVENT_ERROR)) {
+        o->handler_error(o->user);
+        return;
+    }
+    
+    if ((events & EVENT_OTP_WARNING)) {
+        o->handler_otp_warning(o->user);
+        if (!io->owner) {
+            return;
+        }
+    }
+    
+    if ((events & EVENT_OTP_READY)) {
+        o->handler_otp_ready(o->user);
+        return;
+    }
+}
+
+static void stopped_msg_handler (struct DatagramPeerIOGroup_io *io)
+{
+    DatagramPeerIOGroup *g = io->group;
+    ASSERT(!io->owner)
+    DebugObject_Access(&g->d_obj);
+    
+    // nothing refers to the object any more
+    LinkedList1_Remove(&g->stopping_list, &io->stopping_list_node);
+    free_pipes(io);
+    BFree(io);
+}
+
+static void thread_start_handler (DatagramPeerIOGroup *o, int index, BReactor *reactor)
+{
+    // objects in the thread do their work in the thread, like everything else
+    ASSERT_FORCE(BThreadWorkDispatcher_Init(&o->thread_twds[index], reactor, 0))
+    
+    BLog(BLOG_DEBUG, "thread %d started", index);
+}
+
+static void thread_stop_handler (DatagramPeerIOGroup *o, int index, BReactor *reactor)
+{
+    BThreadWorkDispatcher_Free(&o->thread_twds[index]);
+}
+
+#endif
+
+int DatagramPeerIOGroup_Init (DatagramPeerIOGroup *o, BReactor *reactor, BThreadWorkDispatcher *twd, int num_threads)
+{
+    ASSERT(num_threads >= 0)
+    ASSERT(num_threads <= DATAGRAMPEERIOGROUP_MAX_THREADS)
+#ifdef BADVPN_USE_WINAPI
+    ASSERT(num_threads == 0)
+#endif
+    
+    // init arguments
+    o->reactor = reactor;
+    o->twd = twd;
+    o->num_threads = num_threads;
+    
+#ifndef BADVPN_USE_WINAPI
+    if (num_threads > 0) {
+        // init mailbox for messages from the threads
+        if (!BReactorMailbox_Init(&o->mailbox, reactor)) {
+            BLog(BLOG_ERROR, "BReactorMailbox_Init failed");
+            goto fail0;
+        }
+        
+        // init semaphore for waiting for calls
+        if (sem_init(&o->call_sem, 0, 0) < 0) {
+            BLog(BLOG_ERROR, "sem_init failed");
+            goto fail1;
+        }
+        
+        // init call message
+        BReactorMailboxMessage_Init(&o->call_msg, (BReactorMailboxMessage_handler)call_msg_handler, o);
+        
+        // no objects yet
+        for (int i = 0; i < num_threads; i++) {
+            o->num_ios[i] = 0;
+        }
+        LinkedList1_Init(&o->stopping_list);
+        
+        // start threads
+        if (!BReactorGroup_Init(&o->group, num_threads, 0, o, (BReactorGroup_handler)thread_start_handler, (BReactorGroup_handler)thread_stop_handler)) {
+            BLog(BLOG_ERROR, "BReactorGroup_Init failed");
+            goto fail2;
+        }
+    }
+#endif
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_ctr);
+    return 1;
+    
+#ifndef BADVPN_USE_WINAPI
+fail2:
+    ASSERT_FORCE(sem_destroy(&o->call_sem) == 0)
+fail1:
+    BReactorMailbox_Free(&o->mailbox);
+fail0:
+    return 0;
+#endif
+}
+
+void DatagramPeerIOGroup_Free (DatagramPeerIOGroup *o)
+{
+    DebugCounter_Free(&o->d_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+#ifndef BADVPN_USE_WINAPI
+    if (o->num_threads > 0) {
+        // stop threads; there are no objects, so they post nothing any more
+        BReactorGroup_Free(&o->group);
+        
+        // free mailbox, discarding any messages from the threads
+        BReactorMailbox_Free(&o->mailbox);
+        
+        // free objects whose stopped messages were discarded
+        LinkedList1Node *node;
+        while (node = LinkedList1_GetFirst(&o->stopping_list)) {
+            struct DatagramPeerIOGroup_io *io = UPPER_OBJECT(node, struct DatagramPeerIOGroup_io, stopping_list_node);
+            LinkedList1_Remove(&o->stopping_list, &io->stopping_list_node);
+            free_pipes(io);
+            BFree(io);
+        }
+        
+        // free semaphore
+        ASSERT_FORCE(sem_destroy(&o->call_sem) == 0)
+    }
+#endif
+}
+
+int DatagramPeerIOThread_Init (
+    DatagramPeerIOThread *o,
+    DatagramPeerIOGroup *group,
+    int payload_mtu,
+    int socket_mtu,
+    int max_socket_mtu,
+    struct spproto_security_params sp_params,
+    btime_t latency,
+    int num_frames,
+    int fec_group_size,
+    btime_t fec_flush_latency,
+    int compact,
+    int num_sockets,
+    PacketPassInterface *recv_userif,
+    int otp_warning_count,
+    int spproto_batch_size,
+    int spproto_window,
+    void *user,
+    BLog_logfunc logfunc,
+    DatagramPeerIO_handler_error handler_error,
+    DatagramPeerIO_handler_otp_warning handler_otp_warning,
+    DatagramPeerIO_handler_otp_ready handler_otp_ready
+)
+{
+    DebugObject_Access(&group->d_obj);
+    ASSERT(payload_mtu >= 0)
+    ASSERT(PacketPassInterface_GetMTU(recv_userif) >= payload_mtu)
+    
+    // init arguments
+    o->group = group;
+    o->user = user;
+    o->handler_error = handler_error;
+    o->handler_otp_warning = handler_otp_warning;
+    o->handler_otp_ready = handler_otp_ready;
+    
+    // allocate state shared with the thread
+    struct DatagramPeerIOGroup_io *io = (struct DatagramPeerIOGroup_io *)BAlloc(sizeof(*io));
+    if (!io) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    o->io = io;
+    io->group = group;
+    io->owner = o;
+    io->user = user;
+    io->logfunc = logfunc;
+    io->thread_index = -1;
+    
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(group)) {
+        // choose the thread with the fewest objects
+        io->thread_index = 0;
+        for (int i = 1; i < group->num_threads; i++) {
+            if (group->num_ios[i] < group->num_ios[io->thread_index]) {
+                io->thread_index = i;
+            }
+        }
+        BReactorMailbox *thread_mailbox = BReactorGroup_GetMailbox(&group->group, io->thread_index);
+        
+        // init pipes between the main thread and the object's thread
+        if (!PacketPassThreadPipe_Init(&io->send_pipe, payload_mtu, DATAGRAMPEERIOGROUP_PIPE_PACKETS, &group->mailbox, thread_mailbox)) {
+            BLog(BLOG_ERROR, "PacketPassThreadPipe_Init failed");
+            goto fail1;
+        }
+        if (!PacketPassThreadPipe_Init(&io->recv_pipe, payload_mtu, DATAGRAMPEERIOGROUP_PIPE_PACKETS, thread_mailbox, &group->mailbox)) {
+            BLog(BLOG_ERROR, "PacketPassThreadPipe_Init failed");
+            goto fail2;
+        }
+        
+        // init messages from the thread
+        io->events = 0;
+        io->event_posted = 0;
+        BReactorMailboxMessage_Init(&io->event_msg, (BReactorMailboxMessage_handler)event_msg_handler, io);
+        BReactorMailboxMessage_Init(&io->stopped_msg, (BReactorMailboxMessage_handler)stopped_msg_handler, io);
+        
+        // init our sides of the pipes
+        PacketPassThreadPipe_Sender_Init(&io->send_pipe, BReactor_PendingGroup(group->reactor));
+        PacketPassThreadPipe_Receiver_Init(&io->recv_pipe, recv_userif, BReactor_PendingGroup(group->reactor));
+    }
+#endif
+    
+    // init DatagramPeerIO in its thread
+    struct init_args args = {
+        .payload_mtu = payload_mtu,
+        .socket_mtu = socket_mtu,
+        .max_socket_mtu = max_socket_mtu,
+        .sp_params = sp_params,
+        .latency = latency,
+        .num_frames = num_frames,
+        .fec_group_size = fec_group_size,
+        .fec_flush_latency = fec_flush_latency,
+        .compact = compact,
+        .num_sockets = num_sockets,
+        .recv_userif = recv_userif,
+        .otp_warning_count = otp_warning_count,
+        .spproto_batch_size = spproto_batch_size,
+        .spproto_window = spproto_window
+    };
+    io->call_args = &args;
+    run_call(o, call_init);
+    if (!io->call_result) {
+        BLog(BLOG_ERROR, "DatagramPeerIO_Init failed");
+        goto fail3;
+    }
+    
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(group)) {
+        group->num_ios[io->thread_index]++;
+    }
+#endif
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Increment(&group->d_ctr);
+    return 1;
+    
+fail3:
+#ifndef BADVPN_USE_WINAPI
+    // nothing was posted about the pipes yet
+    if (using_threads(group)) {
+        PacketPassThreadPipe_Receiver_Free(&io->recv_pipe);
+        PacketPassThreadPipe_Sender_Free(&io->send_pipe);
+        PacketPassThreadPipe_Free(&io->recv_pipe);
+    }
+fail2:
+    if (using_threads(group)) {
+        PacketPassThreadPipe_Free(&io->send_pipe);
+    }
+fail1:
+#endif
+    BFree(io);
+fail0:
+    return 0;
+}
+
+void DatagramPeerIOThread_Free (DatagramPeerIOThread *o)
+{
+    DatagramPeerIOGroup *g = o->group;
+    struct DatagramPeerIOGroup_io *io = o->io;
+    DebugCounter_Decrement(&g->d_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(g)) {
+        // free our sides of the pipes
+        PacketPassThreadPipe_Receiver_Free(&io->recv_pipe);
+        PacketPassThreadPipe_Sender_Free(&io->send_pipe);
+        
+        // ignore events which are still on their way, and keep the shared
+        // state until the thread's stopped message arrives
+        io->owner = NULL;
+        LinkedList1_Append(&g->stopping_list, &io->stopping_list_node);
+        g->num_ios[io->thread_index]--;
+        
+        // free DatagramPeerIO in its thread
+        run_call(o, call_free);
+        return;
+    }
+#endif
+    
+    // free DatagramPeerIO
+    run_call(o, call_free);
+    
+    // free shared state
+    BFree(io);
+}
+
+PacketPassInterface * DatagramPeerIOThread_GetSendInput (DatagramPeerIOThread *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+#ifndef BADVPN_USE_WINAPI
+    if (using_threads(o->group)) {
+        return PacketPassThreadPipe_Sender_GetInput(&o->io->send_pipe);
+    }
+#endif
+    
+    return DatagramPeerIO_GetSendInput(&o->io->pio);
+}
+
+void DatagramPeerIOThread_SetBusyPoll (DatagramPeerIOThread *o, int usecs)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->io->call_args = &usecs;
+    run_call(o, call_set_busy_poll);
+}
+
+void DatagramPeerIOThread_SetSegmentOffload (DatagramPeerIOThread *o, int enabled)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->io->call_args = &enabled;
+    run_call(o, call_set_segment_offload);
+}
+
+#ifdef BADVPN_USE_AF_XDP
+void DatagramPeerIOThread_SetXdp (DatagramPeerIOThread *o, BXdp *xdp)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!xdp || !using_threads(o->group))
+    
+    o->io->call_args = xdp;
+    run_call(o, call_set_xdp);
+}
+#endif
+
+int DatagramPeerIOThread_Connect (DatagramPeerIOThread *o, BAddr addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->io->call_args = &addr;
+    run_call(o, call_connect);
+    return o->io->call_result;
+}
+
+int DatagramPeerIOThread_Bind (DatagramPeerIOThread *o, BAddr addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->io->call_args = &addr;
+    run_call(o, call_bind);
+    return o->io->call_result;
+}
+
+int DatagramPeerIOThread_GetLocalAddr (DatagramPeerIOThread *o, BAddr *addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->io->call_args = addr;
+    run_call(o, call_get_local_addr);
+    return o->io->call_result;
+}
+
+int DatagramPeerIOThread_Punch (DatagramPeerIOThread *o, BAddr addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->io->call_args = &addr;
+    run_call(o, call_punch);
+    return o->io->call_result;
+}
+
+void DatagramPeerIOThread_SetEncryptionKey (DatagramPeerIOThread *o, uint8_t *encryption_key)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->io->call_args = encryption_key;
+    run_call(o, call_set_encryption_key);
+}
+
+void DatagramPeerIOThread_SetOTPSendSeed (DatagramPeerIOThread *o, uint16_t seed_id, uint8_t *key, uint8_t *iv)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    struct seed_args args = {seed_id, key, iv};
+    o->io->call_args = &args;
+    run_call(o, call_set_otp_send_seed);
+}
+
+void DatagramPeerIOThread_PrepareOTPSendSeed (DatagramPeerIOThread *o, uint8_t *key, uint8_t *iv)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    struct seed_args args = {0, key, iv};
+    o->io->call_args = &args;
+    run_call(o, call_prepare_otp_send_seed);
+}
+
+void DatagramPeerIOThread_AddOTPRecvSeed (DatagramPeerIOThread *o, uint16_t seed_id, uint8_t *key, uint8_t *iv)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    struct seed_args args = {seed_id, key, iv};
+    o->io->call_args = &args;
+    run_call(o, call_add_otp_recv_seed);
+}
@@ -0,0 +1,287 @@
+/**
+ * @file BBufferArena.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Group of reactor threads running {@link DatagramPeerIO} objects.
+ */
+
+#ifndef BADVPN_CLIENT_DATAGRAMPEERIOGROUP_H
+#define BADVPN_CLIENT_DATAGRAMPEERIOGROUP_H
+
+#include <stdint.h>
+
+#ifndef BADVPN_USE_WINAPI
+#include <semaphore.h>
+#endif
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <base/DebugObject.h>
+#include <base/BLog.h>
+#include <structure/LinkedList1.h>
+#include <system/BReactor.h>
+#include <system/BAddr.h>
+#include <threadwork/BThreadWork.h>
+#include <flow/PacketPassInterface.h>
+#include <client/DatagramPeerIO.h>
+
+#ifndef BADVPN_USE_WINAPI
+#include <system/BReactorGroup.h>
+#include <system/BReactorMailbox.h>
+#include <flowextra/PacketPassThreadPipe.h>
+#endif
+
+/**
+ * Maximum number of threads in a group.
+ */
+#define DATAGRAMPEERIOGROUP_MAX_THREADS 64
+
+/**
+ * Number of packets queued between the main thread and the thread of an
+ * object, in each direction.
+ */
+#define DATAGRAMPEERIOGROUP_PIPE_PACKETS 64
+
+struct DatagramPeerIOGroup_io;
+
+/**
+ * Group of reactor threads running {@link DatagramPeerIO} objects, so that
+ * SPProto encryption, fragmentation and socket I/O of peers are spread over
+ * CPU cores.
+ * 
+ * Each {@link DatagramPeerIOThread} is placed on the thread with the fewest
+ * objects and stays there, so all packets of a peer are handled by one core.
+ * Packets pass between the main thread and the thread of an object through
+ * a {@link PacketPassThreadPipe} in each direction. Control functions like
+ * {@link DatagramPeerIOThread_Connect} are run in the thread of the object
+ * while the main thread waits for them, and handlers are called in the main
+ * thread.
+ * 
+ * A group with no threads runs its objects in the main reactor directly,
+ * behaving exactly like plain {@link DatagramPeerIO} objects.
+ */
+typedef struct {
+    BReactor *reactor;
+    BThreadWorkDispatcher *twd;
+    int num_threads;
+#ifndef BADVPN_USE_WINAPI
+    int num_ios[DATAGRAMPEERIOGROUP_MAX_THREADS];
+    BThreadWorkDispatcher thread_twds[DATAGRAMPEERIOGROUP_MAX_THREADS];
+    BReactorMailbox mailbox;
+    BReactorGroup group;
+    sem_t call_sem;
+    BReactorMailboxMessage call_msg;
+    void (*call_func) (struct DatagramPeerIOGroup_io *io);
+    struct DatagramPeerIOGroup_io *call_io;
+    LinkedList1 stopping_list;
+#endif
+    DebugObject d_obj;
+    DebugCounter d_ctr;
+} DatagramPeerIOGroup;
+
+/**
+ * A {@link DatagramPeerIO} running in a thread of a {@link DatagramPeerIOGroup}.
+ * 
+ * The functions correspond to those of {@link DatagramPeerIO}, and must be
+ * called from the main thread. Handlers are called from the main thread too,
+ * but not from within Send calls to the sending interface, except when the
+ * group has no threads.
+ */
+typedef struct DatagramPeerIOThread_s {
+    DatagramPeerIOGroup *group;
+    struct DatagramPeerIOGroup_io *io;
+    void *user;
+    DatagramPeerIO_handler_error handler_error;
+    DatagramPeerIO_handler_otp_warning handler_otp_warning;
+    DatagramPeerIO_handler_otp_ready handler_otp_ready;
+    DebugObject d_obj;
+} DatagramPeerIOThread;
+
+struct DatagramPeerIOGroup_io {
+    DatagramPeerIOGroup *group;
+    DatagramPeerIOThread *owner;
+    int thread_index;
+    void *user;
+    BLog_logfunc logfunc;
+    DatagramPeerIO pio;
+    void *call_args;
+    int call_result;
+#ifndef BADVPN_USE_WINAPI
+    PacketPassThreadPipe send_pipe;
+    PacketPassThreadPipe recv_pipe;
+    int events;
+    int event_posted;
+    BReactorMailboxMessage event_msg;
+    BReactorMailboxMessage stopped_msg;
+    LinkedList1Node stopping_list_node;
+#endif
+};
+
+/**
+ * Initializes the group.
+ * {@link BSecurity_GlobalInitThreadSafe} must have been done if num_threads>0.
+ * 
+ * @param o the object
+ * @param reactor {@link BReactor} of the main thread
+ * @param twd thread work dispatcher used by objects when there are no threads.
+ *            Objects in threads do their work in their thread.
+ * @param num_threads number of threads to run objects in, or 0 to run them
+ *                    in the main reactor. Must be >=0 and
+ *                    <={@link DATAGRAMPEERIOGROUP_MAX_THREADS}. Threads are not
+ *                    supported on Windows.
+ * @return 1 on success, 0 on failure
+ */
+int DatagramPeerIOGroup_Init (DatagramPeerIOGroup *o, BReactor *reactor, BThreadWorkDispatcher *twd, int num_threads) WARN_UNUSED;
+
+/**
+ * Frees the group.
+ * There must be no {@link DatagramPeerIOThread} objects in the group.
+ * 
+ * @param o the object
+ */
+void DatagramPeerIOGroup_Free (DatagramPeerIOGroup *o);
+
+/**
+ * Initializes the object, in the thread of the group with the fewest objects.
+ * The arguments are as in {@link DatagramPeerIO_Init}. The logging function is
+ * called from the thread of the object, with the log mutex held.
+ * 
+ * @return 1 on success, 0 on failure
+ */
+int DatagramPeerIOThread_Init (
+    DatagramPeerIOThread *o,
+    DatagramPeerIOGroup *group,
+    int payload_mtu,
+    int socket_mtu,
+    int max_socket_mtu,
+    struct spproto_security_params sp_params,
+    btime_t latency,
+    int num_frames,
+    int fec_group_size,
+    btime_t fec_flush_latency,
+    int compact,
+    int num_sockets,
+    PacketPassInterface *recv_userif,
+    int otp_warning_count,
+    int spproto_batch_size,
+    int spproto_window,
+    void *user,
+    BLog_logfunc logfunc,
+    DatagramPeerIO_handler_error handler_error,
+    DatagramPeerIO_handler_otp_warning handler_otp_warning,
+    DatagramPeerIO_handler_otp_ready handler_otp_ready
+) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * The thread of the object stops using it, and no more handlers are called,
+ * before this returns.
+ * 
+ * @param o the object
+ */
+void DatagramPeerIOThread_Free (DatagramPeerIOThread *o);
+
+/**
+ * Returns an interface the user should use to send packets, as in
+ * {@link DatagramPeerIO_GetSendInput}.
+ * The interface supports cancel functionality and vectored sends.
+ * 
+ * @param o the object
+ * @return sending interface
+ */
+PacketPassInterface * DatagramPeerIOThread_GetSendInput (DatagramPeerIOThread *o);
+
+/**
+ * As in {@link DatagramPeerIO_SetBusyPoll}.
+ */
+void DatagramPeerIOThread_SetBusyPoll (DatagramPeerIOThread *o, int usecs);
+
+/**
+ * As in {@link DatagramPeerIO_SetSegmentOffload}.
+ */
+void DatagramPeerIOThread_SetSegmentOffload (DatagramPeerIOThread *o, int enabled);
+
+#ifdef BADVPN_USE_AF_XDP
+/**
+ * As in {@link DatagramPeerIO_SetXdp}.
+ * The XDP object lives in the main reactor, so the group must have no threads
+ * if xdp is not NULL.
+ */
+void DatagramPeerIOThread_SetXdp (DatagramPeerIOThread *o, BXdp *xdp);
+#endif
+
+/**
+ * As in {@link DatagramPeerIO_Connect}.
+ * An error which was reported by the thread before, but not delivered yet,
+ * is discarded.
+ */
+int DatagramPeerIOThread_Connect (DatagramPeerIOThread *o, BAddr addr) WARN_UNUSED;
+
+/**
+ * As in {@link DatagramPeerIO_Bind}.
+ * An error which was reported by the thread before, but not delivered yet,
+ * is discarded.
+ */
+int DatagramPeerIOThread_Bind (DatagramPeerIOThread *o, BAddr addr) WARN_UNUSED;
+
+/**
+ * As in {@link DatagramPeerIO_GetLocalAddr}.
+ */
+int DatagramPeerIOThread_GetLocalAddr (DatagramPeerIOThread *o, BAddr *addr) WARN_UNUSED;
+
+/**
+ * As in {@link DatagramPeerIO_Punch}.
+ */
+int DatagramPeerIOThread_Punch (DatagramPeerIOThread *o, BAddr addr);
+
+/**
+ * As in {@link DatagramPeerIO_SetEncryptionKey}.
+ */
+void DatagramPeerIOThread_SetEncryptionKey (DatagramPeerIOThread *o, uint8_t *encryption_key);
+
+/**
+ * As in {@link DatagramPeerIO_SetOTPSendSeed}.
+ * An OTP warning which was reported by the thread for the previous seed, but
+ * not delivered yet, is discarded.
+ */
+void DatagramPeerIOThread_SetOTPSendSeed (DatagramPeerIOThread *o, uint16_t seed_id, uint8_t *key, uint8_t *iv);
+
+/**
+ * As in {@link DatagramPeerIO_PrepareOTPSendSeed}.
+ */
+void DatagramPeerIOThread_PrepareOTPSendSeed (DatagramPeerIOThread *o, uint8_t *key, uint8_t *iv);
+
+/**
+ * As in {@link DatagramPeerIO_AddOTPRecvSeed}.
+ * An OTP ready notification which was reported by the thread for the previous
+ * seed, but not delivered yet, is discarded.
+ */
+void DatagramPeerIOThread_AddOTPRecvSeed (DatagramPeerIOThread *o, uint16_t seed_id, uint8_t *key, uint8_t *iv);
+
+#endif
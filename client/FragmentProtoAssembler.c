@@ -33,6 +33,9 @@
 #include <misc/offset.h>
 #include <misc/byteorder.h>
 #include <misc/balloc.h>
+#include <misc/balign.h>
+#include <misc/minmax.h>
+#include <base/BPacketTrace.h>
 
 #include "FragmentProtoAssembler.h"
 
@@ -40,45 +43,54 @@
 
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-#include "FragmentProtoAssembler_tree.h"
-#include <structure/SAvl_impl.h>
+static struct FragmentProtoAssembler_frame ** frame_slot (FragmentProtoAssembler *o, fragmentproto_frameid id)
+{
+    return &o->slots[id & (o->num_slots - 1)];
+}
 
 static void free_frame (FragmentProtoAssembler *o, struct FragmentProtoAssembler_frame *frame)
 {
+    ASSERT(*frame_slot(o, frame->id) == frame)
+    
     // remove from used list
     LinkedList1_Remove(&o->frames_used, &frame->list_node);
-    // remove from used tree
-    FPAFramesTree_Remove(&o->frames_used_tree, 0, frame);
+    // remove from slot
+    *frame_slot(o, frame->id) = NULL;
     
     // append to free list
     LinkedList1_Append(&o->frames_free, &frame->list_node);
 }
 
-static void free_oldest_frame (FragmentProtoAssembler *o)
+static int frame_is_timed_out (struct FragmentProtoAssembler_frame *frame, btime_t now)
 {
-    ASSERT(!LinkedList1_IsEmpty(&o->frames_used))
-    
-    // obtain oldest frame (first on the list)
-    LinkedList1Node *list_node = LinkedList1_GetFirst(&o->frames_used);
-    ASSERT(list_node)
-    struct FragmentProtoAssembler_frame *frame = UPPER_OBJECT(list_node, struct FragmentProtoAssembler_frame, list_node);
-    
-    // free frame
-    free_frame(o, frame);
+    return (now - frame->time > FPA_FRAME_TIMEOUT);
 }
 
-static struct FragmentProtoAssembler_frame * allocate_new_frame (FragmentProtoAssembler *o, fragmentproto_frameid id)
+static struct FragmentProtoAssembler_frame * allocate_new_frame (FragmentProtoAssembler *o, fragmentproto_frameid id, btime_t now)
 {
-    ASSERT(!FPAFramesTree_LookupExact(&o->frames_used_tree, 0, id))
+    ASSERT(!*frame_slot(o, id))
+    
+    // free timed out frames; the least recently used ones are first on the list
+    LinkedList1Node *list_node;
+    while ((list_node = LinkedList1_GetFirst(&o->frames_used))) {
+        struct FragmentProtoAssembler_frame *frame = UPPER_OBJECT(list_node, struct FragmentProtoAssembler_frame, list_node);
+        if (!frame_is_timed_out(frame, now)) {
+            break;
+        }
+        PeerLog(o, BLOG_INFO, "freeing timed out frame");
+        free_frame(o, frame);
+    }
     
-    // if there are no free entries, free the oldest used one
+    // if there are no free entries, free the least recently used one
     if (LinkedList1_IsEmpty(&o->frames_free)) {
         PeerLog(o, BLOG_INFO, "freeing used frame");
-        free_oldest_frame(o);
+        list_node = LinkedList1_GetFirst(&o->frames_used);
+        ASSERT(list_node)
+        free_frame(o, UPPER_OBJECT(list_node, struct FragmentProtoAssembler_frame, list_node));
     }
     
     // obtain frame entry
-    LinkedList1Node *list_node = LinkedList1_GetFirst(&o->frames_free);
+    list_node = LinkedList1_GetFirst(&o->frames_free);
     ASSERT(list_node)
     struct FragmentProtoAssembler_frame *frame = UPPER_OBJECT(list_node, struct FragmentProtoAssembler_frame, list_node);
     
@@ -87,71 +99,103 @@ static struct FragmentProtoAssembler_frame * allocate_new_frame (FragmentProtoAs
     
     // initialize values
     frame->id = id;
-    frame->time = o->time;
-    frame->num_chunks = 0;
+    frame->time = now;
     frame->sum = 0;
     frame->length = -1;
     frame->length_so_far = 0;
+    memset(frame->bitmap, 0, o->bitmap_words * sizeof(frame->bitmap[0]));
     
     // append to used list
     LinkedList1_Append(&o->frames_used, &frame->list_node);
-    // insert to used tree
-    int res = FPAFramesTree_Insert(&o->frames_used_tree, 0, frame, NULL);
-    ASSERT_EXECUTE(res)
+    // put into slot
+    *frame_slot(o, id) = frame;
     
     return frame;
 }
 
-static int chunks_overlap (int c1_start, int c1_len, int c2_start, int c2_len)
+static struct FragmentProtoAssembler_frame * lookup_frame (FragmentProtoAssembler *o, fragmentproto_frameid id, btime_t now)
 {
-    return (c1_start + c1_len > c2_start && c2_start + c2_len > c1_start);
+    struct FragmentProtoAssembler_frame *frame = *frame_slot(o, id);
+    
+    if (frame && frame->id != id) {
+        // The slot is taken by another frame. Frame IDs are ascending, so if ours is newer,
+        // that frame is num_slots or more frames behind and won't be completed anymore.
+        if ((int16_t)(id - frame->id) < 0) {
+            PeerLog(o, BLOG_INFO, "chunk for frame which is too old");
+            return NULL;
+        }
+        PeerLog(o, BLOG_INFO, "freeing frame overtaken by newer ones");
+        free_frame(o, frame);
+        frame = NULL;
+    }
+    else if (frame && frame_is_timed_out(frame, now)) {
+        // frame is timed out, remove it and use a new one
+        PeerLog(o, BLOG_INFO, "freeing timed out frame (while processing chunk)");
+        free_frame(o, frame);
+        frame = NULL;
+    }
+    
+    if (!frame) {
+        frame = allocate_new_frame(o, id, now);
+    }
+    
+    return frame;
 }
 
-static int frame_is_timed_out (FragmentProtoAssembler *o, struct FragmentProtoAssembler_frame *frame)
+/**
+ * Tells whether the bytes [start, start+len) of the frame have been
+ * received: 0 if none, 1 if all, -1 if some.
+ */
+static int bitmap_check (FragmentProtoAssembler *o, struct FragmentProtoAssembler_frame *frame, int start, int len)
 {
-    ASSERT(frame->time <= o->time)
+    ASSERT(len > 0)
+    
+    int first = start / 32;
+    int last = (start + len - 1) / 32;
+    uint32_t first_mask = UINT32_MAX << (start % 32);
+    uint32_t last_mask = UINT32_MAX >> (31 - (start + len - 1) % 32);
+    
+    uint32_t have_set = 0;
+    uint32_t have_clear = 0;
     
-    return (o->time - frame->time > o->time_tolerance);
+    for (int i = first; i <= last; i++) {
+        uint32_t mask = UINT32_MAX;
+        if (i == first) {
+            mask &= first_mask;
+        }
+        if (i == last) {
+            mask &= last_mask;
+        }
+        uint32_t word = frame->bitmap[i];
+        have_set |= word & mask;
+        have_clear |= ~word & mask;
+    }
+    
+    return (have_set ? (have_clear ? -1 : 1) : 0);
 }
 
-static void reduce_times (FragmentProtoAssembler *o)
+static void bitmap_set (FragmentProtoAssembler *o, struct FragmentProtoAssembler_frame *frame, int start, int len)
 {
-    // find the frame with minimal time, removing timed out frames
-    struct FragmentProtoAssembler_frame *minframe = NULL;
-    LinkedList1Node *list_node = LinkedList1_GetFirst(&o->frames_used);
-    while (list_node) {
-        LinkedList1Node *next = LinkedList1Node_Next(list_node);
-        struct FragmentProtoAssembler_frame *frame = UPPER_OBJECT(list_node, struct FragmentProtoAssembler_frame, list_node);
-        if (frame_is_timed_out(o, frame)) {
-            PeerLog(o, BLOG_INFO, "freeing timed out frame (while reducing times)");
-            free_frame(o, frame);
-        } else {
-            if (!minframe || frame->time < minframe->time) {
-                minframe = frame;
-            }
-        }
-        list_node = next;
-    }
+    ASSERT(len > 0)
     
-    if (!minframe) {
-        // have no frames, set packet time to zero
-        o->time = 0;
+    int first = start / 32;
+    int last = (start + len - 1) / 32;
+    uint32_t first_mask = UINT32_MAX << (start % 32);
+    uint32_t last_mask = UINT32_MAX >> (31 - (start + len - 1) % 32);
+    
+    if (first == last) {
+        frame->bitmap[first] |= first_mask & last_mask;
         return;
     }
     
-    uint32_t min_time = minframe->time;
-    
-    // subtract minimal time from all frames
-    for (list_node = LinkedList1_GetFirst(&o->frames_used); list_node; list_node = LinkedList1Node_Next(list_node)) {
-        struct FragmentProtoAssembler_frame *frame = UPPER_OBJECT(list_node, struct FragmentProtoAssembler_frame, list_node);
-        frame->time -= min_time;
+    frame->bitmap[first] |= first_mask;
+    for (int i = first + 1; i < last; i++) {
+        frame->bitmap[i] = UINT32_MAX;
     }
-    
-    // subtract minimal time from packet time
-    o->time -= min_time;
+    frame->bitmap[last] |= last_mask;
 }
 
-static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame_id, int chunk_start, int chunk_len, int is_last, uint8_t *payload)
+static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame_id, int chunk_start, int chunk_len, int is_last, uint8_t *payload, btime_t now)
 {
     ASSERT(chunk_start >= 0)
     ASSERT(chunk_len >= 0)
@@ -176,28 +220,21 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     ASSERT(chunk_end >= 0)
     ASSERT(chunk_end <= o->output_mtu)
     
-    // lookup frame
-    struct FragmentProtoAssembler_frame *frame = FPAFramesTree_LookupExact(&o->frames_used_tree, 0, frame_id);
+    // lookup frame, or add a new one
+    struct FragmentProtoAssembler_frame *frame = lookup_frame(o, frame_id, now);
     if (!frame) {
-        // frame not found, add a new one
-        frame = allocate_new_frame(o, frame_id);
-    } else {
-        // have existing frame with that ID
-        // check frame time
-        if (frame_is_timed_out(o, frame)) {
-            // frame is timed out, remove it and use a new one
-            PeerLog(o, BLOG_INFO, "freeing timed out frame (while processing chunk)");
-            free_frame(o, frame);
-            frame = allocate_new_frame(o, frame_id);
-        }
+        return 0;
     }
     
-    ASSERT(frame->num_chunks < o->num_chunks)
-    
-    // check if the chunk overlaps with any existing chunks
-    for (int i = 0; i < frame->num_chunks; i++) {
-        struct FragmentProtoAssembler_chunk *chunk = &frame->chunks[i];
-        if (chunks_overlap(chunk->start, chunk->len, chunk_start, chunk_len)) {
+    // check if the chunk overlaps with data we already have
+    if (chunk_len > 0 && frame->sum > 0) {
+        int have = bitmap_check(o, frame, chunk_start, chunk_len);
+        if (have == 1 && (!is_last || frame->length == chunk_end)) {
+            // duplicate chunk, ignore it
+            PeerLog(o, BLOG_DEBUG, "duplicate chunk");
+            return 0;
+        }
+        if (have != 0) {
             PeerLog(o, BLOG_INFO, "chunk overlaps with existing chunk");
             goto fail_frame;
         }
@@ -227,14 +264,15 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     
     // chunk is good, add it
     
-    // update frame time
-    frame->time = o->time;
+    // update frame time, moving it to the end of the used list
+    frame->time = now;
+    LinkedList1_Remove(&o->frames_used, &frame->list_node);
+    LinkedList1_Append(&o->frames_used, &frame->list_node);
     
-    // add chunk entry
-    struct FragmentProtoAssembler_chunk *chunk = &frame->chunks[frame->num_chunks];
-    chunk->start = chunk_start;
-    chunk->len = chunk_len;
-    frame->num_chunks++;
+    // mark chunk bytes as received
+    if (chunk_len > 0) {
+        bitmap_set(o, frame, chunk_start, chunk_len);
+    }
     
     // update sum
     frame->sum += chunk_len;
@@ -255,12 +293,6 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     
     // is frame incomplete?
     if (frame->length < 0 || frame->sum < frame->length) {
-        // if all chunks are used, fail it
-        if (frame->num_chunks == o->num_chunks) {
-            PeerLog(o, BLOG_INFO, "all chunks used, but frame not complete");
-            goto fail_frame;
-        }
-        
         // wait for more chunks
         return 0;
     }
@@ -272,6 +304,8 @@ static int process_chunk (FragmentProtoAssembler *o, fragmentproto_frameid frame
     // free frame entry
     free_frame(o, frame);
     
+    BPacketTrace_Stamp(BPACKETTRACE_RECV, o, BMETRICS_HISTOGRAM_TRACE_RECV_ASSEMBLE_NS, frame->buffer);
+    
     // send frame
     PacketPassInterface_Sender_Send(o->output, frame->buffer, frame->length);
     
@@ -286,23 +320,25 @@ static void process_input (FragmentProtoAssembler *o)
 {
     ASSERT(o->in_len >= 0)
     
+    btime_t now = btime_gettime();
+    
     // read chunks
     while (o->in_pos < o->in_len) {
         // obtain header
-        if (o->in_len - o->in_pos < sizeof(struct fragmentproto_chunk_header)) {
+        fragmentproto_frameid frame_id = 0;
+        int chunk_start;
+        int chunk_len;
+        int is_last;
+        int whole;
+        int header_len = fragmentproto_read_header(o->compact, o->in + o->in_pos, o->in_len - o->in_pos, &frame_id, &chunk_start, &chunk_len, &is_last, &whole);
+        if (header_len < 0) {
             PeerLog(o, BLOG_INFO, "too little data for chunk header");
             break;
         }
-        struct fragmentproto_chunk_header header;
-        memcpy(&header, o->in + o->in_pos, sizeof(header));
-        o->in_pos += sizeof(struct fragmentproto_chunk_header);
-        fragmentproto_frameid frame_id = ltoh16(header.frame_id);
-        int chunk_start = ltoh16(header.chunk_start);
-        int chunk_len = ltoh16(header.chunk_len);
-        int is_last = ltoh8(header.is_last);
+        o->in_pos += header_len;
         
         // check is_last field
-        if (!(is_last == 0 || is_last == 1)) {
+        if (!(is_last == 0 || is_last == 1 || is_last == FRAGMENTPROTO_IS_LAST_PROBE || is_last == FRAGMENTPROTO_IS_LAST_PROBE_ACK)) {
             PeerLog(o, BLOG_INFO, "chunk is_last wrong");
             break;
         }
@@ -313,8 +349,40 @@ static void process_input (FragmentProtoAssembler *o)
             break;
         }
         
+        // handle probe, skipping its padding
+        if (is_last == FRAGMENTPROTO_IS_LAST_PROBE) {
+            o->in_pos += chunk_len;
+            if (o->handler_probe) {
+                o->handler_probe(o->handler_user, frame_id, o->in_len);
+            }
+            continue;
+        }
+        
+        // handle probe acknowledgement
+        if (is_last == FRAGMENTPROTO_IS_LAST_PROBE_ACK) {
+            o->in_pos += chunk_len;
+            if (o->handler_probe_ack) {
+                o->handler_probe_ack(o->handler_user, frame_id, chunk_start);
+            }
+            continue;
+        }
+        
+        // pass on a whole frame from where it is
+        if (whole) {
+            if (chunk_len > o->output_mtu) {
+                PeerLog(o, BLOG_INFO, "chunk ends outside");
+                o->in_pos += chunk_len;
+                continue;
+            }
+            uint8_t *frame = o->in + o->in_pos;
+            o->in_pos += chunk_len;
+            BPacketTrace_Stamp(BPACKETTRACE_RECV, o, BMETRICS_HISTOGRAM_TRACE_RECV_ASSEMBLE_NS, frame);
+            PacketPassInterface_Sender_Send(o->output, frame, chunk_len);
+            return;
+        }
+        
         // process chunk
-        int res = process_chunk(o, frame_id, chunk_start, chunk_len, is_last, o->in + o->in_pos);
+        int res = process_chunk(o, frame_id, chunk_start, chunk_len, is_last, o->in + o->in_pos, now);
         o->in_pos += chunk_len;
         
         if (res) {
@@ -323,21 +391,6 @@ static void process_input (FragmentProtoAssembler *o)
         }
     }
     
-    // increment packet time
-    if (o->time == FPA_MAX_TIME) {
-        reduce_times(o);
-        if (!LinkedList1_IsEmpty(&o->frames_used)) {
-            ASSERT(o->time < FPA_MAX_TIME) // If there was a frame with zero time, it was removed because
-                                           // time_tolerance < FPA_MAX_TIME. So something >0 was subtracted.
-            o->time++;
-        } else {
-            // it was set to zero by reduce_times
-            ASSERT(o->time == 0)
-        }
-    } else {
-        o->time++;
-    }
-    
     // set no input packet
     o->in_len = -1;
     
@@ -356,6 +409,8 @@ static void input_handler_send (FragmentProtoAssembler *o, uint8_t *data, int da
     o->in = data;
     o->in_pos = 0;
     
+    BPacketTrace_Stamp(BPACKETTRACE_RECV, data, BPACKETTRACE_NO_HISTOGRAM, o);
+    
     process_input(o);
 }
 
@@ -367,16 +422,16 @@ static void output_handler_done (FragmentProtoAssembler *o)
     process_input(o);
 }
 
-int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, PacketPassInterface *output, int num_frames, int num_chunks, BPendingGroup *pg, void *user, BLog_logfunc logfunc)
+int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, PacketPassInterface *output, int num_frames, int compact, BPendingGroup *pg, void *user, BLog_logfunc logfunc)
 {
     ASSERT(input_mtu >= 0)
     ASSERT(num_frames > 0)
-    ASSERT(num_frames < FPA_MAX_TIME) // needed so we can always subtract times when packet time is maximum
-    ASSERT(num_chunks > 0)
+    ASSERT(num_frames <= FPA_MAX_FRAMES)
+    ASSERT(compact == 0 || compact == 1)
     
     // init arguments
     o->output = output;
-    o->num_chunks = num_chunks;
+    o->compact = compact;
     o->user = user;
     o->logfunc = logfunc;
     
@@ -389,19 +444,23 @@ int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, Packe
     // remebmer output MTU
     o->output_mtu = PacketPassInterface_GetMTU(o->output);
     
-    // set packet time to zero
-    o->time = 0;
+    // calculate bitmap size
+    o->bitmap_words = bdivide_up(o->output_mtu, 32);
     
-    // set time tolerance to num_frames
-    o->time_tolerance = num_frames;
+    // use the smallest power of two number of slots which fits all frames,
+    // so that frame IDs map to slots consistently when they wrap
+    o->num_slots = 1;
+    while (o->num_slots < num_frames) {
+        o->num_slots *= 2;
+    }
     
     // allocate frames
     if (!(o->frames_entries = (struct FragmentProtoAssembler_frame *)BAllocArray(num_frames, sizeof(o->frames_entries[0])))) {
         goto fail1;
     }
     
-    // allocate chunks
-    if (!(o->frames_chunks = (struct FragmentProtoAssembler_chunk *)BAllocArray2(num_frames, o->num_chunks, sizeof(o->frames_chunks[0])))) {
+    // allocate bitmaps
+    if (!(o->frames_bitmap = (uint32_t *)BAllocArray2(num_frames, o->bitmap_words, sizeof(o->frames_bitmap[0])))) {
         goto fail2;
     }
     
@@ -410,6 +469,14 @@ int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, Packe
         goto fail3;
     }
     
+    // allocate slots
+    if (!(o->slots = (struct FragmentProtoAssembler_frame **)BAllocArray(o->num_slots, sizeof(o->slots[0])))) {
+        goto fail4;
+    }
+    for (int i = 0; i < o->num_slots; i++) {
+        o->slots[i] = NULL;
+    }
+    
     // init frame lists
     LinkedList1_Init(&o->frames_free);
     LinkedList1_Init(&o->frames_used);
@@ -417,26 +484,29 @@ int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, Packe
     // initialize frame entries
     for (int i = 0; i < num_frames; i++) {
         struct FragmentProtoAssembler_frame *frame = &o->frames_entries[i];
-        // set chunks array pointer
-        frame->chunks = o->frames_chunks + (size_t)i * o->num_chunks;
+        // set bitmap pointer
+        frame->bitmap = o->frames_bitmap + (size_t)i * o->bitmap_words;
         // set buffer pointer
         frame->buffer = o->frames_buffer + (size_t)i * o->output_mtu;
         // add to free list
         LinkedList1_Append(&o->frames_free, &frame->list_node);
     }
     
-    // init tree
-    FPAFramesTree_Init(&o->frames_used_tree);
-    
     // have no input packet
     o->in_len = -1;
     
+    // have no probe handlers
+    o->handler_probe = NULL;
+    o->handler_probe_ack = NULL;
+    
     DebugObject_Init(&o->d_obj);
     
     return 1;
     
+fail4:
+    BFree(o->frames_buffer);
 fail3:
-    BFree(o->frames_chunks);
+    BFree(o->frames_bitmap);
 fail2:
     BFree(o->frames_entries);
 fail1:
@@ -448,11 +518,14 @@ void FragmentProtoAssembler_Free (FragmentProtoAssembler *o)
 {
     DebugObject_Free(&o->d_obj);
 
+    // free slots
+    BFree(o->slots);
+    
     // free buffers
     BFree(o->frames_buffer);
     
-    // free chunks
-    BFree(o->frames_chunks);
+    // free bitmaps
+    BFree(o->frames_bitmap);
     
     // free frames
     BFree(o->frames_entries);
@@ -467,3 +540,12 @@ PacketPassInterface * FragmentProtoAssembler_GetInput (FragmentProtoAssembler *o
     
     return &o->input;
 }
+
+void FragmentProtoAssembler_SetProbeHandlers (FragmentProtoAssembler *o, FragmentProtoAssembler_handler_probe handler_probe, FragmentProtoAssembler_handler_probe handler_probe_ack, void *user)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->handler_probe = handler_probe;
+    o->handler_probe_ack = handler_probe_ack;
+    o->handler_user = user;
+}
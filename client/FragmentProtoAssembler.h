@@ -38,34 +38,43 @@
 
 #include <protocol/fragmentproto.h>
 #include <misc/debug.h>
-#include <misc/compare.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
+#include <system/BTime.h>
 #include <structure/LinkedList1.h>
-#include <structure/SAvl.h>
 #include <flow/PacketPassInterface.h>
 
-#define FPA_MAX_TIME UINT32_MAX
-
-struct FragmentProtoAssembler_frame;
+/**
+ * Maximum number of frames the assembler can hold, which keeps
+ * the frames being assembled within half the frame ID space.
+ */
+#define FPA_MAX_FRAMES 32768
 
-#include "FragmentProtoAssembler_tree.h"
-#include <structure/SAvl_decl.h>
+/**
+ * Time in milliseconds after which an incomplete frame which hasn't
+ * received any chunks is discarded.
+ */
+#define FPA_FRAME_TIMEOUT 1000
 
-struct FragmentProtoAssembler_chunk {
-    int start;
-    int len;
-};
+/**
+ * Handler called when a path MTU probe, or an acknowledgement for a
+ * probe we sent, is received. It is called from within the input
+ * send call, and must not free the object.
+ * 
+ * @param user as in {@link FragmentProtoAssembler_SetProbeHandlers}
+ * @param probe_id probe identifier
+ * @param probe_len for a probe, the length of the FragmentProto packet which carried it;
+ *                  for an acknowledgement, the length reported by the peer
+ */
+typedef void (*FragmentProtoAssembler_handler_probe) (void *user, fragmentproto_frameid probe_id, int probe_len);
 
 struct FragmentProtoAssembler_frame {
-    LinkedList1Node list_node; // node in free or used list
-    struct FragmentProtoAssembler_chunk *chunks; // array of chunks, up to num_chunks
+    LinkedList1Node list_node; // node in free or used list (used list is least recently used first)
+    uint32_t *bitmap; // bitmap of received bytes, bitmap_words words
     uint8_t *buffer; // buffer with frame data, size output_mtu
     // everything below only defined when frame entry is used
     fragmentproto_frameid id; // frame identifier
-    uint32_t time; // packet time when the last chunk was received
-    FPAFramesTreeNode tree_node; // node fields in tree for searching frames by id
-    int num_chunks; // number of valid chunks
+    btime_t time; // time when the last chunk was received
     int sum; // sum of all chunks' lengths
     int length; // length of the frame, or -1 if not yet known
     int length_so_far; // if length=-1, current data set's upper bound
@@ -80,21 +89,24 @@ struct FragmentProtoAssembler_frame {
 typedef struct {
     void *user;
     BLog_logfunc logfunc;
+    int compact;
     PacketPassInterface input;
     PacketPassInterface *output;
     int output_mtu;
-    int num_chunks;
-    uint32_t time;
-    int time_tolerance;
+    int bitmap_words;
+    int num_slots;
+    struct FragmentProtoAssembler_frame **slots;
     struct FragmentProtoAssembler_frame *frames_entries;
-    struct FragmentProtoAssembler_chunk *frames_chunks;
+    uint32_t *frames_bitmap;
     uint8_t *frames_buffer;
     LinkedList1 frames_free;
     LinkedList1 frames_used;
-    FPAFramesTree frames_used_tree;
     int in_len;
     uint8_t *in;
     int in_pos;
+    FragmentProtoAssembler_handler_probe handler_probe;
+    FragmentProtoAssembler_handler_probe handler_probe_ack;
+    void *handler_user;
     DebugObject d_obj;
 } FragmentProtoAssembler;
 
@@ -105,16 +117,19 @@ typedef struct {
  * @param o the object
  * @param input_mtu maximum input packet size. Must be >=0.
  * @param output output interface
- * @param num_frames number of frames we can hold. Must be >0 and < FPA_MAX_TIME.
- *  To make the assembler tolerate out-of-order input of degree D, set to D+2.
- *  Here, D is the minimum size of a hypothetical buffer needed to order the input.
- * @param num_chunks maximum number of chunks a frame can come in. Must be >0.
+ * @param num_frames number of frames we can hold. Must be >0 and <=FPA_MAX_FRAMES.
+ *  Frames are looked up by their ID modulo the smallest power of two >=num_frames,
+ *  and chunks for a frame that many frames older than one being assembled are dropped.
+ *  When all frames are in use, the least recently used one is discarded. A frame is also
+ *  discarded if it receives no chunks for {@link FPA_FRAME_TIMEOUT}.
+ * @param compact whether to read compact chunk headers. Must be 0 or 1. Whole chunks
+ *                are then passed on from the input packet, without copying them.
  * @param pg pending group
  * @param user argument to handlers
  * @param logfunc function which prepends the log prefix using {@link BLog_Append}
  * @return 1 on success, 0 on failure
  */
-int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, PacketPassInterface *output, int num_frames, int num_chunks, BPendingGroup *pg, void *user, BLog_logfunc logfunc) WARN_UNUSED;
+int FragmentProtoAssembler_Init (FragmentProtoAssembler *o, int input_mtu, PacketPassInterface *output, int num_frames, int compact, BPendingGroup *pg, void *user, BLog_logfunc logfunc) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -131,4 +146,15 @@ void FragmentProtoAssembler_Free (FragmentProtoAssembler *o);
  */
 PacketPassInterface * FragmentProtoAssembler_GetInput (FragmentProtoAssembler *o);
 
+/**
+ * Sets handlers for path MTU probes and their acknowledgements.
+ * Initially there are no handlers, and such chunks are ignored.
+ *
+ * @param o the object
+ * @param handler_probe handler for received probes, or NULL
+ * @param handler_probe_ack handler for received acknowledgements, or NULL
+ * @param user value to pass to handlers
+ */
+void FragmentProtoAssembler_SetProbeHandlers (FragmentProtoAssembler *o, FragmentProtoAssembler_handler_probe handler_probe, FragmentProtoAssembler_handler_probe handler_probe_ack, void *user);
+
 #endif
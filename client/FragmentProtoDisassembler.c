@@ -33,14 +33,72 @@
 #include <misc/debug.h>
 #include <misc/byteorder.h>
 #include <misc/minmax.h>
+#include <base/BPacketTrace.h>
 
 #include "client/FragmentProtoDisassembler.h"
 
-static void write_chunks (FragmentProtoDisassembler *o)
+#define IN_AVAIL (o->in_len - o->in_used)
+#define OUT_AVAIL ((o->output_mtu - o->out_used) - o->header_len)
+
+static void finish_output (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->out)
+    
+    // set no output packet
+    o->out = NULL;
+    
+    // stop timer (if it's running)
+    if (o->latency >= 0) {
+        BReactor_RemoveTimer(o->reactor, &o->timer);
+    }
+    
+    // finish output
+    PacketRecvInterface_Done(&o->output, o->out_used);
+}
+
+static void output_written (FragmentProtoDisassembler *o)
+{
+    ASSERT(o->out)
+    ASSERT(o->out_used > 0)
+    
+    // should we finish the output packet?
+    if (OUT_AVAIL <= 0 || o->latency < 0) {
+        finish_output(o);
+    } else {
+        // start timer if we have output and it's not running (output was empty before)
+        if (!BTimer_IsRunning(&o->timer)) {
+            BReactor_SetTimer(o->reactor, &o->timer);
+        }
+    }
+}
+
+static void write_control (FragmentProtoDisassembler *o)
 {
-    #define IN_AVAIL (o->in_len - o->in_used)
-    #define OUT_AVAIL ((o->output_mtu - o->out_used) - (int)sizeof(struct fragmentproto_chunk_header))
+    ASSERT(o->out)
     
+    // a probe goes out alone in a packet of its own
+    if (o->have_probe && o->out_used == 0) {
+        int header_len = fragmentproto_write_header(o->compact, o->out, o->probe_id, 0, o->probe_len - o->header_len, FRAGMENTPROTO_IS_LAST_PROBE, 1);
+        ASSERT(header_len == o->header_len)
+        memset(o->out + header_len, 0, o->probe_len - header_len);
+        o->out_used = o->probe_len;
+        
+        o->have_probe = 0;
+        
+        finish_output(o);
+        return;
+    }
+    
+    // an acknowledgement is added to whatever else is being sent
+    if (o->have_probe_ack && o->output_mtu - o->out_used >= o->header_len) {
+        o->out_used += fragmentproto_write_header(o->compact, o->out + o->out_used, o->probe_ack_id, o->probe_ack_len, 0, FRAGMENTPROTO_IS_LAST_PROBE_ACK, 0);
+        
+        o->have_probe_ack = 0;
+    }
+}
+
+static void write_chunks (FragmentProtoDisassembler *o)
+{
     ASSERT(o->in_len >= 0)
     ASSERT(o->out)
     ASSERT(OUT_AVAIL > 0)
@@ -54,19 +112,19 @@ static void write_chunks (FragmentProtoDisassembler *o)
         }
         
         // write chunk header
-        struct fragmentproto_chunk_header header;
-        header.frame_id = htol16(o->frame_id);
-        header.chunk_start = htol16(o->in_used);
-        header.chunk_len = htol16(chunk_len);
-        header.is_last = (chunk_len == IN_AVAIL);
-        memcpy(o->out + o->out_used, &header, sizeof(header));
+        int header_len = fragmentproto_write_header(o->compact, o->out + o->out_used, o->frame_id, o->in_used, chunk_len, (chunk_len == IN_AVAIL), 0);
         
         // write chunk data
-        memcpy(o->out + o->out_used + sizeof(struct fragmentproto_chunk_header), o->in + o->in_used, chunk_len);
+        uint8_t *chunk_data = o->out + o->out_used + header_len;
+        if (o->in_num_bufs > 0) {
+            PacketPassInterface_CopyBufs(o->in_bufs, o->in_num_bufs, o->in_used, chunk_data, chunk_len);
+        } else {
+            memcpy(chunk_data, o->in + o->in_used, chunk_len);
+        }
         
         // increment pointers
         o->in_used += chunk_len;
-        o->out_used += sizeof(struct fragmentproto_chunk_header) + chunk_len;
+        o->out_used += header_len + chunk_len;
     } while (IN_AVAIL > 0 && OUT_AVAIL > 0);
     
     // have we finished the input packet?
@@ -81,24 +139,7 @@ static void write_chunks (FragmentProtoDisassembler *o)
         PacketPassInterface_Done(&o->input);
     }
     
-    // should we finish the output packet?
-    if (OUT_AVAIL <= 0 || o->latency < 0) {
-        // set no output packet
-        o->out = NULL;
-        
-        // stop timer (if it's running)
-        if (o->latency >= 0) {
-            BReactor_RemoveTimer(o->reactor, &o->timer);
-        }
-        
-        // finish output
-        PacketRecvInterface_Done(&o->output, o->out_used);
-    } else {
-        // start timer if we have output and it's not running (output was empty before)
-        if (!BTimer_IsRunning(&o->timer)) {
-            BReactor_SetTimer(o->reactor, &o->timer);
-        }
-    }
+    output_written(o);
 }
 
 static void input_handler_send (FragmentProtoDisassembler *o, uint8_t *data, int data_len)
@@ -109,8 +150,36 @@ static void input_handler_send (FragmentProtoDisassembler *o, uint8_t *data, int
     // set input packet
     o->in_len = data_len;
     o->in = data;
+    o->in_num_bufs = 0;
+    o->in_used = 0;
+    
+    BPacketTrace_Stamp(BPACKETTRACE_SEND, data, BPACKETTRACE_NO_HISTOGRAM, &o->output);
+    
+    // if there is no output, wait for it
+    if (!o->out) {
+        return;
+    }
+    
+    write_chunks(o);
+}
+
+static void input_handler_sendv (FragmentProtoDisassembler *o, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    ASSERT(o->in_len == -1)
+    
+    // set input packet
+    int total = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        o->in_bufs[i] = bufs[i];
+        total += bufs[i].len;
+    }
+    o->in_len = total;
+    o->in = NULL;
+    o->in_num_bufs = num_bufs;
     o->in_used = 0;
     
+    BPacketTrace_Stamp(BPACKETTRACE_SEND, bufs[0].data, BPACKETTRACE_NO_HISTOGRAM, &o->output);
+    
     // if there is no output, wait for it
     if (!o->out) {
         return;
@@ -140,8 +209,23 @@ static void output_handler_recv (FragmentProtoDisassembler *o, uint8_t *data)
     o->out = data;
     o->out_used = 0;
     
+    // write pending probe or acknowledgement
+    write_control(o);
+    if (!o->out) {
+        return;
+    }
+    
     // if there is no input, wait for it
     if (o->in_len < 0) {
+        if (o->out_used > 0) {
+            output_written(o);
+        }
+        return;
+    }
+    
+    // if there is no room for a chunk, send what we have
+    if (OUT_AVAIL <= 0) {
+        finish_output(o);
         return;
     }
     
@@ -161,25 +245,32 @@ static void timer_handler (FragmentProtoDisassembler *o)
     PacketRecvInterface_Done(&o->output, o->out_used);
 }
 
-void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency)
+void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency, int compact)
 {
     ASSERT(input_mtu >= 0)
     ASSERT(input_mtu <= UINT16_MAX)
-    ASSERT(output_mtu > sizeof(struct fragmentproto_chunk_header))
+    ASSERT(output_mtu > FRAGMENTPROTO_MAX_HEADER_LEN(compact))
     ASSERT(chunk_mtu > 0 || chunk_mtu < 0)
+    ASSERT(compact == 0 || compact == 1)
     
     // init arguments
     o->reactor = reactor;
+    o->max_output_mtu = output_mtu;
     o->output_mtu = output_mtu;
     o->chunk_mtu = chunk_mtu;
     o->latency = latency;
+    o->compact = compact;
+    
+    // chunks are fitted in assuming the longest header
+    o->header_len = FRAGMENTPROTO_MAX_HEADER_LEN(o->compact);
     
     // init input
     PacketPassInterface_Init(&o->input, input_mtu, (PacketPassInterface_handler_send)input_handler_send, o, BReactor_PendingGroup(reactor));
     PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+    PacketPassInterface_EnableSendV(&o->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
     
     // init output
-    PacketRecvInterface_Init(&o->output, o->output_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, BReactor_PendingGroup(reactor));
+    PacketRecvInterface_Init(&o->output, o->max_output_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, BReactor_PendingGroup(reactor));
     
     // init timer
     if (o->latency >= 0) {
@@ -195,6 +286,10 @@ void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *rea
     // start with zero frame ID
     o->frame_id = 0;
     
+    // have no probe or acknowledgement to send
+    o->have_probe = 0;
+    o->have_probe_ack = 0;
+    
     DebugObject_Init(&o->d_obj);
 }
 
@@ -227,3 +322,56 @@ PacketRecvInterface * FragmentProtoDisassembler_GetOutput (FragmentProtoDisassem
     
     return &o->output;
 }
+
+void FragmentProtoDisassembler_SetOutputMTU (FragmentProtoDisassembler *o, int output_mtu)
+{
+    ASSERT(output_mtu > o->header_len)
+    ASSERT(output_mtu <= o->max_output_mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    o->output_mtu = output_mtu;
+    
+    // send a pending packet which can't take any more chunks
+    if (o->out && o->out_used > 0 && OUT_AVAIL <= 0) {
+        finish_output(o);
+    }
+}
+
+void FragmentProtoDisassembler_SendProbe (FragmentProtoDisassembler *o, fragmentproto_frameid probe_id, int probe_len)
+{
+    ASSERT(probe_len >= o->header_len)
+    ASSERT(probe_len <= o->max_output_mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember probe
+    o->have_probe = 1;
+    o->probe_id = probe_id;
+    o->probe_len = probe_len;
+    
+    // send it now if output is waiting for data
+    if (o->out) {
+        ASSERT(o->in_len == -1)
+        write_control(o);
+    }
+}
+
+void FragmentProtoDisassembler_SendProbeAck (FragmentProtoDisassembler *o, fragmentproto_frameid probe_id, int probe_len)
+{
+    ASSERT(probe_len >= 0)
+    ASSERT(probe_len <= UINT16_MAX)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember acknowledgement
+    o->have_probe_ack = 1;
+    o->probe_ack_id = probe_id;
+    o->probe_ack_len = probe_len;
+    
+    // add it to the output packet if output is waiting for data
+    if (o->out) {
+        ASSERT(o->in_len == -1)
+        write_control(o);
+        if (o->out && o->out_used > 0) {
+            output_written(o);
+        }
+    }
+}
@@ -53,18 +53,29 @@
  */
 typedef struct {
     BReactor *reactor;
+    int max_output_mtu;
     int output_mtu;
     int chunk_mtu;
     btime_t latency;
+    int compact;
+    int header_len;
     PacketPassInterface input;
     PacketRecvInterface output;
     BTimer timer;
     int in_len;
     uint8_t *in;
+    struct PacketPassInterface_buf in_bufs[PPI_MAX_BUFS];
+    int in_num_bufs;
     int in_used;
     uint8_t *out;
     int out_used;
     fragmentproto_frameid frame_id;
+    int have_probe;
+    fragmentproto_frameid probe_id;
+    int probe_len;
+    int have_probe_ack;
+    fragmentproto_frameid probe_ack_id;
+    int probe_ack_len;
     DebugObject d_obj;
 } FragmentProtoDisassembler;
 
@@ -74,14 +85,17 @@ typedef struct {
  * @param o the object
  * @param reactor reactor we live in
  * @param input_mtu maximum input packet size. Must be >=0 and <=UINT16_MAX.
- * @param output_mtu maximum output packet size. Must be >sizeof(struct fragmentproto_chunk_header).
+ * @param output_mtu maximum output packet size. Must be >FRAGMENTPROTO_MAX_HEADER_LEN(compact).
+ *                   This is the MTU of the output interface; output packets can be limited
+ *                   further with {@link FragmentProtoDisassembler_SetOutputMTU}.
  * @param chunk_mtu maximum chunk size. Must be >0, or <0 for no explicit limit.
  * @param latency maximum time a pending output packet with some data can wait for more data
  *                before being sent out. If nonnegative, a timer will be used. If negative,
  *                packets will always be sent out immediately. If low latency is desired,
  *                prefer setting this to zero rather than negative.
+ * @param compact whether to write compact chunk headers. Must be 0 or 1.
  */
-void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency);
+void FragmentProtoDisassembler_Init (FragmentProtoDisassembler *o, BReactor *reactor, int input_mtu, int output_mtu, int chunk_mtu, btime_t latency, int compact);
 
 /**
  * Frees the object.
@@ -92,6 +106,7 @@ void FragmentProtoDisassembler_Free (FragmentProtoDisassembler *o);
 
 /**
  * Returns the input interface.
+ * The interface will support cancel functionality and vectored sends.
  *
  * @param o the object
  * @return input interface
@@ -106,4 +121,42 @@ PacketPassInterface * FragmentProtoDisassembler_GetInput (FragmentProtoDisassemb
  */
 PacketRecvInterface * FragmentProtoDisassembler_GetOutput (FragmentProtoDisassembler *o);
 
+/**
+ * Sets the maximum size of output packets carrying frame data.
+ * If a partially filled output packet can no longer take another chunk,
+ * it is sent out.
+ *
+ * @param o the object
+ * @param output_mtu maximum output packet size. Must be >FRAGMENTPROTO_MAX_HEADER_LEN(compact)
+ *                   and <= the output_mtu given to {@link FragmentProtoDisassembler_Init}.
+ */
+void FragmentProtoDisassembler_SetOutputMTU (FragmentProtoDisassembler *o, int output_mtu);
+
+/**
+ * Sends a path MTU probe, that is an output packet of the given size carrying
+ * only a probe chunk. The size may be larger than the limit set with
+ * {@link FragmentProtoDisassembler_SetOutputMTU}.
+ * The probe goes out in the next output packet which has no frame data yet.
+ * If a probe is already pending, it is replaced.
+ *
+ * @param o the object
+ * @param probe_id probe identifier
+ * @param probe_len size of the probe packet. Must be >=FRAGMENTPROTO_MAX_HEADER_LEN(compact)
+ *                  and <= the output_mtu given to {@link FragmentProtoDisassembler_Init}.
+ */
+void FragmentProtoDisassembler_SendProbe (FragmentProtoDisassembler *o, fragmentproto_frameid probe_id, int probe_len);
+
+/**
+ * Sends an acknowledgement for a path MTU probe received from the peer.
+ * The acknowledgement is added to the current or next output packet,
+ * subject to the latency parameter as frame data is.
+ * If an acknowledgement is already pending, it is replaced.
+ *
+ * @param o the object
+ * @param probe_id identifier of the received probe
+ * @param probe_len size of the FragmentProto packet which carried the probe.
+ *                  Must be >=0 and <=UINT16_MAX.
+ */
+void FragmentProtoDisassembler_SendProbeAck (FragmentProtoDisassembler *o, fragmentproto_frameid probe_id, int probe_len);
+
 #endif
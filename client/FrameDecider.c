@@ -29,12 +29,16 @@
 
 #include <string.h>
 #include <stddef.h>
+#include <limits.h>
 
 #include <misc/debug.h>
 #include <misc/offset.h>
 #include <misc/balloc.h>
 #include <misc/ethernet_proto.h>
 #include <misc/ipv4_proto.h>
+#include <misc/ipv6_proto.h>
+#include <misc/icmp6_proto.h>
+#include <misc/arp_proto.h>
 #include <misc/igmp_proto.h>
 #include <misc/byteorder.h>
 #include <misc/compare.h>
@@ -49,16 +53,53 @@
 #define DECIDE_STATE_FLOOD 3
 #define DECIDE_STATE_MULTICAST 4
 
+// number of IP address bindings kept per MAC address entry
+#define IPS_PER_MAC 4
+
+// how long after learning an IP address binding we may answer for it
+#define NEIGHBOR_MAX_AGE 60000
+
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-static int compare_macs (const uint8_t *mac1, const uint8_t *mac2)
+static size_t hash_mac (const uint8_t *mac)
 {
-    int c = memcmp(mac1, mac2, 6);
-    return B_COMPARE(c, 0);
+    uint64_t x = ((uint64_t)mac[0] << 40) | ((uint64_t)mac[1] << 32) | ((uint64_t)mac[2] << 24) |
+                 ((uint64_t)mac[3] << 16) | ((uint64_t)mac[4] << 8) | (uint64_t)mac[5];
+    
+    // multiplicative hashing; the high bits are well mixed
+    return (x * UINT64_C(0x9E3779B97F4A7C15)) >> 32;
 }
 
-#include "FrameDecider_macs_tree.h"
-#include <structure/SAvl_impl.h>
+static size_t hash_ip (const uint8_t *addr)
+{
+    uint64_t a;
+    uint64_t b;
+    memcpy(&a, addr, 8);
+    memcpy(&b, addr + 8, 8);
+    
+    return ((a * UINT64_C(0x9E3779B97F4A7C15)) ^ (b * UINT64_C(0xC2B2AE3D27D4EB4F))) >> 32;
+}
+
+static void make_ipv4_mapped (uint8_t *addr, uint32_t ipv4_addr)
+{
+    memset(addr, 0, 10);
+    addr[10] = 0xff;
+    addr[11] = 0xff;
+    memcpy(addr + 12, &ipv4_addr, 4);
+}
+
+static int is_ipv4_mapped (const uint8_t *addr)
+{
+    const uint8_t mapped_prefix[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    
+    return !memcmp(addr, mapped_prefix, sizeof(mapped_prefix));
+}
+
+#include "FrameDecider_macs_hash.h"
+#include <structure/CHash_impl.h>
+
+#include "FrameDecider_ips_hash.h"
+#include <structure/CHash_impl.h>
 
 #include "FrameDecider_groups_tree.h"
 #include <structure/SAvl_impl.h>
@@ -66,12 +107,24 @@ static int compare_macs (const uint8_t *mac1, const uint8_t *mac2)
 #include "FrameDecider_multicast_tree.h"
 #include <structure/SAvl_impl.h>
 
+static void remove_mac_entry (FrameDecider *d, struct _FrameDecider_mac_entry *entry)
+{
+    // remove from hash
+    FDMacsHashRef ref = {entry, entry};
+    FDMacsHash_Remove(&d->macs_hash, 0, ref);
+    
+    // forget cached destination
+    if (d->last_dest_entry == entry) {
+        d->last_dest_entry = NULL;
+    }
+}
+
 static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
 {
     FrameDecider *d = o->d;
     
-    // locate entry in tree
-    struct _FrameDecider_mac_entry *e_entry = FDMacsTree_LookupExact(&d->macs_tree, 0, mac);
+    // locate entry in hash
+    struct _FrameDecider_mac_entry *e_entry = FDMacsHash_Lookup(&d->macs_hash, 0, mac).ptr;
     if (e_entry) {
         if (e_entry->peer == o) {
             // this is our MAC; only move it to the end of the used list
@@ -81,7 +134,7 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
         }
         
         // some other peer has that MAC; disassociate it
-        FDMacsTree_Remove(&d->macs_tree, 0, e_entry);
+        remove_mac_entry(d, e_entry);
         LinkedList1_Remove(&e_entry->peer->mac_entries_used, &e_entry->list_node);
         LinkedList1_Append(&e_entry->peer->mac_entries_free, &e_entry->list_node);
     }
@@ -102,7 +155,7 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
         ASSERT(entry->peer == o)
         
         // remove from used
-        FDMacsTree_Remove(&d->macs_tree, 0, entry);
+        remove_mac_entry(d, entry);
         LinkedList1_Remove(&o->mac_entries_used, &entry->list_node);
     }
     
@@ -113,10 +166,194 @@ static void add_mac_to_peer (FrameDeciderPeer *o, uint8_t *mac)
     
     // add to used
     LinkedList1_Append(&o->mac_entries_used, &entry->list_node);
-    int res = FDMacsTree_Insert(&d->macs_tree, 0, entry, NULL);
+    FDMacsHashRef ref = {entry, entry};
+    int res = FDMacsHash_Insert(&d->macs_hash, 0, ref, NULL);
     ASSERT_EXECUTE(res)
 }
 
+static void remove_ip_entry (FrameDecider *d, struct _FrameDecider_ip_entry *entry)
+{
+    FDIpsHashRef ref = {entry, entry};
+    FDIpsHash_Remove(&d->ips_hash, 0, ref);
+}
+
+static void add_ip_to_peer (FrameDeciderPeer *o, const uint8_t *addr, const uint8_t *mac, int is_router)
+{
+    FrameDecider *d = o->d;
+    ASSERT(d->max_peer_ips > 0)
+    
+    // locate entry in hash
+    struct _FrameDecider_ip_entry *entry = FDIpsHash_Lookup(&d->ips_hash, 0, addr).ptr;
+    if (entry && entry->peer == o) {
+        // this is our address; only move it to the end of the used list
+        LinkedList1_Remove(&o->ip_entries_used, &entry->list_node);
+        LinkedList1_Append(&o->ip_entries_used, &entry->list_node);
+    } else {
+        if (entry) {
+            // some other peer has that address; disassociate it
+            remove_ip_entry(d, entry);
+            LinkedList1_Remove(&entry->peer->ip_entries_used, &entry->list_node);
+            LinkedList1_Append(&entry->peer->ip_entries_free, &entry->list_node);
+        }
+        
+        // aquire address entry, if there are no free ones reuse the oldest used one
+        LinkedList1Node *list_node;
+        if (list_node = LinkedList1_GetFirst(&o->ip_entries_free)) {
+            entry = UPPER_OBJECT(list_node, struct _FrameDecider_ip_entry, list_node);
+            ASSERT(entry->peer == o)
+            
+            // remove from free
+            LinkedList1_Remove(&o->ip_entries_free, &entry->list_node);
+        } else {
+            list_node = LinkedList1_GetFirst(&o->ip_entries_used);
+            ASSERT(list_node)
+            entry = UPPER_OBJECT(list_node, struct _FrameDecider_ip_entry, list_node);
+            ASSERT(entry->peer == o)
+            
+            // remove from used
+            remove_ip_entry(d, entry);
+            LinkedList1_Remove(&o->ip_entries_used, &entry->list_node);
+        }
+        
+        // set address in entry
+        memcpy(entry->addr, addr, sizeof(entry->addr));
+        
+        // add to used
+        LinkedList1_Append(&o->ip_entries_used, &entry->list_node);
+        FDIpsHashRef ref = {entry, entry};
+        int res = FDIpsHash_Insert(&d->ips_hash, 0, ref, NULL);
+        ASSERT_EXECUTE(res)
+    }
+    
+    // update binding
+    memcpy(entry->mac, mac, sizeof(entry->mac));
+    entry->is_router = is_router;
+    entry->learn_time = btime_gettime();
+}
+
+static struct _FrameDecider_ip_entry * find_neighbor (FrameDecider *d, const uint8_t *addr)
+{
+    struct _FrameDecider_ip_entry *entry = FDIpsHash_Lookup(&d->ips_hash, 0, addr).ptr;
+    if (!entry) {
+        return NULL;
+    }
+    
+    // the binding must be recent
+    if (btime_gettime() - entry->learn_time > NEIGHBOR_MAX_AGE) {
+        return NULL;
+    }
+    
+    // the MAC address must still belong to the same peer, so that we
+    // don't answer for hosts which moved or peers which went away
+    struct _FrameDecider_mac_entry *mac_entry = FDMacsHash_Lookup(&d->macs_hash, 0, entry->mac).ptr;
+    if (!mac_entry || mac_entry->peer != entry->peer) {
+        return NULL;
+    }
+    
+    return entry;
+}
+
+static void build_arp_reply (FrameDecider *d, const struct ethernet_header *req_eh, const struct arp_packet *req, const struct _FrameDecider_ip_entry *entry)
+{
+    struct ethernet_header eh;
+    memcpy(eh.dest, req_eh->source, sizeof(eh.dest));
+    memcpy(eh.source, entry->mac, sizeof(eh.source));
+    eh.type = hton16(ETHERTYPE_ARP);
+    
+    struct arp_packet arp;
+    arp.hardware_type = hton16(ARP_HARDWARE_TYPE_ETHERNET);
+    arp.protocol_type = hton16(ETHERTYPE_IPV4);
+    arp.hardware_size = hton8(6);
+    arp.protocol_size = hton8(4);
+    arp.opcode = hton16(ARP_OPCODE_REPLY);
+    memcpy(arp.sender_mac, entry->mac, sizeof(arp.sender_mac));
+    arp.sender_ip = req->target_ip;
+    memcpy(arp.target_mac, req->sender_mac, sizeof(arp.target_mac));
+    arp.target_ip = req->sender_ip;
+    
+    memcpy(d->reply, &eh, sizeof(eh));
+    memcpy(d->reply + sizeof(eh), &arp, sizeof(arp));
+    d->reply_len = sizeof(eh) + sizeof(arp);
+}
+
+static void build_nd_reply (FrameDecider *d, const struct ethernet_header *req_eh, const struct ipv6_header *req_ipv6, const struct _FrameDecider_ip_entry *entry)
+{
+    struct ethernet_header eh;
+    memcpy(eh.dest, req_eh->source, sizeof(eh.dest));
+    memcpy(eh.source, entry->mac, sizeof(eh.source));
+    eh.type = hton16(ETHERTYPE_IPV6);
+    
+    struct icmp6_header icmp;
+    icmp.type = hton8(ICMP6_TYPE_NEIGHBOR_ADVERTISEMENT);
+    icmp.code = hton8(0);
+    icmp.checksum = hton16(0);
+    
+    struct nd_neighbor_advert advert;
+    advert.flags = hton32(ND_ADVERT_FLAG_SOLICITED | ND_ADVERT_FLAG_OVERRIDE | (entry->is_router ? ND_ADVERT_FLAG_ROUTER : 0));
+    memcpy(advert.target, entry->addr, sizeof(advert.target));
+    
+    struct nd_option_link_address option;
+    option.type = hton8(ND_OPTION_TARGET_LINK_ADDRESS);
+    option.length = hton8(sizeof(option) / 8);
+    memcpy(option.mac, entry->mac, sizeof(option.mac));
+    
+    uint16_t payload_len = sizeof(icmp) + sizeof(advert) + sizeof(option);
+    
+    struct ipv6_header ipv6;
+    ipv6.version4_tc4 = hton8(6 << 4);
+    ipv6.tc4_fl4 = hton8(0);
+    ipv6.fl = hton16(0);
+    ipv6.payload_length = hton16(payload_len);
+    ipv6.next_header = hton8(IPV6_NEXT_ICMPV6);
+    ipv6.hop_limit = hton8(ND_HOP_LIMIT);
+    memcpy(ipv6.source_address, entry->addr, sizeof(ipv6.source_address));
+    memcpy(ipv6.destination_address, req_ipv6->source_address, sizeof(ipv6.destination_address));
+    
+    uint8_t *pos = d->reply;
+    memcpy(pos, &eh, sizeof(eh));
+    pos += sizeof(eh);
+    memcpy(pos, &ipv6, sizeof(ipv6));
+    pos += sizeof(ipv6);
+    uint8_t *payload = pos;
+    memcpy(pos, &icmp, sizeof(icmp));
+    pos += sizeof(icmp);
+    memcpy(pos, &advert, sizeof(advert));
+    pos += sizeof(advert);
+    memcpy(pos, &option, sizeof(option));
+    pos += sizeof(option);
+    
+    // fill in checksum
+    icmp.checksum = icmp6_checksum(payload, payload_len, ipv6.source_address, ipv6.destination_address);
+    memcpy(payload, &icmp, sizeof(icmp));
+    
+    d->reply_len = pos - d->reply;
+    ASSERT(d->reply_len <= FRAMEDECIDER_REPLY_MAX)
+}
+
+static int flood_allowed (FrameDecider *d, const uint8_t *source_mac)
+{
+    if (d->max_flood_rate == 0) {
+        return 1;
+    }
+    
+    // Times are kept in units of 1/max_flood_rate milliseconds, so a frame
+    // advances the slot's theoretical arrival time by 1000. A frame is let
+    // through if that time is less than one second ahead of now.
+    btime_t *tat = &d->flood_tat[hash_mac(source_mac) % FRAMEDECIDER_FLOOD_SLOTS];
+    btime_t now = btime_gettime() * d->max_flood_rate;
+    
+    if (*tat < now) {
+        *tat = now;
+    }
+    
+    if (*tat - now >= (btime_t)1000 * d->max_flood_rate) {
+        return 0;
+    }
+    
+    *tat += 1000;
+    return 1;
+}
+
 static uint32_t compute_sig_for_group (uint32_t group)
 {
     return hton32(ntoh32(group)&0x7FFFFF);
@@ -320,27 +557,60 @@ static void group_entry_timer_handler (struct _FrameDecider_group_entry *group_e
     remove_group_entry(group_entry);
 }
 
-void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor)
+int FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, int proxy_neighbors, int max_flood_rate, BReactor *reactor)
 {
     ASSERT(max_peer_macs > 0)
     ASSERT(max_peer_groups > 0)
+    ASSERT(max_flood_rate >= 0)
     
     // init arguments
     o->max_peer_macs = max_peer_macs;
     o->max_peer_groups = max_peer_groups;
     o->igmp_group_membership_interval = igmp_group_membership_interval;
     o->igmp_last_member_query_time = igmp_last_member_query_time;
+    o->proxy_neighbors = proxy_neighbors;
+    o->max_flood_rate = max_flood_rate;
     o->reactor = reactor;
     
+    // IP address bindings are only learned if we answer for them
+    if (!o->proxy_neighbors) {
+        o->max_peer_ips = 0;
+    } else if (o->max_peer_macs > INT_MAX / IPS_PER_MAC) {
+        o->max_peer_ips = INT_MAX;
+    } else {
+        o->max_peer_ips = o->max_peer_macs * IPS_PER_MAC;
+    }
+    
     // init peers list
     LinkedList1_Init(&o->peers_list);
+    o->num_peers = 0;
     
-    // init MAC tree
-    FDMacsTree_Init(&o->macs_tree);
+    // init MAC hash; buckets are added as peers come
+    if (!FDMacsHash_Init(&o->macs_hash, o->max_peer_macs)) {
+        BLog(BLOG_ERROR, "FDMacsHash_Init failed");
+        return 0;
+    }
+    
+    // have no cached destination
+    o->last_dest_entry = NULL;
+    
+    // init IP hash; buckets are added as peers come
+    if (!FDIpsHash_Init(&o->ips_hash, (o->max_peer_ips > 0 ? o->max_peer_ips : 1))) {
+        BLog(BLOG_ERROR, "FDIpsHash_Init failed");
+        goto fail1;
+    }
     
     // init multicast tree
     FDMulticastTree_Init(&o->multicast_tree);
     
+    // init flood rate limiter
+    for (int i = 0; i < FRAMEDECIDER_FLOOD_SLOTS; i++) {
+        o->flood_tat[i] = 0;
+    }
+    
+    // have no reply
+    o->reply_len = -1;
+    
     // init decide state
     o->decide_state = DECIDE_STATE_NONE;
     
@@ -348,14 +618,25 @@ void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups,
     o->decide_flood_current = NULL;
     
     DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    FDMacsHash_Free(&o->macs_hash);
+    return 0;
 }
 
 void FrameDecider_Free (FrameDecider *o)
 {
     ASSERT(FDMulticastTree_IsEmpty(&o->multicast_tree))
-    ASSERT(FDMacsTree_IsEmpty(&o->macs_tree))
     ASSERT(LinkedList1_IsEmpty(&o->peers_list))
+    ASSERT(!o->last_dest_entry)
     DebugObject_Free(&o->d_obj);
+    
+    // free IP hash
+    FDIpsHash_Free(&o->ips_hash);
+    
+    // free MAC hash
+    FDMacsHash_Free(&o->macs_hash);
 }
 
 void FrameDecider_AnalyzeAndDecide (FrameDecider *o, const uint8_t *frame, int frame_len)
@@ -363,6 +644,9 @@ void FrameDecider_AnalyzeAndDecide (FrameDecider *o, const uint8_t *frame, int f
     ASSERT(frame_len >= 0)
     DebugObject_Access(&o->d_obj);
     
+    // forget previous reply
+    o->reply_len = -1;
+    
     // reset decide state
     switch (o->decide_state) {
         case DECIDE_STATE_NONE:
@@ -464,6 +748,96 @@ void FrameDecider_AnalyzeAndDecide (FrameDecider *o, const uint8_t *frame, int f
                 } break;
             }
         } break;
+        
+        case ETHERTYPE_ARP: {
+            if (!o->proxy_neighbors) {
+                goto out;
+            }
+            
+            // check ARP packet
+            if (len < sizeof(struct arp_packet)) {
+                BLog(BLOG_INFO, "decide: ARP: short packet");
+                goto out;
+            }
+            struct arp_packet arp;
+            memcpy(&arp, pos, sizeof(arp));
+            
+            if (ntoh16(arp.hardware_type) != ARP_HARDWARE_TYPE_ETHERNET || ntoh16(arp.protocol_type) != ETHERTYPE_IPV4 ||
+                ntoh8(arp.hardware_size) != 6 || ntoh8(arp.protocol_size) != 4 || ntoh16(arp.opcode) != ARP_OPCODE_REQUEST
+            ) {
+                goto out;
+            }
+            
+            // leave probes and gratuitous ARP alone
+            if (arp.sender_ip == 0 || arp.sender_ip == arp.target_ip) {
+                goto out;
+            }
+            
+            // look for a binding of a peer
+            uint8_t addr[16];
+            make_ipv4_mapped(addr, arp.target_ip);
+            struct _FrameDecider_ip_entry *entry = find_neighbor(o, addr);
+            if (!entry) {
+                goto out;
+            }
+            
+            // answer on behalf of the peer, not forwarding the request
+            build_arp_reply(o, &eh, &arp, entry);
+            return;
+        } break;
+        
+        case ETHERTYPE_IPV6: {
+            if (!o->proxy_neighbors) {
+                goto out;
+            }
+            
+            // check IPv6 header
+            struct ipv6_header ipv6_header;
+            if (!ipv6_check((uint8_t *)pos, len, &ipv6_header, (uint8_t **)&pos, &len)) {
+                BLog(BLOG_INFO, "decide: wrong IPv6 packet");
+                goto out;
+            }
+            
+            // check if it's Neighbor Discovery
+            if (ntoh8(ipv6_header.next_header) != IPV6_NEXT_ICMPV6 || ntoh8(ipv6_header.hop_limit) != ND_HOP_LIMIT) {
+                goto out;
+            }
+            
+            // check ICMPv6 header
+            if (len < sizeof(struct icmp6_header) + sizeof(struct nd_neighbor_solicit)) {
+                goto out;
+            }
+            struct icmp6_header icmp;
+            memcpy(&icmp, pos, sizeof(icmp));
+            pos += sizeof(struct icmp6_header);
+            len -= sizeof(struct icmp6_header);
+            
+            if (ntoh8(icmp.type) != ICMP6_TYPE_NEIGHBOR_SOLICITATION || ntoh8(icmp.code) != 0) {
+                goto out;
+            }
+            
+            // leave Duplicate Address Detection alone
+            const uint8_t unspecified_addr[16] = {0};
+            if (!memcmp(ipv6_header.source_address, unspecified_addr, sizeof(unspecified_addr))) {
+                goto out;
+            }
+            
+            struct nd_neighbor_solicit solicit;
+            memcpy(&solicit, pos, sizeof(solicit));
+            
+            // look for a binding of a peer
+            if (is_ipv4_mapped(solicit.target)) {
+                goto out;
+            }
+            struct _FrameDecider_ip_entry *entry = find_neighbor(o, solicit.target);
+            if (!entry) {
+                goto out;
+            }
+            
+            // answer on behalf of the peer, not forwarding the solicitation
+            build_nd_reply(o, &eh, &ipv6_header, entry);
+            return;
+        } break;
     }
     
 out:;
@@ -471,8 +845,18 @@ out:;
     const uint8_t broadcast_mac[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
     const uint8_t multicast_mac_header[] = {0x01, 0x00, 0x5e};
     
-    // if it's broadcast or IGMP, flood it
-    if (is_igmp || !memcmp(eh.dest, broadcast_mac, sizeof(broadcast_mac))) {
+    // if it's IGMP, flood it
+    if (is_igmp) {
+        o->decide_state = DECIDE_STATE_FLOOD;
+        o->decide_flood_current = LinkedList1_GetFirst(&o->peers_list);
+        return;
+    }
+    
+    // if it's broadcast, flood it, within the source's flood rate
+    if (!memcmp(eh.dest, broadcast_mac, sizeof(broadcast_mac))) {
+        if (!flood_allowed(o, eh.source)) {
+            return;
+        }
         o->decide_state = DECIDE_STATE_FLOOD;
         o->decide_flood_current = LinkedList1_GetFirst(&o->peers_list);
         return;
@@ -495,15 +879,23 @@ out:;
         return;
     }
     
-    // look for MAC entry
-    struct _FrameDecider_mac_entry *entry = FDMacsTree_LookupExact(&o->macs_tree, 0, eh.dest);
+    // look for MAC entry, first checking the previous destination,
+    // which likely repeats for a stream of frames
+    struct _FrameDecider_mac_entry *entry = o->last_dest_entry;
+    if (!entry || memcmp(entry->mac, eh.dest, sizeof(entry->mac))) {
+        entry = FDMacsHash_Lookup(&o->macs_hash, 0, eh.dest).ptr;
+    }
     if (entry) {
+        o->last_dest_entry = entry;
         o->decide_state = DECIDE_STATE_UNICAST;
         o->decide_unicast_peer = entry->peer;
         return;
     }
     
-    // unknown destination MAC, flood
+    // unknown destination MAC, flood within the source's flood rate
+    if (!flood_allowed(o, eh.source)) {
+        return;
+    }
     o->decide_state = DECIDE_STATE_FLOOD;
     o->decide_flood_current = LinkedList1_GetFirst(&o->peers_list);
     return;
@@ -555,6 +947,21 @@ FrameDeciderPeer * FrameDecider_NextDestination (FrameDecider *o)
     }
 }
 
+int FrameDecider_GetReply (FrameDecider *o, uint8_t **out_frame, int *out_frame_len)
+{
+    ASSERT(out_frame)
+    ASSERT(out_frame_len)
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->reply_len < 0) {
+        return 0;
+    }
+    
+    *out_frame = o->reply;
+    *out_frame_len = o->reply_len;
+    return 1;
+}
+
 int FrameDeciderPeer_Init (FrameDeciderPeer *o, FrameDecider *d, void *user, BLog_logfunc logfunc)
 {
     // init arguments
@@ -574,8 +981,37 @@ int FrameDeciderPeer_Init (FrameDeciderPeer *o, FrameDecider *d, void *user, BLo
         goto fail1;
     }
     
+    // allocate IP entries
+    if (!(o->ip_entries = (struct _FrameDecider_ip_entry *)BAllocArray(d->max_peer_ips, sizeof(struct _FrameDecider_ip_entry)))) {
+        PeerLog(o, BLOG_ERROR, "failed to allocate IP entries");
+        goto fail2;
+    }
+    
+    // make sure the MAC hash has a bucket for each possible MAC entry
+    if (d->num_peers < INT_MAX / d->max_peer_macs - 1) {
+        size_t num_entries = (size_t)(d->num_peers + 1) * d->max_peer_macs;
+        while (d->macs_hash.num_buckets < num_entries) {
+            if (!FDMacsHash_MultiplyBuckets(&d->macs_hash, 0, 1)) {
+                PeerLog(o, BLOG_WARNING, "FDMacsHash_MultiplyBuckets failed");
+                break;
+            }
+        }
+    }
+    
+    // same for the IP hash
+    if (d->max_peer_ips > 0 && d->num_peers < INT_MAX / d->max_peer_ips - 1) {
+        size_t num_entries = (size_t)(d->num_peers + 1) * d->max_peer_ips;
+        while (d->ips_hash.num_buckets < num_entries) {
+            if (!FDIpsHash_MultiplyBuckets(&d->ips_hash, 0, 1)) {
+                PeerLog(o, BLOG_WARNING, "FDIpsHash_MultiplyBuckets failed");
+                break;
+            }
+        }
+    }
+    
     // insert to peers list
     LinkedList1_Append(&d->peers_list, &o->list_node);
+    d->num_peers++;
     
     // init MAC entry lists
     LinkedList1_Init(&o->mac_entries_free);
@@ -613,10 +1049,27 @@ int FrameDeciderPeer_Init (FrameDeciderPeer *o, FrameDecider *d, void *user, BLo
     // initialize groups tree
     FDGroupsTree_Init(&o->groups_tree);
     
+    // init IP entry lists
+    LinkedList1_Init(&o->ip_entries_free);
+    LinkedList1_Init(&o->ip_entries_used);
+    
+    // initialize IP entries
+    for (int i = 0; i < d->max_peer_ips; i++) {
+        struct _FrameDecider_ip_entry *entry = &o->ip_entries[i];
+        
+        // set peer
+        entry->peer = o;
+        
+        // insert to free list
+        LinkedList1_Append(&o->ip_entries_free, &entry->list_node);
+    }
+    
     DebugObject_Init(&o->d_obj);
     
     return 1;
     
+fail2:
+    BFree(o->group_entries);
 fail1:
     BFree(o->mac_entries);
 fail0:
@@ -647,12 +1100,20 @@ void FrameDeciderPeer_Free (FrameDeciderPeer *o)
         BReactor_RemoveTimer(d->reactor, &entry->timer);
     }
     
-    // remove used MAC entries from tree
+    // remove used MAC entries from hash
     for (node = LinkedList1_GetFirst(&o->mac_entries_used); node; node = LinkedList1Node_Next(node)) {
         struct _FrameDecider_mac_entry *entry = UPPER_OBJECT(node, struct _FrameDecider_mac_entry, list_node);
         
-        // remove from tree
-        FDMacsTree_Remove(&d->macs_tree, 0, entry);
+        // remove from hash
+        remove_mac_entry(d, entry);
+    }
+    
+    // remove used IP entries from hash
+    for (node = LinkedList1_GetFirst(&o->ip_entries_used); node; node = LinkedList1Node_Next(node)) {
+        struct _FrameDecider_ip_entry *entry = UPPER_OBJECT(node, struct _FrameDecider_ip_entry, list_node);
+        
+        // remove from hash
+        remove_ip_entry(d, entry);
     }
     
     // remove from peers list
@@ -660,6 +1121,10 @@ void FrameDeciderPeer_Free (FrameDeciderPeer *o)
         d->decide_flood_current = LinkedList1Node_Next(d->decide_flood_current);
     }
     LinkedList1_Remove(&d->peers_list, &o->list_node);
+    d->num_peers--;
+    
+    // free IP entries
+    BFree(o->ip_entries);
     
     // free group entries
     BFree(o->group_entries);
@@ -673,6 +1138,8 @@ void FrameDeciderPeer_Analyze (FrameDeciderPeer *o, const uint8_t *frame, int fr
     ASSERT(frame_len >= 0)
     DebugObject_Access(&o->d_obj);
     
+    FrameDecider *d = o->d;
+    
     const uint8_t *pos = frame;
     int len = frame_len;
     
@@ -789,6 +1256,103 @@ void FrameDeciderPeer_Analyze (FrameDeciderPeer *o, const uint8_t *frame, int fr
                 } break;
             }
         } break;
+        
+        case ETHERTYPE_ARP: {
+            if (!d->proxy_neighbors) {
+                goto out;
+            }
+            
+            // check ARP packet
+            if (len < sizeof(struct arp_packet)) {
+                PeerLog(o, BLOG_INFO, "analyze: ARP: short packet");
+                goto out;
+            }
+            struct arp_packet arp;
+            memcpy(&arp, pos, sizeof(arp));
+            
+            if (ntoh16(arp.hardware_type) != ARP_HARDWARE_TYPE_ETHERNET || ntoh16(arp.protocol_type) != ETHERTYPE_IPV4 ||
+                ntoh8(arp.hardware_size) != 6 || ntoh8(arp.protocol_size) != 4
+            ) {
+                goto out;
+            }
+            
+            uint16_t opcode = ntoh16(arp.opcode);
+            if (opcode != ARP_OPCODE_REQUEST && opcode != ARP_OPCODE_REPLY) {
+                goto out;
+            }
+            
+            // learn the sender's binding, if it agrees with the frame
+            if (arp.sender_ip == 0 || memcmp(arp.sender_mac, eh.source, sizeof(eh.source))) {
+                goto out;
+            }
+            uint8_t addr[16];
+            make_ipv4_mapped(addr, arp.sender_ip);
+            add_ip_to_peer(o, addr, arp.sender_mac, 0);
+        } break;
+        
+        case ETHERTYPE_IPV6: {
+            if (!d->proxy_neighbors) {
+                goto out;
+            }
+            
+            // check IPv6 header
+            struct ipv6_header ipv6_header;
+            if (!ipv6_check((uint8_t *)pos, len, &ipv6_header, (uint8_t **)&pos, &len)) {
+                PeerLog(o, BLOG_INFO, "analyze: wrong IPv6 packet");
+                goto out;
+            }
+            
+            // check if it's Neighbor Discovery
+            if (ntoh8(ipv6_header.next_header) != IPV6_NEXT_ICMPV6 || ntoh8(ipv6_header.hop_limit) != ND_HOP_LIMIT) {
+                goto out;
+            }
+            
+            // check ICMPv6 header
+            if (len < sizeof(struct icmp6_header) + sizeof(struct nd_neighbor_advert)) {
+                goto out;
+            }
+            struct icmp6_header icmp;
+            memcpy(&icmp, pos, sizeof(icmp));
+            pos += sizeof(struct icmp6_header);
+            len -= sizeof(struct icmp6_header);
+            
+            // only learn from advertisements, which tell whether the host is a router
+            if (ntoh8(icmp.type) != ICMP6_TYPE_NEIGHBOR_ADVERTISEMENT || ntoh8(icmp.code) != 0) {
+                goto out;
+            }
+            
+            struct nd_neighbor_advert advert;
+            memcpy(&advert, pos, sizeof(advert));
+            pos += sizeof(struct nd_neighbor_advert);
+            len -= sizeof(struct nd_neighbor_advert);
+            
+            if (advert.target[0] == 0xff || is_ipv4_mapped(advert.target)) {
+                goto out;
+            }
+            
+            // look for the target link-layer address option
+            while (len >= 2) {
+                int opt_len = 8 * ntoh8(pos[1]);
+                if (opt_len == 0 || opt_len > len) {
+                    PeerLog(o, BLOG_INFO, "analyze: ND: bad option");
+                    goto out;
+                }
+                
+                if (ntoh8(pos[0]) == ND_OPTION_TARGET_LINK_ADDRESS && opt_len >= sizeof(struct nd_option_link_address)) {
+                    struct nd_option_link_address option;
+                    memcpy(&option, pos, sizeof(option));
+                    
+                    // learn the binding, if it agrees with the frame
+                    if (!memcmp(option.mac, eh.source, sizeof(eh.source))) {
+                        add_ip_to_peer(o, advert.target, option.mac, !!(ntoh32(advert.flags) & ND_ADVERT_FLAG_ROUTER));
+                    }
+                    goto out;
+                }
+                
+                pos += opt_len;
+                len -= opt_len;
+            }
+        } break;
     }
     
 out:;
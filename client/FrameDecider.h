@@ -40,6 +40,7 @@
 #include <structure/LinkedList1.h>
 #include <structure/LinkedList3.h>
 #include <structure/SAvl.h>
+#include <structure/CHash.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
 #include <system/BReactor.h>
@@ -47,11 +48,16 @@
 struct _FrameDeciderPeer;
 struct _FrameDecider_mac_entry;
 struct _FrameDecider_group_entry;
+struct _FrameDecider_ip_entry;
 
-typedef const uint8_t *FDMacsTree_key;
+typedef const uint8_t *FDMacsHash_key;
+typedef const uint8_t *FDIpsHash_key;
 
-#include "FrameDecider_macs_tree.h"
-#include <structure/SAvl_decl.h>
+#include "FrameDecider_macs_hash.h"
+#include <structure/CHash_decl.h>
+
+#include "FrameDecider_ips_hash.h"
+#include <structure/CHash_decl.h>
 
 #include "FrameDecider_groups_tree.h"
 #include <structure/SAvl_decl.h>
@@ -64,9 +70,23 @@ struct _FrameDecider_mac_entry {
     LinkedList1Node list_node; // node in FrameDeciderPeer.mac_entries_free or FrameDeciderPeer.mac_entries_used
     // defined when used:
     uint8_t mac[6];
-    FDMacsTreeNode tree_node; // node in FrameDecider.macs_tree, indexed by mac
+    struct _FrameDecider_mac_entry *hash_next; // next in FrameDecider.macs_hash bucket, indexed by mac
+};
+
+struct _FrameDecider_ip_entry {
+    struct _FrameDeciderPeer *peer;
+    LinkedList1Node list_node; // node in FrameDeciderPeer.ip_entries_free or FrameDeciderPeer.ip_entries_used
+    // defined when used:
+    uint8_t addr[16]; // IPv6 address, or IPv4-mapped IPv6 address
+    uint8_t mac[6];
+    int is_router; // Router flag of the Neighbor Advertisement the IPv6 binding was learned from
+    btime_t learn_time;
+    struct _FrameDecider_ip_entry *hash_next; // next in FrameDecider.ips_hash bucket, indexed by addr
 };
 
+#define FRAMEDECIDER_FLOOD_SLOTS 64
+#define FRAMEDECIDER_REPLY_MAX 86
+
 struct _FrameDecider_group_entry {
     struct _FrameDeciderPeer *peer;
     LinkedList1Node list_node; // node in FrameDeciderPeer.group_entries_free or FrameDeciderPeer.group_entries_used
@@ -94,10 +114,19 @@ typedef struct {
     int max_peer_groups;
     btime_t igmp_group_membership_interval;
     btime_t igmp_last_member_query_time;
+    int proxy_neighbors;
+    int max_flood_rate;
+    int max_peer_ips;
     BReactor *reactor;
     LinkedList1 peers_list;
-    FDMacsTree macs_tree;
+    int num_peers;
+    FDMacsHash macs_hash;
+    struct _FrameDecider_mac_entry *last_dest_entry;
+    FDIpsHash ips_hash;
     FDMulticastTree multicast_tree;
+    btime_t flood_tat[FRAMEDECIDER_FLOOD_SLOTS]; // flood rate limiter state, indexed by hash of source MAC
+    int reply_len;
+    uint8_t reply[FRAMEDECIDER_REPLY_MAX];
     int decide_state;
     LinkedList1Node *decide_flood_current;
     struct _FrameDeciderPeer *decide_unicast_peer;
@@ -114,11 +143,14 @@ typedef struct _FrameDeciderPeer {
     BLog_logfunc logfunc;
     struct _FrameDecider_mac_entry *mac_entries;
     struct _FrameDecider_group_entry *group_entries;
+    struct _FrameDecider_ip_entry *ip_entries;
     LinkedList1Node list_node; // node in FrameDecider.peers_list
     LinkedList1 mac_entries_free;
     LinkedList1 mac_entries_used;
     LinkedList1 group_entries_free;
     LinkedList1 group_entries_used;
+    LinkedList1 ip_entries_free;
+    LinkedList1 ip_entries_used;
     FDGroupsTree groups_tree;
     DebugObject d_obj;
 } FrameDeciderPeer;
@@ -136,8 +168,16 @@ typedef struct _FrameDeciderPeer {
  * @param igmp_last_member_query_time IGMP Last Member Query Time value. When a Group-Specific
  *        Query is detected in {@link FrameDecider_AnalyzeAndDecide}, this is how long we wait for a peer
  *        belonging to the group to send a join before we remove the group from it.
+ * @param proxy_neighbors whether to answer ARP requests and IPv6 Neighbor Solicitations
+ *        from the local device for addresses of peers, using bindings learned in
+ *        {@link FrameDeciderPeer_Analyze}, instead of flooding them. Answers are obtained
+ *        with {@link FrameDecider_GetReply}.
+ * @param max_flood_rate maximum number of flooded frames per second from a single source
+ *        MAC address, with a burst of the same number of frames. Excess floods are dropped.
+ *        Must be >=0; 0 means no limit.
+ * @return 1 on success, 0 on failure
  */
-void FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, BReactor *reactor);
+int FrameDecider_Init (FrameDecider *o, int max_peer_macs, int max_peer_groups, btime_t igmp_group_membership_interval, btime_t igmp_last_member_query_time, int proxy_neighbors, int max_flood_rate, BReactor *reactor) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -166,6 +206,20 @@ void FrameDecider_AnalyzeAndDecide (FrameDecider *o, const uint8_t *frame, int f
  */
 FrameDeciderPeer * FrameDecider_NextDestination (FrameDecider *o);
 
+/**
+ * Returns the frame to be written to the local device in response to the frame
+ * submitted to {@link FrameDecider_AnalyzeAndDecide}, if there is one.
+ * This is the case when the frame was an ARP request or Neighbor Solicitation
+ * answered on behalf of a peer; such a frame has no destinations.
+ * The frame remains valid until the next {@link FrameDecider_AnalyzeAndDecide}.
+ * 
+ * @param o the object
+ * @param out_frame on success, will be set to the frame data
+ * @param out_frame_len on success, will be set to the frame length
+ * @return 1 if there is a reply, 0 if not
+ */
+int FrameDecider_GetReply (FrameDecider *o, uint8_t **out_frame, int *out_frame_len);
+
 /**
  * Initializes the object.
  * 
@@ -186,6 +240,9 @@ void FrameDeciderPeer_Free (FrameDeciderPeer *o);
 
 /**
  * Analyzes a frame received from the peer.
+ * Learns the peer's MAC addresses and multicast group memberships, and if
+ * proxy_neighbors was enabled, bindings of IP addresses to MAC addresses
+ * from ARP packets and IPv6 Neighbor Advertisements.
  * 
  * @param o the object
  * @param frame frame data
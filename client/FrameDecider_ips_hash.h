@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME FDIpsHash
+#define CHASH_PARAM_ENTRY struct _FrameDecider_ip_entry
+#define CHASH_PARAM_LINK struct _FrameDecider_ip_entry *
+#define CHASH_PARAM_KEY FDIpsHash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((struct _FrameDecider_ip_entry *)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) hash_ip((entry).ptr->addr)
+#define CHASH_PARAM_KEYHASH(arg, key) hash_ip((key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 0
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (!memcmp((entry1).ptr->addr, (entry2).ptr->addr, 16))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (!memcmp((key1), (entry2).ptr->addr, 16))
+#define CHASH_PARAM_ENTRY_NEXT hash_next
@@ -0,0 +1,333 @@
+/**
+ * @file IPDecider.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/ipv4_proto.h>
+#include <misc/ipv6_proto.h>
+
+#include <client/IPDecider.h>
+
+#include <generated/blog_channel_IPDecider.h>
+
+#define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
+
+static size_t hash_key (const uint8_t *key)
+{
+    uint64_t a;
+    uint64_t b;
+    memcpy(&a, key + 2, 8);
+    memcpy(&b, key + 10, 8);
+    
+    uint64_t x = (a * UINT64_C(0x9E3779B97F4A7C15)) ^ (b * UINT64_C(0xC2B2AE3D27D4EB4F)) ^ ((uint64_t)key[0] << 8 | key[1]);
+    
+    return (x * UINT64_C(0x9E3779B97F4A7C15)) >> 32;
+}
+
+#include "IPDecider_routes_hash.h"
+#include <structure/CHash_impl.h>
+
+static void make_key (uint8_t *key, int is_ipv6, const uint8_t *addr, int prefix)
+{
+    key[0] = is_ipv6;
+    key[1] = prefix;
+    
+    // copy whole bytes of the network part, clear the rest
+    int quot = prefix / 8;
+    int rem = prefix % 8;
+    memcpy(key + 2, addr, quot);
+    memset(key + 2 + quot, 0, 16 - quot);
+    if (rem > 0) {
+        key[2 + quot] = addr[quot] & (uint8_t)(0xFF << (8 - rem));
+    }
+}
+
+static int * route_counter (IPDecider *d, const uint8_t *key)
+{
+    return (key[0] ? &d->num_routes6[key[1]] : &d->num_routes4[key[1]]);
+}
+
+static void install_route (IPDecider *d, struct _IPDecider_route *route)
+{
+    ASSERT(!route->installed)
+    
+    IPDRoutesHashRef ref = {route, route};
+    if (!IPDRoutesHash_Insert(&d->routes_hash, 0, ref, NULL)) {
+        return;
+    }
+    
+    route->installed = 1;
+    (*route_counter(d, route->key))++;
+    
+    // routes changed, forget cached destination
+    d->cache_peer = NULL;
+}
+
+static void remove_route (IPDecider *d, struct _IPDecider_route *route)
+{
+    if (!route->installed) {
+        return;
+    }
+    
+    IPDRoutesHashRef ref = {route, route};
+    IPDRoutesHash_Remove(&d->routes_hash, 0, ref);
+    
+    route->installed = 0;
+    (*route_counter(d, route->key))--;
+    
+    // routes changed, forget cached destination
+    d->cache_peer = NULL;
+    
+    // let another peer's route to the same network take over
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&d->peers_list); node; node = LinkedList1Node_Next(node)) {
+        IPDeciderPeer *peer = UPPER_OBJECT(node, IPDeciderPeer, list_node);
+        for (int i = 0; i < peer->num_routes; i++) {
+            struct _IPDecider_route *other = &peer->routes[i];
+            if (other != route && !other->installed && !memcmp(other->key, route->key, IPDECIDER_KEY_LEN)) {
+                install_route(d, other);
+                return;
+            }
+        }
+    }
+}
+
+int IPDecider_Init (IPDecider *o, int max_peer_routes)
+{
+    ASSERT(max_peer_routes > 0)
+    
+    // init arguments
+    o->max_peer_routes = max_peer_routes;
+    
+    // init peers list
+    LinkedList1_Init(&o->peers_list);
+    o->num_peers = 0;
+    
+    // init routes hash; buckets are added as peers come
+    if (!IPDRoutesHash_Init(&o->routes_hash, o->max_peer_routes)) {
+        BLog(BLOG_ERROR, "IPDRoutesHash_Init failed");
+        return 0;
+    }
+    
+    // init route counters
+    for (int i = 0; i <= 32; i++) {
+        o->num_routes4[i] = 0;
+    }
+    for (int i = 0; i <= 128; i++) {
+        o->num_routes6[i] = 0;
+    }
+    
+    // have no cached destination
+    o->cache_peer = NULL;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
+void IPDecider_Free (IPDecider *o)
+{
+    ASSERT(LinkedList1_IsEmpty(&o->peers_list))
+    ASSERT(!o->cache_peer)
+    DebugObject_Free(&o->d_obj);
+    
+    // free routes hash
+    IPDRoutesHash_Free(&o->routes_hash);
+}
+
+IPDeciderPeer * IPDecider_Decide (IPDecider *o, const uint8_t *packet, int packet_len)
+{
+    ASSERT(packet_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    if (packet_len < 1) {
+        return NULL;
+    }
+    
+    // extract destination address
+    uint8_t key[IPDECIDER_KEY_LEN];
+    int max_prefix;
+    int *num_routes;
+    switch (packet[0] >> 4) {
+        case 4: {
+            if (packet_len < sizeof(struct ipv4_header)) {
+                return NULL;
+            }
+            key[0] = 0;
+            memcpy(key + 2, packet + offsetof(struct ipv4_header, destination_address), 4);
+            memset(key + 6, 0, 12);
+            max_prefix = 32;
+            num_routes = o->num_routes4;
+        } break;
+        
+        case 6: {
+            if (packet_len < sizeof(struct ipv6_header)) {
+                return NULL;
+            }
+            key[0] = 1;
+            memcpy(key + 2, packet + offsetof(struct ipv6_header, destination_address), 16);
+            max_prefix = 128;
+            num_routes = o->num_routes6;
+        } break;
+        
+        default:
+            return NULL;
+    }
+    key[1] = 0;
+    
+    // check the previous destination, which likely repeats for a stream of packets
+    if (o->cache_peer && !memcmp(o->cache_key, key, IPDECIDER_KEY_LEN)) {
+        return o->cache_peer;
+    }
+    
+    uint8_t addr[16];
+    memcpy(addr, key + 2, sizeof(addr));
+    
+    // look for the longest matching prefix, trying only prefix lengths in use
+    for (int prefix = max_prefix; prefix >= 0; prefix--) {
+        if (num_routes[prefix] == 0) {
+            continue;
+        }
+        
+        make_key(key, key[0], addr, prefix);
+        struct _IPDecider_route *route = IPDRoutesHash_Lookup(&o->routes_hash, 0, key).ptr;
+        if (route) {
+            ASSERT(route->installed)
+            
+            // remember destination
+            o->cache_key[0] = key[0];
+            o->cache_key[1] = 0;
+            memcpy(o->cache_key + 2, addr, sizeof(addr));
+            o->cache_peer = route->peer;
+            
+            return route->peer;
+        }
+    }
+    
+    return NULL;
+}
+
+int IPDeciderPeer_Init (IPDeciderPeer *o, IPDecider *d, void *user, BLog_logfunc logfunc)
+{
+    // init arguments
+    o->d = d;
+    o->user = user;
+    o->logfunc = logfunc;
+    
+    // allocate routes
+    if (!(o->routes = (struct _IPDecider_route *)BAllocArray(d->max_peer_routes, sizeof(struct _IPDecider_route)))) {
+        PeerLog(o, BLOG_ERROR, "failed to allocate routes");
+        return 0;
+    }
+    
+    // have no routes
+    o->num_routes = 0;
+    
+    // make sure the routes hash has a bucket for each possible route
+    if (d->num_peers < INT_MAX / d->max_peer_routes - 1) {
+        size_t num_entries = (size_t)(d->num_peers + 1) * d->max_peer_routes;
+        while (d->routes_hash.num_buckets < num_entries) {
+            if (!IPDRoutesHash_MultiplyBuckets(&d->routes_hash, 0, 1)) {
+                PeerLog(o, BLOG_WARNING, "IPDRoutesHash_MultiplyBuckets failed");
+                break;
+            }
+        }
+    }
+    
+    // insert to peers list
+    LinkedList1_Append(&d->peers_list, &o->list_node);
+    d->num_peers++;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
+void IPDeciderPeer_Free (IPDeciderPeer *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    IPDecider *d = o->d;
+    
+    // remove from peers list, so that our routes don't take over each other
+    LinkedList1_Remove(&d->peers_list, &o->list_node);
+    d->num_peers--;
+    
+    // remove routes
+    for (int i = 0; i < o->num_routes; i++) {
+        remove_route(d, &o->routes[i]);
+    }
+    
+    // free routes
+    BFree(o->routes);
+}
+
+void IPDeciderPeer_ClearRoutes (IPDeciderPeer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    IPDecider *d = o->d;
+    
+    // mark routes as going away, so that they don't take over each other
+    int num_routes = o->num_routes;
+    o->num_routes = 0;
+    
+    for (int i = 0; i < num_routes; i++) {
+        remove_route(d, &o->routes[i]);
+    }
+}
+
+int IPDeciderPeer_AddRoute (IPDeciderPeer *o, int is_ipv6, const uint8_t *addr, int prefix)
+{
+    ASSERT(is_ipv6 == 0 || is_ipv6 == 1)
+    ASSERT(prefix >= 0)
+    ASSERT(prefix <= (is_ipv6 ? 128 : 32))
+    DebugObject_Access(&o->d_obj);
+    
+    IPDecider *d = o->d;
+    
+    if (o->num_routes == d->max_peer_routes) {
+        return 0;
+    }
+    
+    struct _IPDecider_route *route = &o->routes[o->num_routes++];
+    route->peer = o;
+    route->installed = 0;
+    make_key(route->key, is_ipv6, addr, prefix);
+    
+    // install route, unless another one to the same network is installed
+    install_route(d, route);
+    if (!route->installed) {
+        PeerLog(o, BLOG_WARNING, "route is already used by another peer");
+    }
+    
+    return 1;
+}
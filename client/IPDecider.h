@@ -0,0 +1,161 @@
+/**
+ * @file IPDecider.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Module which decides to which peer IP packets from a TUN device are to be
+ * forwarded, based on the networks announced by peers.
+ */
+
+#ifndef BADVPN_CLIENT_IPDECIDER_H
+#define BADVPN_CLIENT_IPDECIDER_H
+
+#include <stdint.h>
+
+#include <structure/LinkedList1.h>
+#include <structure/CHash.h>
+#include <base/DebugObject.h>
+#include <base/BLog.h>
+
+// route key: IP version (0 for IPv4, 1 for IPv6), prefix length, and 16 bytes of
+// network address with host bits cleared (IPv4 uses the first 4 bytes)
+#define IPDECIDER_KEY_LEN 18
+
+struct _IPDeciderPeer;
+struct _IPDecider_route;
+
+typedef const uint8_t *IPDRoutesHash_key;
+
+#include "IPDecider_routes_hash.h"
+#include <structure/CHash_decl.h>
+
+struct _IPDecider_route {
+    struct _IPDeciderPeer *peer;
+    int installed; // whether the route is in IPDecider.routes_hash
+    uint8_t key[IPDECIDER_KEY_LEN];
+    struct _IPDecider_route *hash_next; // next in IPDecider.routes_hash bucket, indexed by key
+};
+
+/**
+ * Object that represents a local TUN device.
+ */
+typedef struct {
+    int max_peer_routes;
+    LinkedList1 peers_list;
+    int num_peers;
+    IPDRoutesHash routes_hash;
+    int num_routes4[33]; // number of installed IPv4 routes by prefix length
+    int num_routes6[129]; // number of installed IPv6 routes by prefix length
+    struct _IPDeciderPeer *cache_peer; // peer for cache_key, or NULL
+    uint8_t cache_key[IPDECIDER_KEY_LEN]; // IP version, zero and address of the previous destination
+    DebugObject d_obj;
+} IPDecider;
+
+/**
+ * Object that represents a peer that a local TUN device can send packets to.
+ */
+typedef struct _IPDeciderPeer {
+    IPDecider *d;
+    void *user;
+    BLog_logfunc logfunc;
+    struct _IPDecider_route *routes;
+    int num_routes;
+    LinkedList1Node list_node; // node in IPDecider.peers_list
+    DebugObject d_obj;
+} IPDeciderPeer;
+
+/**
+ * Initializes the object.
+ * 
+ * @param o the object
+ * @param max_peer_routes maximum number of routes a peer may announce. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int IPDecider_Init (IPDecider *o, int max_peer_routes) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * There must be no {@link IPDeciderPeer} objects using this decider.
+ * 
+ * @param o the object
+ */
+void IPDecider_Free (IPDecider *o);
+
+/**
+ * Decides which peer an IP packet read from the local device should be
+ * forwarded to, by the longest prefix match of its destination address
+ * among the routes of all peers.
+ * 
+ * @param o the object
+ * @param packet packet data
+ * @param packet_len packet length. Must be >=0.
+ * @return peer to forward the packet to, or NULL if no route matches
+ */
+IPDeciderPeer * IPDecider_Decide (IPDecider *o, const uint8_t *packet, int packet_len);
+
+/**
+ * Initializes the object.
+ * The peer starts with no routes.
+ * 
+ * @param o the object
+ * @param d decider this peer will belong to
+ * @param user argument to log function
+ * @param logfunc function which prepends the log prefix using {@link BLog_Append}
+ * @return 1 on success, 0 on failure
+ */
+int IPDeciderPeer_Init (IPDeciderPeer *o, IPDecider *d, void *user, BLog_logfunc logfunc) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void IPDeciderPeer_Free (IPDeciderPeer *o);
+
+/**
+ * Removes all routes of the peer.
+ * 
+ * @param o the object
+ */
+void IPDeciderPeer_ClearRoutes (IPDeciderPeer *o);
+
+/**
+ * Adds a route to the peer.
+ * If another peer already has a route to the same network, the route is only
+ * used once that peer's route is removed.
+ * 
+ * @param o the object
+ * @param is_ipv6 whether this is an IPv6 route. Must be 0 or 1.
+ * @param addr network address; 4 bytes for IPv4, 16 bytes for IPv6.
+ *             Host bits are ignored.
+ * @param prefix prefix length. Must be >=0 and <=32 for IPv4 or <=128 for IPv6.
+ * @return 1 on success, 0 if the peer already has the maximum number of routes
+ */
+int IPDeciderPeer_AddRoute (IPDeciderPeer *o, int is_ipv6, const uint8_t *addr, int prefix);
+
+#endif
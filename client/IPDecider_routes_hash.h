@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME IPDRoutesHash
+#define CHASH_PARAM_ENTRY struct _IPDecider_route
+#define CHASH_PARAM_LINK struct _IPDecider_route *
+#define CHASH_PARAM_KEY IPDRoutesHash_key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((struct _IPDecider_route *)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) hash_key((entry).ptr->key)
+#define CHASH_PARAM_KEYHASH(arg, key) hash_key((key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 0
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) (!memcmp((entry1).ptr->key, (entry2).ptr->key, IPDECIDER_KEY_LEN))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) (!memcmp((key1), (entry2).ptr->key, IPDECIDER_KEY_LEN))
+#define CHASH_PARAM_ENTRY_NEXT hash_next
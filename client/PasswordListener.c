@@ -28,6 +28,7 @@
  */
 
 #include <stdlib.h>
+#include <limits.h>
 
 #include <prerror.h>
 
@@ -36,7 +37,6 @@
 #include <misc/offset.h>
 #include <misc/byteorder.h>
 #include <misc/balloc.h>
-#include <misc/compare.h>
 #include <base/BLog.h>
 #include <security/BRandom.h>
 #include <nspr_support/DummyPRFileDesc.h>
@@ -45,40 +45,49 @@
 
 #include <generated/blog_channel_PasswordListener.h>
 
-static int password_comparator (void *user, uint64_t *p1, uint64_t *p2);
+#define PASSWORDLISTENER_HASH_INITIAL_BUCKETS 16
+
 static void remove_client (struct PasswordListenerClient *client);
+static int start_client (struct PasswordListenerClient *client);
+static void start_pending_clients (PasswordListener *l);
 static void listener_handler (PasswordListener *l);
 static void client_connection_handler (struct PasswordListenerClient *client, int event);
 static void client_sslcon_handler (struct PasswordListenerClient *client, int event);
 static void client_receiver_handler (struct PasswordListenerClient *client);
 
-int password_comparator (void *user, uint64_t *p1, uint64_t *p2)
-{
-    return B_COMPARE(*p1, *p2);
-}
+#include "PasswordListener_hash.h"
+#include <structure/CHash_impl.h>
 
 void remove_client (struct PasswordListenerClient *client)
 {
     PasswordListener *l = client->l;
     
-    // stop using any buffers before they get freed
-    if (l->ssl) {
-        BSSLConnection_ReleaseBuffers(&client->sslcon);
-    }
-    
-    // free receiver
-    SingleStreamReceiver_Free(&client->receiver);
-    
-    // free SSL
-    if (l->ssl) {
-        BSSLConnection_Free(&client->sslcon);
-        ASSERT_FORCE(PR_Close(client->sock->ssl_prfd) == PR_SUCCESS)
+    if (client->started) {
+        // stop using any buffers before they get freed
+        if (l->ssl) {
+            BSSLConnection_ReleaseBuffers(&client->sslcon);
+        }
+        
+        // free receiver
+        SingleStreamReceiver_Free(&client->receiver);
+        
+        // free SSL
+        if (l->ssl) {
+            BSSLConnection_Free(&client->sslcon);
+            ASSERT_FORCE(PR_Close(client->sock->ssl_prfd) == PR_SUCCESS)
+        }
+        
+        // free connection interfaces
+        BConnection_RecvAsync_Free(&client->sock->con);
+        BConnection_SendAsync_Free(&client->sock->con);
+        
+        // release slot
+        LinkedList1_Remove(&l->clients_used, &client->list_node);
+        l->num_used--;
+    } else {
+        LinkedList1_Remove(&l->clients_pending, &client->list_node);
     }
     
-    // free connection interfaces
-    BConnection_RecvAsync_Free(&client->sock->con);
-    BConnection_SendAsync_Free(&client->sock->con);
-    
     // free connection
     BConnection_Free(&client->sock->con);
     
@@ -86,36 +95,14 @@ void remove_client (struct PasswordListenerClient *client)
     free(client->sock);
     
     // move to free list
-    LinkedList1_Remove(&l->clients_used, &client->list_node);
     LinkedList1_Append(&l->clients_free, &client->list_node);
 }
 
-void listener_handler (PasswordListener *l)
+int start_client (struct PasswordListenerClient *client)
 {
-    DebugObject_Access(&l->d_obj);
-    
-    // obtain client entry
-    if (LinkedList1_IsEmpty(&l->clients_free)) {
-        struct PasswordListenerClient *client = UPPER_OBJECT(LinkedList1_GetFirst(&l->clients_used), struct PasswordListenerClient, list_node);
-        remove_client(client);
-    }
-    struct PasswordListenerClient *client = UPPER_OBJECT(LinkedList1_GetLast(&l->clients_free), struct PasswordListenerClient, list_node);
-    LinkedList1_Remove(&l->clients_free, &client->list_node);
-    LinkedList1_Append(&l->clients_used, &client->list_node);
-    
-    // allocate sslsocket structure
-    if (!(client->sock = (sslsocket *)malloc(sizeof(*client->sock)))) {
-        BLog(BLOG_ERROR, "malloc failedt");
-        goto fail0;
-    }
-    
-    // accept connection
-    if (!BConnection_Init(&client->sock->con, BConnection_source_listener(&l->listener, NULL), l->bsys, client, (BConnection_handler)client_connection_handler)) {
-        BLog(BLOG_ERROR, "BConnection_Init failed");
-        goto fail1;
-    }
-    
-    BLog(BLOG_INFO, "Connection accepted");
+    PasswordListener *l = client->l;
+    ASSERT(!client->started)
+    ASSERT(l->num_used < l->max_clients)
     
     // init connection interfaces
     BConnection_SendAsync_Init(&client->sock->con);
@@ -128,29 +115,29 @@ void listener_handler (PasswordListener *l)
         // create bottom NSPR file descriptor
         if (!BSSLConnection_MakeBackend(&client->sock->bottom_prfd, send_if, recv_if, l->twd, l->ssl_flags)) {
             BLog(BLOG_ERROR, "BSSLConnection_MakeBackend failed");
-            goto fail2;
+            goto fail0;
         }
         
         // create SSL file descriptor from the bottom NSPR file descriptor
         if (!(client->sock->ssl_prfd = SSL_ImportFD(l->model_prfd, &client->sock->bottom_prfd))) {
             ASSERT_FORCE(PR_Close(&client->sock->bottom_prfd) == PR_SUCCESS)
-            goto fail2;
+            goto fail0;
         }
         
         // set server mode
         if (SSL_ResetHandshake(client->sock->ssl_prfd, PR_TRUE) != SECSuccess) {
             BLog(BLOG_ERROR, "SSL_ResetHandshake failed");
-            goto fail3;
+            goto fail1;
         }
         
         // set require client certificate
         if (SSL_OptionSet(client->sock->ssl_prfd, SSL_REQUEST_CERTIFICATE, PR_TRUE) != SECSuccess) {
             BLog(BLOG_ERROR, "SSL_OptionSet(SSL_REQUEST_CERTIFICATE) failed");
-            goto fail3;
+            goto fail1;
         }
         if (SSL_OptionSet(client->sock->ssl_prfd, SSL_REQUIRE_CERTIFICATE, PR_TRUE) != SECSuccess) {
             BLog(BLOG_ERROR, "SSL_OptionSet(SSL_REQUIRE_CERTIFICATE) failed");
-            goto fail3;
+            goto fail1;
         }
         
         // initialize SSLConnection
@@ -163,21 +150,75 @@ void listener_handler (PasswordListener *l)
     // init receiver
     SingleStreamReceiver_Init(&client->receiver, (uint8_t *)&client->recv_buffer, sizeof(client->recv_buffer), recv_if, BReactor_PendingGroup(l->bsys), client, (SingleStreamReceiver_handler)client_receiver_handler);
     
-    return;
+    // take slot
+    client->started = 1;
+    LinkedList1_Remove(&l->clients_pending, &client->list_node);
+    LinkedList1_Append(&l->clients_used, &client->list_node);
+    l->num_used++;
     
-    // cleanup on error
-fail3:
+    return 1;
+    
+fail1:
     if (l->ssl) {
         ASSERT_FORCE(PR_Close(client->sock->ssl_prfd) == PR_SUCCESS)
     }
-fail2:
+fail0:
     BConnection_RecvAsync_Free(&client->sock->con);
     BConnection_SendAsync_Free(&client->sock->con);
-    BConnection_Free(&client->sock->con);
+    return 0;
+}
+
+void start_pending_clients (PasswordListener *l)
+{
+    LinkedList1Node *node;
+    while (l->num_used < l->max_clients && (node = LinkedList1_GetFirst(&l->clients_pending))) {
+        struct PasswordListenerClient *client = UPPER_OBJECT(node, struct PasswordListenerClient, list_node);
+        if (!start_client(client)) {
+            remove_client(client);
+        }
+    }
+}
+
+void listener_handler (PasswordListener *l)
+{
+    DebugObject_Access(&l->d_obj);
+    
+    // obtain client entry; if all are taken, drop the client which has been
+    // holding a slot the longest, and let the oldest waiting one take it
+    if (LinkedList1_IsEmpty(&l->clients_free)) {
+        ASSERT(!LinkedList1_IsEmpty(&l->clients_used))
+        struct PasswordListenerClient *client = UPPER_OBJECT(LinkedList1_GetFirst(&l->clients_used), struct PasswordListenerClient, list_node);
+        remove_client(client);
+        start_pending_clients(l);
+    }
+    struct PasswordListenerClient *client = UPPER_OBJECT(LinkedList1_GetLast(&l->clients_free), struct PasswordListenerClient, list_node);
+    LinkedList1_Remove(&l->clients_free, &client->list_node);
+    
+    // allocate sslsocket structure
+    if (!(client->sock = (sslsocket *)malloc(sizeof(*client->sock)))) {
+        BLog(BLOG_ERROR, "malloc failedt");
+        goto fail0;
+    }
+    
+    // accept connection
+    if (!BConnection_Init(&client->sock->con, BConnection_source_listener(&l->listener, NULL), l->bsys, client, (BConnection_handler)client_connection_handler)) {
+        BLog(BLOG_ERROR, "BConnection_Init failed");
+        goto fail1;
+    }
+    
+    BLog(BLOG_INFO, "Connection accepted");
+    
+    // queue behind the clients accepted before
+    client->started = 0;
+    LinkedList1_Append(&l->clients_pending, &client->list_node);
+    
+    start_pending_clients(l);
+    return;
+    
+    // cleanup on error
 fail1:
     free(client->sock);
 fail0:
-    LinkedList1_Remove(&l->clients_used, &client->list_node);
     LinkedList1_Append(&l->clients_free, &client->list_node);
 }
 
@@ -193,6 +234,7 @@ void client_connection_handler (struct PasswordListenerClient *client, int event
     }
     
     remove_client(client);
+    start_pending_clients(l);
 }
 
 void client_sslcon_handler (struct PasswordListenerClient *client, int event)
@@ -205,6 +247,7 @@ void client_sslcon_handler (struct PasswordListenerClient *client, int event)
     BLog(BLOG_INFO, "SSL error");
     
     remove_client(client);
+    start_pending_clients(l);
 }
 
 void client_receiver_handler (struct PasswordListenerClient *client)
@@ -212,20 +255,23 @@ void client_receiver_handler (struct PasswordListenerClient *client)
     PasswordListener *l = client->l;
     DebugObject_Access(&l->d_obj);
     
+    ASSERT(client->started)
+    
     // check password
     uint64_t received_pass = ltoh64(client->recv_buffer);
-    BAVLNode *pw_tree_node = BAVL_LookupExact(&l->passwords, &received_pass);
-    if (!pw_tree_node) {
+    PasswordListener_pwentry *pw_entry = PasswordListener__Hash_Lookup(&l->passwords, 0, received_pass).ptr;
+    if (!pw_entry) {
         BLog(BLOG_WARNING, "unknown password");
         remove_client(client);
+        start_pending_clients(l);
         return;
     }
-    PasswordListener_pwentry *pw_entry = UPPER_OBJECT(pw_tree_node, PasswordListener_pwentry, tree_node);
     
     BLog(BLOG_INFO, "Password recognized");
     
     // remove password entry
-    BAVL_Remove(&l->passwords, &pw_entry->tree_node);
+    PasswordListener__HashRef ref = {pw_entry, pw_entry};
+    PasswordListener__Hash_Remove(&l->passwords, 0, ref);
     
     // stop using any buffers before they get freed
     if (l->ssl) {
@@ -250,16 +296,22 @@ void client_receiver_handler (struct PasswordListenerClient *client)
     // move client entry to free list
     LinkedList1_Remove(&l->clients_used, &client->list_node);
     LinkedList1_Append(&l->clients_free, &client->list_node);
+    l->num_used--;
+    
+    // let the next waiting client take the slot
+    start_pending_clients(l);
     
     // give the socket to the handler
     pw_entry->handler_client(pw_entry->user, client->sock);
     return;
 }
 
-int PasswordListener_Init (PasswordListener *l, BReactor *bsys, BThreadWorkDispatcher *twd, BAddr listen_addr, int max_clients, int ssl, int ssl_flags, CERTCertificate *cert, SECKEYPrivateKey *key)
+int PasswordListener_Init (PasswordListener *l, BReactor *bsys, BThreadWorkDispatcher *twd, BAddr listen_addr, int max_clients, int max_pending, int ssl, int ssl_flags, CERTCertificate *cert, SECKEYPrivateKey *key)
 {
     ASSERT(BConnection_AddressSupported(listen_addr))
     ASSERT(max_clients > 0)
+    ASSERT(max_pending >= 0)
+    ASSERT(max_pending <= INT_MAX - max_clients)
     ASSERT(ssl == 0 || ssl == 1)
     
     // init arguments
@@ -267,9 +319,10 @@ int PasswordListener_Init (PasswordListener *l, BReactor *bsys, BThreadWorkDispa
     l->twd = twd;
     l->ssl = ssl;
     l->ssl_flags = ssl_flags;
+    l->max_clients = max_clients;
     
     // allocate client entries
-    if (!(l->clients_data = (struct PasswordListenerClient *)BAllocArray(max_clients, sizeof(struct PasswordListenerClient)))) {
+    if (!(l->clients_data = (struct PasswordListenerClient *)BAllocArray(max_clients + max_pending, sizeof(struct PasswordListenerClient)))) {
         BLog(BLOG_ERROR, "BAllocArray failed");
         goto fail0;
     }
@@ -293,25 +346,33 @@ int PasswordListener_Init (PasswordListener *l, BReactor *bsys, BThreadWorkDispa
     // initialize client entries
     LinkedList1_Init(&l->clients_free);
     LinkedList1_Init(&l->clients_used);
-    for (int i = 0; i < max_clients; i++) {
+    LinkedList1_Init(&l->clients_pending);
+    l->num_used = 0;
+    for (int i = 0; i < max_clients + max_pending; i++) {
         struct PasswordListenerClient *conn = &l->clients_data[i];
         conn->l = l;
         LinkedList1_Append(&l->clients_free, &conn->list_node);
     }
     
-    // initialize passwords tree
-    BAVL_Init(&l->passwords, OFFSET_DIFF(PasswordListener_pwentry, password, tree_node), (BAVL_comparator)password_comparator, NULL);
+    // initialize passwords hash
+    if (!PasswordListener__Hash_Init(&l->passwords, PASSWORDLISTENER_HASH_INITIAL_BUCKETS)) {
+        BLog(BLOG_ERROR, "PasswordListener__Hash_Init failed");
+        goto fail2;
+    }
     
-    // initialize listener
-    if (!BListener_Init(&l->listener, listen_addr,  l->bsys, l, (BListener_handler)listener_handler)) {
+    // initialize listener; clients speak first, so they need not be
+    // reported until they have sent something
+    if (!BListener_InitFrom2(&l->listener, BLisCon_from_addr(listen_addr), BLISTENER_FLAG_DEFER_ACCEPT, l->bsys, l, (BListener_handler)listener_handler)) {
         BLog(BLOG_ERROR, "Listener_Init failed");
-        goto fail2;
+        goto fail3;
     }
     
     DebugObject_Init(&l->d_obj);
     return 1;
     
     // cleanup
+fail3:
+    PasswordListener__Hash_Free(&l->passwords);
 fail2:
     if (l->ssl) {
         ASSERT_FORCE(PR_Close(l->model_prfd) == PR_SUCCESS)
@@ -332,10 +393,17 @@ void PasswordListener_Free (PasswordListener *l)
         struct PasswordListenerClient *client = UPPER_OBJECT(node, struct PasswordListenerClient, list_node);
         remove_client(client);
     }
+    while (node = LinkedList1_GetFirst(&l->clients_pending)) {
+        struct PasswordListenerClient *client = UPPER_OBJECT(node, struct PasswordListenerClient, list_node);
+        remove_client(client);
+    }
     
     // free listener
     BListener_Free(&l->listener);
     
+    // free passwords hash
+    PasswordListener__Hash_Free(&l->passwords);
+    
     // free model SSL file descriptor
     if (l->ssl) {
         ASSERT_FORCE(PR_Close(l->model_prfd) == PR_SUCCESS)
@@ -354,7 +422,8 @@ uint64_t PasswordListener_AddEntry (PasswordListener *l, PasswordListener_pwentr
         BRandom_randomize((uint8_t *)&entry->password, sizeof(entry->password));
         
         // try inserting
-        if (BAVL_Insert(&l->passwords, &entry->tree_node, NULL)) {
+        PasswordListener__HashRef ref = {entry, entry};
+        if (PasswordListener__Hash_Insert(&l->passwords, 0, ref, NULL)) {
             break;
         }
     }
@@ -370,5 +439,6 @@ void PasswordListener_RemoveEntry (PasswordListener *l, PasswordListener_pwentry
     DebugObject_Access(&l->d_obj);
     
     // remove
-    BAVL_Remove(&l->passwords, &entry->tree_node);
+    PasswordListener__HashRef ref = {entry, entry};
+    PasswordListener__Hash_Remove(&l->passwords, 0, ref);
 }
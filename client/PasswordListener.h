@@ -45,7 +45,7 @@
 #include <misc/debug.h>
 #include <misc/sslsocket.h>
 #include <structure/LinkedList1.h>
-#include <structure/BAVL.h>
+#include <structure/CHash.h>
 #include <base/DebugObject.h>
 #include <flow/SingleStreamReceiver.h>
 #include <system/BConnection.h>
@@ -67,9 +67,25 @@ typedef void (*PasswordListener_handler_client) (void *user, sslsocket *sock);
 
 struct PasswordListenerClient;
 
+typedef struct PasswordListener_pwentry_s {
+    uint64_t password;
+    struct PasswordListener_pwentry_s *hash_next;
+    PasswordListener_handler_client handler_client;
+    void *user;
+} PasswordListener_pwentry;
+
+#include "PasswordListener_hash.h"
+#include <structure/CHash_decl.h>
+
 /**
  * Object used to listen on a socket, accept clients and identify them
  * based on a number they send.
+ * Connections are accepted in batches and only reported once the client
+ * has sent data, where supported. Only a limited number of clients go
+ * through the TLS handshake at the same time; the others are kept in a
+ * queue, so that a burst of connections does not make them all compete
+ * for the CPU (or, with BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE, for the
+ * worker threads) and time out together.
  */
 typedef struct {
     BReactor *bsys;
@@ -81,21 +97,18 @@ typedef struct {
     struct PasswordListenerClient *clients_data;
     LinkedList1 clients_free;
     LinkedList1 clients_used;
-    BAVL passwords;
+    LinkedList1 clients_pending;
+    int num_used;
+    int max_clients;
+    PasswordListener__Hash passwords;
     BListener listener;
     DebugObject d_obj;
 } PasswordListener;
 
-typedef struct {
-    uint64_t password;
-    BAVLNode tree_node;
-    PasswordListener_handler_client handler_client;
-    void *user;
-} PasswordListener_pwentry;
-
 struct PasswordListenerClient {
     PasswordListener *l;
     LinkedList1Node list_node;
+    int started;
     sslsocket *sock;
     BSSLConnection sslcon;
     SingleStreamReceiver receiver;
@@ -110,8 +123,13 @@ struct PasswordListenerClient {
  * @param twd thread work dispatcher. May be NULL if ssl_flags does not request performing SSL
  *            operations in threads.
  * @param listen_addr address to listen on. Must be supported according to {@link BConnection_AddressSupported}.
- * @param max_clients maximum number of client to hold until they are identified.
+ * @param max_clients maximum number of clients to perform the TLS handshake with
+ *                    and read passwords from at the same time. When a connection is
+ *                    accepted and these are all taken, it waits for one to be released.
  *                    Must be >0.
+ * @param max_pending maximum number of accepted connections to hold while they are
+ *                    waiting. When this is exceeded too, the client which started
+ *                    the longest ago is dropped. Must be >=0.
  * @param ssl whether to use TLS. Must be 1 or 0.
  * @param ssl_flags flags passed down to {@link BSSLConnection_MakeBackend}. May be used to
  *                  request performing SSL operations in threads.
@@ -119,7 +137,7 @@ struct PasswordListenerClient {
  * @param key if using TLS, the private key
  * @return 1 on success, 0 on failure
  */
-int PasswordListener_Init (PasswordListener *l, BReactor *bsys, BThreadWorkDispatcher *twd, BAddr listen_addr, int max_clients, int ssl, int ssl_flags, CERTCertificate *cert, SECKEYPrivateKey *key) WARN_UNUSED;
+int PasswordListener_Init (PasswordListener *l, BReactor *bsys, BThreadWorkDispatcher *twd, BAddr listen_addr, int max_clients, int max_pending, int ssl, int ssl_flags, CERTCertificate *cert, SECKEYPrivateKey *key) WARN_UNUSED;
 
 /**
  * Frees the object.
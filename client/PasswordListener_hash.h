@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME PasswordListener__Hash
+#define CHASH_PARAM_ENTRY PasswordListener_pwentry
+#define CHASH_PARAM_LINK PasswordListener_pwentry *
+#define CHASH_PARAM_KEY uint64_t
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((PasswordListener_pwentry *)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((size_t)(entry).ptr->password)
+#define CHASH_PARAM_KEYHASH(arg, key) ((size_t)(key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->password == (entry2).ptr->password)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1) == (entry2).ptr->password)
+#define CHASH_PARAM_ENTRY_NEXT hash_next
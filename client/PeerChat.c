@@ -28,9 +28,12 @@
  */
 
 #include <string.h>
+#include <stdio.h>
 
 #include <ssl.h>
 #include <sslerr.h>
+#include <pk11pub.h>
+#include <hasht.h>
 
 #include <misc/byteorder.h>
 #include <security/BRandom.h>
@@ -85,15 +88,75 @@ static void recv_job_handler (PeerChat *o)
     }
 }
 
+static void ssl_recv_if_handler_send (PeerChat *o, uint8_t *data, int data_len);
+static void ssl_recv_decoder_handler_error (PeerChat *o);
+
+static int check_peer_cert (PeerChat *o)
+{
+    CERTCertificate *cert = SSL_PeerCertificate(o->ssl_prfd);
+    if (!cert) {
+        PeerLog(o, BLOG_ERROR, "SSL_PeerCertificate failed");
+        return 0;
+    }
+    
+    // compare to certificate provided by the server
+    SECItem der = cert->derCert;
+    int res = (der.len == o->ssl_peer_cert_len && !memcmp(der.data, o->ssl_peer_cert, der.len));
+    
+    CERT_DestroyCertificate(cert);
+    return res;
+}
+
 static void ssl_con_handler (PeerChat *o, int event)
 {
     DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
     ASSERT(o->ssl_mode == PEERCHAT_SSL_CLIENT || o->ssl_mode == PEERCHAT_SSL_SERVER)
-    ASSERT(event == BSSLCONNECTION_EVENT_ERROR)
+    ASSERT(event == BSSLCONNECTION_EVENT_UP || event == BSSLCONNECTION_EVENT_ERROR)
+    
+    if (event == BSSLCONNECTION_EVENT_ERROR) {
+        PeerLog(o, BLOG_ERROR, "SSL error");
+        goto fail0;
+    }
+    
+    ASSERT(!o->ssl_up)
+    
+    // a resumed session skips the certificate callback; it was checked when the
+    // session was established, but possibly for another peer, so check again
+    if (!check_peer_cert(o)) {
+        PeerLog(o, BLOG_ERROR, "peer certificate doesn't match");
+        SSL_InvalidateSession(o->ssl_prfd);
+        goto fail0;
+    }
+    
+    // init SSL PacketStreamSender
+    PacketStreamSender_Init(&o->ssl_ps_sender, BSSLConnection_GetSendIf(&o->ssl_con), sizeof(struct packetproto_header) + SC_MAX_MSGLEN, o->pg);
+    
+    // init SSL buffer
+    if (!SinglePacketBuffer_Init(&o->ssl_buffer, PacketProtoEncoder_GetOutput(&o->ssl_encoder), PacketStreamSender_GetInput(&o->ssl_ps_sender), o->pg)) {
+        PeerLog(o, BLOG_ERROR, "SinglePacketBuffer_Init failed");
+        goto fail1;
+    }
+    
+    // init receive interface
+    PacketPassInterface_Init(&o->ssl_recv_if, SC_MAX_MSGLEN, (PacketPassInterface_handler_send)ssl_recv_if_handler_send, o, o->pg);
+    
+    // init receive decoder
+    if (!PacketProtoDecoder_Init(&o->ssl_recv_decoder, BSSLConnection_GetRecvIf(&o->ssl_con), &o->ssl_recv_if, o->pg, o, (PacketProtoDecoder_handler_error)ssl_recv_decoder_handler_error)) {
+        PeerLog(o, BLOG_ERROR, "PacketProtoDecoder_Init failed");
+        goto fail2;
+    }
     
-    PeerLog(o, BLOG_ERROR, "SSL error");
+    // set up
+    o->ssl_up = 1;
+    return;
     
+fail2:
+    PacketPassInterface_Free(&o->ssl_recv_if);
+    SinglePacketBuffer_Free(&o->ssl_buffer);
+fail1:
+    PacketStreamSender_Free(&o->ssl_ps_sender);
+fail0:
     report_error(o);
     return;
 }
@@ -211,6 +274,7 @@ int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, C
     o->ssl_key = ssl_key;
     o->ssl_peer_cert = ssl_peer_cert;
     o->ssl_peer_cert_len = ssl_peer_cert_len;
+    o->pg = pg;
     o->user = user;
     o->logfunc = logfunc;
     o->handler_error = handler_error;
@@ -284,6 +348,27 @@ int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, C
                 PeerLog(o, BLOG_ERROR, "SSL_GetClientAuthDataHook failed");
                 goto fail3;
             }
+            
+            // name the peer by the hash of its certificate, which is what cached
+            // sessions are looked up by when the link is established again
+            uint8_t hash[SHA256_LENGTH];
+            if (PK11_HashBuf(SEC_OID_SHA256, hash, o->ssl_peer_cert, o->ssl_peer_cert_len) != SECSuccess) {
+                PeerLog(o, BLOG_ERROR, "PK11_HashBuf failed");
+                goto fail3;
+            }
+            char url[2 * PEERCHAT_SSL_SESSION_KEY_LEN + 1];
+            for (int i = 0; i < PEERCHAT_SSL_SESSION_KEY_LEN; i++) {
+                sprintf(url + 2 * i, "%02x", hash[i]);
+            }
+            if (SSL_SetURL(o->ssl_prfd, url) != SECSuccess) {
+                PeerLog(o, BLOG_ERROR, "SSL_SetURL failed");
+                goto fail3;
+            }
+        }
+        
+        // resume the session of a previous link to the peer
+        if (!BSSLConnection_EnableResumption(o->ssl_prfd)) {
+            goto fail3;
         }
         
         // set verify peer certificate hook
@@ -292,11 +377,10 @@ int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, C
             goto fail3;
         }
         
-        // init SSL connection
-        BSSLConnection_Init(&o->ssl_con, o->ssl_prfd, 0, pg, o, (BSSLConnection_handler)ssl_con_handler);
-        
-        // init SSL PacketStreamSender
-        PacketStreamSender_Init(&o->ssl_ps_sender, BSSLConnection_GetSendIf(&o->ssl_con), sizeof(struct packetproto_header) + SC_MAX_MSGLEN, pg);
+        // init SSL connection; the handshake is done before any messages, so that
+        // the peer's certificate can be checked even when a session is resumed
+        BSSLConnection_Init(&o->ssl_con, o->ssl_prfd, 1, pg, o, (BSSLConnection_handler)ssl_con_handler);
+        o->ssl_up = 0;
         
         // init SSL copier
         PacketCopier_Init(&o->ssl_copier, SC_MAX_MSGLEN, pg);
@@ -304,20 +388,7 @@ int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, C
         // init SSL encoder
         PacketProtoEncoder_Init(&o->ssl_encoder, PacketCopier_GetOutput(&o->ssl_copier), pg);
         
-        // init SSL buffer
-        if (!SinglePacketBuffer_Init(&o->ssl_buffer, PacketProtoEncoder_GetOutput(&o->ssl_encoder), PacketStreamSender_GetInput(&o->ssl_ps_sender), pg)) {
-            PeerLog(o, BLOG_ERROR, "SinglePacketBuffer_Init failed");
-            goto fail4;
-        }
-        
-        // init receive interface
-        PacketPassInterface_Init(&o->ssl_recv_if, SC_MAX_MSGLEN, (PacketPassInterface_handler_send)ssl_recv_if_handler_send, o, pg);
-        
-        // init receive decoder
-        if (!PacketProtoDecoder_Init(&o->ssl_recv_decoder, BSSLConnection_GetRecvIf(&o->ssl_con), &o->ssl_recv_if, pg, o, (PacketProtoDecoder_handler_error)ssl_recv_decoder_handler_error)) {
-            PeerLog(o, BLOG_ERROR, "PacketProtoDecoder_Init failed");
-            goto fail5;
-        }
+        // the rest of the SSL higher layer is initialized when the handshake is done
         
         send_buf_output = PacketCopier_GetInput(&o->ssl_copier);
     }
@@ -338,14 +409,8 @@ int PeerChat_Init (PeerChat *o, peerid_t peer_id, int ssl_mode, int ssl_flags, C
 fail6:
     BufferWriter_Free(&o->send_writer);
     if (o->ssl_mode != PEERCHAT_SSL_NONE) {
-        PacketProtoDecoder_Free(&o->ssl_recv_decoder);
-fail5:
-        PacketPassInterface_Free(&o->ssl_recv_if);
-        SinglePacketBuffer_Free(&o->ssl_buffer);
-fail4:
         PacketProtoEncoder_Free(&o->ssl_encoder);
         PacketCopier_Free(&o->ssl_copier);
-        PacketStreamSender_Free(&o->ssl_ps_sender);
         BSSLConnection_Free(&o->ssl_con);
 fail3:
         ASSERT_FORCE(PR_Close(o->ssl_prfd) == PR_SUCCESS)
@@ -374,12 +439,14 @@ void PeerChat_Free (PeerChat *o)
     PacketBuffer_Free(&o->send_buf);
     BufferWriter_Free(&o->send_writer);
     if (o->ssl_mode != PEERCHAT_SSL_NONE) {
-        PacketProtoDecoder_Free(&o->ssl_recv_decoder);
-        PacketPassInterface_Free(&o->ssl_recv_if);
-        SinglePacketBuffer_Free(&o->ssl_buffer);
+        if (o->ssl_up) {
+            PacketProtoDecoder_Free(&o->ssl_recv_decoder);
+            PacketPassInterface_Free(&o->ssl_recv_if);
+            SinglePacketBuffer_Free(&o->ssl_buffer);
+            PacketStreamSender_Free(&o->ssl_ps_sender);
+        }
         PacketProtoEncoder_Free(&o->ssl_encoder);
         PacketCopier_Free(&o->ssl_copier);
-        PacketStreamSender_Free(&o->ssl_ps_sender);
         BSSLConnection_Free(&o->ssl_con);
         ASSERT_FORCE(PR_Close(o->ssl_prfd) == PR_SUCCESS)
         StreamPacketSender_Free(&o->ssl_sp_sender);
@@ -60,6 +60,9 @@
 #define PEERCHAT_SSL_RECV_BUF_SIZE 4096
 #define PEERCHAT_SEND_BUF_SIZE 200
 
+// bytes of the hash of the peer's certificate naming its cached SSL sessions
+#define PEERCHAT_SSL_SESSION_KEY_LEN 16
+
 //#define PEERCHAT_SIMULATE_ERROR 40
 
 typedef void (*PeerChat_handler_error) (void *user);
@@ -71,6 +74,7 @@ typedef struct {
     SECKEYPrivateKey *ssl_key;
     uint8_t *ssl_peer_cert;
     int ssl_peer_cert_len;
+    BPendingGroup *pg;
     void *user;
     BLog_logfunc logfunc;
     PeerChat_handler_error handler_error;
@@ -92,6 +96,7 @@ typedef struct {
     PRFileDesc ssl_bottom_prfd;
     PRFileDesc *ssl_prfd;
     BSSLConnection ssl_con;
+    int ssl_up;
     
     // SSL higher layer
     PacketStreamSender ssl_ps_sender;
@@ -28,10 +28,17 @@
  */
 
 #include <string.h>
+#include <limits.h>
 
 #include <misc/balign.h>
 #include <misc/byteorder.h>
+#include <misc/balloc.h>
+#include <misc/probe.h>
 #include <security/BHash.h>
+#include <flow/PacketBuf.h>
+#include <base/BMetrics.h>
+#include <base/BBufferArena.h>
+#include <base/BPacketTrace.h>
 
 #include "SPProtoDecoder.h"
 
@@ -39,40 +46,183 @@
 
 #define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
 
-static void decode_work_func (SPProtoDecoder *o)
+static void batch_decode_work_handler (struct SPProtoDecoder_lane *l);
+
+static int init_cipher (SPProtoDecoder *o, BEncryption *encryptor, BAEAD *aead, uint8_t *encryption_key)
 {
-    ASSERT(o->in_len >= 0)
-    ASSERT(o->in_len <= o->input_mtu)
+    if (!SPPROTO_HAVE_AEAD(o->sp_params)) {
+        BEncryption_Init(encryptor, BENCRYPTION_MODE_DECRYPT, o->sp_params.encryption_mode, encryption_key);
+        return 1;
+    }
+    
+    if (!BAEAD_Init(aead, BAEAD_MODE_DECRYPT, o->sp_params.encryption_mode, encryption_key)) {
+        PeerLog(o, BLOG_ERROR, "BAEAD_Init failed");
+        return 0;
+    }
+    
+    return 1;
+}
+
+static void free_cipher (SPProtoDecoder *o, BEncryption *encryptor, BAEAD *aead)
+{
+    if (!SPPROTO_HAVE_AEAD(o->sp_params)) {
+        BEncryption_Free(encryptor);
+    } else {
+        BAEAD_Free(aead);
+    }
+}
+
+static int init_encryptor (SPProtoDecoder *o, uint8_t *encryption_key)
+{
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(!o->have_encryption_key)
+    
+    if (o->num_slots == 1) {
+        return init_cipher(o, &o->encryptor, &o->aead, encryption_key);
+    }
+    
+    // lanes are decoded concurrently, and a cipher context can only be
+    // used by one thread at a time, so each lane gets its own
+    for (int i = 0; i < o->window; i++) {
+        if (!init_cipher(o, &o->lanes[i].encryptor, &o->lanes[i].aead, encryption_key)) {
+            while (i-- > 0) {
+                free_cipher(o, &o->lanes[i].encryptor, &o->lanes[i].aead);
+            }
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static void free_encryptor (SPProtoDecoder *o)
+{
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(o->have_encryption_key)
+    
+    if (o->num_slots == 1) {
+        free_cipher(o, &o->encryptor, &o->aead);
+        return;
+    }
+    
+    for (int i = 0; i < o->window; i++) {
+        free_cipher(o, &o->lanes[i].encryptor, &o->lanes[i].aead);
+    }
+}
+
+static void replay_reset (SPProtoDecoder *o)
+{
+    ASSERT(SPPROTO_HAVE_REPLAY_WINDOW(o->sp_params))
+    
+    o->replay_top = 0;
+    memset(o->replay_bitmap, 0, sizeof(o->replay_bitmap));
+}
+
+static int replay_check_and_update (SPProtoDecoder *o, uint64_t seq)
+{
+    ASSERT(SPPROTO_HAVE_REPLAY_WINDOW(o->sp_params))
+    
+    // the bitmap is a ring indexed by sequence number, and remembers the
+    // window below and including the highest sequence number seen
+    uint64_t ring_bits = sizeof(o->replay_bitmap) * 8;
+    
+    if (seq > o->replay_top) {
+        // advance window, forgetting the positions it now covers
+        uint64_t diff = seq - o->replay_top;
+        if (diff >= ring_bits) {
+            memset(o->replay_bitmap, 0, sizeof(o->replay_bitmap));
+        } else {
+            for (uint64_t i = 1; i <= diff; i++) {
+                uint64_t pos = (o->replay_top + i) % ring_bits;
+                o->replay_bitmap[pos / 64] &= ~((uint64_t)1 << (pos % 64));
+            }
+        }
+        o->replay_top = seq;
+    } else if (o->replay_top - seq >= (uint64_t)o->sp_params.replay_window) {
+        return 0;
+    }
     
-    uint8_t *in = o->in;
-    int in_len = o->in_len;
+    uint64_t pos = seq % ring_bits;
+    uint64_t mask = (uint64_t)1 << (pos % 64);
+    
+    if ((o->replay_bitmap[pos / 64] & mask)) {
+        return 0;
+    }
     
-    o->tw_out_len = -1;
+    o->replay_bitmap[pos / 64] |= mask;
+    
+    return 1;
+}
+
+static int decode_one (SPProtoDecoder *o, BEncryption *encryptor, BAEAD *aead, uint64_t seq_ref, uint8_t *in, int in_len, uint8_t *buf, uint8_t **out, uint16_t *seed_id, otp_t *otp, uint64_t *seq)
+{
+    ASSERT(in_len >= 0)
+    ASSERT(in_len <= o->input_mtu)
     
-    uint8_t *plaintext;
-    int plaintext_len;
+    PacketBuf pkt;
+    uint8_t seq_block[BENCRYPTION_MAX_BLOCK_SIZE];
     
     // decrypt if needed
     if (!SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        plaintext = in;
-        plaintext_len = in_len;
+        PacketBuf_Init(&pkt, in, in_len, 0);
+        PacketBuf_Put(&pkt, in_len);
+    } else if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        // input must have a nonce and a tag
+        int nonce_len = SPPROTO_AEAD_NONCE_LEN(o->sp_params);
+        if (in_len < nonce_len + BAEAD_TAG_SIZE) {
+            PeerLog(o, BLOG_WARNING, "packet has no nonce or tag");
+            return -1;
+        }
+        
+        // check if we have encryption key
+        if (!o->have_encryption_key) {
+            PeerLog(o, BLOG_WARNING, "have no encryption key");
+            return -1;
+        }
+        
+        // nonce is the sequence block
+        PacketBuf_Init(&pkt, in, in_len, 0);
+        PacketBuf_Put(&pkt, in_len);
+        memcpy(seq_block, PacketBuf_Pull(&pkt, nonce_len), nonce_len);
+        
+        // complete a compact nonce with the high bytes of the sequence number
+        if (o->sp_params.compact) {
+            uint32_t le_low;
+            memcpy(&le_low, seq_block + o->seq_prefix_len, sizeof(le_low));
+            uint64_t le_seq = htol64(spproto_expand_compact_seq(ltoh32(le_low), seq_ref));
+            memcpy(seq_block + o->seq_prefix_len, &le_seq, sizeof(le_seq));
+        }
+        
+        // verify and decrypt in place, dropping the tag
+        if (!BAEAD_Open(aead, seq_block, PacketBuf_Data(&pkt), PacketBuf_Len(&pkt), PacketBuf_Data(&pkt))) {
+            PeerLog(o, BLOG_WARNING, "packet authentication failed");
+            return -1;
+        }
+        PacketBuf_Trim(&pkt, PacketBuf_Len(&pkt) - BAEAD_TAG_SIZE);
     } else {
         // input must be a multiple of blocks size
         if (in_len % o->enc_block_size != 0) {
             PeerLog(o, BLOG_WARNING, "packet size not a multiple of block size");
-            return;
+            return -1;
         }
         
         // input must have an IV block
         if (in_len < o->enc_block_size) {
             PeerLog(o, BLOG_WARNING, "packet does not have an IV");
-            return;
+            return -1;
         }
         
         // check if we have encryption key
         if (!o->have_encryption_key) {
             PeerLog(o, BLOG_WARNING, "have no encryption key");
-            return;
+            return -1;
+        }
+        
+        // recover sequence block from IV
+        if (SPPROTO_HAVE_REPLAY_WINDOW(o->sp_params)) {
+            uint8_t zero_iv[BENCRYPTION_MAX_BLOCK_SIZE];
+            memset(zero_iv, 0, o->enc_block_size);
+            BEncryption_Decrypt(encryptor, in, seq_block, o->enc_block_size, zero_iv);
         }
         
         // copy IV as BEncryption_Decrypt changes the IV
@@ -82,13 +232,13 @@ static void decode_work_func (SPProtoDecoder *o)
         // decrypt
         uint8_t *ciphertext = in + o->enc_block_size;
         int ciphertext_len = in_len - o->enc_block_size;
-        plaintext = o->buf;
-        BEncryption_Decrypt(&o->encryptor, ciphertext, plaintext, ciphertext_len, iv);
+        uint8_t *plaintext = buf;
+        BEncryption_Decrypt(encryptor, ciphertext, plaintext, ciphertext_len, iv);
         
         // read padding
         if (ciphertext_len < o->enc_block_size) {
             PeerLog(o, BLOG_WARNING, "packet does not have a padding block");
-            return;
+            return -1;
         }
         int i;
         for (i = ciphertext_len - 1; i >= ciphertext_len - o->enc_block_size; i--) {
@@ -97,27 +247,32 @@ static void decode_work_func (SPProtoDecoder *o)
             }
             if (plaintext[i] != 0) {
                 PeerLog(o, BLOG_WARNING, "packet padding wrong (nonzero byte)");
-                return;
+                return -1;
             }
         }
         if (i < ciphertext_len - o->enc_block_size) {
             PeerLog(o, BLOG_WARNING, "packet padding wrong (all zeroes)");
-            return;
+            return -1;
         }
-        plaintext_len = i;
+        PacketBuf_Init(&pkt, plaintext, ciphertext_len, 0);
+        PacketBuf_Put(&pkt, i);
     }
     
+    // the hash covers the whole plaintext, header included
+    uint8_t *plaintext = PacketBuf_Data(&pkt);
+    int plaintext_len = PacketBuf_Len(&pkt);
+    
     // check for header
     if (plaintext_len < SPPROTO_HEADER_LEN(o->sp_params)) {
         PeerLog(o, BLOG_WARNING, "packet has no header");
-        return;
+        return -1;
     }
-    uint8_t *header = plaintext;
+    uint8_t *header = PacketBuf_Pull(&pkt, SPPROTO_HEADER_LEN(o->sp_params));
     
     // check data length
-    if (plaintext_len - SPPROTO_HEADER_LEN(o->sp_params) > o->output_mtu) {
+    if (PacketBuf_Len(&pkt) > o->output_mtu) {
         PeerLog(o, BLOG_WARNING, "packet too long");
-        return;
+        return -1;
     }
     
     // check OTP
@@ -125,8 +280,8 @@ static void decode_work_func (SPProtoDecoder *o)
         // remember seed and OTP (can't check from here)
         struct spproto_otpdata header_otpd;
         memcpy(&header_otpd, header + SPPROTO_HEADER_OTPDATA_OFF(o->sp_params), sizeof(header_otpd));
-        o->tw_out_seed_id = ltoh16(header_otpd.seed_id);
-        o->tw_out_otp = header_otpd.otp;
+        *seed_id = ltoh16(header_otpd.seed_id);
+        *otp = header_otpd.otp;
     }
     
     // check hash
@@ -139,19 +294,208 @@ static void decode_work_func (SPProtoDecoder *o)
         memset(header_hash, 0, o->hash_size);
         // calculate hash
         uint8_t hash_calc[BHASH_MAX_SIZE];
-        BHash_calculate(o->sp_params.hash_mode, plaintext, plaintext_len, hash_calc);
+        if (SPPROTO_HAVE_KEYED_HASH(o->sp_params)) {
+            BHash_calculate_keyed(o->sp_params.hash_mode, o->hash_key, plaintext, plaintext_len, hash_calc);
+        } else {
+            BHash_calculate(o->sp_params.hash_mode, plaintext, plaintext_len, hash_calc);
+        }
         // set hash field to its original value
         memcpy(header_hash, hash, o->hash_size);
         // compare hashes
         if (memcmp(hash, hash_calc, o->hash_size)) {
             PeerLog(o, BLOG_WARNING, "packet has wrong hash");
-            return;
+            return -1;
         }
     }
     
+    // remember sequence number (can't check from here)
+    if (SPPROTO_HAVE_REPLAY_WINDOW(o->sp_params)) {
+        uint64_t le_seq;
+        memcpy(&le_seq, seq_block + o->seq_prefix_len, sizeof(le_seq));
+        *seq = ltoh64(le_seq);
+    }
+    
     // return packet
-    o->tw_out = plaintext + SPPROTO_HEADER_LEN(o->sp_params);
-    o->tw_out_len = plaintext_len - SPPROTO_HEADER_LEN(o->sp_params);
+    *out = PacketBuf_Data(&pkt);
+    return PacketBuf_Len(&pkt);
+}
+
+static void decode_work_func (SPProtoDecoder *o)
+{
+    ASSERT(o->in_len >= 0)
+    
+    BPROBE2(spproto_decode_begin, o, o->in_len);
+    uint64_t start = BMetrics_Start();
+    o->tw_out_len = decode_one(o, &o->encryptor, &o->aead, o->tw_seq_ref, o->in, o->in_len, o->buf, &o->tw_out, &o->tw_out_seed_id, &o->tw_out_otp, &o->tw_out_seq);
+    BMetrics_ObserveSince(BMETRICS_HISTOGRAM_SPPROTO_DECODE_NS, start);
+    BPROBE2(spproto_decode_end, o, o->tw_out_len);
+}
+
+static int check_otp (SPProtoDecoder *o, uint16_t seed_id, otp_t otp)
+{
+    ASSERT(SPPROTO_HAVE_OTP(o->sp_params))
+    
+    if (!OTPChecker_CheckOTP(&o->otpchecker, seed_id, otp)) {
+        PeerLog(o, BLOG_WARNING, "packet has wrong OTP");
+        return 0;
+    }
+    
+    return 1;
+}
+
+static int check_seq (SPProtoDecoder *o, uint64_t seq)
+{
+    ASSERT(SPPROTO_HAVE_REPLAY_WINDOW(o->sp_params))
+    
+    if (!replay_check_and_update(o, seq)) {
+        PeerLog(o, BLOG_WARNING, "packet replayed or too old");
+        return 0;
+    }
+    
+    return 1;
+}
+
+static struct SPProtoDecoder_slot * batch_slot (SPProtoDecoder *o, int i)
+{
+    ASSERT(o->num_slots > 1)
+    ASSERT(i >= 0)
+    ASSERT(i < o->num_slots)
+    
+    return &o->slots[(o->slots_start + i) % o->num_slots];
+}
+
+static struct SPProtoDecoder_lane * batch_lane (SPProtoDecoder *o, int i)
+{
+    ASSERT(o->num_slots > 1)
+    ASSERT(i >= 0)
+    ASSERT(i < o->lanes_count)
+    
+    return &o->lanes[(o->lanes_start + i) % o->window];
+}
+
+static void batch_decode_work_func (struct SPProtoDecoder_lane *l)
+{
+    SPProtoDecoder *o = l->o;
+    ASSERT(l->num > 0)
+    
+    // only touch the lane's own slots, other lanes may be running concurrently
+    for (int i = 0; i < l->num; i++) {
+        struct SPProtoDecoder_slot *s = &o->slots[(l->first + i) % o->num_slots];
+        BPROBE2(spproto_decode_begin, o, s->in_len);
+        uint64_t start = BMetrics_Start();
+        s->out_len = decode_one(o, &l->encryptor, &l->aead, l->seq_ref, s->in, s->in_len, s->buf, &s->out, &s->seed_id, &s->otp, &s->seq);
+        BMetrics_ObserveSince(BMETRICS_HISTOGRAM_SPPROTO_DECODE_NS, start);
+        BPROBE2(spproto_decode_end, o, s->out_len);
+    }
+}
+
+static void batch_maybe_decode (SPProtoDecoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    // start lanes while there are free ones and packets to decode
+    while (o->lanes_count < o->window && o->slots_queued > 0) {
+        // take up to a batch of queued packets
+        int num = o->slots_queued;
+        if (num > o->batch_size) {
+            num = o->batch_size;
+        }
+        
+        // set up lane
+        struct SPProtoDecoder_lane *l = &o->lanes[(o->lanes_start + o->lanes_count) % o->window];
+        l->first = (o->slots_start + o->slots_decoded + o->slots_decoding) % o->num_slots;
+        l->num = num;
+        l->done = 0;
+        l->seq_ref = o->replay_top;
+        o->lanes_count++;
+        
+        o->slots_decoding += num;
+        o->slots_queued -= num;
+        
+        // start work
+        BThreadWork_Init(&l->tw, o->twd, (BThreadWork_handler_done)batch_decode_work_handler, l, (BThreadWork_work_func)batch_decode_work_func, l);
+    }
+}
+
+static void batch_pop (SPProtoDecoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    ASSERT(o->slots_decoded > 0)
+    
+    // free the oldest slot
+    o->slots_start = (o->slots_start + 1) % o->num_slots;
+    o->slots_decoded--;
+    
+    // accept the input packet that was waiting for a slot
+    if (o->in_blocked) {
+        o->in_blocked = 0;
+        PacketPassInterface_Done(&o->input);
+    }
+}
+
+static void batch_maybe_output (SPProtoDecoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    while (!o->out_busy && o->slots_decoded > 0) {
+        struct SPProtoDecoder_slot *s = batch_slot(o, 0);
+        
+        // skip packets which could not be decoded
+        if (s->out_len < 0) {
+            BPacketTrace_Stamp(BPACKETTRACE_RECV, s, BPACKETTRACE_NO_HISTOGRAM, NULL);
+            batch_pop(o);
+            continue;
+        }
+        
+        BPacketTrace_Stamp(BPACKETTRACE_RECV, s, BMETRICS_HISTOGRAM_TRACE_RECV_DECODE_DONE_NS, s->out);
+        
+        // submit decoded packet to output
+        o->out_busy = 1;
+        PacketPassInterface_Sender_Send(o->output, s->out, s->out_len);
+    }
+}
+
+static void batch_retire_lanes (SPProtoDecoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    // lanes may finish out of order; retire finished lanes from the front
+    // only, so that packets stay in order
+    while (o->lanes_count > 0 && batch_lane(o, 0)->done) {
+        struct SPProtoDecoder_lane *first = batch_lane(o, 0);
+        o->slots_decoded += first->num;
+        o->slots_decoding -= first->num;
+        o->lanes_start = (o->lanes_start + 1) % o->window;
+        o->lanes_count--;
+    }
+}
+
+static void batch_decode_work_handler (struct SPProtoDecoder_lane *l)
+{
+    SPProtoDecoder *o = l->o;
+    ASSERT(!l->done)
+    ASSERT(o->slots_decoding > 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // free work
+    BThreadWork_Free(&l->tw);
+    l->done = 1;
+    
+    // check OTPs and sequence numbers
+    for (int i = 0; i < l->num; i++) {
+        struct SPProtoDecoder_slot *s = &o->slots[(l->first + i) % o->num_slots];
+        if (s->out_len >= 0 && SPPROTO_HAVE_OTP(o->sp_params) && !check_otp(o, s->seed_id, s->otp)) {
+            s->out_len = -1;
+        }
+        if (s->out_len >= 0 && SPPROTO_HAVE_REPLAY_WINDOW(o->sp_params) && !check_seq(o, s->seq)) {
+            s->out_len = -1;
+        }
+    }
+    
+    // output decoded packets, and decode what was queued meanwhile
+    batch_retire_lanes(o);
+    batch_maybe_output(o);
+    batch_maybe_decode(o);
 }
 
 static void decode_work_handler (SPProtoDecoder *o)
@@ -166,17 +510,27 @@ static void decode_work_handler (SPProtoDecoder *o)
     
     // check OTP
     if (SPPROTO_HAVE_OTP(o->sp_params) && o->tw_out_len >= 0) {
-        if (!OTPChecker_CheckOTP(&o->otpchecker, o->tw_out_seed_id, o->tw_out_otp)) {
-            PeerLog(o, BLOG_WARNING, "packet has wrong OTP");
+        if (!check_otp(o, o->tw_out_seed_id, o->tw_out_otp)) {
+            o->tw_out_len = -1;
+        }
+    }
+    
+    // check sequence number, only now that the packet is authenticated
+    if (SPPROTO_HAVE_REPLAY_WINDOW(o->sp_params) && o->tw_out_len >= 0) {
+        if (!check_seq(o, o->tw_out_seq)) {
             o->tw_out_len = -1;
         }
     }
     
     if (o->tw_out_len < 0) {
+        BPacketTrace_Stamp(BPACKETTRACE_RECV, o, BPACKETTRACE_NO_HISTOGRAM, NULL);
+        
         // cannot decode, finish input packet
         PacketPassInterface_Done(&o->input);
         o->in_len = -1;
     } else {
+        BPacketTrace_Stamp(BPACKETTRACE_RECV, o, BMETRICS_HISTOGRAM_TRACE_RECV_DECODE_DONE_NS, o->tw_out);
+        
         // submit decoded packet to output
         PacketPassInterface_Sender_Send(o->output, o->tw_out, o->tw_out_len);
     }
@@ -186,24 +540,65 @@ static void input_handler_send (SPProtoDecoder *o, uint8_t *data, int data_len)
 {
     ASSERT(data_len >= 0)
     ASSERT(data_len <= o->input_mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->num_slots > 1) {
+        ASSERT(!o->in_blocked)
+        
+        // copy packet into the next free slot
+        int used = o->slots_decoded + o->slots_decoding + o->slots_queued;
+        ASSERT(used < o->num_slots)
+        struct SPProtoDecoder_slot *s = batch_slot(o, used);
+        memcpy(s->in, data, data_len);
+        s->in_len = data_len;
+        o->slots_queued++;
+        
+        BPacketTrace_Stamp(BPACKETTRACE_RECV, data, BMETRICS_HISTOGRAM_TRACE_RECV_DECODE_QUEUE_NS, s);
+        
+        // accept the next input packet now if there is room for it
+        if (used + 1 < o->num_slots) {
+            PacketPassInterface_Done(&o->input);
+        } else {
+            o->in_blocked = 1;
+        }
+        
+        // decode if possible
+        batch_maybe_decode(o);
+        return;
+    }
+    
     ASSERT(o->in_len == -1)
     ASSERT(!o->tw_have)
-    DebugObject_Access(&o->d_obj);
     
     // remember input
     o->in = data;
     o->in_len = data_len;
     
-    // start decoding
+    BPacketTrace_Stamp(BPACKETTRACE_RECV, data, BMETRICS_HISTOGRAM_TRACE_RECV_DECODE_QUEUE_NS, o);
+    
+    // start decoding; compact sequence numbers are taken to be near the
+    // highest one accepted so far
+    o->tw_seq_ref = o->replay_top;
     BThreadWork_Init(&o->tw, o->twd, (BThreadWork_handler_done)decode_work_handler, o, (BThreadWork_work_func)decode_work_func, o);
     o->tw_have = 1;
 }
 
 static void output_handler_done (SPProtoDecoder *o)
 {
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->num_slots > 1) {
+        ASSERT(o->out_busy)
+        
+        // free the slot of the packet just output, continue with the next one
+        o->out_busy = 0;
+        batch_pop(o);
+        batch_maybe_output(o);
+        return;
+    }
+    
     ASSERT(o->in_len >= 0)
     ASSERT(!o->tw_have)
-    DebugObject_Access(&o->d_obj);
     
     // finish input packet
     PacketPassInterface_Done(&o->input);
@@ -212,6 +607,29 @@ static void output_handler_done (SPProtoDecoder *o)
 
 static void maybe_stop_work_and_ignore (SPProtoDecoder *o)
 {
+    if (o->num_slots > 1) {
+        if (o->lanes_count > 0) {
+            // free works of unfinished lanes, ignoring their packets;
+            // finished lanes were fully checked and are kept
+            for (int i = 0; i < o->lanes_count; i++) {
+                struct SPProtoDecoder_lane *l = batch_lane(o, i);
+                if (!l->done) {
+                    BThreadWork_Free(&l->tw);
+                    l->done = 1;
+                    for (int j = 0; j < l->num; j++) {
+                        o->slots[(l->first + j) % o->num_slots].out_len = -1;
+                    }
+                }
+            }
+            
+            // release their slots, and decode what was queued meanwhile
+            batch_retire_lanes(o);
+            batch_maybe_output(o);
+            batch_maybe_decode(o);
+        }
+        return;
+    }
+    
     ASSERT(!(o->tw_have) || o->in_len >= 0)
     
     if (o->tw_have) {
@@ -225,15 +643,96 @@ static void maybe_stop_work_and_ignore (SPProtoDecoder *o)
     }
 }
 
-int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc)
+static int alloc_buffers (SPProtoDecoder *o)
+{
+    // calculate plaintext buffer size
+    int buf_size = 0;
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && !SPPROTO_HAVE_AEAD(o->sp_params)) {
+        buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->output_mtu + 1), o->enc_block_size);
+    }
+    
+    // a full batch for each lane
+    if (o->batch_size > INT_MAX / o->window) {
+        return 0;
+    }
+    o->num_slots = o->batch_size * o->window;
+    
+    if (o->num_slots == 1) {
+        // allocate plaintext buffer
+        if (buf_size > 0 && !(o->buf = (uint8_t *)BBufferArena_Alloc(buf_size))) {
+            return 0;
+        }
+        return 1;
+    }
+    
+    // allocate slots, each with an input buffer and a plaintext buffer
+    if (!(o->slots = (struct SPProtoDecoder_slot *)BAllocArray(o->num_slots, sizeof(o->slots[0])))) {
+        goto fail0;
+    }
+    size_t slot_size = (size_t)o->input_mtu + buf_size;
+    if (!(o->slots_mem = (uint8_t *)BBufferArena_AllocArray(o->num_slots, slot_size))) {
+        goto fail1;
+    }
+    for (int i = 0; i < o->num_slots; i++) {
+        o->slots[i].in = o->slots_mem + i * slot_size;
+        o->slots[i].buf = o->slots[i].in + o->input_mtu;
+    }
+    
+    // allocate lanes
+    if (!(o->lanes = (struct SPProtoDecoder_lane *)BAllocArray(o->window, sizeof(o->lanes[0])))) {
+        goto fail2;
+    }
+    for (int i = 0; i < o->window; i++) {
+        o->lanes[i].o = o;
+    }
+    
+    // have no packets
+    o->slots_start = 0;
+    o->slots_decoded = 0;
+    o->slots_decoding = 0;
+    o->slots_queued = 0;
+    o->in_blocked = 0;
+    o->out_busy = 0;
+    
+    // have no lanes in use
+    o->lanes_start = 0;
+    o->lanes_count = 0;
+    
+    return 1;
+    
+fail2:
+    BBufferArena_Free(o->slots_mem);
+fail1:
+    BFree(o->slots);
+fail0:
+    return 0;
+}
+
+static void free_buffers (SPProtoDecoder *o)
+{
+    if (o->num_slots > 1) {
+        BFree(o->lanes);
+        BBufferArena_Free(o->slots_mem);
+        BFree(o->slots);
+    }
+    else if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && !SPPROTO_HAVE_AEAD(o->sp_params)) {
+        BBufferArena_Free(o->buf);
+    }
+}
+
+int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, int batch_size, int window, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc)
 {
     spproto_assert_security_params(sp_params);
     ASSERT(spproto_carrier_mtu_for_payload_mtu(sp_params, PacketPassInterface_GetMTU(output)) >= 0)
     ASSERT(!SPPROTO_HAVE_OTP(sp_params) || num_otp_seeds >= 2)
+    ASSERT(batch_size > 0)
+    ASSERT(window > 0)
     
     // init arguments
     o->output = output;
     o->sp_params = sp_params;
+    o->batch_size = batch_size;
+    o->window = window;
     o->twd = twd;
     o->user = user;
     o->logfunc = logfunc;
@@ -250,20 +749,20 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
     }
     
     // calculate encryption block and key sizes
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && !SPPROTO_HAVE_AEAD(o->sp_params)) {
         o->enc_block_size = BEncryption_cipher_block_size(o->sp_params.encryption_mode);
-        o->enc_key_size = BEncryption_cipher_key_size(o->sp_params.encryption_mode);
+    }
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+        o->enc_key_size = spproto_encryption_key_size(o->sp_params);
+        o->seq_prefix_len = spproto_seq_prefix_len(o->sp_params);
     }
     
     // calculate input MTU
     o->input_mtu = spproto_carrier_mtu_for_payload_mtu(o->sp_params, o->output_mtu);
     
-    // allocate plaintext buffer
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        int buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->output_mtu + 1), o->enc_block_size);
-        if (!(o->buf = (uint8_t *)malloc(buf_size))) {
-            goto fail0;
-        }
+    // allocate plaintext buffer or slots
+    if (!alloc_buffers(o)) {
+        goto fail0;
     }
     
     // init input
@@ -281,6 +780,9 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
         o->have_encryption_key = 0;
     }
     
+    // have seen no sequence numbers
+    o->replay_top = 0;
+    
     // have no input packet
     o->in_len = -1;
     
@@ -293,9 +795,7 @@ int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct
     
 fail1:
     PacketPassInterface_Free(&o->input);
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        free(o->buf);
-    }
+    free_buffers(o);
 fail0:
     return 0;
 }
@@ -305,13 +805,21 @@ void SPProtoDecoder_Free (SPProtoDecoder *o)
     DebugObject_Free(&o->d_obj);
     
     // free work
-    if (o->tw_have) {
+    if (o->num_slots > 1) {
+        for (int i = 0; i < o->lanes_count; i++) {
+            struct SPProtoDecoder_lane *l = batch_lane(o, i);
+            if (!l->done) {
+                BThreadWork_Free(&l->tw);
+            }
+        }
+    }
+    else if (o->tw_have) {
         BThreadWork_Free(&o->tw);
     }
     
     // free encryptor
     if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && o->have_encryption_key) {
-        BEncryption_Free(&o->encryptor);
+        free_encryptor(o);
     }
     
     // free OTP checker
@@ -322,10 +830,8 @@ void SPProtoDecoder_Free (SPProtoDecoder *o)
     // free input
     PacketPassInterface_Free(&o->input);
     
-    // free plaintext buffer
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        free(o->buf);
-    }
+    // free plaintext buffer or slots
+    free_buffers(o);
 }
 
 PacketPassInterface * SPProtoDecoder_GetInput (SPProtoDecoder *o)
@@ -345,11 +851,24 @@ void SPProtoDecoder_SetEncryptionKey (SPProtoDecoder *o, uint8_t *encryption_key
     
     // free encryptor
     if (o->have_encryption_key) {
-        BEncryption_Free(&o->encryptor);
+        free_encryptor(o);
+        o->have_encryption_key = 0;
     }
     
     // init encryptor
-    BEncryption_Init(&o->encryptor, BENCRYPTION_MODE_DECRYPT, o->sp_params.encryption_mode, encryption_key);
+    if (!init_encryptor(o, encryption_key)) {
+        return;
+    }
+    
+    // the sender starts a new sequence with a new key
+    if (SPPROTO_HAVE_REPLAY_WINDOW(o->sp_params)) {
+        replay_reset(o);
+    }
+    
+    // derive hash key
+    if (SPPROTO_HAVE_KEYED_HASH(o->sp_params)) {
+        spproto_hash_key(o->sp_params, encryption_key, o->hash_key);
+    }
     
     // have encryption key
     o->have_encryption_key = 1;
@@ -365,7 +884,7 @@ void SPProtoDecoder_RemoveEncryptionKey (SPProtoDecoder *o)
     
     if (o->have_encryption_key) {
         // free encryptor
-        BEncryption_Free(&o->encryptor);
+        free_encryptor(o);
         
         // have no encryption key
         o->have_encryption_key = 0;
@@ -41,8 +41,10 @@
 #include <base/BLog.h>
 #include <protocol/spproto.h>
 #include <security/BEncryption.h>
+#include <security/BAEAD.h>
 #include <security/OTPChecker.h>
 #include <flow/PacketPassInterface.h>
+#include <threadwork/BThreadWork.h>
 
 /**
  * Handler called when OTP generation for a new seed is finished.
@@ -51,12 +53,34 @@
  */
 typedef void (*SPProtoDecoder_otp_handler) (void *user);
 
+struct SPProtoDecoder_slot {
+    uint8_t *in;
+    uint8_t *buf;
+    int in_len;
+    uint8_t *out;
+    int out_len;
+    uint16_t seed_id;
+    otp_t otp;
+    uint64_t seq;
+};
+
+struct SPProtoDecoder_lane {
+    struct SPProtoDecoder_s *o;
+    BThreadWork tw;
+    BEncryption encryptor;
+    BAEAD aead;
+    int first;
+    int num;
+    int done;
+    uint64_t seq_ref;
+};
+
 /**
  * Object which decodes packets according to SPProto.
  * Input is with {@link PacketPassInterface}.
  * Output is with {@link PacketPassInterface}.
  */
-typedef struct {
+typedef struct SPProtoDecoder_s {
     PacketPassInterface *output;
     struct spproto_security_params sp_params;
     BThreadWorkDispatcher *twd;
@@ -64,6 +88,7 @@ typedef struct {
     BLog_logfunc logfunc;
     int output_mtu;
     int hash_size;
+    uint8_t hash_key[BHASH_MAX_KEY_SIZE];
     int enc_block_size;
     int enc_key_size;
     int input_mtu;
@@ -72,14 +97,34 @@ typedef struct {
     OTPChecker otpchecker;
     int have_encryption_key;
     BEncryption encryptor;
+    BAEAD aead;
+    int seq_prefix_len;
+    uint64_t replay_top;
+    uint64_t replay_bitmap[SPPROTO_MAX_REPLAY_WINDOW / 64];
     uint8_t *in;
     int in_len;
     int tw_have;
     BThreadWork tw;
     uint16_t tw_out_seed_id;
     otp_t tw_out_otp;
+    uint64_t tw_seq_ref;
+    uint64_t tw_out_seq;
     uint8_t *tw_out;
     int tw_out_len;
+    int batch_size;
+    int window;
+    int num_slots;
+    struct SPProtoDecoder_slot *slots;
+    uint8_t *slots_mem;
+    int slots_start;
+    int slots_decoded;
+    int slots_decoding;
+    int slots_queued;
+    int in_blocked;
+    int out_busy;
+    struct SPProtoDecoder_lane *lanes;
+    int lanes_start;
+    int lanes_count;
     DebugObject d_obj;
 } SPProtoDecoder;
 
@@ -95,13 +140,25 @@ typedef struct {
  * @param encryption_key if using encryption, the encryption key
  * @param num_otp_seeds if using OTPs, how many OTP seeds to keep for checking
  *                      receiving packets. Must be >=2 if using OTPs.
+ * @param batch_size maximum number of packets decoded in a single thread work. Must be >0.
+ *                   If this and window are 1, each packet is decoded in the input buffer
+ *                   or the plaintext buffer, and input is accepted only after the packet
+ *                   was output.
+ *                   If >1, input packets are copied into up to this many internal slots
+ *                   and accepted immediately while slots are free; packets queued while
+ *                   a work is running are decoded together in the next work. Packets are
+ *                   output in order.
+ * @param window maximum number of thread works in flight at once. Must be >0.
+ *               If >1, up to this many batches are decoded concurrently on different
+ *               threads, and the object keeps up to batch_size*window packets internally.
+ *               Packets are still output in order.
  * @param pg pending group
  * @param twd thread work dispatcher
  * @param user argument to handlers
  * @param logfunc function which prepends the log prefix using {@link BLog_Append}
  * @return 1 on success, 0 on failure
  */
-int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc) WARN_UNUSED;
+int SPProtoDecoder_Init (SPProtoDecoder *o, PacketPassInterface *output, struct spproto_security_params sp_params, int num_otp_seeds, int batch_size, int window, BPendingGroup *pg, BThreadWorkDispatcher *twd, void *user, BLog_logfunc logfunc) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -123,6 +180,8 @@ PacketPassInterface * SPProtoDecoder_GetInput (SPProtoDecoder *o);
 /**
  * Sets an encryption key for decrypting packets.
  * Encryption must be enabled.
+ * With an AEAD encryption mode, if initializing the cipher fails,
+ * the object is left without an encryption key.
  *
  * @param o the object
  * @param encryption_key key to use
@@ -29,17 +29,26 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include <misc/balign.h>
 #include <misc/offset.h>
 #include <misc/byteorder.h>
+#include <misc/balloc.h>
+#include <misc/probe.h>
 #include <security/BRandom.h>
 #include <security/BHash.h>
+#include <base/BMetrics.h>
+#include <base/BBufferArena.h>
+#include <base/BPacketTrace.h>
 
 #include "SPProtoEncoder.h"
 
+#include <generated/blog_channel_SPProtoEncoder.h>
+
 static int can_encode (SPProtoEncoder *o);
 static void encode_packet (SPProtoEncoder *o);
+static int encode_one (SPProtoEncoder *o, BEncryption *encryptor, BAEAD *aead, uint8_t *plaintext, int in_len, uint16_t seed_id, otp_t otp, uint64_t seq, uint8_t *out);
 static void encode_work_func (SPProtoEncoder *o);
 static void encode_work_handler (SPProtoEncoder *o);
 static void maybe_encode (SPProtoEncoder *o);
@@ -48,6 +57,21 @@ static void input_handler_done (SPProtoEncoder *o, int data_len);
 static void handler_job_hander (SPProtoEncoder *o);
 static void otpgenerator_handler (SPProtoEncoder *o);
 static void maybe_stop_work (SPProtoEncoder *o);
+static uint8_t * plaintext_location (SPProtoEncoder *o, uint8_t *out, uint8_t *buf);
+static int init_cipher (SPProtoEncoder *o, BEncryption *encryptor, BAEAD *aead, uint8_t *encryption_key);
+static void free_cipher (SPProtoEncoder *o, BEncryption *encryptor, BAEAD *aead);
+static int init_encryptor (SPProtoEncoder *o, uint8_t *encryption_key);
+static void free_encryptor (SPProtoEncoder *o);
+static void write_seq_block (SPProtoEncoder *o, uint64_t seq, uint8_t *dst);
+static int have_key (SPProtoEncoder *o);
+static void generate_otp (SPProtoEncoder *o, uint16_t *seed_id, otp_t *otp);
+static struct SPProtoEncoder_slot * batch_slot (SPProtoEncoder *o, int i);
+static struct SPProtoEncoder_lane * batch_lane (SPProtoEncoder *o, int i);
+static void batch_encode_work_func (struct SPProtoEncoder_lane *l);
+static void batch_encode_work_handler (struct SPProtoEncoder_lane *l);
+static void batch_maybe_encode (SPProtoEncoder *o);
+static void batch_maybe_recv (SPProtoEncoder *o);
+static void batch_maybe_output (SPProtoEncoder *o);
 
 static int can_encode (SPProtoEncoder *o)
 {
@@ -57,7 +81,7 @@ static int can_encode (SPProtoEncoder *o)
     
     return (
         (!SPPROTO_HAVE_OTP(o->sp_params) || OTPGenerator_GetPosition(&o->otpgen) < o->sp_params.otp_num) &&
-        (!SPPROTO_HAVE_ENCRYPTION(o->sp_params) || o->have_encryption_key)
+        have_key(o)
     );
 }
 
@@ -70,42 +94,36 @@ static void encode_packet (SPProtoEncoder *o)
     
     // generate OTP, remember seed ID
     if (SPPROTO_HAVE_OTP(o->sp_params)) {
-        o->tw_seed_id = o->otpgen_seed_id;
-        o->tw_otp = OTPGenerator_GetOTP(&o->otpgen);
+        generate_otp(o, &o->tw_seed_id, &o->tw_otp);
+    }
+    
+    // assign sequence number
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+        o->tw_seq = o->seq++;
     }
     
     // start work
     BThreadWork_Init(&o->tw, o->twd, (BThreadWork_handler_done)encode_work_handler, o, (BThreadWork_work_func)encode_work_func, o);
     o->tw_have = 1;
-    
-    // schedule OTP warning handler
-    if (SPPROTO_HAVE_OTP(o->sp_params) && OTPGenerator_GetPosition(&o->otpgen) == o->otp_warning_count) {
-        BPending_Set(&o->handler_job);
-    }
 }
 
-static void encode_work_func (SPProtoEncoder *o)
+static int encode_one (SPProtoEncoder *o, BEncryption *encryptor, BAEAD *aead, uint8_t *plaintext, int in_len, uint16_t seed_id, otp_t otp, uint64_t seq, uint8_t *out)
 {
-    ASSERT(o->in_len >= 0)
-    ASSERT(o->out_have)
-    ASSERT(!SPPROTO_HAVE_ENCRYPTION(o->sp_params) || o->have_encryption_key)
-    
-    ASSERT(o->in_len <= o->input_mtu)
-    
-    // determine plaintext location
-    uint8_t *plaintext = (SPPROTO_HAVE_ENCRYPTION(o->sp_params) ? o->buf : o->out);
+    ASSERT(in_len >= 0)
+    ASSERT(in_len <= o->input_mtu)
+    ASSERT(have_key(o))
     
     // plaintext begins with header
     uint8_t *header = plaintext;
     
     // plaintext is header + payload
-    int plaintext_len = SPPROTO_HEADER_LEN(o->sp_params) + o->in_len;
+    int plaintext_len = SPPROTO_HEADER_LEN(o->sp_params) + in_len;
     
     // write OTP
     if (SPPROTO_HAVE_OTP(o->sp_params)) {
         struct spproto_otpdata header_otpd;
-        header_otpd.seed_id = htol16(o->tw_seed_id);
-        header_otpd.otp = o->tw_otp;
+        header_otpd.seed_id = htol16(seed_id);
+        header_otpd.otp = otp;
         memcpy(header + SPPROTO_HEADER_OTPDATA_OFF(o->sp_params), &header_otpd, sizeof(header_otpd));
     }
     
@@ -116,14 +134,28 @@ static void encode_work_func (SPProtoEncoder *o)
         memset(header_hash, 0, o->hash_size);
         // calculate hash
         uint8_t hash[BHASH_MAX_SIZE];
-        BHash_calculate(o->sp_params.hash_mode, plaintext, plaintext_len, hash);
+        if (SPPROTO_HAVE_KEYED_HASH(o->sp_params)) {
+            BHash_calculate_keyed(o->sp_params.hash_mode, o->hash_key, plaintext, plaintext_len, hash);
+        } else {
+            BHash_calculate(o->sp_params.hash_mode, plaintext, plaintext_len, hash);
+        }
         // set hash field
         memcpy(header_hash, hash, o->hash_size);
     }
     
     int out_len;
     
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        // nonce is the sequence block, of which compact nonces leave
+        // out the high bytes of the sequence number
+        uint8_t nonce[BAEAD_NONCE_SIZE];
+        write_seq_block(o, seq, nonce);
+        memcpy(out, nonce, SPPROTO_AEAD_NONCE_LEN(o->sp_params));
+        
+        // encrypt and authenticate header + payload in place, appending the tag
+        BAEAD_Seal(aead, nonce, plaintext, plaintext_len, plaintext);
+        out_len = SPPROTO_AEAD_NONCE_LEN(o->sp_params) + plaintext_len + BAEAD_TAG_SIZE;
+    } else if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
         // encrypting pad(header + payload)
         int cyphertext_len = balign_up((plaintext_len + 1), o->enc_block_size);
         
@@ -133,22 +165,36 @@ static void encode_work_func (SPProtoEncoder *o)
             plaintext[i] = 0;
         }
         
-        // generate IV
-        BRandom_randomize(o->out, o->enc_block_size);
-        
-        // copy IV because BEncryption_Encrypt changes the IV
+        // generate IV by encrypting the sequence block, which makes it
+        // unpredictable without the key and avoids the RNG; a single block
+        // with a zero IV is encrypted as in ECB mode, and afterwards iv holds
+        // the output block, the IV to continue with
+        uint8_t seq_block[BENCRYPTION_MAX_BLOCK_SIZE];
+        write_seq_block(o, seq, seq_block);
         uint8_t iv[BENCRYPTION_MAX_BLOCK_SIZE];
-        memcpy(iv, o->out, o->enc_block_size);
+        memset(iv, 0, o->enc_block_size);
+        BEncryption_Encrypt(encryptor, seq_block, out, o->enc_block_size, iv);
         
         // encrypt
-        BEncryption_Encrypt(&o->encryptor, plaintext, o->out + o->enc_block_size, cyphertext_len, iv);
+        BEncryption_Encrypt(encryptor, plaintext, out + o->enc_block_size, cyphertext_len, iv);
         out_len = o->enc_block_size + cyphertext_len;
     } else {
         out_len = plaintext_len;
     }
     
-    // remember length
-    o->tw_out_len = out_len;
+    return out_len;
+}
+
+static void encode_work_func (SPProtoEncoder *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(o->out_have)
+    
+    BPROBE2(spproto_encode_begin, o, o->in_len);
+    uint64_t start = BMetrics_Start();
+    o->tw_out_len = encode_one(o, &o->encryptor, &o->aead, plaintext_location(o, o->out, o->buf), o->in_len, o->tw_seed_id, o->tw_otp, o->tw_seq, o->out);
+    BMetrics_ObserveSince(BMETRICS_HISTOGRAM_SPPROTO_ENCODE_NS, start);
+    BPROBE2(spproto_encode_end, o, o->tw_out_len);
 }
 
 static void encode_work_handler (SPProtoEncoder *o)
@@ -161,6 +207,8 @@ static void encode_work_handler (SPProtoEncoder *o)
     BThreadWork_Free(&o->tw);
     o->tw_have = 0;
     
+    BPacketTrace_Stamp(BPACKETTRACE_SEND, o, BMETRICS_HISTOGRAM_TRACE_SEND_ENCODE_DONE_NS, o->out);
+    
     // finish packet
     o->in_len = -1;
     o->out_have = 0;
@@ -169,6 +217,11 @@ static void encode_work_handler (SPProtoEncoder *o)
 
 static void maybe_encode (SPProtoEncoder *o)
 {
+    if (o->num_slots > 1) {
+        batch_maybe_encode(o);
+        return;
+    }
+    
     if (o->in_len >= 0 && o->out_have && !o->tw_have && can_encode(o)) {
         encode_packet(o);
     }
@@ -176,17 +229,23 @@ static void maybe_encode (SPProtoEncoder *o)
 
 static void output_handler_recv (SPProtoEncoder *o, uint8_t *data)
 {
-    ASSERT(o->in_len == -1)
     ASSERT(!o->out_have)
-    ASSERT(!o->tw_have)
     DebugObject_Access(&o->d_obj);
     
     // remember output packet
     o->out_have = 1;
     o->out = data;
     
+    if (o->num_slots > 1) {
+        batch_maybe_output(o);
+        return;
+    }
+    
+    ASSERT(o->in_len == -1)
+    ASSERT(!o->tw_have)
+    
     // determine plaintext location
-    uint8_t *plaintext = (SPPROTO_HAVE_ENCRYPTION(o->sp_params) ? o->buf : o->out);
+    uint8_t *plaintext = plaintext_location(o, o->out, o->buf);
     
     // schedule receive
     PacketRecvInterface_Receiver_Recv(o->input, plaintext + SPPROTO_HEADER_LEN(o->sp_params));
@@ -196,14 +255,34 @@ static void input_handler_done (SPProtoEncoder *o, int data_len)
 {
     ASSERT(data_len >= 0)
     ASSERT(data_len <= o->input_mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->num_slots > 1) {
+        ASSERT(o->slot_receiving)
+        
+        // queue packet
+        struct SPProtoEncoder_slot *s = batch_slot(o, o->slots_encoded + o->slots_encoding + o->slots_queued);
+        s->in_len = data_len;
+        o->slot_receiving = 0;
+        o->slots_queued++;
+        
+        BPacketTrace_Stamp(BPACKETTRACE_SEND, o->input, BMETRICS_HISTOGRAM_TRACE_SEND_ENCODE_QUEUE_NS, s);
+        
+        // encode if possible, and receive the next packet meanwhile
+        batch_maybe_encode(o);
+        batch_maybe_recv(o);
+        return;
+    }
+    
     ASSERT(o->in_len == -1)
     ASSERT(o->out_have)
     ASSERT(!o->tw_have)
-    DebugObject_Access(&o->d_obj);
     
     // remember input packet
     o->in_len = data_len;
     
+    BPacketTrace_Stamp(BPACKETTRACE_SEND, o->input, BMETRICS_HISTOGRAM_TRACE_SEND_ENCODE_QUEUE_NS, o);
+    
     // encode if possible
     if (can_encode(o)) {
         encode_packet(o);
@@ -229,12 +308,50 @@ static void otpgenerator_handler (SPProtoEncoder *o)
     // remember seed ID
     o->otpgen_seed_id = o->otpgen_pending_seed_id;
     
+    btime_t now = btime_gettime();
+    
+    // if the warning for the previous seed is what brought this one, warn early
+    // enough next time that the OTPs left last twice the time it took, at the
+    // rate they were used until the warning
+    if (o->otp_warned) {
+        int64_t latency = now - o->otp_warn_time;
+        int64_t elapsed = o->otp_warn_time - o->otp_seed_time;
+        if (elapsed < 1) {
+            elapsed = 1;
+        }
+        int64_t needed = 2 * latency * o->otp_warn_position / elapsed;
+        
+        o->otp_warn_position = o->otp_warning_count;
+        if (needed > o->sp_params.otp_num - o->otp_warn_position) {
+            o->otp_warn_position = (needed >= o->sp_params.otp_num ? 1 : o->sp_params.otp_num - needed);
+        }
+    }
+    
+    o->otp_warned = 0;
+    o->otp_seed_time = now;
+    
     // possibly continue I/O
     maybe_encode(o);
 }
 
 static void maybe_stop_work (SPProtoEncoder *o)
 {
+    if (o->num_slots > 1) {
+        // stop works of unfinished lanes
+        for (int i = 0; i < o->lanes_count; i++) {
+            struct SPProtoEncoder_lane *l = batch_lane(o, i);
+            if (!l->done) {
+                BThreadWork_Free(&l->tw);
+            }
+        }
+        o->lanes_count = 0;
+        
+        // packets being encoded go back to the queue
+        o->slots_queued += o->slots_encoding;
+        o->slots_encoding = 0;
+        return;
+    }
+    
     // stop existing work
     if (o->tw_have) {
         BThreadWork_Free(&o->tw);
@@ -242,9 +359,266 @@ static void maybe_stop_work (SPProtoEncoder *o)
     }
 }
 
-int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, BPendingGroup *pg, BThreadWorkDispatcher *twd)
+static uint8_t * plaintext_location (SPProtoEncoder *o, uint8_t *out, uint8_t *buf)
+{
+    // AEAD encrypts in place right after the nonce, CBC needs a separate
+    // buffer because of the padding and the IV
+    if (SPPROTO_HAVE_AEAD(o->sp_params)) {
+        return (out + SPPROTO_AEAD_NONCE_LEN(o->sp_params));
+    }
+    
+    return (SPPROTO_HAVE_ENCRYPTION(o->sp_params) ? buf : out);
+}
+
+static int init_cipher (SPProtoEncoder *o, BEncryption *encryptor, BAEAD *aead, uint8_t *encryption_key)
+{
+    if (!SPPROTO_HAVE_AEAD(o->sp_params)) {
+        BEncryption_Init(encryptor, BENCRYPTION_MODE_ENCRYPT, o->sp_params.encryption_mode, encryption_key);
+        return 1;
+    }
+    
+    if (!BAEAD_Init(aead, BAEAD_MODE_ENCRYPT, o->sp_params.encryption_mode, encryption_key)) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+static void free_cipher (SPProtoEncoder *o, BEncryption *encryptor, BAEAD *aead)
+{
+    if (!SPPROTO_HAVE_AEAD(o->sp_params)) {
+        BEncryption_Free(encryptor);
+    } else {
+        BAEAD_Free(aead);
+    }
+}
+
+static int init_encryptor (SPProtoEncoder *o, uint8_t *encryption_key)
+{
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(!o->have_encryption_key)
+    
+    if (o->num_slots == 1) {
+        return init_cipher(o, &o->encryptor, &o->aead, encryption_key);
+    }
+    
+    // lanes are encoded concurrently, and a cipher context can only be
+    // used by one thread at a time, so each lane gets its own
+    for (int i = 0; i < o->window; i++) {
+        if (!init_cipher(o, &o->lanes[i].encryptor, &o->lanes[i].aead, encryption_key)) {
+            while (i-- > 0) {
+                free_cipher(o, &o->lanes[i].encryptor, &o->lanes[i].aead);
+            }
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static void free_encryptor (SPProtoEncoder *o)
+{
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(o->have_encryption_key)
+    
+    if (o->num_slots == 1) {
+        free_cipher(o, &o->encryptor, &o->aead);
+        return;
+    }
+    
+    for (int i = 0; i < o->window; i++) {
+        free_cipher(o, &o->lanes[i].encryptor, &o->lanes[i].aead);
+    }
+}
+
+static void write_seq_block (SPProtoEncoder *o, uint64_t seq, uint8_t *dst)
+{
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(o->sp_params))
+    ASSERT(o->have_encryption_key)
+    
+    memcpy(dst, o->seq_prefix, o->seq_prefix_len);
+    uint64_t le_seq = htol64(seq);
+    memcpy(dst + o->seq_prefix_len, &le_seq, sizeof(le_seq));
+}
+
+static int have_key (SPProtoEncoder *o)
+{
+    return (!SPPROTO_HAVE_ENCRYPTION(o->sp_params) || o->have_encryption_key);
+}
+
+static void generate_otp (SPProtoEncoder *o, uint16_t *seed_id, otp_t *otp)
+{
+    ASSERT(SPPROTO_HAVE_OTP(o->sp_params))
+    ASSERT(OTPGenerator_GetPosition(&o->otpgen) < o->sp_params.otp_num)
+    
+    *seed_id = o->otpgen_seed_id;
+    *otp = OTPGenerator_GetOTP(&o->otpgen);
+    
+    // schedule OTP warning handler
+    if (OTPGenerator_GetPosition(&o->otpgen) == o->otp_warn_position) {
+        o->otp_warned = 1;
+        o->otp_warn_time = btime_gettime();
+        BPending_Set(&o->handler_job);
+    }
+}
+
+static struct SPProtoEncoder_slot * batch_slot (SPProtoEncoder *o, int i)
+{
+    ASSERT(o->num_slots > 1)
+    ASSERT(i >= 0)
+    ASSERT(i < o->num_slots)
+    
+    return &o->slots[(o->slots_start + i) % o->num_slots];
+}
+
+static struct SPProtoEncoder_lane * batch_lane (SPProtoEncoder *o, int i)
+{
+    ASSERT(o->num_slots > 1)
+    ASSERT(i >= 0)
+    ASSERT(i < o->lanes_count)
+    
+    return &o->lanes[(o->lanes_start + i) % o->window];
+}
+
+static void batch_encode_work_func (struct SPProtoEncoder_lane *l)
+{
+    SPProtoEncoder *o = l->o;
+    ASSERT(l->num > 0)
+    
+    // only touch the lane's own slots, other lanes may be running concurrently
+    for (int i = 0; i < l->num; i++) {
+        struct SPProtoEncoder_slot *s = &o->slots[(l->first + i) % o->num_slots];
+        BPROBE2(spproto_encode_begin, o, s->in_len);
+        uint64_t start = BMetrics_Start();
+        s->out_len = encode_one(o, &l->encryptor, &l->aead, plaintext_location(o, s->out, s->buf), s->in_len, s->seed_id, s->otp, s->seq, s->out);
+        BMetrics_ObserveSince(BMETRICS_HISTOGRAM_SPPROTO_ENCODE_NS, start);
+        BPROBE2(spproto_encode_end, o, s->out_len);
+    }
+}
+
+static void batch_encode_work_handler (struct SPProtoEncoder_lane *l)
+{
+    SPProtoEncoder *o = l->o;
+    ASSERT(!l->done)
+    ASSERT(o->slots_encoding > 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // free work
+    BThreadWork_Free(&l->tw);
+    l->done = 1;
+    
+    // lanes may finish out of order; retire finished lanes from the front
+    // only, so that packets stay in order
+    while (o->lanes_count > 0 && batch_lane(o, 0)->done) {
+        struct SPProtoEncoder_lane *first = batch_lane(o, 0);
+        o->slots_encoded += first->num;
+        o->slots_encoding -= first->num;
+        o->lanes_start = (o->lanes_start + 1) % o->window;
+        o->lanes_count--;
+    }
+    
+    // pass the first packet on, and encode what was queued meanwhile
+    batch_maybe_output(o);
+    batch_maybe_encode(o);
+}
+
+static void batch_maybe_encode (SPProtoEncoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    // start lanes while there are free ones and packets to encode
+    while (o->lanes_count < o->window && o->slots_queued > 0 && have_key(o)) {
+        // take up to a batch of queued packets we have OTPs for
+        int num = o->slots_queued;
+        if (num > o->batch_size) {
+            num = o->batch_size;
+        }
+        if (SPPROTO_HAVE_OTP(o->sp_params)) {
+            int otps_left = o->sp_params.otp_num - OTPGenerator_GetPosition(&o->otpgen);
+            if (num > otps_left) {
+                num = otps_left;
+            }
+            if (num == 0) {
+                return;
+            }
+        }
+        
+        // assign OTPs and sequence numbers here rather than in the work,
+        // so that they follow packet order
+        int first = o->slots_encoded + o->slots_encoding;
+        for (int i = 0; i < num; i++) {
+            struct SPProtoEncoder_slot *s = batch_slot(o, first + i);
+            if (SPPROTO_HAVE_OTP(o->sp_params)) {
+                generate_otp(o, &s->seed_id, &s->otp);
+            }
+            if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+                s->seq = o->seq++;
+            }
+        }
+        
+        // set up lane
+        struct SPProtoEncoder_lane *l = &o->lanes[(o->lanes_start + o->lanes_count) % o->window];
+        l->first = (o->slots_start + first) % o->num_slots;
+        l->num = num;
+        l->done = 0;
+        o->lanes_count++;
+        
+        o->slots_encoding += num;
+        o->slots_queued -= num;
+        
+        // start work
+        BThreadWork_Init(&l->tw, o->twd, (BThreadWork_handler_done)batch_encode_work_handler, l, (BThreadWork_work_func)batch_encode_work_func, l);
+    }
+}
+
+static void batch_maybe_recv (SPProtoEncoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    int used = o->slots_encoded + o->slots_encoding + o->slots_queued;
+    
+    if (o->slot_receiving || used == o->num_slots) {
+        return;
+    }
+    
+    // receive into the next free slot
+    struct SPProtoEncoder_slot *s = batch_slot(o, used);
+    o->slot_receiving = 1;
+    PacketRecvInterface_Receiver_Recv(o->input, plaintext_location(o, s->out, s->buf) + SPPROTO_HEADER_LEN(o->sp_params));
+}
+
+static void batch_maybe_output (SPProtoEncoder *o)
+{
+    ASSERT(o->num_slots > 1)
+    
+    if (!o->out_have || o->slots_encoded == 0) {
+        return;
+    }
+    
+    // copy out the oldest encoded packet
+    struct SPProtoEncoder_slot *s = batch_slot(o, 0);
+    int out_len = s->out_len;
+    memcpy(o->out, s->out, out_len);
+    
+    BPacketTrace_Stamp(BPACKETTRACE_SEND, s, BMETRICS_HISTOGRAM_TRACE_SEND_ENCODE_DONE_NS, o->out);
+    
+    // free its slot
+    o->slots_start = (o->slots_start + 1) % o->num_slots;
+    o->slots_encoded--;
+    
+    // finish packet
+    o->out_have = 0;
+    PacketRecvInterface_Done(&o->output, out_len);
+    
+    // the slot can take another packet
+    batch_maybe_recv(o);
+}
+
+int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, int batch_size, int window, BPendingGroup *pg, BThreadWorkDispatcher *twd)
 {
     spproto_assert_security_params(sp_params);
+    ASSERT(batch_size > 0)
+    ASSERT(window > 0)
     ASSERT(spproto_carrier_mtu_for_payload_mtu(sp_params, PacketRecvInterface_GetMTU(input)) >= 0)
     if (SPPROTO_HAVE_OTP(sp_params)) {
         ASSERT(otp_warning_count > 0)
@@ -255,6 +629,8 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
     o->input = input;
     o->sp_params = sp_params;
     o->otp_warning_count = otp_warning_count;
+    o->batch_size = batch_size;
+    o->window = window;
     o->twd = twd;
     
     // set no handlers
@@ -266,21 +642,30 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
     }
     
     // calculate encryption block and key sizes
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && !SPPROTO_HAVE_AEAD(o->sp_params)) {
         o->enc_block_size = BEncryption_cipher_block_size(o->sp_params.encryption_mode);
-        o->enc_key_size = BEncryption_cipher_key_size(o->sp_params.encryption_mode);
+    }
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
+        o->enc_key_size = spproto_encryption_key_size(o->sp_params);
+        o->seq_prefix_len = spproto_seq_prefix_len(o->sp_params);
     }
     
     // init otp generator
     if (SPPROTO_HAVE_OTP(o->sp_params)) {
-        if (!OTPGenerator_Init(&o->otpgen, o->sp_params.otp_num, o->sp_params.otp_mode, o->twd, (OTPGenerator_handler)otpgenerator_handler, o)) {
+        if (!OTPGenerator_Init(&o->otpgen, o->sp_params.otp_num, o->sp_params.otp_mode, pg, o->twd, (OTPGenerator_handler)otpgenerator_handler, o)) {
             goto fail0;
         }
+        
+        // warn at the configured position until the packet rate is known
+        o->otp_warn_position = o->otp_warning_count;
+        o->otp_warned = 0;
+        o->otp_seed_time = 0;
     }
     
     // have no encryption key
     if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) { 
         o->have_encryption_key = 0;
+        o->have_last_key = 0;
     }
     
     // remember input MTU
@@ -301,12 +686,55 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
     // have no output available
     o->out_have = 0;
     
-    // allocate plaintext buffer
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        int buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->input_mtu + 1), o->enc_block_size);
-        if (!(o->buf = (uint8_t *)malloc(buf_size))) {
+    // calculate plaintext buffer size
+    int buf_size = 0;
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && !SPPROTO_HAVE_AEAD(o->sp_params)) {
+        buf_size = balign_up((SPPROTO_HEADER_LEN(o->sp_params) + o->input_mtu + 1), o->enc_block_size);
+    }
+    
+    // a full batch for each lane
+    if (o->batch_size > INT_MAX / o->window) {
+        goto fail1;
+    }
+    o->num_slots = o->batch_size * o->window;
+    
+    if (o->num_slots == 1) {
+        // allocate plaintext buffer
+        if (buf_size > 0 && !(o->buf = (uint8_t *)BBufferArena_Alloc(buf_size))) {
+            goto fail1;
+        }
+    } else {
+        // allocate slots, each with an output buffer and a plaintext buffer
+        if (!(o->slots = (struct SPProtoEncoder_slot *)BAllocArray(o->num_slots, sizeof(o->slots[0])))) {
             goto fail1;
         }
+        size_t slot_size = (size_t)o->output_mtu + buf_size;
+        if (!(o->slots_mem = (uint8_t *)BBufferArena_AllocArray(o->num_slots, slot_size))) {
+            goto fail2;
+        }
+        for (int i = 0; i < o->num_slots; i++) {
+            o->slots[i].out = o->slots_mem + i * slot_size;
+            o->slots[i].buf = o->slots[i].out + o->output_mtu;
+        }
+        
+        // allocate lanes
+        if (!(o->lanes = (struct SPProtoEncoder_lane *)BAllocArray(o->window, sizeof(o->lanes[0])))) {
+            goto fail3;
+        }
+        for (int i = 0; i < o->window; i++) {
+            o->lanes[i].o = o;
+        }
+        
+        // have no packets
+        o->slots_start = 0;
+        o->slots_encoded = 0;
+        o->slots_encoding = 0;
+        o->slots_queued = 0;
+        o->slot_receiving = 0;
+        
+        // have no lanes in use
+        o->lanes_start = 0;
+        o->lanes_count = 0;
     }
     
     // init handler job
@@ -317,8 +745,17 @@ int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct s
     
     DebugObject_Init(&o->d_obj);
     
+    // start receiving input into slots
+    if (o->num_slots > 1) {
+        batch_maybe_recv(o);
+    }
+    
     return 1;
     
+fail3:
+    BBufferArena_Free(o->slots_mem);
+fail2:
+    BFree(o->slots);
 fail1:
     PacketRecvInterface_Free(&o->output);
     if (SPPROTO_HAVE_OTP(o->sp_params)) {
@@ -333,26 +770,29 @@ void SPProtoEncoder_Free (SPProtoEncoder *o)
     DebugObject_Free(&o->d_obj);
     
     // free work
-    if (o->tw_have) {
-        BThreadWork_Free(&o->tw);
-    }
+    maybe_stop_work(o);
     
     // free handler job
     BPending_Free(&o->handler_job);
     
-    // free plaintext buffer
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params)) {
-        free(o->buf);
+    // free encryptor
+    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && o->have_encryption_key) {
+        free_encryptor(o);
+    }
+    
+    // free slots or plaintext buffer
+    if (o->num_slots > 1) {
+        BFree(o->lanes);
+        BBufferArena_Free(o->slots_mem);
+        BFree(o->slots);
+    }
+    else if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && !SPPROTO_HAVE_AEAD(o->sp_params)) {
+        BBufferArena_Free(o->buf);
     }
     
     // free output
     PacketRecvInterface_Free(&o->output);
     
-    // free encryptor
-    if (SPPROTO_HAVE_ENCRYPTION(o->sp_params) && o->have_encryption_key) {
-        BEncryption_Free(&o->encryptor);
-    }
-    
     // free otp generator
     if (SPPROTO_HAVE_OTP(o->sp_params)) {
         OTPGenerator_Free(&o->otpgen);
@@ -376,11 +816,41 @@ void SPProtoEncoder_SetEncryptionKey (SPProtoEncoder *o, uint8_t *encryption_key
     
     // free encryptor
     if (o->have_encryption_key) {
-        BEncryption_Free(&o->encryptor);
+        free_encryptor(o);
+        o->have_encryption_key = 0;
     }
     
-    // init encryptor
-    BEncryption_Init(&o->encryptor, BENCRYPTION_MODE_ENCRYPT, o->sp_params.encryption_mode, encryption_key);
+    // refuse the previous key, with which the sequence could repeat nonces
+    // or IVs; stay without a key until a fresh one is set
+    if (o->have_last_key && !memcmp(o->last_key, encryption_key, o->enc_key_size)) {
+        BLog(BLOG_ERROR, "refusing to reuse the previous encryption key");
+        return;
+    }
+    
+    // init encryptor; on failure (already logged), stay without a key,
+    // encoding waits until a key is set successfully
+    if (!init_encryptor(o, encryption_key)) {
+        return;
+    }
+    
+    // remember key
+    memcpy(o->last_key, encryption_key, o->enc_key_size);
+    o->have_last_key = 1;
+    
+    // start a new sequence with a new random prefix, and at a random position
+    // unless nonces are compact; both ends of a link send with the same key,
+    // which these keep apart (see spproto.h)
+    BRandom_randomize(o->seq_prefix, o->seq_prefix_len);
+    o->seq = 0;
+    if (!o->sp_params.compact) {
+        BRandom_randomize((uint8_t *)&o->seq, sizeof(o->seq));
+        o->seq &= SPPROTO_SEQ_START_MASK;
+    }
+    
+    // derive hash key
+    if (SPPROTO_HAVE_KEYED_HASH(o->sp_params)) {
+        spproto_hash_key(o->sp_params, encryption_key, o->hash_key);
+    }
     
     // have encryption key
     o->have_encryption_key = 1;
@@ -399,7 +869,7 @@ void SPProtoEncoder_RemoveEncryptionKey (SPProtoEncoder *o)
     
     if (o->have_encryption_key) {
         // free encryptor
-        BEncryption_Free(&o->encryptor);
+        free_encryptor(o);
         
         // have no encryption key
         o->have_encryption_key = 0;
@@ -418,6 +888,15 @@ void SPProtoEncoder_SetOTPSeed (SPProtoEncoder *o, uint16_t seed_id, uint8_t *ke
     o->otpgen_pending_seed_id = seed_id;
 }
 
+void SPProtoEncoder_PrepareOTPSeed (SPProtoEncoder *o, uint8_t *key, uint8_t *iv)
+{
+    ASSERT(SPPROTO_HAVE_OTP(o->sp_params))
+    DebugObject_Access(&o->d_obj);
+    
+    // start generating OTPs ahead of time
+    OTPGenerator_PrepareSeed(&o->otpgen, key, iv);
+}
+
 void SPProtoEncoder_RemoveOTPSeed (SPProtoEncoder *o)
 {
     ASSERT(SPPROTO_HAVE_OTP(o->sp_params))
@@ -425,6 +904,9 @@ void SPProtoEncoder_RemoveOTPSeed (SPProtoEncoder *o)
     
     // reset OTP generator
     OTPGenerator_Reset(&o->otpgen);
+    
+    // a warning for the removed seed says nothing about the next one
+    o->otp_warned = 0;
 }
 
 void SPProtoEncoder_SetHandlers (SPProtoEncoder *o, SPProtoEncoder_handler handler, void *user)
@@ -40,25 +40,50 @@
 #include <protocol/spproto.h>
 #include <base/DebugObject.h>
 #include <security/BEncryption.h>
+#include <security/BAEAD.h>
 #include <security/OTPGenerator.h>
 #include <flow/PacketRecvInterface.h>
 #include <threadwork/BThreadWork.h>
+#include <system/BTime.h>
 
 /**
  * Event context handler called when the remaining number of
  * OTPs equals the warning number after having encoded a packet.
+ * The warning comes earlier if, at the packet rate seen with the previous
+ * seed, the OTPs left would not last twice as long as it took from the
+ * warning until the next seed was in use.
  * 
  * @param user as in {@link SPProtoEncoder_Init}
  */
 typedef void (*SPProtoEncoder_handler) (void *user);
 
+struct SPProtoEncoder_slot {
+    uint8_t *out;
+    uint8_t *buf;
+    int in_len;
+    int out_len;
+    uint16_t seed_id;
+    otp_t otp;
+    uint64_t seq;
+};
+
+struct SPProtoEncoder_lane {
+    struct SPProtoEncoder_s *o;
+    BThreadWork tw;
+    BEncryption encryptor;
+    BAEAD aead;
+    int first;
+    int num;
+    int done;
+};
+
 /**
  * Object which encodes packets according to SPProto.
- *
+ * 
  * Input is with {@link PacketRecvInterface}.
  * Output is with {@link PacketRecvInterface}.
  */
-typedef struct {
+typedef struct SPProtoEncoder_s {
     PacketRecvInterface *input;
     struct spproto_security_params sp_params;
     int otp_warning_count;
@@ -66,13 +91,24 @@ typedef struct {
     BThreadWorkDispatcher *twd;
     void *user;
     int hash_size;
+    uint8_t hash_key[BHASH_MAX_KEY_SIZE];
     int enc_block_size;
     int enc_key_size;
     OTPGenerator otpgen;
     uint16_t otpgen_seed_id;
     uint16_t otpgen_pending_seed_id;
+    int otp_warn_position;
+    int otp_warned;
+    btime_t otp_seed_time;
+    btime_t otp_warn_time;
     int have_encryption_key;
     BEncryption encryptor;
+    BAEAD aead;
+    int seq_prefix_len;
+    uint8_t seq_prefix[SPPROTO_SEQ_LEN];
+    uint64_t seq;
+    int have_last_key;
+    uint8_t last_key[SPPROTO_ENCRYPTION_MAX_KEY_SIZE];
     int input_mtu;
     int output_mtu;
     int in_len;
@@ -85,7 +121,21 @@ typedef struct {
     BThreadWork tw;
     uint16_t tw_seed_id;
     otp_t tw_otp;
+    uint64_t tw_seq;
     int tw_out_len;
+    int batch_size;
+    int window;
+    int num_slots;
+    struct SPProtoEncoder_slot *slots;
+    uint8_t *slots_mem;
+    int slots_start;
+    int slots_encoded;
+    int slots_encoding;
+    int slots_queued;
+    int slot_receiving;
+    struct SPProtoEncoder_lane *lanes;
+    int lanes_start;
+    int lanes_count;
     DebugObject d_obj;
 } SPProtoEncoder;
 
@@ -94,22 +144,35 @@ typedef struct {
  * The object is initialized in blocked state.
  * {@link BSecurity_GlobalInitThreadSafe} must have been done if
  * {@link BThreadWorkDispatcher_UsingThreads}(twd) = 1.
- *
+ * 
  * @param o the object
  * @param input input interface. Its MTU must not be too large, i.e. this must hold:
  *              spproto_carrier_mtu_for_payload_mtu(sp_params, input MTU) >= 0
  * @param sp_params SPProto security parameters
  * @param otp_warning_count If using OTPs, after how many encoded packets to call the handler.
  *                          In this case, must be >0 and <=sp_params.otp_num.
+ * @param batch_size maximum number of packets encoded in a single thread work. Must be >0.
+ *                   If this and window are 1, each packet is encoded directly into
+ *                   the output buffer.
+ *                   If >1, the object keeps up to this many packets internally, receiving
+ *                   input while earlier packets are being encoded, and encodes packets
+ *                   queued meanwhile together in the next work. Packets are output in order, copied
+ *                   from the internal buffers. This lowers the per-packet cost of handing
+ *                   work to threads.
+ * @param window maximum number of thread works in flight at once. Must be >0.
+ *               If >1, up to this many batches are encoded concurrently on different
+ *               threads, so that a single encoder can make use of multiple threads.
+ *               Batches may finish in any order, but packets are still output in order.
+ *               The object then keeps up to batch_size*window packets internally.
  * @param pg pending group
  * @param twd thread work dispatcher
  * @return 1 on success, 0 on failure
  */
-int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, BPendingGroup *pg, BThreadWorkDispatcher *twd) WARN_UNUSED;
+int SPProtoEncoder_Init (SPProtoEncoder *o, PacketRecvInterface *input, struct spproto_security_params sp_params, int otp_warning_count, int batch_size, int window, BPendingGroup *pg, BThreadWorkDispatcher *twd) WARN_UNUSED;
 
 /**
  * Frees the object.
- *
+ * 
  * @param o the object
  */
 void SPProtoEncoder_Free (SPProtoEncoder *o);
@@ -118,7 +181,7 @@ void SPProtoEncoder_Free (SPProtoEncoder *o);
  * Returns the output interface.
  * The MTU of the output interface will depend on the input MTU and security parameters,
  * that is spproto_carrier_mtu_for_payload_mtu(sp_params, input MTU).
- *
+ * 
  * @param o the object
  * @return output interface
  */
@@ -127,7 +190,12 @@ PacketRecvInterface * SPProtoEncoder_GetOutput (SPProtoEncoder *o);
 /**
  * Sets an encryption key to use.
  * Encryption must be enabled.
- *
+ * Every key must be freshly generated, see the sequence number requirements in
+ * spproto.h. Setting the same key as the previous call is refused, and leaves
+ * the object without an encryption key.
+ * With an AEAD encryption mode, if initializing the cipher fails,
+ * the object is left without an encryption key.
+ * 
  * @param o the object
  * @param encryption_key key to use
  */
@@ -136,7 +204,7 @@ void SPProtoEncoder_SetEncryptionKey (SPProtoEncoder *o, uint8_t *encryption_key
 /**
  * Removes an encryption key if one is configured.
  * Encryption must be enabled.
- *
+ * 
  * @param o the object
  */
 void SPProtoEncoder_RemoveEncryptionKey (SPProtoEncoder *o);
@@ -144,7 +212,7 @@ void SPProtoEncoder_RemoveEncryptionKey (SPProtoEncoder *o);
 /**
  * Sets an OTP seed to use.
  * OTPs must be enabled.
- *
+ * 
  * @param o the object
  * @param seed_id seed identifier
  * @param key OTP encryption key
@@ -152,17 +220,29 @@ void SPProtoEncoder_RemoveEncryptionKey (SPProtoEncoder *o);
  */
 void SPProtoEncoder_SetOTPSeed (SPProtoEncoder *o, uint16_t seed_id, uint8_t *key, uint8_t *iv);
 
+/**
+ * Starts generating the OTPs of a seed which is expected to be set
+ * with {@link SPProtoEncoder_SetOTPSeed} later, while encoding continues
+ * with the current seed. See {@link OTPGenerator_PrepareSeed}.
+ * OTPs must be enabled.
+ * 
+ * @param o the object
+ * @param key OTP encryption key
+ * @param iv OTP initialization vector
+ */
+void SPProtoEncoder_PrepareOTPSeed (SPProtoEncoder *o, uint8_t *key, uint8_t *iv);
+
 /**
  * Removes the OTP seed if one is configured.
  * OTPs must be enabled.
- *
+ * 
  * @param o the object
  */
 void SPProtoEncoder_RemoveOTPSeed (SPProtoEncoder *o);
 
 /**
  * Sets handlers.
- *
+ * 
  * @param o the object
  * @param handler OTP warning handler
  * @param user value to pass to handler
@@ -34,6 +34,7 @@
 
 #include <misc/offset.h>
 #include <misc/byteorder.h>
+#include <security/BRandom.h>
 
 #include <client/StreamPeerIO.h>
 
@@ -322,6 +323,11 @@ int init_io (StreamPeerIO *pio, sslsocket *sock)
         }
     }
     
+    // apply socket options
+    if (pio->sock_options && !BConnection_SetOptions(&sock->con, pio->sock_options)) {
+        PeerLog(pio, BLOG_WARNING, "BConnection_SetOptions failed");
+    }
+    
     if (pio->ssl) {
         // init BSSLConnection
         BSSLConnection_Init(&pio->sslcon, sock->ssl_prfd, 0, BReactor_PendingGroup(pio->reactor), pio, (BSSLConnection_handler)sslcon_handler);
@@ -338,7 +344,7 @@ int init_io (StreamPeerIO *pio, sslsocket *sock)
     StreamRecvConnector_ConnectInput(&pio->input_connector, recv_if);
     
     // init sending
-    PacketStreamSender_Init(&pio->output_pss, send_if, PACKETPROTO_ENCLEN(pio->payload_mtu), BReactor_PendingGroup(pio->reactor));
+    PacketStreamSender_Init(&pio->output_pss, send_if, PACKETPROTO_ENCLEN(pio->carrier_mtu), BReactor_PendingGroup(pio->reactor));
     PacketPassConnector_ConnectOutput(&pio->output_connector, PacketStreamSender_GetInput(&pio->output_pss));
     
     pio->sock = sock;
@@ -535,6 +541,12 @@ void reset_state (StreamPeerIO *pio)
             ASSERT(0);
     }
     
+    // forget the key of the connection
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+        SPProtoEncoder_RemoveEncryptionKey(&pio->output_encoder);
+        SPProtoDecoder_RemoveEncryptionKey(&pio->input_spdecoder);
+    }
+    
     // set mode none
     pio->mode = MODE_NONE;
     
@@ -557,6 +569,7 @@ int StreamPeerIO_Init (
     int ssl_flags,
     uint8_t *ssl_peer_cert,
     int ssl_peer_cert_len,
+    struct spproto_security_params sp_params,
     int payload_mtu,
     int sock_sndbuf,
     PacketPassInterface *user_recv_if,
@@ -566,6 +579,10 @@ int StreamPeerIO_Init (
 )
 {
     ASSERT(ssl == 0 || ssl == 1)
+    ASSERT(!SPPROTO_HAVE_ENCRYPTION(sp_params) || SPPROTO_HAVE_AEAD(sp_params))
+    ASSERT(!SPPROTO_HAVE_ENCRYPTION(sp_params) || !ssl)
+    ASSERT(!SPPROTO_HAVE_HASH(sp_params))
+    ASSERT(!SPPROTO_HAVE_OTP(sp_params))
     ASSERT(payload_mtu >= 0)
     ASSERT(PacketPassInterface_GetMTU(user_recv_if) >= payload_mtu)
     ASSERT(handler_error)
@@ -579,21 +596,39 @@ int StreamPeerIO_Init (
         pio->ssl_peer_cert = ssl_peer_cert;
         pio->ssl_peer_cert_len = ssl_peer_cert_len;
     }
+    pio->sp_params = sp_params;
     pio->payload_mtu = payload_mtu;
     pio->sock_sndbuf = sock_sndbuf;
+    pio->sock_options = NULL;
     pio->logfunc = logfunc;
     pio->handler_error = handler_error;
     pio->user = user;
     
+    // packets on the stream are SPProto packets if using encryption
+    pio->carrier_mtu = pio->payload_mtu;
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+        pio->carrier_mtu = spproto_carrier_mtu_for_payload_mtu(pio->sp_params, pio->payload_mtu);
+    }
+    
     // check payload MTU
-    if (pio->payload_mtu > PACKETPROTO_MAXPAYLOAD) {
+    if (pio->carrier_mtu < 0 || pio->carrier_mtu > PACKETPROTO_MAXPAYLOAD) {
         PeerLog(pio, BLOG_ERROR, "payload MTU is too large");
         goto fail0;
     }
     
+    // init decryption
+    PacketPassInterface *decoder_output = user_recv_if;
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+        if (!SPProtoDecoder_Init(&pio->input_spdecoder, user_recv_if, pio->sp_params, 0, 1, 1, BReactor_PendingGroup(pio->reactor), pio->twd, pio->user, pio->logfunc)) {
+            PeerLog(pio, BLOG_ERROR, "SPProtoDecoder_Init failed");
+            goto fail0;
+        }
+        decoder_output = SPProtoDecoder_GetInput(&pio->input_spdecoder);
+    }
+    
     // init receiveing objects
     StreamRecvConnector_Init(&pio->input_connector, BReactor_PendingGroup(pio->reactor));
-    if (!PacketProtoDecoder_Init(&pio->input_decoder, StreamRecvConnector_GetOutput(&pio->input_connector), user_recv_if, BReactor_PendingGroup(pio->reactor), pio,
+    if (!PacketProtoDecoder_Init(&pio->input_decoder, StreamRecvConnector_GetOutput(&pio->input_connector), decoder_output, BReactor_PendingGroup(pio->reactor), pio,
         (PacketProtoDecoder_handler_error)decoder_handler_error
     )) {
         PeerLog(pio, BLOG_ERROR, "FlowErrorDomain_Init failed");
@@ -601,14 +636,33 @@ int StreamPeerIO_Init (
     }
     
     // init sending objects
-    PacketCopier_Init(&pio->output_user_copier, pio->payload_mtu, BReactor_PendingGroup(pio->reactor));
-    PacketProtoEncoder_Init(&pio->output_user_ppe, PacketCopier_GetOutput(&pio->output_user_copier), BReactor_PendingGroup(pio->reactor));
-    PacketPassConnector_Init(&pio->output_connector, PACKETPROTO_ENCLEN(pio->payload_mtu), BReactor_PendingGroup(pio->reactor));
-    if (!SinglePacketBuffer_Init(&pio->output_user_spb, PacketProtoEncoder_GetOutput(&pio->output_user_ppe), PacketPassConnector_GetInput(&pio->output_connector), BReactor_PendingGroup(pio->reactor))) {
-        PeerLog(pio, BLOG_ERROR, "SinglePacketBuffer_Init failed");
+    PacketPassConnector_Init(&pio->output_connector, PACKETPROTO_ENCLEN(pio->carrier_mtu), BReactor_PendingGroup(pio->reactor));
+    PacketPassConnector_EnableCancel(&pio->output_connector);
+#ifndef BADVPN_USE_WINAPI
+    // without SSL, packets go to the socket with writev, header and payload
+    // together, instead of being copied behind their header first
+    if (!pio->ssl) {
+        PacketPassConnector_EnableSendV(&pio->output_connector);
+    }
+#endif
+    if (!PacketProtoPassEncoder_Init(&pio->output_user_ppe, PacketPassConnector_GetInput(&pio->output_connector), pio->carrier_mtu, BReactor_PendingGroup(pio->reactor))) {
+        PeerLog(pio, BLOG_ERROR, "PacketProtoPassEncoder_Init failed");
         goto fail2;
     }
     
+    // init encryption; packets wait in the encoder while there is no key
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+        PacketCopier_Init(&pio->output_copier, pio->payload_mtu, BReactor_PendingGroup(pio->reactor));
+        if (!SPProtoEncoder_Init(&pio->output_encoder, PacketCopier_GetOutput(&pio->output_copier), pio->sp_params, 0, 1, 1, BReactor_PendingGroup(pio->reactor), pio->twd)) {
+            PeerLog(pio, BLOG_ERROR, "SPProtoEncoder_Init failed");
+            goto fail3;
+        }
+        if (!SinglePacketBuffer_Init(&pio->output_buffer, SPProtoEncoder_GetOutput(&pio->output_encoder), PacketProtoPassEncoder_GetInput(&pio->output_user_ppe), BReactor_PendingGroup(pio->reactor))) {
+            PeerLog(pio, BLOG_ERROR, "SinglePacketBuffer_Init failed");
+            goto fail4;
+        }
+    }
+    
     // set mode none
     pio->mode = MODE_NONE;
     
@@ -618,13 +672,21 @@ int StreamPeerIO_Init (
     DebugObject_Init(&pio->d_obj);
     return 1;
     
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+fail4:
+        SPProtoEncoder_Free(&pio->output_encoder);
+fail3:
+        PacketCopier_Free(&pio->output_copier);
+    }
+    PacketProtoPassEncoder_Free(&pio->output_user_ppe);
 fail2:
     PacketPassConnector_Free(&pio->output_connector);
-    PacketProtoEncoder_Free(&pio->output_user_ppe);
-    PacketCopier_Free(&pio->output_user_copier);
     PacketProtoDecoder_Free(&pio->input_decoder);
 fail1:
     StreamRecvConnector_Free(&pio->input_connector);
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+        SPProtoDecoder_Free(&pio->input_spdecoder);
+    }
 fail0:
     return 0;
 }
@@ -636,25 +698,46 @@ void StreamPeerIO_Free (StreamPeerIO *pio)
     // reset state
     reset_state(pio);
     
+    // free encryption
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+        SinglePacketBuffer_Free(&pio->output_buffer);
+        SPProtoEncoder_Free(&pio->output_encoder);
+        PacketCopier_Free(&pio->output_copier);
+    }
+    
     // free sending objects
-    SinglePacketBuffer_Free(&pio->output_user_spb);
+    PacketProtoPassEncoder_Free(&pio->output_user_ppe);
     PacketPassConnector_Free(&pio->output_connector);
-    PacketProtoEncoder_Free(&pio->output_user_ppe);
-    PacketCopier_Free(&pio->output_user_copier);
     
     // free receiveing objects
     PacketProtoDecoder_Free(&pio->input_decoder);
     StreamRecvConnector_Free(&pio->input_connector);
+    
+    // free decryption
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+        SPProtoDecoder_Free(&pio->input_spdecoder);
+    }
+}
+
+void StreamPeerIO_SetSocketOptions (StreamPeerIO *pio, const struct BConnection_options *opts)
+{
+    DebugObject_Access(&pio->d_obj);
+    
+    pio->sock_options = opts;
 }
 
 PacketPassInterface * StreamPeerIO_GetSendInput (StreamPeerIO *pio)
 {
     DebugObject_Access(&pio->d_obj);
     
-    return PacketCopier_GetInput(&pio->output_user_copier);
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+        return PacketCopier_GetInput(&pio->output_copier);
+    }
+    
+    return PacketProtoPassEncoder_GetInput(&pio->output_user_ppe);
 }
 
-int StreamPeerIO_Connect (StreamPeerIO *pio, BAddr addr, uint64_t password, CERTCertificate *ssl_cert, SECKEYPrivateKey *ssl_key)
+int StreamPeerIO_Connect (StreamPeerIO *pio, BAddr addr, uint64_t password, uint8_t *encryption_key, CERTCertificate *ssl_cert, SECKEYPrivateKey *ssl_key)
 {
     DebugObject_Access(&pio->d_obj);
     
@@ -680,6 +763,12 @@ int StreamPeerIO_Connect (StreamPeerIO *pio, BAddr addr, uint64_t password, CERT
     }
     pio->connect.password = htol64(password);
     
+    // set encryption key
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+        SPProtoEncoder_SetEncryptionKey(&pio->output_encoder, encryption_key);
+        SPProtoDecoder_SetEncryptionKey(&pio->input_spdecoder, encryption_key);
+    }
+    
     // set state
     pio->mode = MODE_CONNECT;
     pio->connect.state = CONNECT_STATE_CONNECTING;
@@ -690,7 +779,7 @@ fail0:
     return 0;
 }
 
-void StreamPeerIO_Listen (StreamPeerIO *pio, PasswordListener *listener, uint64_t *password)
+void StreamPeerIO_Listen (StreamPeerIO *pio, PasswordListener *listener, uint64_t *password, uint8_t *encryption_key)
 {
     DebugObject_Access(&pio->d_obj);
     ASSERT(listener->ssl == pio->ssl)
@@ -704,6 +793,13 @@ void StreamPeerIO_Listen (StreamPeerIO *pio, PasswordListener *listener, uint64_
     // remember data
     pio->listen.listener = listener;
     
+    // choose a new encryption key
+    if (SPPROTO_HAVE_ENCRYPTION(pio->sp_params)) {
+        BRandom_randomize(encryption_key, spproto_encryption_key_size(pio->sp_params));
+        SPProtoEncoder_SetEncryptionKey(&pio->output_encoder, encryption_key);
+        SPProtoDecoder_SetEncryptionKey(&pio->input_spdecoder, encryption_key);
+    }
+    
     // set state
     pio->mode = MODE_LISTEN;
     pio->listen.state = LISTEN_STATE_LISTENER;
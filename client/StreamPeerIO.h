@@ -47,13 +47,16 @@
 #include <structure/LinkedList1.h>
 #include <flow/PacketProtoDecoder.h>
 #include <flow/PacketStreamSender.h>
-#include <flow/SinglePacketBuffer.h>
-#include <flow/PacketProtoEncoder.h>
-#include <flow/PacketCopier.h>
+#include <flow/PacketProtoPassEncoder.h>
 #include <flow/PacketPassConnector.h>
 #include <flow/StreamRecvConnector.h>
 #include <flow/SingleStreamSender.h>
+#include <flow/PacketCopier.h>
+#include <flow/SinglePacketBuffer.h>
+#include <protocol/spproto.h>
 #include <client/PasswordListener.h>
+#include <client/SPProtoEncoder.h>
+#include <client/SPProtoDecoder.h>
 
 /**
  * Callback function invoked when an error occurs with the peer connection.
@@ -79,8 +82,11 @@ typedef struct {
     int ssl_flags;
     uint8_t *ssl_peer_cert;
     int ssl_peer_cert_len;
+    struct spproto_security_params sp_params;
     int payload_mtu;
+    int carrier_mtu;
     int sock_sndbuf;
+    const struct BConnection_options *sock_options;
     BLog_logfunc logfunc;
     StreamPeerIO_handler_error handler_error;
     void *user;
@@ -88,15 +94,21 @@ typedef struct {
     // persistent I/O modules
     
     // base sending objects
-    PacketCopier output_user_copier;
-    PacketProtoEncoder output_user_ppe;
-    SinglePacketBuffer output_user_spb;
+    PacketProtoPassEncoder output_user_ppe;
     PacketPassConnector output_connector;
     
+    // sending objects for encryption
+    PacketCopier output_copier;
+    SPProtoEncoder output_encoder;
+    SinglePacketBuffer output_buffer;
+    
     // receiving objects
     StreamRecvConnector input_connector;
     PacketProtoDecoder input_decoder;
     
+    // receiving objects for encryption
+    SPProtoDecoder input_spdecoder;
+    
     // connection side
     int mode;
     
@@ -137,16 +149,26 @@ typedef struct {
  * {@link BLog_Init} must have been done.
  * {@link BNetwork_GlobalInit} must have been done.
  * {@link BSSLConnection_GlobalInit} must have been done if using SSL.
+ * {@link BSecurity_GlobalInitThreadSafe} must have been done if using encryption and
+ * {@link BThreadWorkDispatcher_UsingThreads}(twd) = 1.
+ *
+ * Instead of SSL, packets may be encrypted with an AEAD mode of SPProto, using a key
+ * which the peers exchanged beforehand; the listening side chooses the key, see
+ * {@link StreamPeerIO_Listen}. Packets which fail to authenticate are dropped,
+ * so the link never works with a peer which does not know the key.
  *
  * @param pio the object
  * @param reactor reactor we live in
  * @param twd thread work dispatcher. May be NULL if ssl_flags does not request performing SSL
- *            operations in threads.
+ *            operations in threads, and encryption is not used.
  * @param ssl if nonzero, SSL will be used for peer connection
  * @param ssl_flags flags passed down to {@link BSSLConnection_MakeBackend}. May be used to
  *                  request performing SSL operations in threads.
  * @param ssl_peer_cert if using SSL, the certificate we expect the peer to have
  * @param ssl_peer_cert_len if using SSL, the length of the certificate
+ * @param sp_params SPProto parameters for encrypting packets. The encryption mode must be
+ *                  none or an AEAD mode, and hashes and OTPs must be disabled. Encryption
+ *                  cannot be used together with SSL.
  * @param payload_mtu maximum packet size as seen from the user. Must be >=0.
  * @param sock_sndbuf socket SO_SNDBUF option. Specify <=0 to not set it.
  * @param user_recv_if interface to use for submitting received packets. Its MTU
@@ -164,6 +186,7 @@ int StreamPeerIO_Init (
     int ssl_flags,
     uint8_t *ssl_peer_cert,
     int ssl_peer_cert_len,
+    struct spproto_security_params sp_params,
     int payload_mtu,
     int sock_sndbuf,
     PacketPassInterface *user_recv_if,
@@ -179,6 +202,17 @@ int StreamPeerIO_Init (
  */
 void StreamPeerIO_Free (StreamPeerIO *pio);
 
+/**
+ * Sets socket options to be applied to peer connections established
+ * from now on, after the SO_SNDBUF option given to {@link StreamPeerIO_Init}.
+ * Failure to apply them is logged and otherwise ignored.
+ *
+ * @param pio the object
+ * @param opts socket options, or NULL for none. Must remain valid as long as
+ *             the object exists.
+ */
+void StreamPeerIO_SetSocketOptions (StreamPeerIO *pio, const struct BConnection_options *opts);
+
 /**
  * Returns the interface for sending packets to the peer.
  * The OTP warning handler may be called from within Send calls
@@ -197,6 +231,8 @@ PacketPassInterface * StreamPeerIO_GetSendInput (StreamPeerIO *pio);
  * @param pio the object
  * @param addr address to connect to
  * @param password identification code to send to the peer
+ * @param encryption_key if using encryption, the key the peer chose when it started
+ *                       listening. It is copied.
  * @param ssl_cert if using SSL, the client certificate to use. This object does not
  *                 take ownership of the certificate; it must remain valid until
  *                 the object is reset.
@@ -204,7 +240,7 @@ PacketPassInterface * StreamPeerIO_GetSendInput (StreamPeerIO *pio);
  *                ownership of the key; it must remain valid until the object is reset.
  * @return 1 on success, 0 on failure
  */
-int StreamPeerIO_Connect (StreamPeerIO *pio, BAddr addr, uint64_t password, CERTCertificate *ssl_cert, SECKEYPrivateKey *ssl_key) WARN_UNUSED;
+int StreamPeerIO_Connect (StreamPeerIO *pio, BAddr addr, uint64_t password, uint8_t *encryption_key, CERTCertificate *ssl_cert, SECKEYPrivateKey *ssl_key) WARN_UNUSED;
 
 /**
  * Starts an attempt to accept a connection from the peer.
@@ -216,7 +252,9 @@ int StreamPeerIO_Connect (StreamPeerIO *pio, BAddr addr, uint64_t password, CERT
  *                 SSL enabled. The listener must be available until the object is
  *                 reset or {@link StreamPeerIO_handler_up} is called.
  * @param password will return the identification code the peer should send when connecting
+ * @param encryption_key if using encryption, will return a new random key for the peer
+ *                       to use, spproto_encryption_key_size(sp_params) bytes
  */
-void StreamPeerIO_Listen (StreamPeerIO *pio, PasswordListener *listener, uint64_t *password);
+void StreamPeerIO_Listen (StreamPeerIO *pio, PasswordListener *listener, uint64_t *password, uint8_t *encryption_key);
 
 #endif
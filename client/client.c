@@ -31,10 +31,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <inttypes.h>
 
 #include <protocol/msgproto.h>
 #include <protocol/addr.h>
 #include <protocol/dataproto.h>
+#include <protocol/fecproto.h>
 #include <misc/version.h>
 #include <misc/debug.h>
 #include <misc/offset.h>
@@ -44,14 +46,24 @@
 #include <misc/loggers_string.h>
 #include <misc/string_begins_with.h>
 #include <misc/open_standard_streams.h>
+#include <misc/ipaddr.h>
+#include <misc/ipaddr6.h>
+#include <misc/ethernet_proto.h>
+#include <misc/ipv4_proto.h>
+#include <misc/ipv6_proto.h>
 #include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
+#include <base/BPacketTrace.h>
+#include <base/BBufferArena.h>
+#include <base/BAllocStats.h>
 #include <security/BSecurity.h>
 #include <security/BRandom.h>
 #include <system/BSignal.h>
 #include <system/BTime.h>
 #include <system/BNetwork.h>
+#include <system/BCpuSet.h>
 #include <nspr_support/DummyPRFileDesc.h>
 #include <nspr_support/BSSLConnection.h>
 #include <server_connection/ServerConnection.h>
@@ -60,6 +72,7 @@
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
+#include <system/BUnixSignal.h>
 #endif
 
 #include <client/client.h>
@@ -96,12 +109,19 @@ struct {
     int threads;
     int use_threads_for_ssl_handshake;
     int use_threads_for_ssl_data;
+    BCpuSet cpu_affinity;
+    BCpuSet worker_cpus;
+    int buffer_arena;
     int ssl;
     char *nssdb;
     char *client_cert_name;
     char *server_name;
+    char *peer_cert_cache;
     char *server_addr;
     char *tapdev;
+    int tun;
+    int num_routes;
+    char *routes[MAX_ROUTES];
     int num_scopes;
     char *scopes[MAX_SCOPES];
     int num_bind_addrs;
@@ -112,17 +132,46 @@ struct {
     int otp_mode;
     int otp_num;
     int otp_num_warn;
+    int replay_window;
+    int spproto_batch_size;
+    int spproto_window;
     int fragmentation_latency;
+    int pmtu_discovery_max_mtu;
+    int fec_group_size;
+    int peer_udp_sockets;
+    int peer_udp_offload;
+    char *peer_udp_xdp;
+    int peer_threads;
+    int peer_tcp_fallback;
     int peer_ssl;
     int peer_tcp_socket_sndbuf;
+    struct BConnection_options peer_tcp_socket_options;
+    struct BConnection_options server_socket_options;
+    int busy_poll;
+    int stall_threshold;
+    int job_budget;
     int send_buffer_size;
     int send_buffer_relay_size;
+    int send_buffer_relay_pool_size;
+    int send_buffer_pool_size;
+    int send_buffer_codel_target;
+    int send_buffer_codel_interval;
     int max_macs;
     int max_groups;
     int igmp_group_membership_interval;
     int igmp_last_member_query_time;
+    int proxy_neighbors;
+    int max_flood_rate;
     int allow_peer_talk_without_ssl;
+    int relay_multidest;
+    int compress;
+    int compact_headers;
     int max_peers;
+    int peer_link_idle_time;
+    int qos_dscp;
+    int num_qos_ports;
+    uint16_t qos_ports[MAX_QOS_PORTS];
+    int trace_packets;
 } options;
 
 // bind addresses
@@ -140,10 +189,19 @@ struct bind_addr {
 int num_bind_addrs;
 struct bind_addr bind_addrs[MAX_BIND_ADDRS];
 
+// networks announced to peers in TUN mode
+struct route {
+    int is_ipv6;
+    uint8_t addr[16];
+    int prefix;
+};
+int num_routes;
+struct route routes[MAX_ROUTES];
+
 // TCP listeners
 PasswordListener listeners[MAX_BIND_ADDRS];
 
-// SPProto parameters (UDP only)
+// SPProto parameters; with TCP, only for encrypting the stream
 struct spproto_security_params sp_params;
 
 // server address we connect to
@@ -155,6 +213,11 @@ char server_name[256];
 // reactor
 BReactor ss;
 
+#ifndef BADVPN_USE_WINAPI
+// memory report signal
+BUnixSignal report_signal;
+#endif
+
 // thread work dispatcher
 BThreadWorkDispatcher twd;
 
@@ -171,9 +234,29 @@ int device_mtu;
 // DataProtoSource for device input (reading)
 DataProtoSource device_dpsource;
 
+// pool for peers' send buffers (--send-buffer-pool-size)
+RouteBufferPool device_send_pool;
+
 // DPReceiveDevice for device output (writing)
 DPReceiveDevice device_output_dprd;
 
+// keep-alive timer shared by peers' links
+DataProtoKeepaliveTimer peer_keepalive_timer;
+
+#ifdef BADVPN_USE_AF_XDP
+// AF_XDP fast path for peer links
+BXdp peer_xdp;
+#endif
+
+// threads running peers' UDP links (--peer-threads)
+DatagramPeerIOGroup peer_io_group;
+
+// timer for reporting traced packets (--trace-packets), and the
+// histograms and dropped samples at the last report
+BTimer trace_timer;
+uint64_t trace_last_buckets[CLIENT_TRACE_NUM_STAGES][BMETRICS_HISTOGRAM_BUCKETS];
+uint64_t trace_last_dropped;
+
 // data communication MTU
 int data_mtu;
 
@@ -181,15 +264,21 @@ int data_mtu;
 LinkedList1 peers;
 int num_peers;
 
-// frame decider
+// frame decider (TAP mode)
 FrameDecider frame_decider;
 
+// IP decider (TUN mode)
+IPDecider ip_decider;
+
 // peers that can be user as relays
 LinkedList1 relays;
 
 // peers than need a relay
 LinkedList1 waiting_relay_peers;
 
+// relays with destinations collected for the current device frame
+LinkedList1 multidest_relays;
+
 // server connection
 ServerConnection server;
 
@@ -225,9 +314,20 @@ static int ssl_flags (void);
 // handler for program termination request
 static void signal_handler (void *unused);
 
+#ifndef BADVPN_USE_WINAPI
+// handler for memory report request
+static void report_signal_handler (void *unused, int signo);
+#endif
+
 // adds a new peer
 static void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len);
 
+// decodes the certificate of a peer, possibly from another thread
+static void peer_cert_work_func (struct peer_data *peer);
+
+// called when the certificate of a peer has been decoded
+static void peer_cert_work_handler_done (struct peer_data *peer);
+
 // removes a peer
 static void peer_remove (struct peer_data *peer, int exiting);
 
@@ -244,11 +344,28 @@ static int peer_am_master (struct peer_data *peer);
 static void peer_free_chat (struct peer_data *peer);
 
 // initializes the link
-static int peer_init_link (struct peer_data *peer);
+static int peer_init_link (struct peer_data *peer, int compact);
 
 // frees link resources
 static void peer_free_link (struct peer_data *peer);
 
+// initializes the TCP fallback link (--peer-tcp-fallback)
+static int peer_init_fallback (struct peer_data *peer);
+
+// frees the TCP fallback link. Frames must not be sent through it.
+static void peer_free_fallback (struct peer_data *peer);
+
+// returns the sink frames for the peer are sent to, of the UDP link
+// or the TCP fallback link
+static DataProtoSink * peer_link_sink (struct peer_data *peer);
+
+// checks if the link works, directly or through the TCP fallback link
+static int peer_link_working (struct peer_data *peer);
+
+// moves frames to the link which works after link state changes, and
+// registers or unregisters the peer as a relay provider
+static void peer_update_link (struct peer_data *peer);
+
 // frees link, relaying, waiting relaying
 static void peer_cleanup_connections (struct peer_data *peer);
 
@@ -264,6 +381,15 @@ static void peer_install_relaying (struct peer_data *peer, struct peer_data *rel
 // uninstall relaying for a peer
 static void peer_free_relaying (struct peer_data *peer);
 
+// returns the peer's local flow for frames of the given priority class
+static DataProtoFlow * peer_local_dpflow (struct peer_data *peer, int priority);
+
+// attaches the peer's local flows to a sink
+static void peer_attach_local_dpflows (struct peer_data *peer, DataProtoSink *sink);
+
+// detaches the peer's local flows
+static void peer_detach_local_dpflows (struct peer_data *peer);
+
 // handle a peer that needs a relay
 static void peer_need_relay (struct peer_data *peer);
 
@@ -285,11 +411,18 @@ static void peer_chat_handler_message (struct peer_data *peer, uint8_t *data, in
 
 // handlers for different message types
 static void peer_msg_youconnect (struct peer_data *peer, uint8_t *data, int data_len);
+
+// picks the TCP fallback link address from a youconnect message, leaving
+// out_addr unchanged if there is no usable one
+static void peer_youconnect_fallback_addr (struct peer_data *peer, msg_youconnectParser *parser, BAddr *out_addr);
 static void peer_msg_cannotconnect (struct peer_data *peer, uint8_t *data, int data_len);
 static void peer_msg_cannotbind (struct peer_data *peer, uint8_t *data, int data_len);
 static void peer_msg_seed (struct peer_data *peer, uint8_t *data, int data_len);
 static void peer_msg_confirmseed (struct peer_data *peer, uint8_t *data, int data_len);
 static void peer_msg_youretry (struct peer_data *peer, uint8_t *data, int data_len);
+static void peer_msg_routes (struct peer_data *peer, uint8_t *data, int data_len);
+static void peer_msg_punch (struct peer_data *peer, uint8_t *data, int data_len);
+static void peer_msg_linkidle (struct peer_data *peer, uint8_t *data, int data_len);
 
 // handler from DatagramPeerIO when we should generate a new OTP send seed
 static void peer_udp_pio_handler_seed_warning (struct peer_data *peer);
@@ -303,6 +436,9 @@ static void peer_udp_pio_handler_error (struct peer_data *peer);
 // handler from StreamPeerIO when an error occurs on the connection
 static void peer_tcp_pio_handler_error (struct peer_data *peer);
 
+// handler from StreamPeerIO of the TCP fallback link when an error occurs on the connection
+static void peer_fallback_pio_handler_error (struct peer_data *peer);
+
 // peer retry timer handler. The timer is used only on the master side,
 // wither when we detect an error, or the peer reports an error.
 static void peer_reset_timer_handler (struct peer_data *peer);
@@ -310,12 +446,27 @@ static void peer_reset_timer_handler (struct peer_data *peer);
 // start binding, according to the protocol
 static void peer_start_binding (struct peer_data *peer);
 
+// checks if the link with the peer is only set up when needed (--peer-link-idle-time)
+static int peer_link_on_demand (struct peer_data *peer);
+
+// notes that the link is wanted, starting the idle timer
+static void peer_set_link_wanted (struct peer_data *peer);
+
+// notes that a frame is being sent to the peer, requesting a link if there is none
+static void peer_frame_routed (struct peer_data *peer);
+
+// frees the link when it is no longer wanted
+static void peer_free_idle_link (struct peer_data *peer);
+
+// idle timer handler, frees the link if no frames were passed since the last time
+static void peer_idle_timer_handler (struct peer_data *peer);
+
 // tries binding on one address, according to the protocol
 static void peer_bind (struct peer_data *peer);
 
 static void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont);
 
-static void peer_connect (struct peer_data *peer, BAddr addr, uint8_t *encryption_key, uint64_t password);
+static void peer_connect (struct peer_data *peer, BAddr addr, uint8_t *encryption_key, uint64_t password, BAddr fallback_addr, int compact);
 
 static int peer_start_msg (struct peer_data *peer, void **data, int type, int len);
 
@@ -328,9 +479,17 @@ static void peer_send_conectinfo (struct peer_data *peer, int addr_index, int po
 
 static void peer_send_confirmseed (struct peer_data *peer, uint16_t seed_id);
 
+static void peer_send_routes (struct peer_data *peer);
+
+// sends the addresses our connecting socket may be reachable at
+static void peer_send_punch (struct peer_data *peer);
+
 // handler for peer DataProto up state changes
 static void peer_dataproto_handler (struct peer_data *peer, int up);
 
+// handler for DataProto up state changes of the TCP fallback link
+static void peer_fallback_dataproto_handler (struct peer_data *peer, int up);
+
 // looks for a peer with the given ID
 static struct peer_data * find_peer_by_id (peerid_t id);
 
@@ -340,6 +499,29 @@ static void device_error_handler (void *unused);
 // DataProtoSource handler for packets from the device
 static void device_dpsource_handler (void *unused, const uint8_t *frame, int frame_len);
 
+// checks if frames are sent in priority classes (--qos-dscp, --qos-port)
+static int qos_enabled (void);
+
+// determines the DataProto priority class of a frame from the device
+static int device_frame_priority (const uint8_t *frame, int frame_len);
+
+// returns the relay through which a frame for the peer can be sent together
+// with frames for other peers, or NULL
+static struct peer_data * device_multidest_relay (struct peer_data *peer);
+
+// routes the current device frame to the destinations collected for a relay
+static void device_route_multidest (struct peer_data *relay, int priority, int more);
+
+// returns the cost of sending through the peer's link, from its measured
+// quality; lower is better
+static int peer_link_cost (struct peer_data *peer);
+
+// logs the measured quality of the peer's link
+static void peer_log_link_quality (struct peer_data *peer, int level);
+
+// logs the latencies of the packets traced since the last report
+static void trace_timer_handler (void *unused);
+
 // assign relays to clients waiting for them
 static void assign_relays (void);
 
@@ -356,6 +538,8 @@ static void server_handler_message (void *user, peerid_t peer_id, uint8_t *data,
 // jobs
 static void peer_job_send_seed (struct peer_data *peer);
 static void peer_job_init (struct peer_data *peer);
+static void peer_job_send_routes (struct peer_data *peer);
+static void peer_job_want_link (struct peer_data *peer);
 
 // server flows
 static struct server_flow * server_flow_init (void);
@@ -475,11 +659,30 @@ int main (int argc, char *argv[])
         goto fail1;
     }
     
+    // bind to CPUs before allocating anything large, so that our memory
+    // is placed on their NUMA node; threads started later inherit this
+    if (!BCpuSet_IsEmpty(&options.cpu_affinity) && !BCpuSet_BindThread(&options.cpu_affinity)) {
+        BLog(BLOG_ERROR, "BCpuSet_BindThread failed");
+        goto fail1;
+    }
+    
+    // map the packet buffer arena, after binding so that it is on our NUMA node
+    if (options.buffer_arena > 0) {
+        if (!BBufferArena_Enable((size_t)options.buffer_arena * 1024 * 1024)) {
+            BLog(BLOG_ERROR, "BBufferArena_Enable failed");
+            goto fail1;
+        }
+        BLog(BLOG_INFO, "buffer arena uses %s huge pages", (BBufferArena_IsHugeTLB() ? "reserved" : "transparent"));
+    }
+    
     // init reactor
     if (!BReactor_Init(&ss)) {
         BLog(BLOG_ERROR, "BReactor_Init failed");
         goto fail1;
     }
+    BReactor_SetBusyPoll(&ss, options.busy_poll);
+    BReactor_SetStallThreshold(&ss, options.stall_threshold);
+    BReactor_SetJobBudget(&ss, options.job_budget);
     
     // setup signal handler
     if (!BSignal_Init(&ss, signal_handler, NULL)) {
@@ -487,14 +690,25 @@ int main (int argc, char *argv[])
         goto fail2;
     }
     
-    // init thread work dispatcher
-    if (!BThreadWorkDispatcher_Init(&twd, &ss, options.threads)) {
-        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init failed");
+#ifndef BADVPN_USE_WINAPI
+    // report memory usage on SIGUSR1
+    sigset_t report_signals;
+    sigemptyset(&report_signals);
+    sigaddset(&report_signals, SIGUSR1);
+    if (!BUnixSignal_Init(&report_signal, &ss, report_signals, report_signal_handler, NULL)) {
+        BLog(BLOG_ERROR, "BUnixSignal_Init failed");
         goto fail3;
     }
+#endif
+    
+    // init thread work dispatcher
+    if (!BThreadWorkDispatcher_Init2(&twd, &ss, options.threads, &options.worker_cpus)) {
+        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init2 failed");
+        goto fail3a;
+    }
     
     // init BSecurity
-    if (BThreadWorkDispatcher_UsingThreads(&twd)) {
+    if (BThreadWorkDispatcher_UsingThreads(&twd) || options.peer_threads > 0) {
         if (!BSecurity_GlobalInitThreadSafe()) {
             BLog(BLOG_ERROR, "BSecurity_GlobalInitThreadSafe failed");
             goto fail4;
@@ -503,10 +717,10 @@ int main (int argc, char *argv[])
     
     // init listeners
     int num_listeners = 0;
-    if (options.transport_mode == TRANSPORT_MODE_TCP) {
+    if (options.transport_mode == TRANSPORT_MODE_TCP || options.peer_tcp_fallback) {
         while (num_listeners < num_bind_addrs) {
             struct bind_addr *addr = &bind_addrs[num_listeners];
-            if (!PasswordListener_Init(&listeners[num_listeners], &ss, &twd, addr->addr, TCP_MAX_PASSWORD_LISTENER_CLIENTS, options.peer_ssl, ssl_flags(), client_cert, client_key)) {
+            if (!PasswordListener_Init(&listeners[num_listeners], &ss, &twd, addr->addr, TCP_MAX_PASSWORD_LISTENER_CLIENTS, TCP_MAX_PASSWORD_LISTENER_PENDING, options.peer_ssl, ssl_flags(), client_cert, client_key)) {
                 BLog(BLOG_ERROR, "PasswordListener_Init failed");
                 goto fail8;
             }
@@ -514,10 +728,20 @@ int main (int argc, char *argv[])
         }
     }
     
+    // start tracing packets, before the device is read from
+    if (options.trace_packets > 0) {
+        BMetrics_Enable();
+        BPacketTrace_Enable(options.trace_packets);
+        memset(trace_last_buckets, 0, sizeof(trace_last_buckets));
+        trace_last_dropped = 0;
+        BTimer_Init(&trace_timer, CLIENT_TRACE_REPORT_INTERVAL, trace_timer_handler, NULL);
+        BReactor_SetTimer(&ss, &trace_timer);
+    }
+    
     // init device
-    if (!BTap_Init(&device, &ss, options.tapdev, device_error_handler, NULL, 0)) {
+    if (!BTap_Init(&device, &ss, options.tapdev, device_error_handler, NULL, options.tun)) {
         BLog(BLOG_ERROR, "BTap_Init failed");
-        goto fail8;
+        goto fail8a;
     }
     
     // remember device MTU
@@ -532,24 +756,68 @@ int main (int argc, char *argv[])
     }
     data_mtu = DATAPROTO_MAX_OVERHEAD + device_mtu;
     
+    // init pool for peers' send buffers
+    if (options.send_buffer_pool_size > 0) {
+        RouteBufferPool_Init(&device_send_pool, data_mtu, options.send_buffer_pool_size);
+    }
+    
     // init device input
     if (!DataProtoSource_Init(&device_dpsource, BTap_GetOutput(&device), device_dpsource_handler, NULL, &ss)) {
         BLog(BLOG_ERROR, "DataProtoSource_Init failed");
-        goto fail9;
+        goto fail9a;
     }
     
     // init device output
-    if (!DPReceiveDevice_Init(&device_output_dprd, device_mtu, (DPReceiveDevice_output_func)BTap_Send, &device, &ss, options.send_buffer_relay_size, PEER_RELAY_FLOW_INACTIVITY_TIME)) {
+    if (!DPReceiveDevice_Init(&device_output_dprd, device_mtu, (DPReceiveDevice_output_func)BTap_Send, &device, &ss, options.send_buffer_relay_size, options.send_buffer_relay_pool_size, options.send_buffer_codel_target, options.send_buffer_codel_interval, PEER_RELAY_FLOW_INACTIVITY_TIME)) {
         BLog(BLOG_ERROR, "DPReceiveDevice_Init failed");
         goto fail10;
     }
     
+    // init keep-alive timer for peers' links, with faster keep-alives if failing over to TCP
+    DataProtoKeepaliveTimer_Init(&peer_keepalive_timer, &ss, (options.peer_tcp_fallback ? PEER_FALLBACK_KEEPALIVE_INTERVAL : PEER_KEEPALIVE_INTERVAL));
+    
+    // take peer links on the given interface past the kernel network stack
+    if (options.peer_udp_xdp) {
+#ifdef BADVPN_USE_AF_XDP
+        if (!BXdp_Init(&peer_xdp, &ss, options.peer_udp_xdp)) {
+            BLog(BLOG_ERROR, "BXdp_Init failed");
+            goto fail10b;
+        }
+#else
+        BLog(BLOG_ERROR, "AF_XDP is not supported");
+        goto fail10b;
+#endif
+    }
+    
+    // init threads for peers' UDP links
+#ifdef BADVPN_USE_WINAPI
+    if (options.peer_threads > 0) {
+        BLog(BLOG_ERROR, "peer threads are not supported");
+        goto fail10a;
+    }
+#endif
+    if (!DatagramPeerIOGroup_Init(&peer_io_group, &ss, &twd, options.peer_threads)) {
+        BLog(BLOG_ERROR, "DatagramPeerIOGroup_Init failed");
+        goto fail10a;
+    }
+    
     // init peers list
     LinkedList1_Init(&peers);
     num_peers = 0;
     
-    // init frame decider
-    FrameDecider_Init(&frame_decider, options.max_macs, options.max_groups, options.igmp_group_membership_interval, options.igmp_last_member_query_time, &ss);
+    if (options.tun) {
+        // init IP decider
+        if (!IPDecider_Init(&ip_decider, MAX_ROUTES)) {
+            BLog(BLOG_ERROR, "IPDecider_Init failed");
+            goto fail10c;
+        }
+    } else {
+        // init frame decider
+        if (!FrameDecider_Init(&frame_decider, options.max_macs, options.max_groups, options.igmp_group_membership_interval, options.igmp_last_member_query_time, options.proxy_neighbors, options.max_flood_rate, &ss)) {
+            BLog(BLOG_ERROR, "FrameDecider_Init failed");
+            goto fail10c;
+        }
+    }
     
     // init relays list
     LinkedList1_Init(&relays);
@@ -557,6 +825,9 @@ int main (int argc, char *argv[])
     // init need relay list
     LinkedList1_Init(&waiting_relay_peers);
     
+    // init multi-destination relays list
+    LinkedList1_Init(&multidest_relays);
+    
     // start connecting to server
     if (!ServerConnection_Init(&server, &ss, &twd, server_addr, SC_KEEPALIVE_INTERVAL, SERVER_BUFFER_MIN_PACKETS, options.ssl, ssl_flags(), client_cert, client_key, server_name, NULL,
                                server_handler_error, server_handler_ready, server_handler_newclient, server_handler_endclient, server_handler_message
@@ -565,6 +836,15 @@ int main (int argc, char *argv[])
         goto fail11;
     }
     
+    // apply socket options once connected
+    ServerConnection_SetSocketOptions(&server, &options.server_socket_options);
+    
+    // keep certificates of peers across restarts
+    if (options.peer_cert_cache && !ServerConnection_SetCertCache(&server, options.peer_cert_cache)) {
+        BLog(BLOG_ERROR, "ServerConnection_SetCertCache failed");
+        goto fail12;
+    }
+    
     // set server not ready
     server_ready = 0;
     
@@ -598,30 +878,58 @@ int main (int argc, char *argv[])
     if (server_ready) {
         PacketPassFairQueue_Free(&server_queue);
     }
+fail12:
     ServerConnection_Free(&server);
 fail11:
-    FrameDecider_Free(&frame_decider);
+    if (options.tun) {
+        IPDecider_Free(&ip_decider);
+    } else {
+        FrameDecider_Free(&frame_decider);
+    }
+fail10c:
+    DatagramPeerIOGroup_Free(&peer_io_group);
+fail10a:
+#ifdef BADVPN_USE_AF_XDP
+    if (options.peer_udp_xdp) {
+        BXdp_Free(&peer_xdp);
+    }
+#endif
+fail10b:
+    DataProtoKeepaliveTimer_Free(&peer_keepalive_timer);
     DPReceiveDevice_Free(&device_output_dprd);
 fail10:
     DataProtoSource_Free(&device_dpsource);
+fail9a:
+    if (options.send_buffer_pool_size > 0) {
+        RouteBufferPool_Free(&device_send_pool);
+    }
 fail9:
     BTap_Free(&device);
+fail8a:
+    if (options.trace_packets > 0) {
+        BReactor_RemoveTimer(&ss, &trace_timer);
+    }
 fail8:
-    if (options.transport_mode == TRANSPORT_MODE_TCP) {
+    if (options.transport_mode == TRANSPORT_MODE_TCP || options.peer_tcp_fallback) {
         while (num_listeners-- > 0) {
             PasswordListener_Free(&listeners[num_listeners]);
         }
     }
-    if (BThreadWorkDispatcher_UsingThreads(&twd)) {
+    if (BThreadWorkDispatcher_UsingThreads(&twd) || options.peer_threads > 0) {
         BSecurity_GlobalFreeThreadSafe();
     }
 fail4:
     // NOTE: BThreadWorkDispatcher must be freed before NSPR and stuff
     BThreadWorkDispatcher_Free(&twd);
+fail3a:
+#ifndef BADVPN_USE_WINAPI
+    BUnixSignal_Free(&report_signal, 0);
+#endif
 fail3:
     BSignal_Finish();
 fail2:
     BReactor_Free(&ss);
+    BMetrics_Free();
 fail1:
     if (options.ssl) {
         CERT_DestroyCertificate(client_cert);
@@ -670,10 +978,16 @@ void print_help (const char *name)
         "        [--threads <integer>]\n"
         "        [--use-threads-for-ssl-handshake]\n"
         "        [--use-threads-for-ssl-data]\n"
+        "        [--cpu-affinity <cpu-list>]\n"
+        "        [--worker-cpus <cpu-list>]\n"
+        "        [--buffer-arena <megabytes>]\n"
         "        [--ssl --nssdb <string> --client-cert-name <string>]\n"
         "        [--server-name <string>]\n"
+        "        [--peer-cert-cache <directory>]\n"
         "        --server-addr <addr>\n"
         "        [--tapdev <name>]\n"
+        "        [--tun]\n"
+        "        [--route <addr>/<prefix>] ...\n"
         "        [--scope <scope_name>] ...\n"
         "        [\n"
         "            --bind-addr <addr>\n"
@@ -682,23 +996,54 @@ void print_help (const char *name)
         "        ] ...\n"
         "        --transport-mode <udp/tcp>\n"
         "        (transport-mode=udp?\n"
-        "            --encryption-mode <blowfish/aes/none>\n"
-        "            --hash-mode <md5/sha1/none>\n"
-        "            [--otp <blowfish/aes> <num> <num-warn>]\n"
+        "            --encryption-mode <blowfish/aes/aes256/aes-gcm/chacha20-poly1305/none>\n"
+        "            --hash-mode <md5/sha1/sha256/hmac-sha256/siphash24/none>\n"
+        "            [--otp <blowfish/aes/aes256> <num> <num-warn>]\n"
+        "            [--replay-window <packets>]\n"
         "            [--fragmentation-latency <milliseconds>]\n"
+        "            [--pmtu-discovery <max-datagram-size>]\n"
+        "            [--fec <group-size>]\n"
+        "            [--peer-udp-sockets <num>]\n"
+        "            [--peer-udp-offload]\n"
+        "            [--peer-udp-xdp <interface>]\n"
+        "            [--peer-threads <num>]\n"
+        "            [--spproto-batch-size <packets>]\n"
+        "            [--spproto-window <works>]\n"
+        "            [--peer-tcp-fallback]\n"
         "        )\n"
         "        (transport-mode=tcp?\n"
+        "            [--encryption-mode <aes-gcm/chacha20-poly1305/none>]\n"
+        "            [--replay-window <packets>]\n"
+        "        )\n"
+        "        (transport-mode=tcp or peer-tcp-fallback?\n"
         "            (ssl? [--peer-ssl])\n"
         "            [--peer-tcp-socket-sndbuf <bytes / 0>]\n"
+        "            [--peer-tcp-socket-options <options>]\n"
         "        )\n"
+        "        [--server-socket-options <options>]\n"
+        "        [--busy-poll <microseconds>]\n"
+        "        [--stall-threshold <ms>]\n"
+        "        [--job-budget <number>]\n"
         "        [--send-buffer-size <num-packets>]\n"
         "        [--send-buffer-relay-size <num-packets>]\n"
+        "        [--send-buffer-relay-pool-size <num-packets>]\n"
+        "        [--send-buffer-pool-size <num-packets>]\n"
+        "        [--send-buffer-codel-target <ms> [--send-buffer-codel-interval <ms>]]\n"
         "        [--max-macs <num>]\n"
         "        [--max-groups <num>]\n"
         "        [--igmp-group-membership-interval <ms>]\n"
         "        [--igmp-last-member-query-time <ms>]\n"
+        "        [--proxy-neighbors]\n"
+        "        [--max-flood-rate <frames-per-second>]\n"
         "        [--allow-peer-talk-without-ssl]\n"
+        "        [--relay-multidest]\n"
+        "        [--compress]\n"
+        "        [--compact-headers]\n"
         "        [--max-peers <number>]\n"
+        "        [--peer-link-idle-time <ms>]\n"
+        "        [--qos-dscp <min-dscp>]\n"
+        "        [--qos-port <port>] ...\n"
+        "        [--trace-packets <interval>]\n"
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
@@ -729,31 +1074,74 @@ int parse_arguments (int argc, char *argv[])
     options.threads = 0;
     options.use_threads_for_ssl_handshake = 0;
     options.use_threads_for_ssl_data = 0;
+    BCpuSet_Init(&options.cpu_affinity);
+    BCpuSet_Init(&options.worker_cpus);
+    options.buffer_arena = 0;
     options.ssl = 0;
     options.nssdb = NULL;
     options.client_cert_name = NULL;
     options.server_name = NULL;
+    options.peer_cert_cache = NULL;
     options.server_addr = NULL;
     options.tapdev = NULL;
+    options.tun = 0;
+    options.num_routes = 0;
     options.num_scopes = 0;
     options.num_bind_addrs = 0;
     options.transport_mode = -1;
     options.encryption_mode = -1;
     options.hash_mode = -1;
     options.otp_mode = SPPROTO_OTP_MODE_NONE;
+    options.replay_window = 0;
     options.fragmentation_latency = PEER_DEFAULT_UDP_FRAGMENTATION_LATENCY;
+    options.pmtu_discovery_max_mtu = -1;
+    options.fec_group_size = 0;
+    options.peer_udp_sockets = 1;
+    options.peer_udp_offload = 0;
+    options.peer_udp_xdp = NULL;
+    options.peer_threads = 0;
+    options.peer_tcp_fallback = 0;
+    options.spproto_batch_size = PEER_DEFAULT_SPPROTO_BATCH_SIZE;
+    options.spproto_window = PEER_DEFAULT_SPPROTO_WINDOW;
     options.peer_ssl = 0;
     options.peer_tcp_socket_sndbuf = -1;
+    BConnection_options_Init(&options.peer_tcp_socket_options);
+    BConnection_options_Init(&options.server_socket_options);
+    options.busy_poll = 0;
+    options.stall_threshold = 0;
+    options.job_budget = 0;
     options.send_buffer_size = PEER_DEFAULT_SEND_BUFFER_SIZE;
     options.send_buffer_relay_size = PEER_DEFAULT_SEND_BUFFER_RELAY_SIZE;
+    options.send_buffer_relay_pool_size = 0;
+    options.send_buffer_pool_size = 0;
+    options.send_buffer_codel_target = 0;
+    options.send_buffer_codel_interval = PEER_DEFAULT_SEND_BUFFER_CODEL_INTERVAL;
     options.max_macs = PEER_DEFAULT_MAX_MACS;
     options.max_groups = PEER_DEFAULT_MAX_GROUPS;
     options.igmp_group_membership_interval = DEFAULT_IGMP_GROUP_MEMBERSHIP_INTERVAL;
     options.igmp_last_member_query_time = DEFAULT_IGMP_LAST_MEMBER_QUERY_TIME;
+    options.proxy_neighbors = 0;
+    options.max_flood_rate = 0;
     options.allow_peer_talk_without_ssl = 0;
+    options.relay_multidest = 0;
+    options.compress = 0;
+    options.compact_headers = 0;
     options.max_peers = DEFAULT_MAX_PEERS;
+    options.peer_link_idle_time = -1;
+    options.qos_dscp = -1;
+    options.num_qos_ports = 0;
+    options.trace_packets = 0;
     
     int have_fragmentation_latency = 0;
+    int have_pmtu_discovery = 0;
+    int have_fec = 0;
+    int have_peer_udp_sockets = 0;
+    int have_peer_udp_offload = 0;
+    int have_peer_udp_xdp = 0;
+    int have_peer_threads = 0;
+    int have_spproto_batch_size = 0;
+    int have_send_buffer_codel_interval = 0;
+    int have_spproto_window = 0;
     
     int i;
     for (i = 1; i < argc; i++) {
@@ -845,6 +1233,39 @@ int parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--use-threads-for-ssl-data")) {
             options.use_threads_for_ssl_data = 1;
         }
+        else if (!strcmp(arg, "--cpu-affinity")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BCpuSet_InitParse(&options.cpu_affinity, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--buffer-arena")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.buffer_arena = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--worker-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BCpuSet_InitParse(&options.worker_cpus, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--ssl")) {
             options.ssl = 1;
         }
@@ -872,6 +1293,14 @@ int parse_arguments (int argc, char *argv[])
             options.server_name = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--peer-cert-cache")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.peer_cert_cache = argv[i + 1];
+            i++;
+        }
         else if (!strcmp(arg, "--server-addr")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -888,6 +1317,22 @@ int parse_arguments (int argc, char *argv[])
             options.tapdev = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--tun")) {
+            options.tun = 1;
+        }
+        else if (!strcmp(arg, "--route")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (options.num_routes == MAX_ROUTES) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            options.routes[options.num_routes] = argv[i + 1];
+            options.num_routes++;
+            i++;
+        }
         else if (!strcmp(arg, "--scope")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -986,6 +1431,15 @@ int parse_arguments (int argc, char *argv[])
             else if (!strcmp(arg2, "aes")) {
                 options.encryption_mode = BENCRYPTION_CIPHER_AES;
             }
+            else if (!strcmp(arg2, "aes256")) {
+                options.encryption_mode = BENCRYPTION_CIPHER_AES256;
+            }
+            else if (!strcmp(arg2, "aes-gcm")) {
+                options.encryption_mode = BAEAD_CIPHER_AES128_GCM;
+            }
+            else if (!strcmp(arg2, "chacha20-poly1305")) {
+                options.encryption_mode = BAEAD_CIPHER_CHACHA20_POLY1305;
+            }
             else {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
@@ -1007,6 +1461,15 @@ int parse_arguments (int argc, char *argv[])
             else if (!strcmp(arg2, "sha1")) {
                 options.hash_mode = BHASH_TYPE_SHA1;
             }
+            else if (!strcmp(arg2, "sha256")) {
+                options.hash_mode = BHASH_TYPE_SHA256;
+            }
+            else if (!strcmp(arg2, "hmac-sha256")) {
+                options.hash_mode = BHASH_TYPE_HMAC_SHA256;
+            }
+            else if (!strcmp(arg2, "siphash24")) {
+                options.hash_mode = BHASH_TYPE_SIPHASH24;
+            }
             else {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
@@ -1027,6 +1490,9 @@ int parse_arguments (int argc, char *argv[])
             else if (!strcmp(otp_mode, "aes")) {
                 options.otp_mode = BENCRYPTION_CIPHER_AES;
             }
+            else if (!strcmp(otp_mode, "aes256")) {
+                options.otp_mode = BENCRYPTION_CIPHER_AES256;
+            }
             else {
                 fprintf(stderr, "%s: wrong mode\n", arg);
                 return 0;
@@ -1042,6 +1508,18 @@ int parse_arguments (int argc, char *argv[])
             }
             i += 3;
         }
+        else if (!strcmp(arg, "--replay-window")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.replay_window = atoi(argv[i + 1]);
+            if (options.replay_window <= 0 || options.replay_window > SPPROTO_MAX_REPLAY_WINDOW) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--fragmentation-latency")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -1051,6 +1529,94 @@ int parse_arguments (int argc, char *argv[])
             have_fragmentation_latency = 1;
             i++;
         }
+        else if (!strcmp(arg, "--pmtu-discovery")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.pmtu_discovery_max_mtu = atoi(argv[i + 1])) < CLIENT_UDP_MTU || options.pmtu_discovery_max_mtu > CLIENT_UDP_MAX_MTU) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_pmtu_discovery = 1;
+            i++;
+        }
+        else if (!strcmp(arg, "--fec")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.fec_group_size = atoi(argv[i + 1])) <= 0 || options.fec_group_size > FECPROTO_MAX_GROUP_SIZE) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_fec = 1;
+            i++;
+        }
+        else if (!strcmp(arg, "--peer-udp-sockets")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.peer_udp_sockets = atoi(argv[i + 1])) <= 0 || options.peer_udp_sockets > DATAGRAMPEERIO_MAX_SOCKETS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_peer_udp_sockets = 1;
+            i++;
+        }
+        else if (!strcmp(arg, "--peer-udp-offload")) {
+            options.peer_udp_offload = 1;
+            have_peer_udp_offload = 1;
+        }
+        else if (!strcmp(arg, "--peer-udp-xdp")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.peer_udp_xdp = argv[i + 1];
+            have_peer_udp_xdp = 1;
+            i++;
+        }
+        else if (!strcmp(arg, "--peer-threads")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.peer_threads = atoi(argv[i + 1])) < 0 || options.peer_threads > DATAGRAMPEERIOGROUP_MAX_THREADS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_peer_threads = 1;
+            i++;
+        }
+        else if (!strcmp(arg, "--spproto-batch-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.spproto_batch_size = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_spproto_batch_size = 1;
+            i++;
+        }
+        else if (!strcmp(arg, "--spproto-window")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.spproto_window = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_spproto_window = 1;
+            i++;
+        }
+        else if (!strcmp(arg, "--peer-tcp-fallback")) {
+            options.peer_tcp_fallback = 1;
+        }
         else if (!strcmp(arg, "--peer-ssl")) {
             options.peer_ssl = 1;
         }
@@ -1065,97 +1631,271 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
-        else if (!strcmp(arg, "--send-buffer-size")) {
+        else if (!strcmp(arg, "--peer-tcp-socket-options")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            if ((options.send_buffer_size = atoi(argv[i + 1])) <= 0) {
+            if (!BConnection_options_Parse(&options.peer_tcp_socket_options, argv[i + 1])) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
             i++;
         }
-        else if (!strcmp(arg, "--send-buffer-relay-size")) {
+        else if (!strcmp(arg, "--server-socket-options")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            if ((options.send_buffer_relay_size = atoi(argv[i + 1])) <= 0) {
+            if (!BConnection_options_Parse(&options.server_socket_options, argv[i + 1])) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
             i++;
         }
-        else if (!strcmp(arg, "--max-macs")) {
+        else if (!strcmp(arg, "--busy-poll")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            if ((options.max_macs = atoi(argv[i + 1])) <= 0) {
+            if ((options.busy_poll = atoi(argv[i + 1])) < 0) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
             i++;
         }
-        else if (!strcmp(arg, "--max-groups")) {
+        else if (!strcmp(arg, "--stall-threshold")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            if ((options.max_groups = atoi(argv[i + 1])) <= 0) {
+            if ((options.stall_threshold = atoi(argv[i + 1])) < 0) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
             i++;
         }
-        else if (!strcmp(arg, "--igmp-group-membership-interval")) {
+        else if (!strcmp(arg, "--job-budget")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            if ((options.igmp_group_membership_interval = atoi(argv[i + 1])) <= 0) {
+            if ((options.job_budget = atoi(argv[i + 1])) < 0) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
             i++;
         }
-        else if (!strcmp(arg, "--igmp-last-member-query-time")) {
+        else if (!strcmp(arg, "--send-buffer-size")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            if ((options.igmp_last_member_query_time = atoi(argv[i + 1])) <= 0) {
+            if ((options.send_buffer_size = atoi(argv[i + 1])) <= 0) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
             i++;
         }
-        else if (!strcmp(arg, "--max-peers")) {
+        else if (!strcmp(arg, "--send-buffer-relay-size")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            if ((options.max_peers = atoi(argv[i + 1])) <= 0) {
+            if ((options.send_buffer_relay_size = atoi(argv[i + 1])) <= 0) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return 0;
             }
             i++;
         }
-        else if (!strcmp(arg, "--allow-peer-talk-without-ssl")) {
-            options.allow_peer_talk_without_ssl = 1;
+        else if (!strcmp(arg, "--send-buffer-pool-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.send_buffer_pool_size = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
         }
-        else {
-            fprintf(stderr, "unknown option: %s\n", arg);
-            return 0;
+        else if (!strcmp(arg, "--send-buffer-codel-target")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.send_buffer_codel_target = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
         }
-    }
-    
-    if (options.help || options.version) {
-        return 1;
-    }
-    
-    if (options.ssl != !!options.nssdb) {
+        else if (!strcmp(arg, "--send-buffer-codel-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.send_buffer_codel_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            have_send_buffer_codel_interval = 1;
+            i++;
+        }
+        else if (!strcmp(arg, "--send-buffer-relay-pool-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.send_buffer_relay_pool_size = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--max-macs")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.max_macs = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--max-groups")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.max_groups = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--igmp-group-membership-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.igmp_group_membership_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--igmp-last-member-query-time")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.igmp_last_member_query_time = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--proxy-neighbors")) {
+            options.proxy_neighbors = 1;
+        }
+        else if (!strcmp(arg, "--max-flood-rate")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.max_flood_rate = atoi(argv[i + 1])) < 0 || options.max_flood_rate > MAX_FLOOD_RATE) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--max-peers")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.max_peers = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--allow-peer-talk-without-ssl")) {
+            options.allow_peer_talk_without_ssl = 1;
+        }
+        else if (!strcmp(arg, "--relay-multidest")) {
+            options.relay_multidest = 1;
+        }
+        else if (!strcmp(arg, "--compress")) {
+            options.compress = 1;
+        }
+        else if (!strcmp(arg, "--compact-headers")) {
+            options.compact_headers = 1;
+        }
+        else if (!strcmp(arg, "--qos-dscp")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.qos_dscp = atoi(argv[i + 1])) < 0 || options.qos_dscp > 63) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--qos-port")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (options.num_qos_ports == MAX_QOS_PORTS) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            int port = atoi(argv[i + 1]);
+            if (port <= 0 || port > 65535) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            options.qos_ports[options.num_qos_ports] = port;
+            options.num_qos_ports++;
+            i++;
+        }
+        else if (!strcmp(arg, "--peer-link-idle-time")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.peer_link_idle_time = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--trace-packets")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.trace_packets = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            return 0;
+        }
+    }
+    
+    if (options.help || options.version) {
+        return 1;
+    }
+    
+    if (options.ssl != !!options.nssdb) {
         fprintf(stderr, "False: --ssl <=> --nssdb\n");
         return 0;
     }
@@ -1165,6 +1905,11 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if (!(!options.peer_cert_cache || options.ssl)) {
+        fprintf(stderr, "False: --peer-cert-cache => --ssl\n");
+        return 0;
+    }
+    
     if (!options.server_addr) {
         fprintf(stderr, "False: --server-addr\n");
         return 0;
@@ -1175,8 +1920,18 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
-    if ((options.transport_mode == TRANSPORT_MODE_UDP) != (options.encryption_mode >= 0)) {
-        fprintf(stderr, "False: UDP <=> --encryption-mode\n");
+    if (!(!(options.transport_mode == TRANSPORT_MODE_UDP) || (options.encryption_mode >= 0))) {
+        fprintf(stderr, "False: UDP => --encryption-mode\n");
+        return 0;
+    }
+    
+    if (!(!(options.transport_mode == TRANSPORT_MODE_TCP && options.encryption_mode > 0) || BAEAD_cipher_valid(options.encryption_mode))) {
+        fprintf(stderr, "False: (TCP && --encryption-mode != none) => AEAD --encryption-mode\n");
+        return 0;
+    }
+    
+    if (!(!(options.transport_mode == TRANSPORT_MODE_TCP && options.encryption_mode > 0) || !options.peer_ssl)) {
+        fprintf(stderr, "False: (TCP && --encryption-mode != none) => !--peer-ssl\n");
         return 0;
     }
     
@@ -1185,23 +1940,100 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    if (!(!(BAEAD_cipher_valid(options.encryption_mode) && options.transport_mode == TRANSPORT_MODE_UDP) || options.hash_mode == SPPROTO_HASH_MODE_NONE)) {
+        fprintf(stderr, "False: AEAD --encryption-mode => --hash-mode none\n");
+        return 0;
+    }
+    
+    if (!(!(options.hash_mode > 0 && BHash_type_keyed(options.hash_mode)) || options.encryption_mode != SPPROTO_ENCRYPTION_MODE_NONE)) {
+        fprintf(stderr, "False: keyed --hash-mode => --encryption-mode != none\n");
+        return 0;
+    }
+    
     if (!(!(options.otp_mode != SPPROTO_OTP_MODE_NONE) || (options.transport_mode == TRANSPORT_MODE_UDP))) {
         fprintf(stderr, "False: --otp => UDP\n");
         return 0;
     }
     
+    if (!(!(options.replay_window > 0) || options.encryption_mode > 0)) {
+        fprintf(stderr, "False: --replay-window => --encryption-mode != none\n");
+        return 0;
+    }
+    
     if (!(!have_fragmentation_latency || (options.transport_mode == TRANSPORT_MODE_UDP))) {
         fprintf(stderr, "False: --fragmentation-latency => UDP\n");
         return 0;
     }
     
-    if (!(!options.peer_ssl || (options.ssl && options.transport_mode == TRANSPORT_MODE_TCP))) {
-        fprintf(stderr, "False: --peer-ssl => (--ssl && TCP)\n");
+    if (!(!have_pmtu_discovery || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --pmtu-discovery => UDP\n");
+        return 0;
+    }
+    
+    if (!(!have_fec || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --fec => UDP\n");
+        return 0;
+    }
+    
+    if (!(!have_peer_udp_sockets || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --peer-udp-sockets => UDP\n");
+        return 0;
+    }
+    
+    if (!(!have_peer_udp_offload || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --peer-udp-offload => UDP\n");
+        return 0;
+    }
+    
+    if (!(!have_peer_udp_xdp || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --peer-udp-xdp => UDP\n");
+        return 0;
+    }
+    
+    if (!(!have_peer_threads || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --peer-threads => UDP\n");
+        return 0;
+    }
+    
+    // peer threads allocate buffers and trace packets concurrently, and the
+    // AF_XDP sockets live in the main reactor
+    if (!(options.peer_threads == 0 || (options.buffer_arena == 0 && options.trace_packets == 0 && !options.peer_udp_xdp))) {
+        fprintf(stderr, "False: --peer-threads => (not --buffer-arena and not --trace-packets and not --peer-udp-xdp)\n");
+        return 0;
+    }
+    
+    if (!(!have_spproto_batch_size || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --spproto-batch-size => UDP\n");
+        return 0;
+    }
+    
+    if (!(!have_spproto_window || (options.transport_mode == TRANSPORT_MODE_UDP))) {
+        fprintf(stderr, "False: --spproto-window => UDP\n");
         return 0;
     }
     
-    if (!(!(options.peer_tcp_socket_sndbuf >= 0) || options.transport_mode == TRANSPORT_MODE_TCP)) {
-        fprintf(stderr, "False: --peer-tcp-socket-sndbuf => TCP\n");
+    if (!(options.spproto_batch_size <= INT_MAX / options.spproto_window)) {
+        fprintf(stderr, "False: --spproto-batch-size * --spproto-window <= INT_MAX\n");
+        return 0;
+    }
+    
+    if (!(!have_send_buffer_codel_interval || options.send_buffer_codel_target > 0)) {
+        fprintf(stderr, "False: --send-buffer-codel-interval => --send-buffer-codel-target\n");
+        return 0;
+    }
+    
+    if (!(!options.peer_tcp_fallback || options.transport_mode == TRANSPORT_MODE_UDP)) {
+        fprintf(stderr, "False: --peer-tcp-fallback => UDP\n");
+        return 0;
+    }
+    
+    if (!(!options.peer_ssl || (options.ssl && (options.transport_mode == TRANSPORT_MODE_TCP || options.peer_tcp_fallback)))) {
+        fprintf(stderr, "False: --peer-ssl => (--ssl && (TCP || --peer-tcp-fallback))\n");
+        return 0;
+    }
+    
+    if (!(!(options.peer_tcp_socket_sndbuf >= 0) || options.transport_mode == TRANSPORT_MODE_TCP || options.peer_tcp_fallback)) {
+        fprintf(stderr, "False: --peer-tcp-socket-sndbuf => (TCP || --peer-tcp-fallback)\n");
         return 0;
     }
     
@@ -1289,6 +2121,36 @@ int process_arguments (void)
         num_bind_addrs++;
     }
     
+    // parse routes
+    if (options.num_routes > 0 && !options.tun) {
+        BLog(BLOG_ERROR, "route: only allowed in TUN mode");
+        return 0;
+    }
+    num_routes = 0;
+    for (int i = 0; i < options.num_routes; i++) {
+        struct route *out = &routes[num_routes];
+        MemRef str = MemRef_MakeCstr(options.routes[i]);
+        
+        struct ipv4_ifaddr ifaddr;
+        struct ipv6_ifaddr ifaddr6;
+        if (ipaddr_parse_ipv4_ifaddr(str, &ifaddr)) {
+            out->is_ipv6 = 0;
+            memcpy(out->addr, &ifaddr.addr, 4);
+            out->prefix = ifaddr.prefix;
+        }
+        else if (ipaddr6_parse_ipv6_ifaddr(str, &ifaddr6)) {
+            out->is_ipv6 = 1;
+            memcpy(out->addr, ifaddr6.addr.bytes, 16);
+            out->prefix = ifaddr6.prefix;
+        }
+        else {
+            BLog(BLOG_ERROR, "route: wrong format");
+            return 0;
+        }
+        
+        num_routes++;
+    }
+    
     // initialize SPProto parameters
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
         sp_params.encryption_mode = options.encryption_mode;
@@ -1297,6 +2159,13 @@ int process_arguments (void)
         if (options.otp_mode > 0) {
             sp_params.otp_num = options.otp_num;
         }
+        sp_params.replay_window = options.replay_window;
+    } else {
+        // the stream is encrypted with an AEAD mode instead of TLS, if one is given
+        sp_params.encryption_mode = (options.encryption_mode > 0 ? options.encryption_mode : SPPROTO_ENCRYPTION_MODE_NONE);
+        sp_params.hash_mode = SPPROTO_HASH_MODE_NONE;
+        sp_params.otp_mode = SPPROTO_OTP_MODE_NONE;
+        sp_params.replay_window = options.replay_window;
     }
     
     return 1;
@@ -1321,6 +2190,18 @@ void signal_handler (void *unused)
     terminate();
 }
 
+#ifndef BADVPN_USE_WINAPI
+void report_signal_handler (void *unused, int signo)
+{
+    for (int i = 0; i < BALLOCSTATS_NUM_CATEGORIES; i++) {
+        size_t current;
+        size_t peak;
+        BAllocStats_Get(i, &current, &peak);
+        BLog(BLOG_NOTICE, "memory %s: %" PRIu64 " bytes, peak %" PRIu64 " bytes", BAllocStats_CategoryName(i), (uint64_t)current, (uint64_t)peak);
+    }
+}
+#endif
+
 void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
 {
     ASSERT(server_ready)
@@ -1331,7 +2212,7 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     ASSERT(cert_len <= SCID_NEWCLIENT_MAX_CERT_LEN)
     
     // allocate structure
-    struct peer_data *peer = (struct peer_data *)malloc(sizeof(*peer));
+    struct peer_data *peer = (struct peer_data *)BAllocStats_Alloc(BALLOCSTATS_PEERS, sizeof(*peer));
     if (!peer) {
         BLog(BLOG_ERROR, "peer %d: failed to allocate memory", (int)id);
         goto fail0;
@@ -1357,42 +2238,15 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
             peer_log(peer, BLOG_ERROR, "certificate does not look like DER");
             goto fail1;
         }
-        
-        // copy the certificate and append it a good load of zero bytes,
-        // hopefully preventing the crappy CERT_DecodeCertFromPackage from crashing
-        // by reading past the of its input
-        uint8_t *certbuf = (uint8_t *)malloc(cert_len + 100);
-        if (!certbuf) {
-            peer_log(peer, BLOG_ERROR, "malloc failed");
-            goto fail1;
-        }
-        memcpy(certbuf, cert, cert_len);
-        memset(certbuf + cert_len, 0, 100);
-        
-        // decode certificate, so we can extract the common name
-        CERTCertificate *nsscert = CERT_DecodeCertFromPackage((char *)certbuf, cert_len);
-        if (!nsscert) {
-            peer_log(peer, BLOG_ERROR, "CERT_DecodeCertFromPackage failed (%d)", PORT_GetError());
-            free(certbuf);
-            goto fail1;
-        }
-        
-        free(certbuf);
-        
-        // remember common name
-        if (!(peer->common_name = CERT_GetCommonName(&nsscert->subject))) {
-            peer_log(peer, BLOG_ERROR, "CERT_GetCommonName failed");
-            CERT_DestroyCertificate(nsscert);
-            goto fail1;
-        }
-        
-        CERT_DestroyCertificate(nsscert);
     }
     
     // init and set init job (must be before initing server flow so we can send)
     BPending_Init(&peer->job_init, BReactor_PendingGroup(&ss), (BPending_handler)peer_job_init, peer);
     BPending_Set(&peer->job_init);
     
+    // init routes job
+    BPending_Init(&peer->job_send_routes, BReactor_PendingGroup(&ss), (BPending_handler)peer_job_send_routes, peer);
+    
     // init server flow
     if (!(peer->server_flow = server_flow_init())) {
         peer_log(peer, BLOG_ERROR, "server_flow_init failed");
@@ -1438,19 +2292,36 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     peer->have_resetpeer = 0;
     
     // init local flow
-    if (!DataProtoFlow_Init(&peer->local_dpflow, &device_dpsource, my_id, peer->id, options.send_buffer_size, -1, NULL, NULL)) {
+    RouteBufferPool *send_pool = (options.send_buffer_pool_size > 0 ? &device_send_pool : NULL);
+    if (!DataProtoFlow_Init(&peer->local_dpflow, &device_dpsource, my_id, peer->id, DATAPROTO_PRIORITY_NORMAL, options.send_buffer_size, send_pool, options.send_buffer_codel_target, options.send_buffer_codel_interval, -1, NULL, NULL)) {
         peer_log(peer, BLOG_ERROR, "DataProtoFlow_Init failed");
         goto fail4;
     }
     
-    // init frame decider peer
-    if (!FrameDeciderPeer_Init(&peer->decider_peer, &frame_decider, peer, (BLog_logfunc)peer_logfunc)) {
-        peer_log(peer, BLOG_ERROR, "FrameDeciderPeer_Init failed");
-        goto fail5;
+    // init local flow for high priority frames
+    if (qos_enabled()) {
+        if (!DataProtoFlow_Init(&peer->local_dpflow_high, &device_dpsource, my_id, peer->id, DATAPROTO_PRIORITY_HIGH, options.send_buffer_size, send_pool, options.send_buffer_codel_target, options.send_buffer_codel_interval, -1, NULL, NULL)) {
+            peer_log(peer, BLOG_ERROR, "DataProtoFlow_Init failed");
+            goto fail4a;
+        }
+    }
+    
+    if (options.tun) {
+        // init IP decider peer
+        if (!IPDeciderPeer_Init(&peer->ip_decider_peer, &ip_decider, peer, (BLog_logfunc)peer_logfunc)) {
+            peer_log(peer, BLOG_ERROR, "IPDeciderPeer_Init failed");
+            goto fail5;
+        }
+    } else {
+        // init frame decider peer
+        if (!FrameDeciderPeer_Init(&peer->decider_peer, &frame_decider, peer, (BLog_logfunc)peer_logfunc)) {
+            peer_log(peer, BLOG_ERROR, "FrameDeciderPeer_Init failed");
+            goto fail5;
+        }
     }
     
     // init receive peer
-    DPReceivePeer_Init(&peer->receive_peer, &device_output_dprd, peer->id, &peer->decider_peer, !!(peer->flags & SCID_NEWCLIENT_FLAG_RELAY_CLIENT));
+    DPReceivePeer_Init(&peer->receive_peer, &device_output_dprd, peer->id, (options.tun ? NULL : &peer->decider_peer), !!(peer->flags & SCID_NEWCLIENT_FLAG_RELAY_CLIENT));
     
     // have no link
     peer->have_link = 0;
@@ -1470,6 +2341,23 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     // init binding
     peer->binding = 0;
     
+    // link not wanted yet
+    peer->link_wanted = 0;
+    peer->link_up = 0;
+    peer->frame_sent = 0;
+    BPending_Init(&peer->job_want_link, BReactor_PendingGroup(&ss), (BPending_handler)peer_job_want_link, peer);
+    BTimer_InitCoarse(&peer->idle_timer, options.peer_link_idle_time, (BTimer_handler)peer_idle_timer_handler, peer);
+    
+    // start decoding the certificate, so we can extract the common name; this
+    // is done with the work dispatcher so that, when many peers are added at
+    // once, certificates are decoded in parallel and don't hold up the event loop
+    peer->cert_decoding = 0;
+    if (options.ssl) {
+        peer->cert_work_common_name = NULL;
+        BThreadWork_Init(&peer->cert_work, &twd, (BThreadWork_handler_done)peer_cert_work_handler_done, peer, (BThreadWork_work_func)peer_cert_work_func, peer);
+        peer->cert_decoding = 1;
+    }
+    
     // add to peers list
     LinkedList1_Append(&peers, &peer->list_node);
     num_peers++;
@@ -1489,6 +2377,10 @@ void peer_add (peerid_t id, int flags, const uint8_t *cert, int cert_len)
     return;
     
 fail5:
+    if (qos_enabled()) {
+        DataProtoFlow_Free(&peer->local_dpflow_high);
+    }
+fail4a:
     DataProtoFlow_Free(&peer->local_dpflow);
 fail4:
     server_flow_disconnect(peer->server_flow);
@@ -1496,16 +2388,75 @@ fail4:
 fail3:
     server_flow_free(peer->server_flow);
 fail2:
+    BPending_Free(&peer->job_send_routes);
     BPending_Free(&peer->job_init);
-    if (peer->common_name) {
-        PORT_Free(peer->common_name);
-    }
 fail1:
-    free(peer);
+    BAllocStats_Free(peer);
 fail0:
     return;
 }
 
+void peer_cert_work_func (struct peer_data *peer)
+{
+    // NOTE: this may run in another thread; only the cert_work_* fields
+    // may be written, and nothing may be logged
+    
+    peer->cert_work_failed = NULL;
+    
+    // copy the certificate and append it a good load of zero bytes,
+    // hopefully preventing the crappy CERT_DecodeCertFromPackage from crashing
+    // by reading past the of its input
+    uint8_t *certbuf = (uint8_t *)malloc(peer->cert_len + 100);
+    if (!certbuf) {
+        peer->cert_work_failed = "malloc";
+        peer->cert_work_error = 0;
+        return;
+    }
+    memcpy(certbuf, peer->cert, peer->cert_len);
+    memset(certbuf + peer->cert_len, 0, 100);
+    
+    // decode certificate
+    CERTCertificate *nsscert = CERT_DecodeCertFromPackage((char *)certbuf, peer->cert_len);
+    if (!nsscert) {
+        peer->cert_work_failed = "CERT_DecodeCertFromPackage";
+        peer->cert_work_error = PORT_GetError();
+        free(certbuf);
+        return;
+    }
+    
+    free(certbuf);
+    
+    // extract common name
+    if (!(peer->cert_work_common_name = CERT_GetCommonName(&nsscert->subject))) {
+        peer->cert_work_failed = "CERT_GetCommonName";
+        peer->cert_work_error = PORT_GetError();
+    }
+    
+    CERT_DestroyCertificate(nsscert);
+}
+
+void peer_cert_work_handler_done (struct peer_data *peer)
+{
+    ASSERT(options.ssl)
+    ASSERT(peer->cert_decoding)
+    ASSERT(!peer->common_name)
+    
+    // free work
+    BThreadWork_Free(&peer->cert_work);
+    peer->cert_decoding = 0;
+    
+    if (peer->cert_work_failed) {
+        peer_log(peer, BLOG_ERROR, "%s failed (%d)", peer->cert_work_failed, peer->cert_work_error);
+        peer_remove(peer, 0);
+        return;
+    }
+    
+    // remember common name
+    peer->common_name = peer->cert_work_common_name;
+    
+    peer_log(peer, BLOG_INFO, "certificate decoded");
+}
+
 void peer_remove (struct peer_data *peer, int exiting)
 {
     peer_log(peer, BLOG_INFO, "removing");
@@ -1525,13 +2476,24 @@ void peer_remove (struct peer_data *peer, int exiting)
     // free reset timer
     BReactor_RemoveTimer(&ss, &peer->reset_timer);
     
+    // free on-demand link state
+    BReactor_RemoveTimer(&ss, &peer->idle_timer);
+    BPending_Free(&peer->job_want_link);
+    
     // free receive peer
     DPReceivePeer_Free(&peer->receive_peer);
     
-    // free frame decider
-    FrameDeciderPeer_Free(&peer->decider_peer);
+    // free decider peer
+    if (options.tun) {
+        IPDeciderPeer_Free(&peer->ip_decider_peer);
+    } else {
+        FrameDeciderPeer_Free(&peer->decider_peer);
+    }
     
-    // free local flow
+    // free local flows
+    if (qos_enabled()) {
+        DataProtoFlow_Free(&peer->local_dpflow_high);
+    }
     DataProtoFlow_Free(&peer->local_dpflow);
     
     // free chat
@@ -1556,15 +2518,24 @@ void peer_remove (struct peer_data *peer, int exiting)
     }
     
     // free jobs
+    BPending_Free(&peer->job_send_routes);
     BPending_Free(&peer->job_init);
     
+    // stop decoding the certificate
+    if (peer->cert_decoding) {
+        BThreadWork_Free(&peer->cert_work);
+        if (peer->cert_work_common_name) {
+            PORT_Free(peer->cert_work_common_name);
+        }
+    }
+    
     // free common name
     if (peer->common_name) {
         PORT_Free(peer->common_name);
     }
     
     // free peer structure
-    free(peer);
+    BAllocStats_Free(peer);
 }
 
 void peer_logfunc (struct peer_data *peer)
@@ -1603,7 +2574,7 @@ void peer_free_chat (struct peer_data *peer)
     peer->have_chat = 0;
 }
 
-int peer_init_link (struct peer_data *peer)
+int peer_init_link (struct peer_data *peer, int compact)
 {
     ASSERT(!peer->have_link)
     ASSERT(!peer->relaying_peer)
@@ -1618,20 +2589,27 @@ int peer_init_link (struct peer_data *peer)
     // init transport-specific link objects
     PacketPassInterface *link_if;
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
-        // init DatagramPeerIO
-        if (!DatagramPeerIO_Init(
-            &peer->pio.udp.pio, &ss, data_mtu, CLIENT_UDP_MTU, sp_params,
-            options.fragmentation_latency, PEER_UDP_ASSEMBLER_NUM_FRAMES, recv_if,
-            options.otp_num_warn, &twd, peer,
+        // init DatagramPeerIO, in one of the peer threads if there are any
+        if (!DatagramPeerIOThread_Init(
+            &peer->pio.udp.pio, &peer_io_group, data_mtu, CLIENT_UDP_MTU, options.pmtu_discovery_max_mtu, sp_params,
+            options.fragmentation_latency, PEER_UDP_ASSEMBLER_NUM_FRAMES,
+            options.fec_group_size, PEER_UDP_FEC_FLUSH_LATENCY, compact, options.peer_udp_sockets, recv_if,
+            options.otp_num_warn, options.spproto_batch_size, options.spproto_window, peer,
             (BLog_logfunc)peer_logfunc,
             (DatagramPeerIO_handler_error)peer_udp_pio_handler_error,
             (DatagramPeerIO_handler_otp_warning)peer_udp_pio_handler_seed_warning,
             (DatagramPeerIO_handler_otp_ready)peer_udp_pio_handler_seed_ready
         )) {
-            peer_log(peer, BLOG_ERROR, "DatagramPeerIO_Init failed");
+            peer_log(peer, BLOG_ERROR, "DatagramPeerIOThread_Init failed");
             goto fail1;
         }
         
+        DatagramPeerIOThread_SetBusyPoll(&peer->pio.udp.pio, options.busy_poll);
+        DatagramPeerIOThread_SetSegmentOffload(&peer->pio.udp.pio, options.peer_udp_offload);
+#ifdef BADVPN_USE_AF_XDP
+        DatagramPeerIOThread_SetXdp(&peer->pio.udp.pio, (options.peer_udp_xdp ? &peer_xdp : NULL));
+#endif
+        
         if (SPPROTO_HAVE_OTP(sp_params)) {
             // init send seed state
             peer->pio.udp.sendseed_nextid = 0;
@@ -1641,13 +2619,14 @@ int peer_init_link (struct peer_data *peer)
             BPending_Init(&peer->pio.udp.job_send_seed, BReactor_PendingGroup(&ss), (BPending_handler)peer_job_send_seed, peer);
         }
         
-        link_if = DatagramPeerIO_GetSendInput(&peer->pio.udp.pio);
+        link_if = DatagramPeerIOThread_GetSendInput(&peer->pio.udp.pio);
     } else {
         // init StreamPeerIO
         if (!StreamPeerIO_Init(
             &peer->pio.tcp.pio, &ss, &twd, options.peer_ssl, ssl_flags(),
             (options.peer_ssl ? peer->cert : NULL),
             (options.peer_ssl ? peer->cert_len : -1),
+            sp_params,
             data_mtu,
             (options.peer_tcp_socket_sndbuf >= 0 ? options.peer_tcp_socket_sndbuf : PEER_DEFAULT_TCP_SOCKET_SNDBUF),
             recv_if,
@@ -1658,72 +2637,236 @@ int peer_init_link (struct peer_data *peer)
             goto fail1;
         }
         
+        StreamPeerIO_SetSocketOptions(&peer->pio.tcp.pio, &options.peer_tcp_socket_options);
+        
         link_if = StreamPeerIO_GetSendInput(&peer->pio.tcp.pio);
     }
     
-    // init sending
-    if (!DataProtoSink_Init(&peer->send_dp, &ss, link_if, PEER_KEEPALIVE_INTERVAL, PEER_KEEPALIVE_RECEIVE_TIMER, (DataProtoSink_handler)peer_dataproto_handler, peer)) {
+    // init sending, with faster keep-alives if failing over to TCP
+    btime_t keepalive_receive_timer = (options.peer_tcp_fallback ? PEER_FALLBACK_KEEPALIVE_RECEIVE_TIMER : PEER_KEEPALIVE_RECEIVE_TIMER);
+    if (!DataProtoSink_Init(&peer->send_dp, &ss, link_if, &peer_keepalive_timer, keepalive_receive_timer, options.compress,
+                           options.compact_headers, my_id, peer->id, (DataProtoSink_handler)peer_dataproto_handler, peer)) {
         peer_log(peer, BLOG_ERROR, "DataProto_Init failed");
         goto fail2;
     }
     
-    // attach local flow to our DataProtoSink
-    DataProtoFlow_Attach(&peer->local_dpflow, &peer->send_dp);
+    // received packets are for our DataProtoSink, even when
+    // frames are sent through the fallback link
+    DPReceiveReceiver_SetSink(&peer->receive_receiver, &peer->send_dp);
+    
+    // init TCP fallback link
+    peer->have_fallback = 0;
+    peer->fallback_active = 0;
+    if (options.peer_tcp_fallback && !peer_init_fallback(peer)) {
+        goto fail3;
+    }
+    
+    // attach local flows to our DataProtoSink
+    peer_attach_local_dpflows(peer, &peer->send_dp);
     
     // attach receive peer to our DataProtoSink
     DPReceivePeer_AttachSink(&peer->receive_peer, &peer->send_dp);
     
     // set have link
     peer->have_link = 1;
+    peer->link_up = 0;
+    
+    return 1;
+    
+fail3:
+    DataProtoSink_Free(&peer->send_dp);
+fail2:
+    if (options.transport_mode == TRANSPORT_MODE_UDP) {
+        if (SPPROTO_HAVE_OTP(sp_params)) {
+            BPending_Free(&peer->pio.udp.job_send_seed);
+        }
+        DatagramPeerIOThread_Free(&peer->pio.udp.pio);
+    } else {
+        StreamPeerIO_Free(&peer->pio.tcp.pio);
+    }
+fail1:
+    DPReceiveReceiver_Free(&peer->receive_receiver);
+    return 0;
+}
+
+void peer_free_link (struct peer_data *peer)
+{
+    ASSERT(peer->have_link)
+    ASSERT(!peer->is_relay)
+    
+    ASSERT(!peer->relaying_peer)
+    ASSERT(!peer->waiting_relay)
+    
+    // detach receive peer from our DataProtoSink
+    DPReceivePeer_DetachSink(&peer->receive_peer);
+    
+    // detach local flows from our DataProtoSink
+    peer_detach_local_dpflows(peer);
+    
+    // free TCP fallback link
+    if (peer->have_fallback) {
+        peer->fallback_active = 0;
+        peer_free_fallback(peer);
+    }
+    
+    // free sending
+    DataProtoSink_Free(&peer->send_dp);
+    
+    // free transport-specific link objects
+    if (options.transport_mode == TRANSPORT_MODE_UDP) {
+        if (SPPROTO_HAVE_OTP(sp_params)) {
+            BPending_Free(&peer->pio.udp.job_send_seed);
+        }
+        DatagramPeerIOThread_Free(&peer->pio.udp.pio);
+    } else {
+        StreamPeerIO_Free(&peer->pio.tcp.pio);
+    }
+    
+    // free receive receiver
+    DPReceiveReceiver_Free(&peer->receive_receiver);
+    
+    // set have no link
+    peer->have_link = 0;
+}
+
+int peer_init_fallback (struct peer_data *peer)
+{
+    ASSERT(options.peer_tcp_fallback)
+    ASSERT(!peer->have_fallback)
+    
+    // init receive receiver
+    DPReceiveReceiver_Init(&peer->fallback.receive_receiver, &peer->receive_peer);
+    PacketPassInterface *recv_if = DPReceiveReceiver_GetInput(&peer->fallback.receive_receiver);
+    
+    // the fallback link doesn't encrypt packets itself
+    struct spproto_security_params fallback_sp_params;
+    memset(&fallback_sp_params, 0, sizeof(fallback_sp_params));
+    
+    // init StreamPeerIO
+    if (!StreamPeerIO_Init(
+        &peer->fallback.pio, &ss, &twd, options.peer_ssl, ssl_flags(),
+        (options.peer_ssl ? peer->cert : NULL),
+        (options.peer_ssl ? peer->cert_len : -1),
+        fallback_sp_params,
+        data_mtu,
+        (options.peer_tcp_socket_sndbuf >= 0 ? options.peer_tcp_socket_sndbuf : PEER_DEFAULT_TCP_SOCKET_SNDBUF),
+        recv_if,
+        (BLog_logfunc)peer_logfunc,
+        (StreamPeerIO_handler_error)peer_fallback_pio_handler_error, peer
+    )) {
+        peer_log(peer, BLOG_ERROR, "StreamPeerIO_Init failed");
+        goto fail1;
+    }
+    
+    StreamPeerIO_SetSocketOptions(&peer->fallback.pio, &options.peer_tcp_socket_options);
+    
+    // init sending
+    if (!DataProtoSink_Init(&peer->fallback.send_dp, &ss, StreamPeerIO_GetSendInput(&peer->fallback.pio), &peer_keepalive_timer, PEER_FALLBACK_KEEPALIVE_RECEIVE_TIMER, options.compress,
+                           options.compact_headers, my_id, peer->id, (DataProtoSink_handler)peer_fallback_dataproto_handler, peer)) {
+        peer_log(peer, BLOG_ERROR, "DataProto_Init failed");
+        goto fail2;
+    }
+    
+    // received packets are for the fallback DataProtoSink
+    DPReceiveReceiver_SetSink(&peer->fallback.receive_receiver, &peer->fallback.send_dp);
+    
+    // set have fallback
+    peer->have_fallback = 1;
+    peer->fallback.link_up = 0;
     
     return 1;
     
 fail2:
-    if (options.transport_mode == TRANSPORT_MODE_UDP) {
-        if (SPPROTO_HAVE_OTP(sp_params)) {
-            BPending_Free(&peer->pio.udp.job_send_seed);
-        }
-        DatagramPeerIO_Free(&peer->pio.udp.pio);
-    } else {
-        StreamPeerIO_Free(&peer->pio.tcp.pio);
-    }
+    StreamPeerIO_Free(&peer->fallback.pio);
 fail1:
-    DPReceiveReceiver_Free(&peer->receive_receiver);
+    DPReceiveReceiver_Free(&peer->fallback.receive_receiver);
     return 0;
 }
 
-void peer_free_link (struct peer_data *peer)
+void peer_free_fallback (struct peer_data *peer)
+{
+    ASSERT(peer->have_fallback)
+    ASSERT(!peer->fallback_active)
+    
+    // free sending
+    DataProtoSink_Free(&peer->fallback.send_dp);
+    
+    // free StreamPeerIO
+    StreamPeerIO_Free(&peer->fallback.pio);
+    
+    // free receive receiver
+    DPReceiveReceiver_Free(&peer->fallback.receive_receiver);
+    
+    // set have no fallback
+    peer->have_fallback = 0;
+}
+
+DataProtoSink * peer_link_sink (struct peer_data *peer)
 {
     ASSERT(peer->have_link)
-    ASSERT(!peer->is_relay)
     
-    ASSERT(!peer->relaying_peer)
-    ASSERT(!peer->waiting_relay)
+    if (peer->fallback_active) {
+        return &peer->fallback.send_dp;
+    }
     
-    // detach receive peer from our DataProtoSink
-    DPReceivePeer_DetachSink(&peer->receive_peer);
+    return &peer->send_dp;
+}
+
+int peer_link_working (struct peer_data *peer)
+{
+    ASSERT(peer->have_link)
     
-    // detach local flow from our DataProtoSink
-    DataProtoFlow_Detach(&peer->local_dpflow);
+    return (peer->link_up || (peer->have_fallback && peer->fallback.link_up));
+}
+
+void peer_update_link (struct peer_data *peer)
+{
+    ASSERT(peer->have_link)
     
-    // free sending
-    DataProtoSink_Free(&peer->send_dp);
+    // use the fallback link while only it works, and go back to UDP as soon as that works
+    int use_fallback = (peer->have_fallback && !peer->link_up && peer->fallback.link_up);
     
-    // free transport-specific link objects
-    if (options.transport_mode == TRANSPORT_MODE_UDP) {
-        if (SPPROTO_HAVE_OTP(sp_params)) {
-            BPending_Free(&peer->pio.udp.job_send_seed);
+    if (use_fallback != peer->fallback_active) {
+        peer_log(peer, BLOG_NOTICE, (use_fallback ? "switching to TCP fallback link" : "switching back to UDP link"));
+        peer_log_link_quality(peer, BLOG_INFO);
+        
+        // detach everything that sends to the peer
+        DPReceivePeer_DetachSink(&peer->receive_peer);
+        peer_detach_local_dpflows(peer);
+        if (peer->is_relay) {
+            for (LinkedList1Node *node = LinkedList1_GetFirst(&peer->relay_users); node; node = LinkedList1Node_Next(node)) {
+                struct peer_data *relay_user = UPPER_OBJECT(node, struct peer_data, relaying_list_node);
+                peer_detach_local_dpflows(relay_user);
+            }
+        }
+        
+        peer->fallback_active = use_fallback;
+        DataProtoSink *sink = peer_link_sink(peer);
+        
+        // attach it to the other link
+        peer_attach_local_dpflows(peer, sink);
+        DPReceivePeer_AttachSink(&peer->receive_peer, sink);
+        if (peer->is_relay) {
+            for (LinkedList1Node *node = LinkedList1_GetFirst(&peer->relay_users); node; node = LinkedList1Node_Next(node)) {
+                struct peer_data *relay_user = UPPER_OBJECT(node, struct peer_data, relaying_list_node);
+                peer_attach_local_dpflows(relay_user, sink);
+            }
         }
-        DatagramPeerIO_Free(&peer->pio.udp.pio);
-    } else {
-        StreamPeerIO_Free(&peer->pio.tcp.pio);
     }
     
-    // free receive receiver
-    DPReceiveReceiver_Free(&peer->receive_receiver);
+    int working = peer_link_working(peer);
     
-    // set have no link
-    peer->have_link = 0;
+    if (working) {
+        // if it can be a relay provided, enable it
+        if ((peer->flags & SCID_NEWCLIENT_FLAG_RELAY_SERVER) && !peer->is_relay) {
+            peer_enable_relay_provider(peer);
+        }
+    } else {
+        // if it is a relay provider, disable it
+        if (peer->is_relay) {
+            peer_disable_relay_provider(peer);
+        }
+    }
 }
 
 void peer_cleanup_connections (struct peer_data *peer)
@@ -1761,6 +2904,9 @@ void peer_enable_relay_provider (struct peer_data *peer)
     // init users list
     LinkedList1_Init(&peer->relay_users);
     
+    // have no collected destinations
+    peer->multidest_num = 0;
+    
     // set is relay
     peer->is_relay = 1;
     
@@ -1810,12 +2956,13 @@ void peer_install_relaying (struct peer_data *peer, struct peer_data *relay)
     ASSERT(relay->have_link)
     
     peer_log(peer, BLOG_INFO, "installing relaying through %d", (int)relay->id);
+    peer_log_link_quality(relay, BLOG_INFO);
     
     // add to relay's users list
     LinkedList1_Append(&relay->relay_users, &peer->relaying_list_node);
     
-    // attach local flow to relay
-    DataProtoFlow_Attach(&peer->local_dpflow, &relay->send_dp);
+    // attach local flows to relay
+    peer_attach_local_dpflows(peer, peer_link_sink(relay));
     
     // set relaying
     peer->relaying_peer = relay;
@@ -1834,8 +2981,8 @@ void peer_free_relaying (struct peer_data *peer)
     
     peer_log(peer, BLOG_INFO, "uninstalling relaying through %d", (int)relay->id);
     
-    // detach local flow from relay
-    DataProtoFlow_Detach(&peer->local_dpflow);
+    // detach local flows from relay
+    peer_detach_local_dpflows(peer);
     
     // remove from relay's users list
     LinkedList1_Remove(&relay->relay_users, &peer->relaying_list_node);
@@ -1844,6 +2991,35 @@ void peer_free_relaying (struct peer_data *peer)
     peer->relaying_peer = NULL;
 }
 
+DataProtoFlow * peer_local_dpflow (struct peer_data *peer, int priority)
+{
+    ASSERT(priority == DATAPROTO_PRIORITY_NORMAL || qos_enabled())
+    
+    if (priority == DATAPROTO_PRIORITY_HIGH) {
+        return &peer->local_dpflow_high;
+    }
+    
+    return &peer->local_dpflow;
+}
+
+void peer_attach_local_dpflows (struct peer_data *peer, DataProtoSink *sink)
+{
+    DataProtoFlow_Attach(&peer->local_dpflow, sink);
+    
+    if (qos_enabled()) {
+        DataProtoFlow_Attach(&peer->local_dpflow_high, sink);
+    }
+}
+
+void peer_detach_local_dpflows (struct peer_data *peer)
+{
+    if (qos_enabled()) {
+        DataProtoFlow_Detach(&peer->local_dpflow_high);
+    }
+    
+    DataProtoFlow_Detach(&peer->local_dpflow);
+}
+
 void peer_need_relay (struct peer_data *peer)
 {
     ASSERT(!peer->is_relay)
@@ -1992,12 +3168,60 @@ void peer_chat_handler_message (struct peer_data *peer, uint8_t *data, int data_
         case MSGID_CONFIRMSEED:
             peer_msg_confirmseed(peer, payload, payload_len);
             return;
+        case MSGID_ROUTES:
+            peer_msg_routes(peer, payload, payload_len);
+            return;
+        case MSGID_PUNCH:
+            peer_msg_punch(peer, payload, payload_len);
+            return;
+        case MSGID_LINKIDLE:
+            peer_msg_linkidle(peer, payload, payload_len);
+            return;
         default:
             BLog(BLOG_NOTICE, "msg: unknown type");
             return;
     }
 }
 
+void peer_youconnect_fallback_addr (struct peer_data *peer, msg_youconnectParser *parser, BAddr *out_addr)
+{
+    uint8_t *addrmsg_data;
+    int addrmsg_len;
+    while (msg_youconnectParser_Gettcpaddr(parser, &addrmsg_data, &addrmsg_len)) {
+        // parse address message
+        msg_youconnect_addrParser aparser;
+        if (!msg_youconnect_addrParser_Init(&aparser, addrmsg_data, addrmsg_len)) {
+            peer_log(peer, BLOG_WARNING, "msg_youconnect: failed to parse TCP fallback address message");
+            return;
+        }
+        
+        // check if the address scope is known
+        uint8_t *name_data = NULL; // to remove warning
+        int name_len = 0; // to remove warning
+        ASSERT_EXECUTE(msg_youconnect_addrParser_Getname(&aparser, &name_data, &name_len))
+        char *name;
+        if (!(name = address_scope_known(name_data, name_len))) {
+            continue;
+        }
+        
+        // read address
+        uint8_t *addr_data = NULL; // to remove warning
+        int addr_len = 0; // to remove warning
+        ASSERT_EXECUTE(msg_youconnect_addrParser_Getaddr(&aparser, &addr_data, &addr_len))
+        BAddr addr;
+        if (!addr_read(addr_data, addr_len, &addr)) {
+            peer_log(peer, BLOG_WARNING, "msg_youconnect: failed to read TCP fallback address");
+            continue;
+        }
+        
+        peer_log(peer, BLOG_INFO, "msg_youconnect: using TCP fallback address in scope '%s'", name);
+        *out_addr = addr;
+        return;
+    }
+    
+    peer_log(peer, BLOG_NOTICE, "msg_youconnect: no usable TCP fallback addresses");
+}
+
 void peer_msg_youconnect (struct peer_data *peer, uint8_t *data, int data_len)
 {
     // init parser
@@ -2055,25 +3279,45 @@ void peer_msg_youconnect (struct peer_data *peer, uint8_t *data, int data_len)
     uint64_t password = 0;
     
     // read additonal parameters
-    if (options.transport_mode == TRANSPORT_MODE_UDP) {
-        if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
-            int key_len;
-            if (!msg_youconnectParser_Getkey(&parser, &key, &key_len)) {
-                peer_log(peer, BLOG_WARNING, "msg_youconnect: no key");
-                return;
-            }
-            if (key_len != BEncryption_cipher_key_size(sp_params.encryption_mode)) {
-                peer_log(peer, BLOG_WARNING, "msg_youconnect: wrong key size");
-                return;
-            }
+    if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+        int key_len;
+        if (!msg_youconnectParser_Getkey(&parser, &key, &key_len)) {
+            peer_log(peer, BLOG_WARNING, "msg_youconnect: no key");
+            return;
         }
-    } else {
+        if (key_len != spproto_encryption_key_size(sp_params)) {
+            peer_log(peer, BLOG_WARNING, "msg_youconnect: wrong key size");
+            return;
+        }
+    }
+    if (options.transport_mode == TRANSPORT_MODE_TCP) {
         if (!msg_youconnectParser_Getpassword(&parser, &password)) {
             peer_log(peer, BLOG_WARNING, "msg_youconnect: no password");
             return;
         }
     }
     
+    // read TCP fallback link parameters
+    BAddr fallback_addr = BAddr_MakeNone();
+    if (options.transport_mode == TRANSPORT_MODE_UDP) {
+        if (options.peer_tcp_fallback && msg_youconnectParser_Getpassword(&parser, &password)) {
+            peer_youconnect_fallback_addr(peer, &parser, &fallback_addr);
+        }
+        msg_youconnectParser_Forwardpassword(&parser);
+        msg_youconnectParser_Forwardtcpaddr(&parser);
+    }
+    
+    // read whether the link uses compact headers
+    int compact = 0;
+    uint8_t compact_value;
+    if (msg_youconnectParser_Getcompact(&parser, &compact_value)) {
+        if (options.transport_mode != TRANSPORT_MODE_UDP || compact_value != 1) {
+            peer_log(peer, BLOG_WARNING, "msg_youconnect: bad compact");
+            return;
+        }
+        compact = 1;
+    }
+    
     if (!msg_youconnectParser_GotEverything(&parser)) {
         peer_log(peer, BLOG_WARNING, "msg_youconnect: stray data");
         return;
@@ -2081,7 +3325,7 @@ void peer_msg_youconnect (struct peer_data *peer, uint8_t *data, int data_len)
     
     peer_log(peer, BLOG_INFO, "connecting");
     
-    peer_connect(peer, addr, key, password);
+    peer_connect(peer, addr, key, password, fallback_addr, compact);
 }
 
 void peer_msg_cannotconnect (struct peer_data *peer, uint8_t *data, int data_len)
@@ -2167,7 +3411,7 @@ void peer_msg_seed (struct peer_data *peer, uint8_t *data, int data_len)
     peer_log(peer, BLOG_DEBUG, "received OTP receive seed");
     
     // add receive seed
-    DatagramPeerIO_AddOTPRecvSeed(&peer->pio.udp.pio, seed_id, key, iv);
+    DatagramPeerIOThread_AddOTPRecvSeed(&peer->pio.udp.pio, seed_id, key, iv);
     
     // remember seed ID so we can confirm it from peer_udp_pio_handler_seed_ready
     peer->pio.udp.pending_recvseed_id = seed_id;
@@ -2216,7 +3460,7 @@ void peer_msg_confirmseed (struct peer_data *peer, uint8_t *data, int data_len)
     peer->pio.udp.sendseed_sent = 0;
     
     // start using the seed
-    DatagramPeerIO_SetOTPSendSeed(&peer->pio.udp.pio, peer->pio.udp.sendseed_sent_id, peer->pio.udp.sendseed_sent_key, peer->pio.udp.sendseed_sent_iv);
+    DatagramPeerIOThread_SetOTPSendSeed(&peer->pio.udp.pio, peer->pio.udp.sendseed_sent_id, peer->pio.udp.sendseed_sent_key, peer->pio.udp.sendseed_sent_iv);
 }
 
 void peer_msg_youretry (struct peer_data *peer, uint8_t *data, int data_len)
@@ -2231,11 +3475,151 @@ void peer_msg_youretry (struct peer_data *peer, uint8_t *data, int data_len)
         return;
     }
     
+    // with on-demand links, this is how the slave asks for one
+    if (peer_link_on_demand(peer) && !peer->link_wanted) {
+        peer_log(peer, BLOG_INFO, "peer needs link");
+        peer_start_binding(peer);
+        return;
+    }
+    
     peer_log(peer, BLOG_NOTICE, "requests reset");
     
     peer_reset(peer);
 }
 
+void peer_msg_routes (struct peer_data *peer, uint8_t *data, int data_len)
+{
+    if (!options.tun) {
+        peer_log(peer, BLOG_WARNING, "msg_routes: not in TUN mode");
+        return;
+    }
+    
+    msg_routesParser parser;
+    if (!msg_routesParser_Init(&parser, data, data_len)) {
+        peer_log(peer, BLOG_WARNING, "msg_routes: failed to parse");
+        return;
+    }
+    
+    // replace routes
+    IPDeciderPeer_ClearRoutes(&peer->ip_decider_peer);
+    
+    uint8_t *route_data;
+    int route_len;
+    while (msg_routesParser_Getroute(&parser, &route_data, &route_len)) {
+        msg_routes_routeParser rparser;
+        if (!msg_routes_routeParser_Init(&rparser, route_data, route_len)) {
+            peer_log(peer, BLOG_WARNING, "msg_routes: failed to parse route");
+            continue;
+        }
+        
+        uint8_t *addr;
+        int addr_len;
+        uint8_t prefix;
+        if (!msg_routes_routeParser_Getaddr(&rparser, &addr, &addr_len) ||
+            !msg_routes_routeParser_Getprefix(&rparser, &prefix)
+        ) {
+            peer_log(peer, BLOG_WARNING, "msg_routes: failed to parse route");
+            return;
+        }
+        
+        int is_ipv6;
+        if (addr_len == 4 && prefix <= 32) {
+            is_ipv6 = 0;
+        }
+        else if (addr_len == 16 && prefix <= 128) {
+            is_ipv6 = 1;
+        }
+        else {
+            peer_log(peer, BLOG_WARNING, "msg_routes: wrong route");
+            continue;
+        }
+        
+        if (!IPDeciderPeer_AddRoute(&peer->ip_decider_peer, is_ipv6, addr, prefix)) {
+            peer_log(peer, BLOG_WARNING, "msg_routes: too many routes");
+            return;
+        }
+    }
+    
+    peer_log(peer, BLOG_INFO, "got %d routes", peer->ip_decider_peer.num_routes);
+}
+
+void peer_msg_punch (struct peer_data *peer, uint8_t *data, int data_len)
+{
+    if (options.transport_mode != TRANSPORT_MODE_UDP) {
+        peer_log(peer, BLOG_WARNING, "msg_punch: not using UDP");
+        return;
+    }
+    
+    if (!peer->binding || !peer->have_link) {
+        peer_log(peer, BLOG_INFO, "msg_punch: not binding");
+        return;
+    }
+    
+    msg_punchParser parser;
+    if (!msg_punchParser_Init(&parser, data, data_len)) {
+        peer_log(peer, BLOG_WARNING, "msg_punch: failed to parse");
+        return;
+    }
+    
+    // try addresses, like with youconnect
+    uint8_t *addrmsg_data;
+    int addrmsg_len;
+    while (msg_punchParser_Getaddr(&parser, &addrmsg_data, &addrmsg_len)) {
+        msg_youconnect_addrParser aparser;
+        if (!msg_youconnect_addrParser_Init(&aparser, addrmsg_data, addrmsg_len)) {
+            peer_log(peer, BLOG_WARNING, "msg_punch: failed to parse address message");
+            return;
+        }
+        
+        // check if the address scope is known
+        uint8_t *name_data = NULL; // to remove warning
+        int name_len = 0; // to remove warning
+        ASSERT_EXECUTE(msg_youconnect_addrParser_Getname(&aparser, &name_data, &name_len))
+        char *name;
+        if (!(name = address_scope_known(name_data, name_len))) {
+            continue;
+        }
+        
+        // read address
+        uint8_t *addr_data = NULL; // to remove warning
+        int addr_len = 0; // to remove warning
+        ASSERT_EXECUTE(msg_youconnect_addrParser_Getaddr(&aparser, &addr_data, &addr_len))
+        BAddr addr;
+        if (!addr_read(addr_data, addr_len, &addr)) {
+            peer_log(peer, BLOG_WARNING, "msg_punch: failed to read address");
+            continue;
+        }
+        
+        if (DatagramPeerIOThread_Punch(&peer->pio.udp.pio, addr)) {
+            peer_log(peer, BLOG_NOTICE, "msg_punch: sending to address in scope '%s'", name);
+            return;
+        }
+    }
+    
+    peer_log(peer, BLOG_INFO, "msg_punch: no usable addresses");
+}
+
+void peer_msg_linkidle (struct peer_data *peer, uint8_t *data, int data_len)
+{
+    if (data_len != 0) {
+        peer_log(peer, BLOG_WARNING, "msg_linkidle: invalid length");
+        return;
+    }
+    
+    if (!peer_link_on_demand(peer)) {
+        peer_log(peer, BLOG_WARNING, "msg_linkidle: link is not on demand");
+        return;
+    }
+    
+    if (!peer->link_wanted) {
+        return;
+    }
+    
+    peer_log(peer, BLOG_INFO, "peer freed idle link");
+    
+    peer_free_idle_link(peer);
+}
+
 void peer_udp_pio_handler_seed_warning (struct peer_data *peer)
 {
     ASSERT(options.transport_mode == TRANSPORT_MODE_UDP)
@@ -2280,22 +3664,114 @@ void peer_tcp_pio_handler_error (struct peer_data *peer)
     return;
 }
 
+void peer_fallback_pio_handler_error (struct peer_data *peer)
+{
+    ASSERT(options.peer_tcp_fallback)
+    ASSERT(peer->have_link)
+    ASSERT(peer->have_fallback)
+    
+    peer_log(peer, BLOG_NOTICE, "TCP fallback connection failed");
+    
+    // move frames back to the UDP link
+    peer->fallback.link_up = 0;
+    peer_update_link(peer);
+    
+    // continue with the UDP link only
+    peer_free_fallback(peer);
+}
+
 void peer_reset_timer_handler (struct peer_data *peer)
 {
     ASSERT(peer_am_master(peer))
     
     BLog(BLOG_NOTICE, "retry timer expired");
     
-    // start setup process
-    peer_start_binding(peer);
+    // start setup process
+    peer_start_binding(peer);
+}
+
+void peer_start_binding (struct peer_data *peer)
+{
+    peer_set_link_wanted(peer);
+    
+    peer->binding = 1;
+    peer->binding_addrpos = 0;
+    
+    peer_bind(peer);
+}
+
+int peer_link_on_demand (struct peer_data *peer)
+{
+    // links with relays and their clients are always kept up,
+    // since they carry traffic for other peers
+    return (options.peer_link_idle_time > 0 &&
+            !(peer->flags & (SCID_NEWCLIENT_FLAG_RELAY_SERVER | SCID_NEWCLIENT_FLAG_RELAY_CLIENT)));
+}
+
+void peer_set_link_wanted (struct peer_data *peer)
+{
+    if (!peer_link_on_demand(peer) || peer->link_wanted) {
+        return;
+    }
+    
+    peer->link_wanted = 1;
+    
+    // start looking for traffic
+    peer->frame_sent = 0;
+    DPReceivePeer_TakeFrameReceived(&peer->receive_peer);
+    BReactor_SetTimer(&ss, &peer->idle_timer);
+}
+
+void peer_frame_routed (struct peer_data *peer)
+{
+    if (!peer_link_on_demand(peer)) {
+        return;
+    }
+    
+    peer->frame_sent = 1;
+    
+    // request the link from a job, since setting it up changes
+    // the flows we are routing frames to
+    if (!peer->link_wanted) {
+        BPending_Set(&peer->job_want_link);
+    }
+}
+
+void peer_free_idle_link (struct peer_data *peer)
+{
+    ASSERT(peer->link_wanted)
+    
+    peer->link_wanted = 0;
+    BReactor_RemoveTimer(&ss, &peer->idle_timer);
+    
+    // free link or relaying, and stop any retries
+    peer_cleanup_connections(peer);
+    peer->binding = 0;
+    BReactor_RemoveTimer(&ss, &peer->reset_timer);
 }
 
-void peer_start_binding (struct peer_data *peer)
+void peer_idle_timer_handler (struct peer_data *peer)
 {
-    peer->binding = 1;
-    peer->binding_addrpos = 0;
+    ASSERT(peer->link_wanted)
     
-    peer_bind(peer);
+    int working = ((peer->have_link && peer_link_working(peer)) || peer->relaying_peer);
+    int frame_received = DPReceivePeer_TakeFrameReceived(&peer->receive_peer);
+    
+    // keep the link while it carries frames
+    if (working && (peer->frame_sent || frame_received)) {
+        peer->frame_sent = 0;
+        BReactor_SetTimer(&ss, &peer->idle_timer);
+        return;
+    }
+    
+    // also free a link which did not come up, so that the next
+    // frame sets it up from the start
+    peer_log(peer, BLOG_INFO, (working ? "link idle, freeing" : "link not up, freeing"));
+    
+    peer_free_idle_link(peer);
+    
+    // tell the peer to free its side
+    peer_send_simple(peer, MSGID_LINKIDLE);
 }
 
 void peer_bind (struct peer_data *peer)
@@ -2345,9 +3821,10 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
     ASSERT(addr_index < num_bind_addrs)
     ASSERT(bind_addrs[addr_index].num_ext_addrs > 0)
     
-    // get a fresh link
+    // get a fresh link, with compact headers if we want them;
+    // the peer follows what we say in youconnect
     peer_cleanup_connections(peer);
-    if (!peer_init_link(peer)) {
+    if (!peer_init_link(peer, (options.transport_mode == TRANSPORT_MODE_UDP && options.compact_headers))) {
         peer_log(peer, BLOG_ERROR, "cannot get link");
         *cont = 0;
         peer_reset(peer);
@@ -2363,7 +3840,7 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
         for (port_add = 0; port_add < addr->num_ports; port_add++) {
             BAddr tryaddr = addr->addr;
             BAddr_SetPort(&tryaddr, hton16(ntoh16(BAddr_GetPort(&tryaddr)) + port_add));
-            if (DatagramPeerIO_Bind(&peer->pio.udp.pio, tryaddr)) {
+            if (DatagramPeerIOThread_Bind(&peer->pio.udp.pio, tryaddr)) {
                 break;
             }
         }
@@ -2373,12 +3850,12 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
             return;
         }
         
-        uint8_t key[BENCRYPTION_MAX_KEY_SIZE];
+        uint8_t key[SPPROTO_ENCRYPTION_MAX_KEY_SIZE];
         
         // generate and set encryption key
         if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
-            BRandom_randomize(key, BEncryption_cipher_key_size(sp_params.encryption_mode));
-            DatagramPeerIO_SetEncryptionKey(&peer->pio.udp.pio, key);
+            BRandom_randomize(key, spproto_encryption_key_size(sp_params));
+            DatagramPeerIOThread_SetEncryptionKey(&peer->pio.udp.pio, key);
         }
         
         // schedule sending OTP seed
@@ -2386,15 +3863,22 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
             BPending_Set(&peer->pio.udp.job_send_seed);
         }
         
+        // order the TCP fallback link to listen
+        uint64_t pass = 0;
+        if (peer->have_fallback) {
+            StreamPeerIO_Listen(&peer->fallback.pio, &listeners[addr_index], &pass, NULL);
+        }
+        
         // send connectinfo
-        peer_send_conectinfo(peer, addr_index, port_add, key, 0);
+        peer_send_conectinfo(peer, addr_index, port_add, key, pass);
     } else {
         // order StreamPeerIO to listen
         uint64_t pass;
-        StreamPeerIO_Listen(&peer->pio.tcp.pio, &listeners[addr_index], &pass);
+        uint8_t key[SPPROTO_ENCRYPTION_MAX_KEY_SIZE];
+        StreamPeerIO_Listen(&peer->pio.tcp.pio, &listeners[addr_index], &pass, key);
         
         // send connectinfo
-        peer_send_conectinfo(peer, addr_index, 0, NULL, pass);
+        peer_send_conectinfo(peer, addr_index, 0, key, pass);
     }
     
     peer_log(peer, BLOG_NOTICE, "bound to address number %d", addr_index);
@@ -2402,11 +3886,13 @@ void peer_bind_one_address (struct peer_data *peer, int addr_index, int *cont)
     *cont = 0;
 }
 
-void peer_connect (struct peer_data *peer, BAddr addr, uint8_t* encryption_key, uint64_t password)
+void peer_connect (struct peer_data *peer, BAddr addr, uint8_t* encryption_key, uint64_t password, BAddr fallback_addr, int compact)
 {
+    peer_set_link_wanted(peer);
+    
     // get a fresh link
     peer_cleanup_connections(peer);
-    if (!peer_init_link(peer)) {
+    if (!peer_init_link(peer, compact)) {
         peer_log(peer, BLOG_ERROR, "cannot get link");
         peer_reset(peer);
         return;
@@ -2414,24 +3900,39 @@ void peer_connect (struct peer_data *peer, BAddr addr, uint8_t* encryption_key,
     
     if (options.transport_mode == TRANSPORT_MODE_UDP) {
         // order DatagramPeerIO to connect
-        if (!DatagramPeerIO_Connect(&peer->pio.udp.pio, addr)) {
-            peer_log(peer, BLOG_NOTICE, "DatagramPeerIO_Connect failed");
+        if (!DatagramPeerIOThread_Connect(&peer->pio.udp.pio, addr)) {
+            peer_log(peer, BLOG_NOTICE, "DatagramPeerIOThread_Connect failed");
             peer_reset(peer);
             return;
         }
         
         // set encryption key
         if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
-            DatagramPeerIO_SetEncryptionKey(&peer->pio.udp.pio, encryption_key);
+            DatagramPeerIOThread_SetEncryptionKey(&peer->pio.udp.pio, encryption_key);
         }
         
         // generate and send a send seed
         if (SPPROTO_HAVE_OTP(sp_params)) {
             BPending_Set(&peer->pio.udp.job_send_seed);
         }
+        
+        // tell the peer where to send to, in case it is behind a NAT
+        peer_send_punch(peer);
+        
+        // order the TCP fallback link to connect
+        if (peer->have_fallback) {
+            if (fallback_addr.type == BADDR_TYPE_NONE) {
+                peer_log(peer, BLOG_WARNING, "peer did not offer a TCP fallback link");
+                peer_free_fallback(peer);
+            }
+            else if (!StreamPeerIO_Connect(&peer->fallback.pio, fallback_addr, password, NULL, client_cert, client_key)) {
+                peer_log(peer, BLOG_NOTICE, "StreamPeerIO_Connect failed for TCP fallback link");
+                peer_free_fallback(peer);
+            }
+        }
     } else {
         // order StreamPeerIO to connect
-        if (!StreamPeerIO_Connect(&peer->pio.tcp.pio, addr, password, client_cert, client_key)) {
+        if (!StreamPeerIO_Connect(&peer->pio.tcp.pio, addr, password, encryption_key, client_cert, client_key)) {
             peer_log(peer, BLOG_NOTICE, "StreamPeerIO_Connect failed");
             peer_reset(peer);
             return;
@@ -2517,8 +4018,8 @@ void peer_send_conectinfo (struct peer_data *peer, int addr_index, int port_adju
     
     // remember encryption key size
     int key_size = 0; // to remove warning
-    if (options.transport_mode == TRANSPORT_MODE_UDP && SPPROTO_HAVE_ENCRYPTION(sp_params)) {
-        key_size = BEncryption_cipher_key_size(sp_params.encryption_mode);
+    if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+        key_size = spproto_encryption_key_size(sp_params);
     }
     
     // calculate message length ..
@@ -2533,31 +4034,46 @@ void peer_send_conectinfo (struct peer_data *peer, int addr_index, int port_adju
     }
     
     // encryption key
-    if (options.transport_mode == TRANSPORT_MODE_UDP && SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+    if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
         msg_len += msg_youconnect_SIZEkey(key_size);
     }
     
     // password
-    if (options.transport_mode == TRANSPORT_MODE_TCP) {
+    if (options.transport_mode == TRANSPORT_MODE_TCP || options.peer_tcp_fallback) {
         msg_len += msg_youconnect_SIZEpassword;
     }
     
+    // TCP fallback addresses
+    if (options.peer_tcp_fallback) {
+        for (int i = 0; i < bind_addr->num_ext_addrs; i++) {
+            int addrmsg_len =
+                msg_youconnect_addr_SIZEname(strlen(bind_addr->ext_addrs[i].scope)) +
+                msg_youconnect_addr_SIZEaddr(addr_size(bind_addr->ext_addrs[i].addr));
+            msg_len += msg_youconnect_SIZEtcpaddr(addrmsg_len);
+        }
+    }
+    
+    // compact headers
+    if (options.transport_mode == TRANSPORT_MODE_UDP && options.compact_headers) {
+        msg_len += msg_youconnect_SIZEcompact;
+    }
+    
     // check if it's too big (because of the addresses)
     if (msg_len > MSG_MAX_PAYLOAD) {
         BLog(BLOG_ERROR, "cannot send too big youconnect message");
         return;
     }
-        
+    
     // start message
     uint8_t *msg;
     if (!peer_start_msg(peer, (void **)&msg, MSGID_YOUCONNECT, msg_len)) {
         return;
     }
-        
+    
     // init writer
     msg_youconnectWriter writer;
     msg_youconnectWriter_Init(&writer, msg);
-        
+    
     // write addresses
     for (int i = 0; i < bind_addr->num_ext_addrs; i++) {
         int name_len = strlen(bind_addr->ext_addrs[i].scope);
@@ -2588,16 +4104,44 @@ void peer_send_conectinfo (struct peer_data *peer, int addr_index, int port_adju
     }
     
     // write encryption key
-    if (options.transport_mode == TRANSPORT_MODE_UDP && SPPROTO_HAVE_ENCRYPTION(sp_params)) {
+    if (SPPROTO_HAVE_ENCRYPTION(sp_params)) {
         uint8_t *key_dst = msg_youconnectWriter_Addkey(&writer, key_size);
         memcpy(key_dst, enckey, key_size);
     }
     
     // write password
-    if (options.transport_mode == TRANSPORT_MODE_TCP) {
+    if (options.transport_mode == TRANSPORT_MODE_TCP || options.peer_tcp_fallback) {
         msg_youconnectWriter_Addpassword(&writer, pass);
     }
     
+    // write TCP fallback addresses, where the listener is on the first port
+    if (options.peer_tcp_fallback) {
+        for (int i = 0; i < bind_addr->num_ext_addrs; i++) {
+            int name_len = strlen(bind_addr->ext_addrs[i].scope);
+            int addr_len = addr_size(bind_addr->ext_addrs[i].addr);
+            
+            // get a pointer for writing the address
+            int addrmsg_len =
+                msg_youconnect_addr_SIZEname(name_len) +
+                msg_youconnect_addr_SIZEaddr(addr_len);
+            uint8_t *addrmsg_dst = msg_youconnectWriter_Addtcpaddr(&writer, addrmsg_len);
+            
+            // write address
+            msg_youconnect_addrWriter awriter;
+            msg_youconnect_addrWriter_Init(&awriter, addrmsg_dst);
+            uint8_t *name_dst = msg_youconnect_addrWriter_Addname(&awriter, name_len);
+            memcpy(name_dst, bind_addr->ext_addrs[i].scope, name_len);
+            uint8_t *addr_dst = msg_youconnect_addrWriter_Addaddr(&awriter, addr_len);
+            addr_write(addr_dst, bind_addr->ext_addrs[i].addr);
+            msg_youconnect_addrWriter_Finish(&awriter);
+        }
+    }
+    
+    // write compact headers
+    if (options.transport_mode == TRANSPORT_MODE_UDP && options.compact_headers) {
+        msg_youconnectWriter_Addcompact(&writer, 1);
+    }
+    
     // finish writer
     msg_youconnectWriter_Finish(&writer);
     
@@ -2623,25 +4167,174 @@ void peer_send_confirmseed (struct peer_data *peer, uint16_t seed_id)
     peer_end_msg(peer);
 }
 
+void peer_send_routes (struct peer_data *peer)
+{
+    ASSERT(options.tun)
+    
+    // calculate message length
+    int msg_len = 0;
+    for (int i = 0; i < num_routes; i++) {
+        int routemsg_len =
+            msg_routes_route_SIZEaddr(routes[i].is_ipv6 ? 16 : 4) +
+            msg_routes_route_SIZEprefix;
+        msg_len += msg_routes_SIZEroute(routemsg_len);
+    }
+    
+    // check if it's too big
+    if (msg_len > MSG_MAX_PAYLOAD) {
+        BLog(BLOG_ERROR, "cannot send too big routes message");
+        return;
+    }
+    
+    // start message
+    uint8_t *msg;
+    if (!peer_start_msg(peer, (void **)&msg, MSGID_ROUTES, msg_len)) {
+        return;
+    }
+    
+    // init writer
+    msg_routesWriter writer;
+    msg_routesWriter_Init(&writer, msg);
+    
+    // write routes
+    for (int i = 0; i < num_routes; i++) {
+        int addr_len = (routes[i].is_ipv6 ? 16 : 4);
+        int routemsg_len =
+            msg_routes_route_SIZEaddr(addr_len) +
+            msg_routes_route_SIZEprefix;
+        uint8_t *routemsg_dst = msg_routesWriter_Addroute(&writer, routemsg_len);
+        
+        msg_routes_routeWriter rwriter;
+        msg_routes_routeWriter_Init(&rwriter, routemsg_dst);
+        uint8_t *addr_dst = msg_routes_routeWriter_Addaddr(&rwriter, addr_len);
+        memcpy(addr_dst, routes[i].addr, addr_len);
+        msg_routes_routeWriter_Addprefix(&rwriter, routes[i].prefix);
+        msg_routes_routeWriter_Finish(&rwriter);
+    }
+    
+    // finish writer
+    msg_routesWriter_Finish(&writer);
+    
+    // end message
+    peer_end_msg(peer);
+}
+
+void peer_send_punch (struct peer_data *peer)
+{
+    ASSERT(options.transport_mode == TRANSPORT_MODE_UDP)
+    ASSERT(peer->have_link)
+    
+    // get the port of our socket
+    BAddr local_addr;
+    if (!DatagramPeerIOThread_GetLocalAddr(&peer->pio.udp.pio, &local_addr)) {
+        peer_log(peer, BLOG_WARNING, "DatagramPeerIOThread_GetLocalAddr failed");
+        return;
+    }
+    uint16_t port = BAddr_GetPort(&local_addr);
+    
+    // our external addresses with that port are the candidates; this works
+    // through NATs which keep the port
+    int msg_len = 0;
+    int num_addrs = 0;
+    for (int i = 0; i < num_bind_addrs; i++) {
+        struct bind_addr *bind_addr = &bind_addrs[i];
+        for (int j = 0; j < bind_addr->num_ext_addrs; j++) {
+            if (bind_addr->ext_addrs[j].addr.type != local_addr.type) {
+                continue;
+            }
+            int addrmsg_len =
+                msg_youconnect_addr_SIZEname(strlen(bind_addr->ext_addrs[j].scope)) +
+                msg_youconnect_addr_SIZEaddr(addr_size(bind_addr->ext_addrs[j].addr));
+            msg_len += msg_punch_SIZEaddr(addrmsg_len);
+            num_addrs++;
+        }
+    }
+    
+    if (num_addrs == 0) {
+        return;
+    }
+    
+    // check if it's too big (because of the addresses)
+    if (msg_len > MSG_MAX_PAYLOAD) {
+        BLog(BLOG_ERROR, "cannot send too big punch message");
+        return;
+    }
+    
+    // start message
+    uint8_t *msg;
+    if (!peer_start_msg(peer, (void **)&msg, MSGID_PUNCH, msg_len)) {
+        return;
+    }
+    
+    // init writer
+    msg_punchWriter writer;
+    msg_punchWriter_Init(&writer, msg);
+    
+    // write addresses
+    for (int i = 0; i < num_bind_addrs; i++) {
+        struct bind_addr *bind_addr = &bind_addrs[i];
+        for (int j = 0; j < bind_addr->num_ext_addrs; j++) {
+            if (bind_addr->ext_addrs[j].addr.type != local_addr.type) {
+                continue;
+            }
+            int name_len = strlen(bind_addr->ext_addrs[j].scope);
+            int addr_len = addr_size(bind_addr->ext_addrs[j].addr);
+            
+            int addrmsg_len =
+                msg_youconnect_addr_SIZEname(name_len) +
+                msg_youconnect_addr_SIZEaddr(addr_len);
+            uint8_t *addrmsg_dst = msg_punchWriter_Addaddr(&writer, addrmsg_len);
+            
+            msg_youconnect_addrWriter awriter;
+            msg_youconnect_addrWriter_Init(&awriter, addrmsg_dst);
+            
+            // write scope
+            uint8_t *name_dst = msg_youconnect_addrWriter_Addname(&awriter, name_len);
+            memcpy(name_dst, bind_addr->ext_addrs[j].scope, name_len);
+            
+            // write address with the port of our socket
+            BAddr addr = bind_addr->ext_addrs[j].addr;
+            BAddr_SetPort(&addr, port);
+            uint8_t *addr_dst = msg_youconnect_addrWriter_Addaddr(&awriter, addr_len);
+            addr_write(addr_dst, addr);
+            
+            msg_youconnect_addrWriter_Finish(&awriter);
+        }
+    }
+    
+    // finish writer
+    msg_punchWriter_Finish(&writer);
+    
+    // end message
+    peer_end_msg(peer);
+}
+
 void peer_dataproto_handler (struct peer_data *peer, int up)
 {
     ASSERT(peer->have_link)
     
+    peer->link_up = up;
+    
     if (up) {
         peer_log(peer, BLOG_INFO, "up");
-        
-        // if it can be a relay provided, enable it
-        if ((peer->flags & SCID_NEWCLIENT_FLAG_RELAY_SERVER) && !peer->is_relay) {
-            peer_enable_relay_provider(peer);
-        }
     } else {
         peer_log(peer, BLOG_INFO, "down");
-        
-        // if it is a relay provider, disable it
-        if (peer->is_relay) {
-            peer_disable_relay_provider(peer);
-        }
+        peer_log_link_quality(peer, BLOG_INFO);
     }
+    
+    peer_update_link(peer);
+}
+
+void peer_fallback_dataproto_handler (struct peer_data *peer, int up)
+{
+    ASSERT(peer->have_link)
+    ASSERT(peer->have_fallback)
+    
+    peer->fallback.link_up = up;
+    
+    peer_log(peer, BLOG_INFO, (up ? "TCP fallback link up" : "TCP fallback link down"));
+    
+    peer_update_link(peer);
 }
 
 struct peer_data * find_peer_by_id (peerid_t id)
@@ -2667,18 +4360,318 @@ void device_dpsource_handler (void *unused, const uint8_t *frame, int frame_len)
 {
     ASSERT(frame_len >= 0)
     ASSERT(frame_len <= device_mtu)
+    ASSERT(LinkedList1_IsEmpty(&multidest_relays))
+    
+    // classify frame
+    int priority = (qos_enabled() ? device_frame_priority(frame, frame_len) : DATAPROTO_PRIORITY_NORMAL);
+    
+    // in TUN mode, route the packet to the peer with the matching network
+    if (options.tun) {
+        IPDeciderPeer *ip_decider_peer = IPDecider_Decide(&ip_decider, frame, frame_len);
+        if (ip_decider_peer) {
+            struct peer_data *peer = UPPER_OBJECT(ip_decider_peer, struct peer_data, ip_decider_peer);
+            peer_frame_routed(peer);
+            DataProtoFlow_Route(peer_local_dpflow(peer, priority), 0);
+        }
+        return;
+    }
     
     // give frame to decider
     FrameDecider_AnalyzeAndDecide(&frame_decider, frame, frame_len);
     
-    // forward frame to peers
-    FrameDeciderPeer *decider_peer = FrameDecider_NextDestination(&frame_decider);
-    while (decider_peer) {
-        FrameDeciderPeer *next = FrameDecider_NextDestination(&frame_decider);
+    // forward frame to peers, collecting peers behind relays if
+    // sending a single frame to multiple peers through relays
+    struct peer_data *pending = NULL;
+    FrameDeciderPeer *decider_peer;
+    while (decider_peer = FrameDecider_NextDestination(&frame_decider)) {
         struct peer_data *peer = UPPER_OBJECT(decider_peer, struct peer_data, decider_peer);
-        DataProtoFlow_Route(&peer->local_dpflow, !!next);
-        decider_peer = next;
+        
+        peer_frame_routed(peer);
+        
+        struct peer_data *relay = device_multidest_relay(peer);
+        if (relay) {
+            if (relay->multidest_num == 0) {
+                LinkedList1_Append(&multidest_relays, &relay->multidest_list_node);
+            }
+            relay->multidest_peers[relay->multidest_num++] = peer;
+            
+            // if the frame can't take more destinations, send it now
+            if (relay->multidest_num == DATAPROTO_MAX_PEER_IDS) {
+                LinkedList1_Remove(&multidest_relays, &relay->multidest_list_node);
+                device_route_multidest(relay, priority, 1);
+            }
+            continue;
+        }
+        
+        // route to previous peer, now knowing there are more
+        if (pending) {
+            DataProtoFlow_Route(peer_local_dpflow(pending, priority), 1);
+        }
+        pending = peer;
+    }
+    
+    // route to last peer
+    if (pending) {
+        DataProtoFlow_Route(peer_local_dpflow(pending, priority), !LinkedList1_IsEmpty(&multidest_relays));
+    }
+    
+    // route to peers behind relays
+    LinkedList1Node *list_node;
+    while (list_node = LinkedList1_GetFirst(&multidest_relays)) {
+        struct peer_data *relay = UPPER_OBJECT(list_node, struct peer_data, multidest_list_node);
+        LinkedList1_Remove(&multidest_relays, &relay->multidest_list_node);
+        device_route_multidest(relay, priority, !LinkedList1_IsEmpty(&multidest_relays));
+    }
+    
+    // write answer to the device if the decider answered on behalf of a peer
+    uint8_t *reply;
+    int reply_len;
+    if (FrameDecider_GetReply(&frame_decider, &reply, &reply_len) && reply_len <= device_mtu) {
+        BTap_Send(&device, reply, reply_len);
+    }
+}
+
+struct peer_data * device_multidest_relay (struct peer_data *peer)
+{
+    if (!options.relay_multidest) {
+        return NULL;
+    }
+    
+    // peer is relaying through a relay
+    if (peer->relaying_peer) {
+        return peer->relaying_peer;
+    }
+    
+    // peer is a relay itself, include it in frames for its users
+    if (peer->is_relay) {
+        return peer;
+    }
+    
+    return NULL;
+}
+
+void device_route_multidest (struct peer_data *relay, int priority, int more)
+{
+    ASSERT(relay->is_relay)
+    ASSERT(relay->multidest_num > 0)
+    ASSERT(relay->multidest_num <= DATAPROTO_MAX_PEER_IDS)
+    
+    // a single destination needs nothing special
+    struct peer_data *first = relay->multidest_peers[0];
+    if (relay->multidest_num == 1) {
+        DataProtoFlow_Route(peer_local_dpflow(first, priority), more);
+        relay->multidest_num = 0;
+        return;
+    }
+    
+    // collect IDs
+    peerid_t ids[DATAPROTO_MAX_PEER_IDS];
+    for (int i = 0; i < relay->multidest_num; i++) {
+        ids[i] = relay->multidest_peers[i]->id;
+    }
+    
+    // route a single frame for all, through the flow of the first one, which
+    // is attached to the relay's sink like the flows of the others
+    DataProtoFlow_RouteMulti(peer_local_dpflow(first, priority), ids, relay->multidest_num, more);
+    
+    relay->multidest_num = 0;
+}
+
+int qos_enabled (void)
+{
+    return (options.qos_dscp >= 0 || options.num_qos_ports > 0);
+}
+
+int device_frame_priority (const uint8_t *frame, int frame_len)
+{
+    ASSERT(qos_enabled())
+    
+    // get the ethertype; in TUN mode, frames are IP packets
+    int ethertype;
+    if (options.tun) {
+        if (frame_len < 1) {
+            return DATAPROTO_PRIORITY_NORMAL;
+        }
+        ethertype = ((frame[0] >> 4) == 6 ? ETHERTYPE_IPV6 : ETHERTYPE_IPV4);
+    } else {
+        struct ethernet_header eh;
+        if (frame_len < sizeof(eh)) {
+            return DATAPROTO_PRIORITY_NORMAL;
+        }
+        memcpy(&eh, frame, sizeof(eh));
+        ethertype = ntoh16(eh.type);
+        frame += sizeof(eh);
+        frame_len -= sizeof(eh);
+    }
+    
+    // get DSCP, and the transport header if it starts this packet
+    int dscp;
+    int protocol = -1;
+    const uint8_t *payload = NULL;
+    int payload_len = 0;
+    switch (ethertype) {
+        case ETHERTYPE_IPV4: {
+            struct ipv4_header ipv4;
+            if (frame_len < sizeof(ipv4)) {
+                return DATAPROTO_PRIORITY_NORMAL;
+            }
+            memcpy(&ipv4, frame, sizeof(ipv4));
+            if (IPV4_GET_VERSION(ipv4) != 4) {
+                return DATAPROTO_PRIORITY_NORMAL;
+            }
+            dscp = ipv4.ds >> 2;
+            int header_len = IPV4_GET_IHL(ipv4) * 4;
+            if (header_len >= sizeof(ipv4) && header_len <= frame_len && (ntoh16(ipv4.flags3_fragmentoffset13) & 0x1FFF) == 0) {
+                protocol = ipv4.protocol;
+                payload = frame + header_len;
+                payload_len = frame_len - header_len;
+            }
+        } break;
+        
+        case ETHERTYPE_IPV6: {
+            struct ipv6_header ipv6;
+            if (frame_len < sizeof(ipv6)) {
+                return DATAPROTO_PRIORITY_NORMAL;
+            }
+            memcpy(&ipv6, frame, sizeof(ipv6));
+            if ((ipv6.version4_tc4 >> 4) != 6) {
+                return DATAPROTO_PRIORITY_NORMAL;
+            }
+            dscp = ((ipv6.version4_tc4 & 0xF) << 2) | (ipv6.tc4_fl4 >> 6);
+            protocol = ipv6.next_header;
+            payload = frame + sizeof(ipv6);
+            payload_len = frame_len - sizeof(ipv6);
+        } break;
+        
+        default:
+            return DATAPROTO_PRIORITY_NORMAL;
+    }
+    
+    // check DSCP
+    int min_dscp = (options.qos_dscp >= 0 ? options.qos_dscp : DEFAULT_QOS_DSCP);
+    if (dscp >= min_dscp) {
+        return DATAPROTO_PRIORITY_HIGH;
     }
+    
+    // check ports; both TCP and UDP headers start with the source and destination ports
+    if (options.num_qos_ports > 0 && (protocol == IPV4_PROTOCOL_TCP || protocol == IPV4_PROTOCOL_UDP) && payload_len >= 4) {
+        uint16_t source_port = ((uint16_t)payload[0] << 8) | payload[1];
+        uint16_t dest_port = ((uint16_t)payload[2] << 8) | payload[3];
+        for (int i = 0; i < options.num_qos_ports; i++) {
+            if (options.qos_ports[i] == source_port || options.qos_ports[i] == dest_port) {
+                return DATAPROTO_PRIORITY_HIGH;
+            }
+        }
+    }
+    
+    return DATAPROTO_PRIORITY_NORMAL;
+}
+
+int peer_link_cost (struct peer_data *peer)
+{
+    ASSERT(peer->have_link)
+    
+    struct DataProtoSink_quality q;
+    DataProtoSink_GetQuality(peer_link_sink(peer), &q);
+    
+    // prefer links which have been measured
+    if (!q.have_rtt) {
+        return INT_MAX;
+    }
+    
+    // weigh in jitter like a retransmission timeout would, then scale by loss
+    int64_t cost = (int64_t)q.rtt + 4 * q.jitter;
+    cost = cost * (1000 + 10 * q.loss) / 1000;
+    
+    return (cost < INT_MAX ? cost : INT_MAX - 1);
+}
+
+void peer_log_link_quality (struct peer_data *peer, int level)
+{
+    ASSERT(peer->have_link)
+    
+    struct DataProtoSink_quality q;
+    DataProtoSink_GetQuality(peer_link_sink(peer), &q);
+    
+    if (!q.have_rtt) {
+        peer_log(peer, level, "link quality not measured");
+        return;
+    }
+    
+    struct DataProtoSink_compression c;
+    DataProtoSink_GetCompression(peer_link_sink(peer), &c);
+    
+    if (c.frame_bytes == 0) {
+        peer_log(peer, level, "link rtt %d ms, jitter %d ms, loss %d.%d%%", q.rtt, q.jitter, q.loss / 10, q.loss % 10);
+        return;
+    }
+    
+    int ratio = (int)(c.sent_bytes * 1000 / c.frame_bytes);
+    
+    peer_log(peer, level, "link rtt %d ms, jitter %d ms, loss %d.%d%%, compressed to %d.%d%%", q.rtt, q.jitter, q.loss / 10, q.loss % 10, ratio / 10, ratio % 10);
+}
+
+void trace_timer_handler (void *unused)
+{
+    static const struct {
+        int histogram;
+        const char *name;
+    } stages[CLIENT_TRACE_NUM_STAGES] = {
+        {BMETRICS_HISTOGRAM_TRACE_SEND_SOURCE_NS, "send: routed"},
+        {BMETRICS_HISTOGRAM_TRACE_SEND_SINK_NS, "send: left send buffer"},
+        {BMETRICS_HISTOGRAM_TRACE_SEND_ENCODE_QUEUE_NS, "send: queued for encoding"},
+        {BMETRICS_HISTOGRAM_TRACE_SEND_ENCODE_DONE_NS, "send: encoded"},
+        {BMETRICS_HISTOGRAM_TRACE_SEND_DATAGRAM_NS, "send: sent"},
+        {BMETRICS_HISTOGRAM_TRACE_RECV_DECODE_QUEUE_NS, "receive: queued for decoding"},
+        {BMETRICS_HISTOGRAM_TRACE_RECV_DECODE_DONE_NS, "receive: decoded"},
+        {BMETRICS_HISTOGRAM_TRACE_RECV_ASSEMBLE_NS, "receive: reassembled"},
+        {BMETRICS_HISTOGRAM_TRACE_RECV_DEVICE_NS, "receive: written to device"},
+    };
+    
+    ASSERT(options.trace_packets > 0)
+    
+    // restart timer
+    BReactor_SetTimer(&ss, &trace_timer);
+    
+    for (int i = 0; i < CLIENT_TRACE_NUM_STAGES; i++) {
+        // take the packets since the last report
+        uint64_t buckets[BMETRICS_HISTOGRAM_BUCKETS];
+        BMetrics_ReadHistogram(stages[i].histogram, buckets);
+        uint64_t count = 0;
+        for (int j = 0; j < BMETRICS_HISTOGRAM_BUCKETS; j++) {
+            uint64_t n = buckets[j] - trace_last_buckets[i][j];
+            trace_last_buckets[i][j] = buckets[j];
+            buckets[j] = n;
+            count += n;
+        }
+        
+        if (count == 0) {
+            continue;
+        }
+        
+        // find the buckets of the median and the 99th percentile; bucket j
+        // holds times below 2^j ns
+        int p50 = -1;
+        int p99 = -1;
+        uint64_t seen = 0;
+        for (int j = 0; j < BMETRICS_HISTOGRAM_BUCKETS; j++) {
+            seen += buckets[j];
+            if (p50 < 0 && 2 * seen >= count) {
+                p50 = j;
+            }
+            if (p99 < 0 && 100 * seen >= 99 * count) {
+                p99 = j;
+            }
+        }
+        
+        BLog(BLOG_NOTICE, "trace %s: %" PRIu64 " packets, p50 < %.1f us, p99 < %.1f us", stages[i].name, count, (double)((uint64_t)1 << p50) / 1000, (double)((uint64_t)1 << p99) / 1000);
+    }
+    
+    uint64_t dropped = BMetrics_ReadCounter(BMETRICS_COUNTER_TRACE_SAMPLES_DROPPED);
+    if (dropped > trace_last_dropped) {
+        BLog(BLOG_NOTICE, "trace: %" PRIu64 " samples dropped", dropped - trace_last_dropped);
+    }
+    trace_last_dropped = dropped;
 }
 
 void assign_relays (void)
@@ -2691,14 +4684,22 @@ void assign_relays (void)
         ASSERT(!peer->relaying_peer)
         ASSERT(!peer->have_link)
         
-        // get a relay
-        LinkedList1Node *list_node2 = LinkedList1_GetFirst(&relays);
-        if (!list_node2) {
+        // get the relay with the best link
+        struct peer_data *relay = NULL;
+        int relay_cost = INT_MAX;
+        for (LinkedList1Node *list_node2 = LinkedList1_GetFirst(&relays); list_node2; list_node2 = LinkedList1Node_Next(list_node2)) {
+            struct peer_data *candidate = UPPER_OBJECT(list_node2, struct peer_data, relay_list_node);
+            ASSERT(candidate->is_relay)
+            int cost = peer_link_cost(candidate);
+            if (!relay || cost < relay_cost) {
+                relay = candidate;
+                relay_cost = cost;
+            }
+        }
+        if (!relay) {
             BLog(BLOG_NOTICE, "no relays");
             return;
         }
-        struct peer_data *relay = UPPER_OBJECT(list_node2, struct peer_data, relay_list_node);
-        ASSERT(relay->is_relay)
         
         // no longer waiting for relay
         peer_unregister_need_relay(peer);
@@ -2880,13 +4881,47 @@ void peer_job_send_seed (struct peer_data *peer)
     memcpy(iv_dst, peer->pio.udp.sendseed_sent_iv, iv_len);
     msg_seedWriter_Finish(&writer);
     peer_end_msg(peer);
+    
+    // generate the OTPs while waiting for the confirmation, so that the seed
+    // can be used right away once it comes
+    DatagramPeerIOThread_PrepareOTPSendSeed(&peer->pio.udp.pio, peer->pio.udp.sendseed_sent_key, peer->pio.udp.sendseed_sent_iv);
 }
 
 void peer_job_init (struct peer_data *peer)
 {
-    // start setup process
+    // tell the peer which networks are reachable through us; from a job,
+    // since the chat takes only one message at a time and binding sends one
+    if (options.tun) {
+        BPending_Set(&peer->job_send_routes);
+    }
+    
+    // start setup process, unless the link is set up when needed
+    if (peer_am_master(peer) && !peer_link_on_demand(peer)) {
+        peer_start_binding(peer);
+    }
+}
+
+void peer_job_send_routes (struct peer_data *peer)
+{
+    ASSERT(options.tun)
+    
+    peer_send_routes(peer);
+}
+
+void peer_job_want_link (struct peer_data *peer)
+{
+    if (peer->link_wanted) {
+        return;
+    }
+    
+    peer_log(peer, BLOG_INFO, "link needed");
+    
     if (peer_am_master(peer)) {
         peer_start_binding(peer);
+    } else {
+        // ask the master to bind
+        peer_set_link_wanted(peer);
+        peer_send_simple(peer, MSGID_YOURETRY);
     }
 }
 
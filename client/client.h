@@ -35,11 +35,13 @@
 #include <flow/PacketPassFairQueue.h>
 #include <flow/SinglePacketBuffer.h>
 #include <flow/PacketRecvConnector.h>
-#include <client/DatagramPeerIO.h>
+#include <threadwork/BThreadWork.h>
+#include <client/DatagramPeerIOGroup.h>
 #include <client/StreamPeerIO.h>
 #include <client/DataProto.h>
 #include <client/DPReceive.h>
 #include <client/FrameDecider.h>
+#include <client/IPDecider.h>
 #include <client/PeerChat.h>
 #include <client/SinglePacketSource.h>
 
@@ -53,10 +55,15 @@
 
 // maximum UDP payload size
 #define CLIENT_UDP_MTU 1472
+// largest datagram size allowed for path MTU discovery (maximum UDP payload over IPv4)
+#define CLIENT_UDP_MAX_MTU 65507
 
-// maximum number of pending TCP PasswordListener clients
+// maximum number of TCP PasswordListener clients doing the handshake at once
 #define TCP_MAX_PASSWORD_LISTENER_CLIENTS 50
 
+// maximum number of accepted TCP PasswordListener clients waiting for the above
+#define TCP_MAX_PASSWORD_LISTENER_PENDING 256
+
 // maximum number of peers
 #define DEFAULT_MAX_PEERS 256
 // maximum number of peer's MAC addresses to remember
@@ -65,18 +72,31 @@
 #define PEER_DEFAULT_MAX_GROUPS 16
 // how long we wait for a packet to reach full size before sending it (see FragmentProtoDisassembler latency argument)
 #define PEER_DEFAULT_UDP_FRAGMENTATION_LATENCY 0
-// value related to how much out-of-order input we tolerate (see FragmentProtoAssembler num_frames argument)
-#define PEER_UDP_ASSEMBLER_NUM_FRAMES 4
+// how many incomplete frames we keep while waiting for their chunks (see FragmentProtoAssembler num_frames argument)
+#define PEER_UDP_ASSEMBLER_NUM_FRAMES 16
+// how long we wait for more packets before sending the parity packet of an incomplete FEC group (see FECEncoder flush_latency argument)
+#define PEER_UDP_FEC_FLUSH_LATENCY 5
+
+// default maximum number of packets SPProto encodes or decodes in one thread work
+#define PEER_DEFAULT_SPPROTO_BATCH_SIZE 1
+// default maximum number of SPProto thread works in flight per peer and direction
+#define PEER_DEFAULT_SPPROTO_WINDOW 1
 // socket send buffer (SO_SNDBUF) for peer TCP connections, <=0 to not set
 #define PEER_DEFAULT_TCP_SOCKET_SNDBUF 1048576
 // keep-alive packet interval for p2p communication
 #define PEER_KEEPALIVE_INTERVAL 10000
 // keep-alive receive timer for p2p communication (after how long to consider the link down)
 #define PEER_KEEPALIVE_RECEIVE_TIMER 22000
+// keep-alive packet interval with a TCP fallback link, for faster failover
+#define PEER_FALLBACK_KEEPALIVE_INTERVAL 1000
+// keep-alive receive timer with a TCP fallback link
+#define PEER_FALLBACK_KEEPALIVE_RECEIVE_TIMER 3500
 // size of frame send buffer, in number of frames
 #define PEER_DEFAULT_SEND_BUFFER_SIZE 32
 // size of frame send buffer for relayed packets, in number of frames
 #define PEER_DEFAULT_SEND_BUFFER_RELAY_SIZE 32
+// CoDel interval of send buffers, in milliseconds
+#define PEER_DEFAULT_SEND_BUFFER_CODEL_INTERVAL 100
 // time after an unused relay flow is freed (-1 for never)
 #define PEER_RELAY_FLOW_INACTIVITY_TIME 10000
 // retry time
@@ -89,12 +109,26 @@
 // forwarded to a peer before assuming there are no listeners at the peer
 #define DEFAULT_IGMP_LAST_MEMBER_QUERY_TIME 2000
 
+// maximum value of the flood rate limit, keeping the limiter's time units in range
+#define MAX_FLOOD_RATE 1000000
+
 // maximum bind addresses
 #define MAX_BIND_ADDRS 8
 // maximum external addresses per bind address
 #define MAX_EXT_ADDRS 8
 // maximum scopes
 #define MAX_SCOPES 8
+// maximum routes announced by us or by a peer in TUN mode
+#define MAX_ROUTES 32
+// maximum ports given with --qos-port
+#define MAX_QOS_PORTS 16
+// DSCP value from which frames are sent with high priority if only --qos-port is given
+#define DEFAULT_QOS_DSCP 40
+
+// how often to report the latencies of traced packets (--trace-packets)
+#define CLIENT_TRACE_REPORT_INTERVAL 10000
+// number of data path stages packets are traced through
+#define CLIENT_TRACE_NUM_STAGES 9
 
 //#define SIMULATE_PEER_OUT_OF_BUFFER 70
 
@@ -117,9 +151,20 @@ struct peer_data {
     int cert_len;
     char *common_name;
     
+    // decoding of the certificate, which may be done in another thread;
+    // the common name is not known until it is done
+    int cert_decoding;
+    BThreadWork cert_work;
+    char *cert_work_common_name;
+    const char *cert_work_failed;
+    int cert_work_error;
+    
     // init job
     BPending job_init;
     
+    // job for sending routes (TUN mode)
+    BPending job_send_routes;
+    
     // server flow
     struct server_flow *server_flow;
     
@@ -136,9 +181,15 @@ struct peer_data {
     // local flow
     DataProtoFlow local_dpflow;
     
-    // frame decider peer
+    // local flow for high priority frames (--qos-dscp, --qos-port)
+    DataProtoFlow local_dpflow_high;
+    
+    // frame decider peer (TAP mode)
     FrameDeciderPeer decider_peer;
     
+    // IP decider peer (TUN mode)
+    IPDeciderPeer ip_decider_peer;
+    
     // receive peer
     DPReceivePeer receive_peer;
     
@@ -151,7 +202,7 @@ struct peer_data {
     // transport-specific link objects
     union {
         struct {
-            DatagramPeerIO pio;
+            DatagramPeerIOThread pio;
             uint16_t sendseed_nextid;
             int sendseed_sent;
             uint16_t sendseed_sent_id;
@@ -168,6 +219,18 @@ struct peer_data {
     // link sending
     DataProtoSink send_dp;
     
+    // TCP fallback link objects (--peer-tcp-fallback)
+    int have_fallback;
+    struct {
+        DPReceiveReceiver receive_receiver;
+        StreamPeerIO pio;
+        DataProtoSink send_dp;
+        int link_up;
+    } fallback;
+    
+    // whether frames are sent through the fallback link
+    int fallback_active;
+    
     // relaying objects
     struct peer_data *relaying_peer; // peer through which we are relaying, or NULL
     LinkedList1Node relaying_list_node; // node in relay peer's relay_users
@@ -184,10 +247,23 @@ struct peer_data {
     LinkedList1Node relay_list_node;
     LinkedList1 relay_users;
     
+    // destinations of the current device frame collected for
+    // sending through this relay (--relay-multidest)
+    struct peer_data *multidest_peers[DATAPROTO_MAX_PEER_IDS];
+    int multidest_num;
+    LinkedList1Node multidest_list_node;
+    
     // binding state
     int binding;
     int binding_addrpos;
     
+    // on-demand link state (--peer-link-idle-time)
+    int link_wanted;
+    int link_up;
+    int frame_sent;
+    BPending job_want_link;
+    BTimer idle_timer;
+    
     // peers linked list node
     LinkedList1Node list_node;
 };
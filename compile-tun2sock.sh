@@ -50,6 +50,7 @@ system/BReactor_badvpn.c
 system/BSignal.c
 system/BConnection_unix.c
 system/BConnection_common.c
+system/BDatagram_unix.c
 system/BTime.c
 system/BUnixSignal.c
 system/BNetwork.c
@@ -91,13 +92,20 @@ lwip/src/core/ipv6/icmp6.c
 lwip/src/core/ipv6/ip6_addr.c
 lwip/src/core/ipv6/ip6_frag.c
 lwip/custom/sys.c
+lwip/custom/tcpopts.c
+lwip/custom/chksum.c
 tun2socks/tun2socks.c
 base/DebugObject.c
 base/BLog.c
 base/BPending.c
 flowextra/PacketPassInactivityMonitor.c
+flowextra/StatsServer.c
 tun2socks/SocksUdpGwClient.c
+tun2socks/SocksTcpGwClient.c
+tun2socks/SocksUdpClient.c
+tun2socks/DnsCache.c
 udpgw_client/UdpGwClient.c
+tcpmux/TcpMux.c
 "
 
 set -e
@@ -34,11 +34,8 @@
 #include <net/if.h>
 #include <net/if_arp.h>
 #include <sys/ioctl.h>
-#include <linux/filter.h>
 
 #include <misc/debug.h>
-#include <misc/byteorder.h>
-#include <misc/ethernet_proto.h>
 #include <misc/ipv4_proto.h>
 #include <misc/udp_proto.h>
 #include <misc/dhcp_proto.h>
@@ -54,21 +51,10 @@
 
 #define IPUDP_OVERHEAD (sizeof(struct ipv4_header) + sizeof(struct udp_header))
 
-static const struct sock_filter dhcp_sock_filter[] = {
-    BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 9),                        // A <- IP protocol
-    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPV4_PROTOCOL_UDP, 0, 3), // IP protocol = UDP ?
-    BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 22),                       // A <- UDP destination port
-    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, DHCP_CLIENT_PORT, 0, 1),  // UDP destination port = DHCP client ?
-    BPF_STMT(BPF_RET + BPF_K, 65535),                             // return all
-    BPF_STMT(BPF_RET + BPF_K, 0)                                  // ignore
-};
-
-static void dgram_handler (BDHCPClient *o, int event)
+static void sock_handler_error (BDHCPClient *o)
 {
     DebugObject_Access(&o->d_obj);
     
-    BLog(BLOG_ERROR, "packet socket error");
-    
     // report error
     DEBUGERROR(&o->d_err, o->handler(o->user, BDHCPCLIENT_EVENT_ERROR));
     return;
@@ -100,28 +86,7 @@ static void dhcp_func_getsendermac (BDHCPClient *o, uint8_t *out_mac)
 {
     DebugObject_Access(&o->d_obj);
     
-    BAddr remote_addr;
-    BIPAddr local_addr;
-    if (!BDatagram_GetLastReceiveAddrs(&o->dgram, &remote_addr, &local_addr)) {
-        BLog(BLOG_ERROR, "BDatagram_GetLastReceiveAddrs failed");
-        goto fail;
-    }
-    
-    if (remote_addr.type != BADDR_TYPE_PACKET) {
-        BLog(BLOG_ERROR, "address type invalid");
-        goto fail;
-    }
-    
-    if (remote_addr.packet.header_type != BADDR_PACKET_HEADER_TYPE_ETHERNET) {
-        BLog(BLOG_ERROR, "address header type invalid");
-        goto fail;
-    }
-    
-    memcpy(out_mac, remote_addr.packet.phys_addr, 6);
-    return;
-    
-fail:
-    memset(out_mac, 0, 6);
+    DHCPPacketSocketUser_GetSenderMAC(&o->sock, out_mac);
 }
 
 int BDHCPClient_Init (BDHCPClient *o, const char *ifname, struct BDHCPClient_opts opts, BReactor *reactor, BRandom2 *random2, BDHCPClient_handler handler, void *user)
@@ -150,45 +115,21 @@ int BDHCPClient_Init (BDHCPClient *o, const char *ifname, struct BDHCPClient_opt
     
     int dhcp_mtu = if_mtu - IPUDP_OVERHEAD;
     
-    // init dgram
-    if (!BDatagram_Init(&o->dgram, BADDR_TYPE_PACKET, o->reactor, o, (BDatagram_handler)dgram_handler)) {
-        BLog(BLOG_ERROR, "BDatagram_Init failed");
-        goto fail0;
-    }
+    // init receiving
     
-    // set socket filter
-    {
-        struct sock_filter filter[sizeof(dhcp_sock_filter) / sizeof(dhcp_sock_filter[0])];
-        memcpy(filter, dhcp_sock_filter, sizeof(filter));
-        struct sock_fprog fprog = {
-            .len = sizeof(filter) / sizeof(filter[0]),
-            .filter = filter
-        };
-        if (setsockopt(BDatagram_GetFd(&o->dgram), SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
-            BLog(BLOG_NOTICE, "not using socket filter");
-        }
-    }
+    // init copier
+    PacketCopier_Init(&o->recv_copier, dhcp_mtu, BReactor_PendingGroup(o->reactor));
     
-    // bind dgram
-    BAddr bind_addr;
-    BAddr_InitPacket(&bind_addr, hton16(ETHERTYPE_IPV4), if_index, BADDR_PACKET_HEADER_TYPE_ETHERNET, BADDR_PACKET_PACKET_TYPE_HOST, if_mac);
-    if (!BDatagram_Bind(&o->dgram, bind_addr)) {
-        BLog(BLOG_ERROR, "BDatagram_Bind failed");
+    // init decoder
+    DHCPIpUdpDecoder_Init(&o->recv_decoder, PacketCopier_GetInput(&o->recv_copier), BReactor_PendingGroup(o->reactor));
+    
+    // init shared packet socket, passing received packets to the decoder
+    if (!DHCPPacketSocketUser_Init(&o->sock, o->reactor, if_index, if_mac, if_mtu, DHCPIpUdpDecoder_GetInput(&o->recv_decoder), o,
+                                   (DHCPPacketSocketUser_handler_error)sock_handler_error)) {
+        BLog(BLOG_ERROR, "DHCPPacketSocketUser_Init failed");
         goto fail1;
     }
     
-    // set dgram send addresses
-    BAddr dest_addr;
-    uint8_t broadcast_mac[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
-    BAddr_InitPacket(&dest_addr, hton16(ETHERTYPE_IPV4), if_index, BADDR_PACKET_HEADER_TYPE_ETHERNET, BADDR_PACKET_PACKET_TYPE_BROADCAST, broadcast_mac);
-    BIPAddr local_addr;
-    BIPAddr_InitInvalid(&local_addr);
-    BDatagram_SetSendAddrs(&o->dgram, dest_addr, local_addr);
-
-    // init dgram interfaces
-    BDatagram_SendAsync_Init(&o->dgram, if_mtu);
-    BDatagram_RecvAsync_Init(&o->dgram, if_mtu);
-    
     // init sending
     
     // init copier
@@ -198,25 +139,11 @@ int BDHCPClient_Init (BDHCPClient *o, const char *ifname, struct BDHCPClient_opt
     DHCPIpUdpEncoder_Init(&o->send_encoder, PacketCopier_GetOutput(&o->send_copier), BReactor_PendingGroup(o->reactor));
     
     // init buffer
-    if (!SinglePacketBuffer_Init(&o->send_buffer, DHCPIpUdpEncoder_GetOutput(&o->send_encoder), BDatagram_SendAsync_GetIf(&o->dgram), BReactor_PendingGroup(o->reactor))) {
+    if (!SinglePacketBuffer_Init(&o->send_buffer, DHCPIpUdpEncoder_GetOutput(&o->send_encoder), DHCPPacketSocketUser_GetSendInput(&o->sock), BReactor_PendingGroup(o->reactor))) {
         BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed");
         goto fail2;
     }
     
-    // init receiving
-    
-    // init copier
-    PacketCopier_Init(&o->recv_copier, dhcp_mtu, BReactor_PendingGroup(o->reactor));
-    
-    // init decoder
-    DHCPIpUdpDecoder_Init(&o->recv_decoder, PacketCopier_GetInput(&o->recv_copier), BReactor_PendingGroup(o->reactor));
-    
-    // init buffer
-    if (!SinglePacketBuffer_Init(&o->recv_buffer, BDatagram_RecvAsync_GetIf(&o->dgram), DHCPIpUdpDecoder_GetInput(&o->recv_decoder), BReactor_PendingGroup(o->reactor))) {
-        BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed");
-        goto fail3;
-    }
-    
     // init options
     struct BDHCPClientCore_opts core_opts;
     core_opts.hostname = opts.hostname;
@@ -239,7 +166,7 @@ int BDHCPClient_Init (BDHCPClient *o, const char *ifname, struct BDHCPClient_opt
                               (BDHCPClientCore_handler)dhcp_handler
     )) {
         BLog(BLOG_ERROR, "BDHCPClientCore_Init failed");
-        goto fail4;
+        goto fail3;
     }
     
     // set not up
@@ -249,19 +176,15 @@ int BDHCPClient_Init (BDHCPClient *o, const char *ifname, struct BDHCPClient_opt
     DebugObject_Init(&o->d_obj);
     return 1;
     
-fail4:
-    SinglePacketBuffer_Free(&o->recv_buffer);
 fail3:
-    DHCPIpUdpDecoder_Free(&o->recv_decoder);
-    PacketCopier_Free(&o->recv_copier);
     SinglePacketBuffer_Free(&o->send_buffer);
 fail2:
     DHCPIpUdpEncoder_Free(&o->send_encoder);
     PacketCopier_Free(&o->send_copier);
-    BDatagram_RecvAsync_Free(&o->dgram);
-    BDatagram_SendAsync_Free(&o->dgram);
+    DHCPPacketSocketUser_Free(&o->sock);
 fail1:
-    BDatagram_Free(&o->dgram);
+    DHCPIpUdpDecoder_Free(&o->recv_decoder);
+    PacketCopier_Free(&o->recv_copier);
 fail0:
     return 0;
 }
@@ -274,22 +197,17 @@ void BDHCPClient_Free (BDHCPClient *o)
     // free dhcp
     BDHCPClientCore_Free(&o->dhcp);
     
-    // free receiving
-    SinglePacketBuffer_Free(&o->recv_buffer);
-    DHCPIpUdpDecoder_Free(&o->recv_decoder);
-    PacketCopier_Free(&o->recv_copier);
-    
     // free sending
     SinglePacketBuffer_Free(&o->send_buffer);
     DHCPIpUdpEncoder_Free(&o->send_encoder);
     PacketCopier_Free(&o->send_copier);
     
-    // free dgram interfaces
-    BDatagram_RecvAsync_Free(&o->dgram);
-    BDatagram_SendAsync_Free(&o->dgram);
+    // free shared packet socket
+    DHCPPacketSocketUser_Free(&o->sock);
     
-    // free dgram
-    BDatagram_Free(&o->dgram);
+    // free receiving
+    DHCPIpUdpDecoder_Free(&o->recv_decoder);
+    PacketCopier_Free(&o->recv_copier);
 }
 
 int BDHCPClient_IsUp (BDHCPClient *o)
@@ -35,12 +35,12 @@
 #define BADVPN_DHCPCLIENT_BDHCPCLIENT_H
 
 #include <base/DebugObject.h>
-#include <system/BDatagram.h>
 #include <flow/PacketCopier.h>
 #include <flow/SinglePacketBuffer.h>
 #include <dhcpclient/BDHCPClientCore.h>
 #include <dhcpclient/DHCPIpUdpDecoder.h>
 #include <dhcpclient/DHCPIpUdpEncoder.h>
+#include <dhcpclient/DHCPPacketSocket.h>
 
 #define BDHCPCLIENT_EVENT_UP 1
 #define BDHCPCLIENT_EVENT_DOWN 2
@@ -52,13 +52,12 @@ typedef void (*BDHCPClient_handler) (void *user, int event);
 
 typedef struct {
     BReactor *reactor;
-    BDatagram dgram;
     BDHCPClient_handler handler;
     void *user;
+    DHCPPacketSocketUser sock;
     PacketCopier send_copier;
     DHCPIpUdpEncoder send_encoder;
     SinglePacketBuffer send_buffer;
-    SinglePacketBuffer recv_buffer;
     DHCPIpUdpDecoder recv_decoder;
     PacketCopier recv_copier;
     BDHCPClientCore dhcp;
@@ -765,10 +765,10 @@ int BDHCPClientCore_Init (BDHCPClientCore *o, PacketPassInterface *send_if, Pack
     o->sending = 0;
     
     // init timers
-    BTimer_Init(&o->reset_timer, RESET_TIMEOUT, (BTimer_handler)reset_timer_handler, o);
-    BTimer_Init(&o->request_timer, REQUEST_TIMEOUT, (BTimer_handler)request_timer_handler, o);
+    BTimer_InitCoarse(&o->reset_timer, RESET_TIMEOUT, (BTimer_handler)reset_timer_handler, o);
+    BTimer_InitCoarse(&o->request_timer, REQUEST_TIMEOUT, (BTimer_handler)request_timer_handler, o);
     BTimer_Init(&o->renew_timer, 0, (BTimer_handler)renew_timer_handler, o);
-    BTimer_Init(&o->renew_request_timer, RENEW_REQUEST_TIMEOUT, (BTimer_handler)renew_request_timer_handler, o);
+    BTimer_InitCoarse(&o->renew_request_timer, RENEW_REQUEST_TIMEOUT, (BTimer_handler)renew_request_timer_handler, o);
     BTimer_Init(&o->lease_timer, 0, (BTimer_handler)lease_timer_handler, o);
     
     // start receving
@@ -0,0 +1,457 @@
+/**
+ * @file BBufferArena.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+
+#include <misc/balloc.h>
+#include <misc/byteorder.h>
+#include <misc/offset.h>
+#include <misc/ethernet_proto.h>
+#include <misc/ipv4_proto.h>
+#include <misc/dhcp_proto.h>
+#include <base/BLog.h>
+
+#include <dhcpclient/DHCPPacketSocket.h>
+
+#include <generated/blog_channel_DHCPPacketSocket.h>
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+
+// users whose interface and MAC address are matched by the socket filter;
+// with more, the filter only checks that packets are DHCP replies
+#define FILTER_MAX_USERS 512
+
+#define FILTER_HEADER_LEN 15
+#define FILTER_USER_LEN 7
+#define FILTER_REJECT 14
+
+// jump offset from the instruction at pc to the reject instruction
+#define REJ(pc) (FILTER_REJECT - ((pc) + 1))
+
+// accepts DHCP replies to a client port, from a server port, which are
+// not fragmented; X is left holding the IP header length
+static const struct sock_filter filter_header[FILTER_HEADER_LEN] = {
+    BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),        // A <- packet type
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, PACKET_OUTGOING, REJ(1), 0),       // packet type = outgoing ?
+    BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 9),                                 // A <- IP protocol
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPV4_PROTOCOL_UDP, 0, REJ(3)),     // IP protocol = UDP ?
+    BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 6),                                 // A <- IP flags and fragment offset
+    BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K, 0x3fff, REJ(5), 0),               // more fragments or fragment offset ?
+    BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 0),                                // X <- IP header length
+    BPF_STMT(BPF_LD + BPF_H + BPF_IND, 0),                                 // A <- UDP source port
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, DHCP_SERVER_PORT, 0, REJ(8)),      // UDP source port = DHCP server ?
+    BPF_STMT(BPF_LD + BPF_H + BPF_IND, 2),                                 // A <- UDP destination port
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, DHCP_CLIENT_PORT, 0, REJ(10)),     // UDP destination port = DHCP client ?
+    BPF_STMT(BPF_LD + BPF_B + BPF_IND, 8),                                 // A <- DHCP op
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, DHCP_OP_BOOTREPLY, 0, REJ(12)),    // DHCP op = reply ?
+    BPF_STMT(BPF_JMP + BPF_JA, 1),                                         // go to users
+    BPF_STMT(BPF_RET + BPF_K, 0)                                           // reject
+};
+
+// the shared sockets, one per reactor; zero-initialized, which is an empty list
+static LinkedList1 sockets;
+
+static void dgram_handler (DHCPPacketSocket *o, int event)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    BLog(BLOG_ERROR, "packet socket error");
+    
+    // report error to all users, from jobs, since they will free themselves
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->users); ln; ln = LinkedList1Node_Next(ln)) {
+        DHCPPacketSocketUser *user = UPPER_OBJECT(ln, DHCPPacketSocketUser, users_node);
+        BPending_Set(&user->error_job);
+    }
+}
+
+static void send_next (DHCPPacketSocket *o)
+{
+    ASSERT(!o->sending)
+    ASSERT(!LinkedList1_IsEmpty(&o->send_queue))
+    
+    DHCPPacketSocketUser *user = UPPER_OBJECT(LinkedList1_GetFirst(&o->send_queue), DHCPPacketSocketUser, send_queue_node);
+    LinkedList1_Remove(&o->send_queue, &user->send_queue_node);
+    user->send_queued = 0;
+    
+    // copy the packet, so that the user may go away while it is being sent
+    memcpy(o->send_buf, user->send_data, user->send_len);
+    
+    // broadcast on the user's interface
+    BAddr dest_addr;
+    uint8_t broadcast_mac[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    BAddr_InitPacket(&dest_addr, hton16(ETHERTYPE_IPV4), user->ifindex, BADDR_PACKET_HEADER_TYPE_ETHERNET, BADDR_PACKET_PACKET_TYPE_BROADCAST, broadcast_mac);
+    BIPAddr local_addr;
+    BIPAddr_InitInvalid(&local_addr);
+    BDatagram_SetSendAddrs(&o->dgram, dest_addr, local_addr);
+    
+    o->sending = 1;
+    PacketPassInterface_Sender_Send(BDatagram_SendAsync_GetIf(&o->dgram), o->send_buf, user->send_len);
+    
+    // the user's packet is taken care of
+    PacketPassInterface_Done(&user->send_input);
+}
+
+static void send_handler_done (DHCPPacketSocket *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->sending)
+    
+    o->sending = 0;
+    
+    if (!LinkedList1_IsEmpty(&o->send_queue)) {
+        send_next(o);
+    }
+}
+
+static void recv_handler_done (DHCPPacketSocket *o, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= DHCPPACKETSOCKET_MTU)
+    
+    BAddr remote_addr;
+    BIPAddr local_addr;
+    if (!BDatagram_GetLastReceiveAddrs(&o->dgram, &remote_addr, &local_addr) ||
+        remote_addr.type != BADDR_TYPE_PACKET || remote_addr.packet.header_type != BADDR_PACKET_HEADER_TYPE_ETHERNET
+    ) {
+        goto out;
+    }
+    
+    // pass the packet to the users on the interface it arrived on
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->users); ln; ln = LinkedList1Node_Next(ln)) {
+        DHCPPacketSocketUser *user = UPPER_OBJECT(ln, DHCPPacketSocketUser, users_node);
+        if (user->ifindex != remote_addr.packet.interface_index || user->recv_busy || data_len > user->mtu) {
+            continue;
+        }
+        memcpy(user->recv_buf, o->recv_buf, data_len);
+        memcpy(user->recv_sender_mac, remote_addr.packet.phys_addr, 6);
+        user->recv_busy = 1;
+        PacketPassInterface_Sender_Send(user->recv_output, user->recv_buf, data_len);
+    }
+    
+out:
+    // receive next packet
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&o->dgram), o->recv_buf);
+}
+
+static void set_filter (DHCPPacketSocket *o)
+{
+    // count users
+    size_t num_users = 0;
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->users); ln; ln = LinkedList1Node_Next(ln)) {
+        num_users++;
+    }
+    int match_users = (num_users <= FILTER_MAX_USERS);
+    
+    size_t len = FILTER_HEADER_LEN + (match_users ? num_users * FILTER_USER_LEN : 0) + 1;
+    struct sock_filter *filter = (struct sock_filter *)BAllocArray(len, sizeof(filter[0]));
+    if (!filter) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        return;
+    }
+    
+    memcpy(filter, filter_header, sizeof(filter_header));
+    size_t pos = FILTER_HEADER_LEN;
+    
+    if (match_users) {
+        // accept replies with the chaddr of a user on the interface they arrived on
+        for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->users); ln; ln = LinkedList1Node_Next(ln)) {
+            DHCPPacketSocketUser *user = UPPER_OBJECT(ln, DHCPPacketSocketUser, users_node);
+            uint8_t *m = user->mac;
+            uint32_t mac_high = ((uint32_t)m[0] << 24) | ((uint32_t)m[1] << 16) | ((uint32_t)m[2] << 8) | m[3];
+            uint32_t mac_low = ((uint32_t)m[4] << 8) | m[5];
+            
+            struct sock_filter user_filter[FILTER_USER_LEN] = {
+                BPF_STMT(BPF_LD + BPF_W + BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX), // A <- interface index
+                BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, user->ifindex, 0, 5),       // interface index = user's ?
+                BPF_STMT(BPF_LD + BPF_W + BPF_IND, 8 + 28),                      // A <- chaddr[0..3]
+                BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, mac_high, 0, 3),            // chaddr[0..3] = user's ?
+                BPF_STMT(BPF_LD + BPF_H + BPF_IND, 8 + 32),                      // A <- chaddr[4..5]
+                BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, mac_low, 0, 1),             // chaddr[4..5] = user's ?
+                BPF_STMT(BPF_RET + BPF_K, 65535)                                 // return all
+            };
+            memcpy(filter + pos, user_filter, sizeof(user_filter));
+            pos += FILTER_USER_LEN;
+        }
+        
+        // ignore replies for nobody
+        filter[pos++] = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, 0);
+    } else {
+        // too many users, leave matching to recv_handler_done
+        filter[pos++] = (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, 65535);
+    }
+    
+    ASSERT(pos == len)
+    
+    struct sock_fprog fprog = {
+        .len = len,
+        .filter = filter
+    };
+    if (setsockopt(BDatagram_GetFd(&o->dgram), SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+        BLog(BLOG_NOTICE, "not using socket filter");
+    }
+    
+    BFree(filter);
+}
+
+static DHCPPacketSocket * socket_ref (BReactor *reactor)
+{
+    // use the reactor's socket if there is one
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&sockets); ln; ln = LinkedList1Node_Next(ln)) {
+        DHCPPacketSocket *o = UPPER_OBJECT(ln, DHCPPacketSocket, list_node);
+        if (o->reactor == reactor) {
+            o->refcount++;
+            return o;
+        }
+    }
+    
+    DHCPPacketSocket *o = (DHCPPacketSocket *)BAlloc(sizeof(*o));
+    if (!o) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    o->reactor = reactor;
+    o->refcount = 1;
+    
+    // allocate buffers
+    if (!(o->send_buf = (uint8_t *)BAlloc(DHCPPACKETSOCKET_MTU))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail1;
+    }
+    if (!(o->recv_buf = (uint8_t *)BAlloc(DHCPPACKETSOCKET_MTU))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail2;
+    }
+    
+    // init dgram
+    if (!BDatagram_Init(&o->dgram, BADDR_TYPE_PACKET, reactor, o, (BDatagram_handler)dgram_handler)) {
+        BLog(BLOG_ERROR, "BDatagram_Init failed");
+        goto fail3;
+    }
+    
+    // init lists
+    LinkedList1_Init(&o->users);
+    LinkedList1_Init(&o->send_queue);
+    
+    // set socket filter, before binding so that nothing else is queued;
+    // without users, it rejects everything
+    set_filter(o);
+    
+    // bind dgram to all interfaces
+    BAddr bind_addr;
+    uint8_t zero_mac[6] = {0};
+    BAddr_InitPacket(&bind_addr, hton16(ETHERTYPE_IPV4), 0, BADDR_PACKET_HEADER_TYPE_ETHERNET, BADDR_PACKET_PACKET_TYPE_HOST, zero_mac);
+    if (!BDatagram_Bind(&o->dgram, bind_addr)) {
+        BLog(BLOG_ERROR, "BDatagram_Bind failed");
+        goto fail4;
+    }
+    
+    // init dgram interfaces
+    BDatagram_SendAsync_Init(&o->dgram, DHCPPACKETSOCKET_MTU);
+    BDatagram_RecvAsync_Init(&o->dgram, DHCPPACKETSOCKET_MTU);
+    PacketPassInterface_Sender_Init(BDatagram_SendAsync_GetIf(&o->dgram), (PacketPassInterface_handler_done)send_handler_done, o);
+    PacketRecvInterface_Receiver_Init(BDatagram_RecvAsync_GetIf(&o->dgram), (PacketRecvInterface_handler_done)recv_handler_done, o);
+    
+    // not sending
+    o->sending = 0;
+    
+    // start receiving
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&o->dgram), o->recv_buf);
+    
+    LinkedList1_Append(&sockets, &o->list_node);
+    
+    DebugObject_Init(&o->d_obj);
+    return o;
+    
+fail4:
+    BDatagram_Free(&o->dgram);
+fail3:
+    BFree(o->recv_buf);
+fail2:
+    BFree(o->send_buf);
+fail1:
+    BFree(o);
+fail0:
+    return NULL;
+}
+
+static void socket_unref (DHCPPacketSocket *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->refcount > 0)
+    
+    if (--o->refcount > 0) {
+        return;
+    }
+    
+    ASSERT(LinkedList1_IsEmpty(&o->users))
+    ASSERT(LinkedList1_IsEmpty(&o->send_queue))
+    DebugObject_Free(&o->d_obj);
+    
+    LinkedList1_Remove(&sockets, &o->list_node);
+    
+    // free dgram
+    BDatagram_RecvAsync_Free(&o->dgram);
+    BDatagram_SendAsync_Free(&o->dgram);
+    BDatagram_Free(&o->dgram);
+    
+    // free buffers
+    BFree(o->recv_buf);
+    BFree(o->send_buf);
+    
+    BFree(o);
+}
+
+static void user_send_input_handler_send (DHCPPacketSocketUser *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->mtu)
+    
+    // queue the packet
+    o->send_data = data;
+    o->send_len = data_len;
+    o->send_queued = 1;
+    LinkedList1_Append(&o->sock->send_queue, &o->send_queue_node);
+    
+    if (!o->sock->sending) {
+        send_next(o->sock);
+    }
+}
+
+static void user_recv_output_handler_done (DHCPPacketSocketUser *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->recv_busy)
+    
+    o->recv_busy = 0;
+}
+
+static void user_error_job_handler (DHCPPacketSocketUser *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->handler_error(o->user);
+    return;
+}
+
+int DHCPPacketSocketUser_Init (DHCPPacketSocketUser *o, BReactor *reactor, int ifindex, const uint8_t *mac, int mtu, PacketPassInterface *recv_output,
+                               void *user, DHCPPacketSocketUser_handler_error handler_error)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(mtu <= DHCPPACKETSOCKET_MTU)
+    ASSERT(PacketPassInterface_GetMTU(recv_output) >= mtu)
+    
+    // init arguments
+    o->ifindex = ifindex;
+    memcpy(o->mac, mac, sizeof(o->mac));
+    o->mtu = mtu;
+    o->recv_output = recv_output;
+    o->user = user;
+    o->handler_error = handler_error;
+    
+    // allocate receive buffer
+    if (!(o->recv_buf = (uint8_t *)BAlloc(mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    
+    // get the reactor's socket
+    if (!(o->sock = socket_ref(reactor))) {
+        goto fail1;
+    }
+    
+    // init send input
+    PacketPassInterface_Init(&o->send_input, mtu, (PacketPassInterface_handler_send)user_send_input_handler_send, o, BReactor_PendingGroup(reactor));
+    o->send_queued = 0;
+    
+    // init receive output
+    PacketPassInterface_Sender_Init(o->recv_output, (PacketPassInterface_handler_done)user_recv_output_handler_done, o);
+    o->recv_busy = 0;
+    memset(o->recv_sender_mac, 0, sizeof(o->recv_sender_mac));
+    
+    // init error job
+    BPending_Init(&o->error_job, BReactor_PendingGroup(reactor), (BPending_handler)user_error_job_handler, o);
+    
+    // receive packets for our interface
+    LinkedList1_Append(&o->sock->users, &o->users_node);
+    set_filter(o->sock);
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    BFree(o->recv_buf);
+fail0:
+    return 0;
+}
+
+void DHCPPacketSocketUser_Free (DHCPPacketSocketUser *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // stop receiving
+    LinkedList1_Remove(&o->sock->users, &o->users_node);
+    set_filter(o->sock);
+    
+    // drop a packet waiting to be sent
+    if (o->send_queued) {
+        LinkedList1_Remove(&o->sock->send_queue, &o->send_queue_node);
+    }
+    
+    // free error job
+    BPending_Free(&o->error_job);
+    
+    // free send input
+    PacketPassInterface_Free(&o->send_input);
+    
+    // release the reactor's socket
+    socket_unref(o->sock);
+    
+    // free receive buffer
+    BFree(o->recv_buf);
+}
+
+PacketPassInterface * DHCPPacketSocketUser_GetSendInput (DHCPPacketSocketUser *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->send_input;
+}
+
+void DHCPPacketSocketUser_GetSenderMAC (DHCPPacketSocketUser *o, uint8_t *out_mac)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    memcpy(out_mac, o->recv_sender_mac, 6);
+}
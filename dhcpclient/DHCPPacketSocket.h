@@ -0,0 +1,143 @@
+/**
+ * @file BBufferArena.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Packet socket for DHCP client traffic, shared by the DHCP clients of a reactor.
+ */
+
+#ifndef BADVPN_DHCPCLIENT_DHCPPACKETSOCKET_H
+#define BADVPN_DHCPCLIENT_DHCPPACKETSOCKET_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <structure/LinkedList1.h>
+#include <system/BReactor.h>
+#include <system/BDatagram.h>
+#include <flow/PacketPassInterface.h>
+
+// largest packet sent or received through the shared socket
+#define DHCPPACKETSOCKET_MTU 65535
+
+typedef void (*DHCPPacketSocketUser_handler_error) (void *user);
+
+/**
+ * One AF_PACKET socket, not bound to an interface, receiving the DHCP replies
+ * for its users on all interfaces. Its socket filter is rebuilt as users come
+ * and go so that it only accepts replies on a user's interface with the user's
+ * MAC address as chaddr. There is one per reactor, created
+ * with the first {@link DHCPPacketSocketUser} and freed with the last one, so
+ * that many DHCP clients on many interfaces don't each need their own socket,
+ * socket filter and buffers.
+ */
+typedef struct {
+    BReactor *reactor;
+    int refcount;
+    BDatagram dgram;
+    LinkedList1 users;
+    LinkedList1 send_queue;
+    int sending;
+    uint8_t *send_buf;
+    uint8_t *recv_buf;
+    LinkedList1Node list_node;
+    DebugObject d_obj;
+} DHCPPacketSocket;
+
+/**
+ * The use of the shared socket by a DHCP client on one interface.
+ * Packets sent through the input are broadcast on the interface, and received
+ * packets which arrived on the interface are passed to the output; a packet
+ * which arrives while the output is busy is dropped.
+ */
+typedef struct {
+    DHCPPacketSocket *sock;
+    int ifindex;
+    uint8_t mac[6];
+    int mtu;
+    void *user;
+    DHCPPacketSocketUser_handler_error handler_error;
+    LinkedList1Node users_node;
+    PacketPassInterface send_input;
+    uint8_t *send_data;
+    int send_len;
+    int send_queued;
+    LinkedList1Node send_queue_node;
+    PacketPassInterface *recv_output;
+    uint8_t *recv_buf;
+    int recv_busy;
+    uint8_t recv_sender_mac[6];
+    BPending error_job;
+    DebugObject d_obj;
+} DHCPPacketSocketUser;
+
+/**
+ * Initializes the object, creating the reactor's shared socket if this is
+ * its first user.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param ifindex index of the interface
+ * @param mac MAC address of the client (the chaddr of the replies it wants)
+ * @param mtu maximum packet size, in both directions. Must be >=0 and
+ *            <={@link DHCPPACKETSOCKET_MTU}.
+ * @param recv_output interface to pass received packets to. Its MTU must be >=mtu.
+ * @param user argument to handler
+ * @param handler_error handler called when the shared socket fails
+ * @return 1 on success, 0 on failure
+ */
+int DHCPPacketSocketUser_Init (DHCPPacketSocketUser *o, BReactor *reactor, int ifindex, const uint8_t *mac, int mtu, PacketPassInterface *recv_output,
+                               void *user, DHCPPacketSocketUser_handler_error handler_error) WARN_UNUSED;
+
+/**
+ * Frees the object, freeing the shared socket if this was its last user.
+ * 
+ * @param o the object
+ */
+void DHCPPacketSocketUser_Free (DHCPPacketSocketUser *o);
+
+/**
+ * Returns the interface for sending packets.
+ * 
+ * @param o the object
+ * @return input interface, with MTU as in {@link DHCPPacketSocketUser_Init}
+ */
+PacketPassInterface * DHCPPacketSocketUser_GetSendInput (DHCPPacketSocketUser *o);
+
+/**
+ * Returns the MAC address of the sender of the packet last passed to the
+ * output, which is valid while the output is processing it.
+ * 
+ * @param o the object
+ * @param out_mac returns the MAC address
+ */
+void DHCPPacketSocketUser_GetSenderMAC (DHCPPacketSocketUser *o, uint8_t *out_mac);
+
+#endif
@@ -0,0 +1,477 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/byteorder.h>
+#include <misc/hashfun.h>
+#include <misc/balloc.h>
+#include <misc/offset.h>
+#include <base/BLog.h>
+
+#include <dnscache/DnsCache.h>
+
+#include <generated/blog_channel_DnsCache.h>
+
+#include "DnsCache_hash.h"
+#include <structure/CHash_impl.h>
+
+#define DNS_HEADER_LEN 12
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_TC 0x0200
+#define DNS_OPCODE(flags) (((flags) >> 11) & 0xF)
+#define DNS_RCODE(flags) ((flags) & 0xF)
+#define DNS_RCODE_NOERROR 0
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_TYPE_OPT 41
+
+static uint16_t read16 (const uint8_t *p);
+static uint32_t read32 (const uint8_t *p);
+static void write16 (uint8_t *p, uint16_t v);
+static void write32 (uint8_t *p, uint32_t v);
+static int parse_question (const uint8_t *data, int data_len, uint8_t *key, int *out_key_len, int *out_end);
+static int skip_name (const uint8_t *data, int data_len, int *pos);
+static int walk_records (uint8_t *data, int data_len, int pos, int num_records, uint32_t decrement, uint32_t *out_min_ttl);
+static struct DnsCache_entry * find_entry (DnsCache *o, const uint8_t *key, int key_len);
+static struct DnsCache_entry * entry_init (DnsCache *o, const uint8_t *key, int key_len, btime_t now);
+static void entry_free (DnsCache *o, struct DnsCache_entry *e);
+static void send_with_id (DnsCache *o, BAddr local_addr, BAddr remote_addr, uint64_t tag, uint16_t id, const uint8_t *data, int data_len);
+
+static uint16_t read16 (const uint8_t *p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntoh16(v);
+}
+
+static uint32_t read32 (const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntoh32(v);
+}
+
+static void write16 (uint8_t *p, uint16_t v)
+{
+    v = hton16(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void write32 (uint8_t *p, uint32_t v)
+{
+    v = hton32(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static int parse_question (const uint8_t *data, int data_len, uint8_t *key, int *out_key_len, int *out_end)
+{
+    int pos = DNS_HEADER_LEN;
+    int key_len = 0;
+    
+    // copy name, lowercased; no compression is expected in the question
+    while (1) {
+        if (pos >= data_len) {
+            return 0;
+        }
+        uint8_t label_len = data[pos];
+        if (label_len == 0) {
+            key[key_len++] = 0;
+            pos++;
+            break;
+        }
+        if (label_len > 63 || pos + 1 + label_len > data_len || key_len + 1 + label_len + 1 > 255) {
+            return 0;
+        }
+        key[key_len++] = label_len;
+        for (int i = 0; i < label_len; i++) {
+            uint8_t c = data[pos + 1 + i];
+            key[key_len++] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+        }
+        pos += 1 + label_len;
+    }
+    
+    // copy type and class
+    if (pos + 4 > data_len) {
+        return 0;
+    }
+    memcpy(key + key_len, data + pos, 4);
+    key_len += 4;
+    pos += 4;
+    
+    *out_key_len = key_len;
+    *out_end = pos;
+    return 1;
+}
+
+static int skip_name (const uint8_t *data, int data_len, int *pos)
+{
+    while (1) {
+        if (*pos >= data_len) {
+            return 0;
+        }
+        uint8_t label_len = data[*pos];
+        if ((label_len & 0xC0) == 0xC0) {
+            // compression pointer ends the name
+            if (*pos + 2 > data_len) {
+                return 0;
+            }
+            *pos += 2;
+            return 1;
+        }
+        if ((label_len & 0xC0)) {
+            return 0;
+        }
+        *pos += 1 + label_len;
+        if (label_len == 0) {
+            return 1;
+        }
+    }
+}
+
+static int walk_records (uint8_t *data, int data_len, int pos, int num_records, uint32_t decrement, uint32_t *out_min_ttl)
+{
+    int have_ttl = 0;
+    uint32_t min_ttl = 0;
+    
+    for (int i = 0; i < num_records; i++) {
+        if (!skip_name(data, data_len, &pos) || pos + 10 > data_len) {
+            return 0;
+        }
+        uint16_t type = read16(data + pos);
+        uint32_t ttl = read32(data + pos + 4);
+        uint16_t rdlength = read16(data + pos + 8);
+        
+        // the TTL field of OPT holds EDNS flags, leave it alone
+        if (type != DNS_TYPE_OPT) {
+            if (decrement > 0) {
+                ttl = (ttl > decrement) ? ttl - decrement : 0;
+                write32(data + pos + 4, ttl);
+            }
+            if (!have_ttl || ttl < min_ttl) {
+                min_ttl = ttl;
+                have_ttl = 1;
+            }
+        }
+        
+        pos += 10;
+        if (rdlength > data_len - pos) {
+            return 0;
+        }
+        pos += rdlength;
+    }
+    
+    if (out_min_ttl) {
+        if (!have_ttl) {
+            return 0;
+        }
+        *out_min_ttl = min_ttl;
+    }
+    
+    return 1;
+}
+
+static struct DnsCache_entry * find_entry (DnsCache *o, const uint8_t *key, int key_len)
+{
+    DnsCache__hashkey hkey = {key, key_len};
+    return DnsCache__Hash_Lookup(&o->entries_hash, 0, hkey).ptr;
+}
+
+static struct DnsCache_entry * entry_init (DnsCache *o, const uint8_t *key, int key_len, btime_t now)
+{
+    ASSERT(o->num_entries <= o->max_entries)
+    ASSERT(key_len <= DNSCACHE_MAX_KEY_LEN)
+    ASSERT(!find_entry(o, key, key_len))
+    
+    // if we hit the limit, drop the least recently used entry
+    if (o->num_entries == o->max_entries) {
+        entry_free(o, UPPER_OBJECT(LinkedList1_GetFirst(&o->entries_list), struct DnsCache_entry, list_node));
+    }
+    
+    // allocate structure
+    struct DnsCache_entry *e = (struct DnsCache_entry *)malloc(sizeof(*e));
+    if (!e) {
+        BLog(BLOG_ERROR, "malloc failed");
+        return NULL;
+    }
+    
+    // set key
+    memcpy(e->key, key, key_len);
+    e->key_len = key_len;
+    e->key_hash = badvpn_djb2_hash_bin(e->key, e->key_len);
+    
+    // set in flight, without waiters
+    e->time = now;
+    e->response = NULL;
+    e->num_waiters = 0;
+    
+    // insert to hash
+    DnsCache__HashRef ref = {e, e};
+    ASSERT_EXECUTE(DnsCache__Hash_Insert(&o->entries_hash, 0, ref, NULL))
+    
+    // insert to list
+    LinkedList1_Append(&o->entries_list, &e->list_node);
+    
+    o->num_entries++;
+    
+    return e;
+}
+
+static void entry_free (DnsCache *o, struct DnsCache_entry *e)
+{
+    o->num_entries--;
+    
+    // remove from list
+    LinkedList1_Remove(&o->entries_list, &e->list_node);
+    
+    // remove from hash
+    DnsCache__HashRef ref = {e, e};
+    DnsCache__Hash_Remove(&o->entries_hash, 0, ref);
+    
+    // free response
+    free(e->response);
+    
+    // free structure
+    free(e);
+}
+
+static void send_with_id (DnsCache *o, BAddr local_addr, BAddr remote_addr, uint64_t tag, uint16_t id, const uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= DNS_HEADER_LEN)
+    ASSERT(data_len <= o->udp_mtu)
+    
+    memcpy(o->send_buf, data, data_len);
+    write16(o->send_buf, id);
+    
+    o->handler_send(o->user, local_addr, remote_addr, tag, o->send_buf, data_len);
+}
+
+int DnsCache_Init (DnsCache *o, int max_entries, int udp_mtu, btime_t max_ttl, btime_t pending_timeout,
+                   void *user, DnsCache_handler_send handler_send)
+{
+    ASSERT(max_entries > 0)
+    ASSERT(udp_mtu >= 0)
+    
+    // init arguments
+    o->max_entries = max_entries;
+    o->udp_mtu = udp_mtu;
+    o->max_ttl = max_ttl;
+    o->pending_timeout = pending_timeout;
+    o->user = user;
+    o->handler_send = handler_send;
+    
+    // init hash; there are never more entries than buckets
+    if (!DnsCache__Hash_Init(&o->entries_hash, o->max_entries)) {
+        BLog(BLOG_ERROR, "DnsCache__Hash_Init failed");
+        goto fail0;
+    }
+    
+    // init list
+    LinkedList1_Init(&o->entries_list);
+    
+    // set no entries
+    o->num_entries = 0;
+    
+    // allocate send buffer
+    if (!(o->send_buf = (uint8_t *)BAlloc(o->udp_mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail1;
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    DnsCache__Hash_Free(&o->entries_hash);
+fail0:
+    return 0;
+}
+
+void DnsCache_Free (DnsCache *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free entries
+    while (!LinkedList1_IsEmpty(&o->entries_list)) {
+        entry_free(o, UPPER_OBJECT(LinkedList1_GetFirst(&o->entries_list), struct DnsCache_entry, list_node));
+    }
+    
+    // free send buffer
+    BFree(o->send_buf);
+    
+    // free hash
+    DnsCache__Hash_Free(&o->entries_hash);
+}
+
+int DnsCache_HandleQuery (DnsCache *o, BAddr local_addr, BAddr remote_addr, uint64_t tag, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->udp_mtu)
+    
+    // only handle standard queries with a single question
+    if (data_len < DNS_HEADER_LEN) {
+        return 0;
+    }
+    uint16_t id = read16(data);
+    uint16_t flags = read16(data + 2);
+    if ((flags & DNS_FLAG_QR) || DNS_OPCODE(flags) != 0 ||
+        read16(data + 4) != 1 || read16(data + 6) != 0 || read16(data + 8) != 0
+    ) {
+        return 0;
+    }
+    
+    uint8_t key[DNSCACHE_MAX_KEY_LEN];
+    int key_len;
+    int question_end;
+    if (!parse_question(data, data_len, key, &key_len, &question_end)) {
+        return 0;
+    }
+    
+    btime_t now = btime_gettime();
+    
+    struct DnsCache_entry *e = find_entry(o, key, key_len);
+    
+    if (e && e->response) {
+        if (now >= e->expire_time) {
+            // expired, ask again
+            entry_free(o, e);
+            e = NULL;
+        } else {
+            BLog(BLOG_DEBUG, "answering from cache");
+            
+            // move to the end of the list
+            LinkedList1_Remove(&o->entries_list, &e->list_node);
+            LinkedList1_Append(&o->entries_list, &e->list_node);
+            
+            // build answer with the query's ID and question (which may differ
+            // in case), and TTLs reduced by the time it has been cached
+            memcpy(o->send_buf, e->response, e->response_len);
+            write16(o->send_buf, id);
+            memcpy(o->send_buf + DNS_HEADER_LEN, data + DNS_HEADER_LEN, question_end - DNS_HEADER_LEN);
+            int num_records = read16(o->send_buf + 6) + read16(o->send_buf + 8) + read16(o->send_buf + 10);
+            uint32_t decrement = (now - e->time) / 1000;
+            ASSERT_EXECUTE(walk_records(o->send_buf, e->response_len, question_end, num_records, decrement, NULL))
+            
+            o->handler_send(o->user, local_addr, remote_addr, tag, o->send_buf, e->response_len);
+            return 1;
+        }
+    }
+    
+    if (e) {
+        // same question is in flight; wait for it unless it's taking too long
+        if (now - e->time < o->pending_timeout && e->num_waiters < DNSCACHE_MAX_WAITERS) {
+            BLog(BLOG_DEBUG, "waiting for query in flight");
+            
+            struct DnsCache_waiter *w = &e->waiters[e->num_waiters++];
+            w->local_addr = local_addr;
+            w->remote_addr = remote_addr;
+            w->tag = tag;
+            w->id = id;
+            return 1;
+        }
+        
+        // forward this one and wait for it from now on
+        e->time = now;
+        return 0;
+    }
+    
+    // remember that this question is in flight
+    entry_init(o, key, key_len, now);
+    
+    return 0;
+}
+
+void DnsCache_HandleResponse (DnsCache *o, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->udp_mtu)
+    
+    // check header
+    if (data_len < DNS_HEADER_LEN) {
+        return;
+    }
+    uint16_t flags = read16(data + 2);
+    if (!(flags & DNS_FLAG_QR) || DNS_OPCODE(flags) != 0 || read16(data + 4) != 1) {
+        return;
+    }
+    
+    uint8_t key[DNSCACHE_MAX_KEY_LEN];
+    int key_len;
+    int question_end;
+    if (!parse_question(data, data_len, key, &key_len, &question_end)) {
+        return;
+    }
+    
+    // find the question in flight
+    struct DnsCache_entry *e = find_entry(o, key, key_len);
+    if (!e || e->response) {
+        return;
+    }
+    
+    // answer waiting queries
+    for (int i = 0; i < e->num_waiters; i++) {
+        struct DnsCache_waiter *w = &e->waiters[i];
+        send_with_id(o, w->local_addr, w->remote_addr, w->tag, w->id, data, data_len);
+    }
+    e->num_waiters = 0;
+    
+    // only cache complete answers and negative answers
+    int rcode = DNS_RCODE(flags);
+    if ((flags & DNS_FLAG_TC) || (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN)) {
+        goto uncached;
+    }
+    
+    // keep a copy
+    if (!(e->response = (uint8_t *)malloc(data_len))) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto uncached;
+    }
+    memcpy(e->response, data, data_len);
+    e->response_len = data_len;
+    
+    // the response lives as long as its shortest TTL
+    int num_records = read16(data + 6) + read16(data + 8) + read16(data + 10);
+    uint32_t min_ttl;
+    if (!walk_records(e->response, e->response_len, question_end, num_records, 0, &min_ttl) || min_ttl == 0) {
+        goto uncached;
+    }
+    
+    btime_t ttl = (btime_t)min_ttl * 1000;
+    if (ttl > o->max_ttl) {
+        ttl = o->max_ttl;
+    }
+    e->time = btime_gettime();
+    e->expire_time = e->time + ttl;
+    
+    BLog(BLOG_DEBUG, "cached response for %d ms", (int)ttl);
+    return;
+    
+uncached:
+    entry_free(o, e);
+}
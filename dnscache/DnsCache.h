@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef BADVPN_DNSCACHE_DNSCACHE_H
+#define BADVPN_DNSCACHE_DNSCACHE_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <structure/CHash.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <system/BAddr.h>
+#include <system/BTime.h>
+
+// maximum length of a cache key (question name, type and class)
+#define DNSCACHE_MAX_KEY_LEN (255 + 4)
+
+// maximum number of queries waiting for the same in-flight query
+#define DNSCACHE_MAX_WAITERS 8
+
+typedef void (*DnsCache_handler_send) (void *user, BAddr local_addr, BAddr remote_addr, uint64_t tag, const uint8_t *data, int data_len);
+
+struct DnsCache_waiter {
+    BAddr local_addr;
+    BAddr remote_addr;
+    uint64_t tag;
+    uint16_t id;
+};
+
+struct DnsCache_entry;
+
+typedef struct {
+    const uint8_t *data;
+    int len;
+} DnsCache__hashkey;
+
+#include "DnsCache_hash.h"
+#include <structure/CHash_decl.h>
+
+typedef struct {
+    int max_entries;
+    int udp_mtu;
+    btime_t max_ttl;
+    btime_t pending_timeout;
+    void *user;
+    DnsCache_handler_send handler_send;
+    DnsCache__Hash entries_hash;
+    LinkedList1 entries_list;
+    int num_entries;
+    uint8_t *send_buf;
+    DebugObject d_obj;
+} DnsCache;
+
+struct DnsCache_entry {
+    uint8_t key[DNSCACHE_MAX_KEY_LEN];
+    int key_len;
+    size_t key_hash;
+    btime_t time;
+    uint8_t *response;
+    int response_len;
+    btime_t expire_time;
+    int num_waiters;
+    struct DnsCache_waiter waiters[DNSCACHE_MAX_WAITERS];
+    struct DnsCache_entry *hash_next;
+    LinkedList1Node list_node;
+};
+
+/**
+ * Initializes the DNS cache.
+ * The cache answers repeated DNS queries from previously seen responses, with
+ * the TTLs reduced by the time the responses have been cached, and holds back
+ * queries identical to one that is still in flight until its response arrives.
+ * Only single-question standard queries are handled; anything else is left to
+ * be forwarded.
+ * 
+ * @param o the object
+ * @param max_entries maximum number of cached or in-flight questions. Must be >0.
+ *                    When it is reached, the least recently used one is dropped.
+ * @param udp_mtu maximum size of a DNS message. Must be >=0.
+ * @param max_ttl maximum time to keep a response, in milliseconds, regardless of its TTL
+ * @param pending_timeout time after which an unanswered query is forwarded again
+ *                        instead of waiting for it, in milliseconds
+ * @param user value passed to handler
+ * @param handler_send handler called to deliver an answer to a client
+ * @return 1 on success, 0 on failure
+ */
+int DnsCache_Init (DnsCache *o, int max_entries, int udp_mtu, btime_t max_ttl, btime_t pending_timeout,
+                   void *user, DnsCache_handler_send handler_send) WARN_UNUSED;
+
+/**
+ * Frees the DNS cache.
+ * 
+ * @param o the object
+ */
+void DnsCache_Free (DnsCache *o);
+
+/**
+ * Handles a DNS query from a client.
+ * If the answer is cached, it is delivered with the handler (from within this
+ * function). If the same question is already in flight, the query is held back
+ * until the response arrives.
+ * 
+ * @param o the object
+ * @param local_addr client address
+ * @param remote_addr address the query was sent to
+ * @param tag value passed to the handler along with the addresses, for callers
+ *            which need more than the addresses to tell clients apart
+ * @param data query message
+ * @param data_len length of query. Must be >=0 and <=udp_mtu.
+ * @return 1 if the query was taken care of, 0 if it needs to be forwarded
+ */
+int DnsCache_HandleQuery (DnsCache *o, BAddr local_addr, BAddr remote_addr, uint64_t tag, const uint8_t *data, int data_len);
+
+/**
+ * Handles a DNS response for a client.
+ * The response is cached if possible, and also delivered with the handler to
+ * clients whose identical queries were held back. The response itself is not
+ * delivered; the caller passes it on to the client it was meant for.
+ * 
+ * @param o the object
+ * @param data response message
+ * @param data_len length of response. Must be >=0 and <=udp_mtu.
+ */
+void DnsCache_HandleResponse (DnsCache *o, const uint8_t *data, int data_len);
+
+#endif
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME DnsCache__Hash
+#define CHASH_PARAM_ENTRY struct DnsCache_entry
+#define CHASH_PARAM_LINK struct DnsCache_entry *
+#define CHASH_PARAM_KEY DnsCache__hashkey
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((struct DnsCache_entry *)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->key_hash)
+#define CHASH_PARAM_KEYHASH(arg, key) badvpn_djb2_hash_bin((key).data, (key).len)
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->key_len == (entry2).ptr->key_len && !memcmp((entry1).ptr->key, (entry2).ptr->key, (entry1).ptr->key_len))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1).len == (entry2).ptr->key_len && !memcmp((key1).data, (entry2).ptr->key, (key1).len))
+#define CHASH_PARAM_ENTRY_NEXT hash_next
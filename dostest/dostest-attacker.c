@@ -31,6 +31,16 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <prinit.h>
+#include <plarena.h>
+#include <nss.h>
+#include <ssl.h>
+#include <sslproto.h>
+#include <cert.h>
+#include <keyhi.h>
 
 #include <misc/debug.h>
 #include <misc/version.h>
@@ -39,28 +49,87 @@
 #include <misc/balloc.h>
 #include <misc/loglevel.h>
 #include <misc/minmax.h>
+#include <misc/nsskey.h>
+#include <misc/latency_histogram.h>
 #include <structure/LinkedList1.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
 #include <system/BAddr.h>
 #include <system/BReactor.h>
 #include <system/BNetwork.h>
 #include <system/BConnection.h>
 #include <system/BSignal.h>
+#ifndef BADVPN_USE_WINAPI
+#include <system/BReactorGroup.h>
+#endif
+#include <socksclient/BSocksClient.h>
+#include <nspr_support/BSSLConnection.h>
 
 #include <generated/blog_channel_dostest_attacker.h>
 
 #define PROGRAM_NAME "dostest-attacker"
 
+#define MAX_THREADS 64
+
+// how far behind schedule --rate may fall before the missed connections are dropped
+#define RATE_MAX_LAG_NS 10000000
+
+// interval for sampling memory usage of the server, in milliseconds
+#define SAMPLE_INTERVAL 100
+
+#define MODE_TCP 1
+#define MODE_SOCKS 2
+#define MODE_SSL 3
+
+#define STATE_CONNECTING 1
+#define STATE_HANDSHAKE 2
+#define STATE_UP 3
+
+struct attacker_thread;
+
 // connection structure
 struct connection {
-    int connected;
+    struct attacker_thread *t;
+    int state;
+    uint64_t start_time;
+    int have_con;
     BConnector connector;
     BConnection con;
+    int have_ssl;
+    PRFileDesc bottom_prfd;
+    PRFileDesc *ssl_prfd;
+    BSSLConnection sslcon;
+    int have_socks;
+    BSocksClient socks;
     StreamRecvInterface *recv_if;
+    StreamPassInterface *send_if;
+    uint8_t probe;
     uint8_t buf[512];
+    BTimer hold_timer;
     LinkedList1Node connections_list_node;
 };
 
+// state of a thread; with --threads 0, the only one runs in the main reactor
+struct attacker_thread {
+    int index;
+    BReactor *reactor;
+    int max_connections;
+    int max_connecting;
+    uint64_t connect_interval;
+    uint64_t next_connect;
+    LinkedList1 connections_list;
+    int num_connections;
+    int num_connecting;
+    BTimer make_connections_timer;
+    // statistics, read by the main thread after the thread has stopped
+    uint64_t attempted;
+    uint64_t established;
+    uint64_t failed;
+    uint64_t closed;
+    uint64_t resumed;
+    uint64_t handshake[LATENCY_HISTOGRAM_BUCKETS];
+};
+
 // command-line options
 static struct {
     int help;
@@ -68,6 +137,18 @@ static struct {
     char *connect_addr;
     int max_connections;
     int max_connecting;
+    int mode;
+    int probe;
+    char *socks_dest;
+    char *nssdb;
+    char *client_cert_name;
+    char *server_name;
+    int ssl_resume;
+    double rate;
+    int threads;
+    int hold;
+    int duration;
+    int server_pid;
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
 } options;
@@ -75,30 +156,78 @@ static struct {
 // connect address
 static BAddr connect_addr;
 
+// destination requested from the SOCKS server
+static BAddr socks_dest_addr;
+
+// SOCKS authentication
+static struct BSocksClient_auth_info socks_auth;
+
+// client certificate and key for SSL
+static CERTCertificate *client_cert;
+static SECKEYPrivateKey *client_key;
+
 // reactor
 static BReactor reactor;
 
-// connections
-static LinkedList1 connections_list;
-static int num_connections;
-static int num_connecting;
+// threads
+static struct attacker_thread threads[MAX_THREADS];
+static int num_thread_slots;
+#ifndef BADVPN_USE_WINAPI
+static BReactorGroup thread_group;
+#endif
+
+// set when no more connections are to be made; accessed atomically
+static int stopping;
+
+// number of established connections, and the most there were; accessed atomically
+static int num_open;
+static int peak_open;
 
-// timer for scheduling creation of more connections
-static BTimer make_connections_timer;
+// start and end of the run
+static uint64_t start_time;
+static uint64_t stop_time;
+
+// timer for ending the run after --duration
+static BTimer duration_timer;
+
+// sampling of server memory usage
+static BTimer sample_timer;
+static int64_t server_rss_start;
+static int64_t server_rss_peak;
+static int64_t server_rss_at_peak_open;
+static int server_peak_open;
 
 static void print_help (const char *name);
 static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
 static int process_arguments (void);
 static void signal_handler (void *unused);
-static int connection_new (void);
+static void terminate (void);
+static void duration_timer_handler (void *unused);
+static void sample_timer_handler (void *unused);
+static int64_t read_server_rss (void);
+static void print_report (void);
+static void thread_start (struct attacker_thread *t, BReactor *thread_reactor);
+static void thread_stop (struct attacker_thread *t);
+static void thread_start_handler (void *unused, int index, BReactor *thread_reactor);
+static void thread_stop_handler (void *unused, int index, BReactor *thread_reactor);
+static void schedule_connections (struct attacker_thread *t);
+static void make_connections_timer_handler (struct attacker_thread *t);
+static int connection_new (struct attacker_thread *t);
 static void connection_free (struct connection *conn);
 static void connection_logfunc (struct connection *conn);
 static void connection_log (struct connection *conn, int level, const char *fmt, ...);
+static void connection_up (struct connection *conn);
+static void connection_lost (struct connection *conn);
+static int connection_start_ssl (struct connection *conn);
 static void connection_connector_handler (struct connection *conn, int is_error);
 static void connection_connection_handler (struct connection *conn, int event);
+static void connection_sslcon_handler (struct connection *conn, int event);
+static void connection_socks_handler (struct connection *conn, int event);
+static void connection_send_handler_done (struct connection *conn, int data_len);
 static void connection_recv_handler_done (struct connection *conn, int data_len);
-static void make_connections_timer_handler (void *unused);
+static void connection_hold_timer_handler (struct connection *conn);
+static SECStatus client_auth_data_callback (struct connection *conn, PRFileDesc *fd, CERTDistNames *caNames, CERTCertificate **pRetCert, SECKEYPrivateKey **pRetKey);
 
 int main (int argc, char **argv)
 {
@@ -169,26 +298,100 @@ int main (int argc, char **argv)
         goto fail2;
     }
     
-    // init connections list
-    LinkedList1_Init(&connections_list);
-    num_connections = 0;
-    num_connecting = 0;
+    if (options.mode == MODE_SSL) {
+        // init NSPR
+        PR_Init(PR_USER_THREAD, PR_PRIORITY_NORMAL, 0);
+        
+        // register local NSPR file types
+        if (!BSSLConnection_GlobalInit()) {
+            BLog(BLOG_ERROR, "BSSLConnection_GlobalInit failed");
+            goto fail3;
+        }
+        
+        // init NSS
+        if (NSS_Init(options.nssdb) != SECSuccess) {
+            BLog(BLOG_ERROR, "NSS_Init failed (%d)", (int)PR_GetError());
+            goto fail3;
+        }
+        
+        // set cipher policy
+        if (NSS_SetDomesticPolicy() != SECSuccess) {
+            BLog(BLOG_ERROR, "NSS_SetDomesticPolicy failed (%d)", (int)PR_GetError());
+            goto fail4;
+        }
+        
+        // open client certificate and private key
+        if (options.client_cert_name && !open_nss_cert_and_key(options.client_cert_name, &client_cert, &client_key)) {
+            BLog(BLOG_ERROR, "Cannot open certificate and key");
+            goto fail4;
+        }
+    }
     
-    // init make connections timer
-    BTimer_Init(&make_connections_timer, 0, make_connections_timer_handler, NULL);
-    BReactor_SetTimer(&reactor, &make_connections_timer);
+    // init timers
+    BTimer_Init(&duration_timer, (btime_t)options.duration * 1000, duration_timer_handler, NULL);
+    BTimer_Init(&sample_timer, SAMPLE_INTERVAL, sample_timer_handler, NULL);
+    
+    // sample server memory before making connections
+    if (options.server_pid > 0) {
+        server_rss_start = read_server_rss();
+        server_rss_peak = server_rss_start;
+        server_rss_at_peak_open = server_rss_start;
+        server_peak_open = 0;
+        BReactor_SetTimer(&reactor, &sample_timer);
+    }
+    
+    stopping = 0;
+    num_open = 0;
+    peak_open = 0;
+    start_time = BMetrics_Now();
+    
+    // start making connections
+    if (options.threads > 0) {
+#ifndef BADVPN_USE_WINAPI
+        if (!BReactorGroup_Init(&thread_group, options.threads, 0, NULL, thread_start_handler, thread_stop_handler)) {
+            BLog(BLOG_ERROR, "BReactorGroup_Init failed");
+            goto fail5;
+        }
+#endif
+    } else {
+        thread_start(&threads[0], &reactor);
+    }
+    
+    if (options.duration > 0) {
+        BReactor_SetTimer(&reactor, &duration_timer);
+    }
     
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&reactor);
     
     // free connections
-    while (!LinkedList1_IsEmpty(&connections_list)) {
-        struct connection *conn = UPPER_OBJECT(LinkedList1_GetFirst(&connections_list), struct connection, connections_list_node);
-        connection_free(conn);
+    if (options.threads > 0) {
+#ifndef BADVPN_USE_WINAPI
+        BReactorGroup_Free(&thread_group);
+#endif
+    } else {
+        thread_stop(&threads[0]);
     }
-    // free make connections timer
-    BReactor_RemoveTimer(&reactor, &make_connections_timer);
+    
+    print_report();
+
+fail5:
+    BReactor_RemoveTimer(&reactor, &sample_timer);
+    BReactor_RemoveTimer(&reactor, &duration_timer);
+    if (options.mode == MODE_SSL) {
+        if (client_cert) {
+            CERT_DestroyCertificate(client_cert);
+            SECKEY_DestroyPrivateKey(client_key);
+        }
+fail4:
+        SSL_ClearSessionCache();
+        ASSERT_FORCE(NSS_Shutdown() == SECSuccess)
+fail3:
+        ASSERT_FORCE(PR_Cleanup() == PR_SUCCESS)
+        PL_ArenaFinish();
+    }
+    
     // free signal
     BSignal_Finish();
 fail2:
@@ -214,10 +417,24 @@ void print_help (const char *name)
         "        [--version]\n"
         "        --connect-addr <addr>\n"
         "        --max-connections <number>\n"
-        "        --max-connecting <number>\n"
+        "        [--max-connecting <number>]\n"
+        "        [--rate <connections/s>]\n"
+        "        [--threads <number>]\n"
+        "        [--mode <tcp/socks/ssl>]\n"
+        "        [--probe]\n"
+        "        [--socks-dest <addr>]\n"
+        "        [--nssdb <string> --server-name <string> [--client-cert-name <string>] [--ssl-resume]]\n"
+        "        [--hold <ms>]\n"
+        "        [--duration <seconds>]\n"
+        "        [--server-pid <pid>]\n"
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
-        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
+        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n"
+        "--max-connecting is required unless --rate is given.\n"
+        "In socks mode, connections go through the SOCKS5 server at --connect-addr to --socks-dest.\n"
+        "In ssl mode, an SSL handshake is done on every connection.\n"
+        "With --probe (tcp mode only), a connection is up once a byte is echoed back.\n"
+        "A report is printed to standard output on exit.\n",
         name
     );
 }
@@ -234,6 +451,18 @@ int parse_arguments (int argc, char *argv[])
     options.connect_addr = NULL;
     options.max_connections = -1;
     options.max_connecting = -1;
+    options.mode = MODE_TCP;
+    options.probe = 0;
+    options.socks_dest = NULL;
+    options.nssdb = NULL;
+    options.client_cert_name = NULL;
+    options.server_name = NULL;
+    options.ssl_resume = 0;
+    options.rate = 0;
+    options.threads = 0;
+    options.hold = 0;
+    options.duration = 0;
+    options.server_pid = 0;
     options.loglevel = -1;
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         options.loglevels[i] = -1;
@@ -278,6 +507,120 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--rate")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.rate = atof(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--threads")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.threads = atoi(argv[i + 1])) < 0 || options.threads > MAX_THREADS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--mode")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            char *mode = argv[i + 1];
+            if (!strcmp(mode, "tcp")) {
+                options.mode = MODE_TCP;
+            }
+            else if (!strcmp(mode, "socks")) {
+                options.mode = MODE_SOCKS;
+            }
+            else if (!strcmp(mode, "ssl")) {
+                options.mode = MODE_SSL;
+            }
+            else {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--probe")) {
+            options.probe = 1;
+        }
+        else if (!strcmp(arg, "--socks-dest")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.socks_dest = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--nssdb")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.nssdb = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--client-cert-name")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.client_cert_name = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--server-name")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.server_name = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--ssl-resume")) {
+            options.ssl_resume = 1;
+        }
+        else if (!strcmp(arg, "--hold")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.hold = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--duration")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.duration = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--server-pid")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.server_pid = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--loglevel")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -328,10 +671,50 @@ int parse_arguments (int argc, char *argv[])
     }
     
     if (options.max_connecting == -1) {
-        fprintf(stderr, "--max-connecting missing\n");
+        if (options.rate == 0) {
+            fprintf(stderr, "--max-connecting missing\n");
+            return 0;
+        }
+        options.max_connecting = options.max_connections;
+    }
+    
+    if (options.probe && options.mode != MODE_TCP) {
+        fprintf(stderr, "--probe is only supported in tcp mode\n");
+        return 0;
+    }
+    
+    if ((options.mode == MODE_SOCKS) != !!options.socks_dest) {
+        fprintf(stderr, "False: --mode socks <=> --socks-dest\n");
+        return 0;
+    }
+    
+    if ((options.mode == MODE_SSL) != !!options.nssdb) {
+        fprintf(stderr, "False: --mode ssl <=> --nssdb\n");
+        return 0;
+    }
+    
+    if ((options.mode == MODE_SSL) != !!options.server_name) {
+        fprintf(stderr, "False: --mode ssl <=> --server-name\n");
+        return 0;
+    }
+    
+    if (options.client_cert_name && options.mode != MODE_SSL) {
+        fprintf(stderr, "False: --client-cert-name => --mode ssl\n");
         return 0;
     }
     
+    if (options.ssl_resume && options.mode != MODE_SSL) {
+        fprintf(stderr, "False: --ssl-resume => --mode ssl\n");
+        return 0;
+    }
+
+#ifdef BADVPN_USE_WINAPI
+    if (options.threads > 0) {
+        fprintf(stderr, "--threads is not supported on this platform\n");
+        return 0;
+    }
+#endif
+
     return 1;
 }
 
@@ -343,6 +726,25 @@ int process_arguments (void)
         return 0;
     }
     
+    // resolve SOCKS destination address
+    if (options.socks_dest) {
+        if (!BAddr_Parse(&socks_dest_addr, options.socks_dest, NULL, 0)) {
+            BLog(BLOG_ERROR, "socks dest: BAddr_Parse failed");
+            return 0;
+        }
+        socks_auth = BSocksClient_auth_none();
+    }
+    
+    // split the limits and the rate among the threads
+    num_thread_slots = (options.threads > 0 ? options.threads : 1);
+    for (int i = 0; i < num_thread_slots; i++) {
+        struct attacker_thread *t = &threads[i];
+        t->index = i;
+        t->max_connections = options.max_connections / num_thread_slots + (i < options.max_connections % num_thread_slots);
+        t->max_connecting = options.max_connecting / num_thread_slots + (i < options.max_connecting % num_thread_slots);
+        t->connect_interval = (options.rate > 0 ? 1e9 * num_thread_slots / options.rate : 0);
+    }
+    
     return 1;
 }
 
@@ -350,12 +752,222 @@ void signal_handler (void *unused)
 {
     BLog(BLOG_NOTICE, "termination requested");
     
+    terminate();
+}
+
+void terminate (void)
+{
+    // stop making connections
+    if (!stopping) {
+        __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+        stop_time = BMetrics_Now();
+    }
+    
     // exit event loop
     BReactor_Quit(&reactor, 1);
 }
 
-int connection_new (void)
+void duration_timer_handler (void *unused)
+{
+    BLog(BLOG_NOTICE, "duration elapsed");
+    
+    terminate();
+}
+
+void sample_timer_handler (void *unused)
+{
+    int open = __atomic_load_n(&num_open, __ATOMIC_RELAXED);
+    int64_t rss = read_server_rss();
+    
+    if (rss > server_rss_peak) {
+        server_rss_peak = rss;
+    }
+    
+    // remember the memory usage when the most connections were open,
+    // for the memory cost of a connection
+    if (open > server_peak_open && rss >= 0) {
+        server_peak_open = open;
+        server_rss_at_peak_open = rss;
+    }
+    
+    BReactor_SetTimer(&reactor, &sample_timer);
+}
+
+int64_t read_server_rss (void)
+{
+#ifdef BADVPN_LINUX
+    char path[64];
+    sprintf(path, "/proc/%d/status", options.server_pid);
+    
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        BLog(BLOG_WARNING, "failed to open %s", path);
+        return -1;
+    }
+    
+    int64_t rss = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        long long kb;
+        if (sscanf(line, "VmRSS: %lld kB", &kb) == 1) {
+            rss = (int64_t)kb * 1024;
+            break;
+        }
+    }
+    
+    fclose(f);
+    return rss;
+#else
+    return -1;
+#endif
+}
+
+void print_report (void)
+{
+    // sum statistics of threads; the threads have finished
+    uint64_t attempted = 0;
+    uint64_t established = 0;
+    uint64_t failed = 0;
+    uint64_t closed = 0;
+    uint64_t resumed = 0;
+    uint64_t handshake[LATENCY_HISTOGRAM_BUCKETS] = {0};
+    for (int i = 0; i < num_thread_slots; i++) {
+        struct attacker_thread *t = &threads[i];
+        attempted += t->attempted;
+        established += t->established;
+        failed += t->failed;
+        closed += t->closed;
+        resumed += t->resumed;
+        for (int j = 0; j < LATENCY_HISTOGRAM_BUCKETS; j++) {
+            handshake[j] += t->handshake[j];
+        }
+    }
+    
+    double seconds = (stop_time - start_time) / 1e9;
+    
+    printf("threads=%d seconds=%.3f attempted=%"PRIu64" established=%"PRIu64" failed=%"PRIu64" closed=%"PRIu64" "
+           "resumed=%"PRIu64" attempted_per_s=%.0f established_per_s=%.0f peak_open=%d "
+           "handshake_p50_us=%.1f handshake_p90_us=%.1f handshake_p99_us=%.1f handshake_max_us=%.1f",
+           num_thread_slots, seconds, attempted, established, failed, closed,
+           resumed, attempted / seconds, established / seconds, peak_open,
+           latency_histogram_percentile(handshake, 0.5) / 1e3, latency_histogram_percentile(handshake, 0.9) / 1e3,
+           latency_histogram_percentile(handshake, 0.99) / 1e3, latency_histogram_percentile(handshake, 1) / 1e3);
+    
+    if (options.server_pid > 0) {
+        double per_conn = 0;
+        if (server_peak_open > 0 && server_rss_start >= 0) {
+            per_conn = (double)(server_rss_at_peak_open - server_rss_start) / server_peak_open;
+        }
+        printf(" server_rss_start_kb=%"PRId64" server_rss_peak_kb=%"PRId64" server_bytes_per_conn=%.0f",
+               server_rss_start / 1024, server_rss_peak / 1024, per_conn);
+    }
+    
+    printf("\n");
+    fflush(stdout);
+}
+
+void thread_start (struct attacker_thread *t, BReactor *thread_reactor)
 {
+    t->reactor = thread_reactor;
+    
+    // init connections list
+    LinkedList1_Init(&t->connections_list);
+    t->num_connections = 0;
+    t->num_connecting = 0;
+    
+    t->next_connect = BMetrics_Now();
+    
+    // init make connections timer
+    BTimer_Init(&t->make_connections_timer, 0, (BTimer_handler)make_connections_timer_handler, t);
+    BReactor_SetTimer(t->reactor, &t->make_connections_timer);
+}
+
+void thread_stop (struct attacker_thread *t)
+{
+    // free connections
+    while (!LinkedList1_IsEmpty(&t->connections_list)) {
+        struct connection *conn = UPPER_OBJECT(LinkedList1_GetFirst(&t->connections_list), struct connection, connections_list_node);
+        connection_free(conn);
+    }
+    
+    // free make connections timer
+    BReactor_RemoveTimer(t->reactor, &t->make_connections_timer);
+}
+
+#ifndef BADVPN_USE_WINAPI
+
+void thread_start_handler (void *unused, int index, BReactor *thread_reactor)
+{
+    ASSERT(index >= 0)
+    ASSERT(index < num_thread_slots)
+    
+    thread_start(&threads[index], thread_reactor);
+}
+
+void thread_stop_handler (void *unused, int index, BReactor *thread_reactor)
+{
+    thread_stop(&threads[index]);
+}
+
+#endif
+
+void schedule_connections (struct attacker_thread *t)
+{
+    // with --rate, the timer is set for the next scheduled connection; this
+    // only makes the handler look again earlier, it makes no connections early
+    BReactor_SetTimer(t->reactor, &t->make_connections_timer);
+}
+
+void make_connections_timer_handler (struct attacker_thread *t)
+{
+    if (__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        return;
+    }
+    
+    int make_num = bmin_int(t->max_connections - t->num_connections, t->max_connecting - t->num_connecting);
+    
+    if (options.rate > 0) {
+        uint64_t now = BMetrics_Now();
+        
+        // don't make up for time spent at the connection limits
+        if (t->next_connect + RATE_MAX_LAG_NS < now) {
+            t->next_connect = now - RATE_MAX_LAG_NS;
+        }
+        
+        // make the connections which are due
+        int due = 0;
+        while (due < make_num && t->next_connect <= now) {
+            t->next_connect += t->connect_interval;
+            due++;
+        }
+        make_num = due;
+        
+        // wake up for the next one; when at a limit, a finished connection does it
+        if (t->next_connect > now) {
+            BReactor_SetTimerAfter(t->reactor, &t->make_connections_timer, (t->next_connect - now + 999999) / 1000000);
+        }
+    }
+    
+    if (make_num <= 0) {
+        return;
+    }
+    
+    BLog(BLOG_INFO, "making %d connections", make_num);
+    
+    for (int i = 0; i < make_num; i++) {
+        if (!connection_new(t)) {
+            // can happen if fd limit is reached
+            BLog(BLOG_ERROR, "failed to make connection, waiting");
+            BReactor_SetTimerAfter(t->reactor, &t->make_connections_timer, 10);
+            return;
+        }
+    }
+}
+
+int connection_new (struct attacker_thread *t)
+{
+    t->attempted++;
+    
     // allocate structure
     struct connection *conn = (struct connection *)malloc(sizeof(*conn));
     if (!conn) {
@@ -363,47 +975,90 @@ int connection_new (void)
         goto fail0;
     }
     
-    // set not connected
-    conn->connected = 0;
+    // init arguments
+    conn->t = t;
     
-    // init connector
-    if (!BConnector_Init(&conn->connector, connect_addr, &reactor, conn, (BConnector_handler)connection_connector_handler)) {
-        BLog(BLOG_ERROR, "BConnector_Init failed");
-        goto fail1;
+    // set connecting
+    conn->state = STATE_CONNECTING;
+    conn->start_time = BMetrics_Now();
+    conn->have_con = 0;
+    conn->have_ssl = 0;
+    conn->have_socks = 0;
+    
+    if (options.mode == MODE_SOCKS) {
+        // init SOCKS client, which connects to the server itself
+        if (!BSocksClient_Init(&conn->socks, connect_addr, &socks_auth, 1, socks_dest_addr, (BSocksClient_handler)connection_socks_handler, conn, t->reactor)) {
+            BLog(BLOG_ERROR, "BSocksClient_Init failed");
+            goto fail1;
+        }
+        conn->have_socks = 1;
+    } else {
+        // init connector
+        if (!BConnector_Init(&conn->connector, connect_addr, t->reactor, conn, (BConnector_handler)connection_connector_handler)) {
+            BLog(BLOG_ERROR, "BConnector_Init failed");
+            goto fail1;
+        }
     }
     
+    // init hold timer
+    BTimer_Init(&conn->hold_timer, options.hold, (BTimer_handler)connection_hold_timer_handler, conn);
+    
     // add to connections list
-    LinkedList1_Append(&connections_list, &conn->connections_list_node);
-    num_connections++;
-    num_connecting++;
+    LinkedList1_Append(&t->connections_list, &conn->connections_list_node);
+    t->num_connections++;
+    t->num_connecting++;
     
     return 1;
-    
+
 fail1:
     free(conn);
 fail0:
+    t->failed++;
     return 0;
 }
 
 void connection_free (struct connection *conn)
 {
+    struct attacker_thread *t = conn->t;
+    
     // remove from connections list
-    LinkedList1_Remove(&connections_list, &conn->connections_list_node);
-    num_connections--;
-    if (!conn->connected) {
-        num_connecting--;
+    LinkedList1_Remove(&t->connections_list, &conn->connections_list_node);
+    t->num_connections--;
+    if (conn->state != STATE_UP) {
+        t->num_connecting--;
+    } else {
+        __atomic_sub_fetch(&num_open, 1, __ATOMIC_RELAXED);
     }
     
-    if (conn->connected) {
-        // free receive interface
+    // free hold timer
+    BReactor_RemoveTimer(t->reactor, &conn->hold_timer);
+    
+    if (conn->have_socks) {
+        // free SOCKS client
+        BSocksClient_Free(&conn->socks);
+    }
+    
+    if (conn->have_con) {
+        // free SSL
+        if (conn->have_ssl) {
+            BSSLConnection_Free(&conn->sslcon);
+            ASSERT_FORCE(PR_Close(conn->ssl_prfd) == PR_SUCCESS)
+        }
+        
+        // free connection interfaces
+        if (options.mode == MODE_SSL || options.probe) {
+            BConnection_SendAsync_Free(&conn->con);
+        }
         BConnection_RecvAsync_Free(&conn->con);
         
         // free connection
         BConnection_Free(&conn->con);
     }
     
-    // free connector
-    BConnector_Free(&conn->connector);
+    if (options.mode != MODE_SOCKS) {
+        // free connector
+        BConnector_Free(&conn->connector);
+    }
     
     // free structure
     free(conn);
@@ -411,7 +1066,7 @@ void connection_free (struct connection *conn)
 
 void connection_logfunc (struct connection *conn)
 {
-    BLog_Append("%d connection (%p): ", num_connecting, (void *)conn);
+    BLog_Append("%d connection (%p): ", conn->t->num_connecting, (void *)conn);
 }
 
 void connection_log (struct connection *conn, int level, const char *fmt, ...)
@@ -422,9 +1077,124 @@ void connection_log (struct connection *conn, int level, const char *fmt, ...)
     va_end(vl);
 }
 
+void connection_up (struct connection *conn)
+{
+    ASSERT(conn->state != STATE_UP)
+    struct attacker_thread *t = conn->t;
+    
+    // no longer connecting
+    conn->state = STATE_UP;
+    t->num_connecting--;
+    
+    t->established++;
+    latency_histogram_add(t->handshake, BMetrics_Now() - conn->start_time);
+    
+    if (conn->have_ssl) {
+        SSLChannelInfo info;
+        if (SSL_GetChannelInfo(conn->ssl_prfd, &info, sizeof(info)) == SECSuccess && info.resumed) {
+            t->resumed++;
+        }
+    }
+    
+    // update the number of open connections and its peak
+    int open = __atomic_add_fetch(&num_open, 1, __ATOMIC_RELAXED);
+    int peak = __atomic_load_n(&peak_open, __ATOMIC_RELAXED);
+    while (open > peak && !__atomic_compare_exchange_n(&peak_open, &peak, open, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    
+    connection_log(conn, BLOG_INFO, "connected");
+    
+    // close it after a while
+    if (options.hold > 0) {
+        BReactor_SetTimer(t->reactor, &conn->hold_timer);
+    }
+    
+    // schedule making connections (because of connecting limit)
+    schedule_connections(t);
+}
+
+void connection_lost (struct connection *conn)
+{
+    struct attacker_thread *t = conn->t;
+    
+    if (conn->state == STATE_UP) {
+        t->closed++;
+    } else {
+        t->failed++;
+    }
+    
+    // free connection
+    connection_free(conn);
+    
+    // schedule making connections
+    schedule_connections(t);
+}
+
+int connection_start_ssl (struct connection *conn)
+{
+    // create bottom NSPR file descriptor
+    if (!BSSLConnection_MakeBackend(&conn->bottom_prfd, conn->send_if, conn->recv_if, NULL, 0)) {
+        connection_log(conn, BLOG_ERROR, "BSSLConnection_MakeBackend failed");
+        goto fail0;
+    }
+    
+    // create SSL file descriptor from the bottom NSPR file descriptor
+    if (!(conn->ssl_prfd = SSL_ImportFD(NULL, &conn->bottom_prfd))) {
+        connection_log(conn, BLOG_ERROR, "SSL_ImportFD failed");
+        ASSERT_FORCE(PR_Close(&conn->bottom_prfd) == PR_SUCCESS)
+        goto fail0;
+    }
+    
+    // set client mode
+    if (SSL_ResetHandshake(conn->ssl_prfd, PR_FALSE) != SECSuccess) {
+        connection_log(conn, BLOG_ERROR, "SSL_ResetHandshake failed");
+        goto fail1;
+    }
+    
+    // set server name
+    if (SSL_SetURL(conn->ssl_prfd, options.server_name) != SECSuccess) {
+        connection_log(conn, BLOG_ERROR, "SSL_SetURL failed");
+        goto fail1;
+    }
+    
+    // resume sessions of previous connections, or do a full handshake every time
+    if (options.ssl_resume) {
+        if (!BSSLConnection_EnableResumption(conn->ssl_prfd)) {
+            goto fail1;
+        }
+    } else {
+        if (SSL_OptionSet(conn->ssl_prfd, SSL_NO_CACHE, PR_TRUE) != SECSuccess) {
+            connection_log(conn, BLOG_ERROR, "SSL_OptionSet(SSL_NO_CACHE) failed");
+            goto fail1;
+        }
+    }
+    
+    // set client certificate callback
+    if (client_cert && SSL_GetClientAuthDataHook(conn->ssl_prfd, (SSLGetClientAuthData)client_auth_data_callback, conn) != SECSuccess) {
+        connection_log(conn, BLOG_ERROR, "SSL_GetClientAuthDataHook failed");
+        goto fail1;
+    }
+    
+    // init BSSLConnection, handshaking right away
+    BSSLConnection_Init(&conn->sslcon, conn->ssl_prfd, 1, BReactor_PendingGroup(conn->t->reactor), conn, (BSSLConnection_handler)connection_sslcon_handler);
+    conn->have_ssl = 1;
+    
+    // receive through SSL, to notice when the server closes
+    conn->recv_if = BSSLConnection_GetRecvIf(&conn->sslcon);
+    StreamRecvInterface_Receiver_Init(conn->recv_if, (StreamRecvInterface_handler_done)connection_recv_handler_done, conn);
+    StreamRecvInterface_Receiver_Recv(conn->recv_if, conn->buf, sizeof(conn->buf));
+    
+    return 1;
+
+fail1:
+    ASSERT_FORCE(PR_Close(conn->ssl_prfd) == PR_SUCCESS)
+fail0:
+    return 0;
+}
+
 void connection_connector_handler (struct connection *conn, int is_error)
 {
-    ASSERT(!conn->connected)
+    ASSERT(conn->state == STATE_CONNECTING)
+    ASSERT(!conn->have_con)
     
     // check for connection error
     if (is_error) {
@@ -433,40 +1203,51 @@ void connection_connector_handler (struct connection *conn, int is_error)
     }
     
     // init connection from connector
-    if (!BConnection_Init(&conn->con, BConnection_source_connector(&conn->connector), &reactor, conn, (BConnection_handler)connection_connection_handler)) {
+    if (!BConnection_Init(&conn->con, BConnection_source_connector(&conn->connector), conn->t->reactor, conn, (BConnection_handler)connection_connection_handler)) {
         connection_log(conn, BLOG_INFO, "BConnection_Init failed");
         goto fail0;
     }
     
-    // init receive interface
+    // init connection interfaces
+    if (options.mode == MODE_SSL || options.probe) {
+        BConnection_SendAsync_Init(&conn->con);
+        conn->send_if = BConnection_SendAsync_GetIf(&conn->con);
+    }
     BConnection_RecvAsync_Init(&conn->con);
     conn->recv_if = BConnection_RecvAsync_GetIf(&conn->con);
-    StreamRecvInterface_Receiver_Init(conn->recv_if, (StreamRecvInterface_handler_done)connection_recv_handler_done, conn);
+    conn->have_con = 1;
+    
+    if (options.mode == MODE_SSL) {
+        conn->state = STATE_HANDSHAKE;
+        if (!connection_start_ssl(conn)) {
+            goto fail0;
+        }
+        return;
+    }
     
     // start receiving
+    StreamRecvInterface_Receiver_Init(conn->recv_if, (StreamRecvInterface_handler_done)connection_recv_handler_done, conn);
     StreamRecvInterface_Receiver_Recv(conn->recv_if, conn->buf, sizeof(conn->buf));
     
-    // no longer connecting
-    conn->connected = 1;
-    num_connecting--;
-    
-    connection_log(conn, BLOG_INFO, "connected");
+    if (options.probe) {
+        // send a byte and wait for it to come back
+        conn->state = STATE_HANDSHAKE;
+        conn->probe = 'x';
+        StreamPassInterface_Sender_Init(conn->send_if, (StreamPassInterface_handler_done)connection_send_handler_done, conn);
+        StreamPassInterface_Sender_Send(conn->send_if, &conn->probe, 1);
+        return;
+    }
     
-    // schedule making connections (because of connecting limit)
-    BReactor_SetTimer(&reactor, &make_connections_timer);
+    connection_up(conn);
     return;
-    
+
 fail0:
-    // free connection
-    connection_free(conn);
-    
-    // schedule making connections
-    BReactor_SetTimer(&reactor, &make_connections_timer);
+    connection_lost(conn);
 }
 
 void connection_connection_handler (struct connection *conn, int event)
 {
-    ASSERT(conn->connected)
+    ASSERT(conn->have_con)
     
     if (event == BCONNECTION_EVENT_RECVCLOSED) {
         connection_log(conn, BLOG_INFO, "connection closed");
@@ -474,16 +1255,58 @@ void connection_connection_handler (struct connection *conn, int event)
         connection_log(conn, BLOG_INFO, "connection error");
     }
     
-    // free connection
-    connection_free(conn);
+    connection_lost(conn);
+}
+
+void connection_sslcon_handler (struct connection *conn, int event)
+{
+    ASSERT(conn->have_ssl)
     
-    // schedule making connections
-    BReactor_SetTimer(&reactor, &make_connections_timer);
+    if (event == BSSLCONNECTION_EVENT_UP) {
+        connection_up(conn);
+        return;
+    }
+    
+    connection_log(conn, BLOG_INFO, "SSL error");
+    
+    connection_lost(conn);
+}
+
+void connection_socks_handler (struct connection *conn, int event)
+{
+    ASSERT(conn->have_socks)
+    
+    if (event == BSOCKSCLIENT_EVENT_UP) {
+        // start receiving
+        conn->recv_if = BSocksClient_GetRecvInterface(&conn->socks);
+        StreamRecvInterface_Receiver_Init(conn->recv_if, (StreamRecvInterface_handler_done)connection_recv_handler_done, conn);
+        StreamRecvInterface_Receiver_Recv(conn->recv_if, conn->buf, sizeof(conn->buf));
+        
+        connection_up(conn);
+        return;
+    }
+    
+    if (event == BSOCKSCLIENT_EVENT_ERROR_CLOSED) {
+        connection_log(conn, BLOG_INFO, "connection closed");
+    } else {
+        connection_log(conn, BLOG_INFO, "SOCKS error");
+    }
+    
+    connection_lost(conn);
+}
+
+void connection_send_handler_done (struct connection *conn, int data_len)
+{
+    ASSERT(options.probe)
+    ASSERT(data_len == 1)
 }
 
 void connection_recv_handler_done (struct connection *conn, int data_len)
 {
-    ASSERT(conn->connected)
+    // the echoed probe completes the connection
+    if (conn->state == STATE_HANDSHAKE && !conn->have_ssl) {
+        connection_up(conn);
+    }
     
     // receive more
     StreamRecvInterface_Receiver_Recv(conn->recv_if, conn->buf, sizeof(conn->buf));
@@ -491,22 +1314,31 @@ void connection_recv_handler_done (struct connection *conn, int data_len)
     connection_log(conn, BLOG_INFO, "received %d bytes", data_len);
 }
 
-void make_connections_timer_handler (void *unused)
+void connection_hold_timer_handler (struct connection *conn)
 {
-    int make_num = bmin_int(options.max_connections - num_connections, options.max_connecting - num_connecting);
+    ASSERT(conn->state == STATE_UP)
     
-    if (make_num <= 0) {
-        return;
-    }
+    connection_log(conn, BLOG_INFO, "closing");
     
-    BLog(BLOG_INFO, "making %d connections", make_num);
+    connection_lost(conn);
+}
+
+SECStatus client_auth_data_callback (struct connection *conn, PRFileDesc *fd, CERTDistNames *caNames, CERTCertificate **pRetCert, SECKEYPrivateKey **pRetKey)
+{
+    ASSERT(client_cert)
     
-    for (int i = 0; i < make_num; i++) {
-        if (!connection_new()) {
-            // can happen if fd limit is reached
-            BLog(BLOG_ERROR, "failed to make connection, waiting");
-            BReactor_SetTimerAfter(&reactor, &make_connections_timer, 10);
-            return;
-        }
+    CERTCertificate *newcert;
+    if (!(newcert = CERT_DupCertificate(client_cert))) {
+        return SECFailure;
     }
+    
+    SECKEYPrivateKey *newkey;
+    if (!(newkey = SECKEY_CopyPrivateKey(client_key))) {
+        CERT_DestroyCertificate(newcert);
+        return SECFailure;
+    }
+    
+    *pRetCert = newcert;
+    *pRetKey = newkey;
+    return SECSuccess;
 }
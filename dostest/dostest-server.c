@@ -31,6 +31,8 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 
 #ifdef BADVPN_LINUX
 #include <sys/types.h>
@@ -85,6 +87,9 @@ static struct {
     int disconnect_time;
     int defense_prepare_clients;
     int defense_activate_clients;
+    int reuseport;
+    int defer_accept;
+    int stats_interval;
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
 } options;
@@ -106,6 +111,12 @@ static int num_clients;
 static int defense_prepare;
 static int defense_activate;
 
+// accept statistics
+static BTimer stats_timer;
+static uint64_t num_accepts;
+static uint64_t last_accepts;
+static btime_t last_stats_time;
+
 static void print_help (const char *name);
 static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
@@ -118,6 +129,7 @@ static void client_log (struct client *client, int level, const char *fmt, ...);
 static void client_disconnect_timer_handler (struct client *client);
 static void client_connection_handler (struct client *client, int event);
 static void update_defense (void);
+static void stats_timer_handler (void *unused);
 
 int main (int argc, char **argv)
 {
@@ -189,7 +201,8 @@ int main (int argc, char **argv)
     }
     
     // initialize listener
-    if (!BListener_Init(&listener, listen_addr, &ss, NULL, listener_handler)) {
+    int listener_flags = (options.reuseport ? BLISTENER_FLAG_REUSEPORT : 0) | (options.defer_accept ? BLISTENER_FLAG_DEFER_ACCEPT : 0);
+    if (!BListener_InitFrom2(&listener, BLisCon_from_addr(listen_addr), listener_flags, &ss, NULL, listener_handler)) {
         BLog(BLOG_ERROR, "Listener_Init failed");
         goto fail3;
     }
@@ -205,10 +218,22 @@ int main (int argc, char **argv)
     // update defense
     update_defense();
     
+    // init stats timer
+    num_accepts = 0;
+    last_accepts = 0;
+    last_stats_time = btime_gettime();
+    BTimer_Init(&stats_timer, options.stats_interval, stats_timer_handler, NULL);
+    if (options.stats_interval > 0) {
+        BReactor_SetTimer(&ss, &stats_timer);
+    }
+    
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
     
+    // free stats timer
+    BReactor_RemoveTimer(&ss, &stats_timer);
+    
     // free clients
     while (!LinkedList1_IsEmpty(&clients_list)) {
         struct client *client = UPPER_OBJECT(LinkedList1_GetFirst(&clients_list), struct client, clients_list_node);
@@ -245,9 +270,14 @@ void print_help (const char *name)
         "        --disconnect-time <milliseconds>\n"
         "        [--defense-prepare-clients <number>]\n"
         "        [--defense-activate-clients <number>]\n"
+        "        [--reuseport]\n"
+        "        [--defer-accept]\n"
+        "        [--stats-interval <milliseconds>]\n"
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
-        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
+        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n"
+        "With --defer-accept, clients are only accepted once they send data (see dostest-attacker --probe).\n"
+        "With --stats-interval, a line with the number of clients and the accept rate is printed to standard output periodically.\n",
         name
     );
 }
@@ -266,6 +296,9 @@ int parse_arguments (int argc, char *argv[])
     options.disconnect_time = -1;
     options.defense_prepare_clients = -1;
     options.defense_activate_clients = -1;
+    options.reuseport = 0;
+    options.defer_accept = 0;
+    options.stats_interval = 0;
     options.loglevel = -1;
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         options.loglevels[i] = -1;
@@ -332,6 +365,23 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--reuseport")) {
+            options.reuseport = 1;
+        }
+        else if (!strcmp(arg, "--defer-accept")) {
+            options.defer_accept = 1;
+        }
+        else if (!strcmp(arg, "--stats-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.stats_interval = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--loglevel")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -447,6 +497,7 @@ void listener_handler (void *unused)
     // insert to clients list
     LinkedList1_Append(&clients_list, &client->clients_list_node);
     num_clients++;
+    num_accepts++;
     
     client_log(client, BLOG_INFO, "connected");
     BLog(BLOG_NOTICE, "%d clients", num_clients);
@@ -565,3 +616,18 @@ void update_defense (void)
     }
 #endif
 }
+
+void stats_timer_handler (void *unused)
+{
+    btime_t now = btime_gettime();
+    uint64_t accepts = num_accepts - last_accepts;
+    double seconds = (now - last_stats_time) / 1000.0;
+    
+    printf("clients=%d accepts=%"PRIu64" accepts_per_s=%.0f\n", num_clients, num_accepts, (seconds > 0 ? accepts / seconds : 0));
+    fflush(stdout);
+    
+    last_accepts = num_accepts;
+    last_stats_time = now;
+    
+    BReactor_SetTimer(&ss, &stats_timer);
+}
@@ -32,6 +32,14 @@
 #include <string.h>
 #include <stdint.h>
 #include <limits.h>
+#include <time.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
 
 #include <misc/balloc.h>
 #include <security/BRandom.h>
@@ -41,8 +49,10 @@
 static void usage (char *name)
 {
     printf(
-        "Usage: %s <enc/dec> <ciper> <num_blocks> <num_ops>\n"
-        "    <cipher> is one of (blowfish, aes).\n",
+        "Usage: %s <enc/dec> <ciper> <num_blocks> <num_ops> [<cpu_mhz>]\n"
+        "    <cipher> is one of (blowfish, aes, aes256).\n"
+        "    <cpu_mhz> is used to report cycles per byte; if not given, the\n"
+        "    time stamp counter is used where available.\n",
         name
     );
     
@@ -55,7 +65,7 @@ int main (int argc, char **argv)
         return 1;
     }
     
-    if (argc != 5) {
+    if (argc != 5 && argc != 6) {
         usage(argv[0]);
     }
     
@@ -66,6 +76,7 @@ int main (int argc, char **argv)
     int cipher = 0; // silence warning
     int num_blocks = atoi(argv[3]);
     int num_ops = atoi(argv[4]);
+    double cpu_mhz = (argc > 5 ? atof(argv[5]) : 0.0);
     
     if (!strcmp(mode_str, "enc")) {
         mode = BENCRYPTION_MODE_ENCRYPT;
@@ -83,11 +94,14 @@ int main (int argc, char **argv)
     else if (!strcmp(cipher_str, "aes")) {
         cipher = BENCRYPTION_CIPHER_AES;
     }
+    else if (!strcmp(cipher_str, "aes256")) {
+        cipher = BENCRYPTION_CIPHER_AES256;
+    }
     else {
         usage(argv[0]);
     }
     
-    if (num_blocks < 0 || num_ops < 0) {
+    if (num_blocks < 0 || num_ops < 0 || cpu_mhz < 0) {
         usage(argv[0]);
     }
     
@@ -127,14 +141,47 @@ int main (int argc, char **argv)
     uint8_t *out = buf2;
     BRandom_randomize(in, unit_size);
     
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    #if HAVE_TSC
+    uint64_t start_tsc = __rdtsc();
+    #endif
+    
     for (int i = 0; i < num_ops; i++) {
-        BEncryption_Encrypt(&enc, in, out, unit_size, iv);
+        if (mode == BENCRYPTION_MODE_ENCRYPT) {
+            BEncryption_Encrypt(&enc, in, out, unit_size, iv);
+        } else {
+            BEncryption_Decrypt(&enc, in, out, unit_size, iv);
+        }
         
         uint8_t *t = in;
         in = out;
         out = t;
     }
     
+    #if HAVE_TSC
+    uint64_t tsc = __rdtsc() - start_tsc;
+    #endif
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    
+    double ns = (end_time.tv_sec - start_time.tv_sec) * 1e9 + (end_time.tv_nsec - start_time.tv_nsec);
+    double bytes = (double)unit_size * num_ops;
+    
+    printf("%s %s unit size %d: %.1f MB/s", mode_str, cipher_str, unit_size, (ns > 0 ? bytes / ns * 1000.0 : 0.0));
+    if (bytes > 0) {
+        printf(", %.3f ns/byte", ns / bytes);
+        if (cpu_mhz > 0) {
+            printf(", %.2f cycles/byte", ns * cpu_mhz / 1000.0 / bytes);
+        }
+        #if HAVE_TSC
+        else {
+            printf(", %.2f TSC cycles/byte", tsc / bytes);
+        }
+        #endif
+    }
+    printf("\n");
+    
     BEncryption_Free(&enc);
     BFree(buf2);
 fail1:
@@ -0,0 +1,289 @@
+/**
+ * @file cbtree_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Compares CBTree against CAvl and SAvl on the same random keys: inserting,
+// looking up, iterating in order and removing.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <misc/balloc.h>
+#include <misc/compare.h>
+#include <misc/debug.h>
+#include <misc/print_macros.h>
+#include <structure/CBTree.h>
+#include <structure/CAvl.h>
+#include <structure/SAvl.h>
+
+typedef size_t entry_index;
+typedef uint32_t entry_key;
+
+struct entry;
+typedef struct entry *entry_ptr;
+
+#include "cbtree_bench_savl.h"
+#include <structure/SAvl_decl.h>
+
+struct entry {
+    entry_index cavl_child[2];
+    entry_index cavl_parent;
+    int8_t cavl_balance;
+    BenchSAvlNode savl_node;
+    entry_key key;
+};
+
+#include "cbtree_bench_btree.h"
+#include <structure/CBTree_decl.h>
+
+#include "cbtree_bench_btree.h"
+#include <structure/CBTree_impl.h>
+
+#include "cbtree_bench_cavl.h"
+#include <structure/CAvl_decl.h>
+
+#include "cbtree_bench_cavl.h"
+#include <structure/CAvl_impl.h>
+
+#include "cbtree_bench_savl.h"
+#include <structure/SAvl_impl.h>
+
+static size_t num_entries;
+static struct entry *entries;
+static entry_key *lookup_keys;
+static size_t num_lookups;
+static entry_index *remove_order;
+
+static uint64_t checksum;
+
+static double now (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report (const char *tree, const char *op, size_t num_ops, double start)
+{
+    double t = now() - start;
+    printf("%-7s %-8s %8.1f ns/op\n", tree, op, t * 1e9 / num_ops);
+}
+
+static void bench_btree (int do_verify)
+{
+    BenchBTree tree;
+    BenchBTree_Init(&tree);
+    double start;
+    
+    start = now();
+    for (size_t i = 0; i < num_entries; i++) {
+        BenchBTreeRef ref = {&entries[i], i};
+        ASSERT_FORCE(BenchBTree_Insert(&tree, entries, ref, NULL))
+    }
+    report("CBTree", "insert", num_entries, start);
+    
+    if (do_verify) {
+        BenchBTree_Verify(&tree, entries);
+    }
+    
+    start = now();
+    for (size_t i = 0; i < num_lookups; i++) {
+        BenchBTreeRef ref = BenchBTree_LookupExact(&tree, entries, lookup_keys[i]);
+        checksum += ref.link;
+    }
+    report("CBTree", "lookup", num_lookups, start);
+    
+    start = now();
+    for (BenchBTreeRef ref = BenchBTree_GetFirst(&tree, entries); ref.link != -1; ref = BenchBTree_GetNext(&tree, entries, ref)) {
+        checksum += ref.ptr->key;
+    }
+    report("CBTree", "iterate", num_entries, start);
+    
+    start = now();
+    for (size_t i = 0; i < num_entries; i++) {
+        BenchBTreeRef ref = {&entries[remove_order[i]], remove_order[i]};
+        BenchBTree_Remove(&tree, entries, ref);
+        if (do_verify && i % 1024 == 0) {
+            BenchBTree_Verify(&tree, entries);
+        }
+    }
+    report("CBTree", "remove", num_entries, start);
+    
+    ASSERT_FORCE(BenchBTree_IsEmpty(&tree))
+    BenchBTree_Free(&tree);
+}
+
+static void bench_cavl (int do_verify)
+{
+    BenchCAvl tree;
+    BenchCAvl_Init(&tree);
+    double start;
+    
+    start = now();
+    for (size_t i = 0; i < num_entries; i++) {
+        BenchCAvlRef ref = {&entries[i], i};
+        ASSERT_FORCE(BenchCAvl_Insert(&tree, entries, ref, NULL))
+    }
+    report("CAvl", "insert", num_entries, start);
+    
+    if (do_verify) {
+        BenchCAvl_Verify(&tree, entries);
+    }
+    
+    start = now();
+    for (size_t i = 0; i < num_lookups; i++) {
+        BenchCAvlRef ref = BenchCAvl_LookupExact(&tree, entries, lookup_keys[i]);
+        checksum += ref.link;
+    }
+    report("CAvl", "lookup", num_lookups, start);
+    
+    start = now();
+    for (BenchCAvlRef ref = BenchCAvl_GetFirst(&tree, entries); ref.link != -1; ref = BenchCAvl_GetNext(&tree, entries, ref)) {
+        checksum += ref.ptr->key;
+    }
+    report("CAvl", "iterate", num_entries, start);
+    
+    start = now();
+    for (size_t i = 0; i < num_entries; i++) {
+        BenchCAvlRef ref = {&entries[remove_order[i]], remove_order[i]};
+        BenchCAvl_Remove(&tree, entries, ref);
+    }
+    report("CAvl", "remove", num_entries, start);
+    
+    ASSERT_FORCE(BenchCAvl_IsEmpty(&tree))
+}
+
+static void bench_savl (int do_verify)
+{
+    BenchSAvl tree;
+    BenchSAvl_Init(&tree);
+    double start;
+    
+    start = now();
+    for (size_t i = 0; i < num_entries; i++) {
+        ASSERT_FORCE(BenchSAvl_Insert(&tree, 0, &entries[i], NULL))
+    }
+    report("SAvl", "insert", num_entries, start);
+    
+    if (do_verify) {
+        BenchSAvl_Verify(&tree, 0);
+    }
+    
+    start = now();
+    for (size_t i = 0; i < num_lookups; i++) {
+        struct entry *e = BenchSAvl_LookupExact(&tree, 0, lookup_keys[i]);
+        checksum += (e ? (entry_index)(e - entries) : (entry_index)-1);
+    }
+    report("SAvl", "lookup", num_lookups, start);
+    
+    start = now();
+    for (struct entry *e = BenchSAvl_GetFirst(&tree, 0); e; e = BenchSAvl_GetNext(&tree, 0, e)) {
+        checksum += e->key;
+    }
+    report("SAvl", "iterate", num_entries, start);
+    
+    start = now();
+    for (size_t i = 0; i < num_entries; i++) {
+        BenchSAvl_Remove(&tree, 0, &entries[remove_order[i]]);
+    }
+    report("SAvl", "remove", num_entries, start);
+    
+    ASSERT_FORCE(BenchSAvl_IsEmpty(&tree))
+}
+
+static uint32_t random_u32 (void)
+{
+    return ((uint32_t)(rand() & 0xFFFF) << 16) | (uint32_t)(rand() & 0xFFFF);
+}
+
+int main (int argc, char *argv[])
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <num_keys> <num_lookups> <do_verify=1/0>\n", (argc > 0 ? argv[0] : ""));
+        return 1;
+    }
+    
+    num_entries = atoi(argv[1]);
+    num_lookups = atoi(argv[2]);
+    int do_verify = atoi(argv[3]);
+    
+    printf("sizeof(struct entry)=%" PRIsz " sizeof(BenchBTreeNode)=%" PRIsz "\n", sizeof(struct entry), sizeof(BenchBTreeNode));
+    
+    entries = (struct entry *)BAllocArray(num_entries, sizeof(entries[0]));
+    lookup_keys = (entry_key *)BAllocArray(num_lookups, sizeof(lookup_keys[0]));
+    remove_order = (entry_index *)BAllocArray(num_entries, sizeof(remove_order[0]));
+    ASSERT_FORCE(entries && lookup_keys && remove_order)
+    
+    // distinct keys in random order: a random odd multiplier is a
+    // bijection on 32-bit integers
+    entry_key mul = random_u32() | 1;
+    for (size_t i = 0; i < num_entries; i++) {
+        entries[i].key = (entry_key)i * mul;
+    }
+    
+    // half of the lookups hit
+    for (size_t i = 0; i < num_lookups; i++) {
+        lookup_keys[i] = ((rand() & 1) && num_entries > 0) ? entries[random_u32() % num_entries].key : random_u32();
+    }
+    
+    for (size_t i = 0; i < num_entries; i++) {
+        remove_order[i] = i;
+    }
+    for (size_t i = num_entries; i > 1; i--) {
+        size_t j = random_u32() % i;
+        entry_index t = remove_order[i - 1];
+        remove_order[i - 1] = remove_order[j];
+        remove_order[j] = t;
+    }
+    
+    uint64_t checksums[3];
+    
+    checksum = 0;
+    bench_btree(do_verify);
+    checksums[0] = checksum;
+    
+    checksum = 0;
+    bench_cavl(do_verify);
+    checksums[1] = checksum;
+    
+    checksum = 0;
+    bench_savl(do_verify);
+    checksums[2] = checksum;
+    
+    // all trees must have found the same entries in the same order
+    ASSERT_FORCE(checksums[0] == checksums[1])
+    ASSERT_FORCE(checksums[0] == checksums[2])
+    
+    BFree(remove_order);
+    BFree(lookup_keys);
+    BFree(entries);
+    
+    return 0;
+}
@@ -0,0 +1,9 @@
+#define CBTREE_PARAM_NAME BenchBTree
+#define CBTREE_PARAM_TYPE_ENTRY struct entry
+#define CBTREE_PARAM_TYPE_LINK entry_index
+#define CBTREE_PARAM_TYPE_KEY entry_key
+#define CBTREE_PARAM_TYPE_ARG entry_ptr
+#define CBTREE_PARAM_VALUE_NULL ((entry_index)-1)
+#define CBTREE_PARAM_FUN_DEREF(arg, link) (&(arg)[(link)])
+#define CBTREE_PARAM_FUN_ENTRY_KEY(arg, entry) ((entry).ptr->key)
+#define CBTREE_PARAM_FUN_COMPARE_KEYS(arg, key1, key2) B_COMPARE((key1), (key2))
@@ -0,0 +1,9 @@
+#define SAVL_PARAM_NAME BenchSAvl
+#define SAVL_PARAM_FEATURE_COUNTS 0
+#define SAVL_PARAM_FEATURE_NOKEYS 0
+#define SAVL_PARAM_TYPE_ENTRY struct entry
+#define SAVL_PARAM_TYPE_KEY entry_key
+#define SAVL_PARAM_TYPE_ARG int
+#define SAVL_PARAM_FUN_COMPARE_ENTRIES(arg, entry1, entry2) B_COMPARE((entry1)->key, (entry2)->key)
+#define SAVL_PARAM_FUN_COMPARE_KEY_ENTRY(arg, key1, entry2) B_COMPARE((key1), (entry2)->key)
+#define SAVL_PARAM_MEMBER_NODE savl_node
@@ -0,0 +1,247 @@
+/**
+ * @file chash_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <structure/CHash.h>
+#include <structure/OAHash.h>
+
+#define NUM_ENTRIES 4000
+#define NUM_UNIQUE 1000
+#define NUM_MULTI_KEYS 100
+
+typedef size_t entry_index;
+typedef uint32_t entry_key;
+
+struct entry {
+    entry_key key;
+    entry_index hash_next;
+    int in_hash;
+};
+
+typedef struct entry *entry_ptr;
+
+#include "chash_test_hash.h"
+#include <structure/CHash_decl.h>
+
+#include "chash_test_hash.h"
+#include <structure/CHash_impl.h>
+
+#include "chash_test_oahash.h"
+#include <structure/OAHash_decl.h>
+
+#include "chash_test_oahash.h"
+#include <structure/OAHash_impl.h>
+
+static struct entry entries[NUM_ENTRIES];
+static size_t key_counts[NUM_ENTRIES];
+static MyHash hash;
+
+static MyHashRef ref (entry_index i)
+{
+    return MyHashDerefNonNull(entries, i);
+}
+
+static void verify_key (entry_key key)
+{
+    // all entries with the key must be found, one after another
+    size_t count = 0;
+    MyHashRef cur = MyHash_Lookup(&hash, entries, key);
+    while (!MyHashIsNullRef(cur)) {
+        ASSERT_FORCE(cur.ptr->key == key)
+        ASSERT_FORCE(cur.ptr->in_hash)
+        count++;
+        cur = MyHash_GetNextEqual(&hash, entries, cur);
+    }
+    ASSERT_FORCE(count == key_counts[key])
+}
+
+static void insert_multi (entry_index i, entry_key key)
+{
+    entries[i].key = key;
+    MyHash_InsertMulti(&hash, entries, ref(i));
+    entries[i].in_hash = 1;
+    key_counts[key]++;
+    MyHash_Verify(&hash, entries);
+}
+
+static void remove_entry (entry_index i)
+{
+    ASSERT_FORCE(entries[i].in_hash)
+    MyHash_Remove(&hash, entries, ref(i));
+    entries[i].in_hash = 0;
+    key_counts[entries[i].key]--;
+    MyHash_Verify(&hash, entries);
+}
+
+static void test_chash (void)
+{
+    // start small so that the table grows many times
+    ASSERT_FORCE(MyHash_Init(&hash, 1))
+    MyHash_Verify(&hash, entries);
+    
+    size_t growths = 0;
+    size_t last_num_buckets = hash.num_buckets;
+    
+    // unique keys, rejecting duplicates
+    for (entry_index i = 0; i < NUM_UNIQUE; i++) {
+        entries[i].key = i;
+        ASSERT_FORCE(MyHash_Insert(&hash, entries, ref(i), NULL))
+        entries[i].in_hash = 1;
+        key_counts[i]++;
+        MyHash_Verify(&hash, entries);
+        
+        entry_index dup = NUM_ENTRIES - 1;
+        entries[dup].key = i;
+        MyHashRef existing;
+        ASSERT_FORCE(!MyHash_Insert(&hash, entries, ref(dup), &existing))
+        ASSERT_FORCE(existing.link == i)
+        MyHash_Verify(&hash, entries);
+        
+        if (hash.num_buckets != last_num_buckets) {
+            growths++;
+            last_num_buckets = hash.num_buckets;
+        }
+    }
+    ASSERT_FORCE(growths >= 8)
+    
+    // equal entries for some of the keys
+    for (entry_index i = NUM_UNIQUE; i < 2 * NUM_UNIQUE; i++) {
+        insert_multi(i, i % NUM_MULTI_KEYS);
+    }
+    for (entry_key k = 0; k < NUM_UNIQUE; k++) {
+        verify_key(k);
+    }
+    ASSERT_FORCE(MyHashIsNullRef(MyHash_Lookup(&hash, entries, NUM_ENTRIES)))
+    
+    // insert until a growth starts, then remove while it is in progress
+    entry_index next = 2 * NUM_UNIQUE;
+    while (!hash.old_buckets) {
+        ASSERT_FORCE(next < NUM_ENTRIES - 1)
+        insert_multi(next, next % NUM_UNIQUE);
+        next++;
+    }
+    for (entry_index i = 0; hash.old_buckets; i++) {
+        remove_entry(i);
+        verify_key(entries[i].key);
+    }
+    
+    // remove and insert at random
+    for (int round = 0; round < 20000; round++) {
+        entry_index i = rand() % (NUM_ENTRIES - 1);
+        if (entries[i].in_hash) {
+            remove_entry(i);
+        } else {
+            insert_multi(i, rand() % NUM_UNIQUE);
+        }
+        verify_key(entries[i].key);
+    }
+    
+    for (entry_key k = 0; k < NUM_UNIQUE; k++) {
+        verify_key(k);
+    }
+    
+    // remove everything
+    for (entry_index i = 0; i < NUM_ENTRIES; i++) {
+        if (entries[i].in_hash) {
+            remove_entry(i);
+        }
+    }
+    ASSERT_FORCE(hash.num_entries == 0)
+    for (entry_key k = 0; k < NUM_UNIQUE; k++) {
+        ASSERT_FORCE(MyHashIsNullRef(MyHash_Lookup(&hash, entries, k)))
+    }
+    
+    // growing explicitly
+    size_t num_buckets = hash.num_buckets;
+    ASSERT_FORCE(MyHash_MultiplyBuckets(&hash, entries, 2))
+    ASSERT_FORCE(hash.num_buckets == 4 * num_buckets)
+    ASSERT_FORCE(!hash.old_buckets)
+    MyHash_Verify(&hash, entries);
+    
+    MyHash_Free(&hash);
+}
+
+static void test_oahash (void)
+{
+    MyOAHash oah;
+    ASSERT_FORCE(MyOAHash_Init(&oah, 0))
+    
+    // the hash puts groups of four keys in the same home slot, so that
+    // removals have runs to shift back
+    static int present[NUM_ENTRIES];
+    
+    for (entry_key k = 0; k < NUM_UNIQUE; k++) {
+        ASSERT_FORCE(MyOAHash_Insert(&oah, k, k * 3))
+        present[k] = 1;
+        MyOAHash_Verify(&oah);
+    }
+    ASSERT_FORCE(MyOAHash_Count(&oah) == NUM_UNIQUE)
+    
+    for (int round = 0; round < 20000; round++) {
+        entry_key k = rand() % NUM_ENTRIES;
+        if (present[k]) {
+            ASSERT_FORCE(MyOAHash_Remove(&oah, k))
+            present[k] = 0;
+        } else {
+            ASSERT_FORCE(!MyOAHash_Remove(&oah, k))
+            ASSERT_FORCE(MyOAHash_Insert(&oah, k, k * 3))
+            present[k] = 1;
+        }
+        MyOAHash_Verify(&oah);
+    }
+    
+    size_t count = 0;
+    for (entry_key k = 0; k < NUM_ENTRIES; k++) {
+        int *value = MyOAHash_Lookup(&oah, k);
+        ASSERT_FORCE(!value == !present[k])
+        if (value) {
+            ASSERT_FORCE(*value == (int)k * 3)
+            count++;
+        }
+    }
+    ASSERT_FORCE(MyOAHash_Count(&oah) == count)
+    
+    MyOAHash_Free(&oah);
+}
+
+int main (int argc, char *argv[])
+{
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+    
+    test_chash();
+    test_oahash();
+    
+    printf("ok\n");
+    
+    return 0;
+}
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME MyHash
+#define CHASH_PARAM_ENTRY struct entry
+#define CHASH_PARAM_LINK entry_index
+#define CHASH_PARAM_KEY entry_key
+#define CHASH_PARAM_ARG entry_ptr
+#define CHASH_PARAM_NULL ((entry_index)-1)
+#define CHASH_PARAM_DEREF(arg, link) (&(arg)[(link)])
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((size_t)(entry).ptr->key)
+#define CHASH_PARAM_KEYHASH(arg, key) ((size_t)(key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->key == (entry2).ptr->key)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1) == (entry2).ptr->key)
+#define CHASH_PARAM_ENTRY_NEXT hash_next
@@ -0,0 +1,5 @@
+#define OAHASH_PARAM_NAME MyOAHash
+#define OAHASH_PARAM_KEY entry_key
+#define OAHASH_PARAM_VALUE int
+#define OAHASH_PARAM_HASH(key) ((size_t)(key) / 4)
+#define OAHASH_PARAM_COMPARE_KEYS(key1, key2) ((key1) == (key2))
@@ -0,0 +1,248 @@
+/**
+ * @file chunkbuffer2spsc_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <structure/ChunkBuffer2Spsc.h>
+
+#define MAX_QUEUED 1024
+#define NUM_RANDOM_OPS 100000
+
+struct packet {
+    uint32_t seq;
+    int len;
+};
+
+static ChunkBuffer2Spsc buf;
+static struct ChunkBuffer2_block *blocks;
+static int num_blocks;
+static int mtu;
+
+// packets in the buffer, in order
+static struct packet queue[MAX_QUEUED];
+static int queue_start;
+static int queue_count;
+static uint32_t next_seq;
+
+static int num_skips;
+static int num_wraps;
+
+static uint8_t packet_byte (uint32_t seq, int i)
+{
+    return (uint8_t)(seq * 31 + i * 7 + 1);
+}
+
+static int produce (int len)
+{
+    ASSERT_FORCE(len >= 0)
+    ASSERT_FORCE(len <= mtu)
+    
+    uint8_t *dest = ChunkBuffer2Spsc_Producer_GetDest(&buf);
+    if (!dest) {
+        // an empty buffer always has space
+        ASSERT_FORCE(queue_count > 0)
+        return 0;
+    }
+    
+    // an MTU long packet must fit, after a header
+    ASSERT_FORCE(dest >= (uint8_t *)(blocks + 1))
+    ASSERT_FORCE(dest + mtu <= (uint8_t *)(blocks + num_blocks))
+    
+    if (buf.prod_skip > 0) {
+        num_skips++;
+    }
+    
+    // the producer may use all of it, which must not touch queued packets
+    for (int i = 0; i < mtu; i++) {
+        dest[i] = packet_byte(next_seq, i);
+    }
+    
+    int prev_head = buf.prod_head;
+    ChunkBuffer2Spsc_Producer_Submit(&buf, len);
+    if (buf.prod_head < prev_head) {
+        num_wraps++;
+    }
+    
+    ASSERT_FORCE(queue_count < MAX_QUEUED)
+    struct packet *p = &queue[(queue_start + queue_count) % MAX_QUEUED];
+    p->seq = next_seq++;
+    p->len = len;
+    queue_count++;
+    
+    return 1;
+}
+
+static int consume (void)
+{
+    uint8_t *data;
+    int len;
+    if (!ChunkBuffer2Spsc_Consumer_Peek(&buf, &data, &len)) {
+        ASSERT_FORCE(queue_count == 0)
+        return 0;
+    }
+    ASSERT_FORCE(queue_count > 0)
+    
+    // peeking again gives the same packet
+    uint8_t *data2;
+    int len2;
+    ASSERT_FORCE(ChunkBuffer2Spsc_Consumer_Peek(&buf, &data2, &len2))
+    ASSERT_FORCE(data2 == data)
+    ASSERT_FORCE(len2 == len)
+    
+    struct packet *p = &queue[queue_start];
+    ASSERT_FORCE(len == p->len)
+    ASSERT_FORCE(data >= (uint8_t *)(blocks + 1))
+    ASSERT_FORCE(data + len <= (uint8_t *)(blocks + num_blocks))
+    for (int i = 0; i < len; i++) {
+        ASSERT_FORCE(data[i] == packet_byte(p->seq, i))
+    }
+    
+    ChunkBuffer2Spsc_Consumer_Consume(&buf);
+    
+    queue_start = (queue_start + 1) % MAX_QUEUED;
+    queue_count--;
+    
+    return 1;
+}
+
+static int random_len (void)
+{
+    switch (rand() % 4) {
+        case 0: return 0;
+        case 1: return mtu;
+        default: return rand() % (mtu + 1);
+    }
+}
+
+static void test (int the_mtu, int num_packets, int extra_blocks)
+{
+    mtu = the_mtu;
+    num_blocks = ChunkBuffer2_calc_blocks(mtu, num_packets) + extra_blocks;
+    ASSERT_FORCE(num_blocks > 0)
+    blocks = (struct ChunkBuffer2_block *)malloc(num_blocks * sizeof(blocks[0]));
+    ASSERT_FORCE(blocks)
+    
+    ChunkBuffer2Spsc_Init(&buf, blocks, num_blocks, mtu);
+    queue_start = 0;
+    queue_count = 0;
+    num_skips = 0;
+    num_wraps = 0;
+    
+    // empty at the start
+    ASSERT_FORCE(!consume())
+    
+    for (int round = 0; round < 200; round++) {
+        // an empty buffer holds num_packets MTU long packets wherever it starts
+        for (int i = 0; i < num_packets; i++) {
+            ASSERT_FORCE(produce(mtu))
+        }
+        
+        // fill up to the end
+        while (produce(random_len())) {}
+        ASSERT_FORCE(!produce(0))
+        
+        // still full after a failed attempt
+        ASSERT_FORCE(!ChunkBuffer2Spsc_Producer_GetDest(&buf))
+        
+        // drain partially or fully, so the next round starts elsewhere
+        int drain = (rand() % 2 ? queue_count : rand() % queue_count + 1);
+        for (int i = 0; i < drain; i++) {
+            ASSERT_FORCE(consume())
+        }
+        while (queue_count > 0 && rand() % 2) {
+            ASSERT_FORCE(consume())
+        }
+        
+        // empty it
+        while (consume()) {}
+        ASSERT_FORCE(queue_count == 0)
+        
+        // a single packet in an empty buffer, wherever it is
+        ASSERT_FORCE(produce(random_len()))
+        ASSERT_FORCE(consume())
+        ASSERT_FORCE(!consume())
+    }
+    
+    // random operations, sometimes abandoning a destination
+    for (int i = 0; i < NUM_RANDOM_OPS; i++) {
+        switch (rand() % 5) {
+            case 0:
+            case 1: {
+                produce(random_len());
+            } break;
+            case 2:
+            case 3: {
+                consume();
+            } break;
+            default: {
+                if (ChunkBuffer2Spsc_Producer_GetDest(&buf)) {
+                    ASSERT_FORCE(produce(random_len()))
+                } else {
+                    ASSERT_FORCE(queue_count > 0)
+                }
+            } break;
+        }
+    }
+    
+    while (consume()) {}
+    ASSERT_FORCE(queue_count == 0)
+    
+    // the positions must have wrapped around, and packets must have gone
+    // to the beginning instead of the end when they could
+    ASSERT_FORCE(num_wraps > 0)
+    if (mtu > sizeof(struct ChunkBuffer2_block)) {
+        ASSERT_FORCE(num_skips > 0)
+    }
+    
+    free(blocks);
+}
+
+int main (int argc, char *argv[])
+{
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+    
+    static const int mtus[] = {0, 1, 3, 4, 5, 17, 100, 1500};
+    static const int nums[] = {1, 2, 3, 7};
+    static const int extras[] = {0, 1, 3};
+    
+    for (int i = 0; i < sizeof(mtus) / sizeof(mtus[0]); i++) {
+        for (int j = 0; j < sizeof(nums) / sizeof(nums[0]); j++) {
+            for (int k = 0; k < sizeof(extras) / sizeof(extras[0]); k++) {
+                test(mtus[i], nums[j], extras[k]);
+            }
+        }
+    }
+    
+    printf("ok\n");
+    
+    return 0;
+}
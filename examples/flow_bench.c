@@ -0,0 +1,699 @@
+/**
+ * @file flow_bench.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <base/BLog.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <system/BTime.h>
+#include <flow/PacketRecvInterface.h>
+#include <flow/PacketPassInterface.h>
+#include <flow/SinglePacketBuffer.h>
+#include <flow/PacketBuffer.h>
+#include <flow/PacketPassFairQueue.h>
+#include <protocol/packetproto.h>
+#include <flow/PacketProtoEncoder.h>
+#include <threadwork/BThreadWork.h>
+#include <client/SPProtoEncoder.h>
+#include <client/FragmentProtoDisassembler.h>
+
+// Measures the cost of passing packets through a pipeline of pass-through
+// stages: a source, a SinglePacketBuffer, <num_stages> stages which forward
+// packets unchanged, and a sink. With "direct", the stages and the sink enable
+// direct calls, so Send and Done skip the pending job queue where possible.
+//
+// With "pipeline", the pipeline is composed from real flow components given
+// as a comma-separated list, e.g. "buffer,fairqueue,fragment,spproto,single".
+// Everything before "fairqueue" is instantiated once per flow. Components
+// must alternate correctly between PacketRecvInterface and
+// PacketPassInterface: the sources provide Recv, the sink consumes Pass.
+// Besides time per packet, allocations per packet are reported on Linux,
+// where the build wraps malloc.
+
+#define PACKET_SIZE 1400
+#define FRAGMENT_MTU 1400
+#define BUFFER_PACKETS 8
+
+#define STAGE_PACKETPROTO 1
+#define STAGE_SPPROTO 2
+#define STAGE_BUFFER 3
+#define STAGE_SINGLE 4
+#define STAGE_FAIRQUEUE 5
+#define STAGE_FRAGMENT 6
+
+#define MAX_STAGES 16
+
+static const struct {
+    const char *name;
+    int type;
+    int input_pass;
+    int output_pass;
+} stage_types[] = {
+    {"packetproto", STAGE_PACKETPROTO, 0, 0},
+    {"spproto", STAGE_SPPROTO, 0, 0},
+    {"buffer", STAGE_BUFFER, 0, 1},
+    {"single", STAGE_SINGLE, 0, 1},
+    {"fairqueue", STAGE_FAIRQUEUE, 1, 1},
+    {"fragment", STAGE_FRAGMENT, 1, 0},
+};
+
+typedef struct {
+    PacketPassInterface input;
+    PacketPassInterface *output;
+} Stage;
+
+static BReactor reactor;
+static PacketRecvInterface source;
+static PacketPassInterface sink;
+static uint8_t packet[PACKET_SIZE];
+static long long num_packets;
+static long long num_received;
+
+typedef struct {
+    int type;
+    union {
+        PacketProtoEncoder packetproto;
+        SPProtoEncoder spproto;
+        PacketBuffer buffer;
+        SinglePacketBuffer single;
+        PacketPassFairQueueFlow fairqueue_flow;
+        FragmentProtoDisassembler fragment;
+    } u;
+} Instance;
+
+static int pipeline_len;
+static int pipeline_types[MAX_STAGES];
+static int pipeline_mtus[MAX_STAGES + 1];
+static int fairqueue_index;
+static int num_flows;
+static Instance *instances;
+static Instance **init_order;
+static int num_inited;
+static PacketRecvInterface *sources;
+static PacketPassFairQueue fairqueue;
+static int fairqueue_inited;
+static BThreadWorkDispatcher twd;
+static struct spproto_security_params sp_params;
+static long long num_produced;
+static long long num_sink_bytes;
+
+#ifdef FLOW_BENCH_WRAP_MALLOC
+
+static long long num_allocs;
+
+void * __real_malloc (size_t size);
+void * __real_calloc (size_t nmemb, size_t size);
+void * __real_realloc (void *ptr, size_t size);
+
+void * __wrap_malloc (size_t size)
+{
+    num_allocs++;
+    return __real_malloc(size);
+}
+
+void * __wrap_calloc (size_t nmemb, size_t size)
+{
+    num_allocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void * __wrap_realloc (void *ptr, size_t size)
+{
+    num_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+#endif
+
+static void usage (char *name)
+{
+    printf(
+        "Usage: %s <job/direct> <num_stages> <num_packets>\n"
+        "       %s pipeline <stages> <num_flows> <packet_size> <num_packets>\n"
+        "<stages> is a comma-separated list of: packetproto, spproto, buffer, single, fairqueue, fragment\n",
+        name, name
+    );
+    
+    exit(1);
+}
+
+static void stage_input_handler_send (Stage *s, uint8_t *data, int data_len)
+{
+    PacketPassInterface_Sender_Send(s->output, data, data_len);
+}
+
+static void stage_output_handler_done (Stage *s)
+{
+    PacketPassInterface_Done(&s->input);
+}
+
+static void source_handler_recv (void *user, uint8_t *data)
+{
+    memcpy(data, packet, PACKET_SIZE);
+    PacketRecvInterface_Done(&source, PACKET_SIZE);
+}
+
+static void sink_handler_send (void *user, uint8_t *data, int data_len)
+{
+    if (++num_received == num_packets) {
+        BReactor_Quit(&reactor, 0);
+        return;
+    }
+    
+    PacketPassInterface_Done(&sink);
+}
+
+static int parse_stages (char *str)
+{
+    pipeline_len = 0;
+    fairqueue_index = -1;
+    
+    int pass = 0;
+    
+    for (char *name = strtok(str, ","); name; name = strtok(NULL, ",")) {
+        size_t i;
+        for (i = 0; i < sizeof(stage_types) / sizeof(stage_types[0]); i++) {
+            if (!strcmp(name, stage_types[i].name)) {
+                break;
+            }
+        }
+        if (i == sizeof(stage_types) / sizeof(stage_types[0])) {
+            printf("unknown stage: %s\n", name);
+            return 0;
+        }
+        
+        if (pipeline_len == MAX_STAGES) {
+            printf("too many stages\n");
+            return 0;
+        }
+        
+        if (stage_types[i].input_pass != pass) {
+            printf("%s: expects %s input\n", name, (stage_types[i].input_pass ? "PacketPass" : "PacketRecv"));
+            return 0;
+        }
+        
+        if (stage_types[i].type == STAGE_FAIRQUEUE) {
+            if (fairqueue_index >= 0) {
+                printf("only one fairqueue is supported\n");
+                return 0;
+            }
+            fairqueue_index = pipeline_len;
+        }
+        
+        pipeline_types[pipeline_len++] = stage_types[i].type;
+        pass = stage_types[i].output_pass;
+    }
+    
+    if (!pass) {
+        printf("the last stage must have PacketPass output\n");
+        return 0;
+    }
+    
+    return 1;
+}
+
+static int compute_mtus (int packet_size)
+{
+    pipeline_mtus[0] = packet_size;
+    
+    for (int i = 0; i < pipeline_len; i++) {
+        int in = pipeline_mtus[i];
+        int out = in;
+        
+        switch (pipeline_types[i]) {
+            case STAGE_PACKETPROTO:
+                if (in > PACKETPROTO_MAXPAYLOAD) {
+                    return 0;
+                }
+                out = PACKETPROTO_ENCLEN(in);
+                break;
+            case STAGE_SPPROTO:
+                out = spproto_carrier_mtu_for_payload_mtu(sp_params, in);
+                break;
+            case STAGE_FRAGMENT:
+                if (in > UINT16_MAX) {
+                    return 0;
+                }
+                out = FRAGMENT_MTU;
+                break;
+        }
+        
+        if (out < 0) {
+            return 0;
+        }
+        
+        pipeline_mtus[i + 1] = out;
+    }
+    
+    return 1;
+}
+
+// Stages up to and including the fairqueue, whose instances are the
+// PacketPassFairQueueFlow's, exist once per flow.
+static Instance * get_instance (int flow, int stage)
+{
+    int num_flow_stages = fairqueue_index + 1;
+    
+    if (stage < num_flow_stages) {
+        return &instances[flow * num_flow_stages + stage];
+    }
+    
+    return &instances[num_flows * num_flow_stages + (stage - num_flow_stages)];
+}
+
+static void pipeline_source_handler_recv (PacketRecvInterface *src, uint8_t *data)
+{
+    if (num_produced == num_packets) {
+        BReactor_Quit(&reactor, 0);
+        return;
+    }
+    num_produced++;
+    
+    int len = PacketRecvInterface_GetMTU(src);
+    memcpy(data, packet, len);
+    PacketRecvInterface_Done(src, len);
+}
+
+static void pipeline_sink_handler_send (void *user, uint8_t *data, int data_len)
+{
+    num_received++;
+    num_sink_bytes += data_len;
+    
+    PacketPassInterface_Done(&sink);
+}
+
+static PacketRecvInterface * build_recv (int flow, int end);
+
+// Builds stages [0, end) of a flow such that the output of the last one,
+// which must be a PacketPass output, goes to output.
+static int build_pass (int flow, int end, PacketPassInterface *output)
+{
+    ASSERT(end > 0)
+    
+    BPendingGroup *pg = BReactor_PendingGroup(&reactor);
+    Instance *o = get_instance(flow, end - 1);
+    o->type = pipeline_types[end - 1];
+    
+    switch (o->type) {
+        case STAGE_BUFFER: {
+            PacketRecvInterface *input = build_recv(flow, end - 1);
+            if (!input) {
+                return 0;
+            }
+            if (!PacketBuffer_Init(&o->u.buffer, input, output, BUFFER_PACKETS, pg)) {
+                printf("PacketBuffer_Init failed\n");
+                return 0;
+            }
+        } break;
+        
+        case STAGE_SINGLE: {
+            PacketRecvInterface *input = build_recv(flow, end - 1);
+            if (!input) {
+                return 0;
+            }
+            if (!SinglePacketBuffer_Init(&o->u.single, input, output, pg)) {
+                printf("SinglePacketBuffer_Init failed\n");
+                return 0;
+            }
+        } break;
+        
+        case STAGE_FAIRQUEUE: {
+            if (!PacketPassFairQueue_Init(&fairqueue, output, pg, 0, 1)) {
+                printf("PacketPassFairQueue_Init failed\n");
+                return 0;
+            }
+            fairqueue_inited = 1;
+            
+            for (int i = 0; i < num_flows; i++) {
+                Instance *fo = get_instance(i, end - 1);
+                fo->type = STAGE_FAIRQUEUE;
+                PacketPassFairQueueFlow_Init(&fo->u.fairqueue_flow, &fairqueue);
+                init_order[num_inited++] = fo;
+                
+                if (end - 1 > 0 && !build_pass(i, end - 1, PacketPassFairQueueFlow_GetInput(&fo->u.fairqueue_flow))) {
+                    return 0;
+                }
+            }
+            
+            // the flows were recorded individually
+            return 1;
+        }
+        
+        default:
+            ASSERT(0);
+    }
+    
+    init_order[num_inited++] = o;
+    return 1;
+}
+
+// Builds stages [0, end) of a flow, the last of which must have a PacketRecv
+// output, and returns that output. For end=0, returns the flow's source.
+static PacketRecvInterface * build_recv (int flow, int end)
+{
+    if (end == 0) {
+        return &sources[flow];
+    }
+    
+    BPendingGroup *pg = BReactor_PendingGroup(&reactor);
+    Instance *o = get_instance(flow, end - 1);
+    o->type = pipeline_types[end - 1];
+    PacketRecvInterface *output;
+    
+    switch (o->type) {
+        case STAGE_PACKETPROTO: {
+            PacketRecvInterface *input = build_recv(flow, end - 1);
+            if (!input) {
+                return NULL;
+            }
+            PacketProtoEncoder_Init(&o->u.packetproto, input, pg);
+            output = PacketProtoEncoder_GetOutput(&o->u.packetproto);
+        } break;
+        
+        case STAGE_SPPROTO: {
+            PacketRecvInterface *input = build_recv(flow, end - 1);
+            if (!input) {
+                return NULL;
+            }
+            if (!SPProtoEncoder_Init(&o->u.spproto, input, sp_params, 0, 1, 1, pg, &twd)) {
+                printf("SPProtoEncoder_Init failed\n");
+                return NULL;
+            }
+            output = SPProtoEncoder_GetOutput(&o->u.spproto);
+        } break;
+        
+        case STAGE_FRAGMENT: {
+            FragmentProtoDisassembler_Init(&o->u.fragment, &reactor, pipeline_mtus[end - 1], FRAGMENT_MTU, -1, -1, 0);
+            init_order[num_inited++] = o;
+            if (!build_pass(flow, end - 1, FragmentProtoDisassembler_GetInput(&o->u.fragment))) {
+                return NULL;
+            }
+            return FragmentProtoDisassembler_GetOutput(&o->u.fragment);
+        }
+        
+        default:
+            ASSERT(0);
+            return NULL;
+    }
+    
+    init_order[num_inited++] = o;
+    return output;
+}
+
+static void free_instance (Instance *o)
+{
+    switch (o->type) {
+        case STAGE_PACKETPROTO:
+            PacketProtoEncoder_Free(&o->u.packetproto);
+            break;
+        case STAGE_SPPROTO:
+            SPProtoEncoder_Free(&o->u.spproto);
+            break;
+        case STAGE_BUFFER:
+            PacketBuffer_Free(&o->u.buffer);
+            break;
+        case STAGE_SINGLE:
+            SinglePacketBuffer_Free(&o->u.single);
+            break;
+        case STAGE_FAIRQUEUE:
+            PacketPassFairQueueFlow_Free(&o->u.fairqueue_flow);
+            break;
+        case STAGE_FRAGMENT:
+            FragmentProtoDisassembler_Free(&o->u.fragment);
+            break;
+    }
+}
+
+static int pipeline_main (int argc, char **argv)
+{
+    if (argc != 6) {
+        usage(argv[0]);
+    }
+    
+    char *stages_str = strdup(argv[2]);
+    num_flows = atoi(argv[3]);
+    int packet_size = atoi(argv[4]);
+    num_packets = atoll(argv[5]);
+    
+    if (!stages_str || num_flows <= 0 || packet_size <= 0 || packet_size > PACKET_SIZE || num_packets <= 0) {
+        usage(argv[0]);
+    }
+    
+    sp_params.hash_mode = SPPROTO_HASH_MODE_NONE;
+    sp_params.encryption_mode = SPPROTO_ENCRYPTION_MODE_NONE;
+    sp_params.otp_mode = SPPROTO_OTP_MODE_NONE;
+    sp_params.otp_num = 0;
+    sp_params.replay_window = 0;
+    sp_params.compact = 0;
+    
+    if (!parse_stages(stages_str)) {
+        free(stages_str);
+        return 1;
+    }
+    
+    if (fairqueue_index < 0 && num_flows != 1) {
+        printf("multiple flows require a fairqueue\n");
+        free(stages_str);
+        return 1;
+    }
+    
+    if (!compute_mtus(packet_size)) {
+        printf("packet size too large for the pipeline\n");
+        free(stages_str);
+        return 1;
+    }
+    
+    BLog_InitStdout();
+    
+    BTime_Init();
+    
+    if (!BReactor_Init(&reactor)) {
+        printf("BReactor_Init failed\n");
+        goto fail0;
+    }
+    
+    BPendingGroup *pg = BReactor_PendingGroup(&reactor);
+    
+    if (!BThreadWorkDispatcher_Init(&twd, &reactor, 0)) {
+        printf("BThreadWorkDispatcher_Init failed\n");
+        goto fail1;
+    }
+    
+    int num_instances = num_flows * (fairqueue_index + 1) + (pipeline_len - (fairqueue_index + 1));
+    instances = (Instance *)BAllocArray(num_instances, sizeof(instances[0]));
+    init_order = (Instance **)BAllocArray(num_instances, sizeof(init_order[0]));
+    sources = (PacketRecvInterface *)BAllocArray(num_flows, sizeof(sources[0]));
+    if (!instances || !init_order || !sources) {
+        printf("BAllocArray failed\n");
+        goto fail2;
+    }
+    
+    for (int i = 0; i < num_flows; i++) {
+        PacketRecvInterface_Init(&sources[i], packet_size, (PacketRecvInterface_handler_recv)pipeline_source_handler_recv, &sources[i], pg);
+    }
+    
+    PacketPassInterface_Init(&sink, pipeline_mtus[pipeline_len], pipeline_sink_handler_send, NULL, pg);
+    
+    num_inited = 0;
+    fairqueue_inited = 0;
+    
+    if (!build_pass(0, pipeline_len, &sink)) {
+        goto fail3;
+    }
+    
+#ifdef FLOW_BENCH_WRAP_MALLOC
+    long long start_allocs = num_allocs;
+#endif
+    
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    
+    BReactor_Exec(&reactor);
+    
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    
+    double ns = (end_time.tv_sec - start_time.tv_sec) * 1e9 + (end_time.tv_nsec - start_time.tv_nsec);
+    
+    printf("%s, %d flows, %d bytes: %.1f ns/packet, %.2f Mpackets/s, %.2f sink packets/packet, %.1f sink bytes/packet",
+           argv[2], num_flows, packet_size, ns / num_produced, num_produced / ns * 1000.0,
+           (double)num_received / num_produced, (double)num_sink_bytes / num_produced);
+#ifdef FLOW_BENCH_WRAP_MALLOC
+    printf(", %.3f allocs/packet", (double)(num_allocs - start_allocs) / num_produced);
+#endif
+    printf("\n");
+    
+fail3:
+    if (fairqueue_inited) {
+        PacketPassFairQueue_PrepareFree(&fairqueue);
+    }
+    while (num_inited > 0) {
+        free_instance(init_order[--num_inited]);
+    }
+    if (fairqueue_inited) {
+        PacketPassFairQueue_Free(&fairqueue);
+    }
+    PacketPassInterface_Free(&sink);
+    for (int i = 0; i < num_flows; i++) {
+        PacketRecvInterface_Free(&sources[i]);
+    }
+fail2:
+    BFree(sources);
+    BFree(init_order);
+    BFree(instances);
+    BThreadWorkDispatcher_Free(&twd);
+fail1:
+    BReactor_Free(&reactor);
+fail0:
+    BLog_Free();
+    DebugObjectGlobal_Finish();
+    free(stages_str);
+    
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    if (argc >= 2 && !strcmp(argv[1], "pipeline")) {
+        return pipeline_main(argc, argv);
+    }
+    
+    if (argc != 4) {
+        usage(argv[0]);
+    }
+    
+    int direct;
+    if (!strcmp(argv[1], "job")) {
+        direct = 0;
+    }
+    else if (!strcmp(argv[1], "direct")) {
+        direct = 1;
+    }
+    else {
+        usage(argv[0]);
+    }
+    
+    int num_stages = atoi(argv[2]);
+    num_packets = atoll(argv[3]);
+    
+    if (num_stages < 0 || num_packets <= 0) {
+        usage(argv[0]);
+    }
+    
+    BLog_InitStdout();
+    
+    BTime_Init();
+    
+    if (!BReactor_Init(&reactor)) {
+        printf("BReactor_Init failed\n");
+        goto fail0;
+    }
+    
+    BPendingGroup *pg = BReactor_PendingGroup(&reactor);
+    
+    Stage *stages = (Stage *)BAllocArray(num_stages, sizeof(stages[0]));
+    if (num_stages > 0 && !stages) {
+        printf("BAllocArray failed\n");
+        goto fail1;
+    }
+    
+    // build the pipeline from the sink backwards
+    PacketPassInterface_Init(&sink, PACKET_SIZE, sink_handler_send, NULL, pg);
+    if (direct) {
+        PacketPassInterface_EnableDirect(&sink);
+    }
+    
+    PacketPassInterface *output = &sink;
+    for (int i = num_stages - 1; i >= 0; i--) {
+        Stage *s = &stages[i];
+        s->output = output;
+        
+        PacketPassInterface_Init(&s->input, PACKET_SIZE, (PacketPassInterface_handler_send)stage_input_handler_send, s, pg);
+        if (direct) {
+            PacketPassInterface_EnableDirect(&s->input);
+        }
+        
+        PacketPassInterface_Sender_Init(s->output, (PacketPassInterface_handler_done)stage_output_handler_done, s);
+        if (direct) {
+            PacketPassInterface_Sender_EnableDirect(s->output);
+        }
+        
+        output = &s->input;
+    }
+    
+    PacketRecvInterface_Init(&source, PACKET_SIZE, source_handler_recv, NULL, pg);
+    
+    SinglePacketBuffer buffer;
+    if (!SinglePacketBuffer_Init(&buffer, &source, output, pg)) {
+        printf("SinglePacketBuffer_Init failed\n");
+        goto fail2;
+    }
+    
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    
+    BReactor_Exec(&reactor);
+    
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    
+    double ns = (end_time.tv_sec - start_time.tv_sec) * 1e9 + (end_time.tv_nsec - start_time.tv_nsec);
+    
+    // each packet crosses num_stages + 1 interfaces; comparing runs with
+    // different numbers of stages gives the cost of one stage
+    printf("%s, %d stages: %.1f ns/packet, %.1f ns/packet/interface, %.2f Mpackets/s\n",
+           argv[1], num_stages, ns / num_packets, ns / num_packets / (num_stages + 1), num_packets / ns * 1000.0);
+    
+    SinglePacketBuffer_Free(&buffer);
+    PacketRecvInterface_Free(&source);
+fail2:
+    for (int i = 0; i < num_stages; i++) {
+        PacketPassInterface_Free(&stages[i].input);
+    }
+    PacketPassInterface_Free(&sink);
+    BFree(stages);
+fail1:
+    BReactor_Free(&reactor);
+fail0:
+    BLog_Free();
+    DebugObjectGlobal_Finish();
+    
+    return 0;
+}
@@ -91,5 +91,30 @@ int main (int argc, char *argv[])
     remove_at(5);
     print_list();
     
+    // use as a queue, checking the first and last nodes
+    struct elem qarr[100];
+    for (int i = 0; i < 100; i++) {
+        uint64_t count = IndexedList_Count(&il);
+        if (count < 50) {
+            elem_insert(&qarr[i], 100 + i, count);
+            ASSERT_FORCE(IndexedList_GetLast(&il) == &qarr[i].node)
+        }
+        if (i % 3 == 0) {
+            IndexedListNode *second = IndexedList_GetNext(&il, IndexedList_GetFirst(&il));
+            remove_at(0);
+            ASSERT_FORCE(IndexedList_GetFirst(&il) == second)
+        }
+        ASSERT_FORCE(IndexedList_GetFirst(&il) == IndexedList_GetAt(&il, 0))
+        ASSERT_FORCE(IndexedList_GetLast(&il) == IndexedList_GetAt(&il, IndexedList_Count(&il) - 1))
+    }
+    
+    // and as a stack
+    while (IndexedList_Count(&il) > 0) {
+        IndexedListNode *prev = IndexedList_GetPrev(&il, IndexedList_GetLast(&il));
+        remove_at(IndexedList_Count(&il) - 1);
+        ASSERT_FORCE(IndexedList_GetLast(&il) == prev)
+    }
+    ASSERT_FORCE(!IndexedList_GetFirst(&il))
+    
     return 0;
 }
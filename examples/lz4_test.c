@@ -0,0 +1,301 @@
+/**
+ * @file lz4_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/lz4.h>
+
+#define COMP_SIZE (LZ4_MAX_INPUT + LZ4_MAX_INPUT / 255 + 16)
+#define GUARD_SIZE 64
+#define GUARD_BYTE 0xA5
+
+static uint8_t data[LZ4_MAX_INPUT];
+static uint8_t comp[COMP_SIZE + GUARD_SIZE];
+static uint8_t out[LZ4_MAX_INPUT + GUARD_SIZE];
+
+static void set_guard (uint8_t *buf, int avail)
+{
+    memset(buf + avail, GUARD_BYTE, GUARD_SIZE);
+}
+
+static void check_guard (const uint8_t *buf, int avail)
+{
+    for (int i = 0; i < GUARD_SIZE; i++) {
+        ASSERT_FORCE(buf[avail + i] == GUARD_BYTE)
+    }
+}
+
+static int decompress (const uint8_t *src, int src_len, int dst_avail)
+{
+    ASSERT_FORCE(dst_avail <= LZ4_MAX_INPUT)
+    
+    set_guard(out, dst_avail);
+    int res = lz4_decompress_block(src, src_len, out, dst_avail);
+    ASSERT_FORCE(res >= -1)
+    ASSERT_FORCE(res <= dst_avail)
+    check_guard(out, dst_avail);
+    
+    return res;
+}
+
+static void fill_data (int len, int kind)
+{
+    switch (kind) {
+        case 0: {
+            // constant
+            memset(data, 'x', len);
+        } break;
+        
+        case 1: {
+            // random, mostly incompressible
+            for (int i = 0; i < len; i++) {
+                data[i] = rand();
+            }
+        } break;
+        
+        case 2: {
+            // small alphabet, short matches
+            for (int i = 0; i < len; i++) {
+                data[i] = 'a' + rand() % 4;
+            }
+        } break;
+        
+        default: {
+            // repeated pieces from earlier with some noise, long and overlapping matches
+            for (int i = 0; i < len;) {
+                if (i > 0 && rand() % 4 != 0) {
+                    int offset = 1 + rand() % (i < 70000 ? i : 70000);
+                    int n = rand() % 300;
+                    for (int j = 0; j < n && i < len; j++) {
+                        data[i] = data[i - offset];
+                        i++;
+                    }
+                } else {
+                    data[i++] = rand();
+                }
+            }
+        } break;
+    }
+}
+
+static void test_round_trip (int len, int kind)
+{
+    fill_data(len, kind);
+    
+    // compress
+    set_guard(comp, COMP_SIZE);
+    int comp_len = lz4_compress_block(data, len, comp, COMP_SIZE);
+    ASSERT_FORCE(comp_len > 0)
+    ASSERT_FORCE(comp_len <= COMP_SIZE)
+    check_guard(comp, COMP_SIZE);
+    
+    // decompress
+    ASSERT_FORCE(decompress(comp, comp_len, len) == len)
+    ASSERT_FORCE(!memcmp(out, data, len))
+    
+    // decompress with more space than needed
+    if (len < LZ4_MAX_INPUT) {
+        ASSERT_FORCE(decompress(comp, comp_len, len + 1) == len)
+        ASSERT_FORCE(!memcmp(out, data, len))
+    }
+    
+    // decompress with too little space
+    if (len > 0) {
+        ASSERT_FORCE(decompress(comp, comp_len, len - 1) == -1)
+    }
+    
+    // compress with too little space; must not write past it
+    uint8_t *comp2 = (uint8_t *)malloc(comp_len - 1 + GUARD_SIZE);
+    ASSERT_FORCE(comp2)
+    set_guard(comp2, comp_len - 1);
+    ASSERT_FORCE(lz4_compress_block(data, len, comp2, comp_len - 1) == -1)
+    check_guard(comp2, comp_len - 1);
+    free(comp2);
+    
+    // decompress truncated blocks; a cut right after the literals of a sequence
+    // looks like a complete shorter block, anything else must be rejected
+    int step = (comp_len > 1000 ? comp_len / 500 : 1);
+    for (int cut = 0; cut < comp_len; cut += step) {
+        int res = decompress(comp, cut, len);
+        ASSERT_FORCE(res < len)
+        if (res >= 0) {
+            ASSERT_FORCE(!memcmp(out, data, res))
+        }
+    }
+}
+
+static void test_compress_ratio (void)
+{
+    // constant data must compress well
+    fill_data(LZ4_MAX_INPUT, 0);
+    int comp_len = lz4_compress_block(data, LZ4_MAX_INPUT, comp, COMP_SIZE);
+    ASSERT_FORCE(comp_len > 0)
+    ASSERT_FORCE(comp_len < 300)
+}
+
+static void test_malformed (void)
+{
+    // empty block
+    ASSERT_FORCE(decompress((const uint8_t *)"", 0, 100) == -1)
+    
+    // literals only
+    ASSERT_FORCE(decompress((const uint8_t *)"\x00", 1, 100) == 0)
+    ASSERT_FORCE(decompress((const uint8_t *)"\x30" "abc", 4, 100) == 3)
+    ASSERT_FORCE(!memcmp(out, "abc", 3))
+    
+    // literals running past the end of the block
+    ASSERT_FORCE(decompress((const uint8_t *)"\x50" "ab", 3, 100) == -1)
+    
+    // literal length bytes missing or truncated
+    ASSERT_FORCE(decompress((const uint8_t *)"\xF0", 1, 100) == -1)
+    ASSERT_FORCE(decompress((const uint8_t *)"\xF0\xFF\xFF", 3, 1000) == -1)
+    
+    // a valid sequence: 4 literals, then a match of 9 at offset 4, then no literals
+    static const uint8_t seq[] = {0x45, 'a', 'b', 'c', 'd', 4, 0, 0x00};
+    ASSERT_FORCE(decompress(seq, sizeof(seq), 100) == 13)
+    ASSERT_FORCE(!memcmp(out, "abcdabcdabcda", 13))
+    
+    // its match overflowing the output buffer
+    ASSERT_FORCE(decompress(seq, sizeof(seq), 13) == 13)
+    ASSERT_FORCE(decompress(seq, sizeof(seq), 12) == -1)
+    ASSERT_FORCE(decompress(seq, sizeof(seq), 4) == -1)
+    
+    // its literals overflowing the output buffer
+    ASSERT_FORCE(decompress(seq, sizeof(seq), 3) == -1)
+    
+    // block ending after a match, without the final literals sequence
+    ASSERT_FORCE(decompress(seq, sizeof(seq) - 1, 100) == -1)
+    
+    // block ending in the middle of the offset
+    ASSERT_FORCE(decompress(seq, 6, 100) == -1)
+    
+    // overlapping match at offset 1
+    static const uint8_t seq_rle[] = {0x1F, 'z', 1, 0, 20, 0x00};
+    ASSERT_FORCE(decompress(seq_rle, sizeof(seq_rle), 100) == 1 + 15 + 20 + 4)
+    for (int i = 0; i < 40; i++) {
+        ASSERT_FORCE(out[i] == 'z')
+    }
+    
+    // match offset of zero
+    static const uint8_t seq_off0[] = {0x40, 'a', 'b', 'c', 'd', 0, 0, 0x00};
+    ASSERT_FORCE(decompress(seq_off0, sizeof(seq_off0), 100) == -1)
+    
+    // match offset pointing before the start of the buffer
+    static const uint8_t seq_off5[] = {0x40, 'a', 'b', 'c', 'd', 5, 0, 0x00};
+    ASSERT_FORCE(decompress(seq_off5, sizeof(seq_off5), 100) == -1)
+    static const uint8_t seq_off_first[] = {0x00, 1, 0, 0x00};
+    ASSERT_FORCE(decompress(seq_off_first, sizeof(seq_off_first), 100) == -1)
+    static const uint8_t seq_off_max[] = {0x40, 'a', 'b', 'c', 'd', 0xFF, 0xFF, 0x00};
+    ASSERT_FORCE(decompress(seq_off_max, sizeof(seq_off_max), 100) == -1)
+    
+    // match length bytes missing
+    static const uint8_t seq_ml_missing[] = {0x4F, 'a', 'b', 'c', 'd', 4, 0};
+    ASSERT_FORCE(decompress(seq_ml_missing, sizeof(seq_ml_missing), 100) == -1)
+    
+    // overlong literal length: 15 + 300 * 255 bytes claimed
+    uint8_t block[1024];
+    int n = 0;
+    block[n++] = 0xF0;
+    for (int i = 0; i < 300; i++) {
+        block[n++] = 255;
+    }
+    block[n++] = 0;
+    ASSERT_FORCE(decompress(block, n, 1000) == -1)
+    ASSERT_FORCE(decompress(block, n, LZ4_MAX_INPUT) == -1)
+    
+    // overlong match length: 4 + 15 + 300 * 255 bytes claimed
+    n = 0;
+    block[n++] = 0x4F;
+    memcpy(block + n, "abcd", 4);
+    n += 4;
+    block[n++] = 4;
+    block[n++] = 0;
+    for (int i = 0; i < 300; i++) {
+        block[n++] = 255;
+    }
+    block[n++] = 0;
+    block[n++] = 0x00;
+    ASSERT_FORCE(decompress(block, n, 1000) == -1)
+    ASSERT_FORCE(decompress(block, n, LZ4_MAX_INPUT) == -1)
+}
+
+static void test_garbage (void)
+{
+    // random blocks must never make the decoder write out of bounds
+    for (int i = 0; i < 20000; i++) {
+        int len = rand() % 64;
+        for (int j = 0; j < len; j++) {
+            comp[j] = rand();
+        }
+        decompress(comp, len, rand() % 200);
+    }
+    
+    // nor must corrupted valid blocks
+    for (int i = 0; i < 200; i++) {
+        int len = rand() % 2000;
+        fill_data(len, 2 + rand() % 2);
+        int comp_len = lz4_compress_block(data, len, comp, COMP_SIZE);
+        ASSERT_FORCE(comp_len > 0)
+        for (int j = 0; j < 20; j++) {
+            int pos = rand() % comp_len;
+            uint8_t old = comp[pos];
+            comp[pos] ^= 1 << (rand() % 8);
+            decompress(comp, comp_len, len);
+            comp[pos] = old;
+        }
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+    
+    for (int kind = 0; kind < 4; kind++) {
+        for (int len = 0; len <= 40; len++) {
+            test_round_trip(len, kind);
+        }
+        for (int i = 0; i < 50; i++) {
+            test_round_trip(rand() % 5000, kind);
+        }
+        test_round_trip(LZ4_MAX_INPUT - 1, kind);
+        test_round_trip(LZ4_MAX_INPUT, kind);
+    }
+    
+    test_compress_ratio();
+    test_malformed();
+    test_garbage();
+    
+    printf("ok\n");
+    
+    return 0;
+}
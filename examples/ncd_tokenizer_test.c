@@ -132,6 +132,9 @@ static int tokenizer_output (void *user, int token, char *value, size_t value_le
         case NCD_TOKEN_INTERRUPT:
             printf("interrupt\n");
             break;
+        case NCD_TOKEN_PARALLEL:
+            printf("parallel\n");
+            break;
         default:
             printf("UNKNOWN_TOKEN\n");
             break;
@@ -0,0 +1,400 @@
+/**
+ * @file udpgw_dgram_test.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/byteorder.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <udpgw_dgram/UdpGwDgram.h>
+
+#define SESSION_ID 0x1234
+#define WINDOW 64
+
+struct dgram {
+    uint8_t data[UDPGW_DGRAM_PACKET_MTU(0)];
+    int len;
+};
+
+static BReactor reactor;
+static UdpGwDgram client;
+static UdpGwDgram server;
+static PacketPassInterface client_send_output;
+static PacketPassInterface client_recv_output;
+static PacketPassInterface server_send_output;
+static PacketPassInterface server_recv_output;
+static PacketPassInterface *server_recv_input;
+static struct dgram captured;
+static int have_captured;
+static uint64_t received_seq;
+static int num_received;
+static int sending;
+
+static void log_func (void *unused)
+{
+}
+
+static void run_jobs (void)
+{
+    BPendingGroup *pg = BReactor_PendingGroup(&reactor);
+    while (BPendingGroup_HasJobs(pg)) {
+        BPendingGroup_ExecuteJob(pg);
+    }
+}
+
+static void client_send_output_handler_send (void *user, uint8_t *data, int data_len)
+{
+    ASSERT_FORCE(!have_captured)
+    ASSERT_FORCE(data_len <= sizeof(captured.data))
+    
+    memcpy(captured.data, data, data_len);
+    captured.len = data_len;
+    have_captured = 1;
+    
+    PacketPassInterface_Done(&client_send_output);
+}
+
+static void server_recv_output_handler_send (void *user, uint8_t *data, int data_len)
+{
+    ASSERT_FORCE(data_len == sizeof(received_seq))
+    
+    memcpy(&received_seq, data, sizeof(received_seq));
+    num_received++;
+    
+    PacketPassInterface_Done(&server_recv_output);
+}
+
+static void unused_output_handler_send (void *user, uint8_t *data, int data_len)
+{
+    ASSERT_FORCE(0)
+}
+
+static void server_recv_input_handler_done (void *user)
+{
+    ASSERT_FORCE(sending)
+    
+    sending = 0;
+}
+
+static void make_dgram (uint64_t seq, struct dgram *d)
+{
+    // have the client send with the given sequence number
+    client.send_seq = seq;
+    
+    uint8_t *buf;
+    ASSERT_FORCE(BufferWriter_StartPacket(UdpGwDgram_GetSendInput(&client), &buf))
+    memcpy(buf, &seq, sizeof(seq));
+    BufferWriter_EndPacket(UdpGwDgram_GetSendInput(&client), sizeof(seq));
+    
+    have_captured = 0;
+    run_jobs();
+    ASSERT_FORCE(have_captured)
+    
+    *d = captured;
+}
+
+static int deliver (const struct dgram *d)
+{
+    int prev_received = num_received;
+    
+    sending = 1;
+    PacketPassInterface_Sender_Send(server_recv_input, (uint8_t *)d->data, d->len);
+    run_jobs();
+    ASSERT_FORCE(!sending)
+    
+    ASSERT_FORCE(num_received == prev_received || num_received == prev_received + 1)
+    return (num_received > prev_received);
+}
+
+static int deliver_seq (uint64_t seq)
+{
+    struct dgram d;
+    make_dgram(seq, &d);
+    
+    int res = deliver(&d);
+    ASSERT_FORCE(!res || received_seq == seq)
+    
+    return res;
+}
+
+static void set_dgram_seq (struct dgram *d, uint64_t seq)
+{
+    struct udpgw_dgram_header header;
+    memcpy(&header, d->data, sizeof(header));
+    header.seq = htol64(seq);
+    memcpy(d->data, &header, sizeof(header));
+}
+
+static void init_session (void)
+{
+    uint8_t key[UDPGW_DGRAM_KEY_SIZE];
+    memset(key, 0x42, sizeof(key));
+    
+    PacketPassInterface_Init(&client_send_output, UDPGW_DGRAM_PACKET_MTU(0), client_send_output_handler_send, NULL, BReactor_PendingGroup(&reactor));
+    PacketPassInterface_Init(&client_recv_output, UDPGW_DGRAM_MAX_MESSAGE, unused_output_handler_send, NULL, BReactor_PendingGroup(&reactor));
+    PacketPassInterface_Init(&server_send_output, UDPGW_DGRAM_PACKET_MTU(0), unused_output_handler_send, NULL, BReactor_PendingGroup(&reactor));
+    PacketPassInterface_Init(&server_recv_output, UDPGW_DGRAM_MAX_MESSAGE, server_recv_output_handler_send, NULL, BReactor_PendingGroup(&reactor));
+    
+    if (!UdpGwDgram_Init(&client, 0, SESSION_ID, key, 0, 1, &client_send_output, &client_recv_output, &reactor, NULL, log_func)) {
+        DEBUG("UdpGwDgram_Init failed");
+        exit(1);
+    }
+    
+    if (!UdpGwDgram_Init(&server, 1, SESSION_ID, key, 0, 1, &server_send_output, &server_recv_output, &reactor, NULL, log_func)) {
+        DEBUG("UdpGwDgram_Init failed");
+        exit(1);
+    }
+    
+    server_recv_input = UdpGwDgram_GetRecvInput(&server);
+    PacketPassInterface_Sender_Init(server_recv_input, server_recv_input_handler_done, NULL);
+    
+    // let the client ask for its first message
+    run_jobs();
+}
+
+static void free_session (void)
+{
+    UdpGwDgram_Free(&server);
+    UdpGwDgram_Free(&client);
+    
+    PacketPassInterface_Free(&server_recv_output);
+    PacketPassInterface_Free(&server_send_output);
+    PacketPassInterface_Free(&client_recv_output);
+    PacketPassInterface_Free(&client_send_output);
+}
+
+static void test_in_order (void)
+{
+    init_session();
+    
+    for (uint64_t seq = 0; seq < 200; seq++) {
+        ASSERT_FORCE(deliver_seq(seq))
+    }
+    
+    // with gaps
+    for (uint64_t seq = 200; seq < 1000; seq += 7) {
+        ASSERT_FORCE(deliver_seq(seq))
+    }
+    
+    free_session();
+}
+
+static void test_duplicate (void)
+{
+    init_session();
+    
+    struct dgram d[100];
+    for (int i = 0; i < 100; i++) {
+        make_dgram(i, &d[i]);
+        ASSERT_FORCE(deliver(&d[i]))
+    }
+    
+    // the latest one, and any within the window, only get through once
+    ASSERT_FORCE(!deliver(&d[99]))
+    ASSERT_FORCE(!deliver(&d[98]))
+    ASSERT_FORCE(!deliver(&d[99 - WINDOW + 1]))
+    
+    // out of order within the window
+    ASSERT_FORCE(deliver_seq(110))
+    ASSERT_FORCE(deliver_seq(105))
+    ASSERT_FORCE(deliver_seq(103))
+    ASSERT_FORCE(deliver_seq(104))
+    ASSERT_FORCE(!deliver_seq(105))
+    ASSERT_FORCE(!deliver_seq(110))
+    ASSERT_FORCE(deliver_seq(109))
+    ASSERT_FORCE(!deliver_seq(109))
+    
+    free_session();
+}
+
+static void test_too_old (void)
+{
+    init_session();
+    
+    // first one sets the window, anything below it is too old
+    ASSERT_FORCE(deliver_seq(1000))
+    ASSERT_FORCE(deliver_seq(1000 - WINDOW + 1))
+    ASSERT_FORCE(!deliver_seq(1000 - WINDOW))
+    ASSERT_FORCE(!deliver_seq(0))
+    
+    // a jump of a whole window forgets everything before
+    ASSERT_FORCE(deliver_seq(1000 + WINDOW))
+    ASSERT_FORCE(!deliver_seq(1000))
+    ASSERT_FORCE(deliver_seq(1000 + 1))
+    
+    // a jump of less than the window keeps what is still in it
+    ASSERT_FORCE(deliver_seq(1000 + 2 * WINDOW - 1))
+    ASSERT_FORCE(!deliver_seq(1000 + WINDOW))
+    ASSERT_FORCE(!deliver_seq(1000 + 1))
+    ASSERT_FORCE(deliver_seq(1000 + WINDOW + 1))
+    
+    // a big jump
+    ASSERT_FORCE(deliver_seq(UINT64_C(1) << 40))
+    ASSERT_FORCE(!deliver_seq(1000 + 2 * WINDOW - 1))
+    ASSERT_FORCE(deliver_seq((UINT64_C(1) << 40) - 1))
+    
+    free_session();
+}
+
+static void test_wraparound (void)
+{
+    init_session();
+    
+    // the oldest sequence number in the window, near the end of the sequence space
+    ASSERT_FORCE(deliver_seq(UINT64_MAX - 2 * WINDOW))
+    ASSERT_FORCE(deliver_seq(UINT64_MAX - 2))
+    ASSERT_FORCE(deliver_seq(UINT64_MAX - 2 - (WINDOW - 1)))
+    ASSERT_FORCE(!deliver_seq(UINT64_MAX - 2 - (WINDOW - 1)))
+    ASSERT_FORCE(!deliver_seq(UINT64_MAX - 2 - WINDOW))
+    
+    // up to the last sequence number
+    ASSERT_FORCE(deliver_seq(UINT64_MAX - 1))
+    ASSERT_FORCE(deliver_seq(UINT64_MAX))
+    ASSERT_FORCE(!deliver_seq(UINT64_MAX))
+    ASSERT_FORCE(deliver_seq(UINT64_MAX - (WINDOW - 1)))
+    ASSERT_FORCE(!deliver_seq(UINT64_MAX - WINDOW))
+    
+    // sequence numbers which wrapped around are too old, not new
+    for (uint64_t seq = 0; seq < 2 * WINDOW; seq++) {
+        ASSERT_FORCE(!deliver_seq(seq))
+    }
+    
+    free_session();
+}
+
+static void test_forged (void)
+{
+    init_session();
+    
+    struct dgram d;
+    make_dgram(500, &d);
+    
+    // corrupted datagram is dropped and not remembered
+    struct dgram bad = d;
+    bad.data[bad.len - 1] ^= 1;
+    ASSERT_FORCE(!deliver(&bad))
+    ASSERT_FORCE(deliver(&d))
+    
+    // a forged sequence number does not move the window
+    bad = d;
+    set_dgram_seq(&bad, 500 + 10 * WINDOW);
+    ASSERT_FORCE(!deliver(&bad))
+    ASSERT_FORCE(deliver_seq(499))
+    ASSERT_FORCE(deliver_seq(500 - WINDOW + 1))
+    
+    // datagram for another session
+    make_dgram(501, &d);
+    bad = d;
+    struct udpgw_dgram_header header;
+    memcpy(&header, bad.data, sizeof(header));
+    header.session_id = htol32(SESSION_ID + 1);
+    memcpy(bad.data, &header, sizeof(header));
+    ASSERT_FORCE(!deliver(&bad))
+    ASSERT_FORCE(deliver(&d))
+    
+    // truncated datagram
+    bad = d;
+    bad.len = sizeof(struct udpgw_dgram_header) + UDPGW_DGRAM_TAG_SIZE - 1;
+    ASSERT_FORCE(!deliver(&bad))
+    
+    free_session();
+}
+
+static void test_random (void)
+{
+    init_session();
+    
+    // compare against a simple model: a sequence number gets through if it
+    // has not yet and is within the window of the highest one so far
+    #define RANDOM_RANGE 1000
+    static uint8_t seen[RANDOM_RANGE + 1];
+    memset(seen, 0, sizeof(seen));
+    int have_top = 0;
+    uint64_t top = 0;
+    
+    for (int i = 0; i < 20000; i++) {
+        uint64_t seq;
+        if (!have_top || rand() % 8 == 0) {
+            seq = rand() % (RANDOM_RANGE + 1);
+        } else {
+            uint64_t d = rand() % (2 * WINDOW);
+            seq = (d > top ? 0 : top - d) + rand() % 3;
+            if (seq > RANDOM_RANGE) {
+                seq = RANDOM_RANGE;
+            }
+        }
+        
+        int expected = !seen[seq] && (!have_top || seq + WINDOW > top);
+        ASSERT_FORCE(deliver_seq(seq) == expected)
+        
+        if (expected) {
+            seen[seq] = 1;
+            if (!have_top || seq > top) {
+                have_top = 1;
+                top = seq;
+            }
+        }
+    }
+    
+    free_session();
+}
+
+int main (int argc, char *argv[])
+{
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+    
+    BLog_InitStdout();
+    
+    BTime_Init();
+    
+    if (!BReactor_Init(&reactor)) {
+        DEBUG("BReactor_Init failed");
+        return 1;
+    }
+    
+    test_in_order();
+    test_duplicate();
+    test_too_old();
+    test_wraparound();
+    test_forged();
+    test_random();
+    
+    BReactor_Free(&reactor);
+    
+    BLog_Free();
+    
+    printf("ok\n");
+    
+    return 0;
+}
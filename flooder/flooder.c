@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <inttypes.h>
 
 #include <protocol/addr.h>
 #include <protocol/scproto.h>
@@ -40,7 +41,11 @@
 #include <misc/byteorder.h>
 #include <misc/loggers_string.h>
 #include <misc/open_standard_streams.h>
+#include <misc/packed.h>
+#include <misc/balloc.h>
+#include <misc/latency_histogram.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
 #include <system/BReactor.h>
 #include <system/BSignal.h>
 #include <system/BNetwork.h>
@@ -51,6 +56,8 @@
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
+#include <system/BReactorGroup.h>
+#include <system/BReactorMailbox.h>
 #endif
 
 #include <flooder/flooder.h>
@@ -78,6 +85,18 @@ struct {
     char *server_addr;
     peerid_t floods[MAX_FLOODS];
     int num_floods;
+    int flood_all;
+    int num_clients;
+    int threads;
+    double rate_pps;
+    double rate_bps;
+    int packet_size_min;
+    int packet_size_max;
+    int packet_sizes[MAX_PACKET_SIZES];
+    int packet_weights[MAX_PACKET_SIZES];
+    int num_packet_sizes;
+    btime_t duration;
+    btime_t drain_time;
 } options;
 
 // server address we connect to
@@ -95,31 +114,108 @@ CERTCertificate *client_cert;
 // client private key if using SSL
 SECKEYPrivateKey *client_key;
 
-// server connection
-ServerConnection server;
+// statistics of a thread running virtual clients, written only by that thread
+struct flood_thread {
+    int index;
+    BReactor *reactor;
+    uint64_t rng;
+    uint64_t sent;
+    uint64_t sent_bytes;
+    uint64_t received;
+    uint64_t received_bytes;
+    uint64_t errors;
+    uint64_t latency[LATENCY_HISTOGRAM_BUCKETS];
+};
 
-// whether server is ready
-int server_ready;
+// virtual client, one connection to the server
+struct flood_client {
+    int index;
+    struct flood_thread *thread;
+    int alive;
+    int failed;
+    ServerConnection server;
+    BTimer timer;
+    int ready;
+    // following defined only if ready
+    peerid_t my_id;
+    PacketRecvInterface source;
+    PacketProtoEncoder encoder;
+    SinglePacketBuffer buffer;
+    int blocking;
+    uint8_t *send_data;
+    uint64_t next_send;
+    int next_target;
+    peerid_t *peers;
+    int num_peers;
+    // messages counted as sent to and received from each virtual client
+    uint64_t *sent_to;
+    uint64_t *recv_from;
+};
 
-// my ID, defined only after server_ready
-peerid_t my_id;
+// virtual clients
+struct flood_client *clients;
 
-// flooding output
-PacketRecvInterface flood_source;
-PacketProtoEncoder flood_encoder;
-SinglePacketBuffer flood_buffer;
+// capacity of the peers array of each client
+int peers_capacity;
 
-// whether we were asked for a packet and blocked
-int flood_blocking;
+// client threads; with options.threads == 0, the clients run in the
+// main reactor with the statistics of threads[0]
+struct flood_thread threads[MAX_THREADS];
+int num_thread_slots;
 
-// index of next peer to send packet too
-int flood_next;
+#ifndef BADVPN_USE_WINAPI
+// threads running virtual clients, if options.threads > 0
+BReactorGroup thread_group;
+
+// mailbox of the main reactor for messages from client threads
+BReactorMailbox main_mailbox;
+
+// posted to the main reactor when the last virtual client failed
+BReactorMailboxMessage all_failed_msg;
+#endif
+
+// index of the virtual client plus one for every peer ID which belongs to
+// one of our connected virtual clients, zero for other IDs
+int peer_index[UINT16_MAX + 1];
+
+// number of virtual clients which did not fail
+int num_live;
+
+// random ID of this process, in flood messages
+uint32_t run_id;
+
+// nanoseconds between messages of a client for the packet rate and for
+// each bit of the bitrate, zero if not limited
+double pps_interval;
+double bit_interval;
+
+// sum of the weights of the packet size distribution
+int total_weight;
+
+// set once sending stops; read by client threads
+int stopping;
+
+// monotonic times when sending started and stopped, in nanoseconds
+uint64_t start_time;
+uint64_t stop_time;
+
+// stops sending after options.duration
+BTimer duration_timer;
+
+// quits after options.drain_time once sending stops
+BTimer drain_timer;
 
 /**
  * Cleans up everything that can be cleaned up from inside the event loop.
  */
 static void terminate (void);
 
+/**
+ * Stops sending and quits once the messages in flight had time to arrive.
+ * If sending was already stopped, quits right away.
+ */
+static void request_stop (void);
+
 /**
  * Prints command line help.
  */
@@ -144,18 +240,53 @@ static int parse_arguments (int argc, char *argv[]);
  */
 static int resolve_arguments (void);
 
+/**
+ * Parses a packet size specification into the options strucute.
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int parse_packet_size (const char *str);
+
+/**
+ * Parses a rate, optionally with a k, M or G suffix.
+ *
+ * @return 1 on success, 0 on failure
+ */
+static int parse_rate (const char *str, double *out);
+
 /**
  * Handler invoked when program termination is requested.
  */
 static void signal_handler (void *unused);
 
-static void server_handler_error (void *user);
-static void server_handler_ready (void *user, peerid_t param_my_id, uint32_t ext_ip);
-static void server_handler_newclient (void *user, peerid_t peer_id, int flags, const uint8_t *cert, int cert_len);
-static void server_handler_endclient (void *user, peerid_t peer_id);
-static void server_handler_message (void *user, peerid_t peer_id, uint8_t *data, int data_len);
+static int init_clients (void);
+static void free_clients (void);
+static void start_clients (struct flood_thread *t);
+static void stop_clients (struct flood_thread *t);
+#ifndef BADVPN_USE_WINAPI
+static void thread_start_handler (void *unused, int index, BReactor *reactor);
+static void thread_stop_handler (void *unused, int index, BReactor *reactor);
+static void all_failed_msg_handler (void *unused);
+#endif
+static void duration_timer_handler (void *unused);
+static void drain_timer_handler (void *unused);
+static void print_report (void);
+static uint64_t thread_random (struct flood_thread *t);
+static int choose_packet_size (struct flood_thread *t);
+static double loss_percentile (const double *sorted, size_t count, double q);
+static int compare_double (const void *v1, const void *v2);
 
-static void flood_source_handler_recv (void *user, uint8_t *data);
+static void client_init (struct flood_client *c, struct flood_thread *t);
+static void client_free_connection (struct flood_client *c);
+static void client_failed (struct flood_client *c);
+static void client_send (struct flood_client *c);
+static void client_timer_handler (struct flood_client *c);
+static void client_server_handler_error (struct flood_client *c);
+static void client_server_handler_ready (struct flood_client *c, peerid_t my_id, uint32_t ext_ip);
+static void client_server_handler_newclient (struct flood_client *c, peerid_t peer_id, int flags, const uint8_t *cert, int cert_len);
+static void client_server_handler_endclient (struct flood_client *c, peerid_t peer_id);
+static void client_server_handler_message (struct flood_client *c, peerid_t peer_id, uint8_t *data, int data_len);
+static void client_source_handler_recv (struct flood_client *c, uint8_t *data);
 
 int main (int argc, char *argv[])
 {
@@ -275,30 +406,66 @@ int main (int argc, char *argv[])
         }
     }
     
-    // start connecting to server
-    if (!ServerConnection_Init(
-        &server, &ss, NULL, server_addr, SC_KEEPALIVE_INTERVAL, SERVER_BUFFER_MIN_PACKETS, options.ssl, 0, client_cert, client_key, server_name, NULL,
-        server_handler_error, server_handler_ready, server_handler_newclient, server_handler_endclient, server_handler_message
-    )) {
-        BLog(BLOG_ERROR, "ServerConnection_Init failed");
+    // allocate virtual clients
+    if (!init_clients()) {
+        BLog(BLOG_ERROR, "init_clients failed");
         goto fail5;
     }
     
-    // set server not ready
-    server_ready = 0;
+    // init timers
+    BTimer_Init(&duration_timer, options.duration, duration_timer_handler, NULL);
+    BTimer_Init(&drain_timer, options.drain_time, drain_timer_handler, NULL);
+    
+    stopping = 0;
+    num_live = options.num_clients;
+    start_time = BMetrics_Now();
+    
+    // start connecting virtual clients to server
+    if (options.threads > 0) {
+#ifndef BADVPN_USE_WINAPI
+        if (!BReactorMailbox_Init(&main_mailbox, &ss)) {
+            BLog(BLOG_ERROR, "BReactorMailbox_Init failed");
+            goto fail6;
+        }
+        
+        BReactorMailboxMessage_Init(&all_failed_msg, all_failed_msg_handler, NULL);
+        
+        if (!BReactorGroup_Init(&thread_group, options.threads, 0, NULL, thread_start_handler, thread_stop_handler)) {
+            BLog(BLOG_ERROR, "BReactorGroup_Init failed");
+            BReactorMailbox_Free(&main_mailbox);
+            goto fail6;
+        }
+#endif
+    } else {
+        threads[0].reactor = &ss;
+        start_clients(&threads[0]);
+    }
+    
+    if (options.duration > 0) {
+        BReactor_SetTimer(&ss, &duration_timer);
+    }
     
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
     
-    if (server_ready) {
-        ServerConnection_ReleaseBuffers(&server);
-        SinglePacketBuffer_Free(&flood_buffer);
-        PacketProtoEncoder_Free(&flood_encoder);
-        PacketRecvInterface_Free(&flood_source);
+    // disconnect virtual clients
+    if (options.threads > 0) {
+#ifndef BADVPN_USE_WINAPI
+        // stop threads; afterwards they post no more messages
+        BReactorGroup_Free(&thread_group);
+        BReactorMailbox_Free(&main_mailbox);
+#endif
+    } else {
+        stop_clients(&threads[0]);
     }
     
-    ServerConnection_Free(&server);
+    print_report();
+    
+    BReactor_RemoveTimer(&ss, &drain_timer);
+    BReactor_RemoveTimer(&ss, &duration_timer);
+fail6:
+    free_clients();
 fail5:
     if (options.ssl) {
         CERT_DestroyCertificate(client_cert);
@@ -329,10 +496,33 @@ void terminate (void)
 {
     BLog(BLOG_NOTICE, "tearing down");
     
+    // stop sending
+    if (!stopping) {
+        __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+        stop_time = BMetrics_Now();
+    }
+    
     // exit event loop
     BReactor_Quit(&ss, 0);
 }
 
+void request_stop (void)
+{
+    if (stopping) {
+        terminate();
+        return;
+    }
+    
+    BLog(BLOG_NOTICE, "stopping, waiting for messages in flight");
+    
+    // stop sending; clients see this the next time they would send
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    stop_time = BMetrics_Now();
+    
+    BReactor_RemoveTimer(&ss, &duration_timer);
+    BReactor_SetTimer(&ss, &drain_timer);
+}
+
 void print_help (const char *name)
 {
     printf(
@@ -353,7 +543,18 @@ void print_help (const char *name)
         "        [--server-name <string>]\n"
         "        --server-addr <addr>\n"
         "        [--flood-id <id>] ...\n"
-        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
+        "        [--flood-all]\n"
+        "        [--clients <number>]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--threads <number>]\n"
+        #endif
+        "        [--rate-pps <packets_per_second>]\n"
+        "        [--rate-bps <bits_per_second>]\n"
+        "        [--packet-size <size>/<min>-<max>/<size>:<weight>,...]\n"
+        "        [--duration <seconds>]\n"
+        "        [--drain-time <ms>]\n"
+        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n"
+        "Rates are totals over all clients and may have a k, M or G suffix.\n",
         name
     );
 }
@@ -386,6 +587,16 @@ int parse_arguments (int argc, char *argv[])
     options.server_name = NULL;
     options.server_addr = NULL;
     options.num_floods = 0;
+    options.flood_all = 0;
+    options.num_clients = 1;
+    options.threads = 0;
+    options.rate_pps = 0;
+    options.rate_bps = 0;
+    options.packet_size_min = SC_MAX_MSGLEN;
+    options.packet_size_max = SC_MAX_MSGLEN;
+    options.num_packet_sizes = 0;
+    options.duration = 0;
+    options.drain_time = DEFAULT_DRAIN_TIME;
     
     int i;
     for (i = 1; i < argc; i++) {
@@ -511,6 +722,90 @@ int parse_arguments (int argc, char *argv[])
             options.num_floods++;
             i++;
         }
+        else if (!strcmp(arg, "--flood-all")) {
+            options.flood_all = 1;
+        }
+        else if (!strcmp(arg, "--clients")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.num_clients = atoi(argv[i + 1])) <= 0 || options.num_clients > MAX_CLIENTS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--threads")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.threads = atoi(argv[i + 1])) < 0 || options.threads > MAX_THREADS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--rate-pps")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!parse_rate(argv[i + 1], &options.rate_pps)) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--rate-bps")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!parse_rate(argv[i + 1], &options.rate_bps)) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--packet-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!parse_packet_size(argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--duration")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            double seconds = atof(argv[i + 1]);
+            if (!(seconds > 0)) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            options.duration = seconds * 1000;
+            i++;
+        }
+        else if (!strcmp(arg, "--drain-time")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.drain_time = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else {
             fprintf(stderr, "unknown option: %s\n", arg);
             return 0;
@@ -564,108 +859,664 @@ int resolve_arguments (void)
     return 1;
 }
 
+int parse_packet_size (const char *str)
+{
+    int min_size = sizeof(struct flood_header);
+    int max_size = SC_MAX_MSGLEN;
+    char *end;
+    
+    // weighted list of sizes
+    if (strchr(str, ':')) {
+        int num = 0;
+        int total = 0;
+        while (1) {
+            if (num == MAX_PACKET_SIZES) {
+                return 0;
+            }
+            long size = strtol(str, &end, 10);
+            if (end == str || *end != ':' || size < min_size || size > max_size) {
+                return 0;
+            }
+            str = end + 1;
+            long weight = strtol(str, &end, 10);
+            if (end == str || (*end != ',' && *end != '\0') || weight <= 0 || weight > 1000000 - total) {
+                return 0;
+            }
+            options.packet_sizes[num] = size;
+            options.packet_weights[num] = weight;
+            total += weight;
+            num++;
+            if (*end == '\0') {
+                break;
+            }
+            str = end + 1;
+        }
+        options.num_packet_sizes = num;
+        return 1;
+    }
+    
+    // single size or uniform range
+    long size = strtol(str, &end, 10);
+    if (end == str || size < min_size || size > max_size) {
+        return 0;
+    }
+    long size2 = size;
+    if (*end == '-') {
+        str = end + 1;
+        size2 = strtol(str, &end, 10);
+        if (end == str || size2 < size || size2 > max_size) {
+            return 0;
+        }
+    }
+    if (*end != '\0') {
+        return 0;
+    }
+    
+    options.packet_size_min = size;
+    options.packet_size_max = size2;
+    options.num_packet_sizes = 0;
+    return 1;
+}
+
+int parse_rate (const char *str, double *out)
+{
+    char *end;
+    double rate = strtod(str, &end);
+    if (end == str) {
+        return 0;
+    }
+    
+    switch (*end) {
+        case 'k': rate *= 1e3; end++; break;
+        case 'M': rate *= 1e6; end++; break;
+        case 'G': rate *= 1e9; end++; break;
+    }
+    
+    if (*end != '\0' || !(rate > 0)) {
+        return 0;
+    }
+    
+    *out = rate;
+    return 1;
+}
+
 void signal_handler (void *unused)
 {
     BLog(BLOG_NOTICE, "termination requested");
     
-    terminate();
+    request_stop();
+}
+
+
+int init_clients (void)
+{
+    int n = options.num_clients;
+    
+    // compute rate limits per client
+    pps_interval = (options.rate_pps > 0) ? 1e9 * n / options.rate_pps : 0;
+    bit_interval = (options.rate_bps > 0) ? 1e9 * n / options.rate_bps : 0;
+    
+    total_weight = 0;
+    for (int i = 0; i < options.num_packet_sizes; i++) {
+        total_weight += options.packet_weights[i];
+    }
+    
+    // pick an ID to recognize our own messages by
+    run_id = (BMetrics_Now() * UINT64_C(0x9e3779b97f4a7c15)) >> 32;
+    
+    memset(peer_index, 0, sizeof(peer_index));
+    
+    // init thread statistics
+    num_thread_slots = (options.threads > 0) ? options.threads : 1;
+    for (int i = 0; i < num_thread_slots; i++) {
+        struct flood_thread *t = &threads[i];
+        t->index = i;
+        t->reactor = NULL;
+        t->rng = run_id ^ ((uint64_t)(i + 1) * UINT64_C(0x9e3779b97f4a7c15));
+        t->sent = 0;
+        t->sent_bytes = 0;
+        t->received = 0;
+        t->received_bytes = 0;
+        t->errors = 0;
+        memset(t->latency, 0, sizeof(t->latency));
+    }
+    
+    // allocate clients
+    if (!(clients = BAllocArray(n, sizeof(clients[0])))) {
+        goto fail0;
+    }
+    
+    // peers of a client are mostly our other clients
+    peers_capacity = n + MAX_FLOODS;
+    
+    int i;
+    for (i = 0; i < n; i++) {
+        struct flood_client *c = &clients[i];
+        c->index = i;
+        c->alive = 0;
+        c->failed = 0;
+        c->ready = 0;
+        
+        if (!(c->peers = BAllocArray(peers_capacity, sizeof(c->peers[0])))) {
+            goto fail1;
+        }
+        if (!(c->sent_to = BAllocArray(n, sizeof(c->sent_to[0])))) {
+            goto fail2;
+        }
+        if (!(c->recv_from = BAllocArray(n, sizeof(c->recv_from[0])))) {
+            goto fail3;
+        }
+        
+        memset(c->sent_to, 0, n * sizeof(c->sent_to[0]));
+        memset(c->recv_from, 0, n * sizeof(c->recv_from[0]));
+        continue;
+        
+    fail3:
+        BFree(c->sent_to);
+    fail2:
+        BFree(c->peers);
+        goto fail1;
+    }
+    
+    return 1;
+    
+fail1:
+    while (i-- > 0) {
+        BFree(clients[i].recv_from);
+        BFree(clients[i].sent_to);
+        BFree(clients[i].peers);
+    }
+    BFree(clients);
+fail0:
+    return 0;
+}
+
+void free_clients (void)
+{
+    for (int i = 0; i < options.num_clients; i++) {
+        struct flood_client *c = &clients[i];
+        ASSERT(!c->alive)
+        BFree(c->recv_from);
+        BFree(c->sent_to);
+        BFree(c->peers);
+    }
+    
+    BFree(clients);
+}
+
+void start_clients (struct flood_thread *t)
+{
+    ASSERT(t->reactor)
+    
+    for (int i = t->index; i < options.num_clients; i += num_thread_slots) {
+        client_init(&clients[i], t);
+    }
+}
+
+void stop_clients (struct flood_thread *t)
+{
+    for (int i = t->index; i < options.num_clients; i += num_thread_slots) {
+        struct flood_client *c = &clients[i];
+        if (c->alive) {
+            client_free_connection(c);
+        }
+    }
+}
+
+#ifndef BADVPN_USE_WINAPI
+
+void thread_start_handler (void *unused, int index, BReactor *reactor)
+{
+    ASSERT(index >= 0)
+    ASSERT(index < num_thread_slots)
+    
+    threads[index].reactor = reactor;
+    start_clients(&threads[index]);
+}
+
+void thread_stop_handler (void *unused, int index, BReactor *reactor)
+{
+    stop_clients(&threads[index]);
 }
 
-void server_handler_error (void *user)
+void all_failed_msg_handler (void *unused)
 {
-    BLog(BLOG_ERROR, "server connection failed, exiting");
+    BLog(BLOG_ERROR, "all clients failed, exiting");
     
     terminate();
 }
 
-void server_handler_ready (void *user, peerid_t param_my_id, uint32_t ext_ip)
+#endif
+
+void duration_timer_handler (void *unused)
+{
+    request_stop();
+}
+
+void drain_timer_handler (void *unused)
+{
+    terminate();
+}
+
+void print_report (void)
 {
-    ASSERT(!server_ready)
+    int n = options.num_clients;
+    
+    // sum statistics of threads; the threads have finished
+    uint64_t sent = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t received = 0;
+    uint64_t received_bytes = 0;
+    uint64_t errors = 0;
+    uint64_t latency[LATENCY_HISTOGRAM_BUCKETS] = {0};
+    for (int i = 0; i < num_thread_slots; i++) {
+        struct flood_thread *t = &threads[i];
+        sent += t->sent;
+        sent_bytes += t->sent_bytes;
+        received += t->received;
+        received_bytes += t->received_bytes;
+        errors += t->errors;
+        for (int j = 0; j < LATENCY_HISTOGRAM_BUCKETS; j++) {
+            latency[j] += t->latency[j];
+        }
+    }
+    
+    // compute loss of every flow between our clients
+    uint64_t flows_sent = 0;
+    uint64_t flows_received = 0;
+    size_t num_flows = 0;
+    double *flow_loss = BAllocArray2(n, n, sizeof(flow_loss[0]));
+    if (!flow_loss) {
+        BLog(BLOG_ERROR, "BAllocArray2 failed");
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            uint64_t fs = clients[i].sent_to[j];
+            uint64_t fr = clients[j].recv_from[i];
+            if (fs == 0) {
+                continue;
+            }
+            flows_sent += fs;
+            flows_received += fr;
+            if (flow_loss) {
+                flow_loss[num_flows++] = (fr < fs) ? 100.0 * (fs - fr) / fs : 0;
+            }
+        }
+    }
+    if (flow_loss) {
+        qsort(flow_loss, num_flows, sizeof(flow_loss[0]), compare_double);
+    }
+    
+    double seconds = (stop_time - start_time) / 1e9;
+    double loss = (flows_sent > 0 && flows_received < flows_sent) ? 100.0 * (flows_sent - flows_received) / flows_sent : 0;
+    
+    printf("clients=%d errors=%"PRIu64" seconds=%.3f sent=%"PRIu64" sent_pps=%.0f sent_mbps=%.3f "
+           "received=%"PRIu64" received_pps=%.0f received_mbps=%.3f flows=%zu loss_pct=%.3f "
+           "flow_loss_p50_pct=%.3f flow_loss_p90_pct=%.3f flow_loss_p99_pct=%.3f flow_loss_max_pct=%.3f "
+           "latency_p50_us=%.1f latency_p90_us=%.1f latency_p99_us=%.1f latency_p999_us=%.1f latency_max_us=%.1f\n",
+           n, errors, seconds, sent, sent / seconds, sent_bytes * 8 / seconds / 1e6,
+           received, received / seconds, received_bytes * 8 / seconds / 1e6, num_flows, loss,
+           loss_percentile(flow_loss, num_flows, 0.5), loss_percentile(flow_loss, num_flows, 0.9),
+           loss_percentile(flow_loss, num_flows, 0.99), loss_percentile(flow_loss, num_flows, 1),
+           latency_histogram_percentile(latency, 0.5) / 1e3, latency_histogram_percentile(latency, 0.9) / 1e3,
+           latency_histogram_percentile(latency, 0.99) / 1e3, latency_histogram_percentile(latency, 0.999) / 1e3,
+           latency_histogram_percentile(latency, 1) / 1e3);
+    fflush(stdout);
+    
+    BFree(flow_loss);
+}
+
+uint64_t thread_random (struct flood_thread *t)
+{
+    // xorshift64*
+    uint64_t x = t->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    t->rng = x;
+    return x * UINT64_C(2685821657736338717);
+}
+
+int choose_packet_size (struct flood_thread *t)
+{
+    if (options.num_packet_sizes > 0) {
+        int r = (thread_random(t) >> 32) % total_weight;
+        int i = 0;
+        while (r >= options.packet_weights[i]) {
+            r -= options.packet_weights[i];
+            i++;
+        }
+        return options.packet_sizes[i];
+    }
+    
+    if (options.packet_size_min == options.packet_size_max) {
+        return options.packet_size_min;
+    }
+    
+    return options.packet_size_min + (thread_random(t) >> 32) % (options.packet_size_max - options.packet_size_min + 1);
+}
+
+double loss_percentile (const double *sorted, size_t count, double q)
+{
+    if (count == 0) {
+        return 0;
+    }
+    
+    size_t rank = q * count;
+    if (rank < 1) {
+        rank = 1;
+    }
+    
+    return sorted[rank - 1];
+}
+
+int compare_double (const void *v1, const void *v2)
+{
+    double d1 = *(const double *)v1;
+    double d2 = *(const double *)v2;
+    
+    return (d1 > d2) - (d1 < d2);
+}
+
+void client_init (struct flood_client *c, struct flood_thread *t)
+{
+    ASSERT(!c->alive)
+    
+    c->thread = t;
+    
+    // start connecting to server
+    if (!ServerConnection_Init(
+        &c->server, t->reactor, NULL, server_addr, SC_KEEPALIVE_INTERVAL, SERVER_BUFFER_MIN_PACKETS, options.ssl, 0, client_cert, client_key, server_name, c,
+        (ServerConnection_handler_error)client_server_handler_error,
+        (ServerConnection_handler_ready)client_server_handler_ready,
+        (ServerConnection_handler_newclient)client_server_handler_newclient,
+        (ServerConnection_handler_endclient)client_server_handler_endclient,
+        (ServerConnection_handler_message)client_server_handler_message
+    )) {
+        BLog(BLOG_ERROR, "client %d: ServerConnection_Init failed", c->index);
+        client_failed(c);
+        return;
+    }
+    
+    // init send timer
+    BTimer_Init(&c->timer, 0, (BTimer_handler)client_timer_handler, c);
+    
+    c->ready = 0;
+    c->alive = 1;
+}
+
+void client_free_connection (struct flood_client *c)
+{
+    ASSERT(c->alive)
+    
+    if (c->ready) {
+        // forget our ID
+        __atomic_store_n(&peer_index[c->my_id], 0, __ATOMIC_RELAXED);
+        
+        ServerConnection_ReleaseBuffers(&c->server);
+        SinglePacketBuffer_Free(&c->buffer);
+        PacketProtoEncoder_Free(&c->encoder);
+        PacketRecvInterface_Free(&c->source);
+    }
+    
+    BReactor_RemoveTimer(c->thread->reactor, &c->timer);
+    ServerConnection_Free(&c->server);
+    
+    c->ready = 0;
+    c->alive = 0;
+}
+
+void client_failed (struct flood_client *c)
+{
+    if (c->failed) {
+        return;
+    }
+    c->failed = 1;
+    
+    c->thread->errors++;
+    
+    // exit if this was the last client
+    if (__atomic_sub_fetch(&num_live, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    
+    if (options.threads > 0) {
+#ifndef BADVPN_USE_WINAPI
+        BReactorMailbox_Thread_Post(&main_mailbox, &all_failed_msg);
+#endif
+    } else {
+        BLog(BLOG_ERROR, "all clients failed, exiting");
+        terminate();
+    }
+}
+
+void client_send (struct flood_client *c)
+{
+    ASSERT(c->ready)
+    ASSERT(c->blocking)
+    
+    struct flood_thread *t = c->thread;
+    
+    // once stopping, stay blocked
+    if (__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        return;
+    }
+    
+    // wait for a peer if there is none
+    int num_targets = options.num_floods + c->num_peers;
+    if (num_targets == 0) {
+        return;
+    }
+    
+    uint64_t now = BMetrics_Now();
+    
+    // wait until the next message is due
+    if (pps_interval > 0 || bit_interval > 0) {
+        if (c->next_send > now) {
+            BReactor_SetTimerAfter(t->reactor, &c->timer, (c->next_send - now + 999999) / 1000000);
+            return;
+        }
+        if (now - c->next_send > RATE_BURST_NS) {
+            c->next_send = now - RATE_BURST_NS;
+        }
+    }
+    
+    // choose peer
+    if (c->next_target >= num_targets) {
+        c->next_target = 0;
+    }
+    peerid_t peer_id = (c->next_target < options.num_floods) ? options.floods[c->next_target] : c->peers[c->next_target - options.num_floods];
+    c->next_target++;
+    
+    // count the message towards a flow if the peer is one of our clients
+    int dest_index = __atomic_load_n(&peer_index[peer_id], __ATOMIC_RELAXED) - 1;
+    
+    int len = choose_packet_size(t);
+    
+    uint8_t *data = c->send_data;
+    
+    struct sc_header header;
+    header.type = SCID_OUTMSG;
+    memcpy(data, &header, sizeof(header));
+    
+    struct sc_client_outmsg omsg;
+    omsg.clientid = htol16(peer_id);
+    memcpy(data + sizeof(header), &omsg, sizeof(omsg));
+    
+    uint8_t *payload = data + sizeof(struct sc_header) + sizeof(struct sc_client_outmsg);
+    
+    struct flood_header fh;
+    fh.magic = htol32(FLOOD_MAGIC);
+    fh.run_id = htol32(run_id);
+    fh.client_index = htol16(c->index);
+    fh.counted = (dest_index >= 0);
+    fh.send_time = htol64(now);
+    memcpy(payload, &fh, sizeof(fh));
+    memset(payload + sizeof(fh), 0, len - sizeof(fh));
+    
+    if (dest_index >= 0) {
+        c->sent_to[dest_index]++;
+    }
+    t->sent++;
+    t->sent_bytes += len;
+    
+    // schedule next message
+    double interval = pps_interval;
+    if (bit_interval * 8 * len > interval) {
+        interval = bit_interval * 8 * len;
+    }
+    c->next_send += interval;
+    
+    c->blocking = 0;
+    PacketRecvInterface_Done(&c->source, sizeof(struct sc_header) + sizeof(struct sc_client_outmsg) + len);
+}
+
+void client_timer_handler (struct flood_client *c)
+{
+    ASSERT(c->ready)
+    ASSERT(c->blocking)
+    
+    client_send(c);
+}
+
+void client_server_handler_error (struct flood_client *c)
+{
+    BLog(BLOG_ERROR, "client %d: server connection failed", c->index);
+    
+    client_free_connection(c);
+    client_failed(c);
+}
+
+void client_server_handler_ready (struct flood_client *c, peerid_t my_id, uint32_t ext_ip)
+{
+    ASSERT(c->alive)
+    ASSERT(!c->ready)
+    
+    BPendingGroup *pg = BReactor_PendingGroup(c->thread->reactor);
     
     // remember our ID
-    my_id = param_my_id;
+    c->my_id = my_id;
     
     // init flooding
     
     // init source
-    PacketRecvInterface_Init(&flood_source, SC_MAX_ENC, flood_source_handler_recv, NULL, BReactor_PendingGroup(&ss));
+    PacketRecvInterface_Init(&c->source, SC_MAX_ENC, (PacketRecvInterface_handler_recv)client_source_handler_recv, c, pg);
     
     // init encoder
-    PacketProtoEncoder_Init(&flood_encoder, &flood_source, BReactor_PendingGroup(&ss));
+    PacketProtoEncoder_Init(&c->encoder, &c->source, pg);
     
     // init buffer
-    if (!SinglePacketBuffer_Init(&flood_buffer, PacketProtoEncoder_GetOutput(&flood_encoder), ServerConnection_GetSendInterface(&server), BReactor_PendingGroup(&ss))) {
-        BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed, exiting");
+    if (!SinglePacketBuffer_Init(&c->buffer, PacketProtoEncoder_GetOutput(&c->encoder), ServerConnection_GetSendInterface(&c->server), pg)) {
+        BLog(BLOG_ERROR, "client %d: SinglePacketBuffer_Init failed", c->index);
         goto fail1;
     }
     
     // set not blocking
-    flood_blocking = 0;
+    c->blocking = 0;
+    c->next_send = BMetrics_Now();
+    c->next_target = 0;
+    c->num_peers = 0;
+    
+    // let our other clients count messages to us
+    __atomic_store_n(&peer_index[my_id], c->index + 1, __ATOMIC_RELAXED);
     
     // set server ready
-    server_ready = 1;
+    c->ready = 1;
     
-    BLog(BLOG_INFO, "server: ready, my ID is %d", (int)my_id);
+    BLog(BLOG_INFO, "client %d: ready, my ID is %d", c->index, (int)my_id);
     
     return;
     
 fail1:
-    PacketProtoEncoder_Free(&flood_encoder);
-    PacketRecvInterface_Free(&flood_source);
-    terminate();
+    PacketProtoEncoder_Free(&c->encoder);
+    PacketRecvInterface_Free(&c->source);
+    client_failed(c);
 }
 
-void server_handler_newclient (void *user, peerid_t peer_id, int flags, const uint8_t *cert, int cert_len)
+void client_server_handler_newclient (struct flood_client *c, peerid_t peer_id, int flags, const uint8_t *cert, int cert_len)
 {
-    ASSERT(server_ready)
+    ASSERT(c->alive)
+    
+    BLog(BLOG_INFO, "client %d: newclient %d", c->index, (int)peer_id);
+    
+    if (!c->ready || !options.flood_all) {
+        return;
+    }
     
-    BLog(BLOG_INFO, "newclient %d", (int)peer_id);
+    if (c->num_peers == peers_capacity) {
+        BLog(BLOG_WARNING, "client %d: too many peers, not flooding %d", c->index, (int)peer_id);
+        return;
+    }
+    
+    c->peers[c->num_peers++] = peer_id;
+    
+    // start sending if we were waiting for a peer
+    if (c->blocking && !BTimer_IsRunning(&c->timer)) {
+        client_send(c);
+    }
 }
 
-void server_handler_endclient (void *user, peerid_t peer_id)
+void client_server_handler_endclient (struct flood_client *c, peerid_t peer_id)
 {
-    ASSERT(server_ready)
+    ASSERT(c->alive)
+    
+    BLog(BLOG_INFO, "client %d: endclient %d", c->index, (int)peer_id);
     
-    BLog(BLOG_INFO, "endclient %d", (int)peer_id);
+    if (!c->ready) {
+        return;
+    }
+    
+    for (int i = 0; i < c->num_peers; i++) {
+        if (c->peers[i] == peer_id) {
+            c->peers[i] = c->peers[--c->num_peers];
+            break;
+        }
+    }
 }
 
-void server_handler_message (void *user, peerid_t peer_id, uint8_t *data, int data_len)
+void client_server_handler_message (struct flood_client *c, peerid_t peer_id, uint8_t *data, int data_len)
 {
-    ASSERT(server_ready)
+    ASSERT(c->ready)
     ASSERT(data_len >= 0)
     ASSERT(data_len <= SC_MAX_MSGLEN)
     
-    BLog(BLOG_INFO, "message from %d", (int)peer_id);
-}
-
-void flood_source_handler_recv (void *user, uint8_t *data)
-{
-    ASSERT(server_ready)
-    ASSERT(!flood_blocking)
-    if (options.num_floods > 0) {
-        ASSERT(flood_next >= 0)
-        ASSERT(flood_next < options.num_floods)
+    struct flood_thread *t = c->thread;
+    
+    struct flood_header fh;
+    if (data_len < sizeof(fh)) {
+        return;
     }
+    memcpy(&fh, data, sizeof(fh));
     
-    if (options.num_floods == 0) {
-        flood_blocking = 1;
+    if (ltoh32(fh.magic) != FLOOD_MAGIC) {
         return;
     }
     
-    peerid_t peer_id = options.floods[flood_next];
-    flood_next = (flood_next + 1) % options.num_floods;
+    t->received++;
+    t->received_bytes += data_len;
     
-    BLog(BLOG_INFO, "message to %d", (int)peer_id);
+    // measure latency and loss only for our own messages
+    int src_index = ltoh16(fh.client_index);
+    if (ltoh32(fh.run_id) != run_id || src_index >= options.num_clients) {
+        return;
+    }
     
-    struct sc_header header;
-    header.type = SCID_OUTMSG;
-    memcpy(data, &header, sizeof(header));
+    if (fh.counted) {
+        c->recv_from[src_index]++;
+    }
     
-    struct sc_client_outmsg omsg;
-    omsg.clientid = htol16(peer_id);
-    memcpy(data + sizeof(header), &omsg, sizeof(omsg));
+    uint64_t now = BMetrics_Now();
+    uint64_t send_time = ltoh64(fh.send_time);
+    latency_histogram_add(t->latency, (now > send_time) ? now - send_time : 0);
+}
+
+void client_source_handler_recv (struct flood_client *c, uint8_t *data)
+{
+    ASSERT(c->ready)
+    ASSERT(!c->blocking)
     
-    memset(data + sizeof(struct sc_header) + sizeof(struct sc_client_outmsg), 0, SC_MAX_MSGLEN);
+    c->blocking = 1;
+    c->send_data = data;
     
-    PacketRecvInterface_Done(&flood_source, sizeof(struct sc_header) + sizeof(struct sc_client_outmsg) + SC_MAX_MSGLEN);
+    client_send(c);
 }
@@ -35,3 +35,53 @@
 
 // maximum number of peers to flood
 #define MAX_FLOODS 64
+
+// maximum number of virtual clients
+#define MAX_CLIENTS 1024
+
+// maximum number of threads running virtual clients
+#define MAX_THREADS 64
+
+// maximum number of sizes in a packet size distribution
+#define MAX_PACKET_SIZES 16
+
+// how far a rate-limited client may fall behind its schedule and
+// then catch up with a burst, in nanoseconds
+#define RATE_BURST_NS 10000000
+
+// default time to wait for messages in flight after sending stops, in milliseconds
+#define DEFAULT_DRAIN_TIME 1000
+
+#define FLOOD_MAGIC UINT32_C(0x666c6f64)
+
+/**
+ * Header at the start of every flood message payload.
+ * All fields are little-endian.
+ */
+B_START_PACKED
+struct flood_header {
+    /**
+     * FLOOD_MAGIC.
+     */
+    uint32_t magic;
+    /**
+     * Random ID of the flooder process which sent the message.
+     * Latency and loss are only measured for messages from our own process,
+     * whose clock and counters we share.
+     */
+    uint32_t run_id;
+    /**
+     * Index of the sending virtual client.
+     */
+    uint16_t client_index;
+    /**
+     * Whether the sender counted the message as sent to one of our virtual
+     * clients, so that the receiver counts it towards the loss of that flow.
+     */
+    uint8_t counted;
+    /**
+     * Monotonic time when the message was sent, in nanoseconds.
+     */
+    uint64_t send_time;
+} B_PACKED;
+B_END_PACKED
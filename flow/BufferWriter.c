@@ -38,6 +38,11 @@ static void output_handler_recv (BufferWriter *o, uint8_t *data)
     // set output packet
     o->out_have = 1;
     o->out = data;
+    
+    // report that a packet can be written
+    if (o->handler_ready) {
+        o->handler_ready(o->user);
+    }
 }
 
 void BufferWriter_Init (BufferWriter *o, int mtu, BPendingGroup *pg)
@@ -50,6 +55,9 @@ void BufferWriter_Init (BufferWriter *o, int mtu, BPendingGroup *pg)
     // set no output packet
     o->out_have = 0;
     
+    // set no ready handler
+    o->handler_ready = NULL;
+    
     DebugObject_Init(&o->d_obj);
     #ifndef NDEBUG
     o->d_mtu = mtu;
@@ -72,6 +80,14 @@ PacketRecvInterface * BufferWriter_GetOutput (BufferWriter *o)
     return &o->recv_interface;
 }
 
+void BufferWriter_SetReadyHandler (BufferWriter *o, BufferWriter_handler_ready handler, void *user)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->handler_ready = handler;
+    o->user = user;
+}
+
 int BufferWriter_StartPacket (BufferWriter *o, uint8_t **buf)
 {
     ASSERT(!o->d_writing)
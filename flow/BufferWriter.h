@@ -41,6 +41,15 @@
 #include <base/DebugObject.h>
 #include <flow/PacketRecvInterface.h>
 
+/**
+ * Handler called when a memory location for writing a packet becomes
+ * available, i.e. when {@link BufferWriter_StartPacket} would now succeed.
+ * It is called from a job.
+ * 
+ * @param user as in {@link BufferWriter_SetReadyHandler}
+ */
+typedef void (*BufferWriter_handler_ready) (void *user);
+
 /**
  * Object for writing packets to a {@link PacketRecvInterface} client
  * in a best-effort fashion.
@@ -49,6 +58,8 @@ typedef struct {
     PacketRecvInterface recv_interface;
     int out_have;
     uint8_t *out;
+    BufferWriter_handler_ready handler_ready;
+    void *user;
     DebugObject d_obj;
     #ifndef NDEBUG
     int d_mtu;
@@ -81,6 +92,17 @@ void BufferWriter_Free (BufferWriter *o);
  */
 PacketRecvInterface * BufferWriter_GetOutput (BufferWriter *o);
 
+/**
+ * Sets a handler to be called whenever a memory location for writing a
+ * packet becomes available. This allows writing packets as they can be
+ * accepted, instead of dropping those which come while there is no space.
+ * 
+ * @param o the object
+ * @param handler handler to call, or NULL to not call anything
+ * @param user value passed to the handler
+ */
+void BufferWriter_SetReadyHandler (BufferWriter *o, BufferWriter_handler_ready handler, void *user);
+
 /**
  * Attempts to provide a memory location for writing a packet.
  * The object must be in not writing state.
@@ -36,63 +36,71 @@
 
 #include <generated/blog_channel_LineBuffer.h>
 
+static void process (LineBuffer *o)
+{
+    ASSERT(o->buf_start <= o->buf_scanned)
+    ASSERT(o->buf_scanned <= o->buf_used)
+    
+    // look for newline, past what has already been scanned
+    uint8_t *nl = (uint8_t *)memchr(o->buf + o->buf_scanned, o->nl_char, o->buf_used - o->buf_scanned);
+    
+    if (nl) {
+        // pass line to output
+        o->buf_consumed = (nl + 1) - (o->buf + o->buf_start);
+        PacketPassInterface_Sender_Send(o->output, o->buf + o->buf_start, o->buf_consumed);
+        return;
+    }
+    
+    o->buf_scanned = o->buf_used;
+    
+    if (o->buf_used - o->buf_start == o->buf_size) {
+        BLog(BLOG_WARNING, "line too long");
+        
+        // pass to output
+        o->buf_consumed = o->buf_size;
+        PacketPassInterface_Sender_Send(o->output, o->buf + o->buf_start, o->buf_consumed);
+        return;
+    }
+    
+    // move the partial line to the start of the buffer; this is done once
+    // per read rather than once per line
+    if (o->buf_start > 0) {
+        memmove(o->buf, o->buf + o->buf_start, o->buf_used - o->buf_start);
+        o->buf_used -= o->buf_start;
+        o->buf_scanned -= o->buf_start;
+        o->buf_start = 0;
+    }
+    
+    // receive more data
+    StreamRecvInterface_Receiver_Recv(o->input, o->buf + o->buf_used, o->buf_size - o->buf_used);
+}
+
 static void input_handler_done (LineBuffer *o, int data_len)
 {
     DebugObject_Access(&o->d_obj);
+    ASSERT(o->buf_start == 0)
     ASSERT(data_len > 0)
     ASSERT(data_len <= o->buf_size - o->buf_used)
     
     // update buffer
     o->buf_used += data_len;
     
-    // look for newline
-    int i;
-    for (i = o->buf_used - data_len; i < o->buf_used; i++) {
-        if (o->buf[i] == o->nl_char) {
-            break;
-        }
-    }
-    
-    if (i < o->buf_used || o->buf_used == o->buf_size) {
-        if (i == o->buf_used) {
-            BLog(BLOG_WARNING, "line too long");
-        }
-        
-        // pass to output
-        o->buf_consumed = (i < o->buf_used ? i + 1 : i);
-        PacketPassInterface_Sender_Send(o->output, o->buf, o->buf_consumed);
-    } else {
-        // receive more data
-        StreamRecvInterface_Receiver_Recv(o->input, o->buf + o->buf_used, o->buf_size - o->buf_used);
-    }
+    process(o);
 }
 
 static void output_handler_done (LineBuffer *o)
 {
     DebugObject_Access(&o->d_obj);
     ASSERT(o->buf_consumed > 0)
-    ASSERT(o->buf_consumed <= o->buf_used)
+    ASSERT(o->buf_consumed <= o->buf_used - o->buf_start)
     
-    // update buffer
-    memmove(o->buf, o->buf + o->buf_consumed, o->buf_used - o->buf_consumed);
-    o->buf_used -= o->buf_consumed;
-    
-    // look for newline
-    int i;
-    for (i = 0; i < o->buf_used; i++) {
-        if (o->buf[i] == o->nl_char) {
-            break;
-        }
+    // consume the line
+    o->buf_start += o->buf_consumed;
+    if (o->buf_scanned < o->buf_start) {
+        o->buf_scanned = o->buf_start;
     }
     
-    if (i < o->buf_used || o->buf_used == o->buf_size) {
-        // pass to output
-        o->buf_consumed = (i < o->buf_used ? i + 1 : i);
-        PacketPassInterface_Sender_Send(o->output, o->buf, o->buf_consumed);
-    } else {
-        // receive more data
-        StreamRecvInterface_Receiver_Recv(o->input, o->buf + o->buf_used, o->buf_size - o->buf_used);
-    }
+    process(o);
 }
 
 int LineBuffer_Init (LineBuffer *o, StreamRecvInterface *input, PacketPassInterface *output, int buf_size, uint8_t nl_char)
@@ -113,6 +121,8 @@ int LineBuffer_Init (LineBuffer *o, StreamRecvInterface *input, PacketPassInterf
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
     
     // set buffer empty
+    o->buf_start = 0;
+    o->buf_scanned = 0;
     o->buf_used = 0;
     
     // allocate buffer
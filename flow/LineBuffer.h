@@ -42,6 +42,8 @@ typedef struct {
     PacketPassInterface *output;
     int buf_size;
     uint8_t nl_char;
+    int buf_start;
+    int buf_scanned;
     int buf_used;
     uint8_t *buf;
     int buf_consumed;
@@ -0,0 +1,215 @@
+/**
+ * @file PacketBuf.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Descriptor of a packet inside a buffer with room around it, allowing headers
+ * to be added in front of and removed from the packet without moving it.
+ */
+
+#ifndef BADVPN_FLOW_PACKETBUF_H
+#define BADVPN_FLOW_PACKETBUF_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+
+/**
+ * Descriptor of a packet inside a buffer with room around it.
+ * 
+ * The packet occupies len bytes starting at offset start in a buffer of size
+ * bytes; the space before it is the headroom and the space after it is the
+ * tailroom. A stage which was given a buffer with enough headroom for its
+ * header can {@link PacketBuf_Push} the header in front of the packet instead
+ * of copying the packet behind the header, and a stage parsing a packet can
+ * {@link PacketBuf_Pull} its header off the front.
+ * 
+ * This is only a view of memory owned by someone else; it is not freed.
+ */
+typedef struct {
+    uint8_t *mem;
+    int size;
+    int start;
+    int len;
+} PacketBuf;
+
+/**
+ * Initializes the descriptor for an empty packet.
+ * 
+ * @param o the descriptor
+ * @param mem the buffer
+ * @param size size of the buffer. Must be >=0.
+ * @param headroom space to leave in front of the packet. Must be >=0 and <=size.
+ */
+static void PacketBuf_Init (PacketBuf *o, uint8_t *mem, int size, int headroom);
+
+/**
+ * Returns the start of the packet.
+ * 
+ * @param o the descriptor
+ * @return start of the packet
+ */
+static uint8_t * PacketBuf_Data (PacketBuf *o);
+
+/**
+ * Returns the length of the packet.
+ * 
+ * @param o the descriptor
+ * @return length of the packet
+ */
+static int PacketBuf_Len (PacketBuf *o);
+
+/**
+ * Returns the space available in front of the packet.
+ * 
+ * @param o the descriptor
+ * @return headroom
+ */
+static int PacketBuf_Headroom (PacketBuf *o);
+
+/**
+ * Returns the space available after the packet.
+ * 
+ * @param o the descriptor
+ * @return tailroom
+ */
+static int PacketBuf_Tailroom (PacketBuf *o);
+
+/**
+ * Extends the packet at the front, e.g. to add a header.
+ * 
+ * @param o the descriptor
+ * @param len number of bytes. Must be >=0 and <= headroom.
+ * @return the new start of the packet, where the added bytes are
+ */
+static uint8_t * PacketBuf_Push (PacketBuf *o, int len);
+
+/**
+ * Removes bytes from the front of the packet, e.g. a parsed header.
+ * 
+ * @param o the descriptor
+ * @param len number of bytes. Must be >=0 and <= packet length.
+ * @return the removed bytes, i.e. the old start of the packet
+ */
+static uint8_t * PacketBuf_Pull (PacketBuf *o, int len);
+
+/**
+ * Extends the packet at the end, e.g. after data was written there
+ * or to add a trailer.
+ * 
+ * @param o the descriptor
+ * @param len number of bytes. Must be >=0 and <= tailroom.
+ * @return where the added bytes are
+ */
+static uint8_t * PacketBuf_Put (PacketBuf *o, int len);
+
+/**
+ * Shortens the packet by removing bytes from its end.
+ * 
+ * @param o the descriptor
+ * @param len new length. Must be >=0 and <= packet length.
+ */
+static void PacketBuf_Trim (PacketBuf *o, int len);
+
+void PacketBuf_Init (PacketBuf *o, uint8_t *mem, int size, int headroom)
+{
+    ASSERT(size >= 0)
+    ASSERT(headroom >= 0)
+    ASSERT(headroom <= size)
+    
+    o->mem = mem;
+    o->size = size;
+    o->start = headroom;
+    o->len = 0;
+}
+
+uint8_t * PacketBuf_Data (PacketBuf *o)
+{
+    return o->mem + o->start;
+}
+
+int PacketBuf_Len (PacketBuf *o)
+{
+    return o->len;
+}
+
+int PacketBuf_Headroom (PacketBuf *o)
+{
+    return o->start;
+}
+
+int PacketBuf_Tailroom (PacketBuf *o)
+{
+    return o->size - o->start - o->len;
+}
+
+uint8_t * PacketBuf_Push (PacketBuf *o, int len)
+{
+    ASSERT(len >= 0)
+    ASSERT(len <= PacketBuf_Headroom(o))
+    
+    o->start -= len;
+    o->len += len;
+    
+    return o->mem + o->start;
+}
+
+uint8_t * PacketBuf_Pull (PacketBuf *o, int len)
+{
+    ASSERT(len >= 0)
+    ASSERT(len <= o->len)
+    
+    uint8_t *old_start = o->mem + o->start;
+    
+    o->start += len;
+    o->len -= len;
+    
+    return old_start;
+}
+
+uint8_t * PacketBuf_Put (PacketBuf *o, int len)
+{
+    ASSERT(len >= 0)
+    ASSERT(len <= PacketBuf_Tailroom(o))
+    
+    uint8_t *added = o->mem + o->start + o->len;
+    
+    o->len += len;
+    
+    return added;
+}
+
+void PacketBuf_Trim (PacketBuf *o, int len)
+{
+    ASSERT(len >= 0)
+    ASSERT(len <= o->len)
+    
+    o->len = len;
+}
+
+#endif
@@ -30,12 +30,39 @@
 #include <stdlib.h>
 
 #include <misc/debug.h>
-#include <misc/balloc.h>
+#include <base/BBufferArena.h>
 
 #include <flow/PacketBuffer.h>
 
 static void input_handler_done (PacketBuffer *buf, int in_len);
 static void output_handler_done (PacketBuffer *buf);
+static void send_packets (PacketBuffer *buf);
+
+void send_packets (PacketBuffer *buf)
+{
+    ASSERT(buf->buf.output_avail >= 0)
+    
+    if (!buf->sendmany) {
+        buf->burst_num = 1;
+        PacketPassInterface_Sender_Send(buf->output, buf->buf.output_dest, buf->buf.output_avail);
+        return;
+    }
+    
+    // collect buffered packets, which stay in the buffer until done
+    int offset = 0;
+    buf->burst_num = 0;
+    while (buf->burst_num < PACKETBUFFER_MAX_BURST) {
+        struct PacketPassInterface_buf *b = &buf->burst[buf->burst_num];
+        if (!ChunkBuffer2_PeekPacket(&buf->buf, offset, &b->data, &b->len, &offset)) {
+            break;
+        }
+        buf->burst_num++;
+    }
+    
+    ASSERT(buf->burst_num > 0)
+    
+    PacketPassInterface_Sender_SendMany(buf->output, buf->burst, buf->burst_num);
+}
 
 void input_handler_done (PacketBuffer *buf, int in_len)
 {
@@ -56,7 +83,7 @@ void input_handler_done (PacketBuffer *buf, int in_len)
     
     // if buffer was empty, schedule send
     if (was_empty) {
-        PacketPassInterface_Sender_Send(buf->output, buf->buf.output_dest, buf->buf.output_avail);
+        send_packets(buf);
     }
 }
 
@@ -67,8 +94,12 @@ void output_handler_done (PacketBuffer *buf)
     // remember if buffer is full
     int was_full = (buf->buf.input_avail < buf->input_mtu);
     
-    // remove packet from buffer
-    ChunkBuffer2_ConsumePacket(&buf->buf);
+    ASSERT(buf->burst_num > 0)
+    
+    // remove packets from buffer
+    for (int i = 0; i < buf->burst_num; i++) {
+        ChunkBuffer2_ConsumePacket(&buf->buf);
+    }
     
     // if buffer was full and there is space, schedule receive
     if (was_full && buf->buf.input_avail >= buf->input_mtu) {
@@ -77,7 +108,7 @@ void output_handler_done (PacketBuffer *buf)
     
     // if there is more data, schedule send
     if (buf->buf.output_avail >= 0) {
-        PacketPassInterface_Sender_Send(buf->output, buf->buf.output_dest, buf->buf.output_avail);
+        send_packets(buf);
     }
 }
 
@@ -98,13 +129,17 @@ int PacketBuffer_Init (PacketBuffer *buf, PacketRecvInterface *input, PacketPass
     
     // init output
     PacketPassInterface_Sender_Init(buf->output, (PacketPassInterface_handler_done)output_handler_done, buf);
+    PacketPassInterface_Sender_EnableDirect(buf->output);
+    
+    // pass bursts if the output can take them
+    buf->sendmany = PacketPassInterface_HasSendMany(buf->output);
     
     // allocate buffer
     int num_blocks = ChunkBuffer2_calc_blocks(buf->input_mtu, num_packets);
     if (num_blocks < 0) {
         goto fail0;
     }
-    if (!(buf->buf_data = (struct ChunkBuffer2_block *)BAllocArray(num_blocks, sizeof(buf->buf_data[0])))) {
+    if (!(buf->buf_data = (struct ChunkBuffer2_block *)BBufferArena_AllocArray(num_blocks, sizeof(buf->buf_data[0])))) {
         goto fail0;
     }
     
@@ -127,5 +162,5 @@ void PacketBuffer_Free (PacketBuffer *buf)
     DebugObject_Free(&buf->d_obj);
     
     // free buffer
-    BFree(buf->buf_data);
+    BBufferArena_Free(buf->buf_data);
 }
@@ -29,6 +29,8 @@
  * @section DESCRIPTION
  * 
  * Packet buffer with {@link PacketRecvInterface} input and {@link PacketPassInterface} output.
+ * If the output accepts bursts ({@link PacketPassInterface_HasSendMany}), packets
+ * which accumulate while the output is busy are passed on together.
  */
 
 #ifndef BADVPN_FLOW_PACKETBUFFER_H
@@ -42,6 +44,8 @@
 #include <flow/PacketRecvInterface.h>
 #include <flow/PacketPassInterface.h>
 
+#define PACKETBUFFER_MAX_BURST 32
+
 /**
  * Packet buffer with {@link PacketRecvInterface} input and {@link PacketPassInterface} output.
  */
@@ -52,6 +56,9 @@ typedef struct {
     PacketPassInterface *output;
     struct ChunkBuffer2_block *buf_data;
     ChunkBuffer2 buf;
+    int sendmany;
+    int burst_num;
+    struct PacketPassInterface_buf burst[PACKETBUFFER_MAX_BURST];
 } PacketBuffer;
 
 /**
@@ -42,6 +42,7 @@ static void input_handler_send (PacketCopier *o, uint8_t *data, int data_len)
     if (!o->out_have) {
         o->in_len = data_len;
         o->in = data;
+        o->in_num_bufs = 0;
         return;
     }
     
@@ -56,6 +57,36 @@ static void input_handler_send (PacketCopier *o, uint8_t *data, int data_len)
     o->out_have = 0;
 }
 
+static void input_handler_sendv (PacketCopier *o, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    ASSERT(o->in_len == -1)
+    DebugObject_Access(&o->d_obj);
+    
+    int data_len = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        data_len += bufs[i].len;
+    }
+    
+    if (!o->out_have) {
+        for (int i = 0; i < num_bufs; i++) {
+            o->in_bufs[i] = bufs[i];
+        }
+        o->in_len = data_len;
+        o->in_num_bufs = num_bufs;
+        return;
+    }
+    
+    PacketPassInterface_CopyBufs(bufs, num_bufs, 0, o->out, data_len);
+    
+    // finish input packet
+    PacketPassInterface_Done(&o->input);
+    
+    // finish output packet
+    PacketRecvInterface_Done(&o->output, data_len);
+    
+    o->out_have = 0;
+}
+
 static void input_handler_requestcancel (PacketCopier *o)
 {
     ASSERT(o->in_len >= 0)
@@ -79,7 +110,11 @@ static void output_handler_recv (PacketCopier *o, uint8_t *data)
         return;
     }
     
-    memcpy(data, o->in, o->in_len);
+    if (o->in_num_bufs > 0) {
+        PacketPassInterface_CopyBufs(o->in_bufs, o->in_num_bufs, 0, data, o->in_len);
+    } else {
+        memcpy(data, o->in, o->in_len);
+    }
     
     // finish input packet
     PacketPassInterface_Done(&o->input);
@@ -97,6 +132,7 @@ void PacketCopier_Init (PacketCopier *o, int mtu, BPendingGroup *pg)
     // init input
     PacketPassInterface_Init(&o->input, mtu, (PacketPassInterface_handler_send)input_handler_send, o, pg);
     PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+    PacketPassInterface_EnableSendV(&o->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
     
     // init output
     PacketRecvInterface_Init(&o->output, mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, pg);
@@ -50,6 +50,8 @@ typedef struct {
     PacketRecvInterface output;
     int in_len;
     uint8_t *in;
+    struct PacketPassInterface_buf in_bufs[PPI_MAX_BUFS];
+    int in_num_bufs;
     int out_have;
     uint8_t *out;
 } PacketCopier;
@@ -73,7 +75,7 @@ void PacketCopier_Free (PacketCopier *o);
 /**
  * Returns the input interface.
  * The MTU of the interface will as in {@link PacketCopier_Init}.
- * The interface will support cancel functionality.
+ * The interface will support cancel functionality and vectored sends.
  * 
  * @return input interface
  */
@@ -43,6 +43,8 @@ static void input_handler_send (PacketPassConnector *o, uint8_t *data, int data_
     // remember input packet
     o->in_len = data_len;
     o->in = data;
+    o->in_num_bufs = 0;
+    o->cancel_requested = 0;
     
     if (o->output) {
         // schedule send
@@ -50,6 +52,62 @@ static void input_handler_send (PacketPassConnector *o, uint8_t *data, int data_
     }
 }
 
+static void input_handler_sendv (PacketPassConnector *o, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    ASSERT(o->sendv)
+    ASSERT(o->in_len == -1)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember input packet
+    int total = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        o->in_bufs[i] = bufs[i];
+        total += bufs[i].len;
+    }
+    o->in_len = total;
+    o->in_num_bufs = num_bufs;
+    o->cancel_requested = 0;
+    
+    if (o->output) {
+        // schedule send
+        PacketPassInterface_Sender_SendV(o->output, o->in_bufs, o->in_num_bufs);
+    }
+}
+
+static void input_handler_requestcancel (PacketPassConnector *o)
+{
+    ASSERT(o->cancel)
+    ASSERT(o->in_len >= 0)
+    ASSERT(!o->cancel_requested)
+    DebugObject_Access(&o->d_obj);
+    
+    o->cancel_requested = 1;
+    
+    // with no output, drop the packet now
+    if (!o->output) {
+        o->in_len = -1;
+        PacketPassInterface_Done(&o->input);
+        return;
+    }
+    
+    // let the output drop it if it can
+    if (PacketPassInterface_HasCancel(o->output)) {
+        PacketPassInterface_Sender_RequestCancel(o->output);
+    }
+}
+
+static void send_input_packet (PacketPassConnector *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(o->output)
+    
+    if (o->in_num_bufs > 0) {
+        PacketPassInterface_Sender_SendV(o->output, o->in_bufs, o->in_num_bufs);
+    } else {
+        PacketPassInterface_Sender_Send(o->output, o->in, o->in_len);
+    }
+}
+
 static void output_handler_done (PacketPassConnector *o)
 {
     ASSERT(o->in_len >= 0)
@@ -76,6 +134,12 @@ void PacketPassConnector_Init (PacketPassConnector *o, int mtu, BPendingGroup *p
     // have no input packet
     o->in_len = -1;
     
+    // don't accept vectored sends
+    o->sendv = 0;
+    
+    // don't support cancel
+    o->cancel = 0;
+    
     // have no output
     o->output = NULL;
     
@@ -97,10 +161,33 @@ PacketPassInterface * PacketPassConnector_GetInput (PacketPassConnector *o)
     return &o->input;
 }
 
+void PacketPassConnector_EnableSendV (PacketPassConnector *o)
+{
+    ASSERT(!o->sendv)
+    ASSERT(!o->output)
+    DebugObject_Access(&o->d_obj);
+    
+    PacketPassInterface_EnableSendV(&o->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
+    
+    o->sendv = 1;
+}
+
+void PacketPassConnector_EnableCancel (PacketPassConnector *o)
+{
+    ASSERT(!o->cancel)
+    ASSERT(!o->output)
+    DebugObject_Access(&o->d_obj);
+    
+    PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+    
+    o->cancel = 1;
+}
+
 void PacketPassConnector_ConnectOutput (PacketPassConnector *o, PacketPassInterface *output)
 {
     ASSERT(!o->output)
     ASSERT(PacketPassInterface_GetMTU(output) >= o->input_mtu)
+    ASSERT(!o->sendv || PacketPassInterface_HasSendV(output))
     DebugObject_Access(&o->d_obj);
     
     // set output
@@ -111,7 +198,7 @@ void PacketPassConnector_ConnectOutput (PacketPassConnector *o, PacketPassInterf
     
     // if we have an input packet, schedule send
     if (o->in_len >= 0) {
-        PacketPassInterface_Sender_Send(o->output, o->in, o->in_len);
+        send_input_packet(o);
     }
 }
 
@@ -122,4 +209,10 @@ void PacketPassConnector_DisconnectOutput (PacketPassConnector *o)
     
     // set no output
     o->output = NULL;
+    
+    // drop the packet instead of sending it to the next output
+    if (o->in_len >= 0 && o->cancel_requested) {
+        o->in_len = -1;
+        PacketPassInterface_Done(&o->input);
+    }
 }
@@ -49,6 +49,11 @@ typedef struct {
     int input_mtu;
     int in_len;
     uint8_t *in;
+    struct PacketPassInterface_buf in_bufs[PPI_MAX_BUFS];
+    int in_num_bufs;
+    int sendv;
+    int cancel;
+    int cancel_requested;
     PacketPassInterface *output;
     DebugObject d_obj;
 } PacketPassConnector;
@@ -79,6 +84,26 @@ void PacketPassConnector_Free (PacketPassConnector *o);
  */
 PacketPassInterface * PacketPassConnector_GetInput (PacketPassConnector *o);
 
+/**
+ * Makes the input accept vectored sends.
+ * Must be called before the input's sender is initialized.
+ * After this, only outputs supporting vectored sends can be connected.
+ *
+ * @param o the object
+ */
+void PacketPassConnector_EnableSendV (PacketPassConnector *o);
+
+/**
+ * Makes the input support cancel functionality.
+ * Must be called before the input's sender is initialized.
+ * A cancel is passed on to the output if it supports it. A packet whose cancel
+ * was requested is finished right away if there is no output, or when the
+ * output is disconnected, instead of being sent to the next output.
+ *
+ * @param o the object
+ */
+void PacketPassConnector_EnableCancel (PacketPassConnector *o);
+
 /**
  * Connects output.
  * The object must be in not connected state.
@@ -86,7 +111,8 @@ PacketPassInterface * PacketPassConnector_GetInput (PacketPassConnector *o);
  *
  * @param o the object
  * @param output output to connect. Its MTU must be >= MTU specified in
- *               {@link PacketPassConnector_Init}.
+ *               {@link PacketPassConnector_Init}. If {@link PacketPassConnector_EnableSendV}
+ *               was called, it must support vectored sends.
  */
 void PacketPassConnector_ConnectOutput (PacketPassConnector *o, PacketPassInterface *output);
 
@@ -33,6 +33,8 @@
 #include <misc/offset.h>
 #include <misc/minmax.h>
 #include <misc/compare.h>
+#include <misc/probe.h>
+#include <base/BMetrics.h>
 
 #include <flow/PacketPassFairQueue.h>
 
@@ -115,23 +117,59 @@ static void increment_sent_flow (PacketPassFairQueueFlow *flow, uint64_t amount)
     flow->time += amount;
 }
 
+static PacketPassFairQueueFlow * drr_take_turn (PacketPassFairQueue *m)
+{
+    ASSERT(m->mode == FAIRQUEUE_MODE_DRR)
+    ASSERT(!LinkedList1_IsEmpty(&m->queued_list))
+    
+    while (1) {
+        PacketPassFairQueueFlow *flow = UPPER_OBJECT(LinkedList1_GetFirst(&m->queued_list), PacketPassFairQueueFlow, queued.list_node);
+        ASSERT(flow->is_queued)
+        ASSERT(flow->deficit >= 0)
+        
+        // send if the flow has enough credit left in its turn
+        int64_t cost = (int64_t)m->packet_weight + flow->queued.data_len;
+        if (flow->deficit >= cost) {
+            flow->deficit -= cost;
+            return flow;
+        }
+        
+        // turn is over, give it credit for the next one, which is at least
+        // one packet, so this loop ends by the time it comes around
+        flow->deficit += m->quantum * flow->weight;
+        LinkedList1_Remove(&m->queued_list, &flow->queued.list_node);
+        LinkedList1_Append(&m->queued_list, &flow->queued.list_node);
+    }
+}
+
 static void schedule (PacketPassFairQueue *m)
 {
     ASSERT(!m->sending_flow)
     ASSERT(!m->previous_flow)
     ASSERT(!m->freeing)
-    ASSERT(!PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree))
+    ASSERT(m->num_queued > 0)
     
-    // get first queued flow
-    PacketPassFairQueueFlow *qflow = PacketPassFairQueue__Tree_GetFirst(&m->queued_tree, 0);
+    // get next flow and remove it from queue
+    PacketPassFairQueueFlow *qflow;
+    if (m->mode == FAIRQUEUE_MODE_DRR) {
+        qflow = drr_take_turn(m);
+        LinkedList1_Remove(&m->queued_list, &qflow->queued.list_node);
+    } else {
+        qflow = PacketPassFairQueue__Tree_GetFirst(&m->queued_tree, 0);
+        PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, qflow);
+    }
     ASSERT(qflow->is_queued)
-    
-    // remove flow from queue
-    PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, qflow);
+    BMetrics_Observe(BMETRICS_HISTOGRAM_FAIRQUEUE_DEPTH, m->num_queued);
+    BPROBE3(fairqueue_schedule, m, qflow, m->num_queued);
     qflow->is_queued = 0;
+    m->num_queued--;
     
     // schedule send
-    PacketPassInterface_Sender_Send(m->output, qflow->queued.data, qflow->queued.data_len);
+    if (qflow->queued.num_bufs > 0) {
+        PacketPassInterface_Sender_SendV(m->output, qflow->queued.bufs, qflow->queued.num_bufs);
+    } else {
+        PacketPassInterface_Sender_Send(m->output, qflow->queued.data, qflow->queued.data_len);
+    }
     m->sending_flow = qflow;
     m->sending_len = qflow->queued.data_len;
 }
@@ -145,40 +183,79 @@ static void schedule_job_handler (PacketPassFairQueue *m)
     // remove previous flow
     m->previous_flow = NULL;
     
-    if (!PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree)) {
+    if (m->num_queued > 0) {
         schedule(m);
     }
 }
 
-static void input_handler_send (PacketPassFairQueueFlow *flow, uint8_t *data, int data_len)
+static void queue_flow (PacketPassFairQueueFlow *flow)
 {
     PacketPassFairQueue *m = flow->m;
     
     ASSERT(flow != m->sending_flow)
     ASSERT(!flow->is_queued)
     ASSERT(!m->freeing)
-    DebugObject_Access(&flow->d_obj);
     
-    if (flow == m->previous_flow) {
-        // remove from previous flow
-        m->previous_flow = NULL;
+    if (m->mode == FAIRQUEUE_MODE_DRR) {
+        if (flow == m->previous_flow) {
+            // remove from previous flow, and continue its turn
+            m->previous_flow = NULL;
+            LinkedList1_Prepend(&m->queued_list, &flow->queued.list_node);
+        } else {
+            // the flow was idle, start it with credit for a turn at the end
+            flow->deficit = m->quantum * flow->weight;
+            LinkedList1_Append(&m->queued_list, &flow->queued.list_node);
+        }
     } else {
-        // raise time
-        flow->time = bmax_uint64(flow->time, get_current_time(m));
+        if (flow == m->previous_flow) {
+            // remove from previous flow
+            m->previous_flow = NULL;
+        } else {
+            // raise time
+            flow->time = bmax_uint64(flow->time, get_current_time(m));
+        }
+        
+        // queue flow
+        int res = PacketPassFairQueue__Tree_Insert(&m->queued_tree, 0, flow, NULL);
+        ASSERT_EXECUTE(res)
     }
-    
-    // queue flow
-    flow->queued.data = data;
-    flow->queued.data_len = data_len;
-    int res = PacketPassFairQueue__Tree_Insert(&m->queued_tree, 0, flow, NULL);
-    ASSERT_EXECUTE(res)
     flow->is_queued = 1;
+    m->num_queued++;
     
     if (!m->sending_flow && !BPending_IsSet(&m->schedule_job)) {
         schedule(m);
     }
 }
 
+static void input_handler_send (PacketPassFairQueueFlow *flow, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&flow->d_obj);
+    
+    // remember packet
+    flow->queued.data = data;
+    flow->queued.data_len = data_len;
+    flow->queued.num_bufs = 0;
+    
+    queue_flow(flow);
+}
+
+static void input_handler_sendv (PacketPassFairQueueFlow *flow, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    DebugObject_Access(&flow->d_obj);
+    
+    // remember packet
+    int total = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        flow->queued.bufs[i] = bufs[i];
+        total += bufs[i].len;
+    }
+    flow->queued.data = NULL;
+    flow->queued.data_len = total;
+    flow->queued.num_bufs = num_bufs;
+    
+    queue_flow(flow);
+}
+
 static void output_handler_done (PacketPassFairQueue *m)
 {
     ASSERT(m->sending_flow)
@@ -195,8 +272,10 @@ static void output_handler_done (PacketPassFairQueue *m)
     // remember this flow so the schedule job can remove its time if it didn's send
     m->previous_flow = flow;
     
-    // update flow time by packet size
-    increment_sent_flow(flow, (uint64_t)m->packet_weight + m->sending_len);
+    // update flow time by packet size, less for flows with a higher weight
+    if (m->mode == FAIRQUEUE_MODE_TIME) {
+        increment_sent_flow(flow, ((uint64_t)m->packet_weight + m->sending_len) * FAIRQUEUE_MAX_WEIGHT / flow->weight);
+    }
     
     // schedule schedule
     BPending_Set(&m->schedule_job);
@@ -217,21 +296,31 @@ static void output_handler_done (PacketPassFairQueue *m)
 }
 
 int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight)
+{
+    return PacketPassFairQueue_Init2(m, output, pg, use_cancel, packet_weight, FAIRQUEUE_MODE_TIME);
+}
+
+int PacketPassFairQueue_Init2 (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight, int mode)
 {
     ASSERT(packet_weight > 0)
     ASSERT(use_cancel == 0 || use_cancel == 1)
     ASSERT(!use_cancel || PacketPassInterface_HasCancel(output))
+    ASSERT(mode == FAIRQUEUE_MODE_TIME || mode == FAIRQUEUE_MODE_DRR)
     
     // init arguments
     m->output = output;
     m->pg = pg;
     m->use_cancel = use_cancel;
     m->packet_weight = packet_weight;
+    m->mode = mode;
     
-    // make sure that (output MTU + packet_weight <= FAIRQUEUE_MAX_TIME)
+    // a turn of a flow with weight 1 is enough for any packet
+    m->quantum = (int64_t)PacketPassInterface_GetMTU(output) + packet_weight;
+    
+    // make sure that ((output MTU + packet_weight) * FAIRQUEUE_MAX_WEIGHT <= FAIRQUEUE_MAX_TIME)
     if (!(
-        (PacketPassInterface_GetMTU(output) <= FAIRQUEUE_MAX_TIME) &&
-        (packet_weight <= FAIRQUEUE_MAX_TIME - PacketPassInterface_GetMTU(output))
+        (PacketPassInterface_GetMTU(output) <= FAIRQUEUE_MAX_TIME / FAIRQUEUE_MAX_WEIGHT) &&
+        (packet_weight <= FAIRQUEUE_MAX_TIME / FAIRQUEUE_MAX_WEIGHT - PacketPassInterface_GetMTU(output))
     )) {
         goto fail0;
     }
@@ -245,8 +334,10 @@ int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *outpu
     // no previous flow
     m->previous_flow = NULL;
     
-    // init queued tree
+    // init queued tree and list
     PacketPassFairQueue__Tree_Init(&m->queued_tree);
+    LinkedList1_Init(&m->queued_list);
+    m->num_queued = 0;
     
     // init flows list
     LinkedList1_Init(&m->flows_list);
@@ -269,6 +360,7 @@ void PacketPassFairQueue_Free (PacketPassFairQueue *m)
 {
     ASSERT(LinkedList1_IsEmpty(&m->flows_list))
     ASSERT(PacketPassFairQueue__Tree_IsEmpty(&m->queued_tree))
+    ASSERT(LinkedList1_IsEmpty(&m->queued_list))
     ASSERT(!m->previous_flow)
     ASSERT(!m->sending_flow)
     DebugCounter_Free(&m->d_ctr);
@@ -293,6 +385,13 @@ int PacketPassFairQueue_GetMTU (PacketPassFairQueue *m)
     return PacketPassInterface_GetMTU(m->output);
 }
 
+int PacketPassFairQueue_GetNumQueued (PacketPassFairQueue *m)
+{
+    DebugObject_Access(&m->d_obj);
+    
+    return m->num_queued;
+}
+
 void PacketPassFairQueueFlow_Init (PacketPassFairQueueFlow *flow, PacketPassFairQueue *m)
 {
     ASSERT(!m->freeing)
@@ -306,9 +405,16 @@ void PacketPassFairQueueFlow_Init (PacketPassFairQueueFlow *flow, PacketPassFair
     
     // init input
     PacketPassInterface_Init(&flow->input, PacketPassInterface_GetMTU(flow->m->output), (PacketPassInterface_handler_send)input_handler_send, flow, m->pg);
+    if (PacketPassInterface_HasSendV(flow->m->output)) {
+        PacketPassInterface_EnableSendV(&flow->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
+    }
     
-    // set time
+    // set time and credit
     flow->time = 0;
+    flow->deficit = 0;
+    
+    // set weight
+    flow->weight = 1;
     
     // add to flows list
     LinkedList1_Append(&m->flows_list, &flow->list_node);
@@ -340,7 +446,12 @@ void PacketPassFairQueueFlow_Free (PacketPassFairQueueFlow *flow)
     
     // remove from queue
     if (flow->is_queued) {
-        PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, flow);
+        if (m->mode == FAIRQUEUE_MODE_DRR) {
+            LinkedList1_Remove(&m->queued_list, &flow->queued.list_node);
+        } else {
+            PacketPassFairQueue__Tree_Remove(&m->queued_tree, 0, flow);
+        }
+        m->num_queued--;
     }
     
     // remove from flows list
@@ -397,6 +508,15 @@ void PacketPassFairQueueFlow_SetBusyHandler (PacketPassFairQueueFlow *flow, Pack
     flow->user = user;
 }
 
+void PacketPassFairQueueFlow_SetWeight (PacketPassFairQueueFlow *flow, int weight)
+{
+    ASSERT(weight >= 1)
+    ASSERT(weight <= FAIRQUEUE_MAX_WEIGHT)
+    DebugObject_Access(&flow->d_obj);
+    
+    flow->weight = weight;
+}
+
 PacketPassInterface * PacketPassFairQueueFlow_GetInput (PacketPassFairQueueFlow *flow)
 {
     DebugObject_Access(&flow->d_obj);
@@ -47,6 +47,13 @@
 // reduce this to test time overflow handling
 #define FAIRQUEUE_MAX_TIME UINT64_MAX
 
+// maximum weight of a flow
+#define FAIRQUEUE_MAX_WEIGHT 1000
+
+// scheduling modes
+#define FAIRQUEUE_MODE_TIME 0
+#define FAIRQUEUE_MODE_DRR 1
+
 typedef void (*PacketPassFairQueue_handler_busy) (void *user);
 
 struct PacketPassFairQueueFlow_s;
@@ -55,18 +62,31 @@ struct PacketPassFairQueueFlow_s;
 #include <structure/SAvl_decl.h>
 
 typedef struct PacketPassFairQueueFlow_s {
-    struct PacketPassFairQueue_s *m;
-    PacketPassFairQueue_handler_busy handler_busy;
-    void *user;
-    PacketPassInterface input;
+    // Scheduling state comes first. While choosing the next flow the queue
+    // touches these fields of many flows other than the one it sends, so
+    // they are kept within a cache line's worth of bytes; the queue node is
+    // either in the tree or in the round robin list, depending on the mode.
     uint64_t time;
-    LinkedList1Node list_node;
+    int64_t deficit;
+    int weight;
     int is_queued;
     struct {
-        PacketPassFairQueue__TreeNode tree_node;
-        uint8_t *data;
         int data_len;
+        int num_bufs;
+        union {
+            PacketPassFairQueue__TreeNode tree_node;
+            LinkedList1Node list_node;
+        };
+        uint8_t *data;
+        struct PacketPassInterface_buf bufs[PPI_MAX_BUFS];
     } queued;
+    // The rest is only used by the flow's own sender, and when flows are
+    // added or removed.
+    struct PacketPassFairQueue_s *m;
+    PacketPassInterface input;
+    LinkedList1Node list_node;
+    PacketPassFairQueue_handler_busy handler_busy;
+    void *user;
     DebugObject d_obj;
 } PacketPassFairQueueFlow;
 
@@ -78,10 +98,14 @@ typedef struct PacketPassFairQueue_s {
     BPendingGroup *pg;
     int use_cancel;
     int packet_weight;
+    int mode;
+    int64_t quantum;
     struct PacketPassFairQueueFlow_s *sending_flow;
     int sending_len;
     struct PacketPassFairQueueFlow_s *previous_flow;
     PacketPassFairQueue__Tree queued_tree;
+    LinkedList1 queued_list;
+    int num_queued;
     LinkedList1 flows_list;
     int freeing;
     BPending schedule_job;
@@ -93,7 +117,8 @@ typedef struct PacketPassFairQueue_s {
  * Initializes the queue.
  *
  * @param m the object
- * @param output output interface
+ * @param output output interface. If it supports vectored sends, so will the
+ *               inputs of the flows.
  * @param pg pending group
  * @param use_cancel whether cancel functionality is required. Must be 0 or 1.
  *                   If 1, output must support cancel functionality.
@@ -103,6 +128,19 @@ typedef struct PacketPassFairQueue_s {
  */
 int PacketPassFairQueue_Init (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight) WARN_UNUSED;
 
+/**
+ * Initializes the queue, with a choice of scheduling.
+ * In FAIRQUEUE_MODE_TIME, flows are ordered by the virtual time of their
+ * sent data, costing O(log n) per packet in the number of queued flows.
+ * In FAIRQUEUE_MODE_DRR, flows take turns in a deficit round robin, costing
+ * O(1) per packet; each turn a flow may send about an MTU of data per unit
+ * of weight, so sharing is coarser over short periods.
+ * Otherwise the same as {@link PacketPassFairQueue_Init}.
+ *
+ * @param mode FAIRQUEUE_MODE_TIME or FAIRQUEUE_MODE_DRR
+ */
+int PacketPassFairQueue_Init2 (PacketPassFairQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int packet_weight, int mode) WARN_UNUSED;
+
 /**
  * Frees the queue.
  * All flows must have been freed.
@@ -130,6 +168,15 @@ void PacketPassFairQueue_PrepareFree (PacketPassFairQueue *m);
  */
 int PacketPassFairQueue_GetMTU (PacketPassFairQueue *m);
 
+/**
+ * Returns the number of flows waiting to have their packet sent
+ * to the output. The flow currently being sent is not counted.
+ *
+ * @param m the object
+ * @return number of queued flows
+ */
+int PacketPassFairQueue_GetNumQueued (PacketPassFairQueue *m);
+
 /**
  * Initializes a queue flow.
  * Queue must not be in freeing state.
@@ -193,6 +240,16 @@ void PacketPassFairQueueFlow_RequestCancel (PacketPassFairQueueFlow *flow);
  */
 void PacketPassFairQueueFlow_SetBusyHandler (PacketPassFairQueueFlow *flow, PacketPassFairQueue_handler_busy handler, void *user);
 
+/**
+ * Sets the weight of the flow.
+ * When flows are competing, each gets a share of the output proportional to
+ * its weight. Flows start with a weight of 1.
+ *
+ * @param flow the object
+ * @param weight new weight. Must be >=1 and <=FAIRQUEUE_MAX_WEIGHT.
+ */
+void PacketPassFairQueueFlow_SetWeight (PacketPassFairQueueFlow *flow, int weight);
+
 /**
  * Returns the input interface of the flow.
  *
@@ -38,6 +38,14 @@ void _PacketPassInterface_job_operation (PacketPassInterface *i)
     i->state = PPI_STATE_BUSY;
     
     // call handler
+    if (i->job_operation_num_bufs > 0) {
+        i->handler_operation_v(i->user_provider, i->job_operation_bufs, i->job_operation_num_bufs);
+        return;
+    }
+    if (i->job_operation_num_packets > 0) {
+        i->handler_operation_many(i->user_provider, i->job_operation_packets, i->job_operation_num_packets);
+        return;
+    }
     i->handler_operation(i->user_provider, i->job_operation_data, i->job_operation_len);
     return;
 }
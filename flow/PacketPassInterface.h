@@ -29,6 +29,29 @@
  * @section DESCRIPTION
  * 
  * Interface allowing a packet sender to pass data packets to a packet receiver.
+ * 
+ * A receiver may additionally accept vectored sends, enabled with
+ * {@link PacketPassInterface_EnableSendV} before the sender is initialized.
+ * A sender can then check {@link PacketPassInterface_HasSendV} and pass a packet
+ * as up to PPI_MAX_BUFS buffers, which the receiver treats as one packet made of
+ * their concatenation. This allows e.g. a shared payload to be sent with a
+ * per-destination header in front of it without copying the payload.
+ * 
+ * A receiver may also accept bursts of packets, enabled with
+ * {@link PacketPassInterface_EnableSendMany}. A sender which sees
+ * {@link PacketPassInterface_HasSendMany} may then pass any number of packets
+ * in one {@link PacketPassInterface_Sender_SendMany} operation, completed with a
+ * single Done, saving the job round trips of sending them one by one.
+ * 
+ * Normally Send and Done only schedule a job which calls the other side's
+ * handler. If the receiver enables direct calls with
+ * {@link PacketPassInterface_EnableDirect} and the sender with
+ * {@link PacketPassInterface_Sender_EnableDirect}, the handler is called from
+ * within Send or Done instead, unless this happens within another direct call
+ * on the same interface, which falls back to the job and bounds recursion.
+ * A side may only enable direct calls if it calls Send or Done only as the
+ * last thing it does in a handler or job, and its handlers do not free
+ * anything or call out to code which might.
  */
 
 #ifndef BADVPN_FLOW_PACKETPASSINTERFACE_H
@@ -36,6 +59,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
 #include <misc/debug.h>
 #include <base/DebugObject.h>
@@ -46,8 +70,22 @@
 #define PPI_STATE_BUSY 3
 #define PPI_STATE_DONE_PENDING 4
 
+#define PPI_MAX_BUFS 3
+
+/**
+ * One buffer of a vectored send; see {@link PacketPassInterface_Sender_SendV}.
+ */
+struct PacketPassInterface_buf {
+    uint8_t *data;
+    int len;
+};
+
 typedef void (*PacketPassInterface_handler_send) (void *user, uint8_t *data, int data_len);
 
+typedef void (*PacketPassInterface_handler_sendv) (void *user, const struct PacketPassInterface_buf *bufs, int num_bufs);
+
+typedef void (*PacketPassInterface_handler_sendmany) (void *user, const struct PacketPassInterface_buf *packets, int num_packets);
+
 typedef void (*PacketPassInterface_handler_requestcancel) (void *user);
 
 typedef void (*PacketPassInterface_handler_done) (void *user);
@@ -56,6 +94,8 @@ typedef struct {
     // provider data
     int mtu;
     PacketPassInterface_handler_send handler_operation;
+    PacketPassInterface_handler_sendv handler_operation_v;
+    PacketPassInterface_handler_sendmany handler_operation_many;
     PacketPassInterface_handler_requestcancel handler_requestcancel;
     void *user_provider;
     
@@ -67,6 +107,10 @@ typedef struct {
     BPending job_operation;
     uint8_t *job_operation_data;
     int job_operation_len;
+    struct PacketPassInterface_buf job_operation_bufs[PPI_MAX_BUFS];
+    int job_operation_num_bufs;
+    const struct PacketPassInterface_buf *job_operation_packets;
+    int job_operation_num_packets;
     
     // requestcancel job
     BPending job_requestcancel;
@@ -78,6 +122,11 @@ typedef struct {
     int state;
     int cancel_requested;
     
+    // direct calls
+    int direct_provider;
+    int direct_user;
+    int in_direct;
+    
     DebugObject d_obj;
 } PacketPassInterface;
 
@@ -87,22 +136,57 @@ static void PacketPassInterface_Free (PacketPassInterface *i);
 
 static void PacketPassInterface_EnableCancel (PacketPassInterface *i, PacketPassInterface_handler_requestcancel handler_requestcancel);
 
+static void PacketPassInterface_EnableSendV (PacketPassInterface *i, PacketPassInterface_handler_sendv handler_operation_v);
+
+static void PacketPassInterface_EnableSendMany (PacketPassInterface *i, PacketPassInterface_handler_sendmany handler_operation_many);
+
+static void PacketPassInterface_EnableDirect (PacketPassInterface *i);
+
 static void PacketPassInterface_Done (PacketPassInterface *i);
 
 static int PacketPassInterface_GetMTU (PacketPassInterface *i);
 
 static void PacketPassInterface_Sender_Init (PacketPassInterface *i, PacketPassInterface_handler_done handler_done, void *user);
 
+static void PacketPassInterface_Sender_EnableDirect (PacketPassInterface *i);
+
 static void PacketPassInterface_Sender_Send (PacketPassInterface *i, uint8_t *data, int data_len);
 
+static void PacketPassInterface_Sender_SendV (PacketPassInterface *i, const struct PacketPassInterface_buf *bufs, int num_bufs);
+
+/**
+ * Sends a burst of packets as one operation. Unlike with SendV, the packets
+ * array is not copied and must stay valid, along with the packet data, until
+ * the operation is done.
+ */
+static void PacketPassInterface_Sender_SendMany (PacketPassInterface *i, const struct PacketPassInterface_buf *packets, int num_packets);
+
 static void PacketPassInterface_Sender_RequestCancel (PacketPassInterface *i);
 
 static int PacketPassInterface_HasCancel (PacketPassInterface *i);
 
+static int PacketPassInterface_HasSendV (PacketPassInterface *i);
+
+static int PacketPassInterface_HasSendMany (PacketPassInterface *i);
+
+static void PacketPassInterface_CopyBufs (const struct PacketPassInterface_buf *bufs, int num_bufs, int offset, uint8_t *out, int len);
+
 void _PacketPassInterface_job_operation (PacketPassInterface *i);
 void _PacketPassInterface_job_requestcancel (PacketPassInterface *i);
 void _PacketPassInterface_job_done (PacketPassInterface *i);
 
+static void _PacketPassInterface_schedule_operation (PacketPassInterface *i)
+{
+    if (i->direct_provider && i->direct_user && !i->in_direct) {
+        i->in_direct = 1;
+        _PacketPassInterface_job_operation(i);
+        i->in_direct = 0;
+        return;
+    }
+    
+    BPending_Set(&i->job_operation);
+}
+
 void PacketPassInterface_Init (PacketPassInterface *i, int mtu, PacketPassInterface_handler_send handler_operation, void *user, BPendingGroup *pg)
 {
     ASSERT(mtu >= 0)
@@ -110,6 +194,8 @@ void PacketPassInterface_Init (PacketPassInterface *i, int mtu, PacketPassInterf
     // init arguments
     i->mtu = mtu;
     i->handler_operation = handler_operation;
+    i->handler_operation_v = NULL;
+    i->handler_operation_many = NULL;
     i->handler_requestcancel = NULL;
     i->user_provider = user;
     
@@ -124,6 +210,11 @@ void PacketPassInterface_Init (PacketPassInterface *i, int mtu, PacketPassInterf
     // set state
     i->state = PPI_STATE_NONE;
     
+    // no direct calls
+    i->direct_provider = 0;
+    i->direct_user = 0;
+    i->in_direct = 0;
+    
     DebugObject_Init(&i->d_obj);
 }
 
@@ -146,6 +237,32 @@ void PacketPassInterface_EnableCancel (PacketPassInterface *i, PacketPassInterfa
     i->handler_requestcancel = handler_requestcancel;
 }
 
+void PacketPassInterface_EnableSendV (PacketPassInterface *i, PacketPassInterface_handler_sendv handler_operation_v)
+{
+    ASSERT(handler_operation_v)
+    ASSERT(!i->handler_operation_v)
+    ASSERT(!i->handler_done)
+    
+    i->handler_operation_v = handler_operation_v;
+}
+
+void PacketPassInterface_EnableSendMany (PacketPassInterface *i, PacketPassInterface_handler_sendmany handler_operation_many)
+{
+    ASSERT(handler_operation_many)
+    ASSERT(!i->handler_operation_many)
+    ASSERT(!i->handler_done)
+    
+    i->handler_operation_many = handler_operation_many;
+}
+
+void PacketPassInterface_EnableDirect (PacketPassInterface *i)
+{
+    ASSERT(!i->direct_provider)
+    ASSERT(!i->handler_done)
+    
+    i->direct_provider = 1;
+}
+
 void PacketPassInterface_Done (PacketPassInterface *i)
 {
     ASSERT(i->state == PPI_STATE_BUSY)
@@ -154,11 +271,19 @@ void PacketPassInterface_Done (PacketPassInterface *i)
     // unset requestcancel job
     BPending_Unset(&i->job_requestcancel);
     
-    // schedule done
-    BPending_Set(&i->job_done);
-    
     // set state
     i->state = PPI_STATE_DONE_PENDING;
+    
+    // call done handler directly if possible
+    if (i->direct_provider && i->direct_user && !i->in_direct) {
+        i->in_direct = 1;
+        _PacketPassInterface_job_done(i);
+        i->in_direct = 0;
+        return;
+    }
+    
+    // schedule done
+    BPending_Set(&i->job_done);
 }
 
 int PacketPassInterface_GetMTU (PacketPassInterface *i)
@@ -178,6 +303,16 @@ void PacketPassInterface_Sender_Init (PacketPassInterface *i, PacketPassInterfac
     i->user_user = user;
 }
 
+void PacketPassInterface_Sender_EnableDirect (PacketPassInterface *i)
+{
+    ASSERT(i->handler_done)
+    ASSERT(!i->direct_user)
+    ASSERT(i->state == PPI_STATE_NONE)
+    DebugObject_Access(&i->d_obj);
+    
+    i->direct_user = 1;
+}
+
 void PacketPassInterface_Sender_Send (PacketPassInterface *i, uint8_t *data, int data_len)
 {
     ASSERT(data_len >= 0)
@@ -187,14 +322,81 @@ void PacketPassInterface_Sender_Send (PacketPassInterface *i, uint8_t *data, int
     ASSERT(i->handler_done)
     DebugObject_Access(&i->d_obj);
     
-    // schedule operation
+    // remember operation
     i->job_operation_data = data;
     i->job_operation_len = data_len;
-    BPending_Set(&i->job_operation);
+    i->job_operation_num_bufs = 0;
+    i->job_operation_num_packets = 0;
     
     // set state
     i->state = PPI_STATE_OPERATION_PENDING;
     i->cancel_requested = 0;
+    
+    // schedule operation, or perform it directly
+    _PacketPassInterface_schedule_operation(i);
+}
+
+void PacketPassInterface_Sender_SendV (PacketPassInterface *i, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    ASSERT(i->handler_operation_v)
+    ASSERT(num_bufs > 0)
+    ASSERT(num_bufs <= PPI_MAX_BUFS)
+    ASSERT(i->state == PPI_STATE_NONE)
+    ASSERT(i->handler_done)
+    DebugObject_Access(&i->d_obj);
+    
+    // remember buffers, so the caller's array need not stay around
+    int total = 0;
+    for (int j = 0; j < num_bufs; j++) {
+        ASSERT(bufs[j].len >= 0)
+        ASSERT(bufs[j].len <= i->mtu - total)
+        ASSERT(!(bufs[j].len > 0) || bufs[j].data)
+        i->job_operation_bufs[j] = bufs[j];
+        total += bufs[j].len;
+    }
+    
+    // remember operation
+    i->job_operation_data = NULL;
+    i->job_operation_len = total;
+    i->job_operation_num_bufs = num_bufs;
+    i->job_operation_num_packets = 0;
+    
+    // set state
+    i->state = PPI_STATE_OPERATION_PENDING;
+    i->cancel_requested = 0;
+    
+    // schedule operation, or perform it directly
+    _PacketPassInterface_schedule_operation(i);
+}
+
+void PacketPassInterface_Sender_SendMany (PacketPassInterface *i, const struct PacketPassInterface_buf *packets, int num_packets)
+{
+    ASSERT(i->handler_operation_many)
+    ASSERT(num_packets > 0)
+    ASSERT(packets)
+    ASSERT(i->state == PPI_STATE_NONE)
+    ASSERT(i->handler_done)
+    DebugObject_Access(&i->d_obj);
+    
+#ifndef NDEBUG
+    for (int j = 0; j < num_packets; j++) {
+        ASSERT(packets[j].len >= 0)
+        ASSERT(packets[j].len <= i->mtu)
+        ASSERT(!(packets[j].len > 0) || packets[j].data)
+    }
+#endif
+    
+    // remember operation
+    i->job_operation_num_bufs = 0;
+    i->job_operation_packets = packets;
+    i->job_operation_num_packets = num_packets;
+    
+    // set state
+    i->state = PPI_STATE_OPERATION_PENDING;
+    i->cancel_requested = 0;
+    
+    // schedule operation, or perform it directly
+    _PacketPassInterface_schedule_operation(i);
 }
 
 void PacketPassInterface_Sender_RequestCancel (PacketPassInterface *i)
@@ -233,4 +435,43 @@ int PacketPassInterface_HasCancel (PacketPassInterface *i)
     return !!i->handler_requestcancel;
 }
 
+int PacketPassInterface_HasSendV (PacketPassInterface *i)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    return !!i->handler_operation_v;
+}
+
+int PacketPassInterface_HasSendMany (PacketPassInterface *i)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    return !!i->handler_operation_many;
+}
+
+void PacketPassInterface_CopyBufs (const struct PacketPassInterface_buf *bufs, int num_bufs, int offset, uint8_t *out, int len)
+{
+    ASSERT(num_bufs >= 0)
+    ASSERT(num_bufs <= PPI_MAX_BUFS)
+    ASSERT(offset >= 0)
+    ASSERT(len >= 0)
+    
+    for (int j = 0; j < num_bufs && len > 0; j++) {
+        if (offset >= bufs[j].len) {
+            offset -= bufs[j].len;
+            continue;
+        }
+        int part = bufs[j].len - offset;
+        if (part > len) {
+            part = len;
+        }
+        memcpy(out, bufs[j].data + offset, part);
+        out += part;
+        len -= part;
+        offset = 0;
+    }
+    
+    ASSERT(len == 0)
+}
+
 #endif
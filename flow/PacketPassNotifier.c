@@ -45,6 +45,20 @@ void input_handler_send (PacketPassNotifier *o, uint8_t *data, int data_len)
     }
 }
 
+void input_handler_sendv (PacketPassNotifier *o, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // schedule send
+    PacketPassInterface_Sender_SendV(o->output, bufs, num_bufs);
+    
+    // if we have a handler, call it
+    if (o->handler) {
+        o->handler(o->handler_user, bufs[0].data, bufs[0].len);
+        return;
+    }
+}
+
 void input_handler_requestcancel (PacketPassNotifier *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -69,6 +83,9 @@ void PacketPassNotifier_Init (PacketPassNotifier *o, PacketPassInterface *output
     if (PacketPassInterface_HasCancel(o->output)) {
         PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
     }
+    if (PacketPassInterface_HasSendV(o->output)) {
+        PacketPassInterface_EnableSendV(&o->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
+    }
     
     // init output
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
@@ -42,10 +42,11 @@
 
 /**
  * Handler function called when input calls Send, but before the call is passed on to output.
+ * For a vectored send, this is called with the first buffer only.
  * 
  * @param user value specified in {@link PacketPassNotifier_SetHandler}
- * @param data packet provided by input
- * @param data_len size of the packet
+ * @param data packet provided by input, or its first buffer for a vectored send
+ * @param data_len size of the packet, or of its first buffer for a vectored send
  */
 typedef void (*PacketPassNotifier_handler_notify) (void *user, uint8_t *data, int data_len);
 
@@ -65,7 +66,7 @@ typedef struct {
  * Initializes the object.
  *
  * @param o the object
- * @param output output interface
+ * @param output output interface. If it supports vectored sends, so will the input.
  * @param pg pending group
  */
 void PacketPassNotifier_Init (PacketPassNotifier *o, PacketPassInterface *output, BPendingGroup *pg);
@@ -48,22 +48,89 @@ static int compare_flows (PacketPassPriorityQueueFlow *f1, PacketPassPriorityQue
 #include "PacketPassPriorityQueue_tree.h"
 #include <structure/SAvl_impl.h>
 
+static int lowest_level (uint32_t bitmap)
+{
+    ASSERT(bitmap)
+    
+#ifdef __GNUC__
+    return __builtin_ctz(bitmap);
+#else
+    int level = 0;
+    while (!(bitmap & 1)) {
+        bitmap >>= 1;
+        level++;
+    }
+    return level;
+#endif
+}
+
+static int queue_is_empty (PacketPassPriorityQueue *m)
+{
+    if (m->num_levels > 0) {
+        return !m->levels_bitmap;
+    }
+    
+    return PacketPassPriorityQueue__Tree_IsEmpty(&m->queued_tree);
+}
+
+static void queue_insert (PacketPassPriorityQueue *m, PacketPassPriorityQueueFlow *flow)
+{
+    if (m->num_levels > 0) {
+        LinkedList1_Append(&m->levels[flow->priority], &flow->queued.list_node);
+        m->levels_bitmap |= (uint32_t)1 << flow->priority;
+        return;
+    }
+    
+    int res = PacketPassPriorityQueue__Tree_Insert(&m->queued_tree, 0, flow, NULL);
+    ASSERT_EXECUTE(res)
+}
+
+static void queue_remove (PacketPassPriorityQueue *m, PacketPassPriorityQueueFlow *flow)
+{
+    if (m->num_levels > 0) {
+        LinkedList1 *list = &m->levels[flow->priority];
+        LinkedList1_Remove(list, &flow->queued.list_node);
+        if (LinkedList1_IsEmpty(list)) {
+            m->levels_bitmap &= ~((uint32_t)1 << flow->priority);
+        }
+        return;
+    }
+    
+    PacketPassPriorityQueue__Tree_Remove(&m->queued_tree, 0, flow);
+}
+
+static PacketPassPriorityQueueFlow * queue_first (PacketPassPriorityQueue *m)
+{
+    ASSERT(!queue_is_empty(m))
+    
+    if (m->num_levels > 0) {
+        LinkedList1Node *node = LinkedList1_GetFirst(&m->levels[lowest_level(m->levels_bitmap)]);
+        return UPPER_OBJECT(node, PacketPassPriorityQueueFlow, queued.list_node);
+    }
+    
+    return PacketPassPriorityQueue__Tree_GetFirst(&m->queued_tree, 0);
+}
+
 static void schedule (PacketPassPriorityQueue *m)
 {
     ASSERT(!m->sending_flow)
     ASSERT(!m->freeing)
-    ASSERT(!PacketPassPriorityQueue__Tree_IsEmpty(&m->queued_tree))
+    ASSERT(!queue_is_empty(m))
     
     // get first queued flow
-    PacketPassPriorityQueueFlow *qflow = PacketPassPriorityQueue__Tree_GetFirst(&m->queued_tree, 0);
+    PacketPassPriorityQueueFlow *qflow = queue_first(m);
     ASSERT(qflow->is_queued)
     
     // remove flow from queue
-    PacketPassPriorityQueue__Tree_Remove(&m->queued_tree, 0, qflow);
+    queue_remove(m, qflow);
     qflow->is_queued = 0;
     
     // schedule send
-    PacketPassInterface_Sender_Send(m->output, qflow->queued.data, qflow->queued.data_len);
+    if (qflow->queued.num_bufs > 0) {
+        PacketPassInterface_Sender_SendV(m->output, qflow->queued.bufs, qflow->queued.num_bufs);
+    } else {
+        PacketPassInterface_Sender_Send(m->output, qflow->queued.data, qflow->queued.data_len);
+    }
     m->sending_flow = qflow;
 }
 
@@ -73,25 +140,21 @@ static void schedule_job_handler (PacketPassPriorityQueue *m)
     ASSERT(!m->freeing)
     DebugObject_Access(&m->d_obj);
     
-    if (!PacketPassPriorityQueue__Tree_IsEmpty(&m->queued_tree)) {
+    if (!queue_is_empty(m)) {
         schedule(m);
     }
 }
 
-static void input_handler_send (PacketPassPriorityQueueFlow *flow, uint8_t *data, int data_len)
+static void queue_flow (PacketPassPriorityQueueFlow *flow)
 {
     PacketPassPriorityQueue *m = flow->m;
     
     ASSERT(flow != m->sending_flow)
     ASSERT(!flow->is_queued)
     ASSERT(!m->freeing)
-    DebugObject_Access(&flow->d_obj);
     
     // queue flow
-    flow->queued.data = data;
-    flow->queued.data_len = data_len;
-    int res = PacketPassPriorityQueue__Tree_Insert(&m->queued_tree, 0, flow, NULL);
-    ASSERT_EXECUTE(res)
+    queue_insert(m, flow);
     flow->is_queued = 1;
     
     if (!m->sending_flow && !BPending_IsSet(&m->schedule_job)) {
@@ -99,6 +162,57 @@ static void input_handler_send (PacketPassPriorityQueueFlow *flow, uint8_t *data
     }
 }
 
+static void input_handler_send (PacketPassPriorityQueueFlow *flow, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&flow->d_obj);
+    
+    // remember packet
+    flow->queued.data = data;
+    flow->queued.data_len = data_len;
+    flow->queued.num_bufs = 0;
+    
+    queue_flow(flow);
+}
+
+static void input_handler_sendv (PacketPassPriorityQueueFlow *flow, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    DebugObject_Access(&flow->d_obj);
+    
+    // remember packet
+    int total = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        flow->queued.bufs[i] = bufs[i];
+        total += bufs[i].len;
+    }
+    flow->queued.data = NULL;
+    flow->queued.data_len = total;
+    flow->queued.num_bufs = num_bufs;
+    
+    queue_flow(flow);
+}
+
+static void input_handler_requestcancel (PacketPassPriorityQueueFlow *flow)
+{
+    PacketPassPriorityQueue *m = flow->m;
+    
+    ASSERT(flow == m->sending_flow || flow->is_queued)
+    ASSERT(!m->freeing)
+    DebugObject_Access(&flow->d_obj);
+    
+    if (flow == m->sending_flow) {
+        // pass the request on
+        PacketPassInterface_Sender_RequestCancel(m->output);
+        return;
+    }
+    
+    // drop the packet from the queue
+    queue_remove(m, flow);
+    flow->is_queued = 0;
+    
+    // finish flow packet
+    PacketPassInterface_Done(&flow->input);
+}
+
 static void output_handler_done (PacketPassPriorityQueue *m)
 {
     ASSERT(m->sending_flow)
@@ -148,6 +262,10 @@ void PacketPassPriorityQueue_Init (PacketPassPriorityQueue *m, PacketPassInterfa
     // init queued tree
     PacketPassPriorityQueue__Tree_Init(&m->queued_tree);
     
+    // not in levels mode
+    m->num_levels = 0;
+    m->levels_bitmap = 0;
+    
     // not freeing
     m->freeing = 0;
     
@@ -158,9 +276,23 @@ void PacketPassPriorityQueue_Init (PacketPassPriorityQueue *m, PacketPassInterfa
     DebugCounter_Init(&m->d_ctr);
 }
 
+void PacketPassPriorityQueue_InitLevels (PacketPassPriorityQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int num_levels)
+{
+    ASSERT(num_levels >= 1)
+    ASSERT(num_levels <= PACKETPASSPRIORITYQUEUE_MAX_LEVELS)
+    
+    PacketPassPriorityQueue_Init(m, output, pg, use_cancel);
+    
+    // init levels
+    m->num_levels = num_levels;
+    for (int i = 0; i < num_levels; i++) {
+        LinkedList1_Init(&m->levels[i]);
+    }
+}
+
 void PacketPassPriorityQueue_Free (PacketPassPriorityQueue *m)
 {
-    ASSERT(PacketPassPriorityQueue__Tree_IsEmpty(&m->queued_tree))
+    ASSERT(queue_is_empty(m))
     ASSERT(!m->sending_flow)
     DebugCounter_Free(&m->d_ctr);
     DebugObject_Free(&m->d_obj);
@@ -187,6 +319,7 @@ int PacketPassPriorityQueue_GetMTU (PacketPassPriorityQueue *m)
 void PacketPassPriorityQueueFlow_Init (PacketPassPriorityQueueFlow *flow, PacketPassPriorityQueue *m, int priority)
 {
     ASSERT(!m->freeing)
+    ASSERT(m->num_levels == 0 || (priority >= 0 && priority < m->num_levels))
     DebugObject_Access(&m->d_obj);
     
     // init arguments
@@ -198,6 +331,12 @@ void PacketPassPriorityQueueFlow_Init (PacketPassPriorityQueueFlow *flow, Packet
     
     // init input
     PacketPassInterface_Init(&flow->input, PacketPassInterface_GetMTU(flow->m->output), (PacketPassInterface_handler_send)input_handler_send, flow, m->pg);
+    if (m->use_cancel) {
+        PacketPassInterface_EnableCancel(&flow->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+    }
+    if (PacketPassInterface_HasSendV(m->output)) {
+        PacketPassInterface_EnableSendV(&flow->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
+    }
     
     // is not queued
     flow->is_queued = 0;
@@ -221,7 +360,7 @@ void PacketPassPriorityQueueFlow_Free (PacketPassPriorityQueueFlow *flow)
     
     // remove from queue
     if (flow->is_queued) {
-        PacketPassPriorityQueue__Tree_Remove(&m->queued_tree, 0, flow);
+        queue_remove(m, flow);
     }
     
     // free input
@@ -38,10 +38,14 @@
 
 #include <misc/debugcounter.h>
 #include <structure/SAvl.h>
+#include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <base/BPending.h>
 #include <flow/PacketPassInterface.h>
 
+// maximum number of priority levels in levels mode
+#define PACKETPASSPRIORITYQUEUE_MAX_LEVELS 32
+
 typedef void (*PacketPassPriorityQueue_handler_busy) (void *user);
 
 struct PacketPassPriorityQueueFlow_s;
@@ -58,8 +62,11 @@ typedef struct PacketPassPriorityQueueFlow_s {
     int is_queued;
     struct {
         PacketPassPriorityQueue__TreeNode tree_node;
+        LinkedList1Node list_node;
         uint8_t *data;
         int data_len;
+        struct PacketPassInterface_buf bufs[PPI_MAX_BUFS];
+        int num_bufs;
     } queued;
     DebugObject d_obj;
 } PacketPassPriorityQueueFlow;
@@ -73,6 +80,9 @@ typedef struct PacketPassPriorityQueue_s {
     int use_cancel;
     struct PacketPassPriorityQueueFlow_s *sending_flow;
     PacketPassPriorityQueue__Tree queued_tree;
+    int num_levels;
+    uint32_t levels_bitmap;
+    LinkedList1 levels[PACKETPASSPRIORITYQUEUE_MAX_LEVELS];
     int freeing;
     BPending schedule_job;
     DebugObject d_obj;
@@ -81,6 +91,10 @@ typedef struct PacketPassPriorityQueue_s {
 
 /**
  * Initializes the queue.
+ * If the output supports vectored sends, so do the flow inputs.
+ * If cancel functionality is enabled, the flow inputs support cancel;
+ * cancelling a packet which is queued but not yet being sent drops it
+ * from the queue.
  *
  * @param m the object
  * @param output output interface
@@ -90,6 +104,23 @@ typedef struct PacketPassPriorityQueue_s {
  */
 void PacketPassPriorityQueue_Init (PacketPassPriorityQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel);
 
+/**
+ * Initializes the queue in levels mode, where flow priorities are small
+ * numbers, from 0 to num_levels-1. Queued flows are kept in a FIFO list
+ * per level and a bitmap of non-empty levels, so queueing and scheduling
+ * take constant time. Flows of the same priority are served in the order
+ * they were queued. Otherwise like {@link PacketPassPriorityQueue_Init}.
+ * 
+ * @param m the object
+ * @param output output interface
+ * @param pg pending group
+ * @param use_cancel whether cancel functionality is required. Must be 0 or 1.
+ *                   If 1, output must support cancel functionality.
+ * @param num_levels number of priority levels. Must be >=1 and
+ *                   <=PACKETPASSPRIORITYQUEUE_MAX_LEVELS.
+ */
+void PacketPassPriorityQueue_InitLevels (PacketPassPriorityQueue *m, PacketPassInterface *output, BPendingGroup *pg, int use_cancel, int num_levels);
+
 /**
  * Frees the queue.
  * All flows must have been freed.
@@ -125,6 +156,7 @@ int PacketPassPriorityQueue_GetMTU (PacketPassPriorityQueue *m);
  * @param flow the object
  * @param m queue to attach to
  * @param priority flow priority. Lower value means higher priority.
+ *                 In levels mode, must be >=0 and <num_levels.
  */
 void PacketPassPriorityQueueFlow_Init (PacketPassPriorityQueueFlow *flow, PacketPassPriorityQueue *m, int priority);
 
@@ -29,23 +29,59 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include <misc/debug.h>
 #include <misc/byteorder.h>
 #include <misc/minmax.h>
 #include <base/BLog.h>
+#include <base/BBufferArena.h>
 
 #include <flow/PacketProtoDecoder.h>
 
 #include <generated/blog_channel_PacketProtoDecoder.h>
 
+static PacketProtoDecoderBuffer * alloc_buffer (PacketProtoDecoder *enc);
+static void rewind_buffer (PacketProtoDecoder *enc);
 static void process_data (PacketProtoDecoder *enc);
 static void input_handler_done (PacketProtoDecoder *enc, int data_len);
 static void output_handler_done (PacketProtoDecoder *enc);
 
+static PacketProtoDecoderBuffer * alloc_buffer (PacketProtoDecoder *enc)
+{
+    PacketProtoDecoderBuffer *b = (PacketProtoDecoderBuffer *)BBufferArena_Alloc(sizeof(PacketProtoDecoderBuffer) + enc->buf_size);
+    if (!b) {
+        return NULL;
+    }
+    
+    b->refs = 1;
+    
+    return b;
+}
+
+static void rewind_buffer (PacketProtoDecoder *enc)
+{
+    if (enc->buffer->refs > 1) {
+        // packets in the buffer are still referenced, continue in the spare buffer
+        ASSERT(enc->spare)
+        uint8_t *new_buf = (uint8_t *)(enc->spare + 1);
+        memcpy(new_buf, enc->buf + enc->buf_start, enc->buf_used);
+        PacketProtoDecoderBuffer_Unref(enc->buffer);
+        enc->buffer = enc->spare;
+        enc->spare = NULL;
+        enc->buf = new_buf;
+    }
+    else if (enc->buf_used > 0) {
+        memmove(enc->buf, enc->buf + enc->buf_start, enc->buf_used);
+    }
+    
+    enc->buf_start = 0;
+}
+
 void process_data (PacketProtoDecoder *enc)
 {
     int was_error = 0;
+    int need = sizeof(struct packetproto_header);
     
     do {
         uint8_t *data = enc->buf + enc->buf_start;
@@ -70,6 +106,7 @@ void process_data (PacketProtoDecoder *enc)
         
         // check if whole packet was received
         if (left < data_len) {
+            need += data_len;
             break;
         }
         
@@ -84,13 +121,16 @@ void process_data (PacketProtoDecoder *enc)
     
     if (was_error) {
         // reset buffer
-        enc->buf_start = 0;
         enc->buf_used = 0;
+        rewind_buffer(enc);
     } else {
-        // if we reached the end of the buffer, wrap around to allow more data to be received
-        if (enc->buf_start + enc->buf_used == enc->buf_size) {
-            memmove(enc->buf, enc->buf + enc->buf_start, enc->buf_used);
-            enc->buf_start = 0;
+        if (enc->buf_used == 0) {
+            // everything was processed, receive from the start again
+            rewind_buffer(enc);
+        }
+        else if (enc->buf_start + need > enc->buf_size) {
+            // the partial packet can't be completed in place, move it to the start
+            rewind_buffer(enc);
         }
     }
     
@@ -129,6 +169,13 @@ void output_handler_done (PacketProtoDecoder *enc)
 
 int PacketProtoDecoder_Init (PacketProtoDecoder *enc, StreamRecvInterface *input, PacketPassInterface *output, BPendingGroup *pg, void *user, PacketProtoDecoder_handler_error handler_error)
 {
+    return PacketProtoDecoder_Init2(enc, input, output, 1, pg, user, handler_error);
+}
+
+int PacketProtoDecoder_Init2 (PacketProtoDecoder *enc, StreamRecvInterface *input, PacketPassInterface *output, int num_packets, BPendingGroup *pg, void *user, PacketProtoDecoder_handler_error handler_error)
+{
+    ASSERT(num_packets > 0)
+    
     // init arguments
     enc->input = input;
     enc->output = output;
@@ -145,14 +192,24 @@ int PacketProtoDecoder_Init (PacketProtoDecoder *enc, StreamRecvInterface *input
     enc->output_mtu = bmin_int(PacketPassInterface_GetMTU(enc->output), PACKETPROTO_MAXPAYLOAD);
     
     // init buffer state
-    enc->buf_size = PACKETPROTO_ENCLEN(enc->output_mtu);
+    if (num_packets > INT_MAX / PACKETPROTO_ENCLEN(enc->output_mtu)) {
+        goto fail0;
+    }
+    enc->buf_size = num_packets * PACKETPROTO_ENCLEN(enc->output_mtu);
     enc->buf_start = 0;
     enc->buf_used = 0;
     
     // allocate buffer
-    if (!(enc->buf = (uint8_t *)malloc(enc->buf_size))) {
+    if (enc->buf_size > INT_MAX - sizeof(PacketProtoDecoderBuffer)) {
+        goto fail0;
+    }
+    if (!(enc->buffer = alloc_buffer(enc))) {
         goto fail0;
     }
+    enc->buf = (uint8_t *)(enc->buffer + 1);
+    
+    // have no spare buffer
+    enc->spare = NULL;
     
     // start receiving
     StreamRecvInterface_Receiver_Recv(enc->input, enc->buf, enc->buf_size);
@@ -169,8 +226,11 @@ void PacketProtoDecoder_Free (PacketProtoDecoder *enc)
 {
     DebugObject_Free(&enc->d_obj);
     
-    // free buffer
-    free(enc->buf);
+    // free spare buffer
+    BBufferArena_Free(enc->spare);
+    
+    // release buffer
+    PacketProtoDecoderBuffer_Unref(enc->buffer);
 }
 
 void PacketProtoDecoder_Reset (PacketProtoDecoder *enc)
@@ -180,3 +240,26 @@ void PacketProtoDecoder_Reset (PacketProtoDecoder *enc)
     enc->buf_start += enc->buf_used;
     enc->buf_used = 0;
 }
+
+PacketProtoDecoderBuffer * PacketProtoDecoder_RefPacket (PacketProtoDecoder *enc)
+{
+    DebugObject_Access(&enc->d_obj);
+    
+    // make sure we can continue in another buffer
+    if (!enc->spare && !(enc->spare = alloc_buffer(enc))) {
+        return NULL;
+    }
+    
+    enc->buffer->refs++;
+    
+    return enc->buffer;
+}
+
+void PacketProtoDecoderBuffer_Unref (PacketProtoDecoderBuffer *b)
+{
+    ASSERT(b->refs > 0)
+    
+    if (--b->refs == 0) {
+        BBufferArena_Free(b);
+    }
+}
@@ -50,6 +50,14 @@
  */
 typedef void (*PacketProtoDecoder_handler_error) (void *user);
 
+/**
+ * Receive buffer of a {@link PacketProtoDecoder}, which can be referenced to
+ * keep packets in it valid after they have been sent to the output.
+ */
+typedef struct {
+    int refs;
+} PacketProtoDecoderBuffer;
+
 typedef struct {
     StreamRecvInterface *input;
     PacketPassInterface *output;
@@ -60,12 +68,14 @@ typedef struct {
     int buf_start;
     int buf_used;
     uint8_t *buf;
+    PacketProtoDecoderBuffer *buffer;
+    PacketProtoDecoderBuffer *spare;
     DebugObject d_obj;
 } PacketProtoDecoder;
 
 /**
  * Initializes the object.
- *
+ * 
  * @param enc the object
  * @param input input interface. The decoder will accept packets with payload size up to its MTU
  *              (but the payload can never be more than PACKETPROTO_MAXPAYLOAD).
@@ -77,9 +87,28 @@ typedef struct {
  */
 int PacketProtoDecoder_Init (PacketProtoDecoder *enc, StreamRecvInterface *input, PacketPassInterface *output, BPendingGroup *pg, void *user, PacketProtoDecoder_handler_error handler_error) WARN_UNUSED;
 
+/**
+ * Initializes the object, with a buffer for more than one packet.
+ * Received data is parsed in place and each read may fill the whole free space
+ * of the buffer, so a larger buffer lets one read yield many packets. Only a
+ * partial packet which can't be completed before the end of the buffer is
+ * moved to its start.
+ * 
+ * @param enc the object
+ * @param input input interface. The decoder will accept packets with payload size up to its MTU
+ *              (but the payload can never be more than PACKETPROTO_MAXPAYLOAD).
+ * @param output output interface
+ * @param num_packets size of the buffer, in packets of the maximum size. Must be >0.
+ * @param pg pending group
+ * @param user argument to handlers
+ * @param handler_error error handler
+ * @return 1 on success, 0 on failure
+ */
+int PacketProtoDecoder_Init2 (PacketProtoDecoder *enc, StreamRecvInterface *input, PacketPassInterface *output, int num_packets, BPendingGroup *pg, void *user, PacketProtoDecoder_handler_error handler_error) WARN_UNUSED;
+
 /**
  * Frees the object.
- *
+ * 
  * @param enc the object
  */
 void PacketProtoDecoder_Free (PacketProtoDecoder *enc);
@@ -88,9 +117,36 @@ void PacketProtoDecoder_Free (PacketProtoDecoder *enc);
  * Clears the internal buffer.
  * The next data received from the input will be treated as a new
  * PacketProto stream.
- *
+ * 
  * @param enc the object
  */
 void PacketProtoDecoder_Reset (PacketProtoDecoder *enc);
 
+/**
+ * References the buffer holding the packet being sent to the output, so that
+ * the packet data stays valid after the output is done with it, until the
+ * reference is released with {@link PacketProtoDecoderBuffer_Unref}.
+ * While the buffer is referenced, the decoder continues receiving into a new
+ * buffer instead of reusing it, moving over only a partial packet.
+ * 
+ * Must be called while a packet is being sent to the output, before the
+ * decoder is told that it is done. Note that unless direct mode is used,
+ * {@link PacketPassInterface_Done} tells the decoder from a job, so this may
+ * still be called after it within the same job.
+ * 
+ * @param enc the object
+ * @return the referenced buffer, or NULL if a new buffer could not be
+ *         allocated, in which case the packet cannot be referenced
+ */
+PacketProtoDecoderBuffer * PacketProtoDecoder_RefPacket (PacketProtoDecoder *enc);
+
+/**
+ * Releases a reference obtained with {@link PacketProtoDecoder_RefPacket}.
+ * The decoder may have been freed in the meantime, but this must be called
+ * from the thread the decoder runs in.
+ * 
+ * @param b the buffer
+ */
+void PacketProtoDecoderBuffer_Unref (PacketProtoDecoderBuffer *b);
+
 #endif
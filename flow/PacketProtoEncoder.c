@@ -35,6 +35,7 @@
 #include <misc/debug.h>
 #include <misc/byteorder.h>
 
+#include <flow/PacketBuf.h>
 #include <flow/PacketProtoEncoder.h>
 
 static void output_handler_recv (PacketProtoEncoder *enc, uint8_t *data)
@@ -53,14 +54,19 @@ static void input_handler_done (PacketProtoEncoder *enc, int in_len)
     ASSERT(enc->output_packet)
     DebugObject_Access(&enc->d_obj);
     
+    // the payload was received behind the room for the header
+    PacketBuf pkt;
+    PacketBuf_Init(&pkt, enc->output_packet, PacketRecvInterface_GetMTU(&enc->output), sizeof(struct packetproto_header));
+    PacketBuf_Put(&pkt, in_len);
+    
     // write length
     struct packetproto_header pp;
     pp.len = htol16(in_len);
-    memcpy(enc->output_packet, &pp, sizeof(pp));
+    memcpy(PacketBuf_Push(&pkt, sizeof(pp)), &pp, sizeof(pp));
     
     // finish output packet
     enc->output_packet = NULL;
-    PacketRecvInterface_Done(&enc->output, PACKETPROTO_ENCLEN(in_len));
+    PacketRecvInterface_Done(&enc->output, PacketBuf_Len(&pkt));
 }
 
 void PacketProtoEncoder_Init (PacketProtoEncoder *enc, PacketRecvInterface *input, BPendingGroup *pg)
@@ -0,0 +1,150 @@
+/**
+ * @file PacketProtoPassEncoder.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <misc/balloc.h>
+#include <misc/byteorder.h>
+#include <base/BBufferArena.h>
+
+#include <flow/PacketProtoPassEncoder.h>
+
+static void send_packet (PacketProtoPassEncoder *o, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    ASSERT(num_bufs >= 0)
+    ASSERT(num_bufs <= PPI_MAX_BUFS)
+    
+    // compute length
+    int len = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        len += bufs[i].len;
+    }
+    ASSERT(len <= PacketPassInterface_GetMTU(&o->input))
+    
+    // write length
+    o->header.len = htol16(len);
+    
+    if (num_bufs < PPI_MAX_BUFS && PacketPassInterface_HasSendV(o->output)) {
+        // send header followed by the packet's buffers
+        o->out_bufs[0].data = (uint8_t *)&o->header;
+        o->out_bufs[0].len = sizeof(o->header);
+        for (int i = 0; i < num_bufs; i++) {
+            o->out_bufs[1 + i] = bufs[i];
+        }
+        PacketPassInterface_Sender_SendV(o->output, o->out_bufs, 1 + num_bufs);
+        return;
+    }
+    
+    // copy header and packet into the buffer
+    memcpy(o->buf, &o->header, sizeof(o->header));
+    PacketPassInterface_CopyBufs(bufs, num_bufs, 0, o->buf + sizeof(o->header), len);
+    
+    PacketPassInterface_Sender_Send(o->output, o->buf, PACKETPROTO_ENCLEN(len));
+}
+
+static void input_handler_send (PacketProtoPassEncoder *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    struct PacketPassInterface_buf buf;
+    buf.data = data;
+    buf.len = data_len;
+    
+    send_packet(o, &buf, 1);
+}
+
+static void input_handler_sendv (PacketProtoPassEncoder *o, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    send_packet(o, bufs, num_bufs);
+}
+
+static void input_handler_requestcancel (PacketProtoPassEncoder *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    PacketPassInterface_Sender_RequestCancel(o->output);
+}
+
+static void output_handler_done (PacketProtoPassEncoder *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    PacketPassInterface_Done(&o->input);
+}
+
+int PacketProtoPassEncoder_Init (PacketProtoPassEncoder *o, PacketPassInterface *output, int mtu, BPendingGroup *pg)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(mtu <= PACKETPROTO_MAXPAYLOAD)
+    ASSERT(PacketPassInterface_GetMTU(output) >= PACKETPROTO_ENCLEN(mtu))
+    
+    // init arguments
+    o->output = output;
+    
+    // allocate buffer for packets which can't be sent vectored
+    if (!(o->buf = (uint8_t *)BBufferArena_Alloc(PACKETPROTO_ENCLEN(mtu)))) {
+        goto fail0;
+    }
+    
+    // init input
+    PacketPassInterface_Init(&o->input, mtu, (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    PacketPassInterface_EnableSendV(&o->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
+    if (PacketPassInterface_HasCancel(o->output)) {
+        PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+    }
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+void PacketProtoPassEncoder_Free (PacketProtoPassEncoder *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free input
+    PacketPassInterface_Free(&o->input);
+    
+    // free buffer
+    BBufferArena_Free(o->buf);
+}
+
+PacketPassInterface * PacketProtoPassEncoder_GetInput (PacketProtoPassEncoder *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->input;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file PacketProtoPassEncoder.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Object which encodes packets according to PacketProto, without copying them
+ * if the output supports vectored sends.
+ */
+
+#ifndef BADVPN_FLOW_PACKETPROTOPASSENCODER_H
+#define BADVPN_FLOW_PACKETPROTOPASSENCODER_H
+
+#include <stdint.h>
+
+#include <protocol/packetproto.h>
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <flow/PacketPassInterface.h>
+
+/**
+ * Object which encodes packets according to PacketProto.
+ * 
+ * Input is with {@link PacketPassInterface}.
+ * Output is with {@link PacketPassInterface}.
+ * 
+ * Unlike {@link PacketProtoEncoder}, which needs the payload received into a
+ * buffer right behind the header, this sends the header from the object itself
+ * followed by the input packet's buffers in one vectored send, so that a
+ * packet reaches e.g. {@link PacketStreamSender} and a socket's writev without
+ * being copied. If the output doesn't support vectored sends, or the input
+ * packet has too many buffers for that, the packet is copied into an internal
+ * buffer behind the header and sent from there.
+ */
+typedef struct {
+    DebugObject d_obj;
+    PacketPassInterface input;
+    PacketPassInterface *output;
+    struct packetproto_header header;
+    struct PacketPassInterface_buf out_bufs[PPI_MAX_BUFS];
+    uint8_t *buf;
+} PacketProtoPassEncoder;
+
+/**
+ * Initializes the object.
+ *
+ * @param o the object
+ * @param output output interface. Its MTU must be >=PACKETPROTO_ENCLEN(mtu).
+ * @param mtu input MTU. Must be >=0 and <=PACKETPROTO_MAXPAYLOAD.
+ * @param pg pending group
+ * @return 1 on success, 0 on failure
+ */
+int PacketProtoPassEncoder_Init (PacketProtoPassEncoder *o, PacketPassInterface *output, int mtu, BPendingGroup *pg) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ *
+ * @param o the object
+ */
+void PacketProtoPassEncoder_Free (PacketProtoPassEncoder *o);
+
+/**
+ * Returns the input interface.
+ * The MTU of the interface will be as in {@link PacketProtoPassEncoder_Init}.
+ * The interface will support vectored sends, and cancel functionality if the
+ * output interface does.
+ *
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * PacketProtoPassEncoder_GetInput (PacketProtoPassEncoder *o);
+
+#endif
@@ -97,24 +97,30 @@ void PacketRouter_Free (PacketRouter *o);
 /**
  * Routes the current packet to the given buffer.
  * Must be called from the job context of the {@link PacketRouter_handler} handler.
- * On success, copies part of the current packet to next one (regardless if next_buf
- * is provided or not; if not, copies before receiving another packet).
+ * 
+ * If share is 1, on success, the next packet will contain the same data from recv_offset
+ * on as the routed packet, shared with it rather than copied, so that the same received
+ * packet can be routed to more buffers at the cost of only writing its first recv_offset
+ * bytes again. The shared data must not be modified, and the next packet must be routed
+ * with the same length. The sharing ends when a packet is routed with share=0 or when
+ * the next packet is received.
  * 
  * @param o the object
- * @param len total packet length (e.g. recv_offset + (recv_len from handler)).
- *            Must be >=0 and <=mtu.
+ * @param offset offset where the packet begins, so that fewer than recv_offset leading
+ *               bytes can be used. Must be >=0 and <=recv_offset.
+ * @param len total packet length including the offset (e.g. recv_offset + (recv_len from handler)).
+ *            Must be >=recv_offset and <=mtu.
  * @param output buffer to route to. Its MTU must be the same as of this object.
  * @param next_buf if not NULL, on success, will be set to the address of a new current
  *                 packet that can be routed. The pointer will be valid in the job context of
  *                 the calling handler, until this function is called successfully again
- *                 (as for the original pointer provided by the handler).
- * @param copy_offset Offset from the beginning for copying to the next packet.
- *                    Must be >=0 and <=mtu.
- * @param copy_len Number of bytes to copy from the old current
- *                 packet to the next one. Must be >=0 and <= mtu - copy_offset.
+ *                 (as for the original pointer provided by the handler). If share is 1, only
+ *                 the first recv_offset bytes there are part of the next packet.
+ * @param share whether the next packet should share the data of the routed packet
+ *              from recv_offset on. Must be 0 or 1.
  * @return 1 on success, 0 on failure (buffer full)
  */
-int PacketRouter_Route (PacketRouter *o, int len, RouteBuffer *output, uint8_t **next_buf, int copy_offset, int copy_len);
+int PacketRouter_Route (PacketRouter *o, int offset, int len, RouteBuffer *output, uint8_t **next_buf, int share);
 
 /**
  * Asserts that {@link PacketRouter_Route} can be called.
@@ -28,18 +28,48 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <misc/debug.h>
+#include <base/BBufferArena.h>
 
 #include <flow/PacketStreamSender.h>
 
+static int get_in_bufs (PacketStreamSender *s, struct StreamPassInterface_buf *bufs)
+{
+    ASSERT(s->in_len >= 0)
+    
+    // collect the parts of the input packet which haven't been sent yet
+    int num_bufs = 0;
+    int skip = s->in_used;
+    for (int i = 0; i < s->in_num_bufs; i++) {
+        if (skip >= s->in_bufs[i].len) {
+            skip -= s->in_bufs[i].len;
+            continue;
+        }
+        bufs[num_bufs].data = s->in_bufs[i].data + skip;
+        bufs[num_bufs].len = s->in_bufs[i].len - skip;
+        num_bufs++;
+        skip = 0;
+    }
+    
+    return num_bufs;
+}
+
 static void send_data (PacketStreamSender *s)
 {
+    ASSERT(!s->buf)
     ASSERT(s->in_len >= 0)
     
     if (s->in_used < s->in_len) {
         // send more data
-        StreamPassInterface_Sender_Send(s->output, s->in + s->in_used, s->in_len - s->in_used);
+        struct StreamPassInterface_buf bufs[PPI_MAX_BUFS];
+        int num_bufs = get_in_bufs(s, bufs);
+        if (num_bufs == 1) {
+            StreamPassInterface_Sender_Send(s->output, bufs[0].data, bufs[0].len);
+        } else {
+            StreamPassInterface_Sender_SendV(s->output, bufs, num_bufs);
+        }
     } else {
         // finish input packet
         s->in_len = -1;
@@ -47,6 +77,87 @@ static void send_data (PacketStreamSender *s)
     }
 }
 
+static void send_buffer (PacketStreamSender *s)
+{
+    ASSERT(s->buf)
+    ASSERT(!s->out_busy)
+    ASSERT(s->buf_sent < s->buf_used || s->in_direct)
+    ASSERT(!s->in_direct || s->in_used < s->in_len)
+    
+    s->out_busy = 1;
+    
+    if (s->in_direct) {
+        // send the rest of the buffer and the held packet together
+        struct StreamPassInterface_buf bufs[1 + PPI_MAX_BUFS];
+        int num_bufs = 0;
+        if (s->buf_sent < s->buf_used) {
+            bufs[num_bufs].data = s->buf + s->buf_sent;
+            bufs[num_bufs].len = s->buf_used - s->buf_sent;
+            num_bufs++;
+        }
+        num_bufs += get_in_bufs(s, bufs + num_bufs);
+        StreamPassInterface_Sender_SendV(s->output, bufs, num_bufs);
+        return;
+    }
+    
+    // send everything gathered so far
+    StreamPassInterface_Sender_Send(s->output, s->buf + s->buf_sent, s->buf_used - s->buf_sent);
+}
+
+static void append_packet (PacketStreamSender *s)
+{
+    ASSERT(s->buf)
+    ASSERT(s->in_len >= 0)
+    ASSERT(s->in_len <= s->buf_size - s->buf_used)
+    
+    // copy packet to buffer
+    for (int i = 0; i < s->in_num_bufs; i++) {
+        memcpy(s->buf + s->buf_used, s->in_bufs[i].data, s->in_bufs[i].len);
+        s->buf_used += s->in_bufs[i].len;
+    }
+    
+    // schedule a flush; jobs run in reverse order of being set, so setting
+    // it before accepting the packet makes it run after the jobs which that
+    // and the following packets trigger
+    if (!s->out_busy && !BPending_IsSet(&s->flush_job)) {
+        BPending_Set(&s->flush_job);
+    }
+    
+    // accept packet so the next one can arrive
+    s->in_len = -1;
+    PacketPassInterface_Done(&s->input);
+}
+
+static void handle_input (PacketStreamSender *s)
+{
+    ASSERT(s->in_len >= 0)
+    
+    // start from the beginning of the packet
+    s->in_used = 0;
+    
+    if (s->buf) {
+        if (s->in_len > s->buf_size - s->buf_used) {
+            // hold the packet until the buffer has been sent; if the output
+            // takes vectored sends, send it right after the buffer without
+            // copying it in
+            s->in_direct = (s->in_len > 0 && StreamPassInterface_HasSendV(s->output));
+            
+            // the buffer can't be empty, so send it now
+            if (!s->out_busy) {
+                BPending_Unset(&s->flush_job);
+                send_buffer(s);
+            }
+            return;
+        }
+        
+        append_packet(s);
+        return;
+    }
+    
+    // send
+    send_data(s);
+}
+
 static void input_handler_send (PacketStreamSender *s, uint8_t *data, int data_len)
 {
     ASSERT(s->in_len == -1)
@@ -54,20 +165,77 @@ static void input_handler_send (PacketStreamSender *s, uint8_t *data, int data_l
     DebugObject_Access(&s->d_obj);
     
     // set input packet
+    s->in_bufs[0].data = data;
+    s->in_bufs[0].len = data_len;
+    s->in_num_bufs = 1;
     s->in_len = data_len;
-    s->in = data;
-    s->in_used = 0;
     
-    // send
-    send_data(s);
+    handle_input(s);
+}
+
+static void input_handler_sendv (PacketStreamSender *s, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    ASSERT(s->in_len == -1)
+    ASSERT(num_bufs > 0)
+    DebugObject_Access(&s->d_obj);
+    
+    // set input packet
+    s->in_len = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        s->in_bufs[i] = bufs[i];
+        s->in_len += bufs[i].len;
+    }
+    s->in_num_bufs = num_bufs;
+    
+    handle_input(s);
 }
 
 static void output_handler_done (PacketStreamSender *s, int data_len)
 {
+    DebugObject_Access(&s->d_obj);
+    
+    if (s->buf) {
+        ASSERT(s->out_busy)
+        ASSERT(data_len > 0)
+        ASSERT(data_len <= s->buf_used - s->buf_sent + (s->in_direct ? s->in_len - s->in_used : 0))
+        
+        // update number of bytes sent, from the buffer first
+        int buf_part = s->buf_used - s->buf_sent;
+        if (buf_part > data_len) {
+            buf_part = data_len;
+        }
+        s->buf_sent += buf_part;
+        s->in_used += data_len - buf_part;
+        s->out_busy = 0;
+        
+        // send the rest, including packets gathered in the meantime
+        if (s->buf_sent < s->buf_used || (s->in_direct && s->in_used < s->in_len)) {
+            send_buffer(s);
+            return;
+        }
+        
+        // buffer is empty, start from the beginning
+        s->buf_used = 0;
+        s->buf_sent = 0;
+        
+        // finish the held packet if it was sent directly
+        if (s->in_direct) {
+            s->in_len = -1;
+            s->in_direct = 0;
+            PacketPassInterface_Done(&s->input);
+            return;
+        }
+        
+        // take the held packet
+        if (s->in_len >= 0) {
+            append_packet(s);
+        }
+        return;
+    }
+    
     ASSERT(s->in_len >= 0)
     ASSERT(data_len > 0)
     ASSERT(data_len <= s->in_len - s->in_used)
-    DebugObject_Access(&s->d_obj);
     
     // update number of bytes sent
     s->in_used += data_len;
@@ -76,31 +244,88 @@ static void output_handler_done (PacketStreamSender *s, int data_len)
     send_data(s);
 }
 
+static void flush_job_handler (PacketStreamSender *s)
+{
+    ASSERT(s->buf)
+    ASSERT(!s->out_busy)
+    DebugObject_Access(&s->d_obj);
+    
+    // only empty packets may have been gathered
+    if (s->buf_sent == s->buf_used) {
+        return;
+    }
+    
+    send_buffer(s);
+}
+
 void PacketStreamSender_Init (PacketStreamSender *s, StreamPassInterface *output, int mtu, BPendingGroup *pg)
+{
+    // cannot fail without a buffer
+    int res = PacketStreamSender_Init2(s, output, mtu, 0, pg);
+    ASSERT_FORCE(res)
+}
+
+int PacketStreamSender_Init2 (PacketStreamSender *s, StreamPassInterface *output, int mtu, int buffer_size, BPendingGroup *pg)
 {
     ASSERT(mtu >= 0)
+    ASSERT(buffer_size == 0 || buffer_size >= mtu)
     
     // init arguments
     s->output = output;
+    s->buf_size = buffer_size;
+    
+    // allocate buffer
+    s->buf = NULL;
+    if (buffer_size > 0) {
+        if (!(s->buf = (uint8_t *)BBufferArena_Alloc(buffer_size))) {
+            goto fail0;
+        }
+    }
     
     // init input
     PacketPassInterface_Init(&s->input, mtu, (PacketPassInterface_handler_send)input_handler_send, s, pg);
     
+    // accept vectored sends if the output does
+    if (StreamPassInterface_HasSendV(s->output)) {
+        PacketPassInterface_EnableSendV(&s->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
+    }
+    
     // init output
     StreamPassInterface_Sender_Init(s->output, (StreamPassInterface_handler_done)output_handler_done, s);
     
     // have no input packet
     s->in_len = -1;
+    s->in_direct = 0;
+    
+    // buffer is empty
+    s->buf_used = 0;
+    s->buf_sent = 0;
+    s->out_busy = 0;
+    
+    // init flush job
+    BPending_Init(&s->flush_job, pg, (BPending_handler)flush_job_handler, s);
     
     DebugObject_Init(&s->d_obj);
+    return 1;
+    
+fail0:
+    return 0;
 }
 
 void PacketStreamSender_Free (PacketStreamSender *s)
 {
     DebugObject_Free(&s->d_obj);
     
+    // free flush job
+    BPending_Free(&s->flush_job);
+    
     // free input
     PacketPassInterface_Free(&s->input);
+    
+    // free buffer
+    if (s->buf) {
+        BBufferArena_Free(s->buf);
+    }
 }
 
 PacketPassInterface * PacketStreamSender_GetInput (PacketStreamSender *s)
@@ -38,6 +38,7 @@
 #include <stdint.h>
 
 #include <base/DebugObject.h>
+#include <base/BPending.h>
 #include <flow/PacketPassInterface.h>
 #include <flow/StreamPassInterface.h>
 
@@ -50,8 +51,16 @@ typedef struct {
     PacketPassInterface input;
     StreamPassInterface *output;
     int in_len;
-    uint8_t *in;
+    struct PacketPassInterface_buf in_bufs[PPI_MAX_BUFS];
+    int in_num_bufs;
     int in_used;
+    int in_direct;
+    uint8_t *buf;
+    int buf_size;
+    int buf_used;
+    int buf_sent;
+    int out_busy;
+    BPending flush_job;
 } PacketStreamSender;
 
 /**
@@ -64,6 +73,26 @@ typedef struct {
  */
 void PacketStreamSender_Init (PacketStreamSender *s, StreamPassInterface *output, int mtu, BPendingGroup *pg);
 
+/**
+ * Initializes the object, optionally gathering packets into a buffer.
+ * With a buffer, input packets are copied into it and accepted immediately,
+ * and the buffer is sent with a single output operation once no more packets
+ * are ready in the current round of jobs, or when the next packet doesn't fit.
+ * This trades a copy for fewer writes when many small packets are sent.
+ * If the output supports vectored sends ({@link StreamPassInterface_HasSendV}),
+ * a packet which doesn't fit is not copied but sent directly after the buffer,
+ * in the same output operation.
+ *
+ * @param s the object
+ * @param output output interface
+ * @param mtu input MTU. Must be >=0.
+ * @param buffer_size size of the buffer, or 0 to send packets directly
+ *                    as {@link PacketStreamSender_Init} does. Otherwise must be >=mtu.
+ * @param pg pending group
+ * @return 1 on success, 0 on failure
+ */
+int PacketStreamSender_Init2 (PacketStreamSender *s, StreamPassInterface *output, int mtu, int buffer_size, BPendingGroup *pg) WARN_UNUSED;
+
 /**
  * Frees the object.
  *
@@ -74,6 +103,9 @@ void PacketStreamSender_Free (PacketStreamSender *s);
 /**
  * Returns the input interface.
  * Its MTU will be as in {@link PacketStreamSender_Init}.
+ * It will support vectored sends if the output interface does. The buffers of
+ * such a packet are written with one vectored output operation rather than
+ * joined first, unless the packet is gathered into the buffer.
  *
  * @param s the object
  * @return input interface
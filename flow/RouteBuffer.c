@@ -32,6 +32,7 @@
 #include <string.h>
 
 #include <misc/offset.h>
+#include <base/BBufferArena.h>
 
 #include <flow/RouteBuffer.h>
 
@@ -42,14 +43,25 @@ static struct RouteBuffer_packet * alloc_packet (int mtu)
     }
     
     // allocate memory
-    struct RouteBuffer_packet *p = (struct RouteBuffer_packet *)malloc(sizeof(*p) + mtu);
+    struct RouteBuffer_packet *p = (struct RouteBuffer_packet *)BBufferArena_Alloc(sizeof(*p) + mtu);
     if (!p) {
         return NULL;
     }
     
+    // set not in use, no shared data
+    p->owner = NULL;
+    p->refs = 0;
+    p->shared = NULL;
+    
     return p;
 }
 
+static LinkedList1 * free_list (RouteBuffer *o)
+{
+    // buffers using a pool keep free packets there
+    return (o->pool ? &o->pool->packets_free : &o->packets_free);
+}
+
 static int alloc_free_packet (RouteBuffer *o)
 {
     struct RouteBuffer_packet *p = alloc_packet(o->mtu);
@@ -58,37 +70,105 @@ static int alloc_free_packet (RouteBuffer *o)
     }
     
     // add to free packets list
-    LinkedList1_Append(&o->packets_free, &p->node);
+    p->owner = o;
+    LinkedList1_Append(free_list(o), &p->node);
+    
+    return 1;
+}
+
+static int have_free_packet (RouteBuffer *o)
+{
+    if (!LinkedList1_IsEmpty(free_list(o))) {
+        return 1;
+    }
+    
+    // a pool grows as packets are needed, up to its size
+    if (!o->pool || o->pool->num_packets == o->pool->max_packets) {
+        return 0;
+    }
+    if (!alloc_free_packet(o)) {
+        return 0;
+    }
+    o->pool->num_packets++;
     
     return 1;
 }
 
-static void free_free_packets (RouteBuffer *o)
+static void free_free_packets (LinkedList1 *packets_free)
 {
-    while (!LinkedList1_IsEmpty(&o->packets_free)) {
+    while (!LinkedList1_IsEmpty(packets_free)) {
         // get packet
-        struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetLast(&o->packets_free), struct RouteBuffer_packet, node);
+        struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetLast(packets_free), struct RouteBuffer_packet, node);
         
         // remove from free packets list
-        LinkedList1_Remove(&o->packets_free, &p->node);
+        LinkedList1_Remove(packets_free, &p->node);
         
         // free memory
-        free(p);
+        BBufferArena_Free(p);
     }
 }
 
-static void release_used_packet (RouteBuffer *o)
+static void unref_packet (struct RouteBuffer_packet *p)
+{
+    ASSERT(p->refs > 0)
+    
+    p->refs--;
+    if (p->refs > 0) {
+        return;
+    }
+    
+    ASSERT(!p->shared)
+    
+    if (p->owner) {
+        // return to owner's free packets list
+        LinkedList1_Append(free_list(p->owner), &p->node);
+    } else {
+        // owner gave it up, free memory
+        BBufferArena_Free(p);
+    }
+}
+
+static void unshare_packet (struct RouteBuffer_packet *p)
+{
+    if (p->shared) {
+        unref_packet(p->shared);
+        p->shared = NULL;
+    }
+}
+
+static void release_used_packet (RouteBuffer *o, int replace)
 {
     ASSERT(!LinkedList1_IsEmpty(&o->packets_used))
     
     // get packet
     struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetFirst(&o->packets_used), struct RouteBuffer_packet, node);
+    ASSERT(p->owner == o)
     
     // remove from used packets list
     LinkedList1_Remove(&o->packets_used, &p->node);
+    o->num_used--;
+    
+    // release data we were sharing
+    unshare_packet(p);
+    
+    if (p->refs > 1) {
+        // other packets still share our data; give the packet up,
+        // it will be freed when they are done, and take a new one.
+        // If allocation fails, we're left with one packet less.
+        // A pool instead allocates a new one when it is needed.
+        p->owner = NULL;
+        p->refs--;
+        if (o->pool) {
+            o->pool->num_packets--;
+        }
+        else if (replace) {
+            alloc_free_packet(o);
+        }
+        return;
+    }
     
     // add to free packets list
-    LinkedList1_Append(&o->packets_free, &p->node);
+    unref_packet(p);
 }
 
 static void send_used_packet (RouteBuffer *o)
@@ -98,8 +178,27 @@ static void send_used_packet (RouteBuffer *o)
     // get packet
     struct RouteBuffer_packet *p = UPPER_OBJECT(LinkedList1_GetFirst(&o->packets_used), struct RouteBuffer_packet, node);
     
+    if (p->shared) {
+        uint8_t *shared_data = (uint8_t *)(p->shared + 1) + p->share_offset;
+        
+        // send header and shared data without copying, if possible
+        if (PacketPassInterface_HasSendV(o->output)) {
+            struct PacketPassInterface_buf bufs[2];
+            bufs[0].data = (uint8_t *)(p + 1) + p->offset;
+            bufs[0].len = p->share_offset - p->offset;
+            bufs[1].data = shared_data;
+            bufs[1].len = p->len - p->share_offset;
+            PacketPassInterface_Sender_SendV(o->output, bufs, 2);
+            return;
+        }
+        
+        // otherwise copy shared data into the packet
+        memcpy((uint8_t *)(p + 1) + p->share_offset, shared_data, p->len - p->share_offset);
+        unshare_packet(p);
+    }
+    
     // send
-    PacketPassInterface_Sender_Send(o->output, (uint8_t *)(p + 1), p->len);
+    PacketPassInterface_Sender_Send(o->output, (uint8_t *)(p + 1) + p->offset, p->len - p->offset);
 }
 
 static void output_handler_done (RouteBuffer *o)
@@ -108,7 +207,7 @@ static void output_handler_done (RouteBuffer *o)
     DebugObject_Access(&o->d_obj);
     
     // release packet
-    release_used_packet(o);
+    release_used_packet(o, 1);
     
     // send next packet if there is one
     if (!LinkedList1_IsEmpty(&o->packets_used)) {
@@ -125,6 +224,8 @@ int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int
     // init arguments
     o->mtu = mtu;
     o->output = output;
+    o->pool = NULL;
+    o->buf_size = buf_size;
     
     // init output
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
@@ -134,6 +235,7 @@ int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int
     
     // init used packets list
     LinkedList1_Init(&o->packets_used);
+    o->num_used = 0;
     
     // allocate packets
     for (int i = 0; i < buf_size; i++) {
@@ -147,21 +249,78 @@ int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int
     return 1;
     
 fail1:
-    free_free_packets(o);
+    free_free_packets(&o->packets_free);
     return 0;
 }
 
+void RouteBuffer_InitPool (RouteBuffer *o, RouteBufferPool *pool, PacketPassInterface *output, int buf_size)
+{
+    DebugObject_Access(&pool->d_obj);
+    ASSERT(PacketPassInterface_GetMTU(output) >= pool->mtu)
+    ASSERT(buf_size > 0)
+    
+    // init arguments
+    o->mtu = pool->mtu;
+    o->output = output;
+    o->pool = pool;
+    o->buf_size = buf_size;
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    // init free packets list; unused, free packets are in the pool
+    LinkedList1_Init(&o->packets_free);
+    
+    // init used packets list
+    LinkedList1_Init(&o->packets_used);
+    o->num_used = 0;
+    
+    DebugCounter_Increment(&pool->d_ctr);
+    DebugObject_Init(&o->d_obj);
+}
+
 void RouteBuffer_Free (RouteBuffer *o)
 {
     DebugObject_Free(&o->d_obj);
     
-    // release packets so they can be freed
+    // release packets so they can be freed, or returned to the pool
     while (!LinkedList1_IsEmpty(&o->packets_used)) {
-        release_used_packet(o);
+        release_used_packet(o, 0);
+    }
+    
+    if (o->pool) {
+        DebugCounter_Decrement(&o->pool->d_ctr);
+        return;
     }
     
     // free packets
-    free_free_packets(o);
+    free_free_packets(&o->packets_free);
+}
+
+void RouteBufferPool_Init (RouteBufferPool *o, int mtu, int max_packets)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(max_packets > 0)
+    
+    // init arguments
+    o->mtu = mtu;
+    o->max_packets = max_packets;
+    
+    // init free packets list; packets are allocated when needed
+    LinkedList1_Init(&o->packets_free);
+    o->num_packets = 0;
+    
+    DebugCounter_Init(&o->d_ctr);
+    DebugObject_Init(&o->d_obj);
+}
+
+void RouteBufferPool_Free (RouteBufferPool *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Free(&o->d_ctr);
+    
+    // free packets
+    free_free_packets(&o->packets_free);
 }
 
 int RouteBuffer_GetMTU (RouteBuffer *o)
@@ -171,17 +330,21 @@ int RouteBuffer_GetMTU (RouteBuffer *o)
     return o->mtu;
 }
 
-int RouteBufferSource_Init (RouteBufferSource *o, int mtu)
+int RouteBufferSource_Init (RouteBufferSource *o, int mtu, int share_offset)
 {
     ASSERT(mtu >= 0)
+    ASSERT(share_offset >= 0)
+    ASSERT(share_offset <= mtu)
     
     // init arguments
     o->mtu = mtu;
+    o->share_offset = share_offset;
     
     // allocate current packet
     if (!(o->current_packet = alloc_packet(o->mtu))) {
         goto fail0;
     }
+    o->current_packet->refs = 1;
     
     DebugObject_Init(&o->d_obj);
     
@@ -194,9 +357,13 @@ fail0:
 void RouteBufferSource_Free (RouteBufferSource *o)
 {
     DebugObject_Free(&o->d_obj);
+    ASSERT(o->current_packet->refs == 1)
+    
+    // release shared data
+    unshare_packet(o->current_packet);
     
     // free current packet
-    free(o->current_packet);
+    BBufferArena_Free(o->current_packet);
 }
 
 uint8_t * RouteBufferSource_Pointer (RouteBufferSource *o)
@@ -206,45 +373,57 @@ uint8_t * RouteBufferSource_Pointer (RouteBufferSource *o)
     return (uint8_t *)(o->current_packet + 1);
 }
 
-int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int copy_offset, int copy_len)
+int RouteBufferSource_Route (RouteBufferSource *o, int offset, int len, RouteBuffer *b, int share)
 {
-    ASSERT(len >= 0)
+    ASSERT(offset >= 0)
+    ASSERT(offset <= len)
     ASSERT(len <= o->mtu)
     ASSERT(b->mtu == o->mtu)
-    ASSERT(copy_offset >= 0)
-    ASSERT(copy_offset <= o->mtu)
-    ASSERT(copy_len >= 0)
-    ASSERT(copy_len <= o->mtu - copy_offset)
+    ASSERT(share == 0 || share == 1)
+    ASSERT(!share || len >= o->share_offset)
+    ASSERT(!(share || o->current_packet->shared) || offset <= o->share_offset)
+    ASSERT(!o->current_packet->shared || len == o->current_packet->shared->len)
     DebugObject_Access(&b->d_obj);
     DebugObject_Access(&o->d_obj);
     
     // check if there's space in the buffer
-    if (LinkedList1_IsEmpty(&b->packets_free)) {
+    if (b->num_used == b->buf_size || !have_free_packet(b)) {
         return 0;
     }
     
     int was_empty = LinkedList1_IsEmpty(&b->packets_used);
     
     struct RouteBuffer_packet *p = o->current_packet;
+    ASSERT(p->refs == 1)
     
-    // set packet length
+    // set packet bounds and owner
+    p->offset = offset;
     p->len = len;
+    p->owner = b;
     
     // append packet to used packets list
     LinkedList1_Append(&b->packets_used, &p->node);
+    b->num_used++;
     
     // get a free packet
-    struct RouteBuffer_packet *np = UPPER_OBJECT(LinkedList1_GetLast(&b->packets_free), struct RouteBuffer_packet, node);
+    struct RouteBuffer_packet *np = UPPER_OBJECT(LinkedList1_GetLast(free_list(b)), struct RouteBuffer_packet, node);
+    ASSERT(np->refs == 0)
+    ASSERT(!np->shared)
     
     // remove it from free packets list
-    LinkedList1_Remove(&b->packets_free, &np->node);
+    LinkedList1_Remove(free_list(b), &np->node);
     
     // make it the current packet
+    np->owner = NULL;
+    np->refs = 1;
     o->current_packet = np;
     
-    // copy packet
-    if (copy_len > 0) {
-        memcpy((uint8_t *)(np + 1) + copy_offset, (uint8_t *)(p + 1) + copy_offset, copy_len);
+    // share data; always from the packet which holds it
+    if (share) {
+        struct RouteBuffer_packet *sp = (p->shared ? p->shared : p);
+        sp->refs++;
+        np->shared = sp;
+        np->share_offset = o->share_offset;
     }
     
     // start sending if required
@@ -254,3 +433,10 @@ int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int
     
     return 1;
 }
+
+void RouteBufferSource_Unshare (RouteBufferSource *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    unshare_packet(o->current_packet);
+}
@@ -35,23 +35,59 @@
 #define BADVPN_FLOW_ROUTEBUFFER_H
 
 #include <misc/debug.h>
+#include <misc/debugcounter.h>
 #include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <flow/PacketPassInterface.h>
 
 struct RouteBuffer_packet {
     LinkedList1Node node;
+    struct RouteBuffer_s *owner;
+    int refs;
+    int offset;
     int len;
+    struct RouteBuffer_packet *shared;
+    int share_offset;
 };
 
+/**
+ * Shared supply of free packets for {@link RouteBuffer}'s.
+ * 
+ * A buffer using a pool holds no free packets of its own; it takes them from
+ * the pool as packets are routed to it and returns them when they are sent.
+ * This way many buffers which are mostly empty can share the memory of a few
+ * packets, while each is still limited to its own size.
+ * The pool starts empty and allocates packets as they are needed, up to its
+ * size; packets are then kept for reuse until the pool is freed.
+ */
+typedef struct {
+    int mtu;
+    int max_packets;
+    int num_packets;
+    LinkedList1 packets_free;
+    DebugObject d_obj;
+    DebugCounter d_ctr;
+} RouteBufferPool;
+
 /**
  * Packet buffer for zero-copy packet routing.
  * 
  * Packets are buffered using {@link RouteBufferSource} objects.
+ * 
+ * A buffered packet may take its data from some offset on from another
+ * packet, which can be in a different buffer; see {@link RouteBufferSource_Route}.
+ * Such a packet is passed to the output as a vectored send if the output
+ * supports it, and otherwise the shared data is copied in front of sending.
+ * Packets whose data is still shared when they are done are given up by the
+ * buffer and replaced with newly allocated ones, so that a slow buffer
+ * doesn't hold up others.
  */
-typedef struct {
+typedef struct RouteBuffer_s {
     int mtu;
     PacketPassInterface *output;
+    RouteBufferPool *pool;
+    int buf_size;
+    int num_used;
     LinkedList1 packets_free;
     LinkedList1 packets_used;
     DebugObject d_obj;
@@ -65,6 +101,7 @@ typedef struct {
  */
 typedef struct {
     int mtu;
+    int share_offset;
     struct RouteBuffer_packet *current_packet;
     DebugObject d_obj;
 } RouteBufferSource;
@@ -81,11 +118,41 @@ typedef struct {
  */
 int RouteBuffer_Init (RouteBuffer *o, int mtu, PacketPassInterface *output, int buf_size) WARN_UNUSED;
 
+/**
+ * Initializes the object to take its packets from a pool.
+ * Routing to the buffer fails when it holds buf_size packets, or when the
+ * pool has no free packets and cannot allocate more.
+ * 
+ * @param o the object
+ * @param pool pool to take packets from. The buffer's MTU is the MTU of the pool.
+ * @param output output interface. Its MTU must be >= MTU of the pool.
+ * @param buf_size maximum number of packets in the buffer. Must be >0.
+ */
+void RouteBuffer_InitPool (RouteBuffer *o, RouteBufferPool *pool, PacketPassInterface *output, int buf_size);
+
 /**
  * Frees the object.
  */
 void RouteBuffer_Free (RouteBuffer *o);
 
+/**
+ * Initializes the pool.
+ * No packets are allocated yet.
+ * 
+ * @param o the object
+ * @param mtu maximum packet size. Must be >=0.
+ * @param max_packets maximum number of packets in the pool. Must be >0.
+ */
+void RouteBufferPool_Init (RouteBufferPool *o, int mtu, int max_packets);
+
+/**
+ * Frees the pool.
+ * There must be no {@link RouteBuffer}'s using the pool.
+ * 
+ * @param o the object
+ */
+void RouteBufferPool_Free (RouteBufferPool *o);
+
 /**
  * Retuns the buffer's MTU (mtu argument to {@link RouteBuffer_Init}).
  * 
@@ -99,9 +166,11 @@ int RouteBuffer_GetMTU (RouteBuffer *o);
  * @param o the object
  * @param mtu maximum packet size. Must be >=0. The object will only be able to route packets
  *            to {@link RouteBuffer}'s with the same MTU.
+ * @param share_offset offset from which packet data can be shared between routed
+ *                     packets; see {@link RouteBufferSource_Route}. Must be >=0 and <=mtu.
  * @return 1 on success, 0 on failure
  */
-int RouteBufferSource_Init (RouteBufferSource *o, int mtu) WARN_UNUSED;
+int RouteBufferSource_Init (RouteBufferSource *o, int mtu, int share_offset) WARN_UNUSED;
 
 /**
  * Frees the object.
@@ -113,6 +182,8 @@ void RouteBufferSource_Free (RouteBufferSource *o);
 /**
  * Returns a pointer to the current packet.
  * The pointed to memory area will have space for MTU bytes.
+ * If the current packet shares data (see {@link RouteBufferSource_Route}), only
+ * the first share_offset bytes of this area are part of the packet.
  * The pointer is only valid until {@link RouteBufferSource_Route} succeeds.
  * 
  * @param o the object
@@ -125,15 +196,35 @@ uint8_t * RouteBufferSource_Pointer (RouteBufferSource *o);
  * On success, this invalidates the pointer previously returned from
  * {@link RouteBufferSource_Pointer}.
  * 
+ * If share is 1, the new current packet will share the data of the routed packet
+ * from share_offset on, instead of having it copied. The shared data must not be
+ * modified. Only the first share_offset bytes of the new current packet need to be
+ * written before it is routed, and it must be routed with the same length.
+ * The sharing ends when the new current packet is routed with share=0, or when
+ * {@link RouteBufferSource_Unshare} is called.
+ * 
+ * The packet may begin at an offset into the memory area, so that packets sharing
+ * data can have leading parts of different lengths.
+ * 
  * @param o the object
- * @param len length of the packet. Must be >=0 and <=MTU.
+ * @param offset offset where the packet begins. Must be >=0 and <=len. If the current
+ *               packet shares data, or share is 1, must be <=share_offset.
+ * @param len length of the packet including the offset. Must be <=MTU. If the current packet
+ *            shares data, must be the length of the packet it shares data with.
  * @param b buffer to route to. Its MTU must equal this object's MTU.
- * @param copy_offset Offset from the beginning for copying. Must be >=0 and
- *                    <=mtu.
- * @param copy_len Number of bytes to copy from the old current packet to the new one.
- *                 Must be >=0 and <= mtu - copy_offset.
+ * @param share whether the new current packet should share data with the routed
+ *              one. Must be 0 or 1. If 1, len must be >=share_offset.
  * @return 1 on success, 0 on failure
  */
-int RouteBufferSource_Route (RouteBufferSource *o, int len, RouteBuffer *b, int copy_offset, int copy_len);
+int RouteBufferSource_Route (RouteBufferSource *o, int offset, int len, RouteBuffer *b, int share);
+
+/**
+ * Makes the current packet stop sharing data with previously routed packets,
+ * if it does. After this the whole memory area at {@link RouteBufferSource_Pointer}
+ * belongs to the current packet.
+ * 
+ * @param o the object
+ */
+void RouteBufferSource_Unshare (RouteBufferSource *o);
 
 #endif
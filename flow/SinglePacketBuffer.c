@@ -30,7 +30,7 @@
 #include <stdlib.h>
 
 #include <misc/debug.h>
-#include <misc/balloc.h>
+#include <base/BBufferArena.h>
 
 #include <flow/SinglePacketBuffer.h>
 
@@ -61,9 +61,10 @@ int SinglePacketBuffer_Init (SinglePacketBuffer *o, PacketRecvInterface *input,
     
     // init output
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    PacketPassInterface_Sender_EnableDirect(o->output);
     
     // init buffer
-    if (!(o->buf = (uint8_t *)BAlloc(PacketRecvInterface_GetMTU(o->input)))) {
+    if (!(o->buf = (uint8_t *)BBufferArena_Alloc(PacketRecvInterface_GetMTU(o->input)))) {
         goto fail1;
     }
     
@@ -83,5 +84,5 @@ void SinglePacketBuffer_Free (SinglePacketBuffer *o)
     DebugObject_Free(&o->d_obj);
     
     // free buffer
-    BFree(o->buf);
+    BBufferArena_Free(o->buf);
 }
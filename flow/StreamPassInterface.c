@@ -38,6 +38,10 @@ void _StreamPassInterface_job_operation (StreamPassInterface *i)
     i->state = SPI_STATE_BUSY;
     
     // call handler
+    if (i->job_operation_num_bufs > 0) {
+        i->handler_operation_v(i->user_provider, i->job_operation_bufs, i->job_operation_num_bufs);
+        return;
+    }
     i->handler_operation(i->user_provider, i->job_operation_data, i->job_operation_len);
     return;
 }
@@ -30,6 +30,12 @@
  * 
  * Interface allowing a stream sender to pass stream data to a stream receiver.
  * 
+ * A receiver may additionally accept vectored sends, enabled with
+ * {@link StreamPassInterface_EnableSendV} before the sender is initialized.
+ * A sender can then check {@link StreamPassInterface_HasSendV} and pass up to
+ * SPI_MAX_BUFS buffers in one operation; they are treated as one contiguous
+ * piece of data, and Done may report any prefix of it.
+ * 
  * Note that this interface behaves exactly the same and has the same code as
  * {@link StreamRecvInterface} if names and its external semantics are disregarded.
  * If you modify this file, you should probably modify {@link StreamRecvInterface}
@@ -41,6 +47,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <limits.h>
 
 #include <misc/debug.h>
 #include <base/DebugObject.h>
@@ -51,13 +58,26 @@
 #define SPI_STATE_BUSY 3
 #define SPI_STATE_DONE_PENDING 4
 
+#define SPI_MAX_BUFS 8
+
+/**
+ * One buffer of a vectored send; see {@link StreamPassInterface_Sender_SendV}.
+ */
+struct StreamPassInterface_buf {
+    uint8_t *data;
+    int len;
+};
+
 typedef void (*StreamPassInterface_handler_send) (void *user, uint8_t *data, int data_len);
 
+typedef void (*StreamPassInterface_handler_sendv) (void *user, const struct StreamPassInterface_buf *bufs, int num_bufs);
+
 typedef void (*StreamPassInterface_handler_done) (void *user, int data_len);
 
 typedef struct {
     // provider data
     StreamPassInterface_handler_send handler_operation;
+    StreamPassInterface_handler_sendv handler_operation_v;
     void *user_provider;
     
     // user data
@@ -68,6 +88,8 @@ typedef struct {
     BPending job_operation;
     uint8_t *job_operation_data;
     int job_operation_len;
+    struct StreamPassInterface_buf job_operation_bufs[SPI_MAX_BUFS];
+    int job_operation_num_bufs;
     
     // done job
     BPending job_done;
@@ -83,12 +105,18 @@ static void StreamPassInterface_Init (StreamPassInterface *i, StreamPassInterfac
 
 static void StreamPassInterface_Free (StreamPassInterface *i);
 
+static void StreamPassInterface_EnableSendV (StreamPassInterface *i, StreamPassInterface_handler_sendv handler_operation_v);
+
 static void StreamPassInterface_Done (StreamPassInterface *i, int data_len);
 
 static void StreamPassInterface_Sender_Init (StreamPassInterface *i, StreamPassInterface_handler_done handler_done, void *user);
 
 static void StreamPassInterface_Sender_Send (StreamPassInterface *i, uint8_t *data, int data_len);
 
+static void StreamPassInterface_Sender_SendV (StreamPassInterface *i, const struct StreamPassInterface_buf *bufs, int num_bufs);
+
+static int StreamPassInterface_HasSendV (StreamPassInterface *i);
+
 void _StreamPassInterface_job_operation (StreamPassInterface *i);
 void _StreamPassInterface_job_done (StreamPassInterface *i);
 
@@ -98,6 +126,9 @@ void StreamPassInterface_Init (StreamPassInterface *i, StreamPassInterface_handl
     i->handler_operation = handler_operation;
     i->user_provider = user;
     
+    // set no vectored sends
+    i->handler_operation_v = NULL;
+    
     // set no user
     i->handler_done = NULL;
     
@@ -120,6 +151,16 @@ void StreamPassInterface_Free (StreamPassInterface *i)
     BPending_Free(&i->job_operation);
 }
 
+void StreamPassInterface_EnableSendV (StreamPassInterface *i, StreamPassInterface_handler_sendv handler_operation_v)
+{
+    ASSERT(handler_operation_v)
+    ASSERT(!i->handler_operation_v)
+    ASSERT(!i->handler_done)
+    DebugObject_Access(&i->d_obj);
+    
+    i->handler_operation_v = handler_operation_v;
+}
+
 void StreamPassInterface_Done (StreamPassInterface *i, int data_len)
 {
     ASSERT(i->state == SPI_STATE_BUSY)
@@ -156,10 +197,47 @@ void StreamPassInterface_Sender_Send (StreamPassInterface *i, uint8_t *data, int
     // schedule operation
     i->job_operation_data = data;
     i->job_operation_len = data_len;
+    i->job_operation_num_bufs = 0;
+    BPending_Set(&i->job_operation);
+    
+    // set state
+    i->state = SPI_STATE_OPERATION_PENDING;
+}
+
+void StreamPassInterface_Sender_SendV (StreamPassInterface *i, const struct StreamPassInterface_buf *bufs, int num_bufs)
+{
+    ASSERT(i->handler_operation_v)
+    ASSERT(num_bufs > 0)
+    ASSERT(num_bufs <= SPI_MAX_BUFS)
+    ASSERT(i->state == SPI_STATE_NONE)
+    ASSERT(i->handler_done)
+    DebugObject_Access(&i->d_obj);
+    
+    // remember buffers, so the caller's array need not stay around
+    int total = 0;
+    for (int j = 0; j < num_bufs; j++) {
+        ASSERT(bufs[j].data)
+        ASSERT(bufs[j].len > 0)
+        ASSERT(bufs[j].len <= INT_MAX - total)
+        i->job_operation_bufs[j] = bufs[j];
+        total += bufs[j].len;
+    }
+    
+    // schedule operation
+    i->job_operation_data = NULL;
+    i->job_operation_len = total;
+    i->job_operation_num_bufs = num_bufs;
     BPending_Set(&i->job_operation);
     
     // set state
     i->state = SPI_STATE_OPERATION_PENDING;
 }
 
+int StreamPassInterface_HasSendV (StreamPassInterface *i)
+{
+    DebugObject_Access(&i->d_obj);
+    
+    return !!i->handler_operation_v;
+}
+
 #endif
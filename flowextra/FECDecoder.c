@@ -0,0 +1,288 @@
+/**
+ * @file FECDecoder.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include <misc/byteorder.h>
+#include <misc/balloc.h>
+#include <misc/minmax.h>
+
+#include "FECDecoder.h"
+
+#include <generated/blog_channel_FECDecoder.h>
+
+#define PeerLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
+
+static uint32_t group_mask (int count)
+{
+    ASSERT(count > 0)
+    ASSERT(count <= FECPROTO_MAX_GROUP_SIZE)
+    
+    return (count == 32 ? UINT32_MAX : ((uint32_t)1 << count) - 1);
+}
+
+static struct FECDecoder_group * get_group (FECDecoder *o, uint16_t id)
+{
+    struct FECDecoder_group *g = &o->groups[id % FECDECODER_NUM_GROUPS];
+    
+    if (g->used) {
+        if (g->id == id) {
+            return g;
+        }
+        
+        // the slot is taken by a newer group, this one is too old
+        if ((int16_t)(id - g->id) < 0) {
+            return NULL;
+        }
+        
+        // clear the older group's data
+        memset(g->acc, 0, g->len);
+    }
+    
+    // start group
+    g->used = 1;
+    g->id = id;
+    g->received = 0;
+    g->num_received = 0;
+    g->count = -1;
+    g->len = 0;
+    g->len_xor = 0;
+    
+    return g;
+}
+
+static void group_add (struct FECDecoder_group *g, uint8_t *data, int data_len)
+{
+    for (int i = 0; i < data_len; i++) {
+        g->acc[i] ^= data[i];
+    }
+    g->len = bmax_int(g->len, data_len);
+}
+
+static int group_recoverable (struct FECDecoder_group *g)
+{
+    return (g->count > 0 && g->num_received == g->count - 1);
+}
+
+static int group_recover (FECDecoder *o, struct FECDecoder_group *g)
+{
+    ASSERT(group_recoverable(g))
+    
+    // find missing packet
+    int index = 0;
+    while (g->received & ((uint32_t)1 << index)) {
+        index++;
+    }
+    ASSERT(index < g->count)
+    
+    // mark it received, so that it's dropped if it arrives later
+    g->received |= ((uint32_t)1 << index);
+    g->num_received++;
+    
+    // the lengths of the other packets cancel out
+    int len = g->len_xor;
+    if (len > g->len) {
+        PeerLog(o, BLOG_INFO, "recovered packet is too long");
+        return -1;
+    }
+    
+    return len;
+}
+
+static void input_handler_send (FECDecoder *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= sizeof(struct fecproto_header) + o->output_mtu)
+    ASSERT(!o->recover_group)
+    
+    if (data_len < sizeof(struct fecproto_header)) {
+        PeerLog(o, BLOG_INFO, "packet is too short");
+        goto done;
+    }
+    
+    struct fecproto_header header;
+    memcpy(&header, data, sizeof(header));
+    uint16_t group_id = ltoh16(header.group_id);
+    int index = ltoh8(header.index);
+    int count = ltoh8(header.count);
+    uint16_t len_xor = ltoh16(header.len_xor);
+    
+    uint8_t *payload = data + sizeof(struct fecproto_header);
+    int payload_len = data_len - sizeof(struct fecproto_header);
+    
+    if (index == FECPROTO_INDEX_PARITY) {
+        if (count == 0 || count > FECPROTO_MAX_GROUP_SIZE) {
+            PeerLog(o, BLOG_INFO, "parity packet has wrong count");
+            goto done;
+        }
+        
+        // ignore parity of a group too old, and duplicate parity
+        struct FECDecoder_group *g = get_group(o, group_id);
+        if (!g || g->count >= 0) {
+            goto done;
+        }
+        
+        if ((g->received & ~group_mask(count))) {
+            PeerLog(o, BLOG_INFO, "parity packet count does not match packets");
+            goto done;
+        }
+        
+        // add parity to group
+        g->count = count;
+        group_add(g, payload, payload_len);
+        g->len_xor ^= len_xor;
+        
+        // recover the missing packet if it's the only one
+        if (group_recoverable(g)) {
+            int len = group_recover(o, g);
+            if (len >= 0) {
+                PacketPassInterface_Sender_Send(o->output, g->acc, len);
+                return;
+            }
+        }
+        
+        goto done;
+    }
+    
+    if (index >= FECPROTO_MAX_GROUP_SIZE) {
+        PeerLog(o, BLOG_INFO, "packet has wrong index");
+        goto done;
+    }
+    
+    // pass on packets of groups too old to track as they are
+    struct FECDecoder_group *g = get_group(o, group_id);
+    if (g) {
+        if (g->count >= 0 && index >= g->count) {
+            PeerLog(o, BLOG_INFO, "packet index does not match parity count");
+            goto done;
+        }
+        
+        // drop duplicate
+        if ((g->received & ((uint32_t)1 << index))) {
+            goto done;
+        }
+        
+        // add packet to group
+        g->received |= ((uint32_t)1 << index);
+        g->num_received++;
+        group_add(g, payload, payload_len);
+        g->len_xor ^= payload_len;
+        
+        // recover the missing packet after passing this one on
+        if (group_recoverable(g)) {
+            o->recover_group = g;
+        }
+    }
+    
+    PacketPassInterface_Sender_Send(o->output, payload, payload_len);
+    return;
+    
+done:
+    PacketPassInterface_Done(&o->input);
+}
+
+static void output_handler_done (FECDecoder *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // pass on recovered packet
+    if (o->recover_group) {
+        struct FECDecoder_group *g = o->recover_group;
+        o->recover_group = NULL;
+        
+        int len = group_recover(o, g);
+        if (len >= 0) {
+            PacketPassInterface_Sender_Send(o->output, g->acc, len);
+            return;
+        }
+    }
+    
+    PacketPassInterface_Done(&o->input);
+}
+
+int FECDecoder_Init (FECDecoder *o, PacketPassInterface *output, BPendingGroup *pg, void *user, BLog_logfunc logfunc)
+{
+    ASSERT(PacketPassInterface_GetMTU(output) <= INT_MAX - sizeof(struct fecproto_header))
+    
+    // init arguments
+    o->output = output;
+    o->user = user;
+    o->logfunc = logfunc;
+    
+    // remember output MTU
+    o->output_mtu = PacketPassInterface_GetMTU(o->output);
+    
+    // init input
+    PacketPassInterface_Init(&o->input, sizeof(struct fecproto_header) + o->output_mtu, (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    // allocate group buffers
+    if (!(o->groups_buffer = (uint8_t *)BAllocArray(FECDECODER_NUM_GROUPS, o->output_mtu))) {
+        goto fail1;
+    }
+    memset(o->groups_buffer, 0, (size_t)FECDECODER_NUM_GROUPS * o->output_mtu);
+    
+    // init groups
+    for (int i = 0; i < FECDECODER_NUM_GROUPS; i++) {
+        o->groups[i].used = 0;
+        o->groups[i].acc = o->groups_buffer + (size_t)i * o->output_mtu;
+    }
+    
+    // have no packet to recover
+    o->recover_group = NULL;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    PacketPassInterface_Free(&o->input);
+    return 0;
+}
+
+void FECDecoder_Free (FECDecoder *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free group buffers
+    BFree(o->groups_buffer);
+    
+    // free input
+    PacketPassInterface_Free(&o->input);
+}
+
+PacketPassInterface * FECDecoder_GetInput (FECDecoder *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->input;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file FECDecoder.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Object which decodes FECProto packets, recovering lost packets.
+ */
+
+#ifndef BADVPN_FLOWEXTRA_FECDECODER_H
+#define BADVPN_FLOWEXTRA_FECDECODER_H
+
+#include <stdint.h>
+
+#include <protocol/fecproto.h>
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <base/BLog.h>
+#include <flow/PacketPassInterface.h>
+
+/**
+ * Number of groups the decoder keeps track of. Must be a power of two.
+ */
+#define FECDECODER_NUM_GROUPS 16
+
+struct FECDecoder_group {
+    int used; // whether the group entry is used
+    // everything below only defined when group entry is used
+    uint16_t id; // group identifier
+    uint32_t received; // bitmap of received or recovered packets
+    int num_received; // number of bits set in received
+    int count; // number of packets in the group, or -1 if the parity packet wasn't received
+    int len; // length of the longest packet received, bytes of acc after this are zero
+    uint16_t len_xor; // XOR of the lengths of received packets and len_xor of the parity packet
+    uint8_t *acc; // XOR of received packets and the parity packet, size output_mtu
+};
+
+/**
+ * Object which decodes FECProto packets, recovering lost packets.
+ * A packet is recovered when the parity packet and all other packets of its
+ * group have been received. Duplicate packets are dropped.
+ *
+ * Input is with {@link PacketPassInterface}.
+ * Output is with {@link PacketPassInterface}.
+ */
+typedef struct {
+    void *user;
+    BLog_logfunc logfunc;
+    PacketPassInterface input;
+    PacketPassInterface *output;
+    int output_mtu;
+    struct FECDecoder_group groups[FECDECODER_NUM_GROUPS];
+    uint8_t *groups_buffer;
+    struct FECDecoder_group *recover_group;
+    DebugObject d_obj;
+} FECDecoder;
+
+/**
+ * Initializes the object.
+ * {@link BLog_Init} must have been done.
+ *
+ * @param o the object
+ * @param output output interface. Its MTU must be <= INT_MAX - sizeof(struct fecproto_header).
+ * @param pg pending group
+ * @param user argument to handlers
+ * @param logfunc function which prepends the log prefix using {@link BLog_Append}
+ * @return 1 on success, 0 on failure
+ */
+int FECDecoder_Init (FECDecoder *o, PacketPassInterface *output, BPendingGroup *pg, void *user, BLog_logfunc logfunc) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ *
+ * @param o the object
+ */
+void FECDecoder_Free (FECDecoder *o);
+
+/**
+ * Returns the input interface.
+ * The MTU of the input interface will be the output MTU plus
+ * sizeof(struct fecproto_header).
+ *
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * FECDecoder_GetInput (FECDecoder *o);
+
+#endif
@@ -0,0 +1,269 @@
+/**
+ * @file FECEncoder.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include <misc/byteorder.h>
+#include <misc/balloc.h>
+#include <misc/minmax.h>
+
+#include "FECEncoder.h"
+
+static void xor_into (uint8_t *dst, const uint8_t *src, int len)
+{
+    for (int i = 0; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+static void write_header (uint8_t *out, uint16_t group_id, int index, int count, uint16_t len_xor)
+{
+    struct fecproto_header header;
+    header.group_id = htol16(group_id);
+    header.index = htol8(index);
+    header.count = htol8(count);
+    header.len_xor = htol16(len_xor);
+    memcpy(out, &header, sizeof(header));
+}
+
+static void output_parity (FECEncoder *o)
+{
+    ASSERT(o->out)
+    ASSERT(o->parity_pending)
+    ASSERT(o->group_count > 0)
+    
+    uint8_t *out = o->out;
+    int out_len = sizeof(struct fecproto_header) + o->parity_len;
+    
+    // write parity packet
+    write_header(out, o->group_id, FECPROTO_INDEX_PARITY, o->group_count, o->len_xor);
+    memcpy(out + sizeof(struct fecproto_header), o->parity, o->parity_len);
+    
+    // start next group
+    memset(o->parity, 0, o->parity_len);
+    o->parity_len = 0;
+    o->len_xor = 0;
+    o->group_id++;
+    o->group_count = 0;
+    o->parity_pending = 0;
+    
+    // set no output packet
+    o->out = NULL;
+    
+    // finish output
+    PacketRecvInterface_Done(&o->output, out_len);
+}
+
+static void output_packet (FECEncoder *o)
+{
+    ASSERT(o->out)
+    ASSERT(o->in_len >= 0)
+    ASSERT(!o->parity_pending)
+    ASSERT(o->group_count < o->group_size)
+    
+    uint8_t *out = o->out;
+    int out_len = sizeof(struct fecproto_header) + o->in_len;
+    
+    // write packet
+    write_header(out, o->group_id, o->group_count, 0, 0);
+    memcpy(out + sizeof(struct fecproto_header), o->in_buf, o->in_len);
+    
+    // add it to parity
+    xor_into(o->parity, o->in_buf, o->in_len);
+    o->parity_len = bmax_int(o->parity_len, o->in_len);
+    o->len_xor ^= o->in_len;
+    o->group_count++;
+    
+    if (o->group_count == o->group_size) {
+        // group is complete, send parity next
+        o->parity_pending = 1;
+        BReactor_RemoveTimer(o->reactor, &o->timer);
+    } else {
+        // close group if nothing more comes soon
+        BReactor_SetTimer(o->reactor, &o->timer);
+    }
+    
+    // set no input packet
+    o->in_len = -1;
+    
+    // set no output packet
+    o->out = NULL;
+    
+    // finish output
+    PacketRecvInterface_Done(&o->output, out_len);
+}
+
+static void output_handler_recv (FECEncoder *o, uint8_t *data)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->out)
+    ASSERT(data)
+    
+    // set output packet
+    o->out = data;
+    
+    // send parity packet if a group was completed
+    if (o->parity_pending) {
+        output_parity(o);
+        return;
+    }
+    
+    // send input packet if we already have one
+    if (o->in_len >= 0) {
+        output_packet(o);
+        return;
+    }
+    
+    // receive input packet
+    if (!o->in_receiving) {
+        o->in_receiving = 1;
+        PacketRecvInterface_Receiver_Recv(o->input, o->in_buf);
+    }
+}
+
+static void input_handler_done (FECEncoder *o, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->in_receiving)
+    ASSERT(o->in_len == -1)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->input_mtu)
+    
+    // set input packet
+    o->in_receiving = 0;
+    o->in_len = data_len;
+    
+    // send it if output is waiting
+    if (o->out) {
+        ASSERT(!o->parity_pending)
+        output_packet(o);
+        return;
+    }
+}
+
+static void timer_handler (FECEncoder *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->group_count > 0)
+    ASSERT(o->group_count < o->group_size)
+    ASSERT(!o->parity_pending)
+    
+    // close the incomplete group
+    o->parity_pending = 1;
+    
+    // send parity packet if output is waiting
+    if (o->out) {
+        output_parity(o);
+        return;
+    }
+}
+
+int FECEncoder_Init (FECEncoder *o, BReactor *reactor, PacketRecvInterface *input, int group_size, btime_t flush_latency)
+{
+    ASSERT(PacketRecvInterface_GetMTU(input) <= INT_MAX - sizeof(struct fecproto_header))
+    ASSERT(group_size > 0)
+    ASSERT(group_size <= FECPROTO_MAX_GROUP_SIZE)
+    ASSERT(flush_latency >= 0)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->input = input;
+    o->group_size = group_size;
+    
+    // remember input MTU
+    o->input_mtu = PacketRecvInterface_GetMTU(o->input);
+    
+    // init input
+    PacketRecvInterface_Receiver_Init(o->input, (PacketRecvInterface_handler_done)input_handler_done, o);
+    
+    // init output
+    PacketRecvInterface_Init(&o->output, sizeof(struct fecproto_header) + o->input_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, BReactor_PendingGroup(o->reactor));
+    
+    // init timer
+    BTimer_Init(&o->timer, flush_latency, (BTimer_handler)timer_handler, o);
+    
+    // allocate input buffer
+    if (!(o->in_buf = (uint8_t *)BAlloc(o->input_mtu))) {
+        goto fail1;
+    }
+    
+    // allocate parity buffer
+    if (!(o->parity = (uint8_t *)BAlloc(o->input_mtu))) {
+        goto fail2;
+    }
+    memset(o->parity, 0, o->input_mtu);
+    
+    // have no input packet
+    o->in_len = -1;
+    o->in_receiving = 0;
+    
+    // have no output packet
+    o->out = NULL;
+    
+    // start first group
+    o->parity_len = 0;
+    o->len_xor = 0;
+    o->group_id = 0;
+    o->group_count = 0;
+    o->parity_pending = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail2:
+    BFree(o->in_buf);
+fail1:
+    PacketRecvInterface_Free(&o->output);
+    return 0;
+}
+
+void FECEncoder_Free (FECEncoder *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free timer
+    BReactor_RemoveTimer(o->reactor, &o->timer);
+    
+    // free parity buffer
+    BFree(o->parity);
+    
+    // free input buffer
+    BFree(o->in_buf);
+    
+    // free output
+    PacketRecvInterface_Free(&o->output);
+}
+
+PacketRecvInterface * FECEncoder_GetOutput (FECEncoder *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->output;
+}
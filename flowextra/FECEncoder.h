@@ -0,0 +1,104 @@
+/**
+ * @file FECEncoder.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Object which adds FECProto parity packets to a stream of packets.
+ */
+
+#ifndef BADVPN_FLOWEXTRA_FECENCODER_H
+#define BADVPN_FLOWEXTRA_FECENCODER_H
+
+#include <stdint.h>
+
+#include <protocol/fecproto.h>
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <system/BTime.h>
+#include <flow/PacketRecvInterface.h>
+
+/**
+ * Object which adds FECProto parity packets to a stream of packets.
+ *
+ * Input is with {@link PacketRecvInterface}.
+ * Output is with {@link PacketRecvInterface}.
+ */
+typedef struct {
+    BReactor *reactor;
+    PacketRecvInterface *input;
+    int input_mtu;
+    int group_size;
+    PacketRecvInterface output;
+    BTimer timer;
+    uint8_t *in_buf;
+    int in_len;
+    int in_receiving;
+    uint8_t *out;
+    uint8_t *parity;
+    int parity_len;
+    uint16_t len_xor;
+    uint16_t group_id;
+    int group_count;
+    int parity_pending;
+    DebugObject d_obj;
+} FECEncoder;
+
+/**
+ * Initializes the object.
+ *
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param input input interface. Its MTU must be <= INT_MAX - sizeof(struct fecproto_header).
+ * @param group_size number of packets covered by a parity packet.
+ *                   Must be >0 and <={@link FECPROTO_MAX_GROUP_SIZE}.
+ * @param flush_latency if no packet comes for this long after a packet, the parity
+ *                      packet of the incomplete group is sent. Must be >=0.
+ * @return 1 on success, 0 on failure
+ */
+int FECEncoder_Init (FECEncoder *o, BReactor *reactor, PacketRecvInterface *input, int group_size, btime_t flush_latency) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ *
+ * @param o the object
+ */
+void FECEncoder_Free (FECEncoder *o);
+
+/**
+ * Returns the output interface.
+ * The MTU of the output interface will be the input MTU plus
+ * sizeof(struct fecproto_header).
+ *
+ * @param o the object
+ * @return output interface
+ */
+PacketRecvInterface * FECEncoder_GetOutput (FECEncoder *o);
+
+#endif
@@ -50,10 +50,10 @@ int KeepaliveIO_Init (KeepaliveIO *o, BReactor *reactor, PacketPassInterface *ou
     PacketPassInactivityMonitor_Init(&o->kasender, output, o->reactor, keepalive_interval_ms, (PacketPassInactivityMonitor_handler)keepalive_handler, o);
     
     // init queue
-    PacketPassPriorityQueue_Init(&o->queue, PacketPassInactivityMonitor_GetInput(&o->kasender), BReactor_PendingGroup(o->reactor), 0);
+    PacketPassPriorityQueue_InitLevels(&o->queue, PacketPassInactivityMonitor_GetInput(&o->kasender), BReactor_PendingGroup(o->reactor), 0, 2);
     
     // init keepalive flow
-    PacketPassPriorityQueueFlow_Init(&o->ka_qflow, &o->queue, -1);
+    PacketPassPriorityQueueFlow_Init(&o->ka_qflow, &o->queue, 0);
     
     // init keepalive blocker
     PacketRecvBlocker_Init(&o->ka_blocker, keepalive_input, BReactor_PendingGroup(reactor));
@@ -64,7 +64,7 @@ int KeepaliveIO_Init (KeepaliveIO *o, BReactor *reactor, PacketPassInterface *ou
     }
     
     // init user flow
-    PacketPassPriorityQueueFlow_Init(&o->user_qflow, &o->queue, 0);
+    PacketPassPriorityQueueFlow_Init(&o->user_qflow, &o->queue, 1);
     
     DebugObject_Init(&o->d_obj);
     
@@ -0,0 +1,224 @@
+/**
+ * @file PacketPassCoDel.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <misc/balloc.h>
+
+#include "PacketPassCoDel.h"
+
+static uint32_t isqrt (uint32_t x)
+{
+    uint32_t r = 0;
+    uint32_t bit = (uint32_t)1 << 30;
+    
+    while (bit > x) {
+        bit >>= 2;
+    }
+    
+    while (bit != 0) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    
+    return r;
+}
+
+static btime_t control_law (PacketPassCoDel *o, btime_t t)
+{
+    ASSERT(o->count > 0)
+    
+    // drops get closer together as the square root of their number
+    btime_t next = o->interval / isqrt(o->count);
+    
+    return t + (next > 0 ? next : 1);
+}
+
+static int should_drop (PacketPassCoDel *o)
+{
+    ASSERT(o->num_queued > 0)
+    
+    btime_t now = btime_gettime();
+    
+    // take queue time of the packet
+    btime_t sojourn = now - o->queued_times[o->queued_start];
+    o->queued_start = (o->queued_start + 1) % o->max_queued;
+    o->num_queued--;
+    
+    // check if sojourn time has been above target for an interval
+    int ok_to_drop = 0;
+    if (sojourn < o->target || o->num_queued == 0) {
+        o->first_above_time = 0;
+    } else if (o->first_above_time == 0) {
+        o->first_above_time = now + o->interval;
+    } else if (now >= o->first_above_time) {
+        ok_to_drop = 1;
+    }
+    
+    if (o->dropping) {
+        if (!ok_to_drop) {
+            // sojourn time went below target, leave dropping state
+            o->dropping = 0;
+            return 0;
+        }
+        
+        if (now < o->drop_next) {
+            return 0;
+        }
+        
+        // drop, scheduling the next drop sooner
+        o->count++;
+        o->drop_next = control_law(o, o->drop_next);
+        return 1;
+    }
+    
+    if (!ok_to_drop) {
+        return 0;
+    }
+    
+    // enter dropping state; if we were dropping recently, continue at
+    // about the rate we were dropping then
+    o->dropping = 1;
+    uint32_t delta = o->count - o->lastcount;
+    o->count = 1;
+    if (delta > 1 && now - o->drop_next < 16 * o->interval) {
+        o->count = delta;
+    }
+    o->drop_next = control_law(o, now);
+    o->lastcount = o->count;
+    
+    return 1;
+}
+
+static void input_handler_send (PacketPassCoDel *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (should_drop(o)) {
+        PacketPassInterface_Done(&o->input);
+        return;
+    }
+    
+    // schedule send
+    PacketPassInterface_Sender_Send(o->output, data, data_len);
+}
+
+static void input_handler_sendv (PacketPassCoDel *o, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (should_drop(o)) {
+        PacketPassInterface_Done(&o->input);
+        return;
+    }
+    
+    // schedule send
+    PacketPassInterface_Sender_SendV(o->output, bufs, num_bufs);
+}
+
+static void output_handler_done (PacketPassCoDel *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // call done
+    PacketPassInterface_Done(&o->input);
+}
+
+int PacketPassCoDel_Init (PacketPassCoDel *o, PacketPassInterface *output, int max_queued, btime_t target, btime_t interval, BPendingGroup *pg)
+{
+    ASSERT(max_queued > 0)
+    ASSERT(target > 0)
+    ASSERT(interval > 0)
+    
+    // init arguments
+    o->output = output;
+    o->max_queued = max_queued;
+    o->target = target;
+    o->interval = interval;
+    
+    // allocate queue times
+    if (!(o->queued_times = (btime_t *)BAllocArray(o->max_queued, sizeof(o->queued_times[0])))) {
+        goto fail0;
+    }
+    o->queued_start = 0;
+    o->num_queued = 0;
+    
+    // not dropping
+    o->dropping = 0;
+    o->first_above_time = 0;
+    o->drop_next = 0;
+    o->count = 0;
+    o->lastcount = 0;
+    
+    // init input
+    PacketPassInterface_Init(&o->input, PacketPassInterface_GetMTU(o->output), (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    if (PacketPassInterface_HasSendV(o->output)) {
+        PacketPassInterface_EnableSendV(&o->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
+    }
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+void PacketPassCoDel_Free (PacketPassCoDel *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free input
+    PacketPassInterface_Free(&o->input);
+    
+    // free queue times
+    BFree(o->queued_times);
+}
+
+PacketPassInterface * PacketPassCoDel_GetInput (PacketPassCoDel *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->input;
+}
+
+void PacketPassCoDel_Enqueued (PacketPassCoDel *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->num_queued < o->max_queued)
+    
+    // remember when the packet was queued
+    o->queued_times[(o->queued_start + o->num_queued) % o->max_queued] = btime_gettime();
+    o->num_queued++;
+}
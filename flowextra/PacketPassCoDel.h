@@ -0,0 +1,117 @@
+/**
+ * @file PacketPassCoDel.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * A {@link PacketPassInterface} layer which drops packets that waited too long
+ * in the queue in front of it, using the CoDel algorithm.
+ */
+
+#ifndef BADVPN_PACKETPASSCODEL_H
+#define BADVPN_PACKETPASSCODEL_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <system/BTime.h>
+#include <flow/PacketPassInterface.h>
+
+/**
+ * A {@link PacketPassInterface} layer which drops packets that waited too long
+ * in the queue in front of it, using the CoDel algorithm (RFC 8289).
+ * 
+ * The queue in front must pass packets on in the order they were queued, and
+ * the user reports each queued packet with {@link PacketPassCoDel_Enqueued}.
+ * When a packet arrives at the input, the time it spent in the queue is taken
+ * as its sojourn time. Once the sojourn time has stayed above the target for
+ * an interval, packets are dropped at increasing rate until it falls below the
+ * target again. Packets are never dropped when no others are queued behind them.
+ * Dropped packets are finished at the input without being passed on.
+ */
+typedef struct {
+    PacketPassInterface *output;
+    btime_t target;
+    btime_t interval;
+    int max_queued;
+    btime_t *queued_times;
+    int queued_start;
+    int num_queued;
+    int dropping;
+    btime_t first_above_time;
+    btime_t drop_next;
+    uint32_t count;
+    uint32_t lastcount;
+    PacketPassInterface input;
+    DebugObject d_obj;
+} PacketPassCoDel;
+
+/**
+ * Initializes the object.
+ * {@link BTime_Init} must have been done.
+ *
+ * @param o the object
+ * @param output output interface
+ * @param max_queued maximum number of packets in the queue in front. Must be >0.
+ * @param target acceptable sojourn time in milliseconds. Must be >0.
+ * @param interval milliseconds the sojourn time must stay above target before
+ *                 dropping starts; also the initial time between drops. Must be >0.
+ * @param pg pending group
+ * @return 1 on success, 0 on failure
+ */
+int PacketPassCoDel_Init (PacketPassCoDel *o, PacketPassInterface *output, int max_queued, btime_t target, btime_t interval, BPendingGroup *pg) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ *
+ * @param o the object
+ */
+void PacketPassCoDel_Free (PacketPassCoDel *o);
+
+/**
+ * Returns the input interface.
+ * The MTU of the interface will be the same as of the output interface.
+ * The interface supports vectored sends if the output interface supports them.
+ *
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * PacketPassCoDel_GetInput (PacketPassCoDel *o);
+
+/**
+ * Reports that a packet was added to the queue in front.
+ * There must be less than max_queued packets in the queue, not counting
+ * packets which have been passed to the input.
+ *
+ * @param o the object
+ */
+void PacketPassCoDel_Enqueued (PacketPassCoDel *o);
+
+#endif
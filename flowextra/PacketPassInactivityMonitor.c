@@ -33,11 +33,22 @@ static void input_handler_send (PacketPassInactivityMonitor *o, uint8_t *data, i
 {
     DebugObject_Access(&o->d_obj);
     
+    // output busy, the timer will wait for it
+    o->busy = 1;
+    
     // schedule send
     PacketPassInterface_Sender_Send(o->output, data, data_len);
+}
+
+static void input_handler_sendv (PacketPassInactivityMonitor *o, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    DebugObject_Access(&o->d_obj);
     
-    // stop timer
-    BReactor_RemoveTimer(o->reactor, &o->timer);
+    // output busy, the timer will wait for it
+    o->busy = 1;
+    
+    // schedule send
+    PacketPassInterface_Sender_SendV(o->output, bufs, num_bufs);
 }
 
 static void input_handler_requestcancel (PacketPassInactivityMonitor *o)
@@ -52,8 +63,10 @@ static void output_handler_done (PacketPassInactivityMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     
-    // output no longer busy, restart timer
-    BReactor_SetTimer(o->reactor, &o->timer);
+    // output no longer busy; remember the time instead of restarting the
+    // timer, which checks it when it expires
+    o->busy = 0;
+    o->last_activity = BReactor_GetTime(o->reactor);
     
     // call done
     PacketPassInterface_Done(&o->input);
@@ -63,7 +76,26 @@ static void timer_handler (PacketPassInactivityMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     
+    btime_t now = BReactor_GetTime(o->reactor);
+    
+    if (!o->forced) {
+        // a packet is being sent, check again after a full interval
+        if (o->busy) {
+            BReactor_SetTimer(o->reactor, &o->timer);
+            return;
+        }
+        
+        // a packet was sent since the timer was set, wait for the rest of the interval
+        btime_t remaining = o->last_activity + o->interval - now;
+        if (remaining > 0) {
+            BReactor_SetTimerAfter(o->reactor, &o->timer, remaining);
+            return;
+        }
+    }
+    
     // restart timer
+    o->forced = 0;
+    o->last_activity = now;
     BReactor_SetTimer(o->reactor, &o->timer);
     
     // call handler
@@ -78,6 +110,7 @@ void PacketPassInactivityMonitor_Init (PacketPassInactivityMonitor *o, PacketPas
     // init arguments
     o->output = output;
     o->reactor = reactor;
+    o->interval = interval;
     o->handler = handler;
     o->user = user;
     
@@ -86,13 +119,19 @@ void PacketPassInactivityMonitor_Init (PacketPassInactivityMonitor *o, PacketPas
     if (PacketPassInterface_HasCancel(o->output)) {
         PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
     }
+    if (PacketPassInterface_HasSendV(o->output)) {
+        PacketPassInterface_EnableSendV(&o->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
+    }
     
     // init output
     PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
     
     // init timer
-    BTimer_Init(&o->timer, interval, (BTimer_handler)timer_handler, o);
+    BTimer_InitCoarse(&o->timer, interval, (BTimer_handler)timer_handler, o);
     BReactor_SetTimer(o->reactor, &o->timer);
+    o->last_activity = BReactor_GetTime(o->reactor);
+    o->busy = 0;
+    o->forced = 0;
     
     DebugObject_Init(&o->d_obj);
 }
@@ -127,5 +166,6 @@ void PacketPassInactivityMonitor_Force (PacketPassInactivityMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     
+    o->forced = 1;
     BReactor_SetTimerAfter(o->reactor, &o->timer, 0);
 }
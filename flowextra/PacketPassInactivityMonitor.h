@@ -64,6 +64,12 @@ typedef void (*PacketPassInactivityMonitor_handler) (void *user);
  *       passed on to the output.
  *     - When the timer expires, the timer is set, ant the user's handler
  *       function is invoked.
+ *
+ * The timer is not actually touched for every packet. Done only records the
+ * time, and when the timer expires early because of that, it is started again
+ * for what is left of the interval; while the output is busy, it is started
+ * again for a full interval. It is a coarse timer (see {@link BTimer_InitCoarse}),
+ * and may expire somewhat late.
  */
 typedef struct {
     DebugObject d_obj;
@@ -73,6 +79,10 @@ typedef struct {
     void *user;
     PacketPassInterface input;
     BTimer timer;
+    btime_t interval;
+    btime_t last_activity;
+    int busy;
+    int forced;
 } PacketPassInactivityMonitor;
 
 /**
@@ -80,7 +90,8 @@ typedef struct {
  * See {@link PacketPassInactivityMonitor} for details.
  *
  * @param o the object
- * @param output output interface
+ * @param output output interface. If it supports cancel functionality or vectored
+ *               sends, so will the input.
  * @param reactor reactor we live in
  * @param interval timer value in milliseconds
  * @param handler handler function for reporting inactivity, or NULL to disable
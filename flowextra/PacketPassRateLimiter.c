@@ -0,0 +1,222 @@
+/**
+ * @file PacketPassRateLimiter.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <misc/debug.h>
+
+#include "PacketPassRateLimiter.h"
+
+// tokens are kept in thousandths of bytes, so that refilling every
+// millisecond at the given bytes per second rate is exact
+
+static void refill (PacketPassRateLimiter *o)
+{
+    btime_t now = BReactor_GetTime(o->reactor);
+    
+    // time going backwards, or a long pause, fills the bucket
+    if (now < o->last_time || now - o->last_time >= (o->max_tokens - o->tokens) / o->rate + 1) {
+        o->tokens = o->max_tokens;
+    } else {
+        o->tokens += (now - o->last_time) * o->rate;
+        if (o->tokens > o->max_tokens) {
+            o->tokens = o->max_tokens;
+        }
+    }
+    
+    o->last_time = now;
+}
+
+static void try_send (PacketPassRateLimiter *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(!o->out_busy)
+    ASSERT(!BTimer_IsRunning(&o->timer))
+    
+    // not limited
+    if (o->rate == 0) {
+        o->out_busy = 1;
+        PacketPassInterface_Sender_Send(o->output, o->in, o->in_len);
+        return;
+    }
+    
+    refill(o);
+    
+    if (o->tokens <= 0) {
+        // wait until the bucket is no longer empty
+        o->num_delayed++;
+        BReactor_SetTimerAfter(o->reactor, &o->timer, -o->tokens / o->rate + 1);
+        return;
+    }
+    
+    // take packet from the bucket
+    o->tokens -= (int64_t)o->in_len * 1000;
+    
+    // send packet
+    o->out_busy = 1;
+    PacketPassInterface_Sender_Send(o->output, o->in, o->in_len);
+}
+
+static void input_handler_send (PacketPassRateLimiter *o, uint8_t *data, int data_len)
+{
+    ASSERT(o->in_len == -1)
+    ASSERT(data_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember packet
+    o->in = data;
+    o->in_len = data_len;
+    
+    try_send(o);
+}
+
+static void input_handler_requestcancel (PacketPassRateLimiter *o)
+{
+    ASSERT(o->in_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // packet is with the output, request cancel there
+    if (o->out_busy) {
+        PacketPassInterface_Sender_RequestCancel(o->output);
+        return;
+    }
+    
+    // packet is waiting for the bucket, drop it
+    BReactor_RemoveTimer(o->reactor, &o->timer);
+    o->in_len = -1;
+    PacketPassInterface_Done(&o->input);
+}
+
+static void output_handler_done (PacketPassRateLimiter *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(o->out_busy)
+    DebugObject_Access(&o->d_obj);
+    
+    // set no packet
+    o->out_busy = 0;
+    o->in_len = -1;
+    
+    // call done
+    PacketPassInterface_Done(&o->input);
+}
+
+static void timer_handler (PacketPassRateLimiter *o)
+{
+    ASSERT(o->in_len >= 0)
+    ASSERT(!o->out_busy)
+    DebugObject_Access(&o->d_obj);
+    
+    try_send(o);
+}
+
+void PacketPassRateLimiter_Init (PacketPassRateLimiter *o, PacketPassInterface *output, int rate, int burst, BReactor *reactor)
+{
+    ASSERT(rate >= 0)
+    ASSERT(burst > 0)
+    
+    // init arguments
+    o->output = output;
+    o->reactor = reactor;
+    o->rate = rate;
+    
+    // start with a full bucket
+    o->max_tokens = (int64_t)burst * 1000;
+    o->tokens = o->max_tokens;
+    o->last_time = BReactor_GetTime(reactor);
+    
+    // init input
+    PacketPassInterface_Init(&o->input, PacketPassInterface_GetMTU(o->output), (PacketPassInterface_handler_send)input_handler_send, o, BReactor_PendingGroup(o->reactor));
+    if (PacketPassInterface_HasCancel(o->output)) {
+        PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+    }
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    // init timer
+    BTimer_Init(&o->timer, 0, (BTimer_handler)timer_handler, o);
+    
+    // set no packet
+    o->in_len = -1;
+    o->out_busy = 0;
+    
+    // init counters
+    o->num_delayed = 0;
+    
+    DebugObject_Init(&o->d_obj);
+}
+
+void PacketPassRateLimiter_Free (PacketPassRateLimiter *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free timer
+    BReactor_RemoveTimer(o->reactor, &o->timer);
+    
+    // free input
+    PacketPassInterface_Free(&o->input);
+}
+
+PacketPassInterface * PacketPassRateLimiter_GetInput (PacketPassRateLimiter *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->input;
+}
+
+void PacketPassRateLimiter_SetRate (PacketPassRateLimiter *o, int rate, int burst)
+{
+    ASSERT(rate >= 0)
+    ASSERT(burst > 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // account for the time so far at the old rate
+    if (o->rate > 0) {
+        refill(o);
+    }
+    
+    o->rate = rate;
+    o->max_tokens = (int64_t)burst * 1000;
+    if (o->rate == 0 || o->tokens > o->max_tokens) {
+        o->tokens = o->max_tokens;
+    }
+    o->last_time = BReactor_GetTime(o->reactor);
+    
+    // a waiting packet is sent or waits according to the new rate
+    if (BTimer_IsRunning(&o->timer)) {
+        BReactor_RemoveTimer(o->reactor, &o->timer);
+        try_send(o);
+    }
+}
+
+uint64_t PacketPassRateLimiter_GetNumDelayed (PacketPassRateLimiter *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_delayed;
+}
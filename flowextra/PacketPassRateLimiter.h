@@ -0,0 +1,115 @@
+/**
+ * @file PacketPassRateLimiter.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * A {@link PacketPassInterface} layer which limits the data rate with a token bucket.
+ */
+
+#ifndef BADVPN_PACKETPASSRATELIMITER_H
+#define BADVPN_PACKETPASSRATELIMITER_H
+
+#include <stdint.h>
+
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <flow/PacketPassInterface.h>
+
+/**
+ * A {@link PacketPassInterface} layer which limits the data rate with a token bucket.
+ * 
+ * The bucket fills at the configured rate, up to the configured burst size.
+ * A packet is passed on to the output when the bucket is not empty, and its
+ * length is then taken from the bucket, which may make it negative. Otherwise
+ * the packet waits until the bucket has refilled; packets are never dropped.
+ * Since there is no packet size limit, the burst size may be smaller than the MTU.
+ */
+typedef struct {
+    DebugObject d_obj;
+    PacketPassInterface *output;
+    BReactor *reactor;
+    int rate;
+    int64_t max_tokens;
+    int64_t tokens;
+    btime_t last_time;
+    PacketPassInterface input;
+    BTimer timer;
+    uint8_t *in;
+    int in_len;
+    int out_busy;
+    uint64_t num_delayed;
+} PacketPassRateLimiter;
+
+/**
+ * Initializes the object.
+ * The bucket starts full.
+ *
+ * @param o the object
+ * @param output output interface
+ * @param rate rate in bytes per second, or 0 to not limit. Must be >=0.
+ * @param burst bucket size in bytes. Must be >0.
+ * @param reactor reactor we live in
+ */
+void PacketPassRateLimiter_Init (PacketPassRateLimiter *o, PacketPassInterface *output, int rate, int burst, BReactor *reactor);
+
+/**
+ * Frees the object.
+ *
+ * @param o the object
+ */
+void PacketPassRateLimiter_Free (PacketPassRateLimiter *o);
+
+/**
+ * Returns the input interface.
+ * The MTU of the interface will be the same as of the output interface.
+ * The interface supports cancel functionality if the output interface supports it.
+ *
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * PacketPassRateLimiter_GetInput (PacketPassRateLimiter *o);
+
+/**
+ * Changes the rate and the bucket size.
+ * Tokens above the new bucket size are discarded.
+ *
+ * @param o the object
+ * @param rate rate in bytes per second, or 0 to not limit. Must be >=0.
+ * @param burst bucket size in bytes. Must be >0.
+ */
+void PacketPassRateLimiter_SetRate (PacketPassRateLimiter *o, int rate, int burst);
+
+/**
+ * Returns the number of packets which had to wait for the bucket to refill.
+ *
+ * @param o the object
+ * @return number of delayed packets
+ */
+uint64_t PacketPassRateLimiter_GetNumDelayed (PacketPassRateLimiter *o);
+
+#endif
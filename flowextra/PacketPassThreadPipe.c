@@ -0,0 +1,323 @@
+/**
+ * @file PacketPassThreadPipe.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <base/BBufferArena.h>
+
+#include "ThreadPipeWait.h"
+#include "PacketPassThreadPipe.h"
+
+static uint8_t * slot_at (PacketPassThreadPipe *o, unsigned int pos)
+{
+    return o->slots + (size_t)(pos % o->num_packets) * o->slot_size;
+}
+
+static void try_send (PacketPassThreadPipe *o)
+{
+    ASSERT(o->have_sender)
+    ASSERT(o->send_len >= 0)
+    
+    unsigned int head = o->send_head;
+    
+    // if the ring is full, ask to be woken up when there is space, and check again
+    if (head - __atomic_load_n(&o->tail, __ATOMIC_ACQUIRE) == o->num_packets) {
+        if (!ThreadPipeWait_Start(&o->space_state)) {
+            return;
+        }
+        if (head - __atomic_load_n(&o->tail, __ATOMIC_SEQ_CST) == o->num_packets) {
+            return;
+        }
+        ThreadPipeWait_Stop(&o->space_state);
+    }
+    
+    // copy packet into slot
+    uint8_t *slot = slot_at(o, head);
+    memcpy(slot, &o->send_len, sizeof(int));
+    PacketPassInterface_CopyBufs(o->send_bufs, o->send_num_bufs, 0, slot + sizeof(int), o->send_len);
+    
+    // publish it
+    o->send_head = head + 1;
+    __atomic_store_n(&o->head, o->send_head, __ATOMIC_SEQ_CST);
+    
+    // wake up receiver if it's waiting
+    ThreadPipeWait_WakeUp(&o->data_state, o->receiver_mailbox, &o->data_msg);
+    
+    // accept packet
+    o->send_len = -1;
+    PacketPassInterface_Done(&o->input);
+}
+
+static void try_recv (PacketPassThreadPipe *o)
+{
+    ASSERT(o->have_receiver)
+    ASSERT(!o->recv_busy)
+    
+    unsigned int tail = o->recv_tail;
+    
+    // if the ring is empty, ask to be woken up when there is a packet, and check again
+    if (__atomic_load_n(&o->head, __ATOMIC_ACQUIRE) == tail) {
+        if (!ThreadPipeWait_Start(&o->data_state)) {
+            return;
+        }
+        if (__atomic_load_n(&o->head, __ATOMIC_SEQ_CST) == tail) {
+            return;
+        }
+        ThreadPipeWait_Stop(&o->data_state);
+    }
+    
+    // pass packet on from its slot
+    uint8_t *slot = slot_at(o, tail);
+    int len;
+    memcpy(&len, slot, sizeof(int));
+    ASSERT(len >= 0)
+    ASSERT(len <= o->mtu)
+    
+    o->recv_busy = 1;
+    PacketPassInterface_Sender_Send(o->output, slot + sizeof(int), len);
+}
+
+static void input_handler_send (PacketPassThreadPipe *o, uint8_t *data, int data_len)
+{
+    ASSERT(o->have_sender)
+    ASSERT(o->send_len == -1)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    o->send_bufs[0].data = data;
+    o->send_bufs[0].len = data_len;
+    o->send_num_bufs = 1;
+    o->send_len = data_len;
+    
+    try_send(o);
+}
+
+static void input_handler_sendv (PacketPassThreadPipe *o, const struct PacketPassInterface_buf *bufs, int num_bufs)
+{
+    ASSERT(o->have_sender)
+    ASSERT(o->send_len == -1)
+    ASSERT(num_bufs >= 0)
+    ASSERT(num_bufs <= PPI_MAX_BUFS)
+    DebugObject_Access(&o->d_obj);
+    
+    // remember buffers; the array is only valid during the call
+    int len = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        o->send_bufs[i] = bufs[i];
+        len += bufs[i].len;
+    }
+    ASSERT(len <= o->mtu)
+    o->send_num_bufs = num_bufs;
+    o->send_len = len;
+    
+    try_send(o);
+}
+
+static void input_handler_requestcancel (PacketPassThreadPipe *o)
+{
+    ASSERT(o->have_sender)
+    ASSERT(o->send_len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    // stop waiting for space; a wakeup already posted is delivered harmlessly
+    ThreadPipeWait_Stop(&o->space_state);
+    
+    // drop the packet waiting for space
+    o->send_len = -1;
+    PacketPassInterface_Done(&o->input);
+}
+
+static void output_handler_done (PacketPassThreadPipe *o)
+{
+    ASSERT(o->have_receiver)
+    ASSERT(o->recv_busy)
+    DebugObject_Access(&o->d_obj);
+    
+    o->recv_busy = 0;
+    
+    // free slot
+    o->recv_tail++;
+    __atomic_store_n(&o->tail, o->recv_tail, __ATOMIC_SEQ_CST);
+    
+    // wake up sender if it's waiting
+    ThreadPipeWait_WakeUp(&o->space_state, o->sender_mailbox, &o->space_msg);
+    
+    try_recv(o);
+}
+
+static void recv_job_handler (PacketPassThreadPipe *o)
+{
+    ASSERT(o->have_receiver)
+    DebugObject_Access(&o->d_obj);
+    
+    if (!o->recv_busy) {
+        try_recv(o);
+    }
+}
+
+static void data_msg_handler (PacketPassThreadPipe *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    ThreadPipeWait_Delivered(&o->data_state);
+    
+    if (!o->have_receiver || o->recv_busy) {
+        return;
+    }
+    
+    try_recv(o);
+}
+
+static void space_msg_handler (PacketPassThreadPipe *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    ThreadPipeWait_Delivered(&o->space_state);
+    
+    if (!o->have_sender || o->send_len < 0) {
+        return;
+    }
+    
+    try_send(o);
+}
+
+int PacketPassThreadPipe_Init (PacketPassThreadPipe *o, int mtu, int num_packets, BReactorMailbox *sender_mailbox, BReactorMailbox *receiver_mailbox)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(num_packets > 0)
+    ASSERT(sender_mailbox)
+    ASSERT(receiver_mailbox)
+    
+    // init arguments
+    o->mtu = mtu;
+    o->num_packets = num_packets;
+    o->sender_mailbox = sender_mailbox;
+    o->receiver_mailbox = receiver_mailbox;
+    
+    // allocate slots, keeping them aligned
+    o->slot_size = (sizeof(int) + mtu + 7) / 8 * 8;
+    if (!(o->slots = (uint8_t *)BBufferArena_AllocArray(num_packets, o->slot_size))) {
+        goto fail0;
+    }
+    
+    // init messages
+    BReactorMailboxMessage_Init(&o->data_msg, (BReactorMailboxMessage_handler)data_msg_handler, o);
+    BReactorMailboxMessage_Init(&o->space_msg, (BReactorMailboxMessage_handler)space_msg_handler, o);
+    
+    // init ring; neither side is waiting
+    o->head = 0;
+    o->space_state = THREADPIPEWAIT_STATE_RUNNING;
+    o->tail = 0;
+    o->data_state = THREADPIPEWAIT_STATE_RUNNING;
+    
+    // no sides
+    o->have_sender = 0;
+    o->have_receiver = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+void PacketPassThreadPipe_Free (PacketPassThreadPipe *o)
+{
+    ASSERT(!o->have_sender)
+    ASSERT(!o->have_receiver)
+    DebugObject_Free(&o->d_obj);
+    
+    // free slots
+    BBufferArena_Free(o->slots);
+}
+
+void PacketPassThreadPipe_Sender_Init (PacketPassThreadPipe *o, BPendingGroup *pg)
+{
+    ASSERT(!o->have_sender)
+    DebugObject_Access(&o->d_obj);
+    
+    o->have_sender = 1;
+    o->send_head = __atomic_load_n(&o->head, __ATOMIC_SEQ_CST);
+    o->send_len = -1;
+    
+    // init input
+    PacketPassInterface_Init(&o->input, o->mtu, (PacketPassInterface_handler_send)input_handler_send, o, pg);
+    PacketPassInterface_EnableSendV(&o->input, (PacketPassInterface_handler_sendv)input_handler_sendv);
+    PacketPassInterface_EnableCancel(&o->input, (PacketPassInterface_handler_requestcancel)input_handler_requestcancel);
+}
+
+void PacketPassThreadPipe_Sender_Free (PacketPassThreadPipe *o)
+{
+    ASSERT(o->have_sender)
+    DebugObject_Access(&o->d_obj);
+    
+    // free input
+    PacketPassInterface_Free(&o->input);
+    
+    o->have_sender = 0;
+}
+
+PacketPassInterface * PacketPassThreadPipe_Sender_GetInput (PacketPassThreadPipe *o)
+{
+    ASSERT(o->have_sender)
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->input;
+}
+
+void PacketPassThreadPipe_Receiver_Init (PacketPassThreadPipe *o, PacketPassInterface *output, BPendingGroup *pg)
+{
+    ASSERT(!o->have_receiver)
+    ASSERT(PacketPassInterface_GetMTU(output) >= o->mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    o->have_receiver = 1;
+    o->recv_tail = __atomic_load_n(&o->tail, __ATOMIC_SEQ_CST);
+    o->output = output;
+    o->recv_busy = 0;
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    // init and set job to pass on packets which are already queued
+    BPending_Init(&o->recv_job, pg, (BPending_handler)recv_job_handler, o);
+    BPending_Set(&o->recv_job);
+}
+
+void PacketPassThreadPipe_Receiver_Free (PacketPassThreadPipe *o)
+{
+    ASSERT(o->have_receiver)
+    DebugObject_Access(&o->d_obj);
+    
+    // free job
+    BPending_Free(&o->recv_job);
+    
+    o->have_receiver = 0;
+}
@@ -0,0 +1,174 @@
+/**
+ * @file PacketPassThreadPipe.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Lock-free queue passing packets from a {@link PacketPassInterface} in one
+ * thread to a {@link PacketPassInterface} in another thread.
+ */
+
+#ifndef BADVPN_PACKETPASSTHREADPIPE_H
+#define BADVPN_PACKETPASSTHREADPIPE_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <system/BReactorMailbox.h>
+#include <flow/PacketPassInterface.h>
+
+/**
+ * Lock-free queue passing packets from a {@link PacketPassInterface} in one
+ * thread (the sender) to a {@link PacketPassInterface} in another thread
+ * (the receiver).
+ * 
+ * The queue is a ring of a fixed number of packet slots with one producer and
+ * one consumer. The sender copies input packets into free slots and accepts them
+ * right away; the receiver passes packets to its output directly from the slots.
+ * When the ring is full, the sender waits with the input packet until the
+ * receiver has freed a slot.
+ * A side which has run out of work marks itself as waiting, and the other side
+ * posts a {@link BReactorMailboxMessage} to its mailbox only if it finds it
+ * waiting, so a busy pipe moves packets without any messages.
+ * 
+ * The sender and receiver sides are initialized and freed separately, each in
+ * its own thread. Messages about the pipe may still be queued in either mailbox
+ * after a side has been freed; they are ignored when delivered, but the pipe
+ * as a whole must not be freed until they have been delivered.
+ */
+typedef struct {
+    int mtu;
+    int num_packets;
+    int slot_size;
+    uint8_t *slots;
+    BReactorMailbox *sender_mailbox;
+    BReactorMailbox *receiver_mailbox;
+    BReactorMailboxMessage data_msg;
+    BReactorMailboxMessage space_msg;
+    
+    // position and wait state of the sender
+    unsigned int head;
+    int space_state;
+    uint8_t pad1[64];
+    
+    // position and wait state of the receiver
+    unsigned int tail;
+    int data_state;
+    uint8_t pad2[64];
+    
+    // sender side
+    int have_sender;
+    unsigned int send_head;
+    PacketPassInterface input;
+    struct PacketPassInterface_buf send_bufs[PPI_MAX_BUFS];
+    int send_num_bufs;
+    int send_len;
+    
+    // receiver side
+    int have_receiver;
+    unsigned int recv_tail;
+    PacketPassInterface *output;
+    int recv_busy;
+    BPending recv_job;
+    
+    DebugObject d_obj;
+} PacketPassThreadPipe;
+
+/**
+ * Initializes the pipe, without either side.
+ * May be called from any thread.
+ * 
+ * @param o the object
+ * @param mtu maximum packet size. Must be >=0.
+ * @param num_packets number of packet slots. Must be >0.
+ * @param sender_mailbox mailbox of the thread which will be the sender
+ * @param receiver_mailbox mailbox of the thread which will be the receiver
+ * @return 1 on success, 0 on failure
+ */
+int PacketPassThreadPipe_Init (PacketPassThreadPipe *o, int mtu, int num_packets, BReactorMailbox *sender_mailbox, BReactorMailbox *receiver_mailbox) WARN_UNUSED;
+
+/**
+ * Frees the pipe.
+ * Neither side may be initialized, and no messages about the pipe may be
+ * queued in either mailbox, i.e. messages posted by the sides must have been
+ * delivered.
+ * 
+ * @param o the object
+ */
+void PacketPassThreadPipe_Free (PacketPassThreadPipe *o);
+
+/**
+ * Initializes the sender side.
+ * Must be called from the sender thread.
+ * 
+ * @param o the object
+ * @param pg pending group of the sender thread's reactor
+ */
+void PacketPassThreadPipe_Sender_Init (PacketPassThreadPipe *o, BPendingGroup *pg);
+
+/**
+ * Frees the sender side.
+ * Must be called from the sender thread. A packet waiting for space is dropped.
+ * 
+ * @param o the object
+ */
+void PacketPassThreadPipe_Sender_Free (PacketPassThreadPipe *o);
+
+/**
+ * Returns the input interface.
+ * The MTU of the interface will be as in {@link PacketPassThreadPipe_Init}.
+ * The interface supports vectored sends, and cancel functionality, which
+ * drops a packet waiting for space.
+ * Must be called from the sender thread, with the sender side initialized.
+ * 
+ * @param o the object
+ * @return input interface
+ */
+PacketPassInterface * PacketPassThreadPipe_Sender_GetInput (PacketPassThreadPipe *o);
+
+/**
+ * Initializes the receiver side.
+ * Must be called from the receiver thread. Packets which the sender has already
+ * queued are passed on.
+ * 
+ * @param o the object
+ * @param output output interface. Its MTU must be >= the MTU of the pipe.
+ * @param pg pending group of the receiver thread's reactor
+ */
+void PacketPassThreadPipe_Receiver_Init (PacketPassThreadPipe *o, PacketPassInterface *output, BPendingGroup *pg);
+
+/**
+ * Frees the receiver side.
+ * Must be called from the receiver thread. Queued packets are dropped.
+ * 
+ * @param o the object
+ */
+void PacketPassThreadPipe_Receiver_Free (PacketPassThreadPipe *o);
+
+#endif
@@ -0,0 +1,277 @@
+/**
+ * @file PacketThreadBuffer.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <base/BBufferArena.h>
+
+#include "ThreadPipeWait.h"
+#include "PacketThreadBuffer.h"
+
+static void try_send (PacketThreadBuffer *o)
+{
+    ASSERT(o->have_sender)
+    ASSERT(!o->input_busy)
+    
+    // if there's no space, ask to be woken up when there is, and check again
+    uint8_t *dest = ChunkBuffer2Spsc_Producer_GetDest(&o->buf);
+    if (!dest) {
+        if (!ThreadPipeWait_Start(&o->space_state)) {
+            return;
+        }
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!(dest = ChunkBuffer2Spsc_Producer_GetDest(&o->buf))) {
+            return;
+        }
+        ThreadPipeWait_Stop(&o->space_state);
+    }
+    
+    // receive packet into the buffer
+    o->input_busy = 1;
+    PacketRecvInterface_Receiver_Recv(o->input, dest);
+}
+
+static void try_recv (PacketThreadBuffer *o)
+{
+    ASSERT(o->have_receiver)
+    ASSERT(!o->recv_busy)
+    
+    // if there are no packets, ask to be woken up when there are, and check again
+    uint8_t *data;
+    int len;
+    if (!ChunkBuffer2Spsc_Consumer_Peek(&o->buf, &data, &len)) {
+        if (!ThreadPipeWait_Start(&o->data_state)) {
+            return;
+        }
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!ChunkBuffer2Spsc_Consumer_Peek(&o->buf, &data, &len)) {
+            return;
+        }
+        ThreadPipeWait_Stop(&o->data_state);
+    }
+    
+    ASSERT(len <= o->mtu)
+    
+    // pass packet on from the buffer
+    o->recv_busy = 1;
+    PacketPassInterface_Sender_Send(o->output, data, len);
+}
+
+static void input_handler_done (PacketThreadBuffer *o, int data_len)
+{
+    ASSERT(o->have_sender)
+    ASSERT(o->input_busy)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    o->input_busy = 0;
+    
+    // publish packet
+    ChunkBuffer2Spsc_Producer_Submit(&o->buf, data_len);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    // wake up receiver if it's waiting
+    ThreadPipeWait_WakeUp(&o->data_state, o->receiver_mailbox, &o->data_msg);
+    
+    try_send(o);
+}
+
+static void output_handler_done (PacketThreadBuffer *o)
+{
+    ASSERT(o->have_receiver)
+    ASSERT(o->recv_busy)
+    DebugObject_Access(&o->d_obj);
+    
+    o->recv_busy = 0;
+    
+    // free space
+    ChunkBuffer2Spsc_Consumer_Consume(&o->buf);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    // wake up sender if it's waiting
+    ThreadPipeWait_WakeUp(&o->space_state, o->sender_mailbox, &o->space_msg);
+    
+    try_recv(o);
+}
+
+static void send_job_handler (PacketThreadBuffer *o)
+{
+    ASSERT(o->have_sender)
+    DebugObject_Access(&o->d_obj);
+    
+    if (!o->input_busy) {
+        try_send(o);
+    }
+}
+
+static void recv_job_handler (PacketThreadBuffer *o)
+{
+    ASSERT(o->have_receiver)
+    DebugObject_Access(&o->d_obj);
+    
+    if (!o->recv_busy) {
+        try_recv(o);
+    }
+}
+
+static void data_msg_handler (PacketThreadBuffer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    ThreadPipeWait_Delivered(&o->data_state);
+    
+    if (!o->have_receiver || o->recv_busy) {
+        return;
+    }
+    
+    try_recv(o);
+}
+
+static void space_msg_handler (PacketThreadBuffer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    ThreadPipeWait_Delivered(&o->space_state);
+    
+    if (!o->have_sender || o->input_busy) {
+        return;
+    }
+    
+    try_send(o);
+}
+
+int PacketThreadBuffer_Init (PacketThreadBuffer *o, int mtu, int num_packets, BReactorMailbox *sender_mailbox, BReactorMailbox *receiver_mailbox)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(num_packets > 0)
+    ASSERT(sender_mailbox)
+    ASSERT(receiver_mailbox)
+    
+    // init arguments
+    o->mtu = mtu;
+    o->sender_mailbox = sender_mailbox;
+    o->receiver_mailbox = receiver_mailbox;
+    
+    // allocate buffer
+    int num_blocks = ChunkBuffer2_calc_blocks(mtu, num_packets);
+    if (num_blocks < 0 || num_blocks > INT_MAX / 2) {
+        goto fail0;
+    }
+    if (!(o->buf_data = (struct ChunkBuffer2_block *)BBufferArena_AllocArray(num_blocks, sizeof(o->buf_data[0])))) {
+        goto fail0;
+    }
+    
+    // init buffer
+    ChunkBuffer2Spsc_Init(&o->buf, o->buf_data, num_blocks, mtu);
+    
+    // init messages
+    BReactorMailboxMessage_Init(&o->data_msg, (BReactorMailboxMessage_handler)data_msg_handler, o);
+    BReactorMailboxMessage_Init(&o->space_msg, (BReactorMailboxMessage_handler)space_msg_handler, o);
+    
+    // neither side is waiting
+    o->space_state = THREADPIPEWAIT_STATE_RUNNING;
+    o->data_state = THREADPIPEWAIT_STATE_RUNNING;
+    
+    // no sides
+    o->have_sender = 0;
+    o->have_receiver = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+void PacketThreadBuffer_Free (PacketThreadBuffer *o)
+{
+    ASSERT(!o->have_sender)
+    ASSERT(!o->have_receiver)
+    DebugObject_Free(&o->d_obj);
+    
+    // free buffer
+    BBufferArena_Free(o->buf_data);
+}
+
+void PacketThreadBuffer_Sender_Init (PacketThreadBuffer *o, PacketRecvInterface *input, BPendingGroup *pg)
+{
+    ASSERT(!o->have_sender)
+    ASSERT(PacketRecvInterface_GetMTU(input) <= o->mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    o->have_sender = 1;
+    o->input = input;
+    o->input_busy = 0;
+    
+    // init input
+    PacketRecvInterface_Receiver_Init(o->input, (PacketRecvInterface_handler_done)input_handler_done, o);
+    
+    // init and set job to start receiving
+    BPending_Init(&o->send_job, pg, (BPending_handler)send_job_handler, o);
+    BPending_Set(&o->send_job);
+}
+
+void PacketThreadBuffer_Sender_Free (PacketThreadBuffer *o)
+{
+    ASSERT(o->have_sender)
+    DebugObject_Access(&o->d_obj);
+    
+    // free job
+    BPending_Free(&o->send_job);
+    
+    o->have_sender = 0;
+}
+
+void PacketThreadBuffer_Receiver_Init (PacketThreadBuffer *o, PacketPassInterface *output, BPendingGroup *pg)
+{
+    ASSERT(!o->have_receiver)
+    ASSERT(PacketPassInterface_GetMTU(output) >= o->mtu)
+    DebugObject_Access(&o->d_obj);
+    
+    o->have_receiver = 1;
+    o->output = output;
+    o->recv_busy = 0;
+    
+    // init output
+    PacketPassInterface_Sender_Init(o->output, (PacketPassInterface_handler_done)output_handler_done, o);
+    
+    // init and set job to pass on packets which are already buffered
+    BPending_Init(&o->recv_job, pg, (BPending_handler)recv_job_handler, o);
+    BPending_Set(&o->recv_job);
+}
+
+void PacketThreadBuffer_Receiver_Free (PacketThreadBuffer *o)
+{
+    ASSERT(o->have_receiver)
+    DebugObject_Access(&o->d_obj);
+    
+    // free job
+    BPending_Free(&o->recv_job);
+    
+    o->have_receiver = 0;
+}
@@ -0,0 +1,155 @@
+/**
+ * @file PacketThreadBuffer.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * @section DESCRIPTION
+ * 
+ * Packet buffer with {@link PacketRecvInterface} input in one thread and
+ * {@link PacketPassInterface} output in another thread.
+ */
+
+#ifndef BADVPN_PACKETTHREADBUFFER_H
+#define BADVPN_PACKETTHREADBUFFER_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <structure/ChunkBuffer2Spsc.h>
+#include <system/BReactorMailbox.h>
+#include <flow/PacketRecvInterface.h>
+#include <flow/PacketPassInterface.h>
+
+/**
+ * Packet buffer with {@link PacketRecvInterface} input in one thread (the sender)
+ * and {@link PacketPassInterface} output in another thread (the receiver).
+ * 
+ * Like {@link PacketBuffer}, input packets are received directly into the
+ * buffer, and passed to the output from there, but the buffer is a
+ * {@link ChunkBuffer2Spsc}, so packets take only as much space as their length.
+ * Waiting and wakeups work as in {@link PacketPassThreadPipe}.
+ * 
+ * The sender and receiver sides are initialized and freed separately, each in
+ * its own thread. Messages about the buffer may still be queued in either
+ * mailbox after a side has been freed; they are ignored when delivered, but the
+ * buffer as a whole must not be freed until they have been delivered.
+ */
+typedef struct {
+    int mtu;
+    struct ChunkBuffer2_block *buf_data;
+    ChunkBuffer2Spsc buf;
+    BReactorMailbox *sender_mailbox;
+    BReactorMailbox *receiver_mailbox;
+    BReactorMailboxMessage data_msg;
+    BReactorMailboxMessage space_msg;
+    
+    // wait state of the sender
+    int space_state;
+    uint8_t pad1[64];
+    
+    // wait state of the receiver
+    int data_state;
+    uint8_t pad2[64];
+    
+    // sender side
+    int have_sender;
+    PacketRecvInterface *input;
+    int input_busy;
+    BPending send_job;
+    
+    // receiver side
+    int have_receiver;
+    PacketPassInterface *output;
+    int recv_busy;
+    BPending recv_job;
+    
+    DebugObject d_obj;
+} PacketThreadBuffer;
+
+/**
+ * Initializes the buffer, without either side.
+ * May be called from any thread.
+ * 
+ * @param o the object
+ * @param mtu maximum packet size. Must be >=0.
+ * @param num_packets minimum number of packets the buffer must hold. Must be >0.
+ * @param sender_mailbox mailbox of the thread which will be the sender
+ * @param receiver_mailbox mailbox of the thread which will be the receiver
+ * @return 1 on success, 0 on failure
+ */
+int PacketThreadBuffer_Init (PacketThreadBuffer *o, int mtu, int num_packets, BReactorMailbox *sender_mailbox, BReactorMailbox *receiver_mailbox) WARN_UNUSED;
+
+/**
+ * Frees the buffer.
+ * Neither side may be initialized, and no messages about the buffer may be
+ * queued in either mailbox, i.e. messages posted by the sides must have been
+ * delivered.
+ * 
+ * @param o the object
+ */
+void PacketThreadBuffer_Free (PacketThreadBuffer *o);
+
+/**
+ * Initializes the sender side.
+ * Must be called from the sender thread.
+ * 
+ * @param o the object
+ * @param input input interface. Its MTU must be <= the MTU of the buffer.
+ * @param pg pending group of the sender thread's reactor
+ */
+void PacketThreadBuffer_Sender_Init (PacketThreadBuffer *o, PacketRecvInterface *input, BPendingGroup *pg);
+
+/**
+ * Frees the sender side.
+ * Must be called from the sender thread. The input must be freed too before
+ * the buffer is, as it may be receiving into it.
+ * 
+ * @param o the object
+ */
+void PacketThreadBuffer_Sender_Free (PacketThreadBuffer *o);
+
+/**
+ * Initializes the receiver side.
+ * Must be called from the receiver thread. Packets which the sender has already
+ * buffered are passed on.
+ * 
+ * @param o the object
+ * @param output output interface. Its MTU must be >= the MTU of the buffer.
+ * @param pg pending group of the receiver thread's reactor
+ */
+void PacketThreadBuffer_Receiver_Init (PacketThreadBuffer *o, PacketPassInterface *output, BPendingGroup *pg);
+
+/**
+ * Frees the receiver side.
+ * Must be called from the receiver thread. Buffered packets stay in the buffer
+ * for a receiver initialized later.
+ * 
+ * @param o the object
+ */
+void PacketThreadBuffer_Receiver_Free (PacketThreadBuffer *o);
+
+#endif
@@ -0,0 +1,366 @@
+/**
+ * @file StatsServer.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <base/BLog.h>
+
+#include "StatsServer.h"
+
+#include <generated/blog_channel_StatsServer.h>
+
+struct client {
+    StatsServer *s;
+    LinkedList1Node list_node;
+    BConnection con;
+    BTimer timer;
+    uint8_t request[STATSSERVER_MAX_REQUEST];
+    int request_len;
+    int responding;
+    ExpString response;
+    size_t response_sent;
+};
+
+static void client_free (struct client *c);
+static int find_request_end (struct client *c);
+static int build_response (struct client *c);
+static void send_response (struct client *c);
+static void client_timer_handler (struct client *c);
+static void client_connection_handler (struct client *c, int event);
+static void client_recv_handler_done (struct client *c, int data_len);
+static void client_send_handler_done (struct client *c, int data_len);
+static void listener_handler (StatsServer *o);
+
+static const char error_response[] =
+    "HTTP/1.0 500 Internal Server Error\r\n"
+    "Content-Type: text/plain\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "failed to build report\n";
+
+void client_free (struct client *c)
+{
+    StatsServer *o = c->s;
+    
+    // free response
+    if (c->responding) {
+        ExpString_Free(&c->response);
+    }
+    
+    // free timer
+    BReactor_RemoveTimer(o->reactor, &c->timer);
+    
+    // free connection interfaces
+    BConnection_RecvAsync_Free(&c->con);
+    BConnection_SendAsync_Free(&c->con);
+    
+    // free connection
+    BConnection_Free(&c->con);
+    
+    // remove from clients list
+    LinkedList1_Remove(&o->clients_list, &c->list_node);
+    o->num_clients--;
+    
+    free(c);
+}
+
+int find_request_end (struct client *c)
+{
+    // the request ends with an empty line; accept bare LF line endings too
+    for (int i = 0; i < c->request_len; i++) {
+        if (c->request[i] != '\n') {
+            continue;
+        }
+        if (i >= 1 && c->request[i - 1] == '\n') {
+            return 1;
+        }
+        if (i >= 3 && !memcmp(c->request + i - 3, "\r\n\r", 3)) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+int build_response (struct client *c)
+{
+    StatsServer *o = c->s;
+    
+    // build report
+    StatsServerReport r;
+    if (!ExpString_Init(&r.str)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail0;
+    }
+    r.failed = 0;
+    
+    o->handler_report(o->user, &r);
+    
+    // init response
+    if (!ExpString_Init(&c->response)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail1;
+    }
+    
+    if (r.failed) {
+        BLog(BLOG_ERROR, "failed to build report");
+        if (!ExpString_Append(&c->response, error_response)) {
+            goto fail2;
+        }
+    } else {
+        char header[128];
+        snprintf(header, sizeof(header),
+                 "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: text/plain; charset=utf-8\r\n"
+                 "Content-Length: %zu\r\n"
+                 "Connection: close\r\n"
+                 "\r\n", ExpString_Length(&r.str));
+        
+        if (!ExpString_Append(&c->response, header) ||
+            !ExpString_AppendBinary(&c->response, (uint8_t *)ExpString_Get(&r.str), ExpString_Length(&r.str))
+        ) {
+            BLog(BLOG_ERROR, "ExpString_Append failed");
+            goto fail2;
+        }
+    }
+    
+    ExpString_Free(&r.str);
+    return 1;
+    
+fail2:
+    ExpString_Free(&c->response);
+fail1:
+    ExpString_Free(&r.str);
+fail0:
+    return 0;
+}
+
+void send_response (struct client *c)
+{
+    ASSERT(c->responding)
+    ASSERT(c->response_sent < ExpString_Length(&c->response))
+    
+    size_t left = ExpString_Length(&c->response) - c->response_sent;
+    int to_send = (left > INT_MAX ? INT_MAX : left);
+    
+    StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&c->con), (uint8_t *)ExpString_Get(&c->response) + c->response_sent, to_send);
+}
+
+void client_timer_handler (struct client *c)
+{
+    BLog(BLOG_INFO, "client timed out");
+    
+    client_free(c);
+}
+
+void client_connection_handler (struct client *c, int event)
+{
+    if (event == BCONNECTION_EVENT_RECVCLOSED && c->responding) {
+        // the client may close its sending side after the request
+        return;
+    }
+    
+    BLog(BLOG_INFO, "client disconnected");
+    
+    client_free(c);
+}
+
+void client_recv_handler_done (struct client *c, int data_len)
+{
+    ASSERT(!c->responding)
+    ASSERT(data_len > 0)
+    ASSERT(data_len <= STATSSERVER_MAX_REQUEST - c->request_len)
+    
+    c->request_len += data_len;
+    
+    if (!find_request_end(c)) {
+        if (c->request_len == STATSSERVER_MAX_REQUEST) {
+            BLog(BLOG_ERROR, "request too long");
+            client_free(c);
+            return;
+        }
+        
+        // receive more
+        StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&c->con), c->request + c->request_len, STATSSERVER_MAX_REQUEST - c->request_len);
+        return;
+    }
+    
+    // build response
+    if (!build_response(c)) {
+        client_free(c);
+        return;
+    }
+    c->responding = 1;
+    c->response_sent = 0;
+    
+    // start sending
+    send_response(c);
+}
+
+void client_send_handler_done (struct client *c, int data_len)
+{
+    ASSERT(c->responding)
+    ASSERT(data_len > 0)
+    
+    c->response_sent += data_len;
+    
+    if (c->response_sent < ExpString_Length(&c->response)) {
+        send_response(c);
+        return;
+    }
+    
+    BLog(BLOG_INFO, "report sent");
+    
+    client_free(c);
+}
+
+void listener_handler (StatsServer *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->num_clients == STATSSERVER_MAX_CLIENTS) {
+        BLog(BLOG_ERROR, "too many clients");
+        goto fail0;
+    }
+    
+    // allocate structure
+    struct client *c = (struct client *)malloc(sizeof(*c));
+    if (!c) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    c->s = o;
+    
+    // accept connection
+    if (!BConnection_Init(&c->con, BConnection_source_listener(&o->listener, NULL), o->reactor, c, (BConnection_handler)client_connection_handler)) {
+        BLog(BLOG_ERROR, "BConnection_Init failed");
+        goto fail1;
+    }
+    
+    // init connection interfaces
+    BConnection_SendAsync_Init(&c->con);
+    BConnection_RecvAsync_Init(&c->con);
+    StreamPassInterface_Sender_Init(BConnection_SendAsync_GetIf(&c->con), (StreamPassInterface_handler_done)client_send_handler_done, c);
+    StreamRecvInterface_Receiver_Init(BConnection_RecvAsync_GetIf(&c->con), (StreamRecvInterface_handler_done)client_recv_handler_done, c);
+    
+    // init timer
+    BTimer_Init(&c->timer, STATSSERVER_CLIENT_TIMEOUT, (BTimer_handler)client_timer_handler, c);
+    BReactor_SetTimer(o->reactor, &c->timer);
+    
+    // insert to clients list
+    LinkedList1_Append(&o->clients_list, &c->list_node);
+    o->num_clients++;
+    
+    // start receiving request
+    c->request_len = 0;
+    c->responding = 0;
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&c->con), c->request, STATSSERVER_MAX_REQUEST);
+    
+    BLog(BLOG_INFO, "client connected");
+    
+    return;
+    
+fail1:
+    free(c);
+fail0:
+    return;
+}
+
+int StatsServer_Init (StatsServer *o, struct BLisCon_from from, BReactor *reactor, void *user,
+                      StatsServer_handler_report handler_report)
+{
+    ASSERT(handler_report)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->user = user;
+    o->handler_report = handler_report;
+    
+    // init listener
+    if (!BListener_InitFrom(&o->listener, from, reactor, o, (BListener_handler)listener_handler)) {
+        BLog(BLOG_ERROR, "BListener_InitFrom failed");
+        return 0;
+    }
+    
+    // init clients list
+    LinkedList1_Init(&o->clients_list);
+    o->num_clients = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    
+    return 1;
+}
+
+void StatsServer_Free (StatsServer *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free clients
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&o->clients_list))) {
+        struct client *c = UPPER_OBJECT(node, struct client, list_node);
+        client_free(c);
+    }
+    
+    // free listener
+    BListener_Free(&o->listener);
+}
+
+void StatsServerReport_Printf (StatsServerReport *r, const char *fmt, ...)
+{
+    if (r->failed) {
+        return;
+    }
+    
+    va_list vl;
+    va_start(vl, fmt);
+    int len = vsnprintf(NULL, 0, fmt, vl);
+    va_end(vl);
+    
+    if (len < 0) {
+        r->failed = 1;
+        return;
+    }
+    
+    size_t old_len = ExpString_Length(&r->str);
+    if (!ExpString_AppendZeros(&r->str, len)) {
+        r->failed = 1;
+        return;
+    }
+    
+    va_start(vl, fmt);
+    vsnprintf(ExpString_Get(&r->str) + old_len, len + 1, fmt, vl);
+    va_end(vl);
+}
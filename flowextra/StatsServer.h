@@ -0,0 +1,121 @@
+/**
+ * @file StatsServer.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * A minimal HTTP server reporting runtime statistics of a program.
+ */
+
+#ifndef BADVPN_STATSSERVER_H
+#define BADVPN_STATSSERVER_H
+
+#include <misc/expstring.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <system/BConnection.h>
+
+// maximum number of clients being served at the same time
+#define STATSSERVER_MAX_CLIENTS 16
+
+// maximum size of a request, including headers
+#define STATSSERVER_MAX_REQUEST 2048
+
+// time after which a client is disconnected
+#define STATSSERVER_CLIENT_TIMEOUT 10000
+
+/**
+ * Report being built by the report handler of {@link StatsServer}.
+ */
+typedef struct {
+    ExpString str;
+    int failed;
+} StatsServerReport;
+
+/**
+ * Handler called to build a report for a client.
+ * The handler should write the report using {@link StatsServerReport_Printf}.
+ * It must not free the {@link StatsServer}.
+ * 
+ * @param user as in {@link StatsServer_Init}
+ * @param report report to write to
+ */
+typedef void (*StatsServer_handler_report) (void *user, StatsServerReport *report);
+
+/**
+ * A minimal HTTP server reporting runtime statistics of a program.
+ * 
+ * Each client sends a request and receives a plain text report,
+ * after which the connection is closed. The report is generated
+ * at the time the request is received, so a client can only ever
+ * see a consistent snapshot. The request is not interpreted beyond
+ * finding its end, so it does not matter which path is requested.
+ * This works the same way on TCP and on Unix sockets, the latter
+ * being queryable with e.g. "curl --unix-socket".
+ */
+typedef struct {
+    BReactor *reactor;
+    void *user;
+    StatsServer_handler_report handler_report;
+    BListener listener;
+    LinkedList1 clients_list;
+    int num_clients;
+    DebugObject d_obj;
+} StatsServer;
+
+/**
+ * Initializes the server.
+ * 
+ * @param o the object
+ * @param from address to listen on
+ * @param reactor reactor we live in
+ * @param user value passed to the report handler
+ * @param handler_report handler called to build a report
+ * @return 1 on success, 0 on failure
+ */
+int StatsServer_Init (StatsServer *o, struct BLisCon_from from, BReactor *reactor, void *user,
+                      StatsServer_handler_report handler_report) WARN_UNUSED;
+
+/**
+ * Frees the server.
+ * Clients being served are disconnected.
+ * 
+ * @param o the object
+ */
+void StatsServer_Free (StatsServer *o);
+
+/**
+ * Appends formatted text to a report.
+ * If this fails, the report is replaced with an error response.
+ * 
+ * @param r the report
+ * @param fmt printf format string
+ */
+void StatsServerReport_Printf (StatsServerReport *r, const char *fmt, ...);
+
+#endif
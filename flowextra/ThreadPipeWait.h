@@ -0,0 +1,96 @@
+/**
+ * @file ThreadPipeWait.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * @section DESCRIPTION
+ * 
+ * Wakeups between the two sides of a lock-free queue in different threads.
+ * 
+ * A side which has run out of work moves its wait state from RUNNING to
+ * WAITING with a sequentially consistent operation and then looks at the other
+ * side's position again, while the other side publishes its position and then
+ * moves the wait state from WAITING to POSTED, posting a message only if that
+ * succeeds. So either the waiting side sees the new position, or the other side
+ * sees it waiting and wakes it up; a wakeup is never lost. The waiting side
+ * goes back to RUNNING only when the message is delivered, so a message is
+ * never posted while it is still queued.
+ */
+
+#ifndef BADVPN_THREADPIPEWAIT_H
+#define BADVPN_THREADPIPEWAIT_H
+
+#include <misc/debug.h>
+#include <system/BReactorMailbox.h>
+
+#define THREADPIPEWAIT_STATE_RUNNING 0
+#define THREADPIPEWAIT_STATE_WAITING 1
+#define THREADPIPEWAIT_STATE_POSTED 2
+
+/**
+ * Asks to be woken up.
+ * Returns 1 if the caller should check again whether it can make progress,
+ * 0 if a message is already on its way.
+ */
+static int ThreadPipeWait_Start (int *state)
+{
+    int expected = THREADPIPEWAIT_STATE_RUNNING;
+    if (!__atomic_compare_exchange_n(state, &expected, THREADPIPEWAIT_STATE_WAITING, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        ASSERT(expected == THREADPIPEWAIT_STATE_POSTED)
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Called after finding work when checking again. A message may have been
+ * posted in the meantime, in which case it will be delivered harmlessly.
+ */
+static void ThreadPipeWait_Stop (int *state)
+{
+    int expected = THREADPIPEWAIT_STATE_WAITING;
+    __atomic_compare_exchange_n(state, &expected, THREADPIPEWAIT_STATE_RUNNING, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Called when the wakeup message is delivered; it may be posted again from now on.
+ */
+static void ThreadPipeWait_Delivered (int *state)
+{
+    __atomic_store_n(state, THREADPIPEWAIT_STATE_RUNNING, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Wakes up the other side if it is waiting.
+ */
+static void ThreadPipeWait_WakeUp (int *state, BReactorMailbox *mailbox, BReactorMailboxMessage *msg)
+{
+    int expected = THREADPIPEWAIT_STATE_WAITING;
+    if (__atomic_compare_exchange_n(state, &expected, THREADPIPEWAIT_STATE_POSTED, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        BReactorMailbox_Thread_Post(mailbox, msg);
+    }
+}
+
+#endif
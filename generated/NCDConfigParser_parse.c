@@ -109,19 +109,19 @@ static void free_value (struct value o) { if (o.have) NCDValue_Free(&o.v); }
 **                       defined, then do no error processing.
 */
 #define YYCODETYPE unsigned char
-#define YYNOCODE 49
+#define YYNOCODE 50
 #define YYACTIONTYPE unsigned char
 #define ParseTOKENTYPE  struct token 
 typedef union {
   int yyinit;
   ParseTOKENTYPE yy0;
-  struct program yy6;
-  struct value yy19;
-  int yy28;
-  struct ifblock yy44;
-  struct statement yy47;
-  char * yy49;
-  struct block yy69;
+  struct value yy5;
+  struct program yy18;
+  char * yy29;
+  struct ifblock yy32;
+  int yy33;
+  struct statement yy77;
+  struct block yy79;
 } YYMINORTYPE;
 #ifndef YYSTACKDEPTH
 #define YYSTACKDEPTH 0
@@ -130,8 +130,8 @@ typedef union {
 #define ParseARG_PDECL , struct parser_out *parser_out 
 #define ParseARG_FETCH  struct parser_out *parser_out  = yypParser->parser_out 
 #define ParseARG_STORE yypParser->parser_out  = parser_out 
-#define YYNSTATE 130
-#define YYNRULE 49
+#define YYNSTATE 136
+#define YYNRULE 50
 #define YY_NO_ACTION      (YYNSTATE+YYNRULE+2)
 #define YY_ACCEPT_ACTION  (YYNSTATE+YYNRULE+1)
 #define YY_ERROR_ACTION   (YYNSTATE+YYNRULE)
@@ -201,92 +201,95 @@ static const YYMINORTYPE yyzerominor = { 0 };
 **  yy_default[]       Default action for each state.
 */
 static const YYACTIONTYPE yy_action[] = {
- /*     0 */   107,   51,   59,    4,  104,    9,  107,    2,   59,    4,
- /*    10 */    94,    9,  107,   58,   59,    4,   54,    9,   95,  180,
- /*    20 */     5,    6,   29,   30,  100,   54,    5,  117,   29,   30,
- /*    30 */    34,  128,    5,   54,   29,   30,  111,   57,  102,  112,
- /*    40 */    59,  113,  115,   43,  111,   62,  102,  112,   96,  113,
- /*    50 */   115,   43,    2,  111,   65,  102,  112,   91,  113,  115,
- /*    60 */    43,  101,  111,   54,   60,  112,    7,  113,  115,   43,
- /*    70 */   111,   61,    2,  112,   63,  113,  115,   44,  111,    8,
- /*    80 */   103,  112,  108,  113,  115,   43,  111,    2,  116,  112,
- /*    90 */   106,  113,  115,   44,  111,    2,   68,  112,    2,  113,
- /*   100 */   115,   45,    1,  111,   73,   32,  112,  110,  113,  115,
- /*   110 */    46,  111,   64,   52,  112,   53,  113,  115,   47,  111,
- /*   120 */   109,   66,  112,   71,  113,  115,   48,  111,   70,   59,
- /*   130 */   112,   35,  113,  115,   50,   39,   67,   72,   97,   98,
- /*   140 */    76,   20,   77,   79,   80,   56,   42,   20,   82,   20,
- /*   150 */   129,   69,   42,   90,   42,  130,   20,   84,   20,   89,
- /*   160 */    75,   42,   78,   42,   20,   23,   24,   20,   81,   42,
- /*   170 */    20,   83,   42,   20,  124,   42,   20,   88,   42,   74,
- /*   180 */    93,   42,    2,   92,   55,   85,   13,   27,   25,   28,
- /*   190 */   105,  118,   99,   31,  114,    3,  119,   33,   10,   14,
- /*   200 */    49,   26,  120,   15,   11,   16,   86,   36,  121,   17,
- /*   210 */   181,   37,  122,   18,   87,   38,  123,   19,  181,   21,
- /*   220 */   181,   40,  125,  127,   41,  126,  181,   12,   22,
+ /*     0 */   112,   96,   61,    4,  109,    9,  112,    2,   61,    4,
+ /*    10 */    99,    9,  112,  116,   61,    4,  117,    9,  118,  120,
+ /*    20 */    47,    5,    6,   30,   31,   56,  100,    5,  122,   30,
+ /*    30 */    31,   35,  134,    5,    2,   30,   31,  116,   59,  107,
+ /*    40 */   117,   56,  118,  120,   45,  116,   64,  107,  117,    7,
+ /*    50 */   118,  120,   45,  105,  116,   67,  107,  117,   60,  118,
+ /*    60 */   120,   45,    1,   61,  116,   33,   62,  117,  106,  118,
+ /*    70 */   120,   45,  116,    2,  121,  117,   65,  118,  120,   46,
+ /*    80 */   116,   53,  108,  117,  113,  118,  120,   45,  116,   63,
+ /*    90 */    61,  117,  111,  118,  120,   46,   56,   69,   74,  187,
+ /*   100 */   115,    2,  114,   79,  116,   82,   86,  117,    8,  118,
+ /*   110 */   120,   48,  116,   66,   54,  117,   55,  118,  120,   49,
+ /*   120 */   116,  101,   68,  117,   73,  118,  120,   50,  116,    2,
+ /*   130 */    70,  117,   36,  118,  120,   52,   56,   72,   21,   76,
+ /*   140 */   102,  103,   58,   44,   78,   90,   21,   81,   21,   41,
+ /*   150 */    71,   44,   95,   44,   84,   21,   88,   21,   89,   77,
+ /*   160 */    44,   80,   44,   21,   94,   21,  135,   83,   44,   85,
+ /*   170 */    44,  136,   21,   57,   21,    2,   87,   44,  130,   44,
+ /*   180 */    21,   75,   21,   13,   93,   44,   98,   44,    2,   97,
+ /*   190 */    24,   25,   26,   28,   29,   32,  104,  110,  119,  123,
+ /*   200 */     3,  124,   34,   10,   14,   51,   27,  125,   15,   11,
+ /*   210 */    16,   91,   37,  126,   17,  188,   38,  127,   18,   92,
+ /*   220 */    39,  128,   19,   20,  188,   40,   42,  188,   22,  188,
+ /*   230 */   129,  131,  133,  132,   12,   43,   23,
 };
 static const YYCODETYPE yy_lookahead[] = {
- /*     0 */     2,   29,    4,    5,    6,    7,    2,    7,    4,    5,
- /*    10 */    29,    7,    2,   43,    4,    5,   44,    7,   29,   47,
- /*    20 */    22,   21,   24,   25,    4,   44,   22,   23,   24,   25,
- /*    30 */    31,   32,   22,   44,   24,   25,   35,   36,   37,   38,
- /*    40 */     4,   40,   41,   42,   35,   36,   37,   38,   29,   40,
- /*    50 */    41,   42,    7,   35,   36,   37,   38,   15,   40,   41,
- /*    60 */    42,   35,   35,   44,   37,   38,   21,   40,   41,   42,
- /*    70 */    35,    4,    7,   38,   39,   40,   41,   42,   35,   14,
- /*    80 */    37,   38,   35,   40,   41,   42,   35,    7,    8,   38,
- /*    90 */    39,   40,   41,   42,   35,    7,    8,   38,    7,   40,
- /*   100 */    41,   42,    7,   35,   13,   10,   38,   45,   40,   41,
- /*   110 */    42,   35,   35,    1,   38,    3,   40,   41,   42,   35,
- /*   120 */    45,   43,   38,   16,   40,   41,   42,   35,   43,    4,
- /*   130 */    38,   33,   40,   41,   42,   46,   11,   12,   26,   27,
- /*   140 */    43,   30,   17,   43,   19,   34,   35,   30,   18,   30,
- /*   150 */    32,   34,   35,   34,   35,    0,   30,   43,   30,   43,
- /*   160 */    34,   35,   34,   35,   30,    2,    2,   30,   34,   35,
- /*   170 */    30,   34,   35,   30,   34,   35,   30,   34,   35,    8,
- /*   180 */    34,   35,    7,    8,    4,   14,    5,    8,    6,   20,
- /*   190 */     6,   23,    9,   20,    8,    7,    9,    8,    7,    5,
- /*   200 */     4,    6,    9,    5,    7,    5,    4,    6,    9,    5,
- /*   210 */    48,    6,    9,    5,    8,    6,    6,    5,   48,    5,
- /*   220 */    48,    6,    9,    6,    6,    9,   48,    7,    5,
+ /*     0 */     2,   15,    4,    5,    6,    7,    2,    7,    4,    5,
+ /*    10 */    30,    7,    2,   36,    4,    5,   39,    7,   41,   42,
+ /*    20 */    43,   23,   22,   25,   26,   45,   30,   23,   24,   25,
+ /*    30 */    26,   32,   33,   23,    7,   25,   26,   36,   37,   38,
+ /*    40 */    39,   45,   41,   42,   43,   36,   37,   38,   39,   22,
+ /*    50 */    41,   42,   43,    4,   36,   37,   38,   39,   44,   41,
+ /*    60 */    42,   43,    7,    4,   36,   10,   38,   39,   36,   41,
+ /*    70 */    42,   43,   36,    7,    8,   39,   40,   41,   42,   43,
+ /*    80 */    36,   30,   38,   39,   36,   41,   42,   43,   36,    4,
+ /*    90 */     4,   39,   40,   41,   42,   43,   45,   11,   12,   48,
+ /*   100 */    46,    7,   46,   17,   36,   19,   20,   39,   14,   41,
+ /*   110 */    42,   43,   36,   36,    1,   39,    3,   41,   42,   43,
+ /*   120 */    36,   30,   44,   39,   16,   41,   42,   43,   36,    7,
+ /*   130 */     8,   39,   34,   41,   42,   43,   45,   44,   31,    8,
+ /*   140 */    27,   28,   35,   36,   44,   14,   31,   44,   31,   47,
+ /*   150 */    35,   36,   35,   36,   18,   31,   44,   31,   44,   35,
+ /*   160 */    36,   35,   36,   31,   44,   31,   33,   35,   36,   35,
+ /*   170 */    36,    0,   31,    4,   31,    7,   35,   36,   35,   36,
+ /*   180 */    31,   13,   31,    5,   35,   36,   35,   36,    7,    8,
+ /*   190 */     2,    2,    6,    8,   21,   21,    9,    6,    8,   24,
+ /*   200 */     7,    9,    8,    7,    5,    4,    6,    9,    5,    7,
+ /*   210 */     5,    4,    6,    9,    5,   49,    6,    9,    5,    8,
+ /*   220 */     6,    6,    5,    5,   49,    6,    6,   49,    5,   49,
+ /*   230 */     9,    9,    6,    9,    7,    6,    5,
 };
-#define YY_SHIFT_USE_DFLT (-3)
-#define YY_SHIFT_MAX 93
+#define YY_SHIFT_USE_DFLT (-15)
+#define YY_SHIFT_MAX 98
 static const short yy_shift_ofst[] = {
- /*     0 */   112,   10,   10,   10,   -2,    4,   10,   10,   10,   10,
- /*    10 */    10,   10,   10,  125,  125,  125,  125,  125,  125,  125,
- /*    20 */   125,  125,  125,  112,  112,  112,   42,   20,   36,   36,
- /*    30 */    67,   67,   36,   20,  107,   20,   20,   20,  130,   20,
- /*    40 */    20,   42,   95,    0,   65,   45,   80,   88,   91,  171,
- /*    50 */   175,  155,  163,  164,  180,  181,  182,  179,  183,  169,
- /*    60 */   184,  173,  186,  168,  188,  189,  187,  191,  194,  195,
- /*    70 */   193,  198,  197,  196,  200,  201,  199,  204,  205,  203,
- /*    80 */   208,  209,  212,  210,  213,  202,  206,  214,  215,  216,
- /*    90 */   217,  220,  223,  218,
+ /*     0 */   113,   10,   10,   10,   -2,    4,   10,   10,   10,   10,
+ /*    10 */    10,   10,   10,   86,   86,   86,   86,   86,   86,   86,
+ /*    20 */    86,   86,   86,   86,  113,  113,  113,  -14,   49,   59,
+ /*    30 */    59,   85,   85,   59,   49,  108,   49,   49,   49,  136,
+ /*    40 */    49,   49,   49,  -14,   55,    0,   94,   27,   66,  122,
+ /*    50 */   168,  131,  181,  171,  188,  189,  169,  178,  186,  185,
+ /*    60 */   187,  173,  191,  174,  190,  175,  193,  194,  192,  196,
+ /*    70 */   199,  200,  198,  203,  202,  201,  205,  206,  204,  209,
+ /*    80 */   210,  208,  213,  214,  217,  215,  218,  219,  221,  222,
+ /*    90 */   207,  211,  223,  220,  224,  226,  227,  231,  229,
 };
-#define YY_REDUCE_USE_DFLT (-31)
-#define YY_REDUCE_MAX 41
+#define YY_REDUCE_USE_DFLT (-24)
+#define YY_REDUCE_MAX 43
 static const short yy_reduce_ofst[] = {
- /*     0 */   -28,    1,    9,   18,   27,   35,   43,   51,   59,   68,
- /*    10 */    76,   84,   92,  111,  117,  119,  126,  128,  134,  137,
- /*    20 */   140,  143,  146,  -19,  -11,   19,   -1,  -30,   26,   47,
- /*    30 */    62,   75,   77,   78,   98,   85,   97,  100,   89,  114,
- /*    40 */   116,  118,
+ /*     0 */    51,    1,    9,   18,   28,   36,   44,   52,  -23,   68,
+ /*    10 */    76,   84,   92,  107,  115,  117,  124,  126,  132,  134,
+ /*    20 */   141,  143,  149,  151,  -20,   -4,   91,   -1,   14,   32,
+ /*    30 */    48,   54,   56,   77,   78,   98,   93,  100,  103,  102,
+ /*    40 */   112,  114,  120,  133,
 };
 static const YYACTIONTYPE yy_default[] = {
- /*     0 */   131,  156,  156,  156,  179,  179,  179,  179,  179,  179,
- /*    10 */   179,  179,  179,  179,  179,  179,  179,  179,  179,  179,
- /*    20 */   150,  179,  179,  131,  131,  131,  140,  175,  179,  179,
- /*    30 */   179,  179,  179,  175,  144,  175,  175,  175,  147,  175,
- /*    40 */   175,  142,  179,  158,  179,  162,  179,  179,  179,  179,
- /*    50 */   179,  179,  179,  179,  179,  179,  179,  179,  179,  152,
- /*    60 */   179,  154,  179,  179,  179,  179,  179,  179,  179,  179,
- /*    70 */   179,  179,  179,  179,  179,  179,  179,  179,  179,  179,
- /*    80 */   179,  179,  179,  179,  179,  179,  179,  179,  179,  179,
- /*    90 */   179,  179,  179,  179,  132,  133,  134,  177,  178,  135,
- /*   100 */   176,  153,  157,  159,  160,  161,  163,  167,  168,  155,
- /*   110 */   169,  170,  171,  172,  166,  174,  173,  164,  165,  136,
- /*   120 */   137,  138,  146,  148,  151,  149,  139,  145,  141,  143,
+ /*     0 */   137,  163,  163,  163,  186,  186,  186,  186,  186,  186,
+ /*    10 */   186,  186,  186,  186,  186,  186,  186,  186,  186,  186,
+ /*    20 */   186,  157,  186,  186,  137,  137,  137,  146,  182,  186,
+ /*    30 */   186,  186,  186,  186,  182,  150,  182,  182,  182,  153,
+ /*    40 */   182,  182,  182,  148,  186,  165,  186,  169,  186,  186,
+ /*    50 */   186,  186,  186,  186,  186,  186,  186,  186,  186,  186,
+ /*    60 */   186,  159,  186,  161,  186,  186,  186,  186,  186,  186,
+ /*    70 */   186,  186,  186,  186,  186,  186,  186,  186,  186,  186,
+ /*    80 */   186,  186,  186,  186,  186,  186,  186,  186,  186,  186,
+ /*    90 */   186,  186,  186,  186,  186,  186,  186,  186,  186,  138,
+ /*   100 */   139,  140,  184,  185,  141,  183,  160,  164,  166,  167,
+ /*   110 */   168,  170,  174,  175,  162,  176,  177,  178,  179,  173,
+ /*   120 */   181,  180,  171,  172,  142,  143,  144,  152,  154,  156,
+ /*   130 */   158,  155,  145,  151,  147,  149,
 };
 #define YY_SZ_ACTTAB (int)(sizeof(yy_action)/sizeof(yy_action[0]))
 
@@ -385,13 +388,14 @@ static const char *const yyTokenName[] = {
   "ROUND_CLOSE",   "SEMICOLON",     "ARROW",         "IF",          
   "FOREACH",       "AS",            "COLON",         "ELIF",        
   "ELSE",          "BLOCK",         "TOKEN_INTERRUPT",  "TOKEN_DO",    
-  "DOT",           "COMMA",         "BRACKET_OPEN",  "BRACKET_CLOSE",
-  "AT_SIGN",       "CARET",         "PROCESS",       "TEMPLATE",    
-  "error",         "processes",     "statement",     "elif_maybe",  
-  "elif",          "else_maybe",    "statements",    "dotted_name", 
-  "list_contents_maybe",  "list_contents",  "list",          "map_contents",
-  "map",           "invoc",         "value",         "name_maybe",  
-  "process_or_template",  "name_list",     "interrupt_maybe",  "input",       
+  "TOKEN_PARALLEL",  "DOT",           "COMMA",         "BRACKET_OPEN",
+  "BRACKET_CLOSE",  "AT_SIGN",       "CARET",         "PROCESS",     
+  "TEMPLATE",      "error",         "processes",     "statement",   
+  "elif_maybe",    "elif",          "else_maybe",    "statements",  
+  "dotted_name",   "list_contents_maybe",  "list_contents",  "list",        
+  "map_contents",  "map",           "invoc",         "value",       
+  "name_maybe",    "process_or_template",  "name_list",     "interrupt_maybe",
+  "input",       
 };
 #endif /* NDEBUG */
 
@@ -419,35 +423,36 @@ static const char *const yyRuleName[] = {
  /*  17 */ "interrupt_maybe ::=",
  /*  18 */ "interrupt_maybe ::= TOKEN_INTERRUPT CURLY_OPEN statements CURLY_CLOSE",
  /*  19 */ "statement ::= TOKEN_DO CURLY_OPEN statements CURLY_CLOSE interrupt_maybe name_maybe SEMICOLON",
- /*  20 */ "statements ::= statement",
- /*  21 */ "statements ::= statement statements",
- /*  22 */ "dotted_name ::= NAME",
- /*  23 */ "dotted_name ::= NAME DOT dotted_name",
- /*  24 */ "name_list ::= NAME",
- /*  25 */ "name_list ::= NAME DOT name_list",
- /*  26 */ "list_contents_maybe ::=",
- /*  27 */ "list_contents_maybe ::= list_contents",
- /*  28 */ "list_contents ::= value",
- /*  29 */ "list_contents ::= value COMMA list_contents",
- /*  30 */ "list ::= CURLY_OPEN CURLY_CLOSE",
- /*  31 */ "list ::= CURLY_OPEN list_contents CURLY_CLOSE",
- /*  32 */ "map_contents ::= value COLON value",
- /*  33 */ "map_contents ::= value COLON value COMMA map_contents",
- /*  34 */ "map ::= BRACKET_OPEN BRACKET_CLOSE",
- /*  35 */ "map ::= BRACKET_OPEN map_contents BRACKET_CLOSE",
- /*  36 */ "invoc ::= value ROUND_OPEN list_contents_maybe ROUND_CLOSE",
- /*  37 */ "value ::= STRING",
- /*  38 */ "value ::= AT_SIGN dotted_name",
- /*  39 */ "value ::= CARET name_list",
- /*  40 */ "value ::= dotted_name",
- /*  41 */ "value ::= list",
- /*  42 */ "value ::= map",
- /*  43 */ "value ::= ROUND_OPEN value ROUND_CLOSE",
- /*  44 */ "value ::= invoc",
- /*  45 */ "name_maybe ::=",
- /*  46 */ "name_maybe ::= NAME",
- /*  47 */ "process_or_template ::= PROCESS",
- /*  48 */ "process_or_template ::= TEMPLATE",
+ /*  20 */ "statement ::= TOKEN_PARALLEL CURLY_OPEN statements CURLY_CLOSE name_maybe SEMICOLON",
+ /*  21 */ "statements ::= statement",
+ /*  22 */ "statements ::= statement statements",
+ /*  23 */ "dotted_name ::= NAME",
+ /*  24 */ "dotted_name ::= NAME DOT dotted_name",
+ /*  25 */ "name_list ::= NAME",
+ /*  26 */ "name_list ::= NAME DOT name_list",
+ /*  27 */ "list_contents_maybe ::=",
+ /*  28 */ "list_contents_maybe ::= list_contents",
+ /*  29 */ "list_contents ::= value",
+ /*  30 */ "list_contents ::= value COMMA list_contents",
+ /*  31 */ "list ::= CURLY_OPEN CURLY_CLOSE",
+ /*  32 */ "list ::= CURLY_OPEN list_contents CURLY_CLOSE",
+ /*  33 */ "map_contents ::= value COLON value",
+ /*  34 */ "map_contents ::= value COLON value COMMA map_contents",
+ /*  35 */ "map ::= BRACKET_OPEN BRACKET_CLOSE",
+ /*  36 */ "map ::= BRACKET_OPEN map_contents BRACKET_CLOSE",
+ /*  37 */ "invoc ::= value ROUND_OPEN list_contents_maybe ROUND_CLOSE",
+ /*  38 */ "value ::= STRING",
+ /*  39 */ "value ::= AT_SIGN dotted_name",
+ /*  40 */ "value ::= CARET name_list",
+ /*  41 */ "value ::= dotted_name",
+ /*  42 */ "value ::= list",
+ /*  43 */ "value ::= map",
+ /*  44 */ "value ::= ROUND_OPEN value ROUND_CLOSE",
+ /*  45 */ "value ::= invoc",
+ /*  46 */ "name_maybe ::=",
+ /*  47 */ "name_maybe ::= NAME",
+ /*  48 */ "process_or_template ::= PROCESS",
+ /*  49 */ "process_or_template ::= TEMPLATE",
 };
 #endif /* NDEBUG */
 
@@ -546,71 +551,72 @@ static void yy_destructor(
     case 17: /* BLOCK */
     case 18: /* TOKEN_INTERRUPT */
     case 19: /* TOKEN_DO */
-    case 20: /* DOT */
-    case 21: /* COMMA */
-    case 22: /* BRACKET_OPEN */
-    case 23: /* BRACKET_CLOSE */
-    case 24: /* AT_SIGN */
-    case 25: /* CARET */
-    case 26: /* PROCESS */
-    case 27: /* TEMPLATE */
+    case 20: /* TOKEN_PARALLEL */
+    case 21: /* DOT */
+    case 22: /* COMMA */
+    case 23: /* BRACKET_OPEN */
+    case 24: /* BRACKET_CLOSE */
+    case 25: /* AT_SIGN */
+    case 26: /* CARET */
+    case 27: /* PROCESS */
+    case 28: /* TEMPLATE */
 {
 #line 89 "NCDConfigParser_parse.y"
  free_token((yypminor->yy0)); 
-#line 561 "NCDConfigParser_parse.c"
+#line 567 "NCDConfigParser_parse.c"
 }
       break;
-    case 29: /* processes */
+    case 30: /* processes */
 {
 #line 111 "NCDConfigParser_parse.y"
- (void)parser_out; free_program((yypminor->yy6)); 
-#line 568 "NCDConfigParser_parse.c"
+ (void)parser_out; free_program((yypminor->yy18)); 
+#line 574 "NCDConfigParser_parse.c"
 }
       break;
-    case 30: /* statement */
+    case 31: /* statement */
 {
 #line 112 "NCDConfigParser_parse.y"
- free_statement((yypminor->yy47)); 
-#line 575 "NCDConfigParser_parse.c"
+ free_statement((yypminor->yy77)); 
+#line 581 "NCDConfigParser_parse.c"
 }
       break;
-    case 31: /* elif_maybe */
-    case 32: /* elif */
+    case 32: /* elif_maybe */
+    case 33: /* elif */
 {
 #line 113 "NCDConfigParser_parse.y"
- free_ifblock((yypminor->yy44)); 
-#line 583 "NCDConfigParser_parse.c"
+ free_ifblock((yypminor->yy32)); 
+#line 589 "NCDConfigParser_parse.c"
 }
       break;
-    case 33: /* else_maybe */
-    case 34: /* statements */
-    case 46: /* interrupt_maybe */
+    case 34: /* else_maybe */
+    case 35: /* statements */
+    case 47: /* interrupt_maybe */
 {
 #line 115 "NCDConfigParser_parse.y"
- free_block((yypminor->yy69)); 
-#line 592 "NCDConfigParser_parse.c"
+ free_block((yypminor->yy79)); 
+#line 598 "NCDConfigParser_parse.c"
 }
       break;
-    case 35: /* dotted_name */
-    case 43: /* name_maybe */
+    case 36: /* dotted_name */
+    case 44: /* name_maybe */
 {
 #line 117 "NCDConfigParser_parse.y"
- free((yypminor->yy49)); 
-#line 600 "NCDConfigParser_parse.c"
+ free((yypminor->yy29)); 
+#line 606 "NCDConfigParser_parse.c"
 }
       break;
-    case 36: /* list_contents_maybe */
-    case 37: /* list_contents */
-    case 38: /* list */
-    case 39: /* map_contents */
-    case 40: /* map */
-    case 41: /* invoc */
-    case 42: /* value */
-    case 45: /* name_list */
+    case 37: /* list_contents_maybe */
+    case 38: /* list_contents */
+    case 39: /* list */
+    case 40: /* map_contents */
+    case 41: /* map */
+    case 42: /* invoc */
+    case 43: /* value */
+    case 46: /* name_list */
 {
 #line 118 "NCDConfigParser_parse.y"
- free_value((yypminor->yy19)); 
-#line 614 "NCDConfigParser_parse.c"
+ free_value((yypminor->yy5)); 
+#line 620 "NCDConfigParser_parse.c"
 }
       break;
     default:  break;   /* If no destructor action specified: do nothing */
@@ -788,7 +794,7 @@ static void yyStackOverflow(yyParser *yypParser, YYMINORTYPE *yypMinor){
     if (yypMinor) {
         free_token(yypMinor->yy0);
     }
-#line 792 "NCDConfigParser_parse.c"
+#line 798 "NCDConfigParser_parse.c"
    ParseARG_STORE; /* Suppress warning about unused %extra_argument var */
 }
 
@@ -845,55 +851,56 @@ static const struct {
   YYCODETYPE lhs;         /* Symbol on the left-hand side of the rule */
   unsigned char nrhs;     /* Number of right-hand side symbols in the rule */
 } yyRuleInfo[] = {
-  { 47, 1 },
-  { 29, 0 },
-  { 29, 3 },
-  { 29, 3 },
-  { 29, 6 },
+  { 48, 1 },
+  { 30, 0 },
+  { 30, 3 },
+  { 30, 3 },
   { 30, 6 },
-  { 30, 8 },
-  { 30, 11 },
-  { 30, 11 },
-  { 30, 13 },
-  { 31, 0 },
-  { 31, 1 },
-  { 32, 7 },
-  { 32, 8 },
-  { 33, 0 },
-  { 33, 4 },
-  { 30, 6 },
-  { 46, 0 },
-  { 46, 4 },
-  { 30, 7 },
-  { 34, 1 },
-  { 34, 2 },
+  { 31, 6 },
+  { 31, 8 },
+  { 31, 11 },
+  { 31, 11 },
+  { 31, 13 },
+  { 32, 0 },
+  { 32, 1 },
+  { 33, 7 },
+  { 33, 8 },
+  { 34, 0 },
+  { 34, 4 },
+  { 31, 6 },
+  { 47, 0 },
+  { 47, 4 },
+  { 31, 7 },
+  { 31, 6 },
   { 35, 1 },
-  { 35, 3 },
-  { 45, 1 },
-  { 45, 3 },
-  { 36, 0 },
+  { 35, 2 },
   { 36, 1 },
+  { 36, 3 },
+  { 46, 1 },
+  { 46, 3 },
+  { 37, 0 },
   { 37, 1 },
-  { 37, 3 },
-  { 38, 2 },
+  { 38, 1 },
   { 38, 3 },
+  { 39, 2 },
   { 39, 3 },
-  { 39, 5 },
-  { 40, 2 },
   { 40, 3 },
-  { 41, 4 },
-  { 42, 1 },
-  { 42, 2 },
-  { 42, 2 },
-  { 42, 1 },
-  { 42, 1 },
-  { 42, 1 },
-  { 42, 3 },
-  { 42, 1 },
-  { 43, 0 },
+  { 40, 5 },
+  { 41, 2 },
+  { 41, 3 },
+  { 42, 4 },
   { 43, 1 },
+  { 43, 2 },
+  { 43, 2 },
+  { 43, 1 },
+  { 43, 1 },
+  { 43, 1 },
+  { 43, 3 },
+  { 43, 1 },
+  { 44, 0 },
   { 44, 1 },
-  { 44, 1 },
+  { 45, 1 },
+  { 45, 1 },
 };
 
 static void yy_accept(yyParser*);  /* Forward Declaration */
@@ -953,12 +960,12 @@ static void yy_reduce(
 {
     ASSERT(!parser_out->have_ast)
 
-    if (yymsp[0].minor.yy6.have) {
+    if (yymsp[0].minor.yy18.have) {
         parser_out->have_ast = 1;
-        parser_out->ast = yymsp[0].minor.yy6.v;
+        parser_out->ast = yymsp[0].minor.yy18.v;
     }
 }
-#line 962 "NCDConfigParser_parse.c"
+#line 969 "NCDConfigParser_parse.c"
         break;
       case 1: /* processes ::= */
 #line 151 "NCDConfigParser_parse.y"
@@ -966,16 +973,16 @@ static void yy_reduce(
     NCDProgram prog;
     NCDProgram_Init(&prog);
     
-    yygotominor.yy6.have = 1;
-    yygotominor.yy6.v = prog;
+    yygotominor.yy18.have = 1;
+    yygotominor.yy18.v = prog;
 }
-#line 973 "NCDConfigParser_parse.c"
+#line 980 "NCDConfigParser_parse.c"
         break;
       case 2: /* processes ::= INCLUDE STRING processes */
 #line 159 "NCDConfigParser_parse.y"
 {
     ASSERT(yymsp[-1].minor.yy0.str)
-    if (!yymsp[0].minor.yy6.have) {
+    if (!yymsp[0].minor.yy18.have) {
         goto failA0;
     }
     
@@ -984,32 +991,32 @@ static void yy_reduce(
         goto failA0;
     }
     
-    if (!NCDProgram_PrependElem(&yymsp[0].minor.yy6.v, elem)) {
+    if (!NCDProgram_PrependElem(&yymsp[0].minor.yy18.v, elem)) {
         goto failA1;
     }
     
-    yygotominor.yy6.have = 1;
-    yygotominor.yy6.v = yymsp[0].minor.yy6.v;
-    yymsp[0].minor.yy6.have = 0;
+    yygotominor.yy18.have = 1;
+    yygotominor.yy18.v = yymsp[0].minor.yy18.v;
+    yymsp[0].minor.yy18.have = 0;
     goto doneA;
 
 failA1:
     NCDProgramElem_Free(&elem);
 failA0:
-    yygotominor.yy6.have = 0;
+    yygotominor.yy18.have = 0;
     parser_out->out_of_memory = 1;
 doneA:
     free_token(yymsp[-1].minor.yy0);
-    free_program(yymsp[0].minor.yy6);
+    free_program(yymsp[0].minor.yy18);
   yy_destructor(yypParser,1,&yymsp[-2].minor);
 }
-#line 1007 "NCDConfigParser_parse.c"
+#line 1014 "NCDConfigParser_parse.c"
         break;
       case 3: /* processes ::= INCLUDE_GUARD STRING processes */
 #line 189 "NCDConfigParser_parse.y"
 {
     ASSERT(yymsp[-1].minor.yy0.str)
-    if (!yymsp[0].minor.yy6.have) {
+    if (!yymsp[0].minor.yy18.have) {
         goto failZ0;
     }
     
@@ -1018,164 +1025,164 @@ doneA:
         goto failZ0;
     }
     
-    if (!NCDProgram_PrependElem(&yymsp[0].minor.yy6.v, elem)) {
+    if (!NCDProgram_PrependElem(&yymsp[0].minor.yy18.v, elem)) {
         goto failZ1;
     }
     
-    yygotominor.yy6.have = 1;
-    yygotominor.yy6.v = yymsp[0].minor.yy6.v;
-    yymsp[0].minor.yy6.have = 0;
+    yygotominor.yy18.have = 1;
+    yygotominor.yy18.v = yymsp[0].minor.yy18.v;
+    yymsp[0].minor.yy18.have = 0;
     goto doneZ;
 
 failZ1:
     NCDProgramElem_Free(&elem);
 failZ0:
-    yygotominor.yy6.have = 0;
+    yygotominor.yy18.have = 0;
     parser_out->out_of_memory = 1;
 doneZ:
     free_token(yymsp[-1].minor.yy0);
-    free_program(yymsp[0].minor.yy6);
+    free_program(yymsp[0].minor.yy18);
   yy_destructor(yypParser,3,&yymsp[-2].minor);
 }
-#line 1041 "NCDConfigParser_parse.c"
+#line 1048 "NCDConfigParser_parse.c"
         break;
       case 4: /* processes ::= process_or_template NAME CURLY_OPEN statements CURLY_CLOSE processes */
 #line 219 "NCDConfigParser_parse.y"
 {
     ASSERT(yymsp[-4].minor.yy0.str)
-    if (!yymsp[-2].minor.yy69.have || !yymsp[0].minor.yy6.have) {
+    if (!yymsp[-2].minor.yy79.have || !yymsp[0].minor.yy18.have) {
         goto failB0;
     }
 
     NCDProcess proc;
-    if (!NCDProcess_Init(&proc, yymsp[-5].minor.yy28, yymsp[-4].minor.yy0.str, yymsp[-2].minor.yy69.v)) {
+    if (!NCDProcess_Init(&proc, yymsp[-5].minor.yy33, yymsp[-4].minor.yy0.str, yymsp[-2].minor.yy79.v)) {
         goto failB0;
     }
-    yymsp[-2].minor.yy69.have = 0;
+    yymsp[-2].minor.yy79.have = 0;
     
     NCDProgramElem elem;
     NCDProgramElem_InitProcess(&elem, proc);
 
-    if (!NCDProgram_PrependElem(&yymsp[0].minor.yy6.v, elem)) {
+    if (!NCDProgram_PrependElem(&yymsp[0].minor.yy18.v, elem)) {
         goto failB1;
     }
 
-    yygotominor.yy6.have = 1;
-    yygotominor.yy6.v = yymsp[0].minor.yy6.v;
-    yymsp[0].minor.yy6.have = 0;
+    yygotominor.yy18.have = 1;
+    yygotominor.yy18.v = yymsp[0].minor.yy18.v;
+    yymsp[0].minor.yy18.have = 0;
     goto doneB;
 
 failB1:
     NCDProgramElem_Free(&elem);
 failB0:
-    yygotominor.yy6.have = 0;
+    yygotominor.yy18.have = 0;
     parser_out->out_of_memory = 1;
 doneB:
     free_token(yymsp[-4].minor.yy0);
-    free_block(yymsp[-2].minor.yy69);
-    free_program(yymsp[0].minor.yy6);
+    free_block(yymsp[-2].minor.yy79);
+    free_program(yymsp[0].minor.yy18);
   yy_destructor(yypParser,5,&yymsp[-3].minor);
   yy_destructor(yypParser,6,&yymsp[-1].minor);
 }
-#line 1081 "NCDConfigParser_parse.c"
+#line 1088 "NCDConfigParser_parse.c"
         break;
       case 5: /* statement ::= dotted_name ROUND_OPEN list_contents_maybe ROUND_CLOSE name_maybe SEMICOLON */
 #line 254 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-5].minor.yy49 || !yymsp[-3].minor.yy19.have) {
+    if (!yymsp[-5].minor.yy29 || !yymsp[-3].minor.yy5.have) {
         goto failC0;
     }
 
-    if (!NCDStatement_InitReg(&yygotominor.yy47.v, yymsp[-1].minor.yy49, NULL, yymsp[-5].minor.yy49, yymsp[-3].minor.yy19.v)) {
+    if (!NCDStatement_InitReg(&yygotominor.yy77.v, yymsp[-1].minor.yy29, NULL, yymsp[-5].minor.yy29, yymsp[-3].minor.yy5.v)) {
         goto failC0;
     }
-    yymsp[-3].minor.yy19.have = 0;
+    yymsp[-3].minor.yy5.have = 0;
 
-    yygotominor.yy47.have = 1;
+    yygotominor.yy77.have = 1;
     goto doneC;
 
 failC0:
-    yygotominor.yy47.have = 0;
+    yygotominor.yy77.have = 0;
     parser_out->out_of_memory = 1;
 doneC:
-    free(yymsp[-5].minor.yy49);
-    free_value(yymsp[-3].minor.yy19);
-    free(yymsp[-1].minor.yy49);
+    free(yymsp[-5].minor.yy29);
+    free_value(yymsp[-3].minor.yy5);
+    free(yymsp[-1].minor.yy29);
   yy_destructor(yypParser,7,&yymsp[-4].minor);
   yy_destructor(yypParser,8,&yymsp[-2].minor);
   yy_destructor(yypParser,9,&yymsp[0].minor);
 }
-#line 1109 "NCDConfigParser_parse.c"
+#line 1116 "NCDConfigParser_parse.c"
         break;
       case 6: /* statement ::= dotted_name ARROW dotted_name ROUND_OPEN list_contents_maybe ROUND_CLOSE name_maybe SEMICOLON */
 #line 276 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-7].minor.yy49 || !yymsp[-5].minor.yy49 || !yymsp[-3].minor.yy19.have) {
+    if (!yymsp[-7].minor.yy29 || !yymsp[-5].minor.yy29 || !yymsp[-3].minor.yy5.have) {
         goto failD0;
     }
 
-    if (!NCDStatement_InitReg(&yygotominor.yy47.v, yymsp[-1].minor.yy49, yymsp[-7].minor.yy49, yymsp[-5].minor.yy49, yymsp[-3].minor.yy19.v)) {
+    if (!NCDStatement_InitReg(&yygotominor.yy77.v, yymsp[-1].minor.yy29, yymsp[-7].minor.yy29, yymsp[-5].minor.yy29, yymsp[-3].minor.yy5.v)) {
         goto failD0;
     }
-    yymsp[-3].minor.yy19.have = 0;
+    yymsp[-3].minor.yy5.have = 0;
 
-    yygotominor.yy47.have = 1;
+    yygotominor.yy77.have = 1;
     goto doneD;
 
 failD0:
-    yygotominor.yy47.have = 0;
+    yygotominor.yy77.have = 0;
     parser_out->out_of_memory = 1;
 doneD:
-    free(yymsp[-7].minor.yy49);
-    free(yymsp[-5].minor.yy49);
-    free_value(yymsp[-3].minor.yy19);
-    free(yymsp[-1].minor.yy49);
+    free(yymsp[-7].minor.yy29);
+    free(yymsp[-5].minor.yy29);
+    free_value(yymsp[-3].minor.yy5);
+    free(yymsp[-1].minor.yy29);
   yy_destructor(yypParser,10,&yymsp[-6].minor);
   yy_destructor(yypParser,7,&yymsp[-4].minor);
   yy_destructor(yypParser,8,&yymsp[-2].minor);
   yy_destructor(yypParser,9,&yymsp[0].minor);
 }
-#line 1139 "NCDConfigParser_parse.c"
+#line 1146 "NCDConfigParser_parse.c"
         break;
       case 7: /* statement ::= IF ROUND_OPEN value ROUND_CLOSE CURLY_OPEN statements CURLY_CLOSE elif_maybe else_maybe name_maybe SEMICOLON */
 #line 299 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-8].minor.yy19.have || !yymsp[-5].minor.yy69.have || !yymsp[-3].minor.yy44.have) {
+    if (!yymsp[-8].minor.yy5.have || !yymsp[-5].minor.yy79.have || !yymsp[-3].minor.yy32.have) {
         goto failE0;
     }
 
     NCDIf ifc;
-    NCDIf_Init(&ifc, yymsp[-8].minor.yy19.v, yymsp[-5].minor.yy69.v);
-    yymsp[-8].minor.yy19.have = 0;
-    yymsp[-5].minor.yy69.have = 0;
+    NCDIf_Init(&ifc, yymsp[-8].minor.yy5.v, yymsp[-5].minor.yy79.v);
+    yymsp[-8].minor.yy5.have = 0;
+    yymsp[-5].minor.yy79.have = 0;
 
-    if (!NCDIfBlock_PrependIf(&yymsp[-3].minor.yy44.v, ifc)) {
+    if (!NCDIfBlock_PrependIf(&yymsp[-3].minor.yy32.v, ifc)) {
         NCDIf_Free(&ifc);
         goto failE0;
     }
 
-    if (!NCDStatement_InitIf(&yygotominor.yy47.v, yymsp[-1].minor.yy49, yymsp[-3].minor.yy44.v, NCDIFTYPE_IF)) {
+    if (!NCDStatement_InitIf(&yygotominor.yy77.v, yymsp[-1].minor.yy29, yymsp[-3].minor.yy32.v, NCDIFTYPE_IF)) {
         goto failE0;
     }
-    yymsp[-3].minor.yy44.have = 0;
+    yymsp[-3].minor.yy32.have = 0;
 
-    if (yymsp[-2].minor.yy69.have) {
-        NCDStatement_IfAddElse(&yygotominor.yy47.v, yymsp[-2].minor.yy69.v);
-        yymsp[-2].minor.yy69.have = 0;
+    if (yymsp[-2].minor.yy79.have) {
+        NCDStatement_IfAddElse(&yygotominor.yy77.v, yymsp[-2].minor.yy79.v);
+        yymsp[-2].minor.yy79.have = 0;
     }
 
-    yygotominor.yy47.have = 1;
+    yygotominor.yy77.have = 1;
     goto doneE;
 
 failE0:
-    yygotominor.yy47.have = 0;
+    yygotominor.yy77.have = 0;
     parser_out->out_of_memory = 1;
 doneE:
-    free_value(yymsp[-8].minor.yy19);
-    free_block(yymsp[-5].minor.yy69);
-    free_ifblock(yymsp[-3].minor.yy44);
-    free_block(yymsp[-2].minor.yy69);
-    free(yymsp[-1].minor.yy49);
+    free_value(yymsp[-8].minor.yy5);
+    free_block(yymsp[-5].minor.yy79);
+    free_ifblock(yymsp[-3].minor.yy32);
+    free_block(yymsp[-2].minor.yy79);
+    free(yymsp[-1].minor.yy29);
   yy_destructor(yypParser,11,&yymsp[-10].minor);
   yy_destructor(yypParser,7,&yymsp[-9].minor);
   yy_destructor(yypParser,8,&yymsp[-7].minor);
@@ -1183,32 +1190,32 @@ doneE:
   yy_destructor(yypParser,6,&yymsp[-4].minor);
   yy_destructor(yypParser,9,&yymsp[0].minor);
 }
-#line 1187 "NCDConfigParser_parse.c"
+#line 1194 "NCDConfigParser_parse.c"
         break;
       case 8: /* statement ::= FOREACH ROUND_OPEN value AS NAME ROUND_CLOSE CURLY_OPEN statements CURLY_CLOSE name_maybe SEMICOLON */
 #line 338 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-8].minor.yy19.have || !yymsp[-6].minor.yy0.str || !yymsp[-3].minor.yy69.have) {
+    if (!yymsp[-8].minor.yy5.have || !yymsp[-6].minor.yy0.str || !yymsp[-3].minor.yy79.have) {
         goto failEA0;
     }
     
-    if (!NCDStatement_InitForeach(&yygotominor.yy47.v, yymsp[-1].minor.yy49, yymsp[-8].minor.yy19.v, yymsp[-6].minor.yy0.str, NULL, yymsp[-3].minor.yy69.v)) {
+    if (!NCDStatement_InitForeach(&yygotominor.yy77.v, yymsp[-1].minor.yy29, yymsp[-8].minor.yy5.v, yymsp[-6].minor.yy0.str, NULL, yymsp[-3].minor.yy79.v)) {
         goto failEA0;
     }
-    yymsp[-8].minor.yy19.have = 0;
-    yymsp[-3].minor.yy69.have = 0;
+    yymsp[-8].minor.yy5.have = 0;
+    yymsp[-3].minor.yy79.have = 0;
     
-    yygotominor.yy47.have = 1;
+    yygotominor.yy77.have = 1;
     goto doneEA0;
     
 failEA0:
-    yygotominor.yy47.have = 0;
+    yygotominor.yy77.have = 0;
     parser_out->out_of_memory = 1;
 doneEA0:
-    free_value(yymsp[-8].minor.yy19);
+    free_value(yymsp[-8].minor.yy5);
     free_token(yymsp[-6].minor.yy0);
-    free_block(yymsp[-3].minor.yy69);
-    free(yymsp[-1].minor.yy49);
+    free_block(yymsp[-3].minor.yy79);
+    free(yymsp[-1].minor.yy29);
   yy_destructor(yypParser,12,&yymsp[-10].minor);
   yy_destructor(yypParser,7,&yymsp[-9].minor);
   yy_destructor(yypParser,13,&yymsp[-7].minor);
@@ -1217,33 +1224,33 @@ doneEA0:
   yy_destructor(yypParser,6,&yymsp[-2].minor);
   yy_destructor(yypParser,9,&yymsp[0].minor);
 }
-#line 1221 "NCDConfigParser_parse.c"
+#line 1228 "NCDConfigParser_parse.c"
         break;
       case 9: /* statement ::= FOREACH ROUND_OPEN value AS NAME COLON NAME ROUND_CLOSE CURLY_OPEN statements CURLY_CLOSE name_maybe SEMICOLON */
 #line 362 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-10].minor.yy19.have || !yymsp[-8].minor.yy0.str || !yymsp[-6].minor.yy0.str || !yymsp[-3].minor.yy69.have) {
+    if (!yymsp[-10].minor.yy5.have || !yymsp[-8].minor.yy0.str || !yymsp[-6].minor.yy0.str || !yymsp[-3].minor.yy79.have) {
         goto failEB0;
     }
     
-    if (!NCDStatement_InitForeach(&yygotominor.yy47.v, yymsp[-1].minor.yy49, yymsp[-10].minor.yy19.v, yymsp[-8].minor.yy0.str, yymsp[-6].minor.yy0.str, yymsp[-3].minor.yy69.v)) {
+    if (!NCDStatement_InitForeach(&yygotominor.yy77.v, yymsp[-1].minor.yy29, yymsp[-10].minor.yy5.v, yymsp[-8].minor.yy0.str, yymsp[-6].minor.yy0.str, yymsp[-3].minor.yy79.v)) {
         goto failEB0;
     }
-    yymsp[-10].minor.yy19.have = 0;
-    yymsp[-3].minor.yy69.have = 0;
+    yymsp[-10].minor.yy5.have = 0;
+    yymsp[-3].minor.yy79.have = 0;
     
-    yygotominor.yy47.have = 1;
+    yygotominor.yy77.have = 1;
     goto doneEB0;
     
 failEB0:
-    yygotominor.yy47.have = 0;
+    yygotominor.yy77.have = 0;
     parser_out->out_of_memory = 1;
 doneEB0:
-    free_value(yymsp[-10].minor.yy19);
+    free_value(yymsp[-10].minor.yy5);
     free_token(yymsp[-8].minor.yy0);
     free_token(yymsp[-6].minor.yy0);
-    free_block(yymsp[-3].minor.yy69);
-    free(yymsp[-1].minor.yy49);
+    free_block(yymsp[-3].minor.yy79);
+    free(yymsp[-1].minor.yy29);
   yy_destructor(yypParser,12,&yymsp[-12].minor);
   yy_destructor(yypParser,7,&yymsp[-11].minor);
   yy_destructor(yypParser,13,&yymsp[-9].minor);
@@ -1253,169 +1260,169 @@ doneEB0:
   yy_destructor(yypParser,6,&yymsp[-2].minor);
   yy_destructor(yypParser,9,&yymsp[0].minor);
 }
-#line 1257 "NCDConfigParser_parse.c"
+#line 1264 "NCDConfigParser_parse.c"
         break;
       case 10: /* elif_maybe ::= */
 #line 387 "NCDConfigParser_parse.y"
 {
-    NCDIfBlock_Init(&yygotominor.yy44.v);
-    yygotominor.yy44.have = 1;
+    NCDIfBlock_Init(&yygotominor.yy32.v);
+    yygotominor.yy32.have = 1;
 }
-#line 1265 "NCDConfigParser_parse.c"
+#line 1272 "NCDConfigParser_parse.c"
         break;
       case 11: /* elif_maybe ::= elif */
 #line 392 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy44 = yymsp[0].minor.yy44;
+    yygotominor.yy32 = yymsp[0].minor.yy32;
 }
-#line 1272 "NCDConfigParser_parse.c"
+#line 1279 "NCDConfigParser_parse.c"
         break;
       case 12: /* elif ::= ELIF ROUND_OPEN value ROUND_CLOSE CURLY_OPEN statements CURLY_CLOSE */
 #line 396 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-4].minor.yy19.have || !yymsp[-1].minor.yy69.have) {
+    if (!yymsp[-4].minor.yy5.have || !yymsp[-1].minor.yy79.have) {
         goto failF0;
     }
 
-    NCDIfBlock_Init(&yygotominor.yy44.v);
+    NCDIfBlock_Init(&yygotominor.yy32.v);
 
     NCDIf ifc;
-    NCDIf_Init(&ifc, yymsp[-4].minor.yy19.v, yymsp[-1].minor.yy69.v);
-    yymsp[-4].minor.yy19.have = 0;
-    yymsp[-1].minor.yy69.have = 0;
+    NCDIf_Init(&ifc, yymsp[-4].minor.yy5.v, yymsp[-1].minor.yy79.v);
+    yymsp[-4].minor.yy5.have = 0;
+    yymsp[-1].minor.yy79.have = 0;
 
-    if (!NCDIfBlock_PrependIf(&yygotominor.yy44.v, ifc)) {
+    if (!NCDIfBlock_PrependIf(&yygotominor.yy32.v, ifc)) {
         goto failF1;
     }
 
-    yygotominor.yy44.have = 1;
+    yygotominor.yy32.have = 1;
     goto doneF0;
 
 failF1:
     NCDIf_Free(&ifc);
-    NCDIfBlock_Free(&yygotominor.yy44.v);
+    NCDIfBlock_Free(&yygotominor.yy32.v);
 failF0:
-    yygotominor.yy44.have = 0;
+    yygotominor.yy32.have = 0;
     parser_out->out_of_memory = 1;
 doneF0:
-    free_value(yymsp[-4].minor.yy19);
-    free_block(yymsp[-1].minor.yy69);
+    free_value(yymsp[-4].minor.yy5);
+    free_block(yymsp[-1].minor.yy79);
   yy_destructor(yypParser,15,&yymsp[-6].minor);
   yy_destructor(yypParser,7,&yymsp[-5].minor);
   yy_destructor(yypParser,8,&yymsp[-3].minor);
   yy_destructor(yypParser,5,&yymsp[-2].minor);
   yy_destructor(yypParser,6,&yymsp[0].minor);
 }
-#line 1310 "NCDConfigParser_parse.c"
+#line 1317 "NCDConfigParser_parse.c"
         break;
       case 13: /* elif ::= ELIF ROUND_OPEN value ROUND_CLOSE CURLY_OPEN statements CURLY_CLOSE elif */
 #line 426 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-5].minor.yy19.have || !yymsp[-2].minor.yy69.have || !yymsp[0].minor.yy44.have) {
+    if (!yymsp[-5].minor.yy5.have || !yymsp[-2].minor.yy79.have || !yymsp[0].minor.yy32.have) {
         goto failG0;
     }
 
     NCDIf ifc;
-    NCDIf_Init(&ifc, yymsp[-5].minor.yy19.v, yymsp[-2].minor.yy69.v);
-    yymsp[-5].minor.yy19.have = 0;
-    yymsp[-2].minor.yy69.have = 0;
+    NCDIf_Init(&ifc, yymsp[-5].minor.yy5.v, yymsp[-2].minor.yy79.v);
+    yymsp[-5].minor.yy5.have = 0;
+    yymsp[-2].minor.yy79.have = 0;
 
-    if (!NCDIfBlock_PrependIf(&yymsp[0].minor.yy44.v, ifc)) {
+    if (!NCDIfBlock_PrependIf(&yymsp[0].minor.yy32.v, ifc)) {
         goto failG1;
     }
 
-    yygotominor.yy44.have = 1;
-    yygotominor.yy44.v = yymsp[0].minor.yy44.v;
-    yymsp[0].minor.yy44.have = 0;
+    yygotominor.yy32.have = 1;
+    yygotominor.yy32.v = yymsp[0].minor.yy32.v;
+    yymsp[0].minor.yy32.have = 0;
     goto doneG0;
 
 failG1:
     NCDIf_Free(&ifc);
 failG0:
-    yygotominor.yy44.have = 0;
+    yygotominor.yy32.have = 0;
     parser_out->out_of_memory = 1;
 doneG0:
-    free_value(yymsp[-5].minor.yy19);
-    free_block(yymsp[-2].minor.yy69);
-    free_ifblock(yymsp[0].minor.yy44);
+    free_value(yymsp[-5].minor.yy5);
+    free_block(yymsp[-2].minor.yy79);
+    free_ifblock(yymsp[0].minor.yy32);
   yy_destructor(yypParser,15,&yymsp[-7].minor);
   yy_destructor(yypParser,7,&yymsp[-6].minor);
   yy_destructor(yypParser,8,&yymsp[-4].minor);
   yy_destructor(yypParser,5,&yymsp[-3].minor);
   yy_destructor(yypParser,6,&yymsp[-1].minor);
 }
-#line 1348 "NCDConfigParser_parse.c"
+#line 1355 "NCDConfigParser_parse.c"
         break;
       case 14: /* else_maybe ::= */
       case 17: /* interrupt_maybe ::= */ yytestcase(yyruleno==17);
 #line 456 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy69.have = 0;
+    yygotominor.yy79.have = 0;
 }
-#line 1356 "NCDConfigParser_parse.c"
+#line 1363 "NCDConfigParser_parse.c"
         break;
       case 15: /* else_maybe ::= ELSE CURLY_OPEN statements CURLY_CLOSE */
 #line 460 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy69 = yymsp[-1].minor.yy69;
+    yygotominor.yy79 = yymsp[-1].minor.yy79;
   yy_destructor(yypParser,16,&yymsp[-3].minor);
   yy_destructor(yypParser,5,&yymsp[-2].minor);
   yy_destructor(yypParser,6,&yymsp[0].minor);
 }
-#line 1366 "NCDConfigParser_parse.c"
+#line 1373 "NCDConfigParser_parse.c"
         break;
       case 16: /* statement ::= BLOCK CURLY_OPEN statements CURLY_CLOSE name_maybe SEMICOLON */
 #line 464 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-3].minor.yy69.have) {
+    if (!yymsp[-3].minor.yy79.have) {
         goto failGA0;
     }
     
-    if (!NCDStatement_InitBlock(&yygotominor.yy47.v, yymsp[-1].minor.yy49, yymsp[-3].minor.yy69.v)) {
+    if (!NCDStatement_InitBlock(&yygotominor.yy77.v, yymsp[-1].minor.yy29, yymsp[-3].minor.yy79.v)) {
         goto failGA0;
     }
-    yymsp[-3].minor.yy69.have = 0;
+    yymsp[-3].minor.yy79.have = 0;
     
-    yygotominor.yy47.have = 1;
+    yygotominor.yy77.have = 1;
     goto doneGA0;
     
 failGA0:
-    yygotominor.yy47.have = 0;
+    yygotominor.yy77.have = 0;
     parser_out->out_of_memory = 1;
 doneGA0:
-    free_block(yymsp[-3].minor.yy69);
-    free(yymsp[-1].minor.yy49);
+    free_block(yymsp[-3].minor.yy79);
+    free(yymsp[-1].minor.yy29);
   yy_destructor(yypParser,17,&yymsp[-5].minor);
   yy_destructor(yypParser,5,&yymsp[-4].minor);
   yy_destructor(yypParser,6,&yymsp[-2].minor);
   yy_destructor(yypParser,9,&yymsp[0].minor);
 }
-#line 1394 "NCDConfigParser_parse.c"
+#line 1401 "NCDConfigParser_parse.c"
         break;
       case 18: /* interrupt_maybe ::= TOKEN_INTERRUPT CURLY_OPEN statements CURLY_CLOSE */
 #line 489 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy69 = yymsp[-1].minor.yy69;
+    yygotominor.yy79 = yymsp[-1].minor.yy79;
   yy_destructor(yypParser,18,&yymsp[-3].minor);
   yy_destructor(yypParser,5,&yymsp[-2].minor);
   yy_destructor(yypParser,6,&yymsp[0].minor);
 }
-#line 1404 "NCDConfigParser_parse.c"
+#line 1411 "NCDConfigParser_parse.c"
         break;
       case 19: /* statement ::= TOKEN_DO CURLY_OPEN statements CURLY_CLOSE interrupt_maybe name_maybe SEMICOLON */
 #line 493 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-4].minor.yy69.have) {
+    if (!yymsp[-4].minor.yy79.have) {
         goto failGB0;
     }
     
     NCDIfBlock if_block;
     NCDIfBlock_Init(&if_block);
     
-    if (yymsp[-2].minor.yy69.have) {
+    if (yymsp[-2].minor.yy79.have) {
         NCDIf int_if;
-        NCDIf_InitBlock(&int_if, yymsp[-2].minor.yy69.v);
-        yymsp[-2].minor.yy69.have = 0;
+        NCDIf_InitBlock(&int_if, yymsp[-2].minor.yy79.v);
+        yymsp[-2].minor.yy79.have = 0;
         
         if (!NCDIfBlock_PrependIf(&if_block, int_if)) {
             NCDIf_Free(&int_if);
@@ -1424,163 +1431,204 @@ doneGA0:
     }
     
     NCDIf the_if;
-    NCDIf_InitBlock(&the_if, yymsp[-4].minor.yy69.v);
-    yymsp[-4].minor.yy69.have = 0;
+    NCDIf_InitBlock(&the_if, yymsp[-4].minor.yy79.v);
+    yymsp[-4].minor.yy79.have = 0;
     
     if (!NCDIfBlock_PrependIf(&if_block, the_if)) {
         NCDIf_Free(&the_if);
         goto failGB1;
     }
     
-    if (!NCDStatement_InitIf(&yygotominor.yy47.v, yymsp[-1].minor.yy49, if_block, NCDIFTYPE_DO)) {
+    if (!NCDStatement_InitIf(&yygotominor.yy77.v, yymsp[-1].minor.yy29, if_block, NCDIFTYPE_DO)) {
         goto failGB1;
     }
     
-    yygotominor.yy47.have = 1;
+    yygotominor.yy77.have = 1;
     goto doneGB0;
     
 failGB1:
     NCDIfBlock_Free(&if_block);
 failGB0:
-    yygotominor.yy47.have = 0;
+    yygotominor.yy77.have = 0;
     parser_out->out_of_memory = 1;
 doneGB0:
-    free_block(yymsp[-4].minor.yy69);
-    free_block(yymsp[-2].minor.yy69);
-    free(yymsp[-1].minor.yy49);
+    free_block(yymsp[-4].minor.yy79);
+    free_block(yymsp[-2].minor.yy79);
+    free(yymsp[-1].minor.yy29);
   yy_destructor(yypParser,19,&yymsp[-6].minor);
   yy_destructor(yypParser,5,&yymsp[-5].minor);
   yy_destructor(yypParser,6,&yymsp[-3].minor);
   yy_destructor(yypParser,9,&yymsp[0].minor);
 }
-#line 1457 "NCDConfigParser_parse.c"
+#line 1464 "NCDConfigParser_parse.c"
         break;
-      case 20: /* statements ::= statement */
+      case 20: /* statement ::= TOKEN_PARALLEL CURLY_OPEN statements CURLY_CLOSE name_maybe SEMICOLON */
 #line 539 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[0].minor.yy47.have) {
+    if (!yymsp[-3].minor.yy79.have) {
+        goto failGC0;
+    }
+    
+    NCDIfBlock if_block;
+    NCDIfBlock_Init(&if_block);
+    
+    NCDIf the_if;
+    NCDIf_InitBlock(&the_if, yymsp[-3].minor.yy79.v);
+    yymsp[-3].minor.yy79.have = 0;
+    
+    if (!NCDIfBlock_PrependIf(&if_block, the_if)) {
+        NCDIf_Free(&the_if);
+        goto failGC1;
+    }
+    
+    if (!NCDStatement_InitIf(&yygotominor.yy77.v, yymsp[-1].minor.yy29, if_block, NCDIFTYPE_PARALLEL)) {
+        goto failGC1;
+    }
+    
+    yygotominor.yy77.have = 1;
+    goto doneGC0;
+    
+failGC1:
+    NCDIfBlock_Free(&if_block);
+failGC0:
+    yygotominor.yy77.have = 0;
+    parser_out->out_of_memory = 1;
+doneGC0:
+    free_block(yymsp[-3].minor.yy79);
+    free(yymsp[-1].minor.yy29);
+  yy_destructor(yypParser,20,&yymsp[-5].minor);
+  yy_destructor(yypParser,5,&yymsp[-4].minor);
+  yy_destructor(yypParser,6,&yymsp[-2].minor);
+  yy_destructor(yypParser,9,&yymsp[0].minor);
+}
+#line 1505 "NCDConfigParser_parse.c"
+        break;
+      case 21: /* statements ::= statement */
+#line 573 "NCDConfigParser_parse.y"
+{
+    if (!yymsp[0].minor.yy77.have) {
         goto failH0;
     }
 
-    NCDBlock_Init(&yygotominor.yy69.v);
+    NCDBlock_Init(&yygotominor.yy79.v);
 
-    if (!NCDBlock_PrependStatement(&yygotominor.yy69.v, yymsp[0].minor.yy47.v)) {
+    if (!NCDBlock_PrependStatement(&yygotominor.yy79.v, yymsp[0].minor.yy77.v)) {
         goto failH1;
     }
-    yymsp[0].minor.yy47.have = 0;
+    yymsp[0].minor.yy77.have = 0;
 
-    yygotominor.yy69.have = 1;
+    yygotominor.yy79.have = 1;
     goto doneH;
 
 failH1:
-    NCDBlock_Free(&yygotominor.yy69.v);
+    NCDBlock_Free(&yygotominor.yy79.v);
 failH0:
-    yygotominor.yy69.have = 0;
+    yygotominor.yy79.have = 0;
     parser_out->out_of_memory = 1;
 doneH:
-    free_statement(yymsp[0].minor.yy47);
+    free_statement(yymsp[0].minor.yy77);
 }
-#line 1484 "NCDConfigParser_parse.c"
+#line 1532 "NCDConfigParser_parse.c"
         break;
-      case 21: /* statements ::= statement statements */
-#line 563 "NCDConfigParser_parse.y"
+      case 22: /* statements ::= statement statements */
+#line 597 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-1].minor.yy47.have || !yymsp[0].minor.yy69.have) {
+    if (!yymsp[-1].minor.yy77.have || !yymsp[0].minor.yy79.have) {
         goto failI0;
     }
 
-    if (!NCDBlock_PrependStatement(&yymsp[0].minor.yy69.v, yymsp[-1].minor.yy47.v)) {
+    if (!NCDBlock_PrependStatement(&yymsp[0].minor.yy79.v, yymsp[-1].minor.yy77.v)) {
         goto failI1;
     }
-    yymsp[-1].minor.yy47.have = 0;
+    yymsp[-1].minor.yy77.have = 0;
 
-    yygotominor.yy69.have = 1;
-    yygotominor.yy69.v = yymsp[0].minor.yy69.v;
-    yymsp[0].minor.yy69.have = 0;
+    yygotominor.yy79.have = 1;
+    yygotominor.yy79.v = yymsp[0].minor.yy79.v;
+    yymsp[0].minor.yy79.have = 0;
     goto doneI;
 
 failI1:
-    NCDBlock_Free(&yygotominor.yy69.v);
+    NCDBlock_Free(&yygotominor.yy79.v);
 failI0:
-    yygotominor.yy69.have = 0;
+    yygotominor.yy79.have = 0;
     parser_out->out_of_memory = 1;
 doneI:
-    free_statement(yymsp[-1].minor.yy47);
-    free_block(yymsp[0].minor.yy69);
+    free_statement(yymsp[-1].minor.yy77);
+    free_block(yymsp[0].minor.yy79);
 }
-#line 1512 "NCDConfigParser_parse.c"
+#line 1560 "NCDConfigParser_parse.c"
         break;
-      case 22: /* dotted_name ::= NAME */
-      case 46: /* name_maybe ::= NAME */ yytestcase(yyruleno==46);
-#line 588 "NCDConfigParser_parse.y"
+      case 23: /* dotted_name ::= NAME */
+      case 47: /* name_maybe ::= NAME */ yytestcase(yyruleno==47);
+#line 622 "NCDConfigParser_parse.y"
 {
     ASSERT(yymsp[0].minor.yy0.str)
 
-    yygotominor.yy49 = yymsp[0].minor.yy0.str;
+    yygotominor.yy29 = yymsp[0].minor.yy0.str;
 }
-#line 1522 "NCDConfigParser_parse.c"
+#line 1570 "NCDConfigParser_parse.c"
         break;
-      case 23: /* dotted_name ::= NAME DOT dotted_name */
-#line 594 "NCDConfigParser_parse.y"
+      case 24: /* dotted_name ::= NAME DOT dotted_name */
+#line 628 "NCDConfigParser_parse.y"
 {
     ASSERT(yymsp[-2].minor.yy0.str)
-    if (!yymsp[0].minor.yy49) {
+    if (!yymsp[0].minor.yy29) {
         goto failJ0;
     }
 
-    if (!(yygotominor.yy49 = concat_strings(3, yymsp[-2].minor.yy0.str, ".", yymsp[0].minor.yy49))) {
+    if (!(yygotominor.yy29 = concat_strings(3, yymsp[-2].minor.yy0.str, ".", yymsp[0].minor.yy29))) {
         goto failJ0;
     }
 
     goto doneJ;
 
 failJ0:
-    yygotominor.yy49 = NULL;
+    yygotominor.yy29 = NULL;
     parser_out->out_of_memory = 1;
 doneJ:
     free_token(yymsp[-2].minor.yy0);
-    free(yymsp[0].minor.yy49);
-  yy_destructor(yypParser,20,&yymsp[-1].minor);
+    free(yymsp[0].minor.yy29);
+  yy_destructor(yypParser,21,&yymsp[-1].minor);
 }
-#line 1546 "NCDConfigParser_parse.c"
+#line 1594 "NCDConfigParser_parse.c"
         break;
-      case 24: /* name_list ::= NAME */
-#line 614 "NCDConfigParser_parse.y"
+      case 25: /* name_list ::= NAME */
+#line 648 "NCDConfigParser_parse.y"
 {
     if (!yymsp[0].minor.yy0.str) {
         goto failK0;
     }
 
-    NCDValue_InitList(&yygotominor.yy19.v);
+    NCDValue_InitList(&yygotominor.yy5.v);
     
     NCDValue this_string;
     if (!NCDValue_InitString(&this_string, yymsp[0].minor.yy0.str)) {
         goto failK1;
     }
     
-    if (!NCDValue_ListPrepend(&yygotominor.yy19.v, this_string)) {
+    if (!NCDValue_ListPrepend(&yygotominor.yy5.v, this_string)) {
         goto failK2;
     }
 
-    yygotominor.yy19.have = 1;
+    yygotominor.yy5.have = 1;
     goto doneK;
 
 failK2:
     NCDValue_Free(&this_string);
 failK1:
-    NCDValue_Free(&yygotominor.yy19.v);
+    NCDValue_Free(&yygotominor.yy5.v);
 failK0:
-    yygotominor.yy19.have = 0;
+    yygotominor.yy5.have = 0;
     parser_out->out_of_memory = 1;
 doneK:
     free_token(yymsp[0].minor.yy0);
 }
-#line 1579 "NCDConfigParser_parse.c"
+#line 1627 "NCDConfigParser_parse.c"
         break;
-      case 25: /* name_list ::= NAME DOT name_list */
-#line 644 "NCDConfigParser_parse.y"
+      case 26: /* name_list ::= NAME DOT name_list */
+#line 678 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-2].minor.yy0.str || !yymsp[0].minor.yy19.have) {
+    if (!yymsp[-2].minor.yy0.str || !yymsp[0].minor.yy5.have) {
         goto failKA0;
     }
     
@@ -1589,327 +1637,327 @@ doneK:
         goto failKA0;
     }
 
-    if (!NCDValue_ListPrepend(&yymsp[0].minor.yy19.v, this_string)) {
+    if (!NCDValue_ListPrepend(&yymsp[0].minor.yy5.v, this_string)) {
         goto failKA1;
     }
 
-    yygotominor.yy19.have = 1;
-    yygotominor.yy19.v = yymsp[0].minor.yy19.v;
-    yymsp[0].minor.yy19.have = 0;
+    yygotominor.yy5.have = 1;
+    yygotominor.yy5.v = yymsp[0].minor.yy5.v;
+    yymsp[0].minor.yy5.have = 0;
     goto doneKA;
 
 failKA1:
     NCDValue_Free(&this_string);
 failKA0:
-    yygotominor.yy19.have = 0;
+    yygotominor.yy5.have = 0;
     parser_out->out_of_memory = 1;
 doneKA:
     free_token(yymsp[-2].minor.yy0);
-    free_value(yymsp[0].minor.yy19);
-  yy_destructor(yypParser,20,&yymsp[-1].minor);
+    free_value(yymsp[0].minor.yy5);
+  yy_destructor(yypParser,21,&yymsp[-1].minor);
 }
-#line 1612 "NCDConfigParser_parse.c"
+#line 1660 "NCDConfigParser_parse.c"
         break;
-      case 26: /* list_contents_maybe ::= */
-#line 673 "NCDConfigParser_parse.y"
+      case 27: /* list_contents_maybe ::= */
+#line 707 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy19.have = 1;
-    NCDValue_InitList(&yygotominor.yy19.v);
+    yygotominor.yy5.have = 1;
+    NCDValue_InitList(&yygotominor.yy5.v);
 }
-#line 1620 "NCDConfigParser_parse.c"
+#line 1668 "NCDConfigParser_parse.c"
         break;
-      case 27: /* list_contents_maybe ::= list_contents */
-      case 41: /* value ::= list */ yytestcase(yyruleno==41);
-      case 42: /* value ::= map */ yytestcase(yyruleno==42);
-      case 44: /* value ::= invoc */ yytestcase(yyruleno==44);
-#line 678 "NCDConfigParser_parse.y"
+      case 28: /* list_contents_maybe ::= list_contents */
+      case 42: /* value ::= list */ yytestcase(yyruleno==42);
+      case 43: /* value ::= map */ yytestcase(yyruleno==43);
+      case 45: /* value ::= invoc */ yytestcase(yyruleno==45);
+#line 712 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy19 = yymsp[0].minor.yy19;
+    yygotominor.yy5 = yymsp[0].minor.yy5;
 }
-#line 1630 "NCDConfigParser_parse.c"
+#line 1678 "NCDConfigParser_parse.c"
         break;
-      case 28: /* list_contents ::= value */
-#line 682 "NCDConfigParser_parse.y"
+      case 29: /* list_contents ::= value */
+#line 716 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[0].minor.yy19.have) {
+    if (!yymsp[0].minor.yy5.have) {
         goto failL0;
     }
 
-    NCDValue_InitList(&yygotominor.yy19.v);
+    NCDValue_InitList(&yygotominor.yy5.v);
 
-    if (!NCDValue_ListPrepend(&yygotominor.yy19.v, yymsp[0].minor.yy19.v)) {
+    if (!NCDValue_ListPrepend(&yygotominor.yy5.v, yymsp[0].minor.yy5.v)) {
         goto failL1;
     }
-    yymsp[0].minor.yy19.have = 0;
+    yymsp[0].minor.yy5.have = 0;
 
-    yygotominor.yy19.have = 1;
+    yygotominor.yy5.have = 1;
     goto doneL;
 
 failL1:
-    NCDValue_Free(&yygotominor.yy19.v);
+    NCDValue_Free(&yygotominor.yy5.v);
 failL0:
-    yygotominor.yy19.have = 0;
+    yygotominor.yy5.have = 0;
     parser_out->out_of_memory = 1;
 doneL:
-    free_value(yymsp[0].minor.yy19);
+    free_value(yymsp[0].minor.yy5);
 }
-#line 1657 "NCDConfigParser_parse.c"
+#line 1705 "NCDConfigParser_parse.c"
         break;
-      case 29: /* list_contents ::= value COMMA list_contents */
-#line 706 "NCDConfigParser_parse.y"
+      case 30: /* list_contents ::= value COMMA list_contents */
+#line 740 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-2].minor.yy19.have || !yymsp[0].minor.yy19.have) {
+    if (!yymsp[-2].minor.yy5.have || !yymsp[0].minor.yy5.have) {
         goto failM0;
     }
 
-    if (!NCDValue_ListPrepend(&yymsp[0].minor.yy19.v, yymsp[-2].minor.yy19.v)) {
+    if (!NCDValue_ListPrepend(&yymsp[0].minor.yy5.v, yymsp[-2].minor.yy5.v)) {
         goto failM0;
     }
-    yymsp[-2].minor.yy19.have = 0;
+    yymsp[-2].minor.yy5.have = 0;
 
-    yygotominor.yy19.have = 1;
-    yygotominor.yy19.v = yymsp[0].minor.yy19.v;
-    yymsp[0].minor.yy19.have = 0;
+    yygotominor.yy5.have = 1;
+    yygotominor.yy5.v = yymsp[0].minor.yy5.v;
+    yymsp[0].minor.yy5.have = 0;
     goto doneM;
 
 failM0:
-    yygotominor.yy19.have = 0;
+    yygotominor.yy5.have = 0;
     parser_out->out_of_memory = 1;
 doneM:
-    free_value(yymsp[-2].minor.yy19);
-    free_value(yymsp[0].minor.yy19);
-  yy_destructor(yypParser,21,&yymsp[-1].minor);
+    free_value(yymsp[-2].minor.yy5);
+    free_value(yymsp[0].minor.yy5);
+  yy_destructor(yypParser,22,&yymsp[-1].minor);
 }
-#line 1684 "NCDConfigParser_parse.c"
+#line 1732 "NCDConfigParser_parse.c"
         break;
-      case 30: /* list ::= CURLY_OPEN CURLY_CLOSE */
-#line 729 "NCDConfigParser_parse.y"
+      case 31: /* list ::= CURLY_OPEN CURLY_CLOSE */
+#line 763 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy19.have = 1;
-    NCDValue_InitList(&yygotominor.yy19.v);
+    yygotominor.yy5.have = 1;
+    NCDValue_InitList(&yygotominor.yy5.v);
   yy_destructor(yypParser,5,&yymsp[-1].minor);
   yy_destructor(yypParser,6,&yymsp[0].minor);
 }
-#line 1694 "NCDConfigParser_parse.c"
+#line 1742 "NCDConfigParser_parse.c"
         break;
-      case 31: /* list ::= CURLY_OPEN list_contents CURLY_CLOSE */
-#line 734 "NCDConfigParser_parse.y"
+      case 32: /* list ::= CURLY_OPEN list_contents CURLY_CLOSE */
+#line 768 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy19 = yymsp[-1].minor.yy19;
+    yygotominor.yy5 = yymsp[-1].minor.yy5;
   yy_destructor(yypParser,5,&yymsp[-2].minor);
   yy_destructor(yypParser,6,&yymsp[0].minor);
 }
-#line 1703 "NCDConfigParser_parse.c"
+#line 1751 "NCDConfigParser_parse.c"
         break;
-      case 32: /* map_contents ::= value COLON value */
-#line 738 "NCDConfigParser_parse.y"
+      case 33: /* map_contents ::= value COLON value */
+#line 772 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-2].minor.yy19.have || !yymsp[0].minor.yy19.have) {
+    if (!yymsp[-2].minor.yy5.have || !yymsp[0].minor.yy5.have) {
         goto failS0;
     }
 
-    NCDValue_InitMap(&yygotominor.yy19.v);
+    NCDValue_InitMap(&yygotominor.yy5.v);
 
-    if (!NCDValue_MapPrepend(&yygotominor.yy19.v, yymsp[-2].minor.yy19.v, yymsp[0].minor.yy19.v)) {
+    if (!NCDValue_MapPrepend(&yygotominor.yy5.v, yymsp[-2].minor.yy5.v, yymsp[0].minor.yy5.v)) {
         goto failS1;
     }
-    yymsp[-2].minor.yy19.have = 0;
-    yymsp[0].minor.yy19.have = 0;
+    yymsp[-2].minor.yy5.have = 0;
+    yymsp[0].minor.yy5.have = 0;
 
-    yygotominor.yy19.have = 1;
+    yygotominor.yy5.have = 1;
     goto doneS;
 
 failS1:
-    NCDValue_Free(&yygotominor.yy19.v);
+    NCDValue_Free(&yygotominor.yy5.v);
 failS0:
-    yygotominor.yy19.have = 0;
+    yygotominor.yy5.have = 0;
     parser_out->out_of_memory = 1;
 doneS:
-    free_value(yymsp[-2].minor.yy19);
-    free_value(yymsp[0].minor.yy19);
+    free_value(yymsp[-2].minor.yy5);
+    free_value(yymsp[0].minor.yy5);
   yy_destructor(yypParser,14,&yymsp[-1].minor);
 }
-#line 1733 "NCDConfigParser_parse.c"
+#line 1781 "NCDConfigParser_parse.c"
         break;
-      case 33: /* map_contents ::= value COLON value COMMA map_contents */
-#line 764 "NCDConfigParser_parse.y"
+      case 34: /* map_contents ::= value COLON value COMMA map_contents */
+#line 798 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-4].minor.yy19.have || !yymsp[-2].minor.yy19.have || !yymsp[0].minor.yy19.have) {
+    if (!yymsp[-4].minor.yy5.have || !yymsp[-2].minor.yy5.have || !yymsp[0].minor.yy5.have) {
         goto failT0;
     }
 
-    if (!NCDValue_MapPrepend(&yymsp[0].minor.yy19.v, yymsp[-4].minor.yy19.v, yymsp[-2].minor.yy19.v)) {
+    if (!NCDValue_MapPrepend(&yymsp[0].minor.yy5.v, yymsp[-4].minor.yy5.v, yymsp[-2].minor.yy5.v)) {
         goto failT0;
     }
-    yymsp[-4].minor.yy19.have = 0;
-    yymsp[-2].minor.yy19.have = 0;
+    yymsp[-4].minor.yy5.have = 0;
+    yymsp[-2].minor.yy5.have = 0;
 
-    yygotominor.yy19.have = 1;
-    yygotominor.yy19.v = yymsp[0].minor.yy19.v;
-    yymsp[0].minor.yy19.have = 0;
+    yygotominor.yy5.have = 1;
+    yygotominor.yy5.v = yymsp[0].minor.yy5.v;
+    yymsp[0].minor.yy5.have = 0;
     goto doneT;
 
 failT0:
-    yygotominor.yy19.have = 0;
+    yygotominor.yy5.have = 0;
     parser_out->out_of_memory = 1;
 doneT:
-    free_value(yymsp[-4].minor.yy19);
-    free_value(yymsp[-2].minor.yy19);
-    free_value(yymsp[0].minor.yy19);
+    free_value(yymsp[-4].minor.yy5);
+    free_value(yymsp[-2].minor.yy5);
+    free_value(yymsp[0].minor.yy5);
   yy_destructor(yypParser,14,&yymsp[-3].minor);
-  yy_destructor(yypParser,21,&yymsp[-1].minor);
+  yy_destructor(yypParser,22,&yymsp[-1].minor);
 }
-#line 1763 "NCDConfigParser_parse.c"
+#line 1811 "NCDConfigParser_parse.c"
         break;
-      case 34: /* map ::= BRACKET_OPEN BRACKET_CLOSE */
-#line 789 "NCDConfigParser_parse.y"
+      case 35: /* map ::= BRACKET_OPEN BRACKET_CLOSE */
+#line 823 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy19.have = 1;
-    NCDValue_InitMap(&yygotominor.yy19.v);
-  yy_destructor(yypParser,22,&yymsp[-1].minor);
-  yy_destructor(yypParser,23,&yymsp[0].minor);
+    yygotominor.yy5.have = 1;
+    NCDValue_InitMap(&yygotominor.yy5.v);
+  yy_destructor(yypParser,23,&yymsp[-1].minor);
+  yy_destructor(yypParser,24,&yymsp[0].minor);
 }
-#line 1773 "NCDConfigParser_parse.c"
+#line 1821 "NCDConfigParser_parse.c"
         break;
-      case 35: /* map ::= BRACKET_OPEN map_contents BRACKET_CLOSE */
-#line 794 "NCDConfigParser_parse.y"
+      case 36: /* map ::= BRACKET_OPEN map_contents BRACKET_CLOSE */
+#line 828 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy19 = yymsp[-1].minor.yy19;
-  yy_destructor(yypParser,22,&yymsp[-2].minor);
-  yy_destructor(yypParser,23,&yymsp[0].minor);
+    yygotominor.yy5 = yymsp[-1].minor.yy5;
+  yy_destructor(yypParser,23,&yymsp[-2].minor);
+  yy_destructor(yypParser,24,&yymsp[0].minor);
 }
-#line 1782 "NCDConfigParser_parse.c"
+#line 1830 "NCDConfigParser_parse.c"
         break;
-      case 36: /* invoc ::= value ROUND_OPEN list_contents_maybe ROUND_CLOSE */
-#line 798 "NCDConfigParser_parse.y"
+      case 37: /* invoc ::= value ROUND_OPEN list_contents_maybe ROUND_CLOSE */
+#line 832 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[-3].minor.yy19.have || !yymsp[-1].minor.yy19.have) {
+    if (!yymsp[-3].minor.yy5.have || !yymsp[-1].minor.yy5.have) {
         goto failQ0;
     }
     
-    if (!NCDValue_InitInvoc(&yygotominor.yy19.v, yymsp[-3].minor.yy19.v, yymsp[-1].minor.yy19.v)) {
+    if (!NCDValue_InitInvoc(&yygotominor.yy5.v, yymsp[-3].minor.yy5.v, yymsp[-1].minor.yy5.v)) {
         goto failQ0;
     }
-    yymsp[-3].minor.yy19.have = 0;
-    yymsp[-1].minor.yy19.have = 0;
-    yygotominor.yy19.have = 1;
+    yymsp[-3].minor.yy5.have = 0;
+    yymsp[-1].minor.yy5.have = 0;
+    yygotominor.yy5.have = 1;
     goto doneQ;
     
 failQ0:
-    yygotominor.yy19.have = 0;
+    yygotominor.yy5.have = 0;
     parser_out->out_of_memory = 1;
 doneQ:
-    free_value(yymsp[-3].minor.yy19);
-    free_value(yymsp[-1].minor.yy19);
+    free_value(yymsp[-3].minor.yy5);
+    free_value(yymsp[-1].minor.yy5);
   yy_destructor(yypParser,7,&yymsp[-2].minor);
   yy_destructor(yypParser,8,&yymsp[0].minor);
 }
-#line 1808 "NCDConfigParser_parse.c"
+#line 1856 "NCDConfigParser_parse.c"
         break;
-      case 37: /* value ::= STRING */
-#line 819 "NCDConfigParser_parse.y"
+      case 38: /* value ::= STRING */
+#line 853 "NCDConfigParser_parse.y"
 {
     ASSERT(yymsp[0].minor.yy0.str)
 
-    if (!NCDValue_InitStringBin(&yygotominor.yy19.v, (uint8_t *)yymsp[0].minor.yy0.str, yymsp[0].minor.yy0.len)) {
+    if (!NCDValue_InitStringBin(&yygotominor.yy5.v, (uint8_t *)yymsp[0].minor.yy0.str, yymsp[0].minor.yy0.len)) {
         goto failU0;
     }
 
-    yygotominor.yy19.have = 1;
+    yygotominor.yy5.have = 1;
     goto doneU;
 
 failU0:
-    yygotominor.yy19.have = 0;
+    yygotominor.yy5.have = 0;
     parser_out->out_of_memory = 1;
 doneU:
     free_token(yymsp[0].minor.yy0);
 }
-#line 1828 "NCDConfigParser_parse.c"
+#line 1876 "NCDConfigParser_parse.c"
         break;
-      case 38: /* value ::= AT_SIGN dotted_name */
-#line 836 "NCDConfigParser_parse.y"
+      case 39: /* value ::= AT_SIGN dotted_name */
+#line 870 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[0].minor.yy49) {
+    if (!yymsp[0].minor.yy29) {
         goto failUA0;
     }
     
-    if (!NCDValue_InitString(&yygotominor.yy19.v, yymsp[0].minor.yy49)) {
+    if (!NCDValue_InitString(&yygotominor.yy5.v, yymsp[0].minor.yy29)) {
         goto failUA0;
     }
     
-    yygotominor.yy19.have = 1;
+    yygotominor.yy5.have = 1;
     goto doneUA0;
     
 failUA0:
-    yygotominor.yy19.have = 0;
+    yygotominor.yy5.have = 0;
     parser_out->out_of_memory = 1;
 doneUA0:
-    free(yymsp[0].minor.yy49);
-  yy_destructor(yypParser,24,&yymsp[-1].minor);
+    free(yymsp[0].minor.yy29);
+  yy_destructor(yypParser,25,&yymsp[-1].minor);
 }
-#line 1851 "NCDConfigParser_parse.c"
+#line 1899 "NCDConfigParser_parse.c"
         break;
-      case 39: /* value ::= CARET name_list */
-#line 855 "NCDConfigParser_parse.y"
+      case 40: /* value ::= CARET name_list */
+#line 889 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy19 = yymsp[0].minor.yy19;
-  yy_destructor(yypParser,25,&yymsp[-1].minor);
+    yygotominor.yy5 = yymsp[0].minor.yy5;
+  yy_destructor(yypParser,26,&yymsp[-1].minor);
 }
-#line 1859 "NCDConfigParser_parse.c"
+#line 1907 "NCDConfigParser_parse.c"
         break;
-      case 40: /* value ::= dotted_name */
-#line 859 "NCDConfigParser_parse.y"
+      case 41: /* value ::= dotted_name */
+#line 893 "NCDConfigParser_parse.y"
 {
-    if (!yymsp[0].minor.yy49) {
+    if (!yymsp[0].minor.yy29) {
         goto failV0;
     }
 
-    if (!NCDValue_InitVar(&yygotominor.yy19.v, yymsp[0].minor.yy49)) {
+    if (!NCDValue_InitVar(&yygotominor.yy5.v, yymsp[0].minor.yy29)) {
         goto failV0;
     }
 
-    yygotominor.yy19.have = 1;
+    yygotominor.yy5.have = 1;
     goto doneV;
 
 failV0:
-    yygotominor.yy19.have = 0;
+    yygotominor.yy5.have = 0;
     parser_out->out_of_memory = 1;
 doneV:
-    free(yymsp[0].minor.yy49);
+    free(yymsp[0].minor.yy29);
 }
-#line 1881 "NCDConfigParser_parse.c"
+#line 1929 "NCDConfigParser_parse.c"
         break;
-      case 43: /* value ::= ROUND_OPEN value ROUND_CLOSE */
-#line 886 "NCDConfigParser_parse.y"
+      case 44: /* value ::= ROUND_OPEN value ROUND_CLOSE */
+#line 920 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy19 = yymsp[-1].minor.yy19;
+    yygotominor.yy5 = yymsp[-1].minor.yy5;
   yy_destructor(yypParser,7,&yymsp[-2].minor);
   yy_destructor(yypParser,8,&yymsp[0].minor);
 }
-#line 1890 "NCDConfigParser_parse.c"
+#line 1938 "NCDConfigParser_parse.c"
         break;
-      case 45: /* name_maybe ::= */
-#line 894 "NCDConfigParser_parse.y"
+      case 46: /* name_maybe ::= */
+#line 928 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy49 = NULL;
+    yygotominor.yy29 = NULL;
 }
-#line 1897 "NCDConfigParser_parse.c"
+#line 1945 "NCDConfigParser_parse.c"
         break;
-      case 47: /* process_or_template ::= PROCESS */
-#line 904 "NCDConfigParser_parse.y"
+      case 48: /* process_or_template ::= PROCESS */
+#line 938 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy28 = 0;
-  yy_destructor(yypParser,26,&yymsp[0].minor);
+    yygotominor.yy33 = 0;
+  yy_destructor(yypParser,27,&yymsp[0].minor);
 }
-#line 1905 "NCDConfigParser_parse.c"
+#line 1953 "NCDConfigParser_parse.c"
         break;
-      case 48: /* process_or_template ::= TEMPLATE */
-#line 908 "NCDConfigParser_parse.y"
+      case 49: /* process_or_template ::= TEMPLATE */
+#line 942 "NCDConfigParser_parse.y"
 {
-    yygotominor.yy28 = 1;
-  yy_destructor(yypParser,27,&yymsp[0].minor);
+    yygotominor.yy33 = 1;
+  yy_destructor(yypParser,28,&yymsp[0].minor);
 }
-#line 1913 "NCDConfigParser_parse.c"
+#line 1961 "NCDConfigParser_parse.c"
         break;
       default:
         break;
@@ -1974,7 +2022,7 @@ static void yy_syntax_error(
 #line 131 "NCDConfigParser_parse.y"
 
     parser_out->syntax_error = 1;
-#line 1978 "NCDConfigParser_parse.c"
+#line 2026 "NCDConfigParser_parse.c"
   ParseARG_STORE; /* Suppress warning about unused %extra_argument variable */
 }
 
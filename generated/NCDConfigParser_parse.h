@@ -17,11 +17,12 @@
 #define BLOCK                          17
 #define TOKEN_INTERRUPT                18
 #define TOKEN_DO                       19
-#define DOT                            20
-#define COMMA                          21
-#define BRACKET_OPEN                   22
-#define BRACKET_CLOSE                  23
-#define AT_SIGN                        24
-#define CARET                          25
-#define PROCESS                        26
-#define TEMPLATE                       27
+#define TOKEN_PARALLEL                 20
+#define DOT                            21
+#define COMMA                          22
+#define BRACKET_OPEN                   23
+#define BRACKET_CLOSE                  24
+#define AT_SIGN                        25
+#define CARET                          26
+#define PROCESS                        27
+#define TEMPLATE                       28
@@ -145,4 +145,28 @@
 #define BLOG_CHANNEL_ncd_load_module 144
 #define BLOG_CHANNEL_ncd_basic_functions 145
 #define BLOG_CHANNEL_ncd_objref 146
-#define BLOG_NUM_CHANNELS 147
+#define BLOG_CHANNEL_SocksUdpClient 147
+#define BLOG_CHANNEL_DnsCache 148
+#define BLOG_CHANNEL_StatsServer 149
+#define BLOG_CHANNEL_BReactorMailbox 150
+#define BLOG_CHANNEL_BReactorGroup 151
+#define BLOG_CHANNEL_BAEAD 152
+#define BLOG_CHANNEL_IPDecider 153
+#define BLOG_CHANNEL_FECDecoder 154
+#define BLOG_CHANNEL_NCDUdevNetlinkMonitor 155
+#define BLOG_CHANNEL_NCDUdevDbReader 156
+#define BLOG_CHANNEL_ncd_parallel 157
+#define BLOG_CHANNEL_NCDProgramCache 158
+#define BLOG_CHANNEL_NCDValBinary 159
+#define BLOG_CHANNEL_TcpMux 160
+#define BLOG_CHANNEL_SocksTcpGwClient 161
+#define BLOG_CHANNEL_tcpgw 162
+#define BLOG_CHANNEL_BXdp 163
+#define BLOG_CHANNEL_DatagramPeerIOGroup 164
+#define BLOG_CHANNEL_DHCPPacketSocket 165
+#define BLOG_CHANNEL_UdpGwDgram 166
+#define BLOG_CHANNEL_DirectRules 167
+#define BLOG_CHANNEL_DirectUdpClient 168
+#define BLOG_CHANNEL_SocksUpstreams 169
+#define BLOG_CHANNEL_SPProtoEncoder 170
+#define BLOG_NUM_CHANNELS 171
@@ -145,3 +145,27 @@
 {"ncd_load_module", 4},
 {"ncd_basic_functions", 4},
 {"ncd_objref", 4},
+{"SocksUdpClient", 4},
+{"DnsCache", 4},
+{"StatsServer", 4},
+{"BReactorMailbox", 4},
+{"BReactorGroup", 4},
+{"BAEAD", 4},
+{"IPDecider", 4},
+{"FECDecoder", 4},
+{"NCDUdevNetlinkMonitor", 4},
+{"NCDUdevDbReader", 4},
+{"ncd_parallel", 4},
+{"NCDProgramCache", 4},
+{"NCDValBinary", 4},
+{"TcpMux", 4},
+{"SocksTcpGwClient", 4},
+{"tcpgw", 4},
+{"BXdp", 4},
+{"DatagramPeerIOGroup", 4},
+{"DHCPPacketSocket", 4},
+{"UdpGwDgram", 4},
+{"DirectRules", 4},
+{"DirectUdpClient", 4},
+{"SocksUpstreams", 4},
+{"SPProtoEncoder", 4},
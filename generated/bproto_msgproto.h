@@ -408,6 +408,8 @@ void msgParser_Forwardpayload (msgParser *o)
 #define msg_youconnect_SIZEaddr(_len) (sizeof(struct BProto_header_s) + sizeof(struct BProto_data_header_s) + (_len))
 #define msg_youconnect_SIZEkey(_len) (sizeof(struct BProto_header_s) + sizeof(struct BProto_data_header_s) + (_len))
 #define msg_youconnect_SIZEpassword (sizeof(struct BProto_header_s) + sizeof(struct BProto_uint64_s))
+#define msg_youconnect_SIZEtcpaddr(_len) (sizeof(struct BProto_header_s) + sizeof(struct BProto_data_header_s) + (_len))
+#define msg_youconnect_SIZEcompact (sizeof(struct BProto_header_s) + sizeof(struct BProto_uint8_s))
 
 typedef struct {
     uint8_t *out;
@@ -415,6 +417,8 @@ typedef struct {
     int addr_count;
     int key_count;
     int password_count;
+    int tcpaddr_count;
+    int compact_count;
 } msg_youconnectWriter;
 
 static void msg_youconnectWriter_Init (msg_youconnectWriter *o, uint8_t *out);
@@ -422,6 +426,8 @@ static int msg_youconnectWriter_Finish (msg_youconnectWriter *o);
 static uint8_t * msg_youconnectWriter_Addaddr (msg_youconnectWriter *o, int len);
 static uint8_t * msg_youconnectWriter_Addkey (msg_youconnectWriter *o, int len);
 static void msg_youconnectWriter_Addpassword (msg_youconnectWriter *o, uint64_t v);
+static uint8_t * msg_youconnectWriter_Addtcpaddr (msg_youconnectWriter *o, int len);
+static void msg_youconnectWriter_Addcompact (msg_youconnectWriter *o, uint8_t v);
 
 typedef struct {
     uint8_t *buf;
@@ -435,6 +441,12 @@ typedef struct {
     int password_start;
     int password_span;
     int password_pos;
+    int tcpaddr_start;
+    int tcpaddr_span;
+    int tcpaddr_pos;
+    int compact_start;
+    int compact_span;
+    int compact_pos;
 } msg_youconnectParser;
 
 static int msg_youconnectParser_Init (msg_youconnectParser *o, uint8_t *buf, int buf_len);
@@ -448,6 +460,12 @@ static void msg_youconnectParser_Forwardkey (msg_youconnectParser *o);
 static int msg_youconnectParser_Getpassword (msg_youconnectParser *o, uint64_t *v);
 static void msg_youconnectParser_Resetpassword (msg_youconnectParser *o);
 static void msg_youconnectParser_Forwardpassword (msg_youconnectParser *o);
+static int msg_youconnectParser_Gettcpaddr (msg_youconnectParser *o, uint8_t **data, int *data_len);
+static void msg_youconnectParser_Resettcpaddr (msg_youconnectParser *o);
+static void msg_youconnectParser_Forwardtcpaddr (msg_youconnectParser *o);
+static int msg_youconnectParser_Getcompact (msg_youconnectParser *o, uint8_t *v);
+static void msg_youconnectParser_Resetcompact (msg_youconnectParser *o);
+static void msg_youconnectParser_Forwardcompact (msg_youconnectParser *o);
 
 void msg_youconnectWriter_Init (msg_youconnectWriter *o, uint8_t *out)
 {
@@ -456,6 +474,8 @@ void msg_youconnectWriter_Init (msg_youconnectWriter *o, uint8_t *out)
     o->addr_count = 0;
     o->key_count = 0;
     o->password_count = 0;
+    o->tcpaddr_count = 0;
+    o->compact_count = 0;
 }
 
 int msg_youconnectWriter_Finish (msg_youconnectWriter *o)
@@ -464,6 +484,8 @@ int msg_youconnectWriter_Finish (msg_youconnectWriter *o)
     ASSERT(o->addr_count >= 1)
     ASSERT(o->key_count >= 0 && o->key_count <= 1)
     ASSERT(o->password_count >= 0 && o->password_count <= 1)
+    ASSERT(o->tcpaddr_count >= 0)
+    ASSERT(o->compact_count >= 0 && o->compact_count <= 1)
 
     return o->used;
 }
@@ -538,6 +560,51 @@ void msg_youconnectWriter_Addpassword (msg_youconnectWriter *o, uint64_t v)
     o->password_count++;
 }
 
+uint8_t * msg_youconnectWriter_Addtcpaddr (msg_youconnectWriter *o, int len)
+{
+    ASSERT(o->used >= 0)
+    
+    ASSERT(len >= 0 && len <= UINT32_MAX)
+
+    struct BProto_header_s header;
+    header.id = htol16(4);
+    header.type = htol16(BPROTO_TYPE_DATA);
+    memcpy(o->out + o->used, &header, sizeof(header));
+    o->used += sizeof(struct BProto_header_s);
+
+    struct BProto_data_header_s data;
+    data.len = htol32(len);
+    memcpy(o->out + o->used, &data, sizeof(data));
+    o->used += sizeof(struct BProto_data_header_s);
+
+    uint8_t *dest = (o->out + o->used);
+    o->used += len;
+
+    o->tcpaddr_count++;
+
+    return dest;
+}
+
+void msg_youconnectWriter_Addcompact (msg_youconnectWriter *o, uint8_t v)
+{
+    ASSERT(o->used >= 0)
+    ASSERT(o->compact_count == 0)
+    
+
+    struct BProto_header_s header;
+    header.id = htol16(5);
+    header.type = htol16(BPROTO_TYPE_UINT8);
+    memcpy(o->out + o->used, &header, sizeof(header));
+    o->used += sizeof(struct BProto_header_s);
+
+    struct BProto_uint8_s data;
+    data.v = htol8(v);
+    memcpy(o->out + o->used, &data, sizeof(data));
+    o->used += sizeof(struct BProto_uint8_s);
+
+    o->compact_count++;
+}
+
 int msg_youconnectParser_Init (msg_youconnectParser *o, uint8_t *buf, int buf_len)
 {
     ASSERT(buf_len >= 0)
@@ -553,10 +620,18 @@ int msg_youconnectParser_Init (msg_youconnectParser *o, uint8_t *buf, int buf_le
     o->password_start = o->buf_len;
     o->password_span = 0;
     o->password_pos = 0;
+    o->tcpaddr_start = o->buf_len;
+    o->tcpaddr_span = 0;
+    o->tcpaddr_pos = 0;
+    o->compact_start = o->buf_len;
+    o->compact_span = 0;
+    o->compact_pos = 0;
 
     int addr_count = 0;
     int key_count = 0;
     int password_count = 0;
+    int tcpaddr_count = 0;
+    int compact_count = 0;
 
     int pos = 0;
     int left = o->buf_len;
@@ -583,6 +658,13 @@ int msg_youconnectParser_Init (msg_youconnectParser *o, uint8_t *buf, int buf_le
                 left -= sizeof(struct BProto_uint8_s);
 
                 switch (id) {
+                    case 5:
+                        if (o->compact_start == o->buf_len) {
+                            o->compact_start = entry_pos;
+                        }
+                        o->compact_span = pos - o->compact_start;
+                        compact_count++;
+                        break;
                     default:
                         return 0;
                 }
@@ -669,6 +751,16 @@ int msg_youconnectParser_Init (msg_youconnectParser *o, uint8_t *buf, int buf_le
                         o->key_span = pos - o->key_start;
                         key_count++;
                         break;
+                    case 4:
+                        if (!(type == BPROTO_TYPE_DATA)) {
+                            return 0;
+                        }
+                        if (o->tcpaddr_start == o->buf_len) {
+                            o->tcpaddr_start = entry_pos;
+                        }
+                        o->tcpaddr_span = pos - o->tcpaddr_start;
+                        tcpaddr_count++;
+                        break;
                     default:
                         return 0;
                 }
@@ -687,6 +779,9 @@ int msg_youconnectParser_Init (msg_youconnectParser *o, uint8_t *buf, int buf_le
     if (!(password_count <= 1)) {
         return 0;
     }
+    if (!(compact_count <= 1)) {
+        return 0;
+    }
 
     return 1;
 }
@@ -699,6 +794,10 @@ int msg_youconnectParser_GotEverything (msg_youconnectParser *o)
         o->key_pos == o->key_span
         &&
         o->password_pos == o->password_span
+        &&
+        o->tcpaddr_pos == o->tcpaddr_span
+        &&
+        o->compact_pos == o->compact_span
     );
 }
 
@@ -930,6 +1029,158 @@ void msg_youconnectParser_Forwardpassword (msg_youconnectParser *o)
     o->password_pos = o->password_span;
 }
 
+int msg_youconnectParser_Gettcpaddr (msg_youconnectParser *o, uint8_t **data, int *data_len)
+{
+    ASSERT(o->tcpaddr_pos >= 0)
+    ASSERT(o->tcpaddr_pos <= o->tcpaddr_span)
+
+    int left = o->tcpaddr_span - o->tcpaddr_pos;
+
+    while (left > 0) {
+        ASSERT(left >= sizeof(struct BProto_header_s))
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + o->tcpaddr_start + o->tcpaddr_pos, sizeof(header));
+        o->tcpaddr_pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                ASSERT(left >= sizeof(struct BProto_uint8_s))
+                o->tcpaddr_pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                ASSERT(left >= sizeof(struct BProto_uint16_s))
+                o->tcpaddr_pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                ASSERT(left >= sizeof(struct BProto_uint32_s))
+                o->tcpaddr_pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                ASSERT(left >= sizeof(struct BProto_uint64_s))
+                o->tcpaddr_pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                ASSERT(left >= sizeof(struct BProto_data_header_s))
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + o->tcpaddr_start + o->tcpaddr_pos, sizeof(val));
+                o->tcpaddr_pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                ASSERT(left >= payload_len)
+                uint8_t *payload = o->buf + o->tcpaddr_start + o->tcpaddr_pos;
+                o->tcpaddr_pos += payload_len;
+                left -= payload_len;
+
+                if (type == BPROTO_TYPE_DATA && id == 4) {
+                    *data = payload;
+                    *data_len = payload_len;
+                    return 1;
+                }
+            } break;
+            default:
+                ASSERT(0);
+        }
+    }
+
+    return 0;
+}
+
+void msg_youconnectParser_Resettcpaddr (msg_youconnectParser *o)
+{
+    o->tcpaddr_pos = 0;
+}
+
+void msg_youconnectParser_Forwardtcpaddr (msg_youconnectParser *o)
+{
+    o->tcpaddr_pos = o->tcpaddr_span;
+}
+
+int msg_youconnectParser_Getcompact (msg_youconnectParser *o, uint8_t *v)
+{
+    ASSERT(o->compact_pos >= 0)
+    ASSERT(o->compact_pos <= o->compact_span)
+
+    int left = o->compact_span - o->compact_pos;
+
+    while (left > 0) {
+        ASSERT(left >= sizeof(struct BProto_header_s))
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + o->compact_start + o->compact_pos, sizeof(header));
+        o->compact_pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                ASSERT(left >= sizeof(struct BProto_uint8_s))
+                struct BProto_uint8_s val;
+                memcpy(&val, o->buf + o->compact_start + o->compact_pos, sizeof(val));
+                o->compact_pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+
+                if (id == 5) {
+                    *v = ltoh8(val.v);
+                    return 1;
+                }
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                ASSERT(left >= sizeof(struct BProto_uint16_s))
+                o->compact_pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                ASSERT(left >= sizeof(struct BProto_uint32_s))
+                o->compact_pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                ASSERT(left >= sizeof(struct BProto_uint64_s))
+                o->compact_pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                ASSERT(left >= sizeof(struct BProto_data_header_s))
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + o->compact_start + o->compact_pos, sizeof(val));
+                o->compact_pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                ASSERT(left >= payload_len)
+                o->compact_pos += payload_len;
+                left -= payload_len;
+            } break;
+            default:
+                ASSERT(0);
+        }
+    }
+
+    return 0;
+}
+
+void msg_youconnectParser_Resetcompact (msg_youconnectParser *o)
+{
+    o->compact_pos = 0;
+}
+
+void msg_youconnectParser_Forwardcompact (msg_youconnectParser *o)
+{
+    o->compact_pos = o->compact_span;
+}
+
 #define msg_youconnect_addr_SIZEname(_len) (sizeof(struct BProto_header_s) + sizeof(struct BProto_data_header_s) + (_len))
 #define msg_youconnect_addr_SIZEaddr(_len) (sizeof(struct BProto_header_s) + sizeof(struct BProto_data_header_s) + (_len))
 
@@ -2120,3 +2371,933 @@ void msg_confirmseedParser_Forwardseed_id (msg_confirmseedParser *o)
     o->seed_id_pos = o->seed_id_span;
 }
 
+#define msg_routes_SIZEroute(_len) (sizeof(struct BProto_header_s) + sizeof(struct BProto_data_header_s) + (_len))
+
+typedef struct {
+    uint8_t *out;
+    int used;
+    int route_count;
+} msg_routesWriter;
+
+static void msg_routesWriter_Init (msg_routesWriter *o, uint8_t *out);
+static int msg_routesWriter_Finish (msg_routesWriter *o);
+static uint8_t * msg_routesWriter_Addroute (msg_routesWriter *o, int len);
+
+typedef struct {
+    uint8_t *buf;
+    int buf_len;
+    int route_start;
+    int route_span;
+    int route_pos;
+} msg_routesParser;
+
+static int msg_routesParser_Init (msg_routesParser *o, uint8_t *buf, int buf_len);
+static int msg_routesParser_GotEverything (msg_routesParser *o);
+static int msg_routesParser_Getroute (msg_routesParser *o, uint8_t **data, int *data_len);
+static void msg_routesParser_Resetroute (msg_routesParser *o);
+static void msg_routesParser_Forwardroute (msg_routesParser *o);
+
+void msg_routesWriter_Init (msg_routesWriter *o, uint8_t *out)
+{
+    o->out = out;
+    o->used = 0;
+    o->route_count = 0;
+}
+
+int msg_routesWriter_Finish (msg_routesWriter *o)
+{
+    ASSERT(o->used >= 0)
+    ASSERT(o->route_count >= 0)
+
+    return o->used;
+}
+
+uint8_t * msg_routesWriter_Addroute (msg_routesWriter *o, int len)
+{
+    ASSERT(o->used >= 0)
+    
+    ASSERT(len >= 0 && len <= UINT32_MAX)
+
+    struct BProto_header_s header;
+    header.id = htol16(1);
+    header.type = htol16(BPROTO_TYPE_DATA);
+    memcpy(o->out + o->used, &header, sizeof(header));
+    o->used += sizeof(struct BProto_header_s);
+
+    struct BProto_data_header_s data;
+    data.len = htol32(len);
+    memcpy(o->out + o->used, &data, sizeof(data));
+    o->used += sizeof(struct BProto_data_header_s);
+
+    uint8_t *dest = (o->out + o->used);
+    o->used += len;
+
+    o->route_count++;
+
+    return dest;
+}
+
+int msg_routesParser_Init (msg_routesParser *o, uint8_t *buf, int buf_len)
+{
+    ASSERT(buf_len >= 0)
+
+    o->buf = buf;
+    o->buf_len = buf_len;
+    o->route_start = o->buf_len;
+    o->route_span = 0;
+    o->route_pos = 0;
+
+    int route_count = 0;
+
+    int pos = 0;
+    int left = o->buf_len;
+
+    while (left > 0) {
+        int entry_pos = pos;
+
+        if (!(left >= sizeof(struct BProto_header_s))) {
+            return 0;
+        }
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + pos, sizeof(header));
+        pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                if (!(left >= sizeof(struct BProto_uint8_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                if (!(left >= sizeof(struct BProto_uint16_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                if (!(left >= sizeof(struct BProto_uint32_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                if (!(left >= sizeof(struct BProto_uint64_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                if (!(left >= sizeof(struct BProto_data_header_s))) {
+                    return 0;
+                }
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + pos, sizeof(val));
+                pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                if (!(left >= payload_len)) {
+                    return 0;
+                }
+                pos += payload_len;
+                left -= payload_len;
+
+                switch (id) {
+                    case 1:
+                        if (!(type == BPROTO_TYPE_DATA)) {
+                            return 0;
+                        }
+                        if (o->route_start == o->buf_len) {
+                            o->route_start = entry_pos;
+                        }
+                        o->route_span = pos - o->route_start;
+                        route_count++;
+                        break;
+                    default:
+                        return 0;
+                }
+            } break;
+            default:
+                return 0;
+        }
+    }
+
+
+    return 1;
+}
+
+int msg_routesParser_GotEverything (msg_routesParser *o)
+{
+    return (
+        o->route_pos == o->route_span
+    );
+}
+
+int msg_routesParser_Getroute (msg_routesParser *o, uint8_t **data, int *data_len)
+{
+    ASSERT(o->route_pos >= 0)
+    ASSERT(o->route_pos <= o->route_span)
+
+    int left = o->route_span - o->route_pos;
+
+    while (left > 0) {
+        ASSERT(left >= sizeof(struct BProto_header_s))
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + o->route_start + o->route_pos, sizeof(header));
+        o->route_pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                ASSERT(left >= sizeof(struct BProto_uint8_s))
+                o->route_pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                ASSERT(left >= sizeof(struct BProto_uint16_s))
+                o->route_pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                ASSERT(left >= sizeof(struct BProto_uint32_s))
+                o->route_pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                ASSERT(left >= sizeof(struct BProto_uint64_s))
+                o->route_pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                ASSERT(left >= sizeof(struct BProto_data_header_s))
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + o->route_start + o->route_pos, sizeof(val));
+                o->route_pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                ASSERT(left >= payload_len)
+                uint8_t *payload = o->buf + o->route_start + o->route_pos;
+                o->route_pos += payload_len;
+                left -= payload_len;
+
+                if (type == BPROTO_TYPE_DATA && id == 1) {
+                    *data = payload;
+                    *data_len = payload_len;
+                    return 1;
+                }
+            } break;
+            default:
+                ASSERT(0);
+        }
+    }
+
+    return 0;
+}
+
+void msg_routesParser_Resetroute (msg_routesParser *o)
+{
+    o->route_pos = 0;
+}
+
+void msg_routesParser_Forwardroute (msg_routesParser *o)
+{
+    o->route_pos = o->route_span;
+}
+
+#define msg_routes_route_SIZEaddr(_len) (sizeof(struct BProto_header_s) + sizeof(struct BProto_data_header_s) + (_len))
+#define msg_routes_route_SIZEprefix (sizeof(struct BProto_header_s) + sizeof(struct BProto_uint8_s))
+
+typedef struct {
+    uint8_t *out;
+    int used;
+    int addr_count;
+    int prefix_count;
+} msg_routes_routeWriter;
+
+static void msg_routes_routeWriter_Init (msg_routes_routeWriter *o, uint8_t *out);
+static int msg_routes_routeWriter_Finish (msg_routes_routeWriter *o);
+static uint8_t * msg_routes_routeWriter_Addaddr (msg_routes_routeWriter *o, int len);
+static void msg_routes_routeWriter_Addprefix (msg_routes_routeWriter *o, uint8_t v);
+
+typedef struct {
+    uint8_t *buf;
+    int buf_len;
+    int addr_start;
+    int addr_span;
+    int addr_pos;
+    int prefix_start;
+    int prefix_span;
+    int prefix_pos;
+} msg_routes_routeParser;
+
+static int msg_routes_routeParser_Init (msg_routes_routeParser *o, uint8_t *buf, int buf_len);
+static int msg_routes_routeParser_GotEverything (msg_routes_routeParser *o);
+static int msg_routes_routeParser_Getaddr (msg_routes_routeParser *o, uint8_t **data, int *data_len);
+static void msg_routes_routeParser_Resetaddr (msg_routes_routeParser *o);
+static void msg_routes_routeParser_Forwardaddr (msg_routes_routeParser *o);
+static int msg_routes_routeParser_Getprefix (msg_routes_routeParser *o, uint8_t *v);
+static void msg_routes_routeParser_Resetprefix (msg_routes_routeParser *o);
+static void msg_routes_routeParser_Forwardprefix (msg_routes_routeParser *o);
+
+void msg_routes_routeWriter_Init (msg_routes_routeWriter *o, uint8_t *out)
+{
+    o->out = out;
+    o->used = 0;
+    o->addr_count = 0;
+    o->prefix_count = 0;
+}
+
+int msg_routes_routeWriter_Finish (msg_routes_routeWriter *o)
+{
+    ASSERT(o->used >= 0)
+    ASSERT(o->addr_count == 1)
+    ASSERT(o->prefix_count == 1)
+
+    return o->used;
+}
+
+uint8_t * msg_routes_routeWriter_Addaddr (msg_routes_routeWriter *o, int len)
+{
+    ASSERT(o->used >= 0)
+    ASSERT(o->addr_count == 0)
+    ASSERT(len >= 0 && len <= UINT32_MAX)
+
+    struct BProto_header_s header;
+    header.id = htol16(1);
+    header.type = htol16(BPROTO_TYPE_DATA);
+    memcpy(o->out + o->used, &header, sizeof(header));
+    o->used += sizeof(struct BProto_header_s);
+
+    struct BProto_data_header_s data;
+    data.len = htol32(len);
+    memcpy(o->out + o->used, &data, sizeof(data));
+    o->used += sizeof(struct BProto_data_header_s);
+
+    uint8_t *dest = (o->out + o->used);
+    o->used += len;
+
+    o->addr_count++;
+
+    return dest;
+}
+
+void msg_routes_routeWriter_Addprefix (msg_routes_routeWriter *o, uint8_t v)
+{
+    ASSERT(o->used >= 0)
+    ASSERT(o->prefix_count == 0)
+    
+
+    struct BProto_header_s header;
+    header.id = htol16(2);
+    header.type = htol16(BPROTO_TYPE_UINT8);
+    memcpy(o->out + o->used, &header, sizeof(header));
+    o->used += sizeof(struct BProto_header_s);
+
+    struct BProto_uint8_s data;
+    data.v = htol8(v);
+    memcpy(o->out + o->used, &data, sizeof(data));
+    o->used += sizeof(struct BProto_uint8_s);
+
+    o->prefix_count++;
+}
+
+int msg_routes_routeParser_Init (msg_routes_routeParser *o, uint8_t *buf, int buf_len)
+{
+    ASSERT(buf_len >= 0)
+
+    o->buf = buf;
+    o->buf_len = buf_len;
+    o->addr_start = o->buf_len;
+    o->addr_span = 0;
+    o->addr_pos = 0;
+    o->prefix_start = o->buf_len;
+    o->prefix_span = 0;
+    o->prefix_pos = 0;
+
+    int addr_count = 0;
+    int prefix_count = 0;
+
+    int pos = 0;
+    int left = o->buf_len;
+
+    while (left > 0) {
+        int entry_pos = pos;
+
+        if (!(left >= sizeof(struct BProto_header_s))) {
+            return 0;
+        }
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + pos, sizeof(header));
+        pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                if (!(left >= sizeof(struct BProto_uint8_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+
+                switch (id) {
+                    case 2:
+                        if (o->prefix_start == o->buf_len) {
+                            o->prefix_start = entry_pos;
+                        }
+                        o->prefix_span = pos - o->prefix_start;
+                        prefix_count++;
+                        break;
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                if (!(left >= sizeof(struct BProto_uint16_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                if (!(left >= sizeof(struct BProto_uint32_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                if (!(left >= sizeof(struct BProto_uint64_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                if (!(left >= sizeof(struct BProto_data_header_s))) {
+                    return 0;
+                }
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + pos, sizeof(val));
+                pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                if (!(left >= payload_len)) {
+                    return 0;
+                }
+                pos += payload_len;
+                left -= payload_len;
+
+                switch (id) {
+                    case 1:
+                        if (!(type == BPROTO_TYPE_DATA)) {
+                            return 0;
+                        }
+                        if (o->addr_start == o->buf_len) {
+                            o->addr_start = entry_pos;
+                        }
+                        o->addr_span = pos - o->addr_start;
+                        addr_count++;
+                        break;
+                    default:
+                        return 0;
+                }
+            } break;
+            default:
+                return 0;
+        }
+    }
+
+    if (!(addr_count == 1)) {
+        return 0;
+    }
+    if (!(prefix_count == 1)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+int msg_routes_routeParser_GotEverything (msg_routes_routeParser *o)
+{
+    return (
+        o->addr_pos == o->addr_span
+        &&
+        o->prefix_pos == o->prefix_span
+    );
+}
+
+int msg_routes_routeParser_Getaddr (msg_routes_routeParser *o, uint8_t **data, int *data_len)
+{
+    ASSERT(o->addr_pos >= 0)
+    ASSERT(o->addr_pos <= o->addr_span)
+
+    int left = o->addr_span - o->addr_pos;
+
+    while (left > 0) {
+        ASSERT(left >= sizeof(struct BProto_header_s))
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + o->addr_start + o->addr_pos, sizeof(header));
+        o->addr_pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                ASSERT(left >= sizeof(struct BProto_uint8_s))
+                o->addr_pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                ASSERT(left >= sizeof(struct BProto_uint16_s))
+                o->addr_pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                ASSERT(left >= sizeof(struct BProto_uint32_s))
+                o->addr_pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                ASSERT(left >= sizeof(struct BProto_uint64_s))
+                o->addr_pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                ASSERT(left >= sizeof(struct BProto_data_header_s))
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + o->addr_start + o->addr_pos, sizeof(val));
+                o->addr_pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                ASSERT(left >= payload_len)
+                uint8_t *payload = o->buf + o->addr_start + o->addr_pos;
+                o->addr_pos += payload_len;
+                left -= payload_len;
+
+                if (type == BPROTO_TYPE_DATA && id == 1) {
+                    *data = payload;
+                    *data_len = payload_len;
+                    return 1;
+                }
+            } break;
+            default:
+                ASSERT(0);
+        }
+    }
+
+    return 0;
+}
+
+void msg_routes_routeParser_Resetaddr (msg_routes_routeParser *o)
+{
+    o->addr_pos = 0;
+}
+
+void msg_routes_routeParser_Forwardaddr (msg_routes_routeParser *o)
+{
+    o->addr_pos = o->addr_span;
+}
+
+int msg_routes_routeParser_Getprefix (msg_routes_routeParser *o, uint8_t *v)
+{
+    ASSERT(o->prefix_pos >= 0)
+    ASSERT(o->prefix_pos <= o->prefix_span)
+
+    int left = o->prefix_span - o->prefix_pos;
+
+    while (left > 0) {
+        ASSERT(left >= sizeof(struct BProto_header_s))
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + o->prefix_start + o->prefix_pos, sizeof(header));
+        o->prefix_pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                ASSERT(left >= sizeof(struct BProto_uint8_s))
+                struct BProto_uint8_s val;
+                memcpy(&val, o->buf + o->prefix_start + o->prefix_pos, sizeof(val));
+                o->prefix_pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+
+                if (id == 2) {
+                    *v = ltoh8(val.v);
+                    return 1;
+                }
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                ASSERT(left >= sizeof(struct BProto_uint16_s))
+                o->prefix_pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                ASSERT(left >= sizeof(struct BProto_uint32_s))
+                o->prefix_pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                ASSERT(left >= sizeof(struct BProto_uint64_s))
+                o->prefix_pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                ASSERT(left >= sizeof(struct BProto_data_header_s))
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + o->prefix_start + o->prefix_pos, sizeof(val));
+                o->prefix_pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                ASSERT(left >= payload_len)
+                o->prefix_pos += payload_len;
+                left -= payload_len;
+            } break;
+            default:
+                ASSERT(0);
+        }
+    }
+
+    return 0;
+}
+
+void msg_routes_routeParser_Resetprefix (msg_routes_routeParser *o)
+{
+    o->prefix_pos = 0;
+}
+
+void msg_routes_routeParser_Forwardprefix (msg_routes_routeParser *o)
+{
+    o->prefix_pos = o->prefix_span;
+}
+
+#define msg_punch_SIZEaddr(_len) (sizeof(struct BProto_header_s) + sizeof(struct BProto_data_header_s) + (_len))
+
+typedef struct {
+    uint8_t *out;
+    int used;
+    int addr_count;
+} msg_punchWriter;
+
+static void msg_punchWriter_Init (msg_punchWriter *o, uint8_t *out);
+static int msg_punchWriter_Finish (msg_punchWriter *o);
+static uint8_t * msg_punchWriter_Addaddr (msg_punchWriter *o, int len);
+
+typedef struct {
+    uint8_t *buf;
+    int buf_len;
+    int addr_start;
+    int addr_span;
+    int addr_pos;
+} msg_punchParser;
+
+static int msg_punchParser_Init (msg_punchParser *o, uint8_t *buf, int buf_len);
+static int msg_punchParser_GotEverything (msg_punchParser *o);
+static int msg_punchParser_Getaddr (msg_punchParser *o, uint8_t **data, int *data_len);
+static void msg_punchParser_Resetaddr (msg_punchParser *o);
+static void msg_punchParser_Forwardaddr (msg_punchParser *o);
+
+void msg_punchWriter_Init (msg_punchWriter *o, uint8_t *out)
+{
+    o->out = out;
+    o->used = 0;
+    o->addr_count = 0;
+}
+
+int msg_punchWriter_Finish (msg_punchWriter *o)
+{
+    ASSERT(o->used >= 0)
+    ASSERT(o->addr_count >= 0)
+
+    return o->used;
+}
+
+uint8_t * msg_punchWriter_Addaddr (msg_punchWriter *o, int len)
+{
+    ASSERT(o->used >= 0)
+    
+    ASSERT(len >= 0 && len <= UINT32_MAX)
+
+    struct BProto_header_s header;
+    header.id = htol16(1);
+    header.type = htol16(BPROTO_TYPE_DATA);
+    memcpy(o->out + o->used, &header, sizeof(header));
+    o->used += sizeof(struct BProto_header_s);
+
+    struct BProto_data_header_s data;
+    data.len = htol32(len);
+    memcpy(o->out + o->used, &data, sizeof(data));
+    o->used += sizeof(struct BProto_data_header_s);
+
+    uint8_t *dest = (o->out + o->used);
+    o->used += len;
+
+    o->addr_count++;
+
+    return dest;
+}
+
+int msg_punchParser_Init (msg_punchParser *o, uint8_t *buf, int buf_len)
+{
+    ASSERT(buf_len >= 0)
+
+    o->buf = buf;
+    o->buf_len = buf_len;
+    o->addr_start = o->buf_len;
+    o->addr_span = 0;
+    o->addr_pos = 0;
+
+    int addr_count = 0;
+
+    int pos = 0;
+    int left = o->buf_len;
+
+    while (left > 0) {
+        int entry_pos = pos;
+
+        if (!(left >= sizeof(struct BProto_header_s))) {
+            return 0;
+        }
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + pos, sizeof(header));
+        pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                if (!(left >= sizeof(struct BProto_uint8_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                if (!(left >= sizeof(struct BProto_uint16_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                if (!(left >= sizeof(struct BProto_uint32_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                if (!(left >= sizeof(struct BProto_uint64_s))) {
+                    return 0;
+                }
+                pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+
+                switch (id) {
+                    default:
+                        return 0;
+                }
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                if (!(left >= sizeof(struct BProto_data_header_s))) {
+                    return 0;
+                }
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + pos, sizeof(val));
+                pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                if (!(left >= payload_len)) {
+                    return 0;
+                }
+                pos += payload_len;
+                left -= payload_len;
+
+                switch (id) {
+                    case 1:
+                        if (!(type == BPROTO_TYPE_DATA)) {
+                            return 0;
+                        }
+                        if (o->addr_start == o->buf_len) {
+                            o->addr_start = entry_pos;
+                        }
+                        o->addr_span = pos - o->addr_start;
+                        addr_count++;
+                        break;
+                    default:
+                        return 0;
+                }
+            } break;
+            default:
+                return 0;
+        }
+    }
+
+
+    return 1;
+}
+
+int msg_punchParser_GotEverything (msg_punchParser *o)
+{
+    return (
+        o->addr_pos == o->addr_span
+    );
+}
+
+int msg_punchParser_Getaddr (msg_punchParser *o, uint8_t **data, int *data_len)
+{
+    ASSERT(o->addr_pos >= 0)
+    ASSERT(o->addr_pos <= o->addr_span)
+
+    int left = o->addr_span - o->addr_pos;
+
+    while (left > 0) {
+        ASSERT(left >= sizeof(struct BProto_header_s))
+        struct BProto_header_s header;
+        memcpy(&header, o->buf + o->addr_start + o->addr_pos, sizeof(header));
+        o->addr_pos += sizeof(struct BProto_header_s);
+        left -= sizeof(struct BProto_header_s);
+        uint16_t type = ltoh16(header.type);
+        uint16_t id = ltoh16(header.id);
+
+        switch (type) {
+            case BPROTO_TYPE_UINT8: {
+                ASSERT(left >= sizeof(struct BProto_uint8_s))
+                o->addr_pos += sizeof(struct BProto_uint8_s);
+                left -= sizeof(struct BProto_uint8_s);
+            } break;
+            case BPROTO_TYPE_UINT16: {
+                ASSERT(left >= sizeof(struct BProto_uint16_s))
+                o->addr_pos += sizeof(struct BProto_uint16_s);
+                left -= sizeof(struct BProto_uint16_s);
+            } break;
+            case BPROTO_TYPE_UINT32: {
+                ASSERT(left >= sizeof(struct BProto_uint32_s))
+                o->addr_pos += sizeof(struct BProto_uint32_s);
+                left -= sizeof(struct BProto_uint32_s);
+            } break;
+            case BPROTO_TYPE_UINT64: {
+                ASSERT(left >= sizeof(struct BProto_uint64_s))
+                o->addr_pos += sizeof(struct BProto_uint64_s);
+                left -= sizeof(struct BProto_uint64_s);
+            } break;
+            case BPROTO_TYPE_DATA:
+            case BPROTO_TYPE_CONSTDATA:
+            {
+                ASSERT(left >= sizeof(struct BProto_data_header_s))
+                struct BProto_data_header_s val;
+                memcpy(&val, o->buf + o->addr_start + o->addr_pos, sizeof(val));
+                o->addr_pos += sizeof(struct BProto_data_header_s);
+                left -= sizeof(struct BProto_data_header_s);
+
+                uint32_t payload_len = ltoh32(val.len);
+                ASSERT(left >= payload_len)
+                uint8_t *payload = o->buf + o->addr_start + o->addr_pos;
+                o->addr_pos += payload_len;
+                left -= payload_len;
+
+                if (type == BPROTO_TYPE_DATA && id == 1) {
+                    *data = payload;
+                    *data_len = payload_len;
+                    return 1;
+                }
+            } break;
+            default:
+                ASSERT(0);
+        }
+    }
+
+    return 0;
+}
+
+void msg_punchParser_Resetaddr (msg_punchParser *o)
+{
+    o->addr_pos = 0;
+}
+
+void msg_punchParser_Forwardaddr (msg_punchParser *o)
+{
+    o->addr_pos = o->addr_span;
+}
+
@@ -0,0 +1,85 @@
+/**
+ * @file chksum.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <lwip/opt.h>
+
+// Internet checksum over 64-bit words; see LWIP_CHKSUM in lwipopts.h.
+// Like lwIP's reference versions, this returns the non-inverted sum of
+// native-order 16-bit words, which the ones' complement arithmetic makes
+// independent of the word size and of alignment. Carries out of the 64-bit
+// accumulator are counted separately so the adds don't depend on each other.
+uint16_t lwip_custom_chksum (void *dataptr, int len)
+{
+    const uint8_t *p = (const uint8_t *)dataptr;
+    uint64_t sum = 0;
+    uint64_t carries = 0;
+    
+    while (len >= 32) {
+        uint64_t w[4];
+        memcpy(w, p, sizeof(w));
+        uint64_t s0 = w[0] + w[1];
+        uint64_t s1 = w[2] + w[3];
+        carries += (s0 < w[0]) + (s1 < w[2]);
+        uint64_t s = s0 + s1;
+        carries += (s < s0);
+        sum += s;
+        carries += (sum < s);
+        p += 32;
+        len -= 32;
+    }
+    
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        sum += w;
+        carries += (sum < w);
+        p += 8;
+        len -= 8;
+    }
+    
+    // remaining bytes go to the same positions they'd have in a full word
+    uint64_t t = 0;
+    memcpy(&t, p, len);
+    sum += t;
+    carries += (sum < t);
+    
+    sum += carries;
+    sum += (sum < carries);
+    
+    // fold to 16 bits
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    
+    return sum;
+}
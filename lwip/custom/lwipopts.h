@@ -30,6 +30,9 @@
 #ifndef LWIP_CUSTOM_LWIPOPTS_H
 #define LWIP_CUSTOM_LWIPOPTS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define NO_SYS 1
 #define MEM_ALIGNMENT 4
 
@@ -58,13 +61,75 @@
 #define LWIP_IPV6_MLD 0
 #define LWIP_IPV6_AUTOCONFIG 0
 
+// these only size the static pools, which LWIP_CUSTOM_MEMP replaces; the
+// number of TCP PCBs is instead limited by lwip_custom_max_tcp_pcb, and
+// lwip_custom_num_tcp_pcb tells how many there are
 #define MEMP_NUM_TCP_PCB_LISTEN 16
 #define MEMP_NUM_TCP_PCB 1024
-#define TCP_MSS 1460
-#define TCP_SND_BUF 16384
+#define TCP_PCB_HASH_SIZE 1024
+
+// bound connections which are still in the handshake, 255 per listener by
+// default, so that a SYN flood can't take up all PCBs
+#define TCP_LISTEN_BACKLOG 1
+
+// TCP parameters are runtime variables (see custom/tcpopts.c), so that
+// programs can set them from the command line before calling lwip_init().
+#define TCP_MSS lwip_custom_tcp_mss
+#define TCP_WND lwip_custom_tcp_wnd
+#define TCP_SND_BUF lwip_custom_tcp_snd_buf
 #define TCP_SND_QUEUELEN (4 * (TCP_SND_BUF)/(TCP_MSS))
+#define LWIP_WND_SCALE 1
+#define TCP_RCV_SCALE lwip_custom_tcp_rcv_scale
+#define TCP_WND_UPDATE_THRESHOLD LWIP_MIN((TCP_WND / 4), (TCP_MSS * 4))
+
+// with large windows, a lost segment would otherwise cost a retransmission
+// timeout for every further loss in the same window
+#define LWIP_TCP_SACK 1
+
+// These are used in preprocessor conditionals and static initializers,
+// so they need to be constants; they match the default MSS.
+#define TCP_OVERSIZE 1460
+#define PBUF_POOL_BUFSIZE LWIP_MEM_ALIGN_SIZE(1460 + 40 + PBUF_LINK_HLEN)
+
+// the compile-time checks cannot evaluate the runtime TCP parameters;
+// programs check them before setting them instead
+#define LWIP_DISABLE_TCP_SANITY_CHECKS 1
 
 #define MEM_LIBC_MALLOC 1
 #define MEMP_MEM_MALLOC 1
 
+// heap memory is accounted to lwIP (see base/BAllocStats.h)
+#define mem_malloc lwip_custom_mem_malloc
+#define mem_calloc lwip_custom_mem_calloc
+#define mem_free lwip_custom_mem_free
+
+// pool objects come from a slab per pool (see custom/memp.c) rather than
+// static pools, so their number is only limited by memory
+#define LWIP_CUSTOM_MEMP 1
+
+// checksum over 64-bit words (see custom/chksum.c); incoming TCP segments
+// are verified unless the program turns that off
+#define LWIP_CHKSUM lwip_custom_chksum
+#define CHECKSUM_CHECK_TCP_ENABLED lwip_custom_tcp_checksum_check
+
+// the program drives the TCP timer itself, running it only while there are
+// active or TIME-WAIT pcbs; lwIP asks for it by calling the hook whenever it
+// registers such a pcb
+#define NO_SYS_NO_TIMERS 1
+#define LWIP_TCP_TIMER_NEEDED_HOOK() do { if (lwip_custom_tcp_timer_needed) lwip_custom_tcp_timer_needed(); } while (0)
+
+extern uint16_t lwip_custom_tcp_mss;
+extern uint32_t lwip_custom_tcp_wnd;
+extern uint32_t lwip_custom_tcp_snd_buf;
+extern uint8_t lwip_custom_tcp_rcv_scale;
+extern uint32_t lwip_custom_max_tcp_pcb;
+extern uint32_t lwip_custom_num_tcp_pcb;
+extern uint8_t lwip_custom_tcp_checksum_check;
+extern void (*lwip_custom_tcp_timer_needed) (void);
+
+uint16_t lwip_custom_chksum (void *dataptr, int len);
+void * lwip_custom_mem_malloc (size_t size);
+void * lwip_custom_mem_calloc (size_t count, size_t size);
+void lwip_custom_mem_free (void *mem);
+
 #endif
@@ -0,0 +1,118 @@
+/**
+ * @file memp.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <misc/bslab.h>
+#include <base/BAllocStats.h>
+
+#include <lwip/memp.h>
+
+// number of objects of a pool allocated together
+#define MEMP_SLAB_CHUNK 32
+
+static BSlab slabs[MEMP_MAX];
+static int slabs_inited[MEMP_MAX];
+
+// limit on TCP PCBs, 0 for none; see lwipopts.h
+uint32_t lwip_custom_max_tcp_pcb = 0;
+uint32_t lwip_custom_num_tcp_pcb = 0;
+
+void * lwip_custom_memp_malloc (memp_t type)
+{
+    LWIP_ASSERT("type < MEMP_MAX", type < MEMP_MAX);
+    
+    // slabs don't allocate until used, so init them lazily instead
+    // of requiring a call from lwip_init()
+    if (!slabs_inited[type]) {
+        if (!BSlab_Init(&slabs[type], memp_sizes[type], MEMP_SLAB_CHUNK)) {
+            return NULL;
+        }
+        slabs_inited[type] = 1;
+    }
+    
+    // failing here makes tcp_alloc() evict the oldest TIME-WAIT PCB
+    // and then the longest idle connection, like with a full static pool
+    if (type == MEMP_TCP_PCB && lwip_custom_max_tcp_pcb > 0 && lwip_custom_num_tcp_pcb >= lwip_custom_max_tcp_pcb) {
+        return NULL;
+    }
+    
+    void *mem = BSlab_Alloc(&slabs[type]);
+    
+    if (mem) {
+        BAllocStats_Add(BALLOCSTATS_LWIP, memp_sizes[type]);
+    }
+    
+    if (mem && type == MEMP_TCP_PCB) {
+        lwip_custom_num_tcp_pcb++;
+    }
+    
+    return mem;
+}
+
+void lwip_custom_memp_free (memp_t type, void *mem)
+{
+    LWIP_ASSERT("type < MEMP_MAX", type < MEMP_MAX);
+    LWIP_ASSERT("slab in use", slabs_inited[type] || !mem);
+    
+    if (mem) {
+        BAllocStats_Remove(BALLOCSTATS_LWIP, memp_sizes[type]);
+    }
+    
+    if (mem && type == MEMP_TCP_PCB) {
+        LWIP_ASSERT("lwip_custom_num_tcp_pcb > 0", lwip_custom_num_tcp_pcb > 0);
+        lwip_custom_num_tcp_pcb--;
+    }
+    
+    BSlab_Release(&slabs[type], mem);
+}
+
+void * lwip_custom_mem_malloc (size_t size)
+{
+    return BAllocStats_Alloc(BALLOCSTATS_LWIP, size);
+}
+
+void * lwip_custom_mem_calloc (size_t count, size_t size)
+{
+    if (size > 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    
+    void *mem = BAllocStats_Alloc(BALLOCSTATS_LWIP, count * size);
+    if (mem) {
+        memset(mem, 0, count * size);
+    }
+    
+    return mem;
+}
+
+void lwip_custom_mem_free (void *mem)
+{
+    BAllocStats_Free(mem);
+}
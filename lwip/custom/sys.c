@@ -27,10 +27,14 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stddef.h>
+
 #include <system/BTime.h>
 
 #include <lwip/sys.h>
 
+void (*lwip_custom_tcp_timer_needed) (void) = NULL;
+
 u32_t sys_now (void)
 {
     return btime_gettime();
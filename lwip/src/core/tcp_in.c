@@ -74,12 +74,21 @@ static u16_t tcplen;
 static u8_t recv_flags;
 static struct pbuf *recv_data;
 
+#if LWIP_TCP_SACK
+/* SACK blocks of the segment being processed, as left and right edges */
+static u32_t sack_blocks[2 * TCP_SACK_MAX_BLOCKS];
+static u8_t num_sack_blocks;
+#endif /* LWIP_TCP_SACK */
+
 struct tcp_pcb *tcp_input_pcb;
 
 /* Forward declarations. */
 static err_t tcp_process(struct tcp_pcb *pcb);
 static void tcp_receive(struct tcp_pcb *pcb);
 static void tcp_parseopt(struct tcp_pcb *pcb);
+#if LWIP_TCP_SACK
+static void tcp_sack_update(struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK */
 
 static err_t tcp_listen_input(struct tcp_pcb_listen *pcb);
 static err_t tcp_timewait_input(struct tcp_pcb *pcb);
@@ -136,14 +145,16 @@ tcp_input(struct pbuf *p, struct netif *inp)
 
 #if CHECKSUM_CHECK_TCP
   /* Verify TCP checksum. */
-  chksum = ipX_chksum_pseudo(ip_current_is_v6(), p, IP_PROTO_TCP, p->tot_len,
-                             ipX_current_src_addr(), ipX_current_dest_addr());
-  if (chksum != 0) {
+  if (CHECKSUM_CHECK_TCP_ENABLED) {
+    chksum = ipX_chksum_pseudo(ip_current_is_v6(), p, IP_PROTO_TCP, p->tot_len,
+                               ipX_current_src_addr(), ipX_current_dest_addr());
+    if (chksum != 0) {
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packet discarded due to failing checksum 0x%04"X16_F"\n",
         chksum));
-    tcp_debug_print(tcphdr);
-    TCP_STATS_INC(tcp.chkerr);
-    goto dropped;
+      tcp_debug_print(tcphdr);
+      TCP_STATS_INC(tcp.chkerr);
+      goto dropped;
+    }
   }
 #endif /* CHECKSUM_CHECK_TCP */
 
@@ -171,7 +182,13 @@ tcp_input(struct pbuf *p, struct netif *inp)
      for an active connection. */
   prev = NULL;
 
-  
+#if TCP_PCB_HASH_SIZE
+  pcb = tcp_pcb_hash_lookup(&tcp_active_pcbs, ipX_current_dest_addr(), tcphdr->dest,
+                            ipX_current_src_addr(), tcphdr->src, ip_current_is_v6());
+  LWIP_ASSERT("tcp_input: active pcb->state != CLOSED", pcb == NULL || pcb->state != CLOSED);
+  LWIP_ASSERT("tcp_input: active pcb->state != TIME-WAIT", pcb == NULL || pcb->state != TIME_WAIT);
+  LWIP_ASSERT("tcp_input: active pcb->state != LISTEN", pcb == NULL || pcb->state != LISTEN);
+#else /* TCP_PCB_HASH_SIZE */
   for(pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
     LWIP_ASSERT("tcp_input: active pcb->state != CLOSED", pcb->state != CLOSED);
     LWIP_ASSERT("tcp_input: active pcb->state != TIME-WAIT", pcb->state != TIME_WAIT);
@@ -195,10 +212,22 @@ tcp_input(struct pbuf *p, struct netif *inp)
     }
     prev = pcb;
   }
+#endif /* TCP_PCB_HASH_SIZE */
 
   if (pcb == NULL) {
     /* If it did not go to an active connection, we check the connections
        in the TIME-WAIT state. */
+#if TCP_PCB_HASH_SIZE
+    pcb = tcp_pcb_hash_lookup(&tcp_tw_pcbs, ipX_current_dest_addr(), tcphdr->dest,
+                              ipX_current_src_addr(), tcphdr->src, ip_current_is_v6());
+    if (pcb != NULL) {
+      LWIP_ASSERT("tcp_input: TIME-WAIT pcb->state == TIME-WAIT", pcb->state == TIME_WAIT);
+      LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packed for TIME_WAITing connection.\n"));
+      tcp_timewait_input(pcb);
+      pbuf_free(p);
+      return;
+    }
+#else /* TCP_PCB_HASH_SIZE */
     for(pcb = tcp_tw_pcbs; pcb != NULL; pcb = pcb->next) {
       LWIP_ASSERT("tcp_input: TIME-WAIT pcb->state == TIME-WAIT", pcb->state == TIME_WAIT);
       if (pcb->remote_port == tcphdr->src &&
@@ -215,6 +244,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
         return;
       }
     }
+#endif /* TCP_PCB_HASH_SIZE */
 
     /* Finally, if we still did not get a match, we check all PCBs that
        are LISTENing for incoming connections. */
@@ -356,8 +386,12 @@ tcp_input(struct pbuf *p, struct netif *inp)
         /* If the application has registered a "sent" function to be
            called when new send buffer space is available, we call it
            now. */
-        if (pcb->acked > 0) {
-          TCP_EVENT_SENT(pcb, pcb->acked, err);
+        while (pcb->acked > 0) {
+          /* pcb->acked may not fit into the u16_t taken by the sent
+             callback, so we might have to call it multiple times. */
+          u16_t acked16 = (u16_t)LWIP_MIN(pcb->acked, 0xffffU);
+          pcb->acked -= acked16;
+          TCP_EVENT_SENT(pcb, acked16, err);
           if (err == ERR_ABRT) {
             goto aborted;
           }
@@ -373,16 +407,42 @@ tcp_input(struct pbuf *p, struct netif *inp)
             goto aborted;
           }
 
-          /* Notify application that data has been received. */
-          TCP_EVENT_RECV(pcb, recv_data, ERR_OK, err);
-          if (err == ERR_ABRT) {
-            goto aborted;
-          }
+#if TCP_QUEUE_OOSEQ && LWIP_WND_SCALE
+          /* with window scaling, recv_data may be longer than 64k and then
+             has to be passed to the application in parts */
+          while (recv_data != NULL) {
+            struct pbuf *rest = NULL;
+            pbuf_split_64k(recv_data, &rest);
+#else /* TCP_QUEUE_OOSEQ && LWIP_WND_SCALE */
+          {
+#endif /* TCP_QUEUE_OOSEQ && LWIP_WND_SCALE */
+            /* Notify application that data has been received. */
+            TCP_EVENT_RECV(pcb, recv_data, ERR_OK, err);
+            if (err == ERR_ABRT) {
+#if TCP_QUEUE_OOSEQ && LWIP_WND_SCALE
+              if (rest) {
+                pbuf_free(rest);
+              }
+#endif /* TCP_QUEUE_OOSEQ && LWIP_WND_SCALE */
+              goto aborted;
+            }
 
-          /* If the upper layer can't receive this data, store it */
-          if (err != ERR_OK) {
-            pcb->refused_data = recv_data;
-            LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: keep incoming packet, because pcb is \"full\"\n"));
+            /* If the upper layer can't receive this data, store it */
+            if (err != ERR_OK) {
+#if TCP_QUEUE_OOSEQ && LWIP_WND_SCALE
+              if (rest) {
+                pbuf_cat(recv_data, rest);
+              }
+#endif /* TCP_QUEUE_OOSEQ && LWIP_WND_SCALE */
+              pcb->refused_data = recv_data;
+              LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: keep incoming packet, because pcb is \"full\"\n"));
+#if TCP_QUEUE_OOSEQ && LWIP_WND_SCALE
+              break;
+            } else {
+              /* Upper layer received the data, go on with the rest if > 64K */
+              recv_data = rest;
+#endif /* TCP_QUEUE_OOSEQ && LWIP_WND_SCALE */
+            }
           }
         }
 
@@ -395,7 +455,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
           } else {
             /* correct rcv_wnd as the application won't call tcp_recved()
                for the FIN's seqno */
-            if (pcb->rcv_wnd != TCP_WND) {
+            if (pcb->rcv_wnd != TCP_WND_MAX(pcb)) {
               pcb->rcv_wnd++;
             }
             TCP_EVENT_CLOSED(pcb, err);
@@ -530,6 +590,10 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 
     /* Parse any options in the SYN. */
     tcp_parseopt(npcb);
+#if LWIP_WND_SCALE
+    /* the window in the SYN is never scaled, but later ones will be */
+    npcb->ssthresh = SND_WND_SCALE(npcb, npcb->snd_wnd);
+#endif
 #if TCP_CALCULATE_EFF_SEND_MSS
     npcb->mss = tcp_eff_send_mss(npcb->mss, &npcb->local_ip,
       &npcb->remote_ip, PCB_ISIPV6(npcb));
@@ -717,7 +781,7 @@ tcp_process(struct tcp_pcb *pcb)
     if (flags & TCP_ACK) {
       /* expected ACK number? */
       if (TCP_SEQ_BETWEEN(ackno, pcb->lastack+1, pcb->snd_nxt)) {
-        u16_t old_cwnd;
+        tcpwnd_size_t old_cwnd;
         pcb->state = ESTABLISHED;
         LWIP_DEBUGF(TCP_DEBUG, ("TCP connection established %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
 #if LWIP_CALLBACK_API
@@ -889,6 +953,12 @@ tcp_receive(struct tcp_pcb *pcb)
   u32_t right_wnd_edge;
   u16_t new_tot_len;
   int found_dupack = 0;
+#if TCP_QUEUE_OOSEQ
+  int fills_gap;
+#endif /* TCP_QUEUE_OOSEQ */
+#if LWIP_TCP_SACK
+  int partial_ack = 0;
+#endif /* LWIP_TCP_SACK */
 #if TCP_OOSEQ_MAX_BYTES || TCP_OOSEQ_MAX_PBUFS
   u32_t ooseq_blen;
   u16_t ooseq_qlen;
@@ -899,15 +969,21 @@ tcp_receive(struct tcp_pcb *pcb)
   if (flags & TCP_ACK) {
     right_wnd_edge = pcb->snd_wnd + pcb->snd_wl2;
 
+#if LWIP_TCP_SACK
+    if ((pcb->flags & TF_SACK) && num_sack_blocks > 0) {
+      tcp_sack_update(pcb);
+    }
+#endif /* LWIP_TCP_SACK */
+
     /* Update window. */
     if (TCP_SEQ_LT(pcb->snd_wl1, seqno) ||
        (pcb->snd_wl1 == seqno && TCP_SEQ_LT(pcb->snd_wl2, ackno)) ||
-       (pcb->snd_wl2 == ackno && tcphdr->wnd > pcb->snd_wnd)) {
-      pcb->snd_wnd = tcphdr->wnd;
+       (pcb->snd_wl2 == ackno && (u32_t)SND_WND_SCALE(pcb, tcphdr->wnd) > pcb->snd_wnd)) {
+      pcb->snd_wnd = SND_WND_SCALE(pcb, tcphdr->wnd);
       /* keep track of the biggest window announced by the remote host to calculate
          the maximum segment size */
-      if (pcb->snd_wnd_max < tcphdr->wnd) {
-        pcb->snd_wnd_max = tcphdr->wnd;
+      if (pcb->snd_wnd_max < pcb->snd_wnd) {
+        pcb->snd_wnd_max = pcb->snd_wnd;
       }
       pcb->snd_wl1 = seqno;
       pcb->snd_wl2 = ackno;
@@ -921,10 +997,10 @@ tcp_receive(struct tcp_pcb *pcb)
         /* stop persist timer */
           pcb->persist_backoff = 0;
       }
-      LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"U16_F"\n", pcb->snd_wnd));
+      LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"TCPWNDSIZE_F"\n", pcb->snd_wnd));
 #if TCP_WND_DEBUG
     } else {
-      if (pcb->snd_wnd != tcphdr->wnd) {
+      if (pcb->snd_wnd != (tcpwnd_size_t)SND_WND_SCALE(pcb, tcphdr->wnd)) {
         LWIP_DEBUGF(TCP_WND_DEBUG, 
                     ("tcp_receive: no window update lastack %"U32_F" ackno %"
                      U32_F" wl1 %"U32_F" seqno %"U32_F" wl2 %"U32_F"\n",
@@ -971,13 +1047,19 @@ tcp_receive(struct tcp_pcb *pcb)
               if (pcb->dupacks > 3) {
                 /* Inflate the congestion window, but not if it means that
                    the value overflows. */
-                if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+                if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
                   pcb->cwnd += pcb->mss;
                 }
               } else if (pcb->dupacks == 3) {
                 /* Do fast retransmit */
                 tcp_rexmit_fast(pcb);
               }
+#if LWIP_TCP_SACK
+              if ((pcb->flags & TF_SACK) && (pcb->flags & TF_INFR)) {
+                /* New SACK blocks may have revealed more losses */
+                tcp_rexmit_sack(pcb, 0);
+              }
+#endif /* LWIP_TCP_SACK */
             }
           }
         }
@@ -994,8 +1076,26 @@ tcp_receive(struct tcp_pcb *pcb)
          in fast retransmit. Also reset the congestion window to the
          slow start threshold. */
       if (pcb->flags & TF_INFR) {
-        pcb->flags &= ~TF_INFR;
-        pcb->cwnd = pcb->ssthresh;
+#if LWIP_TCP_SACK
+        if ((pcb->flags & TF_SACK) && TCP_SEQ_LT(ackno, pcb->sack_recover)) {
+          /* A partial ACK: more of what was sent before the loss is
+             missing, so stay in fast recovery. */
+          partial_ack = 1;
+        } else
+#endif /* LWIP_TCP_SACK */
+        {
+          pcb->flags &= ~TF_INFR;
+          pcb->cwnd = pcb->ssthresh;
+#if LWIP_TCP_SACK
+          /* Segments may be retransmitted again in the next recovery. */
+          for (next = pcb->unacked; next != NULL; next = next->next) {
+            next->flags &= ~TF_SEG_SACK_REXMIT;
+          }
+          for (next = pcb->unsent; next != NULL; next = next->next) {
+            next->flags &= ~TF_SEG_SACK_REXMIT;
+          }
+#endif /* LWIP_TCP_SACK */
+        }
       }
 
       /* Reset the number of retransmissions. */
@@ -1004,8 +1104,9 @@ tcp_receive(struct tcp_pcb *pcb)
       /* Reset the retransmission time-out. */
       pcb->rto = (pcb->sa >> 3) + pcb->sv;
 
-      /* Update the send buffer space. Diff between the two can never exceed 64K? */
-      pcb->acked = (u16_t)(ackno - pcb->lastack);
+      /* Update the send buffer space. Diff between the two can never exceed 64K
+         unless window scaling is used. */
+      pcb->acked = (tcpwnd_size_t)(ackno - pcb->lastack);
 
       pcb->snd_buf += pcb->acked;
 
@@ -1015,18 +1116,27 @@ tcp_receive(struct tcp_pcb *pcb)
 
       /* Update the congestion control variables (cwnd and
          ssthresh). */
+#if LWIP_TCP_SACK
+      if (partial_ack) {
+        /* Deflate the congestion window by the amount of new data
+           acknowledged and add back one segment (RFC 6582). */
+        pcb->cwnd = (pcb->cwnd > pcb->acked) ? pcb->cwnd - pcb->acked : 0;
+        pcb->cwnd += pcb->mss;
+        LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: partial ACK cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
+      } else
+#endif /* LWIP_TCP_SACK */
       if (pcb->state >= ESTABLISHED) {
         if (pcb->cwnd < pcb->ssthresh) {
-          if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+          if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
             pcb->cwnd += pcb->mss;
           }
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"U16_F"\n", pcb->cwnd));
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
         } else {
-          u16_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
+          tcpwnd_size_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
           if (new_cwnd > pcb->cwnd) {
             pcb->cwnd = new_cwnd;
           }
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"U16_F"\n", pcb->cwnd));
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
         }
       }
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: ACK for %"U32_F", unacked->seqno %"U32_F":%"U32_F"\n",
@@ -1073,6 +1183,13 @@ tcp_receive(struct tcp_pcb *pcb)
       else
         pcb->rtime = 0;
 
+#if LWIP_TCP_SACK
+      if (partial_ack) {
+        /* The segment now first in line was lost as well. */
+        tcp_rexmit_sack(pcb, 1);
+      }
+#endif /* LWIP_TCP_SACK */
+
       pcb->polltmr = 0;
 
 #if LWIP_IPV6 && LWIP_ND6_TCP_REACHABILITY_HINTS
@@ -1258,6 +1375,9 @@ tcp_receive(struct tcp_pcb *pcb)
            we have to trim the end of the segment and update rcv_nxt
            and pass the data to the application. */
         tcplen = TCP_TCPLEN(&inseg);
+#if TCP_QUEUE_OOSEQ
+        fills_gap = (pcb->ooseq != NULL);
+#endif /* TCP_QUEUE_OOSEQ */
 
         if (tcplen > pcb->rcv_wnd) {
           LWIP_DEBUGF(TCP_INPUT_DEBUG, 
@@ -1401,8 +1521,17 @@ tcp_receive(struct tcp_pcb *pcb)
 #endif /* TCP_QUEUE_OOSEQ */
 
 
-        /* Acknowledge the segment(s). */
-        tcp_ack(pcb);
+        /* Acknowledge the segment(s). A segment which fills a gap in
+           the sequence space is acknowledged immediately (RFC 5681), so
+           that the sender learns about it without delay. */
+#if TCP_QUEUE_OOSEQ
+        if (fills_gap) {
+          tcp_ack_now(pcb);
+        } else
+#endif /* TCP_QUEUE_OOSEQ */
+        {
+          tcp_ack(pcb);
+        }
 
 #if LWIP_IPV6 && LWIP_ND6_TCP_REACHABILITY_HINTS
         if (PCB_ISIPV6(pcb)) {
@@ -1413,7 +1542,9 @@ tcp_receive(struct tcp_pcb *pcb)
 
       } else {
         /* We get here if the incoming segment is out-of-sequence. */
-        tcp_send_empty_ack(pcb);
+#if LWIP_TCP_SACK
+        pcb->rcv_sack_last = seqno;
+#endif /* LWIP_TCP_SACK */
 #if TCP_QUEUE_OOSEQ
         /* We queue the segment on the ->ooseq queue. */
         if (pcb->ooseq == NULL) {
@@ -1561,6 +1692,9 @@ tcp_receive(struct tcp_pcb *pcb)
         }
 #endif /* TCP_OOSEQ_MAX_BYTES || TCP_OOSEQ_MAX_PBUFS */
 #endif /* TCP_QUEUE_OOSEQ */
+        /* Send the duplicate ACK now that the segment is queued, so that
+           SACK blocks cover it. */
+        tcp_send_empty_ack(pcb);
       }
     } else {
       /* The incoming segment is not withing the window. */
@@ -1594,6 +1728,11 @@ tcp_parseopt(struct tcp_pcb *pcb)
 #if LWIP_TCP_TIMESTAMPS
   u32_t tsval;
 #endif
+#if LWIP_TCP_SACK
+  u16_t i;
+
+  num_sack_blocks = 0;
+#endif
 
   opts = (u8_t *)tcphdr + TCP_HLEN;
 
@@ -1626,6 +1765,64 @@ tcp_parseopt(struct tcp_pcb *pcb)
         /* Advance to next option */
         c += 0x04;
         break;
+#if LWIP_WND_SCALE
+      case 0x03:
+        LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: WND_SCALE\n"));
+        if (opts[c + 1] != 0x03 || (c + 0x03) > max_c) {
+          /* Bad length */
+          LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: bad length\n"));
+          return;
+        }
+        /* If syn was received with wnd scale option, activate wnd scale opt,
+           but only if this is not a retransmission */
+        if ((flags & TCP_SYN) && !(pcb->flags & TF_WND_SCALE)) {
+          pcb->snd_scale = opts[c + 2];
+          if (pcb->snd_scale > 14U) {
+            pcb->snd_scale = 14U;
+          }
+          pcb->rcv_scale = TCP_RCV_SCALE;
+          pcb->flags |= TF_WND_SCALE;
+          /* window scaling is enabled, we can use the full receive window */
+          LWIP_ASSERT("window not at default value", pcb->rcv_wnd == TCPWND16(TCP_WND));
+          LWIP_ASSERT("window not at default value", pcb->rcv_ann_wnd == TCPWND16(TCP_WND));
+          pcb->rcv_wnd = pcb->rcv_ann_wnd = TCP_WND;
+        }
+        /* Advance to next option */
+        c += 0x03;
+        break;
+#endif
+#if LWIP_TCP_SACK
+      case 0x04:
+        LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: SACK_PERM\n"));
+        if (opts[c + 1] != 0x02 || c + 0x02 > max_c) {
+          /* Bad length */
+          LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: bad length\n"));
+          return;
+        }
+        if (flags & TCP_SYN) {
+          pcb->flags |= TF_SACK;
+        }
+        /* Advance to next option */
+        c += 0x02;
+        break;
+      case 0x05:
+        LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: SACK\n"));
+        if (opts[c + 1] < 0x0A || ((opts[c + 1] - 2) & 0x07) != 0 || c + opts[c + 1] > max_c) {
+          /* Bad length */
+          LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: bad length\n"));
+          return;
+        }
+        for (i = c + 2; i < c + opts[c + 1] && num_sack_blocks < TCP_SACK_MAX_BLOCKS; i += 8) {
+          sack_blocks[2 * num_sack_blocks] = ((u32_t)opts[i] << 24) | ((u32_t)opts[i + 1] << 16) |
+            ((u32_t)opts[i + 2] << 8) | opts[i + 3];
+          sack_blocks[2 * num_sack_blocks + 1] = ((u32_t)opts[i + 4] << 24) | ((u32_t)opts[i + 5] << 16) |
+            ((u32_t)opts[i + 6] << 8) | opts[i + 7];
+          num_sack_blocks++;
+        }
+        /* Advance to next option */
+        c += opts[c + 1];
+        break;
+#endif
 #if LWIP_TCP_TIMESTAMPS
       case 0x08:
         LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_parseopt: TS\n"));
@@ -1663,4 +1860,44 @@ tcp_parseopt(struct tcp_pcb *pcb)
   }
 }
 
+#if LWIP_TCP_SACK
+/**
+ * Marks the unacked segments covered by the SACK blocks of the incoming
+ * segment (see tcp_parseopt()).
+ *
+ * Called from tcp_receive().
+ *
+ * @param pcb the tcp_pcb for which a segment arrived
+ */
+static void
+tcp_sack_update(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg;
+  u32_t left, right, seg_seqno;
+  u8_t i;
+
+  for (i = 0; i < num_sack_blocks; i++) {
+    left = sack_blocks[2 * i];
+    right = sack_blocks[2 * i + 1];
+
+    /* Ignore malformed blocks, blocks reporting duplicates below the
+       cumulative ACK (RFC 2883) and blocks beyond what we have sent. */
+    if (!TCP_SEQ_LT(left, right) || TCP_SEQ_LEQ(right, ackno) ||
+        TCP_SEQ_GT(right, pcb->snd_nxt)) {
+      continue;
+    }
+
+    for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+      seg_seqno = ntohl(seg->tcphdr->seqno);
+      if (TCP_SEQ_GEQ(seg_seqno, right)) {
+        break;
+      }
+      if (TCP_SEQ_LEQ(left, seg_seqno) && TCP_SEQ_LEQ(seg_seqno + TCP_TCPLEN(seg), right)) {
+        seg->flags |= TF_SEG_SACKED;
+      }
+    }
+  }
+}
+#endif /* LWIP_TCP_SACK */
+
 #endif /* LWIP_TCP */
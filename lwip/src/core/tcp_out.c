@@ -108,7 +108,7 @@ tcp_output_alloc_header(struct tcp_pcb *pcb, u16_t optlen, u16_t datalen,
     tcphdr->seqno = seqno_be;
     tcphdr->ackno = htonl(pcb->rcv_nxt);
     TCPH_HDRLEN_FLAGS_SET(tcphdr, (5 + optlen / 4), TCP_ACK);
-    tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+    tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
     tcphdr->chksum = 0;
     tcphdr->urgp = 0;
 
@@ -309,7 +309,7 @@ tcp_write_checks(struct tcp_pcb *pcb, u16_t len)
 
   /* fail on too much data */
   if (len > pcb->snd_buf) {
-    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_write: too much data (len=%"U16_F" > snd_buf=%"U16_F")\n",
+    LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_write: too much data (len=%"U16_F" > snd_buf=%"TCPWNDSIZE_F")\n",
       len, pcb->snd_buf));
     pcb->flags |= TF_NAGLEMEMERR;
     return ERR_MEM;
@@ -373,7 +373,7 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
 #endif /* TCP_CHECKSUM_ON_COPY */
   err_t err;
   /* don't allocate segments bigger than half the maximum window we ever received */
-  u16_t mss_local = LWIP_MIN(pcb->mss, pcb->snd_wnd_max/2);
+  u16_t mss_local = (u16_t)LWIP_MIN(pcb->mss, pcb->snd_wnd_max/2);
 
 #if LWIP_NETIF_TX_SINGLE_PBUF
   /* Always copy to try to create single pbufs for TX */
@@ -745,6 +745,19 @@ tcp_enqueue_flags(struct tcp_pcb *pcb, u8_t flags)
 
   if (flags & TCP_SYN) {
     optflags = TF_SEG_OPTS_MSS;
+#if LWIP_WND_SCALE
+    if ((pcb->state != SYN_RCVD) || (pcb->flags & TF_WND_SCALE)) {
+      /* In a <SYN,ACK> (sent in state SYN_RCVD), the window scale option may only
+         be sent if we received a window scale option from the remote host. */
+      optflags |= TF_SEG_OPTS_WND_SCALE;
+    }
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK
+    if ((pcb->state != SYN_RCVD) || (pcb->flags & TF_SACK)) {
+      /* Likewise for the SACK permitted option. */
+      optflags |= TF_SEG_OPTS_SACK_PERM;
+    }
+#endif /* LWIP_TCP_SACK */
   }
 #if LWIP_TCP_TIMESTAMPS
   if ((pcb->flags & TF_TIMESTAMP)) {
@@ -837,6 +850,59 @@ tcp_build_timestamp_option(struct tcp_pcb *pcb, u32_t *opts)
 }
 #endif
 
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+/**
+ * Collect SACK blocks describing the out-of-sequence data on ->ooseq.
+ * The block containing the last out-of-sequence segment received comes
+ * first and the rest follow in sequence order (RFC 2018, section 4).
+ *
+ * @param pcb Protocol control block for the TCP connection
+ * @param blocks array of 2*max_blocks receiving the left and right edges
+ * @param max_blocks maximum number of blocks to collect
+ * @return number of blocks collected
+ */
+static u8_t
+tcp_collect_sack_blocks(struct tcp_pcb *pcb, u32_t *blocks, u8_t max_blocks)
+{
+  struct tcp_seg *seg = pcb->ooseq;
+  u8_t num = 1;
+  u8_t have_last = 0;
+  u8_t i;
+
+  /* blocks[0..1] is reserved for the block of the last segment */
+  while (seg != NULL && (!have_last || num < max_blocks)) {
+    u32_t left = seg->tcphdr->seqno;
+    u32_t right = left + TCP_TCPLEN(seg);
+
+    /* merge segments with no gap between them */
+    for (seg = seg->next; seg != NULL && seg->tcphdr->seqno == right; seg = seg->next) {
+      right += TCP_TCPLEN(seg);
+    }
+
+    if (!have_last && TCP_SEQ_BETWEEN(pcb->rcv_sack_last, left, right - 1)) {
+      blocks[0] = left;
+      blocks[1] = right;
+      have_last = 1;
+    } else if (num < max_blocks) {
+      blocks[2 * num] = left;
+      blocks[2 * num + 1] = right;
+      num++;
+    }
+  }
+
+  if (!have_last) {
+    /* the last segment was dropped, give up the reserved block */
+    for (i = 1; i < num; i++) {
+      blocks[2 * (i - 1)] = blocks[2 * i];
+      blocks[2 * (i - 1) + 1] = blocks[2 * i + 1];
+    }
+    num--;
+  }
+
+  return num;
+}
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
+
 /** Send an ACK without data.
  *
  * @param pcb Protocol control block for the TCP connection to send the ACK
@@ -846,24 +912,40 @@ tcp_send_empty_ack(struct tcp_pcb *pcb)
 {
   struct pbuf *p;
   u8_t optlen = 0;
-#if LWIP_TCP_TIMESTAMPS || CHECKSUM_GEN_TCP
+#if LWIP_TCP_TIMESTAMPS || CHECKSUM_GEN_TCP || (LWIP_TCP_SACK && TCP_QUEUE_OOSEQ)
   struct tcp_hdr *tcphdr;
-#endif /* LWIP_TCP_TIMESTAMPS || CHECKSUM_GEN_TCP */
+#endif /* LWIP_TCP_TIMESTAMPS || CHECKSUM_GEN_TCP || (LWIP_TCP_SACK && TCP_QUEUE_OOSEQ) */
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+  u32_t sack_blocks[2 * TCP_SACK_MAX_BLOCKS];
+  u8_t num_sack_blocks = 0;
+  u8_t sack_optlen = 0;
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
 
 #if LWIP_TCP_TIMESTAMPS
   if (pcb->flags & TF_TIMESTAMP) {
     optlen = LWIP_TCP_OPT_LENGTH(TF_SEG_OPTS_TS);
   }
 #endif
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+  if ((pcb->flags & TF_SACK) && pcb->ooseq != NULL) {
+    /* with the timestamp option, only three blocks fit */
+    num_sack_blocks = tcp_collect_sack_blocks(pcb, sack_blocks,
+      (optlen > 0) ? TCP_SACK_MAX_BLOCKS - 1 : TCP_SACK_MAX_BLOCKS);
+    if (num_sack_blocks > 0) {
+      sack_optlen = 4 + 8 * num_sack_blocks;
+      optlen += sack_optlen;
+    }
+  }
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
 
   p = tcp_output_alloc_header(pcb, optlen, 0, htonl(pcb->snd_nxt));
   if (p == NULL) {
     LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_output: (ACK) could not allocate pbuf\n"));
     return ERR_BUF;
   }
-#if LWIP_TCP_TIMESTAMPS || CHECKSUM_GEN_TCP
+#if LWIP_TCP_TIMESTAMPS || CHECKSUM_GEN_TCP || (LWIP_TCP_SACK && TCP_QUEUE_OOSEQ)
   tcphdr = (struct tcp_hdr *)p->payload;
-#endif /* LWIP_TCP_TIMESTAMPS || CHECKSUM_GEN_TCP */
+#endif /* LWIP_TCP_TIMESTAMPS || CHECKSUM_GEN_TCP || (LWIP_TCP_SACK && TCP_QUEUE_OOSEQ) */
   LWIP_DEBUGF(TCP_OUTPUT_DEBUG, 
               ("tcp_output: sending ACK for %"U32_F"\n", pcb->rcv_nxt));
   /* remove ACK flags from the PCB, as we send an empty ACK now */
@@ -877,6 +959,18 @@ tcp_send_empty_ack(struct tcp_pcb *pcb)
     tcp_build_timestamp_option(pcb, (u32_t *)(tcphdr + 1));
   }
 #endif 
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+  if (sack_optlen > 0) {
+    /* The SACK option goes last: NOP, NOP, SACK, length, blocks */
+    u32_t *opts = (u32_t *)(void *)((u8_t *)(tcphdr + 1) + optlen - sack_optlen);
+    u8_t i;
+    opts[0] = htonl(0x01010500 | (u32_t)(sack_optlen - 2));
+    for (i = 0; i < num_sack_blocks; i++) {
+      opts[1 + 2 * i] = htonl(sack_blocks[2 * i]);
+      opts[2 + 2 * i] = htonl(sack_blocks[2 * i + 1]);
+    }
+  }
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
 
 #if CHECKSUM_GEN_TCP
   tcphdr->chksum = ipX_chksum_pseudo(PCB_ISIPV6(pcb), p, IP_PROTO_TCP, p->tot_len,
@@ -926,6 +1020,14 @@ tcp_output(struct tcp_pcb *pcb)
 
   seg = pcb->unsent;
 
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+  /* Data segments carry no SACK blocks, so while we hold out-of-sequence
+   * data, send the ACK on its own rather than piggybacking it. */
+  if ((pcb->flags & TF_ACK_NOW) && (pcb->flags & TF_SACK) && pcb->ooseq != NULL) {
+    tcp_send_empty_ack(pcb);
+  }
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
+
   /* If the TF_ACK_NOW flag is set and no data will be sent (either
    * because the ->unsent queue is empty or because the window does
    * not allow it), construct an empty ACK segment and send it.
@@ -952,13 +1054,13 @@ tcp_output(struct tcp_pcb *pcb)
 #endif /* TCP_OUTPUT_DEBUG */
 #if TCP_CWND_DEBUG
   if (seg == NULL) {
-    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"U16_F
-                                 ", cwnd %"U16_F", wnd %"U32_F
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"TCPWNDSIZE_F
+                                 ", cwnd %"TCPWNDSIZE_F", wnd %"U32_F
                                  ", seg == NULL, ack %"U32_F"\n",
                                  pcb->snd_wnd, pcb->cwnd, wnd, pcb->lastack));
   } else {
     LWIP_DEBUGF(TCP_CWND_DEBUG, 
-                ("tcp_output: snd_wnd %"U16_F", cwnd %"U16_F", wnd %"U32_F
+                ("tcp_output: snd_wnd %"TCPWNDSIZE_F", cwnd %"TCPWNDSIZE_F", wnd %"U32_F
                  ", effwnd %"U32_F", seq %"U32_F", ack %"U32_F"\n",
                  pcb->snd_wnd, pcb->cwnd, wnd,
                  ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len,
@@ -982,7 +1084,7 @@ tcp_output(struct tcp_pcb *pcb)
       break;
     }
 #if TCP_CWND_DEBUG
-    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"U16_F", cwnd %"U16_F", wnd %"U32_F", effwnd %"U32_F", seq %"U32_F", ack %"U32_F", i %"S16_F"\n",
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %"TCPWNDSIZE_F", cwnd %"TCPWNDSIZE_F", wnd %"U32_F", effwnd %"U32_F", seq %"U32_F", ack %"U32_F", i %"S16_F"\n",
                             pcb->snd_wnd, pcb->cwnd, wnd,
                             ntohl(seg->tcphdr->seqno) + seg->len -
                             pcb->lastack,
@@ -1069,7 +1171,16 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
   seg->tcphdr->ackno = htonl(pcb->rcv_nxt);
 
   /* advertise our receive window size in this TCP segment */
-  seg->tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+#if LWIP_WND_SCALE
+  if (seg->flags & TF_SEG_OPTS_WND_SCALE) {
+    /* The Window field in a SYN segment itself (the only type where we send
+       the window scale option) is never scaled. */
+    seg->tcphdr->wnd = htons(TCPWND16(pcb->rcv_ann_wnd));
+  } else
+#endif /* LWIP_WND_SCALE */
+  {
+    seg->tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
+  }
 
   pcb->rcv_ann_right_edge = pcb->rcv_nxt + pcb->rcv_ann_wnd;
 
@@ -1094,6 +1205,20 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
     opts += 3;
   }
 #endif
+#if LWIP_WND_SCALE
+  if (seg->flags & TF_SEG_OPTS_WND_SCALE) {
+    /* NOP, window scale option, length 3, shift count */
+    *opts = PP_HTONL(0x01030300 | TCP_RCV_SCALE);
+    opts += 1;
+  }
+#endif
+#if LWIP_TCP_SACK
+  if (seg->flags & TF_SEG_OPTS_SACK_PERM) {
+    /* NOP, NOP, SACK permitted option, length 2 */
+    *opts = PP_HTONL(0x01010402);
+    opts += 1;
+  }
+#endif
 
   /* Set retransmission timer running if it is not currently enabled 
      This must be set before checking the route. */
@@ -1224,7 +1349,7 @@ tcp_rst_impl(u32_t seqno, u32_t ackno,
   tcphdr->seqno = htonl(seqno);
   tcphdr->ackno = htonl(ackno);
   TCPH_HDRLEN_FLAGS_SET(tcphdr, TCP_HLEN/4, TCP_RST | TCP_ACK);
-  tcphdr->wnd = PP_HTONS(TCP_WND);
+  tcphdr->wnd = PP_HTONS(TCPWND16(TCP_WND));
   tcphdr->chksum = 0;
   tcphdr->urgp = 0;
 
@@ -1257,6 +1382,17 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
     return;
   }
 
+#if LWIP_TCP_SACK
+  if (pcb->flags & TF_SACK) {
+    /* The receiver may have discarded data it SACKed (RFC 2018, section 8),
+       so forget the SACK information; this also ends fast recovery. */
+    for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+      seg->flags &= ~(TF_SEG_SACKED | TF_SEG_SACK_REXMIT);
+    }
+    pcb->flags &= ~TF_INFR;
+  }
+#endif /* LWIP_TCP_SACK */
+
   /* Move all unacked segments to the head of the unsent queue */
   for (seg = pcb->unacked; seg->next != NULL; seg = seg->next);
   /* concatenate unsent queue after unacked queue */
@@ -1324,6 +1460,75 @@ tcp_rexmit(struct tcp_pcb *pcb)
      and thus tcp_output directly returns. */
 }
 
+#if LWIP_TCP_SACK
+/**
+ * Requeue the unacked segments which SACK information shows to be lost
+ *
+ * A segment is considered lost when at least TCP_SACK_DUPTHRESH segments
+ * above it have been SACKed (RFC 6675). Each segment is retransmitted at
+ * most once per fast recovery.
+ *
+ * Called by tcp_receive() during fast recovery.
+ *
+ * @param pcb the tcp_pcb for which to retransmit lost segments
+ * @param first if nonzero, the first unacked segment is considered lost too
+ */
+void
+tcp_rexmit_sack(struct tcp_pcb *pcb, int first)
+{
+  struct tcp_seg *seg;
+  struct tcp_seg **prev_seg;
+  struct tcp_seg **cur_seg;
+  u16_t sacked_above = 0;
+  int requeued = 0;
+
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked_above++;
+    }
+  }
+
+  prev_seg = &pcb->unacked;
+  while ((seg = *prev_seg) != NULL) {
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked_above--;
+      prev_seg = &seg->next;
+      continue;
+    }
+    if ((seg->flags & TF_SEG_SACK_REXMIT) ||
+        !((first && prev_seg == &pcb->unacked) || sacked_above >= TCP_SACK_DUPTHRESH)) {
+      prev_seg = &seg->next;
+      continue;
+    }
+
+    /* Move the segment to the unsent queue, keeping it sorted. */
+    *prev_seg = seg->next;
+    cur_seg = &(pcb->unsent);
+    while (*cur_seg &&
+      TCP_SEQ_LT(ntohl((*cur_seg)->tcphdr->seqno), ntohl(seg->tcphdr->seqno))) {
+        cur_seg = &((*cur_seg)->next );
+    }
+    seg->next = *cur_seg;
+    *cur_seg = seg;
+#if TCP_OVERSIZE
+    if (seg->next == NULL) {
+      /* the retransmitted segment is last in unsent, so reset unsent_oversize */
+      pcb->unsent_oversize = 0;
+    }
+#endif /* TCP_OVERSIZE */
+
+    seg->flags |= TF_SEG_SACK_REXMIT;
+    requeued = 1;
+    snmp_inc_tcpretranssegs();
+  }
+
+  if (requeued) {
+    /* Don't take any rtt measurements after retransmitting. */
+    pcb->rttest = 0;
+  }
+}
+#endif /* LWIP_TCP_SACK */
+
 
 /**
  * Handle retransmission after three dupacks received
@@ -1340,7 +1545,18 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
                  "), fast retransmit %"U32_F"\n",
                  (u16_t)pcb->dupacks, pcb->lastack,
                  ntohl(pcb->unacked->tcphdr->seqno)));
-    tcp_rexmit(pcb);
+#if LWIP_TCP_SACK
+    if (pcb->flags & TF_SACK) {
+      /* Retransmit the first unacked segment along with any others the
+         SACK blocks show to be lost, and stay in fast recovery until
+         everything sent so far is acknowledged. */
+      pcb->sack_recover = pcb->snd_nxt;
+      tcp_rexmit_sack(pcb, 1);
+    } else
+#endif /* LWIP_TCP_SACK */
+    {
+      tcp_rexmit(pcb);
+    }
 
     /* Set ssthresh to half of the minimum of the current
      * cwnd and the advertised window */
@@ -1353,7 +1569,7 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
     /* The minimum value for ssthresh should be 2 MSS */
     if (pcb->ssthresh < 2*pcb->mss) {
       LWIP_DEBUGF(TCP_FR_DEBUG, 
-                  ("tcp_receive: The minimum value for ssthresh %"U16_F
+                  ("tcp_receive: The minimum value for ssthresh %"TCPWNDSIZE_F
                    " should be min 2 mss %"U16_F"...\n",
                    pcb->ssthresh, 2*pcb->mss));
       pcb->ssthresh = 2*pcb->mss;
@@ -1377,9 +1593,9 @@ void
 tcp_keepalive(struct tcp_pcb *pcb)
 {
   struct pbuf *p;
-#if CHECKSUM_GEN_TCP
+#if CHECKSUM_GEN_TCP
   struct tcp_hdr *tcphdr;
-#endif /* CHECKSUM_GEN_TCP */
+#endif /* CHECKSUM_GEN_TCP */
 
   LWIP_DEBUGF(TCP_DEBUG, ("tcp_keepalive: sending KEEPALIVE probe to "));
   ipX_addr_debug_print(PCB_ISIPV6(pcb), TCP_DEBUG, &pcb->remote_ip);
@@ -1394,12 +1610,12 @@ tcp_keepalive(struct tcp_pcb *pcb)
                 ("tcp_keepalive: could not allocate memory for pbuf\n"));
     return;
   }
-#if CHECKSUM_GEN_TCP
+#if CHECKSUM_GEN_TCP
   tcphdr = (struct tcp_hdr *)p->payload;
 
   tcphdr->chksum = ipX_chksum_pseudo(PCB_ISIPV6(pcb), p, IP_PROTO_TCP, p->tot_len,
       &pcb->local_ip, &pcb->remote_ip);
-#endif /* CHECKSUM_GEN_TCP */
+#endif /* CHECKSUM_GEN_TCP */
   TCP_STATS_INC(tcp.xmit);
 
   /* Send output to IP */
@@ -542,5 +542,8 @@ sys_timeouts_mbox_fetch(sys_mbox_t *mbox, void **msg)
 void
 tcp_timer_needed(void)
 {
+#ifdef LWIP_TCP_TIMER_NEEDED_HOOK
+  LWIP_TCP_TIMER_NEEDED_HOOK();
+#endif
 }
 #endif /* LWIP_TIMERS */
@@ -84,8 +84,15 @@ extern const u16_t memp_sizes[MEMP_MAX];
 #include "mem.h"
 
 #define memp_init()
+#if LWIP_CUSTOM_MEMP
+void *lwip_custom_memp_malloc(memp_t type);
+void  lwip_custom_memp_free(memp_t type, void *mem);
+#define memp_malloc(type)     lwip_custom_memp_malloc(type)
+#define memp_free(type, mem)  lwip_custom_memp_free((type), (mem))
+#else /* LWIP_CUSTOM_MEMP */
 #define memp_malloc(type)     mem_malloc(memp_sizes[type])
 #define memp_free(type, mem)  mem_free(mem)
+#endif /* LWIP_CUSTOM_MEMP */
 
 #else /* MEMP_MEM_MALLOC */
 
@@ -923,6 +923,19 @@
 #define TCP_WND                         (4 * TCP_MSS)
 #endif 
 
+/**
+ * LWIP_WND_SCALE and TCP_RCV_SCALE:
+ * Set LWIP_WND_SCALE to 1 to enable window scaling (RFC 1323).
+ * Set TCP_RCV_SCALE to the desired scaling factor (shift count in the
+ * range of [0..14]). TCP_WND may then be up to (0xffff << TCP_RCV_SCALE).
+ * When LWIP_WND_SCALE is enabled but TCP_RCV_SCALE is 0, we can use a large
+ * send window while having a small receive window only.
+ */
+#ifndef LWIP_WND_SCALE
+#define LWIP_WND_SCALE                  0
+#define TCP_RCV_SCALE                   0
+#endif
+
 /**
  * TCP_MAXRTX: Maximum number of retransmissions of data segments.
  */
@@ -1035,6 +1048,16 @@
 #define TCP_DEFAULT_LISTEN_BACKLOG      0xff
 #endif
 
+/**
+ * TCP_PCB_HASH_SIZE: Number of buckets of the hash tables used to find the
+ * active or TIME-WAIT PCB an incoming segment belongs to. Must be zero or a
+ * power of two. With 0, tcp_input() walks the PCB lists instead, which costs
+ * time linear in the number of connections for every segment.
+ */
+#ifndef TCP_PCB_HASH_SIZE
+#define TCP_PCB_HASH_SIZE               0
+#endif
+
 /**
  * TCP_OVERSIZE: The maximum number of bytes that tcp_write may
  * allocate ahead of time in an attempt to create shorter pbuf chains
@@ -1060,6 +1083,16 @@
 #define LWIP_TCP_TIMESTAMPS             0
 #endif
 
+/**
+ * LWIP_TCP_SACK==1: support TCP selective acknowledgments (RFC 2018).
+ * Out-of-sequence data is reported to the remote host in SACK blocks, and
+ * SACK blocks received during fast recovery are used to retransmit all
+ * segments known to be lost instead of only the first unacknowledged one.
+ */
+#ifndef LWIP_TCP_SACK
+#define LWIP_TCP_SACK                   0
+#endif
+
 /**
  * TCP_WND_UPDATE_THRESHOLD: difference in window to trigger an
  * explicit window update
@@ -1885,6 +1918,16 @@
 #define CHECKSUM_CHECK_TCP              1
 #endif
 
+/**
+ * CHECKSUM_CHECK_TCP_ENABLED: Expression evaluated for every incoming TCP
+ * segment when CHECKSUM_CHECK_TCP==1; the checksum is only verified if it is
+ * nonzero. Lets the check be switched off at runtime, e.g. for packets which
+ * come from a local stack that is known to checksum correctly.
+ */
+#ifndef CHECKSUM_CHECK_TCP_ENABLED
+#define CHECKSUM_CHECK_TCP_ENABLED      1
+#endif
+
 /**
  * LWIP_CHECKSUM_ON_COPY==1: Calculate checksum when copying data from
  * application buffers to pbufs.
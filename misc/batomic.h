@@ -0,0 +1,213 @@
+/**
+ * @file batomic.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Atomic operations on integers and pointers, for GCC-compatible compilers
+ * and MSVC.
+ * 
+ * Functions without a suffix are sequentially consistent. The _relaxed
+ * functions only guarantee that the access itself is atomic.
+ */
+
+#ifndef BADVPN_BATOMIC_H
+#define BADVPN_BATOMIC_H
+
+#include <stdint.h>
+
+#ifdef _MSC_VER
+
+#include <intrin.h>
+
+// interlocked operations are full barriers
+static long batomic__fence_dummy;
+
+static void batomic_fence (void)
+{
+    _InterlockedExchange(&batomic__fence_dummy, 0);
+}
+
+static int batomic_load_int (int *p)
+{
+    return _InterlockedCompareExchange((long volatile *)p, 0, 0);
+}
+
+static void batomic_store_int (int *p, int v)
+{
+    _InterlockedExchange((long volatile *)p, v);
+}
+
+static int batomic_load_int_relaxed (int *p)
+{
+    return *(int volatile *)p;
+}
+
+static void batomic_store_int_relaxed (int *p, int v)
+{
+    *(int volatile *)p = v;
+}
+
+static uint32_t batomic_load_uint32_relaxed (uint32_t *p)
+{
+    return *(uint32_t volatile *)p;
+}
+
+static void batomic_store_uint32_relaxed (uint32_t *p, uint32_t v)
+{
+    *(uint32_t volatile *)p = v;
+}
+
+static int batomic_cas_uint64 (uint64_t *p, uint64_t *expected, uint64_t desired)
+{
+    uint64_t old = (uint64_t)_InterlockedCompareExchange64((__int64 volatile *)p, (__int64)desired, (__int64)*expected);
+    if (old != *expected) {
+        *expected = old;
+        return 0;
+    }
+    return 1;
+}
+
+static uint64_t batomic_load_uint64_relaxed (uint64_t *p)
+{
+#ifdef _WIN64
+    return *(uint64_t volatile *)p;
+#else
+    return (uint64_t)_InterlockedCompareExchange64((__int64 volatile *)p, 0, 0);
+#endif
+}
+
+static void batomic_store_uint64_relaxed (uint64_t *p, uint64_t v)
+{
+#ifdef _WIN64
+    *(uint64_t volatile *)p = v;
+#else
+    uint64_t old = batomic_load_uint64_relaxed(p);
+    while (!batomic_cas_uint64(p, &old, v));
+#endif
+}
+
+static uint64_t batomic_add_uint64 (uint64_t *p, uint64_t v)
+{
+    uint64_t old = batomic_load_uint64_relaxed(p);
+    while (!batomic_cas_uint64(p, &old, old + v));
+    return old + v;
+}
+
+static void * batomic_load_ptr (void **p)
+{
+#ifdef _WIN64
+    return (void *)_InterlockedCompareExchange64((__int64 volatile *)p, 0, 0);
+#else
+    return (void *)_InterlockedCompareExchange((long volatile *)p, 0, 0);
+#endif
+}
+
+static int batomic_cas_ptr (void **p, void **expected, void *desired)
+{
+#ifdef _WIN64
+    void *old = (void *)_InterlockedCompareExchange64((__int64 volatile *)p, (__int64)desired, (__int64)*expected);
+#else
+    void *old = (void *)_InterlockedCompareExchange((long volatile *)p, (long)desired, (long)*expected);
+#endif
+    if (old != *expected) {
+        *expected = old;
+        return 0;
+    }
+    return 1;
+}
+
+#else
+
+static void batomic_fence (void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static int batomic_load_int (int *p)
+{
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static void batomic_store_int (int *p, int v)
+{
+    __atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+static int batomic_load_int_relaxed (int *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void batomic_store_int_relaxed (int *p, int v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+static uint32_t batomic_load_uint32_relaxed (uint32_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void batomic_store_uint32_relaxed (uint32_t *p, uint32_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+static int batomic_cas_uint64 (uint64_t *p, uint64_t *expected, uint64_t desired)
+{
+    return __atomic_compare_exchange_n(p, expected, desired, 1, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static uint64_t batomic_load_uint64_relaxed (uint64_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void batomic_store_uint64_relaxed (uint64_t *p, uint64_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+static uint64_t batomic_add_uint64 (uint64_t *p, uint64_t v)
+{
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+static void * batomic_load_ptr (void **p)
+{
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static int batomic_cas_ptr (void **p, void **expected, void *desired)
+{
+    return __atomic_compare_exchange_n(p, expected, desired, 1, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+/**
+ * @file bclz.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Counting leading zero bits, for GCC-compatible compilers and MSVC.
+ */
+
+#ifndef BADVPN_BCLZ_H
+#define BADVPN_BCLZ_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/**
+ * Returns the number of leading zero bits of a nonzero 64-bit value.
+ */
+static int bclz64 (uint64_t x)
+{
+    ASSERT(x != 0)
+    
+#ifdef _MSC_VER
+    unsigned long index;
+#ifdef _WIN64
+    _BitScanReverse64(&index, x);
+    return 63 - (int)index;
+#else
+    if (_BitScanReverse(&index, (unsigned long)(x >> 32))) {
+        return 31 - (int)index;
+    }
+    _BitScanReverse(&index, (unsigned long)x);
+    return 63 - (int)index;
+#endif
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+#endif
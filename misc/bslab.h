@@ -0,0 +1,228 @@
+/**
+ * @file bslab.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Slab allocator for objects of one fixed size.
+ */
+
+#ifndef BADVPN_MISC_BSLAB_H
+#define BADVPN_MISC_BSLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/debugcounter.h>
+#include <misc/balloc.h>
+#include <misc/maxalign.h>
+#include <misc/offset.h>
+#include <structure/LinkedList1.h>
+
+struct BSlab_chunk {
+    LinkedList1Node list_node;
+    void *free_list;
+    size_t num_used;
+    size_t num_carved;
+};
+
+/**
+ * Slab allocator for objects of one fixed size.
+ * 
+ * Objects are carved out of chunks holding a fixed number of objects each,
+ * and released objects are kept on their chunk's free list, so allocating
+ * and releasing usually doesn't go to malloc at all. The chunk with free
+ * objects which was most recently used is preferred, keeping the hot objects
+ * close together. A chunk whose objects were all released is kept for reuse
+ * if there is no other such chunk, and otherwise freed, so memory from a
+ * burst of allocations goes back to the system.
+ * 
+ * Like most objects, a slab must only be used from one thread. Each object
+ * carries one pointer-sized header pointing to its chunk.
+ */
+typedef struct {
+    size_t obj_size;
+    size_t chunk_objs;
+    LinkedList1 partial_chunks;
+    struct BSlab_chunk *empty_chunk;
+    DebugCounter d_ctr;
+} BSlab;
+
+/**
+ * Initializes the slab. Does not allocate anything.
+ * 
+ * @param o the object
+ * @param obj_size size of objects. Must be >0.
+ * @param chunk_objs number of objects allocated together. Must be >0.
+ * @return 1 on success, 0 if the sizes are too large
+ */
+static int BSlab_Init (BSlab *o, size_t obj_size, size_t chunk_objs) WARN_UNUSED;
+
+/**
+ * Frees the slab.
+ * All objects must have been released.
+ * 
+ * @param o the object
+ */
+static void BSlab_Free (BSlab *o);
+
+/**
+ * Allocates an object.
+ * The memory is aligned to {@link BMAX_ALIGN}.
+ * 
+ * @param o the object
+ * @return pointer to the object, or NULL on failure
+ */
+static void * BSlab_Alloc (BSlab *o);
+
+/**
+ * Releases an object.
+ * 
+ * @param o the object
+ * @param obj object obtained from {@link BSlab_Alloc} of this slab.
+ *            May be NULL; in this case, this function does nothing.
+ */
+static void BSlab_Release (BSlab *o, void *obj);
+
+#define BSLAB_HEADER_SIZE (((sizeof(struct BSlab_chunk *) + BMAX_ALIGN - 1) / BMAX_ALIGN) * BMAX_ALIGN)
+#define BSLAB_CHUNK_HEADER_SIZE (((sizeof(struct BSlab_chunk) + BMAX_ALIGN - 1) / BMAX_ALIGN) * BMAX_ALIGN)
+
+int BSlab_Init (BSlab *o, size_t obj_size, size_t chunk_objs)
+{
+    ASSERT(obj_size > 0)
+    ASSERT(chunk_objs > 0)
+    
+    // add the header pointing to the chunk, and keep objects aligned
+    size_t size = obj_size;
+    if (!BSizeAdd(&size, BSLAB_HEADER_SIZE) || !BSizeAlign(&size, BMAX_ALIGN)) {
+        return 0;
+    }
+    
+    // make sure a whole chunk fits in a size_t
+    if (chunk_objs > (SIZE_MAX - BSLAB_CHUNK_HEADER_SIZE) / size) {
+        return 0;
+    }
+    
+    o->obj_size = size;
+    o->chunk_objs = chunk_objs;
+    LinkedList1_Init(&o->partial_chunks);
+    o->empty_chunk = NULL;
+    
+    DebugCounter_Init(&o->d_ctr);
+    return 1;
+}
+
+void BSlab_Free (BSlab *o)
+{
+    DebugCounter_Free(&o->d_ctr);
+    ASSERT(LinkedList1_IsEmpty(&o->partial_chunks))
+    
+    BFree(o->empty_chunk);
+}
+
+void * BSlab_Alloc (BSlab *o)
+{
+    struct BSlab_chunk *chunk;
+    
+    LinkedList1Node *node = LinkedList1_GetFirst(&o->partial_chunks);
+    if (node) {
+        chunk = UPPER_OBJECT(node, struct BSlab_chunk, list_node);
+    } else {
+        if (o->empty_chunk) {
+            chunk = o->empty_chunk;
+            o->empty_chunk = NULL;
+        } else {
+            chunk = (struct BSlab_chunk *)BAlloc(BSLAB_CHUNK_HEADER_SIZE + o->chunk_objs * o->obj_size);
+            if (!chunk) {
+                return NULL;
+            }
+            chunk->free_list = NULL;
+            chunk->num_used = 0;
+            chunk->num_carved = 0;
+        }
+        LinkedList1_Prepend(&o->partial_chunks, &chunk->list_node);
+    }
+    
+    ASSERT(chunk->num_used < o->chunk_objs)
+    
+    char *mem;
+    if (chunk->free_list) {
+        mem = (char *)chunk->free_list - BSLAB_HEADER_SIZE;
+        chunk->free_list = *(void **)chunk->free_list;
+    } else {
+        // objects are only carved when first needed, so a
+        // new chunk isn't touched all at once
+        ASSERT(chunk->num_carved < o->chunk_objs)
+        mem = (char *)chunk + BSLAB_CHUNK_HEADER_SIZE + chunk->num_carved * o->obj_size;
+        *(struct BSlab_chunk **)mem = chunk;
+        chunk->num_carved++;
+    }
+    
+    chunk->num_used++;
+    if (chunk->num_used == o->chunk_objs) {
+        LinkedList1_Remove(&o->partial_chunks, &chunk->list_node);
+    }
+    
+    DebugCounter_Increment(&o->d_ctr);
+    return mem + BSLAB_HEADER_SIZE;
+}
+
+void BSlab_Release (BSlab *o, void *obj)
+{
+    if (!obj) {
+        return;
+    }
+    
+    struct BSlab_chunk *chunk = *(struct BSlab_chunk **)((char *)obj - BSLAB_HEADER_SIZE);
+    ASSERT(chunk->num_used > 0)
+    
+    int was_full = (chunk->num_used == o->chunk_objs);
+    
+    *(void **)obj = chunk->free_list;
+    chunk->free_list = obj;
+    chunk->num_used--;
+    
+    if (chunk->num_used == 0) {
+        if (!was_full) {
+            LinkedList1_Remove(&o->partial_chunks, &chunk->list_node);
+        }
+        if (!o->empty_chunk) {
+            o->empty_chunk = chunk;
+        } else {
+            BFree(chunk);
+        }
+    }
+    else if (was_full) {
+        LinkedList1_Prepend(&o->partial_chunks, &chunk->list_node);
+    }
+    
+    DebugCounter_Decrement(&o->d_ctr);
+}
+
+#endif
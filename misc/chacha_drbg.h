@@ -0,0 +1,212 @@
+/**
+ * @file chacha_drbg.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Deterministic random bit generator based on the ChaCha20 block function.
+ * 
+ * Output is generated in bulk into a buffer and served from there. Each time
+ * the buffer is refilled, the key is replaced with the first bytes of the new
+ * output, and output is erased once handed out, so earlier output cannot be
+ * recovered from the state. The caller is responsible for seeding from a
+ * source of entropy, and for reseeding when {@link chacha_drbg_needs_reseed}
+ * says so and after a fork.
+ */
+
+#ifndef BADVPN_CHACHA_DRBG_H
+#define BADVPN_CHACHA_DRBG_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/debug.h>
+
+// size of a seed
+#define CHACHA_DRBG_SEED_LEN 32
+
+// number of bytes generated between reseeds
+#define CHACHA_DRBG_RESEED_BYTES (UINT64_C(1) << 20)
+
+#define CHACHA_DRBG__BLOCK_LEN 64
+#define CHACHA_DRBG__BUF_BLOCKS 8
+#define CHACHA_DRBG__BUF_LEN (CHACHA_DRBG__BUF_BLOCKS * CHACHA_DRBG__BLOCK_LEN)
+
+struct chacha_drbg {
+    uint32_t key[8];
+    uint64_t counter;
+    uint64_t since_seed;
+    int seeded;
+    int buf_pos;
+    uint8_t buf[CHACHA_DRBG__BUF_LEN];
+};
+
+#define CHACHA_DRBG__ROTL(_x, _n) (((_x) << (_n)) | ((_x) >> (32 - (_n))))
+
+#define CHACHA_DRBG__QR(_a, _b, _c, _d) \
+    _a += _b; _d ^= _a; _d = CHACHA_DRBG__ROTL(_d, 16); \
+    _c += _d; _b ^= _c; _b = CHACHA_DRBG__ROTL(_b, 12); \
+    _a += _b; _d ^= _a; _d = CHACHA_DRBG__ROTL(_d, 8); \
+    _c += _d; _b ^= _c; _b = CHACHA_DRBG__ROTL(_b, 7);
+
+static uint32_t chacha_drbg__load32 (const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void chacha_drbg__store32 (uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void chacha_drbg__block (const uint32_t *key, uint64_t counter, uint8_t *out)
+{
+    uint32_t in[16];
+    in[0] = UINT32_C(0x61707865);
+    in[1] = UINT32_C(0x3320646e);
+    in[2] = UINT32_C(0x79622d32);
+    in[3] = UINT32_C(0x6b206574);
+    for (int i = 0; i < 8; i++) {
+        in[4 + i] = key[i];
+    }
+    in[12] = (uint32_t)counter;
+    in[13] = (uint32_t)(counter >> 32);
+    in[14] = 0;
+    in[15] = 0;
+    
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+    
+    for (int i = 0; i < 10; i++) {
+        CHACHA_DRBG__QR(x[0], x[4], x[8], x[12])
+        CHACHA_DRBG__QR(x[1], x[5], x[9], x[13])
+        CHACHA_DRBG__QR(x[2], x[6], x[10], x[14])
+        CHACHA_DRBG__QR(x[3], x[7], x[11], x[15])
+        CHACHA_DRBG__QR(x[0], x[5], x[10], x[15])
+        CHACHA_DRBG__QR(x[1], x[6], x[11], x[12])
+        CHACHA_DRBG__QR(x[2], x[7], x[8], x[13])
+        CHACHA_DRBG__QR(x[3], x[4], x[9], x[14])
+    }
+    
+    for (int i = 0; i < 16; i++) {
+        chacha_drbg__store32(out + 4 * i, x[i] + in[i]);
+    }
+}
+
+static void chacha_drbg__refill (struct chacha_drbg *d)
+{
+    for (int i = 0; i < CHACHA_DRBG__BUF_BLOCKS; i++) {
+        chacha_drbg__block(d->key, d->counter++, d->buf + i * CHACHA_DRBG__BLOCK_LEN);
+    }
+    
+    // replace the key with the start of the output
+    for (int i = 0; i < 8; i++) {
+        d->key[i] = chacha_drbg__load32(d->buf + 4 * i);
+    }
+    memset(d->buf, 0, sizeof(d->key));
+    d->buf_pos = sizeof(d->key);
+}
+
+/**
+ * Initializes the generator, unseeded.
+ * 
+ * @param d the generator
+ */
+static void chacha_drbg_init (struct chacha_drbg *d)
+{
+    memset(d, 0, sizeof(*d));
+    d->seeded = 0;
+    d->buf_pos = CHACHA_DRBG__BUF_LEN;
+}
+
+/**
+ * Seeds the generator, or reseeds it, mixing the seed into the current state
+ * and discarding buffered output.
+ * 
+ * @param d the generator
+ * @param seed CHACHA_DRBG_SEED_LEN bytes of entropy
+ */
+static void chacha_drbg_seed (struct chacha_drbg *d, const uint8_t *seed)
+{
+    for (int i = 0; i < 8; i++) {
+        d->key[i] ^= chacha_drbg__load32(seed + 4 * i);
+    }
+    
+    d->counter = 0;
+    d->since_seed = 0;
+    d->seeded = 1;
+    
+    chacha_drbg__refill(d);
+}
+
+/**
+ * Returns whether the generator needs to be (re)seeded before generating.
+ * 
+ * @param d the generator
+ * @return 1 if it needs seeding, 0 if not
+ */
+static int chacha_drbg_needs_reseed (struct chacha_drbg *d)
+{
+    return (!d->seeded || d->since_seed >= CHACHA_DRBG_RESEED_BYTES);
+}
+
+/**
+ * Generates random data.
+ * The generator must have been seeded.
+ * 
+ * @param d the generator
+ * @param out output buffer
+ * @param len number of bytes to generate
+ */
+static void chacha_drbg_generate (struct chacha_drbg *d, uint8_t *out, size_t len)
+{
+    ASSERT(d->seeded)
+    
+    d->since_seed += len;
+    
+    while (len > 0) {
+        if (d->buf_pos == CHACHA_DRBG__BUF_LEN) {
+            chacha_drbg__refill(d);
+        }
+        
+        size_t amount = CHACHA_DRBG__BUF_LEN - d->buf_pos;
+        if (amount > len) {
+            amount = len;
+        }
+        
+        memcpy(out, d->buf + d->buf_pos, amount);
+        memset(d->buf + d->buf_pos, 0, amount);
+        d->buf_pos += amount;
+        out += amount;
+        len -= amount;
+    }
+}
+
+#endif
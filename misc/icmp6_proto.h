@@ -0,0 +1,113 @@
+/**
+ * @file icmp6_proto.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Definitions for the ICMPv6 protocol and IPv6 Neighbor Discovery.
+ */
+
+#ifndef BADVPN_MISC_ICMP6_PROTO_H
+#define BADVPN_MISC_ICMP6_PROTO_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <misc/byteorder.h>
+#include <misc/packed.h>
+#include <misc/ipv6_proto.h>
+#include <misc/read_write_int.h>
+
+#define ICMP6_TYPE_NEIGHBOR_SOLICITATION 135
+#define ICMP6_TYPE_NEIGHBOR_ADVERTISEMENT 136
+
+#define ND_OPTION_SOURCE_LINK_ADDRESS 1
+#define ND_OPTION_TARGET_LINK_ADDRESS 2
+
+#define ND_ADVERT_FLAG_ROUTER 0x80000000
+#define ND_ADVERT_FLAG_SOLICITED 0x40000000
+#define ND_ADVERT_FLAG_OVERRIDE 0x20000000
+
+#define ND_HOP_LIMIT 255
+
+B_START_PACKED
+struct icmp6_header {
+    uint8_t type;
+    uint8_t code;
+    uint16_t checksum;
+} B_PACKED;
+B_END_PACKED
+
+B_START_PACKED
+struct nd_neighbor_solicit {
+    uint32_t reserved;
+    uint8_t target[16];
+} B_PACKED;
+B_END_PACKED
+
+B_START_PACKED
+struct nd_neighbor_advert {
+    uint32_t flags;
+    uint8_t target[16];
+} B_PACKED;
+B_END_PACKED
+
+B_START_PACKED
+struct nd_option_link_address {
+    uint8_t type;
+    uint8_t length; // in units of 8 bytes
+    uint8_t mac[6];
+} B_PACKED;
+B_END_PACKED
+
+static uint16_t icmp6_checksum (const uint8_t *data, uint16_t len, const uint8_t *source_addr, const uint8_t *dest_addr)
+{
+    uint32_t t = 0;
+    
+    for (int i = 0; i < 16; i += 2) {
+        t += badvpn_read_be16((const char *)source_addr + i);
+        t += badvpn_read_be16((const char *)dest_addr + i);
+    }
+    
+    t += len;
+    t += IPV6_NEXT_ICMPV6;
+    
+    for (uint16_t i = 0; i + 1 < len; i += 2) {
+        t += badvpn_read_be16((const char *)data + i);
+    }
+    if (len % 2) {
+        t += (uint32_t)data[len - 1] << 8;
+    }
+    
+    while (t >> 16) {
+        t = (t & 0xFFFF) + (t >> 16);
+    }
+    
+    return hton16(~t);
+}
+
+#endif
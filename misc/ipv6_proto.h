@@ -38,7 +38,9 @@
 #include <misc/packed.h>
 
 #define IPV6_NEXT_IGMP 2
+#define IPV6_NEXT_TCP 6
 #define IPV6_NEXT_UDP 17
+#define IPV6_NEXT_ICMPV6 58
 
 B_START_PACKED
 struct ipv6_header {
@@ -0,0 +1,125 @@
+/**
+ * @file latency_histogram.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Log-linear histogram for latency percentiles.
+ * 
+ * Values below 2 * LATENCY_HISTOGRAM_SUB have their own buckets. Above that,
+ * every power of two is split into LATENCY_HISTOGRAM_SUB buckets, so a
+ * percentile is off by less than 1 / LATENCY_HISTOGRAM_SUB of its value.
+ * The histogram itself is an array of LATENCY_HISTOGRAM_BUCKETS counts.
+ */
+
+#ifndef BADVPN_MISC_LATENCY_HISTOGRAM_H
+#define BADVPN_MISC_LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+
+#define LATENCY_HISTOGRAM_SUB_BITS 4
+#define LATENCY_HISTOGRAM_SUB (1 << LATENCY_HISTOGRAM_SUB_BITS)
+#define LATENCY_HISTOGRAM_BUCKETS ((64 - LATENCY_HISTOGRAM_SUB_BITS) * LATENCY_HISTOGRAM_SUB + LATENCY_HISTOGRAM_SUB)
+
+/**
+ * Returns the bucket of a value.
+ */
+static int latency_histogram_bucket (uint64_t value)
+{
+    if (value < 2 * LATENCY_HISTOGRAM_SUB) {
+        return value;
+    }
+    
+    int exp = 63 - __builtin_clzll(value);
+    int sub = (value >> (exp - LATENCY_HISTOGRAM_SUB_BITS)) & (LATENCY_HISTOGRAM_SUB - 1);
+    
+    return (exp - LATENCY_HISTOGRAM_SUB_BITS) * LATENCY_HISTOGRAM_SUB + LATENCY_HISTOGRAM_SUB + sub;
+}
+
+/**
+ * Returns the largest value in a bucket.
+ */
+static uint64_t latency_histogram_bucket_max (int bucket)
+{
+    ASSERT(bucket >= 0)
+    ASSERT(bucket < LATENCY_HISTOGRAM_BUCKETS)
+    
+    if (bucket < 2 * LATENCY_HISTOGRAM_SUB) {
+        return bucket;
+    }
+    
+    int exp = (bucket - LATENCY_HISTOGRAM_SUB) / LATENCY_HISTOGRAM_SUB + LATENCY_HISTOGRAM_SUB_BITS;
+    uint64_t sub = (bucket - LATENCY_HISTOGRAM_SUB) % LATENCY_HISTOGRAM_SUB;
+    
+    return ((LATENCY_HISTOGRAM_SUB + sub + 1) << (exp - LATENCY_HISTOGRAM_SUB_BITS)) - 1;
+}
+
+/**
+ * Records a value.
+ */
+static void latency_histogram_add (uint64_t *buckets, uint64_t value)
+{
+    buckets[latency_histogram_bucket(value)]++;
+}
+
+/**
+ * Returns an upper bound of the q-quantile of the recorded values,
+ * or 0 if there are none.
+ * 
+ * @param q quantile in the range [0, 1]
+ */
+static uint64_t latency_histogram_percentile (const uint64_t *buckets, double q)
+{
+    uint64_t count = 0;
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        count += buckets[i];
+    }
+    
+    if (count == 0) {
+        return 0;
+    }
+    
+    // smallest value which at least the fraction q of values are not above
+    uint64_t rank = q * count;
+    if (rank < 1) {
+        rank = 1;
+    }
+    
+    uint64_t cum = 0;
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        cum += buckets[i];
+        if (cum >= rank) {
+            return latency_histogram_bucket_max(i);
+        }
+    }
+    
+    return latency_histogram_bucket_max(LATENCY_HISTOGRAM_BUCKETS - 1);
+}
+
+#endif
@@ -0,0 +1,267 @@
+/**
+ * @file lz4.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Compression and decompression of single blocks in the LZ4 block format.
+ * 
+ * Blocks are independent of each other, so they survive loss and reordering.
+ * The compressor favours speed: it looks for matches through a small hash table,
+ * and takes bigger steps the longer it goes without finding one, so that
+ * incompressible data is passed over quickly.
+ */
+
+#ifndef BADVPN_LZ4_H
+#define BADVPN_LZ4_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/debug.h>
+
+// maximum size of a block to compress
+#define LZ4_MAX_INPUT 65535
+
+#define LZ4__MIN_MATCH 4
+#define LZ4__LAST_LITERALS 5
+#define LZ4__MF_LIMIT 12
+#define LZ4__HASH_LOG 12
+#define LZ4__SKIP_STRENGTH 6
+
+static uint32_t lz4__read32 (const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int lz4__hash (uint32_t v)
+{
+    return (uint32_t)(v * UINT32_C(2654435761)) >> (32 - LZ4__HASH_LOG);
+}
+
+static int lz4__length_bytes (int len)
+{
+    return (len >= 15 ? (len - 15) / 255 + 1 : 0);
+}
+
+static int lz4__write_length (uint8_t *dst, int len)
+{
+    int pos = 0;
+    
+    if (len >= 15) {
+        len -= 15;
+        while (len >= 255) {
+            dst[pos++] = 255;
+            len -= 255;
+        }
+        dst[pos++] = len;
+    }
+    
+    return pos;
+}
+
+/**
+ * Compresses a block.
+ * 
+ * @param src data to compress
+ * @param src_len length of data. Must be >=0 and <=LZ4_MAX_INPUT.
+ * @param dst buffer for the compressed block
+ * @param dst_avail size of buffer. Must be >=0.
+ * @return length of the compressed block, or -1 if it would not fit in dst_avail bytes
+ */
+static int lz4_compress_block (const uint8_t *src, int src_len, uint8_t *dst, int dst_avail)
+{
+    ASSERT(src_len >= 0)
+    ASSERT(src_len <= LZ4_MAX_INPUT)
+    ASSERT(dst_avail >= 0)
+    
+    uint16_t table[1 << LZ4__HASH_LOG];
+    memset(table, 0, sizeof(table));
+    
+    int ip = 0;
+    int anchor = 0;
+    int op = 0;
+    
+    // the last match must start this far from the end, and end before the last literals
+    int mf_limit = src_len - LZ4__MF_LIMIT;
+    int match_limit = src_len - LZ4__LAST_LITERALS;
+    
+    while (1) {
+        // look for a match, stepping further the longer none is found
+        int match;
+        int searches = 1 << LZ4__SKIP_STRENGTH;
+        while (1) {
+            if (ip > mf_limit) {
+                goto last_literals;
+            }
+            uint32_t seq = lz4__read32(src + ip);
+            int h = lz4__hash(seq);
+            match = table[h];
+            table[h] = ip;
+            if (match < ip && lz4__read32(src + match) == seq) {
+                break;
+            }
+            ip += searches++ >> LZ4__SKIP_STRENGTH;
+        }
+        
+        // extend the match backwards and forwards
+        while (ip > anchor && match > 0 && src[ip - 1] == src[match - 1]) {
+            ip--;
+            match--;
+        }
+        int len = LZ4__MIN_MATCH;
+        while (ip + len < match_limit && src[ip + len] == src[match + len]) {
+            len++;
+        }
+        
+        // check space
+        int lit_len = ip - anchor;
+        int ml = len - LZ4__MIN_MATCH;
+        if (1 + lz4__length_bytes(lit_len) + lit_len + 2 + lz4__length_bytes(ml) > dst_avail - op) {
+            return -1;
+        }
+        
+        // write sequence: token, literals and match
+        dst[op++] = ((lit_len >= 15 ? 15 : lit_len) << 4) | (ml >= 15 ? 15 : ml);
+        op += lz4__write_length(dst + op, lit_len);
+        memcpy(dst + op, src + anchor, lit_len);
+        op += lit_len;
+        dst[op++] = (ip - match) & 0xFF;
+        dst[op++] = (ip - match) >> 8;
+        op += lz4__write_length(dst + op, ml);
+        
+        ip += len;
+        anchor = ip;
+    }
+    
+last_literals:;
+    int lit_len = src_len - anchor;
+    if (1 + lz4__length_bytes(lit_len) + lit_len > dst_avail - op) {
+        return -1;
+    }
+    dst[op++] = (lit_len >= 15 ? 15 : lit_len) << 4;
+    op += lz4__write_length(dst + op, lit_len);
+    memcpy(dst + op, src + anchor, lit_len);
+    op += lit_len;
+    
+    return op;
+}
+
+/**
+ * Decompresses a block.
+ * 
+ * @param src compressed block
+ * @param src_len length of block. Must be >=0.
+ * @param dst buffer for the data
+ * @param dst_avail size of buffer. Must be >=0.
+ * @return length of the data, or -1 if the block is malformed or the data
+ *         would not fit in dst_avail bytes
+ */
+static int lz4_decompress_block (const uint8_t *src, int src_len, uint8_t *dst, int dst_avail)
+{
+    ASSERT(src_len >= 0)
+    ASSERT(dst_avail >= 0)
+    
+    int ip = 0;
+    int op = 0;
+    
+    while (1) {
+        if (ip == src_len) {
+            return -1;
+        }
+        uint8_t token = src[ip++];
+        
+        // read literals length
+        int lit_len = token >> 4;
+        if (lit_len == 15) {
+            uint8_t b;
+            do {
+                if (ip == src_len) {
+                    return -1;
+                }
+                b = src[ip++];
+                lit_len += b;
+                if (lit_len > dst_avail) {
+                    return -1;
+                }
+            } while (b == 255);
+        }
+        
+        // copy literals
+        if (lit_len > src_len - ip || lit_len > dst_avail - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        
+        // the last sequence has only literals
+        if (ip == src_len) {
+            return op;
+        }
+        
+        // read offset
+        if (src_len - ip < 2) {
+            return -1;
+        }
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return -1;
+        }
+        
+        // read match length
+        int len = token & 0xF;
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip == src_len) {
+                    return -1;
+                }
+                b = src[ip++];
+                len += b;
+                if (len > dst_avail) {
+                    return -1;
+                }
+            } while (b == 255);
+        }
+        len += LZ4__MIN_MATCH;
+        
+        // copy match; it may overlap with what it produces
+        if (len > dst_avail - op) {
+            return -1;
+        }
+        for (int i = 0; i < len; i++) {
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += len;
+    }
+}
+
+#endif
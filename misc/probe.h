@@ -0,0 +1,63 @@
+/**
+ * @file probe.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Static tracepoints (USDT) in provider "badvpn".
+ * 
+ * When built with BADVPN_USE_USDT (sys/sdt.h was found), each probe is a
+ * systemtap SDT marker, which is a single nop until a tracer attaches, e.g.:
+ * 
+ *   bpftrace -e 'usdt:./badvpn-tun2socks:badvpn:reactor_wait_end { @[probe] = count(); }'
+ * 
+ * Otherwise the probes expand to nothing and their arguments are not
+ * evaluated. Arguments should be integers or pointers.
+ */
+
+#ifndef BADVPN_MISC_PROBE_H
+#define BADVPN_MISC_PROBE_H
+
+#ifdef BADVPN_USE_USDT
+
+#include <sys/sdt.h>
+
+#define BPROBE(name) DTRACE_PROBE(badvpn, name)
+#define BPROBE1(name, a1) DTRACE_PROBE1(badvpn, name, a1)
+#define BPROBE2(name, a1, a2) DTRACE_PROBE2(badvpn, name, a1, a2)
+#define BPROBE3(name, a1, a2, a3) DTRACE_PROBE3(badvpn, name, a1, a2, a3)
+
+#else
+
+#define BPROBE(name)
+#define BPROBE1(name, a1)
+#define BPROBE2(name, a1, a2)
+#define BPROBE3(name, a1, a2, a3)
+
+#endif
+
+#endif
@@ -101,6 +101,14 @@ struct socks_reply_header {
 } B_PACKED;
 B_END_PACKED
 
+B_START_PACKED
+struct socks_udp_header {
+    uint16_t rsv;
+    uint8_t frag;
+    uint8_t atyp;
+} B_PACKED;
+B_END_PACKED
+
 B_START_PACKED
 struct socks_addr_ipv4 {
     uint32_t addr;
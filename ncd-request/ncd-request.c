@@ -44,33 +44,51 @@
 
 #include <generated/blog_channel_ncd_request.h>
 
+struct request {
+    NCDValMem mem;
+    NCDValRef value;
+    NCDRequestClientRequest creq;
+    int have_creq;
+};
+
 static void client_handler_error (void *user);
 static void client_handler_connected (void *user);
-static void request_handler_sent (void *user);
-static void request_handler_reply (void *user, NCDValMem reply_mem, NCDValRef reply_value);
-static void request_handler_finished (void *user, int is_error);
+static void request_handler_sent (struct request *r);
+static void request_handler_reply (struct request *r, NCDValMem reply_mem, NCDValRef reply_value);
+static void request_handler_finished (struct request *r, int is_error);
 static int write_all (int fd, const uint8_t *data, size_t len);
 static int make_connect_addr (const char *str, struct BConnection_addr *out_addr);
 
 NCDStringIndex string_index;
-NCDValMem request_mem;
-NCDValRef request_value;
 BReactor reactor;
 NCDRequestClient client;
-NCDRequestClientRequest request;
-int have_request;
+struct request *requests;
+int num_requests;
+int num_parsed;
+int num_finished;
+int num_errors;
+int binary;
 
 int main (int argc, char *argv[])
 {
     int res = 1;
     
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s < unix:<socket_path> / tcp:<address>:<port> > <request_payload>\n", (argc > 0 ? argv[0] : ""));
+    int argi = 1;
+    binary = 0;
+    
+    if (argi < argc && !strcmp(argv[argi], "--binary")) {
+        binary = 1;
+        argi++;
+    }
+    
+    if (argc - argi < 2) {
+        fprintf(stderr, "Usage: %s [--binary] < unix:<socket_path> / tcp:<address>:<port> > <request_payload> ...\n", (argc > 0 ? argv[0] : ""));
         goto fail0;
     }
     
-    char *connect_address = argv[1];
-    char *request_payload_string = argv[2];
+    char *connect_address = argv[argi];
+    char **request_payload_strings = argv + argi + 1;
+    num_requests = argc - argi - 1;
     
     BLog_InitStderr();
     
@@ -81,11 +99,21 @@ int main (int argc, char *argv[])
         goto fail01;
     }
     
-    NCDValMem_Init(&request_mem, &string_index);
+    if (!(requests = calloc(num_requests, sizeof(requests[0])))) {
+        BLog(BLOG_ERROR, "calloc failed");
+        goto fail02;
+    }
     
-    if (!NCDValParser_Parse(MemRef_MakeCstr(request_payload_string), &request_mem, &request_value)) {
-        BLog(BLOG_ERROR, "BReactor_Init failed");
-        goto fail1;
+    for (num_parsed = 0; num_parsed < num_requests; num_parsed++) {
+        struct request *r = &requests[num_parsed];
+        
+        NCDValMem_Init(&r->mem, &string_index);
+        
+        if (!NCDValParser_Parse(MemRef_MakeCstr(request_payload_strings[num_parsed]), &r->mem, &r->value)) {
+            BLog(BLOG_ERROR, "failed to parse request payload %d", num_parsed);
+            NCDValMem_Free(&r->mem);
+            goto fail1;
+        }
     }
     
     if (!BNetwork_GlobalInit()) {
@@ -108,18 +136,27 @@ int main (int argc, char *argv[])
         goto fail2;
     }
     
-    have_request = 0;
+    NCDRequestClient_SetBinary(&client, binary);
+    
+    num_finished = 0;
+    num_errors = 0;
     
     res = BReactor_Exec(&reactor);
     
-    if (have_request) {
-        NCDRequestClientRequest_Free(&request);
+    for (int j = 0; j < num_requests; j++) {
+        if (requests[j].have_creq) {
+            NCDRequestClientRequest_Free(&requests[j].creq);
+        }
     }
     NCDRequestClient_Free(&client);
 fail2:
     BReactor_Free(&reactor);
 fail1:
-    NCDValMem_Free(&request_mem);
+    while (num_parsed-- > 0) {
+        NCDValMem_Free(&requests[num_parsed].mem);
+    }
+    free(requests);
+fail02:
     NCDStringIndex_Free(&string_index);
 fail01:
     BLog_Free();
@@ -161,25 +198,33 @@ static void client_handler_error (void *user)
 
 static void client_handler_connected (void *user)
 {
-    ASSERT(!have_request)
-    
-    if (!NCDRequestClientRequest_Init(&request, &client, request_value, NULL, request_handler_sent, request_handler_reply, request_handler_finished)) {
-        BLog(BLOG_ERROR, "NCDRequestClientRequest_Init failed");
-        BReactor_Quit(&reactor, 1);
-        return;
+    // start all requests at once; they are pipelined over the connection
+    // and the server processes them concurrently
+    for (int j = 0; j < num_requests; j++) {
+        struct request *r = &requests[j];
+        ASSERT(!r->have_creq)
+        
+        if (!NCDRequestClientRequest_Init(&r->creq, &client, r->value, r,
+                                          (NCDRequestClientRequest_handler_sent)request_handler_sent,
+                                          (NCDRequestClientRequest_handler_reply)request_handler_reply,
+                                          (NCDRequestClientRequest_handler_finished)request_handler_finished)) {
+            BLog(BLOG_ERROR, "NCDRequestClientRequest_Init failed");
+            BReactor_Quit(&reactor, 1);
+            return;
+        }
+        
+        r->have_creq = 1;
     }
-    
-    have_request = 1;
 }
 
-static void request_handler_sent (void *user)
+static void request_handler_sent (struct request *r)
 {
-    ASSERT(have_request)
+    ASSERT(r->have_creq)
 }
 
-static void request_handler_reply (void *user, NCDValMem reply_mem, NCDValRef reply_value)
+static void request_handler_reply (struct request *r, NCDValMem reply_mem, NCDValRef reply_value)
 {
-    ASSERT(have_request)
+    ASSERT(r->have_creq)
     
     char *str = NCDValGenerator_Generate(reply_value);
     if (!str) {
@@ -187,6 +232,15 @@ static void request_handler_reply (void *user, NCDValMem reply_mem, NCDValRef re
         goto fail0;
     }
     
+    // with multiple requests, prefix replies with the index of the request
+    if (num_requests > 1) {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "%d ", (int)(r - requests));
+        if (!write_all(1, (const uint8_t *)prefix, strlen(prefix))) {
+            goto fail1;
+        }
+    }
+    
     if (!write_all(1, (uint8_t *)str, strlen(str))) {
         goto fail1;
     }
@@ -205,15 +259,21 @@ fail0:
     BReactor_Quit(&reactor, 1);
 }
 
-static void request_handler_finished (void *user, int is_error)
+static void request_handler_finished (struct request *r, int is_error)
 {
+    ASSERT(r->have_creq)
+    
     if (is_error) {
-        BLog(BLOG_ERROR, "request error");
-        BReactor_Quit(&reactor, 1);
-        return;
+        BLog(BLOG_ERROR, "request %d error", (int)(r - requests));
+        num_errors++;
     }
     
-    BReactor_Quit(&reactor, 0);
+    NCDRequestClientRequest_Free(&r->creq);
+    r->have_creq = 0;
+    
+    if (++num_finished == num_requests) {
+        BReactor_Quit(&reactor, num_errors > 0);
+    }
 }
 
 static int write_all (int fd, const uint8_t *data, size_t len)
@@ -716,6 +716,21 @@ NCDStatement * NCDBlock_ReplaceStatement (NCDBlock *o, NCDStatement *es, NCDStat
     return &e->s;
 }
 
+NCDStatement NCDBlock_GrabStatement (NCDBlock *o, NCDStatement *es)
+{
+    ASSERT(es)
+    
+    struct BlockStatement *e = UPPER_OBJECT(es, struct BlockStatement, s);
+    
+    NCDStatement old_s = e->s;
+    
+    LinkedList1_Remove(&o->statements_list, &e->statements_list_node);
+    o->count--;
+    free(e);
+    
+    return old_s;
+}
+
 NCDStatement * NCDBlock_FirstStatement (NCDBlock *o)
 {
     LinkedList1Node *ln = LinkedList1_GetFirst(&o->statements_list);
@@ -158,6 +158,7 @@ struct NCDIf_s {
 
 #define NCDIFTYPE_IF 1
 #define NCDIFTYPE_DO 2
+#define NCDIFTYPE_PARALLEL 3
 
 void NCDValue_Free (NCDValue *o);
 int NCDValue_Type (NCDValue *o);
@@ -215,6 +216,7 @@ void NCDBlock_Free (NCDBlock *o);
 int NCDBlock_PrependStatement (NCDBlock *o, NCDStatement s) WARN_UNUSED;
 int NCDBlock_InsertStatementAfter (NCDBlock *o, NCDStatement *after, NCDStatement s) WARN_UNUSED;
 NCDStatement * NCDBlock_ReplaceStatement (NCDBlock *o, NCDStatement *es, NCDStatement s);
+NCDStatement NCDBlock_GrabStatement (NCDBlock *o, NCDStatement *es);
 NCDStatement * NCDBlock_FirstStatement (NCDBlock *o);
 NCDStatement * NCDBlock_NextStatement (NCDBlock *o, NCDStatement *es);
 size_t NCDBlock_NumStatements (NCDBlock *o);
@@ -35,8 +35,11 @@
 #include <misc/read_file.h>
 #include <misc/strdup.h>
 #include <misc/concat_strings.h>
+#include <misc/balloc.h>
 #include <base/BLog.h>
 #include <ncd/NCDConfigParser.h>
+#include <ncd/NCDSugar.h>
+#include <ncd/NCDProgramCache.h>
 
 #include "NCDBuildProgram.h"
 
@@ -50,8 +53,18 @@ struct guard {
     struct guard *next;
 };
 
+struct source {
+    char *path;
+    size_t len;
+    uint64_t hash;
+    struct source *next;
+};
+
 struct build_state {
     struct guard *top_guard;
+    int record_sources;
+    struct source *first_source;
+    struct source **last_source_next;
 };
 
 static int add_guard (struct guard **first, const char *id_data, size_t id_length)
@@ -114,6 +127,42 @@ static int guard_exists (struct guard *top_guard, const char *id_data, size_t id
     return 0;
 }
 
+static int add_source (struct build_state *st, const char *path, const uint8_t *data, size_t len)
+{
+    struct source *s = malloc(sizeof(*s));
+    if (!s) {
+        goto fail0;
+    }
+    
+    if (!(s->path = b_strdup(path))) {
+        goto fail1;
+    }
+    
+    s->len = len;
+    s->hash = NCDProgramCache_Hash(data, len);
+    s->next = NULL;
+    
+    *st->last_source_next = s;
+    st->last_source_next = &s->next;
+    
+    return 1;
+    
+fail1:
+    free(s);
+fail0:
+    return 0;
+}
+
+static void free_sources (struct source *s)
+{
+    while (s) {
+        struct source *next_s = s->next;
+        free(s->path);
+        free(s);
+        s = next_s;
+    }
+}
+
 static char * make_dir_path (const char *file_path)
 {
     int found_slash = 0;
@@ -202,6 +251,12 @@ static int process_file (struct build_state *st, int depth, const char *file_pat
         goto fail1;
     }
     
+    if (st->record_sources && !add_source(st, file_path, data, len)) {
+        BLog(BLOG_ERROR, "file '%s': add_source failed", file_path);
+        free(data);
+        goto fail1;
+    }
+    
     NCDProgram program;
     res = NCDConfigParser_Parse((char *)data, len, &program);
     free(data);
@@ -305,6 +360,64 @@ int NCDBuildProgram_Build (const char *file_path, NCDProgram *out_program)
     
     struct build_state st;
     st.top_guard = NULL;
+    st.record_sources = 0;
+    
+    int guarded;
+    int res = process_file(&st, 0, file_path, out_program, &guarded);
+    
+    ASSERT(!res || !guarded)
+    
+    free_guards(st.top_guard);
+    
+    return res;
+}
+
+static void store_cache (const char *cache_path, struct source *first_source, NCDProgram *program)
+{
+    size_t num_sources = 0;
+    for (struct source *s = first_source; s; s = s->next) {
+        num_sources++;
+    }
+    
+    ASSERT(num_sources >= 1)
+    
+    struct NCDProgramCache_source *sources = BAllocArray(num_sources, sizeof(sources[0]));
+    if (!sources) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        return;
+    }
+    
+    size_t j = 0;
+    for (struct source *s = first_source; s; s = s->next) {
+        sources[j].path = s->path;
+        sources[j].len = s->len;
+        sources[j].hash = s->hash;
+        j++;
+    }
+    
+    if (!NCDProgramCache_Store(cache_path, sources, num_sources, program)) {
+        BLog(BLOG_WARNING, "failed to store program cache, continuing without");
+    }
+    
+    BFree(sources);
+}
+
+int NCDBuildProgram_BuildCached (const char *file_path, const char *cache_path, NCDProgram *out_program)
+{
+    ASSERT(file_path)
+    ASSERT(cache_path)
+    ASSERT(out_program)
+    
+    if (NCDProgramCache_Load(cache_path, file_path, out_program)) {
+        BLog(BLOG_INFO, "loaded program from cache '%s'", cache_path);
+        return 1;
+    }
+    
+    struct build_state st;
+    st.top_guard = NULL;
+    st.record_sources = 1;
+    st.first_source = NULL;
+    st.last_source_next = &st.first_source;
     
     int guarded;
     int res = process_file(&st, 0, file_path, out_program, &guarded);
@@ -313,5 +426,21 @@ int NCDBuildProgram_Build (const char *file_path, NCDProgram *out_program)
     
     free_guards(st.top_guard);
     
+    if (!res) {
+        goto out;
+    }
+    
+    // the cache holds the desugared program, so desugaring is skipped on load too
+    if (!NCDSugar_Desugar(out_program)) {
+        BLog(BLOG_ERROR, "NCDSugar_Desugar failed");
+        NCDProgram_Free(out_program);
+        res = 0;
+        goto out;
+    }
+    
+    store_cache(cache_path, st.first_source, out_program);
+    
+out:
+    free_sources(st.first_source);
     return res;
 }
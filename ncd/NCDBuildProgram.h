@@ -46,4 +46,20 @@
  */
 int NCDBuildProgram_Build (const char *file_path, NCDProgram *out_program) WARN_UNUSED;
 
+/**
+ * Like {@link NCDBuildProgram_Build}, but goes through a program cache.
+ * If the cache at 'cache_path' was built from the same main file and none of
+ * the source files have changed, the program is loaded from the cache without
+ * parsing anything. Otherwise the program is built from the sources and the
+ * cache is rewritten; failing to write the cache is not an error.
+ * The resulting program is already desugared.
+ * 
+ * @param file_path path to the main file of the program
+ * @param cache_path path to the cache file
+ * @param out_program on success, *out_program will contain the resulting program.
+ *                    On failure, *out_program will be unchanged.
+ * @return 1 on success, 0 on failure
+ */
+int NCDBuildProgram_BuildCached (const char *file_path, const char *cache_path, NCDProgram *out_program) WARN_UNUSED;
+
 #endif
@@ -536,6 +536,40 @@ doneGB0:
     free(N);
 }
 
+statement(R) ::= TOKEN_PARALLEL CURLY_OPEN statements(S) CURLY_CLOSE name_maybe(N) SEMICOLON. {
+    if (!S.have) {
+        goto failGC0;
+    }
+    
+    NCDIfBlock if_block;
+    NCDIfBlock_Init(&if_block);
+    
+    NCDIf the_if;
+    NCDIf_InitBlock(&the_if, S.v);
+    S.have = 0;
+    
+    if (!NCDIfBlock_PrependIf(&if_block, the_if)) {
+        NCDIf_Free(&the_if);
+        goto failGC1;
+    }
+    
+    if (!NCDStatement_InitIf(&R.v, N, if_block, NCDIFTYPE_PARALLEL)) {
+        goto failGC1;
+    }
+    
+    R.have = 1;
+    goto doneGC0;
+    
+failGC1:
+    NCDIfBlock_Free(&if_block);
+failGC0:
+    R.have = 0;
+    parser_out->out_of_memory = 1;
+doneGC0:
+    free_block(S);
+    free(N);
+}
+
 statements(R) ::= statement(A). {
     if (!A.have) {
         goto failH0;
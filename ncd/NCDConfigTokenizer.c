@@ -42,19 +42,67 @@
 
 #include <generated/blog_channel_NCDConfigTokenizer.h>
 
-static int is_name_char (char c)
-{
-    return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_');
-}
+#define CC_NAME_FIRST 1
+#define CC_NAME 2
+#define CC_SPACE 4
+#define CC_STRING_PLAIN 8
+
+#define CC_N (CC_NAME_FIRST|CC_NAME|CC_STRING_PLAIN)
+#define CC_D (CC_NAME|CC_STRING_PLAIN)
+#define CC_S (CC_SPACE|CC_STRING_PLAIN)
+#define CC_P CC_STRING_PLAIN
+
+// character classes, so that runs of characters can be skipped with one lookup each
+static const uint8_t char_class[256] = {
+    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_S, CC_S, CC_P, CC_P, CC_S, CC_P, CC_P,
+    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_S, CC_P, 0,    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_D, CC_D, CC_D, CC_D, CC_D, CC_D, CC_D, CC_D, CC_D, CC_D, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_P, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N,
+    CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_P, 0,    CC_P, CC_P, CC_N,
+    CC_P, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N,
+    CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_N, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P,
+    CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P, CC_P
+};
 
-static int is_name_first_char (char c)
+// keywords in order of precedence; they are matched as prefixes
+static const struct {
+    const char *str;
+    int token;
+} keywords[] = {
+    {"If", NCD_TOKEN_IF},
+    {"Elif", NCD_TOKEN_ELIF},
+    {"elif", NCD_TOKEN_ELIF},
+    {"Else", NCD_TOKEN_ELSE},
+    {"else", NCD_TOKEN_ELSE},
+    {"Foreach", NCD_TOKEN_FOREACH},
+    {"As", NCD_TOKEN_AS},
+    {"Block", NCD_TOKEN_BLOCK},
+    {"Do", NCD_TOKEN_DO},
+    {"Interrupt", NCD_TOKEN_INTERRUPT},
+    {"Parallel", NCD_TOKEN_PARALLEL},
+    {"include_guard", NCD_TOKEN_INCLUDE_GUARD},
+    {"include", NCD_TOKEN_INCLUDE}
+};
+
+static int char_is (char c, int cls)
 {
-    return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_');
+    return !!(char_class[(uint8_t)c] & cls);
 }
 
-static int is_space_char (char c)
+static size_t skip_class (const char *str, size_t pos, size_t len, int cls)
 {
-    return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    while (pos < len && char_is(str[pos], cls)) {
+        pos++;
+    }
+    return pos;
 }
 
 static int string_equals (char *str, int str_len, char *needle)
@@ -78,92 +126,46 @@ void NCDConfigTokenizer_Tokenize (MemRef the_str, NCDConfigTokenizer_output outp
         size_t token_len = 0;
         
         if (*str == '#') {
-            l = 1;
-            while (l < left && str[l] != '\n') {
-                l++;
-            }
+            const char *nl = memchr(str, '\n', left);
+            l = (nl ? (size_t)(nl - str) : left);
             token = 0;
         }
-        else if (l = data_begins_with(str, left, "{")) {
-            token = NCD_TOKEN_CURLY_OPEN;
-        }
-        else if (l = data_begins_with(str, left, "}")) {
-            token = NCD_TOKEN_CURLY_CLOSE;
-        }
-        else if (l = data_begins_with(str, left, "(")) {
-            token = NCD_TOKEN_ROUND_OPEN;
-        }
-        else if (l = data_begins_with(str, left, ")")) {
-            token = NCD_TOKEN_ROUND_CLOSE;
-        }
-        else if (l = data_begins_with(str, left, ";")) {
-            token = NCD_TOKEN_SEMICOLON;
-        }
-        else if (l = data_begins_with(str, left, ".")) {
-            token = NCD_TOKEN_DOT;
-        }
-        else if (l = data_begins_with(str, left, ",")) {
-            token = NCD_TOKEN_COMMA;
-        }
-        else if (l = data_begins_with(str, left, ":")) {
-            token = NCD_TOKEN_COLON;
-        }
-        else if (l = data_begins_with(str, left, "[")) {
-            token = NCD_TOKEN_BRACKET_OPEN;
-        }
-        else if (l = data_begins_with(str, left, "]")) {
-            token = NCD_TOKEN_BRACKET_CLOSE;
-        }
-        else if (l = data_begins_with(str, left, "@")) {
-            token = NCD_TOKEN_AT;
-        }
-        else if (l = data_begins_with(str, left, "^")) {
-            token = NCD_TOKEN_CARET;
-        }
         else if (l = data_begins_with(str, left, "->")) {
             token = NCD_TOKEN_ARROW;
         }
-        else if (l = data_begins_with(str, left, "If")) {
-            token = NCD_TOKEN_IF;
-        }
-        else if (l = data_begins_with(str, left, "Elif")) {
-            token = NCD_TOKEN_ELIF;
-        }
-        else if (l = data_begins_with(str, left, "elif")) {
-            token = NCD_TOKEN_ELIF;
-        }
-        else if (l = data_begins_with(str, left, "Else")) {
-            token = NCD_TOKEN_ELSE;
-        }
-        else if (l = data_begins_with(str, left, "else")) {
-            token = NCD_TOKEN_ELSE;
-        }
-        else if (l = data_begins_with(str, left, "Foreach")) {
-            token = NCD_TOKEN_FOREACH;
-        }
-        else if (l = data_begins_with(str, left, "As")) {
-            token = NCD_TOKEN_AS;
-        }
-        else if (l = data_begins_with(str, left, "Block")) {
-            token = NCD_TOKEN_BLOCK;
-        }
-        else if (l = data_begins_with(str, left, "Do")) {
-            token = NCD_TOKEN_DO;
-        }
-        else if (l = data_begins_with(str, left, "Interrupt")) {
-            token = NCD_TOKEN_INTERRUPT;
-        }
-        else if (l = data_begins_with(str, left, "include_guard")) {
-            token = NCD_TOKEN_INCLUDE_GUARD;
-        }
-        else if (l = data_begins_with(str, left, "include")) {
-            token = NCD_TOKEN_INCLUDE;
-        }
-        else if (is_name_first_char(*str)) {
+        else if (!char_is(*str, CC_NAME_FIRST|CC_SPACE) && *str != '"') {
             l = 1;
-            while (l < left && is_name_char(str[l])) {
-                l++;
+            switch (*str) {
+                case '{': token = NCD_TOKEN_CURLY_OPEN; break;
+                case '}': token = NCD_TOKEN_CURLY_CLOSE; break;
+                case '(': token = NCD_TOKEN_ROUND_OPEN; break;
+                case ')': token = NCD_TOKEN_ROUND_CLOSE; break;
+                case ';': token = NCD_TOKEN_SEMICOLON; break;
+                case '.': token = NCD_TOKEN_DOT; break;
+                case ',': token = NCD_TOKEN_COMMA; break;
+                case ':': token = NCD_TOKEN_COLON; break;
+                case '[': token = NCD_TOKEN_BRACKET_OPEN; break;
+                case ']': token = NCD_TOKEN_BRACKET_CLOSE; break;
+                case '@': token = NCD_TOKEN_AT; break;
+                case '^': token = NCD_TOKEN_CARET; break;
+                default:
+                    BLog(BLOG_ERROR, "unrecognized character");
+                    error = 1;
+            }
+        }
+        else if (char_is(*str, CC_NAME_FIRST)) {
+            token = 0;
+            for (size_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++) {
+                if (keywords[k].str[0] == *str && (l = data_begins_with(str, left, keywords[k].str))) {
+                    token = keywords[k].token;
+                    break;
+                }
             }
+            if (token) {
+                goto out;
+            }
+            
+            l = skip_class(str, 1, left, CC_NAME);
             
             // allocate buffer
             bsize_t bufsize = bsize_add(bsize_fromsize(l), bsize_fromint(1));
@@ -268,8 +270,14 @@ void NCDConfigTokenizer_Tokenize (MemRef the_str, NCDConfigTokenizer_output outp
                     break;
                 }
                 else {
-                    dec_ch = str[l];
-                    l++;
+                    // copy a run of plain characters at once
+                    size_t end = skip_class(str, l, left, CC_STRING_PLAIN);
+                    if (!ExpString_AppendBinary(&estr, (const uint8_t *)str + l, end - l)) {
+                        BLog(BLOG_ERROR, "ExpString_AppendBinary failed");
+                        goto string_fail1;
+                    }
+                    l = end;
+                    continue;
                 }
                 
                 // append character to string
@@ -298,13 +306,10 @@ void NCDConfigTokenizer_Tokenize (MemRef the_str, NCDConfigTokenizer_output outp
         string_fail0:
             error = 1;
         } while (0);
-        else if (is_space_char(*str)) {
-            token = 0;
-            l = 1;
-        }
         else {
-            BLog(BLOG_ERROR, "unrecognized character");
-            error = 1;
+            ASSERT(char_is(*str, CC_SPACE))
+            token = 0;
+            l = skip_class(str, 1, left, CC_SPACE);
         }
         
     out:
@@ -322,14 +327,14 @@ void NCDConfigTokenizer_Tokenize (MemRef the_str, NCDConfigTokenizer_output outp
         }
         
         // update line/char counters
-        for (size_t i = 0; i < l; i++) {
-            if (str[i] == '\n') {
-                line++;
-                line_char = 1;
-            } else {
-                line_char++;
-            }
-        }
+        const char *p = str;
+        const char *nl;
+        while ((nl = memchr(p, '\n', l - (p - str)))) {
+            line++;
+            line_char = 1;
+            p = nl + 1;
+        }
+        line_char += l - (p - str);
         
         str += l;
         left -= l;
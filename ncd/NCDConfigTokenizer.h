@@ -63,6 +63,7 @@
 #define NCD_TOKEN_CARET 25
 #define NCD_TOKEN_DO 26
 #define NCD_TOKEN_INTERRUPT 27
+#define NCD_TOKEN_PARALLEL 28
 
 typedef int (*NCDConfigTokenizer_output) (void *user, int token, char *value, size_t value_len, size_t line, size_t line_char);
 
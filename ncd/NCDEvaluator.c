@@ -55,20 +55,20 @@ struct NCDEvaluator__eval_context {
     NCDEvaluator_EvalFuncs const *funcs;
 };
 
-static int expr_init (struct NCDEvaluator__Expr *o, NCDEvaluator *eval, NCDValue *value);
+static int expr_init (struct NCDEvaluator__Expr *o, NCDEvaluator *eval, NCDEvaluator_ResolveFuncs const *resolve, NCDValue *value);
 static void expr_free (struct NCDEvaluator__Expr *o);
 static int expr_eval (struct NCDEvaluator__Expr *o, struct NCDEvaluator__eval_context const *context, NCDValMem *out_newmem, NCDValRef *out_val);
-static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem, NCDValRef *out);
+static int add_expr_recurser (NCDEvaluator *o, NCDEvaluator_ResolveFuncs const *resolve, NCDValue *value, NCDValMem *mem, NCDValRef *out);
 static int replace_placeholders_callback (void *arg, int plid, NCDValMem *mem, NCDValRef *out);
 
-static int expr_init (struct NCDEvaluator__Expr *o, NCDEvaluator *eval, NCDValue *value)
+static int expr_init (struct NCDEvaluator__Expr *o, NCDEvaluator *eval, NCDEvaluator_ResolveFuncs const *resolve, NCDValue *value)
 {
     ASSERT((NCDValue_Type(value), 1))
     
     NCDValMem_Init(&o->mem, eval->string_index);
     
     NCDValRef ref;
-    if (!add_expr_recurser(eval, value, &o->mem, &ref)) {
+    if (!add_expr_recurser(eval, resolve, value, &o->mem, &ref)) {
         goto fail1;
     }
     
@@ -128,7 +128,7 @@ fail0:
     return 0;
 }
 
-static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem, NCDValRef *out)
+static int add_expr_recurser (NCDEvaluator *o, NCDEvaluator_ResolveFuncs const *resolve, NCDValue *value, NCDValMem *mem, NCDValRef *out)
 {
     switch (NCDValue_Type(value)) {
         case NCDVALUE_STRING: {
@@ -155,7 +155,7 @@ static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem,
             
             for (NCDValue *e = NCDValue_ListFirst(value); e; e = NCDValue_ListNext(value, e)) {
                 NCDValRef vval;
-                if (!add_expr_recurser(o, e, mem, &vval)) {
+                if (!add_expr_recurser(o, resolve, e, mem, &vval)) {
                     goto fail;
                 }
                 
@@ -177,8 +177,8 @@ static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem,
                 
                 NCDValRef vkey;
                 NCDValRef vval;
-                if (!add_expr_recurser(o, ekey, mem, &vkey) ||
-                    !add_expr_recurser(o, eval, mem, &vval)
+                if (!add_expr_recurser(o, resolve, ekey, mem, &vkey) ||
+                    !add_expr_recurser(o, resolve, eval, mem, &vval)
                 ) {
                     goto fail;
                 }
@@ -203,6 +203,8 @@ static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem,
                 goto fail_var0;
             }
             
+            var.resolved = resolve->func_resolve_var(resolve->user, var.varnames, var.num_names);
+            
             size_t index;
             struct NCDEvaluator__Var *varptr = NCDEvaluator__VarVec_Push(&o->vars, &index);
             if (!varptr) {
@@ -243,6 +245,8 @@ static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem,
                 goto fail_invoc0;
             }
             
+            call.resolved = resolve->func_resolve_call(resolve->user, call.func_name_id);
+            
             NCDValue *arg = NCDValue_InvocArg(value);
             if (NCDValue_Type(arg) != NCDVALUE_LIST) {
                 BLog(BLOG_ERROR, "call argument is not a list literal!?");
@@ -256,7 +260,7 @@ static int add_expr_recurser (NCDEvaluator *o, NCDValue *value, NCDValMem *mem,
             call.num_args = 0;
             
             for (NCDValue *e = NCDValue_ListFirst(arg); e; e = NCDValue_ListNext(arg, e)) {
-                if (!expr_init(&call.args[call.num_args], o, e)) {
+                if (!expr_init(&call.args[call.num_args], o, resolve, e)) {
                     goto fail_invoc1;
                 }
                 call.num_args++;
@@ -319,7 +323,7 @@ static int replace_placeholders_callback (void *arg, int plid, NCDValMem *mem, N
         case 0: {
             struct NCDEvaluator__Var *var = NCDEvaluator__VarVec_Get(&o->vars, index);
             
-            res = context->funcs->func_eval_var(context->funcs->user, var->varnames, var->num_names, mem, out);
+            res = context->funcs->func_eval_var(context->funcs->user, var->varnames, var->num_names, var->resolved, mem, out);
         } break;
         
         case 1: {
@@ -329,7 +333,7 @@ static int replace_placeholders_callback (void *arg, int plid, NCDValMem *mem, N
             args.context = context;
             args.call_index = index;
             
-            res = context->funcs->func_eval_call(context->funcs->user, call->func_name_id, args, mem, out);
+            res = context->funcs->func_eval_call(context->funcs->user, call->func_name_id, call->resolved, args, mem, out);
         } break;
         
         default: {
@@ -382,9 +386,11 @@ void NCDEvaluator_Free (NCDEvaluator *o)
     NCDEvaluator__VarVec_Free(&o->vars);
 }
 
-int NCDEvaluatorExpr_Init (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDValue *value)
+int NCDEvaluatorExpr_Init (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDEvaluator_ResolveFuncs const *resolve, NCDValue *value)
 {
-    return expr_init(&o->expr, eval, value);
+    ASSERT(resolve)
+    
+    return expr_init(&o->expr, eval, resolve, value);
 }
 
 void NCDEvaluatorExpr_Free (NCDEvaluatorExpr *o)
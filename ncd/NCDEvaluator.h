@@ -47,6 +47,7 @@ struct NCDEvaluator__Expr {
 struct NCDEvaluator__Var {
     NCD_string_id_t *varnames;
     size_t num_names;
+    int resolved;
 };
 
 #include "NCDEvaluator_var_vec.h"
@@ -54,6 +55,7 @@ struct NCDEvaluator__Var {
 
 struct NCDEvaluator__Call {
     NCD_string_id_t func_name_id;
+    void const *resolved;
     struct NCDEvaluator__Expr *args;
     size_t num_args;
 };
@@ -78,15 +80,23 @@ typedef struct {
     int call_index;
 } NCDEvaluatorArgs;
 
+// called once per variable and call when an expression is built; the results
+// are passed back to func_eval_var and func_eval_call on every evaluation
 typedef struct {
     void *user;
-    int (*func_eval_var) (void *user, NCD_string_id_t const *varnames, size_t num_names, NCDValMem *mem, NCDValRef *out);
-    int (*func_eval_call) (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out);
+    int (*func_resolve_var) (void *user, NCD_string_id_t const *varnames, size_t num_names);
+    void const * (*func_resolve_call) (void *user, NCD_string_id_t func_name_id);
+} NCDEvaluator_ResolveFuncs;
+
+typedef struct {
+    void *user;
+    int (*func_eval_var) (void *user, NCD_string_id_t const *varnames, size_t num_names, int resolved, NCDValMem *mem, NCDValRef *out);
+    int (*func_eval_call) (void *user, NCD_string_id_t func_name_id, void const *resolved, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out);
 } NCDEvaluator_EvalFuncs;
 
 int NCDEvaluator_Init (NCDEvaluator *o, NCDStringIndex *string_index) WARN_UNUSED;
 void NCDEvaluator_Free (NCDEvaluator *o);
-int NCDEvaluatorExpr_Init (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDValue *value) WARN_UNUSED;
+int NCDEvaluatorExpr_Init (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDEvaluator_ResolveFuncs const *resolve, NCDValue *value) WARN_UNUSED;
 void NCDEvaluatorExpr_Free (NCDEvaluatorExpr *o);
 int NCDEvaluatorExpr_Eval (NCDEvaluatorExpr *o, NCDEvaluator *eval, NCDEvaluator_EvalFuncs const *funcs, NCDValMem *out_newmem, NCDValRef *out_val) WARN_UNUSED;
 size_t NCDEvaluatorArgs_Count (NCDEvaluatorArgs *o);
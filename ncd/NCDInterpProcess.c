@@ -47,6 +47,8 @@ struct NCDInterpProcess__stmt {
     NCD_string_id_t cmdname;
     NCD_string_id_t *objnames;
     size_t num_objnames;
+    int objnames_stmt;
+    int dep_max;
     union {
         const struct NCDInterpModule *simple_module;
         int method_name_id;
@@ -57,6 +59,56 @@ struct NCDInterpProcess__stmt {
     int hash_next;
 };
 
+struct resolve_context {
+    NCDInterpProcess *o;
+    NCDModuleIndex *module_index;
+};
+
+static int find_statement (NCDInterpProcess *o, int from_index, NCD_string_id_t name)
+{
+    size_t bucket_idx = name % o->num_hash_buckets;
+    int stmt_idx = o->hash_buckets[bucket_idx];
+    ASSERT(stmt_idx >= -1)
+    ASSERT(stmt_idx < o->num_stmts)
+    
+    while (stmt_idx >= 0) {
+        if (stmt_idx < from_index && o->stmts[stmt_idx].name == name) {
+            return stmt_idx;
+        }
+        
+        stmt_idx = o->stmts[stmt_idx].hash_next;
+        ASSERT(stmt_idx >= -1)
+        ASSERT(stmt_idx < o->num_stmts)
+    }
+    
+    return -1;
+}
+
+static int resolve_var_func (void *user, NCD_string_id_t const *varnames, size_t num_names)
+{
+    struct resolve_context *ctx = user;
+    ASSERT(num_names > 0)
+    
+    // arguments are evaluated from the position of their statement, which is
+    // the one being built; only the statements before it are hashed so far
+    int stmt_idx = find_statement(ctx->o, ctx->o->num_stmts, varnames[0]);
+    
+    // remember the last statement the arguments depend on
+    struct NCDInterpProcess__stmt *e = &ctx->o->stmts[ctx->o->num_stmts];
+    if (stmt_idx > e->dep_max) {
+        e->dep_max = stmt_idx;
+    }
+    
+    return stmt_idx;
+}
+
+static void const * resolve_call_func (void *user, NCD_string_id_t func_name_id)
+{
+    struct resolve_context *ctx = user;
+    
+    return NCDModuleIndex_FindFunction(ctx->module_index, func_name_id);
+}
+
 static int compute_prealloc (NCDInterpProcess *o)
 {
     int size = 0;
@@ -119,7 +171,10 @@ int NCDInterpProcess_Init (NCDInterpProcess *o, NCDProcess *process, NCDStringIn
     o->num_stmts = 0;
     o->prealloc_size = -1;
     o->is_template = NCDProcess_IsTemplate(process);
-    o->cache = NULL;
+    o->cache_count = 0;
+    
+    struct resolve_context resolve_ctx = {o, module_index};
+    NCDEvaluator_ResolveFuncs resolve = {&resolve_ctx, resolve_var_func, resolve_call_func};
     
     for (NCDStatement *s = NCDBlock_FirstStatement(block); s; s = NCDBlock_NextStatement(block, s)) {
         ASSERT(NCDStatement_Type(s) == NCDSTATEMENT_REG)
@@ -128,6 +183,8 @@ int NCDInterpProcess_Init (NCDInterpProcess *o, NCDProcess *process, NCDStringIn
         e->name = -1;
         e->objnames = NULL;
         e->num_objnames = 0;
+        e->objnames_stmt = -1;
+        e->dep_max = -1;
         e->alloc_size = 0;
         
         if (NCDStatement_Name(s)) {
@@ -144,7 +201,7 @@ int NCDInterpProcess_Init (NCDInterpProcess *o, NCDProcess *process, NCDStringIn
             goto loop_fail0;
         }
         
-        if (!NCDEvaluatorExpr_Init(&e->arg_expr, eval, NCDStatement_RegArgs(s))) {
+        if (!NCDEvaluatorExpr_Init(&e->arg_expr, eval, &resolve, NCDStatement_RegArgs(s))) {
             BLog(BLOG_ERROR, "NCDEvaluatorExpr_Init failed");
             goto loop_fail0;
         }
@@ -155,6 +212,12 @@ int NCDInterpProcess_Init (NCDInterpProcess *o, NCDProcess *process, NCDStringIn
                 goto loop_fail1;
             }
             
+            // the object of a method is looked up from the position of its statement
+            e->objnames_stmt = find_statement(o, o->num_stmts, e->objnames[0]);
+            if (e->objnames_stmt > e->dep_max) {
+                e->dep_max = e->objnames_stmt;
+            }
+            
             e->binding.method_name_id = NCDModuleIndex_GetMethodNameId(module_index, NCDStatement_RegCmdName(s));
             if (e->binding.method_name_id == -1) {
                 BLog(BLOG_ERROR, "NCDModuleIndex_GetMethodNameId failed");
@@ -222,22 +285,7 @@ int NCDInterpProcess_FindStatement (NCDInterpProcess *o, int from_index, NCD_str
     ASSERT(from_index >= 0)
     ASSERT(from_index <= o->num_stmts)
     
-    size_t bucket_idx = name % o->num_hash_buckets;
-    int stmt_idx = o->hash_buckets[bucket_idx];
-    ASSERT(stmt_idx >= -1)
-    ASSERT(stmt_idx < o->num_stmts)
-    
-    while (stmt_idx >= 0) {
-        if (stmt_idx < from_index && o->stmts[stmt_idx].name == name) {
-            return stmt_idx;
-        }
-        
-        stmt_idx = o->stmts[stmt_idx].hash_next;
-        ASSERT(stmt_idx >= -1)
-        ASSERT(stmt_idx < o->num_stmts)
-    }
-    
-    return -1;
+    return find_statement(o, from_index, name);
 }
 
 const char * NCDInterpProcess_StatementCmdName (NCDInterpProcess *o, int i, NCDStringIndex *string_index)
@@ -262,6 +310,25 @@ void NCDInterpProcess_StatementObjNames (NCDInterpProcess *o, int i, const NCD_s
     *out_num_objnames = o->stmts[i].num_objnames;
 }
 
+int NCDInterpProcess_StatementObjStatement (NCDInterpProcess *o, int i)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(i >= 0)
+    ASSERT(i < o->num_stmts)
+    ASSERT(o->stmts[i].objnames)
+    
+    return o->stmts[i].objnames_stmt;
+}
+
+int NCDInterpProcess_StatementDepMax (NCDInterpProcess *o, int i)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(i >= 0)
+    ASSERT(i < o->num_stmts)
+    
+    return o->stmts[i].dep_max;
+}
+
 const struct NCDInterpModule * NCDInterpProcess_StatementGetSimpleModule (NCDInterpProcess *o, int i, NCDStringIndex *string_index, NCDModuleIndex *module_index)
 {
     DebugObject_Access(&o->d_obj);
@@ -372,12 +439,14 @@ int NCDInterpProcess_CachePush (NCDInterpProcess *o, void *elem)
 {
     DebugObject_Access(&o->d_obj);
     ASSERT(elem)
+    ASSERT(o->cache_count >= 0)
+    ASSERT(o->cache_count <= NCDINTERPPROCESS_CACHE_SIZE)
     
-    if (o->cache) {
+    if (o->cache_count == NCDINTERPPROCESS_CACHE_SIZE) {
         return 0;
     }
     
-    o->cache = elem;
+    o->cache[o->cache_count++] = elem;
     
     return 1;
 }
@@ -385,9 +454,12 @@ int NCDInterpProcess_CachePush (NCDInterpProcess *o, void *elem)
 void * NCDInterpProcess_CachePull (NCDInterpProcess *o)
 {
     DebugObject_Access(&o->d_obj);
+    ASSERT(o->cache_count >= 0)
+    ASSERT(o->cache_count <= NCDINTERPPROCESS_CACHE_SIZE)
     
-    void *elem = o->cache;
-    o->cache = NULL;
+    if (o->cache_count == 0) {
+        return NULL;
+    }
     
-    return elem;
+    return o->cache[--o->cache_count];
 }
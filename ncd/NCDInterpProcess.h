@@ -41,6 +41,8 @@
 #include <ncd/NCDModuleIndex.h>
 #include <ncd/NCDStringIndex.h>
 
+#define NCDINTERPPROCESS_CACHE_SIZE 32
+
 struct NCDInterpProcess__stmt;
 
 /**
@@ -60,7 +62,8 @@ typedef struct {
     int is_template;
     int *hash_buckets;
     size_t num_hash_buckets;
-    void *cache;
+    void *cache[NCDINTERPPROCESS_CACHE_SIZE];
+    int cache_count;
     DebugObject d_obj;
 } NCDInterpProcess;
 
@@ -69,6 +72,8 @@ void NCDInterpProcess_Free (NCDInterpProcess *o);
 int NCDInterpProcess_FindStatement (NCDInterpProcess *o, int from_index, NCD_string_id_t name);
 const char * NCDInterpProcess_StatementCmdName (NCDInterpProcess *o, int i, NCDStringIndex *string_index);
 void NCDInterpProcess_StatementObjNames (NCDInterpProcess *o, int i, const NCD_string_id_t **out_objnames, size_t *out_num_objnames);
+int NCDInterpProcess_StatementObjStatement (NCDInterpProcess *o, int i);
+int NCDInterpProcess_StatementDepMax (NCDInterpProcess *o, int i);
 const struct NCDInterpModule * NCDInterpProcess_StatementGetSimpleModule (NCDInterpProcess *o, int i, NCDStringIndex *string_index, NCDModuleIndex *module_index);
 const struct NCDInterpModule * NCDInterpProcess_StatementGetMethodModule (NCDInterpProcess *o, int i, NCD_string_id_t obj_type, NCDModuleIndex *module_index);
 NCDEvaluatorExpr * NCDInterpProcess_GetStatementArgsExpr (NCDInterpProcess *o, int i);
@@ -37,6 +37,7 @@
 #include <misc/balloc.h>
 #include <misc/expstring.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
 #include <ncd/NCDSugar.h>
 #include <ncd/modules/modules.h>
 
@@ -96,6 +97,8 @@ static void process_free (struct process *p, NCDModuleProcess **out_mp);
 static void process_set_state (struct process *p, int state);
 static void process_start_terminating (struct process *p);
 static int process_have_child (struct process *p);
+static int process_statement_kept (struct process *p, int i);
+static int process_find_kill (struct process *p);
 static void process_assert_pointers (struct process *p);
 static void process_logfunc (struct process *p);
 static void process_log (struct process *p, int level, const char *fmt, ...);
@@ -103,13 +106,14 @@ static void process_work_job_handler_working (struct process *p);
 static void process_work_job_handler_up (struct process *p);
 static void process_work_job_handler_waiting (struct process *p);
 static void process_work_job_handler_terminating (struct process *p);
-static int eval_func_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_names, NCDValMem *mem, NCDValRef *out);
-static int eval_func_eval_call (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out);
+static int eval_func_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_names, int resolved, NCDValMem *mem, NCDValRef *out);
+static int eval_func_eval_call (void *user, NCD_string_id_t func_name_id, void const *resolved, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out);
 static void process_advance (struct process *p);
 static void process_wait_timer_handler (BSmallTimer *timer);
+static int process_get_object (struct process *p, int i, NCD_string_id_t name, NCDObject *out_object);
 static int process_find_object (struct process *p, int pos, NCD_string_id_t name, NCDObject *out_object);
-static int process_resolve_object_expr (struct process *p, int pos, const NCD_string_id_t *names, size_t num_names, NCDObject *out_object);
-static int process_resolve_variable_expr (struct process *p, int pos, const NCD_string_id_t *names, size_t num_names, NCDValMem *mem, NCDValRef *out_value);
+static int process_resolve_object_expr (struct process *p, int pos, int stmt_index, const NCD_string_id_t *names, size_t num_names, NCDObject *out_object);
+static int process_resolve_variable_expr (struct process *p, int pos, int stmt_index, const NCD_string_id_t *names, size_t num_names, NCDValMem *mem, NCDValRef *out_value);
 static void statement_logfunc (struct statement *ps);
 static void statement_log (struct statement *ps, int level, const char *fmt, ...);
 static struct process * statement_process (struct statement *ps);
@@ -544,6 +548,8 @@ int process_new (NCDInterpreter *interp, NCDInterpProcess *iprocess, NCDModulePr
         return 0;
     }
     
+    BMetrics_Count(BMETRICS_COUNTER_NCD_PROCESSES, 1);
+    
     // set module process pointer
     p->module_process = module_process;
     
@@ -611,6 +617,38 @@ int process_have_child (struct process *p)
     return (p->ap > 0 && p->statements[p->ap - 1].inst.istate == SSTATE_CHILD);
 }
 
+int process_statement_kept (struct process *p, int i)
+{
+    ASSERT(i >= p->ap)
+    ASSERT(i < p->fp)
+    
+    struct statement *ps = &p->statements[i];
+    
+    if (!p->interp->params.keep_on_backtrack || ps->inst.istate != SSTATE_ADULT ||
+        !(ps->inst.m->module.flags & NCDMODULE_FLAG_KEEP_ON_BACKTRACK)
+    ) {
+        return 0;
+    }
+    
+    // the statement before AP may have gone down, so the arguments must not
+    // refer to it either
+    int dep_max = NCDInterpProcess_StatementDepMax(p->iprocess, i);
+    
+    return (dep_max < 0 || dep_max < p->ap - 1);
+}
+
+int process_find_kill (struct process *p)
+{
+    // statements are killed from the end, skipping those which are kept
+    for (int i = p->fp - 1; i >= p->ap; i--) {
+        if (p->statements[i].inst.istate != SSTATE_FORGOTTEN && !process_statement_kept(p, i)) {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
 void process_assert_pointers (struct process *p)
 {
     ASSERT(p->ap <= p->num_statements)
@@ -655,9 +693,10 @@ void process_work_job_handler_working (struct process *p)
     ASSERT(p->state == PSTATE_WORKING)
     
     // cleaning up?
-    if (p->ap < p->fp) {
+    int kill_i = process_find_kill(p);
+    if (kill_i >= 0) {
         // order the last living statement to die, if needed
-        struct statement *ps = &p->statements[p->fp - 1];
+        struct statement *ps = &p->statements[kill_i];
         if (ps->inst.istate == SSTATE_DYING) {
             return;
         }
@@ -704,7 +743,20 @@ void process_work_job_handler_working (struct process *p)
     
     // advancing?
     struct statement *ps = &p->statements[p->ap];
-    ASSERT(ps->inst.istate == SSTATE_FORGOTTEN)
+    
+    // step over a statement which was kept alive
+    if (ps->inst.istate != SSTATE_FORGOTTEN) {
+        ASSERT(process_statement_kept(p, p->ap))
+        
+        STATEMENT_LOG(ps, BLOG_INFO, "kept");
+        
+        // increment AP
+        p->ap++;
+        
+        // schedule work
+        BSmallPending_Set(&p->work_job, BReactor_PendingGroup(p->reactor));
+        return;
+    }
     
     if (p->error) {
         STATEMENT_LOG(ps, BLOG_INFO, "waiting after error");
@@ -823,7 +875,7 @@ again:
     return;
 }
 
-int eval_func_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_names, NCDValMem *mem, NCDValRef *out)
+int eval_func_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_names, int resolved, NCDValMem *mem, NCDValRef *out)
 {
     struct process *p = user;
     ASSERT(varnames)
@@ -831,15 +883,19 @@ int eval_func_eval_var (void *user, NCD_string_id_t const *varnames, size_t num_
     ASSERT(mem)
     ASSERT(out)
     
-    return process_resolve_variable_expr(p, p->ap, varnames, num_names, mem, out);
+    // the statement was looked up when the expression was built, from the
+    // position of the statement whose arguments are being evaluated
+    return process_resolve_variable_expr(p, p->ap, resolved, varnames, num_names, mem, out);
 }
 
-static int eval_func_eval_call (void *user, NCD_string_id_t func_name_id, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out)
+static int eval_func_eval_call (void *user, NCD_string_id_t func_name_id, void const *resolved, NCDEvaluatorArgs args, NCDValMem *mem, NCDValRef *out)
 {
     struct process *p = user;
     struct statement *ps = &p->statements[p->ap];
     
-    struct NCDInterpFunction const *ifunc = NCDModuleIndex_FindFunction(&p->interp->mindex, func_name_id);
+    struct NCDInterpFunction const *ifunc = resolved;
+    ASSERT(ifunc == NCDModuleIndex_FindFunction(&p->interp->mindex, func_name_id))
+    
     if (!ifunc) {
         STATEMENT_LOG(ps, BLOG_ERROR, "unknown function: %s", NCDStringIndex_Value(&p->interp->string_index, func_name_id).ptr);
         return 0;
@@ -855,7 +911,7 @@ static int eval_func_eval_call (void *user, NCD_string_id_t func_name_id, NCDEva
 void process_advance (struct process *p)
 {
     process_assert_pointers(p);
-    ASSERT(p->ap == p->fp)
+    ASSERT(process_find_kill(p) == -1)
     ASSERT(!process_have_child(p))
     ASSERT(p->ap < p->num_statements)
     ASSERT(!p->error)
@@ -887,9 +943,10 @@ void process_advance (struct process *p)
             goto fail0;
         }
     } else {
-        // get object
+        // get object, from the statement found when the program was loaded
         NCDObject object;
-        if (!process_resolve_object_expr(p, p->ap, objnames, num_objnames, &object)) {
+        int obj_stmt = NCDInterpProcess_StatementObjStatement(p->iprocess, p->ap);
+        if (!process_resolve_object_expr(p, p->ap, obj_stmt, objnames, num_objnames, &object)) {
             goto fail0;
         }
         
@@ -937,11 +994,15 @@ void process_advance (struct process *p)
     // increment AP
     p->ap++;
     
-    // increment FP
-    p->fp++;
+    // update FP, statements after this one may have been kept
+    if (p->fp < p->ap) {
+        p->fp = p->ap;
+    }
     
     process_assert_pointers(p);
     
+    BMetrics_Count(BMETRICS_COUNTER_NCD_STATEMENTS, 1);
+    
     // initialize module instance
     NCDModuleInst_Init(&ps->inst, module, method_context, args, &p->interp->module_params);
     return;
@@ -963,7 +1024,9 @@ void process_wait_timer_handler (BSmallTimer *timer)
     ASSERT(!BSmallPending_IsSet(&p->work_job))
     
     // check if something happened that means we no longer need to retry
-    if (p->ap != p->fp || process_have_child(p) || p->ap == p->num_statements) {
+    if (process_find_kill(p) >= 0 || process_have_child(p) || p->ap == p->num_statements ||
+        p->statements[p->ap].inst.istate != SSTATE_FORGOTTEN
+    ) {
         return;
     }
     
@@ -974,13 +1037,12 @@ void process_wait_timer_handler (BSmallTimer *timer)
     process_advance(p);
 }
 
-int process_find_object (struct process *p, int pos, NCD_string_id_t name, NCDObject *out_object)
+int process_get_object (struct process *p, int i, NCD_string_id_t name, NCDObject *out_object)
 {
-    ASSERT(pos >= 0)
-    ASSERT(pos <= p->num_statements)
+    ASSERT(i >= -1)
+    ASSERT(i < p->num_statements)
     ASSERT(out_object)
     
-    int i = NCDInterpProcess_FindStatement(p->iprocess, pos, name);
     if (i >= 0) {
         struct statement *ps = &p->statements[i];
         ASSERT(i < p->num_statements)
@@ -1001,16 +1063,30 @@ int process_find_object (struct process *p, int pos, NCD_string_id_t name, NCDOb
     return 0;
 }
 
-int process_resolve_object_expr (struct process *p, int pos, const NCD_string_id_t *names, size_t num_names, NCDObject *out_object)
+int process_find_object (struct process *p, int pos, NCD_string_id_t name, NCDObject *out_object)
+{
+    ASSERT(pos >= 0)
+    ASSERT(pos <= p->num_statements)
+    ASSERT(out_object)
+    
+    int i = NCDInterpProcess_FindStatement(p->iprocess, pos, name);
+    
+    return process_get_object(p, i, name, out_object);
+}
+
+int process_resolve_object_expr (struct process *p, int pos, int stmt_index, const NCD_string_id_t *names, size_t num_names, NCDObject *out_object)
 {
     ASSERT(pos >= 0)
     ASSERT(pos <= p->num_statements)
+    ASSERT(stmt_index >= -1)
+    ASSERT(stmt_index < pos)
     ASSERT(names)
     ASSERT(num_names > 0)
+    ASSERT(stmt_index == NCDInterpProcess_FindStatement(p->iprocess, pos, names[0]))
     ASSERT(out_object)
     
     NCDObject object;
-    if (!process_find_object(p, pos, names[0], &object)) {
+    if (!process_get_object(p, stmt_index, names[0], &object)) {
         goto fail;
     }
     
@@ -1027,17 +1103,20 @@ fail:;
     return 0;
 }
 
-int process_resolve_variable_expr (struct process *p, int pos, const NCD_string_id_t *names, size_t num_names, NCDValMem *mem, NCDValRef *out_value)
+int process_resolve_variable_expr (struct process *p, int pos, int stmt_index, const NCD_string_id_t *names, size_t num_names, NCDValMem *mem, NCDValRef *out_value)
 {
     ASSERT(pos >= 0)
     ASSERT(pos <= p->num_statements)
+    ASSERT(stmt_index >= -1)
+    ASSERT(stmt_index < pos)
     ASSERT(names)
     ASSERT(num_names > 0)
+    ASSERT(stmt_index == NCDInterpProcess_FindStatement(p->iprocess, pos, names[0]))
     ASSERT(mem)
     ASSERT(out_value)
     
     NCDObject object;
-    if (!process_find_object(p, pos, names[0], &object)) {
+    if (!process_get_object(p, stmt_index, names[0], &object)) {
         goto fail;
     }
     
@@ -70,6 +70,7 @@ struct NCDInterpreter_params {
     
     // options
     btime_t retry_time;
+    int keep_on_backtrack;
     char **extra_args;
     int num_extra_args;
     
@@ -862,7 +862,8 @@ typedef int (*NCDModule_func_getobj) (void *o, NCD_string_id_t name, NCDObject *
  * Handler called when the module instance is in a clean state.
  * This means that all statements preceding it in the process are
  * up, this statement is down, and all following statements are
- * uninitialized. When a backend instance goes down, it is guaranteed,
+ * uninitialized, except for those kept according to
+ * NCDMODULE_FLAG_KEEP_ON_BACKTRACK. When a backend instance goes down, it is guaranteed,
  * as long as it stays down, that either this will be called or
  * termination will be requested with {@link NCDModule_func_die}.
  * The backend instance was in down state.
@@ -872,6 +873,7 @@ typedef int (*NCDModule_func_getobj) (void *o, NCD_string_id_t name, NCDObject *
 typedef void (*NCDModule_func_clean) (void *o);
 
 #define NCDMODULE_FLAG_CAN_RESOLVE_WHEN_DOWN (1 << 0)
+#define NCDMODULE_FLAG_KEEP_ON_BACKTRACK (1 << 1)
 
 /**
  * Structure encapsulating the implementation of a module backend.
@@ -933,6 +935,14 @@ struct NCDModule {
      *   Whether the interpreter is allowed to call func_getvar and func_getobj
      *   even when the backend instance is in down state (as opposed to just
      *   in up state.
+     * - NCDMODULE_FLAG_KEEP_ON_BACKTRACK
+     *   Whether an up backend instance may be kept alive when a preceding
+     *   statement goes down or dies and its arguments do not refer to that
+     *   statement or anything after it. Only honored if the interpreter
+     *   was started with keep_on_backtrack. Set this only if the instance
+     *   does not rely on preceding statements other than through its
+     *   arguments, and if its effect does not depend on the order in which
+     *   it is created relative to the statements that are recreated.
      */
     int flags;
     
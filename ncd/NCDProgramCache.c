@@ -0,0 +1,708 @@
+/**
+ * @file NCDProgramCache.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/expstring.h>
+#include <misc/read_file.h>
+#include <misc/write_file.h>
+#include <misc/read_write_int.h>
+#include <misc/concat_strings.h>
+#include <base/BLog.h>
+
+#include "NCDProgramCache.h"
+
+#include <generated/blog_channel_NCDProgramCache.h>
+
+// bump the last byte whenever the format changes
+#define CACHE_MAGIC "NCDPC\0\0\1"
+#define CACHE_MAGIC_LEN 8
+
+#define MAX_VALUE_DEPTH 1024
+
+struct reader {
+    const char *data;
+    size_t len;
+};
+
+static int read_bytes (struct reader *r, size_t len, const char **out)
+{
+    if (len > r->len) {
+        return 0;
+    }
+    
+    *out = r->data;
+    r->data += len;
+    r->len -= len;
+    return 1;
+}
+
+static int read_u8 (struct reader *r, uint8_t *out)
+{
+    const char *p;
+    if (!read_bytes(r, 1, &p)) {
+        return 0;
+    }
+    *out = badvpn_read_le8(p);
+    return 1;
+}
+
+static int read_u32 (struct reader *r, uint32_t *out)
+{
+    const char *p;
+    if (!read_bytes(r, 4, &p)) {
+        return 0;
+    }
+    *out = badvpn_read_le32(p);
+    return 1;
+}
+
+static int read_u64 (struct reader *r, uint64_t *out)
+{
+    const char *p;
+    if (!read_bytes(r, 8, &p)) {
+        return 0;
+    }
+    *out = badvpn_read_le64(p);
+    return 1;
+}
+
+static int read_bin (struct reader *r, const char **out_data, size_t *out_len)
+{
+    uint32_t len;
+    if (!read_u32(r, &len) || !read_bytes(r, len, out_data)) {
+        return 0;
+    }
+    *out_len = len;
+    return 1;
+}
+
+// reads a string into a malloc'd null-terminated buffer; an optional string
+// is stored with its length plus one, zero meaning NULL
+static int read_str (struct reader *r, int optional, char **out)
+{
+    uint32_t len;
+    if (!read_u32(r, &len)) {
+        return 0;
+    }
+    
+    if (optional) {
+        if (len == 0) {
+            *out = NULL;
+            return 1;
+        }
+        len--;
+    }
+    
+    const char *data;
+    if (!read_bytes(r, len, &data) || memchr(data, '\0', len)) {
+        return 0;
+    }
+    
+    if (!(*out = malloc((size_t)len + 1))) {
+        return 0;
+    }
+    memcpy(*out, data, len);
+    (*out)[len] = '\0';
+    
+    return 1;
+}
+
+static int read_value (struct reader *r, int depth, NCDValue *out)
+{
+    if (depth > MAX_VALUE_DEPTH) {
+        return 0;
+    }
+    
+    uint8_t type;
+    if (!read_u8(r, &type)) {
+        return 0;
+    }
+    
+    switch (type) {
+        case NCDVALUE_STRING: {
+            const char *data;
+            size_t len;
+            if (!read_bin(r, &data, &len)) {
+                return 0;
+            }
+            return NCDValue_InitStringBin(out, (const uint8_t *)data, len);
+        } break;
+        
+        case NCDVALUE_LIST: {
+            uint32_t count;
+            if (!read_u32(r, &count)) {
+                return 0;
+            }
+            
+            NCDValue_InitList(out);
+            
+            for (uint32_t j = 0; j < count; j++) {
+                NCDValue elem;
+                if (!read_value(r, depth + 1, &elem)) {
+                    goto fail_list;
+                }
+                if (!NCDValue_ListAppend(out, elem)) {
+                    NCDValue_Free(&elem);
+                    goto fail_list;
+                }
+            }
+            
+            return 1;
+            
+        fail_list:
+            NCDValue_Free(out);
+            return 0;
+        } break;
+        
+        case NCDVALUE_MAP: {
+            uint32_t count;
+            if (!read_u32(r, &count)) {
+                return 0;
+            }
+            
+            NCDValue_InitMap(out);
+            
+            // entries are stored last one first
+            for (uint32_t j = 0; j < count; j++) {
+                NCDValue key;
+                if (!read_value(r, depth + 1, &key)) {
+                    goto fail_map;
+                }
+                NCDValue val;
+                if (!read_value(r, depth + 1, &val)) {
+                    NCDValue_Free(&key);
+                    goto fail_map;
+                }
+                if (!NCDValue_MapPrepend(out, key, val)) {
+                    NCDValue_Free(&key);
+                    NCDValue_Free(&val);
+                    goto fail_map;
+                }
+            }
+            
+            return 1;
+            
+        fail_map:
+            NCDValue_Free(out);
+            return 0;
+        } break;
+        
+        case NCDVALUE_VAR: {
+            char *name;
+            if (!read_str(r, 0, &name)) {
+                return 0;
+            }
+            int res = NCDValue_InitVar(out, name);
+            free(name);
+            return res;
+        } break;
+        
+        case NCDVALUE_INVOC: {
+            NCDValue func;
+            if (!read_value(r, depth + 1, &func)) {
+                return 0;
+            }
+            NCDValue arg;
+            if (!read_value(r, depth + 1, &arg)) {
+                NCDValue_Free(&func);
+                return 0;
+            }
+            if (!NCDValue_InitInvoc(out, func, arg)) {
+                NCDValue_Free(&func);
+                NCDValue_Free(&arg);
+                return 0;
+            }
+            return 1;
+        } break;
+        
+        default:
+            return 0;
+    }
+}
+
+static int read_statement (struct reader *r, NCDStatement *out)
+{
+    char *name = NULL;
+    char *objname = NULL;
+    char *cmdname = NULL;
+    int res = 0;
+    
+    if (!read_str(r, 1, &name) || !read_str(r, 1, &objname) || !read_str(r, 0, &cmdname)) {
+        goto out;
+    }
+    
+    NCDValue args;
+    if (!read_value(r, 0, &args)) {
+        goto out;
+    }
+    
+    if (NCDValue_Type(&args) != NCDVALUE_LIST || !NCDStatement_InitReg(out, name, objname, cmdname, args)) {
+        NCDValue_Free(&args);
+        goto out;
+    }
+    
+    res = 1;
+    
+out:
+    free(cmdname);
+    free(objname);
+    free(name);
+    return res;
+}
+
+static int read_process (struct reader *r, NCDProcess *out)
+{
+    uint8_t is_template;
+    char *name;
+    if (!read_u8(r, &is_template) || !read_str(r, 0, &name)) {
+        return 0;
+    }
+    
+    uint32_t num_statements;
+    if (!read_u32(r, &num_statements)) {
+        goto fail0;
+    }
+    
+    NCDBlock block;
+    NCDBlock_Init(&block);
+    
+    NCDStatement *last = NULL;
+    
+    for (uint32_t j = 0; j < num_statements; j++) {
+        NCDStatement stmt;
+        if (!read_statement(r, &stmt)) {
+            goto fail1;
+        }
+        if (!NCDBlock_InsertStatementAfter(&block, last, stmt)) {
+            NCDStatement_Free(&stmt);
+            goto fail1;
+        }
+        last = (last ? NCDBlock_NextStatement(&block, last) : NCDBlock_FirstStatement(&block));
+    }
+    
+    if (!NCDProcess_Init(out, is_template, name, block)) {
+        goto fail1;
+    }
+    
+    free(name);
+    return 1;
+    
+fail1:
+    NCDBlock_Free(&block);
+fail0:
+    free(name);
+    return 0;
+}
+
+// checks that the source file is unchanged since the cache was written
+static int check_source (const char *path, uint64_t len, uint64_t hash)
+{
+    uint8_t *data;
+    size_t data_len;
+    if (!read_file(path, &data, &data_len)) {
+        BLog(BLOG_INFO, "file '%s': cannot read, not using cache", path);
+        return 0;
+    }
+    
+    int res = (data_len == len && NCDProgramCache_Hash(data, data_len) == hash);
+    free(data);
+    
+    if (!res) {
+        BLog(BLOG_INFO, "file '%s': changed, not using cache", path);
+    }
+    
+    return res;
+}
+
+static int decode_cache (struct reader *r, const char *file_path, NCDProgram *out_program)
+{
+    const char *magic;
+    if (!read_bytes(r, CACHE_MAGIC_LEN, &magic) || memcmp(magic, CACHE_MAGIC, CACHE_MAGIC_LEN)) {
+        BLog(BLOG_INFO, "unknown cache format");
+        return 0;
+    }
+    
+    uint32_t num_sources;
+    if (!read_u32(r, &num_sources) || num_sources == 0) {
+        goto corrupt;
+    }
+    
+    for (uint32_t j = 0; j < num_sources; j++) {
+        char *path;
+        uint64_t len;
+        uint64_t hash;
+        if (!read_str(r, 0, &path)) {
+            goto corrupt;
+        }
+        if (!read_u64(r, &len) || !read_u64(r, &hash)) {
+            free(path);
+            goto corrupt;
+        }
+        
+        if (j == 0 && strcmp(path, file_path)) {
+            BLog(BLOG_INFO, "cache was built for '%s', not using it", path);
+            free(path);
+            return 0;
+        }
+        
+        int res = check_source(path, len, hash);
+        free(path);
+        if (!res) {
+            return 0;
+        }
+    }
+    
+    uint32_t num_processes;
+    if (!read_u32(r, &num_processes)) {
+        goto corrupt;
+    }
+    
+    NCDProgram program;
+    NCDProgram_Init(&program);
+    
+    // processes are stored last one first
+    for (uint32_t j = 0; j < num_processes; j++) {
+        NCDProcess proc;
+        if (!read_process(r, &proc)) {
+            goto corrupt1;
+        }
+        
+        NCDProgramElem elem;
+        NCDProgramElem_InitProcess(&elem, proc);
+        
+        if (!NCDProgram_PrependElem(&program, elem)) {
+            NCDProgramElem_Free(&elem);
+            goto corrupt1;
+        }
+    }
+    
+    if (r->len != 0) {
+        goto corrupt1;
+    }
+    
+    *out_program = program;
+    return 1;
+    
+corrupt1:
+    NCDProgram_Free(&program);
+corrupt:
+    BLog(BLOG_WARNING, "cache is corrupt or out of memory");
+    return 0;
+}
+
+uint64_t NCDProgramCache_Hash (const uint8_t *data, size_t len)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    
+    for (size_t j = 0; j < len; j++) {
+        hash ^= data[j];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    
+    return hash;
+}
+
+int NCDProgramCache_Load (const char *cache_path, const char *file_path, NCDProgram *out_program)
+{
+    ASSERT(cache_path)
+    ASSERT(file_path)
+    ASSERT(out_program)
+    
+    int res = 0;
+    
+    int fd = open(cache_path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        BLog(BLOG_INFO, "cache '%s' does not exist", cache_path);
+        goto fail0;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0 || (uintmax_t)st.st_size > SIZE_MAX) {
+        BLog(BLOG_WARNING, "cache '%s': bad file", cache_path);
+        goto fail1;
+    }
+    
+    size_t size = st.st_size;
+    
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        BLog(BLOG_WARNING, "cache '%s': mmap failed", cache_path);
+        goto fail1;
+    }
+    
+    struct reader r;
+    r.data = map;
+    r.len = size;
+    
+    res = decode_cache(&r, file_path, out_program);
+    
+    munmap(map, size);
+fail1:
+    close(fd);
+fail0:
+    return res;
+}
+
+static int put_u8 (ExpString *s, uint8_t x)
+{
+    return ExpString_AppendByte(s, x);
+}
+
+static int put_u32 (ExpString *s, uint32_t x)
+{
+    char buf[4];
+    badvpn_write_le32(x, buf);
+    return ExpString_AppendBinary(s, (const uint8_t *)buf, sizeof(buf));
+}
+
+static int put_u64 (ExpString *s, uint64_t x)
+{
+    char buf[8];
+    badvpn_write_le64(x, buf);
+    return ExpString_AppendBinary(s, (const uint8_t *)buf, sizeof(buf));
+}
+
+static int put_bin (ExpString *s, const char *data, size_t len)
+{
+    return len <= UINT32_MAX && put_u32(s, len) && ExpString_AppendBinary(s, (const uint8_t *)data, len);
+}
+
+static int put_str (ExpString *s, int optional, const char *str)
+{
+    if (!str) {
+        ASSERT(optional)
+        return put_u32(s, 0);
+    }
+    
+    size_t len = strlen(str);
+    if (len >= UINT32_MAX) {
+        return 0;
+    }
+    
+    return put_u32(s, len + !!optional) && ExpString_AppendBinary(s, (const uint8_t *)str, len);
+}
+
+static int put_value (ExpString *s, NCDValue *v)
+{
+    if (!put_u8(s, NCDValue_Type(v))) {
+        return 0;
+    }
+    
+    switch (NCDValue_Type(v)) {
+        case NCDVALUE_STRING: {
+            return put_bin(s, NCDValue_StringValue(v), NCDValue_StringLength(v));
+        } break;
+        
+        case NCDVALUE_LIST: {
+            if (NCDValue_ListCount(v) > UINT32_MAX || !put_u32(s, NCDValue_ListCount(v))) {
+                return 0;
+            }
+            for (NCDValue *e = NCDValue_ListFirst(v); e; e = NCDValue_ListNext(v, e)) {
+                if (!put_value(s, e)) {
+                    return 0;
+                }
+            }
+            return 1;
+        } break;
+        
+        case NCDVALUE_MAP: {
+            size_t count = NCDValue_MapCount(v);
+            if (count > UINT32_MAX || !put_u32(s, count)) {
+                return 0;
+            }
+            
+            // the loader can only prepend, so write the entries in reverse
+            NCDValue **keys = BAllocArray(count, sizeof(keys[0]));
+            if (count > 0 && !keys) {
+                return 0;
+            }
+            size_t j = 0;
+            for (NCDValue *ek = NCDValue_MapFirstKey(v); ek; ek = NCDValue_MapNextKey(v, ek)) {
+                keys[j++] = ek;
+            }
+            
+            int res = 1;
+            while (res && j > 0) {
+                j--;
+                res = put_value(s, keys[j]) && put_value(s, NCDValue_MapKeyValue(v, keys[j]));
+            }
+            
+            BFree(keys);
+            return res;
+        } break;
+        
+        case NCDVALUE_VAR: {
+            return put_str(s, 0, NCDValue_VarName(v));
+        } break;
+        
+        case NCDVALUE_INVOC: {
+            return put_value(s, NCDValue_InvocFunc(v)) && put_value(s, NCDValue_InvocArg(v));
+        } break;
+        
+        default:
+            ASSERT(0);
+            return 0;
+    }
+}
+
+static int put_process (ExpString *s, NCDProcess *proc)
+{
+    NCDBlock *block = NCDProcess_Block(proc);
+    
+    if (NCDBlock_NumStatements(block) > UINT32_MAX ||
+        !put_u8(s, !!NCDProcess_IsTemplate(proc)) ||
+        !put_str(s, 0, NCDProcess_Name(proc)) ||
+        !put_u32(s, NCDBlock_NumStatements(block))
+    ) {
+        return 0;
+    }
+    
+    for (NCDStatement *stmt = NCDBlock_FirstStatement(block); stmt; stmt = NCDBlock_NextStatement(block, stmt)) {
+        if (NCDStatement_Type(stmt) != NCDSTATEMENT_REG) {
+            BLog(BLOG_ERROR, "program is not desugared");
+            return 0;
+        }
+        
+        if (!put_str(s, 1, NCDStatement_Name(stmt)) ||
+            !put_str(s, 1, NCDStatement_RegObjName(stmt)) ||
+            !put_str(s, 0, NCDStatement_RegCmdName(stmt)) ||
+            !put_value(s, NCDStatement_RegArgs(stmt))
+        ) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static int encode_cache (ExpString *s, const struct NCDProgramCache_source *sources, size_t num_sources, NCDProgram *program)
+{
+    if (!ExpString_AppendBinary(s, (const uint8_t *)CACHE_MAGIC, CACHE_MAGIC_LEN)) {
+        return 0;
+    }
+    
+    if (num_sources > UINT32_MAX || !put_u32(s, num_sources)) {
+        return 0;
+    }
+    
+    for (size_t j = 0; j < num_sources; j++) {
+        if (!put_str(s, 0, sources[j].path) || !put_u64(s, sources[j].len) || !put_u64(s, sources[j].hash)) {
+            return 0;
+        }
+    }
+    
+    size_t num_processes = NCDProgram_NumElems(program);
+    if (num_processes > UINT32_MAX || !put_u32(s, num_processes)) {
+        return 0;
+    }
+    
+    // the loader can only prepend, so write the processes in reverse
+    NCDProcess **procs = BAllocArray(num_processes, sizeof(procs[0]));
+    if (num_processes > 0 && !procs) {
+        return 0;
+    }
+    
+    size_t j = 0;
+    for (NCDProgramElem *elem = NCDProgram_FirstElem(program); elem; elem = NCDProgram_NextElem(program, elem)) {
+        if (NCDProgramElem_Type(elem) != NCDPROGRAMELEM_PROCESS) {
+            BLog(BLOG_ERROR, "program contains unresolved includes");
+            BFree(procs);
+            return 0;
+        }
+        procs[j++] = NCDProgramElem_Process(elem);
+    }
+    
+    int res = 1;
+    while (res && j > 0) {
+        j--;
+        res = put_process(s, procs[j]);
+    }
+    
+    BFree(procs);
+    return res;
+}
+
+int NCDProgramCache_Store (const char *cache_path, const struct NCDProgramCache_source *sources, size_t num_sources, NCDProgram *program)
+{
+    ASSERT(cache_path)
+    ASSERT(sources)
+    ASSERT(num_sources >= 1)
+    ASSERT(program)
+    
+    int res = 0;
+    
+    ExpString s;
+    if (!ExpString_Init(&s)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail0;
+    }
+    
+    if (!encode_cache(&s, sources, num_sources, program)) {
+        BLog(BLOG_ERROR, "failed to encode program");
+        goto fail1;
+    }
+    
+    char *tmp_path = concat_strings(2, cache_path, ".tmp");
+    if (!tmp_path) {
+        BLog(BLOG_ERROR, "concat_strings failed");
+        goto fail1;
+    }
+    
+    if (!write_file(tmp_path, ExpString_GetMr(&s))) {
+        BLog(BLOG_ERROR, "cache '%s': failed to write", tmp_path);
+        unlink(tmp_path);
+        goto fail2;
+    }
+    
+    if (rename(tmp_path, cache_path) < 0) {
+        BLog(BLOG_ERROR, "cache '%s': failed to rename into place", cache_path);
+        unlink(tmp_path);
+        goto fail2;
+    }
+    
+    res = 1;
+    
+fail2:
+    free(tmp_path);
+fail1:
+    ExpString_Free(&s);
+fail0:
+    return res;
+}
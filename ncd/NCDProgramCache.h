@@ -0,0 +1,79 @@
+/**
+ * @file NCDProgramCache.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NCD_PROGRAM_CACHE_H
+#define NCD_PROGRAM_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <ncd/NCDAst.h>
+
+/**
+ * Describes a source file which a cached program was built from.
+ */
+struct NCDProgramCache_source {
+    const char *path;
+    size_t len;
+    uint64_t hash;
+};
+
+/**
+ * Computes the hash of the contents of a source file, as recorded in
+ * and checked against program caches.
+ */
+uint64_t NCDProgramCache_Hash (const uint8_t *data, size_t len);
+
+/**
+ * Loads a program from a cache file written by {@link NCDProgramCache_Store}.
+ * The cache is only used if it was built with 'file_path' as the main file,
+ * and every recorded source file still has the same length and hash.
+ * 
+ * @param cache_path path to the cache file
+ * @param file_path path to the main file of the program
+ * @param out_program on success, *out_program will contain the program
+ * @return 1 on success, 0 if the cache is missing, stale or invalid
+ */
+int NCDProgramCache_Load (const char *cache_path, const char *file_path, NCDProgram *out_program) WARN_UNUSED;
+
+/**
+ * Writes a program to a cache file. The program must be desugared and
+ * must only contain process elements. The file is written to a temporary
+ * path first and then renamed over 'cache_path'.
+ * 
+ * @param cache_path path to the cache file
+ * @param sources source files the program was built from, the main file first
+ * @param num_sources number of source files, must be at least 1
+ * @param program the program to store
+ * @return 1 on success, 0 on failure
+ */
+int NCDProgramCache_Store (const char *cache_path, const struct NCDProgramCache_source *sources, size_t num_sources, NCDProgram *program) WARN_UNUSED;
+
+#endif
@@ -29,11 +29,13 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #include <misc/hashfun.h>
 #include <misc/strdup.h>
 #include <misc/array_length.h>
 #include <base/BLog.h>
+#include <base/BAllocStats.h>
 
 #include "NCDStringIndex.h"
 
@@ -49,65 +51,111 @@
 
 #include <generated/blog_channel_ncd.h>
 
+// The static strings get the first string IDs. Their entries point to the
+// table below and are not in the hash table; instead, a static string is
+// found with a perfect hash: the slot of a string in static_slots is the
+// top STATIC_SLOTS_BITS bits of its djb2 hash (truncated to 32 bits) times
+// STATIC_SLOTS_MULT. The hashes and static_slots are precomputed. After
+// changing the strings, recompute them and find an odd multiplier under
+// which no two strings share a slot; NCDStringIndex_Init asserts this.
+#define STATIC_SLOTS_BITS 6
+#define STATIC_SLOTS (1 << STATIC_SLOTS_BITS)
+#define STATIC_SLOTS_MULT UINT32_C(0xae94e387)
+
+struct static_string {
+    const char *str;
+    size_t len;
+    uint64_t hash;
+};
+
 // NOTE: keep synchronized with static_strings.h
-static const char *static_strings[] = {
-    "",
-    "_args",
-    "_arg0",
-    "_arg1",
-    "_arg2",
-    "_arg3",
-    "_arg4",
-    "_arg5",
-    "_arg6",
-    "_arg7",
-    "_arg8",
-    "_arg9",
-    "_arg10",
-    "_arg11",
-    "_arg12",
-    "_arg13",
-    "_arg14",
-    "_arg15",
-    "_arg16",
-    "_arg17",
-    "_arg18",
-    "_arg19",
-    "true",
-    "false",
-    "<none>",
-    "_caller",
-    "succeeded",
-    "is_error",
-    "not_eof",
-    "length",
-    "type",
-    "exit_status",
-    "size",
-    "eof",
-    "_scope",
+static const struct static_string static_strings[] = {
+    {"", 0, UINT64_C(0x0000000000001505)},
+    {"_args", 5, UINT64_C(0x000000310eed3b71)},
+    {"_arg0", 5, UINT64_C(0x000000310eed3b2e)},
+    {"_arg1", 5, UINT64_C(0x000000310eed3b2f)},
+    {"_arg2", 5, UINT64_C(0x000000310eed3b30)},
+    {"_arg3", 5, UINT64_C(0x000000310eed3b31)},
+    {"_arg4", 5, UINT64_C(0x000000310eed3b32)},
+    {"_arg5", 5, UINT64_C(0x000000310eed3b33)},
+    {"_arg6", 5, UINT64_C(0x000000310eed3b34)},
+    {"_arg7", 5, UINT64_C(0x000000310eed3b35)},
+    {"_arg8", 5, UINT64_C(0x000000310eed3b36)},
+    {"_arg9", 5, UINT64_C(0x000000310eed3b37)},
+    {"_arg10", 6, UINT64_C(0x00000652ec94a13f)},
+    {"_arg11", 6, UINT64_C(0x00000652ec94a140)},
+    {"_arg12", 6, UINT64_C(0x00000652ec94a141)},
+    {"_arg13", 6, UINT64_C(0x00000652ec94a142)},
+    {"_arg14", 6, UINT64_C(0x00000652ec94a143)},
+    {"_arg15", 6, UINT64_C(0x00000652ec94a144)},
+    {"_arg16", 6, UINT64_C(0x00000652ec94a145)},
+    {"_arg17", 6, UINT64_C(0x00000652ec94a146)},
+    {"_arg18", 6, UINT64_C(0x00000652ec94a147)},
+    {"_arg19", 6, UINT64_C(0x00000652ec94a148)},
+    {"true", 4, UINT64_C(0x000000017c9e9fe5)},
+    {"false", 5, UINT64_C(0x000000310f6bcef0)},
+    {"<none>", 6, UINT64_C(0x000006529bd9d12f)},
+    {"_caller", 7, UINT64_C(0x0000d0b082a339f7)},
+    {"succeeded", 9, UINT64_C(0x0377d923f32a91ca)},
+    {"is_error", 8, UINT64_C(0x001ae728dc1b1a8a)},
+    {"not_eof", 7, UINT64_C(0x0000d0b5229b44ef)},
+    {"length", 6, UINT64_C(0x000006530b2deac7)},
+    {"type", 4, UINT64_C(0x000000017c9ebd07)},
+    {"exit_status", 11, UINT64_C(0xc0870b67e8583582)},
+    {"size", 4, UINT64_C(0x000000017c9dede0)},
+    {"eof", 3, UINT64_C(0x000000000b886f3f)},
+    {"_scope", 6, UINT64_C(0x00000652edd24afe)},
 };
 
-static NCD_string_id_t do_get (NCDStringIndex *o, const char *str, size_t str_len)
+static const int8_t static_slots[STATIC_SLOTS] = {
+    17, 25, 31, 20, 4, -1, -1, 7, -1, -1, 10, -1, 33, 24, 28, 27,
+    -1, 13, -1, -1, 16, -1, -1, 19, 3, 1, -1, 6, -1, 22, 9, 23,
+    30, 32, -1, 26, -1, 12, 29, 0, 15, -1, -1, 18, -1, 2, 21, -1,
+    5, -1, -1, 8, -1, -1, 11, -1, 34, -1, -1, -1, -1, 14, -1, -1,
+};
+
+static int static_slot (size_t hash)
 {
-    ASSERT(str)
+    return (uint32_t)((uint32_t)hash * STATIC_SLOTS_MULT) >> (32 - STATIC_SLOTS_BITS);
+}
+
+static NCD_string_id_t lookup (NCDStringIndex *o, const char *str, size_t str_len, size_t hash)
+{
+    int static_id = static_slots[static_slot(hash)];
+    if (static_id >= 0 && static_strings[static_id].len == str_len && !memcmp(static_strings[static_id].str, str, str_len)) {
+        return static_id;
+    }
     
-    NCDStringIndex_hash_key key = {str, str_len};
+    NCDStringIndex_hash_key key = {str, str_len, hash};
     NCDStringIndex__HashRef ref = NCDStringIndex__Hash_Lookup(&o->hash, o->entries, key);
-    ASSERT(ref.link == -1 || ref.link >= 0)
+    ASSERT(ref.link == -1 || ref.link >= (NCD_string_id_t)B_ARRAY_LENGTH(static_strings))
     ASSERT(ref.link == -1 || ref.link < o->entries_size)
     ASSERT(ref.link == -1 || (ref.ptr->str_len == str_len && !memcmp(ref.ptr->str, str, str_len)))
     
-    if (ref.link != -1) {
-        return ref.link;
+    return ref.link;
+}
+
+static NCD_string_id_t do_get (NCDStringIndex *o, const char *str, size_t str_len)
+{
+    ASSERT(str)
+    
+    size_t hash = badvpn_djb2_hash_bin((const uint8_t *)str, str_len);
+    
+    NCD_string_id_t id = lookup(o, str, str_len, hash);
+    if (id >= 0) {
+        return id;
     }
     
     if (o->entries_size == o->entries_capacity) {
+        NCD_string_id_t old_capacity = o->entries_capacity;
+        
         if (!Array_DoubleUp(o)) {
             BLog(BLOG_ERROR, "Array_DoubleUp failed");
             return -1;
         }
         
+        BAllocStats_Add(BALLOCSTATS_STRINGINDEX, (size_t)(o->entries_capacity - old_capacity) * sizeof(o->entries[0]));
+        
         if (!NCDStringIndex__Hash_MultiplyBuckets(&o->hash, o->entries, 1)) {
             BLog(BLOG_ERROR, "NCDStringIndex__Hash_MultiplyBuckets failed");
             return -1;
@@ -122,8 +170,10 @@ static NCD_string_id_t do_get (NCDStringIndex *o, const char *str, size_t str_le
         BLog(BLOG_ERROR, "b_strdup_bin failed");
         return -1;
     }
+    BAllocStats_Add(BALLOCSTATS_STRINGINDEX, str_len + 1);
     entry->str_len = str_len;
     entry->has_nulls = !!memchr(str, '\0', str_len);
+    entry->hash = hash;
     
     NCDStringIndex__HashRef newref = {entry, o->entries_size};
     int res = NCDStringIndex__Hash_Insert(&o->hash, o->entries, newref, NULL);
@@ -146,20 +196,27 @@ int NCDStringIndex_Init (NCDStringIndex *o)
         goto fail1;
     }
     
+    // the static strings are set up without copying or hashing
+    ASSERT(B_ARRAY_LENGTH(static_strings) <= NCDSTRINGINDEX_INITIAL_CAPACITY)
     for (size_t i = 0; i < B_ARRAY_LENGTH(static_strings); i++) {
-        if (do_get(o, static_strings[i], strlen(static_strings[i])) < 0) {
-            goto fail2;
-        }
+        const struct static_string *ss = &static_strings[i];
+        ASSERT(ss->len == strlen(ss->str))
+        ASSERT((size_t)ss->hash == badvpn_djb2_hash_bin((const uint8_t *)ss->str, ss->len))
+        ASSERT(static_slots[static_slot(ss->hash)] == (int)i)
+        
+        struct NCDStringIndex__entry *entry = &o->entries[i];
+        entry->str = (char *)ss->str;
+        entry->str_len = ss->len;
+        entry->has_nulls = 0;
+        entry->hash = ss->hash;
     }
+    o->entries_size = B_ARRAY_LENGTH(static_strings);
+    
+    BAllocStats_Add(BALLOCSTATS_STRINGINDEX, (size_t)o->entries_capacity * sizeof(o->entries[0]));
     
     DebugObject_Init(&o->d_obj);
     return 1;
     
-fail2:
-    for (NCD_string_id_t i = 0; i < o->entries_size; i++) {
-        free(o->entries[i].str);
-    }
-    NCDStringIndex__Hash_Free(&o->hash);
 fail1:
     Array_Free(o);
 fail0:
@@ -170,10 +227,13 @@ void NCDStringIndex_Free (NCDStringIndex *o)
 {
     DebugObject_Free(&o->d_obj);
     
-    for (NCD_string_id_t i = 0; i < o->entries_size; i++) {
+    for (NCD_string_id_t i = B_ARRAY_LENGTH(static_strings); i < o->entries_size; i++) {
+        BAllocStats_Remove(BALLOCSTATS_STRINGINDEX, o->entries[i].str_len + 1);
         free(o->entries[i].str);
     }
     
+    BAllocStats_Remove(BALLOCSTATS_STRINGINDEX, (size_t)o->entries_capacity * sizeof(o->entries[0]));
+    
     NCDStringIndex__Hash_Free(&o->hash);
     Array_Free(o);
 }
@@ -191,13 +251,7 @@ NCD_string_id_t NCDStringIndex_LookupBin (NCDStringIndex *o, const char *str, si
     DebugObject_Access(&o->d_obj);
     ASSERT(str)
     
-    NCDStringIndex_hash_key key = {str, str_len};
-    NCDStringIndex__HashRef ref = NCDStringIndex__Hash_Lookup(&o->hash, o->entries, key);
-    ASSERT(ref.link == -1 || ref.link >= 0)
-    ASSERT(ref.link == -1 || ref.link < o->entries_size)
-    ASSERT(ref.link == -1 || (ref.ptr->str_len == str_len && !memcmp(ref.ptr->str, str, str_len)))
-    
-    return ref.link;
+    return lookup(o, str, str_len, badvpn_djb2_hash_bin((const uint8_t *)str, str_len));
 }
 
 NCD_string_id_t NCDStringIndex_Get (NCDStringIndex *o, const char *str)
@@ -241,6 +295,16 @@ int NCDStringIndex_HasNulls (NCDStringIndex *o, NCD_string_id_t id)
     return o->entries[id].has_nulls;
 }
 
+size_t NCDStringIndex_Hash (NCDStringIndex *o, NCD_string_id_t id)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(id >= 0)
+    ASSERT(id < o->entries_size)
+    ASSERT(o->entries[id].str)
+    
+    return o->entries[id].hash;
+}
+
 int NCDStringIndex_GetRequests (NCDStringIndex *o, struct NCD_string_request *requests)
 {
     DebugObject_Access(&o->d_obj);
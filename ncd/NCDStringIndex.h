@@ -48,10 +48,11 @@ struct NCDStringIndex__entry {
     char *str;
     size_t str_len;
     int has_nulls;
+    size_t hash;
     NCD_string_id_t hash_next;
 };
 
-typedef struct { const char *str; size_t len; } NCDStringIndex_hash_key;
+typedef struct { const char *str; size_t len; size_t hash; } NCDStringIndex_hash_key;
 typedef struct NCDStringIndex__entry *NCDStringIndex_hash_arg;
 
 #include "NCDStringIndex_hash.h"
@@ -79,6 +80,7 @@ NCD_string_id_t NCDStringIndex_GetBin (NCDStringIndex *o, const char *str, size_
 NCD_string_id_t NCDStringIndex_GetBinMr (NCDStringIndex *o, MemRef str);
 MemRef NCDStringIndex_Value (NCDStringIndex *o, NCD_string_id_t id);
 int NCDStringIndex_HasNulls (NCDStringIndex *o, NCD_string_id_t id);
+size_t NCDStringIndex_Hash (NCDStringIndex *o, NCD_string_id_t id);
 int NCDStringIndex_GetRequests (NCDStringIndex *o, struct NCD_string_request *requests) WARN_UNUSED;
 
 #endif
@@ -42,6 +42,7 @@ static int add_template (struct desugar_state *state, NCDBlock block, NCDValue *
 static int desugar_block (struct desugar_state *state, NCDBlock *block);
 static int desugar_if (struct desugar_state *state, NCDBlock *block, NCDStatement *stmt, NCDStatement **out_next);
 static int desugar_do (struct desugar_state *state, NCDBlock *block, NCDStatement *stmt, NCDStatement **out_next);
+static int desugar_parallel (struct desugar_state *state, NCDBlock *block, NCDStatement *stmt, NCDStatement **out_next);
 static int desugar_foreach (struct desugar_state *state, NCDBlock *block, NCDStatement *stmt, NCDStatement **out_next);
 static int desugar_blockstmt (struct desugar_state *state, NCDBlock *block, NCDStatement *stmt, NCDStatement **out_next);
 
@@ -95,6 +96,8 @@ static int desugar_block (struct desugar_state *state, NCDBlock *block)
                     res = desugar_if(state, block, stmt, &stmt);
                 } else if (iftype == NCDIFTYPE_DO) {
                     res = desugar_do(state, block, stmt, &stmt);
+                } else if (iftype == NCDIFTYPE_PARALLEL) {
+                    res = desugar_parallel(state, block, stmt, &stmt);
                 }
                 
                 if (!res) {
@@ -254,6 +257,61 @@ fail1:
     return 0;
 }
 
+static int desugar_parallel (struct desugar_state *state, NCDBlock *block, NCDStatement *stmt, NCDStatement **out_next)
+{
+    ASSERT(NCDStatement_Type(stmt) == NCDSTATEMENT_IF)
+    ASSERT(NCDStatement_IfType(stmt) == NCDIFTYPE_PARALLEL)
+    
+    NCDIfBlock *ifblock = NCDStatement_IfBlock(stmt);
+    
+    NCDIf the_if = NCDIfBlock_GrabIf(ifblock, NCDIfBlock_FirstIf(ifblock));
+    NCDBlock par_block = NCDIf_FreeGrabBlock(&the_if);
+    
+    NCDValue stmt_args;
+    NCDValue_InitList(&stmt_args);
+    
+    // every statement becomes a template of its own
+    NCDStatement *par_stmt;
+    while (par_stmt = NCDBlock_FirstStatement(&par_block)) {
+        NCDStatement branch_stmt = NCDBlock_GrabStatement(&par_block, par_stmt);
+        
+        NCDBlock branch_block;
+        NCDBlock_Init(&branch_block);
+        
+        if (!NCDBlock_PrependStatement(&branch_block, branch_stmt)) {
+            NCDStatement_Free(&branch_stmt);
+            goto fail1;
+        }
+        
+        NCDValue action_arg;
+        if (!add_template(state, branch_block, &action_arg)) {
+            goto fail1;
+        }
+        
+        if (!NCDValue_ListAppend(&stmt_args, action_arg)) {
+            NCDValue_Free(&action_arg);
+            goto fail1;
+        }
+    }
+    
+    NCDStatement new_stmt;
+    if (!NCDStatement_InitReg(&new_stmt, NCDStatement_Name(stmt), NULL, "parallel", stmt_args)) {
+        goto fail1;
+    }
+    
+    NCDBlock_Free(&par_block);
+    
+    stmt = NCDBlock_ReplaceStatement(block, stmt, new_stmt);
+    
+    *out_next = NCDBlock_NextStatement(block, stmt);
+    return 1;
+    
+fail1:
+    NCDValue_Free(&stmt_args);
+    NCDBlock_Free(&par_block);
+    return 0;
+}
+
 static int desugar_foreach (struct desugar_state *state, NCDBlock *block, NCDStatement *stmt, NCDStatement **out_next)
 {
     ASSERT(NCDStatement_Type(stmt) == NCDSTATEMENT_FOREACH)
@@ -36,8 +36,11 @@
 #include <misc/balloc.h>
 #include <misc/strdup.h>
 #include <misc/offset.h>
+#include <misc/hashfun.h>
 #include <structure/CAvl.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
+#include <base/BAllocStats.h>
 
 #include "NCDVal.h"
 
@@ -45,6 +48,8 @@
 
 #define NCDVAL_FIRST_SIZE 256
 #define NCDVAL_MAX_DEPTH 32
+#define NCDVAL_MAP_HASH_MIN_COUNT 16
+#define NCDVAL_COMPACT_RATIO 2
 
 #define TYPE_MASK_EXTERNAL_TYPE ((1 << 3) - 1)
 #define TYPE_MASK_INTERNAL_TYPE ((1 << 5) - 1)
@@ -102,10 +107,15 @@ typedef NCDValMem *NCDVal__maptree_arg;
 #include "NCDVal_maptree.h"
 #include <structure/CAvl_decl.h>
 
+// Maps with space for at least NCDVAL_MAP_HASH_MIN_COUNT elements also have
+// a hash index for finding keys, following the elements: a chain link for
+// each element, then the buckets. Both hold element positions, so the index
+// survives copying of the memory object. The tree still provides ordering.
 struct NCDVal__map {
     int type;
     NCDVal__idx maxcount;
     NCDVal__idx count;
+    NCDVal__idx hash_mask;
     NCDVal__MapTree tree;
     struct NCDVal__mapelem elems[];
 };
@@ -168,6 +178,22 @@ static int bump_depth (int *type_ptr, int elem_depth)
     return 1;
 }
 
+// Allocated buffers are preceded by this header. A buffer is shared by
+// all memory objects copied from each other with NCDValMem_InitCopy until
+// one of them is modified, and it owns the references to the targets of
+// the external strings within it.
+union NCDVal__bufhdr {
+    size_t refcnt;
+    bmax_align_t align_max;
+};
+
+static union NCDVal__bufhdr * buffer_hdr (NCDValMem *o)
+{
+    ASSERT(o->size != NCDVAL_FASTBUF_SIZE)
+    
+    return (union NCDVal__bufhdr *)o->allocd_buf - 1;
+}
+
 static void * buffer_at (NCDValMem *o, NCDVal__idx idx)
 {
     ASSERT(idx >= 0)
@@ -176,8 +202,90 @@ static void * buffer_at (NCDValMem *o, NCDVal__idx idx)
     return ((o->size == NCDVAL_FASTBUF_SIZE) ? o->fastbuf : o->allocd_buf) + idx;
 }
 
+static char * buffer_new (NCDVal__idx size)
+{
+    union NCDVal__bufhdr *hdr = BAllocStats_Alloc(BALLOCSTATS_NCDVALMEM, sizeof(*hdr) + (size_t)size);
+    if (!hdr) {
+        return NULL;
+    }
+    
+    BMetrics_Count(BMETRICS_COUNTER_NCDVAL_ALLOCS, 1);
+    
+    hdr->refcnt = 1;
+    
+    return (char *)(hdr + 1);
+}
+
+static int take_refs (NCDValMem *o)
+{
+    NCDVal__idx refidx = o->first_ref;
+    while (refidx != -1) {
+        struct NCDVal__ref *ref = buffer_at(o, refidx);
+        ASSERT(ref->target)
+        if (!BRefTarget_Ref(ref->target)) {
+            goto fail;
+        }
+        refidx = ref->next;
+    }
+    
+    return 1;
+    
+fail:;
+    NCDVal__idx undo_refidx = o->first_ref;
+    while (undo_refidx != refidx) {
+        struct NCDVal__ref *ref = buffer_at(o, undo_refidx);
+        BRefTarget_Deref(ref->target);
+        undo_refidx = ref->next;
+    }
+    return 0;
+}
+
+static void drop_refs (NCDValMem *o)
+{
+    NCDVal__idx refidx = o->first_ref;
+    while (refidx != -1) {
+        struct NCDVal__ref *ref = buffer_at(o, refidx);
+        ASSERT(ref->target)
+        BRefTarget_Deref(ref->target);
+        refidx = ref->next;
+    }
+}
+
+static int buffer_unshare (NCDValMem *o)
+{
+    if (o->size == NCDVAL_FASTBUF_SIZE || buffer_hdr(o)->refcnt == 1) {
+        return 1;
+    }
+    
+    char *newbuf = buffer_new(o->size);
+    if (!newbuf) {
+        goto fail0;
+    }
+    
+    // the new buffer needs its own references to the external strings
+    if (!take_refs(o)) {
+        goto fail1;
+    }
+    
+    memcpy(newbuf, o->allocd_buf, o->used);
+    
+    buffer_hdr(o)->refcnt--;
+    o->allocd_buf = newbuf;
+    
+    return 1;
+    
+fail1:
+    BAllocStats_Free((union NCDVal__bufhdr *)newbuf - 1);
+fail0:
+    return 0;
+}
+
 static NCDVal__idx buffer_allocate (NCDValMem *o, NCDVal__idx alloc_size, NCDVal__idx align)
 {
+    if (!buffer_unshare(o)) {
+        return -1;
+    }
+    
     NCDVal__idx mod = o->used % align;
     NCDVal__idx align_extra = mod ? (align - mod) : 0;
     
@@ -198,16 +306,18 @@ static NCDVal__idx buffer_allocate (NCDValMem *o, NCDVal__idx alloc_size, NCDVal
         char *newbuf;
         
         if (o->size == NCDVAL_FASTBUF_SIZE) {
-            newbuf = malloc(newsize);
+            newbuf = buffer_new(newsize);
             if (!newbuf) {
                 return -1;
             }
             memcpy(newbuf, o->fastbuf, o->used);
         } else {
-            newbuf = realloc(o->allocd_buf, newsize);
-            if (!newbuf) {
+            union NCDVal__bufhdr *hdr = BAllocStats_Realloc(buffer_hdr(o), sizeof(*hdr) + (size_t)newsize);
+            if (!hdr) {
                 return -1;
             }
+            BMetrics_Count(BMETRICS_COUNTER_NCDVAL_ALLOCS, 1);
+            newbuf = (char *)(hdr + 1);
         }
         
         o->size = newsize;
@@ -283,7 +393,9 @@ static void assert_val_only (NCDValMem *mem, NCDVal__idx idx)
             ASSERT(map_e->maxcount >= 0)
             ASSERT(map_e->count >= 0)
             ASSERT(map_e->count <= map_e->maxcount)
-            ASSERT(idx + sizeof(struct NCDVal__map) + map_e->maxcount * sizeof(struct NCDVal__mapelem) <= mem->used)
+            ASSERT(map_e->hash_mask == -1 || map_e->hash_mask >= 0)
+            ASSERT(idx + sizeof(struct NCDVal__map) + map_e->maxcount * sizeof(struct NCDVal__mapelem) +
+                   (map_e->hash_mask < 0 ? 0 : (map_e->maxcount + map_e->hash_mask + 1) * sizeof(NCDVal__idx)) <= mem->used)
         } break;
         case IDSTRING_TYPE: {
             ASSERT(idx + sizeof(struct NCDVal__idstring) <= mem->used)
@@ -322,7 +434,7 @@ static void assert_map_elem_only (NCDValRef map, NCDVal__idx elemidx)
     struct NCDVal__map *map_e = buffer_at(map.mem, map.idx);
     ASSERT(elemidx >= map.idx + offsetof(struct NCDVal__map, elems))
     ASSERT(elemidx < map.idx + offsetof(struct NCDVal__map, elems) + map_e->count * sizeof(struct NCDVal__mapelem))
-
+    
     struct NCDVal__mapelem *me_e = buffer_at(map.mem, elemidx);
     assert_val_only(map.mem, me_e->key_idx);
     assert_val_only(map.mem, me_e->val_idx);
@@ -340,6 +452,92 @@ static NCDVal__idx make_map_elem_idx (NCDVal__idx mapidx, NCDVal__idx pos)
     return mapidx + offsetof(struct NCDVal__map, elems) + pos * sizeof(struct NCDVal__mapelem);
 }
 
+static NCDVal__idx * map_hash_chain (struct NCDVal__map *map_e)
+{
+    ASSERT(map_e->hash_mask >= 0)
+    
+    return (NCDVal__idx *)&map_e->elems[map_e->maxcount];
+}
+
+static NCDVal__idx * map_hash_buckets (struct NCDVal__map *map_e)
+{
+    ASSERT(map_e->hash_mask >= 0)
+    
+    return map_hash_chain(map_e) + map_e->maxcount;
+}
+
+static size_t map_hash_key (NCDValRef key)
+{
+    // other keys all land in one bucket; equality is decided by
+    // NCDVal_Compare, the hash only has to agree with it
+    if (key.idx < 0 || NCDVal_Type(key) != NCDVAL_STRING) {
+        return 0;
+    }
+    
+    int *type_ptr = buffer_at(key.mem, key.idx);
+    
+    // interned strings have their hash computed already
+    if (get_internal_type(*type_ptr) == IDSTRING_TYPE) {
+        struct NCDVal__idstring *ids_e = (struct NCDVal__idstring *)type_ptr;
+        return NCDStringIndex_Hash(key.mem->string_index, ids_e->string_id);
+    }
+    
+    return badvpn_djb2_hash_bin((const uint8_t *)NCDVal_StringData(key), NCDVal_StringLength(key));
+}
+
+static void map_hash_link (struct NCDVal__map *map_e, NCDVal__idx pos, size_t hash)
+{
+    ASSERT(pos >= 0)
+    ASSERT(pos < map_e->maxcount)
+    
+    NCDVal__idx *chain = map_hash_chain(map_e);
+    NCDVal__idx *bucket = &map_hash_buckets(map_e)[hash & map_e->hash_mask];
+    
+    chain[pos] = *bucket;
+    *bucket = pos;
+}
+
+static void map_hash_unlink (struct NCDVal__map *map_e, NCDVal__idx pos)
+{
+    ASSERT(pos >= 0)
+    ASSERT(pos < map_e->count)
+    
+    NCDVal__idx *chain = map_hash_chain(map_e);
+    NCDVal__idx *buckets = map_hash_buckets(map_e);
+    
+    // the key may have changed since the element was linked, so we don't
+    // know its bucket; this only happens when placeholders are replaced
+    for (NCDVal__idx b = 0; b <= map_e->hash_mask; b++) {
+        for (NCDVal__idx *link = &buckets[b]; *link != -1; link = &chain[*link]) {
+            if (*link == pos) {
+                *link = chain[pos];
+                return;
+            }
+        }
+    }
+    
+    ASSERT(0)
+}
+
+static NCDVal__idx map_hash_lookup (NCDValRef map, struct NCDVal__map *map_e, NCDValRef key)
+{
+    NCDVal__idx *chain = map_hash_chain(map_e);
+    NCDVal__idx pos = map_hash_buckets(map_e)[map_hash_key(key) & map_e->hash_mask];
+    
+    while (pos != -1) {
+        ASSERT(pos >= 0)
+        ASSERT(pos < map_e->count)
+        
+        if (NCDVal_Compare(key, make_ref(map.mem, map_e->elems[pos].key_idx)) == 0) {
+            return make_map_elem_idx(map.idx, pos);
+        }
+        
+        pos = chain[pos];
+    }
+    
+    return -1;
+}
+
 static int get_val_depth (NCDValRef val)
 {
     ASSERT(val.idx != -1)
@@ -366,6 +564,63 @@ static void register_ref (NCDValMem *o, NCDVal__idx refidx, struct NCDVal__ref *
     o->first_ref = refidx;
 }
 
+// adds the space a copy of the value would take to *size, returning 0
+// as soon as the total exceeds limit
+static int add_live_size (NCDValMem *o, NCDVal__idx idx, size_t *size, size_t limit)
+{
+    // placeholders take no space
+    if (idx < 0) {
+        return 1;
+    }
+    
+    void *ptr = buffer_at(o, idx);
+    
+    switch (get_internal_type(*(int *)ptr)) {
+        case STOREDSTRING_TYPE: {
+            struct NCDVal__string *str_e = ptr;
+            *size += sizeof(struct NCDVal__string) + (size_t)str_e->length + 1;
+        } break;
+        
+        case IDSTRING_TYPE: {
+            *size += sizeof(struct NCDVal__idstring);
+        } break;
+        
+        case EXTERNALSTRING_TYPE: {
+            *size += sizeof(struct NCDVal__externalstring);
+        } break;
+        
+        case NCDVAL_LIST: {
+            struct NCDVal__list *list_e = ptr;
+            *size += sizeof(struct NCDVal__list) + (size_t)list_e->maxcount * sizeof(NCDVal__idx);
+            
+            for (NCDVal__idx i = 0; i < list_e->count; i++) {
+                if (*size > limit || !add_live_size(o, list_e->elem_indices[i], size, limit)) {
+                    return 0;
+                }
+            }
+        } break;
+        
+        case NCDVAL_MAP: {
+            // copies of maps are sized for the elements they actually have
+            struct NCDVal__map *map_e = ptr;
+            *size += sizeof(struct NCDVal__map) + (size_t)map_e->count * sizeof(struct NCDVal__mapelem);
+            
+            for (NCDVal__idx i = 0; i < map_e->count; i++) {
+                if (*size > limit ||
+                    !add_live_size(o, map_e->elems[i].key_idx, size, limit) ||
+                    !add_live_size(o, map_e->elems[i].val_idx, size, limit)
+                ) {
+                    return 0;
+                }
+            }
+        } break;
+        
+        default: ASSERT(0);
+    }
+    
+    return (*size <= limit);
+}
+
 #include "NCDVal_maptree.h"
 #include <structure/CAvl_impl.h>
 
@@ -383,16 +638,16 @@ void NCDValMem_Free (NCDValMem *o)
 {
     assert_mem(o);
     
-    NCDVal__idx refidx = o->first_ref;
-    while (refidx != -1) {
-        struct NCDVal__ref *ref = buffer_at(o, refidx);
-        ASSERT(ref->target)
-        BRefTarget_Deref(ref->target);
-        refidx = ref->next;
-    }
-    
-    if (o->size != NCDVAL_FASTBUF_SIZE) {
-        BFree(o->allocd_buf);
+    if (o->size == NCDVAL_FASTBUF_SIZE) {
+        drop_refs(o);
+    } else {
+        union NCDVal__bufhdr *hdr = buffer_hdr(o);
+        ASSERT(hdr->refcnt > 0)
+        if (--hdr->refcnt == 0) {
+            BMetrics_Observe(BMETRICS_HISTOGRAM_NCDVAL_MEM_BYTES, o->size);
+            drop_refs(o);
+            BAllocStats_Free(hdr);
+        }
     }
 }
 
@@ -407,36 +662,72 @@ int NCDValMem_InitCopy (NCDValMem *o, NCDValMem *other)
     
     if (other->size == NCDVAL_FASTBUF_SIZE) {
         memcpy(o->fastbuf, other->fastbuf, other->used);
+        if (!take_refs(o)) {
+            return 0;
+        }
     } else {
-        o->allocd_buf = BAlloc(other->size);
-        if (!o->allocd_buf) {
-            goto fail0;
+        // share the buffer, it is copied when one of the objects is modified
+        o->allocd_buf = other->allocd_buf;
+        buffer_hdr(o)->refcnt++;
+    }
+    
+    return 1;
+}
+
+int NCDValMem_Compact (NCDValMem *o, NCDValSafeRef *roots, size_t num_roots)
+{
+    assert_mem(o);
+    ASSERT(roots || num_roots == 0)
+    
+    // values in the fast buffer take no memory of their own
+    if (o->size == NCDVAL_FASTBUF_SIZE) {
+        return 1;
+    }
+    
+    // compact only if most of the used space is dead
+    size_t limit = o->used / NCDVAL_COMPACT_RATIO;
+    size_t live = 0;
+    for (size_t i = 0; i < num_roots; i++) {
+        if (!add_live_size(o, roots[i].idx, &live, limit)) {
+            return 1;
         }
-        memcpy(o->allocd_buf, other->allocd_buf, other->used);
     }
     
-    NCDVal__idx refidx = o->first_ref;
-    while (refidx != -1) {
-        struct NCDVal__ref *ref = buffer_at(o, refidx);
-        ASSERT(ref->target)
-        if (!BRefTarget_Ref(ref->target)) {
+    NCDVal__idx *new_indices = BAllocArray(num_roots, sizeof(new_indices[0]));
+    if (num_roots > 0 && !new_indices) {
+        goto fail0;
+    }
+    
+    NCDValMem newmem;
+    NCDValMem_Init(&newmem, o->string_index);
+    
+    for (size_t i = 0; i < num_roots; i++) {
+        if (roots[i].idx < 0) {
+            new_indices[i] = roots[i].idx;
+            continue;
+        }
+        
+        NCDValRef copy = NCDVal_NewCopy(&newmem, make_ref(o, roots[i].idx));
+        if (NCDVal_IsInvalid(copy)) {
             goto fail1;
         }
-        refidx = ref->next;
+        
+        new_indices[i] = copy.idx;
     }
     
-    return 1;
+    NCDValMem_Free(o);
+    *o = newmem;
     
-fail1:;
-    NCDVal__idx undo_refidx = o->first_ref;
-    while (undo_refidx != refidx) {
-        struct NCDVal__ref *ref = buffer_at(o, undo_refidx);
-        BRefTarget_Deref(ref->target);
-        undo_refidx = ref->next;
-    }
-    if (other->size != NCDVAL_FASTBUF_SIZE) {
-        BFree(o->allocd_buf);
+    for (size_t i = 0; i < num_roots; i++) {
+        roots[i].idx = new_indices[i];
     }
+    
+    BFree(new_indices);
+    return 1;
+    
+fail1:
+    NCDValMem_Free(&newmem);
+    BFree(new_indices);
 fail0:
     return 0;
 }
@@ -1194,6 +1485,10 @@ int NCDVal_ListAppend (NCDValRef list, NCDValRef elem)
     ASSERT(elem.mem == list.mem)
     assert_val_only(list.mem, elem.idx);
     
+    if (!buffer_unshare(list.mem)) {
+        return 0;
+    }
+    
     struct NCDVal__list *list_e = buffer_at(list.mem, list.idx);
     
     int new_type = list_e->type;
@@ -1327,6 +1622,18 @@ NCDValRef NCDVal_NewMap (NCDValMem *mem, size_t maxcount)
     }
     
     NCDVal__idx size = sizeof(struct NCDVal__map) + maxcount * sizeof(struct NCDVal__mapelem);
+    
+    // large maps get a hash index, with the number of buckets being the
+    // smallest power of two not below maxcount
+    NCDVal__idx num_buckets = 0;
+    if (maxcount >= NCDVAL_MAP_HASH_MIN_COUNT && maxcount <= (NCDVAL_MAXIDX - size) / (3 * sizeof(NCDVal__idx))) {
+        num_buckets = 1;
+        while (num_buckets < maxcount) {
+            num_buckets *= 2;
+        }
+        size += (maxcount + num_buckets) * sizeof(NCDVal__idx);
+    }
+    
     NCDVal__idx idx = buffer_allocate(mem, size, __alignof(struct NCDVal__map));
     if (idx < 0) {
         goto fail;
@@ -1336,8 +1643,16 @@ NCDValRef NCDVal_NewMap (NCDValMem *mem, size_t maxcount)
     map_e->type = make_type(NCDVAL_MAP, 0);
     map_e->maxcount = maxcount;
     map_e->count = 0;
+    map_e->hash_mask = num_buckets - 1;
     NCDVal__MapTree_Init(&map_e->tree);
     
+    if (map_e->hash_mask >= 0) {
+        NCDVal__idx *buckets = map_hash_buckets(map_e);
+        for (NCDVal__idx i = 0; i < num_buckets; i++) {
+            buckets[i] = -1;
+        }
+    }
+    
     return make_ref(mem, idx);
     
 fail:
@@ -1353,6 +1668,10 @@ int NCDVal_MapInsert (NCDValRef map, NCDValRef key, NCDValRef val, int *out_inse
     assert_val_only(map.mem, key.idx);
     assert_val_only(map.mem, val.idx);
     
+    if (!buffer_unshare(map.mem)) {
+        goto fail0;
+    }
+    
     struct NCDVal__map *map_e = buffer_at(map.mem, map.idx);
     
     int new_type = map_e->type;
@@ -1375,6 +1694,10 @@ int NCDVal_MapInsert (NCDValRef map, NCDValRef key, NCDValRef val, int *out_inse
         return 1;
     }
     
+    if (map_e->hash_mask >= 0) {
+        map_hash_link(map_e, map_e->count, map_hash_key(key));
+    }
+    
     map_e->type = new_type;
     map_e->count++;
     
@@ -1497,6 +1820,13 @@ NCDValMapElem NCDVal_MapFindKey (NCDValRef map, NCDValRef key)
     
     struct NCDVal__map *map_e = buffer_at(map.mem, map.idx);
     
+    if (map_e->hash_mask >= 0) {
+        NCDVal__idx elemidx = map_hash_lookup(map, map_e, key);
+        ASSERT(elemidx == NCDVal__MapTree_LookupExact(&map_e->tree, map.mem, key).link)
+        
+        return make_map_elem(elemidx);
+    }
+    
     NCDVal__MapTreeRef ref = NCDVal__MapTree_LookupExact(&map_e->tree, map.mem, key);
     ASSERT(ref.link == -1 || (assert_map_elem_only(map, ref.link), 1))
     
@@ -1695,6 +2025,11 @@ int NCDValReplaceProg_Execute (NCDValReplaceProg prog, NCDValMem *mem, NCDVal_re
     assert_mem(mem);
     ASSERT(replace)
     
+    if (prog.num_instrs > 0 && !buffer_unshare(mem)) {
+        BLog(BLOG_ERROR, "buffer_unshare failed");
+        return 0;
+    }
+    
     for (size_t i = 0; i < prog.num_instrs; i++) {
         struct NCDVal__instr instr = prog.instrs[i];
         
@@ -1728,6 +2063,11 @@ int NCDValReplaceProg_Execute (NCDValReplaceProg prog, NCDValMem *mem, NCDVal_re
                     BLog(BLOG_ERROR, "duplicate key in map");
                     return 0;
                 }
+                
+                if (map_e->hash_mask >= 0) {
+                    map_hash_unlink(map_e, instr.reinsert.elempos);
+                    map_hash_link(map_e, instr.reinsert.elempos, map_hash_key(make_ref(mem, map_e->elems[instr.reinsert.elempos].key_idx)));
+                }
             } break;
             
             case NCDVAL_INSTR_BUMPDEPTH: {
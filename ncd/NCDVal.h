@@ -79,10 +79,30 @@ void NCDValMem_Free (NCDValMem *o);
  * to {@link NCDValSafeRef} using {@link NCDVal_ToSafe} and back to
  * {@link NCDValRef} using {@link NCDVal_FromSafe} with the new memory object
  * specified. Alternatively, {@link NCDVal_Moved} can be used.
+ * The memory buffer is shared with the original until either object is
+ * modified, so copying a large memory object takes constant time.
  * Returns 1 on success and 0 on failure.
  */
 int NCDValMem_InitCopy (NCDValMem *o, NCDValMem *other) WARN_UNUSED;
 
+/**
+ * Reclaims the space of unreachable values in a memory object, if there
+ * is enough of it.
+ * The values reachable from the given roots are measured, and if they take
+ * less than half of the used space, they are copied into a fresh memory
+ * object which then replaces the existing one, and the roots
+ * are updated to point to the copies. Otherwise nothing is done. Either way,
+ * the roots remain valid; roots which are invalid references or placeholders
+ * are kept as they are. If compaction happened, all other references into
+ * the memory object become invalid.
+ * This is intended for memory objects which are kept around for a long time
+ * after being built, and which may contain leftovers of values which were
+ * replaced or discarded during building.
+ * Returns 1 on success and 0 on failure. On failure, the memory object and
+ * the roots are unchanged and remain usable.
+ */
+int NCDValMem_Compact (NCDValMem *o, NCDValSafeRef *roots, size_t num_roots);
+
 /**
  * Get the string index of a value memory object.
  */
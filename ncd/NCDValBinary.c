@@ -0,0 +1,284 @@
+/**
+ * @file NCDValBinary.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <base/BLog.h>
+
+#include "NCDValBinary.h"
+
+#include <generated/blog_channel_NCDValBinary.h>
+
+#define TYPE_STRING 0
+#define TYPE_LIST 1
+#define TYPE_MAP 2
+
+// same as the nesting limit of NCDVal itself
+#define MAX_DEPTH 32
+
+struct decoder {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+};
+
+static int encode_varint (ExpString *str, uint64_t x)
+{
+    uint8_t buf[10];
+    size_t len = 0;
+    
+    do {
+        uint8_t b = x & 0x7F;
+        x >>= 7;
+        if (x > 0) {
+            b |= 0x80;
+        }
+        buf[len++] = b;
+    } while (x > 0);
+    
+    return ExpString_AppendBinary(str, buf, len);
+}
+
+static int encode_val (NCDValRef value, ExpString *str)
+{
+    ASSERT(!NCDVal_IsInvalid(value))
+    
+    switch (NCDVal_Type(value)) {
+        case NCDVAL_STRING: {
+            MemRef mr = NCDVal_StringMemRef(value);
+            
+            if (!ExpString_AppendByte(str, TYPE_STRING) || !encode_varint(str, mr.len) ||
+                !ExpString_AppendBinaryMr(str, mr)
+            ) {
+                goto fail;
+            }
+        } break;
+        
+        case NCDVAL_LIST: {
+            size_t count = NCDVal_ListCount(value);
+            
+            if (!ExpString_AppendByte(str, TYPE_LIST) || !encode_varint(str, count)) {
+                goto fail;
+            }
+            
+            for (size_t i = 0; i < count; i++) {
+                if (!encode_val(NCDVal_ListGet(value, i), str)) {
+                    return 0;
+                }
+            }
+        } break;
+        
+        case NCDVAL_MAP: {
+            if (!ExpString_AppendByte(str, TYPE_MAP) || !encode_varint(str, NCDVal_MapCount(value))) {
+                goto fail;
+            }
+            
+            for (NCDValMapElem e = NCDVal_MapOrderedFirst(value); !NCDVal_MapElemInvalid(e); e = NCDVal_MapOrderedNext(value, e)) {
+                if (!encode_val(NCDVal_MapElemKey(value, e), str) || !encode_val(NCDVal_MapElemVal(value, e), str)) {
+                    return 0;
+                }
+            }
+        } break;
+        
+        default: ASSERT(0);
+    }
+    
+    return 1;
+    
+fail:
+    BLog(BLOG_ERROR, "ExpString append failed");
+    return 0;
+}
+
+static int decode_varint (struct decoder *d, uint64_t *out)
+{
+    uint64_t x = 0;
+    
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (d->pos == d->len) {
+            return 0;
+        }
+        uint8_t b = d->data[d->pos++];
+        
+        x |= (uint64_t)(b & 0x7F) << shift;
+        
+        if (!(b & 0x80)) {
+            *out = x;
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+static int decode_count (struct decoder *d, size_t *out)
+{
+    uint64_t x;
+    if (!decode_varint(d, &x)) {
+        return 0;
+    }
+    
+    // every element takes at least two bytes, which also prevents
+    // allocating storage for elements which can't be there
+    if (x > (d->len - d->pos) / 2) {
+        return 0;
+    }
+    
+    *out = x;
+    return 1;
+}
+
+static int decode_val (struct decoder *d, NCDValMem *mem, int depth, NCDValRef *out)
+{
+    if (depth > MAX_DEPTH) {
+        BLog(BLOG_ERROR, "too deeply nested");
+        return 0;
+    }
+    
+    if (d->pos == d->len) {
+        BLog(BLOG_ERROR, "unexpected end of data");
+        return 0;
+    }
+    uint8_t type = d->data[d->pos++];
+    
+    switch (type) {
+        case TYPE_STRING: {
+            uint64_t len;
+            if (!decode_varint(d, &len) || len > d->len - d->pos) {
+                BLog(BLOG_ERROR, "bad string length");
+                return 0;
+            }
+            
+            *out = NCDVal_NewStringBin(mem, d->data + d->pos, len);
+            if (NCDVal_IsInvalid(*out)) {
+                BLog(BLOG_ERROR, "NCDVal_NewStringBin failed");
+                return 0;
+            }
+            
+            d->pos += len;
+        } break;
+        
+        case TYPE_LIST: {
+            size_t count;
+            if (!decode_count(d, &count)) {
+                BLog(BLOG_ERROR, "bad list count");
+                return 0;
+            }
+            
+            *out = NCDVal_NewList(mem, count);
+            if (NCDVal_IsInvalid(*out)) {
+                BLog(BLOG_ERROR, "NCDVal_NewList failed");
+                return 0;
+            }
+            
+            for (size_t i = 0; i < count; i++) {
+                NCDValRef elem;
+                if (!decode_val(d, mem, depth + 1, &elem)) {
+                    return 0;
+                }
+                if (!NCDVal_ListAppend(*out, elem)) {
+                    BLog(BLOG_ERROR, "NCDVal_ListAppend failed");
+                    return 0;
+                }
+            }
+        } break;
+        
+        case TYPE_MAP: {
+            size_t count;
+            if (!decode_count(d, &count) || count > (d->len - d->pos) / 4) {
+                BLog(BLOG_ERROR, "bad map count");
+                return 0;
+            }
+            
+            *out = NCDVal_NewMap(mem, count);
+            if (NCDVal_IsInvalid(*out)) {
+                BLog(BLOG_ERROR, "NCDVal_NewMap failed");
+                return 0;
+            }
+            
+            for (size_t i = 0; i < count; i++) {
+                NCDValRef key;
+                NCDValRef val;
+                if (!decode_val(d, mem, depth + 1, &key) || !decode_val(d, mem, depth + 1, &val)) {
+                    return 0;
+                }
+                
+                int inserted;
+                if (!NCDVal_MapInsert(*out, key, val, &inserted)) {
+                    BLog(BLOG_ERROR, "NCDVal_MapInsert failed");
+                    return 0;
+                }
+                if (!inserted) {
+                    BLog(BLOG_ERROR, "duplicate map key");
+                    return 0;
+                }
+            }
+        } break;
+        
+        default:
+            BLog(BLOG_ERROR, "unknown type %d", (int)type);
+            return 0;
+    }
+    
+    return 1;
+}
+
+int NCDValBinary_AppendEncode (NCDValRef value, ExpString *str)
+{
+    ASSERT(!NCDVal_IsInvalid(value))
+    ASSERT(str)
+    
+    return encode_val(value, str);
+}
+
+int NCDValBinary_Decode (MemRef data, NCDValMem *mem, NCDValRef *out_value)
+{
+    ASSERT(mem)
+    ASSERT(out_value)
+    
+    struct decoder d;
+    d.data = (const uint8_t *)data.ptr;
+    d.len = data.len;
+    d.pos = 0;
+    
+    NCDValRef value;
+    if (!decode_val(&d, mem, 0, &value)) {
+        return 0;
+    }
+    
+    if (d.pos != d.len) {
+        BLog(BLOG_ERROR, "trailing data");
+        return 0;
+    }
+    
+    *out_value = value;
+    return 1;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file NCDValBinary.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BADVPN_NCDVALBINARY_H
+#define BADVPN_NCDVALBINARY_H
+
+#include <misc/debug.h>
+#include <misc/memref.h>
+#include <misc/expstring.h>
+#include <ncd/NCDVal.h>
+
+/**
+ * Compact binary encoding of {@link NCDVal} values.
+ * 
+ * Each value is a type byte followed by its body:
+ * - 0 (string): length, then the string bytes,
+ * - 1 (list): element count, then the elements,
+ * - 2 (map): entry count, then key and value of each entry in order.
+ * Lengths and counts are unsigned LEB128 varints.
+ */
+
+/**
+ * Appends the binary encoding of a value to a string.
+ * 
+ * @param value value to encode; must not be an invalid reference
+ * @param str string to append to
+ * @return 1 on success, 0 on failure
+ */
+int NCDValBinary_AppendEncode (NCDValRef value, ExpString *str) WARN_UNUSED;
+
+/**
+ * Decodes a binary encoded value. The data must contain exactly one value.
+ * 
+ * @param data data to decode
+ * @param mem value memory object which the result will be stored in
+ * @param out_value on success, the value reference of the result will be
+ *                  written here
+ * @return 1 on success, 0 on failure
+ */
+int NCDValBinary_Decode (MemRef data, NCDValMem *mem, NCDValRef *out_value) WARN_UNUSED;
+
+#endif
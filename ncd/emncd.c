@@ -107,6 +107,7 @@ void emncd_start (const char *program_text, int loglevel)
     params.handler_finished = interpreter_handler_finished;
     params.user = NULL;
     params.retry_time = 5000;
+    params.keep_on_backtrack = 0;
     params.extra_args = NULL;
     params.num_extra_args = 0;
     params.reactor = &reactor;
@@ -41,6 +41,11 @@
 #include <fcntl.h>
 #include <linux/if_tun.h>
 #include <pwd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
   
 #include <misc/debug.h>
 #include <base/BLog.h>
@@ -49,11 +54,26 @@
 
 #include <generated/blog_channel_NCDIfConfig.h>
 
-#define IP_CMD "ip"
 #define MODPROBE_CMD "modprobe"
 #define RESOLVCONF_FILE "/etc/resolv.conf"
 #define RESOLVCONF_TEMP_FILE "/etc/resolv.conf-ncd-temp"
 #define TUN_DEVNODE "/dev/net/tun"
+#define NL_TIMEOUT_SEC 5
+#define NL_RECV_SIZE 4096
+
+struct nl_req {
+    struct nlmsghdr nlh;
+    union {
+        struct ifinfomsg ifi;
+        struct ifaddrmsg ifa;
+        struct rtmsg rtm;
+        char payload[sizeof(struct rtmsg) + 128];
+    };
+};
+
+// rtnetlink socket shared by all requests, opened on first use
+static int nl_fd = -1;
+static uint32_t nl_seq;
 
 static int run_command (const char *cmd)
 {
@@ -111,117 +131,283 @@ fail0:
     return flags;
 }
 
-int NCDIfConfig_set_up (const char *ifname)
+static int nl_open (void)
 {
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
+    if (nl_fd >= 0) {
+        return 1;
+    }
+    
+    int fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        BLog(BLOG_ERROR, "socket(AF_NETLINK) failed");
         return 0;
     }
     
-    char cmd[50 + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" link set %s up", ifname);
+    // don't hang forever if the kernel doesn't answer
+    struct timeval tv = {NL_TIMEOUT_SEC, 0};
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+        BLog(BLOG_ERROR, "setsockopt(SO_RCVTIMEO) failed");
+        close(fd);
+        return 0;
+    }
+    
+    nl_fd = fd;
     
-    return !run_command(cmd);
+    return 1;
 }
 
-int NCDIfConfig_set_down (const char *ifname)
+static void nl_close (void)
 {
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
+    ASSERT(nl_fd >= 0)
+    
+    close(nl_fd);
+    nl_fd = -1;
+}
+
+static void nl_init_req (struct nl_req *req, uint16_t type, uint16_t flags, size_t payload_len)
+{
+    ASSERT(payload_len <= sizeof(req->payload))
+    
+    memset(req, 0, sizeof(*req));
+    req->nlh.nlmsg_len = NLMSG_LENGTH(payload_len);
+    req->nlh.nlmsg_type = type;
+    req->nlh.nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK|flags;
+}
+
+static void nl_add_attr (struct nl_req *req, uint16_t type, const void *data, size_t len)
+{
+    size_t offset = NLMSG_ALIGN(req->nlh.nlmsg_len);
+    ASSERT(offset + RTA_SPACE(len) <= sizeof(*req))
+    
+    struct rtattr *rta = (struct rtattr *)((char *)req + offset);
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    
+    req->nlh.nlmsg_len = offset + RTA_SPACE(len);
+}
+
+// sends the request and waits for its acknowledgement, returning 1 on success
+static int nl_request (struct nl_req *req)
+{
+    if (!nl_open()) {
         return 0;
     }
     
-    char cmd[50 + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" link set %s down", ifname);
+    req->nlh.nlmsg_seq = ++nl_seq;
+    
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
     
-    return !run_command(cmd);
+    if (sendto(nl_fd, req, req->nlh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        BLog(BLOG_ERROR, "netlink send failed: %s", strerror(errno));
+        goto fail;
+    }
+    
+    while (1) {
+        union {
+            struct nlmsghdr nlh;
+            char buf[NL_RECV_SIZE];
+        } resp;
+        
+        socklen_t sa_len = sizeof(sa);
+        ssize_t len = recvfrom(nl_fd, &resp, sizeof(resp), 0, (struct sockaddr *)&sa, &sa_len);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            BLog(BLOG_ERROR, "netlink recv failed: %s", strerror(errno));
+            goto fail;
+        }
+        
+        if (sa.nl_pid != 0) {
+            continue;
+        }
+        
+        for (struct nlmsghdr *nlh = &resp.nlh; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            // skip answers to earlier requests which timed out
+            if (nlh->nlmsg_seq != req->nlh.nlmsg_seq || nlh->nlmsg_type != NLMSG_ERROR) {
+                continue;
+            }
+            
+            if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+                BLog(BLOG_ERROR, "netlink answer truncated");
+                goto fail;
+            }
+            
+            struct nlmsgerr *err = NLMSG_DATA(nlh);
+            if (err->error != 0) {
+                BLog(BLOG_ERROR, "netlink answers: %s", strerror(-err->error));
+                return 0;
+            }
+            
+            return 1;
+        }
+    }
+    
+fail:
+    // start over with a fresh socket next time
+    nl_close();
+    return 0;
 }
 
-int NCDIfConfig_add_ipv4_addr (const char *ifname, struct ipv4_ifaddr ifaddr)
+static int get_ifindex (const char *ifname, int *out_index)
 {
-    ASSERT(ifaddr.prefix >= 0)
-    ASSERT(ifaddr.prefix <= 32)
-    
     if (strlen(ifname) >= IFNAMSIZ) {
         BLog(BLOG_ERROR, "ifname too long");
         return 0;
     }
     
-    uint8_t *addr = (uint8_t *)&ifaddr.addr;
-    
-    char cmd[50 + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" addr add %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d dev %s", addr[0], addr[1], addr[2], addr[3], ifaddr.prefix, ifname);
+    unsigned int index = if_nametoindex(ifname);
+    if (index == 0 || index > INT_MAX) {
+        BLog(BLOG_ERROR, "cannot find interface %s", ifname);
+        return 0;
+    }
     
-    return !run_command(cmd);
+    *out_index = index;
+    return 1;
 }
 
-int NCDIfConfig_remove_ipv4_addr (const char *ifname, struct ipv4_ifaddr ifaddr)
+static int link_set_flags (const char *ifname, unsigned int flags)
 {
-    ASSERT(ifaddr.prefix >= 0)
-    ASSERT(ifaddr.prefix <= 32)
+    int ifindex;
+    if (!get_ifindex(ifname, &ifindex)) {
+        return 0;
+    }
     
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
+    BLog(BLOG_INFO, "link set %s %s", ifname, (flags & IFF_UP) ? "up" : "down");
+    
+    struct nl_req req;
+    nl_init_req(&req, RTM_NEWLINK, 0, sizeof(struct ifinfomsg));
+    req.ifi.ifi_family = AF_UNSPEC;
+    req.ifi.ifi_index = ifindex;
+    req.ifi.ifi_flags = flags;
+    req.ifi.ifi_change = IFF_UP;
+    
+    return nl_request(&req);
+}
+
+int NCDIfConfig_set_up (const char *ifname)
+{
+    return link_set_flags(ifname, IFF_UP);
+}
+
+int NCDIfConfig_set_down (const char *ifname)
+{
+    return link_set_flags(ifname, 0);
+}
+
+static int addr_request (int add, const char *ifname, int family, const void *addr, size_t addr_len, int prefix, int scope)
+{
+    int ifindex;
+    if (!get_ifindex(ifname, &ifindex)) {
         return 0;
     }
     
+    struct nl_req req;
+    nl_init_req(&req, (add ? RTM_NEWADDR : RTM_DELADDR), (add ? NLM_F_CREATE|NLM_F_EXCL : 0), sizeof(struct ifaddrmsg));
+    req.ifa.ifa_family = family;
+    req.ifa.ifa_prefixlen = prefix;
+    req.ifa.ifa_scope = scope;
+    req.ifa.ifa_index = ifindex;
+    nl_add_attr(&req, IFA_LOCAL, addr, addr_len);
+    nl_add_attr(&req, IFA_ADDRESS, addr, addr_len);
+    
+    return nl_request(&req);
+}
+
+static int ipv4_addr_cmd (int add, const char *ifname, struct ipv4_ifaddr ifaddr)
+{
+    ASSERT(ifaddr.prefix >= 0)
+    ASSERT(ifaddr.prefix <= 32)
+    
     uint8_t *addr = (uint8_t *)&ifaddr.addr;
     
-    char cmd[50 + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" addr del %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d dev %s", addr[0], addr[1], addr[2], addr[3], ifaddr.prefix, ifname);
+    BLog(BLOG_INFO, "addr %s %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d dev %s", (add ? "add" : "del"), addr[0], addr[1], addr[2], addr[3], ifaddr.prefix, ifname);
     
-    return !run_command(cmd);
+    // same default as ip(8)
+    int scope = (addr[0] == 127) ? RT_SCOPE_HOST : RT_SCOPE_UNIVERSE;
+    
+    return addr_request(add, ifname, AF_INET, &ifaddr.addr, sizeof(ifaddr.addr), ifaddr.prefix, scope);
 }
 
-int NCDIfConfig_add_ipv6_addr (const char *ifname, struct ipv6_ifaddr ifaddr)
+int NCDIfConfig_add_ipv4_addr (const char *ifname, struct ipv4_ifaddr ifaddr)
+{
+    return ipv4_addr_cmd(1, ifname, ifaddr);
+}
+
+int NCDIfConfig_remove_ipv4_addr (const char *ifname, struct ipv4_ifaddr ifaddr)
+{
+    return ipv4_addr_cmd(0, ifname, ifaddr);
+}
+
+static int ipv6_addr_cmd (int add, const char *ifname, struct ipv6_ifaddr ifaddr)
 {
     ASSERT(ifaddr.prefix >= 0)
     ASSERT(ifaddr.prefix <= 128)
     
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
-        return 0;
-    }
-    
     char addr_str[IPADDR6_PRINT_MAX];
     ipaddr6_print_addr(ifaddr.addr, addr_str);
     
-    char cmd[40 + IPADDR6_PRINT_MAX + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" addr add %s/%d dev %s", addr_str, ifaddr.prefix, ifname);
+    BLog(BLOG_INFO, "addr %s %s/%d dev %s", (add ? "add" : "del"), addr_str, ifaddr.prefix, ifname);
     
-    return !run_command(cmd);
+    return addr_request(add, ifname, AF_INET6, ifaddr.addr.bytes, sizeof(ifaddr.addr.bytes), ifaddr.prefix, RT_SCOPE_UNIVERSE);
+}
+
+int NCDIfConfig_add_ipv6_addr (const char *ifname, struct ipv6_ifaddr ifaddr)
+{
+    return ipv6_addr_cmd(1, ifname, ifaddr);
 }
 
 int NCDIfConfig_remove_ipv6_addr (const char *ifname, struct ipv6_ifaddr ifaddr)
 {
-    ASSERT(ifaddr.prefix >= 0)
-    ASSERT(ifaddr.prefix <= 128)
-    
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
+    return ipv6_addr_cmd(0, ifname, ifaddr);
+}
+
+// ifname is NULL for blackhole routes, gateway is NULL for none
+static int route_request (int add, int family, const void *dest, size_t addr_len, int prefix, const void *gateway, int metric, const char *ifname)
+{
+    int ifindex = 0;
+    if (ifname && !get_ifindex(ifname, &ifindex)) {
         return 0;
     }
     
-    char addr_str[IPADDR6_PRINT_MAX];
-    ipaddr6_print_addr(ifaddr.addr, addr_str);
+    struct nl_req req;
+    nl_init_req(&req, (add ? RTM_NEWROUTE : RTM_DELROUTE), (add ? NLM_F_CREATE|NLM_F_EXCL : 0), sizeof(struct rtmsg));
+    req.rtm.rtm_family = family;
+    req.rtm.rtm_dst_len = prefix;
+    req.rtm.rtm_table = RT_TABLE_MAIN;
+    
+    // like ip(8), leave protocol, scope and unicast type as wildcards when deleting
+    if (add) {
+        req.rtm.rtm_protocol = RTPROT_BOOT;
+        req.rtm.rtm_scope = (ifname && !gateway) ? RT_SCOPE_LINK : RT_SCOPE_UNIVERSE;
+        req.rtm.rtm_type = ifname ? RTN_UNICAST : RTN_BLACKHOLE;
+    } else {
+        req.rtm.rtm_scope = RT_SCOPE_NOWHERE;
+        req.rtm.rtm_type = ifname ? RTN_UNSPEC : RTN_BLACKHOLE;
+    }
+    
+    uint32_t priority = metric;
     
-    char cmd[40 + IPADDR6_PRINT_MAX + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" addr del %s/%d dev %s", addr_str, ifaddr.prefix, ifname);
+    nl_add_attr(&req, RTA_DST, dest, addr_len);
+    if (gateway) {
+        nl_add_attr(&req, RTA_GATEWAY, gateway, addr_len);
+    }
+    nl_add_attr(&req, RTA_PRIORITY, &priority, sizeof(priority));
+    if (ifname) {
+        nl_add_attr(&req, RTA_OIF, &ifindex, sizeof(ifindex));
+    }
     
-    return !run_command(cmd);
+    return nl_request(&req);
 }
 
-static int route_cmd (const char *cmdtype, struct ipv4_ifaddr dest, const uint32_t *gateway, int metric, const char *ifname)
+static int route_cmd (int add, struct ipv4_ifaddr dest, const uint32_t *gateway, int metric, const char *ifname)
 {
-    ASSERT(!strcmp(cmdtype, "add") || !strcmp(cmdtype, "del"))
     ASSERT(dest.prefix >= 0)
     ASSERT(dest.prefix <= 32)
     
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
-        return 0;
-    }
-    
     uint8_t *d_addr = (uint8_t *)&dest.addr;
     
     char gwstr[30];
@@ -232,34 +418,27 @@ static int route_cmd (const char *cmdtype, struct ipv4_ifaddr dest, const uint32
         gwstr[0] = '\0';
     }
     
-    char cmd[120 + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" route %s %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d%s metric %d dev %s",
-            cmdtype, d_addr[0], d_addr[1], d_addr[2], d_addr[3], dest.prefix, gwstr, metric, ifname);
+    BLog(BLOG_INFO, "route %s %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d%s metric %d dev %s",
+         (add ? "add" : "del"), d_addr[0], d_addr[1], d_addr[2], d_addr[3], dest.prefix, gwstr, metric, ifname);
     
-    return !run_command(cmd);
+    return route_request(add, AF_INET, &dest.addr, sizeof(dest.addr), dest.prefix, gateway, metric, ifname);
 }
 
 int NCDIfConfig_add_ipv4_route (struct ipv4_ifaddr dest, const uint32_t *gateway, int metric, const char *device)
 {
-    return route_cmd("add", dest, gateway, metric, device);
+    return route_cmd(1, dest, gateway, metric, device);
 }
 
 int NCDIfConfig_remove_ipv4_route (struct ipv4_ifaddr dest, const uint32_t *gateway, int metric, const char *device)
 {
-    return route_cmd("del", dest, gateway, metric, device);
+    return route_cmd(0, dest, gateway, metric, device);
 }
 
-static int route_cmd6 (const char *cmdtype, struct ipv6_ifaddr dest, const struct ipv6_addr *gateway, int metric, const char *ifname)
+static int route_cmd6 (int add, struct ipv6_ifaddr dest, const struct ipv6_addr *gateway, int metric, const char *ifname)
 {
-    ASSERT(!strcmp(cmdtype, "add") || !strcmp(cmdtype, "del"))
     ASSERT(dest.prefix >= 0)
     ASSERT(dest.prefix <= 128)
     
-    if (strlen(ifname) >= IFNAMSIZ) {
-        BLog(BLOG_ERROR, "ifname too long");
-        return 0;
-    }
-    
     char dest_str[IPADDR6_PRINT_MAX];
     ipaddr6_print_addr(dest.addr, dest_str);
     
@@ -271,72 +450,67 @@ static int route_cmd6 (const char *cmdtype, struct ipv6_ifaddr dest, const struc
         gwstr[0] = '\0';
     }
     
-    char cmd[70 + IPADDR6_PRINT_MAX + IPADDR6_PRINT_MAX + IFNAMSIZ];
-    sprintf(cmd, IP_CMD" route %s %s/%d%s metric %d dev %s",
-            cmdtype, dest_str, dest.prefix, gwstr, metric, ifname);
+    BLog(BLOG_INFO, "route %s %s/%d%s metric %d dev %s",
+         (add ? "add" : "del"), dest_str, dest.prefix, gwstr, metric, ifname);
     
-    return !run_command(cmd);
+    return route_request(add, AF_INET6, dest.addr.bytes, sizeof(dest.addr.bytes), dest.prefix, (gateway ? gateway->bytes : NULL), metric, ifname);
 }
 
 int NCDIfConfig_add_ipv6_route (struct ipv6_ifaddr dest, const struct ipv6_addr *gateway, int metric, const char *device)
 {
-    return route_cmd6("add", dest, gateway, metric, device);
+    return route_cmd6(1, dest, gateway, metric, device);
 }
 
 int NCDIfConfig_remove_ipv6_route (struct ipv6_ifaddr dest, const struct ipv6_addr *gateway, int metric, const char *device)
 {
-    return route_cmd6("del", dest, gateway, metric, device);
+    return route_cmd6(0, dest, gateway, metric, device);
 }
 
-static int blackhole_route_cmd (const char *cmdtype, struct ipv4_ifaddr dest, int metric)
+static int blackhole_route_cmd (int add, struct ipv4_ifaddr dest, int metric)
 {
-    ASSERT(!strcmp(cmdtype, "add") || !strcmp(cmdtype, "del"))
     ASSERT(dest.prefix >= 0)
     ASSERT(dest.prefix <= 32)
     
     uint8_t *d_addr = (uint8_t *)&dest.addr;
     
-    char cmd[120];
-    sprintf(cmd, IP_CMD" route %s blackhole %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d metric %d",
-            cmdtype, d_addr[0], d_addr[1], d_addr[2], d_addr[3], dest.prefix, metric);
+    BLog(BLOG_INFO, "route %s blackhole %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"/%d metric %d",
+         (add ? "add" : "del"), d_addr[0], d_addr[1], d_addr[2], d_addr[3], dest.prefix, metric);
     
-    return !run_command(cmd);
+    return route_request(add, AF_INET, &dest.addr, sizeof(dest.addr), dest.prefix, NULL, metric, NULL);
 }
 
 int NCDIfConfig_add_ipv4_blackhole_route (struct ipv4_ifaddr dest, int metric)
 {
-    return blackhole_route_cmd("add", dest, metric);
+    return blackhole_route_cmd(1, dest, metric);
 }
 
 int NCDIfConfig_remove_ipv4_blackhole_route (struct ipv4_ifaddr dest, int metric)
 {
-    return blackhole_route_cmd("del", dest, metric);
+    return blackhole_route_cmd(0, dest, metric);
 }
 
-static int blackhole_route_cmd6 (const char *cmdtype, struct ipv6_ifaddr dest, int metric)
+static int blackhole_route_cmd6 (int add, struct ipv6_ifaddr dest, int metric)
 {
-    ASSERT(!strcmp(cmdtype, "add") || !strcmp(cmdtype, "del"))
     ASSERT(dest.prefix >= 0)
     ASSERT(dest.prefix <= 128)
     
     char dest_str[IPADDR6_PRINT_MAX];
     ipaddr6_print_addr(dest.addr, dest_str);
     
-    char cmd[70 + IPADDR6_PRINT_MAX];
-    sprintf(cmd, IP_CMD" route %s blackhole %s/%d metric %d",
-            cmdtype, dest_str, dest.prefix, metric);
+    BLog(BLOG_INFO, "route %s blackhole %s/%d metric %d",
+         (add ? "add" : "del"), dest_str, dest.prefix, metric);
     
-    return !run_command(cmd);
+    return route_request(add, AF_INET6, dest.addr.bytes, sizeof(dest.addr.bytes), dest.prefix, NULL, metric, NULL);
 }
 
 int NCDIfConfig_add_ipv6_blackhole_route (struct ipv6_ifaddr dest, int metric)
 {
-    return blackhole_route_cmd6("add", dest, metric);
+    return blackhole_route_cmd6(1, dest, metric);
 }
 
 int NCDIfConfig_remove_ipv6_blackhole_route (struct ipv6_ifaddr dest, int metric)
 {
-    return blackhole_route_cmd6("del", dest, metric);
+    return blackhole_route_cmd6(0, dest, metric);
 }
 
 int NCDIfConfig_set_resolv_conf (const char *data, size_t data_len)
@@ -71,7 +71,7 @@ static void decoder_handler_error (NCDRequestClient *o);
 static void recv_if_handler_send (NCDRequestClient *o, uint8_t *data, int data_len);
 static struct NCDRequestClient_req * find_req (NCDRequestClient *o, uint32_t request_id);
 static int get_free_request_id (NCDRequestClient *o, uint32_t *out);
-static int build_requestproto_packet (uint32_t request_id, uint32_t type, NCDValRef payload_value, uint8_t **out_data, int *out_len);
+static int build_requestproto_packet (uint32_t request_id, uint32_t type, int binary, NCDValRef payload_value, uint8_t **out_data, int *out_len);
 static void build_nodata_packet (uint32_t request_id, uint32_t type, uint8_t *data, int *out_len);
 static int req_is_aborted (struct NCDRequestClient_req *req);
 static void req_abort (struct NCDRequestClient_req *req);
@@ -212,8 +212,9 @@ static void recv_if_handler_send (NCDRequestClient *o, uint8_t *data, int data_l
     }
     
     switch (type) {
-        case REQUESTPROTO_TYPE_SERVER_REPLY: {
-            switch (o->state) {
+        case REQUESTPROTO_TYPE_SERVER_REPLY:
+        case REQUESTPROTO_TYPE_SERVER_REPLY_BINARY: {
+            switch (req->state) {
                 case RSTATE_READY: {
                     // init memory
                     NCDValMem mem;
@@ -221,7 +222,11 @@ static void recv_if_handler_send (NCDRequestClient *o, uint8_t *data, int data_l
                     
                     // parse payload
                     NCDValRef payload_value;
-                    if (!NCDValParser_Parse(MemRef_Make((char *)payload, payload_len), &mem, &payload_value)) {
+                    MemRef payload_mr = MemRef_Make((char *)payload, payload_len);
+                    int res = (type == REQUESTPROTO_TYPE_SERVER_REPLY_BINARY) ?
+                        NCDValBinary_Decode(payload_mr, &mem, &payload_value) :
+                        NCDValParser_Parse(payload_mr, &mem, &payload_value);
+                    if (!res) {
                         BLog(BLOG_ERROR, "failed to parse reply payload");
                         NCDValMem_Free(&mem);
                         goto fail;
@@ -315,7 +320,7 @@ static int get_free_request_id (NCDRequestClient *o, uint32_t *out)
     return 0;
 }
 
-static int build_requestproto_packet (uint32_t request_id, uint32_t type, NCDValRef payload_value, uint8_t **out_data, int *out_len)
+static int build_requestproto_packet (uint32_t request_id, uint32_t type, int binary, NCDValRef payload_value, uint8_t **out_data, int *out_len)
 {
     ExpString str;
     if (!ExpString_Init(&str)) {
@@ -328,9 +333,18 @@ static int build_requestproto_packet (uint32_t request_id, uint32_t type, NCDVal
         goto fail1;
     }
     
-    if (!NCDVal_IsInvalid(payload_value) && !NCDValGenerator_AppendGenerate(payload_value, &str)) {
-        BLog(BLOG_ERROR, "NCDValGenerator_AppendGenerate failed");
-        goto fail1;
+    if (!NCDVal_IsInvalid(payload_value)) {
+        if (binary) {
+            if (!NCDValBinary_AppendEncode(payload_value, &str)) {
+                BLog(BLOG_ERROR, "NCDValBinary_AppendEncode failed");
+                goto fail1;
+            }
+        } else {
+            if (!NCDValGenerator_AppendGenerate(payload_value, &str)) {
+                BLog(BLOG_ERROR, "NCDValGenerator_AppendGenerate failed");
+                goto fail1;
+            }
+        }
     }
     
     size_t len = ExpString_Length(&str);
@@ -494,6 +508,9 @@ int NCDRequestClient_Init (NCDRequestClient *o, struct BConnection_addr addr, BR
     // set next request ID
     o->next_request_id = 0;
     
+    // send text requests by default
+    o->binary = 0;
+    
     // set state connecting
     o->state = CSTATE_CONNECTING;
     
@@ -541,6 +558,13 @@ void NCDRequestClient_Free (NCDRequestClient *o)
     BConnector_Free(&o->connector);
 }
 
+void NCDRequestClient_SetBinary (NCDRequestClient *o, int binary)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    o->binary = !!binary;
+}
+
 int NCDRequestClientRequest_Init (NCDRequestClientRequest *o, NCDRequestClient *client, NCDValRef payload_value, void *user,
                                   NCDRequestClientRequest_handler_sent handler_sent,
                                   NCDRequestClientRequest_handler_reply handler_reply,
@@ -583,7 +607,8 @@ int NCDRequestClientRequest_Init (NCDRequestClientRequest *o, NCDRequestClient *
     req->client = client;
     
     // build request
-    if (!build_requestproto_packet(req->request_id, REQUESTPROTO_TYPE_CLIENT_REQUEST, payload_value, &req->request_data, &req->request_len)) {
+    uint32_t type = client->binary ? REQUESTPROTO_TYPE_CLIENT_REQUEST_BINARY : REQUESTPROTO_TYPE_CLIENT_REQUEST;
+    if (!build_requestproto_packet(req->request_id, type, client->binary, payload_value, &req->request_data, &req->request_len)) {
         BLog(BLOG_ERROR, "failed to build request");
         goto fail2;
     }
@@ -44,6 +44,7 @@
 #include <flow/PacketPassFifoQueue.h>
 #include <ncd/NCDValGenerator.h>
 #include <ncd/NCDValParser.h>
+#include <ncd/NCDValBinary.h>
 
 struct NCDRequestClient_req;
 
@@ -67,6 +68,7 @@ typedef struct {
     PacketPassInterface recv_if;
     BAVL reqs_tree;
     uint32_t next_request_id;
+    int binary;
     int state;
     int is_error;
     DebugCounter d_reqests_ctr;
@@ -103,6 +105,17 @@ int NCDRequestClient_Init (NCDRequestClient *o, struct BConnection_addr addr, BR
                            NCDRequestClient_handler_connected handler_connected) WARN_UNUSED;
 void NCDRequestClient_Free (NCDRequestClient *o);
 
+/**
+ * Sets whether requests started from now on are sent in the binary format
+ * of NCDValBinary instead of the text format. Replies to a request always come
+ * in the format the request was sent in. The binary format is cheaper to
+ * produce and parse, but servers predating it will reject such requests.
+ * 
+ * @param o the object
+ * @param binary 1 to send binary requests, 0 to send text requests
+ */
+void NCDRequestClient_SetBinary (NCDRequestClient *o, int binary);
+
 int NCDRequestClientRequest_Init (NCDRequestClientRequest *o, NCDRequestClient *client, NCDValRef payload_value, void *user,
                                   NCDRequestClientRequest_handler_sent handler_sent,
                                   NCDRequestClientRequest_handler_reply handler_reply,
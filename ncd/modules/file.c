@@ -38,10 +38,32 @@
  * 
  * Description:
  *   Reads the contents of a file. Reports an error if something goes wrong.
- *   WARNING: this uses fopen/fread/fclose, blocking the entire interpreter while
- *            the file is being read. For this reason, you should only use this
- *            to read small local files which will be read quickly, and especially
- *            not files on network mounts.
+ *   Regular files of at least 64KiB are mapped into memory with mmap() instead
+ *   of being copied; the contents are then shared with any values derived from
+ *   the variable, and the mapping is released when the last of them goes away.
+ *   WARNING: if a mapped file is truncated while its contents are still referenced,
+ *            accessing the contents will crash the interpreter with SIGBUS. Do not
+ *            use this on files which may be truncated in place (e.g. log files
+ *            rotated with copytruncate); use file_read_async() for those.
+ *   WARNING: this blocks the entire interpreter while the file is being opened
+ *            and (for small or non-regular files) read. For this reason, you
+ *            should only use this to read local files which will be read quickly,
+ *            and especially not files on network mounts.
+ * 
+ * Synopsis:
+ *   file_read_async(string filename [, string chunk_size])
+ * 
+ * Variables:
+ *   string (empty) - file contents
+ * 
+ * Description:
+ *   Reads the contents of a file in chunks of 'chunk_size' bytes (default 65536),
+ *   returning to the event loop after each chunk, and goes up once the whole file
+ *   has been read. Pipes and other pollable files are read as data becomes
+ *   available. Reports an error if something goes wrong.
+ *   The contents are read into a private buffer, so unlike file_read() this is
+ *   safe to use on files which are modified while being read, though the result
+ *   may then be inconsistent.
  * 
  * Synopsis:
  *   file_write(string filename, string contents)
@@ -81,20 +103,47 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include <misc/read_file.h>
 #include <misc/write_file.h>
 #include <misc/parse_number.h>
+#include <misc/BRefTarget.h>
+#include <misc/offset.h>
 
 #include <ncd/module_common.h>
 
 #include <generated/blog_channel_ncd_file.h>
 
+#define MMAP_MIN_SIZE 65536
+#define ASYNC_DEFAULT_CHUNK_SIZE 65536
+
+struct file_data {
+    BRefTarget ref_target;
+    char *data;
+    size_t len;
+    int is_mapped;
+};
+
 struct read_instance {
     NCDModuleInst *i;
-    uint8_t *file_data;
-    size_t file_len;
+    struct file_data *data;
+};
+
+struct read_async_instance {
+    NCDModuleInst *i;
+    int fd;
+    int use_bfd;
+    BFileDescriptor bfd;
+    BTimer timer;
+    size_t chunk_size;
+    char *buf;
+    size_t buf_len;
+    size_t buf_size;
+    struct file_data *fdata;
 };
 
 struct stat_instance {
@@ -103,6 +152,56 @@ struct stat_instance {
     struct stat result;
 };
 
+static void file_data_release (BRefTarget *ref_target)
+{
+    struct file_data *o = UPPER_OBJECT(ref_target, struct file_data, ref_target);
+    
+    if (o->is_mapped) {
+        munmap(o->data, o->len);
+    } else {
+        free(o->data);
+    }
+    
+    free(o);
+}
+
+static struct file_data * file_data_new (char *data, size_t len, int is_mapped)
+{
+    struct file_data *o = malloc(sizeof(*o));
+    if (!o) {
+        return NULL;
+    }
+    
+    BRefTarget_Init(&o->ref_target, file_data_release);
+    o->data = data;
+    o->len = len;
+    o->is_mapped = is_mapped;
+    
+    return o;
+}
+
+static int file_data_getvar (struct file_data *o, NCDValMem *mem, NCDValRef *out)
+{
+    *out = NCDVal_NewExternalString(mem, o->data, o->len, &o->ref_target);
+    return 1;
+}
+
+static struct file_data * map_file (int fd, size_t len)
+{
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    
+    struct file_data *o = file_data_new(map, len, 1);
+    if (!o) {
+        munmap(map, len);
+        return NULL;
+    }
+    
+    return o;
+}
+
 static void read_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
     struct read_instance *o = vo;
@@ -126,14 +225,38 @@ static void read_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleIns
         goto fail0;
     }
     
-    // read file
-    int res = read_file(filename_nts.data, &o->file_data, &o->file_len);
-    NCDValNullTermString_Free(&filename_nts);
-    if (!res) {
-        ModuleLog(i, BLOG_ERROR, "failed to read file");
-        goto fail0;
+    o->data = NULL;
+    
+    // map the file if it is a large enough regular file
+    int fd = open(filename_nts.data, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= MMAP_MIN_SIZE && (uintmax_t)st.st_size <= SIZE_MAX) {
+            o->data = map_file(fd, st.st_size);
+        }
+        close(fd);
+    }
+    
+    // otherwise read it
+    if (!o->data) {
+        uint8_t *data;
+        size_t len;
+        if (!read_file(filename_nts.data, &data, &len)) {
+            NCDValNullTermString_Free(&filename_nts);
+            ModuleLog(i, BLOG_ERROR, "failed to read file");
+            goto fail0;
+        }
+        
+        if (!(o->data = file_data_new((char *)data, len, 0))) {
+            free(data);
+            NCDValNullTermString_Free(&filename_nts);
+            ModuleLog(i, BLOG_ERROR, "malloc failed");
+            goto fail0;
+        }
     }
     
+    NCDValNullTermString_Free(&filename_nts);
+    
     // signal up
     NCDModuleInst_Backend_Up(i);
     return;
@@ -146,8 +269,8 @@ static void read_func_die (void *vo)
 {
     struct read_instance *o = vo;
     
-    // free data
-    free(o->file_data);
+    // release data
+    BRefTarget_Deref(&o->data->ref_target);
     
     NCDModuleInst_Backend_Dead(o->i);
 }
@@ -157,8 +280,244 @@ static int read_func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NC
     struct read_instance *o = vo;
     
     if (name == NCD_STRING_EMPTY) {
-        *out = NCDVal_NewStringBin(mem, o->file_data, o->file_len);
-        return 1;
+        return file_data_getvar(o->data, mem, out);
+    }
+    
+    return 0;
+}
+
+static void read_async_stop (struct read_async_instance *o)
+{
+    ASSERT(o->fd >= 0)
+    
+    if (o->use_bfd) {
+        BReactor_RemoveFileDescriptor(o->i->params->iparams->reactor, &o->bfd);
+    } else {
+        BReactor_RemoveTimer(o->i->params->iparams->reactor, &o->timer);
+    }
+    
+    if (close(o->fd) < 0) {
+        ModuleLog(o->i, BLOG_ERROR, "close failed");
+    }
+    
+    o->fd = -1;
+}
+
+static void read_async_continue (struct read_async_instance *o)
+{
+    ASSERT(o->fd >= 0)
+    
+    // a pollable file keeps its read event enabled; for a regular file,
+    // an expired timer makes sure the event loop polls before the next chunk
+    if (!o->use_bfd) {
+        BReactor_SetTimerAfter(o->i->params->iparams->reactor, &o->timer, 0);
+    }
+}
+
+static void read_async_read (struct read_async_instance *o)
+{
+    ASSERT(o->fd >= 0)
+    ASSERT(!o->fdata)
+    
+    // make room for the next chunk
+    if (o->buf_size - o->buf_len < o->chunk_size) {
+        size_t new_size = o->buf_size;
+        do {
+            if (new_size > SIZE_MAX / 2) {
+                ModuleLog(o->i, BLOG_ERROR, "file too large");
+                goto fail;
+            }
+            new_size *= 2;
+        } while (new_size - o->buf_len < o->chunk_size);
+        
+        char *new_buf = realloc(o->buf, new_size);
+        if (!new_buf) {
+            ModuleLog(o->i, BLOG_ERROR, "realloc failed");
+            goto fail;
+        }
+        
+        o->buf = new_buf;
+        o->buf_size = new_size;
+    }
+    
+    ssize_t res = read(o->fd, o->buf + o->buf_len, o->chunk_size);
+    if (res < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            // wait for more data
+            read_async_continue(o);
+            return;
+        }
+        ModuleLog(o->i, BLOG_ERROR, "read failed");
+        goto fail;
+    }
+    
+    if (res > 0) {
+        o->buf_len += res;
+        
+        // continue in the next event loop iteration
+        read_async_continue(o);
+        return;
+    }
+    
+    // end of file
+    read_async_stop(o);
+    
+    if (!(o->fdata = file_data_new(o->buf, o->buf_len, 0))) {
+        ModuleLog(o->i, BLOG_ERROR, "malloc failed");
+        goto fail;
+    }
+    o->buf = NULL;
+    
+    // signal up
+    NCDModuleInst_Backend_Up(o->i);
+    return;
+    
+fail:
+    if (o->fd >= 0) {
+        read_async_stop(o);
+    }
+    free(o->buf);
+    NCDModuleInst_Backend_DeadError(o->i);
+}
+
+static void read_async_timer_handler (void *vo)
+{
+    struct read_async_instance *o = vo;
+    
+    read_async_read(o);
+}
+
+static void read_async_fd_handler (void *vo, int events)
+{
+    struct read_async_instance *o = vo;
+    
+    read_async_read(o);
+}
+
+static void read_async_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    struct read_async_instance *o = vo;
+    o->i = i;
+    
+    // read arguments
+    NCDValRef filename_arg;
+    NCDValRef chunk_size_arg = NCDVal_NewInvalid();
+    if (!NCDVal_ListRead(params->args, 1, &filename_arg) &&
+        !NCDVal_ListRead(params->args, 2, &filename_arg, &chunk_size_arg)
+    ) {
+        ModuleLog(i, BLOG_ERROR, "wrong arity");
+        goto fail0;
+    }
+    if (!NCDVal_IsStringNoNulls(filename_arg)) {
+        ModuleLog(i, BLOG_ERROR, "wrong type");
+        goto fail0;
+    }
+    
+    o->chunk_size = ASYNC_DEFAULT_CHUNK_SIZE;
+    if (!NCDVal_IsInvalid(chunk_size_arg)) {
+        uintmax_t chunk_size;
+        if (!ncd_read_uintmax(chunk_size_arg, &chunk_size) || chunk_size == 0 || chunk_size > SIZE_MAX / 2) {
+            ModuleLog(i, BLOG_ERROR, "wrong chunk_size");
+            goto fail0;
+        }
+        o->chunk_size = chunk_size;
+    }
+    
+    // get null terminated name
+    NCDValNullTermString filename_nts;
+    if (!NCDVal_StringNullTerminate(filename_arg, &filename_nts)) {
+        ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
+        goto fail0;
+    }
+    
+    // open file
+    o->fd = open(filename_nts.data, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    NCDValNullTermString_Free(&filename_nts);
+    if (o->fd < 0) {
+        ModuleLog(i, BLOG_ERROR, "open failed");
+        goto fail0;
+    }
+    
+    struct stat st;
+    if (fstat(o->fd, &st) < 0) {
+        ModuleLog(i, BLOG_ERROR, "fstat failed");
+        goto fail1;
+    }
+    
+    // size the buffer for the whole file if we know how large it is
+    o->buf_size = o->chunk_size;
+    if (S_ISREG(st.st_mode) && (uintmax_t)st.st_size < SIZE_MAX - o->chunk_size) {
+        o->buf_size = st.st_size + o->chunk_size;
+    }
+    
+    // allocate buffer
+    o->buf_len = 0;
+    if (!(o->buf = malloc(o->buf_size))) {
+        ModuleLog(i, BLOG_ERROR, "malloc failed");
+        goto fail1;
+    }
+    
+    // regular files cannot be polled and are read one chunk per event loop
+    // iteration; anything else is read when the reactor reports it readable
+    o->use_bfd = !S_ISREG(st.st_mode);
+    BTimer_Init(&o->timer, 0, read_async_timer_handler, o);
+    if (o->use_bfd) {
+        BFileDescriptor_Init(&o->bfd, o->fd, read_async_fd_handler, o);
+        if (!BReactor_AddFileDescriptor(i->params->iparams->reactor, &o->bfd)) {
+            ModuleLog(i, BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+            goto fail2;
+        }
+    }
+    
+    o->fdata = NULL;
+    
+    // start reading
+    if (o->use_bfd) {
+        BReactor_SetFileDescriptorEvents(i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
+    } else {
+        read_async_continue(o);
+    }
+    return;
+    
+fail2:
+    free(o->buf);
+fail1:
+    if (close(o->fd) < 0) {
+        ModuleLog(i, BLOG_ERROR, "close failed");
+    }
+fail0:
+    NCDModuleInst_Backend_DeadError(i);
+}
+
+static void read_async_func_die (void *vo)
+{
+    struct read_async_instance *o = vo;
+    
+    // stop reading
+    if (o->fd >= 0) {
+        read_async_stop(o);
+    }
+    
+    // release data
+    if (o->fdata) {
+        BRefTarget_Deref(&o->fdata->ref_target);
+    }
+    
+    // free buffer
+    free(o->buf);
+    
+    NCDModuleInst_Backend_Dead(o->i);
+}
+
+static int read_async_func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NCDValRef *out)
+{
+    struct read_async_instance *o = vo;
+    
+    if (name == NCD_STRING_EMPTY) {
+        if (!o->fdata) {
+            return 0;
+        }
+        return file_data_getvar(o->fdata, mem, out);
     }
     
     return 0;
@@ -319,6 +678,12 @@ static struct NCDModule modules[] = {
         .func_die = read_func_die,
         .func_getvar2 = read_func_getvar2,
         .alloc_size = sizeof(struct read_instance)
+    }, {
+        .type = "file_read_async",
+        .func_new2 = read_async_func_new,
+        .func_die = read_async_func_die,
+        .func_getvar2 = read_async_func_getvar2,
+        .alloc_size = sizeof(struct read_async_instance)
     }, {
         .type = "file_write",
         .func_new2 = write_func_new
@@ -29,7 +29,7 @@
  * @section DESCRIPTION
  * 
  * Synopsis:
- *   foreach(list/map collection, string template, list args)
+ *   foreach(list/map collection, string template, list args [, string window])
  * 
  * Description:
  *   Initializes a template process for each element of list, sequentially,
@@ -49,6 +49,17 @@
  *   _val - (maps only) value of the current map entry
  *   _caller.X - X as seen from the foreach() statement
  * 
+ *   If 'window' is given (a positive number), only the processes of the last
+ *   'window' elements are kept once they are up: when an element process goes
+ *   up and there are more than 'window' of them, the oldest one is terminated
+ *   and is not started again. The next element is started once it is gone.
+ *   At most window+1 element processes exist at any time, so a large
+ *   collection can be iterated without instantiating a process for every
+ *   element. This suits template processes which do their work as they go
+ *   up and don't rely on the processes of earlier elements staying up or on
+ *   being deinitialized in reverse order. The statement goes up when the last
+ *   element process is up.
+ * 
  * Synopsis:
  *   foreach_emb(list/map collection, string template, string name1 [, string name2])
  * 
@@ -93,16 +104,23 @@ struct element;
 
 struct instance {
     NCDModuleInst *i;
+    NCDValRef collection;
     NCDValRef template_name;
     NCDValRef args;
     NCD_string_id_t name1;
     NCD_string_id_t name2;
     BTimer timer;
-    struct element *elems;
+    struct element *elems; // slots, element j is in slot j % num_slots
     int type;
     int num_elems;
+    int num_slots;
+    int window; // zero if not limited
+    NCDValMapElem next_map_elem; // for filling elements (maps only)
+    int filled; // filled pointer, elements below it have their values set
+    int bp; // base pointer, elements below it have been retired
     int gp; // good pointer
     int ip; // initialized pointer
+    int retiring; // element at BP is terminating because of the window
     int state;
 };
 
@@ -122,7 +140,9 @@ struct element {
     int state;
 };
 
+static struct element * elem_at (struct instance *o, int j);
 static void assert_state (struct instance *o);
+static int all_up (struct instance *o);
 static void work (struct instance *o);
 static void advance (struct instance *o);
 static void timer_handler (struct instance *o);
@@ -141,46 +161,93 @@ static const char *strings[] = {
     "_index", "_elem", "_key", "_val", NULL
 };
 
+static struct element * elem_at (struct instance *o, int j)
+{
+    ASSERT(j >= o->bp)
+    ASSERT(j < o->filled)
+    ASSERT(j - o->bp < o->num_slots)
+    
+    struct element *e = &o->elems[j % o->num_slots];
+    ASSERT(e->i == j)
+    
+    return e;
+}
+
 static void assert_state (struct instance *o)
 {
     ASSERT(o->num_elems >= 0)
-    ASSERT(o->gp >= 0)
-    ASSERT(o->ip >= 0)
-    ASSERT(o->gp <= o->num_elems)
-    ASSERT(o->ip <= o->num_elems)
+    ASSERT(o->bp >= 0)
+    ASSERT(o->bp <= o->gp)
     ASSERT(o->gp <= o->ip)
+    ASSERT(o->ip <= o->filled)
+    ASSERT(o->filled <= o->num_elems)
+    ASSERT(o->ip - o->bp <= o->num_slots)
+    ASSERT(!o->retiring || o->bp < o->ip)
     
 #ifndef NDEBUG
     // check GP
-    for (int i = 0; i < o->gp; i++) {
-        if (i == o->gp - 1) {
-            ASSERT(o->elems[i].state == ESTATE_UP || o->elems[i].state == ESTATE_DOWN ||
-                   o->elems[i].state == ESTATE_WAITING)
+    for (int i = o->bp; i < o->gp; i++) {
+        struct element *e = elem_at(o, i);
+        if (i == o->bp && o->retiring) {
+            ASSERT(e->state == ESTATE_TERMINATING)
+        } else if (i == o->gp - 1) {
+            ASSERT(e->state == ESTATE_UP || e->state == ESTATE_DOWN ||
+                   e->state == ESTATE_WAITING)
         } else {
-            ASSERT(o->elems[i].state == ESTATE_UP)
+            ASSERT(e->state == ESTATE_UP)
         }
     }
     
     // check IP
-    int ip = o->num_elems;
-    while (ip > 0 && o->elems[ip - 1].state == ESTATE_FORGOTTEN) {
-        ip--;
+    ASSERT(o->ip == o->bp || elem_at(o, o->ip - 1)->state != ESTATE_FORGOTTEN)
+    for (int i = o->ip; i < o->filled && i - o->bp < o->num_slots; i++) {
+        ASSERT(elem_at(o, i)->state == ESTATE_FORGOTTEN)
     }
-    ASSERT(o->ip == ip)
     
     // check gap
     for (int i = o->gp; i < o->ip; i++) {
-        if (i == o->ip - 1) {
-            ASSERT(o->elems[i].state == ESTATE_UP || o->elems[i].state == ESTATE_DOWN ||
-                   o->elems[i].state == ESTATE_WAITING || o->elems[i].state == ESTATE_TERMINATING)
+        struct element *e = elem_at(o, i);
+        if (i == o->ip - 1 || (i == o->bp && o->retiring)) {
+            ASSERT(e->state == ESTATE_UP || e->state == ESTATE_DOWN ||
+                   e->state == ESTATE_WAITING || e->state == ESTATE_TERMINATING)
         } else {
-            ASSERT(o->elems[i].state == ESTATE_UP || o->elems[i].state == ESTATE_DOWN ||
-                   o->elems[i].state == ESTATE_WAITING)
+            ASSERT(e->state == ESTATE_UP || e->state == ESTATE_DOWN ||
+                   e->state == ESTATE_WAITING)
         }
     }
 #endif
 }
 
+static int all_up (struct instance *o)
+{
+    return (o->gp == o->ip && o->gp == o->num_elems && !o->retiring &&
+            (o->window == 0 || o->ip - o->bp <= o->window) &&
+            (o->gp == o->bp || elem_at(o, o->gp - 1)->state == ESTATE_UP));
+}
+
+static void fill_element (struct instance *o)
+{
+    ASSERT(o->filled < o->num_elems)
+    
+    struct element *e = &o->elems[o->filled % o->num_slots];
+    ASSERT(e->state == ESTATE_FORGOTTEN)
+    
+    e->i = o->filled;
+    
+    switch (o->type) {
+        case NCDVAL_LIST: {
+            e->list_elem = NCDVal_ListGet(o->collection, e->i);
+        } break;
+        case NCDVAL_MAP: {
+            e->map_key = NCDVal_MapElemKey(o->collection, o->next_map_elem);
+            e->map_val = NCDVal_MapElemVal(o->collection, o->next_map_elem);
+            o->next_map_elem = NCDVal_MapOrderedNext(o->collection, o->next_map_elem);
+        } break;
+    }
+    
+    o->filled++;
+}
+
 static void work (struct instance *o)
 {
     assert_state(o);
@@ -192,7 +259,7 @@ static void work (struct instance *o)
         return;
     }
     
-    if (o->state == ISTATE_UP && !(o->gp == o->ip && o->gp == o->num_elems && (o->gp == 0 || o->elems[o->gp - 1].state == ESTATE_UP))) {
+    if (o->state == ISTATE_UP && !all_up(o)) {
         // signal down
         NCDModuleInst_Backend_Down(o->i);
         
@@ -203,7 +270,7 @@ static void work (struct instance *o)
     
     if (o->gp < o->ip) {
         // get last element
-        struct element *le = &o->elems[o->ip - 1];
+        struct element *le = elem_at(o, o->ip - 1);
         ASSERT(le->state != ESTATE_FORGOTTEN)
         
         // start terminating if not already
@@ -224,7 +291,7 @@ static void work (struct instance *o)
         return;
     }
     
-    if (o->gp == o->num_elems && (o->gp == 0 || o->elems[o->gp - 1].state == ESTATE_UP)) {
+    if (all_up(o)) {
         if (o->state == ISTATE_WORKING) {
             // signal up
             NCDModuleInst_Backend_Up(o->i);
@@ -236,9 +303,9 @@ static void work (struct instance *o)
         return;
     }
     
-    if (o->gp > 0 && o->elems[o->gp - 1].state == ESTATE_WAITING) {
+    if (o->gp > o->bp && elem_at(o, o->gp - 1)->state == ESTATE_WAITING) {
         // get last element
-        struct element *le = &o->elems[o->gp - 1];
+        struct element *le = elem_at(o, o->gp - 1);
         
         // continue process
         NCDModuleProcess_Continue(&le->process);
@@ -248,11 +315,28 @@ static void work (struct instance *o)
         return;
     }
     
-    if (o->gp > 0 && o->elems[o->gp - 1].state == ESTATE_DOWN) {
+    if (o->gp > o->bp && elem_at(o, o->gp - 1)->state == ESTATE_DOWN) {
         return;
     }
     
-    ASSERT(o->gp == 0 || o->elems[o->gp - 1].state == ESTATE_UP)
+    ASSERT(o->gp == o->bp || elem_at(o, o->gp - 1)->state == ESTATE_UP)
+    
+    if (o->retiring) {
+        // wait for the retired element to go away
+        return;
+    }
+    
+    if (o->window > 0 && o->ip - o->bp > o->window) {
+        // get first element
+        struct element *be = elem_at(o, o->bp);
+        ASSERT(be->state == ESTATE_UP)
+        
+        // retire it
+        NCDModuleProcess_Terminate(&be->process);
+        be->state = ESTATE_TERMINATING;
+        o->retiring = 1;
+        return;
+    }
     
     advance(o);
     return;
@@ -263,11 +347,18 @@ static void advance (struct instance *o)
     assert_state(o);
     ASSERT(o->gp == o->ip)
     ASSERT(o->gp < o->num_elems)
-    ASSERT(o->gp == 0 || o->elems[o->gp - 1].state == ESTATE_UP)
-    ASSERT(o->elems[o->gp].state == ESTATE_FORGOTTEN)
+    ASSERT(o->gp == o->bp || elem_at(o, o->gp - 1)->state == ESTATE_UP)
+    ASSERT(o->ip - o->bp < o->num_slots)
+    ASSERT(!o->retiring)
+    
+    // set the values of the next element when reaching it the first time
+    if (o->gp == o->filled) {
+        fill_element(o);
+    }
     
     // get next element
-    struct element *e = &o->elems[o->gp];
+    struct element *e = elem_at(o, o->gp);
+    ASSERT(e->state == ESTATE_FORGOTTEN)
     
     // init process
     if (!NCDModuleProcess_InitValue(&e->process, o->i, o->template_name, o->args, element_process_handler_event)) {
@@ -296,8 +387,7 @@ static void timer_handler (struct instance *o)
     assert_state(o);
     ASSERT(o->gp == o->ip)
     ASSERT(o->gp < o->num_elems)
-    ASSERT(o->gp == 0 || o->elems[o->gp - 1].state == ESTATE_UP)
-    ASSERT(o->elems[o->gp].state == ESTATE_FORGOTTEN)
+    ASSERT(o->gp == o->bp || elem_at(o, o->gp - 1)->state == ESTATE_UP)
     
     advance(o);
     return;
@@ -308,6 +398,7 @@ static void element_process_handler_event (NCDModuleProcess *process, int event)
     struct element *e = UPPER_OBJECT(process, struct element, process);
     struct instance *o = e->inst;
     assert_state(o);
+    ASSERT(e->i >= o->bp)
     ASSERT(e->i < o->ip)
     ASSERT(e->state != ESTATE_FORGOTTEN)
     
@@ -335,8 +426,6 @@ static void element_process_handler_event (NCDModuleProcess *process, int event)
         
         case NCDMODULEPROCESS_EVENT_TERMINATED: {
             ASSERT(e->state == ESTATE_TERMINATING)
-            ASSERT(o->gp < o->ip)
-            ASSERT(o->ip == e->i + 1)
             
             // free process
             NCDModuleProcess_Free(&e->process);
@@ -344,8 +433,20 @@ static void element_process_handler_event (NCDModuleProcess *process, int event)
             // set element state forgotten
             e->state = ESTATE_FORGOTTEN;
             
-            // decrement IP
-            o->ip--;
+            if (o->retiring && e->i == o->bp) {
+                // increment BP, the element is not coming back
+                o->retiring = 0;
+                o->bp++;
+                if (o->gp < o->bp) {
+                    o->gp = o->bp;
+                }
+            } else {
+                ASSERT(o->gp < o->ip)
+                ASSERT(o->ip == e->i + 1)
+                
+                // decrement IP
+                o->ip--;
+            }
         } break;
         
         default: ASSERT(0);
@@ -478,16 +579,19 @@ static int element_map_val_object_func_getvar (const NCDObject *obj, NCD_string_
     return 1;
 }
 
-static void func_new_common (void *vo, NCDModuleInst *i, NCDValRef collection, NCDValRef template_name, NCDValRef args, NCD_string_id_t name1, NCD_string_id_t name2)
+static void func_new_common (void *vo, NCDModuleInst *i, NCDValRef collection, NCDValRef template_name, NCDValRef args, NCD_string_id_t name1, NCD_string_id_t name2, int window)
 {
     ASSERT(!NCDVal_IsInvalid(collection))
     ASSERT(NCDVal_IsString(template_name))
     ASSERT(NCDVal_IsInvalid(args) || NCDVal_IsList(args))
     ASSERT(name1 >= 0)
+    ASSERT(window >= 0)
+    ASSERT(window < INT_MAX)
     
     struct instance *o = vo;
     o->i = i;
     
+    o->collection = collection;
     o->type = NCDVal_Type(collection);
     o->template_name = template_name;
     o->args = args;
@@ -499,7 +603,6 @@ static void func_new_common (void *vo, NCDModuleInst *i, NCDValRef collection, N
     BTimer_Init(&o->timer, retry_time, (BTimer_handler)timer_handler, o);
     
     size_t num_elems;
-    NCDValMapElem cur_map_elem;
     
     switch (o->type) {
         case NCDVAL_LIST: {
@@ -507,7 +610,7 @@ static void func_new_common (void *vo, NCDModuleInst *i, NCDValRef collection, N
         } break;
         case NCDVAL_MAP: {
             num_elems = NCDVal_MapCount(collection);
-            cur_map_elem = NCDVal_MapOrderedFirst(collection); 
+            o->next_map_elem = NCDVal_MapOrderedFirst(collection);
         } break;
         default:
             ModuleLog(i, BLOG_ERROR, "invalid collection type");
@@ -519,42 +622,36 @@ static void func_new_common (void *vo, NCDModuleInst *i, NCDValRef collection, N
         goto fail0;
     }
     o->num_elems = num_elems;
+    o->window = window;
+    
+    // with a window, only window+1 elements exist at a time
+    o->num_slots = (window > 0 && window < o->num_elems) ? (window + 1) : o->num_elems;
     
-    // allocate elements
-    if (!(o->elems = BAllocArray(o->num_elems, sizeof(o->elems[0])))) {
+    // allocate element slots
+    if (!(o->elems = BAllocArray(o->num_slots, sizeof(o->elems[0])))) {
         ModuleLog(i, BLOG_ERROR, "BAllocArray failed");
         goto fail0;
     }
     
-    for (int j = 0; j < o->num_elems; j++) {
+    for (int j = 0; j < o->num_slots; j++) {
         struct element *e = &o->elems[j];
         
         // set instance
         e->inst = o;
         
-        // set index
-        e->i = j;
-        
         // set state forgotten
         e->state = ESTATE_FORGOTTEN;
-        
-        // set values
-        switch (o->type) {
-            case NCDVAL_LIST: {
-                e->list_elem = NCDVal_ListGet(collection, j);
-            } break;
-            case NCDVAL_MAP: {
-                e->map_key = NCDVal_MapElemKey(collection, cur_map_elem);
-                e->map_val = NCDVal_MapElemVal(collection, cur_map_elem);
-                cur_map_elem = NCDVal_MapOrderedNext(collection, cur_map_elem);
-            } break;
-        }
     }
     
-    // set GP and IP zero
+    // set pointers zero
+    o->filled = 0;
+    o->bp = 0;
     o->gp = 0;
     o->ip = 0;
     
+    // not retiring
+    o->retiring = 0;
+    
     // set state working
     o->state = ISTATE_WORKING;
     
@@ -571,7 +668,10 @@ static void func_new_foreach (void *vo, NCDModuleInst *i, const struct NCDModule
     NCDValRef arg_collection;
     NCDValRef arg_template;
     NCDValRef arg_args;
-    if (!NCDVal_ListRead(params->args, 3, &arg_collection, &arg_template, &arg_args)) {
+    NCDValRef arg_window = NCDVal_NewInvalid();
+    if (!NCDVal_ListRead(params->args, 3, &arg_collection, &arg_template, &arg_args) &&
+        !NCDVal_ListRead(params->args, 4, &arg_collection, &arg_template, &arg_args, &arg_window)
+    ) {
         ModuleLog(i, BLOG_ERROR, "wrong arity");
         goto fail0;
     }
@@ -580,6 +680,16 @@ static void func_new_foreach (void *vo, NCDModuleInst *i, const struct NCDModule
         goto fail0;
     }
     
+    int window = 0;
+    if (!NCDVal_IsInvalid(arg_window)) {
+        uintmax_t window_val;
+        if (!ncd_read_uintmax(arg_window, &window_val) || window_val == 0 || window_val >= INT_MAX) {
+            ModuleLog(i, BLOG_ERROR, "bad window");
+            goto fail0;
+        }
+        window = window_val;
+    }
+    
     NCD_string_id_t name1;
     NCD_string_id_t name2;
     
@@ -597,7 +707,7 @@ static void func_new_foreach (void *vo, NCDModuleInst *i, const struct NCDModule
             goto fail0;
     }
     
-    func_new_common(vo, i, arg_collection, arg_template, arg_args, name1, name2);
+    func_new_common(vo, i, arg_collection, arg_template, arg_args, name1, name2, window);
     return;
     
 fail0:
@@ -635,7 +745,7 @@ static void func_new_foreach_emb (void *vo, NCDModuleInst *i, const struct NCDMo
         }
     }
     
-    func_new_common(vo, i, arg_collection, arg_template, NCDVal_NewInvalid(), name1, name2);
+    func_new_common(vo, i, arg_collection, arg_template, NCDVal_NewInvalid(), name1, name2, 0);
     return;
     
 fail0:
@@ -644,8 +754,9 @@ fail0:
 
 static void instance_free (struct instance *o)
 {
-    ASSERT(o->gp == 0)
-    ASSERT(o->ip == 0)
+    ASSERT(o->gp == o->bp)
+    ASSERT(o->ip == o->bp)
+    ASSERT(!o->retiring)
     
     // free elements
     BFree(o->elems);
@@ -662,8 +773,8 @@ static void func_die (void *vo)
     assert_state(o);
     ASSERT(o->state != ISTATE_TERMINATING)
     
-    // set GP zero
-    o->gp = 0;
+    // set GP to BP, to terminate all remaining elements
+    o->gp = o->bp;
     
     // set state terminating
     o->state = ISTATE_TERMINATING;
@@ -32,12 +32,18 @@
  *   from_string(string str)
  * Variables:
  *   (empty) - str, parsed as a value
+ * 
+ * Synopsis:
+ *   from_binary(string str)
+ * Variables:
+ *   (empty) - str, decoded from the binary format produced by to_binary()
  */
 
 #include <stdlib.h>
 #include <string.h>
 
 #include <ncd/NCDValParser.h>
+#include <ncd/NCDValBinary.h>
 
 #include <ncd/module_common.h>
 
@@ -49,7 +55,7 @@ struct instance {
     NCDValRef val;
 };
 
-static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+static void func_new_common (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params, int binary)
 {
     struct instance *o = vo;
     o->i = i;
@@ -69,7 +75,9 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     NCDValMem_Init(&o->mem, i->params->iparams->string_index);
     
     // parse value string
-    if (!NCDValParser_Parse(NCDVal_StringMemRef(str_arg), &o->mem, &o->val)) {
+    int res = binary ? NCDValBinary_Decode(NCDVal_StringMemRef(str_arg), &o->mem, &o->val) :
+                       NCDValParser_Parse(NCDVal_StringMemRef(str_arg), &o->mem, &o->val);
+    if (!res) {
         ModuleLog(i, BLOG_ERROR, "failed to parse");
         goto fail1;
     }
@@ -84,6 +92,16 @@ fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
 
+static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    func_new_common(vo, i, params, 0);
+}
+
+static void binary_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    func_new_common(vo, i, params, 1);
+}
+
 static void func_die (void *vo)
 {
     struct instance *o = vo;
@@ -113,6 +131,12 @@ static struct NCDModule modules[] = {
         .func_die = func_die,
         .func_getvar2 = func_getvar2,
         .alloc_size = sizeof(struct instance)
+    }, {
+        .type = "from_binary",
+        .func_new2 = binary_func_new,
+        .func_die = func_die,
+        .func_getvar2 = func_getvar2,
+        .alloc_size = sizeof(struct instance)
     }, {
         .type = NULL
     }
@@ -81,6 +81,7 @@ extern const struct NCDModuleGroup ncdmodule_log;
 extern const struct NCDModuleGroup ncdmodule_getenv;
 extern const struct NCDModuleGroup ncdmodule_basic_functions;
 extern const struct NCDModuleGroup ncdmodule_objref;
+extern const struct NCDModuleGroup ncdmodule_parallel;
 #ifndef BADVPN_EMSCRIPTEN
 extern const struct NCDModuleGroup ncdmodule_regex_match;
 extern const struct NCDModuleGroup ncdmodule_run;
@@ -168,6 +169,7 @@ static const struct NCDModuleGroup *ncd_modules[] = {
     &ncdmodule_getenv,
     &ncdmodule_basic_functions,
     &ncdmodule_objref,
+    &ncdmodule_parallel,
 #ifndef BADVPN_EMSCRIPTEN
     &ncdmodule_regex_match,
     &ncdmodule_run,
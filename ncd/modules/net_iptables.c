@@ -90,6 +90,23 @@
  *   deinit: ebtables -t table -X chain
  * 
  * Synopsis:
+ *   net.iptables.batch()
+ * Description:
+ *   While this statement exists, the iptables and ip6tables append, insert, policy
+ *   and newchain statements initialized anywhere in the program are applied in
+ *   batches through a single "iptables-restore --noflush" (or ip6tables-restore)
+ *   invocation per table, instead of running one command for each. They go up as
+ *   soon as they are queued, and die immediately with their removal queued.
+ *   The queue is flushed once the interpreter has nothing else to do. If a batch
+ *   fails, nothing in it is applied, and the statements which were added in it
+ *   die with an error. On deinitialization, waits until all queued commands have
+ *   been applied, so place it before the rules it should cover.
+ *   Commands with arguments which cannot be expressed in the iptables-restore
+ *   format (empty or containing a newline), ebtables commands, and commands for
+ *   which iptables-restore is not found are still run individually, after the
+ *   commands queued so far.
+ * 
+ * Synopsis:
  *   net.iptables.lock()
  * Description:
  *   Use at the beginning of a block of custom iptables/ebtables commands to make sure
@@ -111,9 +128,15 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <stdio.h>
+
 #include <misc/debug.h>
 #include <misc/find_program.h>
 #include <misc/balloc.h>
+#include <misc/expstring.h>
+#include <misc/offset.h>
+#include <misc/strdup.h>
+#include <structure/LinkedList1.h>
 #include <ncd/modules/command_template.h>
 
 #include <ncd/module_common.h>
@@ -122,15 +145,53 @@
 
 static void template_free_func (void *vo, int is_error);
 
+#define BATCH_OP_QUEUED 1
+#define BATCH_OP_RUNNING 2
+#define BATCH_OP_APPLIED 3
+
+#define FLUSH_STATE_IDLE 1
+#define FLUSH_STATE_LOCKING 2
+#define FLUSH_STATE_RUNNING 3
+
 struct global {
     BEventLock iptables_lock;
+    BProcessManager *manager;
+    int batch_users;
+    LinkedList1 batch_waiters;
+    LinkedList1 queue;
+    LinkedList1 running;
+    BPending flush_job;
+    BEventLockJob flush_lock_job;
+    BProcess flush_process;
+    int flush_state;
+};
+
+struct instance;
+
+// a batched command; lives as long as its statement, then for as long as
+// its removal is queued
+struct batch_op {
+    struct instance *inst;
+    const char *restore_prog;
+    char *table;
+    char *line;
+    char *undo_line;
+    int removing;
+    int state;
+    LinkedList1Node list_node;
 };
 
 struct instance {
     NCDModuleInst *i;
+    struct batch_op *op;
     command_template_instance cti;
 };
 
+struct batch_instance {
+    NCDModuleInst *i;
+    LinkedList1Node waiters_node;
+};
+
 struct unlock_instance;
 
 #define LOCK_STATE_LOCKING 1
@@ -432,6 +493,248 @@ static void lock_job_handler (struct lock_instance *o)
     }
 }
 
+static int append_restore_arg (ExpString *str, const char *arg)
+{
+    // iptables-restore splits on whitespace and understands double quotes,
+    // with backslash escapes inside them
+    if (!strpbrk(arg, " \t\"\\'")) {
+        return ExpString_Append(str, arg);
+    }
+    
+    if (!ExpString_AppendChar(str, '"')) {
+        return 0;
+    }
+    
+    for (const char *c = arg; *c; c++) {
+        if ((*c == '"' || *c == '\\') && !ExpString_AppendChar(str, '\\')) {
+            return 0;
+        }
+        if (!ExpString_AppendChar(str, *c)) {
+            return 0;
+        }
+    }
+    
+    return ExpString_AppendChar(str, '"');
+}
+
+// turns "prog -t table cmd ..." into "cmd ..." for iptables-restore, or returns
+// NULL if the arguments cannot be expressed in its format
+static char * make_restore_line (char **argv)
+{
+    ExpString str;
+    if (!ExpString_Init(&str)) {
+        return NULL;
+    }
+    
+    for (size_t j = 3; argv[j]; j++) {
+        if (!*argv[j] || strchr(argv[j], '\n')) {
+            goto fail;
+        }
+        if ((j > 3 && !ExpString_AppendChar(&str, ' ')) || !append_restore_arg(&str, argv[j])) {
+            goto fail;
+        }
+    }
+    
+    return ExpString_Get(&str);
+    
+fail:
+    ExpString_Free(&str);
+    return NULL;
+}
+
+static void batch_schedule_flush (struct global *g)
+{
+    // don't move the job ahead if it's already set, so that the flush
+    // happens only after the work which is already scheduled
+    if (g->flush_state == FLUSH_STATE_IDLE && !LinkedList1_IsEmpty(&g->queue) && !BPending_IsSet(&g->flush_job)) {
+        BPending_Set(&g->flush_job);
+    }
+}
+
+static void batch_enqueue (struct global *g, struct batch_op *op)
+{
+    op->state = BATCH_OP_QUEUED;
+    LinkedList1_Append(&g->queue, &op->list_node);
+    
+    batch_schedule_flush(g);
+}
+
+static void batch_op_free (struct batch_op *op)
+{
+    free(op->undo_line);
+    free(op->line);
+    free(op->table);
+    BFree(op);
+}
+
+static void batch_check_drained (struct global *g)
+{
+    if (g->flush_state != FLUSH_STATE_IDLE || !LinkedList1_IsEmpty(&g->queue)) {
+        return;
+    }
+    
+    LinkedList1Node *ln;
+    while (ln = LinkedList1_GetFirst(&g->batch_waiters)) {
+        struct batch_instance *bo = UPPER_OBJECT(ln, struct batch_instance, waiters_node);
+        LinkedList1_Remove(&g->batch_waiters, &bo->waiters_node);
+        NCDModuleInst_Backend_Dead(bo->i);
+    }
+}
+
+static void batch_finish (struct global *g, int success)
+{
+    // detach the ops from the instances first, the instances may be freed
+    // as each of them is handled
+    LinkedList1Node *ln;
+    while (ln = LinkedList1_GetFirst(&g->running)) {
+        struct batch_op *op = UPPER_OBJECT(ln, struct batch_op, list_node);
+        LinkedList1_Remove(&g->running, &op->list_node);
+        ASSERT(op->state == BATCH_OP_RUNNING)
+        
+        if (success) {
+            if (op->removing) {
+                batch_op_free(op);
+            }
+            else if (!op->inst) {
+                // the statement died while the command was running
+                op->removing = 1;
+                batch_enqueue(g, op);
+            }
+            else {
+                op->state = BATCH_OP_APPLIED;
+            }
+        } else {
+            if (op->removing) {
+                BLog(BLOG_ERROR, "failed to remove: -t %s %s", op->table, op->line);
+                batch_op_free(op);
+            }
+            else if (!op->inst) {
+                batch_op_free(op);
+            }
+            else {
+                struct instance *o = op->inst;
+                ModuleLog(o->i, BLOG_ERROR, "batch failed: -t %s %s", op->table, op->line);
+                o->op = NULL;
+                batch_op_free(op);
+                NCDModuleInst_Backend_DeadError(o->i);
+            }
+        }
+    }
+    
+    g->flush_state = FLUSH_STATE_IDLE;
+    
+    batch_schedule_flush(g);
+    batch_check_drained(g);
+}
+
+static void flush_process_handler (struct global *g, int normally, uint8_t normally_exit_status)
+{
+    ASSERT(g->flush_state == FLUSH_STATE_RUNNING)
+    
+    BProcess_Free(&g->flush_process);
+    BEventLockJob_Release(&g->flush_lock_job);
+    
+    int success = (normally && normally_exit_status == 0);
+    if (!success) {
+        BLog(BLOG_ERROR, "batched iptables-restore failed");
+    }
+    
+    batch_finish(g, success);
+}
+
+static void flush_lock_handler (struct global *g)
+{
+    ASSERT(g->flush_state == FLUSH_STATE_LOCKING)
+    ASSERT(!LinkedList1_IsEmpty(&g->queue))
+    ASSERT(LinkedList1_IsEmpty(&g->running))
+    
+    // take everything for the table of the first queued command; the order
+    // within a table is kept, and different tables are independent
+    struct batch_op *first = UPPER_OBJECT(LinkedList1_GetFirst(&g->queue), struct batch_op, list_node);
+    const char *restore_prog = first->restore_prog;
+    char *table = first->table;
+    
+    FILE *f = tmpfile();
+    if (!f) {
+        BLog(BLOG_ERROR, "tmpfile failed");
+    }
+    
+    if (f) {
+        fprintf(f, "*%s\n", table);
+    }
+    
+    size_t count = 0;
+    LinkedList1Node *ln = LinkedList1_GetFirst(&g->queue);
+    while (ln) {
+        struct batch_op *op = UPPER_OBJECT(ln, struct batch_op, list_node);
+        ln = LinkedList1Node_Next(ln);
+        
+        if (op->restore_prog != restore_prog || strcmp(op->table, table)) {
+            continue;
+        }
+        
+        if (f) {
+            fprintf(f, "%s\n", op->removing ? op->undo_line : op->line);
+        }
+        
+        LinkedList1_Remove(&g->queue, &op->list_node);
+        LinkedList1_Append(&g->running, &op->list_node);
+        op->state = BATCH_OP_RUNNING;
+        count++;
+    }
+    
+    g->flush_state = FLUSH_STATE_RUNNING;
+    
+    if (!f) {
+        goto fail0;
+    }
+    
+    fprintf(f, "COMMIT\n");
+    if (fflush(f) != 0 || ferror(f) || fseek(f, 0, SEEK_SET) != 0) {
+        BLog(BLOG_ERROR, "failed to write batch");
+        goto fail1;
+    }
+    
+    char *exec = badvpn_find_program(restore_prog);
+    if (!exec) {
+        BLog(BLOG_ERROR, "failed to find program: %s", restore_prog);
+        goto fail1;
+    }
+    
+    BLog(BLOG_INFO, "%s: applying %zu commands to table %s", restore_prog, count, table);
+    
+    char *argv[] = {exec, "--noflush", NULL};
+    int fds[] = {fileno(f), -1};
+    int fds_map[] = {0};
+    struct BProcess_params params = {NULL, fds, fds_map, 0};
+    
+    int res = BProcess_Init2(&g->flush_process, g->manager, (BProcess_handler)flush_process_handler, g, exec, argv, params);
+    free(exec);
+    if (!res) {
+        BLog(BLOG_ERROR, "BProcess_Init2 failed");
+        goto fail1;
+    }
+    
+    fclose(f);
+    return;
+    
+fail1:
+    fclose(f);
+fail0:
+    BEventLockJob_Release(&g->flush_lock_job);
+    batch_finish(g, 0);
+}
+
+static void flush_job_handler (struct global *g)
+{
+    if (g->flush_state != FLUSH_STATE_IDLE || LinkedList1_IsEmpty(&g->queue)) {
+        return;
+    }
+    
+    BEventLockJob_Wait(&g->flush_lock_job);
+    g->flush_state = FLUSH_STATE_LOCKING;
+}
+
 static int func_globalinit (struct NCDInterpModuleGroup *group, const struct NCDModuleInst_iparams *params)
 {
     // allocate global state structure
@@ -447,12 +750,42 @@ static int func_globalinit (struct NCDInterpModuleGroup *group, const struct NCD
     // init iptables lock
     BEventLock_Init(&g->iptables_lock, BReactor_PendingGroup(params->reactor));
     
+    // init batching
+    g->manager = params->manager;
+    g->batch_users = 0;
+    LinkedList1_Init(&g->batch_waiters);
+    LinkedList1_Init(&g->queue);
+    LinkedList1_Init(&g->running);
+    BPending_Init(&g->flush_job, BReactor_PendingGroup(params->reactor), (BPending_handler)flush_job_handler, g);
+    BEventLockJob_Init(&g->flush_lock_job, &g->iptables_lock, (BEventLock_handler)flush_lock_handler, g);
+    g->flush_state = FLUSH_STATE_IDLE;
+    
     return 1;
 }
 
 static void func_globalfree (struct NCDInterpModuleGroup *group)
 {
     struct global *g = group->group_state;
+    ASSERT(g->batch_users == 0)
+    ASSERT(LinkedList1_IsEmpty(&g->batch_waiters))
+    
+    // abandon a running batch
+    if (g->flush_state == FLUSH_STATE_RUNNING) {
+        BProcess_Free(&g->flush_process);
+    }
+    
+    // drop commands which were never applied
+    LinkedList1Node *ln;
+    while ((ln = LinkedList1_GetFirst(&g->queue)) || (ln = LinkedList1_GetFirst(&g->running))) {
+        struct batch_op *op = UPPER_OBJECT(ln, struct batch_op, list_node);
+        ASSERT(!op->inst)
+        LinkedList1_Remove(op->state == BATCH_OP_QUEUED ? &g->queue : &g->running, &op->list_node);
+        batch_op_free(op);
+    }
+    
+    // free batching
+    BEventLockJob_Free(&g->flush_lock_job);
+    BPending_Free(&g->flush_job);
     
     // free iptables lock
     BEventLock_Free(&g->iptables_lock);
@@ -461,11 +794,75 @@ static void func_globalfree (struct NCDInterpModuleGroup *group)
     BFree(g);
 }
 
-static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params, command_template_build_cmdline build_cmdline)
+static int batch_new (struct instance *o, const struct NCDModuleInst_new_params *params, command_template_build_cmdline build_cmdline, const char *restore_prog)
+{
+    struct global *g = ModuleGlobal(o->i);
+    
+    char *exec;
+    CmdLine cl;
+    if (!build_cmdline(o->i, params->args, 0, &exec, &cl)) {
+        goto fail0;
+    }
+    free(exec);
+    
+    char *undo_exec;
+    CmdLine undo_cl;
+    if (!build_cmdline(o->i, params->args, 1, &undo_exec, &undo_cl)) {
+        goto fail1;
+    }
+    free(undo_exec);
+    
+    struct batch_op *op = BAlloc(sizeof(*op));
+    if (!op) {
+        goto fail2;
+    }
+    
+    op->inst = o;
+    op->restore_prog = restore_prog;
+    op->removing = 0;
+    op->table = b_strdup(CmdLine_Get(&cl)[2]);
+    op->line = make_restore_line(CmdLine_Get(&cl));
+    op->undo_line = make_restore_line(CmdLine_Get(&undo_cl));
+    
+    if (!op->table || !op->line || !op->undo_line) {
+        batch_op_free(op);
+        goto fail2;
+    }
+    
+    CmdLine_Free(&undo_cl);
+    CmdLine_Free(&cl);
+    
+    o->op = op;
+    batch_enqueue(g, op);
+    
+    NCDModuleInst_Backend_Up(o->i);
+    return 1;
+    
+fail2:
+    CmdLine_Free(&undo_cl);
+fail1:
+    CmdLine_Free(&cl);
+fail0:
+    return 0;
+}
+
+static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params, command_template_build_cmdline build_cmdline, const char *restore_prog)
 {
     struct global *g = ModuleGlobal(i);
     struct instance *o = vo;
     o->i = i;
+    o->op = NULL;
+    
+    // try batching, falling back to running the command on its own
+    if (restore_prog && g->batch_users > 0 && batch_new(o, params, build_cmdline, restore_prog)) {
+        return;
+    }
+    
+    // let the queued commands go first, the lock is taken in order
+    if (g->flush_state == FLUSH_STATE_IDLE && !LinkedList1_IsEmpty(&g->queue)) {
+        BPending_Unset(&g->flush_job);
+        flush_job_handler(g);
+    }
     
     command_template_new(&o->cti, i, params, build_cmdline, template_free_func, o, BLOG_CURRENT_CHANNEL, &g->iptables_lock);
 }
@@ -483,69 +880,130 @@ void template_free_func (void *vo, int is_error)
 
 static void append_iptables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_iptables_append_cmdline);
+    func_new(vo, i, params, build_iptables_append_cmdline, "iptables-restore");
 }
 
 static void insert_iptables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_iptables_insert_cmdline);
+    func_new(vo, i, params, build_iptables_insert_cmdline, "iptables-restore");
 }
 
 static void policy_iptables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_iptables_policy_cmdline);
+    func_new(vo, i, params, build_iptables_policy_cmdline, "iptables-restore");
 }
 
 static void newchain_iptables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_iptables_newchain_cmdline);
+    func_new(vo, i, params, build_iptables_newchain_cmdline, "iptables-restore");
 }
 
 static void append_ip6tables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ip6tables_append_cmdline);
+    func_new(vo, i, params, build_ip6tables_append_cmdline, "ip6tables-restore");
 }
 
 static void insert_ip6tables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ip6tables_insert_cmdline);
+    func_new(vo, i, params, build_ip6tables_insert_cmdline, "ip6tables-restore");
 }
 
 static void policy_ip6tables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ip6tables_policy_cmdline);
+    func_new(vo, i, params, build_ip6tables_policy_cmdline, "ip6tables-restore");
 }
 
 static void newchain_ip6tables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ip6tables_newchain_cmdline);
+    func_new(vo, i, params, build_ip6tables_newchain_cmdline, "ip6tables-restore");
 }
 
 static void append_ebtables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ebtables_append_cmdline);
+    func_new(vo, i, params, build_ebtables_append_cmdline, NULL);
 }
 
 static void insert_ebtables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ebtables_insert_cmdline);
+    func_new(vo, i, params, build_ebtables_insert_cmdline, NULL);
 }
 
 static void policy_ebtables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ebtables_policy_cmdline);
+    func_new(vo, i, params, build_ebtables_policy_cmdline, NULL);
 }
 
 static void newchain_ebtables_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
-    func_new(vo, i, params, build_ebtables_newchain_cmdline);
+    func_new(vo, i, params, build_ebtables_newchain_cmdline, NULL);
 }
 
 static void func_die (void *vo)
 {
     struct instance *o = vo;
     
-    command_template_die(&o->cti);
+    if (!o->op) {
+        command_template_die(&o->cti);
+        return;
+    }
+    
+    struct global *g = ModuleGlobal(o->i);
+    struct batch_op *op = o->op;
+    ASSERT(op->inst == o)
+    ASSERT(!op->removing)
+    
+    switch (op->state) {
+        case BATCH_OP_QUEUED: {
+            // never applied, just forget it
+            LinkedList1_Remove(&g->queue, &op->list_node);
+            batch_op_free(op);
+        } break;
+        
+        case BATCH_OP_RUNNING: {
+            // removal is queued once the batch completes
+            op->inst = NULL;
+        } break;
+        
+        case BATCH_OP_APPLIED: {
+            op->inst = NULL;
+            op->removing = 1;
+            batch_enqueue(g, op);
+        } break;
+        
+        default: ASSERT(0);
+    }
+    
+    NCDModuleInst_Backend_Dead(o->i);
+}
+
+static void batch_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    struct global *g = ModuleGlobal(i);
+    struct batch_instance *o = vo;
+    o->i = i;
+    
+    if (!NCDVal_ListRead(params->args, 0)) {
+        ModuleLog(i, BLOG_ERROR, "wrong arity");
+        NCDModuleInst_Backend_DeadError(i);
+        return;
+    }
+    
+    g->batch_users++;
+    
+    NCDModuleInst_Backend_Up(i);
+}
+
+static void batch_func_die (void *vo)
+{
+    struct batch_instance *o = vo;
+    struct global *g = ModuleGlobal(o->i);
+    ASSERT(g->batch_users > 0)
+    
+    g->batch_users--;
+    
+    // wait for queued commands to be applied
+    LinkedList1_Append(&g->batch_waiters, &o->waiters_node);
+    batch_check_drained(g);
 }
 
 static void lock_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
@@ -716,6 +1174,11 @@ static struct NCDModule modules[] = {
         .func_new2 = newchain_ebtables_func_new,
         .func_die = func_die,
         .alloc_size = sizeof(struct instance)
+    }, {
+        .type = "net.iptables.batch",
+        .func_new2 = batch_func_new,
+        .func_die = batch_func_die,
+        .alloc_size = sizeof(struct batch_instance)
     }, {
         .type = "net.iptables.lock",
         .func_new2 = lock_func_new,
@@ -40,6 +40,10 @@
  *     CIDR notation (a.b.c.d/n).
  *     If 'gateway' is "none", the route will only be associated with an interface.
  *     If 'gateway' is "blackhole", the route will be a blackhole route (and 'ifname' is unused).
+ *     With --keep-on-backtrack, the route is kept when a preceding statement goes
+ *     down as long as the arguments do not refer to it. The kernel removes routes
+ *     through an interface when the interface disappears, so take 'ifname' from the
+ *     statement which waits for the interface if that one may go down.
  */
 
 #include <stdlib.h>
@@ -198,6 +202,7 @@ static struct NCDModule modules[] = {
         .type = "net.ipv4.route",
         .func_new2 = func_new,
         .func_die = func_die,
+        .flags = NCDMODULE_FLAG_KEEP_ON_BACKTRACK,
         .alloc_size = sizeof(struct instance)
     }, {
         .type = NULL
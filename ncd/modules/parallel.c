@@ -0,0 +1,312 @@
+/**
+ * @file parallel.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Synopsis:
+ *   parallel(string template1, ..., string templateN)
+ * 
+ * Description:
+ *   Starts a template process for each of the given templates, all at once,
+ *   and goes up when all of them have gone up. The desugaring process
+ *   converts Parallel clauses into this statement, with one template for
+ *   every statement within the clause. The template processes have direct
+ *   access to objects as seen from this statement, but not to each other.
+ *   Objects within the template processes can be accessed through this
+ *   statement; the first template process which resolves the name wins.
+ * 
+ *   If a template process goes down after this statement went up, this
+ *   statement goes down, and the template process continues only after the
+ *   statements following this one have been deinitialized, like with call().
+ *   On termination, all template processes are requested to terminate at
+ *   once, and this statement dies when all of them have terminated.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include <misc/balloc.h>
+#include <misc/debug.h>
+#include <misc/offset.h>
+
+#include <ncd/module_common.h>
+
+#include <generated/blog_channel_ncd_parallel.h>
+
+#define ISTATE_WORKING 1
+#define ISTATE_UP 2
+#define ISTATE_WAITING 3
+#define ISTATE_TERMINATING 4
+
+#define BSTATE_WORKING 1
+#define BSTATE_UP 2
+#define BSTATE_WAITING 3
+#define BSTATE_TERMINATING 4
+#define BSTATE_NONE 5
+
+struct branch;
+
+struct instance {
+    NCDModuleInst *i;
+    struct branch *branches;
+    int num_branches;
+    int num_up;
+    int num_alive;
+    int state;
+    int error;
+};
+
+struct branch {
+    struct instance *inst;
+    NCDModuleProcess process;
+    int state;
+};
+
+static void instance_free (struct instance *o);
+
+static void start_terminating (struct instance *o)
+{
+    ASSERT(o->state != ISTATE_TERMINATING)
+    
+    for (int j = 0; j < o->num_branches; j++) {
+        struct branch *b = &o->branches[j];
+        if (b->state == BSTATE_NONE) {
+            continue;
+        }
+        ASSERT(b->state != BSTATE_TERMINATING)
+        
+        NCDModuleProcess_Terminate(&b->process);
+        b->state = BSTATE_TERMINATING;
+    }
+    
+    o->state = ISTATE_TERMINATING;
+    
+    if (o->num_alive == 0) {
+        instance_free(o);
+        return;
+    }
+}
+
+static void branch_process_handler_event (NCDModuleProcess *process, int event)
+{
+    struct branch *b = UPPER_OBJECT(process, struct branch, process);
+    struct instance *o = b->inst;
+    
+    switch (event) {
+        case NCDMODULEPROCESS_EVENT_UP: {
+            ASSERT(b->state == BSTATE_WORKING)
+            
+            b->state = BSTATE_UP;
+            o->num_up++;
+            
+            // signal up once the last branch is up
+            if (o->state == ISTATE_WORKING && o->num_up == o->num_branches) {
+                NCDModuleInst_Backend_Up(o->i);
+                o->state = ISTATE_UP;
+            }
+        } break;
+        
+        case NCDMODULEPROCESS_EVENT_DOWN: {
+            ASSERT(b->state == BSTATE_UP)
+            
+            o->num_up--;
+            
+            // nothing after us depends on the branch yet, let it continue
+            if (o->state == ISTATE_WORKING) {
+                NCDModuleProcess_Continue(&b->process);
+                b->state = BSTATE_WORKING;
+                return;
+            }
+            
+            // hold the branch until func_clean
+            b->state = BSTATE_WAITING;
+            
+            if (o->state == ISTATE_UP) {
+                NCDModuleInst_Backend_Down(o->i);
+                o->state = ISTATE_WAITING;
+            }
+        } break;
+        
+        case NCDMODULEPROCESS_EVENT_TERMINATED: {
+            ASSERT(b->state == BSTATE_TERMINATING)
+            ASSERT(o->state == ISTATE_TERMINATING)
+            ASSERT(o->num_alive > 0)
+            
+            NCDModuleProcess_Free(&b->process);
+            b->state = BSTATE_NONE;
+            o->num_alive--;
+            
+            if (o->num_alive == 0) {
+                instance_free(o);
+                return;
+            }
+        } break;
+        
+        default: ASSERT(0);
+    }
+}
+
+static int branch_process_func_getspecialobj (NCDModuleProcess *process, NCD_string_id_t name, NCDObject *out_object)
+{
+    struct branch *b = UPPER_OBJECT(process, struct branch, process);
+    
+    return NCDModuleInst_Backend_GetObj(b->inst->i, name, out_object);
+}
+
+static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    struct instance *o = vo;
+    o->i = i;
+    
+    // check arguments
+    size_t count = NCDVal_ListCount(params->args);
+    if (count > INT_MAX) {
+        ModuleLog(i, BLOG_ERROR, "too many templates");
+        goto fail0;
+    }
+    for (size_t j = 0; j < count; j++) {
+        if (!NCDVal_IsString(NCDVal_ListGet(params->args, j))) {
+            ModuleLog(i, BLOG_ERROR, "wrong type");
+            goto fail0;
+        }
+    }
+    
+    // allocate branches
+    o->num_branches = count;
+    if (!(o->branches = BAllocArray(o->num_branches, sizeof(o->branches[0])))) {
+        ModuleLog(i, BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    o->num_up = 0;
+    o->num_alive = 0;
+    o->state = ISTATE_WORKING;
+    o->error = 0;
+    
+    for (int j = 0; j < o->num_branches; j++) {
+        o->branches[j].inst = o;
+        o->branches[j].state = BSTATE_NONE;
+    }
+    
+    // start all branches
+    for (int j = 0; j < o->num_branches; j++) {
+        struct branch *b = &o->branches[j];
+        
+        if (!NCDModuleProcess_InitValue(&b->process, i, NCDVal_ListGet(params->args, j), NCDVal_NewInvalid(), branch_process_handler_event)) {
+            ModuleLog(i, BLOG_ERROR, "NCDModuleProcess_Init failed");
+            o->error = 1;
+            start_terminating(o);
+            return;
+        }
+        
+        NCDModuleProcess_SetSpecialFuncs(&b->process, branch_process_func_getspecialobj);
+        b->state = BSTATE_WORKING;
+        o->num_alive++;
+    }
+    
+    // nothing to wait for
+    if (o->num_branches == 0) {
+        NCDModuleInst_Backend_Up(i);
+        o->state = ISTATE_UP;
+    }
+    return;
+    
+fail0:
+    NCDModuleInst_Backend_DeadError(i);
+}
+
+static void instance_free (struct instance *o)
+{
+    ASSERT(o->num_alive == 0)
+    
+    BFree(o->branches);
+    
+    if (o->error) {
+        NCDModuleInst_Backend_DeadError(o->i);
+    } else {
+        NCDModuleInst_Backend_Dead(o->i);
+    }
+}
+
+static void func_die (void *vo)
+{
+    struct instance *o = vo;
+    
+    start_terminating(o);
+}
+
+static void func_clean (void *vo)
+{
+    struct instance *o = vo;
+    if (o->state != ISTATE_WAITING) {
+        return;
+    }
+    
+    // let the held branches continue
+    for (int j = 0; j < o->num_branches; j++) {
+        struct branch *b = &o->branches[j];
+        if (b->state == BSTATE_WAITING) {
+            NCDModuleProcess_Continue(&b->process);
+            b->state = BSTATE_WORKING;
+        }
+    }
+    
+    o->state = ISTATE_WORKING;
+}
+
+static int func_getobj (void *vo, NCD_string_id_t name, NCDObject *out_object)
+{
+    struct instance *o = vo;
+    
+    for (int j = 0; j < o->num_branches; j++) {
+        struct branch *b = &o->branches[j];
+        if (b->state != BSTATE_NONE && NCDModuleProcess_GetObj(&b->process, name, out_object)) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+static struct NCDModule modules[] = {
+    {
+        .type = "parallel",
+        .func_new2 = func_new,
+        .func_die = func_die,
+        .func_clean = func_clean,
+        .func_getobj = func_getobj,
+        .flags = NCDMODULE_FLAG_CAN_RESOLVE_WHEN_DOWN,
+        .alloc_size = sizeof(struct instance)
+    }, {
+        .type = NULL
+    }
+};
+
+const struct NCDModuleGroup ncdmodule_parallel = {
+    .modules = modules
+};
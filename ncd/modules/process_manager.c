@@ -75,7 +75,9 @@
 #include <misc/debug.h>
 #include <misc/strdup.h>
 #include <misc/balloc.h>
+#include <misc/array_length.h>
 #include <structure/LinkedList1.h>
+#include <structure/BAVL.h>
 
 #include <ncd/module_common.h>
 
@@ -91,12 +93,15 @@
 struct instance {
     NCDModuleInst *i;
     LinkedList1 processes_list;
+    BAVL processes_tree;
     int dying;
 };
 
 struct process {
     struct instance *manager;
     LinkedList1Node processes_list_node;
+    NCDValRef name; // key in processes_tree, if the process has a name
+    BAVLNode processes_tree_node;
     BSmallTimer retry_timer; // running if state=retrying
     int state;
     NCD_string_id_t template_name;
@@ -109,6 +114,7 @@ struct process {
     NCDModuleProcess module_process; // if state!=retrying
 };
 
+static void compact_mem (struct instance *o, NCDValMem *mem, NCDValSafeRef *name, NCDValSafeRef *args);
 static struct process * find_process (struct instance *o, NCDValRef name);
 static int process_new (struct instance *o, NCDValMem *mem, NCDValSafeRef name, NCDValSafeRef template_name, NCDValSafeRef args);
 static void process_free (struct process *p);
@@ -121,21 +127,39 @@ static void process_stop (struct process *p);
 static int process_restart (struct process *p, NCDValMem *mem, NCDValSafeRef name, NCDValSafeRef template_name, NCDValSafeRef args);
 static void instance_free (struct instance *o);
 
+static int name_comparator (void *user, NCDValRef *v1, NCDValRef *v2)
+{
+    return NCDVal_Compare(*v1, *v2);
+}
+
+static void compact_mem (struct instance *o, NCDValMem *mem, NCDValSafeRef *name, NCDValSafeRef *args)
+{
+    NCDValSafeRef roots[] = {*name, *args};
+    
+    // failing is harmless, the memory object just stays as it is
+    if (!NCDValMem_Compact(mem, roots, B_ARRAY_LENGTH(roots))) {
+        ModuleLog(o->i, BLOG_WARNING, "NCDValMem_Compact failed");
+        return;
+    }
+    
+    *name = roots[0];
+    *args = roots[1];
+}
+
 static struct process * find_process (struct instance *o, NCDValRef name)
 {
     ASSERT(!NCDVal_IsInvalid(name))
     
-    LinkedList1Node *n = LinkedList1_GetFirst(&o->processes_list);
-    while (n) {
-        struct process *p = UPPER_OBJECT(n, struct process, processes_list_node);
-        ASSERT(p->manager == o)
-        if (!NCDVal_IsInvalid(NCDVal_FromSafe(&p->current_mem, p->current_name)) && NCDVal_Compare(NCDVal_FromSafe(&p->current_mem, p->current_name), name) == 0) {
-            return p;
-        }
-        n = LinkedList1Node_Next(n);
+    BAVLNode *tn = BAVL_LookupExact(&o->processes_tree, &name);
+    if (!tn) {
+        return NULL;
     }
     
-    return NULL;
+    struct process *p = UPPER_OBJECT(tn, struct process, processes_tree_node);
+    ASSERT(p->manager == o)
+    ASSERT(!NCDVal_IsInvalid(p->name))
+    
+    return p;
 }
 
 static int process_new (struct instance *o, NCDValMem *mem, NCDValSafeRef name, NCDValSafeRef template_name, NCDValSafeRef args)
@@ -158,8 +182,8 @@ static int process_new (struct instance *o, NCDValMem *mem, NCDValSafeRef name,
     // insert to processes list
     LinkedList1_Append(&o->processes_list, &p->processes_list_node);
 
-    // init retry timer
-    BSmallTimer_Init(&p->retry_timer, process_retry_timer_handler);
+    // init retry timer; the retry time is long, so precision doesn't matter
+    BSmallTimer_InitCoarse(&p->retry_timer, process_retry_timer_handler);
     
     // init template name
     p->template_name = ncd_get_string_id(NCDVal_FromSafe(mem, template_name));
@@ -178,6 +202,15 @@ static int process_new (struct instance *o, NCDValMem *mem, NCDValSafeRef name,
     p->current_name = name;
     p->current_args = args;
     
+    // the copy outlives the statement, don't keep its dead values around
+    compact_mem(o, &p->current_mem, &p->current_name, &p->current_args);
+    
+    // insert to processes tree if named
+    p->name = NCDVal_FromSafe(&p->current_mem, p->current_name);
+    if (!NCDVal_IsInvalid(p->name)) {
+        ASSERT_EXECUTE(BAVL_Insert(&o->processes_tree, &p->processes_tree_node, NULL))
+    }
+    
     // try starting it
     process_try(p);
     return 1;
@@ -193,6 +226,11 @@ static void process_free (struct process *p)
 {
     struct instance *o = p->manager;
     
+    // remove from processes tree
+    if (!NCDVal_IsInvalid(p->name)) {
+        BAVL_Remove(&o->processes_tree, &p->processes_tree_node);
+    }
+    
     // free current mem
     NCDValMem_Free(&p->current_mem);
     
@@ -280,6 +318,10 @@ void process_module_process_handler_event (NCDModuleProcess *module_process, int
                 p->current_name = p->next_name;
                 p->current_args = p->next_args;
                 
+                // the new name compares equal to the old one, so the
+                // position in the processes tree stays valid
+                p->name = NCDVal_FromSafe(&p->current_mem, p->current_name);
+                
                 // try starting it again
                 process_try(p);
                 return;
@@ -370,6 +412,9 @@ static int process_restart (struct process *p, NCDValMem *mem, NCDValSafeRef nam
     p->next_name = name;
     p->next_args = args;
     
+    // the copy outlives the statement, don't keep its dead values around
+    compact_mem(o, &p->next_mem, &p->next_name, &p->next_args);
+    
     // set state
     p->state = PROCESS_STATE_RESTARTING;
     return 1;
@@ -392,6 +437,9 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     // init processes list
     LinkedList1_Init(&o->processes_list);
     
+    // init processes tree
+    BAVL_Init(&o->processes_tree, OFFSET_DIFF(struct process, name, processes_tree_node), (BAVL_comparator)name_comparator, NULL);
+    
     // set not dying
     o->dying = 0;
     
@@ -406,6 +454,7 @@ fail0:
 void instance_free (struct instance *o)
 {
     ASSERT(LinkedList1_IsEmpty(&o->processes_list))
+    ASSERT(BAVL_IsEmpty(&o->processes_tree))
     
     NCDModuleInst_Backend_Dead(o->i);
 }
@@ -62,6 +62,11 @@
  *   from the end of the just-replaced portion until no more regular expressions match.
  *   If multiple regular expressions match at the least position, the one that appears
  *   first in the 'regex' argument wins.
+ * 
+ * Regular expressions which are constants in the program are compiled only once and
+ * kept for the lifetime of the interpreter. Expressions without any special characters,
+ * optionally anchored with '^' and/or '$', are matched with a plain substring search
+ * instead of regexec().
  */
 
 #include <stdlib.h>
@@ -81,6 +86,22 @@
 
 #define MAX_MATCHES 64
 
+#define REGEX_META_CHARS ".[]()*+?{}|^$\\"
+
+struct regex {
+    int is_literal;
+    int anchor_start;
+    int anchor_end;
+    char *literal;
+    size_t literal_len;
+    regex_t preg;
+};
+
+struct global {
+    struct regex **cache;
+    size_t cache_size;
+};
+
 struct instance {
     NCDModuleInst *i;
     MemRef input;
@@ -94,6 +115,237 @@ struct replace_instance {
     MemRef output;
 };
 
+static int regex_init (struct regex *o, const char *pattern)
+{
+    size_t len = strlen(pattern);
+    size_t lit_start = 0;
+    size_t lit_end = len;
+    
+    o->anchor_start = (len > 0 && pattern[0] == '^');
+    if (o->anchor_start) {
+        lit_start++;
+    }
+    o->anchor_end = (lit_end > lit_start && pattern[lit_end - 1] == '$');
+    if (o->anchor_end) {
+        lit_end--;
+    }
+    
+    o->is_literal = 1;
+    for (size_t j = lit_start; j < lit_end; j++) {
+        if (strchr(REGEX_META_CHARS, pattern[j])) {
+            o->is_literal = 0;
+            break;
+        }
+    }
+    
+    if (o->is_literal) {
+        o->literal_len = lit_end - lit_start;
+        if (!(o->literal = BAlloc(o->literal_len + 1))) {
+            return REG_ESPACE;
+        }
+        memcpy(o->literal, pattern + lit_start, o->literal_len);
+        return 0;
+    }
+    
+    return regcomp(&o->preg, pattern, REG_EXTENDED);
+}
+
+static void regex_free (struct regex *o)
+{
+    if (o->is_literal) {
+        BFree(o->literal);
+    } else {
+        regfree(&o->preg);
+    }
+}
+
+static int regex_literal_find (struct regex *o, MemRef in, size_t *out_pos)
+{
+    if (o->literal_len > in.len) {
+        return 0;
+    }
+    
+    if (o->anchor_start || o->anchor_end) {
+        if (o->anchor_start && o->anchor_end && o->literal_len != in.len) {
+            return 0;
+        }
+        size_t pos = o->anchor_start ? 0 : in.len - o->literal_len;
+        if (memcmp(in.ptr + pos, o->literal, o->literal_len)) {
+            return 0;
+        }
+        *out_pos = pos;
+        return 1;
+    }
+    
+    if (o->literal_len == 0) {
+        *out_pos = 0;
+        return 1;
+    }
+    
+    size_t pos = 0;
+    size_t last = in.len - o->literal_len;
+    while (pos <= last) {
+        const char *p = memchr(in.ptr + pos, o->literal[0], last - pos + 1);
+        if (!p) {
+            break;
+        }
+        pos = p - in.ptr;
+        if (!memcmp(p + 1, o->literal + 1, o->literal_len - 1)) {
+            *out_pos = pos;
+            return 1;
+        }
+        pos++;
+    }
+    
+    return 0;
+}
+
+// Matches 'in' like regexec() with REG_STARTEND, with offsets relative to
+// in.ptr. Returns 1 on match, 0 on no match. 'in.len' must fit regoff_t.
+static int regex_exec (struct regex *o, MemRef in, size_t nmatch, regmatch_t *matches)
+{
+    ASSERT(nmatch > 0)
+    
+    if (!o->is_literal) {
+        matches[0].rm_so = 0;
+        matches[0].rm_eo = in.len;
+        return (regexec(&o->preg, in.ptr, nmatch, matches, REG_STARTEND) == 0);
+    }
+    
+    size_t pos;
+    if (!regex_literal_find(o, in, &pos)) {
+        return 0;
+    }
+    
+    matches[0].rm_so = pos;
+    matches[0].rm_eo = pos + o->literal_len;
+    for (size_t j = 1; j < nmatch; j++) {
+        matches[j].rm_so = -1;
+        matches[j].rm_eo = -1;
+    }
+    
+    return 1;
+}
+
+static struct regex ** regex_cache_slot (struct global *g, NCD_string_id_t id)
+{
+    ASSERT(id >= 0)
+    
+    if ((size_t)id >= g->cache_size) {
+        size_t new_size = (g->cache_size > 0) ? g->cache_size : 16;
+        while (new_size <= (size_t)id) {
+            if (new_size > SIZE_MAX / 2) {
+                return NULL;
+            }
+            new_size *= 2;
+        }
+        
+        struct regex **new_cache = BReallocArray(g->cache, new_size, sizeof(new_cache[0]));
+        if (!new_cache) {
+            return NULL;
+        }
+        for (size_t j = g->cache_size; j < new_size; j++) {
+            new_cache[j] = NULL;
+        }
+        
+        g->cache = new_cache;
+        g->cache_size = new_size;
+    }
+    
+    return &g->cache[id];
+}
+
+// Returns the compiled form of the regex value. Constant strings are looked
+// up in and added to the cache; other strings are compiled into 'tmp', and the
+// caller must then free it with regex_free(). Returns NULL on failure.
+static struct regex * regex_get (NCDModuleInst *i, NCDValRef regex_val, struct regex *tmp)
+{
+    ASSERT(NCDVal_IsStringNoNulls(regex_val))
+    
+    struct global *g = ModuleGlobal(i);
+    
+    // find cache slot for constant strings
+    struct regex **slot = NULL;
+    if (NCDVal_IsIdString(regex_val)) {
+        slot = regex_cache_slot(g, NCDVal_IdStringId(regex_val));
+        if (slot && *slot) {
+            return *slot;
+        }
+    }
+    
+    // compile into a cache entry if possible
+    struct regex *re = tmp;
+    if (slot) {
+        struct regex *entry = BAlloc(sizeof(*entry));
+        if (entry) {
+            re = entry;
+        }
+    }
+    
+    // null terminate regex
+    NCDValNullTermString regex_nts;
+    if (!NCDVal_StringNullTerminate(regex_val, &regex_nts)) {
+        ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
+        goto fail;
+    }
+    
+    // compile regex
+    int ret = regex_init(re, regex_nts.data);
+    NCDValNullTermString_Free(&regex_nts);
+    if (ret != 0) {
+        ModuleLog(i, BLOG_ERROR, "regcomp failed (error=%d)", ret);
+        goto fail;
+    }
+    
+    if (re != tmp) {
+        *slot = re;
+    }
+    
+    return re;
+    
+fail:
+    if (re != tmp) {
+        BFree(re);
+    }
+    return NULL;
+}
+
+static int func_globalinit (struct NCDInterpModuleGroup *group, const struct NCDModuleInst_iparams *params)
+{
+    // allocate global state structure
+    struct global *g = BAlloc(sizeof(*g));
+    if (!g) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        return 0;
+    }
+    
+    // set group state pointer
+    group->group_state = g;
+    
+    // init cache
+    g->cache = NULL;
+    g->cache_size = 0;
+    
+    return 1;
+}
+
+static void func_globalfree (struct NCDInterpModuleGroup *group)
+{
+    struct global *g = group->group_state;
+    
+    // free cached regex's
+    for (size_t j = 0; j < g->cache_size; j++) {
+        if (g->cache[j]) {
+            regex_free(g->cache[j]);
+            BFree(g->cache[j]);
+        }
+    }
+    BFree(g->cache);
+    
+    // free global state structure
+    BFree(g);
+}
+
 static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
 {
     struct instance *o = vo;
@@ -118,29 +370,20 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         goto fail0;
     }
     
-    // null terminate regex
-    NCDValNullTermString regex_nts;
-    if (!NCDVal_StringNullTerminate(regex_arg, &regex_nts)) {
-        ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
-        goto fail0;
-    }
-    
-    // compile regex
-    regex_t preg;
-    int ret = regcomp(&preg, regex_nts.data, REG_EXTENDED);
-    NCDValNullTermString_Free(&regex_nts);
-    if (ret != 0) {
-        ModuleLog(o->i, BLOG_ERROR, "regcomp failed (error=%d)", ret);
+    // get compiled regex
+    struct regex tmp;
+    struct regex *re = regex_get(i, regex_arg, &tmp);
+    if (!re) {
         goto fail0;
     }
     
     // execute match
-    o->matches[0].rm_so = 0;
-    o->matches[0].rm_eo = o->input.len;
-    o->succeeded = (regexec(&preg, o->input.ptr, MAX_MATCHES, o->matches, REG_STARTEND) == 0);
+    o->succeeded = regex_exec(re, o->input, MAX_MATCHES, o->matches);
     
     // free regex
-    regfree(&preg);
+    if (re == &tmp) {
+        regex_free(&tmp);
+    }
     
     // signal up
     NCDModuleInst_Backend_Up(o->i);
@@ -204,12 +447,18 @@ static void replace_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
     }
     size_t num_regex = NCDVal_ListCount(regex_arg);
     
-    // allocate array for compiled regex's
-    regex_t *regs = BAllocArray(num_regex, sizeof(regs[0]));
+    // allocate arrays for compiled regex's
+    struct regex **regs = BAllocArray(num_regex, sizeof(regs[0]));
     if (!regs) {
         ModuleLog(i, BLOG_ERROR, "BAllocArray failed");
         goto fail1;
     }
+    struct regex *tmps = BAllocArray(num_regex, sizeof(tmps[0]));
+    if (!tmps) {
+        ModuleLog(i, BLOG_ERROR, "BAllocArray failed");
+        BFree(regs);
+        goto fail1;
+    }
     size_t num_done_regex = 0;
     
     // compile regex's, check arguments
@@ -222,17 +471,8 @@ static void replace_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
             goto fail2;
         }
         
-        // null terminate regex
-        NCDValNullTermString regex_nts;
-        if (!NCDVal_StringNullTerminate(regex, &regex_nts)) {
-            ModuleLog(i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
-            goto fail2;
-        }
-        
-        int res = regcomp(&regs[num_done_regex], regex_nts.data, REG_EXTENDED);
-        NCDValNullTermString_Free(&regex_nts);
-        if (res != 0) {
-            ModuleLog(i, BLOG_ERROR, "regcomp failed for pair %zu (error=%d)", num_done_regex, res);
+        if (!(regs[num_done_regex] = regex_get(i, regex, &tmps[num_done_regex]))) {
+            ModuleLog(i, BLOG_ERROR, "failed to compile regex for pair %zu", num_done_regex);
             goto fail2;
         }
         
@@ -258,9 +498,7 @@ static void replace_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
         regmatch_t match = {0, 0}; // to remove warning
         for (size_t j = 0; j < num_regex; j++) {
             regmatch_t this_match;
-            this_match.rm_so = 0;
-            this_match.rm_eo = in.len - in_pos;
-            if (regexec(&regs[j], in.ptr + in_pos, 1, &this_match, REG_STARTEND) == 0 && (!have_match || this_match.rm_so < match.rm_so)) {
+            if (regex_exec(regs[j], MemRef_SubFrom(in, in_pos), 1, &this_match) && (!have_match || this_match.rm_so < match.rm_so)) {
                 have_match = 1;
                 match_regex = j;
                 match = this_match;
@@ -297,10 +535,13 @@ static void replace_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
     
     // free compiled regex's
     while (num_done_regex-- > 0) {
-        regfree(&regs[num_done_regex]);
+        if (regs[num_done_regex] == &tmps[num_done_regex]) {
+            regex_free(&tmps[num_done_regex]);
+        }
     }
     
-    // free array
+    // free arrays
+    BFree(tmps);
     BFree(regs);
     
     // signal up
@@ -311,8 +552,11 @@ fail3:
     ExpString_Free(&out);
 fail2:
     while (num_done_regex-- > 0) {
-        regfree(&regs[num_done_regex]);
+        if (regs[num_done_regex] == &tmps[num_done_regex]) {
+            regex_free(&tmps[num_done_regex]);
+        }
     }
+    BFree(tmps);
     BFree(regs);
 fail1:
     NCDModuleInst_Backend_DeadError(i);
@@ -358,5 +602,7 @@ static struct NCDModule modules[] = {
 };
 
 const struct NCDModuleGroup ncdmodule_regex_match = {
+    .func_globalinit = func_globalinit,
+    .func_globalfree = func_globalfree,
     .modules = modules
 };
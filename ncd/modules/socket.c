@@ -35,6 +35,15 @@
  *   "read_size" - the maximum number of bytes that can be read by a single
  *     read() call. Must be greater than zero. Greater values may improve
  *     performance, but will increase memory usage. Default: 8192.
+ *   "rcvbuf", "sndbuf" - SO_RCVBUF and SO_SNDBUF, in bytes.
+ *   "nodelay", "quickack" - TCP_NODELAY and TCP_QUICKACK, "true" or "false".
+ *   "notsent_lowat" - TCP_NOTSENT_LOWAT, in bytes.
+ *   "congestion" - TCP_CONGESTION, the name of the congestion control
+ *     algorithm, e.g. "bbr".
+ *   "mark" - SO_MARK.
+ *   Socket options are applied once the connection is established; failure
+ *   to apply them is logged and otherwise ignored. By default, they are left
+ *   as the system sets them.
  * 
  * Variables:
  *   string is_error - "true" if there was an error with the connection,
@@ -82,6 +91,11 @@
  *   WARNING: this may return an arbitrarily small chunk of data. There is
  *   no significance to the size of the chunks. Correct code will behave
  *   the same no matter how the incoming data stream is split up.
+ *   The data is not copied out of the receive buffer; the returned string,
+ *   and any values derived from it, refer to the buffer directly, and the
+ *   buffer is only reused when none of them remain. Keeping many results of
+ *   read() around therefore keeps a buffer of 'read_size' bytes allocated
+ *   for each of them.
  *   WARNING: if a read() is terminated while it is still in progress, i.e.
  *   has not gone up yet, then the connection is automatically closed, as
  *   if close() was called.
@@ -91,6 +105,8 @@
  * 
  * Description:
  *   Sends data to the connection.
+ *   The data is sent directly from the argument value without copying, so
+ *   passing the result of a read() to write() forwards it with no copies.
  *   WARNING: this may block if the operating system's internal send buffer
  *   is full. Be careful not to enter a deadlock where both ends of the
  *   connection are trying to send data to the other, but neither is trying
@@ -115,6 +131,15 @@
  *   "read_size" - the maximum number of bytes that can be read by a single
  *     read() call. Must be greater than zero. Greater values may improve
  *     performance, but will increase memory usage. Default: 8192.
+ *   "rcvbuf", "sndbuf" - SO_RCVBUF and SO_SNDBUF, in bytes.
+ *   "nodelay", "quickack" - TCP_NODELAY and TCP_QUICKACK, "true" or "false".
+ *   "notsent_lowat" - TCP_NOTSENT_LOWAT, in bytes.
+ *   "congestion" - TCP_CONGESTION, the name of the congestion control
+ *     algorithm, e.g. "bbr".
+ *   "mark" - SO_MARK.
+ *   Socket options are applied once the connection is established; failure
+ *   to apply them is logged and otherwise ignored. By default, they are left
+ *   as the system sets them.
  * 
  * Variables:
  *   string is_error - "true" if listening failed to inittialize, "false" if
@@ -175,6 +200,7 @@ struct connection {
             NCDModuleInst *i;
             BConnector connector;
             size_t read_buf_size;
+            struct BConnection_options socket_options;
         } connect;
         struct {
             struct listen_instance *listen_inst;
@@ -211,6 +237,7 @@ struct listen_instance {
     unsigned int have_error:1;
     unsigned int dying:1;
     size_t read_buf_size;
+    struct BConnection_options socket_options;
     NCDValRef client_template;
     NCDValRef client_template_args;
     BListener listener;
@@ -223,7 +250,7 @@ static const char *strings[] = {
     "_socket", "sys.socket", "client_addr", NULL
 };
 
-static int parse_options (NCDModuleInst *i, NCDValRef options, size_t *out_read_size);
+static int parse_options (NCDModuleInst *i, NCDValRef options, size_t *out_read_size, struct BConnection_options *out_socket_options);
 static void connection_log (struct connection *o, int level, const char *fmt, ...);
 static void connection_free_connection (struct connection *o);
 static void connection_error (struct connection *o);
@@ -239,11 +266,13 @@ static int connection_process_socket_obj_func_getvar (const NCDObject *obj, NCD_
 static int connection_process_caller_obj_func_getobj (const NCDObject *obj, NCD_string_id_t name, NCDObject *out_object);
 static void listen_listener_handler (void *user);
 
-static int parse_options (NCDModuleInst *i, NCDValRef options, size_t *out_read_size)
+static int parse_options (NCDModuleInst *i, NCDValRef options, size_t *out_read_size, struct BConnection_options *out_socket_options)
 {
     ASSERT(out_read_size)
+    ASSERT(out_socket_options)
     
     *out_read_size = DEFAULT_READ_BUF_SIZE;
+    BConnection_options_Init(out_socket_options);
     
     if (!NCDVal_IsInvalid(options)) {
         if (!NCDVal_IsMap(options)) {
@@ -264,6 +293,78 @@ static int parse_options (NCDModuleInst *i, NCDValRef options, size_t *out_read_
             *out_read_size = read_size;
         }
         
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options, "rcvbuf"))) {
+            uintmax_t rcvbuf;
+            if (!ncd_read_uintmax(value, &rcvbuf) || rcvbuf > INT_MAX || rcvbuf == 0) {
+                ModuleLog(i, BLOG_ERROR, "wrong rcvbuf");
+                return 0;
+            }
+            num_recognized++;
+            out_socket_options->rcvbuf = rcvbuf;
+        }
+        
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options, "sndbuf"))) {
+            uintmax_t sndbuf;
+            if (!ncd_read_uintmax(value, &sndbuf) || sndbuf > INT_MAX || sndbuf == 0) {
+                ModuleLog(i, BLOG_ERROR, "wrong sndbuf");
+                return 0;
+            }
+            num_recognized++;
+            out_socket_options->sndbuf = sndbuf;
+        }
+        
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options, "nodelay"))) {
+            if (!ncd_read_boolean(value, &out_socket_options->nodelay)) {
+                ModuleLog(i, BLOG_ERROR, "wrong nodelay");
+                return 0;
+            }
+            num_recognized++;
+        }
+        
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options, "notsent_lowat"))) {
+            uintmax_t notsent_lowat;
+            if (!ncd_read_uintmax(value, &notsent_lowat) || notsent_lowat > INT_MAX || notsent_lowat == 0) {
+                ModuleLog(i, BLOG_ERROR, "wrong notsent_lowat");
+                return 0;
+            }
+            num_recognized++;
+            out_socket_options->notsent_lowat = notsent_lowat;
+        }
+        
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options, "quickack"))) {
+            if (!ncd_read_boolean(value, &out_socket_options->quickack)) {
+                ModuleLog(i, BLOG_ERROR, "wrong quickack");
+                return 0;
+            }
+            num_recognized++;
+        }
+        
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options, "congestion"))) {
+            if (!NCDVal_IsString(value)) {
+                ModuleLog(i, BLOG_ERROR, "wrong congestion");
+                return 0;
+            }
+            MemRef name = NCDVal_StringMemRef(value);
+            if (name.len == 0 || name.len >= sizeof(out_socket_options->congestion) || MemRef_FindChar(name, '\0', NULL)) {
+                ModuleLog(i, BLOG_ERROR, "wrong congestion");
+                return 0;
+            }
+            num_recognized++;
+            MemRef_CopyOut(name, out_socket_options->congestion);
+            out_socket_options->congestion[name.len] = '\0';
+        }
+        
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options, "mark"))) {
+            uintmax_t mark;
+            if (!ncd_read_uintmax(value, &mark) || mark > UINT32_MAX) {
+                ModuleLog(i, BLOG_ERROR, "wrong mark");
+                return 0;
+            }
+            num_recognized++;
+            out_socket_options->have_mark = 1;
+            out_socket_options->mark = mark;
+        }
+        
         if (NCDVal_MapCount(options) > num_recognized) {
             ModuleLog(i, BLOG_ERROR, "unrecognized options present");
             return 0;
@@ -393,6 +494,11 @@ static void connection_connector_handler (void *user, int is_error)
         goto fail;
     }
     
+    // apply socket options
+    if (!BConnection_SetOptions(&o->connection, &o->connect.socket_options)) {
+        connection_log(o, BLOG_WARNING, "BConnection_SetOptions failed");
+    }
+    
     // free connector
     BConnector_Free(&o->connect.connector);
     
@@ -606,6 +712,11 @@ static void listen_listener_handler (void *user)
         goto fail1;
     }
     
+    // apply socket options
+    if (!BConnection_SetOptions(&con->connection, &o->socket_options)) {
+        connection_log(con, BLOG_WARNING, "BConnection_SetOptions failed");
+    }
+    
     // init connection interfaces
     BConnection_SendAsync_Init(&con->connection);
     BConnection_RecvAsync_Init(&con->connection);
@@ -682,7 +793,7 @@ static void connect_func_new (void *vo, NCDModuleInst *i, const struct NCDModule
     }
     
     // parse options
-    if (!parse_options(i, options_arg, &o->connect.read_buf_size)) {
+    if (!parse_options(i, options_arg, &o->connect.read_buf_size, &o->connect.socket_options)) {
         goto fail0;
     }
     
@@ -986,7 +1097,7 @@ static void listen_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleI
     }
     
     // parse options
-    if (!parse_options(i, options_arg, &o->read_buf_size)) {
+    if (!parse_options(i, options_arg, &o->read_buf_size, &o->socket_options)) {
         goto fail0;
     }
     
@@ -45,6 +45,13 @@
  *   finish() will immediately initiate termination of the handler process.
  *   Requests can be sent to NCD using the badvpn-ncd-request program.
  * 
+ *   A connection may carry any number of requests at the same time, so clients
+ *   can pipeline requests over a persistent connection instead of connecting
+ *   for every request. Request payloads are either in the text format of
+ *   NCDValGenerator or in the binary format of NCDValBinary, as chosen by the
+ *   client for each request, and replies to a request use the same format as
+ *   the request itself.
+ * 
  *   The listen address should be in the same format as for the socket module.
  *   In particular, it must be in one of the following forms:
  *   - {"tcp", {"ipv4", ipv4_address, port_number}},
@@ -75,9 +82,11 @@
 #include <misc/offset.h>
 #include <misc/debug.h>
 #include <misc/byteorder.h>
+#include <misc/compare.h>
 #include <protocol/packetproto.h>
 #include <protocol/requestproto.h>
 #include <structure/LinkedList0.h>
+#include <structure/BAVL.h>
 #include <system/BConnection.h>
 #include <system/BConnectionGeneric.h>
 #include <system/BAddr.h>
@@ -86,6 +95,7 @@
 #include <flow/PacketPassFifoQueue.h>
 #include <ncd/NCDValParser.h>
 #include <ncd/NCDValGenerator.h>
+#include <ncd/NCDValBinary.h>
 #include <ncd/extra/address_utils.h>
 
 #include <ncd/module_common.h>
@@ -122,6 +132,7 @@ struct connection {
     PacketPassFifoQueue send_queue;
     PacketStreamSender send_pss;
     LinkedList0 requests_list;
+    BAVL requests_tree;
     LinkedList0 replies_list;
     int state;
 };
@@ -130,6 +141,8 @@ struct request {
     struct connection *con;
     uint32_t request_id;
     LinkedList0Node requests_list_node;
+    BAVLNode requests_tree_node;
+    int binary;
     NCDValMem request_data_mem;
     NCDValRef request_data;
     struct reply *end_reply;
@@ -153,7 +166,7 @@ static void connection_terminate (struct connection *c);
 static void connection_con_handler (struct connection *c, int event);
 static void connection_recv_decoder_handler_error (struct connection *c);
 static void connection_recv_if_handler_send (struct connection *c, uint8_t *data, int data_len);
-static int request_init (struct connection *c, uint32_t request_id, const uint8_t *data, int data_len);
+static int request_init (struct connection *c, uint32_t request_id, int binary, const uint8_t *data, int data_len);
 static void request_free (struct request *r);
 static struct request * find_request (struct connection *c, uint32_t request_id);
 static void request_process_handler_event (NCDModuleProcess *process, int event);
@@ -161,12 +174,17 @@ static int request_process_func_getspecialobj (NCDModuleProcess *process, NCD_st
 static int request_process_caller_obj_func_getobj (const NCDObject *obj, NCD_string_id_t name, NCDObject *out_object);
 static int request_process_request_obj_func_getvar (const NCDObject *obj, NCD_string_id_t name, NCDValMem *mem, NCDValRef *out_value);
 static void request_terminate (struct request *r);
-static struct reply * reply_init (struct connection *c, uint32_t request_id, NCDValRef reply_data);
+static struct reply * reply_init (struct connection *c, uint32_t request_id, int binary, NCDValRef reply_data);
 static void reply_start (struct reply *r, uint32_t type);
 static void reply_free (struct reply *r);
 static void reply_send_qflow_if_handler_done (struct reply *r);
 static void instance_free (struct instance *o);
 
+static int request_id_comparator (void *unused, uint32_t *v1, uint32_t *v2)
+{
+    return B_COMPARE(*v1, *v2);
+}
+
 enum {STRING_REQUEST, STRING_DATA, STRING_CLIENT_ADDR,
       STRING_SYS_REQUEST_SERVER_REQUEST};
 
@@ -215,6 +233,8 @@ static void listener_handler (struct instance *o)
     
     LinkedList0_Init(&c->requests_list);
     
+    BAVL_Init(&c->requests_tree, OFFSET_DIFF(struct request, request_id, requests_tree_node), (BAVL_comparator)request_id_comparator, NULL);
+    
     LinkedList0_Init(&c->replies_list);
     
     c->state = CONNECTION_STATE_RUNNING;
@@ -239,6 +259,7 @@ static void connection_free (struct connection *c)
     struct instance *o = c->inst;
     ASSERT(c->state == CONNECTION_STATE_TERMINATING)
     ASSERT(LinkedList0_IsEmpty(&c->requests_list))
+    ASSERT(BAVL_IsEmpty(&c->requests_tree))
     ASSERT(LinkedList0_IsEmpty(&c->replies_list))
     
     LinkedList0_Remove(&o->connections_list, &c->connections_list_node);
@@ -327,13 +348,16 @@ static void connection_recv_if_handler_send (struct connection *c, uint8_t *data
     uint32_t type = ltoh32(header.type);
     
     switch (type) {
-        case REQUESTPROTO_TYPE_CLIENT_REQUEST: {
+        case REQUESTPROTO_TYPE_CLIENT_REQUEST:
+        case REQUESTPROTO_TYPE_CLIENT_REQUEST_BINARY: {
             if (find_request(c, request_id)) {
                 ModuleLog(o->i, BLOG_ERROR, "request with the same ID already exists");
                 goto fail;
             }
             
-            if (!request_init(c, request_id, data + sizeof(header), data_len - sizeof(header))) {
+            int binary = (type == REQUESTPROTO_TYPE_CLIENT_REQUEST_BINARY);
+            
+            if (!request_init(c, request_id, binary, data + sizeof(header), data_len - sizeof(header))) {
                 goto fail;
             }
         } break;
@@ -361,7 +385,7 @@ fail:
     connection_terminate(c);
 }
 
-static int request_init (struct connection *c, uint32_t request_id, const uint8_t *data, int data_len)
+static int request_init (struct connection *c, uint32_t request_id, int binary, const uint8_t *data, int data_len)
 {
     struct instance *o = c->inst;
     ASSERT(c->state == CONNECTION_STATE_RUNNING)
@@ -377,17 +401,29 @@ static int request_init (struct connection *c, uint32_t request_id, const uint8_
     
     r->con = c;
     r->request_id = request_id;
+    r->binary = binary;
     
     LinkedList0_Prepend(&c->requests_list, &r->requests_list_node);
     
+    ASSERT_EXECUTE(BAVL_Insert(&c->requests_tree, &r->requests_tree_node, NULL))
+    
     NCDValMem_Init(&r->request_data_mem, o->i->params->iparams->string_index);
     
-    if (!NCDValParser_Parse(MemRef_Make((const char *)data, data_len), &r->request_data_mem, &r->request_data)) {
-        ModuleLog(o->i, BLOG_ERROR, "NCDValParser_Parse failed");
-        goto fail1;
+    MemRef payload = MemRef_Make((const char *)data, data_len);
+    
+    if (binary) {
+        if (!NCDValBinary_Decode(payload, &r->request_data_mem, &r->request_data)) {
+            ModuleLog(o->i, BLOG_ERROR, "NCDValBinary_Decode failed");
+            goto fail1;
+        }
+    } else {
+        if (!NCDValParser_Parse(payload, &r->request_data_mem, &r->request_data)) {
+            ModuleLog(o->i, BLOG_ERROR, "NCDValParser_Parse failed");
+            goto fail1;
+        }
     }
     
-    if (!(r->end_reply = reply_init(c, request_id, NCDVal_NewInvalid()))) {
+    if (!(r->end_reply = reply_init(c, request_id, binary, NCDVal_NewInvalid()))) {
         goto fail1;
     }
     
@@ -408,6 +444,7 @@ fail3:
     reply_free(r->end_reply);
 fail1:
     NCDValMem_Free(&r->request_data_mem);
+    BAVL_Remove(&c->requests_tree, &r->requests_tree_node);
     LinkedList0_Remove(&c->requests_list, &r->requests_list_node);
     free(r);
 fail0:
@@ -432,14 +469,16 @@ static void request_free (struct request *r)
 
 static struct request * find_request (struct connection *c, uint32_t request_id)
 {
-    for (LinkedList0Node *ln = LinkedList0_GetFirst(&c->requests_list); ln; ln = LinkedList0Node_Next(ln)) {
-        struct request *r = UPPER_OBJECT(ln, struct request, requests_list_node);
-        if (!r->terminating && r->request_id == request_id) {
-            return r;
-        }
+    // only requests which are not terminating are in the tree
+    BAVLNode *tn = BAVL_LookupExact(&c->requests_tree, &request_id);
+    if (!tn) {
+        return NULL;
     }
     
-    return NULL;
+    struct request *r = UPPER_OBJECT(tn, struct request, requests_tree_node);
+    ASSERT(!r->terminating)
+    
+    return r;
 }
 
 static void request_process_handler_event (NCDModuleProcess *process, int event)
@@ -525,10 +564,12 @@ static void request_terminate (struct request *r)
     
     NCDModuleProcess_Terminate(&r->process);
     
+    BAVL_Remove(&r->con->requests_tree, &r->requests_tree_node);
+    
     r->terminating = 1;
 }
 
-static struct reply * reply_init (struct connection *c, uint32_t request_id, NCDValRef reply_data)
+static struct reply * reply_init (struct connection *c, uint32_t request_id, int binary, NCDValRef reply_data)
 {
     struct instance *o = c->inst;
     ASSERT(c->state == CONNECTION_STATE_RUNNING)
@@ -560,9 +601,18 @@ static struct reply * reply_init (struct connection *c, uint32_t request_id, NCD
         goto fail2;
     }
     
-    if (!NCDVal_IsInvalid(reply_data) && !NCDValGenerator_AppendGenerate(reply_data, &str)) {
-        ModuleLog(o->i, BLOG_ERROR, "NCDValGenerator_AppendGenerate failed");
-        goto fail2;
+    if (!NCDVal_IsInvalid(reply_data)) {
+        if (binary) {
+            if (!NCDValBinary_AppendEncode(reply_data, &str)) {
+                ModuleLog(o->i, BLOG_ERROR, "NCDValBinary_AppendEncode failed");
+                goto fail2;
+            }
+        } else {
+            if (!NCDValGenerator_AppendGenerate(reply_data, &str)) {
+                ModuleLog(o->i, BLOG_ERROR, "NCDValGenerator_AppendGenerate failed");
+                goto fail2;
+            }
+        }
     }
     
     size_t len = ExpString_Length(&str);
@@ -727,13 +777,13 @@ static void reply_func_new (void *unused, NCDModuleInst *i, const struct NCDModu
         goto fail;
     }
     
-    struct reply *rpl = reply_init(c, r->request_id, reply_data);
+    struct reply *rpl = reply_init(c, r->request_id, r->binary, reply_data);
     if (!rpl) {
         ModuleLog(i, BLOG_ERROR, "failed to submit reply");
         goto fail;
     }
     
-    reply_start(rpl, REQUESTPROTO_TYPE_SERVER_REPLY);
+    reply_start(rpl, r->binary ? REQUESTPROTO_TYPE_SERVER_REPLY_BINARY : REQUESTPROTO_TYPE_SERVER_REPLY);
     return;
     
 fail:
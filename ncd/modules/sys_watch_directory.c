@@ -30,14 +30,25 @@
  * 
  * Directory watcher.
  * 
- * Synopsis: sys.watch_directory(string dir)
+ * Synopsis: sys.watch_directory(string dir [, map options])
  * Description: reports directory entry events. Transitions up when an event is detected, and
  *   goes down waiting for the next event when sys.watch_directory::nextevent() is called.
  *   The directory is first scanned and "added" events are reported for all files.
+ *   Options:
+ *     "coalesce_ms":milliseconds - report events in batches instead of one by one.
+ *       Events are collected for this long after the first one arrives, and events for
+ *       the same file within a batch are merged into one: "added" followed by "removed"
+ *       cancels out, "removed" followed by "added" becomes "changed", "added" followed
+ *       by "changed" stays "added", and otherwise the last event wins. Events keep being
+ *       collected while a batch is being processed. The initial scan is reported as one
+ *       batch.
  * Variables:
  *   string event_type - what happened with the file: "added", "removed" or "changed"
  *   string filename - name of the file in the directory the event refers to
  *   string filepath - "dir/filename"
+ *   list events - (batch mode only) list of maps with the keys "event_type", "filename"
+ *     and "filepath", one for each file, in the order the files were first seen
+ *   In batch mode, only the 'events' variable is available.
  * 
  * Synopsis: sys.watch_directory::nextevent()
  * Description: makes the watch_directory module transition down in order to report the next event.
@@ -45,25 +56,55 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/inotify.h>
 #include <sys/types.h>
-#include <dirent.h>
+#include <sys/syscall.h>
 #include <errno.h>
 
 #include <misc/nonblocking.h>
 #include <misc/concat_strings.h>
+#include <misc/offset.h>
+#include <structure/BAVL.h>
+#include <structure/LinkedList1.h>
 
 #include <ncd/module_common.h>
 
 #include <generated/blog_channel_ncd_sys_watch_directory.h>
 
-#define MAX_INOTIFY_EVENTS 128
+#define MAX_INOTIFY_EVENTS 1024
+#define DIR_BUF_SIZE 65536
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct batch_entry {
+    char *name;
+    const char *first_type;
+    const char *last_type;
+    BAVLNode tree_node;
+    LinkedList1Node list_node;
+};
+
+struct batch {
+    BAVL tree;
+    LinkedList1 list;
+};
 
 struct instance {
     NCDModuleInst *i;
     NCDValNullTermString dir_nts;
-    DIR *dir_handle;
+    int dir_fd;
+    char *dir_buf;
+    size_t dir_buf_len;
+    size_t dir_buf_pos;
     int inotify_fd;
     BFileDescriptor bfd;
     struct inotify_event events[MAX_INOTIFY_EVENTS];
@@ -72,46 +113,254 @@ struct instance {
     int processing;
     const char *processing_file;
     const char *processing_type;
+    int batch_mode;
+    btime_t coalesce_time;
+    BTimer coalesce_timer;
+    struct batch pending;
+    struct batch delivering;
 };
 
 static void instance_free (struct instance *o, int is_error);
 
-static void next_dir_event (struct instance *o)
+static int batch_entry_comparator (void *user, void *vv1, void *vv2)
 {
-    ASSERT(!o->processing)
-    ASSERT(o->dir_handle)
-    
-    struct dirent *entry;
-    
-    do {
-        // get next entry
-        errno = 0;
-        if (!(entry = readdir(o->dir_handle))) {
-            if (errno != 0) {
-                ModuleLog(o->i, BLOG_ERROR, "readdir failed");
-                instance_free(o, 1);
-                return;
+    char **v1 = vv1;
+    char **v2 = vv2;
+    
+    int cmp = strcmp(*v1, *v2);
+    return B_COMPARE(cmp, 0);
+}
+
+static void batch_init (struct batch *b)
+{
+    BAVL_Init(&b->tree, OFFSET_DIFF(struct batch_entry, name, tree_node), batch_entry_comparator, NULL);
+    LinkedList1_Init(&b->list);
+}
+
+static void batch_free_entry (struct batch *b, struct batch_entry *e)
+{
+    BAVL_Remove(&b->tree, &e->tree_node);
+    LinkedList1_Remove(&b->list, &e->list_node);
+    free(e->name);
+    free(e);
+}
+
+static void batch_clear (struct batch *b)
+{
+    LinkedList1Node *ln;
+    while ((ln = LinkedList1_GetFirst(&b->list))) {
+        batch_free_entry(b, UPPER_OBJECT(ln, struct batch_entry, list_node));
+    }
+}
+
+static int batch_is_empty (struct batch *b)
+{
+    return LinkedList1_IsEmpty(&b->list);
+}
+
+static void batch_move (struct batch *dst, struct batch *src)
+{
+    ASSERT(batch_is_empty(dst))
+    
+    // entries are owned by the tree and the list, so just swap the containers
+    struct batch tmp = *dst;
+    *dst = *src;
+    *src = tmp;
+}
+
+static const char * batch_entry_type (struct batch_entry *e)
+{
+    if (!strcmp(e->last_type, "removed") && !strcmp(e->first_type, "added")) {
+        return NULL;
+    }
+    if (!strcmp(e->last_type, "added") && !strcmp(e->first_type, "removed")) {
+        return "changed";
+    }
+    if (!strcmp(e->last_type, "changed") && !strcmp(e->first_type, "added")) {
+        return "added";
+    }
+    return e->last_type;
+}
+
+static int batch_add (struct batch *b, const char *name, const char *type)
+{
+    BAVLNode *tn = BAVL_LookupExact(&b->tree, &name);
+    if (tn) {
+        struct batch_entry *e = UPPER_OBJECT(tn, struct batch_entry, tree_node);
+        e->last_type = type;
+        return 1;
+    }
+    
+    struct batch_entry *e = malloc(sizeof(*e));
+    if (!e) {
+        return 0;
+    }
+    
+    if (!(e->name = strdup(name))) {
+        free(e);
+        return 0;
+    }
+    
+    e->first_type = type;
+    e->last_type = type;
+    
+    ASSERT_EXECUTE(BAVL_Insert(&b->tree, &e->tree_node, NULL))
+    LinkedList1_Append(&b->list, &e->list_node);
+    
+    return 1;
+}
+
+static int dir_scan_next (struct instance *o, const char **out_name)
+{
+    ASSERT(o->dir_fd >= 0)
+    
+    while (1) {
+        if (o->dir_buf_pos == o->dir_buf_len) {
+            long res = syscall(SYS_getdents64, o->dir_fd, o->dir_buf, DIR_BUF_SIZE);
+            if (res < 0) {
+                return -1;
             }
-            
-            // close directory
-            if (closedir(o->dir_handle) < 0) {
-                ModuleLog(o->i, BLOG_ERROR, "closedir failed");
-                o->dir_handle = NULL;
-                instance_free(o, 1);
-                return;
+            if (res == 0) {
+                return 0;
             }
-            
-            // set no dir handle
-            o->dir_handle = NULL;
-            
-            // start receiving inotify events
-            BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
+            o->dir_buf_len = res;
+            o->dir_buf_pos = 0;
+        }
+        
+        struct linux_dirent64 *entry = (struct linux_dirent64 *)(o->dir_buf + o->dir_buf_pos);
+        o->dir_buf_pos += entry->d_reclen;
+        
+        if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+            *out_name = entry->d_name;
+            return 1;
+        }
+    }
+}
+
+static int dir_scan_close (struct instance *o)
+{
+    ASSERT(o->dir_fd >= 0)
+    
+    int res = close(o->dir_fd);
+    o->dir_fd = -1;
+    
+    free(o->dir_buf);
+    o->dir_buf = NULL;
+    
+    return (res == 0);
+}
+
+static void deliver_batch (struct instance *o)
+{
+    ASSERT(o->batch_mode)
+    ASSERT(!o->processing)
+    ASSERT(batch_is_empty(&o->delivering))
+    ASSERT(!batch_is_empty(&o->pending))
+    ASSERT(!BTimer_IsRunning(&o->coalesce_timer))
+    
+    batch_move(&o->delivering, &o->pending);
+    
+    // drop entries which cancelled out
+    LinkedList1Node *ln = LinkedList1_GetFirst(&o->delivering.list);
+    while (ln) {
+        LinkedList1Node *next = LinkedList1Node_Next(ln);
+        struct batch_entry *e = UPPER_OBJECT(ln, struct batch_entry, list_node);
+        if (!batch_entry_type(e)) {
+            batch_free_entry(&o->delivering, e);
+        }
+        ln = next;
+    }
+    
+    if (batch_is_empty(&o->delivering)) {
+        return;
+    }
+    
+    // set processing
+    o->processing = 1;
+    
+    // signal up
+    NCDModuleInst_Backend_Up(o->i);
+}
+
+static void coalesce_timer_handler (void *vo)
+{
+    struct instance *o = vo;
+    ASSERT(o->batch_mode)
+    ASSERT(!batch_is_empty(&o->pending))
+    
+    // if a batch is being processed, the next one is delivered from nextevent()
+    if (!o->processing) {
+        deliver_batch(o);
+    }
+}
+
+static void scan_dir_batch (struct instance *o)
+{
+    ASSERT(o->batch_mode)
+    ASSERT(!o->processing)
+    ASSERT(o->dir_fd >= 0)
+    
+    // collect all entries
+    const char *name;
+    int res;
+    while ((res = dir_scan_next(o, &name)) > 0) {
+        if (!batch_add(&o->pending, name, "added")) {
+            ModuleLog(o->i, BLOG_ERROR, "batch_add failed");
+            instance_free(o, 1);
             return;
         }
-    } while (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."));
+    }
+    if (res < 0) {
+        ModuleLog(o->i, BLOG_ERROR, "getdents64 failed");
+        instance_free(o, 1);
+        return;
+    }
+    
+    // close directory
+    if (!dir_scan_close(o)) {
+        ModuleLog(o->i, BLOG_ERROR, "close failed");
+        instance_free(o, 1);
+        return;
+    }
+    
+    // start receiving inotify events
+    BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
+    
+    // report the initial scan
+    if (!batch_is_empty(&o->pending)) {
+        deliver_batch(o);
+    }
+}
+
+static void next_dir_event (struct instance *o)
+{
+    ASSERT(!o->processing)
+    ASSERT(o->dir_fd >= 0)
+    
+    // get next entry
+    const char *name;
+    int res = dir_scan_next(o, &name);
+    if (res < 0) {
+        ModuleLog(o->i, BLOG_ERROR, "getdents64 failed");
+        instance_free(o, 1);
+        return;
+    }
+    
+    if (res == 0) {
+        // close directory
+        if (!dir_scan_close(o)) {
+            ModuleLog(o->i, BLOG_ERROR, "close failed");
+            instance_free(o, 1);
+            return;
+        }
+        
+        // start receiving inotify events
+        BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, BREACTOR_READ);
+        return;
+    }
     
     // set event
-    o->processing_file = entry->d_name;
+    o->processing_file = name;
     o->processing_type = "added";
     o->processing = 1;
     
@@ -157,7 +406,7 @@ static void skip_inotify_event (struct instance *o)
 static void next_inotify_event (struct instance *o)
 {
     ASSERT(!o->processing)
-    ASSERT(!o->dir_handle)
+    ASSERT(o->dir_fd < 0)
     
     // skip any bad events
     while (o->events_index < o->events_count && !translate_inotify_event(o)) {
@@ -183,15 +432,40 @@ static void next_inotify_event (struct instance *o)
     NCDModuleInst_Backend_Up(o->i);
 }
 
+static void collect_inotify_events (struct instance *o)
+{
+    ASSERT(o->batch_mode)
+    
+    int was_empty = batch_is_empty(&o->pending);
+    
+    while (o->events_index < o->events_count) {
+        const char *type = translate_inotify_event(o);
+        if (!type) {
+            ModuleLog(o->i, BLOG_ERROR, "unknown inotify event");
+        }
+        else if (!batch_add(&o->pending, o->events[o->events_index].name, type)) {
+            ModuleLog(o->i, BLOG_ERROR, "batch_add failed");
+            instance_free(o, 1);
+            return;
+        }
+        skip_inotify_event(o);
+    }
+    
+    // start the coalescing window with the first event
+    if (was_empty && !batch_is_empty(&o->pending)) {
+        BReactor_SetTimerAfter(o->i->params->iparams->reactor, &o->coalesce_timer, o->coalesce_time);
+    }
+}
+
 static void inotify_fd_handler (struct instance *o, int events)
 {
-    if (o->processing) {
+    if (o->processing && !o->batch_mode) {
         ModuleLog(o->i, BLOG_ERROR, "file descriptor error");
         instance_free(o, 1);
         return;
     }
     
-    ASSERT(!o->dir_handle)
+    ASSERT(o->dir_fd < 0)
     
     int res = read(o->inotify_fd, o->events, sizeof(o->events));
     if (res < 0) {
@@ -200,9 +474,6 @@ static void inotify_fd_handler (struct instance *o, int events)
         return;
     }
     
-    // stop waiting for inotify events
-    BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, 0);
-    
     ASSERT(res <= sizeof(o->events))
     ASSERT(res % sizeof(o->events[0]) == 0)
     
@@ -210,6 +481,15 @@ static void inotify_fd_handler (struct instance *o, int events)
     o->events_count = res / sizeof(o->events[0]);
     o->events_index = 0;
     
+    if (o->batch_mode) {
+        // keep reading while a batch is being processed
+        collect_inotify_events(o);
+        return;
+    }
+    
+    // stop waiting for inotify events
+    BReactor_SetFileDescriptorEvents(o->i->params->iparams->reactor, &o->bfd, 0);
+    
     // process inotify events
     next_inotify_event(o);
 }
@@ -224,7 +504,18 @@ static void next_event (struct instance *o)
     // signal down
     NCDModuleInst_Backend_Down(o->i);
     
-    if (o->dir_handle) {
+    if (o->batch_mode) {
+        // release the reported batch
+        batch_clear(&o->delivering);
+        
+        // report the next batch if its window has already passed
+        if (!batch_is_empty(&o->pending) && !BTimer_IsRunning(&o->coalesce_timer)) {
+            deliver_batch(o);
+        }
+        return;
+    }
+    
+    if (o->dir_fd >= 0) {
         next_dir_event(o);
         return;
     } else {
@@ -240,15 +531,29 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     
     // check arguments
     NCDValRef dir_arg;
-    if (!NCDVal_ListRead(params->args, 1, &dir_arg)) {
+    NCDValRef options_arg = NCDVal_NewInvalid();
+    if (!NCDVal_ListRead(params->args, 1, &dir_arg) && !NCDVal_ListRead(params->args, 2, &dir_arg, &options_arg)) {
         ModuleLog(o->i, BLOG_ERROR, "wrong arity");
         goto fail0;
     }
-    if (!NCDVal_IsStringNoNulls(dir_arg)) {
+    if (!NCDVal_IsStringNoNulls(dir_arg) || (!NCDVal_IsInvalid(options_arg) && !NCDVal_IsMap(options_arg))) {
         ModuleLog(o->i, BLOG_ERROR, "wrong type");
         goto fail0;
     }
     
+    // read options
+    o->batch_mode = 0;
+    if (!NCDVal_IsInvalid(options_arg)) {
+        NCDValRef value;
+        if (!NCDVal_IsInvalid(value = NCDVal_MapGetValue(options_arg, "coalesce_ms"))) {
+            if (!ncd_read_time(value, &o->coalesce_time)) {
+                ModuleLog(o->i, BLOG_ERROR, "wrong coalesce_ms");
+                goto fail0;
+            }
+            o->batch_mode = 1;
+        }
+    }
+    
     // null terminate dir
     if (!NCDVal_StringNullTerminate(dir_arg, &o->dir_nts)) {
         ModuleLog(o->i, BLOG_ERROR, "NCDVal_StringNullTerminate failed");
@@ -281,18 +586,39 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
     }
     
     // open directory
-    if (!(o->dir_handle = opendir(o->dir_nts.data))) {
-        ModuleLog(o->i, BLOG_ERROR, "opendir failed");
+    if ((o->dir_fd = open(o->dir_nts.data, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        ModuleLog(o->i, BLOG_ERROR, "open failed");
         goto fail3;
     }
     
+    // allocate directory buffer
+    if (!(o->dir_buf = malloc(DIR_BUF_SIZE))) {
+        ModuleLog(o->i, BLOG_ERROR, "malloc failed");
+        goto fail4;
+    }
+    o->dir_buf_len = 0;
+    o->dir_buf_pos = 0;
+    
+    // init batch state
+    BTimer_Init(&o->coalesce_timer, 0, coalesce_timer_handler, o);
+    batch_init(&o->pending);
+    batch_init(&o->delivering);
+    
     // set not processing
     o->processing = 0;
     
-    // read first directory entry
-    next_dir_event(o);
+    // scan directory
+    if (o->batch_mode) {
+        scan_dir_batch(o);
+    } else {
+        next_dir_event(o);
+    }
     return;
     
+fail4:
+    if (close(o->dir_fd) < 0) {
+        ModuleLog(o->i, BLOG_ERROR, "close failed");
+    }
 fail3:
     BReactor_RemoveFileDescriptor(o->i->params->iparams->reactor, &o->bfd);
 fail2:
@@ -308,12 +634,17 @@ fail0:
 void instance_free (struct instance *o, int is_error)
 {
     // close directory
-    if (o->dir_handle) {
-        if (closedir(o->dir_handle) < 0) {
-            ModuleLog(o->i, BLOG_ERROR, "closedir failed");
+    if (o->dir_fd >= 0) {
+        if (!dir_scan_close(o)) {
+            ModuleLog(o->i, BLOG_ERROR, "close failed");
         }
     }
     
+    // free batch state
+    BReactor_RemoveTimer(o->i->params->iparams->reactor, &o->coalesce_timer);
+    batch_clear(&o->delivering);
+    batch_clear(&o->pending);
+    
     // free BFileDescriptor
     BReactor_RemoveFileDescriptor(o->i->params->iparams->reactor, &o->bfd);
     
@@ -338,11 +669,71 @@ static void func_die (void *vo)
     instance_free(o, 0);
 }
 
+static int make_events_list (struct instance *o, NCDValMem *mem, NCDValRef *out)
+{
+    ASSERT(o->batch_mode)
+    ASSERT(o->processing)
+    
+    size_t count = 0;
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->delivering.list); ln; ln = LinkedList1Node_Next(ln)) {
+        count++;
+    }
+    
+    *out = NCDVal_NewList(mem, count);
+    if (NCDVal_IsInvalid(*out)) {
+        goto fail;
+    }
+    
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->delivering.list); ln; ln = LinkedList1Node_Next(ln)) {
+        struct batch_entry *e = UPPER_OBJECT(ln, struct batch_entry, list_node);
+        
+        char *path = concat_strings(3, o->dir_nts.data, "/", e->name);
+        if (!path) {
+            ModuleLog(o->i, BLOG_ERROR, "concat_strings failed");
+            goto fail;
+        }
+        
+        NCDValRef map = NCDVal_NewMap(mem, 3);
+        NCDValRef type_key = NCDVal_NewString(mem, "event_type");
+        NCDValRef type_val = NCDVal_NewString(mem, batch_entry_type(e));
+        NCDValRef name_key = NCDVal_NewString(mem, "filename");
+        NCDValRef name_val = NCDVal_NewString(mem, e->name);
+        NCDValRef path_key = NCDVal_NewString(mem, "filepath");
+        NCDValRef path_val = NCDVal_NewString(mem, path);
+        free(path);
+        
+        int inserted;
+        if (NCDVal_IsInvalid(map) || NCDVal_IsInvalid(type_key) || NCDVal_IsInvalid(type_val) ||
+            NCDVal_IsInvalid(name_key) || NCDVal_IsInvalid(name_val) ||
+            NCDVal_IsInvalid(path_key) || NCDVal_IsInvalid(path_val) ||
+            !NCDVal_MapInsert(map, type_key, type_val, &inserted) ||
+            !NCDVal_MapInsert(map, name_key, name_val, &inserted) ||
+            !NCDVal_MapInsert(map, path_key, path_val, &inserted) ||
+            !NCDVal_ListAppend(*out, map)
+        ) {
+            goto fail;
+        }
+    }
+    
+    return 1;
+    
+fail:
+    *out = NCDVal_NewInvalid();
+    return 1;
+}
+
 static int func_getvar (void *vo, const char *name, NCDValMem *mem, NCDValRef *out)
 {
     struct instance *o = vo;
     ASSERT(o->processing)
     
+    if (o->batch_mode) {
+        if (!strcmp(name, "events")) {
+            return make_events_list(o, mem, out);
+        }
+        return 0;
+    }
+    
     if (!strcmp(name, "event_type")) {
         *out = NCDVal_NewString(mem, o->processing_type);
         return 1;
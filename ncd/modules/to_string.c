@@ -32,12 +32,24 @@
  *   to_string(value)
  * Variables:
  *   string (empty) - value, converted to string
+ * 
+ * Synopsis:
+ *   to_binary(value)
+ * Variables:
+ *   string (empty) - value, encoded in the binary format of NCDValBinary
+ * 
+ * Description:
+ *   The binary format is more compact than the text format and is cheaper
+ *   to produce and parse. It is suitable for storing values in files and
+ *   passing them to other programs. Use from_binary() to decode it.
  */
 
 #include <stdlib.h>
 #include <string.h>
 
+#include <misc/expstring.h>
 #include <ncd/NCDValGenerator.h>
+#include <ncd/NCDValBinary.h>
 
 #include <ncd/module_common.h>
 
@@ -46,6 +58,7 @@
 struct instance {
     NCDModuleInst *i;
     char *str;
+    size_t len;
 };
 
 static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
@@ -65,6 +78,7 @@ static void func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new
         ModuleLog(i, BLOG_ERROR, "NCDValGenerator_Generate failed");
         goto fail0;
     }
+    o->len = strlen(o->str);
     
     // signal up
     NCDModuleInst_Backend_Up(i);
@@ -74,6 +88,44 @@ fail0:
     NCDModuleInst_Backend_DeadError(i);
 }
 
+static void binary_func_new (void *vo, NCDModuleInst *i, const struct NCDModuleInst_new_params *params)
+{
+    struct instance *o = vo;
+    o->i = i;
+    
+    // read arguments
+    NCDValRef value_arg;
+    if (!NCDVal_ListRead(params->args, 1, &value_arg)) {
+        ModuleLog(i, BLOG_ERROR, "wrong arity");
+        goto fail0;
+    }
+    
+    // init string
+    ExpString str;
+    if (!ExpString_Init(&str)) {
+        ModuleLog(i, BLOG_ERROR, "ExpString_Init failed");
+        goto fail0;
+    }
+    
+    // encode value
+    if (!NCDValBinary_AppendEncode(value_arg, &str)) {
+        ModuleLog(i, BLOG_ERROR, "NCDValBinary_AppendEncode failed");
+        goto fail1;
+    }
+    
+    o->str = ExpString_Get(&str);
+    o->len = ExpString_Length(&str);
+    
+    // signal up
+    NCDModuleInst_Backend_Up(i);
+    return;
+    
+fail1:
+    ExpString_Free(&str);
+fail0:
+    NCDModuleInst_Backend_DeadError(i);
+}
+
 static void func_die (void *vo)
 {
     struct instance *o = vo;
@@ -89,7 +141,7 @@ static int func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NCDValR
     struct instance *o = vo;
     
     if (name == NCD_STRING_EMPTY) {
-        *out = NCDVal_NewString(mem, o->str);
+        *out = NCDVal_NewStringBin(mem, (const uint8_t *)o->str, o->len);
         return 1;
     }
     
@@ -103,6 +155,12 @@ static struct NCDModule modules[] = {
         .func_die = func_die,
         .func_getvar2 = func_getvar2,
         .alloc_size = sizeof(struct instance)
+    }, {
+        .type = "to_binary",
+        .func_new2 = binary_func_new,
+        .func_die = func_die,
+        .func_getvar2 = func_getvar2,
+        .alloc_size = sizeof(struct instance)
     }, {
         .type = NULL
     }
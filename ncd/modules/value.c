@@ -244,12 +244,15 @@ static void value_string_set_rstr (struct value *v, NCDRefString *rstr, size_t l
 static struct value * value_init_list (NCDModuleInst *i);
 static size_t value_list_len (struct value *v);
 static struct value * value_list_at (struct value *v, size_t index);
+static struct value * value_list_first (struct value *v);
+static struct value * value_list_next (struct value *v, struct value *ev);
 static size_t value_list_indexof (struct value *v, struct value *ev);
 static int value_list_insert (NCDModuleInst *i, struct value *list, struct value *v, size_t index);
 static void value_list_remove (struct value *list, struct value *v);
 static struct value * value_init_map (NCDModuleInst *i);
 static size_t value_map_len (struct value *map);
-static struct value * value_map_at (struct value *map, size_t index);
+static struct value * value_map_first (struct value *map);
+static struct value * value_map_next (struct value *map, struct value *ev);
 static struct value * value_map_find (struct value *map, NCDValRef key);
 static int value_map_insert (struct value *map, struct value *v, NCDValMem mem, NCDValSafeRef key, NCDModuleInst *i);
 static void value_map_remove (struct value *map, struct value *v);
@@ -314,7 +317,7 @@ static void value_cleanup (struct value *v)
         
         case NCDVAL_LIST: {
             while (value_list_len(v) > 0) {
-                struct value *ev = value_list_at(v, 0);
+                struct value *ev = value_list_first(v);
                 value_list_remove(v, ev);
                 value_cleanup(ev);
             }
@@ -322,7 +325,7 @@ static void value_cleanup (struct value *v)
         
         case NCDVAL_MAP: {
             while (value_map_len(v) > 0) {
-                struct value *ev = value_map_at(v, 0);
+                struct value *ev = value_map_first(v);
                 value_map_remove(v, ev);
                 value_cleanup(ev);
             }
@@ -371,14 +374,14 @@ static void value_delete (struct value *v)
         
         case NCDVAL_LIST: {
             while (value_list_len(v) > 0) {
-                struct value *ev = value_list_at(v, 0);
+                struct value *ev = value_list_first(v);
                 value_delete(ev);
             }
         } break;
         
         case NCDVAL_MAP: {
             while (value_map_len(v) > 0) {
-                struct value *ev = value_map_at(v, 0);
+                struct value *ev = value_map_first(v);
                 value_delete(ev);
             }
         } break;
@@ -572,6 +575,37 @@ static struct value * value_list_at (struct value *v, size_t index)
     return e;
 }
 
+static struct value * value_list_first (struct value *v)
+{
+    ASSERT(v->type == NCDVAL_LIST)
+    
+    IndexedListNode *iln = IndexedList_GetFirst(&v->list.list_contents_il);
+    if (!iln) {
+        return NULL;
+    }
+    
+    struct value *e = UPPER_OBJECT(iln, struct value, list_parent.list_contents_il_node);
+    ASSERT(e->parent == v)
+    
+    return e;
+}
+
+static struct value * value_list_next (struct value *v, struct value *ev)
+{
+    ASSERT(v->type == NCDVAL_LIST)
+    ASSERT(ev->parent == v)
+    
+    IndexedListNode *iln = IndexedList_GetNext(&v->list.list_contents_il, &ev->list_parent.list_contents_il_node);
+    if (!iln) {
+        return NULL;
+    }
+    
+    struct value *e = UPPER_OBJECT(iln, struct value, list_parent.list_contents_il_node);
+    ASSERT(e->parent == v)
+    
+    return e;
+}
+
 static size_t value_list_indexof (struct value *v, struct value *ev)
 {
     ASSERT(v->type == NCDVAL_LIST)
@@ -633,14 +667,23 @@ static size_t value_map_len (struct value *map)
     return MapTree_Count(&map->map.map_tree, 0);
 }
 
-static struct value * value_map_at (struct value *map, size_t index)
+static struct value * value_map_first (struct value *map)
 {
     ASSERT(map->type == NCDVAL_MAP)
-    ASSERT(index < value_map_len(map))
     
-    struct value *e =  MapTree_GetAt(&map->map.map_tree, 0, index);
-    ASSERT(e)
-    ASSERT(e->parent == map)
+    struct value *e = MapTree_GetFirst(&map->map.map_tree, 0);
+    ASSERT(!e || e->parent == map)
+    
+    return e;
+}
+
+static struct value * value_map_next (struct value *map, struct value *ev)
+{
+    ASSERT(map->type == NCDVAL_MAP)
+    ASSERT(ev->parent == map)
+    
+    struct value *e = MapTree_GetNext(&map->map.map_tree, 0, ev);
+    ASSERT(!e || e->parent == map)
     
     return e;
 }
@@ -818,9 +861,9 @@ static int value_to_value (NCDModuleInst *i, struct value *v, NCDValMem *mem, NC
                 goto fail;
             }
             
-            for (size_t index = 0; index < value_list_len(v); index++) {
+            for (struct value *ev = value_list_first(v); ev; ev = value_list_next(v, ev)) {
                 NCDValRef eval;
-                if (!value_to_value(i, value_list_at(v, index), mem, &eval)) {
+                if (!value_to_value(i, ev, mem, &eval)) {
                     goto fail;
                 }
                 
@@ -836,9 +879,8 @@ static int value_to_value (NCDModuleInst *i, struct value *v, NCDValMem *mem, NC
                 goto fail;
             }
             
-            for (size_t index = 0; index < value_map_len(v); index++) {
-                struct value *ev = value_map_at(v, index);
-                
+            for (struct value *ev = value_map_first(v); ev; ev = value_map_next(v, ev)) {
+
                 NCDValRef key = NCDVal_NewCopy(mem, ev->map_parent.key);
                 if (NCDVal_IsInvalid(key)) {
                     goto fail;
@@ -1284,9 +1326,8 @@ static int func_getvar2 (void *vo, NCD_string_id_t name, NCDValMem *mem, NCDValR
             goto fail;
         }
         
-        for (size_t j = 0; j < value_map_len(v); j++) {
-            struct value *ev = value_map_at(v, j);
-            
+        for (struct value *ev = value_map_first(v); ev; ev = value_map_next(v, ev)) {
+
             NCDValRef key = NCDVal_NewCopy(mem, ev->map_parent.key);
             if (NCDVal_IsInvalid(key)) {
                 goto fail;
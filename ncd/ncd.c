@@ -37,8 +37,11 @@
 #include <misc/open_standard_streams.h>
 #include <misc/string_begins_with.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
+#include <base/BAllocStats.h>
 #include <system/BReactor.h>
 #include <system/BSignal.h>
+#include <system/BUnixSignal.h>
 #include <system/BProcess.h>
 #include <udevmonitor/NCDUdevManager.h>
 #include <random/BRandom2.h>
@@ -69,10 +72,14 @@ static struct {
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
     char *config_file;
+    char *program_cache;
     int syntax_only;
     int retry_time;
+    int keep_on_backtrack;
     int signal_exit_code;
     int no_udev;
+    int metrics;
+    int stall_threshold;
     char **extra_args;
     int num_extra_args;
 } options;
@@ -92,12 +99,17 @@ static BRandom2 random2;
 // interpreter
 static NCDInterpreter interpreter;
 
+// memory report signal
+static BUnixSignal report_signal;
+
 // forward declarations of functions
 static void print_help (const char *name);
 static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
 static void signal_handler (void *unused);
+static void report_signal_handler (void *unused, int signo);
 static void interpreter_handler_finished (void *user, int exit_code);
+static void print_metric (void *user, const char *line);
 
 int main (int argc, char **argv)
 {
@@ -176,6 +188,7 @@ int main (int argc, char **argv)
         BLog(BLOG_ERROR, "BReactor_Init failed");
         goto fail1;
     }
+    BReactor_SetStallThreshold(&reactor, options.stall_threshold);
     
     // init process manager
     if (!BProcessManager_Init(&manager, &reactor)) {
@@ -198,11 +211,26 @@ int main (int argc, char **argv)
         goto fail4;
     }
     
+    // report memory usage on SIGUSR1
+    sigset_t report_signals;
+    sigemptyset(&report_signals);
+    sigaddset(&report_signals, SIGUSR1);
+    if (!BUnixSignal_Init(&report_signal, &reactor, report_signals, report_signal_handler, NULL)) {
+        BLog(BLOG_ERROR, "BUnixSignal_Init failed");
+        goto fail5;
+    }
+    
     // build program
     NCDProgram program;
-    if (!NCDBuildProgram_Build(options.config_file, &program)) {
+    int build_res;
+    if (options.program_cache) {
+        build_res = NCDBuildProgram_BuildCached(options.config_file, options.program_cache, &program);
+    } else {
+        build_res = NCDBuildProgram_Build(options.config_file, &program);
+    }
+    if (!build_res) {
         BLog(BLOG_ERROR, "failed to build program");
-        goto fail5;
+        goto fail5a;
     }
     
     // setup interpreter parameters
@@ -210,6 +238,7 @@ int main (int argc, char **argv)
     params.handler_finished = interpreter_handler_finished;
     params.user = NULL;
     params.retry_time = options.retry_time;
+    params.keep_on_backtrack = options.keep_on_backtrack;
     params.extra_args = options.extra_args;
     params.num_extra_args = options.num_extra_args;
     params.reactor = &reactor;
@@ -217,9 +246,14 @@ int main (int argc, char **argv)
     params.umanager = &umanager;
     params.random2 = &random2;
     
+    // record interpreter metrics for the report at exit
+    if (options.metrics) {
+        BMetrics_Enable();
+    }
+    
     // initialize interpreter
     if (!NCDInterpreter_Init(&interpreter, program, params)) {
-        goto fail5;
+        goto fail5a;
     }
     
     // don't enter event loop if syntax check is requested
@@ -236,6 +270,14 @@ int main (int argc, char **argv)
 fail6:
     // free interpreter
     NCDInterpreter_Free(&interpreter);
+    
+    // report metrics, including the values freed with the interpreter
+    if (options.metrics) {
+        BMetrics_Print(print_metric, NULL);
+    }
+fail5a:
+    // remove memory report signal handler
+    BUnixSignal_Free(&report_signal, 0);
 fail5:
     // remove signal handler
     BSignal_Finish();
@@ -252,6 +294,9 @@ fail2:
     // free reactor
     BReactor_Free(&reactor);
 fail1:
+    // free metrics
+    BMetrics_Free();
+    
     // free logger
     BLog(BLOG_NOTICE, "exiting");
     BLog_Free();
@@ -277,10 +322,14 @@ void print_help (const char *name)
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
         "        [--retry-time <ms>]\n"
+        "        [--keep-on-backtrack]\n"
         "        [--no-udev]\n"
         "        [--config-file <ncd_program_file>]\n"
+        "        [--program-cache <cache_file>]\n"
         "        [--syntax-only]\n"
         "        [--signal-exit-code <number>]\n"
+        "        [--metrics]\n"
+        "        [--stall-threshold <ms>]\n"
         "        [-- program_args...]\n"
         "        [<ncd_program_file> program_args...]\n" ,
         name
@@ -310,10 +359,14 @@ int parse_arguments (int argc, char *argv[])
         options.loglevels[i] = -1;
     }
     options.config_file = NULL;
+    options.program_cache = NULL;
     options.syntax_only = 0;
     options.retry_time = DEFAULT_RETRY_TIME;
+    options.keep_on_backtrack = 0;
     options.signal_exit_code = DEFAULT_SIGNAL_EXIT_CODE;
     options.no_udev = 0;
+    options.metrics = 0;
+    options.stall_threshold = 0;
     options.extra_args = NULL;
     options.num_extra_args = 0;
     
@@ -403,6 +456,14 @@ int parse_arguments (int argc, char *argv[])
             options.config_file = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--program-cache")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.program_cache = argv[i + 1];
+            i++;
+        }
         else if (!strcmp(arg, "--syntax-only")) {
             options.syntax_only = 1;
         }
@@ -417,6 +478,9 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--keep-on-backtrack")) {
+            options.keep_on_backtrack = 1;
+        }
         else if (!strcmp(arg, "--signal-exit-code")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -431,6 +495,20 @@ int parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--no-udev")) {
             options.no_udev = 1;
         }
+        else if (!strcmp(arg, "--metrics")) {
+            options.metrics = 1;
+        }
+        else if (!strcmp(arg, "--stall-threshold")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.stall_threshold = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--")) {
             options.extra_args = &argv[i + 1];
             options.num_extra_args = argc - i - 1;
@@ -471,7 +549,22 @@ void signal_handler (void *unused)
     NCDInterpreter_RequestShutdown(&interpreter, options.signal_exit_code);
 }
 
+void report_signal_handler (void *unused, int signo)
+{
+    for (int i = 0; i < BALLOCSTATS_NUM_CATEGORIES; i++) {
+        size_t current;
+        size_t peak;
+        BAllocStats_Get(i, &current, &peak);
+        BLog(BLOG_NOTICE, "memory %s: %zu bytes, peak %zu bytes", BAllocStats_CategoryName(i), current, peak);
+    }
+}
+
 void interpreter_handler_finished (void *user, int exit_code)
 {
     BReactor_Quit(&reactor, exit_code);
 }
+
+void print_metric (void *user, const char *line)
+{
+    fprintf(stderr, "%s\n", line);
+}
@@ -913,6 +913,23 @@ fail0:
     return 0;
 }
 
+int BSSLConnection_EnableResumption (PRFileDesc *prfd)
+{
+    // sessions are resumed from the session cache NSS keeps for the whole process;
+    // a backend has no peer address, so a client finds its sessions by the URL
+    // set with SSL_SetURL, and tickets let a server resume them without storing them
+    if (SSL_OptionSet(prfd, SSL_NO_CACHE, PR_FALSE) != SECSuccess) {
+        BLog(BLOG_ERROR, "SSL_OptionSet(SSL_NO_CACHE) failed");
+        return 0;
+    }
+    if (SSL_OptionSet(prfd, SSL_ENABLE_SESSION_TICKETS, PR_TRUE) != SECSuccess) {
+        BLog(BLOG_ERROR, "SSL_OptionSet(SSL_ENABLE_SESSION_TICKETS) failed");
+        return 0;
+    }
+    
+    return 1;
+}
+
 void BSSLConnection_Init (BSSLConnection *o, PRFileDesc *prfd, int force_handshake, BPendingGroup *pg, void *user,
                           BSSLConnection_handler handler)
 {
@@ -45,7 +45,10 @@
 #define BSSLCONNECTION_EVENT_UP 1
 #define BSSLCONNECTION_EVENT_ERROR 2
 
-#define BSSLCONNECTION_BUF_SIZE 4096
+// large enough for one TLS record of maximum size (header, 2^14 bytes of
+// plaintext and 2048 bytes of expansion), so that NSS can move a whole record
+// through the backend in one operation
+#define BSSLCONNECTION_BUF_SIZE (5 + 16384 + 2048)
 
 #define BSSLCONNECTION_FLAG_THREADWORK_HANDSHAKE (1 << 0)
 #define BSSLCONNECTION_FLAG_THREADWORK_IO (1 << 1)
@@ -105,6 +108,7 @@ struct BSSLConnection_backend {
 
 int BSSLConnection_GlobalInit (void) WARN_UNUSED;
 int BSSLConnection_MakeBackend (PRFileDesc *prfd, StreamPassInterface *send_if, StreamRecvInterface *recv_if, BThreadWorkDispatcher *twd, int flags) WARN_UNUSED;
+int BSSLConnection_EnableResumption (PRFileDesc *prfd) WARN_UNUSED;
 
 void BSSLConnection_Init (BSSLConnection *o, PRFileDesc *prfd, int force_handshake, BPendingGroup *pg, void *user,
                           BSSLConnection_handler handler);
@@ -44,7 +44,44 @@
 
 #include <generated/blog_channel_BPredicate.h>
 
-static int eval_predicate_node (BPredicate *p, struct predicate_node *root);
+#define OP_CONSTANT 1
+#define OP_NEG 2
+#define OP_AND 3
+#define OP_OR 4
+#define OP_RESOLVE 5
+#define OP_CALL 6
+
+// The expression tree is compiled into a flat program for a stack machine,
+// evaluated without recursion:
+//   OP_CONSTANT: push arg
+//   OP_NEG: negate top
+//   OP_AND: if top is false, jump to arg keeping it, else pop it
+//   OP_OR: if top is true, jump to arg keeping it, else pop it
+//   OP_RESOLVE: look up the function of call site arg and check its arguments
+//   OP_CALL: pop the bool arguments of call site arg, call it, push result
+struct instruction {
+    int op;
+    int arg;
+};
+
+struct call_site {
+    char *name;
+    int num_args;
+    int arg_types[PREDICATE_MAX_ARGS];
+    void *args[PREDICATE_MAX_ARGS];
+    int num_bool_args;
+    unsigned int resolved_gen;
+    BPredicateFunction *func;
+    const char *error;
+};
+
+struct program {
+    struct instruction *instructions;
+    int num_instructions;
+    struct call_site *sites;
+    int num_sites;
+    int *stack;
+};
 
 void yyerror (YYLTYPE *yylloc, yyscan_t scanner, struct predicate_node **result, char *str)
 {
@@ -56,127 +93,290 @@ static int string_comparator (void *user, char *s1, char *s2)
     return B_COMPARE(cmp, 0);
 }
 
-static int eval_function (BPredicate *p, struct predicate_node *root)
+static void replace_node (struct predicate_node *n, struct predicate_node *child)
+{
+    *n = *child;
+    free(child);
+}
+
+static void fold_node (struct predicate_node *n)
+{
+    switch (n->type) {
+        case NODE_CONSTANT:
+            break;
+        case NODE_NEG: {
+            fold_node(n->neg.op);
+            struct predicate_node *op = n->neg.op;
+            if (op->type == NODE_CONSTANT) {
+                n->type = NODE_CONSTANT;
+                n->constant.val = !op->constant.val;
+                free(op);
+            }
+            else if (op->type == NODE_NEG) {
+                // functions only return 0 or 1, so double negation is identity
+                struct predicate_node *inner = op->neg.op;
+                free(op);
+                replace_node(n, inner);
+            }
+        } break;
+        case NODE_CONJUNCT:
+        case NODE_DISJUNCT: {
+            // conjunct and disjunct have the same layout
+            int absorbing = (n->type == NODE_DISJUNCT);
+            fold_node(n->conjunct.op1);
+            fold_node(n->conjunct.op2);
+            struct predicate_node *op1 = n->conjunct.op1;
+            struct predicate_node *op2 = n->conjunct.op2;
+            if (op1->type == NODE_CONSTANT) {
+                // the second operand is either never evaluated, or is the result
+                if (op1->constant.val == absorbing) {
+                    free_predicate_node(op2);
+                    n->type = NODE_CONSTANT;
+                    n->constant.val = absorbing;
+                } else {
+                    replace_node(n, op2);
+                }
+                free(op1);
+            }
+            else if (op2->type == NODE_CONSTANT && op2->constant.val != absorbing) {
+                // the first operand is the result
+                free(op2);
+                replace_node(n, op1);
+            }
+        } break;
+        case NODE_FUNCTION:
+            for (struct arguments_node *arg = n->function.args; arg; arg = arg->next) {
+                if (arg->arg.type == ARGUMENT_PREDICATE) {
+                    fold_node(arg->arg.predicate);
+                }
+            }
+            break;
+        default:
+            ASSERT(0);
+    }
+}
+
+// counts instructions and call sites, returns the stack depth needed
+static int measure_node (struct predicate_node *n, int *num_instructions, int *num_sites)
+{
+    switch (n->type) {
+        case NODE_CONSTANT:
+            (*num_instructions)++;
+            return 1;
+        case NODE_NEG:
+            (*num_instructions)++;
+            return measure_node(n->neg.op, num_instructions, num_sites);
+        case NODE_CONJUNCT:
+        case NODE_DISJUNCT: {
+            (*num_instructions)++;
+            int depth1 = measure_node(n->conjunct.op1, num_instructions, num_sites);
+            int depth2 = measure_node(n->conjunct.op2, num_instructions, num_sites);
+            return (depth1 > depth2 ? depth1 : depth2);
+        }
+        case NODE_FUNCTION: {
+            (*num_instructions) += 2;
+            (*num_sites)++;
+            int depth = 1;
+            int i = 0;
+            int num_bool = 0;
+            for (struct arguments_node *arg = n->function.args; arg && i < PREDICATE_MAX_ARGS; arg = arg->next, i++) {
+                if (arg->arg.type == ARGUMENT_PREDICATE) {
+                    int arg_depth = num_bool + measure_node(arg->arg.predicate, num_instructions, num_sites);
+                    if (arg_depth > depth) {
+                        depth = arg_depth;
+                    }
+                    num_bool++;
+                }
+            }
+            return depth;
+        }
+        default:
+            ASSERT(0)
+            return 0;
+    }
+}
+
+static void emit_node (struct program *prog, struct predicate_node *n)
 {
-    ASSERT(root->type == NODE_FUNCTION)
+    struct instruction *in;
+    
+    switch (n->type) {
+        case NODE_CONSTANT:
+            in = &prog->instructions[prog->num_instructions++];
+            in->op = OP_CONSTANT;
+            in->arg = n->constant.val;
+            break;
+        case NODE_NEG:
+            emit_node(prog, n->neg.op);
+            in = &prog->instructions[prog->num_instructions++];
+            in->op = OP_NEG;
+            in->arg = 0;
+            break;
+        case NODE_CONJUNCT:
+        case NODE_DISJUNCT: {
+            emit_node(prog, n->conjunct.op1);
+            int jump = prog->num_instructions++;
+            prog->instructions[jump].op = (n->type == NODE_CONJUNCT ? OP_AND : OP_OR);
+            emit_node(prog, n->conjunct.op2);
+            prog->instructions[jump].arg = prog->num_instructions;
+        } break;
+        case NODE_FUNCTION: {
+            int site_index = prog->num_sites++;
+            struct call_site *site = &prog->sites[site_index];
+            
+            // take the name and string arguments from the tree
+            site->name = n->function.name;
+            n->function.name = NULL;
+            site->num_args = 0;
+            site->num_bool_args = 0;
+            site->resolved_gen = 0;
+            site->func = NULL;
+            site->error = NULL;
+            
+            in = &prog->instructions[prog->num_instructions++];
+            in->op = OP_RESOLVE;
+            in->arg = site_index;
+            
+            // bool arguments are evaluated after resolving, left to right;
+            // arguments past the maximum always make the call fail
+            for (struct arguments_node *arg = n->function.args; arg; arg = arg->next, site->num_args++) {
+                if (site->num_args >= PREDICATE_MAX_ARGS) {
+                    continue;
+                }
+                switch (arg->arg.type) {
+                    case ARGUMENT_PREDICATE:
+                        site->arg_types[site->num_args] = PREDICATE_TYPE_BOOL;
+                        site->args[site->num_args] = NULL;
+                        site->num_bool_args++;
+                        emit_node(prog, arg->arg.predicate);
+                        break;
+                    case ARGUMENT_STRING:
+                        site->arg_types[site->num_args] = PREDICATE_TYPE_STRING;
+                        site->args[site->num_args] = arg->arg.string;
+                        arg->arg.string = NULL;
+                        break;
+                    default:
+                        ASSERT(0);
+                }
+            }
+            
+            in = &prog->instructions[prog->num_instructions++];
+            in->op = OP_CALL;
+            in->arg = site_index;
+        } break;
+        default:
+            ASSERT(0);
+    }
+}
+
+static void free_program (struct program *prog)
+{
+    for (int i = 0; i < prog->num_sites; i++) {
+        struct call_site *site = &prog->sites[i];
+        for (int j = 0; j < site->num_args && j < PREDICATE_MAX_ARGS; j++) {
+            if (site->arg_types[j] == PREDICATE_TYPE_STRING) {
+                free(site->args[j]);
+            }
+        }
+        free(site->name);
+    }
+    BFree(prog->stack);
+    BFree(prog->sites);
+    BFree(prog->instructions);
+    BFree(prog);
+}
+
+static struct program * compile (struct predicate_node *root)
+{
+    fold_node(root);
+    
+    int num_instructions = 0;
+    int num_sites = 0;
+    int stack_size = measure_node(root, &num_instructions, &num_sites);
+    
+    struct program *prog = (struct program *)BAlloc(sizeof(*prog));
+    if (!prog) {
+        goto fail0;
+    }
+    
+    prog->instructions = (struct instruction *)BAllocArray(num_instructions, sizeof(prog->instructions[0]));
+    if (!prog->instructions) {
+        goto fail1;
+    }
+    
+    prog->sites = (struct call_site *)BAllocArray(num_sites, sizeof(prog->sites[0]));
+    if (num_sites > 0 && !prog->sites) {
+        goto fail2;
+    }
+    
+    prog->stack = (int *)BAllocArray(stack_size, sizeof(prog->stack[0]));
+    if (!prog->stack) {
+        goto fail3;
+    }
+    
+    prog->num_instructions = 0;
+    prog->num_sites = 0;
+    emit_node(prog, root);
+    ASSERT(prog->num_instructions == num_instructions)
+    ASSERT(prog->num_sites == num_sites)
+    
+    return prog;
     
+fail3:
+    BFree(prog->sites);
+fail2:
+    BFree(prog->instructions);
+fail1:
+    BFree(prog);
+fail0:
+    return NULL;
+}
+
+static BPredicateFunction * lookup_function (BPredicate *p, struct call_site *site, const char **error)
+{
     // lookup function by name
-    ASSERT(root->function.name)
+    ASSERT(site->name)
     BAVLNode *tree_node;
-    if (!(tree_node = BAVL_LookupExact(&p->functions_tree, root->function.name))) {
-        BLog(BLOG_WARNING, "unknown function");
-        return 0;
+    if (!(tree_node = BAVL_LookupExact(&p->functions_tree, site->name))) {
+        *error = "unknown function";
+        return NULL;
     }
     BPredicateFunction *func = UPPER_OBJECT(tree_node, BPredicateFunction, tree_node);
     
-    // evaluate arguments
-    struct arguments_node *arg = root->function.args;
-    void *args[PREDICATE_MAX_ARGS];
+    // check arguments
     for (int i = 0; i < func->num_args; i++) {
-        if (!arg) {
-            BLog(BLOG_WARNING, "not enough arguments");
-            return 0;
+        if (i >= site->num_args) {
+            *error = "not enough arguments";
+            return NULL;
         }
-        switch (func->args[i]) {
-            case PREDICATE_TYPE_BOOL:
-                if (arg->arg.type != ARGUMENT_PREDICATE) {
-                    BLog(BLOG_WARNING, "expecting predicate argument");
-                    return 0;
-                }
-                if (!eval_predicate_node(p, arg->arg.predicate)) {
-                    return 0;
-                }
-                args[i] = &arg->arg.predicate->eval_value;
-                break;
-            case PREDICATE_TYPE_STRING:
-                if (arg->arg.type != ARGUMENT_STRING) {
-                    BLog(BLOG_WARNING, "expecting string argument");
-                    return 0;
-                }
-                args[i] = arg->arg.string;
-                break;
-            default:
-                ASSERT(0);
+        if (site->arg_types[i] != func->args[i]) {
+            *error = (func->args[i] == PREDICATE_TYPE_BOOL ? "expecting predicate argument" : "expecting string argument");
+            return NULL;
         }
-        arg = arg->next;
     }
     
-    if (arg) {
-        BLog(BLOG_WARNING, "too many arguments");
-        return 0;
+    if (site->num_args > func->num_args) {
+        *error = "too many arguments";
+        return NULL;
     }
     
-    // call callback
-    #ifndef NDEBUG
-    p->in_function = 1;
-    #endif
-    int res = func->callback(func->user, args);
-    #ifndef NDEBUG
-    p->in_function = 0;
-    #endif
-    if (res != 0 && res != 1) {
-        BLog(BLOG_WARNING, "callback returned non-boolean");
-        return 0;
-    }
-    
-    root->eval_value = res;
-    return 1;
+    return func;
 }
 
-int eval_predicate_node (BPredicate *p, struct predicate_node *root)
+static int resolve_site (BPredicate *p, struct call_site *site)
 {
-    ASSERT(root)
+    // functions only change when registered or removed
+    if (site->resolved_gen != p->functions_gen) {
+        site->func = lookup_function(p, site, &site->error);
+        site->resolved_gen = p->functions_gen;
+    }
     
-    switch (root->type) {
-        case NODE_CONSTANT:
-            root->eval_value = root->constant.val;
-            return 1;
-        case NODE_NEG:
-            if (!eval_predicate_node(p, root->neg.op)) {
-                return 0;
-            }
-            root->eval_value = !root->neg.op->eval_value;
-            return 1;
-        case NODE_CONJUNCT:
-            if (!eval_predicate_node(p, root->conjunct.op1)) {
-                return 0;
-            }
-            if (!root->conjunct.op1->eval_value) {
-                root->eval_value = 0;
-                return 1;
-            }
-            if (!eval_predicate_node(p, root->conjunct.op2)) {
-                return 0;
-            }
-            if (!root->conjunct.op2->eval_value) {
-                root->eval_value = 0;
-                return 1;
-            }
-            root->eval_value = 1;
-            return 1;
-        case NODE_DISJUNCT:
-            if (!eval_predicate_node(p, root->disjunct.op1)) {
-                return 0;
-            }
-            if (root->disjunct.op1->eval_value) {
-                root->eval_value = 1;
-                return 1;
-            }
-            if (!eval_predicate_node(p, root->disjunct.op2)) {
-                return 0;
-            }
-            if (root->disjunct.op2->eval_value) {
-                root->eval_value = 1;
-                return 1;
-            }
-            root->eval_value = 0;
-            return 1;
-        case NODE_FUNCTION:
-            return eval_function(p, root);
-        default:
-            ASSERT(0)
-            return 0;
+    if (!site->func) {
+        BLog(BLOG_WARNING, "%s", site->error);
+        return 0;
     }
+    
+    return 1;
 }
 
 int BPredicate_Init (BPredicate *p, char *str)
@@ -204,11 +404,18 @@ int BPredicate_Init (BPredicate *p, char *str)
         return 0;
     }
     
-    // init tree
-    p->root = root;
+    // compile tree
+    struct program *prog = compile(root);
+    free_predicate_node(root);
+    if (!prog) {
+        BLog(BLOG_ERROR, "failed to allocate program");
+        return 0;
+    }
+    p->prog = prog;
     
     // init functions tree
     BAVL_Init(&p->functions_tree, OFFSET_DIFF(BPredicateFunction, name, tree_node), (BAVL_comparator)string_comparator, NULL);
+    p->functions_gen = 1;
     
     // init debuggind
     #ifndef NDEBUG
@@ -229,19 +436,84 @@ void BPredicate_Free (BPredicate *p)
     // free debug object
     DebugObject_Free(&p->d_obj);
     
-    // free tree
-    free_predicate_node((struct predicate_node *)p->root);
+    // free program
+    free_program((struct program *)p->prog);
 }
 
 int BPredicate_Eval (BPredicate *p)
 {
     ASSERT(!p->in_function)
     
-    if (!eval_predicate_node(p, (struct predicate_node *)p->root)) {
-        return -1;
+    struct program *prog = (struct program *)p->prog;
+    int *stack = prog->stack;
+    int sp = 0;
+    int pc = 0;
+    
+    while (pc < prog->num_instructions) {
+        struct instruction *in = &prog->instructions[pc++];
+        
+        switch (in->op) {
+            case OP_CONSTANT:
+                stack[sp++] = in->arg;
+                break;
+            case OP_NEG:
+                stack[sp - 1] = !stack[sp - 1];
+                break;
+            case OP_AND:
+                if (!stack[sp - 1]) {
+                    pc = in->arg;
+                } else {
+                    sp--;
+                }
+                break;
+            case OP_OR:
+                if (stack[sp - 1]) {
+                    pc = in->arg;
+                } else {
+                    sp--;
+                }
+                break;
+            case OP_RESOLVE:
+                if (!resolve_site(p, &prog->sites[in->arg])) {
+                    return -1;
+                }
+                break;
+            case OP_CALL: {
+                struct call_site *site = &prog->sites[in->arg];
+                ASSERT(site->func)
+                ASSERT(site->resolved_gen == p->functions_gen)
+                
+                // collect arguments
+                sp -= site->num_bool_args;
+                int *bool_arg = stack + sp;
+                void *args[PREDICATE_MAX_ARGS];
+                for (int i = 0; i < site->num_args; i++) {
+                    args[i] = (site->arg_types[i] == PREDICATE_TYPE_BOOL ? (void *)bool_arg++ : site->args[i]);
+                }
+                
+                // call callback
+                #ifndef NDEBUG
+                p->in_function = 1;
+                #endif
+                int res = site->func->callback(site->func->user, args);
+                #ifndef NDEBUG
+                p->in_function = 0;
+                #endif
+                if (res != 0 && res != 1) {
+                    BLog(BLOG_WARNING, "callback returned non-boolean");
+                    return -1;
+                }
+                
+                stack[sp++] = res;
+            } break;
+            default:
+                ASSERT(0);
+        }
     }
     
-    return ((struct predicate_node *)p->root)->eval_value;
+    ASSERT(sp == 1)
+    
+    return stack[0];
 }
 
 void BPredicateFunction_Init (BPredicateFunction *o, BPredicate *p, char *name, int *args, int num_args, BPredicate_callback callback, void *user)
@@ -266,6 +538,9 @@ void BPredicateFunction_Init (BPredicateFunction *o, BPredicate *p, char *name,
     // add to tree
     ASSERT_EXECUTE(BAVL_Insert(&p->functions_tree, &o->tree_node, NULL))
     
+    // call sites need to look up functions again
+    p->functions_gen++;
+    
     // init debug object
     DebugObject_Init(&o->d_obj);
 }
@@ -281,4 +556,7 @@ void BPredicateFunction_Free (BPredicateFunction *o)
     
     // remove from tree
     BAVL_Remove(&p->functions_tree, &o->tree_node);
+    
+    // call sites need to look up functions again
+    p->functions_gen++;
 }
@@ -62,16 +62,17 @@
  *     Arguments are evaluated from left to right. Each argument can either
  *     be a logical expression or a string (characters enclosed in double
  *     quotes, without any double quote).
- *     If an argument is encountered, but all needed arguments have already
- *     been evaluated, the function evaluates to error.
- *     If an argument is of wrong type, it is not evaluated and the function
+ *     If the function does not take as many arguments as given, or an
+ *     argument is of wrong type, no argument is evaluated and the function
  *     evaluates to error.
  *     If an argument evaluates to error, the function evaluates to error.
- *     If after all arguments have been evaluated, the function needs more
- *     arguments, it evaluates to error.
  *     Then the handler function is called. If it returns anything other
  *     than 1 and 0, the function evaluates to error. Otherwise it evaluates
- *     to what the handler function returned.
+ *     to what the handler function returned. * 
+ * The expression is compiled once, with constant sub-expressions folded,
+ * into a flat program which is evaluated without recursion. Functions are
+ * looked up by name when first called after functions were registered or
+ * removed.
  */
 
 #ifndef BADVPN_PREDICATE_BPREDICATE_H
@@ -105,8 +106,9 @@ typedef int (*BPredicate_callback) (void *user, void **args);
  */
 typedef struct {
     DebugObject d_obj;
-    void *root;
+    void *prog;
     BAVL functions_tree;
+    unsigned int functions_gen;
     #ifndef NDEBUG
     int in_function;
     #endif
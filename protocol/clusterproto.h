@@ -0,0 +1,258 @@
+/**
+ * @file clusterproto.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Definitions for ClusterProto, the protocol that servers of a cluster use
+ * to communicate with each other. It runs over a TCP connection, wrapped in
+ * PacketProto.
+ * 
+ * All multi-byte integers in structs are little-endian, unless stated otherwise.
+ * 
+ * A ClusterProto packet consists of:
+ *   - a header (struct {@link cl_header}) which contains the type of the
+ *     packet
+ *   - the payload
+ * 
+ * Each server of a cluster has a node ID, and assigns peer IDs to its clients
+ * from its own range of the ID space, determined by the node ID and the number
+ * of nodes. When two servers connect, each sends a "hello" packet, followed by
+ * a "newclient" packet for each of its clients that have completed the
+ * handshake. Afterwards, a server sends "newclient" and "endclient" packets as
+ * its clients come and go. A server represents the clients of the other
+ * servers with local proxies, which take part in peer synchronization exactly
+ * as if they were connected locally.
+ * 
+ * For a pair of clients connected to different servers, the server of the
+ * client with the lower ID synchronizes the pair and forwards the messages.
+ * The other server does nothing with the pair other than passing packets
+ * between its client and the synchronizing server:
+ *   - "toclient" packets contain SCProto packets for the synchronizing server
+ *     to the client, which its server passes to the client unchanged.
+ *   - "fromclient" packets contain SCProto packets from the client
+ *     concerning the pair ("outmsg", "resetpeer" and "acceptpeer"), which its
+ *     server passes to the synchronizing server unchanged.
+ * 
+ * If a server runs out of buffer for messages to its client, it sends a
+ * "resetpair" packet to have the synchronizing server reset the pair. If
+ * a server finds a client of another server misbehaving, it sends a "kick"
+ * packet to have its server remove the client.
+ */
+
+#ifndef BADVPN_PROTOCOL_CLUSTERPROTO_H
+#define BADVPN_PROTOCOL_CLUSTERPROTO_H
+
+#include <stdint.h>
+
+#include <misc/packed.h>
+#include <protocol/scproto.h>
+
+#define CL_VERSION 1
+
+#define CL_KEEPALIVE_INTERVAL 10000
+
+/**
+ * ClusterProto packet header.
+ * Follows up to CL_MAX_PAYLOAD bytes of payload.
+ */
+B_START_PACKED
+struct cl_header {
+    /**
+     * Message type.
+     */
+    uint8_t type;
+} B_PACKED;
+B_END_PACKED
+
+#define CL_MAX_PAYLOAD 4608
+#define CL_MAX_ENC (sizeof(struct cl_header) + CL_MAX_PAYLOAD)
+
+#define CLID_KEEPALIVE 0
+#define CLID_HELLO 1
+#define CLID_NEWCLIENT 2
+#define CLID_ENDCLIENT 3
+#define CLID_TOCLIENT 4
+#define CLID_FROMCLIENT 5
+#define CLID_RESETPAIR 6
+#define CLID_KICK 7
+
+/**
+ * "hello" packet payload.
+ * Packet type is CLID_HELLO.
+ */
+B_START_PACKED
+struct cl_hello {
+    /**
+     * Protocol version the server is using.
+     */
+    uint16_t version;
+    
+    /**
+     * Node ID of the server.
+     */
+    uint16_t node_id;
+    
+    /**
+     * Number of nodes in the cluster, as configured on the server.
+     */
+    uint16_t num_nodes;
+} B_PACKED;
+B_END_PACKED
+
+#define CL_ADDR_TYPE_NONE 0
+#define CL_ADDR_TYPE_IPV4 1
+#define CL_ADDR_TYPE_IPV6 2
+
+/**
+ * "newclient" packet header.
+ * Packet type is CLID_NEWCLIENT.
+ * Follows the common name of the client (without a null terminator), then
+ * the certificate of the client, then the certificate in the encoding
+ * for old clients, with the lengths given in the header.
+ */
+B_START_PACKED
+struct cl_newclient {
+    /**
+     * ID of the client.
+     */
+    peerid_t id;
+    
+    /**
+     * SCProto version the client is using.
+     */
+    uint16_t version;
+    
+    /**
+     * Type of the address of the client, one of CL_ADDR_TYPE_*.
+     */
+    uint8_t addr_type;
+    
+    /**
+     * IP address of the client (network byte order), padded with zeros.
+     */
+    uint8_t addr_ip[16];
+    
+    /**
+     * Port of the client (network byte order).
+     */
+    uint16_t addr_port;
+    
+    /**
+     * Length of the common name, zero if the client has none.
+     */
+    uint16_t name_len;
+    
+    /**
+     * Length of the certificate, at most SCID_NEWCLIENT_MAX_CERT_LEN.
+     */
+    uint16_t cert_len;
+    
+    /**
+     * Length of the certificate for old clients, at most
+     * SCID_NEWCLIENT_MAX_CERT_LEN.
+     */
+    uint16_t cert_old_len;
+} B_PACKED;
+B_END_PACKED
+
+#define CLID_NEWCLIENT_MAX_NAME_LEN (CL_MAX_PAYLOAD - sizeof(struct cl_newclient) - 2 * SCID_NEWCLIENT_MAX_CERT_LEN)
+
+/**
+ * "endclient" packet payload.
+ * Packet type is CLID_ENDCLIENT.
+ */
+B_START_PACKED
+struct cl_endclient {
+    /**
+     * ID of the removed client.
+     */
+    peerid_t id;
+} B_PACKED;
+B_END_PACKED
+
+/**
+ * "toclient" packet header.
+ * Packet type is CLID_TOCLIENT.
+ * Follows an SCProto packet for the client, up to SC_MAX_ENC bytes.
+ */
+B_START_PACKED
+struct cl_toclient {
+    /**
+     * ID of the client, which is connected to the receiving server.
+     */
+    peerid_t id;
+} B_PACKED;
+B_END_PACKED
+
+/**
+ * "fromclient" packet header.
+ * Packet type is CLID_FROMCLIENT.
+ * Follows an SCProto packet from the client, up to SC_MAX_ENC bytes.
+ */
+B_START_PACKED
+struct cl_fromclient {
+    /**
+     * ID of the client, which is connected to the sending server.
+     */
+    peerid_t id;
+} B_PACKED;
+B_END_PACKED
+
+/**
+ * "resetpair" packet payload.
+ * Packet type is CLID_RESETPAIR.
+ */
+B_START_PACKED
+struct cl_resetpair {
+    /**
+     * ID of the client whose messages could not be delivered.
+     */
+    peerid_t src_id;
+    
+    /**
+     * ID of the client the messages were for. One of the two clients is
+     * connected to the sending server.
+     */
+    peerid_t dest_id;
+} B_PACKED;
+B_END_PACKED
+
+/**
+ * "kick" packet payload.
+ * Packet type is CLID_KICK.
+ */
+B_START_PACKED
+struct cl_kick {
+    /**
+     * ID of the client to remove, which is connected to the receiving server.
+     */
+    peerid_t id;
+} B_PACKED;
+B_END_PACKED
+
+#endif
@@ -36,6 +36,15 @@
  *   - the header (struct {@link dataproto_header})
  *   - between zero and DATAPROTO_MAX_PEER_IDS destination peer IDs (struct {@link dataproto_peer_id})
  *   - the payload, e.g. Ethernet frame
+ * 
+ * A packet with no destination peer IDs is a keep-alive. Its payload is either
+ * empty or a struct {@link dataproto_keepalive}, which peers use to measure the
+ * round-trip time and loss of the link. Peers ignore anything else in it.
+ * 
+ * A compact packet, identified by DATAPROTO_FLAGS_COMPACT, has only the flags
+ * byte of the header, followed by the payload. It stands for a packet from the
+ * peer at the other end of the link, with the receiving peer as the only
+ * destination.
  */
 
 #ifndef BADVPN_PROTOCOL_DATAPROTO_H
@@ -46,9 +55,18 @@
 #include <protocol/scproto.h>
 #include <misc/packed.h>
 
-#define DATAPROTO_MAX_PEER_IDS 1
+#define DATAPROTO_MAX_PEER_IDS 8
 
 #define DATAPROTO_FLAGS_RECEIVING_KEEPALIVES 1
+#define DATAPROTO_FLAGS_COMPRESSED 2
+#define DATAPROTO_FLAGS_ACCEPTS_COMPRESSED 4
+#define DATAPROTO_FLAGS_COMPACT 8
+#define DATAPROTO_FLAGS_ACCEPTS_COMPACT 16
+
+/**
+ * Length of the header of a compact packet, just the flags.
+ */
+#define DATAPROTO_COMPACT_HEADER_LEN 1
 
 /**
  * DataProto header.
@@ -60,6 +78,17 @@ struct dataproto_header {
      *   - DATAPROTO_FLAGS_RECEIVING_KEEPALIVES
      *     Indicates that when the peer sent this packet, it has received at least
      *     one packet from the other peer in the last keep-alive tolerance time.
+     *   - DATAPROTO_FLAGS_COMPRESSED
+     *     Indicates that the payload following the destination peer IDs is
+     *     compressed as a block in the LZ4 block format.
+     *   - DATAPROTO_FLAGS_ACCEPTS_COMPRESSED
+     *     Indicates that the sender can decompress payloads, so the other peer
+     *     may send it packets with DATAPROTO_FLAGS_COMPRESSED.
+     *   - DATAPROTO_FLAGS_COMPACT
+     *     Indicates a compact packet, where the rest of the header is left out.
+     *   - DATAPROTO_FLAGS_ACCEPTS_COMPACT
+     *     Indicates that the sender understands compact packets, so the other
+     *     peer may send it packets with DATAPROTO_FLAGS_COMPACT.
      */
     uint8_t flags;
     
@@ -71,6 +100,9 @@ struct dataproto_header {
     /**
      * Number of destination peer IDs that follow.
      * Must be <=DATAPROTO_MAX_PEER_IDS.
+     * More than one destination is only used for frames sent to a relay,
+     * which delivers the frame to all the destinations, including itself
+     * if it is one of them.
      */
     peerid_t num_peer_ids;
 } B_PACKED;
@@ -86,6 +118,54 @@ struct dataproto_peer_id {
 } B_PACKED;
 B_END_PACKED
 
+/**
+ * Payload of keep-alive packets.
+ * 
+ * The round-trip time is measured by echoing the timestamp of the last keep-alive
+ * received from the other peer, along with how long ago it was received. The loss
+ * of keep-alives sent is measured from how many of them the other peer reports to
+ * have received.
+ * Times are in milliseconds of the sender's clock, which can have any origin.
+ */
+B_START_PACKED
+struct dataproto_keepalive {
+    /**
+     * Sequence number of this keep-alive; the first one sent over a link is 1.
+     */
+    uint32_t seq;
+    
+    /**
+     * Sender's time when sending this keep-alive.
+     */
+    uint32_t time;
+    
+    /**
+     * Sequence number of the last keep-alive received from the other peer.
+     * Undefined if echo_delay is DATAPROTO_KEEPALIVE_NO_ECHO.
+     */
+    uint32_t echo_seq;
+    
+    /**
+     * Time field of the last keep-alive received from the other peer.
+     * Undefined if echo_delay is DATAPROTO_KEEPALIVE_NO_ECHO.
+     */
+    uint32_t echo_time;
+    
+    /**
+     * Time from receiving the last keep-alive from the other peer until
+     * sending this one, or DATAPROTO_KEEPALIVE_NO_ECHO if none was received.
+     */
+    uint32_t echo_delay;
+    
+    /**
+     * Number of keep-alives received from the other peer.
+     */
+    uint32_t recv_count;
+} B_PACKED;
+B_END_PACKED
+
+#define DATAPROTO_KEEPALIVE_NO_ECHO UINT32_C(0xFFFFFFFF)
+
 #define DATAPROTO_MAX_OVERHEAD (sizeof(struct dataproto_header) + DATAPROTO_MAX_PEER_IDS * sizeof(struct dataproto_peer_id))
 
 #endif
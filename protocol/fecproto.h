@@ -0,0 +1,94 @@
+/**
+ * @file fecproto.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * 
+ * @section DESCRIPTION
+ * 
+ * Definitions for FECProto, a forward error correction protocol which allows
+ * recovering a lost packet from a group of packets without retransmission.
+ * 
+ * All multi-byte integers in structs are little-endian, unless stated otherwise.
+ * 
+ * Packets are sent in groups. Each packet of a group is sent as the header
+ * (struct {@link fecproto_header}) followed by the packet. After the packets of a group,
+ * a parity packet is sent, which is the header followed by the XOR of all the group's
+ * packets, each padded with zeros to the length of the longest one. If a single packet
+ * of a group is lost, the receiver recovers it from the parity packet and the other
+ * packets. A group is closed early if no packets come for some time, so that the
+ * parity packet covers the end of a burst too.
+ */
+
+#ifndef BADVPN_PROTOCOL_FECPROTO_H
+#define BADVPN_PROTOCOL_FECPROTO_H
+
+#include <stdint.h>
+
+#include <misc/packed.h>
+
+/**
+ * FECProto header.
+ */
+B_START_PACKED
+struct fecproto_header {
+    /**
+     * Identifier of the group this packet belongs to.
+     * Groups are given ascending identifiers (except when the ID wraps to zero).
+     */
+    uint16_t group_id;
+    
+    /**
+     * Position of the packet in the group, starting with zero,
+     * or {@link FECPROTO_INDEX_PARITY} for the parity packet.
+     */
+    uint8_t index;
+    
+    /**
+     * For the parity packet, the number of packets in the group.
+     * Zero otherwise.
+     */
+    uint8_t count;
+    
+    /**
+     * For the parity packet, the XOR of the lengths of the group's packets.
+     * Zero otherwise.
+     */
+    uint16_t len_xor;
+} B_PACKED;
+B_END_PACKED
+
+/**
+ * Value of index for the parity packet.
+ */
+#define FECPROTO_INDEX_PARITY 255
+
+/**
+ * Maximum number of packets in a group.
+ */
+#define FECPROTO_MAX_GROUP_SIZE 32
+
+#endif
@@ -37,14 +37,34 @@
  * Each chunk consists of:
  *   - the chunk header (struct {@link fragmentproto_chunk_header})
  *   - the chunk payload, i.e. part of the frame specified in the header
+ * 
+ * Besides frame data, a packet can carry path MTU probes and their acknowledgements,
+ * identified by special values of the is_last field. A probe chunk
+ * ({@link FRAGMENTPROTO_IS_LAST_PROBE}) has the probe identifier in frame_id, and
+ * padding as its payload, which is ignored. The receiver answers with an acknowledgement
+ * chunk ({@link FRAGMENTPROTO_IS_LAST_PROBE_ACK}) with the same frame_id, chunk_start
+ * set to the length of the FragmentProto packet which carried the probe, and no payload.
+ * 
+ * Both ends of a link may instead agree to use compact chunk headers. These are made
+ * of varints, which carry 7 bits of the value per byte, least significant first, with
+ * the high bit set in all but the last byte. A varint is at most three bytes long, but
+ * may be longer than its value needs. A compact chunk header consists of:
+ *   - a varint of chunk_len * 2 + whole,
+ *   - if whole is 0, a varint of chunk_start * 4 + is_last, followed by frame_id
+ *     (2 bytes).
+ * A whole chunk carries an entire frame, i.e. has chunk_start 0 and is_last 1, and no
+ * frame_id.
  */
 
 #ifndef BADVPN_PROTOCOL_FRAGMENTPROTO_H
 #define BADVPN_PROTOCOL_FRAGMENTPROTO_H
 
 #include <stdint.h>
+#include <string.h>
 
 #include <misc/balign.h>
+#include <misc/byteorder.h>
+#include <misc/debug.h>
 #include <misc/packed.h>
 
 typedef uint16_t fragmentproto_frameid;
@@ -74,11 +94,38 @@ struct fragmentproto_chunk_header {
     /**
      * Whether this is the last chunk of the frame, i.e.
      * the total length of the frame is chunk_start + chunk_len.
+     * Can also be {@link FRAGMENTPROTO_IS_LAST_PROBE} or
+     * {@link FRAGMENTPROTO_IS_LAST_PROBE_ACK}.
      */
     uint8_t is_last;
 } B_PACKED;
 B_END_PACKED
 
+/**
+ * Value of is_last for a path MTU probe chunk.
+ */
+#define FRAGMENTPROTO_IS_LAST_PROBE 2
+
+/**
+ * Value of is_last for a path MTU probe acknowledgement chunk.
+ */
+#define FRAGMENTPROTO_IS_LAST_PROBE_ACK 3
+
+/**
+ * Maximum length of a varint in a compact chunk header.
+ */
+#define FRAGMENTPROTO_COMPACT_MAX_VARINT_LEN 3
+
+/**
+ * Maximum length of a compact chunk header.
+ */
+#define FRAGMENTPROTO_COMPACT_MAX_HEADER_LEN (2 * FRAGMENTPROTO_COMPACT_MAX_VARINT_LEN + sizeof(fragmentproto_frameid))
+
+/**
+ * Maximum length of a chunk header, with or without compact headers.
+ */
+#define FRAGMENTPROTO_MAX_HEADER_LEN(_compact) ((_compact) ? FRAGMENTPROTO_COMPACT_MAX_HEADER_LEN : sizeof(struct fragmentproto_chunk_header))
+
 /**
  * Calculates how many chunks are needed at most for encoding one frame of the
  * given maximum size with FragmentProto onto a carrier with a given MTU.
@@ -97,4 +144,146 @@ static int fragmentproto_max_chunks_for_frame (int carrier_mtu, int frame_mtu)
     return (bdivide_up(frame_mtu, (carrier_mtu - sizeof(struct fragmentproto_chunk_header))) + 1);
 }
 
+static int fragmentproto_write_varint (uint8_t *out, uint32_t v, int pad)
+{
+    ASSERT(v < ((uint32_t)1 << (7 * FRAGMENTPROTO_COMPACT_MAX_VARINT_LEN)))
+    
+    int len = 0;
+    while (v >= 0x80 || (pad && len < FRAGMENTPROTO_COMPACT_MAX_VARINT_LEN - 1)) {
+        out[len++] = 0x80 | (v & 0x7F);
+        v >>= 7;
+    }
+    out[len++] = v;
+    
+    return len;
+}
+
+static int fragmentproto_read_varint (const uint8_t *in, int in_len, uint32_t *out_v)
+{
+    uint32_t v = 0;
+    
+    for (int i = 0; i < in_len && i < FRAGMENTPROTO_COMPACT_MAX_VARINT_LEN; i++) {
+        v |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            *out_v = v;
+            return i + 1;
+        }
+    }
+    
+    return -1;
+}
+
+/**
+ * Writes a chunk header.
+ * 
+ * @param compact whether to write a compact header
+ * @param out where to write the header. Must have room for
+ *            FRAGMENTPROTO_MAX_HEADER_LEN(compact) bytes.
+ * @param frame_id frame identifier
+ * @param chunk_start position in the frame where the chunk starts. Must be >=0 and <=UINT16_MAX.
+ * @param chunk_len length of the chunk's payload. Must be >=0 and <=UINT16_MAX.
+ * @param is_last value of is_last. Must be 0, 1, {@link FRAGMENTPROTO_IS_LAST_PROBE} or
+ *                {@link FRAGMENTPROTO_IS_LAST_PROBE_ACK}.
+ * @param pad whether to make the header FRAGMENTPROTO_MAX_HEADER_LEN(compact) bytes
+ *            long, rather than as short as possible
+ * @return length of the header
+ */
+static int fragmentproto_write_header (int compact, uint8_t *out, fragmentproto_frameid frame_id, int chunk_start, int chunk_len, int is_last, int pad)
+{
+    ASSERT(chunk_start >= 0)
+    ASSERT(chunk_start <= UINT16_MAX)
+    ASSERT(chunk_len >= 0)
+    ASSERT(chunk_len <= UINT16_MAX)
+    ASSERT(is_last >= 0 && is_last <= FRAGMENTPROTO_IS_LAST_PROBE_ACK)
+    
+    if (!compact) {
+        struct fragmentproto_chunk_header header;
+        header.frame_id = htol16(frame_id);
+        header.chunk_start = htol16(chunk_start);
+        header.chunk_len = htol16(chunk_len);
+        header.is_last = is_last;
+        memcpy(out, &header, sizeof(header));
+        return sizeof(header);
+    }
+    
+    int whole = (!pad && chunk_start == 0 && is_last == 1);
+    
+    int len = fragmentproto_write_varint(out, (uint32_t)chunk_len * 2 + whole, pad);
+    if (!whole) {
+        len += fragmentproto_write_varint(out + len, (uint32_t)chunk_start * 4 + is_last, pad);
+        fragmentproto_frameid id = htol16(frame_id);
+        memcpy(out + len, &id, sizeof(id));
+        len += sizeof(id);
+    }
+    
+    return len;
+}
+
+/**
+ * Reads a chunk header.
+ * 
+ * @param compact whether to read a compact header
+ * @param in data starting with the header
+ * @param in_len length of data. Must be >=0.
+ * @param out_frame_id frame identifier is returned here. Whole chunks leave it unchanged.
+ * @param out_chunk_start position of the chunk is returned here
+ * @param out_chunk_len length of the chunk's payload is returned here
+ * @param out_is_last value of is_last is returned here. It is not checked.
+ * @param out_whole whether the header is a compact header of a whole chunk, which
+ *                  has no frame_id, is returned here
+ * @return length of the header, or -1 if the data is too short or the header is bad
+ */
+static int fragmentproto_read_header (int compact, const uint8_t *in, int in_len, fragmentproto_frameid *out_frame_id, int *out_chunk_start, int *out_chunk_len, int *out_is_last, int *out_whole)
+{
+    ASSERT(in_len >= 0)
+    
+    if (!compact) {
+        if (in_len < sizeof(struct fragmentproto_chunk_header)) {
+            return -1;
+        }
+        struct fragmentproto_chunk_header header;
+        memcpy(&header, in, sizeof(header));
+        *out_frame_id = ltoh16(header.frame_id);
+        *out_chunk_start = ltoh16(header.chunk_start);
+        *out_chunk_len = ltoh16(header.chunk_len);
+        *out_is_last = ltoh8(header.is_last);
+        *out_whole = 0;
+        return sizeof(header);
+    }
+    
+    uint32_t a;
+    int len = fragmentproto_read_varint(in, in_len, &a);
+    if (len < 0 || (a >> 1) > UINT16_MAX) {
+        return -1;
+    }
+    *out_chunk_len = a >> 1;
+    
+    if ((a & 1)) {
+        *out_chunk_start = 0;
+        *out_is_last = 1;
+        *out_whole = 1;
+        return len;
+    }
+    
+    uint32_t b;
+    int b_len = fragmentproto_read_varint(in + len, in_len - len, &b);
+    if (b_len < 0 || (b >> 2) > UINT16_MAX) {
+        return -1;
+    }
+    len += b_len;
+    *out_chunk_start = b >> 2;
+    *out_is_last = b & 3;
+    
+    fragmentproto_frameid id;
+    if (in_len - len < sizeof(id)) {
+        return -1;
+    }
+    memcpy(&id, in + len, sizeof(id));
+    *out_frame_id = ltoh16(id);
+    len += sizeof(id);
+    
+    *out_whole = 0;
+    return len;
+}
+
 #endif
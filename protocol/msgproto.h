@@ -57,6 +57,21 @@
  * slave runs out of bind addresses, it not only sends "cannotbind" to the master, but
  * registers relaying to the master. And in this case, when the master receives the "cannotbind",
  * it doesn't start the binding procedure all all over, but registers relaying to the slave.
+ * 
+ * In UDP mode, the peer which connected then sends a "punch" message. It lists the
+ * addresses its socket may be reachable at, in the same form as in "youconnect", but
+ * with the port of the socket. The binding peer picks the first one whose scope it
+ * recognizes and starts sending to it before it has heard from the peer, so that
+ * a NAT in front of it lets the peer's datagrams through.
+ * 
+ * If links are set up on demand, the link is only set up when either peer has something
+ * to send. If the master needs it, it starts the binding procedure; the slave sends
+ * "youretry". When a peer sees the link idle, it frees it and sends "linkidle", which
+ * makes the other peer free its side too.
+ * 
+ * In TUN mode, each peer also sends the other a "routes" message when they get to know
+ * about each other. It lists the networks reachable through the sender, which the
+ * receiver uses to decide which peer IP packets should be sent to.
  */
 
 #ifndef BADVPN_PROTOCOL_MSGPROTO_H
@@ -70,6 +85,9 @@
 #define MSGID_YOURETRY 5
 #define MSGID_SEED 6
 #define MSGID_CONFIRMSEED 7
+#define MSGID_ROUTES 8
+#define MSGID_PUNCH 9
+#define MSGID_LINKIDLE 10
 
 #define MSG_MAX_PAYLOAD (SC_MAX_MSGLEN - msg_SIZEtype - msg_SIZEpayload(0))
 
@@ -39,6 +39,8 @@
 #define REQUESTPROTO_TYPE_SERVER_REPLY 3
 #define REQUESTPROTO_TYPE_SERVER_FINISHED 4
 #define REQUESTPROTO_TYPE_SERVER_ERROR 5
+#define REQUESTPROTO_TYPE_CLIENT_REQUEST_BINARY 6
+#define REQUESTPROTO_TYPE_SERVER_REPLY_BINARY 7
 
 B_START_PACKED
 struct requestproto_header {
@@ -88,7 +88,9 @@
 
 #include <misc/packed.h>
 
-#define SC_VERSION 29
+#define SC_VERSION 31
+#define SC_OLDVERSION_NOCERTHASH 30
+#define SC_OLDVERSION_NOBATCH 29
 #define SC_OLDVERSION_NOSSL 27
 #define SC_OLDVERSION_BROKENCERT 26
 
@@ -121,6 +123,9 @@ typedef uint16_t peerid_t;
 #define SCID_INMSG 6
 #define SCID_RESETPEER 7
 #define SCID_ACCEPTPEER 8
+#define SCID_ENDCLIENTS 9
+#define SCID_GETCERT 10
+#define SCID_CERT 11
 
 /**
  * "clienthello" client packet payload.
@@ -163,7 +168,9 @@ B_END_PACKED
  * "newclient" server packet payload.
  * Packet type is SCID_NEWCLIENT.
  * If the server is using TLS, follows up to SCID_NEWCLIENT_MAX_CERT_LEN
- * bytes of the new client's certificate (encoded in DER).
+ * bytes of the new client's certificate (encoded in DER), or, if the
+ * SCID_NEWCLIENT_FLAG_CERT_HASH flag is set, SC_CERT_HASH_LEN bytes of
+ * its SHA-256 hash.
  */
 B_START_PACKED
 struct sc_server_newclient {
@@ -180,6 +187,11 @@ struct sc_server_newclient {
      *     You must allow this peer to relay frames to other peers through you.
      *   - SCID_NEWCLIENT_FLAG_SSL
      *     SSL must be used to talk to this peer through messages.
+     *   - SCID_NEWCLIENT_FLAG_CERT_HASH
+     *     The hash of the certificate follows instead of the certificate.
+     *     A client which does not have a certificate with this hash asks
+     *     for it with a "getcert" packet. The server only sets this flag
+     *     for clients with a version newer than SC_OLDVERSION_NOCERTHASH.
      */
     uint16_t flags;
 } B_PACKED;
@@ -188,9 +200,46 @@ B_END_PACKED
 #define SCID_NEWCLIENT_FLAG_RELAY_SERVER 1
 #define SCID_NEWCLIENT_FLAG_RELAY_CLIENT 2
 #define SCID_NEWCLIENT_FLAG_SSL 4
+#define SCID_NEWCLIENT_FLAG_CERT_HASH 8
 
 #define SCID_NEWCLIENT_MAX_CERT_LEN (SC_MAX_PAYLOAD - sizeof(struct sc_server_newclient))
 
+#define SC_CERT_HASH_LEN 32
+
+/**
+ * "getcert" client packet payload.
+ * Packet type is SCID_GETCERT.
+ * Asks for the certificate of a peer which was reported with the
+ * SCID_NEWCLIENT_FLAG_CERT_HASH flag. The server ignores the request
+ * if it no longer knows the peer; in that case it has already sent
+ * an "endclient" for it.
+ */
+B_START_PACKED
+struct sc_client_getcert {
+    /**
+     * ID of the peer.
+     */
+    peerid_t clientid;
+} B_PACKED;
+B_END_PACKED
+
+/**
+ * "cert" server packet payload.
+ * Packet type is SCID_CERT.
+ * Follows up to SCID_NEWCLIENT_MAX_CERT_LEN bytes of the certificate of the
+ * peer (encoded in DER), in reply to a "getcert". The peer may meanwhile
+ * have been replaced by a different one with the same ID; the client can
+ * tell by the hash.
+ */
+B_START_PACKED
+struct sc_server_cert {
+    /**
+     * ID of the peer.
+     */
+    peerid_t id;
+} B_PACKED;
+B_END_PACKED
+
 /**
  * "endclient" server packet payload.
  * Packet type is SCID_ENDCLIENT.
@@ -204,6 +253,16 @@ struct sc_server_endclient {
 } B_PACKED;
 B_END_PACKED
 
+/**
+ * "endclients" server packet payload.
+ * Packet type is SCID_ENDCLIENTS.
+ * The payload is a sequence of one or more {@link sc_server_endclient}
+ * structures, one for each removed peer. The server only sends this to clients
+ * with a version newer than SC_OLDVERSION_NOBATCH, instead of a separate
+ * "endclient" packet for each of the peers.
+ */
+#define SCID_ENDCLIENTS_MAX_IDS (SC_MAX_PAYLOAD / sizeof(struct sc_server_endclient))
+
 /**
  * "outmsg" client packet header.
  * Packet type is SCID_OUTMSG.
@@ -36,7 +36,9 @@
  *     being transmitted.
  *   - Hashes. Adds a hash of the packet into the packet.
  *     Combined with encryption, protects against tampering
- *     with packets and crafting new packets.
+ *     with packets and crafting new packets. Keyed hashes (MACs)
+ *     require encryption, and their key is derived from the
+ *     encryption key, see {@link spproto_hash_key}.
  *   - One-time passwords. Adds a password to each packet
  *     for the receiver to recognize. Protects agains replaying
  *     packets and crafting new packets.
@@ -46,18 +48,51 @@
  *     the seed ID and the OTP,
  *   - if hashes are used, the hash,
  *   - payload data.
+ * The hash is calculated over the whole plaintext packet, with the hash
+ * field set to zero.
  * 
  * If encryption is used:
  *   - the plaintext is padded by appending a 0x01 byte and as many 0x00
  *     bytes as needed to align to block size,
  *   - the padded plaintext is encrypted, and
  *   - the initialization vector (IV) is prepended.
+ * 
+ * If an AEAD encryption mode is used, the hash and padding are not needed:
+ *   - the plaintext is encrypted and authenticated in a single pass,
+ *   - the nonce is prepended, and
+ *   - the authentication tag is appended.
+ * Hashes should be disabled in this case, as the tag already covers
+ * the whole plaintext.
+ * 
+ * With encryption, each packet carries a sequence number, counting packets
+ * sent under the current key. It is stored little-endian in the last
+ * SPPROTO_SEQ_LEN bytes of the AEAD nonce, or of the CBC IV block before that
+ * block is encrypted with the key to form the IV. The remaining leading bytes,
+ * if the nonce or block has any (none with 64-bit block ciphers), are a random
+ * prefix chosen when the key is set. The sequence starts at a random number
+ * below 2^62, chosen when the key is set. If a replay window is configured,
+ * the receiver uses the sequence numbers to drop replayed packets.
+ * 
+ * With an AEAD encryption mode and a replay window, both ends may agree on
+ * compact nonces. Only the prefix and the low SPPROTO_COMPACT_SEQ_LEN bytes of
+ * the sequence number are then sent, and the receiver takes the remaining bytes
+ * from the sequence number nearest to the highest one it has accepted. The
+ * sequence then starts at zero.
+ * 
+ * A nonce or IV block must never repeat under a key, so each key must be
+ * generated randomly when it is set, and not be set again by the same sender.
+ * Both ends of a link send with the same key; their blocks are told apart only
+ * by the random prefixes and starting sequence numbers. A collision needs the
+ * prefixes to be equal and two random 62-bit starting points to fall within
+ * the number of packets sent. With compact nonces only the 32-bit prefix is
+ * random, so a collision between the two ends has a chance of 2^-32 per key.
  */
 
 #ifndef BADVPN_PROTOCOL_SPPROTO_H
 #define BADVPN_PROTOCOL_SPPROTO_H
 
 #include <stdint.h>
+#include <string.h>
 #include <limits.h>
 
 #include <misc/debug.h>
@@ -65,12 +100,20 @@
 #include <misc/packed.h>
 #include <security/BHash.h>
 #include <security/BEncryption.h>
+#include <security/BAEAD.h>
 #include <security/OTPCalculator.h>
 
 #define SPPROTO_HASH_MODE_NONE 0
 #define SPPROTO_ENCRYPTION_MODE_NONE 0
 #define SPPROTO_OTP_MODE_NONE 0
 
+#define SPPROTO_SEQ_LEN 8
+#define SPPROTO_COMPACT_SEQ_LEN 4
+#define SPPROTO_SEQ_START_MASK (((uint64_t)1 << 62) - 1)
+#define SPPROTO_MAX_REPLAY_WINDOW 4096
+
+#define SPPROTO_ENCRYPTION_MAX_KEY_SIZE (BAEAD_MAX_KEY_SIZE > BENCRYPTION_MAX_KEY_SIZE ? BAEAD_MAX_KEY_SIZE : BENCRYPTION_MAX_KEY_SIZE)
+
 /**
  * Stores security parameters for SPProto.
  */
@@ -84,8 +127,8 @@ struct spproto_security_params {
     
     /**
      * Encryption mode.
-     * Either SPPROTO_ENCRYPTION_MODE_NONE for no encryption, or a valid
-     * {@link BEncryption} cipher.
+     * Either SPPROTO_ENCRYPTION_MODE_NONE for no encryption, a valid
+     * {@link BEncryption} cipher, or a valid {@link BAEAD} cipher.
      */
     int encryption_mode;
     
@@ -101,6 +144,20 @@ struct spproto_security_params {
      * OTPs generated from a single seed.
      */
     int otp_num;
+    
+    /**
+     * Number of most recent sequence numbers for which the receiver
+     * remembers which were already seen, dropping repeated and older packets.
+     * Zero disables replay protection. If nonzero, encryption must be used.
+     * Must be >=0 and <=SPPROTO_MAX_REPLAY_WINDOW.
+     */
+    int replay_window;
+    
+    /**
+     * Whether to send compact nonces. Must be 0 or 1. If 1, an AEAD
+     * encryption mode and a replay window must be used.
+     */
+    int compact;
 };
 
 #define SPPROTO_HAVE_HASH(_params) ((_params).hash_mode != SPPROTO_HASH_MODE_NONE)
@@ -110,10 +167,21 @@ struct spproto_security_params {
     0 \
 )
 
+#define SPPROTO_HAVE_KEYED_HASH(_params) (SPPROTO_HAVE_HASH(_params) && BHash_type_keyed((_params).hash_mode))
+
 #define SPPROTO_HAVE_ENCRYPTION(_params) ((_params).encryption_mode != SPPROTO_ENCRYPTION_MODE_NONE)
+#define SPPROTO_HAVE_AEAD(_params) BAEAD_cipher_valid((_params).encryption_mode)
 
 #define SPPROTO_HAVE_OTP(_params) ((_params).otp_mode != SPPROTO_OTP_MODE_NONE)
 
+#define SPPROTO_HAVE_REPLAY_WINDOW(_params) ((_params).replay_window > 0)
+
+#define SPPROTO_AEAD_NONCE_LEN(_params) ( \
+    (_params).compact ? \
+    BAEAD_NONCE_SIZE - (SPPROTO_SEQ_LEN - SPPROTO_COMPACT_SEQ_LEN) : \
+    BAEAD_NONCE_SIZE \
+)
+
 B_START_PACKED
 struct spproto_otpdata {
     uint16_t seed_id;
@@ -135,9 +203,104 @@ B_END_PACKED
 static void spproto_assert_security_params (struct spproto_security_params params)
 {
     ASSERT(params.hash_mode == SPPROTO_HASH_MODE_NONE || BHash_type_valid(params.hash_mode))
-    ASSERT(params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE || BEncryption_cipher_valid(params.encryption_mode))
+    ASSERT(params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE || BEncryption_cipher_valid(params.encryption_mode) || BAEAD_cipher_valid(params.encryption_mode))
     ASSERT(params.otp_mode == SPPROTO_OTP_MODE_NONE || BEncryption_cipher_valid(params.otp_mode))
     ASSERT(params.otp_mode == SPPROTO_OTP_MODE_NONE || params.otp_num > 0)
+    ASSERT(params.replay_window >= 0)
+    ASSERT(params.replay_window <= SPPROTO_MAX_REPLAY_WINDOW)
+    ASSERT(params.replay_window == 0 || params.encryption_mode != SPPROTO_ENCRYPTION_MODE_NONE)
+    ASSERT(params.hash_mode == SPPROTO_HASH_MODE_NONE || !BHash_type_keyed(params.hash_mode) || params.encryption_mode != SPPROTO_ENCRYPTION_MODE_NONE)
+    ASSERT(params.compact == 0 || params.compact == 1)
+    ASSERT(!params.compact || (BAEAD_cipher_valid(params.encryption_mode) && params.replay_window > 0))
+}
+
+/**
+ * Reconstructs a sequence number from its low SPPROTO_COMPACT_SEQ_LEN bytes,
+ * as the one nearest to a reference sequence number.
+ * 
+ * @param low low bytes of the sequence number
+ * @param ref reference sequence number
+ * @return sequence number
+ */
+static uint64_t spproto_expand_compact_seq (uint32_t low, uint64_t ref)
+{
+    uint64_t half = (uint64_t)1 << 31;
+    uint64_t seq = (ref & ~(uint64_t)UINT32_MAX) | low;
+    
+    if (seq + half < ref) {
+        seq += (uint64_t)1 << 32;
+    }
+    else if (seq > ref + half && seq > UINT32_MAX) {
+        seq -= (uint64_t)1 << 32;
+    }
+    
+    return seq;
+}
+
+/**
+ * Returns the length of the random prefix preceding the sequence number
+ * in the nonce or IV block.
+ * 
+ * @param params security parameters. Must use encryption.
+ * @return prefix length in bytes, between 0 and 8
+ */
+static int spproto_seq_prefix_len (struct spproto_security_params params)
+{
+    spproto_assert_security_params(params);
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(params))
+    
+    if (BAEAD_cipher_valid(params.encryption_mode)) {
+        return (BAEAD_NONCE_SIZE - SPPROTO_SEQ_LEN);
+    }
+    
+    return (BEncryption_cipher_block_size(params.encryption_mode) - SPPROTO_SEQ_LEN);
+}
+
+/**
+ * Returns the size of the encryption key for the given SPProto
+ * security parameters.
+ * 
+ * @param params security parameters. Must use encryption.
+ * @return key size in bytes, at most SPPROTO_ENCRYPTION_MAX_KEY_SIZE
+ */
+static int spproto_encryption_key_size (struct spproto_security_params params)
+{
+    spproto_assert_security_params(params);
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(params))
+    
+    if (SPPROTO_HAVE_AEAD(params)) {
+        return BAEAD_cipher_key_size(params.encryption_mode);
+    }
+    
+    return BEncryption_cipher_key_size(params.encryption_mode);
+}
+
+/**
+ * Derives the key of a keyed hash from the encryption key, as
+ * SHA-256("spproto hash key" || encryption key), truncated to the
+ * hash key size.
+ * 
+ * @param params security parameters. Must use encryption and a keyed hash.
+ * @param encryption_key encryption key, {@link spproto_encryption_key_size} bytes
+ * @param out the hash key will be written here, {@link BHash_key_size} bytes
+ */
+static void spproto_hash_key (struct spproto_security_params params, const uint8_t *encryption_key, uint8_t *out)
+{
+    spproto_assert_security_params(params);
+    ASSERT(SPPROTO_HAVE_ENCRYPTION(params))
+    ASSERT(SPPROTO_HAVE_KEYED_HASH(params))
+    
+    static const char label[] = "spproto hash key";
+    int key_size = spproto_encryption_key_size(params);
+    
+    uint8_t data[sizeof(label) - 1 + SPPROTO_ENCRYPTION_MAX_KEY_SIZE];
+    memcpy(data, label, sizeof(label) - 1);
+    memcpy(data + sizeof(label) - 1, encryption_key, key_size);
+    
+    uint8_t digest[BHASH_TYPE_SHA256_SIZE];
+    BHash_calculate(BHASH_TYPE_SHA256, data, sizeof(label) - 1 + key_size, digest);
+    
+    memcpy(out, digest, BHash_key_size(params.hash_mode));
 }
 
 /**
@@ -156,6 +319,8 @@ static int spproto_payload_mtu_for_carrier_mtu (struct spproto_security_params p
     
     if (params.encryption_mode == SPPROTO_ENCRYPTION_MODE_NONE) {
         return (carrier_mtu - SPPROTO_HEADER_LEN(params));
+    } else if (SPPROTO_HAVE_AEAD(params)) {
+        return (carrier_mtu - SPPROTO_AEAD_NONCE_LEN(params) - SPPROTO_HEADER_LEN(params) - BAEAD_TAG_SIZE);
     } else {
         int block_size = BEncryption_cipher_block_size(params.encryption_mode);
         return (balign_down(carrier_mtu, block_size) - block_size - SPPROTO_HEADER_LEN(params) - 1);
@@ -181,6 +346,12 @@ static int spproto_carrier_mtu_for_payload_mtu (struct spproto_security_params p
         }
         
         return (SPPROTO_HEADER_LEN(params) + payload_mtu);
+    } else if (SPPROTO_HAVE_AEAD(params)) {
+        if (payload_mtu > INT_MAX - (SPPROTO_AEAD_NONCE_LEN(params) + SPPROTO_HEADER_LEN(params) + BAEAD_TAG_SIZE)) {
+            return -1;
+        }
+        
+        return (SPPROTO_AEAD_NONCE_LEN(params) + SPPROTO_HEADER_LEN(params) + payload_mtu + BAEAD_TAG_SIZE);
     } else {
         int block_size = BEncryption_cipher_block_size(params.encryption_mode);
         
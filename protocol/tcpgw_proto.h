@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BADVPN_PROTOCOL_TCPGW_PROTO_H
+#define BADVPN_PROTOCOL_TCPGW_PROTO_H
+
+#include <stdint.h>
+
+#include <misc/packed.h>
+
+// tcpgw protocol: many TCP streams multiplexed over one stream connection.
+// Messages are framed with PacketProto. Each starts with a tcpgw_header;
+// multi-byte fields are in network byte order.
+//
+// TCPGW_TYPE_OPEN (client to server): open a stream to the address which
+// follows (tcpgw_addr_ipv4, or tcpgw_addr_ipv6 if TCPGW_FLAG_IPV6 is set).
+// The client picks the stream ID and never reuses one on a connection.
+// There is no reply; if connecting fails, the server closes the stream.
+//
+// TCPGW_TYPE_DATA: stream data. Each side may send as many bytes as the
+// receive window of the other side allows. Windows start out at
+// TCPGW_INITIAL_WINDOW and grow with TCPGW_TYPE_WINDOW messages.
+//
+// TCPGW_TYPE_WINDOW: followed by a tcpgw_window; lets the other side send
+// that many more bytes.
+//
+// TCPGW_TYPE_CLOSE: the sender is done with the stream, in both directions,
+// after any data it sent before. Messages for streams which are not open are
+// ignored, since they may have crossed a close.
+
+#define TCPGW_TYPE_OPEN 1
+#define TCPGW_TYPE_DATA 2
+#define TCPGW_TYPE_WINDOW 3
+#define TCPGW_TYPE_CLOSE 4
+
+#define TCPGW_FLAG_IPV6 (1 << 0)
+
+#define TCPGW_INITIAL_WINDOW 16384
+
+// maximum data in one TCPGW_TYPE_DATA message
+#define TCPGW_MAX_DATA 16384
+
+B_START_PACKED
+struct tcpgw_header {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+} B_PACKED;
+B_END_PACKED
+
+B_START_PACKED
+struct tcpgw_window {
+    uint32_t bytes;
+} B_PACKED;
+B_END_PACKED
+
+B_START_PACKED
+struct tcpgw_addr_ipv4 {
+    uint32_t addr_ip;
+    uint16_t addr_port;
+} B_PACKED;
+B_END_PACKED
+
+B_START_PACKED
+struct tcpgw_addr_ipv6 {
+    uint8_t addr_ip[16];
+    uint16_t addr_port;
+} B_PACKED;
+B_END_PACKED
+
+// largest message, not counting the PacketProto header
+#define TCPGW_MTU (sizeof(struct tcpgw_header) + TCPGW_MAX_DATA)
+
+#endif
@@ -38,6 +38,7 @@
 #define UDPGW_CLIENT_FLAG_REBIND (1 << 1)
 #define UDPGW_CLIENT_FLAG_DNS (1 << 2)
 #define UDPGW_CLIENT_FLAG_IPV6 (1 << 3)
+#define UDPGW_CLIENT_FLAG_DGRAM (1 << 4)
 
 B_START_PACKED
 struct udpgw_header {
@@ -60,6 +61,51 @@ struct udpgw_addr_ipv6 {
 } B_PACKED;
 B_END_PACKED
 
+// Datagram transport.
+// The client asks for it with a UDPGW_CLIENT_FLAG_DGRAM message carrying a
+// struct udpgw_dgram_request over the stream. The server answers with a
+// UDPGW_CLIENT_FLAG_DGRAM message carrying a struct udpgw_dgram_offer, or
+// nothing if it refuses. Messages may then also be sent as UDP datagrams:
+// a struct udpgw_dgram_header, followed by the message (preceded by a
+// struct fecproto_header if FEC is used) encrypted with AES-128-GCM and the
+// authentication tag. The nonce is the direction (0 from the client, 1 from
+// the server) as a little-endian 32-bit integer followed by the seq field.
+// A keepalive message received as a datagram by the server is answered with
+// one, so that the client can tell that datagrams get through both ways.
+// Messages longer than UDPGW_DGRAM_MAX_MESSAGE always go over the stream.
+// The key is sent in the offer as is, so it is only as secret as the stream.
+// While the transport is in use, the client sends a keepalive datagram every
+// UDPGW_DGRAM_KEEPALIVE_INTERVAL, and either end goes back to sending only
+// over the stream if it has received no datagram for UDPGW_DGRAM_TIMEOUT.
+
+#define UDPGW_DGRAM_KEY_SIZE 16
+#define UDPGW_DGRAM_TAG_SIZE 16
+#define UDPGW_DGRAM_MAX_MESSAGE 1400
+#define UDPGW_DGRAM_KEEPALIVE_INTERVAL 5000
+#define UDPGW_DGRAM_TIMEOUT 15000
+
+B_START_PACKED
+struct udpgw_dgram_request {
+    uint8_t fec_group_size;
+} B_PACKED;
+B_END_PACKED
+
+B_START_PACKED
+struct udpgw_dgram_offer {
+    uint32_t session_id;
+    uint16_t port; // network byte order
+    uint8_t fec_group_size;
+    uint8_t key[UDPGW_DGRAM_KEY_SIZE];
+} B_PACKED;
+B_END_PACKED
+
+B_START_PACKED
+struct udpgw_dgram_header {
+    uint32_t session_id;
+    uint64_t seq;
+} B_PACKED;
+B_END_PACKED
+
 static int udpgw_compute_mtu (int dgram_mtu)
 {
     bsize_t bs = bsize_add(
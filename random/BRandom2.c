@@ -27,6 +27,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -45,6 +46,8 @@ static int do_init (BRandom2 *o)
         return 0;
     }
     
+    chacha_drbg_init(&o->drbg);
+    
     o->initialized = 1;
     
     return 1;
@@ -69,6 +72,7 @@ void BRandom2_Free (BRandom2 *o)
     DebugObject_Free(&o->d_obj);
     
     if (o->initialized) {
+        memset(&o->drbg, 0, sizeof(o->drbg));
         close(o->urandom_fd);
     }
 }
@@ -81,10 +85,20 @@ int BRandom2_GenBytes (BRandom2 *o, void *out, size_t len)
         return 0;
     }
     
-    ssize_t res = read(o->urandom_fd, out, len);
-    if (res < 0 || res != len) {
-        return 0;
+    // reseed periodically, and after a fork so the child doesn't repeat the parent
+    pid_t pid = getpid();
+    if (chacha_drbg_needs_reseed(&o->drbg) || pid != o->drbg_pid) {
+        uint8_t seed[CHACHA_DRBG_SEED_LEN];
+        ssize_t res = read(o->urandom_fd, seed, sizeof(seed));
+        if (res < 0 || res != sizeof(seed)) {
+            return 0;
+        }
+        chacha_drbg_seed(&o->drbg, seed);
+        memset(seed, 0, sizeof(seed));
+        o->drbg_pid = pid;
     }
     
+    chacha_drbg_generate(&o->drbg, (uint8_t *)out, len);
+    
     return 1;
 }
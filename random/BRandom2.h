@@ -31,8 +31,10 @@
 #define BADVPN_RANDOM2_H
 
 #include <stddef.h>
+#include <sys/types.h>
 
 #include <misc/debug.h>
+#include <misc/chacha_drbg.h>
 #include <base/DebugObject.h>
 
 #define BRANDOM2_INIT_LAZY (1 << 0)
@@ -40,11 +42,24 @@
 typedef struct {
     int initialized;
     int urandom_fd;
+    struct chacha_drbg drbg;
+    pid_t drbg_pid;
     DebugObject d_obj;
 } BRandom2;
 
 int BRandom2_Init (BRandom2 *o, int flags) WARN_UNUSED;
 void BRandom2_Free (BRandom2 *o);
+/**
+ * Generates random data.
+ * The data comes from a ChaCha20-based generator seeded from /dev/urandom,
+ * which is reseeded after generating CHACHA_DRBG_RESEED_BYTES bytes and when
+ * called in a different process than the one which seeded it.
+ * 
+ * @param o the object
+ * @param out output buffer
+ * @param len number of bytes to generate
+ * @return 1 on success, 0 on failure
+ */
 int BRandom2_GenBytes (BRandom2 *o, void *out, size_t len) WARN_UNUSED;
 
 #endif
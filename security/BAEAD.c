@@ -0,0 +1,177 @@
+/**
+ * @file BAEAD.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <base/BLog.h>
+
+#include <security/BAEAD.h>
+
+#include <generated/blog_channel_BAEAD.h>
+
+static const EVP_CIPHER * get_evp_cipher (int cipher)
+{
+    switch (cipher) {
+        case BAEAD_CIPHER_AES128_GCM:
+            return EVP_aes_128_gcm();
+        case BAEAD_CIPHER_CHACHA20_POLY1305:
+            return EVP_chacha20_poly1305();
+        default:
+            ASSERT(0)
+            return NULL;
+    }
+}
+
+int BAEAD_cipher_valid (int cipher)
+{
+    switch (cipher) {
+        case BAEAD_CIPHER_AES128_GCM:
+        case BAEAD_CIPHER_CHACHA20_POLY1305:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int BAEAD_cipher_key_size (int cipher)
+{
+    switch (cipher) {
+        case BAEAD_CIPHER_AES128_GCM:
+            return BAEAD_CIPHER_AES128_GCM_KEY_SIZE;
+        case BAEAD_CIPHER_CHACHA20_POLY1305:
+            return BAEAD_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
+        default:
+            ASSERT(0)
+            return 0;
+    }
+}
+
+int BAEAD_Init (BAEAD *o, int mode, int cipher, const uint8_t *key)
+{
+    ASSERT(mode == BAEAD_MODE_ENCRYPT || mode == BAEAD_MODE_DECRYPT)
+    ASSERT(BAEAD_cipher_valid(cipher))
+    
+    o->mode = mode;
+    o->cipher = cipher;
+    
+    if (!(o->ctx = EVP_CIPHER_CTX_new())) {
+        BLog(BLOG_ERROR, "EVP_CIPHER_CTX_new failed");
+        goto fail0;
+    }
+    
+    int enc = (mode == BAEAD_MODE_ENCRYPT);
+    
+    // set cipher first so that the nonce length can be set before the key
+    if (!EVP_CipherInit_ex(o->ctx, get_evp_cipher(cipher), NULL, NULL, NULL, enc)) {
+        BLog(BLOG_ERROR, "EVP_CipherInit_ex failed");
+        goto fail1;
+    }
+    
+    if (!EVP_CIPHER_CTX_ctrl(o->ctx, EVP_CTRL_AEAD_SET_IVLEN, BAEAD_NONCE_SIZE, NULL)) {
+        BLog(BLOG_ERROR, "EVP_CTRL_AEAD_SET_IVLEN failed");
+        goto fail1;
+    }
+    
+    if (!EVP_CipherInit_ex(o->ctx, NULL, NULL, key, NULL, enc)) {
+        BLog(BLOG_ERROR, "EVP_CipherInit_ex failed");
+        goto fail1;
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    EVP_CIPHER_CTX_free(o->ctx);
+fail0:
+    return 0;
+}
+
+void BAEAD_Free (BAEAD *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    EVP_CIPHER_CTX_free(o->ctx);
+}
+
+void BAEAD_Seal (BAEAD *o, const uint8_t *nonce, const uint8_t *in, int len, uint8_t *out)
+{
+    ASSERT(o->mode == BAEAD_MODE_ENCRYPT)
+    ASSERT(len >= 0)
+    DebugObject_Access(&o->d_obj);
+    
+    int res;
+    int out_len;
+    
+    // keeps the key schedule, only resets the nonce
+    res = EVP_EncryptInit_ex(o->ctx, NULL, NULL, NULL, nonce);
+    ASSERT_EXECUTE(res)
+    
+    if (len > 0) {
+        res = EVP_EncryptUpdate(o->ctx, out, &out_len, in, len);
+        ASSERT_EXECUTE(res)
+        ASSERT(out_len == len)
+    }
+    
+    res = EVP_EncryptFinal_ex(o->ctx, out + len, &out_len);
+    ASSERT_EXECUTE(res)
+    ASSERT(out_len == 0)
+    
+    res = EVP_CIPHER_CTX_ctrl(o->ctx, EVP_CTRL_AEAD_GET_TAG, BAEAD_TAG_SIZE, out + len);
+    ASSERT_EXECUTE(res)
+}
+
+int BAEAD_Open (BAEAD *o, const uint8_t *nonce, const uint8_t *in, int len, uint8_t *out)
+{
+    ASSERT(o->mode == BAEAD_MODE_DECRYPT)
+    ASSERT(len >= BAEAD_TAG_SIZE)
+    DebugObject_Access(&o->d_obj);
+    
+    int res;
+    int out_len;
+    int data_len = len - BAEAD_TAG_SIZE;
+    
+    // copy the tag before decrypting, in case out overlaps it
+    uint8_t tag[BAEAD_TAG_SIZE];
+    memcpy(tag, in + data_len, BAEAD_TAG_SIZE);
+    
+    res = EVP_DecryptInit_ex(o->ctx, NULL, NULL, NULL, nonce);
+    ASSERT_EXECUTE(res)
+    
+    if (data_len > 0) {
+        res = EVP_DecryptUpdate(o->ctx, out, &out_len, in, data_len);
+        ASSERT_EXECUTE(res)
+        ASSERT(out_len == data_len)
+    }
+    
+    res = EVP_CIPHER_CTX_ctrl(o->ctx, EVP_CTRL_AEAD_SET_TAG, BAEAD_TAG_SIZE, tag);
+    ASSERT_EXECUTE(res)
+    
+    // verifies the tag
+    return (EVP_DecryptFinal_ex(o->ctx, out + data_len, &out_len) > 0);
+}
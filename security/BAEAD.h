@@ -0,0 +1,137 @@
+/**
+ * @file BAEAD.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Authenticated encryption with associated data (AEAD) abstraction.
+ */
+
+#ifndef BADVPN_SECURITY_BAEAD_H
+#define BADVPN_SECURITY_BAEAD_H
+
+#include <stdint.h>
+
+#include <openssl/evp.h>
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+
+#define BAEAD_MODE_ENCRYPT 1
+#define BAEAD_MODE_DECRYPT 2
+
+#define BAEAD_NONCE_SIZE 12
+#define BAEAD_TAG_SIZE 16
+#define BAEAD_MAX_KEY_SIZE 32
+
+// cipher numbers do not overlap with BEncryption ciphers, so that
+// a single encryption mode field can hold either kind
+#define BAEAD_CIPHER_AES128_GCM 3
+#define BAEAD_CIPHER_AES128_GCM_KEY_SIZE 16
+
+#define BAEAD_CIPHER_CHACHA20_POLY1305 4
+#define BAEAD_CIPHER_CHACHA20_POLY1305_KEY_SIZE 32
+
+// NOTE: update the maximum above when adding a cipher!
+
+/**
+ * AEAD cipher object.
+ * Each call to {@link BAEAD_Seal} or {@link BAEAD_Open} encrypts or decrypts
+ * and authenticates a whole message in a single pass.
+ */
+typedef struct {
+    DebugObject d_obj;
+    int mode;
+    int cipher;
+    EVP_CIPHER_CTX *ctx;
+} BAEAD;
+
+/**
+ * Checks if the given cipher number is a valid AEAD cipher.
+ * 
+ * @param cipher cipher number
+ * @return 1 if valid, 0 if not
+ */
+int BAEAD_cipher_valid (int cipher);
+
+/**
+ * Returns the key size of an AEAD cipher.
+ * 
+ * @param cipher cipher number. Must be valid.
+ * @return key size in bytes
+ */
+int BAEAD_cipher_key_size (int cipher);
+
+/**
+ * Initializes the object.
+ * {@link BSecurity_GlobalInitThreadSafe} must have been done if this object
+ * will be used from a non-main thread.
+ * 
+ * @param o the object
+ * @param mode BAEAD_MODE_ENCRYPT or BAEAD_MODE_DECRYPT
+ * @param cipher cipher number. Must be valid.
+ * @param key encryption key
+ * @return 1 on success, 0 on failure
+ */
+int BAEAD_Init (BAEAD *o, int mode, int cipher, const uint8_t *key) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void BAEAD_Free (BAEAD *o);
+
+/**
+ * Encrypts a message and computes its authentication tag.
+ * The object must have been initialized with BAEAD_MODE_ENCRYPT.
+ * 
+ * @param o the object
+ * @param nonce nonce of BAEAD_NONCE_SIZE bytes. Must never be reused
+ *              with the same key.
+ * @param in plaintext
+ * @param len plaintext length. Must be >=0.
+ * @param out ciphertext output, followed by the BAEAD_TAG_SIZE bytes tag.
+ *            May be the same as in.
+ */
+void BAEAD_Seal (BAEAD *o, const uint8_t *nonce, const uint8_t *in, int len, uint8_t *out);
+
+/**
+ * Verifies and decrypts a message.
+ * The object must have been initialized with BAEAD_MODE_DECRYPT.
+ * 
+ * @param o the object
+ * @param nonce nonce of BAEAD_NONCE_SIZE bytes
+ * @param in ciphertext followed by the tag
+ * @param len length of ciphertext plus tag. Must be >=BAEAD_TAG_SIZE.
+ * @param out plaintext output, len - BAEAD_TAG_SIZE bytes. May be the same as in.
+ *            Contents are undefined if verification fails.
+ * @return 1 if the message is authentic, 0 if not
+ */
+int BAEAD_Open (BAEAD *o, const uint8_t *nonce, const uint8_t *in, int len, uint8_t *out);
+
+#endif
@@ -33,11 +33,67 @@
 
 #include <generated/blog_channel_BEncryption.h>
 
+static const EVP_CIPHER * get_evp_cipher (int cipher)
+{
+    switch (cipher) {
+        case BENCRYPTION_CIPHER_AES:
+            return EVP_aes_128_cbc();
+        case BENCRYPTION_CIPHER_AES256:
+            return EVP_aes_256_cbc();
+        default:
+            ASSERT(0)
+            return NULL;
+    }
+}
+
+static EVP_CIPHER_CTX * evp_init (int cipher, uint8_t *key, int enc)
+{
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    ASSERT_FORCE(ctx)
+    
+    int res = EVP_CipherInit_ex(ctx, get_evp_cipher(cipher), NULL, key, NULL, enc);
+    ASSERT_FORCE(res)
+    
+    // callers always pass whole blocks and do their own padding
+    res = EVP_CIPHER_CTX_set_padding(ctx, 0);
+    ASSERT_EXECUTE(res)
+    
+    return ctx;
+}
+
+static void evp_cbc (EVP_CIPHER_CTX *ctx, int block_size, uint8_t *in, uint8_t *out, int len, uint8_t *iv, int enc)
+{
+    if (len == 0) {
+        return;
+    }
+    
+    // the next IV is the last ciphertext block; when decrypting, save it
+    // before it is possibly overwritten in place
+    uint8_t next_iv[BENCRYPTION_MAX_BLOCK_SIZE];
+    if (!enc) {
+        memcpy(next_iv, in + len - block_size, block_size);
+    }
+    
+    int res;
+    int out_len;
+    
+    // keeps the key schedule, only resets the IV
+    res = EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, -1);
+    ASSERT_EXECUTE(res)
+    
+    res = EVP_CipherUpdate(ctx, out, &out_len, in, len);
+    ASSERT_EXECUTE(res)
+    ASSERT(out_len == len)
+    
+    memcpy(iv, (enc ? out + len - block_size : next_iv), block_size);
+}
+
 int BEncryption_cipher_valid (int cipher)
 {
     switch (cipher) {
         case BENCRYPTION_CIPHER_BLOWFISH:
         case BENCRYPTION_CIPHER_AES:
+        case BENCRYPTION_CIPHER_AES256:
             return 1;
         default:
             return 0;
@@ -51,6 +107,8 @@ int BEncryption_cipher_block_size (int cipher)
             return BENCRYPTION_CIPHER_BLOWFISH_BLOCK_SIZE;
         case BENCRYPTION_CIPHER_AES:
             return BENCRYPTION_CIPHER_AES_BLOCK_SIZE;
+        case BENCRYPTION_CIPHER_AES256:
+            return BENCRYPTION_CIPHER_AES256_BLOCK_SIZE;
         default:
             ASSERT(0)
             return 0;
@@ -64,6 +122,8 @@ int BEncryption_cipher_key_size (int cipher)
             return BENCRYPTION_CIPHER_BLOWFISH_KEY_SIZE;
         case BENCRYPTION_CIPHER_AES:
             return BENCRYPTION_CIPHER_AES_KEY_SIZE;
+        case BENCRYPTION_CIPHER_AES256:
+            return BENCRYPTION_CIPHER_AES256_KEY_SIZE;
         default:
             ASSERT(0)
             return 0;
@@ -82,6 +142,7 @@ void BEncryption_Init (BEncryption *enc, int mode, int cipher, uint8_t *key)
     
     switch (enc->cipher) {
         case BENCRYPTION_CIPHER_AES:
+        case BENCRYPTION_CIPHER_AES256:
             enc->cryptodev.cipher = CRYPTO_AES_CBC;
             break;
         default:
@@ -123,20 +184,21 @@ fail1:
     
     #endif
     
-    int res;
-    
     switch (enc->cipher) {
         case BENCRYPTION_CIPHER_BLOWFISH:
+            // Blowfish has no hardware support, and with OpenSSL 3 its EVP
+            // implementation is only in the legacy provider
             BF_set_key(&enc->blowfish, BENCRYPTION_CIPHER_BLOWFISH_KEY_SIZE, key);
             break;
         case BENCRYPTION_CIPHER_AES:
+        case BENCRYPTION_CIPHER_AES256:
+            enc->evp.encrypt = NULL;
+            enc->evp.decrypt = NULL;
             if (enc->mode&BENCRYPTION_MODE_ENCRYPT) {
-                res = AES_set_encrypt_key(key, 128, &enc->aes.encrypt);
-                ASSERT_EXECUTE(res >= 0)
+                enc->evp.encrypt = evp_init(enc->cipher, key, 1);
             }
             if (enc->mode&BENCRYPTION_MODE_DECRYPT) {
-                res = AES_set_decrypt_key(key, 128, &enc->aes.decrypt);
-                ASSERT_EXECUTE(res >= 0)
+                enc->evp.decrypt = evp_init(enc->cipher, key, 0);
             }
             break;
         default:
@@ -162,9 +224,15 @@ void BEncryption_Free (BEncryption *enc)
         ASSERT_FORCE(ioctl(enc->cryptodev.cfd, CIOCFSESSION, &enc->cryptodev.ses) == 0)
         ASSERT_FORCE(close(enc->cryptodev.cfd) == 0)
         ASSERT_FORCE(close(enc->cryptodev.fd) == 0)
+        return;
     }
     
     #endif
+    
+    if (enc->cipher == BENCRYPTION_CIPHER_AES || enc->cipher == BENCRYPTION_CIPHER_AES256) {
+        EVP_CIPHER_CTX_free(enc->evp.encrypt);
+        EVP_CIPHER_CTX_free(enc->evp.decrypt);
+    }
 }
 
 void BEncryption_Encrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len, uint8_t *iv)
@@ -196,7 +264,8 @@ void BEncryption_Encrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len,
             BF_cbc_encrypt(in, out, len, &enc->blowfish, iv, BF_ENCRYPT);
             break;
         case BENCRYPTION_CIPHER_AES:
-            AES_cbc_encrypt(in, out, len, &enc->aes.encrypt, iv, AES_ENCRYPT);
+        case BENCRYPTION_CIPHER_AES256:
+            evp_cbc(enc->evp.encrypt, BEncryption_cipher_block_size(enc->cipher), in, out, len, iv, 1);
             break;
         default:
             ASSERT(0);
@@ -232,7 +301,8 @@ void BEncryption_Decrypt (BEncryption *enc, uint8_t *in, uint8_t *out, int len,
             BF_cbc_encrypt(in, out, len, &enc->blowfish, iv, BF_DECRYPT);
             break;
         case BENCRYPTION_CIPHER_AES:
-            AES_cbc_encrypt(in, out, len, &enc->aes.decrypt, iv, AES_DECRYPT);
+        case BENCRYPTION_CIPHER_AES256:
+            evp_cbc(enc->evp.decrypt, BEncryption_cipher_block_size(enc->cipher), in, out, len, iv, 0);
             break;
         default:
             ASSERT(0);
@@ -29,6 +29,9 @@
  * @section DESCRIPTION
  * 
  * Block cipher encryption abstraction.
+ * 
+ * AES is done through OpenSSL's EVP interface, which picks the fastest
+ * implementation for the running CPU (e.g. AES-NI, ARMv8 Crypto Extensions).
  */
 
 #ifndef BADVPN_SECURITY_BENCRYPTION_H
@@ -49,7 +52,7 @@
 #endif
 
 #include <openssl/blowfish.h>
-#include <openssl/aes.h>
+#include <openssl/evp.h>
 
 #include <misc/debug.h>
 #include <base/DebugObject.h>
@@ -58,7 +61,7 @@
 #define BENCRYPTION_MODE_DECRYPT 2
 
 #define BENCRYPTION_MAX_BLOCK_SIZE 16
-#define BENCRYPTION_MAX_KEY_SIZE 16
+#define BENCRYPTION_MAX_KEY_SIZE 32
 
 #define BENCRYPTION_CIPHER_BLOWFISH 1
 #define BENCRYPTION_CIPHER_BLOWFISH_BLOCK_SIZE 8
@@ -68,6 +71,11 @@
 #define BENCRYPTION_CIPHER_AES_BLOCK_SIZE 16
 #define BENCRYPTION_CIPHER_AES_KEY_SIZE 16
 
+// 3 and 4 are taken by BAEAD ciphers, see BAEAD.h
+#define BENCRYPTION_CIPHER_AES256 5
+#define BENCRYPTION_CIPHER_AES256_BLOCK_SIZE 16
+#define BENCRYPTION_CIPHER_AES256_KEY_SIZE 32
+
 // NOTE: update the maximums above when adding a cipher!
 
 /**
@@ -83,9 +91,9 @@ typedef struct {
     union {
         BF_KEY blowfish;
         struct {
-            AES_KEY encrypt;
-            AES_KEY decrypt;
-        } aes;
+            EVP_CIPHER_CTX *encrypt;
+            EVP_CIPHER_CTX *decrypt;
+        } evp;
         #ifdef BADVPN_USE_CRYPTODEV
         struct {
             int fd;
@@ -124,7 +132,8 @@ int BEncryption_cipher_key_size (int cipher);
 /**
  * Initializes the object.
  * {@link BSecurity_GlobalInitThreadSafe} must have been done if this object
- * will be used from a non-main thread.
+ * will be used from a non-main thread. The object must not be used from
+ * more than one thread at a time.
  * 
  * @param enc the object
  * @param mode whether encryption or decryption is to be done, or both.
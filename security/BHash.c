@@ -27,13 +27,183 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+
+#include <misc/byteorder.h>
+#include <misc/batomic.h>
+#include <misc/bthreadlocal.h>
+
 #include <security/BHash.h>
 
+#define SIPROUND \
+    { \
+        v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32); \
+        v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32); \
+    }
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+// digests fetched by get_md, indexed by hash type
+static void *fetched_mds[BHASH_TYPE_SHA256 + 1];
+#endif
+
+// In OpenSSL 3, digesting with EVP_sha256() and the like, as well as the
+// one-shot SHA256() and the like, looks up the implementation every time,
+// which costs more than hashing a small packet. So the implementations are
+// fetched once and kept until exit.
+static const EVP_MD * get_md (int type)
+{
+    ASSERT(type == BHASH_TYPE_MD5 || type == BHASH_TYPE_SHA1 || type == BHASH_TYPE_SHA256)
+    
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    void *md = batomic_load_ptr(&fetched_mds[type]);
+    if (!md) {
+        const char *name = (type == BHASH_TYPE_MD5 ? "MD5" : (type == BHASH_TYPE_SHA1 ? "SHA1" : "SHA256"));
+        EVP_MD *new_md = EVP_MD_fetch(NULL, name, NULL);
+        ASSERT_FORCE(new_md)
+        
+        // another thread may have fetched it meanwhile
+        if (batomic_cas_ptr(&fetched_mds[type], &md, new_md)) {
+            md = new_md;
+        } else {
+            EVP_MD_free(new_md);
+        }
+    }
+    return (const EVP_MD *)md;
+#else
+    switch (type) {
+        case BHASH_TYPE_MD5:
+            return EVP_md5();
+        case BHASH_TYPE_SHA1:
+            return EVP_sha1();
+        default:
+            return EVP_sha256();
+    }
+#endif
+}
+
+// context of the calling thread, reused since allocating one for each
+// hash costs about as much as hashing a small packet; never freed
+static BTHREADLOCAL EVP_MD_CTX *thread_ctx;
+
+static EVP_MD_CTX * get_ctx (void)
+{
+    if (!thread_ctx) {
+        thread_ctx = EVP_MD_CTX_new();
+        ASSERT_FORCE(thread_ctx)
+    }
+    return thread_ctx;
+}
+
+// starts a hash with the context of the calling thread
+static EVP_MD_CTX * start_hash (int type)
+{
+    EVP_MD_CTX *ctx = get_ctx();
+    ASSERT_FORCE(EVP_DigestInit_ex(ctx, get_md(type), NULL) == 1)
+    return ctx;
+}
+
+static void digest (int type, const uint8_t *data, int data_len, uint8_t *out)
+{
+    EVP_MD_CTX *ctx = start_hash(type);
+    ASSERT_FORCE(EVP_DigestUpdate(ctx, data, data_len) == 1)
+    ASSERT_FORCE(EVP_DigestFinal_ex(ctx, out, NULL) == 1)
+}
+
+static void hmac_sha256 (const uint8_t *key, const uint8_t *data, int data_len, uint8_t *out)
+{
+    uint8_t pad[SHA256_CBLOCK];
+    uint8_t inner[SHA256_DIGEST_LENGTH];
+    
+    // key is shorter than a block, pad it with zeros
+    memset(pad, 0x36, sizeof(pad));
+    for (int i = 0; i < BHASH_TYPE_HMAC_SHA256_KEY_SIZE; i++) {
+        pad[i] ^= key[i];
+    }
+    EVP_MD_CTX *ctx = start_hash(BHASH_TYPE_SHA256);
+    ASSERT_FORCE(EVP_DigestUpdate(ctx, pad, sizeof(pad)) == 1)
+    ASSERT_FORCE(EVP_DigestUpdate(ctx, data, data_len) == 1)
+    ASSERT_FORCE(EVP_DigestFinal_ex(ctx, inner, NULL) == 1)
+    
+    memset(pad, 0x5c, sizeof(pad));
+    for (int i = 0; i < BHASH_TYPE_HMAC_SHA256_KEY_SIZE; i++) {
+        pad[i] ^= key[i];
+    }
+    ctx = start_hash(BHASH_TYPE_SHA256);
+    ASSERT_FORCE(EVP_DigestUpdate(ctx, pad, sizeof(pad)) == 1)
+    ASSERT_FORCE(EVP_DigestUpdate(ctx, inner, sizeof(inner)) == 1)
+    ASSERT_FORCE(EVP_DigestFinal_ex(ctx, out, NULL) == 1)
+}
+
+static uint64_t rotl64 (uint64_t x, int b)
+{
+    return ((x << b) | (x >> (64 - b)));
+}
+
+static uint64_t read_le64 (const uint8_t *p)
+{
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return ltoh64(x);
+}
+
+static void siphash24 (const uint8_t *key, const uint8_t *data, int data_len, uint8_t *out)
+{
+    uint64_t k0 = read_le64(key);
+    uint64_t k1 = read_le64(key + 8);
+    
+    uint64_t v0 = k0 ^ UINT64_C(0x736f6d6570736575);
+    uint64_t v1 = k1 ^ UINT64_C(0x646f72616e646f6d);
+    uint64_t v2 = k0 ^ UINT64_C(0x6c7967656e657261);
+    uint64_t v3 = k1 ^ UINT64_C(0x7465646279746573);
+    
+    // process whole words
+    const uint8_t *end = data + (data_len - data_len % 8);
+    for (; data != end; data += 8) {
+        uint64_t m = read_le64(data);
+        v3 ^= m;
+        SIPROUND
+        SIPROUND
+        v0 ^= m;
+    }
+    
+    // last word has the remaining bytes and the length in the top byte
+    uint64_t b = (uint64_t)data_len << 56;
+    for (int i = 0; i < data_len % 8; i++) {
+        b |= (uint64_t)data[i] << (8 * i);
+    }
+    v3 ^= b;
+    SIPROUND
+    SIPROUND
+    v0 ^= b;
+    
+    // finalize
+    v2 ^= 0xff;
+    SIPROUND
+    SIPROUND
+    SIPROUND
+    SIPROUND
+    
+    uint64_t h = htol64(v0 ^ v1 ^ v2 ^ v3);
+    memcpy(out, &h, sizeof(h));
+}
+
 int BHash_type_valid (int type)
 {
     switch (type) {
         case BHASH_TYPE_MD5:
         case BHASH_TYPE_SHA1:
+        case BHASH_TYPE_SHA256:
+        case BHASH_TYPE_HMAC_SHA256:
+        case BHASH_TYPE_SIPHASH24:
             return 1;
         default:
             return 0;
@@ -47,6 +217,41 @@ int BHash_size (int type)
             return BHASH_TYPE_MD5_SIZE;
         case BHASH_TYPE_SHA1:
             return BHASH_TYPE_SHA1_SIZE;
+        case BHASH_TYPE_SHA256:
+            return BHASH_TYPE_SHA256_SIZE;
+        case BHASH_TYPE_HMAC_SHA256:
+            return BHASH_TYPE_HMAC_SHA256_SIZE;
+        case BHASH_TYPE_SIPHASH24:
+            return BHASH_TYPE_SIPHASH24_SIZE;
+        default:
+            ASSERT(0)
+            return 0;
+    }
+}
+
+int BHash_type_keyed (int type)
+{
+    switch (type) {
+        case BHASH_TYPE_MD5:
+        case BHASH_TYPE_SHA1:
+        case BHASH_TYPE_SHA256:
+            return 0;
+        case BHASH_TYPE_HMAC_SHA256:
+        case BHASH_TYPE_SIPHASH24:
+            return 1;
+        default:
+            ASSERT(0)
+            return 0;
+    }
+}
+
+int BHash_key_size (int type)
+{
+    switch (type) {
+        case BHASH_TYPE_HMAC_SHA256:
+            return BHASH_TYPE_HMAC_SHA256_KEY_SIZE;
+        case BHASH_TYPE_SIPHASH24:
+            return BHASH_TYPE_SIPHASH24_KEY_SIZE;
         default:
             ASSERT(0)
             return 0;
@@ -57,10 +262,26 @@ void BHash_calculate (int type, uint8_t *data, int data_len, uint8_t *out)
 {
     switch (type) {
         case BHASH_TYPE_MD5:
-            MD5(data, data_len, out);
-            break;
         case BHASH_TYPE_SHA1:
-            SHA1(data, data_len, out);
+        case BHASH_TYPE_SHA256:
+            digest(type, data, data_len, out);
+            break;
+        default:
+            ASSERT(0)
+            ;
+    }
+}
+
+void BHash_calculate_keyed (int type, const uint8_t *key, uint8_t *data, int data_len, uint8_t *out)
+{
+    switch (type) {
+        case BHASH_TYPE_HMAC_SHA256: {
+            uint8_t mac[BHASH_TYPE_SHA256_SIZE];
+            hmac_sha256(key, data, data_len, mac);
+            memcpy(out, mac, BHASH_TYPE_HMAC_SHA256_SIZE);
+        } break;
+        case BHASH_TYPE_SIPHASH24:
+            siphash24(key, data, data_len, out);
             break;
         default:
             ASSERT(0)
@@ -29,6 +29,9 @@
  * @section DESCRIPTION
  * 
  * Cryptographic hash funtions abstraction.
+ * 
+ * Besides plain hashes, there are keyed hashes (MACs), which are calculated
+ * with {@link BHash_calculate_keyed}.
  */
 
 #ifndef BADVPN_SECURITY_BHASH_H
@@ -47,7 +50,23 @@
 #define BHASH_TYPE_SHA1 2
 #define BHASH_TYPE_SHA1_SIZE 20
 
-#define BHASH_MAX_SIZE 20
+#define BHASH_TYPE_SHA256 3
+#define BHASH_TYPE_SHA256_SIZE 32
+
+// keyed; HMAC-SHA256 truncated to 128 bits
+#define BHASH_TYPE_HMAC_SHA256 4
+#define BHASH_TYPE_HMAC_SHA256_SIZE 16
+#define BHASH_TYPE_HMAC_SHA256_KEY_SIZE 32
+
+// keyed; cheap on CPUs without crypto instructions, but only 64 bits
+#define BHASH_TYPE_SIPHASH24 5
+#define BHASH_TYPE_SIPHASH24_SIZE 8
+#define BHASH_TYPE_SIPHASH24_KEY_SIZE 16
+
+#define BHASH_MAX_SIZE 32
+#define BHASH_MAX_KEY_SIZE 32
+
+// NOTE: update the maximums above when adding a hash!
 
 /**
  * Checks if the given hash type number is valid.
@@ -65,16 +84,45 @@ int BHash_type_valid (int type);
  */
 int BHash_size (int type);
 
+/**
+ * Checks if a hash is keyed.
+ * 
+ * @param type hash type number. Must be valid.
+ * @return 1 if keyed, 0 if not
+ */
+int BHash_type_keyed (int type);
+
+/**
+ * Returns the key size of a keyed hash.
+ * 
+ * @param type hash type number. Must be valid and keyed.
+ * @return key size in bytes
+ */
+int BHash_key_size (int type);
+
 /**
  * Calculates a hash.
  * {@link BSecurity_GlobalInitThreadSafe} must have been done if this is
  * being called from a non-main thread.
  * 
- * @param type hash type number. Must be valid.
+ * @param type hash type number. Must be valid and not keyed.
  * @param data data to calculate the hash of
  * @param data_len length of data
  * @param out the hash will be written here. Must not overlap with data.
  */
 void BHash_calculate (int type, uint8_t *data, int data_len, uint8_t *out);
 
+/**
+ * Calculates a keyed hash.
+ * {@link BSecurity_GlobalInitThreadSafe} must have been done if this is
+ * being called from a non-main thread.
+ * 
+ * @param type hash type number. Must be valid and keyed.
+ * @param key key, {@link BHash_key_size} bytes
+ * @param data data to calculate the hash of
+ * @param data_len length of data
+ * @param out the hash will be written here. Must not overlap with data.
+ */
+void BHash_calculate_keyed (int type, const uint8_t *key, uint8_t *data, int data_len, uint8_t *out);
+
 #endif
@@ -29,14 +29,65 @@
 
 #include <openssl/rand.h>
 
+#ifndef BADVPN_USE_WINAPI
+#include <pthread.h>
+#endif
+
 #include <misc/debug.h>
+#include <misc/bthreadlocal.h>
+#include <misc/chacha_drbg.h>
 
 #include <security/BRandom.h>
 
+static BTHREADLOCAL struct chacha_drbg brandom_drbg;
+static BTHREADLOCAL int brandom_drbg_initialized;
+static BTHREADLOCAL unsigned int brandom_drbg_fork_gen;
+
+#ifndef BADVPN_USE_WINAPI
+static pthread_once_t brandom_atfork_once = PTHREAD_ONCE_INIT;
+static volatile unsigned int brandom_fork_gen;
+
+static void atfork_child (void)
+{
+    brandom_fork_gen++;
+}
+
+static void register_atfork (void)
+{
+    ASSERT_FORCE(pthread_atfork(NULL, NULL, atfork_child) == 0)
+}
+#endif
+
 void BRandom_randomize (uint8_t *buf, int len)
 {
     ASSERT(len >= 0)
     
     DEBUG_ZERO_MEMORY(buf, len)
-    ASSERT_FORCE(RAND_bytes(buf, len) == 1)
+    
+    struct chacha_drbg *d = &brandom_drbg;
+    
+    if (!brandom_drbg_initialized) {
+#ifndef BADVPN_USE_WINAPI
+        ASSERT_FORCE(pthread_once(&brandom_atfork_once, register_atfork) == 0)
+#endif
+        chacha_drbg_init(d);
+        brandom_drbg_initialized = 1;
+    }
+    
+    // reseed periodically, and after a fork so the child doesn't repeat the parent
+    int forked = 0;
+#ifndef BADVPN_USE_WINAPI
+    forked = (brandom_drbg_fork_gen != brandom_fork_gen);
+#endif
+    if (chacha_drbg_needs_reseed(d) || forked) {
+        uint8_t seed[CHACHA_DRBG_SEED_LEN];
+        ASSERT_FORCE(RAND_bytes(seed, sizeof(seed)) == 1)
+        chacha_drbg_seed(d, seed);
+        memset(seed, 0, sizeof(seed));
+#ifndef BADVPN_USE_WINAPI
+        brandom_drbg_fork_gen = brandom_fork_gen;
+#endif
+    }
+    
+    chacha_drbg_generate(d, buf, len);
 }
@@ -29,6 +29,10 @@
  * @section DESCRIPTION
  * 
  * Random data generation function.
+ * 
+ * Data comes from a ChaCha20-based generator kept per thread, which is seeded
+ * from the OpenSSL random generator, and reseeded after generating
+ * CHACHA_DRBG_RESEED_BYTES bytes and in the child after a fork.
  */
 
 #ifndef BADVPN_SECURITY_BRANDOM_H
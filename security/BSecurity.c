@@ -29,11 +29,17 @@
 
 #include <stddef.h>
 
-#ifdef BADVPN_THREADWORK_USE_PTHREAD
-    #include <pthread.h>
+#include <openssl/crypto.h>
+#include <openssl/opensslv.h>
+
+// OpenSSL 1.1.0 and later do their own locking, and ignore the callbacks
+#if defined(BADVPN_THREADWORK_USE_PTHREAD) && OPENSSL_VERSION_NUMBER < 0x10100000L
+    #define BSECURITY_USE_LOCKS
 #endif
 
-#include <openssl/crypto.h>
+#ifdef BSECURITY_USE_LOCKS
+    #include <pthread.h>
+#endif
 
 #include <misc/debug.h>
 #include <misc/balloc.h>
@@ -42,12 +48,12 @@
 
 int bsecurity_initialized = 0;
 
-#ifdef BADVPN_THREADWORK_USE_PTHREAD
+#ifdef BSECURITY_USE_LOCKS
 pthread_mutex_t *bsecurity_locks;
 int bsecurity_num_locks;
 #endif
 
-#ifdef BADVPN_THREADWORK_USE_PTHREAD
+#ifdef BSECURITY_USE_LOCKS
 
 static unsigned long id_callback (void)
 {
@@ -75,7 +81,7 @@ int BSecurity_GlobalInitThreadSafe (void)
 {
     ASSERT(!bsecurity_initialized)
     
-    #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    #ifdef BSECURITY_USE_LOCKS
     
     // get number of locks
     int num_locks = CRYPTO_num_locks();
@@ -99,14 +105,14 @@ int BSecurity_GlobalInitThreadSafe (void)
     
     bsecurity_initialized = 1;
     
-    #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    #ifdef BSECURITY_USE_LOCKS
     CRYPTO_set_id_callback(id_callback);
     CRYPTO_set_locking_callback(locking_callback);
     #endif
     
     return 1;
     
-    #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    #ifdef BSECURITY_USE_LOCKS
 fail1:
     while (bsecurity_num_locks > 0) {
         ASSERT_FORCE(pthread_mutex_destroy(&bsecurity_locks[bsecurity_num_locks - 1]) == 0)
@@ -122,7 +128,7 @@ void BSecurity_GlobalFreeThreadSafe (void)
 {
     ASSERT(bsecurity_initialized)
     
-    #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    #ifdef BSECURITY_USE_LOCKS
     
     // remove callbacks
     CRYPTO_set_locking_callback(NULL);
@@ -37,6 +37,8 @@
 /**
  * Initializes thread safety for security functions.
  * Thread safety must not be initialized.
+ * With OpenSSL 1.1.0 or later, which is thread safe by itself, this only
+ * records that it was done.
  * 
  * @return 1 on success, 0 on failure
  */
@@ -30,9 +30,12 @@
 #include <limits.h>
 
 #include <misc/balloc.h>
+#include <misc/minmax.h>
 
 #include <security/OTPCalculator.h>
 
+#define OTPCALCULATOR_CHUNK_SIZE 4096
+
 int OTPCalculator_Init (OTPCalculator *calc, int num_otps, int cipher)
 {
     ASSERT(num_otps >= 0)
@@ -82,17 +85,18 @@ otp_t * OTPCalculator_Generate (OTPCalculator *calc, uint8_t *key, uint8_t *iv,
     uint8_t iv_work[BENCRYPTION_MAX_BLOCK_SIZE];
     memcpy(iv_work, iv, calc->block_size);
     
-    // create zero block
-    uint8_t zero[BENCRYPTION_MAX_BLOCK_SIZE];
-    memset(zero, 0, calc->block_size);
-    
     // init encryptor
     BEncryption encryptor;
     BEncryption_Init(&encryptor, BENCRYPTION_MODE_ENCRYPT, calc->cipher, key);
     
-    // encrypt zero blocks
-    for (size_t i = 0; i < calc->num_blocks; i++) {
-        BEncryption_Encrypt(&encryptor, zero, (uint8_t *)calc->data + i * calc->block_size, calc->block_size, iv_work);
+    // encrypt zero blocks in place, many blocks per call; CBC over zero
+    // blocks gives the same output as encrypting them one by one
+    size_t blocks_per_chunk = OTPCALCULATOR_CHUNK_SIZE / calc->block_size;
+    for (size_t i = 0; i < calc->num_blocks; i += blocks_per_chunk) {
+        size_t blocks = bmin_size(blocks_per_chunk, calc->num_blocks - i);
+        uint8_t *chunk = (uint8_t *)calc->data + i * calc->block_size;
+        memset(chunk, 0, blocks * calc->block_size);
+        BEncryption_Encrypt(&encryptor, chunk, chunk, blocks * calc->block_size, iv_work);
     }
     
     // free encryptor
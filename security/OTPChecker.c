@@ -33,44 +33,46 @@
 
 #include <security/OTPChecker.h>
 
+static int OTPChecker_Table_StartIndex (OTPChecker *mc, otp_t otp);
 static void OTPChecker_Table_Empty (OTPChecker *mc, struct OTPChecker_table *t);
 static void OTPChecker_Table_AddOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t otp);
 static void OTPChecker_Table_Generate (OTPChecker *mc, struct OTPChecker_table *t, OTPCalculator *calc, uint8_t *key, uint8_t *iv);
 static int OTPChecker_Table_CheckOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t otp);
 
+int OTPChecker_Table_StartIndex (OTPChecker *mc, otp_t otp)
+{
+    // OTPs are uniformly distributed, so scale instead of dividing
+    return ((uint64_t)otp * mc->num_entries) >> 32;
+}
+
 void OTPChecker_Table_Empty (OTPChecker *mc, struct OTPChecker_table *t)
 {
-    for (int i = 0; i < mc->num_entries; i++) {
-        t->entries[i].avail = -1;
-    }
+    memset(t->bits, 0, mc->num_bits * sizeof(t->bits[0]));
 }
 
 void OTPChecker_Table_AddOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t otp)
 {
     // calculate starting index
-    int start_index = otp % mc->num_entries;
+    int index = OTPChecker_Table_StartIndex(mc, otp);
     
     // try indexes starting with the base position
     for (int i = 0; i < mc->num_entries; i++) {
-        int index = bmodadd_int(start_index, i, mc->num_entries);
-        struct OTPChecker_entry *entry = &t->entries[index];
+        struct OTPChecker_bits *bits = &t->bits[index / 32];
+        uint32_t mask = (uint32_t)1 << (index % 32);
         
-        // if we find a free index, use it
-        if (entry->avail < 0) {
-            entry->otp = otp;
-            entry->avail = 1;
+        // if we find a free index, use it; repeated OTPs get
+        // an entry each, so they can be accepted as many times
+        if (!(bits->used & mask)) {
+            t->otps[index] = otp;
+            bits->used |= mask;
+            bits->avail |= mask;
             return;
         }
         
-        // if we find a used index with the same mac,
-        // use it by incrementing its count
-        if (entry->otp == otp) {
-            entry->avail++;
-            return;
-        }
+        index = bmodadd_int(index, 1, mc->num_entries);
     }
     
-    // will never add more macs than we can hold
+    // will never add more OTPs than we can hold
     ASSERT(0)
 }
 
@@ -91,26 +93,25 @@ void OTPChecker_Table_Generate (OTPChecker *mc, struct OTPChecker_table *t, OTPC
 int OTPChecker_Table_CheckOTP (OTPChecker *mc, struct OTPChecker_table *t, otp_t otp)
 {
     // calculate starting index
-    int start_index = otp % mc->num_entries;
+    int index = OTPChecker_Table_StartIndex(mc, otp);
     
     // try indexes starting with the base position
     for (int i = 0; i < mc->num_entries; i++) {
-        int index = bmodadd_int(start_index, i, mc->num_entries);
-        struct OTPChecker_entry *entry = &t->entries[index];
+        struct OTPChecker_bits *bits = &t->bits[index / 32];
+        uint32_t mask = (uint32_t)1 << (index % 32);
         
-        // if we find an empty entry, there is no such mac
-        if (entry->avail < 0) {
+        // if we find an empty entry, there is no such OTP left
+        if (!(bits->used & mask)) {
             return 0;
         }
         
-        // if we find a matching entry, check its count
-        if (entry->otp == otp) {
-            if (entry->avail > 0) {
-                entry->avail--;
-                return 1;
-            }
-            return 0;
+        // if we find a matching entry which was not accepted yet, accept it
+        if (t->otps[index] == otp && (bits->avail & mask)) {
+            bits->avail &= ~mask;
+            return 1;
         }
+        
+        index = bmodadd_int(index, 1, mc->num_entries);
     }
     
     // there are always empty slots
@@ -168,6 +169,7 @@ int OTPChecker_Init (OTPChecker *mc, int num_otps, int cipher, int num_tables, B
         goto fail0;
     }
     mc->num_entries = 2 * mc->num_otps;
+    mc->num_bits = bdivide_up(mc->num_entries, 32);
     
     // set no tables used
     mc->tables_used = 0;
@@ -183,15 +185,21 @@ int OTPChecker_Init (OTPChecker *mc, int num_otps, int cipher, int num_tables, B
         goto fail1;
     }
     
-    // allocate entries
-    if (!(mc->entries = (struct OTPChecker_entry *)BAllocArray2(mc->num_tables, mc->num_entries, sizeof(mc->entries[0])))) {
+    // allocate OTPs
+    if (!(mc->otps = (otp_t *)BAllocArray2(mc->num_tables, mc->num_entries, sizeof(mc->otps[0])))) {
         goto fail2;
     }
     
+    // allocate bits
+    if (!(mc->bits = (struct OTPChecker_bits *)BAllocArray2(mc->num_tables, mc->num_bits, sizeof(mc->bits[0])))) {
+        goto fail3;
+    }
+    
     // initialize tables
     for (int i = 0; i < mc->num_tables; i++) {
         struct OTPChecker_table *table = &mc->tables[i];
-        table->entries = mc->entries + (size_t)i * mc->num_entries;
+        table->otps = mc->otps + (size_t)i * mc->num_entries;
+        table->bits = mc->bits + (size_t)i * mc->num_bits;
         OTPChecker_Table_Empty(mc, table);
     }
     
@@ -201,6 +209,8 @@ int OTPChecker_Init (OTPChecker *mc, int num_otps, int cipher, int num_tables, B
     DebugObject_Init(&mc->d_obj);
     return 1;
     
+fail3:
+    BFree(mc->otps);
 fail2:
     BFree(mc->tables);
 fail1:
@@ -218,8 +228,11 @@ void OTPChecker_Free (OTPChecker *mc)
         BThreadWork_Free(&mc->tw);
     }
     
-    // free entries
-    BFree(mc->entries);
+    // free bits
+    BFree(mc->bits);
+    
+    // free OTPs
+    BFree(mc->otps);
     
     // free tables
     BFree(mc->tables);
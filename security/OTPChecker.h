@@ -43,14 +43,20 @@
 #include <base/DebugObject.h>
 #include <threadwork/BThreadWork.h>
 
-struct OTPChecker_entry {
-    otp_t otp;
-    int avail;
+/**
+ * Occupancy bits for 32 consecutive entries of a table.
+ * A bit in used is set if the entry holds an OTP, and a bit in avail
+ * is set if that OTP has not been accepted yet.
+ */
+struct OTPChecker_bits {
+    uint32_t used;
+    uint32_t avail;
 };
 
 struct OTPChecker_table {
     uint16_t id;
-    struct OTPChecker_entry *entries;
+    otp_t *otps;
+    struct OTPChecker_bits *bits;
 };
 
 /**
@@ -71,12 +77,14 @@ typedef struct {
     int num_otps;
     int cipher;
     int num_entries;
+    int num_bits;
     int num_tables;
     int tables_used;
     int next_table;
     OTPCalculator calc;
     struct OTPChecker_table *tables;
-    struct OTPChecker_entry *entries;
+    otp_t *otps;
+    struct OTPChecker_bits *bits;
     int tw_have;
     BThreadWork tw;
     uint8_t tw_key[BENCRYPTION_MAX_KEY_SIZE];
@@ -36,6 +36,24 @@ static void work_func (OTPGenerator *g)
     g->otps[!g->cur_calc] = OTPCalculator_Generate(&g->calc[!g->cur_calc], g->tw_key, g->tw_iv, 1);
 }
 
+static void use_next (OTPGenerator *g)
+{
+    ASSERT(!g->tw_have)
+    ASSERT(g->next_ready)
+    ASSERT(g->next_wanted)
+    
+    g->next_ready = 0;
+    g->next_wanted = 0;
+    
+    // use new OTPs
+    g->cur_calc = !g->cur_calc;
+    g->position = 0;
+    
+    // call handler
+    g->handler(g->user);
+    return;
+}
+
 static void work_done_handler (OTPGenerator *g)
 {
     ASSERT(g->tw_have)
@@ -45,16 +63,55 @@ static void work_done_handler (OTPGenerator *g)
     BThreadWork_Free(&g->tw);
     g->tw_have = 0;
     
-    // use new OTPs
-    g->cur_calc = !g->cur_calc;
-    g->position = 0;
+    // new OTPs are ready
+    g->next_ready = 1;
     
-    // call handler
-    g->handler(g->user);
+    // use them if the seed was set, rather than just prepared
+    if (g->next_wanted) {
+        use_next(g);
+        return;
+    }
+}
+
+static void switch_job_handler (OTPGenerator *g)
+{
+    DebugObject_Access(&g->d_obj);
+    
+    use_next(g);
     return;
 }
 
-int OTPGenerator_Init (OTPGenerator *g, int num_otps, int cipher, BThreadWorkDispatcher *twd, OTPGenerator_handler handler, void *user)
+static void forget_next (OTPGenerator *g)
+{
+    // free existing work
+    if (g->tw_have) {
+        BThreadWork_Free(&g->tw);
+        g->tw_have = 0;
+    }
+    
+    // forget OTPs which are ready
+    g->next_ready = 0;
+    g->next_wanted = 0;
+    BPending_Unset(&g->switch_job);
+}
+
+static void start_next (OTPGenerator *g, uint8_t *key, uint8_t *iv)
+{
+    ASSERT(!g->tw_have)
+    ASSERT(!g->next_ready)
+    
+    // copy key and IV
+    memcpy(g->tw_key, key, BEncryption_cipher_key_size(g->cipher));
+    memcpy(g->tw_iv, iv, BEncryption_cipher_block_size(g->cipher));
+    
+    // start work
+    BThreadWork_Init(&g->tw, g->twd, (BThreadWork_handler_done)work_done_handler, g, (BThreadWork_work_func)work_func, g);
+    
+    // set have work
+    g->tw_have = 1;
+}
+
+int OTPGenerator_Init (OTPGenerator *g, int num_otps, int cipher, BPendingGroup *pg, BThreadWorkDispatcher *twd, OTPGenerator_handler handler, void *user)
 {
     ASSERT(num_otps >= 0)
     ASSERT(BEncryption_cipher_valid(cipher))
@@ -85,6 +142,13 @@ int OTPGenerator_Init (OTPGenerator *g, int num_otps, int cipher, BThreadWorkDis
     // have no work
     g->tw_have = 0;
     
+    // have no next OTPs
+    g->next_ready = 0;
+    g->next_wanted = 0;
+    
+    // init switch job
+    BPending_Init(&g->switch_job, pg, (BPending_handler)switch_job_handler, g);
+    
     DebugObject_Init(&g->d_obj);
     return 1;
     
@@ -98,6 +162,9 @@ void OTPGenerator_Free (OTPGenerator *g)
 {
     DebugObject_Free(&g->d_obj);
     
+    // free switch job
+    BPending_Free(&g->switch_job);
+    
     // free work
     if (g->tw_have) {
         BThreadWork_Free(&g->tw);
@@ -114,20 +181,28 @@ void OTPGenerator_SetSeed (OTPGenerator *g, uint8_t *key, uint8_t *iv)
 {
     DebugObject_Access(&g->d_obj);
     
-    // free existing work
-    if (g->tw_have) {
-        BThreadWork_Free(&g->tw);
+    // generate OTPs, unless the seed has been prepared
+    int prepared = (g->tw_have || g->next_ready) &&
+        !memcmp(g->tw_key, key, BEncryption_cipher_key_size(g->cipher)) &&
+        !memcmp(g->tw_iv, iv, BEncryption_cipher_block_size(g->cipher));
+    if (!prepared) {
+        forget_next(g);
+        start_next(g, key, iv);
     }
     
-    // copy key and IV
-    memcpy(g->tw_key, key, BEncryption_cipher_key_size(g->cipher));
-    memcpy(g->tw_iv, iv, BEncryption_cipher_block_size(g->cipher));
-    
-    // start work
-    BThreadWork_Init(&g->tw, g->twd, (BThreadWork_handler_done)work_done_handler, g, (BThreadWork_work_func)work_func, g);
+    // use the OTPs once they are ready
+    g->next_wanted = 1;
+    if (g->next_ready) {
+        BPending_Set(&g->switch_job);
+    }
+}
+
+void OTPGenerator_PrepareSeed (OTPGenerator *g, uint8_t *key, uint8_t *iv)
+{
+    DebugObject_Access(&g->d_obj);
     
-    // set have work
-    g->tw_have = 1;
+    forget_next(g);
+    start_next(g, key, iv);
 }
 
 int OTPGenerator_GetPosition (OTPGenerator *g)
@@ -141,11 +216,8 @@ void OTPGenerator_Reset (OTPGenerator *g)
 {
     DebugObject_Access(&g->d_obj);
     
-    // free existing work
-    if (g->tw_have) {
-        BThreadWork_Free(&g->tw);
-        g->tw_have = 0;
-    }
+    // forget new OTPs
+    forget_next(g);
     
     g->position = g->num_otps;
 }
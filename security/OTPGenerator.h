@@ -37,6 +37,7 @@
 #include <misc/debug.h>
 #include <security/OTPCalculator.h>
 #include <base/DebugObject.h>
+#include <base/BPending.h>
 #include <threadwork/BThreadWork.h>
 
 /**
@@ -49,6 +50,11 @@ typedef void (*OTPGenerator_handler) (void *user);
 
 /**
  * Object which generates OTPs for use in sending packets.
+ * 
+ * OTPs for the next seed are generated in a second buffer while the current
+ * seed is in use, so that a seed can be prepared with
+ * {@link OTPGenerator_PrepareSeed} before it is known whether and when it
+ * will be used, and switched to without delay by {@link OTPGenerator_SetSeed}.
  */
 typedef struct {
     int num_otps;
@@ -64,6 +70,9 @@ typedef struct {
     BThreadWork tw;
     uint8_t tw_key[BENCRYPTION_MAX_KEY_SIZE];
     uint8_t tw_iv[BENCRYPTION_MAX_BLOCK_SIZE];
+    int next_ready;
+    int next_wanted;
+    BPending switch_job;
     DebugObject d_obj;
 } OTPGenerator;
 
@@ -72,22 +81,23 @@ typedef struct {
  * The object is initialized with number of used OTPs = num_otps.
  * {@link BSecurity_GlobalInitThreadSafe} must have been done if
  * {@link BThreadWorkDispatcher_UsingThreads}(twd) = 1.
- *
+ * 
  * @param g the object
  * @param num_otps number of OTPs to generate from a seed. Must be >=0.
  * @param cipher encryption cipher for calculating the OTPs. Must be valid
  *               according to {@link BEncryption_cipher_valid}.
+ * @param pg pending group
  * @param twd thread work dispatcher
  * @param handler handler to call when generation of new OTPs is complete,
  *                after {@link OTPGenerator_SetSeed} was called.
  * @param user argument to handler
  * @return 1 on success, 0 on failure
  */
-int OTPGenerator_Init (OTPGenerator *g, int num_otps, int cipher, BThreadWorkDispatcher *twd, OTPGenerator_handler handler, void *user) WARN_UNUSED;
+int OTPGenerator_Init (OTPGenerator *g, int num_otps, int cipher, BPendingGroup *pg, BThreadWorkDispatcher *twd, OTPGenerator_handler handler, void *user) WARN_UNUSED;
 
 /**
  * Frees the generator.
- *
+ * 
  * @param g the object
  */
 void OTPGenerator_Free (OTPGenerator *g);
@@ -96,20 +106,34 @@ void OTPGenerator_Free (OTPGenerator *g);
  * Starts generating OTPs for a seed.
  * When generation is complete and the new OTPs may be used, the {@link OTPGenerator_handler}
  * handler will be called.
- * If OTPs are still being generated for a previous seed, it will be forgotten.
+ * If OTPs are still being generated for a previous seed, it will be forgotten,
+ * unless it is the same seed, as prepared with {@link OTPGenerator_PrepareSeed};
+ * then its OTPs are used as soon as they are ready, which may be right away.
  * This call by itself does not affect the OTP position; rather the position is set to zero
  * before the handler is called.
- *
+ * 
  * @param g the object
  * @param key encryption key
  * @param iv initialization vector
  */
 void OTPGenerator_SetSeed (OTPGenerator *g, uint8_t *key, uint8_t *iv);
 
+/**
+ * Starts generating OTPs for a seed which is expected to be set with
+ * {@link OTPGenerator_SetSeed} later, while the current OTPs stay in use.
+ * If OTPs are still being generated or ready for a previous seed which has not
+ * been set, they will be forgotten.
+ * 
+ * @param g the object
+ * @param key encryption key
+ * @param iv initialization vector
+ */
+void OTPGenerator_PrepareSeed (OTPGenerator *g, uint8_t *key, uint8_t *iv);
+
 /**
  * Returns the number of OTPs used up from the current seed so far.
  * If there is no seed yet, returns num_otps.
- *
+ * 
  * @param g the object
  * @return number of used OTPs
  */
@@ -117,7 +141,7 @@ int OTPGenerator_GetPosition (OTPGenerator *g);
 
 /**
  * Sets the number of used OTPs to num_otps.
- *
+ * 
  * @param g the object
  */
 void OTPGenerator_Reset (OTPGenerator *g);
@@ -126,7 +150,7 @@ void OTPGenerator_Reset (OTPGenerator *g);
  * Generates a single OTP.
  * The number of used OTPs must be < num_otps.
  * The number of used OTPs is incremented.
- *
+ * 
  * @param g the object
  */
 otp_t OTPGenerator_GetOTP (OTPGenerator *g);
@@ -55,13 +55,17 @@
 #include <misc/open_standard_streams.h>
 #include <misc/compare.h>
 #include <misc/bsize.h>
+#include <misc/strdup.h>
+#include <misc/balloc.h>
 #include <predicate/BPredicate.h>
 #include <base/DebugObject.h>
 #include <base/BLog.h>
 #include <system/BSignal.h>
 #include <system/BTime.h>
 #include <system/BNetwork.h>
+#include <system/BCpuSet.h>
 #include <security/BRandom.h>
+#include <security/BHash.h>
 #include <nspr_support/DummyPRFileDesc.h>
 #include <threadwork/BThreadWork.h>
 
@@ -90,6 +94,11 @@ struct {
     int threads;
     int use_threads_for_ssl_handshake;
     int use_threads_for_ssl_data;
+    #ifndef BADVPN_USE_WINAPI
+    int client_threads;
+    #endif
+    BCpuSet cpu_affinity;
+    BCpuSet worker_cpus;
     int ssl;
     char *nssdb;
     char *server_cert_name;
@@ -97,8 +106,24 @@ struct {
     int num_listen_addrs;
     char *comm_predicate;
     char *relay_predicate;
+    struct {
+        char *predicate;
+        int rate;
+        int burst;
+        int weight;
+    } client_classes[MAX_CLIENT_CLASSES];
+    int num_client_classes;
     int client_socket_sndbuf;
+    int client_send_coalesce;
+    struct BConnection_options client_socket_options;
     int max_clients;
+    int stall_threshold;
+    int job_budget;
+    int cluster_nodes;
+    int cluster_node_id;
+    char *cluster_listen_addr;
+    char *cluster_peer_addrs[CLUSTER_MAX_NODES];
+    int num_cluster_peer_addrs;
 } options;
 
 // listen addresses
@@ -115,10 +140,11 @@ BPredicateFunction comm_predicate_func_p1addr;
 BPredicateFunction comm_predicate_func_p2addr;
 
 // variables when evaluating the predicate, adjusted before every evaluation
-const char *comm_predicate_p1name;
-const char *comm_predicate_p2name;
-BIPAddr comm_predicate_p1addr;
-BIPAddr comm_predicate_p2addr;
+struct predicate_class *comm_predicate_p1class;
+struct predicate_class *comm_predicate_p2class;
+
+// results of the predicate by pairs of predicate classes
+struct predicate_cache_entry comm_predicate_cache[PREDICATE_CACHE_SIZE];
 
 // relay predicate
 BPredicate relay_predicate;
@@ -130,10 +156,29 @@ BPredicateFunction relay_predicate_func_paddr;
 BPredicateFunction relay_predicate_func_raddr;
 
 // variables when evaluating the comm_predicate, adjusted before every evaluation
-const char *relay_predicate_pname;
-const char *relay_predicate_rname;
-BIPAddr relay_predicate_paddr;
-BIPAddr relay_predicate_raddr;
+struct predicate_class *relay_predicate_pclass;
+struct predicate_class *relay_predicate_rclass;
+
+// results of the predicate by pairs of predicate classes
+struct predicate_cache_entry relay_predicate_cache[PREDICATE_CACHE_SIZE];
+
+// client classes, the first one whose predicate matches applies
+struct client_class client_classes[MAX_CLIENT_CLASSES];
+int num_client_classes;
+
+// whether some client class limits the rate
+int client_classes_limit_rate;
+
+// variable when evaluating a client class predicate, adjusted before every evaluation
+struct predicate_class *client_class_pclass;
+
+// predicate classes of clients, by common name and address
+BAVL predicate_classes_tree;
+uint64_t predicate_next_class_id;
+
+// string arguments of predicate functions seen so far, by pointer
+BAVL predicate_args_tree;
+int predicate_num_attrs;
 
 // i/o system
 BReactor ss;
@@ -158,8 +203,10 @@ int num_listeners;
 // number of connected clients
 int clients_num;
 
-// ID assigned to last connected client
-peerid_t clients_nextid;
+// range of IDs for our clients, and offset of the ID to try next
+int clients_id_base;
+int clients_id_count;
+int clients_nextid;
 
 // clients list
 LinkedList1 clients;
@@ -167,6 +214,27 @@ LinkedList1 clients;
 // clients tree (by ID)
 BAVL clients_tree;
 
+#ifndef BADVPN_USE_WINAPI
+// threads running client connections, if options.client_threads > 0
+BReactorGroup client_thread_group;
+struct client_thread client_threads[MAX_CLIENT_THREADS];
+
+// mailbox of the main thread, for messages from client threads
+BReactorMailbox main_mailbox;
+#endif
+
+// cluster listen address and listener, if any
+BAddr cluster_listen_addr;
+int have_cluster_listener;
+BListener cluster_listener;
+
+// other servers of the cluster which we connect to
+struct cluster_peer cluster_peers[CLUSTER_MAX_NODES];
+int num_cluster_peers;
+
+// links to other servers of the cluster
+LinkedList1 cluster_links;
+
 // prints help text to standard output
 static void print_help (const char *name);
 
@@ -198,6 +266,31 @@ static int client_init_io (struct client_data *client);
 // deallocates the I/O portion of the client. Must have no outgoing flows.
 static void client_dealloc_io (struct client_data *client);
 
+// initializes the connection interfaces and SSL. Called in the thread
+// running the connection.
+static int client_init_link (struct client_data *client);
+
+// frees the connection interfaces and SSL. Called in the thread running
+// the connection.
+static void client_free_link (struct client_data *client);
+
+// initializes the decoder and sender of the connection. Called in the
+// thread running the connection.
+static int client_init_link_io (struct client_data *client, PacketPassInterface *input_if);
+
+// frees the decoder and sender of the connection. Called in the thread
+// running the connection.
+static void client_free_link_io (struct client_data *client);
+
+// called in the thread running the connection when it is ready for packets
+static void client_link_up (struct client_data *client);
+
+// called in the thread running the connection when it has failed
+static void client_link_error (struct client_data *client);
+
+// initializes the I/O portion of the client once the connection is ready
+static void client_start_io (struct client_data *client);
+
 // removes a client
 static void client_remove (struct client_data *client);
 
@@ -210,9 +303,19 @@ static void client_logfunc (struct client_data *client);
 // passes a message to the logger, prepending about the client
 static void client_log (struct client_data *client, int level, const char *fmt, ...);
 
+// appends client log prefix, in the thread running the connection
+static void client_link_logfunc (struct client_data *client);
+
+// passes a message to the logger, prepending about the client, in the
+// thread running the connection
+static void client_link_log (struct client_data *client, int level, const char *fmt, ...);
+
 // client activity timer handler. Removes the client.
 static void client_disconnect_timer_handler (struct client_data *client);
 
+// endclients queue timer handler. Sends the queued endclients.
+static void client_endclients_timer_handler (struct client_data *client);
+
 // BConnection handler
 static void client_connection_handler (struct client_data *client, int event);
 
@@ -222,6 +325,50 @@ static void client_sslcon_handler (struct client_data *client, int event);
 // decoder handler
 static void client_decoder_handler_error (struct client_data *client);
 
+// passes a packet for a remote client to the link to its server
+static void client_cluster_output_handler_send (struct client_data *client, uint8_t *data, int data_len);
+
+// called when the link has taken a packet for a remote client
+static void client_cluster_output_handler_done (struct client_data *client);
+
+// called when the output of a removed remote client is no longer in use
+static void client_cluster_qflow_handler_busy (struct client_data *client);
+static void client_cluster_publish_job (struct client_data *client);
+
+// forwards a packet from a client concerning a remote client to the server
+// synchronizing the pair, if that is not us. Returns 1 if forwarded.
+static int client_forward_to_cluster (struct client_data *client, uint8_t type, uint8_t *data, int data_len);
+
+#ifndef BADVPN_USE_WINAPI
+// starts the client threads
+static int init_client_threads (void);
+
+// stops the client threads, freeing the connections running in them
+static void free_client_threads (void);
+
+// client thread handlers
+static void client_thread_start_handler (void *unused, int index, BReactor *reactor);
+static void client_thread_stop_handler (void *unused, int index, BReactor *reactor);
+
+// initializes the client thread's side of the pipes and the decoder and sender
+static int client_init_thread_io (struct client_data *client);
+
+// frees the client thread's side of the pipes and the decoder and sender
+static void client_free_thread_io (struct client_data *client);
+
+// frees everything of the client in the client thread
+static void client_free_thread_link (struct client_data *client);
+
+// messages handled in the client thread
+static void client_link_start_msg_handler (struct client_data *client);
+static void client_link_stop_msg_handler (struct client_data *client);
+
+// messages handled in the main thread
+static void client_link_up_msg_handler (struct client_data *client);
+static void client_link_error_msg_handler (struct client_data *client);
+static void client_link_stopped_msg_handler (struct client_data *client);
+#endif
+
 // provides a buffer for sending a control packet to the client
 static int client_start_control_packet (struct client_data *client, void **data, int len);
 
@@ -234,14 +381,22 @@ static int client_send_newclient (struct client_data *client, struct client_data
 // sends an endclient message to a client
 static int client_send_endclient (struct client_data *client, peerid_t end_id);
 
+// sends an endclients message with multiple peers to a client
+static int client_send_endclients (struct client_data *client, const peerid_t *end_ids, int num_ids);
+
+// sends the queued endclients, if any
+static int client_flush_endclients (struct client_data *client);
+
 // handler for packets received from the client
 static void client_input_handler_send (struct client_data *client, uint8_t *data, int data_len);
 
 // processes hello packets from clients
 static void process_packet_hello (struct client_data *client, uint8_t *data, int data_len);
 
-// processes outmsg packets from clients
-static void process_packet_outmsg (struct client_data *client, uint8_t *data, int data_len);
+// processes outmsg packets from clients. If the packet is being sent by a decoder
+// in this thread, it is passed as decoder, so that the payload can be referenced
+// instead of copied.
+static void process_packet_outmsg (struct client_data *client, uint8_t *data, int data_len, PacketProtoDecoder *decoder);
 
 // processes resetpeer packets from clients
 static void process_packet_resetpeer (struct client_data *client, uint8_t *data, int data_len);
@@ -249,6 +404,13 @@ static void process_packet_resetpeer (struct client_data *client, uint8_t *data,
 // processes acceptpeer packets from clients
 static void process_packet_acceptpeer (struct client_data *client, uint8_t *data, int data_len);
 
+// processes getcert packets from clients
+static void process_packet_getcert (struct client_data *client, uint8_t *data, int data_len);
+
+// creates flows and knows between a client which has become ready and the
+// clients we synchronize it with. Returns 0 if the client was removed.
+static int client_publish (struct client_data *client);
+
 // creates a peer flow
 static struct peer_flow * peer_flow_create (struct client_data *src_client, struct client_data *dest_client);
 
@@ -261,11 +423,17 @@ static void peer_flow_free_io (struct peer_flow *flow);
 // disconnects the source client from a peer flow
 static void peer_flow_disconnect (struct peer_flow *flow);
 
-// provides a buffer for sending a peer-to-peer packet
-static int peer_flow_start_packet (struct peer_flow *flow, void **data, int len);
+// queues a message from the source client for sending. Returns 0 if out of buffer.
+static int peer_flow_send_message (struct peer_flow *flow, const uint8_t *payload, int payload_len, PacketProtoDecoder *decoder);
 
-// submits a peer-to-peer packet written after peer_flow_start_packet
-static void peer_flow_end_packet (struct peer_flow *flow, uint8_t type);
+// sends the first queued packet to the queue flow
+static void peer_flow_send_next (struct peer_flow *flow);
+
+// removes the first queued packet, releasing its memory
+static void peer_flow_release_packet (struct peer_flow *flow);
+
+// handler called by the queue flow when it is done with a packet
+static void peer_flow_qflow_handler_done (struct peer_flow *flow);
 
 // handler called by the queue when a peer flow can be freed after its source has gone away
 static void peer_flow_handler_canremove (struct peer_flow *flow);
@@ -284,6 +452,30 @@ static peerid_t new_client_id (void);
 // finds a client by its ID
 static struct client_data * find_client_by_id (peerid_t id);
 
+// returns the predicate class for a common name and address, with a reference
+// taken, or NULL on allocation failure
+static struct predicate_class * predicate_class_get (const char *name, BIPAddr addr);
+
+// releases a reference to a predicate class
+static void predicate_class_unref (struct predicate_class *c);
+
+// comparator for predicate classes used in AVL tree
+static int predicate_class_comparator (void *unused, struct predicate_class *c1, struct predicate_class *c2);
+
+// evaluates a name (is_addr=0) or address (is_addr=1) predicate function
+// for a predicate class. Remembers the result in the class.
+static int predicate_class_test (struct predicate_class *c, char *str, int is_addr);
+
+// returns the entry for a predicate function argument, parsing it the first
+// time it is seen, or NULL on allocation failure
+static struct predicate_arg * predicate_get_arg (char *str, int is_addr);
+
+// comparator for predicate arguments used in AVL tree
+static int predicate_arg_comparator (void *unused, struct predicate_arg *a1, struct predicate_arg *a2);
+
+// returns the cache entry slot for an ordered pair of predicate classes
+static struct predicate_cache_entry * predicate_cache_slot (struct predicate_cache_entry *cache, struct predicate_class *c1, struct predicate_class *c2);
+
 // checks if two clients are allowed to communicate. May depend on the order
 // of the clients.
 static int clients_allowed (struct client_data *client1, struct client_data *client2);
@@ -315,6 +507,21 @@ static int relay_predicate_func_paddr_cb (void *user, void **args);
 // relay predicate function raddr
 static int relay_predicate_func_raddr_cb (void *user, void **args);
 
+// initializes client classes from options
+static int init_client_classes (void);
+
+// frees client classes
+static void free_client_classes (void);
+
+// determines the client class of a client and applies it
+static void client_apply_class (struct client_data *client);
+
+// client class predicate function pname
+static int client_class_func_pname_cb (void *user, void **args);
+
+// client class predicate function paddr
+static int client_class_func_paddr_cb (void *user, void **args);
+
 // comparator for peerid_t used in AVL tree
 static int peerid_comparator (void *unused, peerid_t *p1, peerid_t *p2);
 
@@ -329,6 +536,102 @@ static int launch_pair (struct peer_flow *flow_to);
 // find flow from a client to some client
 static struct peer_flow * find_flow (struct client_data *client, peerid_t dest_id);
 
+// checks whether we synchronize a pair of clients, which we do unless one of
+// them is remote, and the other one is remote too or has a higher ID
+static int pair_is_local (struct client_data *client1, struct client_data *client2);
+
+// starts the cluster listener and connects to the other servers
+static int init_cluster (void);
+
+// allows freeing the outputs of remote clients, before freeing the clients
+static void cluster_prepare_free (void);
+
+// frees the cluster links, listener and peers, after freeing the clients
+static void free_cluster (void);
+
+static int cluster_compute_buffer_size (void);
+
+// cluster listener handler, accepts connections from other servers
+static void cluster_listener_handler (void *unused);
+
+// starts connecting to another server
+static void cluster_peer_connect (struct cluster_peer *peer);
+
+// connector and retry timer handlers for other servers we connect to
+static void cluster_peer_connector_handler (struct cluster_peer *peer, int is_error);
+static void cluster_peer_retry_timer_handler (struct cluster_peer *peer);
+
+// initializes a link to another server, from the connector of a peer or
+// from the listener
+static void cluster_link_init (struct cluster_peer *peer);
+
+// frees a link which has no remote clients and flows
+static void cluster_link_dealloc (struct cluster_link *link);
+
+// removes a link, with the remote clients of its server
+static void cluster_link_remove (struct cluster_link *link);
+
+// schedules removal of a link
+static void cluster_link_fail (struct cluster_link *link);
+static void cluster_link_fail_job (struct cluster_link *link);
+
+// appends link log prefix
+static void cluster_link_logfunc (struct cluster_link *link);
+
+// passes a message to the logger, prepending about the link
+static void cluster_link_log (struct cluster_link *link, int level, const char *fmt, ...);
+
+// link handlers
+static void cluster_link_connection_handler (struct cluster_link *link, int event);
+static void cluster_link_decoder_handler_error (struct cluster_link *link);
+static void cluster_link_keepalive_timer_handler (struct cluster_link *link);
+static void cluster_link_sync_timer_handler (struct cluster_link *link);
+static void cluster_link_no_data_timer_handler (struct cluster_link *link);
+
+// provides a buffer for sending a control packet to another server
+static int cluster_link_start_control_packet (struct cluster_link *link, void **data, int len);
+
+// submits a packet written after cluster_link_start_control_packet
+static void cluster_link_end_control_packet (struct cluster_link *link, uint8_t type);
+
+// sends packets to another server
+static int cluster_link_send_newclient (struct cluster_link *link, struct client_data *client);
+static int cluster_link_send_endclient (struct cluster_link *link, peerid_t id);
+static int cluster_link_send_resetpair (struct cluster_link *link, peerid_t src_id, peerid_t dest_id);
+static int cluster_link_send_kick (struct cluster_link *link, peerid_t id);
+
+// informs the other servers about a client which has become ready
+static int cluster_link_add_client (struct cluster_link *link, struct client_data *client);
+static void cluster_publish_client (struct client_data *client);
+
+// informs the other servers that a client is no more
+static void cluster_unpublish_client (struct client_data *client);
+static void cluster_forget_client (struct client_data *client);
+
+// handler for packets received from another server
+static void cluster_link_input_handler_send (struct cluster_link *link, uint8_t *data, int data_len);
+static void cluster_link_process_packet (struct cluster_link *link, uint8_t *data, int data_len);
+
+// process packets from other servers
+static void cluster_process_hello (struct cluster_link *link, uint8_t *data, int data_len);
+static void cluster_process_newclient (struct cluster_link *link, uint8_t *data, int data_len);
+static void cluster_process_endclient (struct cluster_link *link, uint8_t *data, int data_len);
+static void cluster_process_toclient (struct cluster_link *link, uint8_t *data, int data_len);
+static void cluster_process_fromclient (struct cluster_link *link, uint8_t *data, int data_len);
+static void cluster_process_resetpair (struct cluster_link *link, uint8_t *data, int data_len);
+static void cluster_process_kick (struct cluster_link *link, uint8_t *data, int data_len);
+
+// returns the flow delivering packets from a link to a client, creating
+// it if needed, or NULL on failure
+static int cluster_flow_init (struct cluster_link *link, struct client_data *client);
+static struct cluster_flow * cluster_flow_find (struct cluster_link *link, struct client_data *client);
+
+// deallocates a cluster flow
+static void cluster_flow_dealloc (struct cluster_flow *flow);
+
+// handler called by the queue when a cluster flow can be freed after its link has gone away
+static void cluster_flow_handler_canremove (struct cluster_flow *flow);
+
 int main (int argc, char *argv[])
 {
     if (argc <= 0) {
@@ -409,8 +712,9 @@ int main (int argc, char *argv[])
             goto fail02;
         }
         
-        // initialize server cache
-        if (SSL_ConfigServerSessionIDCache(0, 0, 0, NULL) != SECSuccess) {
+        // initialize server cache, with room for a session of every client, so that
+        // clients reconnecting all at once resume their sessions
+        if (SSL_ConfigServerSessionIDCache(options.max_clients, 0, 0, NULL) != SECSuccess) {
             BLog(BLOG_ERROR, "SSL_ConfigServerSessionIDCache failed (%d)", (int)PR_GetError());
             goto fail02;
         }
@@ -434,6 +738,11 @@ int main (int argc, char *argv[])
             BLog(BLOG_ERROR, "SSL_ConfigSecureServer failed");
             goto fail05;
         }
+        
+        // allow clients to resume sessions
+        if (!BSSLConnection_EnableResumption(model_prfd)) {
+            goto fail05;
+        }
     }
     
     // initialize network
@@ -448,6 +757,12 @@ int main (int argc, char *argv[])
         goto fail1;
     }
     
+    // init predicate classes and arguments
+    BAVL_Init(&predicate_classes_tree, OFFSET_DIFF(struct predicate_class, id, tree_node), (BAVL_comparator)predicate_class_comparator, NULL);
+    predicate_next_class_id = 1;
+    BAVL_Init(&predicate_args_tree, OFFSET_DIFF(struct predicate_arg, str, tree_node), (BAVL_comparator)predicate_arg_comparator, NULL);
+    predicate_num_attrs = 0;
+    
     // init communication predicate
     if (options.comm_predicate) {
         // init predicate
@@ -480,18 +795,32 @@ int main (int argc, char *argv[])
         BPredicateFunction_Init(&relay_predicate_func_raddr, &relay_predicate, "raddr", args, 1, relay_predicate_func_raddr_cb, NULL);
     }
     
+    // init client classes
+    if (!init_client_classes()) {
+        goto fail3;
+    }
+    
     // init time
     BTime_Init();
     
+    // bind to CPUs before allocating anything large, so that our memory
+    // is placed on their NUMA node; threads started later inherit this
+    if (!BCpuSet_IsEmpty(&options.cpu_affinity) && !BCpuSet_BindThread(&options.cpu_affinity)) {
+        BLog(BLOG_ERROR, "BCpuSet_BindThread failed");
+        goto fail3b;
+    }
+    
     // initialize reactor
     if (!BReactor_Init(&ss)) {
         BLog(BLOG_ERROR, "BReactor_Init failed");
-        goto fail3;
+        goto fail3b;
     }
+    BReactor_SetStallThreshold(&ss, options.stall_threshold);
+    BReactor_SetJobBudget(&ss, options.job_budget);
     
     // init thread work dispatcher
-    if (!BThreadWorkDispatcher_Init(&twd, &ss, options.threads)) {
-        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init failed");
+    if (!BThreadWorkDispatcher_Init2(&twd, &ss, options.threads, &options.worker_cpus)) {
+        BLog(BLOG_ERROR, "BThreadWorkDispatcher_Init2 failed");
         goto fail3a;
     }
     
@@ -504,7 +833,7 @@ int main (int argc, char *argv[])
     // initialize number of clients
     clients_num = 0;
     
-    // first client ID will be zero
+    // first client ID will be the first of our range
     clients_nextid = 0;
     
     // initialize clients linked list
@@ -516,17 +845,39 @@ int main (int argc, char *argv[])
     // initialize listeners
     num_listeners = 0;
     while (num_listeners < num_listen_addrs) {
-        if (!BListener_Init(&listeners[num_listeners], listen_addrs[num_listeners], &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
-            BLog(BLOG_ERROR, "BListener_Init failed");
+        if (!BListener_InitFrom2(&listeners[num_listeners], BLisCon_from_addr(listen_addrs[num_listeners]), BLISTENER_FLAG_DEFER_ACCEPT, &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
+            BLog(BLOG_ERROR, "BListener_InitFrom2 failed");
             goto fail10;
         }
         num_listeners++;
     }
     
+    // start the cluster
+    if (!init_cluster()) {
+        goto fail10;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    // start client threads
+    if (options.client_threads > 0 && !init_client_threads()) {
+        goto fail11;
+    }
+    #endif
+    
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
     
+    #ifndef BADVPN_USE_WINAPI
+    // stop client threads first; the rest of the clients is freed below
+    if (options.client_threads > 0) {
+        free_client_threads();
+    }
+    #endif
+    
+    // allow freeing the outputs of remote clients
+    cluster_prepare_free();
+    
     // free clients
     LinkedList1Node *node;
     while (node = LinkedList1_GetFirst(&clients)) {
@@ -562,6 +913,10 @@ int main (int argc, char *argv[])
         // deallocate client
         client_dealloc(client);
     }
+    #ifndef BADVPN_USE_WINAPI
+fail11:
+    #endif
+    free_cluster();
 fail10:
     while (num_listeners > 0) {
         num_listeners--;
@@ -573,6 +928,8 @@ fail4:
     BThreadWorkDispatcher_Free(&twd);
 fail3a:
     BReactor_Free(&ss);
+fail3b:
+    free_client_classes();
 fail3:
     if (options.relay_predicate) {
         BPredicateFunction_Free(&relay_predicate_func_raddr);
@@ -589,6 +946,13 @@ fail2:
         BPredicateFunction_Free(&comm_predicate_func_p1name);
         BPredicate_Free(&comm_predicate);
     }
+    ASSERT(BAVL_IsEmpty(&predicate_classes_tree))
+    BAVLNode *arg_node;
+    while (arg_node = BAVL_GetFirst(&predicate_args_tree)) {
+        struct predicate_arg *a = UPPER_OBJECT(arg_node, struct predicate_arg, tree_node);
+        BAVL_Remove(&predicate_args_tree, &a->tree_node);
+        free(a);
+    }
 fail1:
     if (options.ssl) {
 fail05:
@@ -631,12 +995,26 @@ void print_help (const char *name)
         "        [--threads <integer>]\n"
         "        [--use-threads-for-ssl-handshake]\n"
         "        [--use-threads-for-ssl-data]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--client-threads <number>]\n"
+        #endif
+        "        [--cpu-affinity <cpu-list>]\n"
+        "        [--worker-cpus <cpu-list>]\n"
         "        [--listen-addr <addr>] ...\n"
         "        [--ssl --nssdb <string> --server-cert-name <string>]\n"
         "        [--comm-predicate <string>]\n"
         "        [--relay-predicate <string>]\n"
+        "        [--client-class <string> <rate> <burst> <weight>] ...\n"
         "        [--client-socket-sndbuf <bytes / 0>]\n"
+        "        [--client-socket-options <options>]\n"
+        "        [--client-send-coalesce <bytes / 0>]\n"
         "        [--max-clients <number>]\n"
+        "        [--stall-threshold <ms>]\n"
+        "        [--job-budget <number>]\n"
+        "        [--cluster-nodes <number> --cluster-node-id <number>\n"
+        "            [--cluster-listen-addr <addr>]\n"
+        "            [--cluster-peer <addr>] ...\n"
+        "        ]\n"
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
@@ -663,14 +1041,28 @@ int parse_arguments (int argc, char *argv[])
     options.threads = 0;
     options.use_threads_for_ssl_handshake = 0;
     options.use_threads_for_ssl_data = 0;
+    #ifndef BADVPN_USE_WINAPI
+    options.client_threads = 0;
+    #endif
+    BCpuSet_Init(&options.cpu_affinity);
+    BCpuSet_Init(&options.worker_cpus);
     options.ssl = 0;
     options.nssdb = NULL;
     options.server_cert_name = NULL;
     options.num_listen_addrs = 0;
     options.comm_predicate = NULL;
     options.relay_predicate = NULL;
+    options.num_client_classes = 0;
     options.client_socket_sndbuf = CLIENT_DEFAULT_SOCKET_SNDBUF;
+    BConnection_options_Init(&options.client_socket_options);
+    options.client_send_coalesce = CLIENT_DEFAULT_SEND_COALESCE;
     options.max_clients = DEFAULT_MAX_CLIENTS;
+    options.stall_threshold = 0;
+    options.job_budget = 0;
+    options.cluster_nodes = 0;
+    options.cluster_node_id = -1;
+    options.cluster_listen_addr = NULL;
+    options.num_cluster_peer_addrs = 0;
     
     for (int i = 1; i < argc; i++) {
         char *arg = argv[i];
@@ -761,6 +1153,41 @@ int parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--use-threads-for-ssl-data")) {
             options.use_threads_for_ssl_data = 1;
         }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--client-threads")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.client_threads = atoi(argv[i + 1])) < 0 || options.client_threads > MAX_CLIENT_THREADS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--cpu-affinity")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BCpuSet_InitParse(&options.cpu_affinity, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--worker-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BCpuSet_InitParse(&options.worker_cpus, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--ssl")) {
             options.ssl = 1;
         }
@@ -809,6 +1236,29 @@ int parse_arguments (int argc, char *argv[])
             options.relay_predicate = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--client-class")) {
+            if (4 >= argc - i) {
+                fprintf(stderr, "%s: requires four arguments\n", arg);
+                return 0;
+            }
+            if (options.num_client_classes == MAX_CLIENT_CLASSES) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            int n = options.num_client_classes;
+            options.client_classes[n].predicate = argv[i + 1];
+            if ((options.client_classes[n].rate = atoi(argv[i + 2])) < 0 ||
+                (options.client_classes[n].burst = atoi(argv[i + 3])) < 0 ||
+                (options.client_classes[n].rate > 0 && options.client_classes[n].burst == 0) ||
+                (options.client_classes[n].weight = atoi(argv[i + 4])) < 1 ||
+                options.client_classes[n].weight > FAIRQUEUE_MAX_WEIGHT
+            ) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            options.num_client_classes++;
+            i += 4;
+        }
         else if (!strcmp(arg, "--client-socket-sndbuf")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -820,6 +1270,28 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--client-socket-options")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BConnection_options_Parse(&options.client_socket_options, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--client-send-coalesce")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.client_send_coalesce = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--max-clients")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -831,6 +1303,71 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--stall-threshold")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.stall_threshold = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--job-budget")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.job_budget = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--cluster-nodes")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.cluster_nodes = atoi(argv[i + 1])) <= 0 || options.cluster_nodes > CLUSTER_MAX_NODES) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--cluster-node-id")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.cluster_node_id = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--cluster-listen-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.cluster_listen_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--cluster-peer")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (options.num_cluster_peer_addrs == CLUSTER_MAX_NODES - 1) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            options.cluster_peer_addrs[options.num_cluster_peer_addrs] = argv[i + 1];
+            options.num_cluster_peer_addrs++;
+            i++;
+        }
         else {
             fprintf(stderr, "%s: unknown option\n", arg);
             return 0;
@@ -851,6 +1388,35 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
+    #ifndef BADVPN_USE_WINAPI
+    // SSL runs in the client threads already
+    if (options.client_threads > 0 && (options.use_threads_for_ssl_handshake || options.use_threads_for_ssl_data)) {
+        fprintf(stderr, "--client-threads cannot be used with --use-threads-for-ssl-handshake or --use-threads-for-ssl-data\n");
+        return 0;
+    }
+    #endif
+    
+    if ((options.cluster_nodes > 0) != (options.cluster_node_id >= 0)) {
+        fprintf(stderr, "--cluster-nodes and --cluster-node-id must be used together\n");
+        return 0;
+    }
+    
+    if (options.cluster_nodes > 0 && options.cluster_node_id >= options.cluster_nodes) {
+        fprintf(stderr, "--cluster-node-id must be less than --cluster-nodes\n");
+        return 0;
+    }
+    
+    if (options.cluster_nodes == 0 && (options.cluster_listen_addr || options.num_cluster_peer_addrs > 0)) {
+        fprintf(stderr, "--cluster-listen-addr and --cluster-peer require --cluster-nodes\n");
+        return 0;
+    }
+    
+    // each server gives its clients IDs from its own part of the ID space
+    if (options.cluster_nodes > 0 && options.max_clients > 65536 / options.cluster_nodes) {
+        fprintf(stderr, "--max-clients must be at most %d with --cluster-nodes %d\n", 65536 / options.cluster_nodes, options.cluster_nodes);
+        return 0;
+    }
+    
     return 1;
 }
 
@@ -866,6 +1432,29 @@ int process_arguments (void)
         num_listen_addrs++;
     }
     
+    // resolve cluster addresses
+    if (options.cluster_listen_addr && !BAddr_Parse(&cluster_listen_addr, options.cluster_listen_addr, NULL, 0)) {
+        BLog(BLOG_ERROR, "cluster listen addr: BAddr_Parse failed");
+        return 0;
+    }
+    num_cluster_peers = 0;
+    while (num_cluster_peers < options.num_cluster_peer_addrs) {
+        if (!BAddr_Parse(&cluster_peers[num_cluster_peers].addr, options.cluster_peer_addrs[num_cluster_peers], NULL, 0)) {
+            BLog(BLOG_ERROR, "cluster peer: BAddr_Parse failed");
+            return 0;
+        }
+        num_cluster_peers++;
+    }
+    
+    // determine the range of IDs for our clients
+    if (options.cluster_nodes > 0) {
+        clients_id_count = 65536 / options.cluster_nodes;
+        clients_id_base = options.cluster_node_id * clients_id_count;
+    } else {
+        clients_id_count = 65536;
+        clients_id_base = 0;
+    }
+    
     return 1;
 }
 
@@ -903,74 +1492,107 @@ void listener_handler (BListener *listener)
         goto fail0;
     }
     
-    // accept connection
-    if (!BConnection_Init(&client->con, BConnection_source_listener(listener, &client->addr), &ss, client, (BConnection_handler)client_connection_handler)) {
-        BLog(BLOG_ERROR, "BConnection_Init failed");
-        goto fail1;
-    }
+    // run the connection in the main thread, unless there are client threads
+    client->thread_index = -1;
+    client->link_reactor = &ss;
     
-    // limit socket send buffer, else our scheduling is pointless
-    if (options.client_socket_sndbuf > 0) {
-        if (!BConnection_SetSendBuffer(&client->con, options.client_socket_sndbuf)) {
-            BLog(BLOG_WARNING, "BConnection_SetSendBuffer failed");
-        }
-    }
+    // connected to us
+    client->remote = 0;
+    client->cluster_link = NULL;
+    client->cluster_kick = 0;
+    client->cluster_have_qflow = 0;
+    client->relay_weight = 1;
     
-    // assign ID
+    #ifndef BADVPN_USE_WINAPI
+    if (options.client_threads > 0) {
+        // pick the thread with the fewest clients
+        client->thread_index = 0;
+        for (int i = 1; i < options.client_threads; i++) {
+            if (client_threads[i].num_clients < client_threads[client->thread_index].num_clients) {
+                client->thread_index = i;
+            }
+        }
+        client->link_reactor = BReactorGroup_GetReactor(&client_thread_group, client->thread_index);
+        BReactorMailbox *thread_mailbox = BReactorGroup_GetMailbox(&client_thread_group, client->thread_index);
+        
+        // init pipes between the threads
+        if (!PacketPassThreadPipe_Init(&client->input_pipe, SC_MAX_ENC, CLIENT_INPUT_PIPE_PACKETS, thread_mailbox, &main_mailbox)) {
+            BLog(BLOG_ERROR, "PacketPassThreadPipe_Init failed");
+            goto fail1;
+        }
+        if (!PacketPassThreadPipe_Init(&client->output_pipe, PACKETPROTO_ENCLEN(SC_MAX_ENC), CLIENT_OUTPUT_PIPE_PACKETS, &main_mailbox, thread_mailbox)) {
+            BLog(BLOG_ERROR, "PacketPassThreadPipe_Init failed");
+            goto fail1a;
+        }
+        
+        // init messages
+        BReactorMailboxMessage_Init(&client->link_start_msg, (BReactorMailboxMessage_handler)client_link_start_msg_handler, client);
+        BReactorMailboxMessage_Init(&client->link_stop_msg, (BReactorMailboxMessage_handler)client_link_stop_msg_handler, client);
+        BReactorMailboxMessage_Init(&client->link_up_msg, (BReactorMailboxMessage_handler)client_link_up_msg_handler, client);
+        BReactorMailboxMessage_Init(&client->link_error_msg, (BReactorMailboxMessage_handler)client_link_error_msg_handler, client);
+        BReactorMailboxMessage_Init(&client->link_stopped_msg, (BReactorMailboxMessage_handler)client_link_stopped_msg_handler, client);
+    }
+    #endif
+    
+    // accept connection
+    if (!BConnection_Init(&client->con, BConnection_source_listener(listener, &client->addr), &ss, client, (BConnection_handler)client_connection_handler)) {
+        BLog(BLOG_ERROR, "BConnection_Init failed");
+        goto fail1b;
+    }
+    
+    // limit socket send buffer, else our scheduling is pointless
+    if (options.client_socket_sndbuf > 0) {
+        if (!BConnection_SetSendBuffer(&client->con, options.client_socket_sndbuf)) {
+            BLog(BLOG_WARNING, "BConnection_SetSendBuffer failed");
+        }
+    }
+    
+    // apply socket options
+    if (!BConnection_SetOptions(&client->con, &options.client_socket_options)) {
+        BLog(BLOG_WARNING, "BConnection_SetOptions failed");
+    }
+    
+    // assign ID
     client->id = new_client_id();
     
     // set no common name
     client->common_name = NULL;
     
-    // now client_log() works
+    // no predicate class yet
+    client->pred_class = NULL;
     
-    // init connection interfaces
-    BConnection_SendAsync_Init(&client->con);
-    BConnection_RecvAsync_Init(&client->con);
+    // now client_log() works
     
-    if (options.ssl) {
-        // create bottom NSPR file descriptor
-        if (!BSSLConnection_MakeBackend(&client->bottom_prfd, BConnection_SendAsync_GetIf(&client->con), BConnection_RecvAsync_GetIf(&client->con), &twd, ssl_flags())) {
-            client_log(client, BLOG_ERROR, "BSSLConnection_MakeBackend failed");
-            goto fail2;
-        }
-        
-        // create SSL file descriptor from the bottom NSPR file descriptor
-        if (!(client->ssl_prfd = SSL_ImportFD(model_prfd, &client->bottom_prfd))) {
-            client_log(client, BLOG_ERROR, "SSL_ImportFD failed");
-            ASSERT_FORCE(PR_Close(&client->bottom_prfd) == PR_SUCCESS)
+    if (client->thread_index < 0) {
+        // init connection interfaces and SSL
+        if (!client_init_link(client)) {
             goto fail2;
         }
         
-        // set server mode
-        if (SSL_ResetHandshake(client->ssl_prfd, PR_TRUE) != SECSuccess) {
-            client_log(client, BLOG_ERROR, "SSL_ResetHandshake failed");
-            goto fail3;
-        }
-        
-        // set require client certificate
-        if (SSL_OptionSet(client->ssl_prfd, SSL_REQUEST_CERTIFICATE, PR_TRUE) != SECSuccess) {
-            client_log(client, BLOG_ERROR, "SSL_OptionSet(SSL_REQUEST_CERTIFICATE) failed");
-            goto fail3;
-        }
-        if (SSL_OptionSet(client->ssl_prfd, SSL_REQUIRE_CERTIFICATE, PR_TRUE) != SECSuccess) {
-            client_log(client, BLOG_ERROR, "SSL_OptionSet(SSL_REQUIRE_CERTIFICATE) failed");
+        // initialize I/O now, unless we need to wait for the handshake
+        if (!options.ssl && !client_init_io(client)) {
             goto fail3;
         }
-        
-        // init SSL connection
-        BSSLConnection_Init(&client->sslcon, client->ssl_prfd, 1, BReactor_PendingGroup(&ss), client, (BSSLConnection_handler)client_sslcon_handler);
-    } else {
-        // initialize I/O
-        if (!client_init_io(client)) {
-            goto fail2;
-        }
     }
+    #ifndef BADVPN_USE_WINAPI
+    else {
+        // hand the socket over to the client thread, which sets up the connection
+        // and reports back when the I/O can be initialized
+        client->link_fd = BConnection_Release(&client->con);
+        client_threads[client->thread_index].num_clients++;
+        BReactorMailbox_Thread_Post(BReactorGroup_GetMailbox(&client_thread_group, client->thread_index), &client->link_start_msg);
+    }
+    #endif
     
     // start disconnect timer
     BTimer_Init(&client->disconnect_timer, CLIENT_NO_DATA_TIME_LIMIT, (BTimer_handler)client_disconnect_timer_handler, client);
     BReactor_SetTimer(&ss, &client->disconnect_timer);
     
+    // init endclients queue; the timer expires immediately, but only after
+    // the I/O events already reported by the reactor have been processed
+    client->endclients_num = 0;
+    BTimer_Init(&client->endclients_timer, 0, (BTimer_handler)client_endclients_timer_handler, client);
+    
     // link in
     clients_num++;
     LinkedList1_Append(&clients, &client->list_node);
@@ -989,21 +1611,25 @@ void listener_handler (BListener *listener)
     BPending_Init(&client->dying_job, BReactor_PendingGroup(&ss), (BPending_handler)client_dying_job, client);
     
     // set state
-    client->initstatus = (options.ssl ? INITSTATUS_HANDSHAKE : INITSTATUS_WAITHELLO);
+    client->initstatus = ((options.ssl || client->thread_index >= 0) ? INITSTATUS_HANDSHAKE : INITSTATUS_WAITHELLO);
     
     client_log(client, BLOG_INFO, "initialized");
     
     return;
     
-    if (options.ssl) {
 fail3:
-        ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
-    }
+    client_free_link(client);
 fail2:
-    BConnection_RecvAsync_Free(&client->con);
-    BConnection_SendAsync_Free(&client->con);
     BConnection_Free(&client->con);
+fail1b:
+    #ifndef BADVPN_USE_WINAPI
+    if (client->thread_index >= 0) {
+        PacketPassThreadPipe_Free(&client->output_pipe);
+fail1a:
+        PacketPassThreadPipe_Free(&client->input_pipe);
+    }
 fail1:
+    #endif
     free(client);
 fail0:
     return;
@@ -1024,17 +1650,54 @@ void client_dealloc (struct client_data *client)
     BPending_Free(&client->dying_job);
     
     // link out
+    cluster_forget_client(client);
     BAVL_Remove(&clients_tree, &client->tree_node);
     LinkedList1_Remove(&clients, &client->list_node);
-    clients_num--;
+    if (!client->remote) {
+        clients_num--;
+    }
     
     // stop disconnect timer
     BReactor_RemoveTimer(&ss, &client->disconnect_timer);
     
-    // free SSL
-    if (options.ssl) {
-        BSSLConnection_Free(&client->sslcon);
-        ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
+    // stop endclients timer
+    BReactor_RemoveTimer(&ss, &client->endclients_timer);
+    
+    if (client->remote) {
+        // free publish job
+        BPending_Free(&client->cluster_publish_job);
+        
+        // free output to the link
+        if (client->cluster_have_qflow) {
+            PacketPassFairQueueFlow_Free(&client->cluster_qflow);
+        }
+        
+        // remove from link list
+        if (client->cluster_link) {
+            LinkedList1_Remove(&client->cluster_link->proxies, &client->cluster_list_node);
+        }
+    }
+    else if (client->thread_index < 0) {
+        // free connection interfaces and SSL
+        client_free_link(client);
+        
+        // free connection
+        BConnection_Free(&client->con);
+    }
+    #ifndef BADVPN_USE_WINAPI
+    else {
+        // the client thread has freed the connection already
+        client_threads[client->thread_index].num_clients--;
+        
+        // free pipes
+        PacketPassThreadPipe_Free(&client->output_pipe);
+        PacketPassThreadPipe_Free(&client->input_pipe);
+    }
+    #endif
+    
+    // release predicate class
+    if (client->pred_class) {
+        predicate_class_unref(client->pred_class);
     }
     
     // free common name
@@ -1042,20 +1705,16 @@ void client_dealloc (struct client_data *client)
         PORT_Free(client->common_name);
     }
     
-    // free connection interfaces
-    BConnection_RecvAsync_Free(&client->con);
-    BConnection_SendAsync_Free(&client->con);
-    
-    // free connection
-    BConnection_Free(&client->con);
-    
     // free memory
     free(client);
 }
 
 int client_compute_buffer_size (struct client_data *client)
 {
-    bsize_t s = bsize_add(bsize_fromsize(1), bsize_mul(bsize_fromsize(2), bsize_fromsize(options.max_clients - 1)));
+    // with a cluster, peers may be connected to any of the servers
+    int num_nodes = (options.cluster_nodes > 0 ? options.cluster_nodes : 1);
+    
+    bsize_t s = bsize_add(bsize_fromsize(1), bsize_mul(bsize_fromsize(2), bsize_fromsize(options.max_clients * num_nodes - 1)));
     
     if (s.is_overflow || s.value > INT_MAX) {
         return INT_MAX;
@@ -1066,34 +1725,50 @@ int client_compute_buffer_size (struct client_data *client)
 
 int client_init_io (struct client_data *client)
 {
-    StreamPassInterface *send_if = (options.ssl ? BSSLConnection_GetSendIf(&client->sslcon) : BConnection_SendAsync_GetIf(&client->con));
-    StreamRecvInterface *recv_if = (options.ssl ? BSSLConnection_GetRecvIf(&client->sslcon) : BConnection_RecvAsync_GetIf(&client->con));
-    
     // init input
     
     // init interface
     PacketPassInterface_Init(&client->input_interface, SC_MAX_ENC, (PacketPassInterface_handler_send)client_input_handler_send, client, BReactor_PendingGroup(&ss));
+    PacketPassInterface *input_if = &client->input_interface;
+    
+    // init rate limiter, unlimited until the client class is known
+    client->have_input_limiter = 0;
+    if (!client->remote && client_classes_limit_rate) {
+        PacketPassRateLimiter_Init(&client->input_limiter, input_if, 0, 1, &ss);
+        input_if = PacketPassRateLimiter_GetInput(&client->input_limiter);
+        client->have_input_limiter = 1;
+    }
     
-    // init decoder
-    if (!PacketProtoDecoder_Init(&client->input_decoder, recv_if, &client->input_interface, BReactor_PendingGroup(&ss), client,
-        (PacketProtoDecoder_handler_error)client_decoder_handler_error
-    )) {
-        client_log(client, BLOG_ERROR, "PacketProtoDecoder_Init failed");
-        goto fail1;
+    // connect to the decoder and sender, directly or through the client thread,
+    // or for a remote client, to the link to its server
+    PacketPassInterface *output_if;
+    if (client->remote) {
+        PacketPassInterface_Init(&client->cluster_output_if, PACKETPROTO_ENCLEN(SC_MAX_ENC), (PacketPassInterface_handler_send)client_cluster_output_handler_send, client, BReactor_PendingGroup(&ss));
+        output_if = &client->cluster_output_if;
+    }
+    #ifndef BADVPN_USE_WINAPI
+    else if (client->thread_index >= 0) {
+        PacketPassThreadPipe_Receiver_Init(&client->input_pipe, input_if, BReactor_PendingGroup(&ss));
+        PacketPassThreadPipe_Sender_Init(&client->output_pipe, BReactor_PendingGroup(&ss));
+        output_if = PacketPassThreadPipe_Sender_GetInput(&client->output_pipe);
+    }
+    #endif
+    else {
+        if (!client_init_link_io(client, input_if)) {
+            goto fail1;
+        }
+        output_if = PacketStreamSender_GetInput(&client->output_sender);
     }
     
     // init output common
     
-    // init sender
-    PacketStreamSender_Init(&client->output_sender, send_if, PACKETPROTO_ENCLEN(SC_MAX_ENC), BReactor_PendingGroup(&ss));
-    
     // init queue
-    PacketPassPriorityQueue_Init(&client->output_priorityqueue, PacketStreamSender_GetInput(&client->output_sender), BReactor_PendingGroup(&ss), 0);
+    PacketPassPriorityQueue_InitLevels(&client->output_priorityqueue, output_if, BReactor_PendingGroup(&ss), 0, 2);
     
     // init output control flow
     
     // init queue flow
-    PacketPassPriorityQueueFlow_Init(&client->output_control_qflow, &client->output_priorityqueue, -1);
+    PacketPassPriorityQueueFlow_Init(&client->output_control_qflow, &client->output_priorityqueue, 0);
     
     // init PacketProtoFlow
     if (!PacketProtoFlow_Init(
@@ -1110,17 +1785,21 @@ int client_init_io (struct client_data *client)
     
     // init queue flow
     // use lower priority than control flow (higher number)
-    PacketPassPriorityQueueFlow_Init(&client->output_peers_qflow, &client->output_priorityqueue, 0);
+    PacketPassPriorityQueueFlow_Init(&client->output_peers_qflow, &client->output_priorityqueue, 1);
     
-    // init fair queue (for different peers)
-    if (!PacketPassFairQueue_Init(&client->output_peers_fairqueue, PacketPassPriorityQueueFlow_GetInput(&client->output_peers_qflow), BReactor_PendingGroup(&ss), 0, 1)) {
-        client_log(client, BLOG_ERROR, "PacketPassFairQueue_Init failed");
+    // init fair queue (for different peers); there may be many peers, so use the
+    // cheaper scheduling
+    if (!PacketPassFairQueue_Init2(&client->output_peers_fairqueue, PacketPassPriorityQueueFlow_GetInput(&client->output_peers_qflow), BReactor_PendingGroup(&ss), 0, 1, FAIRQUEUE_MODE_DRR)) {
+        client_log(client, BLOG_ERROR, "PacketPassFairQueue_Init2 failed");
         goto fail3;
     }
     
     // init list of flows
     LinkedList1_Init(&client->output_peers_flows);
     
+    // init list of flows from other servers
+    LinkedList1_Init(&client->output_cluster_flows);
+    
     return 1;
     
 fail3:
@@ -1130,21 +1809,28 @@ fail2:
     PacketPassPriorityQueueFlow_Free(&client->output_control_qflow);
     // free output common
     PacketPassPriorityQueue_Free(&client->output_priorityqueue);
-    PacketStreamSender_Free(&client->output_sender);
-    // free input
-    PacketProtoDecoder_Free(&client->input_decoder);
+    if (client->remote) {
+        PacketPassInterface_Free(&client->cluster_output_if);
+    }
+    #ifndef BADVPN_USE_WINAPI
+    else if (client->thread_index >= 0) {
+        PacketPassThreadPipe_Sender_Free(&client->output_pipe);
+        PacketPassThreadPipe_Receiver_Free(&client->input_pipe);
+    }
+    #endif
+    else {
+        client_free_link_io(client);
+    }
 fail1:
+    if (client->have_input_limiter) {
+        PacketPassRateLimiter_Free(&client->input_limiter);
+    }
     PacketPassInterface_Free(&client->input_interface);
     return 0;
 }
 
 void client_dealloc_io (struct client_data *client)
 {
-    // stop using any buffers before they get freed
-    if (options.ssl) {
-        BSSLConnection_ReleaseBuffers(&client->sslcon);
-    }
-    
     // allow freeing fair queue flows
     PacketPassFairQueue_PrepareFree(&client->output_peers_fairqueue);
     
@@ -1156,6 +1842,13 @@ void client_dealloc_io (struct client_data *client)
         peer_flow_dealloc(flow);
     }
     
+    // remove flows from other servers
+    while (node = LinkedList1_GetFirst(&client->output_cluster_flows)) {
+        struct cluster_flow *flow = UPPER_OBJECT(node, struct cluster_flow, dest_list_node);
+        ASSERT(flow->dest_client == client)
+        cluster_flow_dealloc(flow);
+    }
+    
     // allow freeing priority queue flows
     PacketPassPriorityQueue_PrepareFree(&client->output_priorityqueue);
     
@@ -1169,93 +1862,333 @@ void client_dealloc_io (struct client_data *client)
     
     // free output common
     PacketPassPriorityQueue_Free(&client->output_priorityqueue);
-    PacketStreamSender_Free(&client->output_sender);
+    
+    // disconnect from the decoder and sender
+    if (client->remote) {
+        PacketPassInterface_Free(&client->cluster_output_if);
+    }
+    #ifndef BADVPN_USE_WINAPI
+    else if (client->thread_index >= 0) {
+        PacketPassThreadPipe_Sender_Free(&client->output_pipe);
+        PacketPassThreadPipe_Receiver_Free(&client->input_pipe);
+    }
+    #endif
+    else {
+        client_free_link_io(client);
+    }
+    
+    // free rate limiter
+    if (client->have_input_limiter) {
+        if (PacketPassRateLimiter_GetNumDelayed(&client->input_limiter) > 0) {
+            client_log(client, BLOG_INFO, "input was delayed %"PRIu64" times by the rate limit", PacketPassRateLimiter_GetNumDelayed(&client->input_limiter));
+        }
+        PacketPassRateLimiter_Free(&client->input_limiter);
+    }
     
     // free input
-    PacketProtoDecoder_Free(&client->input_decoder);
     PacketPassInterface_Free(&client->input_interface);
 }
 
-void client_remove (struct client_data *client)
+int client_init_link (struct client_data *client)
 {
-    ASSERT(!client->dying)
-    
-    client_log(client, BLOG_INFO, "removing");
-    
-    // set dying to prevent sending this client anything
-    client->dying = 1;
-    
-    // free I/O now, removing incoming flows
-    if (client->initstatus >= INITSTATUS_WAITHELLO) {
-        client_dealloc_io(client);
-    }
-    
-    // remove outgoing knows
-    LinkedList1Node *node;
-    while (node = LinkedList1_GetFirst(&client->know_out_list)) {
-        struct peer_know *k = UPPER_OBJECT(node, struct peer_know, from_node);
-        remove_know(k);
-    }
+    // init connection interfaces
+    BConnection_SendAsync_Init(&client->con);
+    BConnection_RecvAsync_Init(&client->con);
     
-    // remove outgoing flows
-    while (node = LinkedList1_GetFirst(&client->peer_out_flows_list)) {
-        struct peer_flow *flow = UPPER_OBJECT(node, struct peer_flow, src_list_node);
-        ASSERT(flow->src_client == client)
-        ASSERT(flow->dest_client->initstatus == INITSTATUS_COMPLETE)
-        ASSERT(!flow->dest_client->dying)
+    if (options.ssl) {
+        // SSL operations may only go to worker threads from the main thread
+        BThreadWorkDispatcher *ssl_twd = (client->thread_index < 0 ? &twd : NULL);
+        int flags = (client->thread_index < 0 ? ssl_flags() : 0);
         
-        if (flow->have_io && PacketPassFairQueueFlow_IsBusy(&flow->qflow)) {
-            client_log(client, BLOG_DEBUG, "removing flow to %d later", (int)flow->dest_client->id);
-            peer_flow_disconnect(flow);
-        } else {
-            client_log(client, BLOG_DEBUG, "removing flow to %d now", (int)flow->dest_client->id);
-            peer_flow_dealloc(flow);
+        // create bottom NSPR file descriptor
+        if (!BSSLConnection_MakeBackend(&client->bottom_prfd, BConnection_SendAsync_GetIf(&client->con), BConnection_RecvAsync_GetIf(&client->con), ssl_twd, flags)) {
+            client_link_log(client, BLOG_ERROR, "BSSLConnection_MakeBackend failed");
+            goto fail1;
+        }
+        
+        // create SSL file descriptor from the bottom NSPR file descriptor
+        if (!(client->ssl_prfd = SSL_ImportFD(model_prfd, &client->bottom_prfd))) {
+            client_link_log(client, BLOG_ERROR, "SSL_ImportFD failed");
+            ASSERT_FORCE(PR_Close(&client->bottom_prfd) == PR_SUCCESS)
+            goto fail1;
+        }
+        
+        // set server mode
+        if (SSL_ResetHandshake(client->ssl_prfd, PR_TRUE) != SECSuccess) {
+            client_link_log(client, BLOG_ERROR, "SSL_ResetHandshake failed");
+            goto fail2;
+        }
+        
+        // set require client certificate
+        if (SSL_OptionSet(client->ssl_prfd, SSL_REQUEST_CERTIFICATE, PR_TRUE) != SECSuccess) {
+            client_link_log(client, BLOG_ERROR, "SSL_OptionSet(SSL_REQUEST_CERTIFICATE) failed");
+            goto fail2;
+        }
+        if (SSL_OptionSet(client->ssl_prfd, SSL_REQUIRE_CERTIFICATE, PR_TRUE) != SECSuccess) {
+            client_link_log(client, BLOG_ERROR, "SSL_OptionSet(SSL_REQUIRE_CERTIFICATE) failed");
+            goto fail2;
         }
+        
+        // init SSL connection
+        BSSLConnection_Init(&client->sslcon, client->ssl_prfd, 1, BReactor_PendingGroup(client->link_reactor), client, (BSSLConnection_handler)client_sslcon_handler);
     }
     
-    // schedule job to finish removal after clients are informed
-    BPending_Set(&client->dying_job);
+    return 1;
     
-    // inform other clients that 'client' is no more
-    node = LinkedList1_GetFirst(&client->know_in_list);
-    while (node) {
-        LinkedList1Node *next = LinkedList1Node_Next(node);
-        struct peer_know *k = UPPER_OBJECT(node, struct peer_know, to_node);
-        uninform_know(k);
-        node = next;
-    }
+fail2:
+    ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
+fail1:
+    BConnection_RecvAsync_Free(&client->con);
+    BConnection_SendAsync_Free(&client->con);
+    return 0;
 }
 
-void client_dying_job (struct client_data *client)
+void client_free_link (struct client_data *client)
 {
-    ASSERT(client->dying)
-    ASSERT(LinkedList1_IsEmpty(&client->know_in_list))
+    // free SSL
+    if (options.ssl) {
+        BSSLConnection_Free(&client->sslcon);
+        ASSERT_FORCE(PR_Close(client->ssl_prfd) == PR_SUCCESS)
+    }
     
-    client_dealloc(client);
-    return;
+    // free connection interfaces
+    BConnection_RecvAsync_Free(&client->con);
+    BConnection_SendAsync_Free(&client->con);
 }
 
-void client_logfunc (struct client_data *client)
+int client_init_link_io (struct client_data *client, PacketPassInterface *input_if)
 {
-    char addr[BADDR_MAX_PRINT_LEN];
-    BAddr_Print(&client->addr, addr);
+    StreamPassInterface *send_if = (options.ssl ? BSSLConnection_GetSendIf(&client->sslcon) : BConnection_SendAsync_GetIf(&client->con));
+    StreamRecvInterface *recv_if = (options.ssl ? BSSLConnection_GetRecvIf(&client->sslcon) : BConnection_RecvAsync_GetIf(&client->con));
     
-    BLog_Append("client %d (%s)", (int)client->id, addr);
-    if (client->common_name) {
-        BLog_Append(" (%s)", client->common_name);
+    // init decoder
+    if (!PacketProtoDecoder_Init(&client->input_decoder, recv_if, input_if, BReactor_PendingGroup(client->link_reactor), client,
+        (PacketProtoDecoder_handler_error)client_decoder_handler_error
+    )) {
+        client_link_log(client, BLOG_ERROR, "PacketProtoDecoder_Init failed");
+        goto fail0;
     }
-    BLog_Append(": ");
-}
-
-void client_log (struct client_data *client, int level, const char *fmt, ...)
-{
-    va_list vl;
-    va_start(vl, fmt);
-    BLog_LogViaFuncVarArg((BLog_logfunc)client_logfunc, client, BLOG_CURRENT_CHANNEL, level, fmt, vl);
-    va_end(vl);
+    
+    // init sender, gathering packets ready at the same time into one write
+    // (and one TLS record)
+    int coalesce = options.client_send_coalesce;
+    if (coalesce > 0 && coalesce < PACKETPROTO_ENCLEN(SC_MAX_ENC)) {
+        coalesce = PACKETPROTO_ENCLEN(SC_MAX_ENC);
+    }
+    if (!PacketStreamSender_Init2(&client->output_sender, send_if, PACKETPROTO_ENCLEN(SC_MAX_ENC), coalesce, BReactor_PendingGroup(client->link_reactor))) {
+        client_link_log(client, BLOG_ERROR, "PacketStreamSender_Init2 failed");
+        goto fail1;
+    }
+    
+    return 1;
+    
+fail1:
+    PacketProtoDecoder_Free(&client->input_decoder);
+fail0:
+    return 0;
 }
 
-void client_disconnect_timer_handler (struct client_data *client)
+void client_free_link_io (struct client_data *client)
+{
+    // stop using any buffers before they get freed
+    if (options.ssl) {
+        BSSLConnection_ReleaseBuffers(&client->sslcon);
+    }
+    
+    // free sender
+    PacketStreamSender_Free(&client->output_sender);
+    
+    // free decoder
+    PacketProtoDecoder_Free(&client->input_decoder);
+}
+
+void client_link_up (struct client_data *client)
+{
+    if (client->thread_index < 0) {
+        client_start_io(client);
+        return;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    // connect the decoder and sender to the pipes
+    if (!client_init_thread_io(client)) {
+        client_link_error(client);
+        return;
+    }
+    
+    // let the main thread initialize the rest of the I/O
+    BReactorMailbox_Thread_Post(&main_mailbox, &client->link_up_msg);
+    #endif
+}
+
+void client_link_error (struct client_data *client)
+{
+    if (client->thread_index < 0) {
+        ASSERT(!client->dying)
+        client_remove(client);
+        return;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    ASSERT(client->link_active)
+    
+    // free everything here right away, then let the main thread remove the client
+    client_free_thread_link(client);
+    BReactorMailbox_Thread_Post(&main_mailbox, &client->link_error_msg);
+    #endif
+}
+
+void client_start_io (struct client_data *client)
+{
+    ASSERT(client->initstatus == INITSTATUS_HANDSHAKE)
+    ASSERT(!client->dying)
+    
+    // init I/O chains
+    if (!client_init_io(client)) {
+        client_remove(client);
+        return;
+    }
+    
+    // set client state
+    client->initstatus = INITSTATUS_WAITHELLO;
+    
+    if (options.ssl) {
+        client_log(client, BLOG_INFO, "handshake complete");
+    }
+}
+
+void client_remove (struct client_data *client)
+{
+    ASSERT(!client->dying)
+    
+    client_log(client, BLOG_INFO, "removing");
+    
+    // set dying to prevent sending this client anything
+    client->dying = 1;
+    
+    if (client->remote) {
+        // have its server remove the client too, unless that's where the removal came from
+        if (client->cluster_kick && client->cluster_link) {
+            cluster_link_send_kick(client->cluster_link, client->id);
+        }
+    }
+    else if (client->initstatus == INITSTATUS_COMPLETE) {
+        // inform the other servers
+        cluster_unpublish_client(client);
+    }
+    
+    // forget queued endclients
+    BReactor_RemoveTimer(&ss, &client->endclients_timer);
+    
+    // free I/O now, removing incoming flows
+    if (client->initstatus >= INITSTATUS_WAITHELLO) {
+        client_dealloc_io(client);
+    }
+    
+    // remove outgoing knows
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&client->know_out_list)) {
+        struct peer_know *k = UPPER_OBJECT(node, struct peer_know, from_node);
+        remove_know(k);
+    }
+    
+    // remove outgoing flows
+    while (node = LinkedList1_GetFirst(&client->peer_out_flows_list)) {
+        struct peer_flow *flow = UPPER_OBJECT(node, struct peer_flow, src_list_node);
+        ASSERT(flow->src_client == client)
+        ASSERT(flow->dest_client->initstatus == INITSTATUS_COMPLETE)
+        ASSERT(!flow->dest_client->dying)
+        
+        if (flow->have_io && PacketPassFairQueueFlow_IsBusy(&flow->qflow)) {
+            client_log(client, BLOG_DEBUG, "removing flow to %d later", (int)flow->dest_client->id);
+            peer_flow_disconnect(flow);
+        } else {
+            client_log(client, BLOG_DEBUG, "removing flow to %d now", (int)flow->dest_client->id);
+            peer_flow_dealloc(flow);
+        }
+    }
+    
+    // schedule job to finish removal after clients are informed
+    BPending_Set(&client->dying_job);
+    
+    // inform other clients that 'client' is no more
+    node = LinkedList1_GetFirst(&client->know_in_list);
+    while (node) {
+        LinkedList1Node *next = LinkedList1Node_Next(node);
+        struct peer_know *k = UPPER_OBJECT(node, struct peer_know, to_node);
+        uninform_know(k);
+        node = next;
+    }
+}
+
+void client_dying_job (struct client_data *client)
+{
+    ASSERT(client->dying)
+    ASSERT(LinkedList1_IsEmpty(&client->know_in_list))
+    
+    // the link may still be sending a packet from the output of a remote client
+    if (client->remote && client->cluster_have_qflow && PacketPassFairQueueFlow_IsBusy(&client->cluster_qflow)) {
+        PacketPassFairQueueFlow_SetBusyHandler(&client->cluster_qflow, (PacketPassFairQueue_handler_busy)client_cluster_qflow_handler_busy, client);
+        return;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    if (client->thread_index >= 0) {
+        // nothing may remove the client again
+        BReactor_RemoveTimer(&ss, &client->disconnect_timer);
+        
+        // have the client thread free the connection first
+        BReactorMailbox_Thread_Post(BReactorGroup_GetMailbox(&client_thread_group, client->thread_index), &client->link_stop_msg);
+        return;
+    }
+    #endif
+    
+    client_dealloc(client);
+    return;
+}
+
+void client_logfunc (struct client_data *client)
+{
+    char addr[BADDR_MAX_PRINT_LEN];
+    BAddr_Print(&client->addr, addr);
+    
+    BLog_Append("%sclient %d (%s)", (client->remote ? "remote " : ""), (int)client->id, addr);
+    // the common name is set during the handshake, possibly in a client thread
+    if (client->initstatus != INITSTATUS_HANDSHAKE && client->common_name) {
+        BLog_Append(" (%s)", client->common_name);
+    }
+    BLog_Append(": ");
+}
+
+void client_log (struct client_data *client, int level, const char *fmt, ...)
+{
+    va_list vl;
+    va_start(vl, fmt);
+    BLog_LogViaFuncVarArg((BLog_logfunc)client_logfunc, client, BLOG_CURRENT_CHANNEL, level, fmt, vl);
+    va_end(vl);
+}
+
+void client_link_logfunc (struct client_data *client)
+{
+    char addr[BADDR_MAX_PRINT_LEN];
+    BAddr_Print(&client->addr, addr);
+    
+    BLog_Append("client %d (%s)", (int)client->id, addr);
+    if (client->common_name) {
+        BLog_Append(" (%s)", client->common_name);
+    }
+    BLog_Append(": ");
+}
+
+void client_link_log (struct client_data *client, int level, const char *fmt, ...)
+{
+    va_list vl;
+    va_start(vl, fmt);
+    BLog_LogViaFuncVarArg((BLog_logfunc)client_link_logfunc, client, BLOG_CURRENT_CHANNEL, level, fmt, vl);
+    va_end(vl);
+}
+
+void client_disconnect_timer_handler (struct client_data *client)
 {
     ASSERT(!client->dying)
     
@@ -1265,89 +2198,88 @@ void client_disconnect_timer_handler (struct client_data *client)
     return;
 }
 
-void client_connection_handler (struct client_data *client, int event)
+void client_endclients_timer_handler (struct client_data *client)
 {
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
     ASSERT(!client->dying)
+    ASSERT(client->endclients_num > 0)
     
+    client_flush_endclients(client);
+    return;
+}
+
+void client_connection_handler (struct client_data *client, int event)
+{
     if (event == BCONNECTION_EVENT_RECVCLOSED) {
-        client_log(client, BLOG_INFO, "connection closed");
+        client_link_log(client, BLOG_INFO, "connection closed");
     } else {
-        client_log(client, BLOG_INFO, "connection error");
+        client_link_log(client, BLOG_INFO, "connection error");
     }
     
-    client_remove(client);
+    client_link_error(client);
     return;
 }
 
 void client_sslcon_handler (struct client_data *client, int event)
 {
     ASSERT(options.ssl)
-    ASSERT(!client->dying)
     ASSERT(event == BSSLCONNECTION_EVENT_UP || event == BSSLCONNECTION_EVENT_ERROR)
-    ASSERT(!(event == BSSLCONNECTION_EVENT_UP) || client->initstatus == INITSTATUS_HANDSHAKE)
     
     if (event == BSSLCONNECTION_EVENT_ERROR) {
-        client_log(client, BLOG_ERROR, "SSL error");
-        client_remove(client);
+        client_link_log(client, BLOG_ERROR, "SSL error");
+        client_link_error(client);
         return;
     }
     
     // get client certificate
     CERTCertificate *cert = SSL_PeerCertificate(client->ssl_prfd);
     if (!cert) {
-        client_log(client, BLOG_ERROR, "SSL_PeerCertificate failed");
+        client_link_log(client, BLOG_ERROR, "SSL_PeerCertificate failed");
         goto fail0;
     }
     
     // remember common name
     if (!(client->common_name = CERT_GetCommonName(&cert->subject))) {
-        client_log(client, BLOG_NOTICE, "CERT_GetCommonName failed");
+        client_link_log(client, BLOG_NOTICE, "CERT_GetCommonName failed");
         goto fail1;
     }
     
     // store certificate
     SECItem der = cert->derCert;
     if (der.len > sizeof(client->cert)) {
-        client_log(client, BLOG_NOTICE, "client certificate too big");
+        client_link_log(client, BLOG_NOTICE, "client certificate too big");
         goto fail1;
     }
     memcpy(client->cert, der.data, der.len);
     client->cert_len = der.len;
+    BHash_calculate(BHASH_TYPE_SHA256, client->cert, client->cert_len, client->cert_hash);
     
     PRArenaPool *arena = PORT_NewArena(DER_DEFAULT_CHUNKSIZE);
     if (!arena) {
-        client_log(client, BLOG_ERROR, "PORT_NewArena failed");
+        client_link_log(client, BLOG_ERROR, "PORT_NewArena failed");
         goto fail1;
     }
     
     // encode certificate
     memset(&der, 0, sizeof(der));
     if (!SEC_ASN1EncodeItem(arena, &der, cert, SEC_ASN1_GET(CERT_CertificateTemplate))) {
-        client_log(client, BLOG_ERROR, "SEC_ASN1EncodeItem failed");
+        client_link_log(client, BLOG_ERROR, "SEC_ASN1EncodeItem failed");
         goto fail2;
     }
     
     // store re-encoded certificate (for compatibility with old clients)
     if (der.len > sizeof(client->cert_old)) {
-        client_log(client, BLOG_NOTICE, "client certificate too big");
+        client_link_log(client, BLOG_NOTICE, "client certificate too big");
         goto fail2;
     }
     memcpy(client->cert_old, der.data, der.len);
     client->cert_old_len = der.len;
     
-    // init I/O chains
-    if (!client_init_io(client)) {
-        goto fail2;
-    }
-    
     PORT_FreeArena(arena, PR_FALSE);
     CERT_DestroyCertificate(cert);
     
-    // set client state
-    client->initstatus = INITSTATUS_WAITHELLO;
-    
-    client_log(client, BLOG_INFO, "handshake complete");
-    
+    // init I/O chains
+    client_link_up(client);
     return;
     
     // handle errors
@@ -1356,98 +2288,450 @@ fail2:
 fail1:
     CERT_DestroyCertificate(cert);
 fail0:
-    client_remove(client);
+    client_link_error(client);
 }
 
 void client_decoder_handler_error (struct client_data *client)
 {
-    ASSERT(INITSTATUS_HASLINK(client->initstatus))
-    ASSERT(!client->dying)
+    client_link_log(client, BLOG_ERROR, "decoder error");
     
-    client_log(client, BLOG_ERROR, "decoder error");
-    
-    client_remove(client);
+    client_link_error(client);
     return;
 }
 
-int client_start_control_packet (struct client_data *client, void **data, int len)
+#ifndef BADVPN_USE_WINAPI
+
+int init_client_threads (void)
 {
-    ASSERT(len >= 0)
-    ASSERT(len <= SC_MAX_PAYLOAD)
-    ASSERT(!(len > 0) || data)
-    ASSERT(INITSTATUS_HASLINK(client->initstatus))
-    ASSERT(!client->dying)
-    ASSERT(client->output_control_packet_len == -1)
+    ASSERT(options.client_threads > 0)
+    ASSERT(options.client_threads <= MAX_CLIENT_THREADS)
     
-#ifdef SIMULATE_OUT_OF_CONTROL_BUFFER
-    uint8_t x;
-    BRandom_randomize(&x, sizeof(x));
-    if (x < SIMULATE_OUT_OF_CONTROL_BUFFER) {
-        client_log(client, BLOG_INFO, "out of control buffer, removing");
-        client_remove(client);
-        return -1;
+    // init mailbox for messages from client threads
+    if (!BReactorMailbox_Init(&main_mailbox, &ss)) {
+        BLog(BLOG_ERROR, "BReactorMailbox_Init failed");
+        goto fail0;
     }
-#endif
     
-    // obtain location for writing the packet
-    if (!BufferWriter_StartPacket(client->output_control_input, &client->output_control_packet)) {
-        // out of buffer, kill client
-        client_log(client, BLOG_INFO, "out of control buffer, removing");
-        client_remove(client);
-        return -1;
+    // no clients assigned yet
+    for (int i = 0; i < options.client_threads; i++) {
+        client_threads[i].num_clients = 0;
     }
     
-    client->output_control_packet_len = len;
-    
-    if (data) {
-        *data = client->output_control_packet + sizeof(struct sc_header);
+    // start threads
+    if (!BReactorGroup_Init(&client_thread_group, options.client_threads, 0, NULL, client_thread_start_handler, client_thread_stop_handler)) {
+        BLog(BLOG_ERROR, "BReactorGroup_Init failed");
+        goto fail1;
     }
     
+    return 1;
+    
+fail1:
+    BReactorMailbox_Free(&main_mailbox);
+fail0:
     return 0;
 }
 
-void client_end_control_packet (struct client_data *client, uint8_t type)
+void free_client_threads (void)
 {
-    ASSERT(INITSTATUS_HASLINK(client->initstatus))
-    ASSERT(!client->dying)
-    ASSERT(client->output_control_packet_len >= 0)
-    ASSERT(client->output_control_packet_len <= SC_MAX_PAYLOAD)
-    
-    // write header
-    struct sc_header header;
-    header.type = htol8(type);
-    memcpy(client->output_control_packet, &header, sizeof(header));
-    
-    // finish writing packet
-    BufferWriter_EndPacket(client->output_control_input, sizeof(struct sc_header) + client->output_control_packet_len);
+    // stop threads; this frees the connections running in them, and
+    // afterwards they post no more messages
+    BReactorGroup_Free(&client_thread_group);
     
-    client->output_control_packet_len = -1;
+    // free mailbox, discarding any messages from the threads
+    BReactorMailbox_Free(&main_mailbox);
 }
 
-int client_send_newclient (struct client_data *client, struct client_data *nc, int relay_server, int relay_client)
+void client_thread_start_handler (void *unused, int index, BReactor *reactor)
 {
-    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!client->dying)
-    ASSERT(nc->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!nc->dying)
+    // init list of clients
+    LinkedList1_Init(&client_threads[index].clients);
     
-    int flags = 0;
-    if (relay_server) {
-        flags |= SCID_NEWCLIENT_FLAG_RELAY_SERVER;
-    }
-    if (relay_client) {
-        flags |= SCID_NEWCLIENT_FLAG_RELAY_CLIENT;
-    }
-    if (options.ssl && client->version > SC_OLDVERSION_NOSSL && nc->version > SC_OLDVERSION_NOSSL) {
-        flags |= SCID_NEWCLIENT_FLAG_SSL;
+    BLog(BLOG_DEBUG, "client thread %d started", index);
+}
+
+void client_thread_stop_handler (void *unused, int index, BReactor *reactor)
+{
+    // free the connections of clients
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&client_threads[index].clients)) {
+        struct client_data *client = UPPER_OBJECT(node, struct client_data, thread_list_node);
+        client_free_thread_link(client);
     }
+}
+
+int client_init_thread_io (struct client_data *client)
+{
+    ASSERT(client->link_active)
+    ASSERT(!client->link_have_io)
     
-    uint8_t *cert_data = NULL;
-    int cert_len = 0;
-    if (options.ssl) {
-        cert_data = (client->version == SC_OLDVERSION_BROKENCERT ?  nc->cert_old : nc->cert);
-        cert_len = (client->version == SC_OLDVERSION_BROKENCERT ?  nc->cert_old_len : nc->cert_len);
-    }
+    // pass received packets to the main thread
+    PacketPassThreadPipe_Sender_Init(&client->input_pipe, BReactor_PendingGroup(client->link_reactor));
+    
+    // init decoder and sender
+    if (!client_init_link_io(client, PacketPassThreadPipe_Sender_GetInput(&client->input_pipe))) {
+        goto fail1;
+    }
+    
+    // send packets from the main thread
+    PacketPassThreadPipe_Receiver_Init(&client->output_pipe, PacketStreamSender_GetInput(&client->output_sender), BReactor_PendingGroup(client->link_reactor));
+    
+    client->link_have_io = 1;
+    
+    return 1;
+    
+fail1:
+    PacketPassThreadPipe_Sender_Free(&client->input_pipe);
+    return 0;
+}
+
+void client_free_thread_io (struct client_data *client)
+{
+    ASSERT(client->link_active)
+    ASSERT(client->link_have_io)
+    
+    // free pipe sides, decoder and sender
+    PacketPassThreadPipe_Receiver_Free(&client->output_pipe);
+    client_free_link_io(client);
+    PacketPassThreadPipe_Sender_Free(&client->input_pipe);
+    
+    client->link_have_io = 0;
+}
+
+void client_free_thread_link (struct client_data *client)
+{
+    ASSERT(client->link_active)
+    
+    // free I/O
+    if (client->link_have_io) {
+        client_free_thread_io(client);
+    }
+    
+    // free connection interfaces and SSL
+    client_free_link(client);
+    
+    // free connection
+    BConnection_Free(&client->con);
+    
+    // remove from thread's list
+    LinkedList1_Remove(&client_threads[client->thread_index].clients, &client->thread_list_node);
+    
+    client->link_active = 0;
+}
+
+void client_link_start_msg_handler (struct client_data *client)
+{
+    client->link_active = 0;
+    client->link_have_io = 0;
+    
+    // take over the socket
+    if (!BConnection_Init(&client->con, BConnection_source_pipe(client->link_fd, 1), client->link_reactor, client, (BConnection_handler)client_connection_handler)) {
+        client_link_log(client, BLOG_ERROR, "BConnection_Init failed");
+        goto fail0;
+    }
+    
+    // init connection interfaces and SSL
+    if (!client_init_link(client)) {
+        goto fail1;
+    }
+    
+    // add to thread's list
+    LinkedList1_Append(&client_threads[client->thread_index].clients, &client->thread_list_node);
+    client->link_active = 1;
+    
+    // without SSL, the connection is ready for packets
+    if (!options.ssl) {
+        client_link_up(client);
+    }
+    
+    return;
+    
+fail1:
+    BConnection_Free(&client->con);
+fail0:
+    BReactorMailbox_Thread_Post(&main_mailbox, &client->link_error_msg);
+}
+
+void client_link_stop_msg_handler (struct client_data *client)
+{
+    // free everything here, if it was not freed because of an error
+    if (client->link_active) {
+        client_free_thread_link(client);
+    }
+    
+    // messages posted to the main thread before this one will have been
+    // delivered when it is, so it is safe to free the client then
+    BReactorMailbox_Thread_Post(&main_mailbox, &client->link_stopped_msg);
+}
+
+void client_link_up_msg_handler (struct client_data *client)
+{
+    ASSERT(client->thread_index >= 0)
+    
+    // ignore if being removed already
+    if (client->dying) {
+        return;
+    }
+    
+    client_start_io(client);
+    return;
+}
+
+void client_link_error_msg_handler (struct client_data *client)
+{
+    ASSERT(client->thread_index >= 0)
+    
+    // ignore if being removed already
+    if (client->dying) {
+        return;
+    }
+    
+    client_remove(client);
+    return;
+}
+
+void client_link_stopped_msg_handler (struct client_data *client)
+{
+    ASSERT(client->thread_index >= 0)
+    ASSERT(client->dying)
+    
+    client_dealloc(client);
+    return;
+}
+
+#endif
+
+void client_cluster_output_handler_send (struct client_data *client, uint8_t *data, int data_len)
+{
+    ASSERT(client->remote)
+    ASSERT(client->cluster_have_qflow)
+    ASSERT(!client->dying)
+    ASSERT(data_len >= sizeof(struct packetproto_header))
+    ASSERT(data_len <= PACKETPROTO_ENCLEN(SC_MAX_ENC))
+    
+    // strip the PacketProto header, the link encodes the packet again
+    uint8_t *sc_data = data + sizeof(struct packetproto_header);
+    int sc_len = data_len - sizeof(struct packetproto_header);
+    int len = sizeof(struct cl_header) + sizeof(struct cl_toclient) + sc_len;
+    
+    uint8_t *out = client->cluster_output_buf;
+    
+    struct packetproto_header pp_header;
+    pp_header.len = htol16(len);
+    memcpy(out, &pp_header, sizeof(pp_header));
+    out += sizeof(pp_header);
+    
+    struct cl_header header;
+    header.type = htol8(CLID_TOCLIENT);
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    
+    struct cl_toclient msg;
+    msg.id = htol16(client->id);
+    memcpy(out, &msg, sizeof(msg));
+    out += sizeof(msg);
+    
+    memcpy(out, sc_data, sc_len);
+    
+    PacketPassInterface_Sender_Send(PacketPassFairQueueFlow_GetInput(&client->cluster_qflow), client->cluster_output_buf, PACKETPROTO_ENCLEN(len));
+}
+
+void client_cluster_output_handler_done (struct client_data *client)
+{
+    ASSERT(client->remote)
+    ASSERT(client->cluster_have_qflow)
+    
+    // the output is gone if the client is being removed
+    if (client->dying) {
+        return;
+    }
+    
+    PacketPassInterface_Done(&client->cluster_output_if);
+}
+
+void client_cluster_publish_job (struct client_data *client)
+{
+    ASSERT(client->remote)
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    
+    if (client->dying) {
+        return;
+    }
+    
+    client_publish(client);
+    return;
+}
+
+void client_cluster_qflow_handler_busy (struct client_data *client)
+{
+    ASSERT(client->remote)
+    ASSERT(client->dying)
+    ASSERT(client->cluster_have_qflow)
+    ASSERT(!BPending_IsSet(&client->dying_job))
+    PacketPassFairQueueFlow_AssertFree(&client->cluster_qflow);
+    
+    client_dealloc(client);
+    return;
+}
+
+int client_forward_to_cluster (struct client_data *client, uint8_t type, uint8_t *data, int data_len)
+{
+    ASSERT(!client->remote)
+    ASSERT(!client->dying)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= SC_MAX_PAYLOAD)
+    
+    // leave bad packets to the normal processing to complain about
+    if (client->initstatus != INITSTATUS_COMPLETE || data_len < sizeof(peerid_t)) {
+        return 0;
+    }
+    
+    // the packets start with the ID of the other client
+    peerid_t id;
+    memcpy(&id, data, sizeof(id));
+    id = ltoh16(id);
+    
+    // check if the pair is synchronized by the server of the other client
+    struct client_data *dest = find_client_by_id(id);
+    if (!dest || !dest->remote || dest->dying || !dest->cluster_link || pair_is_local(client, dest)) {
+        return 0;
+    }
+    struct cluster_link *link = dest->cluster_link;
+    
+    if (link->failing) {
+        client_log(client, BLOG_INFO, "cluster link is failing; not forwarding to %d", (int)id);
+        return 1;
+    }
+    
+    // obtain location for writing the packet
+    uint8_t *out;
+    if (!BufferWriter_StartPacket(link->output_forward_input, &out)) {
+        // if the peer can't see our accept, neither of the clients can recover
+        if (type == SCID_ACCEPTPEER) {
+            client_log(client, BLOG_WARNING, "out of cluster forward buffer, removing");
+            client_remove(client);
+            return 1;
+        }
+        
+        // out of buffer, reset these two clients
+        client_log(client, BLOG_WARNING, "out of cluster forward buffer; resetting to %d", (int)id);
+        cluster_link_send_resetpair(link, client->id, id);
+        return 1;
+    }
+    
+    int len = 0;
+    
+    struct cl_header header;
+    header.type = htol8(CLID_FROMCLIENT);
+    memcpy(out + len, &header, sizeof(header));
+    len += sizeof(header);
+    
+    struct cl_fromclient msg;
+    msg.id = htol16(client->id);
+    memcpy(out + len, &msg, sizeof(msg));
+    len += sizeof(msg);
+    
+    struct sc_header sc_header;
+    sc_header.type = htol8(type);
+    memcpy(out + len, &sc_header, sizeof(sc_header));
+    len += sizeof(sc_header);
+    
+    memcpy(out + len, data, data_len);
+    len += data_len;
+    
+    BufferWriter_EndPacket(link->output_forward_input, len);
+    
+    return 1;
+}
+
+int client_start_control_packet (struct client_data *client, void **data, int len)
+{
+    ASSERT(len >= 0)
+    ASSERT(len <= SC_MAX_PAYLOAD)
+    ASSERT(!(len > 0) || data)
+    ASSERT(INITSTATUS_HASLINK(client->initstatus))
+    ASSERT(!client->dying)
+    ASSERT(client->output_control_packet_len == -1)
+    
+#ifdef SIMULATE_OUT_OF_CONTROL_BUFFER
+    uint8_t x;
+    BRandom_randomize(&x, sizeof(x));
+    if (x < SIMULATE_OUT_OF_CONTROL_BUFFER) {
+        client_log(client, BLOG_INFO, "out of control buffer, removing");
+        client_remove(client);
+        return -1;
+    }
+#endif
+    
+    // obtain location for writing the packet
+    if (!BufferWriter_StartPacket(client->output_control_input, &client->output_control_packet)) {
+        // out of buffer, kill client
+        client_log(client, BLOG_INFO, "out of control buffer, removing");
+        client_remove(client);
+        return -1;
+    }
+    
+    client->output_control_packet_len = len;
+    
+    if (data) {
+        *data = client->output_control_packet + sizeof(struct sc_header);
+    }
+    
+    return 0;
+}
+
+void client_end_control_packet (struct client_data *client, uint8_t type)
+{
+    ASSERT(INITSTATUS_HASLINK(client->initstatus))
+    ASSERT(!client->dying)
+    ASSERT(client->output_control_packet_len >= 0)
+    ASSERT(client->output_control_packet_len <= SC_MAX_PAYLOAD)
+    
+    // write header
+    struct sc_header header;
+    header.type = htol8(type);
+    memcpy(client->output_control_packet, &header, sizeof(header));
+    
+    // finish writing packet
+    BufferWriter_EndPacket(client->output_control_input, sizeof(struct sc_header) + client->output_control_packet_len);
+    
+    client->output_control_packet_len = -1;
+}
+
+int client_send_newclient (struct client_data *client, struct client_data *nc, int relay_server, int relay_client)
+{
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
+    ASSERT(nc->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!nc->dying)
+    
+    // report removed peers first, in case nc reuses the ID of one
+    if (client_flush_endclients(client) < 0) {
+        return -1;
+    }
+    
+    int flags = 0;
+    if (relay_server) {
+        flags |= SCID_NEWCLIENT_FLAG_RELAY_SERVER;
+    }
+    if (relay_client) {
+        flags |= SCID_NEWCLIENT_FLAG_RELAY_CLIENT;
+    }
+    if (options.ssl && client->version > SC_OLDVERSION_NOSSL && nc->version > SC_OLDVERSION_NOSSL) {
+        flags |= SCID_NEWCLIENT_FLAG_SSL;
+    }
+    
+    uint8_t *cert_data = NULL;
+    int cert_len = 0;
+    if (options.ssl && client->version > SC_OLDVERSION_NOCERTHASH) {
+        // the client asks for the certificate if it does not have it
+        flags |= SCID_NEWCLIENT_FLAG_CERT_HASH;
+        cert_data = nc->cert_hash;
+        cert_len = SC_CERT_HASH_LEN;
+    }
+    else if (options.ssl) {
+        cert_data = (client->version == SC_OLDVERSION_BROKENCERT ?  nc->cert_old : nc->cert);
+        cert_len = (client->version == SC_OLDVERSION_BROKENCERT ?  nc->cert_old_len : nc->cert_len);
+    }
     
     struct sc_server_newclient omsg;
     void *pack;
@@ -1482,6 +2766,48 @@ int client_send_endclient (struct client_data *client, peerid_t end_id)
     return 0;
 }
 
+int client_send_endclients (struct client_data *client, const peerid_t *end_ids, int num_ids)
+{
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
+    ASSERT(client->version > SC_OLDVERSION_NOBATCH)
+    ASSERT(num_ids > 0)
+    ASSERT(num_ids <= SCID_ENDCLIENTS_MAX_IDS)
+    
+    void *pack;
+    if (client_start_control_packet(client, &pack, num_ids * sizeof(struct sc_server_endclient)) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < num_ids; i++) {
+        struct sc_server_endclient omsg;
+        omsg.id = htol16(end_ids[i]);
+        memcpy((char *)pack + i * sizeof(omsg), &omsg, sizeof(omsg));
+    }
+    client_end_control_packet(client, SCID_ENDCLIENTS);
+    
+    return 0;
+}
+
+int client_flush_endclients (struct client_data *client)
+{
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
+    
+    if (client->endclients_num == 0) {
+        return 0;
+    }
+    
+    int num_ids = client->endclients_num;
+    client->endclients_num = 0;
+    BReactor_RemoveTimer(&ss, &client->endclients_timer);
+    
+    if (num_ids == 1) {
+        return client_send_endclient(client, client->endclients_ids[0]);
+    }
+    
+    return client_send_endclients(client, client->endclients_ids, num_ids);
+}
+
 void client_input_handler_send (struct client_data *client, uint8_t *data, int data_len)
 {
     ASSERT(data_len >= 0)
@@ -1510,6 +2836,11 @@ void client_input_handler_send (struct client_data *client, uint8_t *data, int d
     ASSERT(data_len >= 0)
     ASSERT(data_len <= SC_MAX_PAYLOAD)
     
+    // pass packets concerning pairs synchronized by another server to it
+    if ((type == SCID_OUTMSG || type == SCID_RESETPEER || type == SCID_ACCEPTPEER) && client_forward_to_cluster(client, type, data, data_len)) {
+        return;
+    }
+    
     // perform action based on packet type
     switch (type) {
         case SCID_KEEPALIVE:
@@ -1519,7 +2850,7 @@ void client_input_handler_send (struct client_data *client, uint8_t *data, int d
             process_packet_hello(client, data, data_len);
             return;
         case SCID_OUTMSG:
-            process_packet_outmsg(client, data, data_len);
+            process_packet_outmsg(client, data, data_len, (!client->remote && client->thread_index < 0 ? &client->input_decoder : NULL));
             return;
         case SCID_RESETPEER:
             process_packet_resetpeer(client, data, data_len);
@@ -1527,6 +2858,9 @@ void client_input_handler_send (struct client_data *client, uint8_t *data, int d
         case SCID_ACCEPTPEER:
             process_packet_acceptpeer(client, data, data_len);
             return;
+        case SCID_GETCERT:
+            process_packet_getcert(client, data, data_len);
+            return;
         default:
             client_log(client, BLOG_NOTICE, "unknown packet type %d, removing", (int)type);
             client_remove(client);
@@ -1554,6 +2888,8 @@ void process_packet_hello (struct client_data *client, uint8_t *data, int data_l
     
     switch (client->version) {
         case SC_VERSION:
+        case SC_OLDVERSION_NOCERTHASH:
+        case SC_OLDVERSION_NOBATCH:
         case SC_OLDVERSION_NOSSL:
         case SC_OLDVERSION_BROKENCERT:
             break;
@@ -1565,40 +2901,28 @@ void process_packet_hello (struct client_data *client, uint8_t *data, int data_l
     
     client_log(client, BLOG_INFO, "received hello");
     
-    // set client state to complete
-    client->initstatus = INITSTATUS_COMPLETE;
-    
-    // publish client
-    for (LinkedList1Node *list_node = LinkedList1_GetFirst(&clients); list_node; list_node = LinkedList1Node_Next(list_node)) {
-        struct client_data *client2 = UPPER_OBJECT(list_node, struct client_data, list_node);
-        if (client2 == client || client2->initstatus != INITSTATUS_COMPLETE || client2->dying || !clients_allowed(client, client2)) {
-            continue;
-        }
-        
-        // create flow from client to client2
-        struct peer_flow *flow_to = peer_flow_create(client, client2);
-        if (!flow_to) {
-            client_log(client, BLOG_ERROR, "failed to allocate flow to %d", (int)client2->id);
-            goto fail;
-        }
-        
-        // create flow from client2 to client
-        struct peer_flow *flow_from = peer_flow_create(client2, client);
-        if (!flow_from) {
-            client_log(client, BLOG_ERROR, "failed to allocate flow from %d", (int)client2->id);
-            goto fail;
-        }
-        
-        // set opposite flow pointers
-        flow_to->opposite = flow_from;
-        flow_from->opposite = flow_to;
-        
-        // launch pair
-        if (!launch_pair(flow_to)) {
+    // get predicate class, now that the common name is known
+    if (options.comm_predicate || options.relay_predicate || num_client_classes > 0) {
+        BIPAddr ipaddr;
+        BAddr_GetIPAddr(&client->addr, &ipaddr);
+        if (!(client->pred_class = predicate_class_get((client->common_name ? client->common_name : ""), ipaddr))) {
+            client_log(client, BLOG_ERROR, "hello: predicate_class_get failed");
+            client_remove(client);
             return;
         }
     }
     
+    // set client state to complete
+    client->initstatus = INITSTATUS_COMPLETE;
+    
+    // apply client class, before flows from the client are created
+    client_apply_class(client);
+    
+    // publish client
+    if (!client_publish(client)) {
+        return;
+    }
+    
     // send hello
     struct sc_server_hello omsg;
     void *pack;
@@ -1611,13 +2935,11 @@ void process_packet_hello (struct client_data *client, uint8_t *data, int data_l
     memcpy(pack, &omsg, sizeof(omsg));
     client_end_control_packet(client, SCID_SERVERHELLO);
     
-    return;
-    
-fail:
-    client_remove(client);
+    // publish client to the other servers
+    cluster_publish_client(client);
 }
 
-void process_packet_outmsg (struct client_data *client, uint8_t *data, int data_len)
+void process_packet_outmsg (struct client_data *client, uint8_t *data, int data_len, PacketProtoDecoder *decoder)
 {
     if (client->initstatus != INITSTATUS_COMPLETE) {
         client_log(client, BLOG_NOTICE, "outmsg: not expected");
@@ -1674,18 +2996,12 @@ void process_packet_outmsg (struct client_data *client, uint8_t *data, int data_
 #endif
     
     // send packet
-    struct sc_server_inmsg omsg;
-    void *pack;
-    if (!peer_flow_start_packet(flow, &pack, sizeof(omsg) + payload_size)) {
+    if (!peer_flow_send_message(flow, payload, payload_size, decoder)) {
         // out of buffer, reset these two clients
         client_log(client, BLOG_WARNING, "out of buffer; resetting to %d", (int)flow->dest_client->id);
         peer_flow_start_reset(flow);
         return;
     }
-    omsg.clientid = htol16(client->id);
-    memcpy(pack, &omsg, sizeof(omsg));
-    memcpy((char *)pack + sizeof(omsg), payload, payload_size);
-    peer_flow_end_packet(flow, SCID_INMSG);
 }
 
 void process_packet_resetpeer (struct client_data *client, uint8_t *data, int data_len)
@@ -1780,6 +3096,95 @@ void process_packet_acceptpeer (struct client_data *client, uint8_t *data, int d
     }
 }
 
+void process_packet_getcert (struct client_data *client, uint8_t *data, int data_len)
+{
+    if (client->initstatus != INITSTATUS_COMPLETE || !options.ssl || client->version <= SC_OLDVERSION_NOCERTHASH) {
+        client_log(client, BLOG_NOTICE, "getcert: not expected");
+        client_remove(client);
+        return;
+    }
+    
+    if (data_len != sizeof(struct sc_client_getcert)) {
+        client_log(client, BLOG_NOTICE, "getcert: wrong size");
+        client_remove(client);
+        return;
+    }
+    
+    struct sc_client_getcert msg;
+    memcpy(&msg, data, sizeof(msg));
+    peerid_t id = ltoh16(msg.clientid);
+    
+    // only give out certificates of peers the client has been told about
+    struct client_data *nc = NULL;
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&client->know_out_list); node; node = LinkedList1Node_Next(node)) {
+        struct peer_know *k = UPPER_OBJECT(node, struct peer_know, from_node);
+        if (k->to->id == id && !BPending_IsSet(&k->inform_job)) {
+            nc = k->to;
+            break;
+        }
+    }
+    if (!nc) {
+        // the peer has probably gone away and the client will learn so
+        // from the endclient we have sent; this is expected
+        client_log(client, BLOG_INFO, "getcert: %d not known", (int)id);
+        return;
+    }
+    
+    client_log(client, BLOG_DEBUG, "sending certificate of %d", (int)id);
+    
+    struct sc_server_cert omsg;
+    void *pack;
+    if (client_start_control_packet(client, &pack, sizeof(omsg) + nc->cert_len) < 0) {
+        return;
+    }
+    omsg.id = htol16(nc->id);
+    memcpy(pack, &omsg, sizeof(omsg));
+    memcpy((char *)pack + sizeof(omsg), nc->cert, nc->cert_len);
+    client_end_control_packet(client, SCID_CERT);
+}
+
+int client_publish (struct client_data *client)
+{
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
+    
+    for (LinkedList1Node *list_node = LinkedList1_GetFirst(&clients); list_node; list_node = LinkedList1Node_Next(list_node)) {
+        struct client_data *client2 = UPPER_OBJECT(list_node, struct client_data, list_node);
+        if (client2 == client || client2->initstatus != INITSTATUS_COMPLETE || client2->dying || !pair_is_local(client, client2) || !clients_allowed(client, client2)) {
+            continue;
+        }
+        
+        // create flow from client to client2
+        struct peer_flow *flow_to = peer_flow_create(client, client2);
+        if (!flow_to) {
+            client_log(client, BLOG_ERROR, "failed to allocate flow to %d", (int)client2->id);
+            goto fail;
+        }
+        
+        // create flow from client2 to client
+        struct peer_flow *flow_from = peer_flow_create(client2, client);
+        if (!flow_from) {
+            client_log(client, BLOG_ERROR, "failed to allocate flow from %d", (int)client2->id);
+            goto fail;
+        }
+        
+        // set opposite flow pointers
+        flow_to->opposite = flow_from;
+        flow_from->opposite = flow_to;
+        
+        // launch pair
+        if (!launch_pair(flow_to)) {
+            return 0;
+        }
+    }
+    
+    return 1;
+    
+fail:
+    client_remove(client);
+    return 0;
+}
+
 struct peer_flow * peer_flow_create (struct client_data *src_client, struct client_data *dest_client)
 {
     ASSERT(src_client->initstatus == INITSTATUS_COMPLETE)
@@ -1850,25 +3255,37 @@ int peer_flow_init_io (struct peer_flow *flow)
     
     // init queue flow
     PacketPassFairQueueFlow_Init(&flow->qflow, &flow->dest_client->output_peers_fairqueue);
+    PacketPassFairQueueFlow_SetWeight(&flow->qflow, flow->src_client->relay_weight);
     
-    // init PacketProtoFlow
-    if (!PacketProtoFlow_Init(
-        &flow->oflow, SC_MAX_ENC, CLIENT_PEER_FLOW_BUFFER_MIN_PACKETS,
-        PacketPassFairQueueFlow_GetInput(&flow->qflow), BReactor_PendingGroup(&ss)
-    )) {
-        BLog(BLOG_ERROR, "PacketProtoFlow_Init failed");
+    // init queue flow input
+    flow->qflow_input = PacketPassFairQueueFlow_GetInput(&flow->qflow);
+    PacketPassInterface_Sender_Init(flow->qflow_input, (PacketPassInterface_handler_done)peer_flow_qflow_handler_done, flow);
+    
+    // allocate packet queue
+    if (!(flow->queue = (struct peer_flow_packet *)BAllocArray(CLIENT_PEER_FLOW_QUEUE_PACKETS, sizeof(flow->queue[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
         goto fail1;
     }
-    flow->input = PacketProtoFlow_GetInput(&flow->oflow);
+    flow->queue_start = 0;
+    flow->queue_count = 0;
+    flow->queue_refs = 0;
     
-    // set no packet
-    flow->packet_len = -1;
+    // allocate buffer
+    if (!(flow->buf = (uint8_t *)BAlloc(PEER_FLOW_BUF_SIZE))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail2;
+    }
+    flow->buf_start = 0;
+    flow->buf_end = 0;
+    flow->buf_count = 0;
     
     // set have I/O
     flow->have_io = 1;
     
     return 1;
     
+fail2:
+    BFree(flow->queue);
 fail1:
     PacketPassFairQueueFlow_Free(&flow->qflow);
     return 0;
@@ -1879,8 +3296,16 @@ void peer_flow_free_io (struct peer_flow *flow)
     ASSERT(flow->have_io)
     PacketPassFairQueueFlow_AssertFree(&flow->qflow);
     
-    // free PacketProtoFlow
-    PacketProtoFlow_Free(&flow->oflow);
+    // release queued packets
+    while (flow->queue_count > 0) {
+        peer_flow_release_packet(flow);
+    }
+    
+    // free buffer
+    BFree(flow->buf);
+    
+    // free packet queue
+    BFree(flow->queue);
     
     // free queue flow
     PacketPassFairQueueFlow_Free(&flow->qflow);
@@ -1911,7 +3336,7 @@ void peer_flow_disconnect (struct peer_flow *flow)
     PacketPassFairQueueFlow_SetBusyHandler(&flow->qflow, (PacketPassFairQueue_handler_busy)peer_flow_handler_canremove, flow);
 }
 
-int peer_flow_start_packet (struct peer_flow *flow, void **data, int len)
+int peer_flow_send_message (struct peer_flow *flow, const uint8_t *payload, int payload_len, PacketProtoDecoder *decoder)
 {
     ASSERT(flow->dest_client->initstatus == INITSTATUS_COMPLETE)
     ASSERT(!flow->dest_client->dying)
@@ -1920,41 +3345,134 @@ int peer_flow_start_packet (struct peer_flow *flow, void **data, int len)
     ASSERT(!flow->resetting)
     ASSERT(!flow->opposite->resetting)
     ASSERT(flow->have_io)
-    ASSERT(flow->packet_len == -1)
-    ASSERT(len >= 0)
-    ASSERT(len <= SC_MAX_PAYLOAD)
-    ASSERT(!(len > 0) || data)
+    ASSERT(payload_len >= 0)
+    ASSERT(payload_len <= SC_MAX_MSGLEN)
     
-    // obtain location for writing the packet
-    if (!BufferWriter_StartPacket(flow->input, &flow->packet)) {
+    if (flow->queue_count == CLIENT_PEER_FLOW_QUEUE_PACKETS) {
         return 0;
     }
+    struct peer_flow_packet *p = &flow->queue[(flow->queue_start + flow->queue_count) % CLIENT_PEER_FLOW_QUEUE_PACKETS];
+    
+    // build headers
+    uint8_t header[PEER_FLOW_HEADER_LEN];
+    struct packetproto_header pp_header;
+    pp_header.len = htol16(sizeof(struct sc_header) + sizeof(struct sc_server_inmsg) + payload_len);
+    struct sc_header sc_header;
+    sc_header.type = SCID_INMSG;
+    struct sc_server_inmsg omsg;
+    omsg.clientid = htol16(flow->src_client->id);
+    memcpy(header, &pp_header, sizeof(pp_header));
+    memcpy(header + sizeof(pp_header), &sc_header, sizeof(sc_header));
+    memcpy(header + sizeof(pp_header) + sizeof(sc_header), &omsg, sizeof(omsg));
+    
+    // If the payload is in a decoder buffer and the headers can be sent in front of it,
+    // reference the buffer instead of copying the payload. Limit the number of
+    // references so the referenced buffers don't take more memory than copies would.
+    if (decoder && PacketPassInterface_HasSendV(flow->qflow_input) && flow->queue_refs < CLIENT_PEER_FLOW_BUFFER_MIN_PACKETS &&
+        (p->ref = PacketProtoDecoder_RefPacket(decoder))
+    ) {
+        memcpy(p->header, header, sizeof(header));
+        p->data = payload;
+        p->data_len = payload_len;
+        flow->queue_refs++;
+    } else {
+        // find space in the buffer
+        int len = sizeof(header) + payload_len;
+        int offset;
+        if (flow->buf_count == 0) {
+            offset = 0;
+        }
+        else if (flow->buf_end > flow->buf_start) {
+            if (len <= PEER_FLOW_BUF_SIZE - flow->buf_end) {
+                offset = flow->buf_end;
+            }
+            else if (len <= flow->buf_start) {
+                offset = 0;
+            }
+            else {
+                return 0;
+            }
+        }
+        else {
+            if (len > flow->buf_start - flow->buf_end) {
+                return 0;
+            }
+            offset = flow->buf_end;
+        }
+        
+        // copy packet
+        memcpy(flow->buf + offset, header, sizeof(header));
+        memcpy(flow->buf + offset + sizeof(header), payload, payload_len);
+        p->ref = NULL;
+        p->data = flow->buf + offset;
+        p->data_len = len;
+        flow->buf_end = offset + len;
+        flow->buf_count++;
+    }
     
-    // remember packet length
-    flow->packet_len = len;
+    flow->queue_count++;
     
-    if (data) {
-        *data = flow->packet + sizeof(struct sc_header);
+    // start sending if this is the only packet
+    if (flow->queue_count == 1) {
+        peer_flow_send_next(flow);
     }
+    
     return 1;
 }
 
-void peer_flow_end_packet (struct peer_flow *flow, uint8_t type)
+void peer_flow_send_next (struct peer_flow *flow)
 {
     ASSERT(flow->have_io)
-    ASSERT(flow->packet_len >= 0)
-    ASSERT(flow->packet_len <= SC_MAX_PAYLOAD)
+    ASSERT(flow->queue_count > 0)
     
-    // write header
-    struct sc_header header;
-    header.type = type;
-    memcpy(flow->packet, &header, sizeof(header));
+    struct peer_flow_packet *p = &flow->queue[flow->queue_start];
     
-    // finish writing packet
-    BufferWriter_EndPacket(flow->input, sizeof(struct sc_header) + flow->packet_len);
+    if (p->ref) {
+        struct PacketPassInterface_buf bufs[2];
+        bufs[0].data = p->header;
+        bufs[0].len = sizeof(p->header);
+        bufs[1].data = (uint8_t *)p->data;
+        bufs[1].len = p->data_len;
+        PacketPassInterface_Sender_SendV(flow->qflow_input, bufs, 2);
+    } else {
+        PacketPassInterface_Sender_Send(flow->qflow_input, (uint8_t *)p->data, p->data_len);
+    }
+}
+
+void peer_flow_release_packet (struct peer_flow *flow)
+{
+    ASSERT(flow->have_io)
+    ASSERT(flow->queue_count > 0)
+    
+    struct peer_flow_packet *p = &flow->queue[flow->queue_start];
+    
+    if (p->ref) {
+        PacketProtoDecoderBuffer_Unref(p->ref);
+        flow->queue_refs--;
+    } else {
+        flow->buf_count--;
+        if (flow->buf_count == 0) {
+            flow->buf_start = 0;
+            flow->buf_end = 0;
+        } else {
+            flow->buf_start = (p->data - flow->buf) + p->data_len;
+        }
+    }
     
-    // set have no packet
-    flow->packet_len = -1;
+    flow->queue_start = (flow->queue_start + 1) % CLIENT_PEER_FLOW_QUEUE_PACKETS;
+    flow->queue_count--;
+}
+
+void peer_flow_qflow_handler_done (struct peer_flow *flow)
+{
+    ASSERT(flow->have_io)
+    ASSERT(flow->queue_count > 0)
+    
+    peer_flow_release_packet(flow);
+    
+    if (flow->queue_count > 0) {
+        peer_flow_send_next(flow);
+    }
 }
 
 void peer_flow_handler_canremove (struct peer_flow *flow)
@@ -2077,7 +3595,8 @@ peerid_t new_client_id (void)
     ASSERT(clients_num < options.max_clients)
     
     for (int i = 0; i < options.max_clients; i++) {
-        peerid_t id = clients_nextid++;
+        peerid_t id = clients_id_base + clients_nextid;
+        clients_nextid = (clients_nextid + 1) % clients_id_count;
         if (!find_client_by_id(id)) {
             return id;
         }
@@ -2097,146 +3616,379 @@ struct client_data * find_client_by_id (peerid_t id)
     return UPPER_OBJECT(node, struct client_data, tree_node);
 }
 
-int clients_allowed (struct client_data *client1, struct client_data *client2)
+struct predicate_class * predicate_class_get (const char *name, BIPAddr addr)
 {
-    ASSERT(client1->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!client1->dying)
-    ASSERT(client2->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!client2->dying)
-    
-    if (!options.comm_predicate) {
-        return 1;
+    // look for an existing class
+    struct predicate_class key;
+    key.name = (char *)name;
+    key.addr = addr;
+    BAVLNode *node = BAVL_LookupExact(&predicate_classes_tree, &key);
+    if (node) {
+        struct predicate_class *c = UPPER_OBJECT(node, struct predicate_class, tree_node);
+        c->refcnt++;
+        return c;
     }
     
-    // set values to compare against
-    comm_predicate_p1name = (client1->common_name ? client1->common_name : "");
-    comm_predicate_p2name = (client2->common_name ? client2->common_name : "");
-    BAddr_GetIPAddr(&client1->addr, &comm_predicate_p1addr);
-    BAddr_GetIPAddr(&client2->addr, &comm_predicate_p2addr);
+    // allocate structure
+    struct predicate_class *c = (struct predicate_class *)malloc(sizeof(*c));
+    if (!c) {
+        goto fail0;
+    }
     
-    // evaluate predicate
-    int res = BPredicate_Eval(&comm_predicate);
-    if (res < 0) {
-        return 0;
+    // copy name
+    if (!(c->name = b_strdup(name))) {
+        goto fail1;
     }
     
-    return res;
-}
-
-int comm_predicate_func_p1name_cb (void *user, void **args)
-{
-    char *arg = (char *)args[0];
+    // init arguments; IDs are never reused so that the caches
+    // need not be invalidated when a class is freed
+    c->id = predicate_next_class_id++;
+    c->addr = addr;
+    c->refcnt = 1;
+    c->attrs_known = 0;
+    c->attrs = 0;
+    
+    // insert to tree
+    ASSERT_EXECUTE(BAVL_Insert(&predicate_classes_tree, &c->tree_node, NULL))
     
-    return (!strcmp(arg, comm_predicate_p1name));
+    return c;
+    
+fail1:
+    free(c);
+fail0:
+    return NULL;
 }
 
-int comm_predicate_func_p2name_cb (void *user, void **args)
+void predicate_class_unref (struct predicate_class *c)
 {
-    char *arg = (char *)args[0];
+    ASSERT(c->refcnt > 0)
+    
+    if (--c->refcnt > 0) {
+        return;
+    }
+    
+    // remove from tree
+    BAVL_Remove(&predicate_classes_tree, &c->tree_node);
+    
+    // free name
+    free(c->name);
     
-    return (!strcmp(arg, comm_predicate_p2name));
+    // free structure
+    free(c);
 }
 
-int comm_predicate_func_p1addr_cb (void *user, void **args)
+int predicate_class_comparator (void *unused, struct predicate_class *c1, struct predicate_class *c2)
 {
-    char *arg = (char *)args[0];
+    int cmp = strcmp(c1->name, c2->name);
+    if (cmp) {
+        return B_COMPARE(cmp, 0);
+    }
     
-    BIPAddr addr;
-    if (!BIPAddr_Resolve(&addr, arg, 1)) {
-        BLog(BLOG_WARNING, "failed to parse address");
-        return -1;
+    if (c1->addr.type != c2->addr.type) {
+        return B_COMPARE(c1->addr.type, c2->addr.type);
+    }
+    
+    switch (c1->addr.type) {
+        case BADDR_TYPE_IPV4:
+            cmp = memcmp(&c1->addr.ipv4, &c2->addr.ipv4, sizeof(c1->addr.ipv4));
+            break;
+        case BADDR_TYPE_IPV6:
+            cmp = memcmp(c1->addr.ipv6, c2->addr.ipv6, sizeof(c1->addr.ipv6));
+            break;
+        default:
+            cmp = 0;
+            break;
     }
     
-    return BIPAddr_Compare(&addr, &comm_predicate_p1addr);
+    return B_COMPARE(cmp, 0);
 }
 
-int comm_predicate_func_p2addr_cb (void *user, void **args)
+int predicate_class_test (struct predicate_class *c, char *str, int is_addr)
 {
-    char *arg = (char *)args[0];
+    struct predicate_arg *a = predicate_get_arg(str, is_addr);
+    if (!a) {
+        return -1;
+    }
     
-    BIPAddr addr;
-    if (!BIPAddr_Resolve(&addr, arg, 1)) {
-        BLog(BLOG_WARNING, "failed to parse address");
+    if (is_addr && !a->addr_ok) {
         return -1;
     }
     
-    return BIPAddr_Compare(&addr, &comm_predicate_p2addr);
-}
-
-int relay_allowed (struct client_data *client, struct client_data *relay)
-{
-    if (!options.relay_predicate) {
-        return 0;
+    // use remembered value
+    uint64_t bit = (a->attr >= 0 ? (uint64_t)1 << a->attr : 0);
+    if ((c->attrs_known & bit)) {
+        return !!(c->attrs & bit);
     }
     
-    // set values to compare against
-    relay_predicate_pname = (client->common_name ? client->common_name : "");
-    relay_predicate_rname = (relay->common_name ? relay->common_name : "");
-    BAddr_GetIPAddr(&client->addr, &relay_predicate_paddr);
-    BAddr_GetIPAddr(&relay->addr, &relay_predicate_raddr);
+    int res = (is_addr ? BIPAddr_Compare(&a->addr, &c->addr) : !strcmp(str, c->name));
     
-    // evaluate predicate
-    int res = BPredicate_Eval(&relay_predicate);
-    if (res < 0) {
-        return 0;
+    // remember value
+    c->attrs_known |= bit;
+    if (res) {
+        c->attrs |= bit;
     }
     
     return res;
 }
 
-int relay_predicate_func_pname_cb (void *user, void **args)
-{
-    char *arg = (char *)args[0];
-    
-    return (!strcmp(arg, relay_predicate_pname));
-}
-
-int relay_predicate_func_rname_cb (void *user, void **args)
+struct predicate_arg * predicate_get_arg (char *str, int is_addr)
 {
-    char *arg = (char *)args[0];
+    // strings are owned by the predicates and do not move, so
+    // they are identified by their pointers
+    struct predicate_arg key;
+    key.str = str;
+    key.is_addr = is_addr;
+    BAVLNode *node = BAVL_LookupExact(&predicate_args_tree, &key);
+    if (node) {
+        return UPPER_OBJECT(node, struct predicate_arg, tree_node);
+    }
     
-    return (!strcmp(arg, relay_predicate_rname));
-}
-
-int relay_predicate_func_paddr_cb (void *user, void **args)
-{
-    char *arg = (char *)args[0];
+    // allocate structure
+    struct predicate_arg *a = (struct predicate_arg *)malloc(sizeof(*a));
+    if (!a) {
+        BLog(BLOG_ERROR, "predicate: failed to allocate argument");
+        return NULL;
+    }
     
-    BIPAddr addr;
-    if (!BIPAddr_Resolve(&addr, arg, 1)) {
-        BLog(BLOG_ERROR, "paddr: failed to parse address");
-        return -1;
+    // init arguments
+    a->str = str;
+    a->is_addr = is_addr;
+    a->attr = (predicate_num_attrs < PREDICATE_MAX_ATTRS ? predicate_num_attrs++ : -1);
+    
+    // parse address once
+    a->addr_ok = 0;
+    if (is_addr) {
+        if (!(a->addr_ok = BIPAddr_Resolve(&a->addr, str, 1))) {
+            BLog(BLOG_WARNING, "predicate: failed to parse address %s", str);
+        }
     }
     
-    return BIPAddr_Compare(&addr, &relay_predicate_paddr);
+    // insert to tree
+    ASSERT_EXECUTE(BAVL_Insert(&predicate_args_tree, &a->tree_node, NULL))
+    
+    return a;
 }
 
-int relay_predicate_func_raddr_cb (void *user, void **args)
+int predicate_arg_comparator (void *unused, struct predicate_arg *a1, struct predicate_arg *a2)
 {
-    char *arg = (char *)args[0];
-    
-    BIPAddr addr;
-    if (!BIPAddr_Resolve(&addr, arg, 1)) {
-        BLog(BLOG_ERROR, "raddr: failed to parse address");
-        return -1;
+    if (a1->str != a2->str) {
+        return B_COMPARE((uintptr_t)a1->str, (uintptr_t)a2->str);
     }
     
-    return BIPAddr_Compare(&addr, &relay_predicate_raddr);
+    return B_COMPARE(a1->is_addr, a2->is_addr);
 }
 
-int peerid_comparator (void *unused, peerid_t *p1, peerid_t *p2)
+struct predicate_cache_entry * predicate_cache_slot (struct predicate_cache_entry *cache, struct predicate_class *c1, struct predicate_class *c2)
 {
-    return B_COMPARE(*p1, *p2);
+    uint64_t h = (c1->id * UINT64_C(0x9E3779B97F4A7C15)) ^ (c2->id * UINT64_C(0xC2B2AE3D27D4EB4F));
+    
+    return &cache[(h >> 32) % PREDICATE_CACHE_SIZE];
 }
 
-struct peer_know * create_know (struct client_data *from, struct client_data *to, int relay_server, int relay_client)
+int clients_allowed (struct client_data *client1, struct client_data *client2)
 {
-    ASSERT(from->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!from->dying)
-    ASSERT(to->initstatus == INITSTATUS_COMPLETE)
-    ASSERT(!to->dying)
-    
-    // allocate structure
+    ASSERT(client1->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client1->dying)
+    ASSERT(client2->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client2->dying)
+    
+    if (!options.comm_predicate) {
+        return 1;
+    }
+    
+    // clients of the same classes always get the same result
+    struct predicate_cache_entry *e = predicate_cache_slot(comm_predicate_cache, client1->pred_class, client2->pred_class);
+    if (e->id1 == client1->pred_class->id && e->id2 == client2->pred_class->id) {
+        return e->res;
+    }
+    
+    // set values to compare against
+    comm_predicate_p1class = client1->pred_class;
+    comm_predicate_p2class = client2->pred_class;
+    
+    // evaluate predicate
+    int res = BPredicate_Eval(&comm_predicate);
+    if (res < 0) {
+        res = 0;
+    }
+    
+    // remember result
+    e->id1 = client1->pred_class->id;
+    e->id2 = client2->pred_class->id;
+    e->res = res;
+    
+    return res;
+}
+
+int comm_predicate_func_p1name_cb (void *user, void **args)
+{
+    return predicate_class_test(comm_predicate_p1class, (char *)args[0], 0);
+}
+
+int comm_predicate_func_p2name_cb (void *user, void **args)
+{
+    return predicate_class_test(comm_predicate_p2class, (char *)args[0], 0);
+}
+
+int comm_predicate_func_p1addr_cb (void *user, void **args)
+{
+    return predicate_class_test(comm_predicate_p1class, (char *)args[0], 1);
+}
+
+int comm_predicate_func_p2addr_cb (void *user, void **args)
+{
+    return predicate_class_test(comm_predicate_p2class, (char *)args[0], 1);
+}
+
+int relay_allowed (struct client_data *client, struct client_data *relay)
+{
+    if (!options.relay_predicate) {
+        return 0;
+    }
+    
+    // clients of the same classes always get the same result
+    struct predicate_cache_entry *e = predicate_cache_slot(relay_predicate_cache, client->pred_class, relay->pred_class);
+    if (e->id1 == client->pred_class->id && e->id2 == relay->pred_class->id) {
+        return e->res;
+    }
+    
+    // set values to compare against
+    relay_predicate_pclass = client->pred_class;
+    relay_predicate_rclass = relay->pred_class;
+    
+    // evaluate predicate
+    int res = BPredicate_Eval(&relay_predicate);
+    if (res < 0) {
+        res = 0;
+    }
+    
+    // remember result
+    e->id1 = client->pred_class->id;
+    e->id2 = relay->pred_class->id;
+    e->res = res;
+    
+    return res;
+}
+
+int relay_predicate_func_pname_cb (void *user, void **args)
+{
+    return predicate_class_test(relay_predicate_pclass, (char *)args[0], 0);
+}
+
+int relay_predicate_func_rname_cb (void *user, void **args)
+{
+    return predicate_class_test(relay_predicate_rclass, (char *)args[0], 0);
+}
+
+int relay_predicate_func_paddr_cb (void *user, void **args)
+{
+    return predicate_class_test(relay_predicate_pclass, (char *)args[0], 1);
+}
+
+int relay_predicate_func_raddr_cb (void *user, void **args)
+{
+    return predicate_class_test(relay_predicate_rclass, (char *)args[0], 1);
+}
+
+int init_client_classes (void)
+{
+    num_client_classes = 0;
+    client_classes_limit_rate = 0;
+    
+    while (num_client_classes < options.num_client_classes) {
+        struct client_class *cc = &client_classes[num_client_classes];
+        
+        // init predicate
+        if (!BPredicate_Init(&cc->predicate, options.client_classes[num_client_classes].predicate)) {
+            BLog(BLOG_ERROR, "BPredicate_Init failed");
+            goto fail;
+        }
+        
+        // init functions
+        int args[] = {PREDICATE_TYPE_STRING};
+        BPredicateFunction_Init(&cc->func_pname, &cc->predicate, "pname", args, 1, client_class_func_pname_cb, NULL);
+        BPredicateFunction_Init(&cc->func_paddr, &cc->predicate, "paddr", args, 1, client_class_func_paddr_cb, NULL);
+        
+        cc->rate = options.client_classes[num_client_classes].rate;
+        cc->burst = (options.client_classes[num_client_classes].burst > 0 ? options.client_classes[num_client_classes].burst : 1);
+        cc->weight = options.client_classes[num_client_classes].weight;
+        
+        if (cc->rate > 0) {
+            client_classes_limit_rate = 1;
+        }
+        
+        num_client_classes++;
+    }
+    
+    return 1;
+    
+fail:
+    free_client_classes();
+    return 0;
+}
+
+void free_client_classes (void)
+{
+    while (num_client_classes > 0) {
+        num_client_classes--;
+        struct client_class *cc = &client_classes[num_client_classes];
+        BPredicateFunction_Free(&cc->func_paddr);
+        BPredicateFunction_Free(&cc->func_pname);
+        BPredicate_Free(&cc->predicate);
+    }
+}
+
+void client_apply_class (struct client_data *client)
+{
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(num_client_classes == 0 || client->pred_class)
+    
+    int rate = 0;
+    int burst = 0;
+    int weight = 1;
+    
+    client_class_pclass = client->pred_class;
+    
+    for (int i = 0; i < num_client_classes; i++) {
+        if (BPredicate_Eval(&client_classes[i].predicate) > 0) {
+            client_log(client, BLOG_INFO, "client class %d", i);
+            rate = client_classes[i].rate;
+            burst = client_classes[i].burst;
+            weight = client_classes[i].weight;
+            break;
+        }
+    }
+    
+    client->relay_weight = weight;
+    
+    if (client->have_input_limiter) {
+        PacketPassRateLimiter_SetRate(&client->input_limiter, rate, burst);
+    }
+}
+
+int client_class_func_pname_cb (void *user, void **args)
+{
+    return predicate_class_test(client_class_pclass, (char *)args[0], 0);
+}
+
+int client_class_func_paddr_cb (void *user, void **args)
+{
+    return predicate_class_test(client_class_pclass, (char *)args[0], 1);
+}
+
+int peerid_comparator (void *unused, peerid_t *p1, peerid_t *p2)
+{
+    return B_COMPARE(*p1, *p2);
+}
+
+struct peer_know * create_know (struct client_data *from, struct client_data *to, int relay_server, int relay_client)
+{
+    ASSERT(from->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!from->dying)
+    ASSERT(to->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!to->dying)
+    
+    // allocate structure
     struct peer_know *k = (struct peer_know *)malloc(sizeof(*k));
     if (!k) {
         return NULL;
@@ -2291,13 +4043,28 @@ void uninform_know (struct peer_know *k)
 {
     ASSERT(!k->from->dying)
     
-    // if 'from' has not been informed about 'to' yet, remove know, otherwise
-    // schedule informing 'from' that 'to' is no more
+    struct client_data *from = k->from;
+    
+    // if 'from' has not been informed about 'to' yet, remove know
     if (BPending_IsSet(&k->inform_job)) {
         remove_know(k);
-    } else {
-        BPending_Set(&k->uninform_job);
+        return;
+    }
+    
+    // if 'from' understands endclients packets, queue the ID so that peers
+    // removed at about the same time (e.g. when many clients disconnect at once)
+    // are reported together
+    if (from->version > SC_OLDVERSION_NOBATCH && from->endclients_num < SCID_ENDCLIENTS_MAX_IDS) {
+        from->endclients_ids[from->endclients_num++] = k->to->id;
+        if (!BTimer_IsRunning(&from->endclients_timer)) {
+            BReactor_SetTimer(&ss, &from->endclients_timer);
+        }
+        remove_know(k);
+        return;
     }
+    
+    // otherwise schedule informing 'from' that 'to' is no more
+    BPending_Set(&k->uninform_job);
 }
 
 void know_uninform_job_handler (struct peer_know *k)
@@ -2392,3 +4159,1316 @@ struct peer_flow * find_flow (struct client_data *client, peerid_t dest_id)
     
     return flow;
 }
+
+int pair_is_local (struct client_data *client1, struct client_data *client2)
+{
+    if (!client1->remote && !client2->remote) {
+        return 1;
+    }
+    
+    if (client1->remote && client2->remote) {
+        return 0;
+    }
+    
+    struct client_data *local_client = (client1->remote ? client2 : client1);
+    struct client_data *remote_client = (client1->remote ? client1 : client2);
+    
+    return (local_client->id < remote_client->id);
+}
+
+int init_cluster (void)
+{
+    // init links list
+    LinkedList1_Init(&cluster_links);
+    
+    have_cluster_listener = 0;
+    
+    if (options.cluster_nodes == 0) {
+        return 1;
+    }
+    
+    // init listener
+    if (options.cluster_listen_addr) {
+        if (!BListener_Init(&cluster_listener, cluster_listen_addr, &ss, NULL, (BListener_handler)cluster_listener_handler)) {
+            BLog(BLOG_ERROR, "cluster: BListener_Init failed");
+            return 0;
+        }
+        have_cluster_listener = 1;
+    }
+    
+    // start connecting to peers
+    for (int i = 0; i < num_cluster_peers; i++) {
+        struct cluster_peer *peer = &cluster_peers[i];
+        peer->connecting = 0;
+        peer->link = NULL;
+        BTimer_Init(&peer->retry_timer, CLUSTER_RETRY_TIME, (BTimer_handler)cluster_peer_retry_timer_handler, peer);
+        cluster_peer_connect(peer);
+    }
+    
+    BLog(BLOG_NOTICE, "cluster node %d of %d, client IDs %d-%d", options.cluster_node_id, options.cluster_nodes, clients_id_base, clients_id_base + clients_id_count - 1);
+    
+    return 1;
+}
+
+void cluster_prepare_free (void)
+{
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&cluster_links); node; node = LinkedList1Node_Next(node)) {
+        struct cluster_link *link = UPPER_OBJECT(node, struct cluster_link, list_node);
+        PacketPassFairQueue_PrepareFree(&link->output_data_fairqueue);
+    }
+}
+
+void free_cluster (void)
+{
+    // free links
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&cluster_links)) {
+        struct cluster_link *link = UPPER_OBJECT(node, struct cluster_link, list_node);
+        cluster_link_dealloc(link);
+    }
+    
+    if (options.cluster_nodes == 0) {
+        return;
+    }
+    
+    // free peers
+    for (int i = 0; i < num_cluster_peers; i++) {
+        struct cluster_peer *peer = &cluster_peers[i];
+        if (peer->connecting) {
+            BConnector_Free(&peer->connector);
+        }
+        BReactor_RemoveTimer(&ss, &peer->retry_timer);
+    }
+    
+    // free listener
+    if (have_cluster_listener) {
+        BListener_Free(&cluster_listener);
+    }
+}
+
+int cluster_compute_buffer_size (void)
+{
+    // room for a newclient and an endclient for each of our clients which
+    // the other server is not keeping up with, and some for other packets
+    bsize_t s = bsize_add(bsize_fromsize(16), bsize_mul(bsize_fromsize(2), bsize_fromsize(options.max_clients)));
+    
+    if (s.is_overflow || s.value > INT_MAX) {
+        return INT_MAX;
+    } else {
+        return s.value;
+    }
+}
+
+void cluster_listener_handler (void *unused)
+{
+    cluster_link_init(NULL);
+}
+
+void cluster_peer_connect (struct cluster_peer *peer)
+{
+    ASSERT(!peer->connecting)
+    ASSERT(!peer->link)
+    
+    if (!BConnector_Init(&peer->connector, peer->addr, &ss, peer, (BConnector_handler)cluster_peer_connector_handler)) {
+        BLog(BLOG_ERROR, "cluster: BConnector_Init failed");
+        BReactor_SetTimer(&ss, &peer->retry_timer);
+        return;
+    }
+    
+    peer->connecting = 1;
+}
+
+void cluster_peer_connector_handler (struct cluster_peer *peer, int is_error)
+{
+    ASSERT(peer->connecting)
+    ASSERT(!peer->link)
+    
+    if (is_error) {
+        char addr[BADDR_MAX_PRINT_LEN];
+        BAddr_Print(&peer->addr, addr);
+        BLog(BLOG_INFO, "cluster: failed to connect to %s", addr);
+        BReactor_SetTimer(&ss, &peer->retry_timer);
+    } else {
+        cluster_link_init(peer);
+    }
+    
+    // free connector
+    BConnector_Free(&peer->connector);
+    peer->connecting = 0;
+}
+
+void cluster_peer_retry_timer_handler (struct cluster_peer *peer)
+{
+    ASSERT(!peer->connecting)
+    ASSERT(!peer->link)
+    
+    cluster_peer_connect(peer);
+}
+
+void cluster_link_init (struct cluster_peer *peer)
+{
+    ASSERT(!peer || peer->connecting)
+    ASSERT(!peer || !peer->link)
+    
+    // allocate the link structure
+    struct cluster_link *link = (struct cluster_link *)malloc(sizeof(*link));
+    if (!link) {
+        BLog(BLOG_ERROR, "cluster: failed to allocate link");
+        goto fail0;
+    }
+    
+    link->peer = peer;
+    link->state = CLUSTER_LINK_STATE_WAITHELLO;
+    link->node_id = -1;
+    
+    // init connection
+    struct BConnection_source source;
+    if (peer) {
+        link->addr = peer->addr;
+        source = BConnection_source_connector(&peer->connector);
+    } else {
+        source = BConnection_source_listener(&cluster_listener, &link->addr);
+    }
+    if (!BConnection_Init(&link->con, source, &ss, link, (BConnection_handler)cluster_link_connection_handler)) {
+        BLog(BLOG_ERROR, "cluster: BConnection_Init failed");
+        goto fail1;
+    }
+    
+    // init connection interfaces
+    BConnection_SendAsync_Init(&link->con);
+    BConnection_RecvAsync_Init(&link->con);
+    
+    // init input
+    PacketPassInterface_Init(&link->input_interface, CL_MAX_ENC, (PacketPassInterface_handler_send)cluster_link_input_handler_send, link, BReactor_PendingGroup(&ss));
+    if (!PacketProtoDecoder_Init(&link->input_decoder, BConnection_RecvAsync_GetIf(&link->con), &link->input_interface, BReactor_PendingGroup(&ss), link,
+        (PacketProtoDecoder_handler_error)cluster_link_decoder_handler_error
+    )) {
+        cluster_link_log(link, BLOG_ERROR, "PacketProtoDecoder_Init failed");
+        goto fail2;
+    }
+    
+    // init output common
+    int coalesce = options.client_send_coalesce;
+    if (coalesce > 0 && coalesce < PACKETPROTO_ENCLEN(CL_MAX_ENC)) {
+        coalesce = PACKETPROTO_ENCLEN(CL_MAX_ENC);
+    }
+    if (!PacketStreamSender_Init2(&link->output_sender, BConnection_SendAsync_GetIf(&link->con), PACKETPROTO_ENCLEN(CL_MAX_ENC), coalesce, BReactor_PendingGroup(&ss))) {
+        cluster_link_log(link, BLOG_ERROR, "PacketStreamSender_Init2 failed");
+        goto fail3;
+    }
+    PacketPassPriorityQueue_InitLevels(&link->output_priorityqueue, PacketStreamSender_GetInput(&link->output_sender), BReactor_PendingGroup(&ss), 0, 2);
+    
+    // init output control flow
+    PacketPassPriorityQueueFlow_Init(&link->output_control_qflow, &link->output_priorityqueue, 0);
+    if (!PacketProtoFlow_Init(
+        &link->output_control_oflow, CL_MAX_ENC, cluster_compute_buffer_size(),
+        PacketPassPriorityQueueFlow_GetInput(&link->output_control_qflow), BReactor_PendingGroup(&ss)
+    )) {
+        cluster_link_log(link, BLOG_ERROR, "PacketProtoFlow_Init failed");
+        goto fail4;
+    }
+    link->output_control_input = PacketProtoFlow_GetInput(&link->output_control_oflow);
+    link->output_control_packet_len = -1;
+    
+    // init output data flow
+    PacketPassPriorityQueueFlow_Init(&link->output_data_qflow, &link->output_priorityqueue, 1);
+    if (!PacketPassFairQueue_Init(&link->output_data_fairqueue, PacketPassPriorityQueueFlow_GetInput(&link->output_data_qflow), BReactor_PendingGroup(&ss), 0, 1)) {
+        cluster_link_log(link, BLOG_ERROR, "PacketPassFairQueue_Init failed");
+        goto fail5;
+    }
+    
+    // init output forward flow
+    PacketPassFairQueueFlow_Init(&link->output_forward_qflow, &link->output_data_fairqueue);
+    if (!PacketProtoFlow_Init(
+        &link->output_forward_oflow, sizeof(struct cl_header) + sizeof(struct cl_fromclient) + SC_MAX_ENC, CLUSTER_FORWARD_BUFFER_PACKETS,
+        PacketPassFairQueueFlow_GetInput(&link->output_forward_qflow), BReactor_PendingGroup(&ss)
+    )) {
+        cluster_link_log(link, BLOG_ERROR, "PacketProtoFlow_Init failed");
+        goto fail6;
+    }
+    link->output_forward_input = PacketProtoFlow_GetInput(&link->output_forward_oflow);
+    
+    // init lists
+    LinkedList1_Init(&link->proxies);
+    LinkedList1_Init(&link->flows);
+    
+    // init timers
+    BTimer_Init(&link->keepalive_timer, CL_KEEPALIVE_INTERVAL, (BTimer_handler)cluster_link_keepalive_timer_handler, link);
+    BReactor_SetTimerAfter(&ss, &link->keepalive_timer, 0);
+    link->hello_sent = 0;
+    link->input_held_len = -1;
+    BTimer_Init(&link->sync_timer, 0, (BTimer_handler)cluster_link_sync_timer_handler, link);
+    link->sync_node = NULL;
+    BTimer_Init(&link->no_data_timer, CLUSTER_NO_DATA_TIME_LIMIT, (BTimer_handler)cluster_link_no_data_timer_handler, link);
+    BReactor_SetTimer(&ss, &link->no_data_timer);
+    
+    // init failing
+    link->failing = 0;
+    BPending_Init(&link->fail_job, BReactor_PendingGroup(&ss), (BPending_handler)cluster_link_fail_job, link);
+    
+    // link in
+    LinkedList1_Append(&cluster_links, &link->list_node);
+    if (peer) {
+        peer->link = link;
+    }
+    
+    cluster_link_log(link, BLOG_INFO, "connected");
+    
+    return;
+    
+fail6:
+    PacketPassFairQueueFlow_Free(&link->output_forward_qflow);
+    PacketPassFairQueue_Free(&link->output_data_fairqueue);
+fail5:
+    PacketPassPriorityQueueFlow_Free(&link->output_data_qflow);
+    PacketProtoFlow_Free(&link->output_control_oflow);
+fail4:
+    PacketPassPriorityQueueFlow_Free(&link->output_control_qflow);
+    PacketPassPriorityQueue_Free(&link->output_priorityqueue);
+    PacketStreamSender_Free(&link->output_sender);
+fail3:
+    PacketProtoDecoder_Free(&link->input_decoder);
+fail2:
+    PacketPassInterface_Free(&link->input_interface);
+    BConnection_RecvAsync_Free(&link->con);
+    BConnection_SendAsync_Free(&link->con);
+    BConnection_Free(&link->con);
+fail1:
+    free(link);
+fail0:
+    if (peer) {
+        BReactor_SetTimer(&ss, &peer->retry_timer);
+    }
+}
+
+void cluster_link_dealloc (struct cluster_link *link)
+{
+    ASSERT(LinkedList1_IsEmpty(&link->proxies))
+    ASSERT(LinkedList1_IsEmpty(&link->flows))
+    
+    // link out
+    if (link->peer) {
+        link->peer->link = NULL;
+    }
+    LinkedList1_Remove(&cluster_links, &link->list_node);
+    
+    // free failing
+    BPending_Free(&link->fail_job);
+    
+    // free timers
+    BReactor_RemoveTimer(&ss, &link->sync_timer);
+    BReactor_RemoveTimer(&ss, &link->no_data_timer);
+    BReactor_RemoveTimer(&ss, &link->keepalive_timer);
+    
+    // allow freeing queue flows
+    PacketPassFairQueue_PrepareFree(&link->output_data_fairqueue);
+    PacketPassPriorityQueue_PrepareFree(&link->output_priorityqueue);
+    
+    // free output forward flow
+    PacketProtoFlow_Free(&link->output_forward_oflow);
+    PacketPassFairQueueFlow_Free(&link->output_forward_qflow);
+    
+    // free output data flow
+    PacketPassFairQueue_Free(&link->output_data_fairqueue);
+    PacketPassPriorityQueueFlow_Free(&link->output_data_qflow);
+    
+    // free output control flow
+    PacketProtoFlow_Free(&link->output_control_oflow);
+    PacketPassPriorityQueueFlow_Free(&link->output_control_qflow);
+    
+    // free output common
+    PacketPassPriorityQueue_Free(&link->output_priorityqueue);
+    PacketStreamSender_Free(&link->output_sender);
+    
+    // free input
+    PacketProtoDecoder_Free(&link->input_decoder);
+    PacketPassInterface_Free(&link->input_interface);
+    
+    // free connection
+    BConnection_RecvAsync_Free(&link->con);
+    BConnection_SendAsync_Free(&link->con);
+    BConnection_Free(&link->con);
+    
+    // free memory
+    free(link);
+}
+
+void cluster_link_remove (struct cluster_link *link)
+{
+    cluster_link_log(link, BLOG_INFO, "removing");
+    
+    // allow freeing outputs of remote clients
+    PacketPassFairQueue_PrepareFree(&link->output_data_fairqueue);
+    
+    // remove remote clients
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&link->proxies)) {
+        struct client_data *client = UPPER_OBJECT(node, struct client_data, cluster_list_node);
+        ASSERT(client->remote)
+        ASSERT(client->cluster_link == link)
+        ASSERT(client->cluster_have_qflow)
+        
+        // the server is gone, there's nobody to inform
+        if (!client->dying) {
+            client->cluster_kick = 0;
+            client_remove(client);
+        }
+        
+        // free output to the link
+        PacketPassFairQueueFlow_Free(&client->cluster_qflow);
+        client->cluster_have_qflow = 0;
+        
+        // unlink
+        LinkedList1_Remove(&link->proxies, &client->cluster_list_node);
+        client->cluster_link = NULL;
+        
+        // if the removal was waiting for the output, finish it
+        if (!BPending_IsSet(&client->dying_job)) {
+            client_dealloc(client);
+        }
+    }
+    
+    // detach flows to our clients, freeing them once their packets are sent
+    while (node = LinkedList1_GetFirst(&link->flows)) {
+        struct cluster_flow *flow = UPPER_OBJECT(node, struct cluster_flow, link_list_node);
+        ASSERT(flow->link == link)
+        
+        LinkedList1_Remove(&link->flows, &flow->link_list_node);
+        flow->link = NULL;
+        
+        if (PacketPassFairQueueFlow_IsBusy(&flow->qflow)) {
+            PacketPassFairQueueFlow_SetBusyHandler(&flow->qflow, (PacketPassFairQueue_handler_busy)cluster_flow_handler_canremove, flow);
+        } else {
+            cluster_flow_dealloc(flow);
+        }
+    }
+    
+    struct cluster_peer *peer = link->peer;
+    
+    // free link
+    cluster_link_dealloc(link);
+    
+    // reconnect later
+    if (peer) {
+        BReactor_SetTimer(&ss, &peer->retry_timer);
+    }
+}
+
+void cluster_link_fail (struct cluster_link *link)
+{
+    if (link->failing) {
+        return;
+    }
+    
+    // stop sending and receiving, and remove the link from a job, since we
+    // may be deep inside processing a client
+    link->failing = 1;
+    BPending_Set(&link->fail_job);
+}
+
+void cluster_link_fail_job (struct cluster_link *link)
+{
+    ASSERT(link->failing)
+    
+    cluster_link_remove(link);
+    return;
+}
+
+void cluster_link_logfunc (struct cluster_link *link)
+{
+    char addr[BADDR_MAX_PRINT_LEN];
+    BAddr_Print(&link->addr, addr);
+    
+    BLog_Append("cluster link (%s)", addr);
+    if (link->node_id >= 0) {
+        BLog_Append(" (node %d)", link->node_id);
+    }
+    BLog_Append(": ");
+}
+
+void cluster_link_log (struct cluster_link *link, int level, const char *fmt, ...)
+{
+    va_list vl;
+    va_start(vl, fmt);
+    BLog_LogViaFuncVarArg((BLog_logfunc)cluster_link_logfunc, link, BLOG_CURRENT_CHANNEL, level, fmt, vl);
+    va_end(vl);
+}
+
+void cluster_link_connection_handler (struct cluster_link *link, int event)
+{
+    if (event == BCONNECTION_EVENT_RECVCLOSED) {
+        cluster_link_log(link, BLOG_INFO, "connection closed");
+    } else {
+        cluster_link_log(link, BLOG_INFO, "connection error");
+    }
+    
+    cluster_link_remove(link);
+    return;
+}
+
+void cluster_link_decoder_handler_error (struct cluster_link *link)
+{
+    cluster_link_log(link, BLOG_ERROR, "decoder error");
+    
+    cluster_link_remove(link);
+    return;
+}
+
+void cluster_link_keepalive_timer_handler (struct cluster_link *link)
+{
+    BReactor_SetTimer(&ss, &link->keepalive_timer);
+    
+    if (!link->hello_sent) {
+        struct cl_hello omsg;
+        void *pack;
+        if (cluster_link_start_control_packet(link, &pack, sizeof(omsg)) < 0) {
+            return;
+        }
+        omsg.version = htol16(CL_VERSION);
+        omsg.node_id = htol16(options.cluster_node_id);
+        omsg.num_nodes = htol16(options.cluster_nodes);
+        memcpy(pack, &omsg, sizeof(omsg));
+        cluster_link_end_control_packet(link, CLID_HELLO);
+        link->hello_sent = 1;
+        
+        // process any packet received before
+        if (link->input_held_len >= 0) {
+            int data_len = link->input_held_len;
+            link->input_held_len = -1;
+            cluster_link_process_packet(link, link->input_held_data, data_len);
+        }
+        return;
+    }
+    
+    if (cluster_link_start_control_packet(link, NULL, 0) < 0) {
+        return;
+    }
+    cluster_link_end_control_packet(link, CLID_KEEPALIVE);
+}
+
+void cluster_link_sync_timer_handler (struct cluster_link *link)
+{
+    ASSERT(link->state == CLUSTER_LINK_STATE_UP)
+    
+    if (link->failing) {
+        return;
+    }
+    
+    while (link->sync_node) {
+        struct client_data *client = UPPER_OBJECT(link->sync_node, struct client_data, list_node);
+        link->sync_node = LinkedList1Node_Next(link->sync_node);
+        
+        // skip clients which were published since the link came up
+        if (client->remote || client->initstatus != INITSTATUS_COMPLETE || client->dying || cluster_flow_find(link, client)) {
+            continue;
+        }
+        
+        if (!cluster_link_add_client(link, client)) {
+            return;
+        }
+        
+        if (link->sync_node) {
+            BReactor_SetTimer(&ss, &link->sync_timer);
+        }
+        return;
+    }
+}
+
+void cluster_link_no_data_timer_handler (struct cluster_link *link)
+{
+    cluster_link_log(link, BLOG_INFO, "timed out");
+    
+    cluster_link_remove(link);
+    return;
+}
+
+int cluster_link_start_control_packet (struct cluster_link *link, void **data, int len)
+{
+    ASSERT(len >= 0)
+    ASSERT(len <= CL_MAX_PAYLOAD)
+    ASSERT(!(len > 0) || data)
+    ASSERT(link->output_control_packet_len == -1)
+    
+    if (link->failing) {
+        return -1;
+    }
+    
+    // obtain location for writing the packet
+    if (!BufferWriter_StartPacket(link->output_control_input, &link->output_control_packet)) {
+        // out of buffer, the other server is not keeping up
+        cluster_link_log(link, BLOG_WARNING, "out of control buffer, removing");
+        cluster_link_fail(link);
+        return -1;
+    }
+    
+    link->output_control_packet_len = len;
+    
+    if (data) {
+        *data = link->output_control_packet + sizeof(struct cl_header);
+    }
+    
+    return 0;
+}
+
+void cluster_link_end_control_packet (struct cluster_link *link, uint8_t type)
+{
+    ASSERT(link->output_control_packet_len >= 0)
+    ASSERT(link->output_control_packet_len <= CL_MAX_PAYLOAD)
+    
+    // write header
+    struct cl_header header;
+    header.type = htol8(type);
+    memcpy(link->output_control_packet, &header, sizeof(header));
+    
+    // finish writing packet
+    BufferWriter_EndPacket(link->output_control_input, sizeof(struct cl_header) + link->output_control_packet_len);
+    
+    link->output_control_packet_len = -1;
+}
+
+int cluster_link_send_newclient (struct cluster_link *link, struct client_data *client)
+{
+    ASSERT(link->state == CLUSTER_LINK_STATE_UP)
+    ASSERT(!client->remote)
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
+    
+    int name_len = (client->common_name ? strlen(client->common_name) : 0);
+    if (name_len > CLID_NEWCLIENT_MAX_NAME_LEN) {
+        client_log(client, BLOG_WARNING, "common name too long for the cluster");
+        return 0;
+    }
+    
+    int cert_len = (options.ssl ? client->cert_len : 0);
+    int cert_old_len = (options.ssl ? client->cert_old_len : 0);
+    
+    struct cl_newclient omsg;
+    void *pack;
+    if (cluster_link_start_control_packet(link, &pack, sizeof(omsg) + name_len + cert_len + cert_old_len) < 0) {
+        return -1;
+    }
+    omsg.id = htol16(client->id);
+    omsg.version = htol16(client->version);
+    memset(omsg.addr_ip, 0, sizeof(omsg.addr_ip));
+    switch (client->addr.type) {
+        case BADDR_TYPE_IPV4:
+            omsg.addr_type = CL_ADDR_TYPE_IPV4;
+            memcpy(omsg.addr_ip, &client->addr.ipv4.ip, sizeof(client->addr.ipv4.ip));
+            omsg.addr_port = client->addr.ipv4.port;
+            break;
+        case BADDR_TYPE_IPV6:
+            omsg.addr_type = CL_ADDR_TYPE_IPV6;
+            memcpy(omsg.addr_ip, client->addr.ipv6.ip, sizeof(client->addr.ipv6.ip));
+            omsg.addr_port = client->addr.ipv6.port;
+            break;
+        default:
+            omsg.addr_type = CL_ADDR_TYPE_NONE;
+            omsg.addr_port = 0;
+            break;
+    }
+    omsg.name_len = htol16(name_len);
+    omsg.cert_len = htol16(cert_len);
+    omsg.cert_old_len = htol16(cert_old_len);
+    memcpy(pack, &omsg, sizeof(omsg));
+    memcpy((char *)pack + sizeof(omsg), client->common_name, name_len);
+    memcpy((char *)pack + sizeof(omsg) + name_len, client->cert, cert_len);
+    memcpy((char *)pack + sizeof(omsg) + name_len + cert_len, client->cert_old, cert_old_len);
+    cluster_link_end_control_packet(link, CLID_NEWCLIENT);
+    
+    return 0;
+}
+
+int cluster_link_send_endclient (struct cluster_link *link, peerid_t id)
+{
+    struct cl_endclient omsg;
+    void *pack;
+    if (cluster_link_start_control_packet(link, &pack, sizeof(omsg)) < 0) {
+        return -1;
+    }
+    omsg.id = htol16(id);
+    memcpy(pack, &omsg, sizeof(omsg));
+    cluster_link_end_control_packet(link, CLID_ENDCLIENT);
+    
+    return 0;
+}
+
+int cluster_link_send_resetpair (struct cluster_link *link, peerid_t src_id, peerid_t dest_id)
+{
+    struct cl_resetpair omsg;
+    void *pack;
+    if (cluster_link_start_control_packet(link, &pack, sizeof(omsg)) < 0) {
+        return -1;
+    }
+    omsg.src_id = htol16(src_id);
+    omsg.dest_id = htol16(dest_id);
+    memcpy(pack, &omsg, sizeof(omsg));
+    cluster_link_end_control_packet(link, CLID_RESETPAIR);
+    
+    return 0;
+}
+
+int cluster_link_send_kick (struct cluster_link *link, peerid_t id)
+{
+    struct cl_kick omsg;
+    void *pack;
+    if (cluster_link_start_control_packet(link, &pack, sizeof(omsg)) < 0) {
+        return -1;
+    }
+    omsg.id = htol16(id);
+    memcpy(pack, &omsg, sizeof(omsg));
+    cluster_link_end_control_packet(link, CLID_KICK);
+    
+    return 0;
+}
+
+int cluster_link_add_client (struct cluster_link *link, struct client_data *client)
+{
+    ASSERT(link->state == CLUSTER_LINK_STATE_UP)
+    ASSERT(!client->remote)
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
+    
+    // create the flow for packets from the server to the client now, since
+    // a new flow cannot be written to until its jobs have run
+    if (!cluster_flow_init(link, client)) {
+        client_log(client, BLOG_ERROR, "failed to allocate flow from cluster node %d", link->node_id);
+        client_remove(client);
+        return 0;
+    }
+    
+    // tell the server about the client
+    cluster_link_send_newclient(link, client);
+    
+    return 1;
+}
+
+void cluster_publish_client (struct client_data *client)
+{
+    ASSERT(!client->remote)
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
+    
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&cluster_links); node; node = LinkedList1Node_Next(node)) {
+        struct cluster_link *link = UPPER_OBJECT(node, struct cluster_link, list_node);
+        if (link->state == CLUSTER_LINK_STATE_UP) {
+            if (!cluster_link_add_client(link, client)) {
+                return;
+            }
+        }
+    }
+}
+
+void cluster_unpublish_client (struct client_data *client)
+{
+    ASSERT(!client->remote)
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&cluster_links); node; node = LinkedList1Node_Next(node)) {
+        struct cluster_link *link = UPPER_OBJECT(node, struct cluster_link, list_node);
+        if (link->state == CLUSTER_LINK_STATE_UP) {
+            cluster_link_send_endclient(link, client->id);
+        }
+    }
+}
+
+void cluster_forget_client (struct client_data *client)
+{
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&cluster_links); node; node = LinkedList1Node_Next(node)) {
+        struct cluster_link *link = UPPER_OBJECT(node, struct cluster_link, list_node);
+        if (link->sync_node == &client->list_node) {
+            link->sync_node = LinkedList1Node_Next(link->sync_node);
+        }
+    }
+}
+
+void cluster_link_input_handler_send (struct cluster_link *link, uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= CL_MAX_ENC)
+    ASSERT(link->input_held_len == -1)
+    
+    // we cannot answer before sending hello, hold the packet until then
+    if (!link->hello_sent) {
+        link->input_held_data = data;
+        link->input_held_len = data_len;
+        return;
+    }
+    
+    cluster_link_process_packet(link, data, data_len);
+    return;
+}
+
+void cluster_link_process_packet (struct cluster_link *link, uint8_t *data, int data_len)
+{
+    ASSERT(link->hello_sent)
+    
+    // accept packet
+    PacketPassInterface_Done(&link->input_interface);
+    
+    // ignore anything after deciding to remove the link
+    if (link->failing) {
+        return;
+    }
+    
+    // restart no data timer
+    BReactor_SetTimer(&ss, &link->no_data_timer);
+    
+    // parse header
+    if (data_len < sizeof(struct cl_header)) {
+        cluster_link_log(link, BLOG_NOTICE, "packet too short");
+        cluster_link_remove(link);
+        return;
+    }
+    struct cl_header header;
+    memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    data_len -= sizeof(header);
+    uint8_t type = ltoh8(header.type);
+    
+    if (type == CLID_KEEPALIVE) {
+        return;
+    }
+    
+    if (type == CLID_HELLO) {
+        cluster_process_hello(link, data, data_len);
+        return;
+    }
+    
+    if (link->state != CLUSTER_LINK_STATE_UP) {
+        cluster_link_log(link, BLOG_NOTICE, "packet before hello");
+        cluster_link_remove(link);
+        return;
+    }
+    
+    // perform action based on packet type
+    switch (type) {
+        case CLID_NEWCLIENT:
+            cluster_process_newclient(link, data, data_len);
+            return;
+        case CLID_ENDCLIENT:
+            cluster_process_endclient(link, data, data_len);
+            return;
+        case CLID_TOCLIENT:
+            cluster_process_toclient(link, data, data_len);
+            return;
+        case CLID_FROMCLIENT:
+            cluster_process_fromclient(link, data, data_len);
+            return;
+        case CLID_RESETPAIR:
+            cluster_process_resetpair(link, data, data_len);
+            return;
+        case CLID_KICK:
+            cluster_process_kick(link, data, data_len);
+            return;
+        default:
+            cluster_link_log(link, BLOG_NOTICE, "unknown packet type %d, removing", (int)type);
+            cluster_link_remove(link);
+            return;
+    }
+}
+
+void cluster_process_hello (struct cluster_link *link, uint8_t *data, int data_len)
+{
+    if (link->state != CLUSTER_LINK_STATE_WAITHELLO) {
+        cluster_link_log(link, BLOG_NOTICE, "hello: not expected");
+        cluster_link_remove(link);
+        return;
+    }
+    
+    if (data_len != sizeof(struct cl_hello)) {
+        cluster_link_log(link, BLOG_NOTICE, "hello: invalid length");
+        cluster_link_remove(link);
+        return;
+    }
+    
+    struct cl_hello msg;
+    memcpy(&msg, data, sizeof(msg));
+    int version = ltoh16(msg.version);
+    int node_id = ltoh16(msg.node_id);
+    int num_nodes = ltoh16(msg.num_nodes);
+    
+    if (version != CL_VERSION) {
+        cluster_link_log(link, BLOG_ERROR, "hello: unknown version (%d)", version);
+        cluster_link_remove(link);
+        return;
+    }
+    
+    if (num_nodes != options.cluster_nodes) {
+        cluster_link_log(link, BLOG_ERROR, "hello: server has %d nodes, we have %d", num_nodes, options.cluster_nodes);
+        cluster_link_remove(link);
+        return;
+    }
+    
+    if (node_id >= num_nodes || node_id == options.cluster_node_id) {
+        cluster_link_log(link, BLOG_ERROR, "hello: bad node ID (%d)", node_id);
+        cluster_link_remove(link);
+        return;
+    }
+    
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&cluster_links); node; node = LinkedList1Node_Next(node)) {
+        struct cluster_link *link2 = UPPER_OBJECT(node, struct cluster_link, list_node);
+        if (link2->state == CLUSTER_LINK_STATE_UP && link2->node_id == node_id) {
+            cluster_link_log(link, BLOG_ERROR, "hello: node %d is already connected", node_id);
+            cluster_link_remove(link);
+            return;
+        }
+    }
+    
+    // set link state to up
+    link->node_id = node_id;
+    link->state = CLUSTER_LINK_STATE_UP;
+    
+    cluster_link_log(link, BLOG_NOTICE, "up");
+    
+    // start informing the server about our clients
+    link->sync_node = LinkedList1_GetFirst(&clients);
+    if (link->sync_node) {
+        BReactor_SetTimer(&ss, &link->sync_timer);
+    }
+}
+
+void cluster_process_newclient (struct cluster_link *link, uint8_t *data, int data_len)
+{
+    if (data_len < sizeof(struct cl_newclient)) {
+        cluster_link_log(link, BLOG_NOTICE, "newclient: invalid length");
+        cluster_link_remove(link);
+        return;
+    }
+    
+    struct cl_newclient msg;
+    memcpy(&msg, data, sizeof(msg));
+    peerid_t id = ltoh16(msg.id);
+    int name_len = ltoh16(msg.name_len);
+    int cert_len = ltoh16(msg.cert_len);
+    int cert_old_len = ltoh16(msg.cert_old_len);
+    
+    if (cert_len > SCID_NEWCLIENT_MAX_CERT_LEN || cert_old_len > SCID_NEWCLIENT_MAX_CERT_LEN ||
+        data_len != sizeof(msg) + name_len + cert_len + cert_old_len
+    ) {
+        cluster_link_log(link, BLOG_NOTICE, "newclient: invalid length");
+        cluster_link_remove(link);
+        return;
+    }
+    uint8_t *name_data = data + sizeof(msg);
+    uint8_t *cert_data = name_data + name_len;
+    uint8_t *cert_old_data = cert_data + cert_len;
+    
+    // the ID must be from the range of the server
+    if (id / clients_id_count != link->node_id) {
+        cluster_link_log(link, BLOG_NOTICE, "newclient: ID %d not of the node", (int)id);
+        cluster_link_remove(link);
+        return;
+    }
+    
+    if (find_client_by_id(id)) {
+        cluster_link_log(link, BLOG_NOTICE, "newclient: ID %d already exists", (int)id);
+        cluster_link_remove(link);
+        return;
+    }
+    
+    // allocate the client structure
+    struct client_data *client = (struct client_data *)malloc(sizeof(*client));
+    if (!client) {
+        cluster_link_log(link, BLOG_ERROR, "failed to allocate client");
+        goto fail0;
+    }
+    
+    client->thread_index = -1;
+    client->link_reactor = &ss;
+    client->remote = 1;
+    client->cluster_link = link;
+    client->cluster_kick = 1;
+    client->id = id;
+    client->version = ltoh16(msg.version);
+    client->initstatus = INITSTATUS_COMPLETE;
+    client->pred_class = NULL;
+    client->relay_weight = 1;
+    
+    // set address
+    switch (msg.addr_type) {
+        case CL_ADDR_TYPE_IPV4: {
+            uint32_t ip;
+            memcpy(&ip, msg.addr_ip, sizeof(ip));
+            BAddr_InitIPv4(&client->addr, ip, msg.addr_port);
+        } break;
+        case CL_ADDR_TYPE_IPV6:
+            BAddr_InitIPv6(&client->addr, msg.addr_ip, msg.addr_port);
+            break;
+        default:
+            BAddr_InitNone(&client->addr);
+            break;
+    }
+    
+    // set common name
+    client->common_name = NULL;
+    if (name_len > 0) {
+        if (!(client->common_name = (char *)PORT_Alloc(name_len + 1))) {
+            cluster_link_log(link, BLOG_ERROR, "PORT_Alloc failed");
+            goto fail1;
+        }
+        memcpy(client->common_name, name_data, name_len);
+        client->common_name[name_len] = '\0';
+    }
+    
+    // now client_log() works
+    
+    // set certificates
+    memcpy(client->cert, cert_data, cert_len);
+    client->cert_len = cert_len;
+    BHash_calculate(BHASH_TYPE_SHA256, client->cert, client->cert_len, client->cert_hash);
+    memcpy(client->cert_old, cert_old_data, cert_old_len);
+    client->cert_old_len = cert_old_len;
+    
+    // get predicate class
+    if (options.comm_predicate || options.relay_predicate || num_client_classes > 0) {
+        BIPAddr ipaddr;
+        BAddr_GetIPAddr(&client->addr, &ipaddr);
+        if (!(client->pred_class = predicate_class_get((client->common_name ? client->common_name : ""), ipaddr))) {
+            client_log(client, BLOG_ERROR, "predicate_class_get failed");
+            goto fail2;
+        }
+    }
+    
+    // init output to the link
+    PacketPassFairQueueFlow_Init(&client->cluster_qflow, &link->output_data_fairqueue);
+    PacketPassInterface_Sender_Init(PacketPassFairQueueFlow_GetInput(&client->cluster_qflow), (PacketPassInterface_handler_done)client_cluster_output_handler_done, client);
+    client->cluster_have_qflow = 1;
+    
+    // init publish job; it is set before the I/O so that the jobs starting
+    // the output flows, which are pushed on top of it, run first
+    BPending_Init(&client->cluster_publish_job, BReactor_PendingGroup(&ss), (BPending_handler)client_cluster_publish_job, client);
+    BPending_Set(&client->cluster_publish_job);
+    
+    // init I/O
+    if (!client_init_io(client)) {
+        goto fail3;
+    }
+    
+    // apply client class; there is no rate limit for remote clients, it
+    // is applied by their server
+    client_apply_class(client);
+    
+    // init timers; the client is not timed out by us
+    BTimer_Init(&client->disconnect_timer, CLIENT_NO_DATA_TIME_LIMIT, (BTimer_handler)client_disconnect_timer_handler, client);
+    client->endclients_num = 0;
+    BTimer_Init(&client->endclients_timer, 0, (BTimer_handler)client_endclients_timer_handler, client);
+    
+    // link in
+    LinkedList1_Append(&clients, &client->list_node);
+    ASSERT_EXECUTE(BAVL_Insert(&clients_tree, &client->tree_node, NULL))
+    LinkedList1_Append(&link->proxies, &client->cluster_list_node);
+    
+    // init knowledge lists
+    LinkedList1_Init(&client->know_out_list);
+    LinkedList1_Init(&client->know_in_list);
+    
+    // initialize peer flows from us list and tree
+    LinkedList1_Init(&client->peer_out_flows_list);
+    BAVL_Init(&client->peer_out_flows_tree, OFFSET_DIFF(struct peer_flow, dest_client_id, src_tree_node), (BAVL_comparator)peerid_comparator, NULL);
+    
+    // init dying
+    client->dying = 0;
+    BPending_Init(&client->dying_job, BReactor_PendingGroup(&ss), (BPending_handler)client_dying_job, client);
+    
+    client_log(client, BLOG_INFO, "initialized");
+    
+    return;
+    
+fail3:
+    BPending_Free(&client->cluster_publish_job);
+    PacketPassFairQueueFlow_Free(&client->cluster_qflow);
+    if (client->pred_class) {
+        predicate_class_unref(client->pred_class);
+    }
+fail2:
+    if (client->common_name) {
+        PORT_Free(client->common_name);
+    }
+fail1:
+    free(client);
+fail0:
+    return;
+}
+
+void cluster_process_endclient (struct cluster_link *link, uint8_t *data, int data_len)
+{
+    if (data_len != sizeof(struct cl_endclient)) {
+        cluster_link_log(link, BLOG_NOTICE, "endclient: invalid length");
+        cluster_link_remove(link);
+        return;
+    }
+    
+    struct cl_endclient msg;
+    memcpy(&msg, data, sizeof(msg));
+    peerid_t id = ltoh16(msg.id);
+    
+    // we may have removed the client already
+    struct client_data *client = find_client_by_id(id);
+    if (!client || !client->remote || client->cluster_link != link || client->dying) {
+        cluster_link_log(link, BLOG_DEBUG, "endclient: no client %d", (int)id);
+        return;
+    }
+    
+    // remove client
+    client->cluster_kick = 0;
+    client_remove(client);
+}
+
+void cluster_process_toclient (struct cluster_link *link, uint8_t *data, int data_len)
+{
+    if (data_len < sizeof(struct cl_toclient) + sizeof(struct sc_header) || data_len > sizeof(struct cl_toclient) + SC_MAX_ENC) {
+        cluster_link_log(link, BLOG_NOTICE, "toclient: invalid length");
+        cluster_link_remove(link);
+        return;
+    }
+    
+    struct cl_toclient msg;
+    memcpy(&msg, data, sizeof(msg));
+    peerid_t id = ltoh16(msg.id);
+    uint8_t *sc_data = data + sizeof(msg);
+    int sc_len = data_len - sizeof(msg);
+    
+    // the client may have gone away
+    struct client_data *client = find_client_by_id(id);
+    if (!client || client->remote || client->initstatus != INITSTATUS_COMPLETE || client->dying) {
+        cluster_link_log(link, BLOG_DEBUG, "toclient: no client %d", (int)id);
+        return;
+    }
+    
+    // get flow from the link to the client; none if the client was not
+    // published yet when we received this
+    struct cluster_flow *flow = cluster_flow_find(link, client);
+    if (!flow) {
+        client_log(client, BLOG_DEBUG, "toclient: no flow from cluster node %d", link->node_id);
+        return;
+    }
+    
+    // obtain location for writing the packet
+    uint8_t *out;
+    if (!BufferWriter_StartPacket(flow->input, &out)) {
+        struct sc_header sc_header;
+        memcpy(&sc_header, sc_data, sizeof(sc_header));
+        
+        // if this is a message, have the server reset the pair like with our own flows
+        if (ltoh8(sc_header.type) == SCID_INMSG && sc_len >= sizeof(struct sc_header) + sizeof(struct sc_server_inmsg)) {
+            struct sc_server_inmsg inmsg;
+            memcpy(&inmsg, sc_data + sizeof(struct sc_header), sizeof(inmsg));
+            peerid_t src_id = ltoh16(inmsg.clientid);
+            client_log(client, BLOG_WARNING, "out of cluster buffer; resetting from %d", (int)src_id);
+            cluster_link_send_resetpair(link, src_id, client->id);
+            return;
+        }
+        
+        // out of buffer for control packets, kill client
+        client_log(client, BLOG_INFO, "out of cluster buffer, removing");
+        client_remove(client);
+        return;
+    }
+    
+    memcpy(out, sc_data, sc_len);
+    BufferWriter_EndPacket(flow->input, sc_len);
+}
+
+void cluster_process_fromclient (struct cluster_link *link, uint8_t *data, int data_len)
+{
+    if (data_len < sizeof(struct cl_fromclient) + sizeof(struct sc_header) || data_len > sizeof(struct cl_fromclient) + SC_MAX_ENC) {
+        cluster_link_log(link, BLOG_NOTICE, "fromclient: invalid length");
+        cluster_link_remove(link);
+        return;
+    }
+    
+    struct cl_fromclient msg;
+    memcpy(&msg, data, sizeof(msg));
+    peerid_t id = ltoh16(msg.id);
+    data += sizeof(msg);
+    data_len -= sizeof(msg);
+    
+    // the client may have gone away
+    struct client_data *client = find_client_by_id(id);
+    if (!client || !client->remote || client->cluster_link != link || client->dying) {
+        cluster_link_log(link, BLOG_DEBUG, "fromclient: no client %d", (int)id);
+        return;
+    }
+    
+    // parse header
+    struct sc_header header;
+    memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    data_len -= sizeof(header);
+    uint8_t type = ltoh8(header.type);
+    
+    // process packet as if the client was connected to us
+    switch (type) {
+        case SCID_OUTMSG:
+            process_packet_outmsg(client, data, data_len, &link->input_decoder);
+            return;
+        case SCID_RESETPEER:
+            process_packet_resetpeer(client, data, data_len);
+            return;
+        case SCID_ACCEPTPEER:
+            process_packet_acceptpeer(client, data, data_len);
+            return;
+        default:
+            client_log(client, BLOG_NOTICE, "unexpected packet type %d, removing", (int)type);
+            client_remove(client);
+            return;
+    }
+}
+
+void cluster_process_resetpair (struct cluster_link *link, uint8_t *data, int data_len)
+{
+    if (data_len != sizeof(struct cl_resetpair)) {
+        cluster_link_log(link, BLOG_NOTICE, "resetpair: invalid length");
+        cluster_link_remove(link);
+        return;
+    }
+    
+    struct cl_resetpair msg;
+    memcpy(&msg, data, sizeof(msg));
+    peerid_t src_id = ltoh16(msg.src_id);
+    peerid_t dest_id = ltoh16(msg.dest_id);
+    
+    // the clients may have gone away
+    struct client_data *src = find_client_by_id(src_id);
+    struct client_data *dest = find_client_by_id(dest_id);
+    if (!src || src->initstatus != INITSTATUS_COMPLETE || src->dying || !dest || dest->dying) {
+        cluster_link_log(link, BLOG_DEBUG, "resetpair: no clients %d and %d", (int)src_id, (int)dest_id);
+        return;
+    }
+    
+    // one of the clients must be of the server
+    if (src->cluster_link != link && dest->cluster_link != link) {
+        cluster_link_log(link, BLOG_NOTICE, "resetpair: clients %d and %d not of the node", (int)src_id, (int)dest_id);
+        return;
+    }
+    
+    // lookup flow
+    struct peer_flow *flow = find_flow(src, dest_id);
+    if (!flow) {
+        client_log(src, BLOG_INFO, "no flow for cluster reset to %d", (int)dest_id);
+        return;
+    }
+    
+    // if pair is resetting, ignore message
+    if (flow->resetting || flow->opposite->resetting) {
+        client_log(src, BLOG_INFO, "pair is resetting; not resetting to %d", (int)dest_id);
+        return;
+    }
+    
+    client_log(src, BLOG_WARNING, "cluster out of buffer; resetting to %d", (int)dest_id);
+    
+    // reset clients
+    peer_flow_start_reset(flow);
+}
+
+void cluster_process_kick (struct cluster_link *link, uint8_t *data, int data_len)
+{
+    if (data_len != sizeof(struct cl_kick)) {
+        cluster_link_log(link, BLOG_NOTICE, "kick: invalid length");
+        cluster_link_remove(link);
+        return;
+    }
+    
+    struct cl_kick msg;
+    memcpy(&msg, data, sizeof(msg));
+    peerid_t id = ltoh16(msg.id);
+    
+    // the client may have gone away
+    struct client_data *client = find_client_by_id(id);
+    if (!client || client->remote || client->dying) {
+        cluster_link_log(link, BLOG_DEBUG, "kick: no client %d", (int)id);
+        return;
+    }
+    
+    client_log(client, BLOG_INFO, "removal requested by cluster node %d", link->node_id);
+    
+    client_remove(client);
+}
+
+struct cluster_flow * cluster_flow_find (struct cluster_link *link, struct client_data *client)
+{
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&client->output_cluster_flows); node; node = LinkedList1Node_Next(node)) {
+        struct cluster_flow *flow = UPPER_OBJECT(node, struct cluster_flow, dest_list_node);
+        if (flow->link == link) {
+            return flow;
+        }
+    }
+    
+    return NULL;
+}
+
+int cluster_flow_init (struct cluster_link *link, struct client_data *client)
+{
+    ASSERT(link->state == CLUSTER_LINK_STATE_UP)
+    ASSERT(!client->remote)
+    ASSERT(client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!client->dying)
+    ASSERT(!cluster_flow_find(link, client))
+    
+    // allocate flow structure
+    struct cluster_flow *flow = (struct cluster_flow *)malloc(sizeof(*flow));
+    if (!flow) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    
+    // init queue flow
+    PacketPassFairQueueFlow_Init(&flow->qflow, &client->output_peers_fairqueue);
+    
+    // init PacketProtoFlow
+    if (!PacketProtoFlow_Init(
+        &flow->oflow, SC_MAX_ENC, client_compute_buffer_size(client),
+        PacketPassFairQueueFlow_GetInput(&flow->qflow), BReactor_PendingGroup(&ss)
+    )) {
+        BLog(BLOG_ERROR, "PacketProtoFlow_Init failed");
+        goto fail1;
+    }
+    flow->input = PacketProtoFlow_GetInput(&flow->oflow);
+    
+    // set link and destination
+    flow->link = link;
+    flow->dest_client = client;
+    LinkedList1_Append(&link->flows, &flow->link_list_node);
+    LinkedList1_Append(&client->output_cluster_flows, &flow->dest_list_node);
+    
+    return 1;
+    
+fail1:
+    PacketPassFairQueueFlow_Free(&flow->qflow);
+    free(flow);
+fail0:
+    return 0;
+}
+
+void cluster_flow_dealloc (struct cluster_flow *flow)
+{
+    PacketPassFairQueueFlow_AssertFree(&flow->qflow);
+    
+    // free PacketProtoFlow
+    PacketProtoFlow_Free(&flow->oflow);
+    
+    // free queue flow
+    PacketPassFairQueueFlow_Free(&flow->qflow);
+    
+    // remove from lists
+    LinkedList1_Remove(&flow->dest_client->output_cluster_flows, &flow->dest_list_node);
+    if (flow->link) {
+        LinkedList1_Remove(&flow->link->flows, &flow->link_list_node);
+    }
+    
+    // free memory
+    free(flow);
+}
+
+void cluster_flow_handler_canremove (struct cluster_flow *flow)
+{
+    ASSERT(!flow->link)
+    ASSERT(flow->dest_client->initstatus == INITSTATUS_COMPLETE)
+    ASSERT(!flow->dest_client->dying)
+    PacketPassFairQueueFlow_AssertFree(&flow->qflow);
+    
+    client_log(flow->dest_client, BLOG_DEBUG, "removing old cluster flow");
+    
+    cluster_flow_dealloc(flow);
+    return;
+}
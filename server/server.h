@@ -30,6 +30,8 @@
 #include <stdint.h>
 
 #include <protocol/scproto.h>
+#include <protocol/clusterproto.h>
+#include <protocol/packetproto.h>
 #include <structure/LinkedList1.h>
 #include <structure/BAVL.h>
 #include <flow/PacketProtoDecoder.h>
@@ -40,6 +42,13 @@
 #include <system/BReactor.h>
 #include <system/BConnection.h>
 #include <nspr_support/BSSLConnection.h>
+#include <predicate/BPredicate.h>
+#include <flowextra/PacketPassRateLimiter.h>
+
+#ifndef BADVPN_USE_WINAPI
+#include <system/BReactorGroup.h>
+#include <flowextra/PacketPassThreadPipe.h>
+#endif
 
 // name of the program
 #define PROGRAM_NAME "server"
@@ -52,21 +61,59 @@
 #define CLIENT_CONTROL_BUFFER_MIN_PACKETS (1 + 2*(MAX_CLIENTS - 1))
 // size of client-to-client buffers in packets
 #define CLIENT_PEER_FLOW_BUFFER_MIN_PACKETS 10
+// maximum number of packets queued in a client-to-client flow; at most
+// CLIENT_PEER_FLOW_BUFFER_MIN_PACKETS of them reference the receive buffers
+// of their source instead of being copied
+#define CLIENT_PEER_FLOW_QUEUE_PACKETS 64
 // after how long of not hearing anything from the client we disconnect it
 #define CLIENT_NO_DATA_TIME_LIMIT 30000
 // SO_SNDBFUF socket option for clients
 #define CLIENT_DEFAULT_SOCKET_SNDBUF 16384
+// how many bytes of packets to gather into one write to a client, 0 to write
+// each packet separately; at least one packet always fits
+#define CLIENT_DEFAULT_SEND_COALESCE 16384
 // reset time when a buffer runs out or when we get the resetpeer message
 #define CLIENT_RESET_TIME 30000
+// size of the queue passing received packets from a client thread to the
+// main thread, in packets
+#define CLIENT_INPUT_PIPE_PACKETS 16
+// size of the queue passing packets to send from the main thread to a client
+// thread, in packets; small, so that packets wait in the queues which
+// schedule them
+#define CLIENT_OUTPUT_PIPE_PACKETS 4
+
+// maximum number of threads running client connections
+#define MAX_CLIENT_THREADS 64
 
 // maxiumum listen addresses
 #define MAX_LISTEN_ADDRS 16
 
+// maximum number of client classes
+#define MAX_CLIENT_CLASSES 16
+
+// maximum number of servers in a cluster
+#define CLUSTER_MAX_NODES 16
+// size of the buffer for packets from our clients forwarded to another server
+// of the cluster, in packets
+#define CLUSTER_FORWARD_BUFFER_PACKETS 256
+// after how long of not hearing anything from another server we disconnect it
+#define CLUSTER_NO_DATA_TIME_LIMIT 30000
+// how long to wait before connecting to another server again
+#define CLUSTER_RETRY_TIME 5000
+
+// number of entries in the caches of predicate results for pairs of
+// predicate classes
+#define PREDICATE_CACHE_SIZE 4096
+// maximum number of distinct predicate function arguments whose values are
+// remembered per predicate class
+#define PREDICATE_MAX_ATTRS 64
+
 //#define SIMULATE_OUT_OF_CONTROL_BUFFER 20
 //#define SIMULATE_OUT_OF_FLOW_BUFFER 100
 
 
-// performing SSL handshake
+// performing SSL handshake, or waiting for the client thread to set up
+// the connection
 #define INITSTATUS_HANDSHAKE 1
 // waiting for clienthello
 #define INITSTATUS_WAITHELLO 2
@@ -75,8 +122,31 @@
 
 #define INITSTATUS_HASLINK(status) ((status) == INITSTATUS_WAITHELLO || (status) == INITSTATUS_COMPLETE)
 
+// the link to another server is waiting for its hello
+#define CLUSTER_LINK_STATE_WAITHELLO 1
+// the link to another server is up
+#define CLUSTER_LINK_STATE_UP 2
+
 struct client_data;
 struct peer_know;
+struct cluster_link;
+
+// headers in front of the payload of a relayed message
+#define PEER_FLOW_HEADER_LEN (sizeof(struct packetproto_header) + sizeof(struct sc_header) + sizeof(struct sc_server_inmsg))
+
+// size of the buffer of a client-to-client flow for copied packets
+#define PEER_FLOW_BUF_SIZE (CLIENT_PEER_FLOW_BUFFER_MIN_PACKETS * PACKETPROTO_ENCLEN(SC_MAX_ENC))
+
+struct peer_flow_packet {
+    // decoder buffer holding the payload, or NULL if the whole packet
+    // is in the flow buffer
+    PacketProtoDecoderBuffer *ref;
+    // headers, if ref is not NULL
+    uint8_t header[PEER_FLOW_HEADER_LEN];
+    // payload if ref is not NULL, otherwise the whole packet
+    const uint8_t *data;
+    int data_len;
+};
 
 struct peer_flow {
     // source client
@@ -93,10 +163,17 @@ struct peer_flow {
     // output chain
     int have_io;
     PacketPassFairQueueFlow qflow;
-    PacketProtoFlow oflow;
-    BufferWriter *input;
-    int packet_len;
-    uint8_t *packet;
+    PacketPassInterface *qflow_input;
+    // queued packets, the first one being sent
+    struct peer_flow_packet *queue;
+    int queue_start;
+    int queue_count;
+    int queue_refs;
+    // buffer for copied packets, used in FIFO order
+    uint8_t *buf;
+    int buf_start;
+    int buf_end;
+    int buf_count;
     // reset timer
     BTimer reset_timer;
     // opposite flow
@@ -118,7 +195,164 @@ struct peer_know {
     BPending uninform_job;
 };
 
+// clients with the same common name and address, which the predicates
+// cannot tell apart
+struct predicate_class {
+    uint64_t id;
+    char *name;
+    BIPAddr addr;
+    int refcnt;
+    // values of predicate function arguments, by attribute index
+    uint64_t attrs_known;
+    uint64_t attrs;
+    BAVLNode tree_node;
+};
+
+// string argument of a name or address predicate function
+struct predicate_arg {
+    char *str;
+    int is_addr;
+    int attr;
+    int addr_ok;
+    BIPAddr addr;
+    BAVLNode tree_node;
+};
+
+// cached result of a predicate for an ordered pair of predicate classes
+struct predicate_cache_entry {
+    uint64_t id1;
+    uint64_t id2;
+    int res;
+};
+
+// class of clients, chosen by a predicate, determining how the messages
+// they send are relayed
+struct client_class {
+    BPredicate predicate;
+    BPredicateFunction func_pname;
+    BPredicateFunction func_paddr;
+    // limit for data a client sends, in bytes per second (0 for none) and
+    // burst bytes
+    int rate;
+    int burst;
+    // weight of a client's messages when they compete with those of other
+    // clients for the receiver's connection
+    int weight;
+};
+
+// delivers packets from another server of the cluster to one of our clients
+struct cluster_flow {
+    // link to the other server, or NULL after it is gone
+    struct cluster_link *link;
+    // destination client
+    struct client_data *dest_client;
+    // node in link list, only when link != NULL
+    LinkedList1Node link_list_node;
+    // node in destination client list
+    LinkedList1Node dest_list_node;
+    // output chain
+    PacketPassFairQueueFlow qflow;
+    PacketProtoFlow oflow;
+    BufferWriter *input;
+};
+
+// another server of the cluster which we connect to
+struct cluster_peer {
+    BAddr addr;
+    int connecting;
+    BConnector connector;
+    BTimer retry_timer;
+    // link when connected, else NULL
+    struct cluster_link *link;
+};
+
+// connection to another server of the cluster
+struct cluster_link {
+    // the peer we connected to, or NULL if the other server connected to us
+    struct cluster_peer *peer;
+    BAddr addr;
+    int state;
+    // node ID of the other server, when up
+    int node_id;
+    
+    // socket
+    BConnection con;
+    
+    // input
+    PacketProtoDecoder input_decoder;
+    PacketPassInterface input_interface;
+    
+    // output common
+    PacketStreamSender output_sender;
+    PacketPassPriorityQueue output_priorityqueue;
+    
+    // output control flow
+    PacketPassPriorityQueueFlow output_control_qflow;
+    PacketProtoFlow output_control_oflow;
+    BufferWriter *output_control_input;
+    int output_control_packet_len;
+    uint8_t *output_control_packet;
+    
+    // output data flow, shared fairly by the proxies of the other server's
+    // clients and the packets of our clients forwarded to the other server
+    PacketPassPriorityQueueFlow output_data_qflow;
+    PacketPassFairQueue output_data_fairqueue;
+    PacketPassFairQueueFlow output_forward_qflow;
+    PacketProtoFlow output_forward_oflow;
+    BufferWriter *output_forward_input;
+    
+    // proxies of the other server's clients
+    LinkedList1 proxies;
+    
+    // flows delivering packets to our clients
+    LinkedList1 flows;
+    
+    // timers
+    BTimer keepalive_timer;
+    BTimer no_data_timer;
+    
+    // sends our clients to the server once the link is up, one per timer
+    // expiry since the control buffer takes one packet per job cycle
+    BTimer sync_timer;
+    LinkedList1Node *sync_node;
+    
+    // whether hello was sent; it is sent from the first keepalive timer
+    // expiry, once the output is ready, and input is held until then
+    int hello_sent;
+    uint8_t *input_held_data;
+    int input_held_len;
+    
+    // whether it's being removed
+    int failing;
+    BPending fail_job;
+    
+    // node in links list
+    LinkedList1Node list_node;
+};
+
+// a thread running client connections
+struct client_thread {
+    // number of clients assigned to the thread, used by the main thread
+    int num_clients;
+    // clients whose connection is running, used by the thread
+    LinkedList1 clients;
+};
+
 struct client_data {
+    // index of the client thread running the connection, or -1 if it runs
+    // in the main thread; the socket, SSL, PacketProtoDecoder and
+    // PacketStreamSender belong to that thread, everything else to the
+    // main thread
+    int thread_index;
+    BReactor *link_reactor;
+    
+    // whether the client is connected to another server of the cluster and
+    // is represented here by a proxy, which has no connection
+    int remote;
+    
+    // relay weight determined by the client class, when complete
+    int relay_weight;
+    
     // socket
     BConnection con;
     BAddr addr;
@@ -134,6 +368,7 @@ struct client_data {
     // client data if using SSL
     uint8_t cert[SCID_NEWCLIENT_MAX_CERT_LEN];
     int cert_len;
+    uint8_t cert_hash[SC_CERT_HASH_LEN];
     uint8_t cert_old[SCID_NEWCLIENT_MAX_CERT_LEN];
     int cert_old_len;
     char *common_name;
@@ -141,9 +376,17 @@ struct client_data {
     // client version
     int version;
     
+    // predicate class, if using predicates
+    struct predicate_class *pred_class;
+    
     // no data timer
     BTimer disconnect_timer;
     
+    // IDs of removed peers queued to be reported together in one packet
+    peerid_t endclients_ids[SCID_ENDCLIENTS_MAX_IDS];
+    int endclients_num;
+    BTimer endclients_timer;
+    
     // client ID
     peerid_t id;
     
@@ -168,6 +411,10 @@ struct client_data {
     PacketProtoDecoder input_decoder;
     PacketPassInterface input_interface;
     
+    // rate limit of the input, when some client class has one
+    int have_input_limiter;
+    PacketPassRateLimiter input_limiter;
+    
     // output common
     PacketStreamSender output_sender;
     PacketPassPriorityQueue output_priorityqueue;
@@ -183,4 +430,45 @@ struct client_data {
     PacketPassPriorityQueueFlow output_peers_qflow;
     PacketPassFairQueue output_peers_fairqueue;
     LinkedList1 output_peers_flows;
+    
+    // flows from other servers of the cluster to us
+    LinkedList1 output_cluster_flows;
+    
+    // if remote: link to the server of the client, or NULL after it is gone
+    struct cluster_link *cluster_link;
+    LinkedList1Node cluster_list_node;
+    // whether to have its server remove the client when we remove it
+    int cluster_kick;
+    // if remote: tells our clients about it once its output is ready
+    BPending cluster_publish_job;
+    // if remote: output to the link, prepending the ClusterProto header
+    PacketPassInterface cluster_output_if;
+    int cluster_have_qflow;
+    PacketPassFairQueueFlow cluster_qflow;
+    uint8_t cluster_output_buf[PACKETPROTO_ENCLEN(sizeof(struct cl_header) + sizeof(struct cl_toclient) + SC_MAX_ENC)];
+    
+#ifndef BADVPN_USE_WINAPI
+    // when running in a client thread: socket handed over to the thread
+    int link_fd;
+    
+    // received packets, from the client thread to the main thread
+    PacketPassThreadPipe input_pipe;
+    
+    // packets to send, from the main thread to the client thread
+    PacketPassThreadPipe output_pipe;
+    
+    // messages from the main thread to the client thread
+    BReactorMailboxMessage link_start_msg;
+    BReactorMailboxMessage link_stop_msg;
+    
+    // messages from the client thread to the main thread
+    BReactorMailboxMessage link_up_msg;
+    BReactorMailboxMessage link_error_msg;
+    BReactorMailboxMessage link_stopped_msg;
+    
+    // state in the client thread
+    int link_active;
+    int link_have_io;
+    LinkedList1Node thread_list_node;
+#endif
 };
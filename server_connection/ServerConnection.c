@@ -28,12 +28,19 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
 
 #include <misc/debug.h>
 #include <misc/strdup.h>
+#include <misc/offset.h>
+#include <misc/compare.h>
+#include <misc/concat_strings.h>
+#include <misc/read_file.h>
+#include <misc/write_file.h>
 #include <base/BLog.h>
+#include <security/BHash.h>
 
 #include <server_connection/ServerConnection.h>
 
@@ -54,7 +61,16 @@ static void input_handler_send (ServerConnection *o, uint8_t *data, int data_len
 static void packet_hello (ServerConnection *o, uint8_t *data, int data_len);
 static void packet_newclient (ServerConnection *o, uint8_t *data, int data_len);
 static void packet_endclient (ServerConnection *o, uint8_t *data, int data_len);
+static void packet_endclients (ServerConnection *o, uint8_t *data, int data_len);
 static void packet_inmsg (ServerConnection *o, uint8_t *data, int data_len);
+static void packet_cert (ServerConnection *o, uint8_t *data, int data_len);
+static void report_newclient (ServerConnection *o, peerid_t id, int flags, const uint8_t *cert, int cert_len, struct ServerConnection_certfetch *fetch);
+static int peerid_comparator (void *unused, peerid_t *v1, peerid_t *v2);
+static struct ServerConnection_certfetch * find_certfetch (ServerConnection *o, peerid_t id);
+static void free_certfetch (struct ServerConnection_certfetch *fetch);
+static char * cert_cache_path (ServerConnection *o, const uint8_t *cert_hash, const char *suffix);
+static int cert_cache_read (ServerConnection *o, const uint8_t *cert_hash, uint8_t *out_cert, int *out_cert_len);
+static void cert_cache_write (ServerConnection *o, const uint8_t *cert_hash, const uint8_t *cert, int cert_len);
 static int start_packet (ServerConnection *o, void **data, int len);
 static void end_packet (ServerConnection *o, uint8_t type);
 static void newclient_job_handler (ServerConnection *o);
@@ -84,6 +100,11 @@ void connector_handler (ServerConnection *o, int is_error)
         goto fail0;
     }
     
+    // apply socket options
+    if (o->socket_options && !BConnection_SetOptions(&o->con, o->socket_options)) {
+        BLog(BLOG_WARNING, "BConnection_SetOptions failed");
+    }
+    
     // init connection interfaces
     BConnection_SendAsync_Init(&o->con);
     BConnection_RecvAsync_Init(&o->con);
@@ -117,6 +138,11 @@ void connector_handler (ServerConnection *o, int is_error)
             goto fail1;
         }
         
+        // resume the session of a previous connection to the server
+        if (!BSSLConnection_EnableResumption(o->ssl_prfd)) {
+            goto fail1;
+        }
+        
         // set client certificate callback
         if (SSL_GetClientAuthDataHook(o->ssl_prfd, (SSLGetClientAuthData)client_auth_data_callback, o) != SECSuccess) {
             BLog(BLOG_ERROR, "SSL_GetClientAuthDataHook failed");
@@ -159,7 +185,7 @@ void connector_handler (ServerConnection *o, int is_error)
     }
     
     // init queue
-    PacketPassPriorityQueue_Init(&o->output_queue, KeepaliveIO_GetInput(&o->output_keepaliveio), BReactor_PendingGroup(o->reactor), 0);
+    PacketPassPriorityQueue_InitLevels(&o->output_queue, KeepaliveIO_GetInput(&o->output_keepaliveio), BReactor_PendingGroup(o->reactor), 0, 2);
     
     // init output local flow
     
@@ -326,9 +352,15 @@ void input_handler_send (ServerConnection *o, uint8_t *data, int data_len)
         case SCID_ENDCLIENT:
             packet_endclient(o, data, data_len);
             return;
+        case SCID_ENDCLIENTS:
+            packet_endclients(o, data, data_len);
+            return;
         case SCID_INMSG:
             packet_inmsg(o, data, data_len);
             return;
+        case SCID_CERT:
+            packet_cert(o, data, data_len);
+            return;
         default:
             BLog(BLOG_ERROR, "unknown packet type %d", (int)type);
             report_error(o);
@@ -378,23 +410,60 @@ void packet_newclient (ServerConnection *o, uint8_t *data, int data_len)
     struct sc_server_newclient msg;
     memcpy(&msg, data, sizeof(msg));
     peerid_t id = ltoh16(msg.id);
+    int flags = ltoh16(msg.flags);
+    uint8_t *cert_data = data + sizeof(msg);
+    int cert_len = data_len - sizeof(msg);
     
-    // schedule reporting new client
-    o->newclient_data = data;
-    o->newclient_data_len = data_len;
-    BPending_Set(&o->newclient_job);
+    if (find_certfetch(o, id)) {
+        BLog(BLOG_ERROR, "newclient: already waiting for certificate of %d", (int)id);
+        report_error(o);
+        return;
+    }
     
-    // send acceptpeer
-    struct sc_client_acceptpeer omsg;
+    if (!(flags & SCID_NEWCLIENT_FLAG_CERT_HASH)) {
+        report_newclient(o, id, flags, cert_data, cert_len, NULL);
+        return;
+    }
+    
+    flags &= ~SCID_NEWCLIENT_FLAG_CERT_HASH;
+    
+    if (cert_len != SC_CERT_HASH_LEN) {
+        BLog(BLOG_ERROR, "newclient: invalid hash length");
+        report_error(o);
+        return;
+    }
+    
+    // use the cached certificate if we have it
+    if (o->cert_cache_dir && cert_cache_read(o, cert_data, o->newclient_cert, &o->newclient_cert_len)) {
+        report_newclient(o, id, flags, o->newclient_cert, o->newclient_cert_len, NULL);
+        return;
+    }
+    
+    // allocate fetch entry
+    struct ServerConnection_certfetch *fetch = (struct ServerConnection_certfetch *)malloc(sizeof(*fetch));
+    if (!fetch) {
+        BLog(BLOG_ERROR, "newclient: malloc failed");
+        report_error(o);
+        return;
+    }
+    fetch->id = id;
+    fetch->flags = flags;
+    memcpy(fetch->cert_hash, cert_data, SC_CERT_HASH_LEN);
+    LinkedList1_Init(&fetch->msgs_list);
+    fetch->num_msgs = 0;
+    ASSERT_EXECUTE(BAVL_Insert(&o->certfetch_tree, &fetch->tree_node, NULL))
+    
+    // ask for the certificate
+    struct sc_client_getcert omsg;
     void *packet;
     if (!start_packet(o, &packet, sizeof(omsg))) {
-        BLog(BLOG_ERROR, "newclient: out of buffer for acceptpeer");
+        BLog(BLOG_ERROR, "newclient: out of buffer for getcert");
         report_error(o);
         return;
     }
     omsg.clientid = htol16(id);
     memcpy(packet, &omsg, sizeof(omsg));
-    end_packet(o, SCID_ACCEPTPEER);
+    end_packet(o, SCID_GETCERT);
 }
 
 void packet_endclient (ServerConnection *o, uint8_t *data, int data_len)
@@ -415,11 +484,51 @@ void packet_endclient (ServerConnection *o, uint8_t *data, int data_len)
     memcpy(&msg, data, sizeof(msg));
     peerid_t id = ltoh16(msg.id);
     
+    // a peer whose certificate has not arrived yet was never reported
+    struct ServerConnection_certfetch *fetch = find_certfetch(o, id);
+    if (fetch) {
+        BAVL_Remove(&o->certfetch_tree, &fetch->tree_node);
+        free_certfetch(fetch);
+        return;
+    }
+    
     // report
     o->handler_endclient(o->user, id);
     return;
 }
 
+void packet_endclients (ServerConnection *o, uint8_t *data, int data_len)
+{
+    if (o->state != STATE_COMPLETE) {
+        BLog(BLOG_ERROR, "endclients: not expected");
+        report_error(o);
+        return;
+    }
+    
+    if (data_len == 0 || data_len % sizeof(struct sc_server_endclient) != 0) {
+        BLog(BLOG_ERROR, "endclients: invalid length");
+        report_error(o);
+        return;
+    }
+    
+    for (int pos = 0; pos < data_len; pos += sizeof(struct sc_server_endclient)) {
+        struct sc_server_endclient msg;
+        memcpy(&msg, data + pos, sizeof(msg));
+        peerid_t id = ltoh16(msg.id);
+        
+        // a peer whose certificate has not arrived yet was never reported
+        struct ServerConnection_certfetch *fetch = find_certfetch(o, id);
+        if (fetch) {
+            BAVL_Remove(&o->certfetch_tree, &fetch->tree_node);
+            free_certfetch(fetch);
+            continue;
+        }
+        
+        // report
+        o->handler_endclient(o->user, id);
+    }
+}
+
 void packet_inmsg (ServerConnection *o, uint8_t *data, int data_len)
 {
     if (o->state != STATE_COMPLETE) {
@@ -446,11 +555,192 @@ void packet_inmsg (ServerConnection *o, uint8_t *data, int data_len)
     uint8_t *payload = data + sizeof(struct sc_server_inmsg);
     int payload_len = data_len - sizeof(struct sc_server_inmsg);
     
+    // keep messages from a peer which has not been reported yet
+    struct ServerConnection_certfetch *fetch = find_certfetch(o, peer_id);
+    if (fetch) {
+        if (fetch->num_msgs == SERVERCONNECTION_CERTFETCH_MAX_MSGS) {
+            BLog(BLOG_WARNING, "inmsg: too many messages from %d while waiting for its certificate", (int)peer_id);
+            return;
+        }
+        struct ServerConnection_fetchmsg *fmsg = (struct ServerConnection_fetchmsg *)malloc(sizeof(*fmsg) + payload_len);
+        if (!fmsg) {
+            BLog(BLOG_ERROR, "inmsg: malloc failed");
+            return;
+        }
+        fmsg->len = payload_len;
+        memcpy(fmsg->data, payload, payload_len);
+        LinkedList1_Append(&fetch->msgs_list, &fmsg->list_node);
+        fetch->num_msgs++;
+        return;
+    }
+    
     // report
     o->handler_message(o->user, peer_id, payload, payload_len);
     return;
 }
 
+void packet_cert (ServerConnection *o, uint8_t *data, int data_len)
+{
+    if (o->state != STATE_COMPLETE) {
+        BLog(BLOG_ERROR, "cert: not expected");
+        report_error(o);
+        return;
+    }
+    
+    if (data_len < sizeof(struct sc_server_cert) || data_len > sizeof(struct sc_server_cert) + SCID_NEWCLIENT_MAX_CERT_LEN) {
+        BLog(BLOG_ERROR, "cert: invalid length");
+        report_error(o);
+        return;
+    }
+    
+    struct sc_server_cert msg;
+    memcpy(&msg, data, sizeof(msg));
+    peerid_t id = ltoh16(msg.id);
+    uint8_t *cert_data = data + sizeof(msg);
+    int cert_len = data_len - sizeof(msg);
+    
+    struct ServerConnection_certfetch *fetch = find_certfetch(o, id);
+    if (!fetch) {
+        // the peer has gone away after we asked; this is expected
+        BLog(BLOG_INFO, "cert: not waiting for certificate of %d", (int)id);
+        return;
+    }
+    
+    // the reply may be for an earlier peer with the same ID
+    uint8_t cert_hash[SC_CERT_HASH_LEN];
+    BHash_calculate(BHASH_TYPE_SHA256, cert_data, cert_len, cert_hash);
+    if (memcmp(cert_hash, fetch->cert_hash, SC_CERT_HASH_LEN)) {
+        BLog(BLOG_INFO, "cert: certificate of %d does not match hash", (int)id);
+        return;
+    }
+    
+    BAVL_Remove(&o->certfetch_tree, &fetch->tree_node);
+    
+    if (o->cert_cache_dir) {
+        cert_cache_write(o, cert_hash, cert_data, cert_len);
+    }
+    
+    report_newclient(o, id, fetch->flags, cert_data, cert_len, fetch);
+}
+
+void report_newclient (ServerConnection *o, peerid_t id, int flags, const uint8_t *cert, int cert_len, struct ServerConnection_certfetch *fetch)
+{
+    ASSERT(!BPending_IsSet(&o->newclient_job))
+    ASSERT(!o->newclient_fetch)
+    ASSERT(cert_len >= 0)
+    ASSERT(cert_len <= SCID_NEWCLIENT_MAX_CERT_LEN)
+    
+    // schedule reporting new client
+    o->newclient_id = id;
+    o->newclient_flags = flags;
+    memmove(o->newclient_cert, cert, cert_len);
+    o->newclient_cert_len = cert_len;
+    o->newclient_fetch = fetch;
+    BPending_Set(&o->newclient_job);
+    
+    // send acceptpeer
+    struct sc_client_acceptpeer omsg;
+    void *packet;
+    if (!start_packet(o, &packet, sizeof(omsg))) {
+        BLog(BLOG_ERROR, "newclient: out of buffer for acceptpeer");
+        report_error(o);
+        return;
+    }
+    omsg.clientid = htol16(id);
+    memcpy(packet, &omsg, sizeof(omsg));
+    end_packet(o, SCID_ACCEPTPEER);
+}
+
+int peerid_comparator (void *unused, peerid_t *v1, peerid_t *v2)
+{
+    return B_COMPARE(*v1, *v2);
+}
+
+struct ServerConnection_certfetch * find_certfetch (ServerConnection *o, peerid_t id)
+{
+    BAVLNode *node = BAVL_LookupExact(&o->certfetch_tree, &id);
+    if (!node) {
+        return NULL;
+    }
+    
+    return UPPER_OBJECT(node, struct ServerConnection_certfetch, tree_node);
+}
+
+void free_certfetch (struct ServerConnection_certfetch *fetch)
+{
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(&fetch->msgs_list)) {
+        struct ServerConnection_fetchmsg *fmsg = UPPER_OBJECT(node, struct ServerConnection_fetchmsg, list_node);
+        LinkedList1_Remove(&fetch->msgs_list, &fmsg->list_node);
+        free(fmsg);
+    }
+    
+    free(fetch);
+}
+
+char * cert_cache_path (ServerConnection *o, const uint8_t *cert_hash, const char *suffix)
+{
+    ASSERT(o->cert_cache_dir)
+    
+    char hex[2 * SC_CERT_HASH_LEN + 1];
+    for (int i = 0; i < SC_CERT_HASH_LEN; i++) {
+        sprintf(hex + 2 * i, "%02x", (unsigned int)cert_hash[i]);
+    }
+    
+    return concat_strings(4, o->cert_cache_dir, "/", hex, suffix);
+}
+
+int cert_cache_read (ServerConnection *o, const uint8_t *cert_hash, uint8_t *out_cert, int *out_cert_len)
+{
+    char *path = cert_cache_path(o, cert_hash, "");
+    if (!path) {
+        BLog(BLOG_ERROR, "concat_strings failed");
+        return 0;
+    }
+    
+    uint8_t *data;
+    size_t len;
+    int res = read_file(path, &data, &len);
+    free(path);
+    if (!res) {
+        return 0;
+    }
+    
+    // don't trust the file more than the server
+    uint8_t hash[SC_CERT_HASH_LEN];
+    if (len > SCID_NEWCLIENT_MAX_CERT_LEN || (BHash_calculate(BHASH_TYPE_SHA256, data, len, hash), memcmp(hash, cert_hash, SC_CERT_HASH_LEN))) {
+        BLog(BLOG_WARNING, "cached certificate is corrupt");
+        free(data);
+        return 0;
+    }
+    
+    memcpy(out_cert, data, len);
+    *out_cert_len = len;
+    
+    free(data);
+    return 1;
+}
+
+void cert_cache_write (ServerConnection *o, const uint8_t *cert_hash, const uint8_t *cert, int cert_len)
+{
+    char *path = cert_cache_path(o, cert_hash, "");
+    char *tmp_path = cert_cache_path(o, cert_hash, ".tmp");
+    if (!path || !tmp_path) {
+        BLog(BLOG_ERROR, "concat_strings failed");
+        goto out;
+    }
+    
+    // write to a temporary file first so that readers never see a partial file
+    if (!write_file(tmp_path, MemRef_Make((const char *)cert, cert_len)) || rename(tmp_path, path) < 0) {
+        BLog(BLOG_WARNING, "failed to store certificate in cache");
+        remove(tmp_path);
+    }
+    
+out:
+    free(tmp_path);
+    free(path);
+}
+
 int start_packet (ServerConnection *o, void **data, int len)
 {
     ASSERT(o->state >= STATE_WAITINIT)
@@ -545,6 +835,15 @@ int ServerConnection_Init (
         goto fail1;
     }
     
+    // set no socket options
+    o->socket_options = NULL;
+    
+    // set no certificate cache
+    o->cert_cache_dir = NULL;
+    
+    // init certificate fetches tree
+    BAVL_Init(&o->certfetch_tree, OFFSET_DIFF(struct ServerConnection_certfetch, id, tree_node), (BAVL_comparator)peerid_comparator, NULL);
+    
     // init connector
     if (!BConnector_Init(&o->connector, addr, o->reactor, o, (BConnector_handler)connector_handler)) {
         BLog(BLOG_ERROR, "BConnector_Init failed");
@@ -553,6 +852,7 @@ int ServerConnection_Init (
     
     // init newclient job
     BPending_Init(&o->newclient_job, BReactor_PendingGroup(o->reactor), (BPending_handler)newclient_job_handler, o);
+    o->newclient_fetch = NULL;
     
     // set state
     o->state = STATE_CONNECTING;
@@ -621,6 +921,20 @@ void ServerConnection_Free (ServerConnection *o)
     
     // free newclient job
     BPending_Free(&o->newclient_job);
+    if (o->newclient_fetch) {
+        free_certfetch(o->newclient_fetch);
+    }
+    
+    // free certificate fetches
+    BAVLNode *node;
+    while (node = BAVL_GetFirst(&o->certfetch_tree)) {
+        struct ServerConnection_certfetch *fetch = UPPER_OBJECT(node, struct ServerConnection_certfetch, tree_node);
+        BAVL_Remove(&o->certfetch_tree, &fetch->tree_node);
+        free_certfetch(fetch);
+    }
+    
+    // free certificate cache directory
+    free(o->cert_cache_dir);
     
     // free connector
     BConnector_Free(&o->connector);
@@ -629,6 +943,28 @@ void ServerConnection_Free (ServerConnection *o)
     free(o->server_name);
 }
 
+void ServerConnection_SetSocketOptions (ServerConnection *o, const struct BConnection_options *opts)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state == STATE_CONNECTING)
+    
+    o->socket_options = opts;
+}
+
+int ServerConnection_SetCertCache (ServerConnection *o, const char *dir)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state == STATE_CONNECTING)
+    ASSERT(!o->cert_cache_dir)
+    
+    if (!(o->cert_cache_dir = b_strdup(dir))) {
+        BLog(BLOG_ERROR, "b_strdup failed");
+        return 0;
+    }
+    
+    return 1;
+}
+
 void ServerConnection_ReleaseBuffers (ServerConnection *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -655,15 +991,19 @@ void newclient_job_handler (ServerConnection *o)
     DebugObject_Access(&o->d_obj);
     ASSERT(o->state == STATE_COMPLETE)
     
-    struct sc_server_newclient msg;
-    memcpy(&msg, o->newclient_data, sizeof(msg));
-    peerid_t id = ltoh16(msg.id);
-    int flags = ltoh16(msg.flags);
-    
-    uint8_t *cert_data = o->newclient_data + sizeof(msg);
-    int cert_len = o->newclient_data_len - sizeof(msg);
+    struct ServerConnection_certfetch *fetch = o->newclient_fetch;
+    o->newclient_fetch = NULL;
     
     // report new client
-    o->handler_newclient(o->user, id, flags, cert_data, cert_len);
-    return;
+    o->handler_newclient(o->user, o->newclient_id, o->newclient_flags, o->newclient_cert, o->newclient_cert_len);
+    
+    if (fetch) {
+        // report messages received while waiting for the certificate
+        for (LinkedList1Node *node = LinkedList1_GetFirst(&fetch->msgs_list); node; node = LinkedList1Node_Next(node)) {
+            struct ServerConnection_fetchmsg *fmsg = UPPER_OBJECT(node, struct ServerConnection_fetchmsg, list_node);
+            o->handler_message(o->user, fetch->id, fmsg->data, fmsg->len);
+        }
+        
+        free_certfetch(fetch);
+    }
 }
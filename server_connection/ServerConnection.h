@@ -48,6 +48,8 @@
 
 #include <misc/debug.h>
 #include <misc/debugerror.h>
+#include <structure/BAVL.h>
+#include <structure/LinkedList1.h>
 #include <protocol/scproto.h>
 #include <protocol/msgproto.h>
 #include <base/DebugObject.h>
@@ -61,6 +63,24 @@
 #include <nspr_support/BSSLConnection.h>
 #include <server_connection/SCKeepaliveSource.h>
 
+// messages from a peer whose certificate is being fetched, kept until it is reported
+#define SERVERCONNECTION_CERTFETCH_MAX_MSGS 16
+
+struct ServerConnection_certfetch {
+    peerid_t id;
+    int flags;
+    uint8_t cert_hash[SC_CERT_HASH_LEN];
+    BAVLNode tree_node;
+    LinkedList1 msgs_list;
+    int num_msgs;
+};
+
+struct ServerConnection_fetchmsg {
+    LinkedList1Node list_node;
+    int len;
+    uint8_t data[];
+};
+
 /**
  * Handler function invoked when an error occurs.
  * The object must be freed from withing this function.
@@ -87,7 +107,9 @@ typedef void (*ServerConnection_handler_ready) (void *user, peerid_t my_id, uint
  *
  * @param user value passed to {@link ServerConnection_Init}
  * @param peer_id ID of the peer
- * @param flags flags field from the newclient message
+ * @param flags flags field from the newclient message, without SCID_NEWCLIENT_FLAG_CERT_HASH.
+ *              When the server only sent the hash of the certificate, this is reported
+ *              once the certificate has been obtained.
  * @param cert peer's certificate (if any)
  * @param cert_len certificate length. Will be >=0.
  */
@@ -95,6 +117,7 @@ typedef void (*ServerConnection_handler_newclient) (void *user, peerid_t peer_id
 
 /**
  * Handler function invoked when an enclient packet is received.
+ * For an endclients packet, it is invoked once for each peer in the packet.
  * The object was in ready state.
  *
  * @param user value passed to {@link ServerConnection_Init}
@@ -151,13 +174,24 @@ typedef struct {
     ServerConnection_handler_message handler_message;
     
     // socket
+    const struct BConnection_options *socket_options;
     BConnector connector;
     BConnection con;
     
+    // directory of cached peer certificates, or NULL
+    char *cert_cache_dir;
+    
+    // peers reported by certificate hash whose certificates we have asked for,
+    // by peer ID
+    BAVL certfetch_tree;
+    
     // job to report new client after sending acceptpeer
     BPending newclient_job;
-    uint8_t *newclient_data;
-    int newclient_data_len;
+    peerid_t newclient_id;
+    int newclient_flags;
+    uint8_t newclient_cert[SCID_NEWCLIENT_MAX_CERT_LEN];
+    int newclient_cert_len;
+    struct ServerConnection_certfetch *newclient_fetch;
     
     // state
     int state;
@@ -265,6 +299,33 @@ int ServerConnection_Init (
  */
 void ServerConnection_Free (ServerConnection *o);
 
+/**
+ * Sets socket options to be applied to the connection to the server once
+ * it is established. Failure to apply them is logged and otherwise ignored.
+ * Must be called before the connection is established, i.e. right after
+ * {@link ServerConnection_Init}.
+ *
+ * @param o the object
+ * @param opts socket options, or NULL for none. Must remain valid as long as
+ *             the object exists.
+ */
+void ServerConnection_SetSocketOptions (ServerConnection *o, const struct BConnection_options *opts);
+
+/**
+ * Sets a directory in which to keep the certificates of peers. The server
+ * only sends the hash of a peer's certificate to clients which can fetch
+ * it, so with the cache, a client reconnecting to the server only needs
+ * to download the certificates of peers it has not seen before.
+ * Certificates are stored in files named by the hex encoded hash, and are
+ * checked against the hash when read.
+ * Must be called right after {@link ServerConnection_Init}.
+ *
+ * @param o the object
+ * @param dir directory path. The string is copied.
+ * @return 1 on success, 0 on failure
+ */
+int ServerConnection_SetCertCache (ServerConnection *o, const char *dir) WARN_UNUSED;
+
 /**
  * Stops using any buffers passed to the send interface obtained from
  * {@link ServerConnection_GetSendInterface}. If the send interface
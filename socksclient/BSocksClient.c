@@ -53,12 +53,19 @@ static void free_control_io (BSocksClient *o);
 static void init_up_io (BSocksClient *o);
 static void free_up_io (BSocksClient *o);
 static int reserve_buffer (BSocksClient *o, bsize_t size);
+static int append_hello (BSocksClient *o, size_t *len);
+static int append_password (BSocksClient *o, const struct BSocksClient_auth_info *ai, size_t *len);
+static int append_request (BSocksClient *o, size_t *len);
+static int receive_hello (BSocksClient *o);
+static int receive_password_reply (BSocksClient *o);
+static int receive_reply (BSocksClient *o);
 static void start_receive (BSocksClient *o, uint8_t *dest, int total);
 static void do_receive (BSocksClient *o);
 static void connector_handler (BSocksClient* o, int is_error);
 static void connection_handler (BSocksClient* o, int event);
 static void recv_handler_done (BSocksClient *o, int data_len);
 static void send_handler_done (BSocksClient *o);
+static int parse_bind_addr (BSocksClient *o);
 static void auth_finished (BSocksClient *p);
 
 void report_error (BSocksClient *o, int error)
@@ -126,6 +133,179 @@ int reserve_buffer (BSocksClient *o, bsize_t size)
     return 1;
 }
 
+int append_hello (BSocksClient *o, size_t *len)
+{
+    // check number of methods
+    if (o->num_auth_info == 0 || o->num_auth_info > 255) {
+        BLog(BLOG_ERROR, "invalid number of authentication methods");
+        return 0;
+    }
+    
+    // allocate space for hello
+    bsize_t size = bsize_add(
+        bsize_fromsize(*len),
+        bsize_add(
+            bsize_fromsize(sizeof(struct socks_client_hello_header)),
+            bsize_mul(
+                bsize_fromsize(o->num_auth_info),
+                bsize_fromsize(sizeof(struct socks_client_hello_method))
+            )
+        )
+    );
+    if (!reserve_buffer(o, size)) {
+        return 0;
+    }
+    
+    char *ptr = o->buffer + *len;
+    
+    // write hello header
+    struct socks_client_hello_header header;
+    header.ver = hton8(SOCKS_VERSION);
+    header.nmethods = hton8(o->num_auth_info);
+    memcpy(ptr, &header, sizeof(header));
+    
+    // write hello methods
+    for (size_t i = 0; i < o->num_auth_info; i++) {
+        struct socks_client_hello_method method;
+        method.method = hton8(o->auth_info[i].auth_type);
+        memcpy(ptr + sizeof(header) + i * sizeof(method), &method, sizeof(method));
+    }
+    
+    *len = size.value;
+    
+    return 1;
+}
+
+int append_password (BSocksClient *o, const struct BSocksClient_auth_info *ai, size_t *len)
+{
+    ASSERT(ai->auth_type == SOCKS_METHOD_USERNAME_PASSWORD)
+    
+    if (ai->password.username_len == 0 || ai->password.username_len > 255 ||
+        ai->password.password_len == 0 || ai->password.password_len > 255
+    ) {
+        BLog(BLOG_NOTICE, "invalid username/password length");
+        return 0;
+    }
+    
+    // allocate space for password packet
+    bsize_t size = bsize_add(bsize_fromsize(*len), bsize_fromsize(1 + 1 + ai->password.username_len + 1 + ai->password.password_len));
+    if (!reserve_buffer(o, size)) {
+        return 0;
+    }
+    
+    // write password packet
+    char *ptr = o->buffer + *len;
+    *ptr++ = 1;
+    *ptr++ = ai->password.username_len;
+    memcpy(ptr, ai->password.username, ai->password.username_len);
+    ptr += ai->password.username_len;
+    *ptr++ = ai->password.password_len;
+    memcpy(ptr, ai->password.password, ai->password.password_len);
+    ptr += ai->password.password_len;
+    
+    *len = size.value;
+    
+    return 1;
+}
+
+int append_request (BSocksClient *o, size_t *len)
+{
+    // allocate space for request
+    bsize_t size = bsize_add(bsize_fromsize(*len), bsize_fromsize(sizeof(struct socks_request_header)));
+    switch (o->dest_addr.type) {
+        case BADDR_TYPE_IPV4: size = bsize_add(size, bsize_fromsize(sizeof(struct socks_addr_ipv4))); break;
+        case BADDR_TYPE_IPV6: size = bsize_add(size, bsize_fromsize(sizeof(struct socks_addr_ipv6))); break;
+    }
+    if (!reserve_buffer(o, size)) {
+        return 0;
+    }
+    
+    char *ptr = o->buffer + *len;
+    
+    // write request
+    struct socks_request_header header;
+    header.ver = hton8(SOCKS_VERSION);
+    header.cmd = hton8(o->udp ? SOCKS_CMD_UDP_ASSOCIATE : SOCKS_CMD_CONNECT);
+    header.rsv = hton8(0);
+    switch (o->dest_addr.type) {
+        case BADDR_TYPE_IPV4: {
+            header.atyp = hton8(SOCKS_ATYP_IPV4);
+            struct socks_addr_ipv4 addr;
+            addr.addr = o->dest_addr.ipv4.ip;
+            addr.port = o->dest_addr.ipv4.port;
+            memcpy(ptr + sizeof(header), &addr, sizeof(addr));
+        } break;
+        case BADDR_TYPE_IPV6: {
+            header.atyp = hton8(SOCKS_ATYP_IPV6);
+            struct socks_addr_ipv6 addr;
+            memcpy(addr.addr, o->dest_addr.ipv6.ip, sizeof(o->dest_addr.ipv6.ip));
+            addr.port = o->dest_addr.ipv6.port;
+            memcpy(ptr + sizeof(header), &addr, sizeof(addr));
+        } break;
+        default:
+            ASSERT(0);
+    }
+    memcpy(ptr, &header, sizeof(header));
+    
+    *len = size.value;
+    
+    return 1;
+}
+
+int receive_hello (BSocksClient *o)
+{
+    // allocate buffer for receiving hello
+    bsize_t size = bsize_fromsize(sizeof(struct socks_server_hello));
+    if (!reserve_buffer(o, size)) {
+        return 0;
+    }
+    
+    // receive hello
+    start_receive(o, (uint8_t *)o->buffer, size.value);
+    
+    // set state
+    o->state = STATE_SENT_HELLO;
+    
+    return 1;
+}
+
+int receive_password_reply (BSocksClient *o)
+{
+    // allocate buffer for receiving reply
+    bsize_t size = bsize_fromsize(2);
+    if (!reserve_buffer(o, size)) {
+        return 0;
+    }
+    
+    // receive reply
+    start_receive(o, (uint8_t *)o->buffer, size.value);
+    
+    // set state
+    o->state = STATE_SENT_PASSWORD;
+    
+    return 1;
+}
+
+int receive_reply (BSocksClient *o)
+{
+    // allocate buffer for receiving reply
+    bsize_t size = bsize_add(
+        bsize_fromsize(sizeof(struct socks_reply_header)),
+        bsize_max(bsize_fromsize(sizeof(struct socks_addr_ipv4)), bsize_fromsize(sizeof(struct socks_addr_ipv6)))
+    );
+    if (!reserve_buffer(o, size)) {
+        return 0;
+    }
+    
+    // receive reply header
+    start_receive(o, (uint8_t *)o->buffer, sizeof(struct socks_reply_header));
+    
+    // set state
+    o->state = STATE_SENT_REQUEST;
+    
+    return 1;
+}
+
 void start_receive (BSocksClient *o, uint8_t *dest, int total)
 {
     ASSERT(total > 0)
@@ -161,44 +341,35 @@ void connector_handler (BSocksClient* o, int is_error)
         goto fail0;
     }
     
+    // apply socket options
+    if (o->socket_options && !BConnection_SetOptions(&o->con, o->socket_options)) {
+        BLog(BLOG_WARNING, "BConnection_SetOptions failed");
+    }
+    
     BLog(BLOG_DEBUG, "connected");
     
     // init control I/O
     init_control_io(o);
     
-    // check number of methods
-    if (o->num_auth_info == 0 || o->num_auth_info > 255) {
-        BLog(BLOG_ERROR, "invalid number of authentication methods");
-        goto fail1;
-    }
-    
-    // allocate buffer for sending hello
-    bsize_t size = bsize_add(
-        bsize_fromsize(sizeof(struct socks_client_hello_header)), 
-        bsize_mul(
-            bsize_fromsize(o->num_auth_info),
-            bsize_fromsize(sizeof(struct socks_client_hello_method))
-        )
-    );
-    if (!reserve_buffer(o, size)) {
+    // write hello
+    size_t len = 0;
+    if (!append_hello(o, &len)) {
         goto fail1;
     }
     
-    // write hello header
-    struct socks_client_hello_header header;
-    header.ver = hton8(SOCKS_VERSION);
-    header.nmethods = hton8(o->num_auth_info);
-    memcpy(o->buffer, &header, sizeof(header));
-    
-    // write hello methods
-    for (size_t i = 0; i < o->num_auth_info; i++) {
-        struct socks_client_hello_method method;
-        method.method = hton8(o->auth_info[i].auth_type);
-        memcpy(o->buffer + sizeof(header) + i * sizeof(method), &method, sizeof(method));
+    // when pipelining, the server has no choice of method, so follow the
+    // hello with the password packet and the request right away
+    if (o->pipelined) {
+        if (o->auth_info[0].auth_type == SOCKS_METHOD_USERNAME_PASSWORD && !append_password(o, &o->auth_info[0], &len)) {
+            goto fail1;
+        }
+        if (!append_request(o, &len)) {
+            goto fail1;
+        }
     }
     
     // send
-    PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)o->buffer, size.value);
+    PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)o->buffer, len);
     
     // set state
     o->state = STATE_SENDING_HELLO;
@@ -276,31 +447,22 @@ void recv_handler_done (BSocksClient *o, int data_len)
                 case SOCKS_METHOD_USERNAME_PASSWORD: {
                     BLog(BLOG_DEBUG, "password authentication");
                     
-                    if (ai->password.username_len == 0 || ai->password.username_len > 255 ||
-                        ai->password.password_len == 0 || ai->password.password_len > 255
-                    ) {
-                        BLog(BLOG_NOTICE, "invalid username/password length");
-                        goto fail;
+                    // the password packet was already sent with the hello
+                    if (o->pipelined) {
+                        if (!receive_password_reply(o)) {
+                            goto fail;
+                        }
+                        break;
                     }
                     
-                    // allocate password packet
-                    bsize_t size = bsize_fromsize(1 + 1 + ai->password.username_len + 1 + ai->password.password_len);
-                    if (!reserve_buffer(o, size)) {
+                    // write password packet
+                    size_t len = 0;
+                    if (!append_password(o, ai, &len)) {
                         goto fail;
                     }
                     
-                    // write password packet
-                    char *ptr = o->buffer;
-                    *ptr++ = 1;
-                    *ptr++ = ai->password.username_len;
-                    memcpy(ptr, ai->password.username, ai->password.username_len);
-                    ptr += ai->password.username_len;
-                    *ptr++ = ai->password.password_len;
-                    memcpy(ptr, ai->password.password, ai->password.password_len);
-                    ptr += ai->password.password_len;
-                    
                     // start sending
-                    PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)o->buffer, size.value);
+                    PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)o->buffer, len);
                     
                     // set state
                     o->state = STATE_SENDING_PASSWORD;
@@ -365,24 +527,42 @@ void recv_handler_done (BSocksClient *o, int data_len)
         case STATE_RECEIVED_REPLY_HEADER: {
             BLog(BLOG_DEBUG, "received reply rest");
             
-            // free buffer
-            BFree(o->buffer);
-            o->buffer = NULL;
-            
-            // free control I/O
-            free_control_io(o);
-            
-            // init up I/O
-            init_up_io(o);
+            // remember bound address
+            if (!parse_bind_addr(o)) {
+                goto fail;
+            }
             
             // set state
             o->state = STATE_UP;
             
+            if (o->udp) {
+                // keep control I/O and keep receiving, so that we notice
+                // when the server closes the connection
+                start_receive(o, (uint8_t *)o->buffer, 1);
+            } else {
+                // free buffer
+                BFree(o->buffer);
+                o->buffer = NULL;
+                
+                // free control I/O
+                free_control_io(o);
+                
+                // init up I/O
+                init_up_io(o);
+            }
+            
             // call handler
             o->handler(o->user, BSOCKSCLIENT_EVENT_UP);
             return;
         } break;
         
+        case STATE_UP: {
+            ASSERT(o->udp)
+            
+            // the server is not supposed to send anything after the reply; ignore it
+            start_receive(o, (uint8_t *)o->buffer, 1);
+        } break;
+        
         default:
             ASSERT(0);
     }
@@ -402,52 +582,25 @@ void send_handler_done (BSocksClient *o)
         case STATE_SENDING_HELLO: {
             BLog(BLOG_DEBUG, "sent hello");
             
-            // allocate buffer for receiving hello
-            bsize_t size = bsize_fromsize(sizeof(struct socks_server_hello));
-            if (!reserve_buffer(o, size)) {
+            if (!receive_hello(o)) {
                 goto fail;
             }
-            
-            // receive hello
-            start_receive(o, (uint8_t *)o->buffer, size.value);
-            
-            // set state
-            o->state = STATE_SENT_HELLO;
         } break;
         
         case STATE_SENDING_REQUEST: {
             BLog(BLOG_DEBUG, "sent request");
             
-            // allocate buffer for receiving reply
-            bsize_t size = bsize_add(
-                bsize_fromsize(sizeof(struct socks_reply_header)),
-                bsize_max(bsize_fromsize(sizeof(struct socks_addr_ipv4)), bsize_fromsize(sizeof(struct socks_addr_ipv6)))
-            );
-            if (!reserve_buffer(o, size)) {
+            if (!receive_reply(o)) {
                 goto fail;
             }
-            
-            // receive reply header
-            start_receive(o, (uint8_t *)o->buffer, sizeof(struct socks_reply_header));
-            
-            // set state
-            o->state = STATE_SENT_REQUEST;
         } break;
         
         case STATE_SENDING_PASSWORD: {
             BLog(BLOG_DEBUG, "send password");
             
-            // allocate buffer for receiving reply
-            bsize_t size = bsize_fromsize(2);
-            if (!reserve_buffer(o, size)) {
+            if (!receive_password_reply(o)) {
                 goto fail;
             }
-            
-            // receive reply header
-            start_receive(o, (uint8_t *)o->buffer, size.value);
-            
-            // set state
-            o->state = STATE_SENT_PASSWORD;
         } break;
         
         default:
@@ -460,46 +613,48 @@ fail:
     report_error(o, BSOCKSCLIENT_EVENT_ERROR);
 }
 
-void auth_finished (BSocksClient *o)
+int parse_bind_addr (BSocksClient *o)
 {
-    // allocate request buffer
-    bsize_t size = bsize_fromsize(sizeof(struct socks_request_header));
-    switch (o->dest_addr.type) {
-        case BADDR_TYPE_IPV4: size = bsize_add(size, bsize_fromsize(sizeof(struct socks_addr_ipv4))); break;
-        case BADDR_TYPE_IPV6: size = bsize_add(size, bsize_fromsize(sizeof(struct socks_addr_ipv6))); break;
-    }
-    if (!reserve_buffer(o, size)) {
-        report_error(o, BSOCKSCLIENT_EVENT_ERROR);
-        return;
-    }
+    struct socks_reply_header imsg;
+    memcpy(&imsg, o->buffer, sizeof(imsg));
     
-    // write request
-    struct socks_request_header header;
-    header.ver = hton8(SOCKS_VERSION);
-    header.cmd = hton8(SOCKS_CMD_CONNECT);
-    header.rsv = hton8(0);
-    switch (o->dest_addr.type) {
-        case BADDR_TYPE_IPV4: {
-            header.atyp = hton8(SOCKS_ATYP_IPV4);
+    switch (ntoh8(imsg.atyp)) {
+        case SOCKS_ATYP_IPV4: {
             struct socks_addr_ipv4 addr;
-            addr.addr = o->dest_addr.ipv4.ip;
-            addr.port = o->dest_addr.ipv4.port;
-            memcpy(o->buffer + sizeof(header), &addr, sizeof(addr));
+            memcpy(&addr, o->buffer + sizeof(imsg), sizeof(addr));
+            BAddr_InitIPv4(&o->bind_addr, addr.addr, addr.port);
         } break;
-        case BADDR_TYPE_IPV6: {
-            header.atyp = hton8(SOCKS_ATYP_IPV6);
+        case SOCKS_ATYP_IPV6: {
             struct socks_addr_ipv6 addr;
-            memcpy(addr.addr, o->dest_addr.ipv6.ip, sizeof(o->dest_addr.ipv6.ip));
-            addr.port = o->dest_addr.ipv6.port;
-            memcpy(o->buffer + sizeof(header), &addr, sizeof(addr));
+            memcpy(&addr, o->buffer + sizeof(imsg), sizeof(addr));
+            BAddr_InitIPv6(&o->bind_addr, addr.addr, addr.port);
         } break;
         default:
-            ASSERT(0);
+            return 0;
+    }
+    
+    return 1;
+}
+
+void auth_finished (BSocksClient *o)
+{
+    // the request was already sent with the hello
+    if (o->pipelined) {
+        if (!receive_reply(o)) {
+            report_error(o, BSOCKSCLIENT_EVENT_ERROR);
+        }
+        return;
+    }
+    
+    // write request
+    size_t len = 0;
+    if (!append_request(o, &len)) {
+        report_error(o, BSOCKSCLIENT_EVENT_ERROR);
+        return;
     }
-    memcpy(o->buffer, &header, sizeof(header));
     
     // send request
-    PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)o->buffer, size.value);
+    PacketPassInterface_Sender_Send(o->control.send_if, (uint8_t *)o->buffer, len);
     
     // set state
     o->state = STATE_SENDING_REQUEST;
@@ -526,6 +681,13 @@ struct BSocksClient_auth_info BSocksClient_auth_password (const char *username,
 int BSocksClient_Init (BSocksClient *o,
                        BAddr server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
                        BAddr dest_addr, BSocksClient_handler handler, void *user, BReactor *reactor)
+{
+    return BSocksClient_Init2(o, server_addr, auth_info, num_auth_info, dest_addr, 0, handler, user, reactor);
+}
+
+int BSocksClient_Init2 (BSocksClient *o,
+                        BAddr server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
+                        BAddr dest_addr, int flags, BSocksClient_handler handler, void *user, BReactor *reactor)
 {
     ASSERT(!BAddr_IsInvalid(&server_addr))
     ASSERT(dest_addr.type == BADDR_TYPE_IPV4 || dest_addr.type == BADDR_TYPE_IPV6)
@@ -540,16 +702,25 @@ int BSocksClient_Init (BSocksClient *o,
     o->auth_info = auth_info;
     o->num_auth_info = num_auth_info;
     o->dest_addr = dest_addr;
+    o->udp = !!(flags & BSOCKSCLIENT_FLAG_UDP);
     o->handler = handler;
     o->user = user;
     o->reactor = reactor;
     
+    // set no socket options
+    o->socket_options = NULL;
+    
+    // don't pipeline
+    o->pipelined = 0;
+    
     // set no buffer
     o->buffer = NULL;
     
     // init connector
-    if (!BConnector_Init(&o->connector, server_addr, o->reactor, o, (BConnector_handler)connector_handler)) {
-        BLog(BLOG_ERROR, "BConnector_Init failed");
+    int connector_flags = ((flags & BSOCKSCLIENT_FLAG_FASTOPEN) ? BCONNECTOR_FLAG_FASTOPEN : 0);
+    if (!BConnector_InitFrom2(&o->connector, BLisCon_from_addr(server_addr), connector_flags,
+                              o->reactor, o, (BConnector_handler)connector_handler)) {
+        BLog(BLOG_ERROR, "BConnector_InitFrom2 failed");
         goto fail0;
     }
     
@@ -570,7 +741,7 @@ void BSocksClient_Free (BSocksClient *o)
     DebugError_Free(&o->d_err);
     
     if (o->state != STATE_CONNECTING) {
-        if (o->state == STATE_UP) {
+        if (o->state == STATE_UP && !o->udp) {
             // free up I/O
             free_up_io(o);
         } else {
@@ -591,9 +762,35 @@ void BSocksClient_Free (BSocksClient *o)
     }
 }
 
+void BSocksClient_SetSocketOptions (BSocksClient *o, const struct BConnection_options *opts)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state == STATE_CONNECTING)
+    
+    o->socket_options = opts;
+}
+
+void BSocksClient_SetPipelined (BSocksClient *o, int pipelined)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state == STATE_CONNECTING)
+    ASSERT(!pipelined || o->num_auth_info == 1)
+    
+    o->pipelined = !!pipelined;
+}
+
+BAddr BSocksClient_GetBindAddr (BSocksClient *o)
+{
+    ASSERT(o->state == STATE_UP)
+    DebugObject_Access(&o->d_obj);
+    
+    return o->bind_addr;
+}
+
 StreamPassInterface * BSocksClient_GetSendInterface (BSocksClient *o)
 {
     ASSERT(o->state == STATE_UP)
+    ASSERT(!o->udp)
     DebugObject_Access(&o->d_obj);
     
     return BConnection_SendAsync_GetIf(&o->con);
@@ -602,6 +799,7 @@ StreamPassInterface * BSocksClient_GetSendInterface (BSocksClient *o)
 StreamRecvInterface * BSocksClient_GetRecvInterface (BSocksClient *o)
 {
     ASSERT(o->state == STATE_UP)
+    ASSERT(!o->udp)
     DebugObject_Access(&o->d_obj);
     
     return BConnection_RecvAsync_GetIf(&o->con);
@@ -28,7 +28,8 @@
  * 
  * @section DESCRIPTION
  * 
- * SOCKS5 client. TCP only, no authentication.
+ * SOCKS5 client. Supports CONNECT and UDP ASSOCIATE, with no authentication
+ * or username/password authentication.
  */
 
 #ifndef BADVPN_SOCKS_BSOCKSCLIENT_H
@@ -48,6 +49,19 @@
 #define BSOCKSCLIENT_EVENT_UP 2
 #define BSOCKSCLIENT_EVENT_ERROR_CLOSED 3
 
+/**
+ * Flag for {@link BSocksClient_Init2}: request UDP ASSOCIATE instead of CONNECT.
+ */
+#define BSOCKSCLIENT_FLAG_UDP 1
+
+/**
+ * Flag for {@link BSocksClient_Init2}: connect to the SOCKS server with TCP Fast
+ * Open (see BCONNECTOR_FLAG_FASTOPEN), so that the hello, or the whole handshake
+ * when pipelined, can go out in the SYN. A failure to connect is then reported
+ * as an error event after the hello has been written.
+ */
+#define BSOCKSCLIENT_FLAG_FASTOPEN 2
+
 /**
  * Handler for events generated by the SOCKS client.
  * 
@@ -78,11 +92,15 @@ typedef struct {
     const struct BSocksClient_auth_info *auth_info;
     size_t num_auth_info;
     BAddr dest_addr;
+    int udp;
+    BAddr bind_addr;
     BSocksClient_handler handler;
     void *user;
     BReactor *reactor;
     int state;
     char *buffer;
+    const struct BConnection_options *socket_options;
+    int pipelined;
     BConnector connector;
     BConnection con;
     union {
@@ -119,6 +137,30 @@ int BSocksClient_Init (BSocksClient *o,
                        BAddr server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
                        BAddr dest_addr, BSocksClient_handler handler, void *user, BReactor *reactor) WARN_UNUSED;
 
+/**
+ * Initializes the object, with flags.
+ * 
+ * With BSOCKSCLIENT_FLAG_UDP, UDP ASSOCIATE is requested instead of CONNECT, and
+ * dest_addr is the address the client expects to send datagrams from (which may
+ * be all zeros if unknown). Once up, datagrams are exchanged with the relay at
+ * {@link BSocksClient_GetBindAddr}, and the TCP connection is only kept open to
+ * keep the association alive; the send and receive interfaces are not available.
+ * Closing of the TCP connection is reported as an error event.
+ * 
+ * @param o the object
+ * @param server_addr SOCKS5 server address
+ * @param dest_addr remote address, or the expected UDP source address with
+ *                  BSOCKSCLIENT_FLAG_UDP
+ * @param flags bitmask of BSOCKSCLIENT_FLAG_* flags
+ * @param handler handler for up and error events
+ * @param user value passed to handler
+ * @param reactor reactor we live in
+ * @return 1 on success, 0 on failure
+ */
+int BSocksClient_Init2 (BSocksClient *o,
+                        BAddr server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
+                        BAddr dest_addr, int flags, BSocksClient_handler handler, void *user, BReactor *reactor) WARN_UNUSED;
+
 /**
  * Frees the object.
  * 
@@ -127,17 +169,52 @@ int BSocksClient_Init (BSocksClient *o,
 void BSocksClient_Free (BSocksClient *o);
 
 /**
- * Returns the send interface.
+ * Sets socket options to be applied to the connection to the SOCKS server once
+ * it is established. Failure to apply them is logged and otherwise ignored.
+ * Must be called before the object goes up.
+ * 
+ * @param o the object
+ * @param opts socket options, or NULL for none. Must remain valid as long as
+ *             the object exists.
+ */
+void BSocksClient_SetSocketOptions (BSocksClient *o, const struct BConnection_options *opts);
+
+/**
+ * Sets whether the handshake is pipelined. When it is, the hello, the
+ * password packet (if any) and the request go out in a single write as soon
+ * as the connection is established, and the replies are read afterwards;
+ * this saves a round trip per message, but not all servers may cope with it.
+ * Requires that only one authentication method was given, since the server
+ * has no choice to make. Must be called before the object goes up.
+ * 
+ * @param o the object
+ * @param pipelined whether to pipeline the handshake
+ */
+void BSocksClient_SetPipelined (BSocksClient *o, int pipelined);
+
+/**
+ * Returns the address the server bound for the connection, as received in its
+ * reply. For UDP ASSOCIATE, this is the relay address; if it is all zeros, the
+ * relay is at the server's IP address.
  * The object must be in up state.
  * 
  * @param o the object
+ * @return bound address
+ */
+BAddr BSocksClient_GetBindAddr (BSocksClient *o);
+
+/**
+ * Returns the send interface.
+ * The object must be in up state and not in UDP mode.
+ * 
+ * @param o the object
  * @return send interface
  */
 StreamPassInterface * BSocksClient_GetSendInterface (BSocksClient *o);
 
 /**
  * Returns the receive interface.
- * The object must be in up state.
+ * The object must be in up state and not in UDP mode.
  * 
  * @param o the object
  * @return receive interface
@@ -0,0 +1,73 @@
+/**
+ * @file CBTree_decl.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CBTree_header.h"
+
+typedef struct CBTree_node_struct {
+    int num_keys;
+    int is_leaf;
+    CBTreeKey keys[CBTree_MAX_KEYS];
+    CBTreeLink links[CBTree_MAX_KEYS];
+    // only allocated for internal nodes
+    struct CBTree_node_struct *children[];
+} CBTreeNode;
+
+typedef struct {
+    CBTreeNode *root;
+    size_t count;
+} CBTree;
+
+typedef struct {
+    CBTreeEntry *ptr;
+    CBTreeLink link;
+} CBTreeRef;
+
+static int CBTreeIsNullRef (CBTreeRef node);
+static int CBTreeIsValidRef (CBTreeRef node);
+static CBTreeRef CBTreeDeref (CBTreeArg arg, CBTreeLink link);
+
+static void CBTree_Init (CBTree *o);
+static void CBTree_Free (CBTree *o);
+static int CBTree_Insert (CBTree *o, CBTreeArg arg, CBTreeRef node, CBTreeRef *out_ref);
+static void CBTree_Remove (CBTree *o, CBTreeArg arg, CBTreeRef node);
+static CBTreeRef CBTree_Lookup (const CBTree *o, CBTreeArg arg, CBTreeKey key);
+static CBTreeRef CBTree_LookupExact (const CBTree *o, CBTreeArg arg, CBTreeKey key);
+static CBTreeRef CBTree_GetFirstGreater (const CBTree *o, CBTreeArg arg, CBTreeKey key);
+static CBTreeRef CBTree_GetLastLesser (const CBTree *o, CBTreeArg arg, CBTreeKey key);
+static CBTreeRef CBTree_GetFirstGreaterEqual (const CBTree *o, CBTreeArg arg, CBTreeKey key);
+static CBTreeRef CBTree_GetLastLesserEqual (const CBTree *o, CBTreeArg arg, CBTreeKey key);
+static CBTreeRef CBTree_GetFirst (const CBTree *o, CBTreeArg arg);
+static CBTreeRef CBTree_GetLast (const CBTree *o, CBTreeArg arg);
+static CBTreeRef CBTree_GetNext (const CBTree *o, CBTreeArg arg, CBTreeRef node);
+static CBTreeRef CBTree_GetPrev (const CBTree *o, CBTreeArg arg, CBTreeRef node);
+static int CBTree_IsEmpty (const CBTree *o);
+static size_t CBTree_Count (const CBTree *o);
+static void CBTree_Verify (const CBTree *o, CBTreeArg arg);
+
+#include "CBTree_footer.h"
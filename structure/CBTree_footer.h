@@ -0,0 +1,89 @@
+/**
+ * @file CBTree_footer.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// preprocessor inputs
+#undef CBTREE_PARAM_NAME
+#undef CBTREE_PARAM_TYPE_ENTRY
+#undef CBTREE_PARAM_TYPE_LINK
+#undef CBTREE_PARAM_TYPE_KEY
+#undef CBTREE_PARAM_TYPE_ARG
+#undef CBTREE_PARAM_VALUE_NULL
+#undef CBTREE_PARAM_FUN_DEREF
+#undef CBTREE_PARAM_FUN_ENTRY_KEY
+#undef CBTREE_PARAM_FUN_COMPARE_KEYS
+
+// types
+#undef CBTree
+#undef CBTreeEntry
+#undef CBTreeLink
+#undef CBTreeRef
+#undef CBTreeArg
+#undef CBTreeKey
+#undef CBTreeNode
+
+// non-object public functions
+#undef CBTreeIsNullRef
+#undef CBTreeIsValidRef
+#undef CBTreeDeref
+
+// public functions
+#undef CBTree_Init
+#undef CBTree_Free
+#undef CBTree_Insert
+#undef CBTree_Remove
+#undef CBTree_Lookup
+#undef CBTree_LookupExact
+#undef CBTree_GetFirstGreater
+#undef CBTree_GetLastLesser
+#undef CBTree_GetFirstGreaterEqual
+#undef CBTree_GetLastLesserEqual
+#undef CBTree_GetFirst
+#undef CBTree_GetLast
+#undef CBTree_GetNext
+#undef CBTree_GetPrev
+#undef CBTree_IsEmpty
+#undef CBTree_Count
+#undef CBTree_Verify
+
+// private stuff
+#undef CBTree_MAX_KEYS
+#undef CBTree_MIN_KEYS
+#undef CBTree_node_struct
+#undef CBTree_nulllink
+#undef CBTree_nullref
+#undef CBTree_entry_key
+#undef CBTree_alloc_node
+#undef CBTree_free_subtree
+#undef CBTree_search_node
+#undef CBTree_move_keys
+#undef CBTree_split_child
+#undef CBTree_merge_children
+#undef CBTree_fill_child
+#undef CBTree_find_bound
+#undef CBTree_verify_recurser
@@ -0,0 +1,102 @@
+/**
+ * @file CBTree_header.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// B-tree of entries which are not modified by the tree. Each node holds
+// up to CBTree_MAX_KEYS entries, storing a copy of each entry's key next
+// to its link, so a lookup touches only one node per level and never the
+// entries themselves. Nodes are allocated by the tree, so unlike CAvl,
+// inserting may fail due to lack of memory.
+//
+// Entries are identified by their keys, which must be unique in the tree
+// and must not change while the entry is in the tree.
+
+// Preprocessor inputs:
+// CBTREE_PARAM_NAME - name of this data structure
+// CBTREE_PARAM_TYPE_ENTRY - type of entry
+// CBTREE_PARAM_TYPE_LINK - type of entry link (usually pointer or index)
+// CBTREE_PARAM_TYPE_KEY - type of key; should be small and cheap to copy
+// CBTREE_PARAM_TYPE_ARG - type of argument pass through to callbacks
+// CBTREE_PARAM_VALUE_NULL - value of invalid link (type is CBTREE_PARAM_TYPE_LINK)
+// CBTREE_PARAM_FUN_DEREF(arg, link) - dereference a non-null link; returns pointer to CBTREE_PARAM_TYPE_ENTRY
+// CBTREE_PARAM_FUN_ENTRY_KEY(arg, entry) - get the key of an entry (entry is a reference)
+// CBTREE_PARAM_FUN_COMPARE_KEYS(arg, key1, key2) - compare two keys; returns -1/0/1
+
+#ifndef BADVPN_CBTREE_H
+#error CBTree.h has not been included
+#endif
+
+// types
+#define CBTree CBTREE_PARAM_NAME
+#define CBTreeEntry CBTREE_PARAM_TYPE_ENTRY
+#define CBTreeLink CBTREE_PARAM_TYPE_LINK
+#define CBTreeRef MERGE(CBTREE_PARAM_NAME, Ref)
+#define CBTreeArg CBTREE_PARAM_TYPE_ARG
+#define CBTreeKey CBTREE_PARAM_TYPE_KEY
+#define CBTreeNode MERGE(CBTREE_PARAM_NAME, Node)
+
+// non-object public functions
+#define CBTreeIsNullRef MERGE(CBTree, IsNullRef)
+#define CBTreeIsValidRef MERGE(CBTree, IsValidRef)
+#define CBTreeDeref MERGE(CBTree, Deref)
+
+// public functions
+#define CBTree_Init MERGE(CBTree, _Init)
+#define CBTree_Free MERGE(CBTree, _Free)
+#define CBTree_Insert MERGE(CBTree, _Insert)
+#define CBTree_Remove MERGE(CBTree, _Remove)
+#define CBTree_Lookup MERGE(CBTree, _Lookup)
+#define CBTree_LookupExact MERGE(CBTree, _LookupExact)
+#define CBTree_GetFirstGreater MERGE(CBTree, _GetFirstGreater)
+#define CBTree_GetLastLesser MERGE(CBTree, _GetLastLesser)
+#define CBTree_GetFirstGreaterEqual MERGE(CBTree, _GetFirstGreaterEqual)
+#define CBTree_GetLastLesserEqual MERGE(CBTree, _GetLastLesserEqual)
+#define CBTree_GetFirst MERGE(CBTree, _GetFirst)
+#define CBTree_GetLast MERGE(CBTree, _GetLast)
+#define CBTree_GetNext MERGE(CBTree, _GetNext)
+#define CBTree_GetPrev MERGE(CBTree, _GetPrev)
+#define CBTree_IsEmpty MERGE(CBTree, _IsEmpty)
+#define CBTree_Count MERGE(CBTree, _Count)
+#define CBTree_Verify MERGE(CBTree, _Verify)
+
+// private stuff
+#define CBTree_MAX_KEYS 15
+#define CBTree_MIN_KEYS (CBTree_MAX_KEYS / 2)
+#define CBTree_node_struct MERGE(CBTree, __node)
+#define CBTree_nulllink MERGE(CBTree, __nulllink)
+#define CBTree_nullref MERGE(CBTree, __nullref)
+#define CBTree_entry_key MERGE(CBTree, __entry_key)
+#define CBTree_alloc_node MERGE(CBTree, __alloc_node)
+#define CBTree_free_subtree MERGE(CBTree, __free_subtree)
+#define CBTree_search_node MERGE(CBTree, __search_node)
+#define CBTree_move_keys MERGE(CBTree, __move_keys)
+#define CBTree_split_child MERGE(CBTree, __split_child)
+#define CBTree_merge_children MERGE(CBTree, __merge_children)
+#define CBTree_fill_child MERGE(CBTree, __fill_child)
+#define CBTree_find_bound MERGE(CBTree, __find_bound)
+#define CBTree_verify_recurser MERGE(CBTree, __verify_recurser)
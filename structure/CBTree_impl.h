@@ -0,0 +1,583 @@
+/**
+ * @file CBTree_impl.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CBTree_header.h"
+
+static CBTreeLink CBTree_nulllink (void)
+{
+    return CBTREE_PARAM_VALUE_NULL;
+}
+
+static CBTreeRef CBTree_nullref (void)
+{
+    CBTreeRef n;
+    n.link = CBTREE_PARAM_VALUE_NULL;
+    n.ptr = NULL;
+    return n;
+}
+
+static CBTreeKey CBTree_entry_key (CBTreeArg arg, CBTreeRef entry)
+{
+    return CBTREE_PARAM_FUN_ENTRY_KEY(arg, entry);
+}
+
+static CBTreeNode * CBTree_alloc_node (int is_leaf)
+{
+    size_t size = sizeof(CBTreeNode);
+    if (!is_leaf) {
+        size += (CBTree_MAX_KEYS + 1) * sizeof(CBTreeNode *);
+    }
+    
+    CBTreeNode *n = (CBTreeNode *)BAlloc(size);
+    if (!n) {
+        return NULL;
+    }
+    
+    n->num_keys = 0;
+    n->is_leaf = is_leaf;
+    
+    return n;
+}
+
+static void CBTree_free_subtree (CBTreeNode *n)
+{
+    if (!n->is_leaf) {
+        for (int i = 0; i <= n->num_keys; i++) {
+            CBTree_free_subtree(n->children[i]);
+        }
+    }
+    
+    BFree(n);
+}
+
+// Returns the index of the first key in the node not lesser than the given
+// key, and whether that key is equal.
+static int CBTree_search_node (CBTreeArg arg, const CBTreeNode *n, CBTreeKey key, int *out_found)
+{
+    int lo = 0;
+    int hi = n->num_keys;
+    
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int comp = CBTREE_PARAM_FUN_COMPARE_KEYS(arg, n->keys[mid], key);
+        if (comp == 0) {
+            *out_found = 1;
+            return mid;
+        }
+        if (comp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    *out_found = 0;
+    return lo;
+}
+
+static void CBTree_move_keys (CBTreeNode *dst, int dst_i, CBTreeNode *src, int src_i, int num)
+{
+    memmove(&dst->keys[dst_i], &src->keys[src_i], num * sizeof(dst->keys[0]));
+    memmove(&dst->links[dst_i], &src->links[src_i], num * sizeof(dst->links[0]));
+}
+
+// Splits the full child i of a non-full node, moving its middle key up.
+static int CBTree_split_child (CBTreeNode *n, int i)
+{
+    ASSERT(!n->is_leaf)
+    ASSERT(n->num_keys < CBTree_MAX_KEYS)
+    
+    CBTreeNode *y = n->children[i];
+    ASSERT(y->num_keys == CBTree_MAX_KEYS)
+    
+    CBTreeNode *z = CBTree_alloc_node(y->is_leaf);
+    if (!z) {
+        return 0;
+    }
+    
+    int mid = CBTree_MAX_KEYS / 2;
+    int num_right = CBTree_MAX_KEYS - mid - 1;
+    
+    CBTree_move_keys(z, 0, y, mid + 1, num_right);
+    if (!y->is_leaf) {
+        memcpy(&z->children[0], &y->children[mid + 1], (num_right + 1) * sizeof(z->children[0]));
+    }
+    z->num_keys = num_right;
+    y->num_keys = mid;
+    
+    CBTree_move_keys(n, i + 1, n, i, n->num_keys - i);
+    memmove(&n->children[i + 2], &n->children[i + 1], (n->num_keys - i) * sizeof(n->children[0]));
+    CBTree_move_keys(n, i, y, mid, 1);
+    n->children[i + 1] = z;
+    n->num_keys++;
+    
+    return 1;
+}
+
+// Merges child i + 1 and key i into child i; both children must be at
+// the minimum.
+static void CBTree_merge_children (CBTreeNode *n, int i)
+{
+    ASSERT(!n->is_leaf)
+    ASSERT(i >= 0)
+    ASSERT(i < n->num_keys)
+    
+    CBTreeNode *y = n->children[i];
+    CBTreeNode *z = n->children[i + 1];
+    ASSERT(y->num_keys + z->num_keys + 1 <= CBTree_MAX_KEYS)
+    
+    CBTree_move_keys(y, y->num_keys, n, i, 1);
+    CBTree_move_keys(y, y->num_keys + 1, z, 0, z->num_keys);
+    if (!y->is_leaf) {
+        memcpy(&y->children[y->num_keys + 1], &z->children[0], (z->num_keys + 1) * sizeof(y->children[0]));
+    }
+    y->num_keys += 1 + z->num_keys;
+    
+    CBTree_move_keys(n, i, n, i + 1, n->num_keys - i - 1);
+    memmove(&n->children[i + 1], &n->children[i + 2], (n->num_keys - i - 1) * sizeof(n->children[0]));
+    n->num_keys--;
+    
+    BFree(z);
+}
+
+// Makes sure child i has more than the minimum number of keys, by borrowing
+// from a sibling or merging with it. Returns the index of the child which
+// now covers the range that child i did.
+static int CBTree_fill_child (CBTreeNode *n, int i)
+{
+    ASSERT(!n->is_leaf)
+    
+    CBTreeNode *c = n->children[i];
+    if (c->num_keys > CBTree_MIN_KEYS) {
+        return i;
+    }
+    
+    if (i > 0 && n->children[i - 1]->num_keys > CBTree_MIN_KEYS) {
+        // rotate right through key i - 1
+        CBTreeNode *l = n->children[i - 1];
+        CBTree_move_keys(c, 1, c, 0, c->num_keys);
+        CBTree_move_keys(c, 0, n, i - 1, 1);
+        if (!c->is_leaf) {
+            memmove(&c->children[1], &c->children[0], (c->num_keys + 1) * sizeof(c->children[0]));
+            c->children[0] = l->children[l->num_keys];
+        }
+        c->num_keys++;
+        CBTree_move_keys(n, i - 1, l, l->num_keys - 1, 1);
+        l->num_keys--;
+        return i;
+    }
+    
+    if (i < n->num_keys && n->children[i + 1]->num_keys > CBTree_MIN_KEYS) {
+        // rotate left through key i
+        CBTreeNode *r = n->children[i + 1];
+        CBTree_move_keys(c, c->num_keys, n, i, 1);
+        if (!c->is_leaf) {
+            c->children[c->num_keys + 1] = r->children[0];
+            memmove(&r->children[0], &r->children[1], r->num_keys * sizeof(r->children[0]));
+        }
+        c->num_keys++;
+        CBTree_move_keys(n, i, r, 0, 1);
+        CBTree_move_keys(r, 0, r, 1, r->num_keys - 1);
+        r->num_keys--;
+        return i;
+    }
+    
+    if (i < n->num_keys) {
+        CBTree_merge_children(n, i);
+        return i;
+    }
+    
+    CBTree_merge_children(n, i - 1);
+    return i - 1;
+}
+
+// Finds the first entry greater than the key (dir=1) or the last entry
+// lesser than the key (dir=0), or an equal one if inclusive.
+static CBTreeRef CBTree_find_bound (const CBTree *o, CBTreeArg arg, CBTreeKey key, int dir, int inclusive)
+{
+    CBTreeLink best = CBTree_nulllink();
+    
+    CBTreeNode *n = o->root;
+    while (n) {
+        int found;
+        int i = CBTree_search_node(arg, n, key, &found);
+        
+        if (found && inclusive) {
+            return CBTreeDeref(arg, n->links[i]);
+        }
+        
+        if (dir) {
+            i += found;
+            if (i < n->num_keys) {
+                best = n->links[i];
+            }
+        } else {
+            if (i > 0) {
+                best = n->links[i - 1];
+            }
+        }
+        
+        n = (n->is_leaf ? NULL : n->children[i]);
+    }
+    
+    return CBTreeDeref(arg, best);
+}
+
+static int CBTree_verify_recurser (CBTreeArg arg, const CBTreeNode *n, int is_root, const CBTreeKey *min, const CBTreeKey *max, size_t *count)
+{
+    ASSERT_FORCE(n->num_keys <= CBTree_MAX_KEYS)
+    ASSERT_FORCE(n->num_keys >= (is_root ? 1 : CBTree_MIN_KEYS))
+    
+    for (int i = 0; i < n->num_keys; i++) {
+        ASSERT_FORCE(n->links[i] != CBTree_nulllink())
+        CBTreeKey ekey = CBTree_entry_key(arg, CBTreeDeref(arg, n->links[i]));
+        ASSERT_FORCE(CBTREE_PARAM_FUN_COMPARE_KEYS(arg, n->keys[i], ekey) == 0)
+        
+        if (i > 0) {
+            ASSERT_FORCE(CBTREE_PARAM_FUN_COMPARE_KEYS(arg, n->keys[i - 1], n->keys[i]) < 0)
+        }
+        if (min) {
+            ASSERT_FORCE(CBTREE_PARAM_FUN_COMPARE_KEYS(arg, *min, n->keys[i]) < 0)
+        }
+        if (max) {
+            ASSERT_FORCE(CBTREE_PARAM_FUN_COMPARE_KEYS(arg, n->keys[i], *max) < 0)
+        }
+    }
+    
+    *count += n->num_keys;
+    
+    if (n->is_leaf) {
+        return 1;
+    }
+    
+    int height = -1;
+    for (int i = 0; i <= n->num_keys; i++) {
+        const CBTreeKey *cmin = (i > 0 ? &n->keys[i - 1] : min);
+        const CBTreeKey *cmax = (i < n->num_keys ? &n->keys[i] : max);
+        int h = CBTree_verify_recurser(arg, n->children[i], 0, cmin, cmax, count);
+        
+        // all leaves are at the same depth
+        ASSERT_FORCE(height == -1 || h == height)
+        height = h;
+    }
+    
+    return height + 1;
+}
+
+static int CBTreeIsNullRef (CBTreeRef node)
+{
+    return node.link == CBTree_nulllink();
+}
+
+static int CBTreeIsValidRef (CBTreeRef node)
+{
+    return node.link != CBTree_nulllink();
+}
+
+static CBTreeRef CBTreeDeref (CBTreeArg arg, CBTreeLink link)
+{
+    if (link == CBTree_nulllink()) {
+        return CBTree_nullref();
+    }
+    
+    CBTreeRef n;
+    n.ptr = CBTREE_PARAM_FUN_DEREF(arg, link);
+    n.link = link;
+    
+    ASSERT(n.ptr)
+    
+    return n;
+}
+
+static void CBTree_Init (CBTree *o)
+{
+    o->root = NULL;
+    o->count = 0;
+}
+
+static void CBTree_Free (CBTree *o)
+{
+    if (o->root) {
+        CBTree_free_subtree(o->root);
+    }
+}
+
+static int CBTree_Insert (CBTree *o, CBTreeArg arg, CBTreeRef node, CBTreeRef *out_ref)
+{
+    ASSERT(node.link != CBTree_nulllink())
+    ASSERT(node.ptr == CBTREE_PARAM_FUN_DEREF(arg, node.link))
+    
+    CBTreeKey key = CBTree_entry_key(arg, node);
+    
+    if (!o->root) {
+        if (!(o->root = CBTree_alloc_node(1))) {
+            goto fail_memory;
+        }
+    }
+    else if (o->root->num_keys == CBTree_MAX_KEYS) {
+        CBTreeNode *new_root = CBTree_alloc_node(0);
+        if (!new_root) {
+            goto fail_memory;
+        }
+        new_root->children[0] = o->root;
+        if (!CBTree_split_child(new_root, 0)) {
+            BFree(new_root);
+            goto fail_memory;
+        }
+        o->root = new_root;
+    }
+    
+    // Split full nodes on the way down so that there is always room
+    // for a key moving up. The tree stays valid if a split fails.
+    CBTreeNode *n = o->root;
+    while (1) {
+        int found;
+        int i = CBTree_search_node(arg, n, key, &found);
+        
+        if (found) {
+            if (out_ref) {
+                *out_ref = CBTreeDeref(arg, n->links[i]);
+            }
+            return 0;
+        }
+        
+        if (n->is_leaf) {
+            CBTree_move_keys(n, i + 1, n, i, n->num_keys - i);
+            n->keys[i] = key;
+            n->links[i] = node.link;
+            n->num_keys++;
+            o->count++;
+            return 1;
+        }
+        
+        if (n->children[i]->num_keys == CBTree_MAX_KEYS) {
+            if (!CBTree_split_child(n, i)) {
+                goto fail_memory;
+            }
+            int comp = CBTREE_PARAM_FUN_COMPARE_KEYS(arg, key, n->keys[i]);
+            if (comp == 0) {
+                if (out_ref) {
+                    *out_ref = CBTreeDeref(arg, n->links[i]);
+                }
+                return 0;
+            }
+            if (comp > 0) {
+                i++;
+            }
+        }
+        
+        n = n->children[i];
+    }
+    
+fail_memory:
+    if (out_ref) {
+        *out_ref = CBTree_nullref();
+    }
+    return 0;
+}
+
+static void CBTree_Remove (CBTree *o, CBTreeArg arg, CBTreeRef node)
+{
+    ASSERT(node.link != CBTree_nulllink())
+    ASSERT(node.ptr == CBTREE_PARAM_FUN_DEREF(arg, node.link))
+    ASSERT(o->root)
+    
+    CBTreeKey key = CBTree_entry_key(arg, node);
+    
+    // Make sure each node we descend into has more than the minimum number
+    // of keys, so that removing from it never needs to go back up.
+    CBTreeNode *n = o->root;
+    while (1) {
+        int found;
+        int i = CBTree_search_node(arg, n, key, &found);
+        
+        if (n->is_leaf) {
+            ASSERT(found)
+            CBTree_move_keys(n, i, n, i + 1, n->num_keys - i - 1);
+            n->num_keys--;
+            break;
+        }
+        
+        if (!found) {
+            i = CBTree_fill_child(n, i);
+            n = n->children[i];
+            continue;
+        }
+        
+        CBTreeNode *y = n->children[i];
+        CBTreeNode *z = n->children[i + 1];
+        
+        if (y->num_keys > CBTree_MIN_KEYS) {
+            // replace with the predecessor, then remove that from the left
+            CBTreeNode *p = y;
+            while (!p->is_leaf) {
+                p = p->children[p->num_keys];
+            }
+            CBTree_move_keys(n, i, p, p->num_keys - 1, 1);
+            key = n->keys[i];
+            n = y;
+        }
+        else if (z->num_keys > CBTree_MIN_KEYS) {
+            // replace with the successor, then remove that from the right
+            CBTreeNode *s = z;
+            while (!s->is_leaf) {
+                s = s->children[0];
+            }
+            CBTree_move_keys(n, i, s, 0, 1);
+            key = n->keys[i];
+            n = z;
+        }
+        else {
+            // bring the key down into the merged child
+            CBTree_merge_children(n, i);
+            n = y;
+        }
+    }
+    
+    o->count--;
+    
+    // shrink the tree if the root became empty
+    if (o->root->num_keys == 0) {
+        CBTreeNode *old_root = o->root;
+        o->root = (old_root->is_leaf ? NULL : old_root->children[0]);
+        BFree(old_root);
+    }
+}
+
+static CBTreeRef CBTree_Lookup (const CBTree *o, CBTreeArg arg, CBTreeKey key)
+{
+    CBTreeRef ref = CBTree_find_bound(o, arg, key, 0, 1);
+    if (CBTreeIsNullRef(ref)) {
+        ref = CBTree_find_bound(o, arg, key, 1, 0);
+    }
+    
+    return ref;
+}
+
+static CBTreeRef CBTree_LookupExact (const CBTree *o, CBTreeArg arg, CBTreeKey key)
+{
+    CBTreeNode *n = o->root;
+    while (n) {
+        int found;
+        int i = CBTree_search_node(arg, n, key, &found);
+        
+        if (found) {
+            return CBTreeDeref(arg, n->links[i]);
+        }
+        
+        n = (n->is_leaf ? NULL : n->children[i]);
+    }
+    
+    return CBTree_nullref();
+}
+
+static CBTreeRef CBTree_GetFirstGreater (const CBTree *o, CBTreeArg arg, CBTreeKey key)
+{
+    return CBTree_find_bound(o, arg, key, 1, 0);
+}
+
+static CBTreeRef CBTree_GetLastLesser (const CBTree *o, CBTreeArg arg, CBTreeKey key)
+{
+    return CBTree_find_bound(o, arg, key, 0, 0);
+}
+
+static CBTreeRef CBTree_GetFirstGreaterEqual (const CBTree *o, CBTreeArg arg, CBTreeKey key)
+{
+    return CBTree_find_bound(o, arg, key, 1, 1);
+}
+
+static CBTreeRef CBTree_GetLastLesserEqual (const CBTree *o, CBTreeArg arg, CBTreeKey key)
+{
+    return CBTree_find_bound(o, arg, key, 0, 1);
+}
+
+static CBTreeRef CBTree_GetFirst (const CBTree *o, CBTreeArg arg)
+{
+    if (!o->root) {
+        return CBTree_nullref();
+    }
+    
+    CBTreeNode *n = o->root;
+    while (!n->is_leaf) {
+        n = n->children[0];
+    }
+    
+    return CBTreeDeref(arg, n->links[0]);
+}
+
+static CBTreeRef CBTree_GetLast (const CBTree *o, CBTreeArg arg)
+{
+    if (!o->root) {
+        return CBTree_nullref();
+    }
+    
+    CBTreeNode *n = o->root;
+    while (!n->is_leaf) {
+        n = n->children[n->num_keys];
+    }
+    
+    return CBTreeDeref(arg, n->links[n->num_keys - 1]);
+}
+
+static CBTreeRef CBTree_GetNext (const CBTree *o, CBTreeArg arg, CBTreeRef node)
+{
+    ASSERT(node.link != CBTree_nulllink())
+    
+    return CBTree_find_bound(o, arg, CBTree_entry_key(arg, node), 1, 0);
+}
+
+static CBTreeRef CBTree_GetPrev (const CBTree *o, CBTreeArg arg, CBTreeRef node)
+{
+    ASSERT(node.link != CBTree_nulllink())
+    
+    return CBTree_find_bound(o, arg, CBTree_entry_key(arg, node), 0, 0);
+}
+
+static int CBTree_IsEmpty (const CBTree *o)
+{
+    return !o->root;
+}
+
+static size_t CBTree_Count (const CBTree *o)
+{
+    return o->count;
+}
+
+static void CBTree_Verify (const CBTree *o, CBTreeArg arg)
+{
+    size_t count = 0;
+    
+    if (o->root) {
+        CBTree_verify_recurser(arg, o->root, 1, NULL, NULL, &count);
+    }
+    
+    ASSERT_FORCE(count == o->count)
+}
+
+#include "CBTree_footer.h"
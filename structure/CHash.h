@@ -31,6 +31,7 @@
 #define BADVPN_CHASH_H
 
 #include <stdlib.h>
+#include <stdint.h>
 
 #include <misc/debug.h>
 #include <misc/merge.h>
@@ -32,6 +32,10 @@
 typedef struct {
     CHashLink *buckets;
     size_t num_buckets;
+    size_t num_entries;
+    CHashLink *old_buckets;
+    size_t old_num_buckets;
+    size_t rehash_pos;
 } CHash;
 
 typedef struct {
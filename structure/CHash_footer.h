@@ -72,3 +72,10 @@
 // private things
 #undef CHash_next
 #undef CHash_assert_valid_entry
+#undef CHash_index
+#undef CHash_bucket
+#undef CHash_migrate_bucket
+#undef CHash_rehash_step
+#undef CHash_start_grow
+#undef CHash_finish_rehash
+#undef CHash_added
@@ -76,3 +76,10 @@
 // private things
 #define CHash_next(entry) ((entry).ptr->CHASH_PARAM_ENTRY_NEXT)
 #define CHash_assert_valid_entry MERGE(CHash, _assert_valid_entry)
+#define CHash_index MERGE(CHash, _index)
+#define CHash_bucket MERGE(CHash, _bucket)
+#define CHash_migrate_bucket MERGE(CHash, _migrate_bucket)
+#define CHash_rehash_step MERGE(CHash, _rehash_step)
+#define CHash_start_grow MERGE(CHash, _start_grow)
+#define CHash_finish_rehash MERGE(CHash, _finish_rehash)
+#define CHash_added MERGE(CHash, _added)
@@ -78,13 +78,129 @@ static CHashRef CHashDerefNonNull (CHashArg arg, CHashLink link)
     return entry;
 }
 
+static size_t CHash_index (size_t hash, size_t num_buckets)
+{
+    ASSERT(num_buckets > 0)
+    ASSERT((num_buckets & (num_buckets - 1)) == 0)
+    
+    // mix the high bits into the low bits which are masked, since some
+    // hashes (e.g. of pointers) have little entropy in their low bits
+    uint64_t h = (uint64_t)hash * UINT64_C(0x9E3779B97F4A7C15);
+    h ^= h >> 32;
+    
+    return (size_t)h & (num_buckets - 1);
+}
+
+static CHashLink * CHash_bucket (const CHash *o, size_t hash)
+{
+    // while growing, buckets which haven't been moved over yet are
+    // still in the old array
+    if (o->old_buckets) {
+        size_t old_index = CHash_index(hash, o->old_num_buckets);
+        if (old_index >= o->rehash_pos) {
+            return &o->old_buckets[old_index];
+        }
+    }
+    
+    return &o->buckets[CHash_index(hash, o->num_buckets)];
+}
+
+static void CHash_migrate_bucket (CHash *o, CHashArg arg)
+{
+    ASSERT(o->old_buckets)
+    ASSERT(o->rehash_pos < o->old_num_buckets)
+    ASSERT(o->num_buckets == 2 * o->old_num_buckets)
+    
+    size_t i = o->rehash_pos;
+    
+    // The entries of old bucket i go to new buckets i and i + old_num_buckets,
+    // which nothing else could have been put into yet. Append them in order,
+    // keeping equal entries next to each other.
+    CHashLink *tails[2] = {&o->buckets[i], &o->buckets[i + o->old_num_buckets]};
+    ASSERT(*tails[0] == CHashNullLink())
+    ASSERT(*tails[1] == CHashNullLink())
+    
+    CHashLink link = o->old_buckets[i];
+    while (link != CHashNullLink()) {
+        CHashRef cur = CHashDerefNonNull(arg, link);
+        link = CHash_next(cur);
+        
+        size_t new_index = CHash_index(CHASH_PARAM_ENTRYHASH(arg, cur), o->num_buckets);
+        ASSERT(new_index == i || new_index == i + o->old_num_buckets)
+        int side = (new_index != i);
+        
+        CHash_next(cur) = CHashNullLink();
+        *tails[side] = cur.link;
+        tails[side] = &CHash_next(cur);
+    }
+    
+    o->old_buckets[i] = CHashNullLink();
+    o->rehash_pos++;
+    
+    // done growing?
+    if (o->rehash_pos == o->old_num_buckets) {
+        BFree(o->old_buckets);
+        o->old_buckets = NULL;
+    }
+}
+
+static void CHash_rehash_step (CHash *o, CHashArg arg)
+{
+    // move two buckets per modification; growing starts when there are as
+    // many entries as old buckets, so it finishes well before the next growth
+    for (int i = 0; i < 2 && o->old_buckets; i++) {
+        CHash_migrate_bucket(o, arg);
+    }
+}
+
+static int CHash_start_grow (CHash *o)
+{
+    ASSERT(!o->old_buckets)
+    
+    if (o->num_buckets > SIZE_MAX / 2) {
+        return 0;
+    }
+    size_t new_num_buckets = 2 * o->num_buckets;
+    
+    CHashLink *new_buckets = (CHashLink *)BAllocArray(new_num_buckets, sizeof(new_buckets[0]));
+    if (!new_buckets) {
+        return 0;
+    }
+    
+    for (size_t i = 0; i < new_num_buckets; i++) {
+        new_buckets[i] = CHashNullLink();
+    }
+    
+    o->old_buckets = o->buckets;
+    o->old_num_buckets = o->num_buckets;
+    o->rehash_pos = 0;
+    o->buckets = new_buckets;
+    o->num_buckets = new_num_buckets;
+    
+    return 1;
+}
+
+static void CHash_finish_rehash (CHash *o, CHashArg arg)
+{
+    while (o->old_buckets) {
+        CHash_migrate_bucket(o, arg);
+    }
+}
+
 static int CHash_Init (CHash *o, size_t num_buckets)
 {
-    if (num_buckets == 0) {
-        num_buckets = 1;
+    // round up to a power of two
+    size_t n = 1;
+    while (n < num_buckets) {
+        if (n > SIZE_MAX / 2) {
+            return 0;
+        }
+        n *= 2;
     }
     
-    o->num_buckets = num_buckets;
+    o->num_buckets = n;
+    o->num_entries = 0;
+    o->old_buckets = NULL;
     
     o->buckets = (CHashLink *)BAllocArray(o->num_buckets, sizeof(o->buckets[0])); 
     if (!o->buckets) {
@@ -100,16 +216,32 @@ static int CHash_Init (CHash *o, size_t num_buckets)
 
 static void CHash_Free (CHash *o)
 {
+    if (o->old_buckets) {
+        BFree(o->old_buckets);
+    }
     BFree(o->buckets);
 }
 
+static void CHash_added (CHash *o, CHashArg arg)
+{
+    o->num_entries++;
+    
+    // grow once the chains get longer than one entry on average; if
+    // that fails, keep working with longer chains
+    if (!o->old_buckets && o->num_entries > o->num_buckets) {
+        CHash_start_grow(o);
+    }
+    
+    CHash_rehash_step(o, arg);
+}
+
 static int CHash_Insert (CHash *o, CHashArg arg, CHashRef entry, CHashRef *out_existing)
 {
     CHash_assert_valid_entry(arg, entry);
     
-    size_t index = CHASH_PARAM_ENTRYHASH(arg, entry) % o->num_buckets;
+    CHashLink *bucket = CHash_bucket(o, CHASH_PARAM_ENTRYHASH(arg, entry));
     
-    CHashLink link = o->buckets[index];
+    CHashLink link = *bucket;
     while (link != CHashNullLink()) {
         CHashRef cur = CHashDerefNonNull(arg, link);
         if (CHASH_PARAM_COMPARE_ENTRIES(arg, cur, entry)) {
@@ -121,8 +253,10 @@ static int CHash_Insert (CHash *o, CHashArg arg, CHashRef entry, CHashRef *out_e
         link = CHash_next(cur);
     }
     
-    CHash_next(entry) = o->buckets[index];
-    o->buckets[index] = entry.link;
+    CHash_next(entry) = *bucket;
+    *bucket = entry.link;
+    
+    CHash_added(o, arg);
     
     return 1;
 }
@@ -131,10 +265,10 @@ static void CHash_InsertMulti (CHash *o, CHashArg arg, CHashRef entry)
 {
     CHash_assert_valid_entry(arg, entry);
     
-    size_t index = CHASH_PARAM_ENTRYHASH(arg, entry) % o->num_buckets;
+    CHashLink *bucket = CHash_bucket(o, CHASH_PARAM_ENTRYHASH(arg, entry));
     
     CHashRef prev = CHashNullRef();
-    CHashLink link = o->buckets[index];
+    CHashLink link = *bucket;
     while (link != CHashNullLink()) {
         CHashRef cur = CHashDerefNonNull(arg, link);
         if (CHASH_PARAM_COMPARE_ENTRIES(arg, cur, entry)) {
@@ -145,22 +279,25 @@ static void CHash_InsertMulti (CHash *o, CHashArg arg, CHashRef entry)
     }
     
     if (link == CHashNullLink() || prev.link == CHashNullLink()) {
-        CHash_next(entry) = o->buckets[index];
-        o->buckets[index] = entry.link;
+        CHash_next(entry) = *bucket;
+        *bucket = entry.link;
     } else {
         CHash_next(entry) = link;
         CHash_next(prev) = entry.link;
     }
+    
+    CHash_added(o, arg);
 }
 
 static void CHash_Remove (CHash *o, CHashArg arg, CHashRef entry)
 {
     CHash_assert_valid_entry(arg, entry);
+    ASSERT(o->num_entries > 0)
     
-    size_t index = CHASH_PARAM_ENTRYHASH(arg, entry) % o->num_buckets;
+    CHashLink *bucket = CHash_bucket(o, CHASH_PARAM_ENTRYHASH(arg, entry));
     
     CHashRef prev = CHashNullRef();
-    CHashLink link = o->buckets[index];
+    CHashLink link = *bucket;
     while (link != entry.link) {
         CHashRef cur = CHashDerefNonNull(arg, link);
         prev = cur;
@@ -169,18 +306,21 @@ static void CHash_Remove (CHash *o, CHashArg arg, CHashRef entry)
     }
     
     if (prev.link == CHashNullLink()) {
-        o->buckets[index] = CHash_next(entry);
+        *bucket = CHash_next(entry);
     } else {
         CHash_next(prev) = CHash_next(entry);
     }
+    
+    o->num_entries--;
+    
+    CHash_rehash_step(o, arg);
 }
 
 static CHashRef CHash_Lookup (const CHash *o, CHashArg arg, CHashKey key) 
 {
     size_t hash = CHASH_PARAM_KEYHASH(arg, key);
-    size_t index = hash % o->num_buckets;
     
-    CHashLink link = o->buckets[index];
+    CHashLink link = *CHash_bucket(o, hash);
     while (link != CHashNullLink()) {
         CHashRef cur = CHashDerefNonNull(arg, link);
 #if CHASH_PARAM_ENTRYHASH_IS_CHEAP
@@ -218,95 +358,61 @@ static int CHash_MultiplyBuckets (CHash *o, CHashArg arg, int exp)
 {
     ASSERT(exp > 0)
     
-    size_t new_num_buckets = o->num_buckets;
+    // complete any growth in progress, then double as many times as asked,
+    // all at once
+    CHash_finish_rehash(o, arg);
+    
     while (exp-- > 0) {
-        if (new_num_buckets > SIZE_MAX / 2) {
+        if (!CHash_start_grow(o)) {
             return 0;
         }
-        new_num_buckets *= 2;
-    }
-    
-    CHashLink *new_buckets = (CHashLink *)BReallocArray(o->buckets, new_num_buckets, sizeof(new_buckets[0]));
-    if (!new_buckets) {
-        return 0;
-    }
-    o->buckets = new_buckets;
-    
-    for (size_t i = o->num_buckets; i < new_num_buckets; i++) {
-        o->buckets[i] = CHashNullLink();
+        CHash_finish_rehash(o, arg);
     }
     
-    for (size_t i = 0; i < o->num_buckets; i++) {
-        CHashRef prev = CHashNullRef();
-        CHashLink link = o->buckets[i];
-        
-        while (link != CHashNullLink()) {
-            CHashRef cur = CHashDerefNonNull(arg, link);
-            link = CHash_next(cur);
-            
-            size_t new_index = CHASH_PARAM_ENTRYHASH(arg, cur) % new_num_buckets;
-            if (new_index == i) {
-                prev = cur;
-                continue;
-            }
-            
-            if (CHashIsNullRef(prev)) {
-                o->buckets[i] = CHash_next(cur);
-            } else {
-                CHash_next(prev) = CHash_next(cur);
-            }
-            
-            CHash_next(cur) = o->buckets[new_index];
-            o->buckets[new_index] = cur.link;
-        }
-    }
-    
-    for (size_t i = o->num_buckets; i < new_num_buckets; i++) {
-        CHashLink new_bucket_link = CHashNullLink();
-        
-        CHashLink link = o->buckets[i];
-        while (link != CHashNullLink()) {
-            CHashRef cur = CHashDerefNonNull(arg, link);
-            link = CHash_next(cur);
-            
-            CHash_next(cur) = new_bucket_link;
-            new_bucket_link = cur.link;
-        }
-        
-        o->buckets[i] = new_bucket_link;
-    }
-    
-    o->num_buckets = new_num_buckets;
-    
     return 1;
 }
 
 static void CHash_Verify (const CHash *o, CHashArg arg)
 {
     ASSERT_FORCE(o->num_buckets > 0)
+    ASSERT_FORCE((o->num_buckets & (o->num_buckets - 1)) == 0)
     ASSERT_FORCE(o->buckets)
+    ASSERT_FORCE(!o->old_buckets || o->num_buckets == 2 * o->old_num_buckets)
+    ASSERT_FORCE(!o->old_buckets || o->rehash_pos < o->old_num_buckets)
     
-    for (size_t i = 0; i < o->num_buckets; i++) {
-        CHashRef cur = CHashDerefMayNull(arg, o->buckets[i]);
-        CHashRef same_first = cur;
+    size_t count = 0;
+    
+    for (int old = 0; old < 2; old++) {
+        CHashLink *buckets = (old ? o->old_buckets : o->buckets);
+        size_t num_buckets = (old ? o->old_num_buckets : o->num_buckets);
+        if (!buckets) {
+            continue;
+        }
         
-        while (!CHashIsNullRef(cur)) {
-            size_t index = CHASH_PARAM_ENTRYHASH(arg, cur) % o->num_buckets;
-            ASSERT_FORCE(index == i)
-            
-            if (!CHASH_PARAM_COMPARE_ENTRIES(arg, cur, same_first)) {
-                same_first = cur;
-            }
+        for (size_t i = 0; i < num_buckets; i++) {
+            CHashRef cur = CHashDerefMayNull(arg, buckets[i]);
+            CHashRef same_first = cur;
             
-            CHashRef ccur = CHashDerefNonNull(arg, o->buckets[i]);
-            while (ccur.link != same_first.link) {
-                ASSERT_FORCE(!CHASH_PARAM_COMPARE_ENTRIES(arg, ccur, cur))
-                ccur = CHashDerefMayNull(arg, CHash_next(ccur));
+            while (!CHashIsNullRef(cur)) {
+                ASSERT_FORCE(CHash_bucket(o, CHASH_PARAM_ENTRYHASH(arg, cur)) == &buckets[i])
+                
+                if (!CHASH_PARAM_COMPARE_ENTRIES(arg, cur, same_first)) {
+                    same_first = cur;
+                }
+                
+                CHashRef ccur = CHashDerefNonNull(arg, buckets[i]);
+                while (ccur.link != same_first.link) {
+                    ASSERT_FORCE(!CHASH_PARAM_COMPARE_ENTRIES(arg, ccur, cur))
+                    ccur = CHashDerefMayNull(arg, CHash_next(ccur));
+                }
+                
+                count++;
+                cur = CHashDerefMayNull(arg, CHash_next(cur));
             }
-            
-            cur = CHashDerefMayNull(arg, CHash_next(cur));
         }
     }
+    
+    ASSERT_FORCE(count == o->num_entries)
 }
 
 #include "CHash_footer.h"
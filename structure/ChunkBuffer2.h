@@ -78,6 +78,10 @@ static void ChunkBuffer2_SubmitPacket (ChunkBuffer2 *buf, int len);
 // remove the first packet
 static void ChunkBuffer2_ConsumePacket (ChunkBuffer2 *buf);
 
+// look at a packet without removing it; 'offset' is 0 for the first packet, or the
+// '*out_next' of the previous packet. Returns 0 if there are no more packets.
+static int ChunkBuffer2_PeekPacket (ChunkBuffer2 *buf, int offset, uint8_t **out_data, int *out_len, int *out_next);
+
 static int _ChunkBuffer2_end (ChunkBuffer2 *buf)
 {
     if (buf->used >= buf->wrap - buf->start) {
@@ -314,4 +318,33 @@ void ChunkBuffer2_ConsumePacket (ChunkBuffer2 *buf)
     CHUNKBUFFER2_ASSERT_IO(buf)
 }
 
+int ChunkBuffer2_PeekPacket (ChunkBuffer2 *buf, int offset, uint8_t **out_data, int *out_len, int *out_next)
+{
+    ASSERT(offset >= 0)
+    ASSERT(offset <= buf->used)
+    
+    CHUNKBUFFER2_ASSERT_BUFFER(buf)
+    
+    if (offset == buf->used) {
+        return 0;
+    }
+    
+    // packets past the wrap point continue at the beginning
+    int pos = buf->start + offset;
+    if (pos >= buf->wrap) {
+        pos -= buf->wrap;
+    }
+    
+    int len = buf->buffer[pos].len;
+    int blocklen = bdivide_up(len, sizeof(struct ChunkBuffer2_block));
+    
+    ASSERT(blocklen <= buf->used - offset - 1)
+    
+    *out_data = (uint8_t *)&buf->buffer[pos + 1];
+    *out_len = len;
+    *out_next = offset + 1 + blocklen;
+    
+    return 1;
+}
+
 #endif
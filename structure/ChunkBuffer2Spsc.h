@@ -0,0 +1,202 @@
+/**
+ * @file ChunkBuffer2Spsc.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * @section DESCRIPTION
+ * 
+ * Circular packet buffer for one producer thread and one consumer thread
+ */
+
+#ifndef BADVPN_STRUCTURE_CHUNKBUFFER2SPSC_H
+#define BADVPN_STRUCTURE_CHUNKBUFFER2SPSC_H
+
+#include <stdint.h>
+#include <limits.h>
+
+#include <misc/balign.h>
+#include <misc/debug.h>
+#include <structure/ChunkBuffer2.h>
+
+// Packets are stored like in ChunkBuffer2, as a header block with the length
+// followed by the data blocks, but the producer and the consumer each own one
+// position and only read the other one. Positions run over twice the buffer
+// size, so that a full buffer can be told from an empty one. When a packet
+// doesn't fit before the end of the buffer, the producer writes a header with
+// length -1 and the packet goes to the beginning.
+
+typedef struct {
+    struct ChunkBuffer2_block *buffer;
+    int size;
+    int mtu;
+    
+    // written by the producer, released after packets
+    int head;
+    uint8_t pad1[64];
+    
+    // written by the consumer, released after consuming packets
+    int tail;
+    uint8_t pad2[64];
+    
+    // producer only
+    int prod_head;
+    int prod_skip;
+    uint8_t pad3[64];
+    
+    // consumer only
+    int cons_tail;
+    int cons_blocks;
+} ChunkBuffer2Spsc;
+
+// initialize; use ChunkBuffer2_calc_blocks with at least one packet for the size,
+// which ensures an empty buffer has space for a packet wherever the positions are
+static void ChunkBuffer2Spsc_Init (ChunkBuffer2Spsc *buf, struct ChunkBuffer2_block *buffer, int blocks, int mtu);
+
+// producer: returns where an MTU long packet can be written, or NULL if there is no space
+static uint8_t * ChunkBuffer2Spsc_Producer_GetDest (ChunkBuffer2Spsc *buf);
+
+// producer: submit a packet written to the location returned by GetDest
+static void ChunkBuffer2Spsc_Producer_Submit (ChunkBuffer2Spsc *buf, int len);
+
+// consumer: look at the first packet; returns 0 if there are no packets
+static int ChunkBuffer2Spsc_Consumer_Peek (ChunkBuffer2Spsc *buf, uint8_t **out_data, int *out_len);
+
+// consumer: remove the packet returned by Peek
+static void ChunkBuffer2Spsc_Consumer_Consume (ChunkBuffer2Spsc *buf);
+
+static int _ChunkBuffer2Spsc_pos (ChunkBuffer2Spsc *buf, int c)
+{
+    return (c < buf->size ? c : c - buf->size);
+}
+
+static int _ChunkBuffer2Spsc_advance (ChunkBuffer2Spsc *buf, int c, int n)
+{
+    c += n;
+    return (c < 2 * buf->size ? c : c - 2 * buf->size);
+}
+
+static int _ChunkBuffer2Spsc_used (ChunkBuffer2Spsc *buf, int head, int tail)
+{
+    int used = head - tail;
+    return (used >= 0 ? used : used + 2 * buf->size);
+}
+
+void ChunkBuffer2Spsc_Init (ChunkBuffer2Spsc *buf, struct ChunkBuffer2_block *buffer, int blocks, int mtu)
+{
+    ASSERT(mtu >= 0)
+    ASSERT(blocks >= 2 * (1 + bdivide_up(mtu, sizeof(struct ChunkBuffer2_block))))
+    ASSERT(blocks <= INT_MAX / 2)
+    
+    buf->buffer = buffer;
+    buf->size = blocks;
+    buf->mtu = bdivide_up(mtu, sizeof(struct ChunkBuffer2_block));
+    buf->head = 0;
+    buf->tail = 0;
+    buf->prod_head = 0;
+    buf->prod_skip = -1;
+    buf->cons_tail = 0;
+    buf->cons_blocks = -1;
+}
+
+uint8_t * ChunkBuffer2Spsc_Producer_GetDest (ChunkBuffer2Spsc *buf)
+{
+    int tail = __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE);
+    int free = buf->size - _ChunkBuffer2Spsc_used(buf, buf->prod_head, tail);
+    int pos = _ChunkBuffer2Spsc_pos(buf, buf->prod_head);
+    
+    // skip the rest of the buffer if the packet may not fit there
+    int skip = (buf->size - pos < 1 + buf->mtu ? buf->size - pos : 0);
+    if (free < skip + 1 + buf->mtu) {
+        buf->prod_skip = -1;
+        return NULL;
+    }
+    
+    buf->prod_skip = skip;
+    
+    return (uint8_t *)&buf->buffer[(skip > 0 ? 0 : pos) + 1];
+}
+
+void ChunkBuffer2Spsc_Producer_Submit (ChunkBuffer2Spsc *buf, int len)
+{
+    ASSERT(buf->prod_skip >= 0)
+    ASSERT(len >= 0)
+    ASSERT(len <= buf->mtu * (int)sizeof(struct ChunkBuffer2_block))
+    
+    int pos = _ChunkBuffer2Spsc_pos(buf, buf->prod_head);
+    if (buf->prod_skip > 0) {
+        buf->buffer[pos].len = -1;
+        pos = 0;
+    }
+    buf->buffer[pos].len = len;
+    
+    int blocklen = bdivide_up(len, sizeof(struct ChunkBuffer2_block));
+    buf->prod_head = _ChunkBuffer2Spsc_advance(buf, buf->prod_head, buf->prod_skip + 1 + blocklen);
+    buf->prod_skip = -1;
+    
+    // publish the packet
+    __atomic_store_n(&buf->head, buf->prod_head, __ATOMIC_RELEASE);
+}
+
+int ChunkBuffer2Spsc_Consumer_Peek (ChunkBuffer2Spsc *buf, uint8_t **out_data, int *out_len)
+{
+    int head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+    if (head == buf->cons_tail) {
+        return 0;
+    }
+    
+    int pos = _ChunkBuffer2Spsc_pos(buf, buf->cons_tail);
+    
+    // a skip marker is always published together with the packet after it
+    if (buf->buffer[pos].len < 0) {
+        buf->cons_tail = _ChunkBuffer2Spsc_advance(buf, buf->cons_tail, buf->size - pos);
+        ASSERT(buf->cons_tail != head)
+        pos = 0;
+    }
+    
+    int len = buf->buffer[pos].len;
+    ASSERT(len >= 0)
+    ASSERT(len <= buf->mtu * (int)sizeof(struct ChunkBuffer2_block))
+    
+    buf->cons_blocks = 1 + bdivide_up(len, sizeof(struct ChunkBuffer2_block));
+    ASSERT(buf->cons_blocks <= _ChunkBuffer2Spsc_used(buf, head, buf->cons_tail))
+    
+    *out_data = (uint8_t *)&buf->buffer[pos + 1];
+    *out_len = len;
+    
+    return 1;
+}
+
+void ChunkBuffer2Spsc_Consumer_Consume (ChunkBuffer2Spsc *buf)
+{
+    ASSERT(buf->cons_blocks > 0)
+    
+    buf->cons_tail = _ChunkBuffer2Spsc_advance(buf, buf->cons_tail, buf->cons_blocks);
+    buf->cons_blocks = -1;
+    
+    // release the space
+    __atomic_store_n(&buf->tail, buf->cons_tail, __ATOMIC_RELEASE);
+}
+
+#endif
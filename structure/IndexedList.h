@@ -29,6 +29,8 @@
  * @section DESCRIPTION
  * 
  * A data structure similar to a list, but with efficient index-based access.
+ * It is a counted AVL tree; the first and last nodes are also tracked, so
+ * that using the list as a queue or stack does not walk the tree.
  */
 
 #ifndef BADVPN_INDEXEDLIST_H
@@ -51,6 +53,8 @@ typedef IndexedListNode *IndexedList__tree_link;
 
 struct IndexedList_s {
     IndexedList__Tree tree;
+    IndexedListNode *first;
+    IndexedListNode *last;
 };
 
 struct IndexedListNode_s {
@@ -114,6 +118,7 @@ static IndexedListNode * IndexedList_GetAt (IndexedList *o, uint64_t index);
 
 /**
  * Returns the first node, or NULL if the list is empty.
+ * This takes constant time.
  * 
  * @param o indexed list
  * @return first node, or NULL
@@ -122,6 +127,7 @@ static IndexedListNode * IndexedList_GetFirst (IndexedList *o);
 
 /**
  * Returns the last node, or NULL if the list is empty.
+ * This takes constant time.
  * 
  * @param o indexed list
  * @return last node, or NULL
@@ -157,6 +163,8 @@ static IndexedListNode * IndexedList__deref (IndexedList__TreeRef ref)
 static void IndexedList_Init (IndexedList *o)
 {
     IndexedList__Tree_Init(&o->tree);
+    o->first = NULL;
+    o->last = NULL;
 }
 
 static void IndexedList_InsertAt (IndexedList *o, IndexedListNode *node, uint64_t index)
@@ -165,16 +173,29 @@ static void IndexedList_InsertAt (IndexedList *o, IndexedListNode *node, uint64_
     ASSERT(IndexedList__Tree_Count(&o->tree, 0) < UINT64_MAX - 1)
     
     uint64_t orig_count = IndexedList__Tree_Count(&o->tree, 0);
-    B_USE(orig_count)
     
     IndexedList__Tree_InsertAt(&o->tree, 0, IndexedList__TreeDeref(0, node), index);
     
+    if (index == 0) {
+        o->first = node;
+    }
+    if (index == orig_count) {
+        o->last = node;
+    }
+    
     ASSERT(IndexedList__Tree_IndexOf(&o->tree, 0, IndexedList__TreeDeref(0, node)) == index)
     ASSERT(IndexedList__Tree_Count(&o->tree, 0) == orig_count + 1)
 }
 
 static void IndexedList_Remove (IndexedList *o, IndexedListNode *node)
 {
+    if (node == o->first) {
+        o->first = IndexedList_GetNext(o, node);
+    }
+    if (node == o->last) {
+        o->last = IndexedList_GetPrev(o, node);
+    }
+    
     IndexedList__Tree_Remove(&o->tree, 0, IndexedList__TreeDeref(0, node));
 }
 
@@ -200,12 +221,16 @@ static IndexedListNode * IndexedList_GetAt (IndexedList *o, uint64_t index)
 
 static IndexedListNode * IndexedList_GetFirst (IndexedList *o)
 {
-    return IndexedList__deref(IndexedList__Tree_GetFirst(&o->tree, 0));
+    ASSERT(o->first == IndexedList__deref(IndexedList__Tree_GetFirst(&o->tree, 0)))
+    
+    return o->first;
 }
 
 static IndexedListNode * IndexedList_GetLast (IndexedList *o)
 {
-    return IndexedList__deref(IndexedList__Tree_GetLast(&o->tree, 0));
+    ASSERT(o->last == IndexedList__deref(IndexedList__Tree_GetLast(&o->tree, 0)))
+    
+    return o->last;
 }
 
 static IndexedListNode * IndexedList_GetNext (IndexedList *o, IndexedListNode *node)
@@ -0,0 +1,52 @@
+/**
+ * @file OAHash_decl.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "OAHash_header.h"
+
+typedef struct {
+    OAHashKey key;
+    OAHashValue value;
+    uint8_t used;
+} OAHashSlot;
+
+typedef struct {
+    OAHashSlot *slots;
+    size_t num_slots;
+    size_t num_entries;
+} OAHash;
+
+static int OAHash_Init (OAHash *o, size_t num_entries);
+static void OAHash_Free (OAHash *o);
+static int OAHash_Insert (OAHash *o, OAHashKey key, OAHashValue value) WARN_UNUSED;
+static int OAHash_Remove (OAHash *o, OAHashKey key);
+static OAHashValue * OAHash_Lookup (const OAHash *o, OAHashKey key);
+static size_t OAHash_Count (const OAHash *o);
+static void OAHash_Verify (const OAHash *o);
+
+#include "OAHash_footer.h"
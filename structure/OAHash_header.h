@@ -0,0 +1,67 @@
+/**
+ * @file OAHash_header.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Open-addressing hash table storing keys and values inline, for small,
+// pointer-free keys (e.g. integer IDs). Uses linear probing with
+// backward-shift deletion, and doubles the table when it gets 3/4 full.
+// Keys and values are moved around when the table grows or entries are
+// removed, so pointers to values are only valid until the next Insert
+// or Remove.
+
+// Preprocessor inputs:
+// OAHASH_PARAM_NAME - name of this data structure
+// OAHASH_PARAM_KEY - type of key
+// OAHASH_PARAM_VALUE - type of value
+// OAHASH_PARAM_HASH(key) - hash function for keys; returns size_t
+// OAHASH_PARAM_COMPARE_KEYS(key1, key2) - compares two keys; returns 1 for equality, 0 otherwise
+
+#ifndef BADVPN_OAHASH_H
+#error OAHash.h has not been included
+#endif
+
+// types
+#define OAHash OAHASH_PARAM_NAME
+#define OAHashKey OAHASH_PARAM_KEY
+#define OAHashValue OAHASH_PARAM_VALUE
+#define OAHashSlot MERGE(OAHash, Slot)
+
+// public functions
+#define OAHash_Init MERGE(OAHash, _Init)
+#define OAHash_Free MERGE(OAHash, _Free)
+#define OAHash_Insert MERGE(OAHash, _Insert)
+#define OAHash_Remove MERGE(OAHash, _Remove)
+#define OAHash_Lookup MERGE(OAHash, _Lookup)
+#define OAHash_Count MERGE(OAHash, _Count)
+#define OAHash_Verify MERGE(OAHash, _Verify)
+
+// private things
+#define OAHash_index MERGE(OAHash, _index)
+#define OAHash_find MERGE(OAHash, _find)
+#define OAHash_alloc_slots MERGE(OAHash, _alloc_slots)
+#define OAHash_grow MERGE(OAHash, _grow)
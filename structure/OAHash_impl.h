@@ -0,0 +1,232 @@
+/**
+ * @file OAHash_impl.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "OAHash_header.h"
+
+static size_t OAHash_index (size_t hash, size_t num_slots)
+{
+    ASSERT(num_slots > 0)
+    ASSERT((num_slots & (num_slots - 1)) == 0)
+    
+    // mix the high bits into the low bits which are masked; small integer
+    // keys hashed to themselves would otherwise form long runs
+    uint64_t h = (uint64_t)hash * UINT64_C(0x9E3779B97F4A7C15);
+    h ^= h >> 32;
+    
+    return (size_t)h & (num_slots - 1);
+}
+
+static OAHashSlot * OAHash_find (const OAHash *o, OAHashKey key)
+{
+    size_t mask = o->num_slots - 1;
+    size_t i = OAHash_index(OAHASH_PARAM_HASH(key), o->num_slots);
+    
+    // there is always at least one free slot, so this terminates
+    while (o->slots[i].used) {
+        if (OAHASH_PARAM_COMPARE_KEYS(o->slots[i].key, key)) {
+            return &o->slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+    
+    return NULL;
+}
+
+static OAHashSlot * OAHash_alloc_slots (size_t num_slots)
+{
+    OAHashSlot *slots = (OAHashSlot *)BAllocArray(num_slots, sizeof(slots[0]));
+    if (!slots) {
+        return NULL;
+    }
+    
+    for (size_t i = 0; i < num_slots; i++) {
+        slots[i].used = 0;
+    }
+    
+    return slots;
+}
+
+static int OAHash_grow (OAHash *o)
+{
+    if (o->num_slots > SIZE_MAX / 2) {
+        return 0;
+    }
+    size_t new_num_slots = 2 * o->num_slots;
+    
+    OAHashSlot *new_slots = OAHash_alloc_slots(new_num_slots);
+    if (!new_slots) {
+        return 0;
+    }
+    
+    size_t mask = new_num_slots - 1;
+    
+    for (size_t j = 0; j < o->num_slots; j++) {
+        if (!o->slots[j].used) {
+            continue;
+        }
+        size_t i = OAHash_index(OAHASH_PARAM_HASH(o->slots[j].key), new_num_slots);
+        while (new_slots[i].used) {
+            i = (i + 1) & mask;
+        }
+        new_slots[i] = o->slots[j];
+    }
+    
+    BFree(o->slots);
+    o->slots = new_slots;
+    o->num_slots = new_num_slots;
+    
+    return 1;
+}
+
+static int OAHash_Init (OAHash *o, size_t num_entries)
+{
+    // enough slots to hold num_entries at 3/4 load, as a power of two
+    size_t n = 4;
+    while (n / 4 * 3 < num_entries) {
+        if (n > SIZE_MAX / 2) {
+            return 0;
+        }
+        n *= 2;
+    }
+    
+    o->num_slots = n;
+    o->num_entries = 0;
+    
+    o->slots = OAHash_alloc_slots(o->num_slots);
+    if (!o->slots) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+static void OAHash_Free (OAHash *o)
+{
+    BFree(o->slots);
+}
+
+static int OAHash_Insert (OAHash *o, OAHashKey key, OAHashValue value)
+{
+    ASSERT(!OAHash_find(o, key))
+    
+    if (o->num_entries + 1 > o->num_slots / 4 * 3) {
+        // if growing fails, keep filling up the table, but always
+        // leave one slot free for lookups to stop at
+        if (!OAHash_grow(o) && o->num_entries + 1 >= o->num_slots) {
+            return 0;
+        }
+    }
+    
+    size_t mask = o->num_slots - 1;
+    size_t i = OAHash_index(OAHASH_PARAM_HASH(key), o->num_slots);
+    while (o->slots[i].used) {
+        i = (i + 1) & mask;
+    }
+    
+    o->slots[i].key = key;
+    o->slots[i].value = value;
+    o->slots[i].used = 1;
+    o->num_entries++;
+    
+    return 1;
+}
+
+static int OAHash_Remove (OAHash *o, OAHashKey key)
+{
+    OAHashSlot *slot = OAHash_find(o, key);
+    if (!slot) {
+        return 0;
+    }
+    
+    size_t mask = o->num_slots - 1;
+    size_t hole = slot - o->slots;
+    
+    // Shift following entries of the run back into the hole, as long as
+    // that doesn't move them before their home slot. This leaves no
+    // tombstones behind, so lookups never get slower from removals.
+    size_t i = (hole + 1) & mask;
+    while (o->slots[i].used) {
+        size_t home = OAHash_index(OAHASH_PARAM_HASH(o->slots[i].key), o->num_slots);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            o->slots[hole] = o->slots[i];
+            hole = i;
+        }
+        i = (i + 1) & mask;
+    }
+    
+    o->slots[hole].used = 0;
+    o->num_entries--;
+    
+    return 1;
+}
+
+static OAHashValue * OAHash_Lookup (const OAHash *o, OAHashKey key)
+{
+    OAHashSlot *slot = OAHash_find(o, key);
+    if (!slot) {
+        return NULL;
+    }
+    
+    return &slot->value;
+}
+
+static size_t OAHash_Count (const OAHash *o)
+{
+    return o->num_entries;
+}
+
+static void OAHash_Verify (const OAHash *o)
+{
+    ASSERT_FORCE(o->num_slots > 0)
+    ASSERT_FORCE((o->num_slots & (o->num_slots - 1)) == 0)
+    ASSERT_FORCE(o->num_entries < o->num_slots)
+    
+    size_t mask = o->num_slots - 1;
+    size_t count = 0;
+    
+    for (size_t i = 0; i < o->num_slots; i++) {
+        if (!o->slots[i].used) {
+            continue;
+        }
+        
+        // all slots from the home slot up to this one must be used
+        size_t j = OAHash_index(OAHASH_PARAM_HASH(o->slots[i].key), o->num_slots);
+        while (j != i) {
+            ASSERT_FORCE(o->slots[j].used)
+            ASSERT_FORCE(!OAHASH_PARAM_COMPARE_KEYS(o->slots[j].key, o->slots[i].key))
+            j = (j + 1) & mask;
+        }
+        
+        count++;
+    }
+    
+    ASSERT_FORCE(count == o->num_entries)
+}
+
+#include "OAHash_footer.h"
@@ -100,11 +100,29 @@ typedef struct BListener_s BListener;
  * BCONNECTION_SOURCE_LISTENER 'source' argument.
  * If no attempt is made to accept the connection from the job closure of this handler,
  * the connection will be discarded.
+ * On Unix-like systems, once a connection has been accepted or discarded, the handler
+ * is called again from a job for the next connection waiting in the backlog, for up
+ * to BLISTENER_ACCEPT_BATCH connections per readiness event.
  * 
  * @param user as in {@link BListener_Init}
  */
 typedef void (*BListener_handler) (void *user);
 
+/**
+ * Flag for {@link BListener_InitFrom2}: set SO_REUSEPORT on the socket, so that
+ * multiple processes can listen on the same address and the kernel distributes
+ * connections among them. Only for BLISCON_FROM_ADDR, and not supported on Windows.
+ */
+#define BLISTENER_FLAG_REUSEPORT 1
+
+/**
+ * Flag for {@link BListener_InitFrom2}: set TCP_DEFER_ACCEPT on the socket, so that
+ * a connection is only reported once the client has sent data, for protocols where
+ * the client speaks first. Only for BLISCON_FROM_ADDR. Where not supported, a warning
+ * is logged and the flag has no effect.
+ */
+#define BLISTENER_FLAG_DEFER_ACCEPT 2
+
 /**
  * Common listener initialization function.
  * 
@@ -114,6 +132,15 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
                         BReactor *reactor, void *user,
                         BListener_handler handler) WARN_UNUSED;
 
+/**
+ * Like {@link BListener_InitFrom}, but with flags.
+ * 
+ * @param flags bitmask of BLISTENER_FLAG_* flags
+ */
+int BListener_InitFrom2 (BListener *o, struct BLisCon_from from, int flags,
+                         BReactor *reactor, void *user,
+                         BListener_handler handler) WARN_UNUSED;
+
 /**
  * Initializes the object for listening on an address.
  * {@link BNetwork_GlobalInit} must have been done.
@@ -174,6 +201,18 @@ typedef struct BConnector_s BConnector;
  */
 typedef void (*BConnector_handler) (void *user, int is_error);
 
+/**
+ * Flag for {@link BConnector_InitFrom2}: set TCP_FASTOPEN_CONNECT on the socket, so that
+ * the data of the first write goes out in the SYN when the kernel has a Fast Open cookie
+ * for the server. The connection attempt then reports success immediately, and a failure
+ * to connect is reported as an error of the resulting {@link BConnection} instead.
+ * Only for BLISCON_FROM_ADDR. Where not supported, a warning is logged and the flag has
+ * no effect.
+ */
+#define BCONNECTOR_FLAG_FASTOPEN 1
+
+struct BConnection_options;
+
 /**
  * Common connector initialization function.
  * 
@@ -182,6 +221,29 @@ typedef void (*BConnector_handler) (void *user, int is_error);
 int BConnector_InitFrom (BConnector *o, struct BLisCon_from from, BReactor *reactor, void *user,
                          BConnector_handler handler) WARN_UNUSED;
 
+/**
+ * Like {@link BConnector_InitFrom}, but with flags.
+ * 
+ * @param flags bitmask of BCONNECTOR_FLAG_* flags
+ */
+int BConnector_InitFrom2 (BConnector *o, struct BLisCon_from from, int flags,
+                          BReactor *reactor, void *user,
+                          BConnector_handler handler) WARN_UNUSED;
+
+/**
+ * Like {@link BConnector_InitFrom2}, but also applies socket options before
+ * connecting, as {@link BConnection_SetOptions} would, so that e.g. SO_MARK
+ * and SO_BINDTODEVICE affect how the connection is routed. The connection
+ * attempt fails if an option can't be applied.
+ * Not supported on Windows, where opts must be NULL.
+ * 
+ * @param opts socket options, or NULL for none. Only used during this call.
+ */
+int BConnector_InitFrom3 (BConnector *o, struct BLisCon_from from, int flags,
+                          const struct BConnection_options *opts,
+                          BReactor *reactor, void *user,
+                          BConnector_handler handler) WARN_UNUSED;
+
 /**
  * Initializes the object for connecting to an address.
  * {@link BNetwork_GlobalInit} must have been done.
@@ -338,6 +400,26 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
  */
 void BConnection_Free (BConnection *o);
 
+#ifndef BADVPN_USE_WINAPI
+/**
+ * Frees the object, but leaves the file descriptor open and returns it.
+ * The send and receive interfaces must not be initialized.
+ * Only available on Unix-like systems.
+ * 
+ * This is used to move a connection to a different reactor, e.g. to another
+ * thread of a {@link BReactorGroup}: the returned file descriptor can be passed
+ * to the other thread and made into a new connection there using
+ * BCONNECTION_SOURCE_PIPE(fd, 1). The caller becomes responsible for closing
+ * the file descriptor. If the connection was created with a BCONNECTION_SOURCE_PIPE
+ * 'source' argument where close_it was false, the original owner of the file
+ * descriptor remains responsible for it.
+ * 
+ * @param o the object
+ * @return the file descriptor of the connection
+ */
+int BConnection_Release (BConnection *o);
+#endif
+
 /**
  * Updates the handler function.
  * 
@@ -359,6 +441,75 @@ void BConnection_SetHandlers (BConnection *o, void *user, BConnection_handler ha
  */
 int BConnection_SetSendBuffer (BConnection *o, int buf_size);
 
+/**
+ * Maximum length of a congestion control algorithm name in
+ * {@link BConnection_options}, including the null terminator.
+ */
+#define BCONNECTION_CONGESTION_NAME_MAX 16
+
+/**
+ * Maximum length of a network interface name in {@link BConnection_options},
+ * including the null terminator.
+ */
+#define BCONNECTION_DEVICE_NAME_MAX 16
+
+/**
+ * Socket options for {@link BConnection_SetOptions}.
+ * Initialize with {@link BConnection_options_Init}, which leaves every option
+ * unset, then set the wanted ones directly or with {@link BConnection_options_Parse}.
+ */
+struct BConnection_options {
+    // SO_RCVBUF in bytes, <=0 if unset
+    int rcvbuf;
+    // SO_SNDBUF in bytes, <=0 if unset
+    int sndbuf;
+    // TCP_NODELAY, 0 or 1, <0 if unset
+    int nodelay;
+    // TCP_NOTSENT_LOWAT in bytes, <=0 if unset
+    int notsent_lowat;
+    // TCP_QUICKACK, 0 or 1, <0 if unset
+    int quickack;
+    // TCP_CONGESTION, empty if unset
+    char congestion[BCONNECTION_CONGESTION_NAME_MAX];
+    // SO_MARK, if have_mark
+    int have_mark;
+    uint32_t mark;
+    // SO_BINDTODEVICE, empty if unset
+    char device[BCONNECTION_DEVICE_NAME_MAX];
+};
+
+/**
+ * Initializes socket options with all options unset.
+ * 
+ * @param o the object
+ */
+void BConnection_options_Init (struct BConnection_options *o);
+
+/**
+ * Sets socket options from a string.
+ * The string is a comma-separated list of name=value pairs, with the names
+ * "rcvbuf", "sndbuf", "nodelay", "notsent-lowat", "quickack", "congestion",
+ * "mark" and "device", e.g. "sndbuf=262144,nodelay=1,congestion=bbr". Options not present
+ * are left as they are.
+ * 
+ * @param o the object
+ * @param str string to parse
+ * @return 1 on success, 0 if the string is not valid. On failure, some of the
+ *         options may have been set.
+ */
+int BConnection_options_Parse (struct BConnection_options *o, const char *str) WARN_UNUSED;
+
+/**
+ * Applies the socket options which are set.
+ * All of them are attempted even if some fail. Options not supported
+ * on this platform fail.
+ * 
+ * @param o the object
+ * @param opts options to apply
+ * @return 1 if all options were applied, 0 if any failed
+ */
+int BConnection_SetOptions (BConnection *o, const struct BConnection_options *opts) WARN_UNUSED;
+
 /**
  * Initializes the send interface for the connection.
  * The send interface must not be initialized.
@@ -27,8 +27,126 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdint.h>
+#include <limits.h>
+
+#include <misc/memref.h>
+#include <misc/parse_number.h>
+
 #include "BConnection.h"
 
+static int parse_option_int (MemRef value, int max, int *out)
+{
+    uintmax_t n;
+    if (!parse_unsigned_integer(value, &n) || n > max) {
+        return 0;
+    }
+    
+    *out = n;
+    return 1;
+}
+
+void BConnection_options_Init (struct BConnection_options *o)
+{
+    o->rcvbuf = 0;
+    o->sndbuf = 0;
+    o->nodelay = -1;
+    o->notsent_lowat = 0;
+    o->quickack = -1;
+    o->congestion[0] = '\0';
+    o->have_mark = 0;
+    o->mark = 0;
+    o->device[0] = '\0';
+}
+
+int BConnection_options_Parse (struct BConnection_options *o, const char *str)
+{
+    MemRef rest = MemRef_MakeCstr(str);
+    
+    while (1) {
+        // cut the next name=value pair
+        size_t len;
+        int last = !MemRef_FindChar(rest, ',', &len);
+        if (last) {
+            len = rest.len;
+        }
+        MemRef pair = MemRef_SubTo(rest, len);
+        
+        size_t eq;
+        if (!MemRef_FindChar(pair, '=', &eq)) {
+            return 0;
+        }
+        MemRef name = MemRef_SubTo(pair, eq);
+        MemRef value = MemRef_SubFrom(pair, eq + 1);
+        
+        if (MemRef_Equal(name, MemRef_MakeCstr("rcvbuf"))) {
+            if (!parse_option_int(value, INT_MAX, &o->rcvbuf) || o->rcvbuf == 0) {
+                return 0;
+            }
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("sndbuf"))) {
+            if (!parse_option_int(value, INT_MAX, &o->sndbuf) || o->sndbuf == 0) {
+                return 0;
+            }
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("nodelay"))) {
+            if (!parse_option_int(value, 1, &o->nodelay)) {
+                return 0;
+            }
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("notsent-lowat"))) {
+            if (!parse_option_int(value, INT_MAX, &o->notsent_lowat) || o->notsent_lowat == 0) {
+                return 0;
+            }
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("quickack"))) {
+            if (!parse_option_int(value, 1, &o->quickack)) {
+                return 0;
+            }
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("congestion"))) {
+            if (value.len == 0 || value.len >= sizeof(o->congestion)) {
+                return 0;
+            }
+            MemRef_CopyOut(value, o->congestion);
+            o->congestion[value.len] = '\0';
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("mark"))) {
+            uintmax_t mark;
+            if (!parse_unsigned_integer(value, &mark) || mark > UINT32_MAX) {
+                return 0;
+            }
+            o->have_mark = 1;
+            o->mark = mark;
+        }
+        else if (MemRef_Equal(name, MemRef_MakeCstr("device"))) {
+            if (value.len == 0 || value.len >= sizeof(o->device)) {
+                return 0;
+            }
+            MemRef_CopyOut(value, o->device);
+            o->device[value.len] = '\0';
+        }
+        else {
+            return 0;
+        }
+        
+        if (last) {
+            break;
+        }
+        
+        rest = MemRef_SubFrom(rest, len + 1);
+    }
+    
+    return 1;
+}
+
+int BListener_InitFrom (BListener *o, struct BLisCon_from from,
+                        BReactor *reactor, void *user,
+                        BListener_handler handler)
+{
+    return BListener_InitFrom2(o, from, 0, reactor, user, handler);
+}
+
 int BListener_Init (BListener *o, BAddr addr, BReactor *reactor, void *user,
                     BListener_handler handler)
 {
@@ -43,6 +161,19 @@ int BListener_InitUnix (BListener *o, const char *socket_path, BReactor *reactor
 }
 #endif
 
+int BConnector_InitFrom (BConnector *o, struct BLisCon_from from, BReactor *reactor, void *user,
+                         BConnector_handler handler)
+{
+    return BConnector_InitFrom2(o, from, 0, reactor, user, handler);
+}
+
+int BConnector_InitFrom2 (BConnector *o, struct BLisCon_from from, int flags,
+                          BReactor *reactor, void *user,
+                          BConnector_handler handler)
+{
+    return BConnector_InitFrom3(o, from, flags, NULL, reactor, user, handler);
+}
+
 int BConnector_Init (BConnector *o, BAddr addr, BReactor *reactor, void *user,
                      BConnector_handler handler)
 {
@@ -27,6 +27,10 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <string.h>
 #include <stddef.h>
 #include <unistd.h>
@@ -34,9 +38,13 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <misc/nonblocking.h>
 #include <misc/strdup.h>
+#include <misc/probe.h>
 #include <base/BLog.h>
 
 #include "BConnection.h"
@@ -76,17 +84,29 @@ static int build_unix_address (struct unix_addr *out, const char *socket_path);
 static void addr_socket_to_sys (struct sys_addr *out, BAddr addr);
 static void addr_sys_to_socket (BAddr *out, struct sys_addr addr);
 static void listener_fd_handler (BListener *o, int events);
+static void listener_accept (BListener *o);
+static void listener_accept_job_handler (BListener *o);
+static void listener_accepted (BListener *o);
 static void listener_default_job_handler (BListener *o);
 static void connector_fd_handler (BConnector *o, int events);
 static void connector_job_handler (BConnector *o);
 static void connection_report_error (BConnection *o);
+static void connection_send_done (BConnection *o, int bytes);
 static void connection_send (BConnection *o);
+static void connection_recv_done (BConnection *o, int bytes);
 static void connection_recv (BConnection *o);
+#ifdef BADVPN_USE_IO_URING
+static void connection_send_uring_handler (BConnection *o, int result);
+static void connection_recv_uring_handler (BConnection *o, int result);
+#endif
+static int connection_uring_busy (BConnection *o, int recv);
 static void connection_fd_handler (BConnection *o, int events);
 static void connection_send_job_handler (BConnection *o);
 static void connection_recv_job_handler (BConnection *o);
 static void connection_send_if_handler_send (BConnection *o, uint8_t *data, int data_len);
+static void connection_send_if_handler_sendv (BConnection *o, const struct StreamPassInterface_buf *bufs, int num_bufs);
 static void connection_recv_if_handler_recv (BConnection *o, uint8_t *data, int data_len);
+static int set_socket_options (int fd, const struct BConnection_options *opts);
 
 static int build_unix_address (struct unix_addr *out, const char *socket_path)
 {
@@ -151,6 +171,55 @@ static void listener_fd_handler (BListener *o, int events)
 {
     DebugObject_Access(&o->d_obj);
     
+    // a batch started by an earlier event is still going on
+    if (o->accepted_fd >= 0 || BPending_IsSet(&o->accept_job)) {
+        return;
+    }
+    
+    // start a new batch
+    o->num_accepted = 0;
+    
+    listener_accept(o);
+    return;
+}
+
+static void listener_accept (BListener *o)
+{
+    ASSERT(o->accepted_fd < 0)
+    ASSERT(!BPending_IsSet(&o->default_job))
+    
+    // accept
+    struct sys_addr sysaddr;
+    sysaddr.len = sizeof(sysaddr.addr);
+#ifdef BADVPN_LINUX
+    int newfd = accept4(o->fd, &sysaddr.addr.generic, &sysaddr.len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int newfd = accept(o->fd, &sysaddr.addr.generic, &sysaddr.len);
+#endif
+    if (newfd < 0) {
+        int error = errno;
+        if (error != EAGAIN && error != EWOULDBLOCK && error != EINTR && error != ECONNABORTED) {
+            BLog(BLOG_ERROR, "accept failed");
+        }
+        return;
+    }
+    
+#ifndef BADVPN_LINUX
+    // set non-blocking
+    if (!badvpn_set_nonblocking(newfd)) {
+        BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
+        if (close(newfd) < 0) {
+            BLog(BLOG_ERROR, "close failed");
+        }
+        listener_accepted(o);
+        return;
+    }
+#endif
+    
+    // hold the connection for the handler
+    o->accepted_fd = newfd;
+    addr_sys_to_socket(&o->accepted_addr, sysaddr);
+    
     // set default job
     BPending_Set(&o->default_job);
     
@@ -159,23 +228,38 @@ static void listener_fd_handler (BListener *o, int events)
     return;
 }
 
-static void listener_default_job_handler (BListener *o)
+static void listener_accept_job_handler (BListener *o)
 {
     DebugObject_Access(&o->d_obj);
     
-    BLog(BLOG_ERROR, "discarding connection");
+    listener_accept(o);
+    return;
+}
+
+static void listener_accepted (BListener *o)
+{
+    ASSERT(o->accepted_fd < 0)
     
-    // accept
-    int newfd = accept(o->fd, NULL, NULL);
-    if (newfd < 0) {
-        BLog(BLOG_ERROR, "accept failed");
-        return;
+    // keep draining the backlog, but return to the event loop once in a while
+    if (++o->num_accepted < BLISTENER_ACCEPT_BATCH) {
+        BPending_Set(&o->accept_job);
     }
+}
+
+static void listener_default_job_handler (BListener *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->accepted_fd >= 0)
+    
+    BLog(BLOG_ERROR, "discarding connection");
     
     // close new fd
-    if (close(newfd) < 0) {
+    if (close(o->accepted_fd) < 0) {
         BLog(BLOG_ERROR, "close failed");
     }
+    o->accepted_fd = -1;
+    
+    listener_accepted(o);
 }
 
 static void connector_fd_handler (BConnector *o, int events)
@@ -236,11 +320,39 @@ static void connection_report_error (BConnection *o)
     return;
 }
 
+static void connection_send_done (BConnection *o, int bytes)
+{
+    ASSERT(bytes > 0)
+    ASSERT(bytes <= o->send.busy_data_len)
+    
+    BPROBE2(connection_send, o->fd, bytes);
+    
+    // set ready
+    o->send.state = SEND_STATE_READY;
+    
+    // done
+    StreamPassInterface_Done(&o->send.iface, bytes);
+}
+
 static void connection_send (BConnection *o)
 {
     DebugError_AssertNoError(&o->d_err);
     ASSERT(o->send.state == SEND_STATE_BUSY)
     
+#ifdef BADVPN_USE_IO_URING
+    if (o->use_uring) {
+        ASSERT(!BReactorIOUringOp_IsBusy(&o->send.uring_op))
+        
+        // submit write; completion comes to connection_send_uring_handler
+        if (o->send.busy_iovcnt > 0) {
+            BReactorIOUringOp_WriteV(&o->send.uring_op, o->fd, o->send.busy_iov, o->send.busy_iovcnt);
+        } else {
+            BReactorIOUringOp_Write(&o->send.uring_op, o->fd, o->send.busy_data, o->send.busy_data_len);
+        }
+        return;
+    }
+#endif
+    
     // limit
     if (!o->is_hupd) {
         if (!BReactorLimit_Increment(&o->send.limit)) {
@@ -252,10 +364,16 @@ static void connection_send (BConnection *o)
     }
     
     // send
-    int bytes = write(o->fd, o->send.busy_data, o->send.busy_data_len);
+    int bytes;
+    if (o->send.busy_iovcnt > 0) {
+        bytes = writev(o->fd, o->send.busy_iov, o->send.busy_iovcnt);
+    } else {
+        bytes = write(o->fd, o->send.busy_data, o->send.busy_data_len);
+    }
     if (bytes < 0) {
         if (!o->is_hupd && (errno == EAGAIN || errno == EWOULDBLOCK)) {
             // wait for fd
+            BReactor_FileDescriptorDrained(o->reactor, &o->bfd, BREACTOR_WRITE);
             o->wait_events |= BREACTOR_WRITE;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
             return;
@@ -266,14 +384,32 @@ static void connection_send (BConnection *o)
         return;
     }
     
+    connection_send_done(o, bytes);
+}
+
+static void connection_recv_done (BConnection *o, int bytes)
+{
+    ASSERT(bytes >= 0)
+    
+    BPROBE2(connection_recv, o->fd, bytes);
+    
+    if (bytes == 0) {
+        // set recv inited closed
+        o->recv.state = RECV_STATE_INITED_CLOSED;
+        
+        // report recv closed
+        o->handler(o->user, BCONNECTION_EVENT_RECVCLOSED);
+        return;
+    }
+    
     ASSERT(bytes > 0)
-    ASSERT(bytes <= o->send.busy_data_len)
+    ASSERT(bytes <= o->recv.busy_data_avail)
     
-    // set ready
-    o->send.state = SEND_STATE_READY;
+    // set not busy
+    o->recv.state = RECV_STATE_READY;
     
     // done
-    StreamPassInterface_Done(&o->send.iface, bytes);
+    StreamRecvInterface_Done(&o->recv.iface, bytes);
 }
 
 static void connection_recv (BConnection *o)
@@ -281,6 +417,16 @@ static void connection_recv (BConnection *o)
     DebugError_AssertNoError(&o->d_err);
     ASSERT(o->recv.state == RECV_STATE_BUSY)
     
+#ifdef BADVPN_USE_IO_URING
+    if (o->use_uring) {
+        ASSERT(!BReactorIOUringOp_IsBusy(&o->recv.uring_op))
+        
+        // submit read; completion comes to connection_recv_uring_handler
+        BReactorIOUringOp_Read(&o->recv.uring_op, o->fd, o->recv.busy_data, o->recv.busy_data_avail);
+        return;
+    }
+#endif
+    
     // limit
     if (!o->is_hupd) {
         if (!BReactorLimit_Increment(&o->recv.limit)) {
@@ -296,6 +442,7 @@ static void connection_recv (BConnection *o)
     if (bytes < 0) {
         if (!o->is_hupd && (errno == EAGAIN || errno == EWOULDBLOCK)) {
             // wait for fd
+            BReactor_FileDescriptorDrained(o->reactor, &o->bfd, BREACTOR_READ);
             o->wait_events |= BREACTOR_READ;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
             return;
@@ -306,23 +453,66 @@ static void connection_recv (BConnection *o)
         return;
     }
     
-    if (bytes == 0) {
-        // set recv inited closed
-        o->recv.state = RECV_STATE_INITED_CLOSED;
+    connection_recv_done(o, bytes);
+}
+
+#ifdef BADVPN_USE_IO_URING
+
+static void connection_send_uring_handler (BConnection *o, int result)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.state == SEND_STATE_BUSY)
+    
+    if (result <= 0) {
+        if (!o->is_hupd && (result == -EAGAIN || result == -EWOULDBLOCK)) {
+            // kernel gave up because the socket is non-blocking; wait for fd
+            // and resubmit from connection_fd_handler
+            o->wait_events |= BREACTOR_WRITE;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
         
-        // report recv closed
-        o->handler(o->user, BCONNECTION_EVENT_RECVCLOSED);
+        BLog(BLOG_ERROR, "send failed");
+        connection_report_error(o);
         return;
     }
     
-    ASSERT(bytes > 0)
-    ASSERT(bytes <= o->recv.busy_data_avail)
+    connection_send_done(o, result);
+}
+
+static void connection_recv_uring_handler (BConnection *o, int result)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.state == RECV_STATE_BUSY)
     
-    // set not busy
-    o->recv.state = RECV_STATE_READY;
+    if (result < 0) {
+        if (!o->is_hupd && (result == -EAGAIN || result == -EWOULDBLOCK)) {
+            // kernel gave up because the socket is non-blocking; wait for fd
+            // and resubmit from connection_fd_handler
+            o->wait_events |= BREACTOR_READ;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
+        
+        BLog(BLOG_ERROR, "recv failed");
+        connection_report_error(o);
+        return;
+    }
     
-    // done
-    StreamRecvInterface_Done(&o->recv.iface, bytes);
+    connection_recv_done(o, result);
+}
+
+#endif
+
+static int connection_uring_busy (BConnection *o, int recv)
+{
+#ifdef BADVPN_USE_IO_URING
+    return (o->use_uring && BReactorIOUringOp_IsBusy(recv ? &o->recv.uring_op : &o->send.uring_op));
+#else
+    return 0;
+#endif
 }
 
 static void connection_fd_handler (BConnection *o, int events)
@@ -344,12 +534,12 @@ static void connection_fd_handler (BConnection *o, int events)
         o->is_hupd = 1;
     }
     
-    if ((events & BREACTOR_WRITE) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->send.state == SEND_STATE_BUSY)) {
+    if ((events & BREACTOR_WRITE) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->send.state == SEND_STATE_BUSY && !connection_uring_busy(o, 0))) {
         ASSERT(o->send.state == SEND_STATE_BUSY)
         have_send = 1;
     }
     
-    if ((events & BREACTOR_READ) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->recv.state == RECV_STATE_BUSY)) {
+    if ((events & BREACTOR_READ) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->recv.state == RECV_STATE_BUSY && !connection_uring_busy(o, 1))) {
         ASSERT(o->recv.state == RECV_STATE_BUSY)
         have_recv = 1;
     }
@@ -368,6 +558,11 @@ static void connection_fd_handler (BConnection *o, int events)
         return;
     }
     
+    // pending io_uring operations will complete with the error
+    if (connection_uring_busy(o, 0) || connection_uring_busy(o, 1)) {
+        return;
+    }
+    
     if (!o->is_hupd) {
         BLog(BLOG_ERROR, "fd error event");
         connection_report_error(o);
@@ -405,6 +600,31 @@ static void connection_send_if_handler_send (BConnection *o, uint8_t *data, int
     // remember data
     o->send.busy_data = data;
     o->send.busy_data_len = data_len;
+    o->send.busy_iovcnt = 0;
+    
+    // set busy
+    o->send.state = SEND_STATE_BUSY;
+    
+    connection_send(o);
+    return;
+}
+
+static void connection_send_if_handler_sendv (BConnection *o, const struct StreamPassInterface_buf *bufs, int num_bufs)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.state == SEND_STATE_READY)
+    ASSERT(num_bufs > 0)
+    ASSERT(num_bufs <= SPI_MAX_BUFS)
+    
+    // remember data
+    o->send.busy_data_len = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        o->send.busy_iov[i].iov_base = bufs[i].data;
+        o->send.busy_iov[i].iov_len = bufs[i].len;
+        o->send.busy_data_len += bufs[i].len;
+    }
+    o->send.busy_iovcnt = num_bufs;
     
     // set busy
     o->send.state = SEND_STATE_BUSY;
@@ -438,12 +658,13 @@ int BConnection_AddressSupported (BAddr addr)
     return (addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6);
 }
 
-int BListener_InitFrom (BListener *o, struct BLisCon_from from,
-                        BReactor *reactor, void *user,
-                        BListener_handler handler)
+int BListener_InitFrom2 (BListener *o, struct BLisCon_from from, int flags,
+                         BReactor *reactor, void *user,
+                         BListener_handler handler)
 {
     ASSERT(from.type == BLISCON_FROM_ADDR || from.type == BLISCON_FROM_UNIX)
     ASSERT(from.type != BLISCON_FROM_UNIX || from.u.from_unix.socket_path)
+    ASSERT(from.type == BLISCON_FROM_ADDR || !(flags & BLISTENER_FLAG_REUSEPORT))
     ASSERT(handler)
     BNetwork_Assert();
     
@@ -519,6 +740,31 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
             BLog(BLOG_ERROR, "setsockopt(SO_REUSEADDR) failed");
         }
         
+        // set SO_REUSEPORT
+        if ((flags & BLISTENER_FLAG_REUSEPORT)) {
+#ifdef SO_REUSEPORT
+            if (setsockopt(o->fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+                BLog(BLOG_ERROR, "setsockopt(SO_REUSEPORT) failed");
+                goto fail2;
+            }
+#else
+            BLog(BLOG_ERROR, "SO_REUSEPORT not supported");
+            goto fail2;
+#endif
+        }
+        
+        // set TCP_DEFER_ACCEPT
+        if ((flags & BLISTENER_FLAG_DEFER_ACCEPT)) {
+#ifdef TCP_DEFER_ACCEPT
+            int secs = BLISTENER_DEFER_ACCEPT_SECS;
+            if (setsockopt(o->fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof(secs)) < 0) {
+                BLog(BLOG_ERROR, "setsockopt(TCP_DEFER_ACCEPT) failed");
+            }
+#else
+            BLog(BLOG_WARNING, "TCP_DEFER_ACCEPT not supported");
+#endif
+        }
+        
         // bind
         if (bind(o->fd, &sysaddr.addr.generic, sysaddr.len) < 0) {
             BLog(BLOG_ERROR, "bind failed");
@@ -543,6 +789,13 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
     // init default job
     BPending_Init(&o->default_job, BReactor_PendingGroup(o->reactor), (BPending_handler)listener_default_job_handler, o);
     
+    // init accept job
+    BPending_Init(&o->accept_job, BReactor_PendingGroup(o->reactor), (BPending_handler)listener_accept_job_handler, o);
+    
+    // set no connection held
+    o->accepted_fd = -1;
+    o->num_accepted = 0;
+    
     DebugObject_Init(&o->d_obj);
     return 1;
     
@@ -566,6 +819,16 @@ void BListener_Free (BListener *o)
 {
     DebugObject_Free(&o->d_obj);
     
+    // close connection not taken by the handler
+    if (o->accepted_fd >= 0) {
+        if (close(o->accepted_fd) < 0) {
+            BLog(BLOG_ERROR, "close failed");
+        }
+    }
+    
+    // free accept job
+    BPending_Free(&o->accept_job);
+    
     // free default job
     BPending_Free(&o->default_job);
     
@@ -590,11 +853,105 @@ void BListener_Free (BListener *o)
     }
 }
 
-int BConnector_InitFrom (BConnector *o, struct BLisCon_from from, BReactor *reactor, void *user,
-                         BConnector_handler handler)
+static int set_socket_options (int fd, const struct BConnection_options *opts)
+{
+    int res = 1;
+    
+    if (opts->rcvbuf > 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opts->rcvbuf, sizeof(opts->rcvbuf)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(SO_RCVBUF) failed");
+            res = 0;
+        }
+    }
+    
+    if (opts->sndbuf > 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opts->sndbuf, sizeof(opts->sndbuf)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(SO_SNDBUF) failed");
+            res = 0;
+        }
+    }
+    
+    if (opts->nodelay >= 0) {
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opts->nodelay, sizeof(opts->nodelay)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(TCP_NODELAY) failed");
+            res = 0;
+        }
+    }
+    
+    if (opts->notsent_lowat > 0) {
+#ifdef TCP_NOTSENT_LOWAT
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &opts->notsent_lowat, sizeof(opts->notsent_lowat)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(TCP_NOTSENT_LOWAT) failed");
+            res = 0;
+        }
+#else
+        BLog(BLOG_ERROR, "TCP_NOTSENT_LOWAT not supported");
+        res = 0;
+#endif
+    }
+    
+    // the kernel clears this again as it sees fit, so it only affects
+    // the ACKs right after it is set
+    if (opts->quickack >= 0) {
+#ifdef TCP_QUICKACK
+        if (setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &opts->quickack, sizeof(opts->quickack)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(TCP_QUICKACK) failed");
+            res = 0;
+        }
+#else
+        BLog(BLOG_ERROR, "TCP_QUICKACK not supported");
+        res = 0;
+#endif
+    }
+    
+    if (opts->congestion[0]) {
+#ifdef TCP_CONGESTION
+        if (setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, opts->congestion, strlen(opts->congestion)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(TCP_CONGESTION, %s) failed", opts->congestion);
+            res = 0;
+        }
+#else
+        BLog(BLOG_ERROR, "TCP_CONGESTION not supported");
+        res = 0;
+#endif
+    }
+    
+    if (opts->have_mark) {
+#ifdef SO_MARK
+        int mark = opts->mark;
+        if (setsockopt(fd, SOL_SOCKET, SO_MARK, &mark, sizeof(mark)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(SO_MARK) failed");
+            res = 0;
+        }
+#else
+        BLog(BLOG_ERROR, "SO_MARK not supported");
+        res = 0;
+#endif
+    }
+    
+    if (opts->device[0]) {
+#ifdef SO_BINDTODEVICE
+        if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, opts->device, strlen(opts->device)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(SO_BINDTODEVICE, %s) failed", opts->device);
+            res = 0;
+        }
+#else
+        BLog(BLOG_ERROR, "SO_BINDTODEVICE not supported");
+        res = 0;
+#endif
+    }
+    
+    return res;
+}
+
+int BConnector_InitFrom3 (BConnector *o, struct BLisCon_from from, int flags,
+                          const struct BConnection_options *opts,
+                          BReactor *reactor, void *user,
+                          BConnector_handler handler)
 {
     ASSERT(from.type == BLISCON_FROM_ADDR || from.type == BLISCON_FROM_UNIX)
     ASSERT(from.type != BLISCON_FROM_UNIX || from.u.from_unix.socket_path)
+    ASSERT(!(flags & BCONNECTOR_FLAG_FASTOPEN) || from.type == BLISCON_FROM_ADDR)
     ASSERT(handler)
     BNetwork_Assert();
     
@@ -646,6 +1003,24 @@ int BConnector_InitFrom (BConnector *o, struct BLisCon_from from, BReactor *reac
         goto fail2;
     }
     
+    // set TCP_FASTOPEN_CONNECT
+    if ((flags & BCONNECTOR_FLAG_FASTOPEN)) {
+#ifdef TCP_FASTOPEN_CONNECT
+        int one = 1;
+        if (setsockopt(o->fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one)) < 0) {
+            BLog(BLOG_WARNING, "setsockopt(TCP_FASTOPEN_CONNECT) failed");
+        }
+#else
+        BLog(BLOG_WARNING, "TCP_FASTOPEN_CONNECT not supported");
+#endif
+    }
+    
+    // apply socket options
+    if (opts && !set_socket_options(o->fd, opts)) {
+        BLog(BLOG_ERROR, "set_socket_options failed");
+        goto fail2;
+    }
+    
     // connect fd
     int connect_res;
     if (from.type == BLISCON_FROM_UNIX) {
@@ -724,6 +1099,7 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
             BListener *listener = source.u.listener.listener;
             DebugObject_Access(&listener->d_obj);
             ASSERT(BPending_IsSet(&listener->default_job))
+            ASSERT(listener->accepted_fd >= 0)
         } break;
         case BCONNECTION_SOURCE_TYPE_CONNECTOR: {
             BConnector *connector = source.u.connector.connector;
@@ -753,24 +1129,17 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
             // unset listener's default job
             BPending_Unset(&listener->default_job);
             
-            // accept
-            struct sys_addr sysaddr;
-            sysaddr.len = sizeof(sysaddr.addr);
-            if ((o->fd = accept(listener->fd, &sysaddr.addr.generic, &sysaddr.len)) < 0) {
-                BLog(BLOG_ERROR, "accept failed");
-                goto fail0;
-            }
+            // take the connection the listener accepted, already non-blocking
+            o->fd = listener->accepted_fd;
+            listener->accepted_fd = -1;
             o->close_fd = 1;
             
-            // set non-blocking
-            if (!badvpn_set_nonblocking(o->fd)) {
-                BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
-                goto fail1;
-            }
+            // let the listener go on with its backlog
+            listener_accepted(listener);
             
             // return address
             if (source.u.listener.out_addr) {
-                addr_sys_to_socket(source.u.listener.out_addr, sysaddr);
+                *source.u.listener.out_addr = listener->accepted_addr;
             }
         } break;
         
@@ -801,8 +1170,8 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
     
     // init BFileDescriptor
     BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)connection_fd_handler, o);
-    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
-        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+    if (!BReactor_AddFileDescriptor2(o->reactor, &o->bfd, BReactor_GetSocketFdFlags(o->reactor))) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor2 failed");
         goto fail1;
     }
     
@@ -817,6 +1186,15 @@ int BConnection_Init (BConnection *o, struct BConnection_source source, BReactor
     o->send.state = SEND_STATE_NOT_INITED;
     o->recv.state = RECV_STATE_NOT_INITED;
     
+#ifdef BADVPN_USE_IO_URING
+    // init io_uring operations
+    o->use_uring = BReactor_HasIOUring(o->reactor);
+    if (o->use_uring) {
+        BReactorIOUringOp_Init(&o->send.uring_op, o->reactor, o, (BReactorIOUringOp_handler)connection_send_uring_handler);
+        BReactorIOUringOp_Init(&o->recv.uring_op, o->reactor, o, (BReactorIOUringOp_handler)connection_recv_uring_handler);
+    }
+#endif
+    
     DebugError_Init(&o->d_err, BReactor_PendingGroup(o->reactor));
     DebugObject_Init(&o->d_obj);
     return 1;
@@ -827,7 +1205,6 @@ fail1:
             BLog(BLOG_ERROR, "close failed");
         }
     }
-fail0:
     return 0;
 }
 
@@ -838,6 +1215,14 @@ void BConnection_Free (BConnection *o)
     ASSERT(o->send.state == SEND_STATE_NOT_INITED)
     ASSERT(o->recv.state == RECV_STATE_NOT_INITED || o->recv.state == RECV_STATE_NOT_INITED_CLOSED)
     
+#ifdef BADVPN_USE_IO_URING
+    // free io_uring operations
+    if (o->use_uring) {
+        BReactorIOUringOp_Free(&o->recv.uring_op);
+        BReactorIOUringOp_Free(&o->send.uring_op);
+    }
+#endif
+    
     // free limits
     BReactorLimit_Free(&o->recv.limit);
     BReactorLimit_Free(&o->send.limit);
@@ -855,6 +1240,19 @@ void BConnection_Free (BConnection *o)
     }
 }
 
+int BConnection_Release (BConnection *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    int fd = o->fd;
+    
+    // free without closing the fd
+    o->close_fd = 0;
+    BConnection_Free(o);
+    
+    return fd;
+}
+
 void BConnection_SetHandlers (BConnection *o, void *user, BConnection_handler handler)
 {
     DebugObject_Access(&o->d_obj);
@@ -876,6 +1274,13 @@ int BConnection_SetSendBuffer (BConnection *o, int buf_size)
     return 1;
 }
 
+int BConnection_SetOptions (BConnection *o, const struct BConnection_options *opts)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return set_socket_options(o->fd, opts);
+}
+
 void BConnection_SendAsync_Init (BConnection *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -884,6 +1289,7 @@ void BConnection_SendAsync_Init (BConnection *o)
     
     // init interface
     StreamPassInterface_Init(&o->send.iface, (StreamPassInterface_handler_send)connection_send_if_handler_send, o, BReactor_PendingGroup(o->reactor));
+    StreamPassInterface_EnableSendV(&o->send.iface, (StreamPassInterface_handler_sendv)connection_send_if_handler_sendv);
     
     // init job
     BPending_Init(&o->send.job, BReactor_PendingGroup(o->reactor), (BPending_handler)connection_send_job_handler, o);
@@ -897,6 +1303,14 @@ void BConnection_SendAsync_Free (BConnection *o)
     DebugObject_Access(&o->d_obj);
     ASSERT(o->send.state == SEND_STATE_READY || o->send.state == SEND_STATE_BUSY)
     
+#ifdef BADVPN_USE_IO_URING
+    // finish io_uring operation
+    if (connection_uring_busy(o, 0)) {
+        BReactorIOUringOp_Cancel(&o->send.uring_op);
+        BReactorIOUringOp_Wait(&o->send.uring_op);
+    }
+#endif
+    
     // update events
     if (!o->is_hupd) {
         o->wait_events &= ~BREACTOR_WRITE;
@@ -942,6 +1356,14 @@ void BConnection_RecvAsync_Free (BConnection *o)
     DebugObject_Access(&o->d_obj);
     ASSERT(o->recv.state == RECV_STATE_READY || o->recv.state == RECV_STATE_BUSY || o->recv.state == RECV_STATE_INITED_CLOSED)
     
+#ifdef BADVPN_USE_IO_URING
+    // finish io_uring operation
+    if (connection_uring_busy(o, 1)) {
+        BReactorIOUringOp_Cancel(&o->recv.uring_op);
+        BReactorIOUringOp_Wait(&o->recv.uring_op);
+    }
+#endif
+    
     // update events
     if (!o->is_hupd) {
         o->wait_events &= ~BREACTOR_READ;
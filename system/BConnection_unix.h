@@ -27,12 +27,17 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/uio.h>
+
 #include <misc/debugerror.h>
 #include <base/DebugObject.h>
 
 #define BCONNECTION_SEND_LIMIT 2
 #define BCONNECTION_RECV_LIMIT 2
-#define BCONNECTION_LISTEN_BACKLOG 128
+// the kernel caps this at net.core.somaxconn
+#define BCONNECTION_LISTEN_BACKLOG 4096
+#define BLISTENER_ACCEPT_BATCH 64
+#define BLISTENER_DEFER_ACCEPT_SECS 10
 
 struct BListener_s {
     BReactor *reactor;
@@ -42,6 +47,10 @@ struct BListener_s {
     int fd;
     BFileDescriptor bfd;
     BPending default_job;
+    BPending accept_job;
+    int accepted_fd;
+    BAddr accepted_addr;
+    int num_accepted;
     DebugObject d_obj;
 };
 
@@ -66,13 +75,21 @@ struct BConnection_s {
     int is_hupd;
     BFileDescriptor bfd;
     int wait_events;
+#ifdef BADVPN_USE_IO_URING
+    int use_uring;
+#endif
     struct {
         BReactorLimit limit;
         StreamPassInterface iface;
         BPending job;
         const uint8_t *busy_data;
         int busy_data_len;
+        struct iovec busy_iov[SPI_MAX_BUFS];
+        int busy_iovcnt;
         int state;
+#ifdef BADVPN_USE_IO_URING
+        BReactorIOUringOp uring_op;
+#endif
     } send;
     struct {
         BReactorLimit limit;
@@ -81,6 +98,9 @@ struct BConnection_s {
         uint8_t *busy_data;
         int busy_data_avail;
         int state;
+#ifdef BADVPN_USE_IO_URING
+        BReactorIOUringOp uring_op;
+#endif
     } recv;
     DebugError d_err;
     DebugObject d_obj;
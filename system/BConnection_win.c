@@ -437,9 +437,9 @@ int BConnection_AddressSupported (BAddr addr)
     return (addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6);
 }
 
-int BListener_InitFrom (BListener *o, struct BLisCon_from from,
-                        BReactor *reactor, void *user,
-                        BListener_handler handler)
+int BListener_InitFrom2 (BListener *o, struct BLisCon_from from, int flags,
+                         BReactor *reactor, void *user,
+                         BListener_handler handler)
 {
     ASSERT(from.type == BLISCON_FROM_ADDR)
     ASSERT(handler)
@@ -450,12 +450,25 @@ int BListener_InitFrom (BListener *o, struct BLisCon_from from,
     o->user = user;
     o->handler = handler;
     
+    if ((flags & BLISTENER_FLAG_REUSEPORT)) {
+        BLog(BLOG_ERROR, "SO_REUSEPORT not supported");
+        goto fail0;
+    }
+    
+    if ((flags & BLISTENER_FLAG_DEFER_ACCEPT)) {
+        BLog(BLOG_WARNING, "TCP_DEFER_ACCEPT not supported");
+    }
+    
     // check address
     if (!BConnection_AddressSupported(from.u.from_addr.addr)) {
         BLog(BLOG_ERROR, "address not supported");
         goto fail0;
     }
     
+    if ((flags & BCONNECTOR_FLAG_FASTOPEN)) {
+        BLog(BLOG_WARNING, "TCP_FASTOPEN_CONNECT not supported");
+    }
+    
     // convert address
     struct sys_addr sysaddr;
     addr_socket_to_sys(&sysaddr, from.u.from_addr.addr);
@@ -564,10 +577,13 @@ void BListener_Free (BListener *o)
     BReactorIOCPOverlapped_Free(&o->olap);
 }
 
-int BConnector_InitFrom (BConnector *o, struct BLisCon_from from, BReactor *reactor, void *user,
-                         BConnector_handler handler)
+int BConnector_InitFrom3 (BConnector *o, struct BLisCon_from from, int flags,
+                          const struct BConnection_options *opts,
+                          BReactor *reactor, void *user,
+                          BConnector_handler handler)
 {
     ASSERT(from.type == BLISCON_FROM_ADDR)
+    ASSERT(!opts)
     ASSERT(handler)
     BNetwork_Assert();
     
@@ -792,6 +808,42 @@ int BConnection_SetSendBuffer (BConnection *o, int buf_size)
     return 1;
 }
 
+int BConnection_SetOptions (BConnection *o, const struct BConnection_options *opts)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    int res = 1;
+    
+    if (opts->rcvbuf > 0) {
+        if (setsockopt(o->sock, SOL_SOCKET, SO_RCVBUF, (char *)&opts->rcvbuf, sizeof(opts->rcvbuf)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(SO_RCVBUF) failed");
+            res = 0;
+        }
+    }
+    
+    if (opts->sndbuf > 0) {
+        if (setsockopt(o->sock, SOL_SOCKET, SO_SNDBUF, (char *)&opts->sndbuf, sizeof(opts->sndbuf)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(SO_SNDBUF) failed");
+            res = 0;
+        }
+    }
+    
+    if (opts->nodelay >= 0) {
+        BOOL nodelay = opts->nodelay;
+        if (setsockopt(o->sock, IPPROTO_TCP, TCP_NODELAY, (char *)&nodelay, sizeof(nodelay)) < 0) {
+            BLog(BLOG_ERROR, "setsockopt(TCP_NODELAY) failed");
+            res = 0;
+        }
+    }
+    
+    if (opts->notsent_lowat > 0 || opts->quickack >= 0 || opts->congestion[0] || opts->have_mark) {
+        BLog(BLOG_ERROR, "notsent-lowat, quickack, congestion and mark are not supported");
+        res = 0;
+    }
+    
+    return res;
+}
+
 void BConnection_SendAsync_Init (BConnection *o)
 {
     DebugObject_Access(&o->d_obj);
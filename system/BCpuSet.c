@@ -0,0 +1,169 @@
+/**
+ * @file BCpuSet.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef BADVPN_LINUX
+#include <sched.h>
+#endif
+
+#include <misc/memref.h>
+#include <misc/parse_number.h>
+
+#include "BCpuSet.h"
+
+static int parse_cpu (MemRef str, int *out)
+{
+    uintmax_t cpu;
+    if (!parse_unsigned_integer(str, &cpu) || cpu >= BCPUSET_MAX_CPUS) {
+        return 0;
+    }
+    
+    *out = cpu;
+    return 1;
+}
+
+#ifdef BADVPN_LINUX
+
+static int bind_cpus (const int *cpus, int num_cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < num_cpus; i++) {
+        CPU_SET(cpus[i], &set);
+    }
+    
+    // on Linux this applies to the calling thread only
+    return (sched_setaffinity(0, sizeof(set), &set) == 0);
+}
+
+#endif
+
+void BCpuSet_Init (BCpuSet *o)
+{
+    o->num_cpus = 0;
+}
+
+int BCpuSet_InitParse (BCpuSet *o, const char *str)
+{
+    o->num_cpus = 0;
+    
+    MemRef rest = MemRef_MakeCstr(str);
+    
+    while (1) {
+        // cut the next element
+        size_t len;
+        int last = !MemRef_FindChar(rest, ',', &len);
+        if (last) {
+            len = rest.len;
+        }
+        MemRef elem = MemRef_SubTo(rest, len);
+        
+        // parse a single CPU or a range
+        int first_cpu;
+        int last_cpu;
+        size_t dash;
+        if (MemRef_FindChar(elem, '-', &dash)) {
+            if (!parse_cpu(MemRef_SubTo(elem, dash), &first_cpu) ||
+                !parse_cpu(MemRef_SubFrom(elem, dash + 1), &last_cpu) ||
+                last_cpu < first_cpu
+            ) {
+                return 0;
+            }
+        } else {
+            if (!parse_cpu(elem, &first_cpu)) {
+                return 0;
+            }
+            last_cpu = first_cpu;
+        }
+        
+        if (last_cpu - first_cpu >= BCPUSET_MAX_CPUS - o->num_cpus) {
+            return 0;
+        }
+        
+        for (int cpu = first_cpu; cpu <= last_cpu; cpu++) {
+            o->cpus[o->num_cpus++] = cpu;
+        }
+        
+        if (last) {
+            break;
+        }
+        
+        rest = MemRef_SubFrom(rest, len + 1);
+    }
+    
+    return 1;
+}
+
+int BCpuSet_IsEmpty (const BCpuSet *o)
+{
+    return (o->num_cpus == 0);
+}
+
+int BCpuSet_GetNumCpus (const BCpuSet *o)
+{
+    return o->num_cpus;
+}
+
+int BCpuSet_GetCpu (const BCpuSet *o, int index)
+{
+    ASSERT(o->num_cpus > 0)
+    ASSERT(index >= 0)
+    
+    return o->cpus[index % o->num_cpus];
+}
+
+int BCpuSet_BindThread (const BCpuSet *o)
+{
+    ASSERT(o->num_cpus > 0)
+    
+#ifdef BADVPN_LINUX
+    return bind_cpus(o->cpus, o->num_cpus);
+#else
+    return 0;
+#endif
+}
+
+int BCpuSet_BindThreadToIndex (const BCpuSet *o, int index)
+{
+    ASSERT(o->num_cpus > 0)
+    ASSERT(index >= 0)
+    
+#ifdef BADVPN_LINUX
+    int cpu = BCpuSet_GetCpu(o, index);
+    return bind_cpus(&cpu, 1);
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,125 @@
+/**
+ * @file BCpuSet.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * A list of CPU numbers, used to restrict threads to particular CPUs.
+ */
+
+#ifndef BADVPN_B_CPU_SET_H
+#define BADVPN_B_CPU_SET_H
+
+#include <misc/debug.h>
+
+/**
+ * Maximum number of CPUs in a {@link BCpuSet}, and the upper bound
+ * (exclusive) of CPU numbers.
+ */
+#define BCPUSET_MAX_CPUS 1024
+
+/**
+ * A list of CPU numbers, in the order they were given.
+ * CPUs may appear more than once.
+ */
+typedef struct {
+    int num_cpus;
+    int cpus[BCPUSET_MAX_CPUS];
+} BCpuSet;
+
+/**
+ * Initializes an empty CPU set.
+ * 
+ * @param o the object
+ */
+void BCpuSet_Init (BCpuSet *o);
+
+/**
+ * Initializes a CPU set from a string.
+ * The string is a comma-separated list of CPU numbers and inclusive
+ * ranges of CPU numbers, e.g. "0-3,8,10-11".
+ * 
+ * @param o the object
+ * @param str string to parse
+ * @return 1 on success, 0 if the string is not valid
+ */
+int BCpuSet_InitParse (BCpuSet *o, const char *str) WARN_UNUSED;
+
+/**
+ * Checks whether the set is empty.
+ * 
+ * @param o the object
+ * @return 1 if empty, 0 if not
+ */
+int BCpuSet_IsEmpty (const BCpuSet *o);
+
+/**
+ * Returns the number of CPUs in the set.
+ * 
+ * @param o the object
+ * @return number of CPUs
+ */
+int BCpuSet_GetNumCpus (const BCpuSet *o);
+
+/**
+ * Returns the CPU assigned to the given index, going around the set
+ * if the index is past its end.
+ * 
+ * @param o the object. Must not be empty.
+ * @param index index, >=0
+ * @return CPU number
+ */
+int BCpuSet_GetCpu (const BCpuSet *o, int index);
+
+/**
+ * Restricts the calling thread to the CPUs in the set.
+ * Threads and processes started by the calling thread afterwards
+ * inherit the restriction.
+ * 
+ * @param o the object. Must not be empty.
+ * @return 1 on success, 0 on failure or if this is not supported
+ *         on this platform
+ */
+int BCpuSet_BindThread (const BCpuSet *o) WARN_UNUSED;
+
+/**
+ * Restricts the calling thread to the single CPU assigned to the given
+ * index, as returned by {@link BCpuSet_GetCpu}.
+ * 
+ * On Linux, memory the thread touches for the first time afterwards,
+ * including its stack, is allocated on the NUMA node of that CPU under
+ * the default memory policy, so this should be done before the thread
+ * sets up its per-thread buffers.
+ * 
+ * @param o the object. Must not be empty.
+ * @param index index, >=0
+ * @return 1 on success, 0 on failure or if this is not supported
+ *         on this platform
+ */
+int BCpuSet_BindThreadToIndex (const BCpuSet *o, int index) WARN_UNUSED;
+
+#endif
@@ -36,6 +36,9 @@
 #include <system/BAddr.h>
 #include <system/BReactor.h>
 #include <system/BNetwork.h>
+#ifdef BADVPN_USE_AF_XDP
+#include <system/BXdp.h>
+#endif
 
 struct BDatagram_s;
 
@@ -100,6 +103,23 @@ void BDatagram_Free (BDatagram *o);
  */
 int BDatagram_Bind (BDatagram *o, BAddr addr) WARN_UNUSED;
 
+/**
+ * Connects the socket to a remote address, like connect() does for UDP.
+ * Datagrams are then sent to this address, and only datagrams from it
+ * are received. The local address is chosen by the system unless already bound.
+ * ICMP errors about earlier datagrams, which the system reports on a
+ * connected socket, are ignored.
+ * Must not be called after {@link BDatagram_SetSendAddrs} or itself, and
+ * {@link BDatagram_SetSendAddrs} must not be called afterwards.
+ * May initiate I/O.
+ * 
+ * @param o the object
+ * @param remote_addr address to connect to; must be an IPv4 or IPv6 address
+ *                    of the family of the object
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_Connect (BDatagram *o, BAddr remote_addr) WARN_UNUSED;
+
 /**
  * Sets addresses for sending.
  * May initiate I/O.
@@ -123,6 +143,17 @@ void BDatagram_SetSendAddrs (BDatagram *o, BAddr remote_addr, BIPAddr local_addr
  */
 int BDatagram_GetLastReceiveAddrs (BDatagram *o, BAddr *remote_addr, BIPAddr *local_addr);
 
+/**
+ * Returns the local address the socket is bound to.
+ * Fails if the socket is not bound yet, explicitly or by sending.
+ * 
+ * @param o the object
+ * @param local_addr returns the local address. On success, it is an IPv4 or IPv6 address
+ *                   with a nonzero port; the IP address may be the wildcard address.
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_GetLocalAddr (BDatagram *o, BAddr *local_addr);
+
 #ifndef BADVPN_USE_WINAPI
 /**
  * Returns the underlying socket file descriptor of the datagram object.
@@ -142,6 +173,105 @@ int BDatagram_GetFd (BDatagram *o);
  */
 int BDatagram_SetReuseAddr (BDatagram *o, int reuse);
 
+/**
+ * Sets the SO_MARK option for the underlying socket, which marks sent
+ * datagrams for policy routing and filtering. Requires privileges.
+ * Only supported on Linux.
+ * 
+ * @param o the object
+ * @param mark the mark
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_SetMark (BDatagram *o, uint32_t mark);
+
+/**
+ * Binds the underlying socket to a network interface with the SO_BINDTODEVICE
+ * option, so that datagrams are sent out of it regardless of routing.
+ * Only supported on Linux.
+ * 
+ * @param o the object
+ * @param device interface name
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_BindToDevice (BDatagram *o, const char *device);
+
+/**
+ * Sets the SO_BUSY_POLL option for the underlying socket, which makes the
+ * kernel poll the device for new packets when the socket is read and no
+ * data is queued, instead of waiting for an interrupt. Requires privileges
+ * for values above the net.core.busy_read sysctl.
+ * Only supported on Linux.
+ * 
+ * @param o the object
+ * @param usecs polling time in microseconds. Must be >=0.
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_SetBusyPoll (BDatagram *o, int usecs);
+
+/**
+ * Disables fragmentation of sent datagrams, by setting the Don't Fragment
+ * bit for IPv4 and disabling fragmentation by the sender for IPv6.
+ * The kernel's own path MTU estimate is not used to limit datagram sizes;
+ * datagrams which are too large for the local link are dropped, and
+ * datagrams which are too large for the path are lost in the network.
+ * This is for doing path MTU discovery by probing.
+ * Only supported on Linux and systems providing IP_DONTFRAG.
+ * 
+ * @param o the object
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_SetDontFragment (BDatagram *o);
+
+/**
+ * Enables UDP segmentation and receive offload for the underlying socket.
+ * When sending in batches, queued datagrams of the same size to the same
+ * address are passed to the kernel as a single message, which is split
+ * into separate datagrams by the kernel or the network device. When
+ * receiving in batches, the kernel may deliver datagrams coalesced into a
+ * single message, which are then split up again. Datagrams are sent and
+ * received exactly as without offload. With receive offload, each datagram
+ * of a receive batch gets a 64KB buffer instead of an MTU-sized one.
+ * Must be called before {@link BDatagram_SendAsync_Init2} and
+ * {@link BDatagram_RecvAsync_Init2}, and has no effect without batching.
+ * Only supported on Linux, for IPv4 and IPv6.
+ * 
+ * @param o the object
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_SetSegmentOffload (BDatagram *o);
+
+#ifdef BADVPN_USE_AF_XDP
+
+/**
+ * Receives datagrams to the local port of the socket through an AF_XDP fast
+ * path (see {@link BXdp}), bypassing the kernel network stack. Datagrams to
+ * the address the last such datagram came from are sent the same way, as
+ * long as they fit the interface MTU and there are free frames; other
+ * datagrams go through the socket as usual.
+ * The socket must be bound, and must not use io_uring.
+ * 
+ * @param o the object
+ * @param xdp XDP object to register the port with; must outlive this object
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_SetXdp (BDatagram *o, BXdp *xdp) WARN_UNUSED;
+
+/**
+ * Hands over a datagram received through XDP. Called by {@link BXdp}.
+ * The frame is released with {@link BXdp_ReleaseFrame} once the datagram
+ * has been received.
+ * 
+ * @param o the object
+ * @param frame UMEM frame holding the datagram
+ * @param data UDP payload, within the frame
+ * @param data_len payload length
+ * @param route where the datagram came from
+ * @return 1 if the datagram was taken, 0 if it must be dropped
+ */
+int BDatagram_XdpReceived (BDatagram *o, uint64_t frame, const uint8_t *data, int data_len, const struct BXdp_route *route);
+
+#endif
+
 /**
  * Initializes the send interface.
  * The send interface must not be initialized.
@@ -151,6 +281,21 @@ int BDatagram_SetReuseAddr (BDatagram *o, int reuse);
  */
 void BDatagram_SendAsync_Init (BDatagram *o, int mtu);
 
+/**
+ * Initializes the send interface, queueing up to a given number of packets
+ * and sending them with a single system call.
+ * Packets are copied into an internal queue, and are flushed once no more
+ * jobs are pending, or when the queue fills up.
+ * If batching is not supported, this is the same as {@link BDatagram_SendAsync_Init}.
+ * The send interface must not be initialized.
+ * 
+ * @param o the object
+ * @param mtu maximum transmission unit. Must be >=0.
+ * @param batch maximum number of packets in a batch. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_SendAsync_Init2 (BDatagram *o, int mtu, int batch) WARN_UNUSED;
+
 /**
  * Frees the send interface.
  * The send interface must be initialized.
@@ -164,7 +309,8 @@ void BDatagram_SendAsync_Free (BDatagram *o);
 /**
  * Returns the send interface.
  * The send interface must be initialized.
- * The MTU of the interface will be as in {@link BDatagram_SendAsync_Init}.
+ * The MTU of the interface will be as in {@link BDatagram_SendAsync_Init}
+ * or {@link BDatagram_SendAsync_Init2}.
  * 
  * @param o the object
  * @return send interface
@@ -180,6 +326,25 @@ PacketPassInterface * BDatagram_SendAsync_GetIf (BDatagram *o);
  */
 void BDatagram_RecvAsync_Init (BDatagram *o, int mtu);
 
+/**
+ * Initializes the receive interface, receiving up to a given number of
+ * datagrams with a single system call.
+ * Datagrams after the first one of a batch are buffered internally and
+ * copied out on subsequent receive operations.
+ * On Windows, if built with BADVPN_USE_WINRIO, this keeps a batch of receives
+ * posted through Registered I/O, where the system supports it; since receives are then always busy, freeing
+ * the receive interface after receiving has started makes the datagram
+ * object unusable.
+ * If batching is not supported, this is the same as {@link BDatagram_RecvAsync_Init}.
+ * The receive interface must not be initialized.
+ * 
+ * @param o the object
+ * @param mtu maximum transmission unit. Must be >=0.
+ * @param batch maximum number of datagrams in a batch. Must be >0.
+ * @return 1 on success, 0 on failure
+ */
+int BDatagram_RecvAsync_Init2 (BDatagram *o, int mtu, int batch) WARN_UNUSED;
+
 /**
  * Frees the receive interface.
  * The receive interface must be initialized.
@@ -193,7 +358,8 @@ void BDatagram_RecvAsync_Free (BDatagram *o);
 /**
  * Returns the receive interface.
  * The receive interface must be initialized.
- * The MTU of the interface will be as in {@link BDatagram_RecvAsync_Init}.
+ * The MTU of the interface will be as in {@link BDatagram_RecvAsync_Init}
+ * or {@link BDatagram_RecvAsync_Init2}.
  * 
  * @param o the object
  * @return receive interface
@@ -40,15 +40,30 @@
 #ifdef BADVPN_LINUX
 #    include <netpacket/packet.h>
 #    include <net/ethernet.h>
+#    include <netinet/udp.h>
 #endif
 
 #include <misc/nonblocking.h>
+#include <misc/balloc.h>
+#include <misc/probe.h>
 #include <base/BLog.h>
+#include <base/BPacketTrace.h>
 
 #include "BDatagram.h"
 
 #include <generated/blog_channel_BDatagram.h>
 
+#ifdef BADVPN_LINUX
+#define HAVE_MMSG 1
+#endif
+
+#if defined(HAVE_MMSG) && defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define HAVE_UDP_OFFLOAD 1
+#define OFFLOAD_CDATA_SPACE CMSG_SPACE(sizeof(int))
+#else
+#define OFFLOAD_CDATA_SPACE 0
+#endif
+
 struct sys_addr {
     socklen_t len;
     union {
@@ -61,17 +76,100 @@ struct sys_addr {
     } addr;
 };
 
+struct BDatagram_batch_packet {
+    int len;
+    BAddr remote_addr;
+    BIPAddr local_addr;
+};
+
+#ifdef BADVPN_USE_AF_XDP
+struct BDatagram_xdp_packet {
+    uint64_t frame;
+    const uint8_t *data;
+    int len;
+    struct BXdp_route route;
+};
+#endif
+
+struct BDatagram_sys_msg {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sys_addr sysaddr;
+    int num_segments;
+    int segment_size;
+    union {
+#ifdef BADVPN_FREEBSD
+        char in[CMSG_SPACE(sizeof(struct in_addr)) + OFFLOAD_CDATA_SPACE];
+#else
+        char in[CMSG_SPACE(sizeof(struct in_pktinfo)) + OFFLOAD_CDATA_SPACE];
+#endif
+        char in6[CMSG_SPACE(sizeof(struct in6_pktinfo)) + OFFLOAD_CDATA_SPACE];
+    } cdata;
+};
+
 static int family_socket_to_sys (int family);
 static void addr_socket_to_sys (struct sys_addr *out, BAddr addr);
 static void addr_sys_to_socket (BAddr *out, struct sys_addr addr);
 static void set_pktinfo (int fd, int family);
 static void report_error (BDatagram *o);
+static int is_ignored_error (BDatagram *o, int err);
+static int is_oversize_error (BDatagram *o, int err);
+static int can_batch (BDatagram *o, int mtu, int batch);
+static int can_batch (BDatagram *o, int mtu, int batch)
+{
+#ifdef HAVE_MMSG
+#ifdef BADVPN_USE_IO_URING
+    // with io_uring, system calls are already batched by the reactor
+    if (o->uring_msgs) {
+        return 0;
+    }
+#endif
+    
+    return (batch > 1 && mtu > 0);
+#else
+    return 0;
+#endif
+}
+
+static void build_send_msg (struct BDatagram_sys_msg *m, const uint8_t *data, int data_len, BAddr remote_addr, BIPAddr local_addr);
+static void start_recv (BDatagram *o);
+static void send_done (BDatagram *o, int bytes);
 static void do_send (BDatagram *o);
+#ifdef HAVE_MMSG
+static int same_send_addrs (struct BDatagram_batch_packet *p1, struct BDatagram_batch_packet *p2);
+static int build_send_batch (BDatagram *o, int use_gso);
+static int flush_send_batch (BDatagram *o);
+static void do_send_batch (BDatagram *o);
+#endif
+static void build_recv_msg (BDatagram *o, struct BDatagram_sys_msg *m);
+static void recv_done (BDatagram *o, struct BDatagram_sys_msg *m, int bytes);
 static void do_recv (BDatagram *o);
+#ifdef HAVE_MMSG
+static void do_recv_batch (BDatagram *o);
+static int read_segment_size (struct BDatagram_sys_msg *m);
+static void recv_batch_next (BDatagram *o);
+#endif
+#ifdef BADVPN_USE_IO_URING
+static void send_uring_handler (BDatagram *o, int result);
+static void recv_uring_handler (BDatagram *o, int result);
+#endif
+#ifdef BADVPN_USE_AF_XDP
+static int xdp_send (BDatagram *o);
+static void xdp_recv_next (BDatagram *o);
+static void xdp_release_packets (BDatagram *o);
+#endif
+static int send_uring_busy (BDatagram *o);
+static int recv_uring_busy (BDatagram *o);
 static void fd_handler (BDatagram *o, int events);
 static void send_job_handler (BDatagram *o);
+#ifdef HAVE_MMSG
+static void send_flush_job_handler (BDatagram *o);
+#endif
 static void recv_job_handler (BDatagram *o);
 static void send_if_handler_send (BDatagram *o, uint8_t *data, int data_len);
+#ifdef HAVE_MMSG
+static void send_if_handler_sendmany (BDatagram *o, const struct PacketPassInterface_buf *packets, int num_packets);
+#endif
 static void recv_if_handler_recv (BDatagram *o, uint8_t *data);
 
 static int family_socket_to_sys (int family)
@@ -145,7 +243,10 @@ static void addr_socket_to_sys (struct sys_addr *out, BAddr addr)
         } break;
 #endif
         
-        default: ASSERT(0);
+        default: {
+            ASSERT(0);
+            out->len = 0;
+        } break;
     }
 }
 
@@ -240,52 +341,44 @@ static void report_error (BDatagram *o)
     return;
 }
 
-static void do_send (BDatagram *o)
+static int is_ignored_error (BDatagram *o, int err)
 {
-    DebugError_AssertNoError(&o->d_err);
-    ASSERT(o->send.inited)
-    ASSERT(o->send.busy)
-    ASSERT(o->send.have_addrs)
-    
-    // limit
-    if (!BReactorLimit_Increment(&o->send.limit)) {
-        // wait for fd
-        o->wait_events |= BREACTOR_WRITE;
-        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
-        return;
-    }
-    
-    // convert destination address
-    struct sys_addr sysaddr;
-    addr_socket_to_sys(&sysaddr, o->send.remote_addr);
+    // a connected socket reports ICMP errors for earlier datagrams on later
+    // calls; those are not errors of the socket itself
+    return (o->connected && err == ECONNREFUSED);
+}
+
+static int is_oversize_error (BDatagram *o, int err)
+{
+    // with fragmentation disabled, a datagram larger than the MTU of the
+    // local link is rejected; treat it as lost, like one too large for the path
+    return (o->dont_fragment && err == EMSGSIZE);
+}
+
+static void build_send_msg (struct BDatagram_sys_msg *m, const uint8_t *data, int data_len, BAddr remote_addr, BIPAddr local_addr)
+{
+    m->iov.iov_base = (uint8_t *)data;
+    m->iov.iov_len = data_len;
     
-    struct iovec iov;
-    iov.iov_base = (uint8_t *)o->send.busy_data;
-    iov.iov_len = o->send.busy_data_len;
+    memset(&m->msg, 0, sizeof(m->msg));
     
-    union {
-#ifdef BADVPN_FREEBSD
-        char in[CMSG_SPACE(sizeof(struct in_addr))];
-#else
-        char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
-#endif
-        char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
-    } cdata;
+    // convert destination address, if not connected
+    if (remote_addr.type != BADDR_TYPE_NONE) {
+        addr_socket_to_sys(&m->sysaddr, remote_addr);
+        m->msg.msg_name = &m->sysaddr.addr.generic;
+        m->msg.msg_namelen = m->sysaddr.len;
+    }
     
-    struct msghdr msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = &sysaddr.addr.generic;
-    msg.msg_namelen = sysaddr.len;
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = &cdata;
-    msg.msg_controllen = sizeof(cdata);
+    m->msg.msg_iov = &m->iov;
+    m->msg.msg_iovlen = 1;
+    m->msg.msg_control = &m->cdata;
+    m->msg.msg_controllen = sizeof(m->cdata);
     
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&m->msg);
     
     size_t controllen = 0;
     
-    switch (o->send.local_addr.type) {
+    switch (local_addr.type) {
         case BADDR_TYPE_IPV4: {
 #ifdef BADVPN_FREEBSD
             memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_addr)));
@@ -293,7 +386,7 @@ static void do_send (BDatagram *o)
             cmsg->cmsg_type = IP_SENDSRCADDR;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
             struct in_addr *addrinfo = (struct in_addr *)CMSG_DATA(cmsg);
-            addrinfo->s_addr = o->send.local_addr.ipv4;
+            addrinfo->s_addr = local_addr.ipv4;
             controllen += CMSG_SPACE(sizeof(struct in_addr));
 #else
             memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_pktinfo)));
@@ -301,7 +394,7 @@ static void do_send (BDatagram *o)
             cmsg->cmsg_type = IP_PKTINFO;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
             struct in_pktinfo *pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
-            pktinfo->ipi_spec_dst.s_addr = o->send.local_addr.ipv4;
+            pktinfo->ipi_spec_dst.s_addr = local_addr.ipv4;
             controllen += CMSG_SPACE(sizeof(struct in_pktinfo));
 #endif
         } break;
@@ -312,39 +405,20 @@ static void do_send (BDatagram *o)
             cmsg->cmsg_type = IPV6_PKTINFO;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
             struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
-            memcpy(pktinfo->ipi6_addr.s6_addr, o->send.local_addr.ipv6, 16);
+            memcpy(pktinfo->ipi6_addr.s6_addr, local_addr.ipv6, 16);
             controllen += CMSG_SPACE(sizeof(struct in6_pktinfo));
         } break;
     }
     
-    msg.msg_controllen = controllen;
-    
-    if (msg.msg_controllen == 0) {
-        msg.msg_control = NULL;
-    }
-    
-    // send
-    int bytes = sendmsg(o->fd, &msg, 0);
-    if (bytes < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            // wait for fd
-            o->wait_events |= BREACTOR_WRITE;
-            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
-            return;
-        }
-        
-        BLog(BLOG_ERROR, "send failed");
-        report_error(o);
-        return;
-    }
-    
-    ASSERT(bytes >= 0)
-    ASSERT(bytes <= o->send.busy_data_len)
+    m->msg.msg_controllen = controllen;
     
-    if (bytes < o->send.busy_data_len) {
-        BLog(BLOG_ERROR, "send sent too little");
+    if (m->msg.msg_controllen == 0) {
+        m->msg.msg_control = NULL;
     }
-    
+}
+
+static void start_recv (BDatagram *o)
+{
     // if recv wasn't started yet, start it
     if (!o->recv.started) {
         // set recv started
@@ -355,6 +429,22 @@ static void do_send (BDatagram *o)
             BPending_Set(&o->recv.job);
         }
     }
+}
+
+static void send_done (BDatagram *o, int bytes)
+{
+    ASSERT(bytes >= 0)
+    ASSERT(bytes <= o->send.busy_data_len)
+    
+    BPROBE2(datagram_send, o->fd, bytes);
+    
+    BPacketTrace_Stamp(BPACKETTRACE_SEND, o->send.busy_data, BMETRICS_HISTOGRAM_TRACE_SEND_DATAGRAM_NS, NULL);
+    
+    if (bytes < o->send.busy_data_len) {
+        BLog(BLOG_ERROR, "send sent too little");
+    }
+    
+    start_recv(o);
     
     // set not busy
     o->send.busy = 0;
@@ -363,70 +453,332 @@ static void do_send (BDatagram *o)
     PacketPassInterface_Done(&o->send.iface);
 }
 
-static void do_recv (BDatagram *o)
+static void do_send (BDatagram *o)
 {
     DebugError_AssertNoError(&o->d_err);
-    ASSERT(o->recv.inited)
-    ASSERT(o->recv.busy)
-    ASSERT(o->recv.started)
+    ASSERT(o->send.inited)
+    ASSERT(o->send.busy)
+    ASSERT(o->send.have_addrs)
+    
+#ifdef BADVPN_USE_AF_XDP
+    // reply through XDP to where datagrams came from that way
+    if (xdp_send(o)) {
+        return;
+    }
+#endif
+    
+#ifdef BADVPN_USE_IO_URING
+    if (o->uring_msgs) {
+        ASSERT(!BReactorIOUringOp_IsBusy(&o->send.uring_op))
+        
+        // submit sendmsg; completion comes to send_uring_handler
+        build_send_msg(&o->uring_msgs[0], o->send.busy_data, o->send.busy_data_len, (o->connected ? BAddr_MakeNone() : o->send.remote_addr), o->send.local_addr);
+        BReactorIOUringOp_SendMsg(&o->send.uring_op, o->fd, &o->uring_msgs[0].msg);
+        return;
+    }
+#endif
+    
+#ifdef HAVE_MMSG
+    if (o->send.batch > 1) {
+        do_send_batch(o);
+        return;
+    }
+#endif
     
     // limit
-    if (!BReactorLimit_Increment(&o->recv.limit)) {
+    if (!BReactorLimit_Increment(&o->send.limit)) {
         // wait for fd
-        o->wait_events |= BREACTOR_READ;
+        o->wait_events |= BREACTOR_WRITE;
         BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
         return;
     }
     
-    struct sys_addr sysaddr;
+    struct BDatagram_sys_msg m;
+    build_send_msg(&m, o->send.busy_data, o->send.busy_data_len, (o->connected ? BAddr_MakeNone() : o->send.remote_addr), o->send.local_addr);
     
-    struct iovec iov;
-    iov.iov_base = o->recv.busy_data;
-    iov.iov_len = o->recv.mtu;
+    // send
+    int bytes = sendmsg(o->fd, &m.msg, 0);
+    if (bytes < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // wait for fd
+            BReactor_FileDescriptorDrained(o->reactor, &o->bfd, BREACTOR_WRITE);
+            o->wait_events |= BREACTOR_WRITE;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
+        
+        if (is_ignored_error(o, errno)) {
+            // the error has been consumed; try again
+            BPending_Set(&o->send.job);
+            return;
+        }
+        
+        if (is_oversize_error(o, errno)) {
+            // drop the datagram
+            send_done(o, o->send.busy_data_len);
+            return;
+        }
+        
+        BLog(BLOG_ERROR, "send failed");
+        report_error(o);
+        return;
+    }
     
-    union {
-#ifdef BADVPN_FREEBSD
-        char in[CMSG_SPACE(sizeof(struct in_addr))];
-#else
-        char in[CMSG_SPACE(sizeof(struct in_pktinfo))];
+    send_done(o, bytes);
+}
+
+#ifdef HAVE_MMSG
+
+static int same_send_addrs (struct BDatagram_batch_packet *p1, struct BDatagram_batch_packet *p2)
+{
+    if (p1->remote_addr.type != p2->remote_addr.type || p1->local_addr.type != p2->local_addr.type) {
+        return 0;
+    }
+    
+    return ((p1->remote_addr.type == BADDR_TYPE_NONE || BAddr_Compare(&p1->remote_addr, &p2->remote_addr)) &&
+            (p1->local_addr.type == BADDR_TYPE_NONE || BIPAddr_Compare(&p1->local_addr, &p2->local_addr)));
+}
+
+static int build_send_batch (BDatagram *o, int use_gso)
+{
+    ASSERT(o->send.batch > 1)
+    ASSERT(!use_gso || o->send.gso)
+    
+    int num_msgs = 0;
+    
+    int i = 0;
+    while (i < o->send.batch_num) {
+        struct BDatagram_batch_packet *p = &o->send.batch_packets[i];
+        struct BDatagram_sys_msg *m = &o->send.batch_msgs[num_msgs];
+        build_send_msg(m, o->send.batch_data + (size_t)i * o->send.mtu, p->len, p->remote_addr, p->local_addr);
+        m->num_segments = 1;
+        
+#ifdef HAVE_UDP_OFFLOAD
+        if (use_gso && p->len > 0 && p->len <= o->send.gso_max_size) {
+            // join following packets of the same size to the same destination into
+            // a single message which the kernel splits up; the last one may be shorter
+            int total = p->len;
+            while (i + m->num_segments < o->send.batch_num && m->num_segments < BDATAGRAM_GSO_MAX_SEGMENTS) {
+                struct BDatagram_batch_packet *np = &o->send.batch_packets[i + m->num_segments];
+                if (np->len == 0 || np->len > p->len || total + np->len > BDATAGRAM_GSO_MAX_BYTES || !same_send_addrs(p, np)) {
+                    break;
+                }
+                total += np->len;
+                m->num_segments++;
+                if (np->len < p->len) {
+                    break;
+                }
+            }
+            
+            if (m->num_segments > 1) {
+                for (int j = 0; j < m->num_segments; j++) {
+                    o->send.batch_iovs[i + j].iov_base = o->send.batch_data + (size_t)(i + j) * o->send.mtu;
+                    o->send.batch_iovs[i + j].iov_len = o->send.batch_packets[i + j].len;
+                }
+                m->msg.msg_iov = &o->send.batch_iovs[i];
+                m->msg.msg_iovlen = m->num_segments;
+                
+                // add segment size after the local address, if any
+                m->msg.msg_control = &m->cdata;
+                struct cmsghdr *cmsg = (struct cmsghdr *)((char *)m->msg.msg_control + m->msg.msg_controllen);
+                memset(cmsg, 0, CMSG_SPACE(sizeof(uint16_t)));
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment_size = p->len;
+                memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+                m->msg.msg_controllen += CMSG_SPACE(sizeof(uint16_t));
+            }
+        }
 #endif
-        char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
-    } cdata;
+        
+        o->send.batch_mmsgs[num_msgs].msg_hdr = m->msg;
+        o->send.batch_mmsgs[num_msgs].msg_len = 0;
+        num_msgs++;
+        
+        i += m->num_segments;
+    }
     
-    struct msghdr msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = &sysaddr.addr.generic;
-    msg.msg_namelen = sizeof(sysaddr.addr);
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = &cdata;
-    msg.msg_controllen = sizeof(cdata);
+    return num_msgs;
+}
+
+static int flush_send_batch (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batch > 1)
+    ASSERT(o->send.batch_num > 0)
     
-    // recv
-    int bytes = recvmsg(o->fd, &msg, 0);
-    if (bytes < 0) {
+    // limit
+    if (!BReactorLimit_Increment(&o->send.limit)) {
+        // wait for fd
+        BPending_Unset(&o->send.flush_job);
+        o->wait_events |= BREACTOR_WRITE;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+        return 0;
+    }
+    
+    int use_gso = o->send.gso;
+    int num_msgs = build_send_batch(o, use_gso);
+    
+    // send
+    int num = sendmmsg(o->fd, o->send.batch_mmsgs, num_msgs, 0);
+    if (num < 0 && use_gso && o->send.batch_msgs[0].num_segments > 1 && (errno == EINVAL || errno == EMSGSIZE || errno == EIO)) {
+        if (errno == EIO) {
+            BLog(BLOG_WARNING, "segmentation offload failed, disabling");
+            o->send.gso = 0;
+        } else {
+            // the segments don't fit the local link without fragmentation;
+            // send packets this large one by one from now on
+            o->send.gso_max_size = o->send.batch_packets[0].len - 1;
+        }
+        num_msgs = build_send_batch(o, o->send.gso);
+        num = sendmmsg(o->fd, o->send.batch_mmsgs, num_msgs, 0);
+    }
+    if (num < 0 && is_oversize_error(o, errno)) {
+        // drop the first message, which is the one that failed
+        num = 1;
+        o->send.batch_mmsgs[0].msg_len = 0;
+        for (int j = 0; j < o->send.batch_msgs[0].num_segments; j++) {
+            o->send.batch_mmsgs[0].msg_len += o->send.batch_packets[j].len;
+        }
+    }
+    if (num < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             // wait for fd
-            o->wait_events |= BREACTOR_READ;
+            BPending_Unset(&o->send.flush_job);
+            BReactor_FileDescriptorDrained(o->reactor, &o->bfd, BREACTOR_WRITE);
+            o->wait_events |= BREACTOR_WRITE;
             BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
-            return;
+            return 0;
         }
         
-        BLog(BLOG_ERROR, "recv failed");
+        if (is_ignored_error(o, errno)) {
+            // the error has been consumed; try again
+            if (o->send.busy) {
+                BPending_Set(&o->send.job);
+            } else {
+                BPending_Set(&o->send.flush_job);
+            }
+            return 0;
+        }
+        
+        BLog(BLOG_ERROR, "send failed");
         report_error(o);
-        return;
+        return 0;
+    }
+    
+    ASSERT(num > 0)
+    ASSERT(num <= num_msgs)
+    
+    // count sent packets
+    int num_packets = 0;
+    for (int i = 0; i < num; i++) {
+        unsigned int len = 0;
+        for (int j = 0; j < o->send.batch_msgs[i].num_segments; j++) {
+            len += o->send.batch_packets[num_packets + j].len;
+        }
+        if (o->send.batch_mmsgs[i].msg_len < len) {
+            BLog(BLOG_ERROR, "send sent too little");
+        }
+        num_packets += o->send.batch_msgs[i].num_segments;
+    }
+    ASSERT(num_packets <= o->send.batch_num)
+    
+    BPROBE2(datagram_send_batch, o->fd, num_packets);
+    
+    // no longer waiting for fd
+    o->wait_events &= ~BREACTOR_WRITE;
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+    
+    // remove sent packets from the queue
+    o->send.batch_num -= num_packets;
+    memmove(o->send.batch_packets, o->send.batch_packets + num_packets, o->send.batch_num * sizeof(o->send.batch_packets[0]));
+    memmove(o->send.batch_data, o->send.batch_data + (size_t)num_packets * o->send.mtu, (size_t)o->send.batch_num * o->send.mtu);
+    
+    start_recv(o);
+    
+    return 1;
+}
+
+static void do_send_batch (BDatagram *o)
+{
+    ASSERT(o->send.batch > 1)
+    ASSERT(o->send.batch_num >= 0)
+    ASSERT(o->send.batch_num <= o->send.batch)
+    ASSERT(o->send.busy_num_packets > 0)
+    
+    while (o->send.busy_num_packets > 0) {
+        // make room in the queue; if waiting for fd, the remaining packets
+        // stay busy until it's writable
+        if (o->send.batch_num == o->send.batch) {
+            if ((o->wait_events & BREACTOR_WRITE) || !flush_send_batch(o)) {
+                return;
+            }
+        }
+        
+        ASSERT(o->send.batch_num < o->send.batch)
+        
+        // queue packet
+        const struct PacketPassInterface_buf *b = o->send.busy_packets;
+        struct BDatagram_batch_packet *p = &o->send.batch_packets[o->send.batch_num];
+        p->len = b->len;
+        p->remote_addr = (o->connected ? BAddr_MakeNone() : o->send.remote_addr);
+        p->local_addr = o->send.local_addr;
+        memcpy(o->send.batch_data + (size_t)o->send.batch_num * o->send.mtu, b->data, b->len);
+        o->send.batch_num++;
+        
+        BPacketTrace_Stamp(BPACKETTRACE_SEND, b->data, BMETRICS_HISTOGRAM_TRACE_SEND_DATAGRAM_NS, NULL);
+        
+        o->send.busy_packets++;
+        o->send.busy_num_packets--;
     }
     
+    // flush once everything else queued up by now has been processed,
+    // or when the fd becomes writable if waiting for it
+    if (!(o->wait_events & BREACTOR_WRITE) && !BPending_IsSet(&o->send.flush_job)) {
+        BPending_Set(&o->send.flush_job);
+    }
+    
+    // set not busy
+    o->send.busy = 0;
+    
+    // done
+    PacketPassInterface_Done(&o->send.iface);
+}
+
+#endif
+
+static void build_recv_msg (BDatagram *o, struct BDatagram_sys_msg *m)
+{
+    m->iov.iov_base = o->recv.busy_data;
+    m->iov.iov_len = o->recv.mtu;
+    
+    memset(&m->msg, 0, sizeof(m->msg));
+    m->msg.msg_name = &m->sysaddr.addr.generic;
+    m->msg.msg_namelen = sizeof(m->sysaddr.addr);
+    m->msg.msg_iov = &m->iov;
+    m->msg.msg_iovlen = 1;
+    m->msg.msg_control = &m->cdata;
+    m->msg.msg_controllen = sizeof(m->cdata);
+}
+
+static void recv_done (BDatagram *o, struct BDatagram_sys_msg *m, int bytes)
+{
     ASSERT(bytes >= 0)
     ASSERT(bytes <= o->recv.mtu)
     
+    BPROBE2(datagram_recv, o->fd, bytes);
+    
+    BPacketTrace_Begin(BPACKETTRACE_RECV, o->recv.busy_data);
+    
     // read returned address
-    sysaddr.len = msg.msg_namelen;
-    addr_sys_to_socket(&o->recv.remote_addr, sysaddr);
+    m->sysaddr.len = m->msg.msg_namelen;
+    addr_sys_to_socket(&o->recv.remote_addr, m->sysaddr);
     
     // read returned local address
     BIPAddr_InitInvalid(&o->recv.local_addr);
-    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&m->msg); cmsg; cmsg = CMSG_NXTHDR(&m->msg, cmsg)) {
 #ifdef BADVPN_FREEBSD
         if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVDSTADDR) {
             struct in_addr *addrinfo = (struct in_addr *)CMSG_DATA(cmsg);
@@ -454,27 +806,404 @@ static void do_recv (BDatagram *o)
     PacketRecvInterface_Done(&o->recv.iface, bytes);
 }
 
-static void fd_handler (BDatagram *o, int events)
+static void do_recv (BDatagram *o)
 {
-    DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.busy)
+    ASSERT(o->recv.started)
     
-    // clear handled events
+#ifdef BADVPN_USE_IO_URING
+    if (o->uring_msgs) {
+        ASSERT(!BReactorIOUringOp_IsBusy(&o->recv.uring_op))
+        
+        // submit recvmsg; completion comes to recv_uring_handler
+        build_recv_msg(o, &o->uring_msgs[1]);
+        BReactorIOUringOp_RecvMsg(&o->recv.uring_op, o->fd, &o->uring_msgs[1].msg);
+        return;
+    }
+#endif
+    
+#ifdef BADVPN_USE_AF_XDP
+    // deliver datagrams steered to us by XDP
+    if (o->xdp.xdp && o->xdp.num > 0) {
+        xdp_recv_next(o);
+        return;
+    }
+#endif
+    
+#ifdef HAVE_MMSG
+    // deliver datagrams left over from the last batch
+    if (o->recv.batch_pos < o->recv.batch_num) {
+        recv_batch_next(o);
+        return;
+    }
+#endif
+    
+    // limit
+    if (!BReactorLimit_Increment(&o->recv.limit)) {
+        // wait for fd
+        o->wait_events |= BREACTOR_READ;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+        return;
+    }
+    
+#ifdef HAVE_MMSG
+    if (o->recv.batch > 1) {
+        do_recv_batch(o);
+        return;
+    }
+#endif
+    
+    struct BDatagram_sys_msg m;
+    build_recv_msg(o, &m);
+    
+    // recv
+    int bytes = recvmsg(o->fd, &m.msg, 0);
+    if (bytes < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // wait for fd
+            BReactor_FileDescriptorDrained(o->reactor, &o->bfd, BREACTOR_READ);
+            o->wait_events |= BREACTOR_READ;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
+        
+        if (is_ignored_error(o, errno)) {
+            // the error has been consumed; try again
+            BPending_Set(&o->recv.job);
+            return;
+        }
+        
+        BLog(BLOG_ERROR, "recv failed");
+        report_error(o);
+        return;
+    }
+    
+    recv_done(o, &m, bytes);
+}
+
+#ifdef HAVE_MMSG
+
+static void do_recv_batch (BDatagram *o)
+{
+    ASSERT(o->recv.batch > 1)
+    ASSERT(o->recv.batch_pos == o->recv.batch_num)
+    
+    // the first datagram goes directly into the receiver's buffer,
+    // the rest into our own buffers; with receive offload, a message
+    // may hold many datagrams, so all go into our own buffers
+    for (int i = 0; i < o->recv.batch; i++) {
+        struct BDatagram_sys_msg *m = &o->recv.batch_msgs[i];
+        build_recv_msg(o, m);
+        if (i > 0 || o->recv.gro) {
+            m->iov.iov_base = o->recv.batch_data + (size_t)i * o->recv.batch_bufsize;
+            m->iov.iov_len = o->recv.batch_bufsize;
+        }
+        o->recv.batch_mmsgs[i].msg_hdr = m->msg;
+        o->recv.batch_mmsgs[i].msg_len = 0;
+    }
+    
+    // recv
+    int num = recvmmsg(o->fd, o->recv.batch_mmsgs, o->recv.batch, 0, NULL);
+    if (num < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // wait for fd
+            BReactor_FileDescriptorDrained(o->reactor, &o->bfd, BREACTOR_READ);
+            o->wait_events |= BREACTOR_READ;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
+        
+        if (is_ignored_error(o, errno)) {
+            // the error has been consumed; try again
+            BPending_Set(&o->recv.job);
+            return;
+        }
+        
+        BLog(BLOG_ERROR, "recv failed");
+        report_error(o);
+        return;
+    }
+    
+    ASSERT(num > 0)
+    ASSERT(num <= o->recv.batch)
+    
+    BPROBE2(datagram_recv_batch, o->fd, num);
+    
+    // pick up lengths of returned addresses and control data
+    for (int i = 0; i < num; i++) {
+        struct BDatagram_sys_msg *m = &o->recv.batch_msgs[i];
+        m->msg = o->recv.batch_mmsgs[i].msg_hdr;
+        m->segment_size = (o->recv.gro ? read_segment_size(m) : 0);
+    }
+    
+    // remember the batch
+    o->recv.batch_num = num;
+    o->recv.batch_offset = 0;
+    
+    if (o->recv.gro) {
+        o->recv.batch_pos = 0;
+        recv_batch_next(o);
+        return;
+    }
+    
+    o->recv.batch_pos = 1;
+    
+    recv_done(o, &o->recv.batch_msgs[0], o->recv.batch_mmsgs[0].msg_len);
+}
+
+static int read_segment_size (struct BDatagram_sys_msg *m)
+{
+#ifdef HAVE_UDP_OFFLOAD
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&m->msg); cmsg; cmsg = CMSG_NXTHDR(&m->msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int segment_size;
+            memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+            return (segment_size > 0 ? segment_size : 0);
+        }
+    }
+#endif
+    
+    return 0;
+}
+
+static void recv_batch_next (BDatagram *o)
+{
+    ASSERT(o->recv.batch > 1)
+    ASSERT(o->recv.batch_pos > 0 || o->recv.gro)
+    ASSERT(o->recv.batch_pos < o->recv.batch_num)
+    
+    struct BDatagram_sys_msg *m = &o->recv.batch_msgs[o->recv.batch_pos];
+    int msg_len = o->recv.batch_mmsgs[o->recv.batch_pos].msg_len;
+    ASSERT(o->recv.batch_offset <= msg_len)
+    
+    // take the next datagram of a coalesced message, or the whole message
+    int bytes = msg_len - o->recv.batch_offset;
+    if (m->segment_size > 0 && bytes > m->segment_size) {
+        bytes = m->segment_size;
+    }
+    uint8_t *data = (uint8_t *)m->iov.iov_base + o->recv.batch_offset;
+    
+    // advance
+    o->recv.batch_offset += bytes;
+    if (o->recv.batch_offset == msg_len) {
+        o->recv.batch_pos++;
+        o->recv.batch_offset = 0;
+    }
+    
+    // copy to receiver's buffer, truncating like recv would
+    if (bytes > o->recv.mtu) {
+        bytes = o->recv.mtu;
+    }
+    memcpy(o->recv.busy_data, data, bytes);
+    
+    recv_done(o, m, bytes);
+}
+
+#endif
+
+#ifdef BADVPN_USE_IO_URING
+
+static void send_uring_handler (BDatagram *o, int result)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.busy)
+    
+    if (result < 0) {
+        if (result == -EAGAIN || result == -EWOULDBLOCK) {
+            // kernel gave up because the socket is non-blocking; wait for fd
+            // and resubmit from fd_handler
+            o->wait_events |= BREACTOR_WRITE;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
+        
+        if (is_ignored_error(o, -result)) {
+            // the error has been consumed; resubmit
+            BPending_Set(&o->send.job);
+            return;
+        }
+        
+        if (is_oversize_error(o, -result)) {
+            // drop the datagram
+            send_done(o, o->send.busy_data_len);
+            return;
+        }
+        
+        BLog(BLOG_ERROR, "send failed");
+        report_error(o);
+        return;
+    }
+    
+    send_done(o, result);
+}
+
+static void recv_uring_handler (BDatagram *o, int result)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->recv.inited)
+    ASSERT(o->recv.busy)
+    
+    if (result < 0) {
+        if (result == -EAGAIN || result == -EWOULDBLOCK) {
+            // kernel gave up because the socket is non-blocking; wait for fd
+            // and resubmit from fd_handler
+            o->wait_events |= BREACTOR_READ;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+            return;
+        }
+        
+        if (is_ignored_error(o, -result)) {
+            // the error has been consumed; resubmit
+            BPending_Set(&o->recv.job);
+            return;
+        }
+        
+        BLog(BLOG_ERROR, "recv failed");
+        report_error(o);
+        return;
+    }
+    
+    recv_done(o, &o->uring_msgs[1], result);
+}
+
+#endif
+
+#ifdef BADVPN_USE_AF_XDP
+
+static int xdp_send (BDatagram *o)
+{
+    ASSERT(o->send.busy_num_packets > 0)
+    
+    if (!o->xdp.xdp || !o->xdp.have_route || o->connected || !BAddr_Compare(&o->send.remote_addr, &o->xdp.route.remote_addr)) {
+        return 0;
+    }
+    
+    if (o->send.local_addr.type != BADDR_TYPE_NONE) {
+        BIPAddr local_addr;
+        BAddr_GetIPAddr(&o->xdp.route.local_addr, &local_addr);
+        if (!BIPAddr_Compare(&o->send.local_addr, &local_addr)) {
+            return 0;
+        }
+    }
+    
+    while (o->send.busy_num_packets > 0) {
+        const struct PacketPassInterface_buf *b = o->send.busy_packets;
+        
+        // out of frames or too large; the rest goes through the socket
+        if (!BXdp_Send(o->xdp.xdp, &o->xdp.route, b->data, b->len)) {
+            return 0;
+        }
+        
+        BPacketTrace_Stamp(BPACKETTRACE_SEND, b->data, BMETRICS_HISTOGRAM_TRACE_SEND_DATAGRAM_NS, NULL);
+        
+        o->send.busy_packets++;
+        o->send.busy_num_packets--;
+    }
+    
+    start_recv(o);
+    
+    // set not busy
+    o->send.busy = 0;
+    
+    // done
+    PacketPassInterface_Done(&o->send.iface);
+    return 1;
+}
+
+static void xdp_recv_next (BDatagram *o)
+{
+    ASSERT(o->xdp.num > 0)
+    
+    struct BDatagram_xdp_packet *p = &o->xdp.packets[o->xdp.start];
+    
+    // copy to receiver's buffer, truncating like recv would
+    int bytes = p->len;
+    if (bytes > o->recv.mtu) {
+        bytes = o->recv.mtu;
+    }
+    memcpy(o->recv.busy_data, p->data, bytes);
+    
+    BPROBE2(datagram_recv, o->fd, bytes);
+    
+    BPacketTrace_Begin(BPACKETTRACE_RECV, o->recv.busy_data);
+    
+    // remember addresses, and the route for replies
+    o->recv.remote_addr = p->route.remote_addr;
+    BAddr_GetIPAddr(&p->route.local_addr, &o->recv.local_addr);
+    o->xdp.route = p->route;
+    o->xdp.have_route = 1;
+    
+    // give the frame back
+    BXdp_ReleaseFrame(o->xdp.xdp, p->route.queue, p->frame);
+    o->xdp.start = (o->xdp.start + 1) % BDATAGRAM_XDP_QUEUE;
+    o->xdp.num--;
+    
+    // set have addresses
+    o->recv.have_addrs = 1;
+    
+    // set not busy
+    o->recv.busy = 0;
+    
+    // done
+    PacketRecvInterface_Done(&o->recv.iface, bytes);
+}
+
+static void xdp_release_packets (BDatagram *o)
+{
+    while (o->xdp.num > 0) {
+        struct BDatagram_xdp_packet *p = &o->xdp.packets[o->xdp.start];
+        BXdp_ReleaseFrame(o->xdp.xdp, p->route.queue, p->frame);
+        o->xdp.start = (o->xdp.start + 1) % BDATAGRAM_XDP_QUEUE;
+        o->xdp.num--;
+    }
+}
+
+#endif
+
+static int send_uring_busy (BDatagram *o)
+{
+#ifdef BADVPN_USE_IO_URING
+    return (o->uring_msgs && o->send.inited && BReactorIOUringOp_IsBusy(&o->send.uring_op));
+#else
+    return 0;
+#endif
+}
+
+static int recv_uring_busy (BDatagram *o)
+{
+#ifdef BADVPN_USE_IO_URING
+    return (o->uring_msgs && o->recv.inited && BReactorIOUringOp_IsBusy(&o->recv.uring_op));
+#else
+    return 0;
+#endif
+}
+
+static void fd_handler (BDatagram *o, int events)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    
+    // clear handled events
     o->wait_events &= ~events;
     BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
     
     int have_send = 0;
     int have_recv = 0;
     
-    if ((events & BREACTOR_WRITE) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->send.inited && o->send.busy && o->send.have_addrs)) {
+    if ((events & BREACTOR_WRITE) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->send.inited && o->send.busy && o->send.have_addrs && !send_uring_busy(o))) {
         ASSERT(o->send.inited)
-        ASSERT(o->send.busy)
-        ASSERT(o->send.have_addrs)
+        ASSERT(o->send.busy || o->send.batch_num > 0)
+        ASSERT(!o->send.busy || o->send.have_addrs)
         
         have_send = 1;
     }
     
-    if ((events & BREACTOR_READ) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->recv.inited && o->recv.busy && o->recv.started)) {
+    if ((events & BREACTOR_READ) || ((events & (BREACTOR_ERROR|BREACTOR_HUP)) && o->recv.inited && o->recv.busy && o->recv.started && !recv_uring_busy(o))) {
         ASSERT(o->recv.inited)
         ASSERT(o->recv.busy)
         ASSERT(o->recv.started)
@@ -487,6 +1216,14 @@ static void fd_handler (BDatagram *o, int events)
             BPending_Set(&o->recv.job);
         }
         
+#ifdef HAVE_MMSG
+        // waiting was only for flushing queued packets
+        if (!o->send.busy) {
+            send_flush_job_handler(o);
+            return;
+        }
+#endif
+        
         do_send(o);
         return;
     }
@@ -496,6 +1233,20 @@ static void fd_handler (BDatagram *o, int events)
         return;
     }
     
+    // pending io_uring operations will complete with the error
+    if (send_uring_busy(o) || recv_uring_busy(o)) {
+        return;
+    }
+    
+    // consume an ICMP error nobody is there to receive
+    if (o->connected) {
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        if (getsockopt(o->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && (err == 0 || is_ignored_error(o, err))) {
+            return;
+        }
+    }
+    
     BLog(BLOG_ERROR, "fd error event");
     report_error(o);
     return;
@@ -513,6 +1264,28 @@ static void send_job_handler (BDatagram *o)
     return;
 }
 
+#ifdef HAVE_MMSG
+
+static void send_flush_job_handler (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batch_num > 0)
+    
+    if (!flush_send_batch(o)) {
+        return;
+    }
+    
+    // a message failed after at least one was sent; the next attempt
+    // will report the error
+    if (o->send.batch_num > 0) {
+        BPending_Set(&o->send.flush_job);
+    }
+}
+
+#endif
+
 static void recv_job_handler (BDatagram *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -537,6 +1310,37 @@ static void send_if_handler_send (BDatagram *o, uint8_t *data, int data_len)
     // remember data
     o->send.busy_data = data;
     o->send.busy_data_len = data_len;
+    o->send.busy_packet.data = data;
+    o->send.busy_packet.len = data_len;
+    o->send.busy_packets = &o->send.busy_packet;
+    o->send.busy_num_packets = 1;
+    
+    // set busy
+    o->send.busy = 1;
+    
+    // if have no addresses, wait
+    if (!o->send.have_addrs) {
+        return;
+    }
+    
+    // set job
+    BPending_Set(&o->send.job);
+}
+
+#ifdef HAVE_MMSG
+
+static void send_if_handler_sendmany (BDatagram *o, const struct PacketPassInterface_buf *packets, int num_packets)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.batch > 1)
+    ASSERT(!o->send.busy)
+    ASSERT(num_packets > 0)
+    
+    // remember packets; they are copied into the queue as it has room
+    o->send.busy_packets = packets;
+    o->send.busy_num_packets = num_packets;
     
     // set busy
     o->send.busy = 1;
@@ -550,6 +1354,8 @@ static void send_if_handler_send (BDatagram *o, uint8_t *data, int data_len)
     BPending_Set(&o->send.job);
 }
 
+#endif
+
 static void recv_if_handler_recv (BDatagram *o, uint8_t *data)
 {
     DebugObject_Access(&o->d_obj);
@@ -597,6 +1403,7 @@ int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
     o->reactor = reactor;
     o->user = user;
     o->handler = handler;
+    o->family = family;
     
     // init fd
     if ((o->fd = socket(family_socket_to_sys(family), SOCK_DGRAM, 0)) < 0) {
@@ -615,14 +1422,21 @@ int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
     
     // init BFileDescriptor
     BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)fd_handler, o);
-    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
-        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+    if (!BReactor_AddFileDescriptor2(o->reactor, &o->bfd, BReactor_GetSocketFdFlags(o->reactor))) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor2 failed");
         goto fail1;
     }
     
     // set no wait events
     o->wait_events = 0;
     
+    // set not connected
+    o->connected = 0;
+    
+    // fragmentation is allowed by default
+    o->dont_fragment = 0;
+    o->offload = 0;
+    
     // init limits
     BReactorLimit_Init(&o->send.limit, o->reactor, BDATAGRAM_SEND_LIMIT);
     BReactorLimit_Init(&o->recv.limit, o->reactor, BDATAGRAM_RECV_LIMIT);
@@ -638,10 +1452,32 @@ int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
     o->send.inited = 0;
     o->recv.inited = 0;
     
+#ifdef BADVPN_USE_AF_XDP
+    // set not using XDP
+    o->xdp.xdp = NULL;
+#endif
+    
+#ifdef BADVPN_USE_IO_URING
+    // with io_uring, sendmsg/recvmsg headers must live until completion
+    o->uring_msgs = NULL;
+    if (BReactor_HasIOUring(o->reactor)) {
+        if (!(o->uring_msgs = (struct BDatagram_sys_msg *)BAllocArray(2, sizeof(o->uring_msgs[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail2;
+        }
+    }
+#endif
+    
     DebugError_Init(&o->d_err, BReactor_PendingGroup(o->reactor));
     DebugObject_Init(&o->d_obj);
     return 1;
     
+#ifdef BADVPN_USE_IO_URING
+fail2:
+    BReactorLimit_Free(&o->recv.limit);
+    BReactorLimit_Free(&o->send.limit);
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+#endif
 fail1:
     if (close(o->fd) < 0) {
         BLog(BLOG_ERROR, "close failed");
@@ -657,6 +1493,22 @@ void BDatagram_Free (BDatagram *o)
     ASSERT(!o->recv.inited)
     ASSERT(!o->send.inited)
     
+#ifdef BADVPN_USE_AF_XDP
+    // stop using XDP
+    if (o->xdp.xdp) {
+        xdp_release_packets(o);
+        BXdp_RemovePort(o->xdp.xdp, o->xdp.port);
+        BFree(o->xdp.packets);
+    }
+#endif
+    
+#ifdef BADVPN_USE_IO_URING
+    // free io_uring message headers
+    if (o->uring_msgs) {
+        BFree(o->uring_msgs);
+    }
+#endif
+    
     // free limits
     BReactorLimit_Free(&o->recv.limit);
     BReactorLimit_Free(&o->send.limit);
@@ -700,10 +1552,51 @@ int BDatagram_Bind (BDatagram *o, BAddr addr)
     return 1;
 }
 
+int BDatagram_Connect (BDatagram *o, BAddr remote_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->connected)
+    ASSERT(!o->send.have_addrs)
+    ASSERT(remote_addr.type == BADDR_TYPE_IPV4 || remote_addr.type == BADDR_TYPE_IPV6)
+    
+    // translate address
+    struct sys_addr sysaddr;
+    addr_socket_to_sys(&sysaddr, remote_addr);
+    
+    // connect; for UDP, this only sets the default destination and
+    // the accepted source, and chooses the local address
+    if (connect(o->fd, &sysaddr.addr.generic, sysaddr.len) < 0) {
+        BLog(BLOG_ERROR, "connect failed");
+        return 0;
+    }
+    
+    // set connected
+    o->connected = 1;
+    
+    // the socket is now bound; if recv wasn't started yet, start it
+    start_recv(o);
+    
+    // set addresses
+    o->send.remote_addr = remote_addr;
+    BIPAddr_InitInvalid(&o->send.local_addr);
+    
+    // set have addresses
+    o->send.have_addrs = 1;
+    
+    // start sending
+    if (o->send.inited && o->send.busy) {
+        BPending_Set(&o->send.job);
+    }
+    
+    return 1;
+}
+
 void BDatagram_SetSendAddrs (BDatagram *o, BAddr remote_addr, BIPAddr local_addr)
 {
     DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->connected)
     ASSERT(BDatagram_AddressFamilySupported(remote_addr.type))
     ASSERT(local_addr.type == BADDR_TYPE_NONE || BDatagram_AddressFamilySupported(local_addr.type))
     
@@ -735,6 +1628,30 @@ int BDatagram_GetLastReceiveAddrs (BDatagram *o, BAddr *remote_addr, BIPAddr *lo
     return 1;
 }
 
+int BDatagram_GetLocalAddr (BDatagram *o, BAddr *local_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // get address
+    struct sys_addr sysaddr;
+    socklen_t len = sizeof(sysaddr.addr);
+    if (getsockname(o->fd, &sysaddr.addr.generic, &len) < 0) {
+        BLog(BLOG_ERROR, "getsockname failed");
+        return 0;
+    }
+    sysaddr.len = len;
+    
+    // translate address
+    BAddr addr;
+    addr_sys_to_socket(&addr, sysaddr);
+    if (!(addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6) || BAddr_GetPort(&addr) == 0) {
+        return 0;
+    }
+    
+    *local_addr = addr;
+    return 1;
+}
+
 int BDatagram_GetFd (BDatagram *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -754,6 +1671,215 @@ int BDatagram_SetReuseAddr (BDatagram *o, int reuse)
     return 1;
 }
 
+int BDatagram_SetMark (BDatagram *o, uint32_t mark)
+{
+    DebugObject_Access(&o->d_obj);
+    
+#ifdef SO_MARK
+    int val = mark;
+    if (setsockopt(o->fd, SOL_SOCKET, SO_MARK, &val, sizeof(val)) < 0) {
+        BLog(BLOG_ERROR, "setsockopt(SO_MARK) failed");
+        return 0;
+    }
+    
+    return 1;
+#else
+    BLog(BLOG_ERROR, "SO_MARK not supported");
+    return 0;
+#endif
+}
+
+int BDatagram_BindToDevice (BDatagram *o, const char *device)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(device)
+    
+#ifdef SO_BINDTODEVICE
+    if (setsockopt(o->fd, SOL_SOCKET, SO_BINDTODEVICE, device, strlen(device)) < 0) {
+        BLog(BLOG_ERROR, "setsockopt(SO_BINDTODEVICE, %s) failed", device);
+        return 0;
+    }
+    
+    return 1;
+#else
+    BLog(BLOG_ERROR, "SO_BINDTODEVICE not supported");
+    return 0;
+#endif
+}
+
+int BDatagram_SetBusyPoll (BDatagram *o, int usecs)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(usecs >= 0)
+    
+#ifdef SO_BUSY_POLL
+    if (setsockopt(o->fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0) {
+        BLog(BLOG_ERROR, "setsockopt(SO_BUSY_POLL) failed");
+        return 0;
+    }
+    
+    return 1;
+#else
+    BLog(BLOG_ERROR, "SO_BUSY_POLL is not supported");
+    return 0;
+#endif
+}
+
+int BDatagram_SetDontFragment (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    switch (o->family) {
+        case BADDR_TYPE_IPV4: {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+            int opt = IP_PMTUDISC_PROBE;
+            if (setsockopt(o->fd, IPPROTO_IP, IP_MTU_DISCOVER, &opt, sizeof(opt)) < 0) {
+                BLog(BLOG_ERROR, "setsockopt(IP_MTU_DISCOVER) failed");
+                return 0;
+            }
+#elif defined(IP_DONTFRAG)
+            int opt = 1;
+            if (setsockopt(o->fd, IPPROTO_IP, IP_DONTFRAG, &opt, sizeof(opt)) < 0) {
+                BLog(BLOG_ERROR, "setsockopt(IP_DONTFRAG) failed");
+                return 0;
+            }
+#else
+            BLog(BLOG_ERROR, "disabling fragmentation is not supported");
+            return 0;
+#endif
+        } break;
+        
+        case BADDR_TYPE_IPV6: {
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+            int opt = IPV6_PMTUDISC_PROBE;
+            if (setsockopt(o->fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &opt, sizeof(opt)) < 0) {
+                BLog(BLOG_ERROR, "setsockopt(IPV6_MTU_DISCOVER) failed");
+                return 0;
+            }
+#elif defined(IPV6_DONTFRAG)
+            int opt = 1;
+            if (setsockopt(o->fd, IPPROTO_IPV6, IPV6_DONTFRAG, &opt, sizeof(opt)) < 0) {
+                BLog(BLOG_ERROR, "setsockopt(IPV6_DONTFRAG) failed");
+                return 0;
+            }
+#else
+            BLog(BLOG_ERROR, "disabling fragmentation is not supported");
+            return 0;
+#endif
+        } break;
+        
+        default:
+            return 0;
+    }
+    
+    o->dont_fragment = 1;
+    
+    return 1;
+}
+
+int BDatagram_SetSegmentOffload (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->send.inited)
+    ASSERT(!o->recv.inited)
+    
+#ifdef HAVE_UDP_OFFLOAD
+    if (o->family != BADDR_TYPE_IPV4 && o->family != BADDR_TYPE_IPV6) {
+        BLog(BLOG_ERROR, "segmentation offload is only supported for IP");
+        return 0;
+    }
+    
+    // check that the kernel knows about segmentation offload;
+    // a segment size of zero leaves it disabled unless asked for per send
+    int opt = 0;
+    if (setsockopt(o->fd, SOL_UDP, UDP_SEGMENT, &opt, sizeof(opt)) < 0) {
+        BLog(BLOG_ERROR, "setsockopt(UDP_SEGMENT) failed");
+        return 0;
+    }
+    
+    o->offload = 1;
+    
+    return 1;
+#else
+    BLog(BLOG_ERROR, "segmentation offload is not supported");
+    return 0;
+#endif
+}
+
+#ifdef BADVPN_USE_AF_XDP
+
+int BDatagram_SetXdp (BDatagram *o, BXdp *xdp)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->xdp.xdp)
+    
+#ifdef BADVPN_USE_IO_URING
+    if (o->uring_msgs) {
+        BLog(BLOG_ERROR, "XDP cannot be used with io_uring");
+        return 0;
+    }
+#endif
+    
+    // get port
+    BAddr addr;
+    if (!BDatagram_GetLocalAddr(o, &addr)) {
+        BLog(BLOG_ERROR, "socket is not bound");
+        return 0;
+    }
+    
+    // allocate queue
+    if (!(o->xdp.packets = (struct BDatagram_xdp_packet *)BAllocArray(BDATAGRAM_XDP_QUEUE, sizeof(o->xdp.packets[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        return 0;
+    }
+    
+    // register port
+    if (!BXdp_AddPort(xdp, BAddr_GetPort(&addr), o)) {
+        BLog(BLOG_ERROR, "BXdp_AddPort failed");
+        BFree(o->xdp.packets);
+        return 0;
+    }
+    
+    o->xdp.xdp = xdp;
+    o->xdp.port = BAddr_GetPort(&addr);
+    o->xdp.have_route = 0;
+    o->xdp.start = 0;
+    o->xdp.num = 0;
+    
+    return 1;
+}
+
+int BDatagram_XdpReceived (BDatagram *o, uint64_t frame, const uint8_t *data, int data_len, const struct BXdp_route *route)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->xdp.xdp)
+    ASSERT(data_len >= 0)
+    
+    // drop if nobody receives or the queue is full, like the socket would
+    if (!o->recv.inited || o->xdp.num == BDATAGRAM_XDP_QUEUE) {
+        return 0;
+    }
+    
+    // queue
+    struct BDatagram_xdp_packet *p = &o->xdp.packets[(o->xdp.start + o->xdp.num) % BDATAGRAM_XDP_QUEUE];
+    p->frame = frame;
+    p->data = data;
+    p->len = data_len;
+    p->route = *route;
+    o->xdp.num++;
+    
+    // if waiting for the socket, receive now instead
+    if (o->recv.busy && o->recv.started && (o->wait_events & BREACTOR_READ)) {
+        o->wait_events &= ~BREACTOR_READ;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+        BPending_Set(&o->recv.job);
+    }
+    
+    return 1;
+}
+
+#endif
+
 void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
 {
     DebugObject_Access(&o->d_obj);
@@ -766,26 +1892,136 @@ void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
     
     // init interface
     PacketPassInterface_Init(&o->send.iface, o->send.mtu, (PacketPassInterface_handler_send)send_if_handler_send, o, BReactor_PendingGroup(o->reactor));
+    PacketPassInterface_EnableDirect(&o->send.iface);
     
     // init job
     BPending_Init(&o->send.job, BReactor_PendingGroup(o->reactor), (BPending_handler)send_job_handler, o);
     
+#ifdef BADVPN_USE_IO_URING
+    // init io_uring operation
+    if (o->uring_msgs) {
+        BReactorIOUringOp_Init(&o->send.uring_op, o->reactor, o, (BReactorIOUringOp_handler)send_uring_handler);
+    }
+#endif
+    
     // set not busy
     o->send.busy = 0;
     
+    // set no batching
+    o->send.batch = 1;
+    o->send.batch_num = 0;
+    o->send.gso = 0;
+    
     // set inited
     o->send.inited = 1;
 }
 
+int BDatagram_SendAsync_Init2 (BDatagram *o, int mtu, int batch)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->send.inited)
+    ASSERT(mtu >= 0)
+    ASSERT(batch > 0)
+    
+    if (!can_batch(o, mtu, batch)) {
+        BDatagram_SendAsync_Init(o, mtu);
+        return 1;
+    }
+    
+#ifdef HAVE_MMSG
+    // allocate queue
+    if (!(o->send.batch_data = (uint8_t *)BAllocArray(batch, mtu))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    if (!(o->send.batch_packets = (struct BDatagram_batch_packet *)BAllocArray(batch, sizeof(o->send.batch_packets[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    if (!(o->send.batch_msgs = (struct BDatagram_sys_msg *)BAllocArray(batch, sizeof(o->send.batch_msgs[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2;
+    }
+    if (!(o->send.batch_mmsgs = (struct mmsghdr *)BAllocArray(batch, sizeof(o->send.batch_mmsgs[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail3;
+    }
+    if (!(o->send.batch_iovs = (struct iovec *)BAllocArray(batch, sizeof(o->send.batch_iovs[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail4;
+    }
+    
+    BDatagram_SendAsync_Init(o, mtu);
+    
+    // init flush job
+    BPending_Init(&o->send.flush_job, BReactor_PendingGroup(o->reactor), (BPending_handler)send_flush_job_handler, o);
+    
+    // set batching
+    o->send.batch = batch;
+    
+    // let senders pass bursts straight into the queue
+    PacketPassInterface_EnableSendMany(&o->send.iface, (PacketPassInterface_handler_sendmany)send_if_handler_sendmany);
+    
+    // use segmentation offload if enabled
+    o->send.gso = o->offload;
+    o->send.gso_max_size = BDATAGRAM_GSO_MAX_BYTES;
+    
+    return 1;
+    
+fail4:
+    BFree(o->send.batch_mmsgs);
+fail3:
+    BFree(o->send.batch_msgs);
+fail2:
+    BFree(o->send.batch_packets);
+fail1:
+    BFree(o->send.batch_data);
+fail0:
+#endif
+    return 0;
+}
+
 void BDatagram_SendAsync_Free (BDatagram *o)
 {
     DebugObject_Access(&o->d_obj);
     ASSERT(o->send.inited)
     
+#ifdef BADVPN_USE_IO_URING
+    // finish io_uring operation
+    if (o->uring_msgs) {
+        if (BReactorIOUringOp_IsBusy(&o->send.uring_op)) {
+            BReactorIOUringOp_Cancel(&o->send.uring_op);
+            BReactorIOUringOp_Wait(&o->send.uring_op);
+        }
+        BReactorIOUringOp_Free(&o->send.uring_op);
+    }
+#endif
+    
     // update events
     o->wait_events &= ~BREACTOR_WRITE;
     BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
     
+#ifdef HAVE_MMSG
+    if (o->send.batch > 1) {
+        // try to send out packets we've already accepted
+        if (o->send.batch_num > 0) {
+            int num_msgs = build_send_batch(o, o->send.gso);
+            sendmmsg(o->fd, o->send.batch_mmsgs, num_msgs, 0);
+        }
+        
+        // free flush job
+        BPending_Free(&o->send.flush_job);
+        
+        // free queue
+        BFree(o->send.batch_iovs);
+        BFree(o->send.batch_mmsgs);
+        BFree(o->send.batch_msgs);
+        BFree(o->send.batch_packets);
+        BFree(o->send.batch_data);
+    }
+#endif
+    
     // free job
     BPending_Free(&o->send.job);
     
@@ -820,22 +2056,127 @@ void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
     // init job
     BPending_Init(&o->recv.job, BReactor_PendingGroup(o->reactor), (BPending_handler)recv_job_handler, o);
     
+#ifdef BADVPN_USE_IO_URING
+    // init io_uring operation
+    if (o->uring_msgs) {
+        BReactorIOUringOp_Init(&o->recv.uring_op, o->reactor, o, (BReactorIOUringOp_handler)recv_uring_handler);
+    }
+#endif
+    
     // set not busy
     o->recv.busy = 0;
     
+    // set no batching
+    o->recv.batch = 1;
+    o->recv.batch_num = 0;
+    o->recv.batch_pos = 0;
+    o->recv.batch_offset = 0;
+    o->recv.gro = 0;
+    
     // set inited
     o->recv.inited = 1;
 }
 
+int BDatagram_RecvAsync_Init2 (BDatagram *o, int mtu, int batch)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->recv.inited)
+    ASSERT(mtu >= 0)
+    ASSERT(batch > 0)
+    
+    if (!can_batch(o, mtu, batch)) {
+        BDatagram_RecvAsync_Init(o, mtu);
+        return 1;
+    }
+    
+#ifdef HAVE_MMSG
+    int bufsize = mtu;
+    int gro = 0;
+    
+#ifdef HAVE_UDP_OFFLOAD
+    // with receive offload, the kernel may coalesce datagrams into large
+    // messages, so buffers must be large enough for any message
+    if (o->offload) {
+        int opt = 1;
+        if (setsockopt(o->fd, SOL_UDP, UDP_GRO, &opt, sizeof(opt)) < 0) {
+            BLog(BLOG_WARNING, "setsockopt(UDP_GRO) failed");
+        } else {
+            bufsize = BDATAGRAM_GRO_BUFFER_SIZE;
+            gro = 1;
+        }
+    }
+#endif
+    
+    // allocate buffers; without receive offload, the first datagram of a batch
+    // is received directly into the receiver's buffer, so slot 0 is unused
+    if (!(o->recv.batch_data = (uint8_t *)BAllocArray(batch, bufsize))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    if (!(o->recv.batch_msgs = (struct BDatagram_sys_msg *)BAllocArray(batch, sizeof(o->recv.batch_msgs[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    if (!(o->recv.batch_mmsgs = (struct mmsghdr *)BAllocArray(batch, sizeof(o->recv.batch_mmsgs[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2;
+    }
+    
+    BDatagram_RecvAsync_Init(o, mtu);
+    
+    // set batching
+    o->recv.batch = batch;
+    o->recv.batch_bufsize = bufsize;
+    o->recv.gro = gro;
+    
+    return 1;
+    
+fail2:
+    BFree(o->recv.batch_msgs);
+fail1:
+    BFree(o->recv.batch_data);
+fail0:
+#endif
+    return 0;
+}
+
 void BDatagram_RecvAsync_Free (BDatagram *o)
 {
     DebugObject_Access(&o->d_obj);
     ASSERT(o->recv.inited)
     
+#ifdef BADVPN_USE_IO_URING
+    // finish io_uring operation
+    if (o->uring_msgs) {
+        if (BReactorIOUringOp_IsBusy(&o->recv.uring_op)) {
+            BReactorIOUringOp_Cancel(&o->recv.uring_op);
+            BReactorIOUringOp_Wait(&o->recv.uring_op);
+        }
+        BReactorIOUringOp_Free(&o->recv.uring_op);
+    }
+#endif
+    
     // update events
     o->wait_events &= ~BREACTOR_READ;
     BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
     
+#ifdef BADVPN_USE_AF_XDP
+    // give back frames nobody will receive
+    if (o->xdp.xdp) {
+        xdp_release_packets(o);
+    }
+#endif
+    
+#ifdef HAVE_MMSG
+    // free batch buffers
+    if (o->recv.batch > 1) {
+        BFree(o->recv.batch_mmsgs);
+        BFree(o->recv.batch_msgs);
+        BFree(o->recv.batch_data);
+    }
+#endif
+    
     // free job
     BPending_Free(&o->recv.job);
     
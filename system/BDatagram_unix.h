@@ -32,14 +32,32 @@
 
 #define BDATAGRAM_SEND_LIMIT 2
 #define BDATAGRAM_RECV_LIMIT 2
+// limits of a single segmentation offload send; the kernel allows
+// at most 64 segments, and the whole must fit a single IPv4 datagram
+#define BDATAGRAM_GSO_MAX_SEGMENTS 64
+#define BDATAGRAM_GSO_MAX_BYTES 65507
+// size of receive buffers when using receive offload
+#define BDATAGRAM_GRO_BUFFER_SIZE 65535
+// number of datagrams from XDP held until received
+#define BDATAGRAM_XDP_QUEUE 256
+
+struct BDatagram_sys_msg;
+struct BDatagram_batch_packet;
+struct BDatagram_xdp_packet;
+struct mmsghdr;
+struct iovec;
 
 struct BDatagram_s {
     BReactor *reactor;
     void *user;
     BDatagram_handler handler;
+    int family;
     int fd;
     BFileDescriptor bfd;
     int wait_events;
+    int connected;
+    int dont_fragment;
+    int offload;
     struct {
         BReactorLimit limit;
         int have_addrs;
@@ -52,6 +70,22 @@ struct BDatagram_s {
         int busy;
         const uint8_t *busy_data;
         int busy_data_len;
+        struct PacketPassInterface_buf busy_packet;
+        const struct PacketPassInterface_buf *busy_packets;
+        int busy_num_packets;
+        int batch;
+        int batch_num;
+        uint8_t *batch_data;
+        struct BDatagram_batch_packet *batch_packets;
+        struct BDatagram_sys_msg *batch_msgs;
+        struct mmsghdr *batch_mmsgs;
+        struct iovec *batch_iovs;
+        int gso;
+        int gso_max_size;
+        BPending flush_job;
+#ifdef BADVPN_USE_IO_URING
+        BReactorIOUringOp uring_op;
+#endif
     } send;
     struct {
         BReactorLimit limit;
@@ -65,7 +99,33 @@ struct BDatagram_s {
         BPending job;
         int busy;
         uint8_t *busy_data;
+        int batch;
+        int batch_num;
+        int batch_pos;
+        int batch_offset;
+        int batch_bufsize;
+        int gro;
+        uint8_t *batch_data;
+        struct BDatagram_sys_msg *batch_msgs;
+        struct mmsghdr *batch_mmsgs;
+#ifdef BADVPN_USE_IO_URING
+        BReactorIOUringOp uring_op;
+#endif
     } recv;
+#ifdef BADVPN_USE_IO_URING
+    struct BDatagram_sys_msg *uring_msgs;
+#endif
+#ifdef BADVPN_USE_AF_XDP
+    struct {
+        BXdp *xdp;
+        uint16_t port;
+        int have_route;
+        struct BXdp_route route;
+        struct BDatagram_xdp_packet *packets;
+        int start;
+        int num;
+    } xdp;
+#endif
     DebugError d_err;
     DebugObject d_obj;
 };
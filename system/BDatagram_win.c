@@ -28,7 +28,10 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
+#include <misc/balloc.h>
 #include <base/BLog.h>
 
 #include "BDatagram.h"
@@ -39,6 +42,7 @@ static int family_socket_to_sys (int family);
 static void addr_socket_to_sys (struct BDatagram_sys_addr *out, BAddr addr);
 static void addr_sys_to_socket (BAddr *out, struct BDatagram_sys_addr addr);
 static void set_pktinfo (SOCKET sock, int family);
+static void read_pktinfo (WSAMSG *msg, BIPAddr *out);
 static void report_error (BDatagram *o);
 static void datagram_abort (BDatagram *o);
 static void start_send (BDatagram *o);
@@ -49,6 +53,16 @@ static void send_if_handler_send (BDatagram *o, uint8_t *data, int data_len);
 static void recv_if_handler_recv (BDatagram *o, uint8_t *data);
 static void send_olap_handler (BDatagram *o, int event, DWORD bytes);
 static void recv_olap_handler (BDatagram *o, int event, DWORD bytes);
+#ifdef BADVPN_USE_WINRIO
+static int rio_init (BDatagram *o, int mtu, int batch);
+static void rio_free (BDatagram *o);
+static void rio_drain (BDatagram *o);
+static int rio_post (BDatagram *o, int slot, DWORD flags);
+static int rio_notify (BDatagram *o);
+static void rio_start (BDatagram *o);
+static void rio_deliver (BDatagram *o);
+static void rio_olap_handler (BDatagram *o, int event, DWORD bytes);
+#endif
 
 static int family_socket_to_sys (int family)
 {
@@ -126,6 +140,22 @@ static void set_pktinfo (SOCKET sock, int family)
     }
 }
 
+static void read_pktinfo (WSAMSG *msg, BIPAddr *out)
+{
+    BIPAddr_InitInvalid(out);
+    
+    for (WSACMSGHDR *cmsg = WSA_CMSG_FIRSTHDR(msg); cmsg; cmsg = WSA_CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+            struct in_pktinfo *pktinfo = (struct in_pktinfo *)WSA_CMSG_DATA(cmsg);
+            BIPAddr_InitIPv4(out, pktinfo->ipi_addr.s_addr);
+        }
+        else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+            struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)WSA_CMSG_DATA(cmsg);
+            BIPAddr_InitIPv6(out, pktinfo->ipi6_addr.s6_addr);
+        }
+    }
+}
+
 static void report_error (BDatagram *o)
 {
     DebugError_AssertNoError(&o->d_err);
@@ -151,6 +181,14 @@ static void datagram_abort (BDatagram *o)
         BLog(BLOG_ERROR, "closesocket failed");
     }
     
+#ifdef BADVPN_USE_WINRIO
+    // wait for posted receives to be cancelled, then free Registered I/O
+    if (o->recv.rio.inited) {
+        rio_drain(o);
+        rio_free(o);
+    }
+#endif
+    
     // wait for receiving to complete
     if (o->recv.inited && o->recv.data_have && o->recv.data_busy) {
         BReactorIOCPOverlapped_Wait(&o->recv.olap, NULL, NULL);
@@ -319,9 +357,20 @@ static void recv_job_handler (BDatagram *o)
     DebugError_AssertNoError(&o->d_err);
     ASSERT(!o->aborted)
     ASSERT(o->recv.inited)
+    ASSERT(o->recv.started)
+    
+#ifdef BADVPN_USE_WINRIO
+    if (o->recv.rio.inited) {
+        // post receives
+        if (!o->recv.rio.posted) {
+            rio_start(o);
+        }
+        return;
+    }
+#endif
+    
     ASSERT(o->recv.data_have)
     ASSERT(!o->recv.data_busy)
-    ASSERT(o->recv.started)
     
     // recv
     start_recv(o);
@@ -366,6 +415,16 @@ static void recv_if_handler_recv (BDatagram *o, uint8_t *data)
     o->recv.data_have = 1;
     o->recv.data_busy = 0;
     
+#ifdef BADVPN_USE_WINRIO
+    if (o->recv.rio.inited) {
+        // take a completed receive, or wait for the notification
+        if (o->recv.rio.results_pos < o->recv.rio.results_num) {
+            rio_deliver(o);
+        }
+        return;
+    }
+#endif
+    
     // if recv not started yet, wait
     if (!o->recv.started) {
         return;
@@ -408,7 +467,7 @@ static void send_olap_handler (BDatagram *o, int event, DWORD bytes)
         o->recv.started = 1;
         
         // continue receiving
-        if (o->recv.inited && o->recv.data_have) {
+        if (o->recv.inited && (o->recv.data_have || o->recv.rio.inited)) {
             ASSERT(!o->recv.data_busy)
             
             BPending_Set(&o->recv.job);
@@ -452,18 +511,277 @@ static void recv_olap_handler (BDatagram *o, int event, DWORD bytes)
     addr_sys_to_socket(&o->recv.remote_addr, o->recv.sysaddr);
     
     // read local address
-    BIPAddr_InitInvalid(&o->recv.local_addr);
     if (o->fnWSARecvMsg) {
-        for (WSACMSGHDR *cmsg = WSA_CMSG_FIRSTHDR(&o->recv.msg); cmsg; cmsg = WSA_CMSG_NXTHDR(&o->recv.msg, cmsg)) {
-            if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
-                struct in_pktinfo *pktinfo = (struct in_pktinfo *)WSA_CMSG_DATA(cmsg);
-                BIPAddr_InitIPv4(&o->recv.local_addr, pktinfo->ipi_addr.s_addr);
-            }
-            else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
-                struct in6_pktinfo *pktinfo = (struct in6_pktinfo *)WSA_CMSG_DATA(cmsg);
-                BIPAddr_InitIPv6(&o->recv.local_addr, pktinfo->ipi6_addr.s6_addr);
-            }
+        read_pktinfo(&o->recv.msg, &o->recv.local_addr);
+    } else {
+        BIPAddr_InitInvalid(&o->recv.local_addr);
+    }
+    
+    // set have addresses
+    o->recv.have_addrs = 1;
+    
+    // set no data
+    o->recv.data_have = 0;
+    
+    // done
+    PacketRecvInterface_Done(&o->recv.iface, bytes);
+}
+
+#ifdef BADVPN_USE_WINRIO
+
+static int rio_init (BDatagram *o, int mtu, int batch)
+{
+    ASSERT(o->have_rio)
+    ASSERT(!o->recv.rio.inited)
+    ASSERT(mtu > 0)
+    ASSERT(batch > 1)
+    
+    // each slot holds a datagram, its source address and control data
+    o->recv.rio.control_len = WSA_CMSGHDR_ALIGN(sizeof(RIO_CMSG_BUFFER)) + sizeof(o->recv.cdata);
+    if (mtu > INT_MAX / 2) {
+        BLog(BLOG_ERROR, "Registered I/O buffer too large");
+        goto fail0;
+    }
+    o->recv.rio.addr_offset = (mtu + 7) & ~7;
+    o->recv.rio.control_offset = (o->recv.rio.addr_offset + (int)sizeof(o->recv.sysaddr.addr) + 7) & ~7;
+    o->recv.rio.slot_size = (o->recv.rio.control_offset + o->recv.rio.control_len + 7) & ~7;
+    if (batch > INT_MAX / o->recv.rio.slot_size) {
+        BLog(BLOG_ERROR, "Registered I/O buffer too large");
+        goto fail0;
+    }
+    
+    // allocate and register buffer
+    if (!(o->recv.rio.mem = (char *)BAllocArray(batch, o->recv.rio.slot_size))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    if ((o->recv.rio.bufid = o->rio.RIORegisterBuffer(o->recv.rio.mem, (DWORD)batch * o->recv.rio.slot_size)) == RIO_INVALID_BUFFERID) {
+        BLog(BLOG_ERROR, "RIORegisterBuffer failed (%d)", WSAGetLastError());
+        goto fail1;
+    }
+    
+    // allocate results array
+    if (!(o->recv.rio.results = (RIORESULT *)BAllocArray(batch, sizeof(o->recv.rio.results[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2;
+    }
+    
+    // init notification olap
+    BReactorIOCPOverlapped_Init(&o->recv.rio.olap, o->reactor, o, (BReactorIOCPOverlapped_handler)rio_olap_handler);
+    
+    // create completion queue, notified through the reactor's IOCP;
+    // it also has room for the completion of a send, which the request
+    // queue must allow for even though sends don't use it
+    RIO_NOTIFICATION_COMPLETION notify;
+    memset(&notify, 0, sizeof(notify));
+    notify.Type = RIO_IOCP_COMPLETION;
+    notify.Iocp.IocpHandle = BReactor_GetIOCPHandle(o->reactor);
+    notify.Iocp.CompletionKey = NULL;
+    notify.Iocp.Overlapped = &o->recv.rio.olap.olap;
+    if ((o->recv.rio.cq = o->rio.RIOCreateCompletionQueue(batch + 1, &notify)) == RIO_INVALID_CQ) {
+        BLog(BLOG_ERROR, "RIOCreateCompletionQueue failed (%d)", WSAGetLastError());
+        goto fail3;
+    }
+    
+    o->recv.rio.batch = batch;
+    o->recv.rio.rq = RIO_INVALID_RQ;
+    o->recv.rio.posted = 0;
+    o->recv.rio.outstanding = 0;
+    o->recv.rio.notify_busy = 0;
+    o->recv.rio.results_num = 0;
+    o->recv.rio.results_pos = 0;
+    o->recv.rio.inited = 1;
+    
+    return 1;
+    
+fail3:
+    BReactorIOCPOverlapped_Free(&o->recv.rio.olap);
+    BFree(o->recv.rio.results);
+fail2:
+    o->rio.RIODeregisterBuffer(o->recv.rio.bufid);
+fail1:
+    BFree(o->recv.rio.mem);
+fail0:
+    return 0;
+}
+
+static void rio_free (BDatagram *o)
+{
+    ASSERT(o->recv.rio.inited)
+    ASSERT(o->recv.rio.outstanding == 0)
+    
+    o->rio.RIOCloseCompletionQueue(o->recv.rio.cq);
+    BReactorIOCPOverlapped_Free(&o->recv.rio.olap);
+    BFree(o->recv.rio.results);
+    o->rio.RIODeregisterBuffer(o->recv.rio.bufid);
+    BFree(o->recv.rio.mem);
+    
+    o->recv.rio.inited = 0;
+}
+
+static void rio_drain (BDatagram *o)
+{
+    ASSERT(o->recv.rio.inited)
+    
+    // the socket is closed, so the remaining receives complete with errors
+    while (o->recv.rio.outstanding > 0) {
+        if (!o->recv.rio.notify_busy && !rio_notify(o)) {
+            break;
         }
+        
+        BReactorIOCPOverlapped_Wait(&o->recv.rio.olap, NULL, NULL);
+        o->recv.rio.notify_busy = 0;
+        
+        ULONG num = o->rio.RIODequeueCompletion(o->recv.rio.cq, o->recv.rio.results, o->recv.rio.batch);
+        if (num == RIO_CORRUPT_CQ) {
+            BLog(BLOG_ERROR, "RIODequeueCompletion failed");
+            break;
+        }
+        
+        o->recv.rio.outstanding -= num;
+    }
+    
+    o->recv.rio.outstanding = 0;
+    o->recv.rio.results_num = 0;
+    o->recv.rio.results_pos = 0;
+}
+
+static int rio_post (BDatagram *o, int slot, DWORD flags)
+{
+    ASSERT(o->recv.rio.inited)
+    ASSERT(slot >= 0)
+    ASSERT(slot < o->recv.rio.batch)
+    ASSERT(o->recv.rio.outstanding < o->recv.rio.batch)
+    
+    ULONG base = (ULONG)slot * o->recv.rio.slot_size;
+    
+    RIO_BUF data;
+    data.BufferId = o->recv.rio.bufid;
+    data.Offset = base;
+    data.Length = o->recv.mtu;
+    
+    RIO_BUF addr;
+    addr.BufferId = o->recv.rio.bufid;
+    addr.Offset = base + o->recv.rio.addr_offset;
+    addr.Length = sizeof(o->recv.sysaddr.addr);
+    
+    RIO_BUF control;
+    control.BufferId = o->recv.rio.bufid;
+    control.Offset = base + o->recv.rio.control_offset;
+    control.Length = o->recv.rio.control_len;
+    
+    if (!o->rio.RIOReceiveEx(o->recv.rio.rq, &data, 1, NULL, &addr, &control, NULL, flags, (PVOID)(ULONG_PTR)slot)) {
+        BLog(BLOG_ERROR, "RIOReceiveEx failed (%d)", WSAGetLastError());
+        return 0;
+    }
+    
+    o->recv.rio.outstanding++;
+    
+    return 1;
+}
+
+static int rio_notify (BDatagram *o)
+{
+    ASSERT(o->recv.rio.inited)
+    ASSERT(!o->recv.rio.notify_busy)
+    
+    int res = o->rio.RIONotify(o->recv.rio.cq);
+    if (res != ERROR_SUCCESS) {
+        BLog(BLOG_ERROR, "RIONotify failed (%d)", res);
+        return 0;
+    }
+    
+    o->recv.rio.notify_busy = 1;
+    
+    return 1;
+}
+
+static void rio_start (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->aborted)
+    ASSERT(o->recv.rio.inited)
+    ASSERT(!o->recv.rio.posted)
+    ASSERT(o->recv.started)
+    
+    // create request queue
+    o->recv.rio.rq = o->rio.RIOCreateRequestQueue(o->sock, o->recv.rio.batch, 1, 1, 1, o->recv.rio.cq, o->recv.rio.cq, NULL);
+    if (o->recv.rio.rq == RIO_INVALID_RQ) {
+        BLog(BLOG_ERROR, "RIOCreateRequestQueue failed (%d)", WSAGetLastError());
+        report_error(o);
+        return;
+    }
+    
+    o->recv.rio.posted = 1;
+    
+    // post a receive into every slot, with a single system call
+    for (int i = 0; i < o->recv.rio.batch; i++) {
+        if (!rio_post(o, i, (i < o->recv.rio.batch - 1 ? RIO_MSG_DEFER : 0))) {
+            report_error(o);
+            return;
+        }
+    }
+    
+    // get notified when some complete
+    if (!rio_notify(o)) {
+        report_error(o);
+        return;
+    }
+}
+
+static void rio_deliver (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->aborted)
+    ASSERT(o->recv.rio.inited)
+    ASSERT(o->recv.data_have)
+    ASSERT(o->recv.rio.results_pos < o->recv.rio.results_num)
+    
+    RIORESULT *result = &o->recv.rio.results[o->recv.rio.results_pos++];
+    int slot = (int)result->RequestContext;
+    ASSERT(slot >= 0)
+    ASSERT(slot < o->recv.rio.batch)
+    
+    if (result->Status != 0) {
+        BLog(BLOG_ERROR, "receiving failed (%d)", (int)result->Status);
+        report_error(o);
+        return;
+    }
+    
+    int bytes = result->BytesTransferred;
+    ASSERT(bytes >= 0)
+    ASSERT(bytes <= o->recv.mtu)
+    
+    char *base = o->recv.rio.mem + (size_t)slot * o->recv.rio.slot_size;
+    
+    // copy out the datagram
+    memcpy(o->recv.data, base, bytes);
+    
+    // read remote address
+    memcpy(&o->recv.sysaddr.addr, base + o->recv.rio.addr_offset, sizeof(o->recv.sysaddr.addr));
+    o->recv.sysaddr.len = (o->recv.sysaddr.addr.generic.sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+    addr_sys_to_socket(&o->recv.remote_addr, o->recv.sysaddr);
+    
+    // read local address; the control messages follow a RIO_CMSG_BUFFER
+    RIO_CMSG_BUFFER *cbuf = (RIO_CMSG_BUFFER *)(base + o->recv.rio.control_offset);
+    WSAMSG msg;
+    memset(&msg, 0, sizeof(msg));
+    if (cbuf->TotalLength > WSA_CMSGHDR_ALIGN(sizeof(RIO_CMSG_BUFFER)) && cbuf->TotalLength <= o->recv.rio.control_len) {
+        msg.Control.buf = (char *)cbuf + WSA_CMSGHDR_ALIGN(sizeof(RIO_CMSG_BUFFER));
+        msg.Control.len = cbuf->TotalLength - WSA_CMSGHDR_ALIGN(sizeof(RIO_CMSG_BUFFER));
+    }
+    read_pktinfo(&msg, &o->recv.local_addr);
+    
+    // the slot is free again, receive into it
+    if (!rio_post(o, slot, 0)) {
+        report_error(o);
+        return;
+    }
+    
+    // all completions taken, get notified of more
+    if (o->recv.rio.results_pos == o->recv.rio.results_num && !rio_notify(o)) {
+        report_error(o);
+        return;
     }
     
     // set have addresses
@@ -476,6 +794,45 @@ static void recv_olap_handler (BDatagram *o, int event, DWORD bytes)
     PacketRecvInterface_Done(&o->recv.iface, bytes);
 }
 
+static void rio_olap_handler (BDatagram *o, int event, DWORD bytes)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->aborted)
+    ASSERT(o->recv.rio.inited)
+    ASSERT(o->recv.rio.notify_busy)
+    ASSERT(o->recv.rio.results_pos == o->recv.rio.results_num)
+    ASSERT(event == BREACTOR_IOCP_EVENT_SUCCEEDED || event == BREACTOR_IOCP_EVENT_FAILED)
+    
+    o->recv.rio.notify_busy = 0;
+    
+    // take all the completed receives at once
+    ULONG num = o->rio.RIODequeueCompletion(o->recv.rio.cq, o->recv.rio.results, o->recv.rio.batch);
+    if (num == RIO_CORRUPT_CQ) {
+        BLog(BLOG_ERROR, "RIODequeueCompletion failed");
+        report_error(o);
+        return;
+    }
+    
+    ASSERT(num <= o->recv.rio.outstanding)
+    o->recv.rio.outstanding -= num;
+    o->recv.rio.results_num = num;
+    o->recv.rio.results_pos = 0;
+    
+    if (num == 0) {
+        if (!rio_notify(o)) {
+            report_error(o);
+        }
+        return;
+    }
+    
+    if (o->recv.inited && o->recv.data_have) {
+        rio_deliver(o);
+    }
+}
+
+#endif
+
 int BDatagram_AddressFamilySupported (int family)
 {
     return (family == BADDR_TYPE_IPV4 || family == BADDR_TYPE_IPV6);
@@ -493,14 +850,37 @@ int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
     o->user = user;
     o->handler = handler;
     
+#ifdef BADVPN_USE_WINRIO
+    // init socket, allowing Registered I/O where the system has it
+    o->have_rio = 1;
+    if ((o->sock = WSASocket(family_socket_to_sys(family), SOCK_DGRAM, 0, NULL, 0, WSA_FLAG_OVERLAPPED|WSA_FLAG_REGISTERED_IO)) == INVALID_SOCKET) {
+        o->have_rio = 0;
+        if ((o->sock = WSASocket(family_socket_to_sys(family), SOCK_DGRAM, 0, NULL, 0, WSA_FLAG_OVERLAPPED)) == INVALID_SOCKET) {
+            BLog(BLOG_ERROR, "WSASocket failed");
+            goto fail0;
+        }
+    }
+#else
     // init socket
     if ((o->sock = WSASocket(family_socket_to_sys(family), SOCK_DGRAM, 0, NULL, 0, WSA_FLAG_OVERLAPPED)) == INVALID_SOCKET) {
         BLog(BLOG_ERROR, "WSASocket failed");
         goto fail0;
     }
+#endif
     
     DWORD out_bytes;
     
+#ifdef BADVPN_USE_WINRIO
+    // obtain Registered I/O functions
+    if (o->have_rio) {
+        GUID guid_rio = WSAID_MULTIPLE_RIO;
+        o->rio.cbSize = sizeof(o->rio);
+        if (WSAIoctl(o->sock, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &guid_rio, sizeof(guid_rio), &o->rio, sizeof(o->rio), &out_bytes, NULL, NULL) != 0) {
+            o->have_rio = 0;
+        }
+    }
+#endif
+    
     // obtain WSASendMsg
     GUID guid1 = WSAID_WSASENDMSG;
     if (WSAIoctl(o->sock, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid1, sizeof(guid1), &o->fnWSASendMsg, sizeof(o->fnWSASendMsg), &out_bytes, NULL, NULL) != 0) {
@@ -547,6 +927,9 @@ int BDatagram_Init (BDatagram *o, int family, BReactor *reactor, void *user,
     // set recv not inited
     o->recv.inited = 0;
     
+    // set Registered I/O not inited
+    o->recv.rio.inited = 0;
+    
     DebugError_Init(&o->d_err, BReactor_PendingGroup(o->reactor));
     DebugObject_Init(&o->d_obj);
     return 1;
@@ -594,7 +977,7 @@ int BDatagram_Bind (BDatagram *o, BAddr addr)
         o->recv.started = 1;
         
         // continue receiving
-        if (o->recv.inited && o->recv.data_have) {
+        if (o->recv.inited && (o->recv.data_have || o->recv.rio.inited)) {
             ASSERT(!o->recv.data_busy)
             
             BPending_Set(&o->recv.job);
@@ -604,6 +987,17 @@ int BDatagram_Bind (BDatagram *o, BAddr addr)
     return 1;
 }
 
+int BDatagram_Connect (BDatagram *o, BAddr remote_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->aborted)
+    ASSERT(remote_addr.type == BADDR_TYPE_IPV4 || remote_addr.type == BADDR_TYPE_IPV6)
+    
+    BLog(BLOG_ERROR, "connect not supported");
+    return 0;
+}
+
 void BDatagram_SetSendAddrs (BDatagram *o, BAddr remote_addr, BIPAddr local_addr)
 {
     DebugObject_Access(&o->d_obj);
@@ -638,6 +1032,30 @@ int BDatagram_GetLastReceiveAddrs (BDatagram *o, BAddr *remote_addr, BIPAddr *lo
     return 1;
 }
 
+int BDatagram_GetLocalAddr (BDatagram *o, BAddr *local_addr)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // get address
+    struct BDatagram_sys_addr sysaddr;
+    int len = sizeof(sysaddr.addr);
+    if (getsockname(o->sock, &sysaddr.addr.generic, &len) < 0) {
+        BLog(BLOG_ERROR, "getsockname failed");
+        return 0;
+    }
+    sysaddr.len = len;
+    
+    // translate address
+    BAddr addr;
+    addr_sys_to_socket(&addr, sysaddr);
+    if (!(addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6) || BAddr_GetPort(&addr) == 0) {
+        return 0;
+    }
+    
+    *local_addr = addr;
+    return 1;
+}
+
 int BDatagram_SetReuseAddr (BDatagram *o, int reuse)
 {
     DebugObject_Access(&o->d_obj);
@@ -650,6 +1068,48 @@ int BDatagram_SetReuseAddr (BDatagram *o, int reuse)
     return 1;
 }
 
+int BDatagram_SetMark (BDatagram *o, uint32_t mark)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    BLog(BLOG_ERROR, "SO_MARK is not supported");
+    return 0;
+}
+
+int BDatagram_BindToDevice (BDatagram *o, const char *device)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(device)
+    
+    BLog(BLOG_ERROR, "SO_BINDTODEVICE is not supported");
+    return 0;
+}
+
+int BDatagram_SetBusyPoll (BDatagram *o, int usecs)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(usecs >= 0)
+    
+    BLog(BLOG_ERROR, "SO_BUSY_POLL is not supported");
+    return 0;
+}
+
+int BDatagram_SetDontFragment (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    BLog(BLOG_ERROR, "disabling fragmentation is not supported");
+    return 0;
+}
+
+int BDatagram_SetSegmentOffload (BDatagram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    BLog(BLOG_ERROR, "segmentation offload is not supported");
+    return 0;
+}
+
 void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
 {
     DebugObject_Access(&o->d_obj);
@@ -674,6 +1134,14 @@ void BDatagram_SendAsync_Init (BDatagram *o, int mtu)
     o->send.inited = 1;
 }
 
+int BDatagram_SendAsync_Init2 (BDatagram *o, int mtu, int batch)
+{
+    ASSERT(batch > 0)
+    
+    BDatagram_SendAsync_Init(o, mtu);
+    return 1;
+}
+
 void BDatagram_SendAsync_Free (BDatagram *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -726,6 +1194,30 @@ void BDatagram_RecvAsync_Init (BDatagram *o, int mtu)
     o->recv.inited = 1;
 }
 
+int BDatagram_RecvAsync_Init2 (BDatagram *o, int mtu, int batch)
+{
+    ASSERT(batch > 0)
+    
+    BDatagram_RecvAsync_Init(o, mtu);
+    
+#ifdef BADVPN_USE_WINRIO
+    // keep a batch of receives posted through Registered I/O
+    if (batch > 1 && mtu > 0 && o->have_rio) {
+        if (!rio_init(o, mtu, batch)) {
+            BLog(BLOG_WARNING, "not using Registered I/O");
+            return 1;
+        }
+        
+        // post receives if receiving has started
+        if (o->recv.started) {
+            BPending_Set(&o->recv.job);
+        }
+    }
+#endif
+    
+    return 1;
+}
+
 void BDatagram_RecvAsync_Free (BDatagram *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -736,6 +1228,17 @@ void BDatagram_RecvAsync_Free (BDatagram *o)
         datagram_abort(o);
     }
     
+#ifdef BADVPN_USE_WINRIO
+    // receives posted through Registered I/O are always busy
+    if (o->recv.rio.inited) {
+        if (o->recv.rio.posted) {
+            datagram_abort(o);
+        } else {
+            rio_free(o);
+        }
+    }
+#endif
+    
     // free job
     BPending_Free(&o->recv.job);
     
@@ -34,6 +34,9 @@
 #else
 #    include <mswsock.h>
 #endif
+#ifdef BADVPN_USE_WINRIO
+#include <misc/winrio.h>
+#endif
 
 #include <misc/debugerror.h>
 #include <base/DebugObject.h>
@@ -54,6 +57,10 @@ struct BDatagram_s {
     SOCKET sock;
     LPFN_WSASENDMSG fnWSASendMsg;
     LPFN_WSARECVMSG fnWSARecvMsg;
+#ifdef BADVPN_USE_WINRIO
+    int have_rio;
+    RIO_EXTENSION_FUNCTION_TABLE rio;
+#endif
     int aborted;
     struct {
         BReactorIOCPOverlapped olap;
@@ -93,6 +100,27 @@ struct BDatagram_s {
             char in6[WSA_CMSG_SPACE(sizeof(struct in6_pktinfo))];
         } cdata;
         WSAMSG msg;
+        struct {
+            int inited;
+#ifdef BADVPN_USE_WINRIO
+            int batch;
+            int slot_size;
+            int addr_offset;
+            int control_offset;
+            int control_len;
+            char *mem;
+            RIO_BUFFERID bufid;
+            RIO_CQ cq;
+            RIO_RQ rq;
+            BReactorIOCPOverlapped olap;
+            int posted;
+            int outstanding;
+            int notify_busy;
+            RIORESULT *results;
+            int results_num;
+            int results_pos;
+#endif
+        } rio;
     } recv;
     DebugError d_err;
     DebugObject d_obj;
@@ -27,6 +27,10 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stddef.h>
 #include <string.h>
 #include <inttypes.h>
@@ -41,14 +45,25 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+#define BPROCESS_USE_POSIX_SPAWN 1
+#include <spawn.h>
+#endif
+
 #include <misc/offset.h>
 #include <misc/open_standard_streams.h>
 #include <base/BLog.h>
 
 #include "BProcess.h"
 
+#include "BProcess_hash.h"
+#include <structure/CHash_impl.h>
+
 #include <generated/blog_channel_BProcess.h>
 
+// number of buckets the processes hash table starts with; it grows as needed
+#define BPROCESS_HASH_INITIAL_BUCKETS 64
+
 static void call_handler (BProcess *o, int normally, uint8_t normally_exit_status)
 {
     DEBUGERROR(&o->d_err, o->handler(o->user, normally, normally_exit_status))
@@ -56,14 +71,7 @@ static void call_handler (BProcess *o, int normally, uint8_t normally_exit_statu
 
 static BProcess * find_process (BProcessManager *o, pid_t pid)
 {
-    for (LinkedList1Node *node = LinkedList1_GetFirst(&o->processes); node; node = LinkedList1Node_Next(node)) {
-        BProcess *p = UPPER_OBJECT(node, BProcess, list_node);
-        if (p->pid == pid) {
-            return p;
-        }
-    }
-    
-    return NULL;
+    return BProcess__Hash_Lookup(&o->processes_hash, 0, pid).ptr;
 }
 
 static void work_signals (BProcessManager *o)
@@ -140,8 +148,12 @@ int BProcessManager_Init (BProcessManager *o, BReactor *reactor)
         goto fail0;
     }
     
-    // init processes list
-    LinkedList1_Init(&o->processes);
+    // init processes hash table
+    if (!BProcess__Hash_Init(&o->processes_hash, BPROCESS_HASH_INITIAL_BUCKETS)) {
+        BLog(BLOG_ERROR, "BProcess__Hash_Init failed");
+        goto fail1;
+    }
+    o->num_processes = 0;
     
     // init wait job
     BPending_Init(&o->wait_job, BReactor_PendingGroup(o->reactor), (BPending_handler)wait_job_handler, o);
@@ -150,18 +162,23 @@ int BProcessManager_Init (BProcessManager *o, BReactor *reactor)
     
     return 1;
     
+fail1:
+    BUnixSignal_Free(&o->signal, 1);
 fail0:
     return 0;
 }
 
 void BProcessManager_Free (BProcessManager *o)
 {
-    ASSERT(LinkedList1_IsEmpty(&o->processes))
+    ASSERT(o->num_processes == 0)
     DebugObject_Free(&o->d_obj);
     
     // free wait job
     BPending_Free(&o->wait_job);
     
+    // free processes hash table
+    BProcess__Hash_Free(&o->processes_hash);
+    
     // free signal handling
     BUnixSignal_Free(&o->signal, 1);
 }
@@ -181,17 +198,19 @@ static int fds_contains (const int *fds, int fd, size_t *pos)
     return 0;
 }
 
-int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, void *user, const char *file, char *const argv[], struct BProcess_params params)
+static int fds_contains_n (const int *fds, size_t num_fds, int fd)
 {
-    // init arguments
-    o->m = m;
-    o->handler = handler;
-    o->user = user;
-    
-    // count fds
-    size_t num_fds;
-    for (num_fds = 0; params.fds[num_fds] >= 0; num_fds++);
+    for (size_t i = 0; i < num_fds; i++) {
+        if (fds[i] == fd) {
+            return 1;
+        }
+    }
     
+    return 0;
+}
+
+static pid_t fork_process (const char *file, char *const argv[], struct BProcess_params params, size_t num_fds)
+{
     // block signals
     // needed to prevent parent's signal handlers from being called
     // in the child
@@ -200,7 +219,7 @@ int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, v
     sigset_t sset_old;
     if (sigprocmask(SIG_SETMASK, &sset_all, &sset_old) < 0) {
         BLog(BLOG_ERROR, "sigprocmask failed");
-        goto fail0;
+        return -1;
     }
     
     // fork
@@ -324,14 +343,158 @@ int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, v
     
     if (pid < 0) {
         BLog(BLOG_ERROR, "fork failed");
+        return -1;
+    }
+    
+    return pid;
+    
+}
+
+#ifdef BPROCESS_USE_POSIX_SPAWN
+
+static int spawn_process (const char *file, char *const argv[], struct BProcess_params params, size_t num_fds, pid_t *out_pid)
+{
+    ASSERT(!params.username)
+    
+    int res = 0;
+    
+    // find the highest target fd; standard streams are always targets
+    // since they are opened to /dev/null if not mapped
+    int max_target = 2;
+    for (size_t i = 0; i < num_fds; i++) {
+        if (params.fds_map[i] > max_target) {
+            max_target = params.fds_map[i];
+        }
+    }
+    
+    // duplicate the source fds above all targets, so that mapping them
+    // in order cannot clobber a source which is yet to be mapped; these
+    // are close-on-exec and disappear in the child along with everything
+    // else above the targets
+    int *tmp_fds = malloc((num_fds + 1) * sizeof(tmp_fds[0]));
+    if (!tmp_fds) {
+        goto fail0;
+    }
+    size_t num_tmp_fds;
+    for (num_tmp_fds = 0; num_tmp_fds < num_fds; num_tmp_fds++) {
+        if ((tmp_fds[num_tmp_fds] = fcntl(params.fds[num_tmp_fds], F_DUPFD_CLOEXEC, max_target + 1)) < 0) {
+            goto fail1;
+        }
+    }
+    
+    posix_spawn_file_actions_t actions;
+    if (posix_spawn_file_actions_init(&actions) != 0) {
+        goto fail1;
+    }
+    
+    posix_spawnattr_t attr;
+    if (posix_spawnattr_init(&attr) != 0) {
+        goto fail2;
+    }
+    
+    // close unmapped fds below the highest target
+    for (int fd = 0; fd < max_target; fd++) {
+        if (!fds_contains_n(params.fds_map, num_fds, fd) && posix_spawn_file_actions_addclose(&actions, fd) != 0) {
+            goto fail3;
+        }
+    }
+    
+    // map fds to requested fd numbers
+    for (size_t i = 0; i < num_fds; i++) {
+        if (posix_spawn_file_actions_adddup2(&actions, tmp_fds[i], params.fds_map[i]) != 0) {
+            goto fail3;
+        }
+    }
+    
+    // close everything else
+    if (posix_spawn_file_actions_addclosefrom_np(&actions, max_target + 1) != 0) {
+        goto fail3;
+    }
+    
+    // make sure standard streams are open
+    for (int fd = 0; fd <= 2; fd++) {
+        if (!fds_contains_n(params.fds_map, num_fds, fd) && posix_spawn_file_actions_addopen(&actions, fd, "/dev/null", O_RDWR, 0) != 0) {
+            goto fail3;
+        }
+    }
+    
+    // restore signal dispositions and unblock signals
+    sigset_t sset_all;
+    sigfillset(&sset_all);
+    sigset_t sset_none;
+    sigemptyset(&sset_none);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    
+    // make session leader if requested
+    if (params.do_setsid) {
+        flags |= POSIX_SPAWN_SETSID;
+    }
+    
+    if (posix_spawnattr_setsigdefault(&attr, &sset_all) != 0 ||
+        posix_spawnattr_setsigmask(&attr, &sset_none) != 0 ||
+        posix_spawnattr_setflags(&attr, flags) != 0
+    ) {
+        goto fail3;
+    }
+    
+    int err = posix_spawn(out_pid, file, &actions, &attr, argv, environ);
+    if (err != 0) {
+        BLog(BLOG_DEBUG, "posix_spawn failed (%d), falling back to fork", err);
+        goto fail3;
+    }
+    
+    res = 1;
+    
+fail3:
+    posix_spawnattr_destroy(&attr);
+fail2:
+    posix_spawn_file_actions_destroy(&actions);
+fail1:
+    while (num_tmp_fds-- > 0) {
+        close(tmp_fds[num_tmp_fds]);
+    }
+    free(tmp_fds);
+fail0:
+    return res;
+}
+
+#endif
+
+int BProcess_Init2 (BProcess *o, BProcessManager *m, BProcess_handler handler, void *user, const char *file, char *const argv[], struct BProcess_params params)
+{
+    // init arguments
+    o->m = m;
+    o->handler = handler;
+    o->user = user;
+    
+    // count fds
+    size_t num_fds;
+    for (num_fds = 0; params.fds[num_fds] >= 0; num_fds++);
+    
+    // start process, preferring posix_spawn() which avoids copying our
+    // address space; fork() is needed to switch user, and is also used if
+    // posix_spawn() fails for any reason so that errors are reported the
+    // same way as before (the child aborting)
+    pid_t pid;
+#ifdef BPROCESS_USE_POSIX_SPAWN
+    if (params.username || !spawn_process(file, argv, params, num_fds, &pid)) {
+        pid = fork_process(file, argv, params, num_fds);
+    }
+#else
+    pid = fork_process(file, argv, params, num_fds);
+#endif
+    
+    if (pid < 0) {
         goto fail0;
     }
     
     // remember pid
     o->pid = pid;
     
-    // add to processes list
-    LinkedList1_Append(&o->m->processes, &o->list_node);
+    // add to processes hash table
+    BProcess__HashRef ref = {o, o};
+    ASSERT_EXECUTE(BProcess__Hash_Insert(&o->m->processes_hash, 0, ref, NULL))
+    o->m->num_processes++;
     
     DebugObject_Init(&o->d_obj);
     DebugError_Init(&o->d_err, BReactor_PendingGroup(m->reactor));
@@ -365,8 +528,10 @@ void BProcess_Free (BProcess *o)
     DebugError_Free(&o->d_err);
     DebugObject_Free(&o->d_obj);
     
-    // remove from processes list
-    LinkedList1_Remove(&o->m->processes, &o->list_node);
+    // remove from processes hash table
+    BProcess__HashRef ref = {o, o};
+    BProcess__Hash_Remove(&o->m->processes_hash, 0, ref);
+    o->m->num_processes--;
 }
 
 int BProcess_Terminate (BProcess *o)
@@ -35,11 +35,16 @@
 
 #include <misc/debug.h>
 #include <misc/debugerror.h>
-#include <structure/LinkedList1.h>
+#include <structure/CHash.h>
 #include <base/DebugObject.h>
 #include <system/BUnixSignal.h>
 #include <base/BPending.h>
 
+struct BProcess_s;
+
+#include "BProcess_hash.h"
+#include <structure/CHash_decl.h>
+
 /**
  * Manages child processes.
  * There may be at most one process manager at any given time. This restriction is not
@@ -48,7 +53,8 @@
 typedef struct {
     BReactor *reactor;
     BUnixSignal signal;
-    LinkedList1 processes;
+    BProcess__Hash processes_hash;
+    size_t num_processes;
     BPending wait_job;
     DebugObject d_obj;
 } BProcessManager;
@@ -69,12 +75,12 @@ typedef void (*BProcess_handler) (void *user, int normally, uint8_t normally_exi
 /**
  * Represents a child process.
  */
-typedef struct {
+typedef struct BProcess_s {
     BProcessManager *m;
     BProcess_handler handler;
     void *user;
     pid_t pid;
-    LinkedList1Node list_node; // node in BProcessManager.processes
+    struct BProcess_s *hash_next; // link in BProcessManager.processes_hash
     DebugObject d_obj;
     DebugError d_err;
 } BProcess;
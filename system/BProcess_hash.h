@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME BProcess__Hash
+#define CHASH_PARAM_ENTRY struct BProcess_s
+#define CHASH_PARAM_LINK struct BProcess_s *
+#define CHASH_PARAM_KEY pid_t
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((struct BProcess_s *)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((size_t)(entry).ptr->pid)
+#define CHASH_PARAM_KEYHASH(arg, key) ((size_t)(key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->pid == (entry2).ptr->pid)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1) == (entry2).ptr->pid)
+#define CHASH_PARAM_ENTRY_NEXT hash_next
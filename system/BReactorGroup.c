@@ -0,0 +1,303 @@
+/**
+ * @file BReactorGroup.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#ifdef BADVPN_LINUX
+#include <sched.h>
+#endif
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <base/BLog.h>
+
+#include "BReactorGroup.h"
+
+#include <generated/blog_channel_BReactorGroup.h>
+
+static void * thread_func (void *arg);
+static void start_msg_handler (struct BReactorGroup_thread *t);
+static void stop_msg_handler (struct BReactorGroup_thread *t);
+static void quit_msg_handler (struct BReactorGroup_thread *t);
+static void pin_thread (struct BReactorGroup_thread *t);
+
+static void * thread_func (void *arg)
+{
+    struct BReactorGroup_thread *t = arg;
+    BReactorGroup *o = t->group;
+    
+    t->init_ok = 0;
+    
+    // init reactor
+    if (!BReactor_Init(&t->reactor)) {
+        BLog(BLOG_ERROR, "thread %d: BReactor_Init failed", t->index);
+        goto fail0;
+    }
+    
+    // init mailbox
+    if (!BReactorMailbox_Init(&t->mailbox, &t->reactor)) {
+        BLog(BLOG_ERROR, "thread %d: BReactorMailbox_Init failed", t->index);
+        goto fail1;
+    }
+    
+    // report success
+    t->init_ok = 1;
+    ASSERT_FORCE(sem_post(&o->sem) == 0)
+    
+    // run until quit message
+    BReactor_Exec(&t->reactor);
+    
+    BReactorMailbox_Free(&t->mailbox);
+    BReactor_Free(&t->reactor);
+    return NULL;
+    
+fail1:
+    BReactor_Free(&t->reactor);
+fail0:
+    ASSERT_FORCE(sem_post(&o->sem) == 0)
+    return NULL;
+}
+
+static void start_msg_handler (struct BReactorGroup_thread *t)
+{
+    BReactorGroup *o = t->group;
+    DebugObject_Access(&o->d_obj);
+    
+    o->handler_start(o->user, t->index, &t->reactor);
+    return;
+}
+
+static void stop_msg_handler (struct BReactorGroup_thread *t)
+{
+    BReactorGroup *o = t->group;
+    
+    o->handler_stop(o->user, t->index, &t->reactor);
+    
+    // report to BReactorGroup_Free
+    ASSERT_FORCE(sem_post(&o->sem) == 0)
+}
+
+static void quit_msg_handler (struct BReactorGroup_thread *t)
+{
+    BReactor_Quit(&t->reactor, 0);
+}
+
+static void pin_thread (struct BReactorGroup_thread *t)
+{
+#ifdef BADVPN_LINUX
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        BLog(BLOG_WARNING, "sched_getaffinity failed");
+        return;
+    }
+    
+    int num_cpus = CPU_COUNT(&allowed);
+    if (num_cpus <= 0) {
+        return;
+    }
+    
+    // find the allowed CPU for this thread
+    int target = t->index % num_cpus;
+    int cpu;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            if (target == 0) {
+                break;
+            }
+            target--;
+        }
+    }
+    ASSERT(cpu < CPU_SETSIZE)
+    
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    
+    int res = pthread_setaffinity_np(t->thread, sizeof(set), &set);
+    if (res != 0) {
+        BLog(BLOG_WARNING, "thread %d: pthread_setaffinity_np failed (%d)", t->index, res);
+        return;
+    }
+    
+    BLog(BLOG_INFO, "thread %d: pinned to CPU %d", t->index, cpu);
+#else
+    BLog(BLOG_WARNING, "pinning threads is not supported on this platform");
+#endif
+}
+
+int BReactorGroup_Init (BReactorGroup *o, int num_threads, int pin_threads, void *user,
+                        BReactorGroup_handler handler_start, BReactorGroup_handler handler_stop)
+{
+    ASSERT(num_threads > 0)
+    ASSERT(handler_start)
+    ASSERT(handler_stop)
+    
+    // init arguments
+    o->num_threads = num_threads;
+    o->user = user;
+    o->handler_start = handler_start;
+    o->handler_stop = handler_stop;
+    
+    // allocate threads
+    if (!(o->threads = BAllocArray(o->num_threads, sizeof(o->threads[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    // init semaphore
+    if (sem_init(&o->sem, 0, 0) < 0) {
+        BLog(BLOG_ERROR, "sem_init failed");
+        goto fail1;
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    
+    // start threads
+    int num_started;
+    for (num_started = 0; num_started < o->num_threads; num_started++) {
+        struct BReactorGroup_thread *t = &o->threads[num_started];
+        t->group = o;
+        t->index = num_started;
+        BReactorMailboxMessage_Init(&t->start_msg, (BReactorMailboxMessage_handler)start_msg_handler, t);
+        BReactorMailboxMessage_Init(&t->stop_msg, (BReactorMailboxMessage_handler)stop_msg_handler, t);
+        BReactorMailboxMessage_Init(&t->quit_msg, (BReactorMailboxMessage_handler)quit_msg_handler, t);
+        
+        if (pthread_create(&t->thread, NULL, thread_func, t) != 0) {
+            BLog(BLOG_ERROR, "pthread_create failed");
+            break;
+        }
+        
+        if (pin_threads) {
+            pin_thread(t);
+        }
+    }
+    
+    // wait for started threads to initialize
+    int ok = (num_started == o->num_threads);
+    for (int i = 0; i < num_started; i++) {
+        while (sem_wait(&o->sem) < 0);
+    }
+    for (int i = 0; i < num_started; i++) {
+        ok = ok && o->threads[i].init_ok;
+    }
+    
+    if (!ok) {
+        goto fail2;
+    }
+    
+    // let the threads set themselves up
+    for (int i = 0; i < o->num_threads; i++) {
+        BReactorMailbox_Thread_Post(&o->threads[i].mailbox, &o->threads[i].start_msg);
+    }
+    
+    return 1;
+    
+fail2:
+    for (int i = 0; i < num_started; i++) {
+        struct BReactorGroup_thread *t = &o->threads[i];
+        if (t->init_ok) {
+            BReactorMailbox_Thread_Post(&t->mailbox, &t->quit_msg);
+        }
+        ASSERT_FORCE(pthread_join(t->thread, NULL) == 0)
+    }
+    DebugObject_Free(&o->d_obj);
+    ASSERT_FORCE(sem_destroy(&o->sem) == 0)
+fail1:
+    BFree(o->threads);
+fail0:
+    return 0;
+}
+
+void BReactorGroup_Free (BReactorGroup *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // stop threads, waiting until all of them have freed their objects
+    for (int i = 0; i < o->num_threads; i++) {
+        BReactorMailbox_Thread_Post(&o->threads[i].mailbox, &o->threads[i].stop_msg);
+    }
+    for (int i = 0; i < o->num_threads; i++) {
+        while (sem_wait(&o->sem) < 0);
+    }
+    
+    // quit reactors and join threads
+    for (int i = 0; i < o->num_threads; i++) {
+        BReactorMailbox_Thread_Post(&o->threads[i].mailbox, &o->threads[i].quit_msg);
+    }
+    for (int i = 0; i < o->num_threads; i++) {
+        ASSERT_FORCE(pthread_join(o->threads[i].thread, NULL) == 0)
+    }
+    
+    // free semaphore
+    ASSERT_FORCE(sem_destroy(&o->sem) == 0)
+    
+    // free threads
+    BFree(o->threads);
+}
+
+int BReactorGroup_GetNumThreads (BReactorGroup *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_threads;
+}
+
+BReactor * BReactorGroup_GetReactor (BReactorGroup *o, int index)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(index >= 0)
+    ASSERT(index < o->num_threads)
+    
+    return &o->threads[index].reactor;
+}
+
+BReactorMailbox * BReactorGroup_GetMailbox (BReactorGroup *o, int index)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(index >= 0)
+    ASSERT(index < o->num_threads)
+    
+    return &o->threads[index].mailbox;
+}
+
+void BReactorGroup_Thread_Post (BReactorGroup *o, int index, BReactorMailboxMessage *msg)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(index >= 0)
+    ASSERT(index < o->num_threads)
+    
+    BReactorMailbox_Thread_Post(&o->threads[index].mailbox, msg);
+}
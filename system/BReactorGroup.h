@@ -0,0 +1,158 @@
+/**
+ * @file BReactorGroup.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * A set of event loops, each running its own {@link BReactor} in its own thread.
+ */
+
+#ifndef BADVPN_B_REACTOR_GROUP_H
+#define BADVPN_B_REACTOR_GROUP_H
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <system/BReactorMailbox.h>
+
+/**
+ * Handler called in a group thread, from a job closure of that thread's reactor.
+ * 
+ * @param user as in {@link BReactorGroup_Init}
+ * @param index index of the thread, in the range [0, num_threads)
+ * @param reactor reactor of the thread
+ */
+typedef void (*BReactorGroup_handler) (void *user, int index, BReactor *reactor);
+
+struct BReactorGroup_s;
+
+struct BReactorGroup_thread {
+    struct BReactorGroup_s *group;
+    int index;
+    pthread_t thread;
+    BReactor reactor;
+    BReactorMailbox mailbox;
+    BReactorMailboxMessage start_msg;
+    BReactorMailboxMessage stop_msg;
+    BReactorMailboxMessage quit_msg;
+    int init_ok;
+};
+
+/**
+ * Object which runs a number of threads, each with its own {@link BReactor}.
+ * 
+ * Each thread owns everything initialized in its reactor, and the threads
+ * communicate by posting {@link BReactorMailboxMessage} messages to each
+ * other's mailboxes. Objects such as {@link BConnection} can be moved
+ * between threads this way; see {@link BConnection_Release}.
+ * 
+ * Optionally, thread i is pinned to the i-th CPU (modulo the number of CPUs)
+ * which the process is allowed to run on.
+ */
+typedef struct BReactorGroup_s {
+    int num_threads;
+    void *user;
+    BReactorGroup_handler handler_start;
+    BReactorGroup_handler handler_stop;
+    struct BReactorGroup_thread *threads;
+    sem_t sem;
+    DebugObject d_obj;
+} BReactorGroup;
+
+/**
+ * Initializes the group, starting its threads.
+ * Once all reactors are running, handler_start is called in every thread.
+ * 
+ * @param o the object
+ * @param num_threads number of threads to run. Must be >0.
+ * @param pin_threads whether to pin threads to CPUs. This is only supported
+ *                    on Linux; elsewhere it is ignored.
+ * @param user argument to handlers
+ * @param handler_start handler called in each thread after all threads have
+ *                      started. Must not be NULL.
+ * @param handler_stop handler called in each thread when the group is being freed.
+ *                     It must free everything which was initialized in the reactor
+ *                     of the thread. Must not be NULL.
+ * @return 1 on success, 0 on failure
+ */
+int BReactorGroup_Init (BReactorGroup *o, int num_threads, int pin_threads, void *user,
+                        BReactorGroup_handler handler_start, BReactorGroup_handler handler_stop) WARN_UNUSED;
+
+/**
+ * Frees the group, stopping its threads.
+ * First handler_stop is called in every thread, and waited for. After that,
+ * messages must no longer be posted to any thread of the group. Then the
+ * reactors are stopped and the threads joined.
+ * Must not be called from a group thread.
+ * 
+ * @param o the object
+ */
+void BReactorGroup_Free (BReactorGroup *o);
+
+/**
+ * Returns the number of threads.
+ * 
+ * @param o the object
+ * @return number of threads
+ */
+int BReactorGroup_GetNumThreads (BReactorGroup *o);
+
+/**
+ * Returns the reactor of a thread.
+ * The reactor must only be used from its own thread.
+ * 
+ * @param o the object
+ * @param index index of the thread
+ * @return reactor
+ */
+BReactor * BReactorGroup_GetReactor (BReactorGroup *o, int index);
+
+/**
+ * Returns the mailbox of a thread.
+ * Messages may be posted to the mailbox from any thread, as with
+ * {@link BReactorGroup_Thread_Post}.
+ * 
+ * @param o the object
+ * @param index index of the thread
+ * @return mailbox
+ */
+BReactorMailbox * BReactorGroup_GetMailbox (BReactorGroup *o, int index);
+
+/**
+ * Posts a message to a thread.
+ * May be called from any thread.
+ * 
+ * @param o the object
+ * @param index index of the thread
+ * @param msg message to post, as in {@link BReactorMailbox_Thread_Post}
+ */
+void BReactorGroup_Thread_Post (BReactorGroup *o, int index, BReactorMailboxMessage *msg);
+
+#endif
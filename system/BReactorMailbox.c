@@ -0,0 +1,162 @@
+/**
+ * @file BReactorMailbox.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <misc/offset.h>
+#include <base/BLog.h>
+
+#include "BReactorMailbox.h"
+
+#include <generated/blog_channel_BReactorMailbox.h>
+
+static void thread_signal_handler (BThreadSignal *thread_signal);
+static void job_handler (BReactorMailbox *o);
+
+static void thread_signal_handler (BThreadSignal *thread_signal)
+{
+    BReactorMailbox *o = UPPER_OBJECT(thread_signal, BReactorMailbox, thread_signal);
+    DebugObject_Access(&o->d_obj);
+    
+    // allow posters to signal again; this must happen before taking the
+    // stack, so that anything pushed afterwards results in another signal
+    __atomic_store_n(&o->signalled, 0, __ATOMIC_SEQ_CST);
+    
+    // take all posted messages
+    BReactorMailboxMessage *msg = __atomic_exchange_n(&o->stack, NULL, __ATOMIC_SEQ_CST);
+    if (!msg) {
+        return;
+    }
+    
+    // reverse into posting order
+    BReactorMailboxMessage *batch_first = NULL;
+    BReactorMailboxMessage *batch_last = msg;
+    while (msg) {
+        BReactorMailboxMessage *next = msg->next;
+        msg->next = batch_first;
+        batch_first = msg;
+        msg = next;
+    }
+    
+    // append to the delivery list
+    if (o->first) {
+        o->last->next = batch_first;
+    } else {
+        o->first = batch_first;
+    }
+    o->last = batch_last;
+    
+    BPending_Set(&o->job);
+}
+
+static void job_handler (BReactorMailbox *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->first)
+    
+    // remove first message
+    BReactorMailboxMessage *msg = o->first;
+    o->first = msg->next;
+    
+    // continue with the rest later
+    if (o->first) {
+        BPending_Set(&o->job);
+    }
+    
+    // deliver message
+    msg->handler(msg->user);
+    return;
+}
+
+void BReactorMailboxMessage_Init (BReactorMailboxMessage *msg, BReactorMailboxMessage_handler handler, void *user)
+{
+    ASSERT(handler)
+    
+    msg->handler = handler;
+    msg->user = user;
+    msg->next = NULL;
+}
+
+int BReactorMailbox_Init (BReactorMailbox *o, BReactor *reactor)
+{
+    // init arguments
+    o->reactor = reactor;
+    
+    // init thread signal
+    if (!BThreadSignal_Init(&o->thread_signal, o->reactor, thread_signal_handler)) {
+        BLog(BLOG_ERROR, "BThreadSignal_Init failed");
+        goto fail0;
+    }
+    
+    // init job
+    BPending_Init(&o->job, BReactor_PendingGroup(o->reactor), (BPending_handler)job_handler, o);
+    
+    // init queues
+    o->stack = NULL;
+    o->signalled = 0;
+    o->first = NULL;
+    o->last = NULL;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+void BReactorMailbox_Free (BReactorMailbox *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free job
+    BPending_Free(&o->job);
+    
+    // free thread signal
+    BThreadSignal_Free(&o->thread_signal);
+}
+
+void BReactorMailbox_Thread_Post (BReactorMailbox *o, BReactorMailboxMessage *msg)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(msg->handler)
+    
+    // push onto stack
+    BReactorMailboxMessage *head = __atomic_load_n(&o->stack, __ATOMIC_RELAXED);
+    do {
+        msg->next = head;
+    } while (!__atomic_compare_exchange_n(&o->stack, &head, msg, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    
+    // wake up the reactor unless a wakeup is already on its way
+    if (!__atomic_exchange_n(&o->signalled, 1, __ATOMIC_SEQ_CST)) {
+        if (!BThreadSignal_Thread_Signal(&o->thread_signal)) {
+            BLog(BLOG_ERROR, "BThreadSignal_Thread_Signal failed");
+        }
+    }
+}
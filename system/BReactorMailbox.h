@@ -0,0 +1,125 @@
+/**
+ * @file BReactorMailbox.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Queue for passing messages to a {@link BReactor} from other threads.
+ */
+
+#ifndef BADVPN_B_REACTOR_MAILBOX_H
+#define BADVPN_B_REACTOR_MAILBOX_H
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <system/BReactor.h>
+#include <system/BThreadSignal.h>
+
+typedef struct BReactorMailboxMessage_s BReactorMailboxMessage;
+
+/**
+ * Handler called in the receiving reactor when a message is delivered.
+ * It is called from a job closure of the receiving reactor.
+ * When it is called, the message is no longer queued and may be posted again.
+ * 
+ * @param user as in {@link BReactorMailboxMessage_Init}
+ */
+typedef void (*BReactorMailboxMessage_handler) (void *user);
+
+/**
+ * A message which can be posted to a {@link BReactorMailbox}.
+ * The message is intrusive; the caller provides the storage, and it must
+ * remain valid until the handler is called.
+ */
+struct BReactorMailboxMessage_s {
+    BReactorMailboxMessage_handler handler;
+    void *user;
+    BReactorMailboxMessage *next;
+};
+
+/**
+ * Object which lets any thread post messages to a {@link BReactor}.
+ * 
+ * Posting is lock-free: messages are pushed onto an atomic stack, and the
+ * receiving reactor takes the whole stack at once and restores the posting
+ * order. The receiving reactor is woken up through a {@link BThreadSignal},
+ * which is only signalled when the mailbox goes from having been drained to
+ * having a message, so a burst of posts costs a single wakeup.
+ * Messages posted from one thread are delivered in the order they were posted.
+ */
+typedef struct {
+    BReactor *reactor;
+    BThreadSignal thread_signal;
+    BPending job;
+    BReactorMailboxMessage *stack;
+    int signalled;
+    BReactorMailboxMessage *first;
+    BReactorMailboxMessage *last;
+    DebugObject d_obj;
+} BReactorMailbox;
+
+/**
+ * Initializes a message.
+ * 
+ * @param msg the message
+ * @param handler handler called in the receiving reactor
+ * @param user argument to handler
+ */
+void BReactorMailboxMessage_Init (BReactorMailboxMessage *msg, BReactorMailboxMessage_handler handler, void *user);
+
+/**
+ * Initializes the mailbox.
+ * Must be called from the thread of the reactor.
+ * 
+ * @param o the object
+ * @param reactor reactor which will receive messages
+ * @return 1 on success, 0 on failure
+ */
+int BReactorMailbox_Init (BReactorMailbox *o, BReactor *reactor) WARN_UNUSED;
+
+/**
+ * Frees the mailbox.
+ * Must be called from the thread of the reactor, and no other thread may be
+ * posting to the mailbox anymore. Messages which were not yet delivered are
+ * discarded without calling their handlers.
+ * 
+ * @param o the object
+ */
+void BReactorMailbox_Free (BReactorMailbox *o);
+
+/**
+ * Posts a message to the mailbox.
+ * May be called from any thread, including the thread of the reactor.
+ * The message must not currently be queued in any mailbox.
+ * 
+ * @param o the object
+ * @param msg message to post
+ */
+void BReactorMailbox_Thread_Post (BReactorMailbox *o, BReactorMailboxMessage *msg);
+
+#endif
@@ -31,6 +31,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <inttypes.h>
 
 #ifdef BADVPN_USE_WINAPI
 #include <windows.h>
@@ -41,11 +42,18 @@
 #include <unistd.h>
 #endif
 
+#ifdef BADVPN_USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 #include <misc/debug.h>
 #include <misc/offset.h>
 #include <misc/balloc.h>
 #include <misc/compare.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
+#include <misc/probe.h>
 
 #include <system/BReactor.h>
 
@@ -57,6 +65,15 @@
 #define TIMER_STATE_INACTIVE 1
 #define TIMER_STATE_RUNNING 2
 #define TIMER_STATE_EXPIRED 3
+#define TIMER_STATE_WHEEL 4
+
+#define EDGE_LISTED_NONE 0
+#define EDGE_LISTED_READY 1
+#define EDGE_LISTED_DISPATCH 2
+
+#define URING_OP_STATE_IDLE 1
+#define URING_OP_STATE_PENDING 2
+#define URING_OP_STATE_READY 3
 
 static int compare_timers (BSmallTimer *t1, BSmallTimer *t2)
 {
@@ -74,7 +91,102 @@ static int compare_timers (BSmallTimer *t1, BSmallTimer *t2)
 static void assert_timer (BSmallTimer *bt)
 {
     ASSERT(bt->state == TIMER_STATE_INACTIVE || bt->state == TIMER_STATE_RUNNING ||
-           bt->state == TIMER_STATE_EXPIRED)
+           bt->state == TIMER_STATE_EXPIRED || bt->state == TIMER_STATE_WHEEL)
+}
+
+// The wheel is advanced in ticks of BREACTOR_WHEEL_GRANULARITY milliseconds.
+// A coarse timer has its expiration time rounded up to a tick, and is kept in
+// the slot of that tick; timers in a slot may belong to different rounds of
+// the wheel. A single normal timer is kept running for the earliest tick
+// whose slot is not empty, and its handler moves the due timers to the
+// expired list.
+
+static LinkedList1 * wheel_slot (BReactor *bsys, btime_t tick)
+{
+    ASSERT(tick >= 0)
+    
+    return &bsys->wheel.slots[tick % BREACTOR_WHEEL_SLOTS];
+}
+
+static void wheel_schedule (BReactor *bsys)
+{
+    if (bsys->wheel.num_timers == 0) {
+        return;
+    }
+    
+    for (int i = 0; i < BREACTOR_WHEEL_SLOTS; i++) {
+        btime_t tick = bsys->wheel.next_tick + i;
+        if (!LinkedList1_IsEmpty(wheel_slot(bsys, tick))) {
+            BReactor_SetSmallTimer(bsys, &bsys->wheel.timer, BTIMER_SET_ABSOLUTE, tick * BREACTOR_WHEEL_GRANULARITY);
+            return;
+        }
+    }
+    
+    ASSERT(0)
+}
+
+static void wheel_timer_handler (BSmallTimer *timer)
+{
+    BReactor *bsys = UPPER_OBJECT(timer, BReactor, wheel.timer);
+    
+    btime_t now = BReactor_GetTime(bsys);
+    ASSERT(now >= 0)
+    
+    // visit the slots of the ticks that have passed, but each slot only once
+    btime_t last_tick = now / BREACTOR_WHEEL_GRANULARITY;
+    btime_t tick = bsys->wheel.next_tick;
+    if (last_tick - tick >= BREACTOR_WHEEL_SLOTS) {
+        tick = last_tick - (BREACTOR_WHEEL_SLOTS - 1);
+    }
+    
+    for (; tick <= last_tick; tick++) {
+        LinkedList1 *slot = wheel_slot(bsys, tick);
+        
+        LinkedList1Node *node = LinkedList1_GetFirst(slot);
+        while (node) {
+            LinkedList1Node *next = LinkedList1Node_Next(node);
+            BSmallTimer *bt = UPPER_OBJECT(node, BSmallTimer, u.list_node);
+            ASSERT(bt->state == TIMER_STATE_WHEEL)
+            
+            // skip timers of later rounds
+            if (bt->absTime <= now) {
+                LinkedList1_Remove(slot, &bt->u.list_node);
+                bsys->wheel.num_timers--;
+                
+                LinkedList1_Append(&bsys->timers_expired_list, &bt->u.list_node);
+                bt->state = TIMER_STATE_EXPIRED;
+            }
+            
+            node = next;
+        }
+    }
+    
+    if (bsys->wheel.next_tick <= last_tick) {
+        bsys->wheel.next_tick = last_tick + 1;
+    }
+    
+    wheel_schedule(bsys);
+}
+
+static void wheel_insert (BReactor *bsys, BSmallTimer *bt, btime_t time)
+{
+    ASSERT(bt->is_coarse)
+    
+    // round up to a tick which has not been visited yet
+    btime_t tick = (time > 0 ? (time - 1) / BREACTOR_WHEEL_GRANULARITY + 1 : 0);
+    if (tick < bsys->wheel.next_tick) {
+        tick = bsys->wheel.next_tick;
+    }
+    
+    bt->absTime = tick * BREACTOR_WHEEL_GRANULARITY;
+    bt->state = TIMER_STATE_WHEEL;
+    LinkedList1_Append(wheel_slot(bsys, tick), &bt->u.list_node);
+    bsys->wheel.num_timers++;
+    
+    // make sure the wheel timer expires no later than this timer
+    if (!BSmallTimer_IsRunning(&bsys->wheel.timer) || bsys->wheel.timer.absTime > bt->absTime) {
+        BReactor_SetSmallTimer(bsys, &bsys->wheel.timer, BTIMER_SET_ABSOLUTE, bt->absTime);
+    }
 }
 
 static int move_expired_timers (BReactor *bsys, btime_t now)
@@ -98,11 +210,11 @@ static int move_expired_timers (BReactor *bsys, btime_t now)
         
         // add to expired timers list
         LinkedList1_Append(&bsys->timers_expired_list, &timer->u.list_node);
-
+        
         // set expired
         timer->state = TIMER_STATE_EXPIRED;
     }
-
+    
     return moved;
 }
 
@@ -165,10 +277,75 @@ static void set_iocp_ready (BReactorIOCPOverlapped *olap, int succeeded, DWORD b
     olap->is_ready = 1;
 }
 
+#ifdef BADVPN_USE_IOCP_BATCH
+
+static int iocp_entry_succeeded (OVERLAPPED_ENTRY *entry)
+{
+    // the status of the operation is left in the OVERLAPPED as an NTSTATUS;
+    // it stays zero for completions posted with PostQueuedCompletionStatus
+    return ((LONG)entry->lpOverlapped->Internal >= 0);
+}
+
+#endif
+
 #endif
 
 #ifdef BADVPN_USE_EPOLL
 
+static int epoll_edge_events (BFileDescriptor *bfd)
+{
+    ASSERT(bfd->epoll_edge)
+    
+    return ((bfd->epoll_edge_ready & bfd->waitEvents) | bfd->epoll_edge_oneshot);
+}
+
+static void epoll_edge_unlist (BReactor *bsys, BFileDescriptor *bfd)
+{
+    switch (bfd->epoll_edge_listed) {
+        case EDGE_LISTED_READY:
+            LinkedList1_Remove(&bsys->epoll_edge_ready_list, &bfd->epoll_edge_list_node);
+            break;
+        case EDGE_LISTED_DISPATCH:
+            LinkedList1_Remove(&bsys->epoll_edge_dispatch_list, &bfd->epoll_edge_list_node);
+            break;
+    }
+    
+    bfd->epoll_edge_listed = EDGE_LISTED_NONE;
+}
+
+static void epoll_edge_update (BReactor *bsys, BFileDescriptor *bfd)
+{
+    ASSERT(bfd->active)
+    ASSERT(bfd->epoll_edge)
+    
+    // An edge-triggered file descriptor is in one of the lists exactly
+    // when it has an event to report. New entries are dispatched after
+    // the next wait, like level-triggered events would be.
+    if (epoll_edge_events(bfd)) {
+        if (bfd->epoll_edge_listed == EDGE_LISTED_NONE) {
+            LinkedList1_Append(&bsys->epoll_edge_ready_list, &bfd->epoll_edge_list_node);
+            bfd->epoll_edge_listed = EDGE_LISTED_READY;
+        }
+    } else {
+        epoll_edge_unlist(bsys, bfd);
+    }
+}
+
+static void epoll_edge_schedule (BReactor *bsys)
+{
+    ASSERT(LinkedList1_IsEmpty(&bsys->epoll_edge_dispatch_list))
+    
+    // move ready edge-triggered file descriptors to the dispatch list
+    LinkedList1Node *list_node;
+    while (list_node = LinkedList1_GetFirst(&bsys->epoll_edge_ready_list)) {
+        BFileDescriptor *bfd = UPPER_OBJECT(list_node, BFileDescriptor, epoll_edge_list_node);
+        ASSERT(bfd->epoll_edge_listed == EDGE_LISTED_READY)
+        LinkedList1_Remove(&bsys->epoll_edge_ready_list, &bfd->epoll_edge_list_node);
+        LinkedList1_Append(&bsys->epoll_edge_dispatch_list, &bfd->epoll_edge_list_node);
+        bfd->epoll_edge_listed = EDGE_LISTED_DISPATCH;
+    }
+}
+
 static void set_epoll_fd_pointers (BReactor *bsys)
 {
     // Write pointers to our entry pointers into file descriptors.
@@ -180,10 +357,71 @@ static void set_epoll_fd_pointers (BReactor *bsys)
         BFileDescriptor *bfd = (BFileDescriptor *)event->data.ptr;
         ASSERT(bfd->active)
         ASSERT(!bfd->epoll_returned_ptr)
+        
+        // edge-triggered file descriptors only record readiness here,
+        // they are dispatched from the edge lists
+        if (bfd->epoll_edge) {
+            if ((event->events & EPOLLIN)) {
+                bfd->epoll_edge_ready |= BREACTOR_READ;
+            }
+            if ((event->events & EPOLLOUT)) {
+                bfd->epoll_edge_ready |= BREACTOR_WRITE;
+            }
+            if ((event->events & EPOLLERR)) {
+                bfd->epoll_edge_oneshot |= BREACTOR_ERROR;
+            }
+            if ((event->events & EPOLLHUP)) {
+                bfd->epoll_edge_oneshot |= BREACTOR_HUP;
+            }
+            epoll_edge_update(bsys, bfd);
+            event->data.ptr = NULL;
+            continue;
+        }
+        
         bfd->epoll_returned_ptr = (BFileDescriptor **)&event->data.ptr;
     }
 }
 
+static int epoll_busy_poll (BReactor *bsys, int have_timeout, btime_t timeout_abs)
+{
+    ASSERT(bsys->busy_poll_usecs > 0)
+    ASSERT(bsys->epoll_results_num == 0)
+    
+    struct timespec start;
+    ASSERT_FORCE(clock_gettime(CLOCK_MONOTONIC, &start) == 0)
+    
+    while (1) {
+        int waitres = epoll_wait(bsys->efd, bsys->epoll_results, bsys->results_max, 0);
+        if (waitres < 0) {
+            int error = errno;
+            if (error != EINTR) {
+                perror("epoll_wait");
+                ASSERT_FORCE(0)
+            }
+            waitres = 0;
+        }
+        
+        ASSERT_FORCE(waitres <= bsys->results_max)
+        
+        if (waitres > 0) {
+            return waitres;
+        }
+        
+        // stop when a timer is due
+        if (have_timeout && btime_gettime() >= timeout_abs) {
+            return 0;
+        }
+        
+        // stop when the time is up
+        struct timespec ts;
+        ASSERT_FORCE(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        int64_t elapsed = (int64_t)(ts.tv_sec - start.tv_sec) * 1000000 + (ts.tv_nsec - start.tv_nsec) / 1000;
+        if (elapsed >= bsys->busy_poll_usecs) {
+            return 0;
+        }
+    }
+}
+
 #endif
 
 #ifdef BADVPN_USE_KEVENT
@@ -269,16 +507,183 @@ static void set_poll_fd_pointers (BReactor *bsys)
 
 #endif
 
+#ifdef BADVPN_USE_IO_URING
+
+static int uring_enter (BReactor *bsys, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, bsys->uring.fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void uring_reap (BReactor *bsys)
+{
+    ASSERT(bsys->uring.enabled)
+    
+    unsigned int head = *bsys->uring.cq_head;
+    unsigned int tail = __atomic_load_n(bsys->uring.cq_tail, __ATOMIC_ACQUIRE);
+    
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &bsys->uring.cqes[head & *bsys->uring.cq_mask];
+        head++;
+        
+        // completions of cancel requests have no operation
+        if (cqe->user_data == 0) {
+            continue;
+        }
+        
+        BReactorIOUringOp *op = (BReactorIOUringOp *)(uintptr_t)cqe->user_data;
+        ASSERT(op->reactor == bsys)
+        ASSERT(op->state == URING_OP_STATE_PENDING)
+        
+        // mark ready, to be dispatched from the event loop
+        op->state = URING_OP_STATE_READY;
+        op->result = cqe->res;
+        LinkedList1_Append(&bsys->uring.ready_list, &op->ready_list_node);
+    }
+    
+    __atomic_store_n(bsys->uring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void uring_submit (BReactor *bsys, unsigned int min_complete)
+{
+    ASSERT(bsys->uring.enabled)
+    
+    while (bsys->uring.to_submit > 0 || min_complete > 0) {
+        unsigned int flags = (min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+        int res = uring_enter(bsys, bsys->uring.to_submit, min_complete, flags);
+        if (res < 0) {
+            int error = errno;
+            if (error == EINTR) {
+                continue;
+            }
+            if (error == EAGAIN || error == EBUSY) {
+                // completion queue is backed up, make room
+                uring_reap(bsys);
+                continue;
+            }
+            BLog(BLOG_ERROR, "io_uring_enter failed: %d", error);
+            ASSERT_FORCE(0)
+        }
+        
+        ASSERT((unsigned int)res <= bsys->uring.to_submit)
+        bsys->uring.to_submit -= res;
+        
+        if (min_complete > 0) {
+            break;
+        }
+    }
+}
+
+static struct io_uring_sqe * uring_get_sqe (BReactor *bsys)
+{
+    ASSERT(bsys->uring.enabled)
+    
+    unsigned int tail = *bsys->uring.sq_tail;
+    
+    // if the submission queue is full, submit now
+    if (tail - __atomic_load_n(bsys->uring.sq_head, __ATOMIC_ACQUIRE) == bsys->uring.sq_entries) {
+        uring_submit(bsys, 0);
+        ASSERT_FORCE(tail - __atomic_load_n(bsys->uring.sq_head, __ATOMIC_ACQUIRE) < bsys->uring.sq_entries)
+    }
+    
+    struct io_uring_sqe *sqe = &bsys->uring.sqes[tail & *bsys->uring.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    
+    return sqe;
+}
+
+static void uring_push_sqe (BReactor *bsys)
+{
+    // publish the entry filled in after uring_get_sqe; it will be
+    // submitted when the reactor next waits
+    __atomic_store_n(bsys->uring.sq_tail, *bsys->uring.sq_tail + 1, __ATOMIC_RELEASE);
+    bsys->uring.to_submit++;
+}
+
+static void uring_fd_handler (BReactor *bsys, int events)
+{
+    uring_reap(bsys);
+}
+
+static void uring_start_op (BReactorIOUringOp *o, int opcode, int fd, uint64_t addr, uint32_t len, uint32_t msg_flags)
+{
+    BReactor *bsys = o->reactor;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state == URING_OP_STATE_IDLE)
+    
+    struct io_uring_sqe *sqe = uring_get_sqe(bsys);
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->len = len;
+    sqe->msg_flags = msg_flags;
+    sqe->user_data = (uintptr_t)o;
+    uring_push_sqe(bsys);
+    
+    o->state = URING_OP_STATE_PENDING;
+}
+
+#endif
+
+static void update_results_array (BReactor *bsys)
+{
+    ASSERT(bsys->results_max_want > 0)
+    
+    if (bsys->results_max_want == bsys->results_max) {
+        return;
+    }
+    
+    #ifdef BADVPN_USE_EPOLL
+    ASSERT(bsys->epoll_results_num == 0)
+    struct epoll_event *new_results = BAllocArray(bsys->results_max_want, sizeof(new_results[0]));
+    if (!new_results) {
+        BLog(BLOG_ERROR, "BAllocArray failed, keeping %d results", bsys->results_max);
+        bsys->results_max_want = bsys->results_max;
+        return;
+    }
+    BFree(bsys->epoll_results);
+    bsys->epoll_results = new_results;
+    #endif
+    
+    #ifdef BADVPN_USE_KEVENT
+    ASSERT(bsys->kevent_results_num == 0)
+    struct kevent *new_results = BAllocArray(bsys->results_max_want, sizeof(new_results[0]));
+    if (!new_results) {
+        BLog(BLOG_ERROR, "BAllocArray failed, keeping %d results", bsys->results_max);
+        bsys->results_max_want = bsys->results_max;
+        return;
+    }
+    BFree(bsys->kevent_results);
+    bsys->kevent_results = new_results;
+    #endif
+    
+    #ifdef BADVPN_USE_IOCP_BATCH
+    OVERLAPPED_ENTRY *new_results = (OVERLAPPED_ENTRY *)BAllocArray(bsys->results_max_want, sizeof(new_results[0]));
+    if (!new_results) {
+        BLog(BLOG_ERROR, "BAllocArray failed, keeping %d results", bsys->results_max);
+        bsys->results_max_want = bsys->results_max;
+        return;
+    }
+    BFree(bsys->iocp_results);
+    bsys->iocp_results = new_results;
+    #endif
+    
+    bsys->results_max = bsys->results_max_want;
+}
+
 static void wait_for_events (BReactor *bsys)
 {
-    // must have processed all pending events
-    ASSERT(!BPendingGroup_HasJobs(&bsys->pending_jobs))
+    // must have processed all pending events, except jobs left over by the job budget
+    ASSERT(!BPendingGroup_HasJobs(&bsys->pending_jobs) || bsys->job_budget_left < 0)
     ASSERT(LinkedList1_IsEmpty(&bsys->timers_expired_list))
     #ifdef BADVPN_USE_WINAPI
     ASSERT(LinkedList1_IsEmpty(&bsys->iocp_ready_list))
     #endif
     #ifdef BADVPN_USE_EPOLL
     ASSERT(bsys->epoll_results_pos == bsys->epoll_results_num)
+    ASSERT(LinkedList1_IsEmpty(&bsys->epoll_edge_dispatch_list))
+    #endif
+    #ifdef BADVPN_USE_IO_URING
+    ASSERT(LinkedList1_IsEmpty(&bsys->uring.ready_list))
     #endif
     #ifdef BADVPN_USE_KEVENT
     ASSERT(bsys->kevent_results_pos == bsys->kevent_results_num)
@@ -286,7 +691,7 @@ static void wait_for_events (BReactor *bsys)
     #ifdef BADVPN_USE_POLL
     ASSERT(bsys->poll_results_pos == bsys->poll_results_num)
     #endif
-
+    
     // clean up epoll results
     #ifdef BADVPN_USE_EPOLL
     bsys->epoll_results_num = 0;
@@ -305,9 +710,30 @@ static void wait_for_events (BReactor *bsys)
     bsys->poll_results_pos = 0;
     #endif
     
+    // resize results array if requested
+    update_results_array(bsys);
+    
+    // don't block if edge-triggered file descriptors are known to be ready,
+    // or if jobs are waiting
+    #ifdef BADVPN_USE_EPOLL
+    int edge_nowait = !LinkedList1_IsEmpty(&bsys->epoll_edge_ready_list) || BPendingGroup_HasJobs(&bsys->pending_jobs);
+    #endif
+    
+    // submit queued io_uring operations with a single system call,
+    // and don't block if some have already completed
+    #ifdef BADVPN_USE_IO_URING
+    if (bsys->uring.enabled) {
+        uring_submit(bsys, 0);
+        uring_reap(bsys);
+        if (!LinkedList1_IsEmpty(&bsys->uring.ready_list)) {
+            edge_nowait = 1;
+        }
+    }
+    #endif
+    
     // timeout vars
     int have_timeout = 0;
-    btime_t timeout_abs;
+    btime_t timeout_abs = 0; // to remove warning
     btime_t now = 0; // to remove warning
     
     // compute timeout
@@ -321,6 +747,11 @@ static void wait_for_events (BReactor *bsys)
         // if some timers have already timed out, return them immediately
         if (move_expired_timers(bsys, now)) {
             BLog(BLOG_DEBUG, "Got already expired timers");
+            bsys->now = now;
+            bsys->now_valid = 1;
+            #ifdef BADVPN_USE_EPOLL
+            epoll_edge_schedule(bsys);
+            #endif
             return;
         }
         
@@ -329,6 +760,29 @@ static void wait_for_events (BReactor *bsys)
         timeout_abs = first_timer->absTime;
     }
     
+    // poll for a while before blocking
+    #ifdef BADVPN_USE_EPOLL
+    if (bsys->busy_poll_usecs > 0 && !edge_nowait) {
+        int waitres = epoll_busy_poll(bsys, have_timeout, timeout_abs);
+        if (waitres > 0) {
+            BLog(BLOG_DEBUG, "busy poll returned %d file descriptors", waitres);
+            bsys->epoll_results_num = waitres;
+            set_epoll_fd_pointers(bsys);
+            goto busy_poll_done;
+        }
+        
+        // time has passed while polling
+        if (have_timeout) {
+            now = btime_gettime();
+            if (now >= timeout_abs) {
+                BLog(BLOG_DEBUG, "timed out while busy polling");
+                move_first_timers(bsys);
+                goto busy_poll_done;
+            }
+        }
+    }
+    #endif
+    
     // wait until the timeout is reached or the file descriptor / handle in ready
     while (1) {
         // compute timeout
@@ -349,6 +803,36 @@ static void wait_for_events (BReactor *bsys)
             }
         }
         
+        #ifdef BADVPN_USE_IOCP_BATCH
+        
+        ULONG num = 0;
+        BOOL res = GetQueuedCompletionStatusEx(bsys->iocp_handle, bsys->iocp_results, bsys->results_max, &num, (have_timeout ? timeout_rel_trunc : INFINITE), FALSE);
+        
+        ASSERT_FORCE((res && num > 0) || have_timeout)
+        ASSERT_FORCE(num <= bsys->results_max)
+        
+        if (res || timeout_rel_trunc == timeout_rel) {
+            if (res) {
+                BLog(BLOG_DEBUG, "GetQueuedCompletionStatusEx returned %d events", (int)num);
+                
+                for (ULONG i = 0; i < num; i++) {
+                    BReactorIOCPOverlapped *olap = (BReactorIOCPOverlapped *)bsys->iocp_results[i].lpOverlapped;
+                    ASSERT_FORCE(olap)
+                    DebugObject_Access(&olap->d_obj);
+                    ASSERT(olap->reactor == bsys)
+                    ASSERT(!olap->is_ready)
+                    
+                    set_iocp_ready(olap, iocp_entry_succeeded(&bsys->iocp_results[i]), bsys->iocp_results[i].dwNumberOfBytesTransferred);
+                }
+            } else {
+                BLog(BLOG_DEBUG, "GetQueuedCompletionStatusEx timed out");
+                move_first_timers(bsys);
+            }
+            break;
+        }
+        
+        #else
+        
         DWORD bytes = 0;
         ULONG_PTR key;
         BReactorIOCPOverlapped *olap = NULL;
@@ -374,6 +858,8 @@ static void wait_for_events (BReactor *bsys)
         
         #endif
         
+        #endif
+        
         #ifdef BADVPN_USE_EPOLL
         
         if (have_timeout) {
@@ -384,7 +870,7 @@ static void wait_for_events (BReactor *bsys)
         
         BLog(BLOG_DEBUG, "Calling epoll_wait");
         
-        int waitres = epoll_wait(bsys->efd, bsys->epoll_results, BSYSTEM_MAX_RESULTS, (have_timeout ? timeout_rel_trunc : -1));
+        int waitres = epoll_wait(bsys->efd, bsys->epoll_results, bsys->results_max, (edge_nowait ? 0 : have_timeout ? timeout_rel_trunc : -1));
         if (waitres < 0) {
             int error = errno;
             if (error == EINTR) {
@@ -395,15 +881,15 @@ static void wait_for_events (BReactor *bsys)
             ASSERT_FORCE(0)
         }
         
-        ASSERT_FORCE(!(waitres == 0) || have_timeout)
-        ASSERT_FORCE(waitres <= BSYSTEM_MAX_RESULTS)
+        ASSERT_FORCE(!(waitres == 0) || have_timeout || edge_nowait)
+        ASSERT_FORCE(waitres <= bsys->results_max)
         
-        if (waitres != 0 || timeout_rel_trunc == timeout_rel) {
+        if (waitres != 0 || edge_nowait || timeout_rel_trunc == timeout_rel) {
             if (waitres != 0) {
                 BLog(BLOG_DEBUG, "epoll_wait returned %d file descriptors", waitres);
                 bsys->epoll_results_num = waitres;
                 set_epoll_fd_pointers(bsys);
-            } else {
+            } else if (!edge_nowait) {
                 BLog(BLOG_DEBUG, "epoll_wait timed out");
                 move_first_timers(bsys);
             }
@@ -425,7 +911,7 @@ static void wait_for_events (BReactor *bsys)
         
         BLog(BLOG_DEBUG, "Calling kevent");
         
-        int waitres = kevent(bsys->kqueue_fd, NULL, 0, bsys->kevent_results, BSYSTEM_MAX_RESULTS, (have_timeout ? &ts : NULL));
+        int waitres = kevent(bsys->kqueue_fd, NULL, 0, bsys->kevent_results, bsys->results_max, (have_timeout ? &ts : NULL));
         if (waitres < 0) {
             int error = errno;
             if (error == EINTR) {
@@ -437,7 +923,7 @@ static void wait_for_events (BReactor *bsys)
         }
         
         ASSERT_FORCE(!(waitres == 0) || have_timeout)
-        ASSERT_FORCE(waitres <= BSYSTEM_MAX_RESULTS)
+        ASSERT_FORCE(waitres <= bsys->results_max)
         
         if (waitres != 0 || timeout_rel_trunc == timeout_rel) {
             if (waitres != 0) {
@@ -524,7 +1010,7 @@ static void wait_for_events (BReactor *bsys)
         }
         
         #endif
-        
+    
     try_again:
         if (have_timeout) {
             // get current time
@@ -538,6 +1024,11 @@ static void wait_for_events (BReactor *bsys)
         }
     }
     
+    #ifdef BADVPN_USE_EPOLL
+busy_poll_done:
+    epoll_edge_schedule(bsys);
+    #endif
+    
     // reset limit objects
     LinkedList1Node *list_node;
     while (list_node = LinkedList1_GetFirst(&bsys->active_limits_list)) {
@@ -546,6 +1037,9 @@ static void wait_for_events (BReactor *bsys)
         limit->count = 0;
         LinkedList1_Remove(&bsys->active_limits_list, &limit->active_limits_list_node);
     }
+    
+    // time has passed while waiting
+    bsys->now_valid = 0;
 }
 
 #ifndef BADVPN_USE_WINAPI
@@ -556,6 +1050,10 @@ void BFileDescriptor_Init (BFileDescriptor *bs, int fd, BFileDescriptor_handler
     bs->handler = handler;
     bs->user = user;
     bs->active = 0;
+    
+    #ifdef BADVPN_USE_EPOLL
+    bs->epoll_edge = 0;
+    #endif
 }
 
 #endif
@@ -565,6 +1063,13 @@ void BSmallTimer_Init (BSmallTimer *bt, BSmallTimer_handler handler)
     bt->handler.smalll = handler;
     bt->state = TIMER_STATE_INACTIVE;
     bt->is_small = 1;
+    bt->is_coarse = 0;
+}
+
+void BSmallTimer_InitCoarse (BSmallTimer *bt, BSmallTimer_handler handler)
+{
+    BSmallTimer_Init(bt, handler);
+    bt->is_coarse = 1;
 }
 
 int BSmallTimer_IsRunning (BSmallTimer *bt)
@@ -579,10 +1084,17 @@ void BTimer_Init (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user
     bt->base.handler.heavy = handler;
     bt->base.state = TIMER_STATE_INACTIVE;
     bt->base.is_small = 0;
+    bt->base.is_coarse = 0;
     bt->user = user;
     bt->msTime = msTime;
 }
 
+void BTimer_InitCoarse (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user)
+{
+    BTimer_Init(bt, msTime, handler, user);
+    bt->base.is_coarse = 1;
+}
+
 int BTimer_IsRunning (BTimer *bt)
 {
     return BSmallTimer_IsRunning(&bt->base);
@@ -602,9 +1114,44 @@ int BReactor_Init (BReactor *bsys)
     BReactor__TimersTree_Init(&bsys->timers_tree);
     LinkedList1_Init(&bsys->timers_expired_list);
     
+    // init coarse timers wheel
+    for (int i = 0; i < BREACTOR_WHEEL_SLOTS; i++) {
+        LinkedList1_Init(&bsys->wheel.slots[i]);
+    }
+    bsys->wheel.num_timers = 0;
+    bsys->wheel.next_tick = 0;
+    BSmallTimer_Init(&bsys->wheel.timer, wheel_timer_handler);
+    
+    // no cached time yet
+    bsys->now_valid = 0;
+    
     // init limits
     LinkedList1_Init(&bsys->active_limits_list);
     
+    // set default results array size
+    bsys->results_max = BSYSTEM_MAX_RESULTS;
+    bsys->results_max_want = BSYSTEM_MAX_RESULTS;
+    
+    // set no socket fd flags
+    bsys->socket_fd_flags = 0;
+    
+    // set no busy polling
+    bsys->busy_poll_usecs = 0;
+    
+    // set no job budget
+    bsys->job_budget = 0;
+    bsys->job_budget_left = 0;
+    
+    // set no stall detection
+    bsys->stall_threshold_ns = 0;
+    bsys->stall_start = 0;
+    bsys->stall_worst_num = 0;
+    
+    #ifdef BADVPN_USE_IO_URING
+    // io_uring is enabled on request
+    bsys->uring.enabled = 0;
+    #endif
+    
     #ifdef BADVPN_USE_WINAPI
     
     // init IOCP list
@@ -619,6 +1166,14 @@ int BReactor_Init (BReactor *bsys)
     // init IOCP ready list
     LinkedList1_Init(&bsys->iocp_ready_list);
     
+    #ifdef BADVPN_USE_IOCP_BATCH
+    // allocate results array
+    if (!(bsys->iocp_results = (OVERLAPPED_ENTRY *)BAllocArray(bsys->results_max, sizeof(bsys->iocp_results[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    #endif
+    
     #endif
     
     #ifdef BADVPN_USE_EPOLL
@@ -629,10 +1184,20 @@ int BReactor_Init (BReactor *bsys)
         goto fail0;
     }
     
+    // allocate results array
+    if (!(bsys->epoll_results = BAllocArray(bsys->results_max, sizeof(bsys->epoll_results[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
     // init results array
     bsys->epoll_results_num = 0;
     bsys->epoll_results_pos = 0;
     
+    // init edge-triggered lists
+    LinkedList1_Init(&bsys->epoll_edge_ready_list);
+    LinkedList1_Init(&bsys->epoll_edge_dispatch_list);
+    
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -643,6 +1208,12 @@ int BReactor_Init (BReactor *bsys)
         goto fail0;
     }
     
+    // allocate results array
+    if (!(bsys->kevent_results = BAllocArray(bsys->results_max, sizeof(bsys->kevent_results[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
     // init results array
     bsys->kevent_results_num = 0;
     bsys->kevent_results_pos = 0;
@@ -684,6 +1255,18 @@ int BReactor_Init (BReactor *bsys)
     
     return 1;
     
+    #ifdef BADVPN_USE_IOCP_BATCH
+fail1:
+    ASSERT_FORCE(CloseHandle(bsys->iocp_handle))
+    #endif
+    #ifdef BADVPN_USE_EPOLL
+fail1:
+    ASSERT_FORCE(close(bsys->efd) == 0)
+    #endif
+    #ifdef BADVPN_USE_KEVENT
+fail1:
+    ASSERT_FORCE(close(bsys->kqueue_fd) == 0)
+    #endif
     #ifdef BADVPN_USE_POLL
 fail1:
     BFree(bsys->poll_results_pollfds);
@@ -698,6 +1281,22 @@ void BReactor_Free (BReactor *bsys)
 {
     DebugObject_Access(&bsys->d_obj);
     
+    #ifdef BADVPN_USE_IO_URING
+    if (bsys->uring.enabled) {
+        DebugCounter_Free(&bsys->uring.d_ops_ctr);
+        ASSERT(LinkedList1_IsEmpty(&bsys->uring.ready_list))
+        
+        // free ring
+        BReactor_RemoveFileDescriptor(bsys, &bsys->uring.bfd);
+        ASSERT_FORCE(munmap(bsys->uring.sqes, bsys->uring.sqes_size) == 0)
+        if (bsys->uring.cq_ring_ptr != bsys->uring.sq_ring_ptr) {
+            ASSERT_FORCE(munmap(bsys->uring.cq_ring_ptr, bsys->uring.cq_ring_size) == 0)
+        }
+        ASSERT_FORCE(munmap(bsys->uring.sq_ring_ptr, bsys->uring.sq_ring_size) == 0)
+        ASSERT_FORCE(close(bsys->uring.fd) == 0)
+    }
+    #endif
+    
     #ifdef BADVPN_USE_WINAPI
     while (!LinkedList1_IsEmpty(&bsys->iocp_list)) {
         BReactorIOCPOverlapped *olap = UPPER_OBJECT(LinkedList1_GetLast(&bsys->iocp_list), BReactorIOCPOverlapped, iocp_list_node);
@@ -706,6 +1305,10 @@ void BReactor_Free (BReactor *bsys)
     }
     #endif
     
+    // free coarse timers wheel
+    ASSERT(bsys->wheel.num_timers == 0)
+    BReactor_RemoveSmallTimer(bsys, &bsys->wheel.timer);
+    
     // {pending group has no BPending objects}
     ASSERT(!BPendingGroup_HasJobs(&bsys->pending_jobs))
     ASSERT(BReactor__TimersTree_IsEmpty(&bsys->timers_tree))
@@ -723,6 +1326,10 @@ void BReactor_Free (BReactor *bsys)
     DebugCounter_Free(&bsys->d_kevent_ctr);
     #endif
     DebugCounter_Free(&bsys->d_limits_ctr);
+    #ifdef BADVPN_USE_EPOLL
+    ASSERT(LinkedList1_IsEmpty(&bsys->epoll_edge_ready_list))
+    ASSERT(LinkedList1_IsEmpty(&bsys->epoll_edge_dispatch_list))
+    #endif
     #ifdef BADVPN_USE_POLL
     ASSERT(bsys->poll_num_enabled_fds == 0)
     ASSERT(LinkedList1_IsEmpty(&bsys->poll_enabled_fds_list))
@@ -732,6 +1339,11 @@ void BReactor_Free (BReactor *bsys)
     
     #ifdef BADVPN_USE_WINAPI
     
+    #ifdef BADVPN_USE_IOCP_BATCH
+    // free results array
+    BFree(bsys->iocp_results);
+    #endif
+    
     // close IOCP handle
     ASSERT_FORCE(CloseHandle(bsys->iocp_handle))
     
@@ -739,6 +1351,9 @@ void BReactor_Free (BReactor *bsys)
     
     #ifdef BADVPN_USE_EPOLL
     
+    // free results array
+    BFree(bsys->epoll_results);
+    
     // close epoll fd
     ASSERT_FORCE(close(bsys->efd) == 0)
     
@@ -746,6 +1361,9 @@ void BReactor_Free (BReactor *bsys)
     
     #ifdef BADVPN_USE_KEVENT
     
+    // free results array
+    BFree(bsys->kevent_results);
+    
     // close kqueue fd
     ASSERT_FORCE(close(bsys->kqueue_fd) == 0)
     
@@ -763,17 +1381,117 @@ void BReactor_Free (BReactor *bsys)
     BPendingGroup_Free(&bsys->pending_jobs);
 }
 
+static void stall_begin (BReactor *bsys, const char *source, int fd, void *handler, void *user)
+{
+    if (bsys->stall_threshold_ns == 0) {
+        return;
+    }
+    
+    bsys->stall_source = source;
+    bsys->stall_fd = fd;
+    bsys->stall_handler = handler;
+    bsys->stall_user = user;
+    bsys->stall_start = BMetrics_Now();
+}
+
+static void stall_record_worst (BReactor *bsys, uint64_t ns)
+{
+    struct BReactor_stall_entry *e = NULL;
+    
+    // find the handler, or else take a free entry, or else replace the
+    // entry with the shortest stall if this one is longer
+    for (int i = 0; i < bsys->stall_worst_num; i++) {
+        if (bsys->stall_worst[i].handler == bsys->stall_handler) {
+            e = &bsys->stall_worst[i];
+            break;
+        }
+    }
+    
+    if (!e) {
+        if (bsys->stall_worst_num < BREACTOR_STALL_WORST) {
+            e = &bsys->stall_worst[bsys->stall_worst_num++];
+        } else {
+            e = &bsys->stall_worst[0];
+            for (int i = 1; i < BREACTOR_STALL_WORST; i++) {
+                if (bsys->stall_worst[i].max_ns < e->max_ns) {
+                    e = &bsys->stall_worst[i];
+                }
+            }
+            if (e->max_ns >= ns) {
+                return;
+            }
+        }
+        e->source = bsys->stall_source;
+        e->handler = bsys->stall_handler;
+        e->count = 0;
+        e->max_ns = 0;
+    }
+    
+    e->count++;
+    if (ns > e->max_ns) {
+        e->max_ns = ns;
+    }
+}
+
+static void stall_end (BReactor *bsys)
+{
+    // nothing to do if stall detection was not on when the handler started
+    if (bsys->stall_start == 0) {
+        return;
+    }
+    
+    uint64_t ns = BMetrics_Now() - bsys->stall_start;
+    bsys->stall_start = 0;
+    
+    BMetrics_Observe(BMETRICS_HISTOGRAM_REACTOR_HANDLER_NS, ns);
+    
+    if (bsys->stall_threshold_ns == 0 || ns < bsys->stall_threshold_ns) {
+        return;
+    }
+    
+    BMetrics_Observe(BMETRICS_HISTOGRAM_REACTOR_STALL_NS, ns);
+    stall_record_worst(bsys, ns);
+    
+    if (bsys->stall_fd >= 0) {
+        BLog(BLOG_WARNING, "stall: %s handler %p (user %p, fd %d) ran for %"PRIu64" ms",
+             bsys->stall_source, bsys->stall_handler, bsys->stall_user, bsys->stall_fd, ns / 1000000);
+    } else {
+        BLog(BLOG_WARNING, "stall: %s handler %p (user %p) ran for %"PRIu64" ms",
+             bsys->stall_source, bsys->stall_handler, bsys->stall_user, ns / 1000000);
+    }
+}
+
 int BReactor_Exec (BReactor *bsys)
 {
     BLog(BLOG_DEBUG, "Entering event loop");
     
+    uint64_t dispatch_start = 0;
+    
+    bsys->job_budget_left = bsys->job_budget;
+    
     while (!bsys->exiting) {
-        // dispatch job
-        if (BPendingGroup_HasJobs(&bsys->pending_jobs)) {
+        // dispatch job, unless the job budget of this iteration has run out
+        if (BPendingGroup_HasJobs(&bsys->pending_jobs) && (bsys->job_budget == 0 || bsys->job_budget_left > 0)) {
+            if (bsys->job_budget > 0) {
+                bsys->job_budget_left--;
+            }
+            BPROBE(reactor_job);
+            if (bsys->stall_threshold_ns > 0) {
+                BSmallPending *job = BPendingGroup_PeekJob(&bsys->pending_jobs);
+                stall_begin(bsys, "job", -1, (void *)job->handler, job->user);
+            }
             BPendingGroup_ExecuteJob(&bsys->pending_jobs);
+            stall_end(bsys);
             continue;
         }
         
+        // the budget has run out; leave the remaining jobs until after
+        // the other events
+        if (bsys->job_budget_left == 0 && BPendingGroup_HasJobs(&bsys->pending_jobs)) {
+            BMetrics_Count(BMETRICS_COUNTER_REACTOR_JOB_BUDGET_EXHAUSTED, 1);
+            bsys->job_budget_left = -1;
+        }
+        
         // dispatch timer
         LinkedList1Node *list_node = LinkedList1_GetFirst(&bsys->timers_expired_list);
         if (list_node) {
@@ -788,12 +1506,16 @@ int BReactor_Exec (BReactor *bsys)
             
             // call handler
             BLog(BLOG_DEBUG, "Dispatching timer");
+            BPROBE1(reactor_timer, timer);
             if (timer->is_small) {
+                stall_begin(bsys, "timer", -1, (void *)timer->handler.smalll, timer);
                 timer->handler.smalll(timer);
             } else {
                 BTimer *btimer = UPPER_OBJECT(timer, BTimer, base);
+                stall_begin(bsys, "timer", -1, (void *)timer->handler.heavy, btimer->user);
                 timer->handler.heavy(btimer->user);
             }
+            stall_end(bsys);
             continue;
         }
         
@@ -813,7 +1535,34 @@ int BReactor_Exec (BReactor *bsys)
             int event = (olap->ready_succeeded ? BREACTOR_IOCP_EVENT_SUCCEEDED : BREACTOR_IOCP_EVENT_FAILED);
             
             // call handler
+            stall_begin(bsys, "iocp", -1, (void *)olap->handler, olap->user);
             olap->handler(olap->user, event, olap->ready_bytes);
+            stall_end(bsys);
+            continue;
+        }
+        
+        #endif
+        
+        #ifdef BADVPN_USE_IO_URING
+        
+        // dispatch io_uring completion
+        if (!LinkedList1_IsEmpty(&bsys->uring.ready_list)) {
+            BReactorIOUringOp *op = UPPER_OBJECT(LinkedList1_GetFirst(&bsys->uring.ready_list), BReactorIOUringOp, ready_list_node);
+            ASSERT(op->reactor == bsys)
+            ASSERT(op->state == URING_OP_STATE_READY)
+            
+            // remove from ready list
+            LinkedList1_Remove(&bsys->uring.ready_list, &op->ready_list_node);
+            
+            // set idle
+            op->state = URING_OP_STATE_IDLE;
+            
+            // call handler
+            BLog(BLOG_DEBUG, "Dispatching io_uring completion");
+            BPROBE2(reactor_uring, op, op->result);
+            stall_begin(bsys, "io_uring", -1, (void *)op->handler, op->user);
+            op->handler(op->user, op->result);
+            stall_end(bsys);
             continue;
         }
         
@@ -862,7 +1611,36 @@ int BReactor_Exec (BReactor *bsys)
             
             // call handler
             BLog(BLOG_DEBUG, "Dispatching file descriptor");
+            BPROBE2(reactor_fd, bfd->fd, events);
+            stall_begin(bsys, "fd", bfd->fd, (void *)bfd->handler, bfd->user);
             bfd->handler(bfd->user, events);
+            stall_end(bsys);
+            continue;
+        }
+        
+        // dispatch edge-triggered file descriptor
+        if (!LinkedList1_IsEmpty(&bsys->epoll_edge_dispatch_list)) {
+            BFileDescriptor *bfd = UPPER_OBJECT(LinkedList1_GetFirst(&bsys->epoll_edge_dispatch_list), BFileDescriptor, epoll_edge_list_node);
+            ASSERT(bfd->active)
+            ASSERT(bfd->epoll_edge)
+            ASSERT(bfd->epoll_edge_listed == EDGE_LISTED_DISPATCH)
+            
+            // calculate events to report
+            int events = epoll_edge_events(bfd);
+            ASSERT(events)
+            
+            // consume one-shot events; if still ready, the file descriptor
+            // goes to the ready list to be dispatched again after the next wait
+            epoll_edge_unlist(bsys, bfd);
+            bfd->epoll_edge_oneshot = 0;
+            epoll_edge_update(bsys, bfd);
+            
+            // call handler
+            BLog(BLOG_DEBUG, "Dispatching edge-triggered file descriptor");
+            BPROBE2(reactor_fd, bfd->fd, events);
+            stall_begin(bsys, "fd", bfd->fd, (void *)bfd->handler, bfd->user);
+            bfd->handler(bfd->user, events);
+            stall_end(bsys);
             continue;
         }
         
@@ -909,7 +1687,10 @@ int BReactor_Exec (BReactor *bsys)
                     
                     // call handler
                     BLog(BLOG_DEBUG, "Dispatching file descriptor");
+                    BPROBE2(reactor_fd, bfd->fd, events);
+                    stall_begin(bsys, "fd", bfd->fd, (void *)bfd->handler, bfd->user);
                     bfd->handler(bfd->user, events);
+                    stall_end(bsys);
                     continue;
                 } break;
                 
@@ -924,7 +1705,9 @@ int BReactor_Exec (BReactor *bsys)
                     
                     // call handler
                     BLog(BLOG_DEBUG, "Dispatching kevent");
+                    stall_begin(bsys, "kevent", -1, (void *)kev->handler, kev->user);
                     kev->handler(kev->user, event->fflags, event->data);
+                    stall_end(bsys);
                     continue;
                 } break;
                 
@@ -972,17 +1755,45 @@ int BReactor_Exec (BReactor *bsys)
             
             // call handler
             BLog(BLOG_DEBUG, "Dispatching file descriptor");
+            BPROBE2(reactor_fd, bfd->fd, events);
+            stall_begin(bsys, "fd", bfd->fd, (void *)bfd->handler, bfd->user);
             bfd->handler(bfd->user, events);
+            stall_end(bsys);
             continue;
         }
         
         #endif
         
+        // everything that was ready has been dispatched
+        BMetrics_ObserveSince(BMETRICS_HISTOGRAM_REACTOR_DISPATCH_NS, dispatch_start);
+        
+        #ifdef BADVPN_USE_EPOLL
+        BPROBE(reactor_wait_begin);
         wait_for_events(bsys);
+        BPROBE(reactor_wait_end);
+        #else
+        // only epoll can poll without blocking; go back to the leftover jobs
+        if (!BPendingGroup_HasJobs(&bsys->pending_jobs)) {
+            BPROBE(reactor_wait_begin);
+            wait_for_events(bsys);
+            BPROBE(reactor_wait_end);
+        }
+        #endif
+        
+        bsys->job_budget_left = bsys->job_budget;
+        
+        BMetrics_Count(BMETRICS_COUNTER_REACTOR_ITERATIONS, 1);
+        dispatch_start = BMetrics_Start();
     }
-
+    
     BLog(BLOG_DEBUG, "Exiting event loop, exit code %d", bsys->exit_code);
-
+    
+    // list the handlers which stalled the most
+    for (int i = 0; i < bsys->stall_worst_num; i++) {
+        struct BReactor_stall_entry *e = &bsys->stall_worst[i];
+        BLog(BLOG_NOTICE, "stalled by %s handler %p %d times, longest %"PRIu64" ms", e->source, e->handler, e->count, e->max_ns / 1000000);
+    }
+    
     return bsys->exit_code;
 }
 
@@ -1000,9 +1811,17 @@ void BReactor_SetSmallTimer (BReactor *bsys, BSmallTimer *bt, int mode, btime_t
     // unlink it if it's already in the list
     BReactor_RemoveSmallTimer(bsys, bt);
     
+    // coarse timers go to the wheel, unless they are to expire immediately
+    int to_wheel = (bt->is_coarse && !(mode == BTIMER_SET_RELATIVE && time <= 0));
+    
     // if mode is relative, add current time
     if (mode == BTIMER_SET_RELATIVE) {
-        time = btime_add(btime_gettime(), time);
+        time = btime_add(BReactor_GetTime(bsys), time);
+    }
+    
+    if (to_wheel) {
+        wheel_insert(bsys, bt, time);
+        return;
     }
     
     // set time
@@ -1024,16 +1843,22 @@ void BReactor_RemoveSmallTimer (BReactor *bsys, BSmallTimer *bt)
     if (bt->state == TIMER_STATE_INACTIVE) {
         return;
     }
-
+    
     if (bt->state == TIMER_STATE_EXPIRED) {
         // remove from expired list
         LinkedList1_Remove(&bsys->timers_expired_list, &bt->u.list_node);
-    } else {
+    }
+    else if (bt->state == TIMER_STATE_WHEEL) {
+        // remove from wheel slot
+        LinkedList1_Remove(wheel_slot(bsys, bt->absTime / BREACTOR_WHEEL_GRANULARITY), &bt->u.list_node);
+        bsys->wheel.num_timers--;
+    }
+    else {
         // remove from running tree
         BReactor__TimersTreeRef ref = {bt, bt};
         BReactor__TimersTree_Remove(&bsys->timers_tree, 0, ref);
     }
-
+    
     // set inactive
     bt->state = TIMER_STATE_INACTIVE;
 }
@@ -1058,11 +1883,56 @@ void BReactor_RemoveTimer (BReactor *bsys, BTimer *bt)
     return BReactor_RemoveSmallTimer(bsys, &bt->base);
 }
 
+btime_t BReactor_GetTime (BReactor *bsys)
+{
+    if (!bsys->now_valid) {
+        bsys->now = btime_gettime();
+        bsys->now_valid = 1;
+    }
+    
+    return bsys->now;
+}
+
 BPendingGroup * BReactor_PendingGroup (BReactor *bsys)
 {
     return &bsys->pending_jobs;
 }
 
+void BReactor_SetMaxResults (BReactor *bsys, int max_results)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(max_results > 0)
+    
+    // the array is resized when the reactor next waits, since
+    // results being dispatched are referenced from file descriptors
+    bsys->results_max_want = max_results;
+}
+
+void BReactor_SetBusyPoll (BReactor *bsys, int usecs)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(usecs >= 0)
+    
+    bsys->busy_poll_usecs = usecs;
+}
+
+void BReactor_SetJobBudget (BReactor *bsys, int budget)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(budget >= 0)
+    
+    bsys->job_budget = budget;
+    bsys->job_budget_left = budget;
+}
+
+void BReactor_SetStallThreshold (BReactor *bsys, int threshold_ms)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(threshold_ms >= 0)
+    
+    bsys->stall_threshold_ns = (uint64_t)threshold_ms * 1000000;
+}
+
 int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref)
 {
     ASSERT(ref)
@@ -1083,15 +1953,23 @@ int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref)
 #ifndef BADVPN_USE_WINAPI
 
 int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
+{
+    return BReactor_AddFileDescriptor2(bsys, bs, 0);
+}
+
+int BReactor_AddFileDescriptor2 (BReactor *bsys, BFileDescriptor *bs, int flags)
 {
     ASSERT(!bs->active)
     
     #ifdef BADVPN_USE_EPOLL
     
-    // add epoll entry
+    int edge = !!(flags & BREACTOR_FDFLAG_EDGE);
+    
+    // add epoll entry; edge-triggered entries monitor everything
+    // up front, so they never need to be modified
     struct epoll_event event;
     memset(&event, 0, sizeof(event));
-    event.events = 0;
+    event.events = (edge ? (EPOLLIN | EPOLLOUT | EPOLLET) : 0);
     event.data.ptr = bs;
     if (epoll_ctl(bsys->efd, EPOLL_CTL_ADD, bs->fd, &event) < 0) {
         int error = errno;
@@ -1102,6 +1980,12 @@ int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
     // set epoll returned pointer
     bs->epoll_returned_ptr = NULL;
     
+    // init edge-triggered state
+    bs->epoll_edge = edge;
+    bs->epoll_edge_ready = 0;
+    bs->epoll_edge_oneshot = 0;
+    bs->epoll_edge_listed = EDGE_LISTED_NONE;
+    
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -1141,9 +2025,9 @@ void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
 {
     ASSERT(bs->active)
     DebugCounter_Decrement(&bsys->d_fds_counter);
-
+    
     bs->active = 0;
-
+    
     #ifdef BADVPN_USE_EPOLL
     
     // delete epoll entry
@@ -1156,6 +2040,11 @@ void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
         *bs->epoll_returned_ptr = NULL;
     }
     
+    // remove from edge-triggered lists
+    if (bs->epoll_edge) {
+        epoll_edge_unlist(bsys, bs);
+    }
+    
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -1199,6 +2088,13 @@ void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int
     
     #ifdef BADVPN_USE_EPOLL
     
+    // edge-triggered entries don't need to be modified
+    if (bs->epoll_edge) {
+        bs->waitEvents = events;
+        epoll_edge_update(bsys, bs);
+        return;
+    }
+    
     // calculate epoll events
     int eevents = 0;
     if ((events & BREACTOR_READ)) {
@@ -1227,6 +2123,35 @@ void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int
     bs->waitEvents = events;
 }
 
+void BReactor_FileDescriptorDrained (BReactor *bsys, BFileDescriptor *bs, int events)
+{
+    ASSERT(bs->active)
+    ASSERT(!(events&~(BREACTOR_READ|BREACTOR_WRITE)))
+    
+    #ifdef BADVPN_USE_EPOLL
+    
+    if (bs->epoll_edge) {
+        bs->epoll_edge_ready &= ~events;
+        epoll_edge_update(bsys, bs);
+    }
+    
+    #endif
+}
+
+void BReactor_SetSocketFdFlags (BReactor *bsys, int flags)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    bsys->socket_fd_flags = flags;
+}
+
+int BReactor_GetSocketFdFlags (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return bsys->socket_fd_flags;
+}
+
 #endif
 
 void BReactorLimit_Init (BReactorLimit *o, BReactor *reactor, int limit)
@@ -1345,6 +2270,222 @@ void BReactorKEvent_Free (BReactorKEvent *o)
 
 #endif
 
+#ifdef BADVPN_USE_IO_URING
+
+int BReactor_EnableIOUring (BReactor *bsys, int entries)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(!bsys->uring.enabled)
+    ASSERT(entries > 0)
+    
+    // create ring
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if ((bsys->uring.fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+        BLog(BLOG_ERROR, "io_uring_setup failed: %d", errno);
+        goto fail0;
+    }
+    
+    bsys->uring.sq_entries = params.sq_entries;
+    bsys->uring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    bsys->uring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bsys->uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    
+    int single_mmap = !!(params.features & IORING_FEAT_SINGLE_MMAP);
+    if (single_mmap && bsys->uring.cq_ring_size > bsys->uring.sq_ring_size) {
+        bsys->uring.sq_ring_size = bsys->uring.cq_ring_size;
+    }
+    
+    // map rings
+    bsys->uring.sq_ring_ptr = mmap(NULL, bsys->uring.sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, bsys->uring.fd, IORING_OFF_SQ_RING);
+    if (bsys->uring.sq_ring_ptr == MAP_FAILED) {
+        BLog(BLOG_ERROR, "mmap failed");
+        goto fail1;
+    }
+    
+    if (single_mmap) {
+        bsys->uring.cq_ring_ptr = bsys->uring.sq_ring_ptr;
+    } else {
+        bsys->uring.cq_ring_ptr = mmap(NULL, bsys->uring.cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, bsys->uring.fd, IORING_OFF_CQ_RING);
+        if (bsys->uring.cq_ring_ptr == MAP_FAILED) {
+            BLog(BLOG_ERROR, "mmap failed");
+            goto fail2;
+        }
+    }
+    
+    bsys->uring.sqes = mmap(NULL, bsys->uring.sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, bsys->uring.fd, IORING_OFF_SQES);
+    if (bsys->uring.sqes == MAP_FAILED) {
+        BLog(BLOG_ERROR, "mmap failed");
+        goto fail3;
+    }
+    
+    // resolve ring fields
+    uint8_t *sq = bsys->uring.sq_ring_ptr;
+    bsys->uring.sq_head = (unsigned int *)(sq + params.sq_off.head);
+    bsys->uring.sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    bsys->uring.sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    bsys->uring.sq_array = (unsigned int *)(sq + params.sq_off.array);
+    uint8_t *cq = bsys->uring.cq_ring_ptr;
+    bsys->uring.cq_head = (unsigned int *)(cq + params.cq_off.head);
+    bsys->uring.cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    bsys->uring.cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    bsys->uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    
+    // submission queue slots map directly to entries
+    for (unsigned int i = 0; i < bsys->uring.sq_entries; i++) {
+        bsys->uring.sq_array[i] = i;
+    }
+    
+    // monitor ring fd for completions
+    BFileDescriptor_Init(&bsys->uring.bfd, bsys->uring.fd, (BFileDescriptor_handler)uring_fd_handler, bsys);
+    if (!BReactor_AddFileDescriptor(bsys, &bsys->uring.bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail4;
+    }
+    BReactor_SetFileDescriptorEvents(bsys, &bsys->uring.bfd, BREACTOR_READ);
+    
+    bsys->uring.to_submit = 0;
+    LinkedList1_Init(&bsys->uring.ready_list);
+    DebugCounter_Init(&bsys->uring.d_ops_ctr);
+    
+    bsys->uring.enabled = 1;
+    
+    BLog(BLOG_INFO, "io_uring enabled with %u entries", bsys->uring.sq_entries);
+    return 1;
+    
+fail4:
+    ASSERT_FORCE(munmap(bsys->uring.sqes, bsys->uring.sqes_size) == 0)
+fail3:
+    if (!single_mmap) {
+        ASSERT_FORCE(munmap(bsys->uring.cq_ring_ptr, bsys->uring.cq_ring_size) == 0)
+    }
+fail2:
+    ASSERT_FORCE(munmap(bsys->uring.sq_ring_ptr, bsys->uring.sq_ring_size) == 0)
+fail1:
+    ASSERT_FORCE(close(bsys->uring.fd) == 0)
+fail0:
+    return 0;
+}
+
+int BReactor_HasIOUring (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return bsys->uring.enabled;
+}
+
+void BReactorIOUringOp_Init (BReactorIOUringOp *o, BReactor *reactor, void *user, BReactorIOUringOp_handler handler)
+{
+    DebugObject_Access(&reactor->d_obj);
+    ASSERT(reactor->uring.enabled)
+    ASSERT(handler)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->user = user;
+    o->handler = handler;
+    
+    // set idle
+    o->state = URING_OP_STATE_IDLE;
+    
+    DebugCounter_Increment(&reactor->uring.d_ops_ctr);
+    DebugObject_Init(&o->d_obj);
+}
+
+void BReactorIOUringOp_Free (BReactorIOUringOp *o)
+{
+    BReactor *bsys = o->reactor;
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Decrement(&bsys->uring.d_ops_ctr);
+    ASSERT(o->state != URING_OP_STATE_PENDING)
+    
+    // remove from ready list
+    if (o->state == URING_OP_STATE_READY) {
+        LinkedList1_Remove(&bsys->uring.ready_list, &o->ready_list_node);
+    }
+}
+
+int BReactorIOUringOp_IsBusy (BReactorIOUringOp *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return (o->state != URING_OP_STATE_IDLE);
+}
+
+void BReactorIOUringOp_Read (BReactorIOUringOp *o, int fd, void *buf, size_t len)
+{
+    uring_start_op(o, IORING_OP_READ, fd, (uintptr_t)buf, len, 0);
+}
+
+void BReactorIOUringOp_ReadV (BReactorIOUringOp *o, int fd, const struct iovec *iov, int iovcnt)
+{
+    ASSERT(iovcnt > 0)
+    
+    uring_start_op(o, IORING_OP_READV, fd, (uintptr_t)iov, iovcnt, 0);
+}
+
+void BReactorIOUringOp_Write (BReactorIOUringOp *o, int fd, const void *buf, size_t len)
+{
+    uring_start_op(o, IORING_OP_WRITE, fd, (uintptr_t)buf, len, 0);
+}
+
+void BReactorIOUringOp_WriteV (BReactorIOUringOp *o, int fd, const struct iovec *iov, int iovcnt)
+{
+    ASSERT(iovcnt > 0)
+    
+    uring_start_op(o, IORING_OP_WRITEV, fd, (uintptr_t)iov, iovcnt, 0);
+}
+
+void BReactorIOUringOp_RecvMsg (BReactorIOUringOp *o, int fd, struct msghdr *msg)
+{
+    uring_start_op(o, IORING_OP_RECVMSG, fd, (uintptr_t)msg, 1, 0);
+}
+
+void BReactorIOUringOp_SendMsg (BReactorIOUringOp *o, int fd, const struct msghdr *msg)
+{
+    uring_start_op(o, IORING_OP_SENDMSG, fd, (uintptr_t)msg, 1, 0);
+}
+
+void BReactorIOUringOp_Cancel (BReactorIOUringOp *o)
+{
+    BReactor *bsys = o->reactor;
+    DebugObject_Access(&o->d_obj);
+    
+    if (o->state != URING_OP_STATE_PENDING) {
+        return;
+    }
+    
+    struct io_uring_sqe *sqe = uring_get_sqe(bsys);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)o;
+    sqe->user_data = 0;
+    uring_push_sqe(bsys);
+}
+
+int BReactorIOUringOp_Wait (BReactorIOUringOp *o)
+{
+    BReactor *bsys = o->reactor;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->state != URING_OP_STATE_IDLE)
+    
+    // wait for completions until we get one for this operation
+    while (o->state == URING_OP_STATE_PENDING) {
+        uring_submit(bsys, 1);
+        uring_reap(bsys);
+    }
+    
+    // remove from ready list
+    LinkedList1_Remove(&bsys->uring.ready_list, &o->ready_list_node);
+    
+    // set idle
+    o->state = URING_OP_STATE_IDLE;
+    
+    return o->result;
+}
+
+#endif
+
 #ifdef BADVPN_USE_WINAPI
 
 HANDLE BReactor_GetIOCPHandle (BReactor *reactor)
@@ -57,6 +57,16 @@
 #include <poll.h>
 #endif
 
+#ifdef BADVPN_USE_IO_URING
+#ifndef BADVPN_USE_EPOLL
+#error io_uring support requires the epoll backend
+#endif
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
 #include <stdint.h>
 
 #include <misc/debug.h>
@@ -82,7 +92,7 @@ typedef struct BSmallTimer_t *BReactor_timerstree_link;
  * The timer enters not running state before this function is invoked.
  * This function is being called from within the timer's previosly
  * associated reactor.
- *
+ * 
  * @param timer pointer to the timer. Use the {@link UPPER_OBJECT} macro
  *              to obtain the pointer to the containing structure.
  */
@@ -94,7 +104,7 @@ typedef void (*BSmallTimer_handler) (struct BSmallTimer_t *timer);
  * The timer enters not running state before this function is invoked.
  * This function is being called from within the timer's previosly
  * associated reactor.
- *
+ * 
  * @param user value passed to {@link BTimer_Init}
  */
 typedef void (*BTimer_handler) (void *user);
@@ -116,20 +126,37 @@ typedef struct BSmallTimer_t {
     int8_t tree_balance;
     uint8_t state;
     uint8_t is_small;
+    uint8_t is_coarse;
 } BSmallTimer;
 
 /**
  * Initializes the timer object.
  * The timer object is initialized in not running state.
- *
+ * 
  * @param bt the object
  * @param handler handler function invoked when the timer expires
  */
 void BSmallTimer_Init (BSmallTimer *bt, BSmallTimer_handler handler);
 
+/**
+ * Initializes the timer object as a coarse timer.
+ * The timer object is initialized in not running state.
+ * 
+ * A coarse timer may expire up to {@link BREACTOR_WHEEL_GRANULARITY}
+ * milliseconds after its expiration time, but starting and stopping it is
+ * constant time, as opposed to logarithmic in the number of running timers.
+ * This is intended for timeouts and keepalives which are restarted often
+ * but rarely expire. A coarse timer set to expire after zero or less
+ * milliseconds is handled like a normal timer, so it expires promptly.
+ * 
+ * @param bt the object
+ * @param handler handler function invoked when the timer expires
+ */
+void BSmallTimer_InitCoarse (BSmallTimer *bt, BSmallTimer_handler handler);
+
 /**
  * Checks if the timer is running.
- *
+ * 
  * @param bt the object
  * @return 1 if running, 0 if not running
  */
@@ -148,7 +175,7 @@ typedef struct {
 /**
  * Initializes the timer object.
  * The timer object is initialized in not running state.
- *
+ * 
  * @param bt the object
  * @param msTime default timeout in milliseconds
  * @param handler handler function invoked when the timer expires
@@ -156,9 +183,21 @@ typedef struct {
  */
 void BTimer_Init (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user);
 
+/**
+ * Initializes the timer object as a coarse timer.
+ * The timer object is initialized in not running state.
+ * See {@link BSmallTimer_InitCoarse} for the meaning of coarse timers.
+ * 
+ * @param bt the object
+ * @param msTime default timeout in milliseconds
+ * @param handler handler function invoked when the timer expires
+ * @param user value to pass to the handler function
+ */
+void BTimer_InitCoarse (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user);
+
 /**
  * Checks if the timer is running.
- *
+ * 
  * @param bt the object
  * @return 1 if running, 0 if not running
  */
@@ -173,13 +212,23 @@ struct BFileDescriptor_t;
 #define BREACTOR_ERROR (1 << 2)
 #define BREACTOR_HUP (1 << 3)
 
+/**
+ * Flag for {@link BReactor_AddFileDescriptor2}, requesting edge-triggered
+ * monitoring. With the epoll backend, the file descriptor is registered only
+ * once with the kernel and changing the monitored events does not require any
+ * system calls. In return, the user must call {@link BReactor_FileDescriptorDrained}
+ * whenever an operation on the file descriptor fails with EAGAIN.
+ * On other backends, this flag is ignored and monitoring is level-triggered.
+ */
+#define BREACTOR_FDFLAG_EDGE (1 << 0)
+
 /**
  * Handler function invoked by the reactor when one or more events are detected.
  * The events argument will contain a subset of the monitored events (BREACTOR_READ, BREACTOR_WRITE),
  * plus possibly the error event (BREACTOR_ERROR).
  * The file descriptor object is in active state, being called from within
  * the associated reactor.
- *
+ * 
  * @param user value passed to {@link BFileDescriptor_Init}
  * @param events bitmask composed of a subset of monitored events (BREACTOR_READ, BREACTOR_WRITE),
  *               and possibly the error event BREACTOR_ERROR and the hang-up event BREACTOR_HUP.
@@ -199,6 +248,11 @@ typedef struct BFileDescriptor_t {
     
     #ifdef BADVPN_USE_EPOLL
     struct BFileDescriptor_t **epoll_returned_ptr;
+    int epoll_edge;
+    int epoll_edge_ready;
+    int epoll_edge_oneshot;
+    int epoll_edge_listed;
+    LinkedList1Node epoll_edge_list_node;
     #endif
     
     #ifdef BADVPN_USE_KEVENT
@@ -215,7 +269,7 @@ typedef struct BFileDescriptor_t {
 /**
  * Intializes the file descriptor object.
  * The object is initialized in not active state.
- *
+ * 
  * @param bs file descriptor object to initialize
  * @param fb file descriptor to represent
  * @param handler handler function invoked by the reactor when a monitored event is detected
@@ -231,6 +285,21 @@ void BFileDescriptor_Init (BFileDescriptor *bs, int fd, BFileDescriptor_handler
 #define BSYSTEM_MAX_HANDLES 64
 #define BSYSTEM_MAX_POLL_FDS 4096
 
+// coarse timers are kept in a timer wheel with this many slots,
+// each covering this many milliseconds
+#define BREACTOR_WHEEL_SLOTS 512
+#define BREACTOR_WHEEL_GRANULARITY 128
+
+// number of handlers BReactor_SetStallThreshold keeps the longest stalls of
+#define BREACTOR_STALL_WORST 8
+
+struct BReactor_stall_entry {
+    const char *source;
+    void *handler;
+    int count;
+    uint64_t max_ns;
+};
+
 /**
  * Event loop that supports file desciptor (Linux) or HANDLE (Windows) events
  * and timers.
@@ -246,6 +315,18 @@ typedef struct {
     BReactor__TimersTree timers_tree;
     LinkedList1 timers_expired_list;
     
+    // coarse timers
+    struct {
+        LinkedList1 slots[BREACTOR_WHEEL_SLOTS];
+        int num_timers;
+        btime_t next_tick;
+        BSmallTimer timer;
+    } wheel;
+    
+    // cached time, see BReactor_GetTime
+    btime_t now;
+    int now_valid;
+    
     // limits
     LinkedList1 active_limits_list;
     
@@ -253,18 +334,75 @@ typedef struct {
     LinkedList1 iocp_list;
     HANDLE iocp_handle;
     LinkedList1 iocp_ready_list;
+    #ifdef BADVPN_USE_IOCP_BATCH
+    OVERLAPPED_ENTRY *iocp_results; // GetQueuedCompletionStatusEx results buffer
+    #endif
     #endif
     
+    // size of the results array, and requested size
+    int results_max;
+    int results_max_want;
+    
+    // flags socket objects pass to BReactor_AddFileDescriptor2
+    int socket_fd_flags;
+    
+    // how long to poll for events before blocking, see BReactor_SetBusyPoll
+    int busy_poll_usecs;
+    
+    // jobs per iteration, see BReactor_SetJobBudget; job_budget_left is
+    // -1 once the budget of the iteration has run out
+    int job_budget;
+    int job_budget_left;
+    
+    // stall detection, see BReactor_SetStallThreshold; stall_start is
+    // nonzero while a handler being measured runs
+    uint64_t stall_threshold_ns;
+    uint64_t stall_start;
+    const char *stall_source;
+    int stall_fd;
+    void *stall_handler;
+    void *stall_user;
+    struct BReactor_stall_entry stall_worst[BREACTOR_STALL_WORST];
+    int stall_worst_num;
+    
     #ifdef BADVPN_USE_EPOLL
     int efd; // epoll fd
-    struct epoll_event epoll_results[BSYSTEM_MAX_RESULTS]; // epoll returned events buffer
+    struct epoll_event *epoll_results; // epoll returned events buffer
     int epoll_results_num; // number of events in the array
     int epoll_results_pos; // number of events processed so far
+    LinkedList1 epoll_edge_ready_list; // edge-triggered fds to dispatch after the next wait
+    LinkedList1 epoll_edge_dispatch_list; // edge-triggered fds to dispatch after this wait
+    #endif
+    
+    #ifdef BADVPN_USE_IO_URING
+    struct {
+        int enabled;
+        int fd;
+        BFileDescriptor bfd;
+        unsigned int sq_entries;
+        void *sq_ring_ptr;
+        size_t sq_ring_size;
+        void *cq_ring_ptr;
+        size_t cq_ring_size;
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+        unsigned int *sq_head;
+        unsigned int *sq_tail;
+        unsigned int *sq_mask;
+        unsigned int *sq_array;
+        unsigned int *cq_head;
+        unsigned int *cq_tail;
+        unsigned int *cq_mask;
+        struct io_uring_cqe *cqes;
+        unsigned int to_submit;
+        LinkedList1 ready_list;
+        DebugCounter d_ops_ctr;
+    } uring;
     #endif
     
     #ifdef BADVPN_USE_KEVENT
     int kqueue_fd;
-    struct kevent kevent_results[BSYSTEM_MAX_RESULTS];
+    struct kevent *kevent_results;
     int kevent_results_num;
     int kevent_results_pos;
     #endif
@@ -292,7 +430,7 @@ typedef struct {
  * Initializes the reactor.
  * {@link BLog_Init} must have been done.
  * {@link BTime_Init} must have been done.
- *
+ * 
  * @param bsys the object
  * @return 1 on success, 0 on failure
  */
@@ -308,14 +446,14 @@ int BReactor_Init (BReactor *bsys) WARN_UNUSED;
  * There must be no file descriptors or handles registered
  * with this reactor.
  * There must be no {@link BReactorKEvent} objects in this reactor.
- *
+ * 
  * @param bsys the object
  */
 void BReactor_Free (BReactor *bsys);
 
 /**
  * Runs the event loop.
- *
+ * 
  * @param bsys the object
  * @return value passed to {@link BReactor_Quit}
  */
@@ -325,7 +463,7 @@ int BReactor_Exec (BReactor *bsys);
  * Causes the event loop ({@link BReactor_Exec}) to cease
  * dispatching events and return.
  * Any further calls of {@link BReactor_Exec} will return immediately.
- *
+ * 
  * @param bsys the object
  * @param code value {@link BReactor_Exec} should return. If this is
  *             called more than once, it will return the last code.
@@ -337,11 +475,12 @@ void BReactor_Quit (BReactor *bsys, int code);
  * The timer must have been initialized with {@link BSmallTimer_Init}.
  * If the timer is in running state, it must be associated with this reactor.
  * The timer enters running state, associated with this reactor.
- *
+ * 
  * @param bsys the object
  * @param bt timer to start
  * @param mode interpretation of time (BTIMER_SET_ABSOLUTE or BTIMER_SET_RELATIVE)
- * @param time absolute or relative expiration time
+ * @param time absolute or relative expiration time. Relative times are
+ *             relative to {@link BReactor_GetTime}.
  */
 void BReactor_SetSmallTimer (BReactor *bsys, BSmallTimer *bt, int mode, btime_t time);
 
@@ -349,7 +488,7 @@ void BReactor_SetSmallTimer (BReactor *bsys, BSmallTimer *bt, int mode, btime_t
  * Stops a timer.
  * If the timer is in running state, it must be associated with this reactor.
  * The timer enters not running state.
- *
+ * 
  * @param bsys the object
  * @param bt timer to stop
  */
@@ -360,7 +499,7 @@ void BReactor_RemoveSmallTimer (BReactor *bsys, BSmallTimer *bt);
  * The timer must have been initialized with {@link BTimer_Init}.
  * If the timer is in running state, it must be associated with this reactor.
  * The timer enters running state, associated with this reactor.
- *
+ * 
  * @param bsys the object
  * @param bt timer to start
  */
@@ -371,7 +510,7 @@ void BReactor_SetTimer (BReactor *bsys, BTimer *bt);
  * The timer must have been initialized with {@link BTimer_Init}.
  * If the timer is in running state, it must be associated with this reactor.
  * The timer enters running state, associated with this reactor.
- *
+ * 
  * @param bsys the object
  * @param bt timer to start
  * @param after relative expiration time
@@ -384,7 +523,7 @@ void BReactor_SetTimerAfter (BReactor *bsys, BTimer *bt, btime_t after);
  * If the timer is in running state, it must be associated with this reactor.
  * The timer enters running state, associated with this reactor.
  * The timer's expiration time is set to the time argument.
- *
+ * 
  * @param bsys the object
  * @param bt timer to start
  * @param time absolute expiration time (according to {@link btime_gettime})
@@ -395,7 +534,7 @@ void BReactor_SetTimerAbsolute (BReactor *bsys, BTimer *bt, btime_t time);
  * Stops a timer.
  * If the timer is in running state, it must be associated with this reactor.
  * The timer enters not running state.
- *
+ * 
  * @param bsys the object
  * @param bt timer to stop
  */
@@ -415,6 +554,20 @@ void BReactor_RemoveTimer (BReactor *bsys, BTimer *bt);
  */
 BPendingGroup * BReactor_PendingGroup (BReactor *bsys);
 
+/**
+ * Returns the current time, as cached by the reactor.
+ * The time is read from {@link btime_gettime} the first time this is
+ * called after the reactor has waited for events, and the same value is
+ * returned until the reactor waits again. This avoids reading the clock for
+ * every event, at the cost of not accounting for the time spent processing
+ * the events. Use {@link btime_gettime} where that matters.
+ * Timers set with relative times are relative to this time.
+ * 
+ * @param bsys the object
+ * @return current time, at most one event loop iteration old
+ */
+btime_t BReactor_GetTime (BReactor *bsys);
+
 /**
  * Executes pending jobs until either:
  *   - the reference job is reached, or
@@ -435,11 +588,72 @@ BPendingGroup * BReactor_PendingGroup (BReactor *bsys);
  */
 int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref);
 
+/**
+ * Sets the maximum number of events the reactor retrieves from the
+ * operating system with a single wait. The default is {@link BSYSTEM_MAX_RESULTS}.
+ * The new size takes effect the next time the reactor waits for events.
+ * Has no effect with backends that do not use a results array.
+ * 
+ * @param bsys the object
+ * @param max_results maximum number of events per wait. Must be >0.
+ */
+void BReactor_SetMaxResults (BReactor *bsys, int max_results);
+
+/**
+ * Makes the reactor poll for events without blocking for up to the given
+ * time before it blocks waiting for them. This saves the wakeup latency of a
+ * blocking wait at the cost of keeping a CPU busy, and is meant for reactors
+ * running on dedicated cores. The spinning stops early when a timer expires.
+ * Only has an effect with the epoll backend.
+ * See also {@link BDatagram_SetBusyPoll} for polling in the kernel.
+ * 
+ * @param bsys the object
+ * @param usecs polling time in microseconds, or 0 to always block right away
+ *              (the default). Must be >=0.
+ */
+void BReactor_SetBusyPoll (BReactor *bsys, int usecs);
+
+/**
+ * Enables detection of handlers which stall the event loop.
+ * The reactor then measures each job, timer, file descriptor and other
+ * event handler it dispatches, and logs a warning with the kind of event,
+ * the handler function and its argument, and the file descriptor if any,
+ * for every dispatch which takes at least the given time. If metrics are
+ * being recorded, all handler times go into the reactor_handler_ns histogram,
+ * and those over the threshold also into reactor_stall_ns. When
+ * {@link BReactor_Exec} returns, the handlers which stalled the longest are
+ * listed, up to BREACTOR_STALL_WORST of them.
+ * Measuring costs two clock readings per dispatched event.
+ * 
+ * @param bsys the object
+ * @param threshold_ms shortest handler run time to report, in milliseconds,
+ *                     or 0 to disable stall detection (the default). Must be >=0.
+ */
+void BReactor_SetStallThreshold (BReactor *bsys, int threshold_ms);
+
+/**
+ * Limits the number of jobs the reactor executes between two polls for
+ * events. Normally, all pending jobs are executed before the reactor looks at
+ * file descriptors and timers again, so a pipeline which keeps producing jobs
+ * delays everything else sharing the reactor. With a budget, once that many
+ * jobs have run in an iteration, the remaining jobs wait until the events
+ * already returned have been dispatched and the reactor has polled for new
+ * ones, without blocking. If metrics are being recorded, iterations in which
+ * the budget runs out are counted in reactor_job_budget_exhausted_total.
+ * Polling without blocking is only done with the epoll backend; with others,
+ * leftover jobs only wait for the events already returned.
+ * 
+ * @param bsys the object
+ * @param budget maximum number of jobs per iteration, or 0 for no limit
+ *               (the default). Must be >=0.
+ */
+void BReactor_SetJobBudget (BReactor *bsys, int budget);
+
 #ifndef BADVPN_USE_WINAPI
 
 /**
  * Starts monitoring a file descriptor.
- *
+ * 
  * @param bsys the object
  * @param bs file descriptor object. Must have been initialized with
  *           {@link BFileDescriptor_Init} Must be in not active state.
@@ -449,9 +663,30 @@ int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref);
  */
 int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs) WARN_UNUSED;
 
+/**
+ * Starts monitoring a file descriptor, with flags.
+ * 
+ * If the BREACTOR_FDFLAG_EDGE flag is given, the user must observe the
+ * following contract. Whenever a read or write operation on the file
+ * descriptor fails with EAGAIN, {@link BReactor_FileDescriptorDrained} must
+ * be called for the corresponding event before waiting for that event.
+ * Monitored events are still set with {@link BReactor_SetFileDescriptorEvents},
+ * and the handler is still invoked as long as a monitored event is known
+ * to be ready, so code written for level-triggered monitoring keeps working.
+ * 
+ * @param bsys the object
+ * @param bs file descriptor object. Must have been initialized with
+ *           {@link BFileDescriptor_Init} Must be in not active state.
+ *           On success, the file descriptor object enters active state,
+ *           associated with this reactor.
+ * @param flags bitmask of BREACTOR_FDFLAG_* flags
+ * @return 1 on success, 0 on failure
+ */
+int BReactor_AddFileDescriptor2 (BReactor *bsys, BFileDescriptor *bs, int flags) WARN_UNUSED;
+
 /**
  * Stops monitoring a file descriptor.
- *
+ * 
  * @param bsys the object
  * @param bs {@link BFileDescriptor} object. Must be in active state,
  *           associated with this reactor. The file descriptor object
@@ -461,7 +696,7 @@ void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs);
 
 /**
  * Sets monitored file descriptor events.
- *
+ * 
  * @param bsys the object
  * @param bs {@link BFileDescriptor} object. Must be in active state,
  *           associated with this reactor.
@@ -471,6 +706,37 @@ void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs);
  */
 void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int events);
 
+/**
+ * Reports that an operation on the file descriptor failed with EAGAIN, so the
+ * given events are no longer ready. This is required for file descriptors
+ * added with the BREACTOR_FDFLAG_EDGE flag; otherwise it does nothing.
+ * 
+ * @param bsys the object
+ * @param bs {@link BFileDescriptor} object. Must be in active state,
+ *           associated with this reactor.
+ * @param events events which are no longer ready. Must not have any bits other than
+ *               BREACTOR_READ and BREACTOR_WRITE.
+ */
+void BReactor_FileDescriptorDrained (BReactor *bsys, BFileDescriptor *bs, int events);
+
+/**
+ * Sets the flags which socket objects ({@link BConnection}, {@link BDatagram})
+ * created with this reactor pass to {@link BReactor_AddFileDescriptor2}.
+ * Does not affect existing objects. The default is zero.
+ * 
+ * @param bsys the object
+ * @param flags bitmask of BREACTOR_FDFLAG_* flags
+ */
+void BReactor_SetSocketFdFlags (BReactor *bsys, int flags);
+
+/**
+ * Returns the flags set by {@link BReactor_SetSocketFdFlags}.
+ * 
+ * @param bsys the object
+ * @return bitmask of BREACTOR_FDFLAG_* flags
+ */
+int BReactor_GetSocketFdFlags (BReactor *bsys);
+
 #endif
 
 typedef struct {
@@ -540,6 +806,142 @@ void BReactorKEvent_Free (BReactorKEvent *o);
 
 #endif
 
+#ifdef BADVPN_USE_IO_URING
+
+/**
+ * Handler function invoked when an io_uring operation completes.
+ * The operation is idle when this is called.
+ * 
+ * @param user value passed to {@link BReactorIOUringOp_Init}
+ * @param result result of the operation, as for the corresponding system call,
+ *               except that errors are reported as negative errno values
+ */
+typedef void (*BReactorIOUringOp_handler) (void *user, int result);
+
+/**
+ * An asynchronous operation submitted through the reactor's io_uring.
+ * Operations started from within the event loop are collected and submitted
+ * with a single system call just before the reactor waits for events.
+ */
+typedef struct {
+    BReactor *reactor;
+    void *user;
+    BReactorIOUringOp_handler handler;
+    int state;
+    int result;
+    LinkedList1Node ready_list_node;
+    DebugObject d_obj;
+} BReactorIOUringOp;
+
+/**
+ * Sets up an io_uring for the reactor. After this, objects such as
+ * {@link BConnection}, {@link BDatagram} and {@link BTap} created with this
+ * reactor perform their reads and writes as io_uring operations.
+ * Must be called before any such objects are created.
+ * 
+ * @param bsys the object
+ * @param entries requested number of submission queue entries. Must be >0.
+ * @return 1 on success, 0 on failure (e.g. kernel without io_uring support)
+ */
+int BReactor_EnableIOUring (BReactor *bsys, int entries) WARN_UNUSED;
+
+/**
+ * Checks whether the reactor has an io_uring set up by
+ * {@link BReactor_EnableIOUring}.
+ * 
+ * @param bsys the object
+ * @return 1 if io_uring is enabled, 0 if not
+ */
+int BReactor_HasIOUring (BReactor *bsys);
+
+/**
+ * Initializes an io_uring operation object, in idle state.
+ * The reactor must have io_uring enabled.
+ * 
+ * @param o the object
+ * @param reactor reactor to submit operations to
+ * @param user value passed to the handler
+ * @param handler handler called when an operation completes
+ */
+void BReactorIOUringOp_Init (BReactorIOUringOp *o, BReactor *reactor, void *user, BReactorIOUringOp_handler handler);
+
+/**
+ * Frees an io_uring operation object.
+ * There must be no operation in progress; use {@link BReactorIOUringOp_Cancel}
+ * and {@link BReactorIOUringOp_Wait} to finish it first.
+ * 
+ * @param o the object
+ */
+void BReactorIOUringOp_Free (BReactorIOUringOp *o);
+
+/**
+ * Checks whether an operation is in progress, i.e. started and its
+ * handler not yet called.
+ * 
+ * @param o the object
+ * @return 1 if busy, 0 if idle
+ */
+int BReactorIOUringOp_IsBusy (BReactorIOUringOp *o);
+
+/**
+ * Starts a read operation. The object must be idle.
+ * The buffer must remain valid until the operation completes.
+ */
+void BReactorIOUringOp_Read (BReactorIOUringOp *o, int fd, void *buf, size_t len);
+
+/**
+ * Starts a scatter read operation. The object must be idle.
+ * The I/O vector and the buffers it points to must remain valid until
+ * the operation completes.
+ */
+void BReactorIOUringOp_ReadV (BReactorIOUringOp *o, int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * Starts a write operation. The object must be idle.
+ * The buffer must remain valid until the operation completes.
+ */
+void BReactorIOUringOp_Write (BReactorIOUringOp *o, int fd, const void *buf, size_t len);
+
+/**
+ * Starts a gather write operation. The object must be idle.
+ * The I/O vector and the buffers it points to must remain valid until
+ * the operation completes.
+ */
+void BReactorIOUringOp_WriteV (BReactorIOUringOp *o, int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * Starts a recvmsg operation. The object must be idle.
+ * The message header and everything it points to must remain valid until
+ * the operation completes.
+ */
+void BReactorIOUringOp_RecvMsg (BReactorIOUringOp *o, int fd, struct msghdr *msg);
+
+/**
+ * Starts a sendmsg operation. The object must be idle.
+ * The message header and everything it points to must remain valid until
+ * the operation completes.
+ */
+void BReactorIOUringOp_SendMsg (BReactorIOUringOp *o, int fd, const struct msghdr *msg);
+
+/**
+ * Requests cancellation of the operation in progress, if any.
+ * The operation still completes, possibly with -ECANCELED.
+ * 
+ * @param o the object
+ */
+void BReactorIOUringOp_Cancel (BReactorIOUringOp *o);
+
+/**
+ * Blocks until the operation in progress completes, without calling
+ * the handler. The object must be busy, and becomes idle.
+ * 
+ * @param o the object
+ * @return result of the operation
+ */
+int BReactorIOUringOp_Wait (BReactorIOUringOp *o);
+
+#endif
+
 #ifdef BADVPN_USE_WINAPI
 
 #define BREACTOR_IOCP_EVENT_SUCCEEDED 1
@@ -80,6 +80,11 @@ void BTimer_Init (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user
     bt->active = 0;
 }
 
+void BTimer_InitCoarse (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user)
+{
+    BTimer_Init(bt, msTime, handler, user);
+}
+
 int BTimer_IsRunning (BTimer *bt)
 {
     assert_timer(bt, NULL);
@@ -93,6 +98,11 @@ void BSmallTimer_Init (BSmallTimer *bt, BSmallTimer_handler handler)
     bt->handler = handler;
 }
 
+void BSmallTimer_InitCoarse (BSmallTimer *bt, BSmallTimer_handler handler)
+{
+    BSmallTimer_Init(bt, handler);
+}
+
 int BSmallTimer_IsRunning (BSmallTimer *bt)
 {
     return BTimer_IsRunning(&bt->timer);
@@ -118,6 +128,11 @@ void BReactor_EmscriptenSync (BReactor *bsys)
     dispatch_pending(bsys);
 }
 
+btime_t BReactor_GetTime (BReactor *bsys)
+{
+    return btime_gettime();
+}
+
 BPendingGroup * BReactor_PendingGroup (BReactor *bsys)
 {
     DebugObject_Access(&bsys->d_obj);
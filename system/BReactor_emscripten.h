@@ -52,6 +52,7 @@ typedef struct BTimer_t {
 } BTimer;
 
 void BTimer_Init (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user);
+void BTimer_InitCoarse (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user);
 int BTimer_IsRunning (BTimer *bt);
 
 struct BSmallTimer_t;
@@ -64,6 +65,7 @@ typedef struct BSmallTimer_t {
 } BSmallTimer;
 
 void BSmallTimer_Init (BSmallTimer *bt, BSmallTimer_handler handler);
+void BSmallTimer_InitCoarse (BSmallTimer *bt, BSmallTimer_handler handler);
 int BSmallTimer_IsRunning (BSmallTimer *bt);
 
 struct BReactor_s {
@@ -76,6 +78,7 @@ void BReactor_EmscriptenFree (BReactor *bsys);
 void BReactor_EmscriptenSync (BReactor *bsys);
 
 BPendingGroup * BReactor_PendingGroup (BReactor *bsys);
+btime_t BReactor_GetTime (BReactor *bsys);
 
 void BReactor_SetTimer (BReactor *bsys, BTimer *bt);
 void BReactor_SetTimerAfter (BReactor *bsys, BTimer *bt, btime_t after);
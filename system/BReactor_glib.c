@@ -187,6 +187,11 @@ void BSmallTimer_Init (BSmallTimer *bt, BSmallTimer_handler handler)
     bt->is_small = 1;
 }
 
+void BSmallTimer_InitCoarse (BSmallTimer *bt, BSmallTimer_handler handler)
+{
+    BSmallTimer_Init(bt, handler);
+}
+
 int BSmallTimer_IsRunning (BSmallTimer *bt)
 {
     assert_timer(bt);
@@ -203,6 +208,12 @@ void BTimer_Init (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user
     bt->msTime = msTime;
 }
 
+void BTimer_InitCoarse (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user)
+{
+    // glib already coalesces timers where it can
+    BTimer_Init(bt, msTime, handler, user);
+}
+
 int BTimer_IsRunning (BTimer *bt)
 {
     return BSmallTimer_IsRunning(&bt->base);
@@ -338,6 +349,11 @@ void BReactor_RemoveTimer (BReactor *bsys, BTimer *bt)
     return BReactor_RemoveSmallTimer(bsys, &bt->base);
 }
 
+btime_t BReactor_GetTime (BReactor *bsys)
+{
+    return btime_gettime();
+}
+
 BPendingGroup * BReactor_PendingGroup (BReactor *bsys)
 {
     DebugObject_Access(&bsys->d_obj);
@@ -363,7 +379,44 @@ int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref)
     return 0;
 }
 
+void BReactor_SetMaxResults (BReactor *bsys, int max_results)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(max_results > 0)
+    
+    // GLib manages its own poll array
+}
+
+void BReactor_SetBusyPoll (BReactor *bsys, int usecs)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(usecs >= 0)
+    
+    // GLib always blocks in its own poll
+}
+
+void BReactor_SetStallThreshold (BReactor *bsys, int threshold_ms)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(threshold_ms >= 0)
+    
+    // GLib dispatches the events itself
+}
+
+void BReactor_SetJobBudget (BReactor *bsys, int budget)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(budget >= 0)
+    
+    // GLib decides when to poll
+}
+
 int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs)
+{
+    return BReactor_AddFileDescriptor2(bsys, bs, 0);
+}
+
+int BReactor_AddFileDescriptor2 (BReactor *bsys, BFileDescriptor *bs, int flags)
 {
     DebugObject_Access(&bsys->d_obj);
     ASSERT(!bs->active)
@@ -417,6 +470,29 @@ void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int
     bs->pollfd.events = get_glib_wait_events(bs->waitEvents);
 }
 
+void BReactor_FileDescriptorDrained (BReactor *bsys, BFileDescriptor *bs, int events)
+{
+    DebugObject_Access(&bsys->d_obj);
+    ASSERT(bs->active)
+    ASSERT(!(events&~(BREACTOR_READ|BREACTOR_WRITE)))
+    
+    // monitoring is always level-triggered
+}
+
+void BReactor_SetSocketFdFlags (BReactor *bsys, int flags)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    bsys->socket_fd_flags = flags;
+}
+
+int BReactor_GetSocketFdFlags (BReactor *bsys)
+{
+    DebugObject_Access(&bsys->d_obj);
+    
+    return bsys->socket_fd_flags;
+}
+
 int BReactor_InitFromExistingGMainLoop (BReactor *bsys, GMainLoop *gloop, int unref_gloop_on_free)
 {
     ASSERT(gloop)
@@ -442,6 +518,9 @@ int BReactor_InitFromExistingGMainLoop (BReactor *bsys, GMainLoop *gloop, int un
     // init active limits list
     LinkedList1_Init(&bsys->active_limits_list);
     
+    // set no socket fd flags
+    bsys->socket_fd_flags = 0;
+    
     DebugCounter_Init(&bsys->d_fds_counter);
     DebugCounter_Init(&bsys->d_limits_ctr);
     DebugCounter_Init(&bsys->d_timers_ctr);
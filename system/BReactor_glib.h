@@ -64,6 +64,7 @@ typedef struct BSmallTimer_t {
 } BSmallTimer;
 
 void BSmallTimer_Init (BSmallTimer *bt, BSmallTimer_handler handler);
+void BSmallTimer_InitCoarse (BSmallTimer *bt, BSmallTimer_handler handler);
 int BSmallTimer_IsRunning (BSmallTimer *bt);
 
 typedef struct {
@@ -73,6 +74,7 @@ typedef struct {
 } BTimer;
 
 void BTimer_Init (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user);
+void BTimer_InitCoarse (BTimer *bt, btime_t msTime, BTimer_handler handler, void *user);
 int BTimer_IsRunning (BTimer *bt);
 
 struct BFileDescriptor_t;
@@ -82,6 +84,8 @@ struct BFileDescriptor_t;
 #define BREACTOR_ERROR (1 << 2)
 #define BREACTOR_HUP (1 << 3)
 
+#define BREACTOR_FDFLAG_EDGE (1 << 0)
+
 typedef void (*BFileDescriptor_handler) (void *user, int events);
 
 typedef struct BFileDescriptor_t {
@@ -105,6 +109,7 @@ struct BReactor_s {
     GSourceFuncs fd_source_funcs;
     BPendingGroup pending_jobs;
     LinkedList1 active_limits_list;
+    int socket_fd_flags;
     
     DebugCounter d_fds_counter;
     DebugCounter d_limits_ctr;
@@ -123,10 +128,19 @@ void BReactor_SetTimerAfter (BReactor *bsys, BTimer *bt, btime_t after);
 void BReactor_SetTimerAbsolute (BReactor *bsys, BTimer *bt, btime_t time);
 void BReactor_RemoveTimer (BReactor *bsys, BTimer *bt);
 BPendingGroup * BReactor_PendingGroup (BReactor *bsys);
+btime_t BReactor_GetTime (BReactor *bsys);
 int BReactor_Synchronize (BReactor *bsys, BSmallPending *ref);
+void BReactor_SetMaxResults (BReactor *bsys, int max_results);
+void BReactor_SetBusyPoll (BReactor *bsys, int usecs);
+void BReactor_SetStallThreshold (BReactor *bsys, int threshold_ms);
+void BReactor_SetJobBudget (BReactor *bsys, int budget);
 int BReactor_AddFileDescriptor (BReactor *bsys, BFileDescriptor *bs) WARN_UNUSED;
+int BReactor_AddFileDescriptor2 (BReactor *bsys, BFileDescriptor *bs, int flags) WARN_UNUSED;
 void BReactor_RemoveFileDescriptor (BReactor *bsys, BFileDescriptor *bs);
 void BReactor_SetFileDescriptorEvents (BReactor *bsys, BFileDescriptor *bs, int events);
+void BReactor_FileDescriptorDrained (BReactor *bsys, BFileDescriptor *bs, int events);
+void BReactor_SetSocketFdFlags (BReactor *bsys, int flags);
+int BReactor_GetSocketFdFlags (BReactor *bsys);
 
 int BReactor_InitFromExistingGMainLoop (BReactor *bsys, GMainLoop *gloop, int unref_gloop_on_free);
 GMainLoop * BReactor_GetGMainLoop (BReactor *bsys);
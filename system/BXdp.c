@@ -0,0 +1,908 @@
+/**
+ * @file BBufferArena.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+
+#include <misc/balloc.h>
+#include <misc/byteorder.h>
+#include <misc/ethernet_proto.h>
+#include <misc/ipv4_proto.h>
+#include <misc/ipv6_proto.h>
+#include <misc/udp_proto.h>
+#include <system/BDatagram.h>
+#include <base/BLog.h>
+
+#include "BXdp.h"
+
+#include <generated/blog_channel_BXdp.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define RING_SIZE (BXDP_QUEUE_FRAMES / 2)
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+#define IPV4_FRAGMENT_MASK 0x3FFF
+#define IPV4_DONT_FRAGMENT 0x4000
+
+struct BXdp_queue {
+    BXdp *xdp;
+    int index;
+    int fd;
+    BFileDescriptor bfd;
+    uint8_t *umem;
+    struct BXdp_ring fill;
+    struct BXdp_ring comp;
+    struct BXdp_ring rx;
+    struct BXdp_ring tx;
+    uint64_t *tx_frames;
+    int tx_num_frames;
+    int tx_queued;
+    BPending kick_job;
+};
+
+static int sys_bpf (int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int count_queues (const char *ifname)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/queues", ifname);
+    
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+    
+    int num = 0;
+    struct dirent *ent;
+    while (ent = readdir(dir)) {
+        if (!strncmp(ent->d_name, "rx-", 3)) {
+            num++;
+        }
+    }
+    
+    closedir(dir);
+    return num;
+}
+
+static int read_mtu (const char *ifname)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/mtu", ifname);
+    
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    
+    int mtu;
+    if (fscanf(f, "%d", &mtu) != 1) {
+        mtu = -1;
+    }
+    
+    fclose(f);
+    return mtu;
+}
+
+static int create_map (int type, int value_size, int max_entries)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = value_size;
+    attr.max_entries = max_entries;
+    
+    return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int update_map (int map_fd, uint32_t key, uint32_t value)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&value;
+    attr.flags = BPF_ANY;
+    
+    return (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) == 0);
+}
+
+#define INSN(code, dst, src, off, imm) ((struct bpf_insn){ (code), (dst), (src), (off), (imm) })
+#define MOV_REG(dst, src) INSN(BPF_ALU64 | BPF_MOV | BPF_X, (dst), (src), 0, 0)
+#define MOV_IMM(dst, imm) INSN(BPF_ALU64 | BPF_MOV | BPF_K, (dst), 0, 0, (imm))
+#define ADD_IMM(dst, imm) INSN(BPF_ALU64 | BPF_ADD | BPF_K, (dst), 0, 0, (imm))
+#define AND_IMM(dst, imm) INSN(BPF_ALU64 | BPF_AND | BPF_K, (dst), 0, 0, (imm))
+#define BE16(dst) INSN(BPF_ALU | BPF_END | BPF_TO_BE, (dst), 0, 0, 16)
+#define LOAD(size, dst, src, off) INSN(BPF_LDX | BPF_MEM | (size), (dst), (src), (off), 0)
+#define STORE(size, dst, src, off) INSN(BPF_STX | BPF_MEM | (size), (dst), (src), (off), 0)
+#define LOAD_MAP(dst, fd) INSN(BPF_LD | BPF_DW | BPF_IMM, (dst), BPF_PSEUDO_MAP_FD, 0, (fd)), INSN(0, 0, 0, 0, 0)
+#define CALL(func) INSN(BPF_JMP | BPF_CALL, 0, 0, 0, (func))
+#define EXIT() INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+// jumps are relative to the next instruction, so they carry their own position
+#define JUMP(pc, target) INSN(BPF_JMP | BPF_JA, 0, 0, (target) - (pc) - 1, 0)
+#define JUMP_IMM(op, pc, dst, imm, target) INSN(BPF_JMP | (op) | BPF_K, (dst), 0, (target) - (pc) - 1, (imm))
+#define JUMP_REG(op, pc, dst, src, target) INSN(BPF_JMP | (op) | BPF_X, (dst), (src), (target) - (pc) - 1, 0)
+
+// positions of jump targets in the program
+#define PROG_IPV4 11
+#define PROG_IPV6 24
+#define PROG_LOOKUP 30
+#define PROG_PASS 46
+#define PROG_LEN 48
+
+#define ETH_LEN sizeof(struct ethernet_header)
+#define IPV4_LEN sizeof(struct ipv4_header)
+#define IPV6_LEN sizeof(struct ipv6_header)
+#define UDP_LEN sizeof(struct udp_header)
+
+static int load_program (BXdp *o)
+{
+    // Redirects UDP datagrams whose destination port is set in the ports map
+    // to the socket of the receive queue; everything else goes to the kernel.
+    struct bpf_insn prog[] = {
+        MOV_REG(6, 1),
+        LOAD(BPF_W, 2, 6, offsetof(struct xdp_md, data)),
+        LOAD(BPF_W, 3, 6, offsetof(struct xdp_md, data_end)),
+        // Ethernet header
+        MOV_REG(4, 2),
+        ADD_IMM(4, ETH_LEN),
+        JUMP_REG(BPF_JGT, 5, 4, 3, PROG_PASS),
+        LOAD(BPF_H, 5, 2, offsetof(struct ethernet_header, type)),
+        BE16(5),
+        JUMP_IMM(BPF_JEQ, 8, 5, ETHERTYPE_IPV4, PROG_IPV4),
+        JUMP_IMM(BPF_JEQ, 9, 5, ETHERTYPE_IPV6, PROG_IPV6),
+        JUMP(10, PROG_PASS),
+        // IPv4 without options and not fragmented
+        MOV_REG(4, 2),
+        ADD_IMM(4, ETH_LEN + IPV4_LEN + UDP_LEN),
+        JUMP_REG(BPF_JGT, 13, 4, 3, PROG_PASS),
+        LOAD(BPF_B, 5, 2, ETH_LEN + offsetof(struct ipv4_header, version4_ihl4)),
+        JUMP_IMM(BPF_JNE, 15, 5, IPV4_MAKE_VERSION_IHL(IPV4_LEN), PROG_PASS),
+        LOAD(BPF_B, 5, 2, ETH_LEN + offsetof(struct ipv4_header, protocol)),
+        JUMP_IMM(BPF_JNE, 17, 5, IPV4_PROTOCOL_UDP, PROG_PASS),
+        LOAD(BPF_H, 5, 2, ETH_LEN + offsetof(struct ipv4_header, flags3_fragmentoffset13)),
+        BE16(5),
+        AND_IMM(5, IPV4_FRAGMENT_MASK),
+        JUMP_IMM(BPF_JNE, 21, 5, 0, PROG_PASS),
+        LOAD(BPF_H, 5, 2, ETH_LEN + IPV4_LEN + offsetof(struct udp_header, dest_port)),
+        JUMP(23, PROG_LOOKUP),
+        // IPv6 without extension headers
+        MOV_REG(4, 2),
+        ADD_IMM(4, ETH_LEN + IPV6_LEN + UDP_LEN),
+        JUMP_REG(BPF_JGT, 26, 4, 3, PROG_PASS),
+        LOAD(BPF_B, 5, 2, ETH_LEN + offsetof(struct ipv6_header, next_header)),
+        JUMP_IMM(BPF_JNE, 28, 5, IPV6_NEXT_UDP, PROG_PASS),
+        LOAD(BPF_H, 5, 2, ETH_LEN + IPV6_LEN + offsetof(struct udp_header, dest_port)),
+        // look up the port
+        BE16(5),
+        STORE(BPF_W, 10, 5, -4),
+        LOAD_MAP(1, o->ports_map_fd),
+        MOV_REG(2, 10),
+        ADD_IMM(2, -4),
+        CALL(BPF_FUNC_map_lookup_elem),
+        JUMP_IMM(BPF_JEQ, 37, 0, 0, PROG_PASS),
+        LOAD(BPF_W, 1, 0, 0),
+        JUMP_IMM(BPF_JEQ, 39, 1, 0, PROG_PASS),
+        // redirect to the socket of the queue, passing if there is none
+        LOAD_MAP(1, o->xsks_map_fd),
+        LOAD(BPF_W, 2, 6, offsetof(struct xdp_md, rx_queue_index)),
+        MOV_IMM(3, XDP_PASS),
+        CALL(BPF_FUNC_redirect_map),
+        EXIT(),
+        // pass to the kernel
+        MOV_IMM(0, XDP_PASS),
+        EXIT(),
+    };
+    
+    ASSERT_FORCE(sizeof(prog) / sizeof(prog[0]) == PROG_LEN)
+    
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)prog;
+    attr.insn_cnt = PROG_LEN;
+    attr.license = (uintptr_t)"BSD";
+    
+    if ((o->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr)) < 0) {
+        // load again to get the verifier's explanation
+        static char log[16384];
+        attr.log_buf = (uintptr_t)log;
+        attr.log_size = sizeof(log);
+        attr.log_level = 1;
+        log[0] = '\0';
+        sys_bpf(BPF_PROG_LOAD, &attr);
+        BLog(BLOG_ERROR, "BPF_PROG_LOAD failed (%s): %s", strerror(errno), log);
+        return 0;
+    }
+    
+    return 1;
+}
+
+static int attach_program (BXdp *o)
+{
+    // prefer running in the driver, fall back to generic mode
+    const uint32_t modes[] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+    
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = o->prog_fd;
+        attr.link_create.target_ifindex = o->ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = modes[i];
+        
+        if ((o->link_fd = sys_bpf(BPF_LINK_CREATE, &attr)) >= 0) {
+            o->driver_mode = (modes[i] == XDP_FLAGS_DRV_MODE);
+            return 1;
+        }
+    }
+    
+    BLog(BLOG_ERROR, "BPF_LINK_CREATE failed (%s)", strerror(errno));
+    return 0;
+}
+
+static int map_ring (struct BXdp_ring *r, int fd, const struct xdp_ring_offset *off, off_t pgoff, size_t desc_size)
+{
+    r->map_len = off->desc + RING_SIZE * desc_size;
+    r->map = mmap(NULL, r->map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        BLog(BLOG_ERROR, "mmap ring failed");
+        return 0;
+    }
+    
+    r->producer = (uint32_t *)((uint8_t *)r->map + off->producer);
+    r->consumer = (uint32_t *)((uint8_t *)r->map + off->consumer);
+    r->flags = (uint32_t *)((uint8_t *)r->map + off->flags);
+    r->ring = (uint8_t *)r->map + off->desc;
+    r->mask = RING_SIZE - 1;
+    
+    return 1;
+}
+
+static void unmap_ring (struct BXdp_ring *r)
+{
+    munmap(r->map, r->map_len);
+}
+
+static int bind_queue (BXdp *o, struct BXdp_queue *q)
+{
+    // the first queue finds the best mode the driver supports, others use the same
+    const uint16_t modes[] = {XDP_ZEROCOPY|XDP_USE_NEED_WAKEUP, XDP_COPY|XDP_USE_NEED_WAKEUP, XDP_COPY};
+    
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        if (q->index > 0 && (!!(modes[i] & XDP_ZEROCOPY) != o->zerocopy || !!(modes[i] & XDP_USE_NEED_WAKEUP) != o->need_wakeup)) {
+            continue;
+        }
+        
+        struct sockaddr_xdp sxdp;
+        memset(&sxdp, 0, sizeof(sxdp));
+        sxdp.sxdp_family = AF_XDP;
+        sxdp.sxdp_flags = modes[i];
+        sxdp.sxdp_ifindex = o->ifindex;
+        sxdp.sxdp_queue_id = q->index;
+        
+        if (bind(q->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0) {
+            o->zerocopy = !!(modes[i] & XDP_ZEROCOPY);
+            o->need_wakeup = !!(modes[i] & XDP_USE_NEED_WAKEUP);
+            return 1;
+        }
+    }
+    
+    BLog(BLOG_ERROR, "bind failed on queue %d (%s)", q->index, strerror(errno));
+    return 0;
+}
+
+static void reclaim_tx (struct BXdp_queue *q)
+{
+    uint32_t cons = *q->comp.consumer;
+    uint32_t prod = __atomic_load_n(q->comp.producer, __ATOMIC_ACQUIRE);
+    
+    while (cons != prod) {
+        ASSERT(q->tx_num_frames < RING_SIZE)
+        q->tx_frames[q->tx_num_frames++] = ((uint64_t *)q->comp.ring)[cons & q->comp.mask];
+        cons++;
+    }
+    
+    __atomic_store_n(q->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+static void kick_job_handler (struct BXdp_queue *q)
+{
+    BXdp *o = q->xdp;
+    DebugObject_Access(&o->d_obj);
+    
+    // let the kernel refill the driver if it ran dry
+    if (o->need_wakeup && (__atomic_load_n(q->fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)) {
+        recvfrom(q->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+    
+    if (q->tx_queued == 0) {
+        return;
+    }
+    
+    uint32_t cons = __atomic_load_n(q->tx.consumer, __ATOMIC_ACQUIRE);
+    
+    // start transmission; errors mean try again later
+    if (!o->need_wakeup || (__atomic_load_n(q->tx.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)) {
+        sendto(q->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+    
+    reclaim_tx(q);
+    
+    uint32_t new_cons = __atomic_load_n(q->tx.consumer, __ATOMIC_ACQUIRE);
+    
+    // in copy mode, each call only transmits a limited number of frames;
+    // keep going while it's making progress
+    if (!o->zerocopy && new_cons != *q->tx.producer && new_cons != cons) {
+        BPending_Set(&q->kick_job);
+        return;
+    }
+    
+    q->tx_queued = 0;
+}
+
+static void handle_frame (struct BXdp_queue *q, uint64_t addr, uint32_t len)
+{
+    BXdp *o = q->xdp;
+    
+    uint64_t frame = addr & ~(uint64_t)(BXDP_FRAME_SIZE - 1);
+    uint8_t *data = q->umem + addr;
+    uint8_t *end;
+    uint8_t *udp;
+    
+    struct BXdp_route route;
+    route.queue = q->index;
+    
+    if (len < ETH_LEN) {
+        goto release;
+    }
+    
+    struct ethernet_header eth;
+    memcpy(&eth, data, sizeof(eth));
+    memcpy(route.local_mac, eth.dest, sizeof(route.local_mac));
+    memcpy(route.remote_mac, eth.source, sizeof(route.remote_mac));
+    
+    struct udp_header udph;
+    
+    switch (ntoh16(eth.type)) {
+        case ETHERTYPE_IPV4: {
+            struct ipv4_header ip;
+            if (len < ETH_LEN + IPV4_LEN + UDP_LEN) {
+                goto release;
+            }
+            memcpy(&ip, data + ETH_LEN, sizeof(ip));
+            
+            // trim Ethernet padding
+            int ip_len = ntoh16(ip.total_length);
+            if (ip_len < IPV4_LEN + UDP_LEN || ip_len > len - ETH_LEN) {
+                goto release;
+            }
+            end = data + ETH_LEN + ip_len;
+            udp = data + ETH_LEN + IPV4_LEN;
+            memcpy(&udph, udp, sizeof(udph));
+            
+            BAddr_InitIPv4(&route.remote_addr, ip.source_address, udph.source_port);
+            BAddr_InitIPv4(&route.local_addr, ip.destination_address, udph.dest_port);
+        } break;
+        
+        case ETHERTYPE_IPV6: {
+            struct ipv6_header ip;
+            if (len < ETH_LEN + IPV6_LEN + UDP_LEN) {
+                goto release;
+            }
+            memcpy(&ip, data + ETH_LEN, sizeof(ip));
+            
+            int payload_len = ntoh16(ip.payload_length);
+            if (payload_len < UDP_LEN || payload_len > len - ETH_LEN - IPV6_LEN) {
+                goto release;
+            }
+            end = data + ETH_LEN + IPV6_LEN + payload_len;
+            udp = data + ETH_LEN + IPV6_LEN;
+            memcpy(&udph, udp, sizeof(udph));
+            
+            BAddr_InitIPv6(&route.remote_addr, ip.source_address, udph.source_port);
+            BAddr_InitIPv6(&route.local_addr, ip.destination_address, udph.dest_port);
+        } break;
+        
+        default:
+            goto release;
+    }
+    
+    int udp_len = ntoh16(udph.length);
+    if (udp_len < UDP_LEN || udp_len > end - udp) {
+        goto release;
+    }
+    
+    // hand to the datagram object, which releases the frame once consumed
+    struct BDatagram_s *dgram = o->ports[ntoh16(udph.dest_port)];
+    if (dgram && BDatagram_XdpReceived(dgram, frame, udp + UDP_LEN, udp_len - UDP_LEN, &route)) {
+        return;
+    }
+    
+release:
+    BXdp_ReleaseFrame(o, q->index, frame);
+}
+
+static void queue_fd_handler (struct BXdp_queue *q, int events)
+{
+    BXdp *o = q->xdp;
+    DebugObject_Access(&o->d_obj);
+    
+    uint32_t cons = *q->rx.consumer;
+    uint32_t prod = __atomic_load_n(q->rx.producer, __ATOMIC_ACQUIRE);
+    
+    // take a burst of descriptors; the fd stays readable if there are more
+    for (int i = 0; i < BXDP_RX_BURST && cons != prod; i++) {
+        struct xdp_desc desc = ((struct xdp_desc *)q->rx.ring)[cons & q->rx.mask];
+        cons++;
+        handle_frame(q, desc.addr, desc.len);
+    }
+    
+    __atomic_store_n(q->rx.consumer, cons, __ATOMIC_RELEASE);
+}
+
+static int init_queue (BXdp *o, struct BXdp_queue *q, int index)
+{
+    q->xdp = o;
+    q->index = index;
+    q->umem = o->umem + (size_t)index * BXDP_QUEUE_FRAMES * BXDP_FRAME_SIZE;
+    
+    // allocate TX frame list
+    if (!(q->tx_frames = (uint64_t *)BAllocArray(RING_SIZE, sizeof(q->tx_frames[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    // init socket
+    if ((q->fd = socket(AF_XDP, SOCK_RAW, 0)) < 0) {
+        BLog(BLOG_ERROR, "socket(AF_XDP) failed (%s)", strerror(errno));
+        goto fail1;
+    }
+    
+    // register our slice of the UMEM
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uintptr_t)q->umem;
+    reg.len = (uint64_t)BXDP_QUEUE_FRAMES * BXDP_FRAME_SIZE;
+    reg.chunk_size = BXDP_FRAME_SIZE;
+    reg.headroom = 0;
+    if (setsockopt(q->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+        BLog(BLOG_ERROR, "setsockopt(XDP_UMEM_REG) failed (%s)", strerror(errno));
+        goto fail2;
+    }
+    
+    // set ring sizes
+    int ring_size = RING_SIZE;
+    if (setsockopt(q->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(q->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(q->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(q->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) < 0
+    ) {
+        BLog(BLOG_ERROR, "setsockopt(ring size) failed (%s)", strerror(errno));
+        goto fail2;
+    }
+    
+    // map rings
+    struct xdp_mmap_offsets off;
+    socklen_t off_len = sizeof(off);
+    if (getsockopt(q->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len) < 0) {
+        BLog(BLOG_ERROR, "getsockopt(XDP_MMAP_OFFSETS) failed (%s)", strerror(errno));
+        goto fail2;
+    }
+    if (!map_ring(&q->fill, q->fd, &off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t))) {
+        goto fail2;
+    }
+    if (!map_ring(&q->comp, q->fd, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t))) {
+        goto fail3;
+    }
+    if (!map_ring(&q->rx, q->fd, &off.rx, XDP_PGOFF_RX_RING, sizeof(struct xdp_desc))) {
+        goto fail4;
+    }
+    if (!map_ring(&q->tx, q->fd, &off.tx, XDP_PGOFF_TX_RING, sizeof(struct xdp_desc))) {
+        goto fail5;
+    }
+    
+    // the first half of the frames is for receiving, the second for sending
+    for (int i = 0; i < RING_SIZE; i++) {
+        ((uint64_t *)q->fill.ring)[i] = (uint64_t)i * BXDP_FRAME_SIZE;
+        q->tx_frames[i] = (uint64_t)(RING_SIZE + i) * BXDP_FRAME_SIZE;
+    }
+    __atomic_store_n(q->fill.producer, RING_SIZE, __ATOMIC_RELEASE);
+    q->tx_num_frames = RING_SIZE;
+    q->tx_queued = 0;
+    
+    // bind to the queue
+    if (!bind_queue(o, q)) {
+        goto fail6;
+    }
+    
+    // have the XDP program redirect to us
+    if (!update_map(o->xsks_map_fd, index, q->fd)) {
+        BLog(BLOG_ERROR, "BPF_MAP_UPDATE_ELEM failed (%s)", strerror(errno));
+        goto fail6;
+    }
+    
+    // init BFileDescriptor
+    BFileDescriptor_Init(&q->bfd, q->fd, (BFileDescriptor_handler)queue_fd_handler, q);
+    if (!BReactor_AddFileDescriptor(o->reactor, &q->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail6;
+    }
+    BReactor_SetFileDescriptorEvents(o->reactor, &q->bfd, BREACTOR_READ);
+    
+    // init kick job
+    BPending_Init(&q->kick_job, BReactor_PendingGroup(o->reactor), (BPending_handler)kick_job_handler, q);
+    
+    return 1;
+    
+fail6:
+    unmap_ring(&q->tx);
+fail5:
+    unmap_ring(&q->rx);
+fail4:
+    unmap_ring(&q->comp);
+fail3:
+    unmap_ring(&q->fill);
+fail2:
+    close(q->fd);
+fail1:
+    BFree(q->tx_frames);
+fail0:
+    return 0;
+}
+
+static void free_queue (BXdp *o, struct BXdp_queue *q)
+{
+    BPending_Free(&q->kick_job);
+    BReactor_RemoveFileDescriptor(o->reactor, &q->bfd);
+    unmap_ring(&q->tx);
+    unmap_ring(&q->rx);
+    unmap_ring(&q->comp);
+    unmap_ring(&q->fill);
+    close(q->fd);
+    BFree(q->tx_frames);
+}
+
+int BXdp_Init (BXdp *o, BReactor *reactor, const char *ifname)
+{
+    ASSERT(ifname)
+    
+    // init arguments
+    o->reactor = reactor;
+    
+    // find interface
+    if (strlen(ifname) >= IFNAMSIZ || !(o->ifindex = if_nametoindex(ifname))) {
+        BLog(BLOG_ERROR, "unknown interface %s", ifname);
+        goto fail0;
+    }
+    if ((o->mtu = read_mtu(ifname)) < 0) {
+        BLog(BLOG_ERROR, "failed to read MTU of %s", ifname);
+        goto fail0;
+    }
+    if ((o->num_queues = count_queues(ifname)) <= 0) {
+        BLog(BLOG_ERROR, "failed to read queues of %s", ifname);
+        goto fail0;
+    }
+    
+    // map UMEM for all queues, trying reserved huge pages first
+    o->umem_len = (size_t)o->num_queues * BXDP_QUEUE_FRAMES * BXDP_FRAME_SIZE;
+    o->umem = (uint8_t *)mmap(NULL, o->umem_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if ((void *)o->umem == MAP_FAILED) {
+        o->umem = (uint8_t *)mmap(NULL, o->umem_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if ((void *)o->umem == MAP_FAILED) {
+            BLog(BLOG_ERROR, "mmap UMEM failed");
+            goto fail0;
+        }
+    }
+    
+    // allocate port table
+    if (!(o->ports = (struct BDatagram_s **)BAllocArray(UINT16_MAX + 1, sizeof(o->ports[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    memset(o->ports, 0, (size_t)(UINT16_MAX + 1) * sizeof(o->ports[0]));
+    
+    // allocate queues
+    if (!(o->queues = (struct BXdp_queue *)BAllocArray(o->num_queues, sizeof(o->queues[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2;
+    }
+    
+    // create maps
+    if ((o->xsks_map_fd = create_map(BPF_MAP_TYPE_XSKMAP, sizeof(uint32_t), o->num_queues)) < 0) {
+        BLog(BLOG_ERROR, "BPF_MAP_CREATE failed (%s)", strerror(errno));
+        goto fail3;
+    }
+    if ((o->ports_map_fd = create_map(BPF_MAP_TYPE_ARRAY, sizeof(uint32_t), UINT16_MAX + 1)) < 0) {
+        BLog(BLOG_ERROR, "BPF_MAP_CREATE failed (%s)", strerror(errno));
+        goto fail4;
+    }
+    
+    // load program
+    if (!load_program(o)) {
+        goto fail5;
+    }
+    
+    // init queues
+    int num_inited;
+    for (num_inited = 0; num_inited < o->num_queues; num_inited++) {
+        if (!init_queue(o, &o->queues[num_inited], num_inited)) {
+            goto fail6;
+        }
+    }
+    
+    // attach program, once all sockets are there
+    if (!attach_program(o)) {
+        goto fail6;
+    }
+    
+    o->ipv4_id = 0;
+    
+    BLog(BLOG_INFO, "attached to %s with %d queues, %s mode, %s", ifname, o->num_queues,
+         (o->driver_mode ? "driver" : "generic"), (o->zerocopy ? "zero-copy" : "copy"));
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_ports_ctr);
+    return 1;
+    
+fail6:
+    while (num_inited-- > 0) {
+        free_queue(o, &o->queues[num_inited]);
+    }
+    close(o->prog_fd);
+fail5:
+    close(o->ports_map_fd);
+fail4:
+    close(o->xsks_map_fd);
+fail3:
+    BFree(o->queues);
+fail2:
+    BFree(o->ports);
+fail1:
+    munmap(o->umem, o->umem_len);
+fail0:
+    return 0;
+}
+
+void BXdp_Free (BXdp *o)
+{
+    DebugCounter_Free(&o->d_ports_ctr);
+    DebugObject_Free(&o->d_obj);
+    
+    // detach program
+    close(o->link_fd);
+    
+    for (int i = o->num_queues - 1; i >= 0; i--) {
+        free_queue(o, &o->queues[i]);
+    }
+    
+    close(o->prog_fd);
+    close(o->ports_map_fd);
+    close(o->xsks_map_fd);
+    BFree(o->queues);
+    BFree(o->ports);
+    munmap(o->umem, o->umem_len);
+}
+
+int BXdp_GetNumQueues (BXdp *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_queues;
+}
+
+int BXdp_IsZeroCopy (BXdp *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->zerocopy;
+}
+
+int BXdp_IsDriverMode (BXdp *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->driver_mode;
+}
+
+int BXdp_AddPort (BXdp *o, uint16_t port, struct BDatagram_s *dgram)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(port != 0)
+    ASSERT(dgram)
+    
+    uint16_t hport = ntoh16(port);
+    
+    if (o->ports[hport]) {
+        BLog(BLOG_ERROR, "port %d is already registered", (int)hport);
+        return 0;
+    }
+    
+    if (!update_map(o->ports_map_fd, hport, 1)) {
+        BLog(BLOG_ERROR, "BPF_MAP_UPDATE_ELEM failed (%s)", strerror(errno));
+        return 0;
+    }
+    
+    o->ports[hport] = dgram;
+    
+    DebugCounter_Increment(&o->d_ports_ctr);
+    return 1;
+}
+
+void BXdp_RemovePort (BXdp *o, uint16_t port)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    uint16_t hport = ntoh16(port);
+    ASSERT(o->ports[hport])
+    
+    if (!update_map(o->ports_map_fd, hport, 0)) {
+        BLog(BLOG_ERROR, "BPF_MAP_UPDATE_ELEM failed (%s)", strerror(errno));
+    }
+    
+    o->ports[hport] = NULL;
+    
+    DebugCounter_Decrement(&o->d_ports_ctr);
+}
+
+void BXdp_ReleaseFrame (BXdp *o, int queue, uint64_t frame)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(queue >= 0)
+    ASSERT(queue < o->num_queues)
+    
+    struct BXdp_queue *q = &o->queues[queue];
+    
+    // there are only as many receive frames as the fill ring has room for
+    uint32_t prod = *q->fill.producer;
+    ASSERT(prod - __atomic_load_n(q->fill.consumer, __ATOMIC_ACQUIRE) < RING_SIZE)
+    ((uint64_t *)q->fill.ring)[prod & q->fill.mask] = frame;
+    __atomic_store_n(q->fill.producer, prod + 1, __ATOMIC_RELEASE);
+    
+    if (o->need_wakeup && (__atomic_load_n(q->fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) && !BPending_IsSet(&q->kick_job)) {
+        BPending_Set(&q->kick_job);
+    }
+}
+
+int BXdp_Send (BXdp *o, const struct BXdp_route *route, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(route->queue >= 0)
+    ASSERT(route->queue < o->num_queues)
+    ASSERT(route->remote_addr.type == BADDR_TYPE_IPV4 || route->remote_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(route->local_addr.type == route->remote_addr.type)
+    ASSERT(data_len >= 0)
+    
+    int ip_len = (route->remote_addr.type == BADDR_TYPE_IPV4 ? IPV4_LEN : IPV6_LEN);
+    
+    // larger datagrams must be fragmented by the kernel
+    if (data_len > o->mtu - ip_len - (int)UDP_LEN || data_len > BXDP_FRAME_SIZE - ETH_LEN - ip_len - UDP_LEN) {
+        return 0;
+    }
+    
+    struct BXdp_queue *q = &o->queues[route->queue];
+    
+    // get a frame
+    if (q->tx_num_frames == 0) {
+        reclaim_tx(q);
+        if (q->tx_num_frames == 0) {
+            return 0;
+        }
+    }
+    uint64_t frame = q->tx_frames[--q->tx_num_frames];
+    uint8_t *out = q->umem + frame;
+    
+    // build Ethernet header
+    struct ethernet_header eth;
+    memcpy(eth.dest, route->remote_mac, sizeof(eth.dest));
+    memcpy(eth.source, route->local_mac, sizeof(eth.source));
+    
+    // build UDP header
+    uint8_t *udp = out + ETH_LEN + ip_len;
+    struct udp_header udph;
+    udph.length = hton16(UDP_LEN + data_len);
+    udph.checksum = hton16(0);
+    memcpy(udp + UDP_LEN, data, data_len);
+    
+    if (route->remote_addr.type == BADDR_TYPE_IPV4) {
+        eth.type = hton16(ETHERTYPE_IPV4);
+        udph.source_port = route->local_addr.ipv4.port;
+        udph.dest_port = route->remote_addr.ipv4.port;
+        
+        // no UDP checksum over IPv4
+        struct ipv4_header ip;
+        ip.version4_ihl4 = IPV4_MAKE_VERSION_IHL(IPV4_LEN);
+        ip.ds = hton8(0);
+        ip.total_length = hton16(IPV4_LEN + UDP_LEN + data_len);
+        ip.identification = hton16(o->ipv4_id++);
+        ip.flags3_fragmentoffset13 = hton16(IPV4_DONT_FRAGMENT);
+        ip.ttl = hton8(64);
+        ip.protocol = hton8(IPV4_PROTOCOL_UDP);
+        ip.checksum = hton16(0);
+        ip.source_address = route->local_addr.ipv4.ip;
+        ip.destination_address = route->remote_addr.ipv4.ip;
+        ip.checksum = ipv4_checksum(&ip, NULL, 0);
+        memcpy(out + ETH_LEN, &ip, sizeof(ip));
+    } else {
+        eth.type = hton16(ETHERTYPE_IPV6);
+        udph.source_port = route->local_addr.ipv6.port;
+        udph.dest_port = route->remote_addr.ipv6.port;
+        
+        struct ipv6_header ip;
+        ip.version4_tc4 = hton8(6 << 4);
+        ip.tc4_fl4 = hton8(0);
+        ip.fl = hton16(0);
+        ip.payload_length = hton16(UDP_LEN + data_len);
+        ip.next_header = hton8(IPV6_NEXT_UDP);
+        ip.hop_limit = hton8(64);
+        memcpy(ip.source_address, route->local_addr.ipv6.ip, 16);
+        memcpy(ip.destination_address, route->remote_addr.ipv6.ip, 16);
+        memcpy(out + ETH_LEN, &ip, sizeof(ip));
+        
+        udph.checksum = udp_ip6_checksum(&udph, udp + UDP_LEN, data_len, ip.source_address, ip.destination_address);
+    }
+    
+    memcpy(out, &eth, sizeof(eth));
+    memcpy(udp, &udph, sizeof(udph));
+    
+    // queue descriptor; there are only as many send frames as the ring has room for
+    uint32_t prod = *q->tx.producer;
+    struct xdp_desc *desc = &((struct xdp_desc *)q->tx.ring)[prod & q->tx.mask];
+    desc->addr = frame;
+    desc->len = ETH_LEN + ip_len + UDP_LEN + data_len;
+    desc->options = 0;
+    __atomic_store_n(q->tx.producer, prod + 1, __ATOMIC_RELEASE);
+    q->tx_queued++;
+    
+    // hand to the kernel once everything else queued up by now has been processed
+    if (!BPending_IsSet(&q->kick_job)) {
+        BPending_Set(&q->kick_job);
+    }
+    
+    return 1;
+}
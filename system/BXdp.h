@@ -0,0 +1,200 @@
+/**
+ * @file BBufferArena.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * AF_XDP fast path for UDP sockets on a dedicated network interface.
+ * 
+ * An XDP program is attached to the interface which redirects UDP datagrams
+ * to registered local ports into one AF_XDP socket per receive queue,
+ * bypassing the kernel network stack; all other traffic passes to the
+ * kernel as usual. Each queue has its own slice of one shared UMEM, mapped
+ * with reserved huge pages if available. Received datagrams are handed to
+ * the {@link BDatagram} which registered the port, keeping the frame until
+ * the datagram has been consumed. Replies to the address a datagram came
+ * from are sent out on the same queue, with the Ethernet and IP headers of
+ * the received frame mirrored, so no neighbour lookup is needed.
+ * 
+ * Only untagged Ethernet frames with unfragmented IPv4 (without options) or
+ * IPv6 (without extension headers) are steered. Requires Linux 5.9 or newer.
+ */
+
+#ifndef BADVPN_SYSTEM_BXDP_H
+#define BADVPN_SYSTEM_BXDP_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <system/BAddr.h>
+#include <system/BReactor.h>
+#include <base/BPending.h>
+#include <misc/debugcounter.h>
+#include <base/DebugObject.h>
+
+// size of a UMEM frame
+#define BXDP_FRAME_SIZE 4096
+// frames of each queue, half for receiving and half for sending
+#define BXDP_QUEUE_FRAMES 4096
+// maximum number of descriptors taken from the receive ring at once
+#define BXDP_RX_BURST 64
+
+struct BDatagram_s;
+
+/**
+ * Where a datagram steered by XDP came from, and how to send replies.
+ */
+struct BXdp_route {
+    int queue;
+    uint8_t local_mac[6];
+    uint8_t remote_mac[6];
+    BAddr remote_addr;
+    BAddr local_addr;
+};
+
+struct BXdp_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *ring;
+    uint32_t mask;
+    void *map;
+    size_t map_len;
+};
+
+struct BXdp_queue;
+
+typedef struct {
+    BReactor *reactor;
+    int ifindex;
+    int mtu;
+    int num_queues;
+    int prog_fd;
+    int xsks_map_fd;
+    int ports_map_fd;
+    int link_fd;
+    int zerocopy;
+    int need_wakeup;
+    int driver_mode;
+    uint8_t *umem;
+    size_t umem_len;
+    struct BXdp_queue *queues;
+    struct BDatagram_s **ports;
+    uint16_t ipv4_id;
+    DebugObject d_obj;
+    DebugCounter d_ports_ctr;
+} BXdp;
+
+/**
+ * Initializes the object, taking over UDP ports registered with
+ * {@link BXdp_AddPort} on the given interface.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param ifname name of the network interface
+ * @return 1 on success, 0 on failure
+ */
+int BXdp_Init (BXdp *o, BReactor *reactor, const char *ifname) WARN_UNUSED;
+
+/**
+ * Frees the object, detaching the XDP program.
+ * There must be no registered ports.
+ * 
+ * @param o the object
+ */
+void BXdp_Free (BXdp *o);
+
+/**
+ * Returns the number of queues of the interface.
+ * 
+ * @param o the object
+ * @return number of queues, >0
+ */
+int BXdp_GetNumQueues (BXdp *o);
+
+/**
+ * Returns whether the sockets use zero-copy mode, as opposed to copy mode,
+ * in which the kernel copies frames between the driver and the UMEM.
+ * 
+ * @param o the object
+ * @return 1 for zero-copy mode, 0 for copy mode
+ */
+int BXdp_IsZeroCopy (BXdp *o);
+
+/**
+ * Returns whether the XDP program runs in the driver, as opposed to
+ * generic mode, in which it runs after the kernel has built a socket buffer.
+ * 
+ * @param o the object
+ * @return 1 for driver mode, 0 for generic mode
+ */
+int BXdp_IsDriverMode (BXdp *o);
+
+/**
+ * Starts steering datagrams to a local UDP port to a datagram object.
+ * Called by {@link BDatagram_SetXdp}.
+ * 
+ * @param o the object
+ * @param port port number in network byte order; must be nonzero
+ * @param dgram datagram object to hand datagrams to
+ * @return 1 on success, 0 if the port is already registered or on failure
+ */
+int BXdp_AddPort (BXdp *o, uint16_t port, struct BDatagram_s *dgram) WARN_UNUSED;
+
+/**
+ * Stops steering datagrams to a local UDP port.
+ * The port must be registered. Frames passed to the datagram object must
+ * have been released.
+ * 
+ * @param o the object
+ * @param port port number in network byte order
+ */
+void BXdp_RemovePort (BXdp *o, uint16_t port);
+
+/**
+ * Gives a received frame back to the kernel.
+ * 
+ * @param o the object
+ * @param queue queue the frame was received on
+ * @param frame frame address, as passed to the datagram object
+ */
+void BXdp_ReleaseFrame (BXdp *o, int queue, uint64_t frame);
+
+/**
+ * Sends a UDP datagram along a route learned from a received datagram.
+ * The frame is queued and handed to the kernel once no more jobs are pending.
+ * 
+ * @param o the object
+ * @param route route of a received datagram
+ * @param data payload
+ * @param data_len payload length; must be >=0
+ * @return 1 if queued, 0 if there is no free frame or the datagram doesn't
+ *         fit the interface MTU, in which case it must be sent otherwise
+ */
+int BXdp_Send (BXdp *o, const struct BXdp_route *route, const uint8_t *data, int data_len);
+
+#endif
@@ -0,0 +1,990 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include <protocol/tcpgw_proto.h>
+#include <misc/debug.h>
+#include <misc/version.h>
+#include <misc/loggers_string.h>
+#include <misc/loglevel.h>
+#include <misc/offset.h>
+#include <misc/open_standard_streams.h>
+#include <structure/LinkedList1.h>
+#include <base/BLog.h>
+#include <system/BReactor.h>
+#include <system/BNetwork.h>
+#include <system/BConnection.h>
+#include <system/BSignal.h>
+#include <tcpmux/TcpMux.h>
+
+#ifndef BADVPN_USE_WINAPI
+#include <base/BLog_syslog.h>
+#include <base/BLog_async.h>
+#include <base/BLog_trace.h>
+#endif
+
+#include <tcpgw/tcpgw.h>
+
+#include <generated/blog_channel_tcpgw.h>
+
+#define LOGGER_STDOUT 1
+#define LOGGER_SYSLOG 2
+#define LOGGER_TRACE 3
+
+#define STREAM_STATE_CONNECTING 1
+#define STREAM_STATE_UP 2
+
+struct client {
+    BConnection con;
+    BAddr addr;
+    TcpMux mux;
+    LinkedList1 streams_list;
+    int num_streams;
+    LinkedList1Node clients_list_node;
+};
+
+// A stream relays between a multiplexed stream from the client and a TCP
+// connection to its destination, each direction through its own buffer.
+// When one side closes, the data already buffered toward the other side is
+// sent before the stream is freed.
+struct stream {
+    struct client *client;
+    BAddr addr;
+    LinkedList1Node streams_list_node;
+    int state;
+    int have_mstream;
+    TcpMuxStream mstream;
+    BConnector connector;
+    int have_con;
+    BConnection con;
+    int con_closed;
+    uint8_t up_buf[STREAM_BUFFER_SIZE];
+    int up_len;
+    int up_sent;
+    uint8_t down_buf[STREAM_BUFFER_SIZE];
+    int down_len;
+    int down_sent;
+};
+
+// command-line options
+struct {
+    int help;
+    int version;
+    int logger;
+    #ifndef BADVPN_USE_WINAPI
+    char *logger_syslog_facility;
+    char *logger_syslog_ident;
+    int logger_async;
+    char *logger_trace_file;
+    int logger_trace_size;
+    #endif
+    int loglevel;
+    int loglevels[BLOG_NUM_CHANNELS];
+    char *listen_addrs[MAX_LISTEN_ADDRS];
+    int num_listen_addrs;
+    int max_clients;
+    int max_streams_for_client;
+    int stream_window;
+    struct BConnection_options client_socket_options;
+    struct BConnection_options dest_socket_options;
+} options;
+
+// listen addresses
+BAddr listen_addrs[MAX_LISTEN_ADDRS];
+int num_listen_addrs;
+
+// reactor
+BReactor ss;
+
+// listeners
+BListener listeners[MAX_LISTEN_ADDRS];
+int num_listeners;
+
+// clients
+LinkedList1 clients_list;
+int num_clients;
+
+static void print_help (const char *name);
+static void print_version (void);
+static int parse_arguments (int argc, char *argv[]);
+static int process_arguments (void);
+static void signal_handler (void *unused);
+static void listener_handler (BListener *listener);
+static void client_free (struct client *client);
+static void client_logfunc (struct client *client);
+static void client_log (struct client *client, int level, const char *fmt, ...);
+static void client_connection_handler (struct client *client, int event);
+static void client_mux_handler_error (struct client *client);
+static void client_mux_handler_open (struct client *client, uint32_t stream_id, BAddr addr);
+static void stream_free (struct stream *s);
+static void stream_free_mstream (struct stream *s);
+static void stream_logfunc (struct stream *s);
+static void stream_log (struct stream *s, int level, const char *fmt, ...);
+static void stream_mstream_handler (struct stream *s, int event);
+static void stream_connector_handler (struct stream *s, int is_error);
+static void stream_connection_handler (struct stream *s, int event);
+static void stream_up_recv_handler_done (struct stream *s, int data_len);
+static void stream_up_send_handler_done (struct stream *s, int data_len);
+static void stream_down_recv_handler_done (struct stream *s, int data_len);
+static void stream_down_send_handler_done (struct stream *s, int data_len);
+
+int main (int argc, char **argv)
+{
+    if (argc <= 0) {
+        return 1;
+    }
+    
+    // open standard streams
+    open_standard_streams();
+    
+    // parse command-line arguments
+    if (!parse_arguments(argc, argv)) {
+        fprintf(stderr, "Failed to parse arguments\n");
+        print_help(argv[0]);
+        goto fail0;
+    }
+    
+    // handle --help and --version
+    if (options.help) {
+        print_version();
+        print_help(argv[0]);
+        return 0;
+    }
+    if (options.version) {
+        print_version();
+        return 0;
+    }
+    
+    // initialize logger
+    switch (options.logger) {
+        case LOGGER_STDOUT:
+            BLog_InitStdout();
+            break;
+        #ifndef BADVPN_USE_WINAPI
+        case LOGGER_SYSLOG:
+            if (!BLog_InitSyslog(options.logger_syslog_ident, options.logger_syslog_facility)) {
+                fprintf(stderr, "Failed to initialize syslog logger\n");
+                goto fail0;
+            }
+            break;
+        case LOGGER_TRACE:
+            if (!BLog_InitTrace(options.logger_trace_file, options.logger_trace_size)) {
+                fprintf(stderr, "Failed to initialize trace logger\n");
+                goto fail0;
+            }
+            break;
+        #endif
+        default:
+            ASSERT(0);
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    // write out logs from a separate thread
+    if (options.logger_async && !BLog_MakeAsync(BLOG_ASYNC_DEFAULT_BUFFER_SIZE)) {
+        fprintf(stderr, "Failed to start asynchronous logger\n");
+        goto fail1;
+    }
+    #endif
+    
+    // configure logger channels
+    for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
+        if (options.loglevels[i] >= 0) {
+            BLog_SetChannelLoglevel(i, options.loglevels[i]);
+        }
+        else if (options.loglevel >= 0) {
+            BLog_SetChannelLoglevel(i, options.loglevel);
+        }
+    }
+    
+    BLog(BLOG_NOTICE, "initializing "GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION);
+    
+    // initialize network
+    if (!BNetwork_GlobalInit()) {
+        BLog(BLOG_ERROR, "BNetwork_GlobalInit failed");
+        goto fail1;
+    }
+    
+    // process arguments
+    if (!process_arguments()) {
+        BLog(BLOG_ERROR, "Failed to process arguments");
+        goto fail1;
+    }
+    
+    // init time
+    BTime_Init();
+    
+    // init reactor
+    if (!BReactor_Init(&ss)) {
+        BLog(BLOG_ERROR, "BReactor_Init failed");
+        goto fail1;
+    }
+    
+    // setup signal handler
+    if (!BSignal_Init(&ss, signal_handler, NULL)) {
+        BLog(BLOG_ERROR, "BSignal_Init failed");
+        goto fail2;
+    }
+    
+    // initialize listeners
+    num_listeners = 0;
+    while (num_listeners < num_listen_addrs) {
+        if (!BListener_Init(&listeners[num_listeners], listen_addrs[num_listeners], &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
+            BLog(BLOG_ERROR, "Listener_Init failed");
+            goto fail3;
+        }
+        num_listeners++;
+    }
+    
+    // init clients list
+    LinkedList1_Init(&clients_list);
+    num_clients = 0;
+    
+    // enter event loop
+    BLog(BLOG_NOTICE, "entering event loop");
+    BReactor_Exec(&ss);
+    
+    // free clients
+    while (!LinkedList1_IsEmpty(&clients_list)) {
+        struct client *client = UPPER_OBJECT(LinkedList1_GetFirst(&clients_list), struct client, clients_list_node);
+        client_free(client);
+    }
+fail3:
+    // free listeners
+    while (num_listeners > 0) {
+        num_listeners--;
+        BListener_Free(&listeners[num_listeners]);
+    }
+    // finish signal handling
+    BSignal_Finish();
+fail2:
+    // free reactor
+    BReactor_Free(&ss);
+fail1:
+    // free logger
+    BLog(BLOG_NOTICE, "exiting");
+    BLog_Free();
+fail0:
+    // finish debug objects
+    DebugObjectGlobal_Finish();
+    
+    return 1;
+}
+
+void print_help (const char *name)
+{
+    printf(
+        "Usage:\n"
+        "    %s\n"
+        "        [--help]\n"
+        "        [--version]\n"
+        #ifdef BADVPN_USE_WINAPI
+        "        [--logger <"LOGGERS_STRING">]\n"
+        #else
+        "        [--logger <"LOGGERS_STRING"/trace>]\n"
+        "        (logger=syslog?\n"
+        "            [--syslog-facility <string>]\n"
+        "            [--syslog-ident <string>]\n"
+        "        )\n"
+        "        (logger=trace?\n"
+        "            --trace-file <file>\n"
+        "            [--trace-size <bytes>]\n"
+        "        )\n"
+        "        [--logger-async]\n"
+        #endif
+        "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
+        "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
+        "        [--listen-addr <addr>] ...\n"
+        "        [--max-clients <number>]\n"
+        "        [--max-streams-for-client <number>]\n"
+        "        [--stream-window <bytes>]\n"
+        "        [--client-socket-options <options>]\n"
+        "        [--dest-socket-options <options>]\n"
+        "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
+        name
+    );
+}
+
+void print_version (void)
+{
+    printf(GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION"\n"GLOBAL_COPYRIGHT_NOTICE"\n");
+}
+
+int parse_arguments (int argc, char *argv[])
+{
+    if (argc <= 0) {
+        return 0;
+    }
+    
+    options.help = 0;
+    options.version = 0;
+    options.logger = LOGGER_STDOUT;
+    #ifndef BADVPN_USE_WINAPI
+    options.logger_syslog_facility = "daemon";
+    options.logger_syslog_ident = argv[0];
+    options.logger_async = 0;
+    options.logger_trace_file = NULL;
+    options.logger_trace_size = BLOG_TRACE_DEFAULT_RING_SIZE;
+    #endif
+    options.loglevel = -1;
+    for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
+        options.loglevels[i] = -1;
+    }
+    options.num_listen_addrs = 0;
+    options.max_clients = DEFAULT_MAX_CLIENTS;
+    options.max_streams_for_client = DEFAULT_MAX_STREAMS_FOR_CLIENT;
+    options.stream_window = DEFAULT_STREAM_WINDOW;
+    BConnection_options_Init(&options.client_socket_options);
+    options.client_socket_options.nodelay = 1;
+    BConnection_options_Init(&options.dest_socket_options);
+    
+    int i;
+    for (i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (!strcmp(arg, "--help")) {
+            options.help = 1;
+        }
+        else if (!strcmp(arg, "--version")) {
+            options.version = 1;
+        }
+        else if (!strcmp(arg, "--logger")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            char *arg2 = argv[i + 1];
+            if (!strcmp(arg2, "stdout")) {
+                options.logger = LOGGER_STDOUT;
+            }
+            #ifndef BADVPN_USE_WINAPI
+            else if (!strcmp(arg2, "syslog")) {
+                options.logger = LOGGER_SYSLOG;
+            }
+            else if (!strcmp(arg2, "trace")) {
+                options.logger = LOGGER_TRACE;
+            }
+            #endif
+            else {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--syslog-facility")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.logger_syslog_facility = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--syslog-ident")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.logger_syslog_ident = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--logger-async")) {
+            options.logger_async = 1;
+        }
+        else if (!strcmp(arg, "--trace-file")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.logger_trace_file = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--trace-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.logger_trace_size = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--loglevel")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.loglevel = parse_loglevel(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--channel-loglevel")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            int channel = BLogGlobal_GetChannelByName(argv[i + 1]);
+            if (channel < 0) {
+                fprintf(stderr, "%s: wrong channel argument\n", arg);
+                return 0;
+            }
+            int loglevel = parse_loglevel(argv[i + 2]);
+            if (loglevel < 0) {
+                fprintf(stderr, "%s: wrong loglevel argument\n", arg);
+                return 0;
+            }
+            options.loglevels[channel] = loglevel;
+            i += 2;
+        }
+        else if (!strcmp(arg, "--listen-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (options.num_listen_addrs == MAX_LISTEN_ADDRS) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            options.listen_addrs[options.num_listen_addrs] = argv[i + 1];
+            options.num_listen_addrs++;
+            i++;
+        }
+        else if (!strcmp(arg, "--max-clients")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.max_clients = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--max-streams-for-client")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.max_streams_for_client = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--stream-window")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.stream_window = atoi(argv[i + 1])) < TCPGW_INITIAL_WINDOW) {
+                fprintf(stderr, "%s: must be at least %d\n", arg, TCPGW_INITIAL_WINDOW);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--client-socket-options")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BConnection_options_Parse(&options.client_socket_options, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--dest-socket-options")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BConnection_options_Parse(&options.dest_socket_options, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            return 0;
+        }
+    }
+    
+    if (options.help || options.version) {
+        return 1;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    if (options.logger == LOGGER_TRACE && !options.logger_trace_file) {
+        fprintf(stderr, "--trace-file is required with --logger trace\n");
+        return 0;
+    }
+    #endif
+    
+    return 1;
+}
+
+int process_arguments (void)
+{
+    // resolve listen addresses
+    num_listen_addrs = 0;
+    while (num_listen_addrs < options.num_listen_addrs) {
+        if (!BAddr_Parse(&listen_addrs[num_listen_addrs], options.listen_addrs[num_listen_addrs], NULL, 0)) {
+            BLog(BLOG_ERROR, "listen addr: BAddr_Parse failed");
+            return 0;
+        }
+        num_listen_addrs++;
+    }
+    
+    return 1;
+}
+
+void signal_handler (void *unused)
+{
+    BLog(BLOG_NOTICE, "termination requested");
+    
+    // exit event loop
+    BReactor_Quit(&ss, 1);
+}
+
+void listener_handler (BListener *listener)
+{
+    if (num_clients == options.max_clients) {
+        BLog(BLOG_ERROR, "maximum number of clients reached");
+        goto fail0;
+    }
+    
+    // allocate structure
+    struct client *client = (struct client *)malloc(sizeof(*client));
+    if (!client) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    
+    // accept client
+    if (!BConnection_Init(&client->con, BConnection_source_listener(listener, &client->addr), &ss, client, (BConnection_handler)client_connection_handler)) {
+        BLog(BLOG_ERROR, "BConnection_Init failed");
+        goto fail1;
+    }
+    
+    // apply socket options; streams share the connection, so small writes
+    // are not delayed by default
+    if (!BConnection_SetOptions(&client->con, &options.client_socket_options)) {
+        BLog(BLOG_WARNING, "BConnection_SetOptions failed");
+    }
+    
+    // init connection interfaces
+    BConnection_SendAsync_Init(&client->con);
+    BConnection_RecvAsync_Init(&client->con);
+    
+    // init multiplexer
+    if (!TcpMux_Init(&client->mux, options.stream_window, &ss, client, (TcpMux_handler_error)client_mux_handler_error, (TcpMux_handler_open)client_mux_handler_open)) {
+        BLog(BLOG_ERROR, "TcpMux_Init failed");
+        goto fail2;
+    }
+    
+    // connect multiplexer to client
+    if (!TcpMux_Connect(&client->mux, BConnection_SendAsync_GetIf(&client->con), BConnection_RecvAsync_GetIf(&client->con))) {
+        BLog(BLOG_ERROR, "TcpMux_Connect failed");
+        goto fail3;
+    }
+    
+    // init streams list
+    LinkedList1_Init(&client->streams_list);
+    client->num_streams = 0;
+    
+    // insert to clients list
+    LinkedList1_Append(&clients_list, &client->clients_list_node);
+    num_clients++;
+    
+    client_log(client, BLOG_INFO, "connected");
+    
+    return;
+    
+fail3:
+    TcpMux_Free(&client->mux);
+fail2:
+    BConnection_RecvAsync_Free(&client->con);
+    BConnection_SendAsync_Free(&client->con);
+    BConnection_Free(&client->con);
+fail1:
+    free(client);
+fail0:
+    return;
+}
+
+void client_free (struct client *client)
+{
+    // free streams
+    while (!LinkedList1_IsEmpty(&client->streams_list)) {
+        struct stream *s = UPPER_OBJECT(LinkedList1_GetFirst(&client->streams_list), struct stream, streams_list_node);
+        stream_free(s);
+    }
+    
+    // remove from clients list
+    LinkedList1_Remove(&clients_list, &client->clients_list_node);
+    num_clients--;
+    
+    // free multiplexer
+    TcpMux_Free(&client->mux);
+    
+    // free connection interfaces
+    BConnection_RecvAsync_Free(&client->con);
+    BConnection_SendAsync_Free(&client->con);
+    
+    // free connection
+    BConnection_Free(&client->con);
+    
+    // free structure
+    free(client);
+}
+
+void client_logfunc (struct client *client)
+{
+    char addr[BADDR_MAX_PRINT_LEN];
+    BAddr_Print(&client->addr, addr);
+    
+    BLog_Append("client (%s): ", addr);
+}
+
+void client_log (struct client *client, int level, const char *fmt, ...)
+{
+    va_list vl;
+    va_start(vl, fmt);
+    BLog_LogViaFuncVarArg((BLog_logfunc)client_logfunc, client, BLOG_CURRENT_CHANNEL, level, fmt, vl);
+    va_end(vl);
+}
+
+void client_connection_handler (struct client *client, int event)
+{
+    if (event == BCONNECTION_EVENT_RECVCLOSED) {
+        client_log(client, BLOG_INFO, "client closed");
+    } else {
+        client_log(client, BLOG_INFO, "client error");
+    }
+    
+    // free client
+    client_free(client);
+}
+
+void client_mux_handler_error (struct client *client)
+{
+    client_log(client, BLOG_ERROR, "protocol error");
+    
+    // free client
+    client_free(client);
+}
+
+void client_mux_handler_open (struct client *client, uint32_t stream_id, BAddr addr)
+{
+    // the stream is refused unless we accept it here
+    
+    if (client->num_streams == options.max_streams_for_client) {
+        client_log(client, BLOG_WARNING, "maximum number of streams reached");
+        goto fail0;
+    }
+    
+    // allocate structure
+    struct stream *s = (struct stream *)malloc(sizeof(*s));
+    if (!s) {
+        client_log(client, BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    s->client = client;
+    s->addr = addr;
+    
+    // start connecting
+    if (!BConnector_Init(&s->connector, addr, &ss, s, (BConnector_handler)stream_connector_handler)) {
+        client_log(client, BLOG_ERROR, "BConnector_Init failed");
+        goto fail1;
+    }
+    
+    // accept stream
+    if (!TcpMuxStream_InitAccept(&s->mstream, &client->mux, stream_id, (TcpMuxStream_handler)stream_mstream_handler, s)) {
+        client_log(client, BLOG_ERROR, "TcpMuxStream_InitAccept failed");
+        goto fail2;
+    }
+    
+    // set state
+    s->state = STREAM_STATE_CONNECTING;
+    s->have_mstream = 1;
+    s->have_con = 0;
+    
+    // insert to streams list
+    LinkedList1_Append(&client->streams_list, &s->streams_list_node);
+    client->num_streams++;
+    
+    stream_log(s, BLOG_INFO, "connecting");
+    
+    return;
+    
+fail2:
+    BConnector_Free(&s->connector);
+fail1:
+    free(s);
+fail0:
+    return;
+}
+
+void stream_free (struct stream *s)
+{
+    struct client *client = s->client;
+    
+    // remove from streams list
+    LinkedList1_Remove(&client->streams_list, &s->streams_list_node);
+    client->num_streams--;
+    
+    // free connection
+    if (s->have_con) {
+        BConnection_RecvAsync_Free(&s->con);
+        BConnection_SendAsync_Free(&s->con);
+        BConnection_Free(&s->con);
+    }
+    
+    // free connector
+    BConnector_Free(&s->connector);
+    
+    // free multiplexed stream
+    if (s->have_mstream) {
+        TcpMuxStream_Free(&s->mstream);
+    }
+    
+    // free structure
+    free(s);
+}
+
+void stream_free_mstream (struct stream *s)
+{
+    ASSERT(s->have_mstream)
+    
+    // free multiplexed stream
+    TcpMuxStream_Free(&s->mstream);
+    s->have_mstream = 0;
+    
+    // free the stream unless we have data to send to the destination
+    if (!s->have_con || s->up_len == 0) {
+        stream_free(s);
+        return;
+    }
+    
+    stream_log(s, BLOG_INFO, "waiting until buffered data is sent to destination");
+}
+
+void stream_logfunc (struct stream *s)
+{
+    client_logfunc(s->client);
+    
+    char addr[BADDR_MAX_PRINT_LEN];
+    BAddr_Print(&s->addr, addr);
+    
+    BLog_Append("stream (%s): ", addr);
+}
+
+void stream_log (struct stream *s, int level, const char *fmt, ...)
+{
+    va_list vl;
+    va_start(vl, fmt);
+    BLog_LogViaFuncVarArg((BLog_logfunc)stream_logfunc, s, BLOG_CURRENT_CHANNEL, level, fmt, vl);
+    va_end(vl);
+}
+
+void stream_mstream_handler (struct stream *s, int event)
+{
+    ASSERT(s->have_mstream)
+    
+    if (event == TCPMUXSTREAM_EVENT_ERROR_CLOSED) {
+        stream_log(s, BLOG_INFO, "client closed stream");
+    } else {
+        stream_log(s, BLOG_INFO, "stream error");
+    }
+    
+    stream_free_mstream(s);
+}
+
+void stream_connector_handler (struct stream *s, int is_error)
+{
+    ASSERT(s->state == STREAM_STATE_CONNECTING)
+    ASSERT(s->have_mstream)
+    
+    if (is_error) {
+        stream_log(s, BLOG_INFO, "connection failed");
+        goto fail0;
+    }
+    
+    // init connection
+    if (!BConnection_Init(&s->con, BConnection_source_connector(&s->connector), &ss, s, (BConnection_handler)stream_connection_handler)) {
+        stream_log(s, BLOG_ERROR, "BConnection_Init failed");
+        goto fail0;
+    }
+    
+    // apply socket options
+    if (!BConnection_SetOptions(&s->con, &options.dest_socket_options)) {
+        stream_log(s, BLOG_WARNING, "BConnection_SetOptions failed");
+    }
+    
+    // init connection interfaces
+    BConnection_SendAsync_Init(&s->con);
+    BConnection_RecvAsync_Init(&s->con);
+    s->have_con = 1;
+    s->con_closed = 0;
+    
+    // set state
+    s->state = STREAM_STATE_UP;
+    
+    stream_log(s, BLOG_INFO, "connected");
+    
+    // start relaying from the client to the destination
+    StreamRecvInterface_Receiver_Init(TcpMuxStream_GetRecvInterface(&s->mstream), (StreamRecvInterface_handler_done)stream_up_recv_handler_done, s);
+    StreamPassInterface_Sender_Init(BConnection_SendAsync_GetIf(&s->con), (StreamPassInterface_handler_done)stream_up_send_handler_done, s);
+    s->up_len = 0;
+    StreamRecvInterface_Receiver_Recv(TcpMuxStream_GetRecvInterface(&s->mstream), s->up_buf, sizeof(s->up_buf));
+    
+    // start relaying from the destination to the client
+    StreamRecvInterface_Receiver_Init(BConnection_RecvAsync_GetIf(&s->con), (StreamRecvInterface_handler_done)stream_down_recv_handler_done, s);
+    StreamPassInterface_Sender_Init(TcpMuxStream_GetSendInterface(&s->mstream), (StreamPassInterface_handler_done)stream_down_send_handler_done, s);
+    s->down_len = 0;
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&s->con), s->down_buf, sizeof(s->down_buf));
+    
+    return;
+    
+fail0:
+    stream_free(s);
+}
+
+void stream_connection_handler (struct stream *s, int event)
+{
+    ASSERT(s->have_con)
+    
+    if (event == BCONNECTION_EVENT_RECVCLOSED) {
+        stream_log(s, BLOG_INFO, "destination closed");
+        
+        ASSERT(!s->con_closed)
+        s->con_closed = 1;
+        
+        // free the stream unless we have data to send to the client
+        if (!s->have_mstream || s->down_len == 0) {
+            stream_free(s);
+            return;
+        }
+        
+        stream_log(s, BLOG_INFO, "waiting until buffered data is sent to client");
+        return;
+    }
+    
+    stream_log(s, BLOG_INFO, "destination error");
+    
+    stream_free(s);
+}
+
+void stream_up_recv_handler_done (struct stream *s, int data_len)
+{
+    ASSERT(s->have_mstream)
+    ASSERT(s->have_con)
+    ASSERT(s->up_len == 0)
+    ASSERT(data_len > 0)
+    
+    // send to destination
+    s->up_len = data_len;
+    s->up_sent = 0;
+    StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&s->con), s->up_buf, s->up_len);
+}
+
+void stream_up_send_handler_done (struct stream *s, int data_len)
+{
+    ASSERT(s->have_con)
+    ASSERT(s->up_len > 0)
+    ASSERT(data_len > 0)
+    ASSERT(data_len <= s->up_len - s->up_sent)
+    
+    s->up_sent += data_len;
+    
+    // send the rest
+    if (s->up_sent < s->up_len) {
+        StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&s->con), s->up_buf + s->up_sent, s->up_len - s->up_sent);
+        return;
+    }
+    s->up_len = 0;
+    
+    // if the client is gone, we're done
+    if (!s->have_mstream) {
+        stream_free(s);
+        return;
+    }
+    
+    // receive more
+    StreamRecvInterface_Receiver_Recv(TcpMuxStream_GetRecvInterface(&s->mstream), s->up_buf, sizeof(s->up_buf));
+}
+
+void stream_down_recv_handler_done (struct stream *s, int data_len)
+{
+    ASSERT(s->have_con)
+    ASSERT(s->down_len == 0)
+    ASSERT(data_len > 0)
+    
+    // the client is gone, the data has nowhere to go
+    if (!s->have_mstream) {
+        return;
+    }
+    
+    // send to client
+    s->down_len = data_len;
+    s->down_sent = 0;
+    StreamPassInterface_Sender_Send(TcpMuxStream_GetSendInterface(&s->mstream), s->down_buf, s->down_len);
+}
+
+void stream_down_send_handler_done (struct stream *s, int data_len)
+{
+    ASSERT(s->have_mstream)
+    ASSERT(s->down_len > 0)
+    ASSERT(data_len > 0)
+    ASSERT(data_len <= s->down_len - s->down_sent)
+    
+    s->down_sent += data_len;
+    
+    // send the rest
+    if (s->down_sent < s->down_len) {
+        StreamPassInterface_Sender_Send(TcpMuxStream_GetSendInterface(&s->mstream), s->down_buf + s->down_sent, s->down_len - s->down_sent);
+        return;
+    }
+    s->down_len = 0;
+    
+    // if the destination is done sending, we're done
+    if (s->con_closed) {
+        stream_free(s);
+        return;
+    }
+    
+    // receive more
+    StreamRecvInterface_Receiver_Recv(BConnection_RecvAsync_GetIf(&s->con), s->down_buf, sizeof(s->down_buf));
+}
@@ -0,0 +1,828 @@
+/**
+ * @file TcpMux.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <misc/offset.h>
+#include <misc/byteorder.h>
+#include <misc/balloc.h>
+#include <misc/compare.h>
+#include <misc/minmax.h>
+#include <base/BLog.h>
+
+#include <tcpmux/TcpMux.h>
+
+#include <generated/blog_channel_TcpMux.h>
+
+#define STREAM_STATE_OPEN 1
+#define STREAM_STATE_CLOSED 2
+#define STREAM_STATE_DEAD 3
+
+// largest window a peer may grant in total
+#define MAX_SEND_WINDOW (INT_MAX / 2)
+
+#define INITIAL_CLOSE_IDS 16
+
+#define GROWARRAY_NAME CloseIdsArray
+#define GROWARRAY_OBJECT_TYPE TcpMux
+#define GROWARRAY_ARRAY_MEMBER close_ids
+#define GROWARRAY_CAPACITY_MEMBER close_ids_capacity
+#define GROWARRAY_MAX_CAPACITY INT_MAX
+#include <misc/grow_array.h>
+
+static int stream_id_comparator (void *unused, uint32_t *v1, uint32_t *v2);
+static TcpMuxStream * find_stream (TcpMux *o, uint32_t stream_id);
+static void free_server (TcpMux *o);
+static void protocol_error (TcpMux *o);
+static void decoder_handler_error (TcpMux *o);
+static void recv_if_handler_send (TcpMux *o, uint8_t *data, int data_len);
+static int handle_open (TcpMux *o, uint32_t stream_id, uint8_t flags, const uint8_t *data, int data_len);
+static int handle_data (TcpMux *o, TcpMuxStream *s, const uint8_t *data, int data_len);
+static int handle_window (TcpMux *o, TcpMuxStream *s, const uint8_t *data, int data_len);
+static void handle_close (TcpMux *o, TcpMuxStream *s);
+static void send_if_handler_done (TcpMux *o);
+static void send_job_handler (TcpMux *o);
+static void send_frame (TcpMux *o, uint8_t type, uint8_t flags, uint32_t stream_id, int payload_len);
+static int stream_init (TcpMuxStream *o, TcpMux *mux, uint32_t stream_id, TcpMuxStream_handler handler, void *user);
+static int stream_wants_send (TcpMuxStream *o);
+static void stream_update_send (TcpMuxStream *o);
+static void stream_remove_send (TcpMuxStream *o);
+static void stream_deliver (TcpMuxStream *o);
+static void stream_report (TcpMuxStream *o, int event);
+static void stream_event_job_handler (TcpMuxStream *o);
+static void stream_send_if_handler_send (TcpMuxStream *o, uint8_t *data, int data_len);
+static void stream_recv_if_handler_recv (TcpMuxStream *o, uint8_t *data, int data_len);
+
+static int stream_id_comparator (void *unused, uint32_t *v1, uint32_t *v2)
+{
+    return B_COMPARE(*v1, *v2);
+}
+
+static TcpMuxStream * find_stream (TcpMux *o, uint32_t stream_id)
+{
+    BAVLNode *node = BAVL_LookupExact(&o->streams_tree, &stream_id);
+    if (!node) {
+        return NULL;
+    }
+    
+    return UPPER_OBJECT(node, TcpMuxStream, streams_tree_node);
+}
+
+static void free_server (TcpMux *o)
+{
+    ASSERT(o->have_server)
+    
+    // stop sending
+    BPending_Unset(&o->send_job);
+    
+    // free send sender
+    PacketStreamSender_Free(&o->send_sender);
+    
+    // free receive decoder
+    PacketProtoDecoder_Free(&o->recv_decoder);
+    
+    // free receive interface
+    PacketPassInterface_Free(&o->recv_if);
+    
+    // set have no server
+    o->have_server = 0;
+}
+
+static void protocol_error (TcpMux *o)
+{
+    ASSERT(o->have_server)
+    
+    // report error
+    o->handler_error(o->user);
+    return;
+}
+
+static void decoder_handler_error (TcpMux *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_server)
+    
+    BLog(BLOG_ERROR, "decoder error");
+    
+    protocol_error(o);
+    return;
+}
+
+static void recv_if_handler_send (TcpMux *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_server)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= TCPGW_MTU)
+    
+    // accept packet
+    PacketPassInterface_Done(&o->recv_if);
+    
+    // check header
+    if (data_len < sizeof(struct tcpgw_header)) {
+        BLog(BLOG_ERROR, "missing header");
+        goto fail;
+    }
+    struct tcpgw_header header;
+    memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    data_len -= sizeof(header);
+    uint32_t stream_id = ntoh32(header.stream_id);
+    
+    if (header.type == TCPGW_TYPE_OPEN) {
+        if (!handle_open(o, stream_id, header.flags, data, data_len)) {
+            goto fail;
+        }
+        return;
+    }
+    
+    if (header.type != TCPGW_TYPE_DATA && header.type != TCPGW_TYPE_WINDOW && header.type != TCPGW_TYPE_CLOSE) {
+        BLog(BLOG_ERROR, "unknown message type %d", (int)header.type);
+        goto fail;
+    }
+    
+    // find stream; messages for unknown streams may have crossed a close
+    TcpMuxStream *s = find_stream(o, stream_id);
+    if (!s) {
+        return;
+    }
+    ASSERT(s->state == STREAM_STATE_OPEN)
+    
+    switch (header.type) {
+        case TCPGW_TYPE_DATA: {
+            if (!handle_data(o, s, data, data_len)) {
+                goto fail;
+            }
+        } break;
+        
+        case TCPGW_TYPE_WINDOW: {
+            if (!handle_window(o, s, data, data_len)) {
+                goto fail;
+            }
+        } break;
+        
+        case TCPGW_TYPE_CLOSE: {
+            handle_close(o, s);
+        } break;
+    }
+    
+    return;
+    
+fail:
+    protocol_error(o);
+    return;
+}
+
+static int handle_open (TcpMux *o, uint32_t stream_id, uint8_t flags, const uint8_t *data, int data_len)
+{
+    if (!o->handler_open) {
+        BLog(BLOG_ERROR, "peer is not allowed to open streams");
+        return 0;
+    }
+    
+    BAddr addr;
+    if ((flags & TCPGW_FLAG_IPV6)) {
+        struct tcpgw_addr_ipv6 addr_ipv6;
+        if (data_len != sizeof(addr_ipv6)) {
+            BLog(BLOG_ERROR, "open: bad IPv6 address");
+            return 0;
+        }
+        memcpy(&addr_ipv6, data, sizeof(addr_ipv6));
+        BAddr_InitIPv6(&addr, addr_ipv6.addr_ip, addr_ipv6.addr_port);
+    } else {
+        struct tcpgw_addr_ipv4 addr_ipv4;
+        if (data_len != sizeof(addr_ipv4)) {
+            BLog(BLOG_ERROR, "open: bad IPv4 address");
+            return 0;
+        }
+        memcpy(&addr_ipv4, data, sizeof(addr_ipv4));
+        BAddr_InitIPv4(&addr, addr_ipv4.addr_ip, addr_ipv4.addr_port);
+    }
+    
+    if (find_stream(o, stream_id)) {
+        BLog(BLOG_ERROR, "open: stream %"PRIu32" already exists", stream_id);
+        return 0;
+    }
+    
+    // let the user accept the stream
+    o->accepting = 1;
+    o->accepting_id = stream_id;
+    o->accepted = 0;
+    o->handler_open(o->user, stream_id, addr);
+    ASSERT(o->have_server)
+    o->accepting = 0;
+    
+    if (!o->accepted) {
+        // refuse the stream
+        if (o->num_close_ids == o->close_ids_capacity && !CloseIdsArray_DoubleUp(o)) {
+            BLog(BLOG_ERROR, "failed to queue close");
+            return 0;
+        }
+        o->close_ids[o->num_close_ids++] = stream_id;
+        BPending_Set(&o->send_job);
+    }
+    
+    return 1;
+}
+
+static int handle_data (TcpMux *o, TcpMuxStream *s, const uint8_t *data, int data_len)
+{
+    if (data_len == 0) {
+        return 1;
+    }
+    
+    // the peer must not send more than we allowed it to
+    if (data_len > o->window - s->recv_used - s->window_pending) {
+        BLog(BLOG_ERROR, "data: stream %"PRIu32" exceeded window", s->stream_id);
+        return 0;
+    }
+    
+    // give as much as possible directly to a waiting receiver
+    if (s->recv_dest) {
+        int to_copy = bmin_int(data_len, s->recv_avail);
+        memcpy(s->recv_dest, data, to_copy);
+        data += to_copy;
+        data_len -= to_copy;
+        s->recv_dest = NULL;
+        s->window_pending += to_copy;
+        StreamRecvInterface_Done(&s->recv_if, to_copy);
+        stream_update_send(s);
+    }
+    
+    // buffer the rest
+    while (data_len > 0) {
+        int end = (s->recv_start + s->recv_used) % o->window;
+        int to_copy = bmin_int(data_len, o->window - end);
+        memcpy(s->recv_buf + end, data, to_copy);
+        data += to_copy;
+        data_len -= to_copy;
+        s->recv_used += to_copy;
+    }
+    
+    return 1;
+}
+
+static int handle_window (TcpMux *o, TcpMuxStream *s, const uint8_t *data, int data_len)
+{
+    struct tcpgw_window window;
+    if (data_len != sizeof(window)) {
+        BLog(BLOG_ERROR, "window: bad length");
+        return 0;
+    }
+    memcpy(&window, data, sizeof(window));
+    uint32_t bytes = ntoh32(window.bytes);
+    
+    if (bytes > MAX_SEND_WINDOW - s->send_window) {
+        BLog(BLOG_ERROR, "window: stream %"PRIu32" window too large", s->stream_id);
+        return 0;
+    }
+    
+    s->send_window += bytes;
+    
+    stream_update_send(s);
+    
+    return 1;
+}
+
+static void handle_close (TcpMux *o, TcpMuxStream *s)
+{
+    // the stream ID is no longer valid
+    BAVL_Remove(&o->streams_tree, &s->streams_tree_node);
+    stream_remove_send(s);
+    s->state = STREAM_STATE_CLOSED;
+    
+    // the peer won't read anything more; discard what we were sending
+    if (s->send_len > 0) {
+        int len = s->send_len;
+        s->send_len = 0;
+        StreamPassInterface_Done(&s->send_if, len);
+    }
+    
+    // report closing when buffered data has been received
+    if (s->recv_used == 0) {
+        stream_report(s, TCPMUXSTREAM_EVENT_ERROR_CLOSED);
+    }
+}
+
+static void send_if_handler_done (TcpMux *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_server)
+    ASSERT(o->sending)
+    
+    o->sending = 0;
+    
+    BPending_Set(&o->send_job);
+}
+
+static void send_job_handler (TcpMux *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_server)
+    
+    if (o->sending) {
+        return;
+    }
+    
+    // closes of freed streams go first
+    if (o->num_close_ids > 0) {
+        uint32_t stream_id = o->close_ids[--o->num_close_ids];
+        send_frame(o, TCPGW_TYPE_CLOSE, 0, stream_id, 0);
+        return;
+    }
+    
+    if (LinkedList1_IsEmpty(&o->send_list)) {
+        return;
+    }
+    
+    // take the first stream which wants to send
+    TcpMuxStream *s = UPPER_OBJECT(LinkedList1_GetFirst(&o->send_list), TcpMuxStream, send_list_node);
+    ASSERT(s->state == STREAM_STATE_OPEN)
+    ASSERT(stream_wants_send(s))
+    LinkedList1_Remove(&o->send_list, &s->send_list_node);
+    s->in_send_list = 0;
+    
+    if (s->open_pending) {
+        s->open_pending = 0;
+        switch (s->addr.type) {
+            case BADDR_TYPE_IPV4: {
+                struct tcpgw_addr_ipv4 addr_ipv4;
+                addr_ipv4.addr_ip = s->addr.ipv4.ip;
+                addr_ipv4.addr_port = s->addr.ipv4.port;
+                memcpy(o->send_frame.payload, &addr_ipv4, sizeof(addr_ipv4));
+                send_frame(o, TCPGW_TYPE_OPEN, 0, s->stream_id, sizeof(addr_ipv4));
+            } break;
+            case BADDR_TYPE_IPV6: {
+                struct tcpgw_addr_ipv6 addr_ipv6;
+                memcpy(addr_ipv6.addr_ip, s->addr.ipv6.ip, sizeof(addr_ipv6.addr_ip));
+                addr_ipv6.addr_port = s->addr.ipv6.port;
+                memcpy(o->send_frame.payload, &addr_ipv6, sizeof(addr_ipv6));
+                send_frame(o, TCPGW_TYPE_OPEN, TCPGW_FLAG_IPV6, s->stream_id, sizeof(addr_ipv6));
+            } break;
+            default: ASSERT(0);
+        }
+    }
+    else if (s->window_pending >= o->window / 4) {
+        struct tcpgw_window window;
+        window.bytes = hton32(s->window_pending);
+        s->window_pending = 0;
+        memcpy(o->send_frame.payload, &window, sizeof(window));
+        send_frame(o, TCPGW_TYPE_WINDOW, 0, s->stream_id, sizeof(window));
+    }
+    else {
+        ASSERT(s->send_len > 0)
+        ASSERT(s->send_window > 0)
+        int len = bmin_int(bmin_int(s->send_len, s->send_window), TCPGW_MAX_DATA);
+        memcpy(o->send_frame.payload, s->send_data, len);
+        s->send_window -= len;
+        s->send_len = 0;
+        StreamPassInterface_Done(&s->send_if, len);
+        send_frame(o, TCPGW_TYPE_DATA, 0, s->stream_id, len);
+    }
+    
+    // go to the back of the queue if there's more to send
+    stream_update_send(s);
+}
+
+static void send_frame (TcpMux *o, uint8_t type, uint8_t flags, uint32_t stream_id, int payload_len)
+{
+    ASSERT(!o->sending)
+    ASSERT(payload_len >= 0)
+    ASSERT(payload_len <= TCPGW_MAX_DATA)
+    
+    int len = sizeof(struct tcpgw_header) + payload_len;
+    o->send_frame.pp.len = htol16(len);
+    o->send_frame.header.type = type;
+    o->send_frame.header.flags = flags;
+    o->send_frame.header.stream_id = hton32(stream_id);
+    
+    PacketPassInterface_Sender_Send(o->send_if, (uint8_t *)&o->send_frame, sizeof(struct packetproto_header) + len);
+    o->sending = 1;
+}
+
+static int stream_init (TcpMuxStream *o, TcpMux *mux, uint32_t stream_id, TcpMuxStream_handler handler, void *user)
+{
+    ASSERT(mux->have_server)
+    ASSERT(!find_stream(mux, stream_id))
+    
+    // init arguments
+    o->mux = mux;
+    o->stream_id = stream_id;
+    o->handler = handler;
+    o->user = user;
+    
+    // reserve space for the close of this stream, so that freeing the stream
+    // never needs to allocate
+    while (mux->close_ids_capacity < mux->num_streams + 1 + mux->num_close_ids) {
+        if (!CloseIdsArray_DoubleUp(mux)) {
+            BLog(BLOG_ERROR, "CloseIdsArray_DoubleUp failed");
+            goto fail0;
+        }
+    }
+    
+    // allocate receive buffer
+    if (!(o->recv_buf = BAlloc(mux->window))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    
+    // init state
+    o->state = STREAM_STATE_OPEN;
+    o->open_pending = 0;
+    o->in_send_list = 0;
+    o->send_len = 0;
+    o->send_window = TCPGW_INITIAL_WINDOW;
+    o->recv_start = 0;
+    o->recv_used = 0;
+    o->recv_dest = NULL;
+    o->window_pending = mux->window - TCPGW_INITIAL_WINDOW;
+    
+    // init interfaces
+    StreamPassInterface_Init(&o->send_if, (StreamPassInterface_handler_send)stream_send_if_handler_send, o, BReactor_PendingGroup(mux->reactor));
+    StreamRecvInterface_Init(&o->recv_if, (StreamRecvInterface_handler_recv)stream_recv_if_handler_recv, o, BReactor_PendingGroup(mux->reactor));
+    
+    // init event job
+    BPending_Init(&o->event_job, BReactor_PendingGroup(mux->reactor), (BPending_handler)stream_event_job_handler, o);
+    
+    // insert to streams
+    ASSERT_EXECUTE(BAVL_Insert(&mux->streams_tree, &o->streams_tree_node, NULL))
+    LinkedList1_Append(&mux->streams_list, &o->streams_list_node);
+    mux->num_streams++;
+    
+    DebugError_Init(&o->d_err, BReactor_PendingGroup(mux->reactor));
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Increment(&mux->d_streams_ctr);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+static int stream_wants_send (TcpMuxStream *o)
+{
+    ASSERT(o->state == STREAM_STATE_OPEN)
+    
+    return o->open_pending || o->window_pending >= o->mux->window / 4 || (o->send_len > 0 && o->send_window > 0);
+}
+
+static void stream_update_send (TcpMuxStream *o)
+{
+    if (o->state != STREAM_STATE_OPEN || o->in_send_list || !stream_wants_send(o)) {
+        return;
+    }
+    
+    LinkedList1_Append(&o->mux->send_list, &o->send_list_node);
+    o->in_send_list = 1;
+    BPending_Set(&o->mux->send_job);
+}
+
+static void stream_remove_send (TcpMuxStream *o)
+{
+    if (o->in_send_list) {
+        LinkedList1_Remove(&o->mux->send_list, &o->send_list_node);
+        o->in_send_list = 0;
+    }
+}
+
+static void stream_deliver (TcpMuxStream *o)
+{
+    ASSERT(o->recv_dest)
+    ASSERT(o->recv_used > 0)
+    
+    int window = o->mux->window;
+    
+    int to_copy = bmin_int(o->recv_avail, o->recv_used);
+    int first = bmin_int(to_copy, window - o->recv_start);
+    memcpy(o->recv_dest, o->recv_buf + o->recv_start, first);
+    memcpy(o->recv_dest + first, o->recv_buf, to_copy - first);
+    o->recv_start = (o->recv_start + to_copy) % window;
+    o->recv_used -= to_copy;
+    o->recv_dest = NULL;
+    
+    StreamRecvInterface_Done(&o->recv_if, to_copy);
+    
+    switch (o->state) {
+        case STREAM_STATE_OPEN: {
+            o->window_pending += to_copy;
+            stream_update_send(o);
+        } break;
+        
+        case STREAM_STATE_CLOSED: {
+            if (o->recv_used == 0) {
+                stream_report(o, TCPMUXSTREAM_EVENT_ERROR_CLOSED);
+            }
+        } break;
+    }
+}
+
+static void stream_report (TcpMuxStream *o, int event)
+{
+    ASSERT(!BPending_IsSet(&o->event_job))
+    
+    o->event = event;
+    BPending_Set(&o->event_job);
+}
+
+static void stream_event_job_handler (TcpMuxStream *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // report event
+    DEBUGERROR(&o->d_err, o->handler(o->user, o->event))
+    return;
+}
+
+static void stream_send_if_handler_send (TcpMuxStream *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->send_len == 0)
+    ASSERT(data_len > 0)
+    
+    switch (o->state) {
+        case STREAM_STATE_OPEN: {
+            o->send_data = data;
+            o->send_len = data_len;
+            stream_update_send(o);
+        } break;
+        
+        case STREAM_STATE_CLOSED: {
+            // the peer is gone, discard
+            StreamPassInterface_Done(&o->send_if, data_len);
+        } break;
+        
+        case STREAM_STATE_DEAD: {
+            // the user is about to free us, leave the operation pending
+        } break;
+    }
+}
+
+static void stream_recv_if_handler_recv (TcpMuxStream *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->recv_dest)
+    ASSERT(data_len > 0)
+    
+    o->recv_dest = data;
+    o->recv_avail = data_len;
+    
+    if (o->recv_used > 0) {
+        stream_deliver(o);
+    }
+}
+
+int TcpMux_Init (TcpMux *o, int window, BReactor *reactor, void *user,
+                 TcpMux_handler_error handler_error, TcpMux_handler_open handler_open)
+{
+    ASSERT(window >= TCPGW_INITIAL_WINDOW)
+    ASSERT(handler_error)
+    
+    // init arguments
+    o->window = window;
+    o->reactor = reactor;
+    o->user = user;
+    o->handler_error = handler_error;
+    o->handler_open = handler_open;
+    
+    // init close IDs array
+    if (!CloseIdsArray_Init(o, INITIAL_CLOSE_IDS)) {
+        BLog(BLOG_ERROR, "CloseIdsArray_Init failed");
+        goto fail0;
+    }
+    o->num_close_ids = 0;
+    
+    // init streams
+    BAVL_Init(&o->streams_tree, OFFSET_DIFF(TcpMuxStream, stream_id, streams_tree_node), (BAVL_comparator)stream_id_comparator, NULL);
+    LinkedList1_Init(&o->streams_list);
+    LinkedList1_Init(&o->send_list);
+    o->num_streams = 0;
+    o->next_stream_id = 1;
+    o->accepting = 0;
+    
+    // init send job
+    BPending_Init(&o->send_job, BReactor_PendingGroup(o->reactor), (BPending_handler)send_job_handler, o);
+    
+    // set no server
+    o->have_server = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    DebugCounter_Init(&o->d_streams_ctr);
+    return 1;
+    
+fail0:
+    return 0;
+}
+
+void TcpMux_Free (TcpMux *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugCounter_Free(&o->d_streams_ctr);
+    ASSERT(o->num_streams == 0)
+    
+    // free server
+    if (o->have_server) {
+        free_server(o);
+    }
+    
+    // free send job
+    BPending_Free(&o->send_job);
+    
+    // free close IDs array
+    CloseIdsArray_Free(o);
+}
+
+int TcpMux_Connect (TcpMux *o, StreamPassInterface *send_if, StreamRecvInterface *recv_if)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->have_server)
+    ASSERT(!o->accepting)
+    
+    // init receive interface
+    PacketPassInterface_Init(&o->recv_if, TCPGW_MTU, (PacketPassInterface_handler_send)recv_if_handler_send, o, BReactor_PendingGroup(o->reactor));
+    
+    // init receive decoder
+    if (!PacketProtoDecoder_Init(&o->recv_decoder, recv_if, &o->recv_if, BReactor_PendingGroup(o->reactor), o, (PacketProtoDecoder_handler_error)decoder_handler_error)) {
+        BLog(BLOG_ERROR, "PacketProtoDecoder_Init failed");
+        goto fail1;
+    }
+    
+    // init send sender, gathering small messages into fewer writes
+    if (!PacketStreamSender_Init2(&o->send_sender, send_if, PACKETPROTO_ENCLEN(TCPGW_MTU), 2 * PACKETPROTO_ENCLEN(TCPGW_MTU), BReactor_PendingGroup(o->reactor))) {
+        BLog(BLOG_ERROR, "PacketStreamSender_Init2 failed");
+        goto fail2;
+    }
+    o->send_if = PacketStreamSender_GetInput(&o->send_sender);
+    PacketPassInterface_Sender_Init(o->send_if, (PacketPassInterface_handler_done)send_if_handler_done, o);
+    o->sending = 0;
+    
+    // set have server
+    o->have_server = 1;
+    
+    return 1;
+    
+fail2:
+    PacketProtoDecoder_Free(&o->recv_decoder);
+fail1:
+    PacketPassInterface_Free(&o->recv_if);
+    return 0;
+}
+
+void TcpMux_Disconnect (TcpMux *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->have_server)
+    ASSERT(!o->accepting)
+    
+    // kill open streams; closed ones may still deliver what they buffered
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&o->streams_list); ln; ln = LinkedList1Node_Next(ln)) {
+        TcpMuxStream *s = UPPER_OBJECT(ln, TcpMuxStream, streams_list_node);
+        if (s->state != STREAM_STATE_OPEN) {
+            continue;
+        }
+        BAVL_Remove(&o->streams_tree, &s->streams_tree_node);
+        stream_remove_send(s);
+        s->state = STREAM_STATE_DEAD;
+        stream_report(s, TCPMUXSTREAM_EVENT_ERROR);
+    }
+    ASSERT(BAVL_IsEmpty(&o->streams_tree))
+    ASSERT(LinkedList1_IsEmpty(&o->send_list))
+    
+    // forget closes
+    o->num_close_ids = 0;
+    
+    // free server
+    free_server(o);
+}
+
+int TcpMux_IsConnected (TcpMux *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->have_server;
+}
+
+int TcpMux_GetNumStreams (TcpMux *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return o->num_streams;
+}
+
+int TcpMuxStream_Init (TcpMuxStream *o, TcpMux *mux, BAddr addr, TcpMuxStream_handler handler, void *user)
+{
+    DebugObject_Access(&mux->d_obj);
+    ASSERT(mux->have_server)
+    ASSERT(!mux->handler_open)
+    ASSERT(addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6)
+    
+    if (mux->next_stream_id == 0) {
+        BLog(BLOG_ERROR, "out of stream IDs");
+        return 0;
+    }
+    
+    if (!stream_init(o, mux, mux->next_stream_id, handler, user)) {
+        return 0;
+    }
+    mux->next_stream_id++;
+    
+    // send open
+    o->addr = addr;
+    o->open_pending = 1;
+    stream_update_send(o);
+    
+    return 1;
+}
+
+int TcpMuxStream_InitAccept (TcpMuxStream *o, TcpMux *mux, uint32_t stream_id, TcpMuxStream_handler handler, void *user)
+{
+    DebugObject_Access(&mux->d_obj);
+    ASSERT(mux->accepting)
+    ASSERT(!mux->accepted)
+    ASSERT(stream_id == mux->accepting_id)
+    
+    if (!stream_init(o, mux, stream_id, handler, user)) {
+        return 0;
+    }
+    
+    mux->accepted = 1;
+    
+    // announce our receive buffer if it's larger than the initial window
+    stream_update_send(o);
+    
+    return 1;
+}
+
+void TcpMuxStream_Free (TcpMuxStream *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugError_Free(&o->d_err);
+    TcpMux *mux = o->mux;
+    DebugCounter_Decrement(&mux->d_streams_ctr);
+    
+    if (o->state == STREAM_STATE_OPEN) {
+        BAVL_Remove(&mux->streams_tree, &o->streams_tree_node);
+        stream_remove_send(o);
+        
+        // close the stream, unless the peer never heard of it
+        if (!o->open_pending) {
+            ASSERT(mux->num_close_ids < mux->close_ids_capacity)
+            mux->close_ids[mux->num_close_ids++] = o->stream_id;
+            BPending_Set(&mux->send_job);
+        }
+    }
+    
+    // remove from streams
+    LinkedList1_Remove(&mux->streams_list, &o->streams_list_node);
+    mux->num_streams--;
+    
+    // free event job
+    BPending_Free(&o->event_job);
+    
+    // free interfaces
+    StreamRecvInterface_Free(&o->recv_if);
+    StreamPassInterface_Free(&o->send_if);
+    
+    // free receive buffer
+    BFree(o->recv_buf);
+}
+
+StreamPassInterface * TcpMuxStream_GetSendInterface (TcpMuxStream *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->send_if;
+}
+
+StreamRecvInterface * TcpMuxStream_GetRecvInterface (TcpMuxStream *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->recv_if;
+}
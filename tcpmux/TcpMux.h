@@ -0,0 +1,270 @@
+/**
+ * @file TcpMux.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Multiplexer of TCP-like streams over a single stream connection, speaking
+ * the tcpgw protocol. Used by both the client and the server side.
+ */
+
+#ifndef BADVPN_TCPMUX_TCPMUX_H
+#define BADVPN_TCPMUX_TCPMUX_H
+
+#include <stdint.h>
+
+#include <protocol/tcpgw_proto.h>
+#include <protocol/packetproto.h>
+#include <misc/debug.h>
+#include <misc/debugerror.h>
+#include <misc/debugcounter.h>
+#include <structure/BAVL.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <system/BAddr.h>
+#include <system/BReactor.h>
+#include <flow/StreamPassInterface.h>
+#include <flow/StreamRecvInterface.h>
+#include <flow/PacketStreamSender.h>
+#include <flow/PacketProtoDecoder.h>
+
+#define TCPMUXSTREAM_EVENT_ERROR 1
+#define TCPMUXSTREAM_EVENT_ERROR_CLOSED 2
+
+/**
+ * Handler called when the peer violated the protocol.
+ * The handler must call {@link TcpMux_Disconnect} from within the job
+ * closure of this handler.
+ * 
+ * @param user as in {@link TcpMux_Init}
+ */
+typedef void (*TcpMux_handler_error) (void *user);
+
+/**
+ * Handler called when the peer opens a stream. To accept it, the handler
+ * calls {@link TcpMuxStream_InitAccept} with the given stream ID; otherwise
+ * the stream is closed.
+ * 
+ * @param user as in {@link TcpMux_Init}
+ * @param stream_id ID of the new stream
+ * @param addr address the peer wants the stream connected to
+ */
+typedef void (*TcpMux_handler_open) (void *user, uint32_t stream_id, BAddr addr);
+
+/**
+ * Handler for stream events.
+ * 
+ * @param user as in {@link TcpMuxStream_Init}
+ * @param event TCPMUXSTREAM_EVENT_ERROR if the multiplexer was disconnected,
+ *              or TCPMUXSTREAM_EVENT_ERROR_CLOSED if the peer closed the stream
+ *              and all data it sent has been received. The stream must be
+ *              freed from within the job closure of this handler, and no
+ *              further I/O must be attempted.
+ */
+typedef void (*TcpMuxStream_handler) (void *user, int event);
+
+B_START_PACKED
+struct TcpMux__frame {
+    struct packetproto_header pp;
+    struct tcpgw_header header;
+    uint8_t payload[TCPGW_MAX_DATA];
+} B_PACKED;
+B_END_PACKED
+
+typedef struct {
+    int window;
+    BReactor *reactor;
+    void *user;
+    TcpMux_handler_error handler_error;
+    TcpMux_handler_open handler_open;
+    uint32_t *close_ids;
+    int close_ids_capacity;
+    int num_close_ids;
+    BAVL streams_tree;
+    LinkedList1 streams_list;
+    LinkedList1 send_list;
+    int num_streams;
+    uint32_t next_stream_id;
+    int accepting;
+    uint32_t accepting_id;
+    int accepted;
+    BPending send_job;
+    int have_server;
+    PacketPassInterface recv_if;
+    PacketProtoDecoder recv_decoder;
+    PacketStreamSender send_sender;
+    PacketPassInterface *send_if;
+    int sending;
+    struct TcpMux__frame send_frame;
+    DebugObject d_obj;
+    DebugCounter d_streams_ctr;
+} TcpMux;
+
+typedef struct {
+    TcpMux *mux;
+    uint32_t stream_id;
+    TcpMuxStream_handler handler;
+    void *user;
+    BAVLNode streams_tree_node;
+    LinkedList1Node streams_list_node;
+    LinkedList1Node send_list_node;
+    int in_send_list;
+    int state;
+    int open_pending;
+    BAddr addr;
+    StreamPassInterface send_if;
+    uint8_t *send_data;
+    int send_len;
+    int send_window;
+    StreamRecvInterface recv_if;
+    uint8_t *recv_buf;
+    int recv_start;
+    int recv_used;
+    uint8_t *recv_dest;
+    int recv_avail;
+    int window_pending;
+    BPending event_job;
+    int event;
+    DebugError d_err;
+    DebugObject d_obj;
+} TcpMuxStream;
+
+/**
+ * Initializes the multiplexer, not connected.
+ * 
+ * @param o the object
+ * @param window receive buffer of each stream, in bytes. Must be
+ *               >=TCPGW_INITIAL_WINDOW.
+ * @param reactor reactor we live in
+ * @param user value passed to handlers
+ * @param handler_error handler called on protocol errors
+ * @param handler_open handler called when the peer opens a stream, or NULL
+ *                     if the peer is not allowed to (the client side)
+ * @return 1 on success, 0 on failure
+ */
+int TcpMux_Init (TcpMux *o, int window, BReactor *reactor, void *user,
+                 TcpMux_handler_error handler_error, TcpMux_handler_open handler_open) WARN_UNUSED;
+
+/**
+ * Frees the multiplexer.
+ * There must be no streams.
+ * 
+ * @param o the object
+ */
+void TcpMux_Free (TcpMux *o);
+
+/**
+ * Connects the multiplexer to the connection carrying its streams.
+ * Must not be connected.
+ * 
+ * @param o the object
+ * @param send_if interface for sending to the peer
+ * @param recv_if interface for receiving from the peer
+ * @return 1 on success, 0 on failure
+ */
+int TcpMux_Connect (TcpMux *o, StreamPassInterface *send_if, StreamRecvInterface *recv_if) WARN_UNUSED;
+
+/**
+ * Disconnects the multiplexer. Must be connected.
+ * All streams are reported TCPMUXSTREAM_EVENT_ERROR.
+ * 
+ * @param o the object
+ */
+void TcpMux_Disconnect (TcpMux *o);
+
+/**
+ * Returns whether the multiplexer is connected.
+ * 
+ * @param o the object
+ * @return 1 if connected, 0 if not
+ */
+int TcpMux_IsConnected (TcpMux *o);
+
+/**
+ * Returns the number of streams which have not been freed yet.
+ * 
+ * @param o the object
+ * @return number of streams
+ */
+int TcpMux_GetNumStreams (TcpMux *o);
+
+/**
+ * Opens a stream to the given address. The peer connects it in the
+ * background; data may be sent right away, and is delivered once it does.
+ * The multiplexer must be connected, and peers must not be allowed to open
+ * streams (handler_open is NULL).
+ * 
+ * @param o the object
+ * @param mux the multiplexer
+ * @param addr address to connect the stream to. Must be IPv4 or IPv6.
+ * @param handler handler for stream events
+ * @param user value passed to handler
+ * @return 1 on success, 0 on failure
+ */
+int TcpMuxStream_Init (TcpMuxStream *o, TcpMux *mux, BAddr addr, TcpMuxStream_handler handler, void *user) WARN_UNUSED;
+
+/**
+ * Accepts a stream opened by the peer.
+ * Must be called from within the handler_open handler of the multiplexer,
+ * at most once.
+ * 
+ * @param o the object
+ * @param mux the multiplexer
+ * @param stream_id stream ID, as passed to handler_open
+ * @param handler handler for stream events
+ * @param user value passed to handler
+ * @return 1 on success, 0 on failure
+ */
+int TcpMuxStream_InitAccept (TcpMuxStream *o, TcpMux *mux, uint32_t stream_id, TcpMuxStream_handler handler, void *user) WARN_UNUSED;
+
+/**
+ * Frees the stream. Unless the peer has closed it or the multiplexer was
+ * disconnected, the stream is closed after the data already accepted by
+ * the send interface; data not yet accepted is discarded.
+ * 
+ * @param o the object
+ */
+void TcpMuxStream_Free (TcpMuxStream *o);
+
+/**
+ * Returns the interface for sending data on the stream.
+ * 
+ * @param o the object
+ * @return send interface
+ */
+StreamPassInterface * TcpMuxStream_GetSendInterface (TcpMuxStream *o);
+
+/**
+ * Returns the interface for receiving data from the stream.
+ * 
+ * @param o the object
+ * @return receive interface
+ */
+StreamRecvInterface * TcpMuxStream_GetRecvInterface (TcpMuxStream *o);
+
+#endif
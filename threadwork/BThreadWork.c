@@ -37,7 +37,11 @@
 #endif
 
 #include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/probe.h>
+#include <misc/batomic.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
 
 #include <generated/blog_channel_BThreadWork.h>
 
@@ -45,43 +49,132 @@
 
 #ifdef BADVPN_THREADWORK_USE_PTHREAD
 
-static void * dispatcher_thread (struct BThreadWorkDispatcher_thread *t)
+#define TYPE_AVG_UNKNOWN UINT32_MAX
+
+static struct BThreadWorkDispatcher_type * get_type (BThreadWorkDispatcher *o, BThreadWork_work_func work_func)
 {
-    BThreadWorkDispatcher *o = t->d;
+    for (int i = 0; i < o->num_types; i++) {
+        if (o->types[i].work_func == work_func) {
+            return &o->types[i];
+        }
+    }
     
-    ASSERT_FORCE(pthread_mutex_lock(&o->mutex) == 0)
+    // take a free entry, or else replace one round-robin
+    struct BThreadWorkDispatcher_type *t;
+    if (o->num_types < BTHREADWORK_NUM_TYPES) {
+        t = &o->types[o->num_types++];
+    } else {
+        t = &o->types[o->next_type];
+        o->next_type = (o->next_type + 1) % BTHREADWORK_NUM_TYPES;
+    }
     
-    while (1) {
-        // exit if requested
-        if (o->cancel) {
-            break;
+    t->work_func = work_func;
+    batomic_store_uint32_relaxed(&t->avg_ns, TYPE_AVG_UNKNOWN);
+    
+    return t;
+}
+
+static void type_add_sample (struct BThreadWorkDispatcher_type *t, uint64_t ns)
+{
+    uint32_t sample = (ns < TYPE_AVG_UNKNOWN ? ns : TYPE_AVG_UNKNOWN - 1);
+    
+    // moving average with weight 1/8; threads updating it at the same time
+    // may lose a sample, which does not matter
+    uint32_t avg = batomic_load_uint32_relaxed(&t->avg_ns);
+    avg = (avg == TYPE_AVG_UNKNOWN ? sample : avg - avg / 8 + sample / 8);
+    batomic_store_uint32_relaxed(&t->avg_ns, avg);
+}
+
+static int all_threads_idle (BThreadWorkDispatcher *o)
+{
+    for (int i = 0; i < o->num_threads; i++) {
+        if (!batomic_load_int(&o->threads[i].idle)) {
+            return 0;
         }
+    }
+    
+    return 1;
+}
+
+static int should_run_inline (BThreadWorkDispatcher *o, struct BThreadWorkDispatcher_type *t)
+{
+    // works never measured or too expensive go to threads
+    uint32_t avg = batomic_load_uint32_relaxed(&t->avg_ns);
+    if (avg > BTHREADWORK_INLINE_MAX_NS) {
+        return 0;
+    }
+    
+    // busy threads mean there is load to spread
+    if (!all_threads_idle(o)) {
+        return 0;
+    }
+    
+    // charge the expected time to the budget of the current period
+    uint64_t now = BMetrics_Now();
+    if (now - o->inline_period_start >= BTHREADWORK_INLINE_PERIOD_NS) {
+        o->inline_period_start = now;
+        o->inline_spent = 0;
+    }
+    if (o->inline_spent >= BTHREADWORK_INLINE_BUDGET_NS) {
+        return 0;
+    }
+    o->inline_spent += avg;
+    
+    return 1;
+}
+
+static BThreadWork * take_work (struct BThreadWorkDispatcher_thread *t)
+{
+    BThreadWorkDispatcher *o = t->d;
+    
+    // take the oldest work from our own queue, or else steal the newest work
+    // from another queue, to stay away from the end its owner works on
+    for (int k = 0; k < o->num_threads; k++) {
+        struct BThreadWorkDispatcher_thread *v = &o->threads[(t->index + k) % o->num_threads];
         
-        if (LinkedList1_IsEmpty(&o->pending_list)) {
-            // wait for event
-            ASSERT_FORCE(pthread_cond_wait(&t->new_cond, &o->mutex) == 0)
-            continue;
+        ASSERT_FORCE(pthread_mutex_lock(&v->mutex) == 0)
+        
+        BThreadWork *w = NULL;
+        if (!LinkedList1_IsEmpty(&v->pending_list)) {
+            LinkedList1Node *node = (k == 0 ? LinkedList1_GetFirst(&v->pending_list) : LinkedList1_GetLast(&v->pending_list));
+            w = UPPER_OBJECT(node, BThreadWork, list_node);
+            ASSERT(w->state == BTHREADWORK_STATE_PENDING)
+            LinkedList1_Remove(&v->pending_list, &w->list_node);
+            w->state = BTHREADWORK_STATE_RUNNING;
         }
         
-        // grab the work
-        BThreadWork *w = UPPER_OBJECT(LinkedList1_GetFirst(&o->pending_list), BThreadWork, list_node);
-        ASSERT(w->state == BTHREADWORK_STATE_PENDING)
-        LinkedList1_Remove(&o->pending_list, &w->list_node);
-        t->running_work = w;
-        w->state = BTHREADWORK_STATE_RUNNING;
-        
-        // do the work
-        ASSERT_FORCE(pthread_mutex_unlock(&o->mutex) == 0)
-        w->work_func(w->work_func_user);
-        ASSERT_FORCE(pthread_mutex_lock(&o->mutex) == 0)
-        
-        // release the work
-        t->running_work = NULL;
-        LinkedList1_Append(&o->finished_list, &w->list_node);
-        w->state = BTHREADWORK_STATE_FINISHED;
-        ASSERT_FORCE(sem_post(&w->finished_sem) == 0)
-        
-        // write to pipe
+        ASSERT_FORCE(pthread_mutex_unlock(&v->mutex) == 0)
+        
+        if (w) {
+            return w;
+        }
+    }
+    
+    return NULL;
+}
+
+static void run_work (BThreadWorkDispatcher *o, BThreadWork *w)
+{
+    BMetrics_ObserveSince(BMETRICS_HISTOGRAM_THREADWORK_WAIT_NS, w->queued_time);
+    
+    // do the work
+    BPROBE1(threadwork_start, w);
+    uint64_t start = BMetrics_Now();
+    w->work_func(w->work_func_user);
+    type_add_sample(w->type, BMetrics_Now() - start);
+    BPROBE1(threadwork_finish, w);
+    
+    // release the work
+    ASSERT_FORCE(pthread_mutex_lock(&o->finished_mutex) == 0)
+    LinkedList1_Append(&o->finished_list, &w->list_node);
+    w->state = BTHREADWORK_STATE_FINISHED;
+    ASSERT_FORCE(sem_post(&w->finished_sem) == 0)
+    int signal = !o->finished_signalled;
+    o->finished_signalled = 1;
+    ASSERT_FORCE(pthread_mutex_unlock(&o->finished_mutex) == 0)
+    
+    // write to pipe, only for the first work in a batch
+    if (signal) {
         uint8_t b = 0;
         int res = write(o->pipe[1], &b, sizeof(b));
         if (res < 0) {
@@ -89,44 +182,78 @@ static void * dispatcher_thread (struct BThreadWorkDispatcher_thread *t)
             ASSERT_FORCE(error == EAGAIN || error == EWOULDBLOCK)
         }
     }
-    
-    ASSERT_FORCE(pthread_mutex_unlock(&o->mutex) == 0)
-    
-    return NULL;
 }
 
-static void dispatch_job (BThreadWorkDispatcher *o)
+static void * dispatcher_thread (struct BThreadWorkDispatcher_thread *t)
 {
-    ASSERT(o->num_threads > 0)
-    
-    // lock
-    ASSERT_FORCE(pthread_mutex_lock(&o->mutex) == 0)
+    BThreadWorkDispatcher *o = t->d;
     
-    // check for finished job
-    if (LinkedList1_IsEmpty(&o->finished_list)) {
-        ASSERT_FORCE(pthread_mutex_unlock(&o->mutex) == 0)
-        return;
+    // bind to our CPU before touching anything, so that memory we touch
+    // first ends up on the local NUMA node
+    if (o->cpus && !BCpuSet_IsEmpty(o->cpus)) {
+        if (!BCpuSet_BindThreadToIndex(o->cpus, t->index)) {
+            BLog(BLOG_WARNING, "thread %d: failed to bind to CPU %d", t->index, BCpuSet_GetCpu(o->cpus, t->index));
+        } else {
+            BLog(BLOG_INFO, "thread %d: bound to CPU %d", t->index, BCpuSet_GetCpu(o->cpus, t->index));
+        }
     }
     
-    // grab finished job
-    BThreadWork *w = UPPER_OBJECT(LinkedList1_GetFirst(&o->finished_list), BThreadWork, list_node);
-    ASSERT(w->state == BTHREADWORK_STATE_FINISHED)
-    LinkedList1_Remove(&o->finished_list, &w->list_node);
-    
-    // schedule more
-    if (!LinkedList1_IsEmpty(&o->finished_list)) {
-        BPending_Set(&o->more_job);
+    while (1) {
+        // exit if requested
+        if (batomic_load_int(&o->cancel)) {
+            break;
+        }
+        
+        BThreadWork *w = take_work(t);
+        
+        if (!w) {
+            // announce that we are idle, then look again, so that a work
+            // queued without seeing us idle is not missed
+            batomic_store_int(&t->idle, 1);
+            
+            w = take_work(t);
+            
+            if (!w) {
+                // wait for event
+                ASSERT_FORCE(pthread_mutex_lock(&t->mutex) == 0)
+                while (!t->wake && LinkedList1_IsEmpty(&t->pending_list)) {
+                    ASSERT_FORCE(pthread_cond_wait(&t->new_cond, &t->mutex) == 0)
+                }
+                t->wake = 0;
+                ASSERT_FORCE(pthread_mutex_unlock(&t->mutex) == 0)
+            }
+            
+            batomic_store_int(&t->idle, 0);
+            
+            if (!w) {
+                continue;
+            }
+        }
+        
+        run_work(o, w);
     }
     
-    // set state forgotten
-    w->state = BTHREADWORK_STATE_FORGOTTEN;
-    
-    // unlock
-    ASSERT_FORCE(pthread_mutex_unlock(&o->mutex) == 0)
+    return NULL;
+}
+
+static void wake_thread (struct BThreadWorkDispatcher_thread *t)
+{
+    ASSERT_FORCE(pthread_mutex_lock(&t->mutex) == 0)
+    t->wake = 1;
+    ASSERT_FORCE(pthread_cond_signal(&t->new_cond) == 0)
+    ASSERT_FORCE(pthread_mutex_unlock(&t->mutex) == 0)
+}
+
+static struct BThreadWorkDispatcher_thread * find_idle_thread (BThreadWorkDispatcher *o)
+{
+    for (int k = 0; k < o->num_threads; k++) {
+        struct BThreadWorkDispatcher_thread *t = &o->threads[(o->next_thread + k) % o->num_threads];
+        if (batomic_load_int(&t->idle)) {
+            return t;
+        }
+    }
     
-    // call handler
-    w->handler_done(w->user);
-    return;
+    return NULL;
 }
 
 static void pipe_fd_handler (BThreadWorkDispatcher *o, int events)
@@ -144,39 +271,78 @@ static void pipe_fd_handler (BThreadWorkDispatcher *o, int events)
         ASSERT(res > 0)
     }
     
-    dispatch_job(o);
-    return;
+    // take all finished works
+    ASSERT_FORCE(pthread_mutex_lock(&o->finished_mutex) == 0)
+    o->finished_signalled = 0;
+    while (!LinkedList1_IsEmpty(&o->finished_list)) {
+        BThreadWork *w = UPPER_OBJECT(LinkedList1_GetFirst(&o->finished_list), BThreadWork, list_node);
+        ASSERT(w->state == BTHREADWORK_STATE_FINISHED)
+        LinkedList1_Remove(&o->finished_list, &w->list_node);
+        LinkedList1_Append(&o->ready_list, &w->list_node);
+        w->state = BTHREADWORK_STATE_READY;
+    }
+    ASSERT_FORCE(pthread_mutex_unlock(&o->finished_mutex) == 0)
+    
+    // dispatch them
+    if (!LinkedList1_IsEmpty(&o->ready_list)) {
+        BPending_Set(&o->more_job);
+    }
 }
 
 static void more_job_handler (BThreadWorkDispatcher *o)
 {
     ASSERT(o->num_threads > 0)
+    ASSERT(!LinkedList1_IsEmpty(&o->ready_list))
     DebugObject_Access(&o->d_obj);
     
-    dispatch_job(o);
+    // grab finished work
+    BThreadWork *w = UPPER_OBJECT(LinkedList1_GetFirst(&o->ready_list), BThreadWork, list_node);
+    ASSERT(w->state == BTHREADWORK_STATE_READY)
+    LinkedList1_Remove(&o->ready_list, &w->list_node);
+    
+    // schedule more
+    if (!LinkedList1_IsEmpty(&o->ready_list)) {
+        BPending_Set(&o->more_job);
+    }
+    
+    // set state forgotten
+    w->state = BTHREADWORK_STATE_FORGOTTEN;
+    
+    // call handler
+    BPROBE1(threadwork_done, w);
+    w->handler_done(w->user);
     return;
 }
 
-static void stop_threads (BThreadWorkDispatcher *o)
+static void stop_threads (BThreadWorkDispatcher *o, int num_started)
 {
     // set cancelling
-    ASSERT_FORCE(pthread_mutex_lock(&o->mutex) == 0)
-    o->cancel = 1;
-    ASSERT_FORCE(pthread_mutex_unlock(&o->mutex) == 0)
+    batomic_store_int(&o->cancel, 1);
     
-    while (o->num_threads > 0) {
-        struct BThreadWorkDispatcher_thread *t = &o->threads[o->num_threads - 1];
+    for (int i = 0; i < num_started; i++) {
+        struct BThreadWorkDispatcher_thread *t = &o->threads[i];
         
         // wake up thread
-        ASSERT_FORCE(pthread_cond_signal(&t->new_cond) == 0)
+        wake_thread(t);
         
         // wait for thread to exit
         ASSERT_FORCE(pthread_join(t->thread, NULL) == 0)
+    }
+}
+
+static void free_thread_queues (BThreadWorkDispatcher *o, int num_inited)
+{
+    while (num_inited > 0) {
+        struct BThreadWorkDispatcher_thread *t = &o->threads[num_inited - 1];
+        ASSERT(LinkedList1_IsEmpty(&t->pending_list))
         
         // free condition variable
         ASSERT_FORCE(pthread_cond_destroy(&t->new_cond) == 0)
         
-        o->num_threads--;
+        // free mutex
+        ASSERT_FORCE(pthread_mutex_destroy(&t->mutex) == 0)
+        
+        num_inited--;
     }
 }
 
@@ -185,44 +351,66 @@ static void stop_threads (BThreadWorkDispatcher *o)
 static void work_job_handler (BThreadWork *o)
 {
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
-    ASSERT(o->d->num_threads == 0)
+    ASSERT(o->d->num_threads == 0 || o->is_inline)
     #endif
     DebugObject_Access(&o->d_obj);
     
     // do the work
-    o->work_func(o->work_func_user);
+    BPROBE1(threadwork_start, o);
+    #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    if (o->is_inline) {
+        uint64_t start = BMetrics_Now();
+        o->work_func(o->work_func_user);
+        type_add_sample(o->type, BMetrics_Now() - start);
+    } else
+    #endif
+    {
+        o->work_func(o->work_func_user);
+    }
+    BPROBE1(threadwork_finish, o);
     
     // call handler
+    BPROBE1(threadwork_done, o);
     o->handler_done(o->user);
     return;
 }
 
 int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint)
+{
+    return BThreadWorkDispatcher_Init2(o, reactor, num_threads_hint, NULL);
+}
+
+int BThreadWorkDispatcher_Init2 (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint, const BCpuSet *cpus)
 {
     // init arguments
     o->reactor = reactor;
     
-    if (num_threads_hint < 0) {
-        num_threads_hint = 2;
-    }
-    if (num_threads_hint > BTHREADWORK_MAX_THREADS) {
-        num_threads_hint = BTHREADWORK_MAX_THREADS;
+    #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    
+    o->cpus = cpus;
+    
+    if (num_threads_hint < 0 && cpus && !BCpuSet_IsEmpty(cpus)) {
+        num_threads_hint = BCpuSet_GetNumCpus(cpus);
+    } else if (num_threads_hint < 0) {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads_hint = (num_cpus > 0 ? num_cpus : 1);
     }
     
-    #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    o->num_threads = 0;
     
     if (num_threads_hint > 0) {
-        // init pending list
-        LinkedList1_Init(&o->pending_list);
-        
         // init finished list
         LinkedList1_Init(&o->finished_list);
         
-        // init mutex
-        if (pthread_mutex_init(&o->mutex, NULL) != 0) {
+        // init ready list
+        LinkedList1_Init(&o->ready_list);
+        
+        // init finished mutex
+        if (pthread_mutex_init(&o->finished_mutex, NULL) != 0) {
             BLog(BLOG_ERROR, "pthread_mutex_init failed");
             goto fail0;
         }
+        o->finished_signalled = 0;
         
         // init pipe
         if (pipe(o->pipe) < 0) {
@@ -256,31 +444,59 @@ int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int
         // set not cancelling
         o->cancel = 0;
         
-        // init threads
-        o->num_threads = 0;
-        for (int i = 0; i < num_threads_hint; i++) {
-            struct BThreadWorkDispatcher_thread *t = &o->threads[i];
+        // allocate threads
+        if (!(o->threads = BAllocArray(num_threads_hint, sizeof(o->threads[0])))) {
+            BLog(BLOG_ERROR, "BAllocArray failed");
+            goto fail3;
+        }
+        
+        // init thread queues; all of them must exist before any thread
+        // starts, since threads steal from each other
+        for (o->num_threads = 0; o->num_threads < num_threads_hint; o->num_threads++) {
+            struct BThreadWorkDispatcher_thread *t = &o->threads[o->num_threads];
             
-            // set parent pointer
+            // set parent pointer and index
             t->d = o;
+            t->index = o->num_threads;
             
-            // set no running work
-            t->running_work = NULL;
+            // init mutex
+            if (pthread_mutex_init(&t->mutex, NULL) != 0) {
+                BLog(BLOG_ERROR, "pthread_mutex_init failed");
+                goto fail4;
+            }
             
             // init condition variable
             if (pthread_cond_init(&t->new_cond, NULL) != 0) {
                 BLog(BLOG_ERROR, "pthread_cond_init failed");
-                goto fail3;
+                ASSERT_FORCE(pthread_mutex_destroy(&t->mutex) == 0)
+                goto fail4;
             }
             
-            // init thread
+            // init pending list
+            LinkedList1_Init(&t->pending_list);
+            
+            // set not idle
+            t->idle = 0;
+            t->wake = 0;
+        }
+        
+        o->next_thread = 0;
+        
+        // no work functions known yet
+        o->num_types = 0;
+        o->next_type = 0;
+        o->inline_period_start = 0;
+        o->inline_spent = 0;
+        
+        // start threads
+        for (int i = 0; i < o->num_threads; i++) {
+            struct BThreadWorkDispatcher_thread *t = &o->threads[i];
+            
             if (pthread_create(&t->thread, NULL, (void * (*) (void *))dispatcher_thread, t) != 0) {
                 BLog(BLOG_ERROR, "pthread_create failed");
-                ASSERT_FORCE(pthread_cond_destroy(&t->new_cond) == 0)
-                goto fail3;
+                stop_threads(o, i);
+                goto fail4;
             }
-        
-            o->num_threads++;
         }
     }
     
@@ -291,15 +507,18 @@ int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int
     return 1;
     
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
+fail4:
+    free_thread_queues(o, o->num_threads);
+    o->num_threads = 0;
+    BFree(o->threads);
 fail3:
-    stop_threads(o);
     BPending_Free(&o->more_job);
     BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
 fail2:
     ASSERT_FORCE(close(o->pipe[0]) == 0)
     ASSERT_FORCE(close(o->pipe[1]) == 0)
 fail1:
-    ASSERT_FORCE(pthread_mutex_destroy(&o->mutex) == 0)
+    ASSERT_FORCE(pthread_mutex_destroy(&o->finished_mutex) == 0)
 fail0:
     return 0;
     #endif
@@ -309,9 +528,8 @@ void BThreadWorkDispatcher_Free (BThreadWorkDispatcher *o)
 {
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
     if (o->num_threads > 0) {
-        ASSERT(LinkedList1_IsEmpty(&o->pending_list))
-        for (int i = 0; i < o->num_threads; i++) { ASSERT(!o->threads[i].running_work) }
         ASSERT(LinkedList1_IsEmpty(&o->finished_list))
+        ASSERT(LinkedList1_IsEmpty(&o->ready_list))
     }
     #endif
     DebugObject_Free(&o->d_obj);
@@ -321,7 +539,13 @@ void BThreadWorkDispatcher_Free (BThreadWorkDispatcher *o)
     
     if (o->num_threads > 0) {
         // stop threads
-        stop_threads(o);
+        stop_threads(o, o->num_threads);
+        
+        // free thread queues
+        free_thread_queues(o, o->num_threads);
+        
+        // free threads array
+        BFree(o->threads);
         
         // free more job
         BPending_Free(&o->more_job);
@@ -333,8 +557,8 @@ void BThreadWorkDispatcher_Free (BThreadWorkDispatcher *o)
         ASSERT_FORCE(close(o->pipe[0]) == 0)
         ASSERT_FORCE(close(o->pipe[1]) == 0)
         
-        // free mutex
-        ASSERT_FORCE(pthread_mutex_destroy(&o->mutex) == 0)
+        // free finished mutex
+        ASSERT_FORCE(pthread_mutex_destroy(&o->finished_mutex) == 0)
     }
     
     #endif
@@ -361,26 +585,48 @@ void BThreadWork_Init (BThreadWork *o, BThreadWorkDispatcher *d, BThreadWork_han
     o->work_func_user = work_func_user;
     
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    o->is_inline = 0;
     if (d->num_threads > 0) {
-        // set state
-        o->state = BTHREADWORK_STATE_PENDING;
-        
+        // decide whether to do the work in the event loop
+        o->type = get_type(d, work_func);
+        o->is_inline = should_run_inline(d, o->type);
+        if (o->is_inline) {
+            BMetrics_Count(BMETRICS_COUNTER_THREADWORK_INLINE, 1);
+        }
+    }
+    
+    if (d->num_threads > 0 && !o->is_inline) {
         // init finished semaphore
         ASSERT_FORCE(sem_init(&o->finished_sem, 0, 0) == 0)
         
+        // choose a thread, preferring an idle one
+        struct BThreadWorkDispatcher_thread *t = find_idle_thread(d);
+        if (!t) {
+            t = &d->threads[d->next_thread];
+        }
+        d->next_thread = (t->index + 1) % d->num_threads;
+        
         // post work
-        ASSERT_FORCE(pthread_mutex_lock(&d->mutex) == 0)
-        LinkedList1_Append(&d->pending_list, &o->list_node);
-        for (int i = 0; i < d->num_threads; i++) {
-            if (!d->threads[i].running_work) {
-                ASSERT_FORCE(pthread_cond_signal(&d->threads[i].new_cond) == 0)
-                break;
-            }
+        BPROBE2(threadwork_submit, o, t->index);
+        o->queued_time = BMetrics_Start();
+        ASSERT_FORCE(pthread_mutex_lock(&t->mutex) == 0)
+        o->state = BTHREADWORK_STATE_PENDING;
+        o->thread_index = t->index;
+        LinkedList1_Append(&t->pending_list, &o->list_node);
+        ASSERT_FORCE(pthread_mutex_unlock(&t->mutex) == 0)
+        
+        // wake up the chosen thread if it is idle, otherwise any idle thread
+        // which can steal the work; pairs with the idle announcement in
+        // dispatcher_thread
+        batomic_fence();
+        struct BThreadWorkDispatcher_thread *wt = (batomic_load_int(&t->idle) ? t : find_idle_thread(d));
+        if (wt) {
+            wake_thread(wt);
         }
-        ASSERT_FORCE(pthread_mutex_unlock(&d->mutex) == 0)
     } else {
     #endif
         // schedule job
+        BPROBE2(threadwork_submit, o, -1);
         BPending_Init(&o->job, BReactor_PendingGroup(d->reactor), (BPending_handler)work_job_handler, o);
         BPending_Set(&o->job);
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
@@ -398,24 +644,30 @@ void BThreadWork_Free (BThreadWork *o)
     DebugCounter_Decrement(&d->d_ctr);
     
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
-    if (d->num_threads > 0) {
-        ASSERT_FORCE(pthread_mutex_lock(&d->mutex) == 0)
+    if (d->num_threads > 0 && !o->is_inline) {
+        struct BThreadWorkDispatcher_thread *t = &d->threads[o->thread_index];
+        
+        // workers change the state under either of these, and never hold both
+        ASSERT_FORCE(pthread_mutex_lock(&t->mutex) == 0)
+        ASSERT_FORCE(pthread_mutex_lock(&d->finished_mutex) == 0)
         
         switch (o->state) {
             case BTHREADWORK_STATE_PENDING: {
                 BLog(BLOG_DEBUG, "remove pending work");
                 
                 // remove from pending list
-                LinkedList1_Remove(&d->pending_list, &o->list_node);
+                LinkedList1_Remove(&t->pending_list, &o->list_node);
             } break;
             
             case BTHREADWORK_STATE_RUNNING: {
                 BLog(BLOG_DEBUG, "remove running work");
                 
                 // wait for the work to finish running
-                ASSERT_FORCE(pthread_mutex_unlock(&d->mutex) == 0)
+                ASSERT_FORCE(pthread_mutex_unlock(&d->finished_mutex) == 0)
+                ASSERT_FORCE(pthread_mutex_unlock(&t->mutex) == 0)
                 ASSERT_FORCE(sem_wait(&o->finished_sem) == 0)
-                ASSERT_FORCE(pthread_mutex_lock(&d->mutex) == 0)
+                ASSERT_FORCE(pthread_mutex_lock(&t->mutex) == 0)
+                ASSERT_FORCE(pthread_mutex_lock(&d->finished_mutex) == 0)
                 
                 ASSERT(o->state == BTHREADWORK_STATE_FINISHED)
                 
@@ -430,6 +682,13 @@ void BThreadWork_Free (BThreadWork *o)
                 LinkedList1_Remove(&d->finished_list, &o->list_node);
             } break;
             
+            case BTHREADWORK_STATE_READY: {
+                BLog(BLOG_DEBUG, "remove ready work");
+                
+                // remove from ready list
+                LinkedList1_Remove(&d->ready_list, &o->list_node);
+            } break;
+            
             case BTHREADWORK_STATE_FORGOTTEN: {
                 BLog(BLOG_DEBUG, "remove forgotten work");
             } break;
@@ -438,7 +697,8 @@ void BThreadWork_Free (BThreadWork *o)
                 ASSERT(0);
         }
         
-        ASSERT_FORCE(pthread_mutex_unlock(&d->mutex) == 0)
+        ASSERT_FORCE(pthread_mutex_unlock(&d->finished_mutex) == 0)
+        ASSERT_FORCE(pthread_mutex_unlock(&t->mutex) == 0)
         
         // free finished semaphore
         ASSERT_FORCE(sem_destroy(&o->finished_sem) == 0)
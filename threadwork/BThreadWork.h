@@ -44,13 +44,25 @@
 #include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <system/BReactor.h>
+#include <system/BCpuSet.h>
 
 #define BTHREADWORK_STATE_PENDING 1
 #define BTHREADWORK_STATE_RUNNING 2
 #define BTHREADWORK_STATE_FINISHED 3
 #define BTHREADWORK_STATE_FORGOTTEN 4
+#define BTHREADWORK_STATE_READY 5
 
-#define BTHREADWORK_MAX_THREADS 8
+// number of work functions whose execution time is tracked
+#define BTHREADWORK_NUM_TYPES 8
+
+// works whose function takes at most this long on average, in nanoseconds,
+// may be run in the event loop
+#define BTHREADWORK_INLINE_MAX_NS 5000
+
+// at most BTHREADWORK_INLINE_BUDGET_NS of every BTHREADWORK_INLINE_PERIOD_NS
+// nanoseconds are spent running works in the event loop
+#define BTHREADWORK_INLINE_BUDGET_NS 200000
+#define BTHREADWORK_INLINE_PERIOD_NS 1000000
 
 struct BThreadWork_s;
 struct BThreadWorkDispatcher_s;
@@ -73,24 +85,41 @@ typedef void (*BThreadWork_handler_done) (void *user);
 #ifdef BADVPN_THREADWORK_USE_PTHREAD
 struct BThreadWorkDispatcher_thread {
     struct BThreadWorkDispatcher_s *d;
-    struct BThreadWork_s *running_work;
+    int index;
+    pthread_mutex_t mutex;
     pthread_cond_t new_cond;
+    LinkedList1 pending_list;
+    int idle;
+    int wake;
     pthread_t thread;
 };
+
+struct BThreadWorkDispatcher_type {
+    BThreadWork_work_func work_func;
+    uint32_t avg_ns;
+};
 #endif
 
 typedef struct BThreadWorkDispatcher_s {
     BReactor *reactor;
     #ifdef BADVPN_THREADWORK_USE_PTHREAD
-    LinkedList1 pending_list;
     LinkedList1 finished_list;
-    pthread_mutex_t mutex;
+    pthread_mutex_t finished_mutex;
+    int finished_signalled;
+    LinkedList1 ready_list;
     int pipe[2];
     BFileDescriptor bfd;
     BPending more_job;
     int cancel;
     int num_threads;
-    struct BThreadWorkDispatcher_thread threads[BTHREADWORK_MAX_THREADS];
+    int next_thread;
+    const BCpuSet *cpus;
+    struct BThreadWorkDispatcher_thread *threads;
+    struct BThreadWorkDispatcher_type types[BTHREADWORK_NUM_TYPES];
+    int num_types;
+    int next_type;
+    uint64_t inline_period_start;
+    uint64_t inline_spent;
     #endif
     DebugObject d_obj;
     DebugCounter d_ctr;
@@ -102,12 +131,18 @@ typedef struct BThreadWork_s {
     void *user;
     BThreadWork_work_func work_func;
     void *work_func_user;
+    #ifdef BADVPN_THREADWORK_USE_PTHREAD
+    struct BThreadWorkDispatcher_type *type;
+    int is_inline;
+    #endif
     union {
         #ifdef BADVPN_THREADWORK_USE_PTHREAD
         struct {
             LinkedList1Node list_node;
             int state;
+            int thread_index;
             sem_t finished_sem;
+            uint64_t queued_time;
         };
         #endif
         struct {
@@ -121,16 +156,50 @@ typedef struct BThreadWork_s {
  * Initializes the work dispatcher.
  * Works may be started using {@link BThreadWork_Init}.
  * 
+ * When threads are used, each thread has its own queue of pending works.
+ * New works are queued on an idle thread if there is one, otherwise
+ * round-robin; a thread whose queue is empty steals the most recently
+ * queued work of another thread. Finished works are collected in one list,
+ * and the event loop is only woken up when that list becomes non-empty,
+ * so many finished works are picked up with a single wakeup.
+ * 
+ * The dispatcher keeps an average execution time for each work function.
+ * When handing a work to a thread would cost more than doing it, that is,
+ * its function takes at most BTHREADWORK_INLINE_MAX_NS on average and all
+ * threads are idle, the work is instead done in the event loop, as if there
+ * were no threads. This is limited to BTHREADWORK_INLINE_BUDGET_NS of every
+ * BTHREADWORK_INLINE_PERIOD_NS, so that under load, works still go to threads.
+ * 
  * @param o the object
  * @param reactor reactor we live in
  * @param num_threads_hint hint for the number of threads to use:
- *                         <0 - A choice will be made automatically, probably based on the number of CPUs.
+ *                         <0 - One thread will be used for every online CPU.
  *                         0 - No additional threads will be used, and computations will be performed directly
  *                             in the event loop in job handlers.
  * @return 1 on success, 0 on failure
  */
 int BThreadWorkDispatcher_Init (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint) WARN_UNUSED;
 
+/**
+ * Initializes the work dispatcher, binding its threads to CPUs.
+ * Like {@link BThreadWorkDispatcher_Init}, except that, if cpus is not NULL
+ * and not empty, thread i binds itself to the CPU returned by
+ * {@link BCpuSet_GetCpu} for index i before it takes any work, so that its
+ * stack and anything else it touches first is placed on the NUMA node of
+ * that CPU. Failure to bind a thread is logged, and the thread keeps running
+ * unbound.
+ * 
+ * @param o the object
+ * @param reactor reactor we live in
+ * @param num_threads_hint as in {@link BThreadWorkDispatcher_Init}, except that
+ *                         <0 means one thread for every CPU in cpus if cpus is
+ *                         not NULL and not empty
+ * @param cpus CPUs to bind threads to, or NULL. If not NULL, must remain valid
+ *             until the dispatcher is freed.
+ * @return 1 on success, 0 on failure
+ */
+int BThreadWorkDispatcher_Init2 (BThreadWorkDispatcher *o, BReactor *reactor, int num_threads_hint, const BCpuSet *cpus) WARN_UNUSED;
+
 /**
  * Frees the work dispatcher.
  * There must be no {@link BThreadWork}'s with this dispatcher.
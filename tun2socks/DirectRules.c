@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/balloc.h>
+#include <misc/memref.h>
+#include <misc/ipaddr.h>
+#include <misc/ipaddr6.h>
+#include <misc/parse_number.h>
+#include <base/BLog.h>
+
+#include <tun2socks/DirectRules.h>
+
+#include <generated/blog_channel_DirectRules.h>
+
+struct rule {
+    int family;
+    uint8_t addr[16];
+    int prefix;
+    uint16_t port_min;
+    uint16_t port_max;
+    int direct;
+};
+
+static int parse_rule (const char *str, struct rule *out);
+static int addr_bit (const uint8_t *addr, int i);
+static int new_node (DirectRules *o, int *num_nodes);
+
+static int parse_rule (const char *str, struct rule *out)
+{
+    MemRef rest = MemRef_MakeCstr(str);
+    
+    // exception
+    out->direct = 1;
+    if (rest.len > 0 && rest.ptr[0] == '!') {
+        out->direct = 0;
+        rest = MemRef_SubFrom(rest, 1);
+    }
+    
+    // ports
+    out->port_min = 0;
+    out->port_max = UINT16_MAX;
+    size_t at;
+    if (MemRef_FindChar(rest, '@', &at)) {
+        MemRef ports = MemRef_SubFrom(rest, at + 1);
+        rest = MemRef_SubTo(rest, at);
+        
+        uintmax_t port_min;
+        uintmax_t port_max;
+        size_t dash;
+        if (MemRef_FindChar(ports, '-', &dash)) {
+            if (!parse_unsigned_integer(MemRef_SubTo(ports, dash), &port_min) ||
+                !parse_unsigned_integer(MemRef_SubFrom(ports, dash + 1), &port_max)) {
+                return 0;
+            }
+        } else {
+            if (!parse_unsigned_integer(ports, &port_min)) {
+                return 0;
+            }
+            port_max = port_min;
+        }
+        if (port_max > UINT16_MAX || port_min > port_max) {
+            return 0;
+        }
+        out->port_min = port_min;
+        out->port_max = port_max;
+    }
+    
+    // prefix
+    memset(out->addr, 0, sizeof(out->addr));
+    struct ipv4_ifaddr ifaddr4;
+    struct ipv6_ifaddr ifaddr6;
+    if (ipaddr_parse_ipv4_ifaddr(rest, &ifaddr4)) {
+        out->family = BADDR_TYPE_IPV4;
+        memcpy(out->addr, &ifaddr4.addr, 4);
+        out->prefix = ifaddr4.prefix;
+    }
+    else if (ipaddr6_parse_ipv6_ifaddr(rest, &ifaddr6)) {
+        out->family = BADDR_TYPE_IPV6;
+        memcpy(out->addr, ifaddr6.addr.bytes, 16);
+        out->prefix = ifaddr6.prefix;
+    }
+    else {
+        return 0;
+    }
+    
+    return 1;
+}
+
+static int addr_bit (const uint8_t *addr, int i)
+{
+    return (addr[i / 8] >> (7 - i % 8)) & 1;
+}
+
+static int new_node (DirectRules *o, int *num_nodes)
+{
+    int i = (*num_nodes)++;
+    o->nodes[i].children[0] = -1;
+    o->nodes[i].children[1] = -1;
+    o->nodes[i].ranges_start = 0;
+    o->nodes[i].ranges_count = 0;
+    return i;
+}
+
+int DirectRules_Init (DirectRules *o, char **rules, int num_rules)
+{
+    ASSERT(num_rules >= 0)
+    
+    // parse rules, counting how many nodes the trie may need
+    struct rule *parsed = (struct rule *)BAllocArray(num_rules, sizeof(parsed[0]));
+    if (!parsed && num_rules > 0) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    int max_nodes = 2;
+    for (int i = 0; i < num_rules; i++) {
+        if (!parse_rule(rules[i], &parsed[i])) {
+            BLog(BLOG_ERROR, "invalid rule: %s", rules[i]);
+            goto fail1;
+        }
+        max_nodes += parsed[i].prefix;
+    }
+    
+    // allocate trie
+    if (!(o->nodes = (struct DirectRules_node *)BAllocArray(max_nodes, sizeof(o->nodes[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    if (!(o->ranges = (struct DirectRules_range *)BAllocArray(num_rules + 1, sizeof(o->ranges[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail2;
+    }
+    
+    // insert prefixes, counting the rules ending at each node
+    int num_nodes = 0;
+    o->roots[0] = new_node(o, &num_nodes);
+    o->roots[1] = new_node(o, &num_nodes);
+    int *rule_nodes = (int *)BAllocArray(num_rules, sizeof(rule_nodes[0]));
+    if (!rule_nodes && num_rules > 0) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail3;
+    }
+    for (int i = 0; i < num_rules; i++) {
+        struct rule *r = &parsed[i];
+        int n = o->roots[r->family == BADDR_TYPE_IPV6];
+        for (int j = 0; j < r->prefix; j++) {
+            int bit = addr_bit(r->addr, j);
+            if (o->nodes[n].children[bit] < 0) {
+                int c = new_node(o, &num_nodes);
+                o->nodes[n].children[bit] = c;
+            }
+            n = o->nodes[n].children[bit];
+        }
+        o->nodes[n].ranges_count++;
+        rule_nodes[i] = n;
+    }
+    
+    // lay out the port ranges of each node together, in rule order
+    int pos = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        o->nodes[i].ranges_start = pos;
+        pos += o->nodes[i].ranges_count;
+        o->nodes[i].ranges_count = 0;
+    }
+    for (int i = 0; i < num_rules; i++) {
+        struct DirectRules_node *node = &o->nodes[rule_nodes[i]];
+        struct DirectRules_range *range = &o->ranges[node->ranges_start + node->ranges_count++];
+        range->port_min = parsed[i].port_min;
+        range->port_max = parsed[i].port_max;
+        range->direct = parsed[i].direct;
+    }
+    
+    BFree(rule_nodes);
+    BFree(parsed);
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail3:
+    BFree(o->ranges);
+fail2:
+    BFree(o->nodes);
+fail1:
+    BFree(parsed);
+fail0:
+    return 0;
+}
+
+void DirectRules_Free (DirectRules *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    BFree(o->ranges);
+    BFree(o->nodes);
+}
+
+int DirectRules_Match (DirectRules *o, BAddr addr)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6)
+    
+    const uint8_t *ip;
+    int bits;
+    uint16_t port = ntoh16(BAddr_GetPort(&addr));
+    if (addr.type == BADDR_TYPE_IPV6) {
+        ip = addr.ipv6.ip;
+        bits = 128;
+    } else {
+        ip = (const uint8_t *)&addr.ipv4.ip;
+        bits = 32;
+    }
+    
+    // walk down along the address, remembering the deepest matching rule
+    int direct = 0;
+    int n = o->roots[addr.type == BADDR_TYPE_IPV6];
+    for (int i = 0; ; i++) {
+        struct DirectRules_node *node = &o->nodes[n];
+        
+        for (int j = 0; j < node->ranges_count; j++) {
+            struct DirectRules_range *range = &o->ranges[node->ranges_start + j];
+            if (port >= range->port_min && port <= range->port_max) {
+                direct = range->direct;
+                break;
+            }
+        }
+        
+        if (i == bits || (n = node->children[addr_bit(ip, i)]) < 0) {
+            break;
+        }
+    }
+    
+    return direct;
+}
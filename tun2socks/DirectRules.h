@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Table of rules selecting destinations which are reached directly
+ * rather than through the proxy.
+ */
+
+#ifndef BADVPN_TUN2SOCKS_DIRECTRULES_H
+#define BADVPN_TUN2SOCKS_DIRECTRULES_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <system/BAddr.h>
+
+struct DirectRules_node {
+    int children[2];
+    int ranges_start;
+    int ranges_count;
+};
+
+struct DirectRules_range {
+    uint16_t port_min;
+    uint16_t port_max;
+    int direct;
+};
+
+typedef struct {
+    struct DirectRules_node *nodes;
+    struct DirectRules_range *ranges;
+    int roots[2];
+    DebugObject d_obj;
+} DirectRules;
+
+/**
+ * Initializes the table, compiling the rules into a binary trie per address
+ * family, so that a lookup takes at most one step per address bit.
+ * 
+ * A rule has the form [!]ADDR/PREFIX[@PORT[-PORT]], where ADDR is an IPv4 or
+ * IPv6 address, e.g. "10.0.0.0/8", "192.168.1.1/32@443" or
+ * "!fd00::/16@1000-2000". It matches destinations within the prefix, with a
+ * port in the range if one is given. Rules without "!" make destinations
+ * direct, and those with it keep them going through the proxy. Of the rules
+ * which match a destination, the one with the longest prefix applies, and of
+ * those with the same prefix, the first one given.
+ * 
+ * @param o the object
+ * @param rules array of rules
+ * @param num_rules number of rules. Must be >=0.
+ * @return 1 on success, 0 on failure, including when a rule is not valid
+ */
+int DirectRules_Init (DirectRules *o, char **rules, int num_rules) WARN_UNUSED;
+
+/**
+ * Frees the table.
+ * 
+ * @param o the object
+ */
+void DirectRules_Free (DirectRules *o);
+
+/**
+ * Determines whether a destination is to be reached directly.
+ * 
+ * @param o the object
+ * @param addr destination address. Must be IPv4 or IPv6.
+ * @return 1 if direct, 0 if through the proxy
+ */
+int DirectRules_Match (DirectRules *o, BAddr addr);
+
+#endif
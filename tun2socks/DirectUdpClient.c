@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <base/BLog.h>
+
+#include <tun2socks/DirectUdpClient.h>
+
+#include <generated/blog_channel_DirectUdpClient.h>
+
+static int addr_comparator (void *unused, BAddr *v1, BAddr *v2);
+static struct DirectUdpClient_connection * find_connection (DirectUdpClient *o, BAddr local_addr);
+static struct DirectUdpClient_connection * connection_init (DirectUdpClient *o, BAddr local_addr);
+static void connection_free (struct DirectUdpClient_connection *con);
+static void connection_socket_handler (struct DirectUdpClient_connection *con, int event);
+static void connection_send_handler_done (struct DirectUdpClient_connection *con);
+static void connection_recv_handler_done (struct DirectUdpClient_connection *con, int data_len);
+static void connection_idle_timer_handler (struct DirectUdpClient_connection *con);
+
+static int addr_comparator (void *unused, BAddr *v1, BAddr *v2)
+{
+    return BAddr_CompareOrder(v1, v2);
+}
+
+static struct DirectUdpClient_connection * find_connection (DirectUdpClient *o, BAddr local_addr)
+{
+    BAVLNode *tree_node = BAVL_LookupExact(&o->connections_tree, &local_addr);
+    if (!tree_node) {
+        return NULL;
+    }
+    
+    return UPPER_OBJECT(tree_node, struct DirectUdpClient_connection, connections_tree_node);
+}
+
+static struct DirectUdpClient_connection * connection_init (DirectUdpClient *o, BAddr local_addr)
+{
+    ASSERT(o->num_connections <= o->max_connections)
+    ASSERT(!find_connection(o, local_addr))
+    
+    // if we hit the limit, close the least recently used connection
+    if (o->num_connections == o->max_connections) {
+        connection_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->connections_list), struct DirectUdpClient_connection, connections_list_node));
+    }
+    
+    // allocate structure
+    struct DirectUdpClient_connection *con = (struct DirectUdpClient_connection *)malloc(sizeof(*con));
+    if (!con) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    
+    // init arguments
+    con->client = o;
+    con->local_addr = local_addr;
+    
+    // allocate buffers
+    if (!(con->send_buf = (uint8_t *)BAlloc(o->udp_mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail1;
+    }
+    if (!(con->recv_buf = (uint8_t *)BAlloc(o->udp_mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail2;
+    }
+    
+    // init socket
+    if (!BDatagram_Init(&con->socket, local_addr.type, o->reactor, con, (BDatagram_handler)connection_socket_handler)) {
+        BLog(BLOG_ERROR, "BDatagram_Init failed");
+        goto fail3;
+    }
+    
+    // keep our datagrams out of the TUN device
+    if (o->have_mark && !BDatagram_SetMark(&con->socket, o->mark)) {
+        BLog(BLOG_ERROR, "BDatagram_SetMark failed");
+        goto fail4;
+    }
+    if (o->device && !BDatagram_BindToDevice(&con->socket, o->device)) {
+        BLog(BLOG_ERROR, "BDatagram_BindToDevice failed");
+        goto fail4;
+    }
+    
+    // bind to any address
+    BAddr bind_addr;
+    if (local_addr.type == BADDR_TYPE_IPV6) {
+        uint8_t zero_ip[16] = {0};
+        BAddr_InitIPv6(&bind_addr, zero_ip, 0);
+    } else {
+        BAddr_InitIPv4(&bind_addr, 0, 0);
+    }
+    if (!BDatagram_Bind(&con->socket, bind_addr)) {
+        BLog(BLOG_ERROR, "BDatagram_Bind failed");
+        goto fail4;
+    }
+    
+    // init sending
+    BDatagram_SendAsync_Init(&con->socket, o->udp_mtu);
+    con->send_if = BDatagram_SendAsync_GetIf(&con->socket);
+    PacketPassInterface_Sender_Init(con->send_if, (PacketPassInterface_handler_done)connection_send_handler_done, con);
+    con->send_busy = 0;
+    
+    // init receiving
+    BDatagram_RecvAsync_Init(&con->socket, o->udp_mtu);
+    PacketRecvInterface_Receiver_Init(BDatagram_RecvAsync_GetIf(&con->socket), (PacketRecvInterface_handler_done)connection_recv_handler_done, con);
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&con->socket), con->recv_buf);
+    
+    // init idle timer
+    BTimer_Init(&con->idle_timer, o->keepalive_time, (BTimer_handler)connection_idle_timer_handler, con);
+    BReactor_SetTimer(o->reactor, &con->idle_timer);
+    
+    // insert to connections tree
+    ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree, &con->connections_tree_node, NULL))
+    
+    // insert to connections list
+    LinkedList1_Append(&o->connections_list, &con->connections_list_node);
+    
+    // increment number of connections
+    o->num_connections++;
+    
+    return con;
+    
+fail4:
+    BDatagram_Free(&con->socket);
+fail3:
+    BFree(con->recv_buf);
+fail2:
+    BFree(con->send_buf);
+fail1:
+    free(con);
+fail0:
+    return NULL;
+}
+
+static void connection_free (struct DirectUdpClient_connection *con)
+{
+    DirectUdpClient *o = con->client;
+    
+    // decrement number of connections
+    o->num_connections--;
+    
+    // remove from connections list
+    LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
+    
+    // remove from connections tree
+    BAVL_Remove(&o->connections_tree, &con->connections_tree_node);
+    
+    // free idle timer
+    BReactor_RemoveTimer(o->reactor, &con->idle_timer);
+    
+    // free socket
+    BDatagram_RecvAsync_Free(&con->socket);
+    BDatagram_SendAsync_Free(&con->socket);
+    BDatagram_Free(&con->socket);
+    
+    // free buffers
+    BFree(con->recv_buf);
+    BFree(con->send_buf);
+    
+    // free structure
+    free(con);
+}
+
+static void connection_socket_handler (struct DirectUdpClient_connection *con, int event)
+{
+    DebugObject_Access(&con->client->d_obj);
+    
+    BLog(BLOG_INFO, "socket error");
+    
+    connection_free(con);
+}
+
+static void connection_send_handler_done (struct DirectUdpClient_connection *con)
+{
+    DebugObject_Access(&con->client->d_obj);
+    ASSERT(con->send_busy)
+    
+    con->send_busy = 0;
+}
+
+static void connection_recv_handler_done (struct DirectUdpClient_connection *con, int data_len)
+{
+    DirectUdpClient *o = con->client;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->udp_mtu)
+    
+    // get source address
+    BAddr remote_addr;
+    BIPAddr local_addr;
+    if (!BDatagram_GetLastReceiveAddrs(&con->socket, &remote_addr, &local_addr)) {
+        BLog(BLOG_ERROR, "missing source address");
+        goto out;
+    }
+    
+    // the source must be of the family we sent from
+    if (remote_addr.type != con->local_addr.type) {
+        BLog(BLOG_ERROR, "address family mismatch");
+        goto out;
+    }
+    
+    // keep connection alive
+    BReactor_SetTimer(o->reactor, &con->idle_timer);
+    
+    // submit to user
+    o->handler_received(o->user, con->local_addr, remote_addr, con->recv_buf, data_len);
+    
+out:
+    // receive next datagram
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&con->socket), con->recv_buf);
+}
+
+static void connection_idle_timer_handler (struct DirectUdpClient_connection *con)
+{
+    DebugObject_Access(&con->client->d_obj);
+    
+    BLog(BLOG_DEBUG, "closing idle connection");
+    
+    connection_free(con);
+}
+
+int DirectUdpClient_Init (DirectUdpClient *o, int udp_mtu, int max_connections, btime_t keepalive_time,
+                          int have_mark, uint32_t mark, const char *device,
+                          BReactor *reactor, void *user, DirectUdpClient_handler_received handler_received)
+{
+    ASSERT(udp_mtu >= 0)
+    ASSERT(max_connections > 0)
+    
+    // init arguments
+    o->udp_mtu = udp_mtu;
+    o->max_connections = max_connections;
+    o->keepalive_time = keepalive_time;
+    o->have_mark = have_mark;
+    o->mark = mark;
+    o->device = device;
+    o->reactor = reactor;
+    o->user = user;
+    o->handler_received = handler_received;
+    
+    // init connections tree
+    BAVL_Init(&o->connections_tree, OFFSET_DIFF(struct DirectUdpClient_connection, local_addr, connections_tree_node), (BAVL_comparator)addr_comparator, NULL);
+    
+    // init connections list
+    LinkedList1_Init(&o->connections_list);
+    
+    // set zero connections
+    o->num_connections = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
+void DirectUdpClient_Free (DirectUdpClient *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free connections
+    while (!LinkedList1_IsEmpty(&o->connections_list)) {
+        connection_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->connections_list), struct DirectUdpClient_connection, connections_list_node));
+    }
+}
+
+void DirectUdpClient_SubmitPacket (DirectUdpClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(local_addr.type == BADDR_TYPE_IPV4 || local_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(remote_addr.type == local_addr.type)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->udp_mtu)
+    
+    // find connection, or start a new one
+    struct DirectUdpClient_connection *con = find_connection(o, local_addr);
+    if (con) {
+        // move to the end of the list
+        LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
+        LinkedList1_Append(&o->connections_list, &con->connections_list_node);
+    } else {
+        if (!(con = connection_init(o, local_addr))) {
+            return;
+        }
+    }
+    
+    // keep connection alive
+    BReactor_SetTimer(o->reactor, &con->idle_timer);
+    
+    // drop the packet if we're still sending the previous one
+    if (con->send_busy) {
+        BLog(BLOG_DEBUG, "dropping packet, previous one is still being sent");
+        return;
+    }
+    
+    // set destination
+    BIPAddr send_local_addr;
+    BIPAddr_InitInvalid(&send_local_addr);
+    BDatagram_SetSendAddrs(&con->socket, remote_addr, send_local_addr);
+    
+    // send
+    memcpy(con->send_buf, data, data_len);
+    PacketPassInterface_Sender_Send(con->send_if, con->send_buf, data_len);
+    con->send_busy = 1;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Sends UDP packets directly, bypassing the proxy.
+ */
+
+#ifndef BADVPN_TUN2SOCKS_DIRECTUDPCLIENT_H
+#define BADVPN_TUN2SOCKS_DIRECTUDPCLIENT_H
+
+#include <stdint.h>
+
+#include <misc/debug.h>
+#include <structure/BAVL.h>
+#include <structure/LinkedList1.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <system/BDatagram.h>
+
+typedef void (*DirectUdpClient_handler_received) (void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+
+typedef struct {
+    int udp_mtu;
+    int max_connections;
+    btime_t keepalive_time;
+    int have_mark;
+    uint32_t mark;
+    const char *device;
+    BReactor *reactor;
+    void *user;
+    DirectUdpClient_handler_received handler_received;
+    BAVL connections_tree;
+    LinkedList1 connections_list;
+    int num_connections;
+    DebugObject d_obj;
+} DirectUdpClient;
+
+struct DirectUdpClient_connection {
+    DirectUdpClient *client;
+    BAddr local_addr;
+    BDatagram socket;
+    PacketPassInterface *send_if;
+    int send_busy;
+    uint8_t *send_buf;
+    uint8_t *recv_buf;
+    BTimer idle_timer;
+    BAVLNode connections_tree_node;
+    LinkedList1Node connections_list_node;
+};
+
+/**
+ * Initializes the object.
+ * Each local source address gets its own socket, bound to any address, through
+ * which it exchanges datagrams with any remote address.
+ * 
+ * Datagrams are sent with the system's routing. The mark or device must be used
+ * to keep them from being routed back into the TUN device.
+ * 
+ * @param o the object
+ * @param udp_mtu maximum UDP payload size. Must be >=0.
+ * @param max_connections maximum number of sockets. Must be >0. When it is
+ *                        reached, the least recently used socket is closed.
+ * @param keepalive_time time after which an idle socket is closed
+ * @param have_mark whether to set SO_MARK on the sockets
+ * @param mark the mark, if have_mark
+ * @param device interface to bind the sockets to with SO_BINDTODEVICE, or NULL.
+ *               Must remain valid for the lifetime of the object.
+ * @param reactor reactor we live in
+ * @param user value passed to handler
+ * @param handler_received handler called when a datagram is received.
+ *                         The remote address is of the same family as the local address.
+ * @return 1 on success, 0 on failure
+ */
+int DirectUdpClient_Init (DirectUdpClient *o, int udp_mtu, int max_connections, btime_t keepalive_time,
+                          int have_mark, uint32_t mark, const char *device,
+                          BReactor *reactor, void *user, DirectUdpClient_handler_received handler_received) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void DirectUdpClient_Free (DirectUdpClient *o);
+
+/**
+ * Submits a packet to be sent.
+ * The packet is dropped if the socket is still sending the previous one.
+ * 
+ * @param o the object
+ * @param local_addr local source address. Must be IPv4 or IPv6.
+ * @param remote_addr remote destination address. Must be of the same family
+ *                    as local_addr.
+ * @param data payload
+ * @param data_len payload length. Must be >=0 and <=udp_mtu.
+ */
+void DirectUdpClient_SubmitPacket (DirectUdpClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+#include <base/BLog.h>
+
+#include <tun2socks/SocksTcpGwClient.h>
+
+#include <generated/blog_channel_SocksTcpGwClient.h>
+
+static void free_socks (struct SocksTcpGwClient_member *m);
+static void try_connect (struct SocksTcpGwClient_member *m);
+static void reconnect_timer_handler (struct SocksTcpGwClient_member *m);
+static void socks_client_handler (struct SocksTcpGwClient_member *m, int event);
+static void mux_handler_error (struct SocksTcpGwClient_member *m);
+
+static void free_socks (struct SocksTcpGwClient_member *m)
+{
+    ASSERT(m->have_socks)
+    
+    // disconnect multiplexer from SOCKS
+    if (TcpMux_IsConnected(&m->mux)) {
+        TcpMux_Disconnect(&m->mux);
+    }
+    
+    // free SOCKS client
+    BSocksClient_Free(&m->socks_client);
+    
+    // set have no SOCKS
+    m->have_socks = 0;
+}
+
+static void try_connect (struct SocksTcpGwClient_member *m)
+{
+    SocksTcpGwClient *o = m->client;
+    ASSERT(!m->have_socks)
+    ASSERT(!BTimer_IsRunning(&m->reconnect_timer))
+    
+    // init SOCKS client
+    if (!BSocksClient_Init(&m->socks_client, o->socks_server_addr, o->auth_info, o->num_auth_info, o->remote_tcpgw_addr, (BSocksClient_handler)socks_client_handler, m, o->reactor)) {
+        BLog(BLOG_ERROR, "BSocksClient_Init failed");
+        goto fail0;
+    }
+    BSocksClient_SetSocketOptions(&m->socks_client, &o->socket_options);
+    
+    // set have SOCKS
+    m->have_socks = 1;
+    
+    return;
+    
+fail0:
+    // set reconnect timer
+    BReactor_SetTimer(o->reactor, &m->reconnect_timer);
+}
+
+static void reconnect_timer_handler (struct SocksTcpGwClient_member *m)
+{
+    DebugObject_Access(&m->client->d_obj);
+    ASSERT(!m->have_socks)
+    
+    // try connecting
+    try_connect(m);
+}
+
+static void socks_client_handler (struct SocksTcpGwClient_member *m, int event)
+{
+    SocksTcpGwClient *o = m->client;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(m->have_socks)
+    
+    switch (event) {
+        case BSOCKSCLIENT_EVENT_UP: {
+            ASSERT(!TcpMux_IsConnected(&m->mux))
+            
+            BLog(BLOG_INFO, "SOCKS up (connection %d)", (int)(m - o->members));
+            
+            // connect multiplexer to SOCKS
+            if (!TcpMux_Connect(&m->mux, BSocksClient_GetSendInterface(&m->socks_client), BSocksClient_GetRecvInterface(&m->socks_client))) {
+                BLog(BLOG_ERROR, "TcpMux_Connect failed");
+                goto fail0;
+            }
+            
+            return;
+            
+        fail0:
+            // free SOCKS
+            free_socks(m);
+            
+            // set reconnect timer
+            BReactor_SetTimer(o->reactor, &m->reconnect_timer);
+        } break;
+        
+        case BSOCKSCLIENT_EVENT_ERROR:
+        case BSOCKSCLIENT_EVENT_ERROR_CLOSED: {
+            BLog(BLOG_INFO, "SOCKS error (connection %d)", (int)(m - o->members));
+            
+            // free SOCKS
+            free_socks(m);
+            
+            // set reconnect timer
+            BReactor_SetTimer(o->reactor, &m->reconnect_timer);
+        } break;
+        
+        default: ASSERT(0);
+    }
+}
+
+static void mux_handler_error (struct SocksTcpGwClient_member *m)
+{
+    SocksTcpGwClient *o = m->client;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(m->have_socks)
+    ASSERT(TcpMux_IsConnected(&m->mux))
+    
+    BLog(BLOG_ERROR, "protocol error (connection %d)", (int)(m - o->members));
+    
+    // free SOCKS
+    free_socks(m);
+    
+    // set reconnect timer
+    BReactor_SetTimer(o->reactor, &m->reconnect_timer);
+}
+
+int SocksTcpGwClient_Init (SocksTcpGwClient *o, int window, BAddr socks_server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
+                           BAddr remote_tcpgw_addr, btime_t reconnect_time, int num_members, BReactor *reactor)
+{
+    ASSERT(!BAddr_IsInvalid(&socks_server_addr))
+    ASSERT(remote_tcpgw_addr.type == BADDR_TYPE_IPV4 || remote_tcpgw_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(num_members > 0)
+    
+    // init arguments
+    o->socks_server_addr = socks_server_addr;
+    o->auth_info = auth_info;
+    o->num_auth_info = num_auth_info;
+    o->remote_tcpgw_addr = remote_tcpgw_addr;
+    o->num_members = num_members;
+    o->reactor = reactor;
+    
+    // streams share the connections, so don't delay small writes; frames
+    // ready at the same time are gathered into one write anyway
+    BConnection_options_Init(&o->socket_options);
+    o->socket_options.nodelay = 1;
+    
+    // allocate members
+    if (!(o->members = (struct SocksTcpGwClient_member *)BAllocArray(o->num_members, sizeof(o->members[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
+    
+    int i;
+    for (i = 0; i < o->num_members; i++) {
+        struct SocksTcpGwClient_member *m = &o->members[i];
+        m->client = o;
+        
+        // init multiplexer
+        if (!TcpMux_Init(&m->mux, window, o->reactor, m, (TcpMux_handler_error)mux_handler_error, NULL)) {
+            BLog(BLOG_ERROR, "TcpMux_Init failed");
+            goto fail1;
+        }
+        
+        // init reconnect timer
+        BTimer_Init(&m->reconnect_timer, reconnect_time, (BTimer_handler)reconnect_timer_handler, m);
+        
+        // set have no SOCKS
+        m->have_socks = 0;
+    }
+    
+    // try connecting
+    for (int j = 0; j < o->num_members; j++) {
+        try_connect(&o->members[j]);
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    while (i-- > 0) {
+        TcpMux_Free(&o->members[i].mux);
+    }
+    BFree(o->members);
+fail0:
+    return 0;
+}
+
+void SocksTcpGwClient_Free (SocksTcpGwClient *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    for (int i = 0; i < o->num_members; i++) {
+        struct SocksTcpGwClient_member *m = &o->members[i];
+        
+        // free SOCKS
+        if (m->have_socks) {
+            free_socks(m);
+        }
+        
+        // free reconnect timer
+        BReactor_RemoveTimer(o->reactor, &m->reconnect_timer);
+        
+        // free multiplexer
+        TcpMux_Free(&m->mux);
+    }
+    
+    // free members
+    BFree(o->members);
+}
+
+TcpMux * SocksTcpGwClient_GetMux (SocksTcpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    TcpMux *best = NULL;
+    
+    for (int i = 0; i < o->num_members; i++) {
+        TcpMux *mux = &o->members[i].mux;
+        if (TcpMux_IsConnected(mux) && (!best || TcpMux_GetNumStreams(mux) < TcpMux_GetNumStreams(best))) {
+            best = mux;
+        }
+    }
+    
+    return best;
+}
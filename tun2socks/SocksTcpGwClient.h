@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BADVPN_TUN2SOCKS_SOCKSTCPGWCLIENT_H
+#define BADVPN_TUN2SOCKS_SOCKSTCPGWCLIENT_H
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <system/BReactor.h>
+#include <tcpmux/TcpMux.h>
+#include <socksclient/BSocksClient.h>
+
+struct SocksTcpGwClient_member;
+
+typedef struct {
+    BAddr socks_server_addr;
+    const struct BSocksClient_auth_info *auth_info;
+    size_t num_auth_info;
+    BAddr remote_tcpgw_addr;
+    struct BConnection_options socket_options;
+    BReactor *reactor;
+    int num_members;
+    struct SocksTcpGwClient_member *members;
+    DebugObject d_obj;
+} SocksTcpGwClient;
+
+struct SocksTcpGwClient_member {
+    SocksTcpGwClient *client;
+    TcpMux mux;
+    BTimer reconnect_timer;
+    int have_socks;
+    BSocksClient socks_client;
+};
+
+/**
+ * Initializes the object.
+ * TCP connections are multiplexed over num_members connections to tcpgw,
+ * each made through the SOCKS server, so that opening a TCP connection
+ * costs no SOCKS handshake and no upstream connection setup.
+ * 
+ * @param o the object
+ * @param window per-stream receive window, as in {@link TcpMux_Init}
+ * @param socks_server_addr SOCKS server address
+ * @param auth_info SOCKS authentication methods
+ * @param num_auth_info number of SOCKS authentication methods
+ * @param remote_tcpgw_addr tcpgw address, as seen by the SOCKS server
+ * @param reconnect_time time after which a failed tcpgw connection is retried
+ * @param num_members number of tcpgw connections. Must be >0.
+ * @param reactor reactor we live in
+ * @return 1 on success, 0 on failure
+ */
+int SocksTcpGwClient_Init (SocksTcpGwClient *o, int window, BAddr socks_server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
+                           BAddr remote_tcpgw_addr, btime_t reconnect_time, int num_members, BReactor *reactor) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * There must be no streams on any of the multiplexers.
+ * 
+ * @param o the object
+ */
+void SocksTcpGwClient_Free (SocksTcpGwClient *o);
+
+/**
+ * Returns the connected multiplexer with the fewest streams, for opening
+ * a new stream with {@link TcpMuxStream_Init}.
+ * 
+ * @param o the object
+ * @return multiplexer, or NULL if no tcpgw connection is up
+ */
+TcpMux * SocksTcpGwClient_GetMux (SocksTcpGwClient *o);
+
+#endif
@@ -0,0 +1,501 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/offset.h>
+#include <misc/byteorder.h>
+#include <misc/balloc.h>
+#include <misc/socks_proto.h>
+#include <base/BLog.h>
+
+#include <tun2socks/SocksUdpClient.h>
+
+#include <generated/blog_channel_SocksUdpClient.h>
+
+// largest SOCKS UDP request header
+#define MAX_HEADER_LEN ((int)(sizeof(struct socks_udp_header) + sizeof(struct socks_addr_ipv6)))
+
+static int addr_comparator (void *unused, BAddr *v1, BAddr *v2);
+static struct SocksUdpClient_connection * find_connection (SocksUdpClient *o, BAddr local_addr);
+static struct SocksUdpClient_connection * connection_init (SocksUdpClient *o, BAddr local_addr);
+static void connection_free (struct SocksUdpClient_connection *con);
+static void connection_socks_handler (struct SocksUdpClient_connection *con, int event);
+static int connection_init_socket (struct SocksUdpClient_connection *con);
+static void connection_socket_handler (struct SocksUdpClient_connection *con, int event);
+static void connection_send (struct SocksUdpClient_connection *con);
+static void connection_send_handler_done (struct SocksUdpClient_connection *con);
+static void connection_recv_handler_done (struct SocksUdpClient_connection *con, int data_len);
+static void connection_idle_timer_handler (struct SocksUdpClient_connection *con);
+
+static int addr_comparator (void *unused, BAddr *v1, BAddr *v2)
+{
+    return BAddr_CompareOrder(v1, v2);
+}
+
+static struct SocksUdpClient_connection * find_connection (SocksUdpClient *o, BAddr local_addr)
+{
+    BAVLNode *tree_node = BAVL_LookupExact(&o->connections_tree, &local_addr);
+    if (!tree_node) {
+        return NULL;
+    }
+    
+    return UPPER_OBJECT(tree_node, struct SocksUdpClient_connection, connections_tree_node);
+}
+
+static struct SocksUdpClient_connection * connection_init (SocksUdpClient *o, BAddr local_addr)
+{
+    ASSERT(o->num_connections <= o->max_connections)
+    ASSERT(!find_connection(o, local_addr))
+    
+    // if we hit the limit, close the least recently used connection
+    if (o->num_connections == o->max_connections) {
+        connection_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->connections_list), struct SocksUdpClient_connection, connections_list_node));
+    }
+    
+    // allocate structure
+    struct SocksUdpClient_connection *con = (struct SocksUdpClient_connection *)malloc(sizeof(*con));
+    if (!con) {
+        BLog(BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    
+    // init arguments
+    con->client = o;
+    con->local_addr = local_addr;
+    
+    // allocate buffers
+    if (!(con->send_buf = (uint8_t *)BAlloc(MAX_HEADER_LEN + o->udp_mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail1;
+    }
+    if (!(con->recv_buf = (uint8_t *)BAlloc(MAX_HEADER_LEN + o->udp_mtu))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail2;
+    }
+    
+    // the association is for datagrams from any address of our family
+    BAddr dest_addr;
+    if (o->server_addr.type == BADDR_TYPE_IPV6) {
+        uint8_t zero_ip[16] = {0};
+        BAddr_InitIPv6(&dest_addr, zero_ip, 0);
+    } else {
+        BAddr_InitIPv4(&dest_addr, 0, 0);
+    }
+    
+    // init SOCKS client
+    if (!BSocksClient_Init2(&con->socks, o->server_addr, o->auth_info, o->num_auth_info, dest_addr, BSOCKSCLIENT_FLAG_UDP,
+                            (BSocksClient_handler)connection_socks_handler, con, o->reactor)) {
+        BLog(BLOG_ERROR, "BSocksClient_Init2 failed");
+        goto fail3;
+    }
+    
+    // set SOCKS not up, nothing to send
+    con->socks_up = 0;
+    con->send_busy = 0;
+    con->send_pending_len = -1;
+    
+    // init idle timer
+    BTimer_Init(&con->idle_timer, o->keepalive_time, (BTimer_handler)connection_idle_timer_handler, con);
+    BReactor_SetTimer(o->reactor, &con->idle_timer);
+    
+    // insert to connections tree
+    ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree, &con->connections_tree_node, NULL))
+    
+    // insert to connections list
+    LinkedList1_Append(&o->connections_list, &con->connections_list_node);
+    
+    // increment number of connections
+    o->num_connections++;
+    
+    return con;
+    
+fail3:
+    BFree(con->recv_buf);
+fail2:
+    BFree(con->send_buf);
+fail1:
+    free(con);
+fail0:
+    return NULL;
+}
+
+static void connection_free (struct SocksUdpClient_connection *con)
+{
+    SocksUdpClient *o = con->client;
+    
+    // decrement number of connections
+    o->num_connections--;
+    
+    // remove from connections list
+    LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
+    
+    // remove from connections tree
+    BAVL_Remove(&o->connections_tree, &con->connections_tree_node);
+    
+    // free idle timer
+    BReactor_RemoveTimer(o->reactor, &con->idle_timer);
+    
+    // free socket
+    if (con->socks_up) {
+        BDatagram_RecvAsync_Free(&con->socket);
+        BDatagram_SendAsync_Free(&con->socket);
+        BDatagram_Free(&con->socket);
+    }
+    
+    // free SOCKS client
+    BSocksClient_Free(&con->socks);
+    
+    // free buffers
+    BFree(con->recv_buf);
+    BFree(con->send_buf);
+    
+    // free structure
+    free(con);
+}
+
+static void connection_socks_handler (struct SocksUdpClient_connection *con, int event)
+{
+    DebugObject_Access(&con->client->d_obj);
+    
+    switch (event) {
+        case BSOCKSCLIENT_EVENT_UP: {
+            ASSERT(!con->socks_up)
+            
+            BLog(BLOG_DEBUG, "SOCKS up");
+            
+            // init socket for talking to the relay
+            if (!connection_init_socket(con)) {
+                connection_free(con);
+                return;
+            }
+            
+            // set SOCKS up
+            con->socks_up = 1;
+            
+            // send any packet submitted while connecting
+            if (con->send_pending_len >= 0) {
+                connection_send(con);
+            }
+        } break;
+        
+        case BSOCKSCLIENT_EVENT_ERROR:
+        case BSOCKSCLIENT_EVENT_ERROR_CLOSED: {
+            BLog(BLOG_INFO, "SOCKS error");
+            
+            connection_free(con);
+        } break;
+        
+        default: ASSERT(0);
+    }
+}
+
+static int connection_init_socket (struct SocksUdpClient_connection *con)
+{
+    SocksUdpClient *o = con->client;
+    
+    // determine relay address; if the server didn't give an IP, use the server's
+    BAddr relay_addr = BSocksClient_GetBindAddr(&con->socks);
+    int relay_ip_zero = 0;
+    if (relay_addr.type == BADDR_TYPE_IPV4) {
+        relay_ip_zero = (relay_addr.ipv4.ip == 0);
+    } else {
+        uint8_t zero_ip[16] = {0};
+        relay_ip_zero = !memcmp(relay_addr.ipv6.ip, zero_ip, sizeof(zero_ip));
+    }
+    if (relay_ip_zero) {
+        uint16_t port = BAddr_GetPort(&relay_addr);
+        relay_addr = o->server_addr;
+        BAddr_SetPort(&relay_addr, port);
+    }
+    
+    // init socket
+    if (!BDatagram_Init(&con->socket, relay_addr.type, o->reactor, con, (BDatagram_handler)connection_socket_handler)) {
+        BLog(BLOG_ERROR, "BDatagram_Init failed");
+        goto fail0;
+    }
+    
+    // bind to any address
+    BAddr bind_addr;
+    if (relay_addr.type == BADDR_TYPE_IPV6) {
+        uint8_t zero_ip[16] = {0};
+        BAddr_InitIPv6(&bind_addr, zero_ip, 0);
+    } else {
+        BAddr_InitIPv4(&bind_addr, 0, 0);
+    }
+    if (!BDatagram_Bind(&con->socket, bind_addr)) {
+        BLog(BLOG_ERROR, "BDatagram_Bind failed");
+        goto fail1;
+    }
+    
+    // send to relay
+    BIPAddr local_addr;
+    BIPAddr_InitInvalid(&local_addr);
+    BDatagram_SetSendAddrs(&con->socket, relay_addr, local_addr);
+    
+    // init sending
+    BDatagram_SendAsync_Init(&con->socket, MAX_HEADER_LEN + o->udp_mtu);
+    con->send_if = BDatagram_SendAsync_GetIf(&con->socket);
+    PacketPassInterface_Sender_Init(con->send_if, (PacketPassInterface_handler_done)connection_send_handler_done, con);
+    
+    // init receiving
+    BDatagram_RecvAsync_Init(&con->socket, MAX_HEADER_LEN + o->udp_mtu);
+    PacketRecvInterface_Receiver_Init(BDatagram_RecvAsync_GetIf(&con->socket), (PacketRecvInterface_handler_done)connection_recv_handler_done, con);
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&con->socket), con->recv_buf);
+    
+    return 1;
+    
+fail1:
+    BDatagram_Free(&con->socket);
+fail0:
+    return 0;
+}
+
+static void connection_socket_handler (struct SocksUdpClient_connection *con, int event)
+{
+    DebugObject_Access(&con->client->d_obj);
+    ASSERT(con->socks_up)
+    
+    BLog(BLOG_INFO, "socket error");
+    
+    connection_free(con);
+}
+
+static void connection_send (struct SocksUdpClient_connection *con)
+{
+    ASSERT(con->socks_up)
+    ASSERT(!con->send_busy)
+    ASSERT(con->send_pending_len >= 0)
+    
+    PacketPassInterface_Sender_Send(con->send_if, con->send_buf, con->send_pending_len);
+    con->send_busy = 1;
+    con->send_pending_len = -1;
+}
+
+static void connection_send_handler_done (struct SocksUdpClient_connection *con)
+{
+    DebugObject_Access(&con->client->d_obj);
+    ASSERT(con->socks_up)
+    ASSERT(con->send_busy)
+    
+    con->send_busy = 0;
+}
+
+static void connection_recv_handler_done (struct SocksUdpClient_connection *con, int data_len)
+{
+    SocksUdpClient *o = con->client;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(con->socks_up)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= MAX_HEADER_LEN + o->udp_mtu)
+    
+    uint8_t *data = con->recv_buf;
+    
+    // parse header
+    if (data_len < (int)sizeof(struct socks_udp_header)) {
+        BLog(BLOG_ERROR, "missing header");
+        goto out;
+    }
+    struct socks_udp_header header;
+    memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    data_len -= sizeof(header);
+    
+    // we don't do fragmentation
+    if (ntoh8(header.frag) != 0) {
+        BLog(BLOG_INFO, "dropping fragment");
+        goto out;
+    }
+    
+    // parse address
+    BAddr remote_addr;
+    switch (ntoh8(header.atyp)) {
+        case SOCKS_ATYP_IPV4: {
+            struct socks_addr_ipv4 addr;
+            if (data_len < (int)sizeof(addr)) {
+                BLog(BLOG_ERROR, "missing ipv4 address");
+                goto out;
+            }
+            memcpy(&addr, data, sizeof(addr));
+            data += sizeof(addr);
+            data_len -= sizeof(addr);
+            BAddr_InitIPv4(&remote_addr, addr.addr, addr.port);
+        } break;
+        case SOCKS_ATYP_IPV6: {
+            struct socks_addr_ipv6 addr;
+            if (data_len < (int)sizeof(addr)) {
+                BLog(BLOG_ERROR, "missing ipv6 address");
+                goto out;
+            }
+            memcpy(&addr, data, sizeof(addr));
+            data += sizeof(addr);
+            data_len -= sizeof(addr);
+            BAddr_InitIPv6(&remote_addr, addr.addr, addr.port);
+        } break;
+        default:
+            BLog(BLOG_ERROR, "unsupported address type");
+            goto out;
+    }
+    
+    // the reply must come from the same address family we sent from
+    if (remote_addr.type != con->local_addr.type) {
+        BLog(BLOG_ERROR, "address family mismatch");
+        goto out;
+    }
+    
+    if (data_len > o->udp_mtu) {
+        BLog(BLOG_ERROR, "packet is too large");
+        goto out;
+    }
+    
+    // keep connection alive
+    BReactor_SetTimer(o->reactor, &con->idle_timer);
+    
+    // submit to user
+    o->handler_received(o->user, con->local_addr, remote_addr, data, data_len);
+    
+out:
+    // receive next datagram
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&con->socket), con->recv_buf);
+}
+
+static void connection_idle_timer_handler (struct SocksUdpClient_connection *con)
+{
+    DebugObject_Access(&con->client->d_obj);
+    
+    BLog(BLOG_DEBUG, "closing idle connection");
+    
+    connection_free(con);
+}
+
+int SocksUdpClient_Init (SocksUdpClient *o, int udp_mtu, int max_connections, btime_t keepalive_time,
+                         BAddr server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
+                         BReactor *reactor, void *user, SocksUdpClient_handler_received handler_received)
+{
+    ASSERT(udp_mtu >= 0)
+    ASSERT(max_connections > 0)
+    ASSERT(server_addr.type == BADDR_TYPE_IPV4 || server_addr.type == BADDR_TYPE_IPV6)
+    
+    // init arguments
+    o->server_addr = server_addr;
+    o->auth_info = auth_info;
+    o->num_auth_info = num_auth_info;
+    o->udp_mtu = udp_mtu;
+    o->max_connections = max_connections;
+    o->keepalive_time = keepalive_time;
+    o->reactor = reactor;
+    o->user = user;
+    o->handler_received = handler_received;
+    
+    // init connections tree
+    BAVL_Init(&o->connections_tree, OFFSET_DIFF(struct SocksUdpClient_connection, local_addr, connections_tree_node), (BAVL_comparator)addr_comparator, NULL);
+    
+    // init connections list
+    LinkedList1_Init(&o->connections_list);
+    
+    // set zero connections
+    o->num_connections = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
+void SocksUdpClient_Free (SocksUdpClient *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free connections
+    while (!LinkedList1_IsEmpty(&o->connections_list)) {
+        connection_free(UPPER_OBJECT(LinkedList1_GetFirst(&o->connections_list), struct SocksUdpClient_connection, connections_list_node));
+    }
+}
+
+void SocksUdpClient_SubmitPacket (SocksUdpClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(local_addr.type == BADDR_TYPE_IPV4 || local_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(remote_addr.type == BADDR_TYPE_IPV4 || remote_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->udp_mtu)
+    
+    // find connection, or start a new one
+    struct SocksUdpClient_connection *con = find_connection(o, local_addr);
+    if (con) {
+        // move to the end of the list
+        LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
+        LinkedList1_Append(&o->connections_list, &con->connections_list_node);
+    } else {
+        if (!(con = connection_init(o, local_addr))) {
+            return;
+        }
+    }
+    
+    // keep connection alive
+    BReactor_SetTimer(o->reactor, &con->idle_timer);
+    
+    // drop the packet if we're still sending the previous one
+    if (con->send_busy) {
+        BLog(BLOG_DEBUG, "dropping packet, previous one is still being sent");
+        return;
+    }
+    
+    // write header
+    struct socks_udp_header header;
+    header.rsv = hton16(0);
+    header.frag = hton8(0);
+    int header_len = sizeof(header);
+    switch (remote_addr.type) {
+        case BADDR_TYPE_IPV4: {
+            header.atyp = hton8(SOCKS_ATYP_IPV4);
+            struct socks_addr_ipv4 addr;
+            addr.addr = remote_addr.ipv4.ip;
+            addr.port = remote_addr.ipv4.port;
+            memcpy(con->send_buf + header_len, &addr, sizeof(addr));
+            header_len += sizeof(addr);
+        } break;
+        case BADDR_TYPE_IPV6: {
+            header.atyp = hton8(SOCKS_ATYP_IPV6);
+            struct socks_addr_ipv6 addr;
+            memcpy(addr.addr, remote_addr.ipv6.ip, sizeof(addr.addr));
+            addr.port = remote_addr.ipv6.port;
+            memcpy(con->send_buf + header_len, &addr, sizeof(addr));
+            header_len += sizeof(addr);
+        } break;
+        default: ASSERT(0);
+    }
+    memcpy(con->send_buf, &header, sizeof(header));
+    
+    // write payload
+    memcpy(con->send_buf + header_len, data, data_len);
+    con->send_pending_len = header_len + data_len;
+    
+    // send now, or when SOCKS comes up; while connecting, newer packets
+    // replace the pending one
+    if (con->socks_up) {
+        connection_send(con);
+    }
+}
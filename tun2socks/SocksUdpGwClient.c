@@ -26,131 +26,141 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+
 #include <misc/debug.h>
+#include <misc/balloc.h>
+#include <misc/hashfun.h>
 #include <base/BLog.h>
 
 #include <tun2socks/SocksUdpGwClient.h>
 
 #include <generated/blog_channel_SocksUdpGwClient.h>
 
-static void free_socks (SocksUdpGwClient *o);
-static void try_connect (SocksUdpGwClient *o);
-static void reconnect_timer_handler (SocksUdpGwClient *o);
-static void socks_client_handler (SocksUdpGwClient *o, int event);
-static void udpgw_handler_servererror (SocksUdpGwClient *o);
-static void udpgw_handler_received (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+static void free_socks (struct SocksUdpGwClient_member *m);
+static void try_connect (struct SocksUdpGwClient_member *m);
+static void reconnect_timer_handler (struct SocksUdpGwClient_member *m);
+static void socks_client_handler (struct SocksUdpGwClient_member *m, int event);
+static void udpgw_handler_servererror (struct SocksUdpGwClient_member *m);
+static void udpgw_handler_received (struct SocksUdpGwClient_member *m, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+static size_t hash_addr (size_t hash, BAddr addr);
+static struct SocksUdpGwClient_member * select_member (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr);
 
-static void free_socks (SocksUdpGwClient *o)
+static void free_socks (struct SocksUdpGwClient_member *m)
 {
-    ASSERT(o->have_socks)
+    ASSERT(m->have_socks)
     
     // disconnect udpgw client from SOCKS
-    if (o->socks_up) {
-        UdpGwClient_DisconnectServer(&o->udpgw_client);
+    if (m->socks_up) {
+        UdpGwClient_DisconnectServer(&m->udpgw_client);
     }
     
     // free SOCKS client
-    BSocksClient_Free(&o->socks_client);
+    BSocksClient_Free(&m->socks_client);
     
     // set have no SOCKS
-    o->have_socks = 0;
+    m->have_socks = 0;
 }
 
-static void try_connect (SocksUdpGwClient *o)
+static void try_connect (struct SocksUdpGwClient_member *m)
 {
-    ASSERT(!o->have_socks)
-    ASSERT(!BTimer_IsRunning(&o->reconnect_timer))
+    SocksUdpGwClient *o = m->client;
+    ASSERT(!m->have_socks)
+    ASSERT(!BTimer_IsRunning(&m->reconnect_timer))
     
     // init SOCKS client
-    if (!BSocksClient_Init(&o->socks_client, o->socks_server_addr, o->auth_info, o->num_auth_info, o->remote_udpgw_addr, (BSocksClient_handler)socks_client_handler, o, o->reactor)) {
+    if (!BSocksClient_Init(&m->socks_client, o->socks_server_addr, o->auth_info, o->num_auth_info, o->remote_udpgw_addr, (BSocksClient_handler)socks_client_handler, m, o->reactor)) {
         BLog(BLOG_ERROR, "BSocksClient_Init failed");
         goto fail0;
     }
     
     // set have SOCKS
-    o->have_socks = 1;
+    m->have_socks = 1;
     
     // set SOCKS not up
-    o->socks_up = 0;
+    m->socks_up = 0;
     
     return;
     
 fail0:
     // set reconnect timer
-    BReactor_SetTimer(o->reactor, &o->reconnect_timer);
+    BReactor_SetTimer(o->reactor, &m->reconnect_timer);
 }
 
-static void reconnect_timer_handler (SocksUdpGwClient *o)
+static void reconnect_timer_handler (struct SocksUdpGwClient_member *m)
 {
-    DebugObject_Access(&o->d_obj);
-    ASSERT(!o->have_socks)
+    DebugObject_Access(&m->client->d_obj);
+    ASSERT(!m->have_socks)
     
     // try connecting
-    try_connect(o);
+    try_connect(m);
 }
 
-static void socks_client_handler (SocksUdpGwClient *o, int event)
+static void socks_client_handler (struct SocksUdpGwClient_member *m, int event)
 {
+    SocksUdpGwClient *o = m->client;
     DebugObject_Access(&o->d_obj);
-    ASSERT(o->have_socks)
+    ASSERT(m->have_socks)
     
     switch (event) {
         case BSOCKSCLIENT_EVENT_UP: {
-            ASSERT(!o->socks_up)
+            ASSERT(!m->socks_up)
             
-            BLog(BLOG_INFO, "SOCKS up");
+            BLog(BLOG_INFO, "SOCKS up (connection %d)", (int)(m - o->members));
             
             // connect udpgw client to SOCKS
-            if (!UdpGwClient_ConnectServer(&o->udpgw_client, BSocksClient_GetSendInterface(&o->socks_client), BSocksClient_GetRecvInterface(&o->socks_client))) {
+            if (!UdpGwClient_ConnectServer(&m->udpgw_client, BSocksClient_GetSendInterface(&m->socks_client), BSocksClient_GetRecvInterface(&m->socks_client))) {
                 BLog(BLOG_ERROR, "UdpGwClient_ConnectServer failed");
                 goto fail0;
             }
             
             // set SOCKS up
-            o->socks_up = 1;
+            m->socks_up = 1;
             
             return;
             
         fail0:
             // free SOCKS
-            free_socks(o);
+            free_socks(m);
             
             // set reconnect timer
-            BReactor_SetTimer(o->reactor, &o->reconnect_timer);
+            BReactor_SetTimer(o->reactor, &m->reconnect_timer);
         } break;
         
         case BSOCKSCLIENT_EVENT_ERROR:
         case BSOCKSCLIENT_EVENT_ERROR_CLOSED: {
-            BLog(BLOG_INFO, "SOCKS error");
+            BLog(BLOG_INFO, "SOCKS error (connection %d)", (int)(m - o->members));
             
             // free SOCKS
-            free_socks(o);
+            free_socks(m);
             
             // set reconnect timer
-            BReactor_SetTimer(o->reactor, &o->reconnect_timer);
+            BReactor_SetTimer(o->reactor, &m->reconnect_timer);
         } break;
         
         default: ASSERT(0);
     }
 }
 
-static void udpgw_handler_servererror (SocksUdpGwClient *o)
+static void udpgw_handler_servererror (struct SocksUdpGwClient_member *m)
 {
+    SocksUdpGwClient *o = m->client;
     DebugObject_Access(&o->d_obj);
-    ASSERT(o->have_socks)
-    ASSERT(o->socks_up)
+    ASSERT(m->have_socks)
+    ASSERT(m->socks_up)
     
-    BLog(BLOG_ERROR, "client reports server error");
+    BLog(BLOG_ERROR, "client reports server error (connection %d)", (int)(m - o->members));
     
     // free SOCKS
-    free_socks(o);
+    free_socks(m);
     
     // set reconnect timer
-    BReactor_SetTimer(o->reactor, &o->reconnect_timer);
+    BReactor_SetTimer(o->reactor, &m->reconnect_timer);
 }
 
-static void udpgw_handler_received (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+static void udpgw_handler_received (struct SocksUdpGwClient_member *m, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
 {
+    SocksUdpGwClient *o = m->client;
     DebugObject_Access(&o->d_obj);
     
     // submit to user
@@ -158,14 +168,56 @@ static void udpgw_handler_received (SocksUdpGwClient *o, BAddr local_addr, BAddr
     return;
 }
 
-int SocksUdpGwClient_Init (SocksUdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time,
+static size_t hash_addr (size_t hash, BAddr addr)
+{
+    uint8_t buf[18];
+    size_t len = 0;
+    
+    switch (addr.type) {
+        case BADDR_TYPE_IPV4: {
+            memcpy(buf, &addr.ipv4.ip, 4);
+            memcpy(buf + 4, &addr.ipv4.port, 2);
+            len = 6;
+        } break;
+        case BADDR_TYPE_IPV6: {
+            memcpy(buf, addr.ipv6.ip, 16);
+            memcpy(buf + 16, &addr.ipv6.port, 2);
+            len = 18;
+        } break;
+        default: ASSERT(0);
+    }
+    
+    return hash * 33 + badvpn_djb2_hash_bin(buf, len);
+}
+
+static struct SocksUdpGwClient_member * select_member (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr)
+{
+    // hash the flow onto a connection; the hash is mixed so that the choice
+    // doesn't correlate with the hash bucket the flow lands in within UdpGwClient
+    uint32_t hash = hash_addr(hash_addr(0, local_addr), remote_addr);
+    int start = ((uint32_t)(hash * UINT32_C(2654435761)) >> 16) % o->num_members;
+    
+    // if it's down, move the flow to the next connection that is up; if none
+    // are, keep the hashed one, which queues packets until it reconnects
+    for (int i = 0; i < o->num_members; i++) {
+        struct SocksUdpGwClient_member *m = &o->members[(start + i) % o->num_members];
+        if (m->have_socks && m->socks_up) {
+            return m;
+        }
+    }
+    
+    return &o->members[start];
+}
+
+int SocksUdpGwClient_Init (SocksUdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, int recv_buffer_size, btime_t keepalive_time,
                            BAddr socks_server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
-                           BAddr remote_udpgw_addr, btime_t reconnect_time, BReactor *reactor, void *user,
+                           BAddr remote_udpgw_addr, btime_t reconnect_time, int num_members, BReactor *reactor, void *user,
                            SocksUdpGwClient_handler_received handler_received)
 {
     // see asserts in UdpGwClient_Init
     ASSERT(!BAddr_IsInvalid(&socks_server_addr))
     ASSERT(remote_udpgw_addr.type == BADDR_TYPE_IPV4 || remote_udpgw_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(num_members > 0)
     
     // init arguments
     o->udp_mtu = udp_mtu;
@@ -173,30 +225,56 @@ int SocksUdpGwClient_Init (SocksUdpGwClient *o, int udp_mtu, int max_connections
     o->auth_info = auth_info;
     o->num_auth_info = num_auth_info;
     o->remote_udpgw_addr = remote_udpgw_addr;
+    o->num_members = num_members;
     o->reactor = reactor;
     o->user = user;
     o->handler_received = handler_received;
     
-    // init udpgw client
-    if (!UdpGwClient_Init(&o->udpgw_client, udp_mtu, max_connections, send_buffer_size, keepalive_time, o->reactor, o,
-                          (UdpGwClient_handler_servererror)udpgw_handler_servererror,
-                          (UdpGwClient_handler_received)udpgw_handler_received
-    )) {
-        goto fail0;
+    // split connection limit among members
+    int member_max_connections = max_connections / num_members;
+    if (member_max_connections < 1) {
+        member_max_connections = 1;
     }
     
-    // init reconnect timer
-    BTimer_Init(&o->reconnect_timer, reconnect_time, (BTimer_handler)reconnect_timer_handler, o);
+    // allocate members
+    if (!(o->members = (struct SocksUdpGwClient_member *)BAllocArray(o->num_members, sizeof(o->members[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail0;
+    }
     
-    // set have no SOCKS
-    o->have_socks = 0;
+    int i;
+    for (i = 0; i < o->num_members; i++) {
+        struct SocksUdpGwClient_member *m = &o->members[i];
+        m->client = o;
+        
+        // init udpgw client
+        if (!UdpGwClient_Init(&m->udpgw_client, udp_mtu, member_max_connections, send_buffer_size, recv_buffer_size, keepalive_time, o->reactor, m,
+                              (UdpGwClient_handler_servererror)udpgw_handler_servererror,
+                              (UdpGwClient_handler_received)udpgw_handler_received
+        )) {
+            goto fail1;
+        }
+        
+        // init reconnect timer
+        BTimer_Init(&m->reconnect_timer, reconnect_time, (BTimer_handler)reconnect_timer_handler, m);
+        
+        // set have no SOCKS
+        m->have_socks = 0;
+    }
     
     // try connecting
-    try_connect(o);
+    for (int j = 0; j < o->num_members; j++) {
+        try_connect(&o->members[j]);
+    }
     
     DebugObject_Init(&o->d_obj);
     return 1;
     
+fail1:
+    while (i-- > 0) {
+        UdpGwClient_Free(&o->members[i].udpgw_client);
+    }
+    BFree(o->members);
 fail0:
     return 0;
 }
@@ -205,16 +283,23 @@ void SocksUdpGwClient_Free (SocksUdpGwClient *o)
 {
     DebugObject_Free(&o->d_obj);
     
-    // free SOCKS
-    if (o->have_socks) {
-        free_socks(o);
+    for (int i = 0; i < o->num_members; i++) {
+        struct SocksUdpGwClient_member *m = &o->members[i];
+        
+        // free SOCKS
+        if (m->have_socks) {
+            free_socks(m);
+        }
+        
+        // free reconnect timer
+        BReactor_RemoveTimer(o->reactor, &m->reconnect_timer);
+        
+        // free udpgw client
+        UdpGwClient_Free(&m->udpgw_client);
     }
     
-    // free reconnect timer
-    BReactor_RemoveTimer(o->reactor, &o->reconnect_timer);
-    
-    // free udpgw client
-    UdpGwClient_Free(&o->udpgw_client);
+    // free members
+    BFree(o->members);
 }
 
 void SocksUdpGwClient_SubmitPacket (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len)
@@ -222,7 +307,22 @@ void SocksUdpGwClient_SubmitPacket (SocksUdpGwClient *o, BAddr local_addr, BAddr
     DebugObject_Access(&o->d_obj);
     // see asserts in UdpGwClient_SubmitPacket
     
+    struct SocksUdpGwClient_member *m = select_member(o, local_addr, remote_addr);
+    
     // submit to udpgw client
-    UdpGwClient_SubmitPacket(&o->udpgw_client, local_addr, remote_addr, is_dns, data, data_len);
+    UdpGwClient_SubmitPacket(&m->udpgw_client, local_addr, remote_addr, is_dns, data, data_len);
+}
+
+#ifdef BADVPN_UDPGW_DGRAM
+
+void SocksUdpGwClient_EnableDatagram (SocksUdpGwClient *o, BIPAddr server_ip, int fec_group_size)
+{
+    DebugObject_Access(&o->d_obj);
+    // see asserts in UdpGwClient_EnableDatagram
+    
+    for (int i = 0; i < o->num_members; i++) {
+        UdpGwClient_EnableDatagram(&o->members[i].udpgw_client, server_ip, fec_group_size);
+    }
 }
 
+#endif
@@ -37,6 +37,8 @@
 
 typedef void (*SocksUdpGwClient_handler_received) (void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
 
+struct SocksUdpGwClient_member;
+
 typedef struct {
     int udp_mtu;
     BAddr socks_server_addr;
@@ -46,19 +48,62 @@ typedef struct {
     BReactor *reactor;
     void *user;
     SocksUdpGwClient_handler_received handler_received;
+    int num_members;
+    struct SocksUdpGwClient_member *members;
+    DebugObject d_obj;
+} SocksUdpGwClient;
+
+struct SocksUdpGwClient_member {
+    SocksUdpGwClient *client;
     UdpGwClient udpgw_client;
     BTimer reconnect_timer;
     int have_socks;
     BSocksClient socks_client;
     int socks_up;
-    DebugObject d_obj;
-} SocksUdpGwClient;
+};
 
-int SocksUdpGwClient_Init (SocksUdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time,
+/**
+ * Initializes the object.
+ * UDP is forwarded over num_members independent connections to udpgw. Each
+ * (local address, remote address) pair is hashed onto one of them, so that
+ * a stalled connection only holds up the flows hashed onto it. While a
+ * connection is down, its flows are moved to the next connection that is up.
+ * 
+ * @param o the object
+ * @param udp_mtu maximum UDP payload size, as in {@link UdpGwClient_Init}
+ * @param max_connections maximum number of UDP connections in total. Each udpgw
+ *                        connection gets an equal share of it.
+ * @param send_buffer_size per-UDP-connection send buffer size, in packets
+ * @param recv_buffer_size per-udpgw-connection receive buffer size, in packets
+ * @param keepalive_time keepalive interval
+ * @param socks_server_addr SOCKS server address
+ * @param auth_info SOCKS authentication methods
+ * @param num_auth_info number of SOCKS authentication methods
+ * @param remote_udpgw_addr udpgw address, as seen by the SOCKS server
+ * @param reconnect_time time after which a failed udpgw connection is retried
+ * @param num_members number of udpgw connections. Must be >0.
+ * @param reactor reactor we live in
+ * @param user value passed to handler
+ * @param handler_received handler called when a packet is received from udpgw
+ * @return 1 on success, 0 on failure
+ */
+int SocksUdpGwClient_Init (SocksUdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, int recv_buffer_size, btime_t keepalive_time,
                            BAddr socks_server_addr, const struct BSocksClient_auth_info *auth_info, size_t num_auth_info,
-                           BAddr remote_udpgw_addr, btime_t reconnect_time, BReactor *reactor, void *user,
+                           BAddr remote_udpgw_addr, btime_t reconnect_time, int num_members, BReactor *reactor, void *user,
                            SocksUdpGwClient_handler_received handler_received) WARN_UNUSED;
 void SocksUdpGwClient_Free (SocksUdpGwClient *o);
 void SocksUdpGwClient_SubmitPacket (SocksUdpGwClient *o, BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len);
 
+#ifdef BADVPN_UDPGW_DGRAM
+/**
+ * Makes every udpgw connection ask for the datagram transport, and use it
+ * if datagrams get through. See {@link UdpGwClient_EnableDatagram}.
+ * 
+ * @param o the object
+ * @param server_ip IP address of the udpgw server, as seen from here
+ * @param fec_group_size FEC group size to ask for, or 0 for no FEC
+ */
+void SocksUdpGwClient_EnableDatagram (SocksUdpGwClient *o, BIPAddr server_ip, int fec_group_size);
+#endif
+
 #endif
@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <misc/balloc.h>
+#include <base/BLog.h>
+
+#include <tun2socks/SocksUpstreams.h>
+
+#include <generated/blog_channel_SocksUpstreams.h>
+
+// servers slower than this multiple of the fastest one, plus the slack,
+// are not picked by source hash
+#define SLOW_FACTOR 2
+#define SLOW_SLACK 5
+
+static uint64_t mix64 (uint64_t x);
+static uint64_t source_key (BAddr source);
+static int server_is_fast (SocksUpstreams *o, struct SocksUpstreams_server *s, btime_t best_latency);
+static int pick_least_conn (SocksUpstreams *o, int healthy_only);
+static int pick_source_hash (SocksUpstreams *o, int healthy_only, BAddr source);
+static void set_healthy (SocksUpstreams *o, struct SocksUpstreams_server *s, int healthy);
+static void probe_finish (SocksUpstreams *o, struct SocksUpstreams_server *s);
+static void probe_connector_handler (struct SocksUpstreams_server *s, int is_error);
+static void check_timer_handler (SocksUpstreams *o);
+
+static uint64_t mix64 (uint64_t x)
+{
+    x ^= x >> 30;
+    x *= UINT64_C(0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x *= UINT64_C(0x94d049bb133111eb);
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t source_key (BAddr source)
+{
+    uint64_t key = 0;
+    
+    switch (source.type) {
+        case BADDR_TYPE_IPV4: {
+            key = mix64(source.ipv4.ip);
+        } break;
+        case BADDR_TYPE_IPV6: {
+            for (int i = 0; i < 16; i += 8) {
+                uint64_t part;
+                memcpy(&part, source.ipv6.ip + i, sizeof(part));
+                key = mix64(key ^ part);
+            }
+        } break;
+    }
+    
+    return key;
+}
+
+static int server_is_fast (SocksUpstreams *o, struct SocksUpstreams_server *s, btime_t best_latency)
+{
+    return (s->latency < 0 || best_latency < 0 || s->latency <= SLOW_FACTOR * best_latency + SLOW_SLACK);
+}
+
+static int pick_least_conn (SocksUpstreams *o, int healthy_only)
+{
+    int best = -1;
+    
+    for (int i = 0; i < o->num_servers; i++) {
+        struct SocksUpstreams_server *s = &o->servers[i];
+        if (healthy_only && !s->healthy) {
+            continue;
+        }
+        
+        if (best >= 0) {
+            struct SocksUpstreams_server *b = &o->servers[best];
+            
+            // compare connections per weight, then latency
+            int64_t load = (int64_t)(s->num_connections + 1) * b->weight;
+            int64_t best_load = (int64_t)(b->num_connections + 1) * s->weight;
+            if (load > best_load || (load == best_load && (s->latency < 0 || (b->latency >= 0 && s->latency >= b->latency)))) {
+                continue;
+            }
+        }
+        
+        best = i;
+    }
+    
+    return best;
+}
+
+static int pick_source_hash (SocksUpstreams *o, int healthy_only, BAddr source)
+{
+    // find the best latency
+    btime_t best_latency = -1;
+    for (int i = 0; i < o->num_servers; i++) {
+        struct SocksUpstreams_server *s = &o->servers[i];
+        if ((!healthy_only || s->healthy) && s->latency >= 0 && (best_latency < 0 || s->latency < best_latency)) {
+            best_latency = s->latency;
+        }
+    }
+    
+    // rendezvous hashing, where a server of weight w gets w draws
+    uint64_t key = source_key(source);
+    int best = -1;
+    uint64_t best_score = 0;
+    for (int i = 0; i < o->num_servers; i++) {
+        struct SocksUpstreams_server *s = &o->servers[i];
+        if ((healthy_only && !s->healthy) || !server_is_fast(o, s, best_latency)) {
+            continue;
+        }
+        
+        for (int j = 0; j < s->weight; j++) {
+            uint64_t score = mix64(key ^ mix64(((uint64_t)i << 32) | j));
+            if (best < 0 || score > best_score) {
+                best = i;
+                best_score = score;
+            }
+        }
+    }
+    
+    return best;
+}
+
+static void set_healthy (SocksUpstreams *o, struct SocksUpstreams_server *s, int healthy)
+{
+    if (healthy == s->healthy) {
+        return;
+    }
+    
+    char addr_str[BADDR_MAX_PRINT_LEN];
+    BAddr_Print(&s->addr, addr_str);
+    if (healthy) {
+        BLog(BLOG_NOTICE, "server %s is up", addr_str);
+    } else {
+        BLog(BLOG_WARNING, "server %s is down", addr_str);
+    }
+    
+    s->healthy = healthy;
+}
+
+static void probe_finish (SocksUpstreams *o, struct SocksUpstreams_server *s)
+{
+    ASSERT(s->probing)
+    
+    BConnector_Free(&s->probe_connector);
+    s->probing = 0;
+}
+
+static void probe_connector_handler (struct SocksUpstreams_server *s, int is_error)
+{
+    SocksUpstreams *o = s->parent;
+    DebugObject_Access(&o->d_obj);
+    ASSERT(s->probing)
+    
+    if (is_error) {
+        set_healthy(o, s, 0);
+    } else {
+        // track latency as a moving average
+        btime_t sample = btime_gettime() - s->probe_start;
+        s->latency = (s->latency < 0 ? sample : (3 * s->latency + sample) / 4);
+        set_healthy(o, s, 1);
+    }
+    
+    probe_finish(o, s);
+}
+
+static void check_timer_handler (SocksUpstreams *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->check_interval > 0)
+    
+    for (int i = 0; i < o->num_servers; i++) {
+        struct SocksUpstreams_server *s = &o->servers[i];
+        
+        // an attempt still going after a whole interval counts as failed
+        if (s->probing) {
+            probe_finish(o, s);
+            set_healthy(o, s, 0);
+        }
+        
+        // start a new attempt
+        if (!BConnector_Init(&s->probe_connector, s->addr, o->reactor, s, (BConnector_handler)probe_connector_handler)) {
+            BLog(BLOG_ERROR, "BConnector_Init failed");
+            set_healthy(o, s, 0);
+            continue;
+        }
+        s->probing = 1;
+        s->probe_start = btime_gettime();
+    }
+    
+    BReactor_SetTimer(o->reactor, &o->check_timer);
+}
+
+int SocksUpstreams_Init (SocksUpstreams *o, const BAddr *addrs, const int *weights, int num_servers,
+                         int policy, btime_t check_interval, BReactor *reactor)
+{
+    ASSERT(num_servers > 0)
+    ASSERT(policy == SOCKS_UPSTREAMS_POLICY_LEAST_CONN || policy == SOCKS_UPSTREAMS_POLICY_SOURCE_HASH)
+    ASSERT(check_interval >= 0)
+    
+    // init arguments
+    o->num_servers = num_servers;
+    o->policy = policy;
+    o->check_interval = check_interval;
+    o->reactor = reactor;
+    
+    // allocate servers
+    if (!(o->servers = (struct SocksUpstreams_server *)BAllocArray(num_servers, sizeof(o->servers[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        return 0;
+    }
+    
+    // init servers
+    for (int i = 0; i < num_servers; i++) {
+        ASSERT(addrs[i].type == BADDR_TYPE_IPV4 || addrs[i].type == BADDR_TYPE_IPV6)
+        ASSERT(weights[i] > 0)
+        ASSERT(weights[i] <= SOCKS_UPSTREAMS_MAX_WEIGHT)
+        
+        struct SocksUpstreams_server *s = &o->servers[i];
+        s->parent = o;
+        s->addr = addrs[i];
+        s->weight = weights[i];
+        s->healthy = 1;
+        s->num_connections = 0;
+        s->latency = -1;
+        s->probing = 0;
+    }
+    
+    // init check timer, checking right away
+    BTimer_Init(&o->check_timer, check_interval, (BTimer_handler)check_timer_handler, o);
+    if (check_interval > 0) {
+        BReactor_SetTimerAfter(o->reactor, &o->check_timer, 0);
+    }
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
+void SocksUpstreams_Free (SocksUpstreams *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free check timer
+    BReactor_RemoveTimer(o->reactor, &o->check_timer);
+    
+    // free servers
+    for (int i = 0; i < o->num_servers; i++) {
+        struct SocksUpstreams_server *s = &o->servers[i];
+        ASSERT(s->num_connections == 0)
+        if (s->probing) {
+            probe_finish(o, s);
+        }
+    }
+    BFree(o->servers);
+}
+
+int SocksUpstreams_Acquire (SocksUpstreams *o, BAddr source)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // pick among healthy servers, or among all if none is healthy
+    int index = -1;
+    for (int healthy_only = 1; index < 0 && healthy_only >= 0; healthy_only--) {
+        if (o->policy == SOCKS_UPSTREAMS_POLICY_SOURCE_HASH) {
+            index = pick_source_hash(o, healthy_only, source);
+        } else {
+            index = pick_least_conn(o, healthy_only);
+        }
+    }
+    ASSERT(index >= 0)
+    ASSERT(index < o->num_servers)
+    
+    o->servers[index].num_connections++;
+    
+    return index;
+}
+
+void SocksUpstreams_Release (SocksUpstreams *o, int index)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(index >= 0)
+    ASSERT(index < o->num_servers)
+    ASSERT(o->servers[index].num_connections > 0)
+    
+    o->servers[index].num_connections--;
+}
+
+BAddr SocksUpstreams_GetAddr (SocksUpstreams *o, int index)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(index >= 0)
+    ASSERT(index < o->num_servers)
+    
+    return o->servers[index].addr;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Set of SOCKS servers which connections are distributed over.
+ */
+
+#ifndef BADVPN_TUN2SOCKS_SOCKSUPSTREAMS_H
+#define BADVPN_TUN2SOCKS_SOCKSUPSTREAMS_H
+
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <system/BAddr.h>
+#include <system/BTime.h>
+#include <system/BReactor.h>
+#include <system/BConnection.h>
+
+// largest server weight
+#define SOCKS_UPSTREAMS_MAX_WEIGHT 100
+
+// pick the server with the fewest connections relative to its weight
+#define SOCKS_UPSTREAMS_POLICY_LEAST_CONN 1
+// pick a server by hashing the source address, among the fastest ones
+#define SOCKS_UPSTREAMS_POLICY_SOURCE_HASH 2
+
+struct SocksUpstreams_s;
+
+struct SocksUpstreams_server {
+    struct SocksUpstreams_s *parent;
+    BAddr addr;
+    int weight;
+    int healthy;
+    int num_connections;
+    btime_t latency;
+    int probing;
+    btime_t probe_start;
+    BConnector probe_connector;
+};
+
+typedef struct SocksUpstreams_s {
+    struct SocksUpstreams_server *servers;
+    int num_servers;
+    int policy;
+    btime_t check_interval;
+    BReactor *reactor;
+    BTimer check_timer;
+    DebugObject d_obj;
+} SocksUpstreams;
+
+/**
+ * Initializes the object.
+ * 
+ * If check_interval is >0, a TCP connection to each server is attempted every
+ * check_interval milliseconds. A server whose attempt fails, or doesn't finish
+ * within the interval, is not picked until an attempt succeeds again, unless
+ * all servers are down. The time to connect is tracked as the server's latency.
+ * Servers start out healthy, with unknown latency.
+ * 
+ * @param o the object
+ * @param addrs server addresses. Must be IPv4 or IPv6.
+ * @param weights server weights. Each must be >0 and <=SOCKS_UPSTREAMS_MAX_WEIGHT.
+ * @param num_servers number of servers. Must be >0.
+ * @param policy SOCKS_UPSTREAMS_POLICY_LEAST_CONN or SOCKS_UPSTREAMS_POLICY_SOURCE_HASH
+ * @param check_interval health check interval in milliseconds, or 0 for no checks
+ * @param reactor reactor we live in
+ * @return 1 on success, 0 on failure
+ */
+int SocksUpstreams_Init (SocksUpstreams *o, const BAddr *addrs, const int *weights, int num_servers,
+                         int policy, btime_t check_interval, BReactor *reactor) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void SocksUpstreams_Free (SocksUpstreams *o);
+
+/**
+ * Picks a server for a new connection and counts the connection against it.
+ * {@link SocksUpstreams_Release} must be called when the connection is gone.
+ * 
+ * With SOCKS_UPSTREAMS_POLICY_SOURCE_HASH, the same source keeps getting the
+ * same server while the set of healthy servers stays the same, and only the
+ * sources of a server which goes down move to other servers.
+ * 
+ * @param o the object
+ * @param source source address of the connection; only the IP address is used
+ * @return server index
+ */
+int SocksUpstreams_Acquire (SocksUpstreams *o, BAddr source);
+
+/**
+ * Uncounts a connection counted by {@link SocksUpstreams_Acquire}.
+ * 
+ * @param o the object
+ * @param index server index returned by {@link SocksUpstreams_Acquire}
+ */
+void SocksUpstreams_Release (SocksUpstreams *o, int index);
+
+/**
+ * Returns the address of a server.
+ * 
+ * @param o the object
+ * @param index server index. Must be >=0 and <num_servers.
+ * @return server address
+ */
+BAddr SocksUpstreams_GetAddr (SocksUpstreams *o, int index);
+
+#endif
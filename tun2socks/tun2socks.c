@@ -27,6 +27,7 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <string.h>
@@ -47,23 +48,46 @@
 #include <misc/read_file.h>
 #include <misc/ipaddr6.h>
 #include <misc/concat_strings.h>
+#include <misc/bslab.h>
+#include <misc/probe.h>
+#include <misc/memref.h>
+#include <misc/parse_number.h>
 #include <structure/LinkedList1.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
+#include <base/BBufferArena.h>
 #include <system/BReactor.h>
 #include <system/BSignal.h>
 #include <system/BAddr.h>
 #include <system/BNetwork.h>
-#include <flow/SinglePacketBuffer.h>
+#include <system/BCpuSet.h>
 #include <socksclient/BSocksClient.h>
 #include <tuntap/BTap.h>
+#include <flowextra/StatsServer.h>
 #include <lwip/init.h>
 #include <lwip/tcp_impl.h>
 #include <lwip/netif.h>
 #include <lwip/tcp.h>
 #include <tun2socks/SocksUdpGwClient.h>
+#include <tun2socks/SocksTcpGwClient.h>
+#include <tun2socks/SocksUdpClient.h>
+#include <tun2socks/SocksUpstreams.h>
+#include <tun2socks/DirectRules.h>
+#include <tun2socks/DirectUdpClient.h>
+#include <dnscache/DnsCache.h>
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
+#include <base/BLog_async.h>
+#include <base/BLog_trace.h>
+#endif
+
+#ifdef BADVPN_LINUX
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #endif
 
 #include <tun2socks/tun2socks.h>
@@ -72,6 +96,11 @@
 
 #define LOGGER_STDOUT 1
 #define LOGGER_SYSLOG 2
+#define LOGGER_TRACE 3
+
+// space left in front of received packets, so lwip can move the payload
+// pointer back over the headers it has stripped
+#define DEVICE_READ_HEADROOM LWIP_MEM_ALIGN_SIZE(PBUF_LINK_HLEN)
 
 #define SYNC_DECL \
     BPending sync_mark; \
@@ -95,6 +124,9 @@ struct {
     #ifndef BADVPN_USE_WINAPI
     char *logger_syslog_facility;
     char *logger_syslog_ident;
+    int logger_async;
+    char *logger_trace_file;
+    int logger_trace_size;
     #endif
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
@@ -102,7 +134,10 @@ struct {
     char *netif_ipaddr;
     char *netif_netmask;
     char *netif_ip6addr;
-    char *socks_server_addr;
+    char *socks_server_addrs[MAX_SOCKS_SERVERS];
+    int num_socks_servers;
+    int socks_balance;
+    int socks_check_interval;
     char *username;
     char *password;
     char *password_file;
@@ -110,10 +145,74 @@ struct {
     char *udpgw_remote_server_addr;
     int udpgw_max_connections;
     int udpgw_connection_buffer_size;
+    int udpgw_recv_buffer_size;
+    int udpgw_num_connections;
     int udpgw_transparent_dns;
+    #ifdef BADVPN_UDPGW_DGRAM
+    char *udpgw_dgram_server_ip;
+    int udpgw_dgram_fec;
+    #endif
+    int dns_cache_size;
+    int socks5_udp;
+    int socks5_pipelining;
+    int socks_fastopen;
+    char *tcpgw_remote_server_addr;
+    int tcpgw_num_connections;
+    int tcpgw_window;
+    char *direct_rules[MAX_DIRECT_RULES];
+    int num_direct_rules;
+    #ifndef BADVPN_USE_WINAPI
+    struct BConnection_options direct_socket_options;
+    #endif
+    int reactor_max_events;
+    int reactor_job_budget;
+    #ifndef BADVPN_USE_WINAPI
+    int reactor_edge_triggered;
+    #endif
+    #ifdef BADVPN_USE_IO_URING
+    int io_uring_entries;
+    #endif
+    #ifdef BADVPN_LINUX
+    int tun_offload;
+    int workers;
+    BCpuSet cpu_affinity;
+    BCpuSet worker_cpus;
+    int buffer_arena;
+    #endif
+    int tcp_mss;
+    int tcp_wnd;
+    int tcp_snd_buf;
+    int max_tcp_connections;
+    int tcp_idle_timeout;
+    int tcp_half_close_timeout;
+    uint64_t max_tcp_buffer_memory;
+    int no_checksum_check;
+    int socks_buf_size;
+    struct BConnection_options socks_socket_options;
+    char *stats_listen_addr;
+    #ifndef BADVPN_USE_WINAPI
+    char *stats_listen_unix;
+    #endif
 } options;
 
+// device read buffer, passed to lwip as a custom pbuf
+struct device_read_pbuf {
+    struct pbuf_custom p;
+    LinkedList1Node free_list_node;
+    uint8_t data[];
+};
+
 // TCP client
+// ring buffer for data from the SOCKS server; while a client moves to a buffer
+// of another size, new data goes to the second ring and the first one drains
+struct client_ring {
+    uint8_t *buf;
+    int size_class;
+    int start;
+    int used;
+    int tcp_pending;
+};
+
 struct tcp_client {
     dead_t dead;
     dead_t dead_client;
@@ -122,19 +221,31 @@ struct tcp_client {
     BAddr remote_addr;
     struct tcp_pcb *pcb;
     int client_closed;
-    uint8_t buf[TCP_WND];
+    uint8_t *buf;
     int buf_used;
     char *socks_username;
+    int socks_server;
+    int use_tcpgw;
+    int use_direct;
     BSocksClient socks_client;
+    TcpMuxStream tcpgw_stream;
+    BConnector direct_connector;
+    BConnection direct_con;
+    int direct_connected;
     int socks_up;
     int socks_closed;
     StreamPassInterface *socks_send_if;
     StreamRecvInterface *socks_recv_if;
-    uint8_t socks_recv_buf[CLIENT_SOCKS_RECV_BUF_SIZE];
+    struct client_ring socks_recv_rings[2];
+    int socks_recv_num_rings;
     int socks_recv_buf_used;
-    int socks_recv_buf_sent;
-    int socks_recv_waiting;
     int socks_recv_tcp_pending;
+    int socks_recv_receiving;
+    int socks_recv_peak;
+    int socks_recv_shrink;
+    struct tcp_pcb *linger_pcb;
+    int closing;
+    uint32_t active_tick;
 };
 
 // IP address of netif
@@ -146,9 +257,16 @@ BIPAddr netif_netmask;
 // IP6 address of netif
 struct ipv6_addr netif_ip6addr;
 
-// SOCKS server address
+// SOCKS server address, the first one given
 BAddr socks_server_addr;
 
+// all SOCKS server addresses and their weights
+BAddr socks_server_addrs[MAX_SOCKS_SERVERS];
+int socks_server_weights[MAX_SOCKS_SERVERS];
+
+// SOCKS servers which TCP connections are distributed over
+SocksUpstreams socks_upstreams;
+
 // allocated password file contents
 uint8_t *password_file_contents;
 
@@ -159,12 +277,26 @@ size_t socks_num_auth_info;
 // remote udpgw server addr, if provided
 BAddr udpgw_remote_server_addr;
 
+#ifdef BADVPN_UDPGW_DGRAM
+// udpgw server IP for datagrams, if provided
+BIPAddr udpgw_dgram_server_ip;
+#endif
+
+// remote tcpgw server addr, if provided
+BAddr tcpgw_remote_server_addr;
+
 // reactor
 BReactor ss;
 
 // set to 1 by terminate
 int quitting;
 
+#ifdef BADVPN_LINUX
+// worker processes, when running with --workers
+pid_t worker_pids[MAX_WORKERS];
+int worker_index;
+#endif
+
 // TUN device
 BTap device;
 
@@ -172,15 +304,34 @@ BTap device;
 uint8_t *device_write_buf;
 
 // device reading
-SinglePacketBuffer device_read_buffer;
-PacketPassInterface device_read_interface;
+int device_read_mtu;
+LinkedList1 device_read_free_list;
+int device_read_num_free;
+struct device_read_pbuf *device_read_cur;
 
 // udpgw client
 SocksUdpGwClient udpgw_client;
 int udp_mtu;
 
-// TCP timer
+// tcpgw client
+SocksTcpGwClient tcpgw_client;
+
+// SOCKS5 UDP client
+SocksUdpClient socks_udp_client;
+
+// rules for destinations reached directly, if any were given
+DirectRules direct_rules;
+
+// client for UDP reached directly
+DirectUdpClient direct_udp_client;
+
+// DNS cache for transparent DNS
+int have_dns_cache;
+DnsCache dns_cache;
+
+// TCP timer, running only while there are pcbs which need it
 BTimer tcp_timer;
+btime_t tcp_timer_next;
 
 // job for initializing lwip
 BPending lwip_init_job;
@@ -201,23 +352,84 @@ LinkedList1 tcp_clients;
 // number of clients
 int num_clients;
 
+// freed clients whose closed pcb may still refer to their buffers
+LinkedList1 lingering_clients;
+
+// clients with one side closed, sending what is left to the other side;
+// like tcp_clients, ordered by the tick of the last activity
+LinkedList1 closing_clients;
+
+// client timer and its tick count
+BTimer client_timer;
+uint32_t client_tick;
+
+// memory for clients
+BSlab clients_slab;
+
+// memory for client buffers; buffers for data to SOCKS have a single size,
+// ring buffers for data from SOCKS come in doubling sizes
+BSlab client_send_bufs_slab;
+BSlab client_ring_slabs[CLIENT_BUF_MAX_CLASSES];
+int num_client_ring_classes;
+uint64_t client_bufs_bytes;
+
+// counters
+struct {
+    uint64_t device_packets_in;
+    uint64_t device_bytes_in;
+    uint64_t device_packets_out;
+    uint64_t device_bytes_out;
+    uint64_t device_read_nobuf;
+    uint64_t device_write_nospace;
+    uint64_t device_drop_malformed;
+    uint64_t device_drop_unhandled;
+    uint64_t tcp_drop_rst;
+    uint64_t tcp_drop_syn;
+    uint64_t tcp_clients;
+    uint64_t tcp_accept_failed;
+    uint64_t tcp_idle_timeouts;
+    uint64_t tcp_half_close_timeouts;
+    uint64_t tcp_evictions;
+} stats;
+
+// statistics server
+int have_stats_server;
+struct BLisCon_from stats_listen_from;
+#ifdef BADVPN_LINUX
+char stats_worker_unix[256];
+#endif
+StatsServer stats_server;
+
 static void terminate (void);
 static void print_help (const char *name);
+#ifdef BADVPN_LINUX
+static void kill_workers (void);
+static int run_workers (void);
+#endif
 static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
+static int parse_socks_server (const char *str, BAddr *out_addr, int *out_weight);
 static int process_arguments (void);
 static void signal_handler (void *unused);
 static BAddr baddr_from_lwip (int is_ipv6, const ipX_addr_t *ipx_addr, uint16_t port_hostorder);
 static void lwip_init_job_hadler (void *unused);
+static void tcp_timer_needed_handler (void);
 static void tcp_timer_handler (void *unused);
 static void device_error_handler (void *unused);
-static void device_read_handler_send (void *unused, uint8_t *data, int data_len);
+static struct device_read_pbuf * device_read_pbuf_get (void);
+static void device_read_pbuf_free_func (struct pbuf *p);
+static void device_read_handler_done (void *unused, int data_len);
 static int process_device_udp_packet (uint8_t *data, int data_len);
+static int prefilter_device_packet (uint8_t *data, int data_len);
 static err_t netif_init_func (struct netif *netif);
 static err_t netif_output_func (struct netif *netif, struct pbuf *p, ip_addr_t *ipaddr);
 static err_t netif_output_ip6_func (struct netif *netif, struct pbuf *p, ip6_addr_t *ipaddr);
 static err_t common_netif_output (struct netif *netif, struct pbuf *p);
 static err_t netif_input_func (struct pbuf *p, struct netif *inp);
+static int client_ring_size (int size_class);
+static size_t client_bufs_chunk_objs (int obj_size);
+static int init_client_bufs (void);
+static void free_client_bufs (void);
 static void client_logfunc (struct tcp_client *client);
 static void client_log (struct tcp_client *client, int level, const char *fmt, ...);
 static err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err);
@@ -227,16 +439,36 @@ static void client_abort_client (struct tcp_client *client);
 static void client_free_socks (struct tcp_client *client);
 static void client_murder (struct tcp_client *client);
 static void client_dealloc (struct tcp_client *client);
+static void client_release (struct tcp_client *client);
+static int client_linger_done (struct tcp_client *client);
+static void free_lingering_clients (int force);
+static void client_touch (struct tcp_client *client);
+static void client_set_closing (struct tcp_client *client);
+static int client_evict (struct tcp_client *except);
+static int client_bufs_reserve (int size, struct tcp_client *except);
+static void client_expire (LinkedList1 *list, int timeout, uint64_t *counter);
+static void client_timer_handler (void *unused);
 static void client_err_func (void *arg, err_t err);
 static err_t client_recv_func (void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
 static void client_socks_handler (struct tcp_client *client, int event);
+static void client_tcpgw_handler (struct tcp_client *client, int event);
+static void client_socks_free_connection (struct tcp_client *client);
+static void client_direct_connector_handler (struct tcp_client *client, int is_error);
+static void client_direct_connection_handler (struct tcp_client *client, int event);
 static void client_send_to_socks (struct tcp_client *client);
 static void client_socks_send_handler_done (struct tcp_client *client, int data_len);
+static int client_socks_recv_have_space (struct tcp_client *client);
 static void client_socks_recv_initiate (struct tcp_client *client);
 static void client_socks_recv_handler_done (struct tcp_client *client, int data_len);
+static void client_socks_recv_resize (struct tcp_client *client);
+static int client_socks_recv_queue_ring (struct tcp_client *client, struct client_ring *r);
 static int client_socks_recv_send_out (struct tcp_client *client);
 static err_t client_sent_func (void *arg, struct tcp_pcb *tpcb, u16_t len);
 static void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+static void udp_send_to_device (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+static void dns_cache_handler_send (void *unused, BAddr local_addr, BAddr remote_addr, uint64_t tag, const uint8_t *data, int data_len);
+static void stats_handler_report (void *unused, StatsServerReport *r);
+static void stats_print_metric (void *user, const char *line);
 
 int main (int argc, char **argv)
 {
@@ -277,11 +509,25 @@ int main (int argc, char **argv)
                 goto fail0;
             }
             break;
+        case LOGGER_TRACE:
+            if (!BLog_InitTrace(options.logger_trace_file, options.logger_trace_size)) {
+                fprintf(stderr, "Failed to initialize trace logger\n");
+                goto fail0;
+            }
+            break;
         #endif
         default:
             ASSERT(0);
     }
     
+    #ifndef BADVPN_USE_WINAPI
+    // write out logs from a separate thread
+    if (options.logger_async && !BLog_MakeAsync(BLOG_ASYNC_DEFAULT_BUFFER_SIZE)) {
+        fprintf(stderr, "Failed to start asynchronous logger\n");
+        goto fail1;
+    }
+    #endif
+    
     // configure logger channels
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         if (options.loglevels[i] >= 0) {
@@ -309,6 +555,43 @@ int main (int argc, char **argv)
         goto fail1;
     }
     
+    #ifdef BADVPN_LINUX
+    // bind to CPUs before starting any workers, so that they inherit it
+    if (!BCpuSet_IsEmpty(&options.cpu_affinity) && !BCpuSet_BindThread(&options.cpu_affinity)) {
+        BLog(BLOG_ERROR, "BCpuSet_BindThread failed");
+        goto fail1;
+    }
+    
+    // with multiple workers, this process only supervises them; each worker
+    // has its own lwip stack and SOCKS connections on its own queue of the
+    // device, and the kernel distributes flows among the queues by hash
+    if (options.workers > 1) {
+        if (run_workers() >= 0) {
+            goto fail1;
+        }
+        BLog(BLOG_NOTICE, "worker %d started", worker_index);
+    }
+    
+    // bind to our own CPU before allocating anything large, so that our
+    // memory is placed on its NUMA node
+    if (!BCpuSet_IsEmpty(&options.worker_cpus)) {
+        if (!BCpuSet_BindThreadToIndex(&options.worker_cpus, worker_index)) {
+            BLog(BLOG_ERROR, "BCpuSet_BindThreadToIndex failed");
+            goto fail1;
+        }
+        BLog(BLOG_INFO, "bound to CPU %d", BCpuSet_GetCpu(&options.worker_cpus, worker_index));
+    }
+    
+    // map our own packet buffer arena, on our NUMA node
+    if (options.buffer_arena > 0) {
+        if (!BBufferArena_Enable((size_t)options.buffer_arena * 1024 * 1024)) {
+            BLog(BLOG_ERROR, "BBufferArena_Enable failed");
+            goto fail1;
+        }
+        BLog(BLOG_INFO, "buffer arena uses %s huge pages", (BBufferArena_IsHugeTLB() ? "reserved" : "transparent"));
+    }
+    #endif
+    
     // init time
     BTime_Init();
     
@@ -318,6 +601,25 @@ int main (int argc, char **argv)
         goto fail1;
     }
     
+    // configure reactor
+    if (options.reactor_max_events > 0) {
+        BReactor_SetMaxResults(&ss, options.reactor_max_events);
+    }
+    BReactor_SetJobBudget(&ss, options.reactor_job_budget);
+    #ifndef BADVPN_USE_WINAPI
+    if (options.reactor_edge_triggered) {
+        BReactor_SetSocketFdFlags(&ss, BREACTOR_FDFLAG_EDGE);
+    }
+    #endif
+    #ifdef BADVPN_USE_IO_URING
+    if (options.io_uring_entries > 0) {
+        if (!BReactor_EnableIOUring(&ss, options.io_uring_entries)) {
+            BLog(BLOG_ERROR, "BReactor_EnableIOUring failed");
+            goto fail2;
+        }
+    }
+    #endif
+    
     // set not quitting
     quitting = 0;
     
@@ -327,26 +629,62 @@ int main (int argc, char **argv)
         goto fail2;
     }
     
-    // init TUN device
-    if (!BTap_Init(&device, &ss, options.tundev, device_error_handler, NULL, 1)) {
-        BLog(BLOG_ERROR, "BTap_Init failed");
+    // init SOCKS servers; with only one there is no choice to check for
+    btime_t check_interval = (options.num_socks_servers > 1 ? (btime_t)options.socks_check_interval * 1000 : 0);
+    if (!SocksUpstreams_Init(&socks_upstreams, socks_server_addrs, socks_server_weights, options.num_socks_servers,
+                             options.socks_balance, check_interval, &ss)) {
+        BLog(BLOG_ERROR, "SocksUpstreams_Init failed");
         goto fail3;
     }
     
+    // init TUN device
+    struct BTap_init_data tap_init;
+    tap_init.dev_type = BTAP_DEV_TUN;
+    tap_init.init_type = BTAP_INIT_STRING;
+    tap_init.init.string = options.tundev;
+    tap_init.flags = 0;
+    #ifdef BADVPN_LINUX
+    if (options.tun_offload) {
+        tap_init.flags |= BTAP_INIT_FLAG_VNET_HDR;
+    }
+    if (options.workers > 1) {
+        tap_init.flags |= BTAP_INIT_FLAG_MULTI_QUEUE;
+    }
+    #endif
+    if (!BTap_Init2(&device, &ss, tap_init, device_error_handler, NULL)) {
+        BLog(BLOG_ERROR, "BTap_Init2 failed");
+        goto fail3a;
+    }
+    
     // NOTE: the order of the following is important:
     // first device writing must evaluate,
     // then lwip (so it can send packets to the device),
     // then device reading (so it can pass received packets to lwip).
     
     // init device reading
-    PacketPassInterface_Init(&device_read_interface, BTap_GetMTU(&device), device_read_handler_send, NULL, BReactor_PendingGroup(&ss));
-    if (!SinglePacketBuffer_Init(&device_read_buffer, BTap_GetOutput(&device), &device_read_interface, BReactor_PendingGroup(&ss))) {
-        BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed");
-        goto fail4;
+    // with offload, received packets may be larger than the MTU
+    device_read_mtu = PacketRecvInterface_GetMTU(BTap_GetOutput(&device));
+    LinkedList1_Init(&device_read_free_list);
+    device_read_num_free = 0;
+    LinkedList1Node *node;
+    for (int i = 0; i < DEVICE_READ_POOL_SIZE; i++) {
+        struct device_read_pbuf *buf = (struct device_read_pbuf *)BAllocSize(bsize_add(bsize_fromsize(sizeof(*buf)), bsize_fromint(DEVICE_READ_HEADROOM + device_read_mtu)));
+        if (!buf) {
+            BLog(BLOG_ERROR, "BAllocSize failed");
+            goto fail4;
+        }
+        LinkedList1_Append(&device_read_free_list, &buf->free_list_node);
+        device_read_num_free++;
     }
     
-    if (options.udpgw_remote_server_addr) {
-        // compute maximum UDP payload size we need to pass through udpgw
+    // start receiving into a buffer from the pool
+    device_read_cur = device_read_pbuf_get();
+    ASSERT(device_read_cur)
+    PacketRecvInterface_Receiver_Init(BTap_GetOutput(&device), device_read_handler_done, NULL);
+    PacketRecvInterface_Receiver_Recv(BTap_GetOutput(&device), device_read_cur->data + DEVICE_READ_HEADROOM);
+    
+    if (options.socks5_udp || options.udpgw_remote_server_addr || options.num_direct_rules > 0) {
+        // compute maximum UDP payload size we need to forward
         udp_mtu = BTap_GetMTU(&device) - (int)(sizeof(struct ipv4_header) + sizeof(struct udp_header));
         if (options.netif_ip6addr) {
             int udp_ip6_mtu = BTap_GetMTU(&device) - (int)(sizeof(struct ipv6_header) + sizeof(struct udp_header));
@@ -357,24 +695,105 @@ int main (int argc, char **argv)
         if (udp_mtu < 0) {
             udp_mtu = 0;
         }
+    }
+    
+    if (options.num_direct_rules > 0) {
+        // init direct rules
+        if (!DirectRules_Init(&direct_rules, options.direct_rules, options.num_direct_rules)) {
+            BLog(BLOG_ERROR, "DirectRules_Init failed");
+            goto fail4a;
+        }
         
+        // init direct UDP client, with the same mark and device as direct TCP
+        int have_mark = 0;
+        uint32_t mark = 0;
+        const char *bind_device = NULL;
+        #ifndef BADVPN_USE_WINAPI
+        have_mark = options.direct_socket_options.have_mark;
+        mark = options.direct_socket_options.mark;
+        if (options.direct_socket_options.device[0]) {
+            bind_device = options.direct_socket_options.device;
+        }
+        #endif
+        if (!DirectUdpClient_Init(&direct_udp_client, udp_mtu, DEFAULT_DIRECT_UDP_MAX_CONNECTIONS, DIRECT_UDP_IDLE_TIME,
+                                  have_mark, mark, bind_device, &ss, NULL, udp_send_to_device
+        )) {
+            BLog(BLOG_ERROR, "DirectUdpClient_Init failed");
+            DirectRules_Free(&direct_rules);
+            goto fail4a;
+        }
+    }
+    
+    // set no DNS cache
+    have_dns_cache = 0;
+    
+    if (options.socks5_udp) {
+        // init SOCKS5 UDP client
+        if (!SocksUdpClient_Init(&socks_udp_client, udp_mtu, DEFAULT_SOCKS_UDP_MAX_CONNECTIONS, SOCKS_UDP_IDLE_TIME,
+                                 socks_server_addr, socks_auth_info, socks_num_auth_info, &ss, NULL, udpgw_client_handler_received
+        )) {
+            BLog(BLOG_ERROR, "SocksUdpClient_Init failed");
+            goto fail4b;
+        }
+    }
+    else if (options.udpgw_remote_server_addr) {
         // make sure our UDP payloads aren't too large for udpgw
         int udpgw_mtu = udpgw_compute_mtu(udp_mtu);
         if (udpgw_mtu < 0 || udpgw_mtu > PACKETPROTO_MAXPAYLOAD) {
             BLog(BLOG_ERROR, "device MTU is too large for UDP");
-            goto fail4a;
+            goto fail4b;
         }
         
         // init udpgw client
-        if (!SocksUdpGwClient_Init(&udpgw_client, udp_mtu, DEFAULT_UDPGW_MAX_CONNECTIONS, options.udpgw_connection_buffer_size, UDPGW_KEEPALIVE_TIME,
+        if (!SocksUdpGwClient_Init(&udpgw_client, udp_mtu, DEFAULT_UDPGW_MAX_CONNECTIONS, options.udpgw_connection_buffer_size, options.udpgw_recv_buffer_size, UDPGW_KEEPALIVE_TIME,
                                    socks_server_addr, socks_auth_info, socks_num_auth_info,
-                                   udpgw_remote_server_addr, UDPGW_RECONNECT_TIME, &ss, NULL, udpgw_client_handler_received
+                                   udpgw_remote_server_addr, UDPGW_RECONNECT_TIME, options.udpgw_num_connections, &ss, NULL, udpgw_client_handler_received
         )) {
             BLog(BLOG_ERROR, "SocksUdpGwClient_Init failed");
-            goto fail4a;
+            goto fail4b;
+        }
+        
+        #ifdef BADVPN_UDPGW_DGRAM
+        // send UDP in datagrams to udpgw where they get through
+        if (options.udpgw_dgram_server_ip) {
+            SocksUdpGwClient_EnableDatagram(&udpgw_client, udpgw_dgram_server_ip, options.udpgw_dgram_fec);
+        }
+        #endif
+        
+        // init DNS cache
+        if (options.dns_cache_size > 0) {
+            if (!DnsCache_Init(&dns_cache, options.dns_cache_size, udp_mtu, DNS_CACHE_MAX_TTL, DNS_CACHE_PENDING_TIMEOUT, NULL, dns_cache_handler_send)) {
+                BLog(BLOG_ERROR, "DnsCache_Init failed");
+                SocksUdpGwClient_Free(&udpgw_client);
+                goto fail4b;
+            }
+            have_dns_cache = 1;
+        }
+    }
+    
+    if (options.tcpgw_remote_server_addr) {
+        // init tcpgw client
+        if (!SocksTcpGwClient_Init(&tcpgw_client, options.tcpgw_window, socks_server_addr, socks_auth_info, socks_num_auth_info,
+                                   tcpgw_remote_server_addr, TCPGW_RECONNECT_TIME, options.tcpgw_num_connections, &ss
+        )) {
+            BLog(BLOG_ERROR, "SocksTcpGwClient_Init failed");
+            goto fail5a;
         }
     }
     
+    // init clients memory
+    if (!BSlab_Init(&clients_slab, sizeof(struct tcp_client), CLIENTS_SLAB_CHUNK)) {
+        BLog(BLOG_ERROR, "BSlab_Init failed");
+        goto fail5b;
+    }
+    
+    // init client buffers memory
+    if (!init_client_bufs()) {
+        BLog(BLOG_ERROR, "init_client_bufs failed");
+        BSlab_Free(&clients_slab);
+        goto fail5b;
+    }
+    
     // init lwip init job
     BPending_Init(&lwip_init_job, BReactor_PendingGroup(&ss), lwip_init_job_hadler, NULL);
     BPending_Set(&lwip_init_job);
@@ -386,9 +805,8 @@ int main (int argc, char **argv)
     }
     
     // init TCP timer
-    // it won't trigger before lwip is initialized, becuase the lwip init is a job
+    // it is started by lwIP when the first pcb needs it
     BTimer_Init(&tcp_timer, TCP_TMR_INTERVAL, tcp_timer_handler, NULL);
-    BReactor_SetTimer(&ss, &tcp_timer);
     
     // set no netif
     have_netif = 0;
@@ -403,16 +821,65 @@ int main (int argc, char **argv)
     // init number of clients
     num_clients = 0;
     
+    // init lingering clients list
+    LinkedList1_Init(&lingering_clients);
+    
+    // init closing clients list
+    LinkedList1_Init(&closing_clients);
+    
+    // init client timer
+    // it is started when the first client is accepted
+    BTimer_Init(&client_timer, CLIENT_TIMER_INTERVAL, client_timer_handler, NULL);
+    client_tick = 0;
+    
+    // init counters
+    memset(&stats, 0, sizeof(stats));
+    
+    // init statistics server
+    if (have_stats_server) {
+        #ifdef BADVPN_LINUX
+        // every worker has its own statistics, reachable at its own address
+        if (options.workers > 1) {
+            if (stats_listen_from.type == BLISCON_FROM_ADDR) {
+                BAddr *addr = &stats_listen_from.u.from_addr.addr;
+                BAddr_SetPort(addr, hton16(ntoh16(BAddr_GetPort(addr)) + worker_index));
+            } else {
+                snprintf(stats_worker_unix, sizeof(stats_worker_unix), "%s.%d", options.stats_listen_unix, worker_index);
+                stats_listen_from = BLisCon_from_unix(stats_worker_unix);
+            }
+        }
+        #endif
+        if (!StatsServer_Init(&stats_server, stats_listen_from, &ss, NULL, stats_handler_report)) {
+            BLog(BLOG_ERROR, "StatsServer_Init failed");
+            goto fail6;
+        }
+        
+        // record hot-path metrics for the reports
+        BMetrics_Enable();
+    }
+    
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
     
+    // free statistics server
+    if (have_stats_server) {
+        StatsServer_Free(&stats_server);
+    }
+fail6:
     // free clients
-    LinkedList1Node *node;
     while (node = LinkedList1_GetFirst(&tcp_clients)) {
         struct tcp_client *client = UPPER_OBJECT(node, struct tcp_client, list_node);
         client_murder(client);
     }
+    while (node = LinkedList1_GetFirst(&closing_clients)) {
+        struct tcp_client *client = UPPER_OBJECT(node, struct tcp_client, list_node);
+        client_murder(client);
+    }
+    BReactor_RemoveTimer(&ss, &client_timer);
+    
+    // free lingering clients; lwip is no longer running
+    free_lingering_clients(1);
     
     // free listener
     if (listener_ip6) {
@@ -431,18 +898,43 @@ int main (int argc, char **argv)
     BFree(device_write_buf);
 fail5:
     BPending_Free(&lwip_init_job);
-    if (options.udpgw_remote_server_addr) {
+    free_client_bufs();
+    BSlab_Free(&clients_slab);
+fail5b:
+    if (options.tcpgw_remote_server_addr) {
+        SocksTcpGwClient_Free(&tcpgw_client);
+    }
+fail5a:
+    if (have_dns_cache) {
+        DnsCache_Free(&dns_cache);
+    }
+    if (options.socks5_udp) {
+        SocksUdpClient_Free(&socks_udp_client);
+    }
+    else if (options.udpgw_remote_server_addr) {
         SocksUdpGwClient_Free(&udpgw_client);
     }
+fail4b:
+    if (options.num_direct_rules > 0) {
+        DirectUdpClient_Free(&direct_udp_client);
+        DirectRules_Free(&direct_rules);
+    }
 fail4a:
-    SinglePacketBuffer_Free(&device_read_buffer);
+    BFree(device_read_cur);
 fail4:
-    PacketPassInterface_Free(&device_read_interface);
+    // buffers still held by lwip will be freed when it releases them
+    while (node = LinkedList1_GetFirst(&device_read_free_list)) {
+        LinkedList1_Remove(&device_read_free_list, node);
+        BFree(UPPER_OBJECT(node, struct device_read_pbuf, free_list_node));
+    }
     BTap_Free(&device);
+fail3a:
+    SocksUpstreams_Free(&socks_upstreams);
 fail3:
     BSignal_Finish();
 fail2:
     BReactor_Free(&ss);
+    BMetrics_Free();
 fail1:
     BFree(password_file_contents);
     BLog(BLOG_NOTICE, "exiting");
@@ -473,19 +965,28 @@ void print_help (const char *name)
         "    %s\n"
         "        [--help]\n"
         "        [--version]\n"
+        #ifdef BADVPN_USE_WINAPI
         "        [--logger <"LOGGERS_STRING">]\n"
-        #ifndef BADVPN_USE_WINAPI
+        #else
+        "        [--logger <"LOGGERS_STRING"/trace>]\n"
         "        (logger=syslog?\n"
         "            [--syslog-facility <string>]\n"
         "            [--syslog-ident <string>]\n"
         "        )\n"
+        "        (logger=trace?\n"
+        "            --trace-file <file>\n"
+        "            [--trace-size <bytes>]\n"
+        "        )\n"
+        "        [--logger-async]\n"
         #endif
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
         "        [--tundev <name>]\n"
         "        --netif-ipaddr <ipaddr>\n"
         "        --netif-netmask <ipnetmask>\n"
-        "        --socks-server-addr <addr>\n"
+        "        --socks-server-addr <addr>[,<weight>] ...\n"
+        "        [--socks-balance <least-conn/source-hash>]\n"
+        "        [--socks-check-interval <seconds>]\n"
         "        [--netif-ip6addr <addr>]\n"
         "        [--username <username>]\n"
         "        [--password <password>]\n"
@@ -494,12 +995,166 @@ void print_help (const char *name)
         "        [--udpgw-remote-server-addr <addr>]\n"
         "        [--udpgw-max-connections <number>]\n"
         "        [--udpgw-connection-buffer-size <number>]\n"
+        "        [--udpgw-recv-buffer-size <number>]\n"
+        "        [--udpgw-connections <number>]\n"
         "        [--udpgw-transparent-dns]\n"
+        #ifdef BADVPN_UDPGW_DGRAM
+        "        [--udpgw-dgram-server-ip <ip>]\n"
+        "        [--udpgw-dgram-fec <group_size>]\n"
+        #endif
+        "        [--dns-cache-size <number>]\n"
+        "        [--socks5-udp]\n"
+        "        [--socks5-pipelining]\n"
+        "        [--socks-fastopen]\n"
+        "        [--tcpgw-remote-server-addr <addr>]\n"
+        "        [--tcpgw-connections <number>]\n"
+        "        [--tcpgw-window <bytes>]\n"
+        "        [--direct <[!]addr/prefix[@port[-port]]>] ...\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--direct-socket-options <options>]\n"
+        #endif
+        "        [--reactor-max-events <number>]\n"
+        "        [--reactor-job-budget <number>]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--reactor-edge-triggered]\n"
+        #endif
+        #ifdef BADVPN_USE_IO_URING
+        "        [--io-uring-entries <number>]\n"
+        #endif
+        #ifdef BADVPN_LINUX
+        "        [--tun-offload]\n"
+        "        [--workers <number>]\n"
+        "        [--cpu-affinity <cpu-list>]\n"
+        "        [--worker-cpus <cpu-list>]\n"
+        "        [--buffer-arena <megabytes>]\n"
+        #endif
+        "        [--tcp-mss <bytes>]\n"
+        "        [--tcp-wnd <bytes>]\n"
+        "        [--tcp-snd-buf <bytes>]\n"
+        "        [--max-tcp-connections <number>]\n"
+        "        [--tcp-idle-timeout <seconds>]\n"
+        "        [--tcp-half-close-timeout <seconds>]\n"
+        "        [--max-tcp-buffer-memory <bytes>]\n"
+        "        [--no-checksum-check]\n"
+        "        [--socks-buf <bytes>]\n"
+        "        [--socks-socket-options <options>]\n"
+        "        [--stats-listen-addr <addr>]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--stats-listen-unix <path>]\n"
+        #endif
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
 }
 
+#ifdef BADVPN_LINUX
+
+void kill_workers (void)
+{
+    for (int i = 0; i < options.workers; i++) {
+        if (worker_pids[i] > 0) {
+            kill(worker_pids[i], SIGTERM);
+        }
+    }
+}
+
+int run_workers (void)
+{
+    ASSERT(options.workers > 1)
+    ASSERT(options.workers <= MAX_WORKERS)
+    
+    // returns -1 in a worker, which should continue starting up,
+    // and 1 (success) or 0 (failure) in the supervisor once all workers have exited
+    
+    // block the signals we wait for; workers get the original mask back
+    sigset_t sigs;
+    sigset_t old_sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &sigs, &old_sigs) < 0) {
+        BLog(BLOG_ERROR, "sigprocmask failed");
+        return 0;
+    }
+    
+    int ok = 1;
+    int terminating = 0;
+    int num_running = 0;
+    
+    for (int i = 0; i < options.workers; i++) {
+        worker_pids[i] = -1;
+    }
+    
+    // don't let workers inherit buffered output
+    fflush(stdout);
+    fflush(stderr);
+    
+    for (int i = 0; i < options.workers; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            BLog(BLOG_ERROR, "fork failed");
+            ok = 0;
+            terminating = 1;
+            kill_workers();
+            break;
+        }
+        if (pid == 0) {
+            sigprocmask(SIG_SETMASK, &old_sigs, NULL);
+            worker_index = i;
+            return -1;
+        }
+        worker_pids[i] = pid;
+        num_running++;
+    }
+    
+    while (num_running > 0) {
+        int sig = sigwaitinfo(&sigs, NULL);
+        if (sig < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            BLog(BLOG_ERROR, "sigwaitinfo failed");
+            ok = 0;
+            kill_workers();
+            break;
+        }
+        
+        if (sig != SIGCHLD) {
+            if (!terminating) {
+                BLog(BLOG_NOTICE, "termination requested");
+                terminating = 1;
+                kill_workers();
+            }
+            continue;
+        }
+        
+        // reap exited workers; if one exits on its own, stop the others
+        pid_t pid;
+        while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+            for (int i = 0; i < options.workers; i++) {
+                if (worker_pids[i] == pid) {
+                    worker_pids[i] = -1;
+                    num_running--;
+                    if (!terminating) {
+                        BLog(BLOG_ERROR, "worker %d exited", i);
+                        ok = 0;
+                        terminating = 1;
+                        kill_workers();
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    
+    sigprocmask(SIG_SETMASK, &old_sigs, NULL);
+    
+    return ok;
+}
+
+#endif
+
 void print_version (void)
 {
     printf(GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION"\n"GLOBAL_COPYRIGHT_NOTICE"\n");
@@ -517,6 +1172,9 @@ int parse_arguments (int argc, char *argv[])
     #ifndef BADVPN_USE_WINAPI
     options.logger_syslog_facility = "daemon";
     options.logger_syslog_ident = argv[0];
+    options.logger_async = 0;
+    options.logger_trace_file = NULL;
+    options.logger_trace_size = BLOG_TRACE_DEFAULT_RING_SIZE;
     #endif
     options.loglevel = -1;
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
@@ -526,7 +1184,9 @@ int parse_arguments (int argc, char *argv[])
     options.netif_ipaddr = NULL;
     options.netif_netmask = NULL;
     options.netif_ip6addr = NULL;
-    options.socks_server_addr = NULL;
+    options.num_socks_servers = 0;
+    options.socks_balance = SOCKS_UPSTREAMS_POLICY_LEAST_CONN;
+    options.socks_check_interval = DEFAULT_SOCKS_CHECK_INTERVAL;
     options.username = NULL;
     options.password = NULL;
     options.password_file = NULL;
@@ -534,7 +1194,53 @@ int parse_arguments (int argc, char *argv[])
     options.udpgw_remote_server_addr = NULL;
     options.udpgw_max_connections = DEFAULT_UDPGW_MAX_CONNECTIONS;
     options.udpgw_connection_buffer_size = DEFAULT_UDPGW_CONNECTION_BUFFER_SIZE;
+    options.udpgw_recv_buffer_size = DEFAULT_UDPGW_RECV_BUFFER_SIZE;
+    options.udpgw_num_connections = DEFAULT_UDPGW_NUM_CONNECTIONS;
     options.udpgw_transparent_dns = 0;
+    #ifdef BADVPN_UDPGW_DGRAM
+    options.udpgw_dgram_server_ip = NULL;
+    options.udpgw_dgram_fec = 0;
+    #endif
+    options.dns_cache_size = 0;
+    options.socks5_udp = 0;
+    options.socks5_pipelining = 0;
+    options.socks_fastopen = 0;
+    options.tcpgw_remote_server_addr = NULL;
+    options.tcpgw_num_connections = DEFAULT_TCPGW_NUM_CONNECTIONS;
+    options.tcpgw_window = DEFAULT_TCPGW_WINDOW;
+    options.num_direct_rules = 0;
+    #ifndef BADVPN_USE_WINAPI
+    BConnection_options_Init(&options.direct_socket_options);
+    #endif
+    options.reactor_max_events = 0;
+    options.reactor_job_budget = 0;
+    #ifndef BADVPN_USE_WINAPI
+    options.reactor_edge_triggered = 0;
+    #endif
+    #ifdef BADVPN_USE_IO_URING
+    options.io_uring_entries = 0;
+    #endif
+    #ifdef BADVPN_LINUX
+    options.tun_offload = 0;
+    options.workers = 1;
+    BCpuSet_Init(&options.cpu_affinity);
+    BCpuSet_Init(&options.worker_cpus);
+    options.buffer_arena = 0;
+    #endif
+    options.tcp_mss = DEFAULT_TCP_MSS;
+    options.tcp_wnd = DEFAULT_TCP_WND;
+    options.tcp_snd_buf = DEFAULT_TCP_SND_BUF;
+    options.max_tcp_connections = 0;
+    options.tcp_idle_timeout = 0;
+    options.tcp_half_close_timeout = DEFAULT_TCP_HALF_CLOSE_TIMEOUT;
+    options.max_tcp_buffer_memory = 0;
+    options.no_checksum_check = 0;
+    options.socks_buf_size = DEFAULT_CLIENT_SOCKS_RECV_BUF_SIZE;
+    BConnection_options_Init(&options.socks_socket_options);
+    options.stats_listen_addr = NULL;
+    #ifndef BADVPN_USE_WINAPI
+    options.stats_listen_unix = NULL;
+    #endif
     
     int i;
     for (i = 1; i < argc; i++) {
@@ -558,6 +1264,9 @@ int parse_arguments (int argc, char *argv[])
             else if (!strcmp(arg2, "syslog")) {
                 options.logger = LOGGER_SYSLOG;
             }
+            else if (!strcmp(arg2, "trace")) {
+                options.logger = LOGGER_TRACE;
+            }
             #endif
             else {
                 fprintf(stderr, "%s: wrong argument\n", arg);
@@ -582,6 +1291,28 @@ int parse_arguments (int argc, char *argv[])
             options.logger_syslog_ident = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--logger-async")) {
+            options.logger_async = 1;
+        }
+        else if (!strcmp(arg, "--trace-file")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.logger_trace_file = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--trace-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.logger_trace_size = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         #endif
         else if (!strcmp(arg, "--loglevel")) {
             if (1 >= argc - i) {
@@ -649,7 +1380,40 @@ int parse_arguments (int argc, char *argv[])
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return 0;
             }
-            options.socks_server_addr = argv[i + 1];
+            if (options.num_socks_servers == MAX_SOCKS_SERVERS) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            options.socks_server_addrs[options.num_socks_servers++] = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--socks-balance")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            char *arg2 = argv[i + 1];
+            if (!strcmp(arg2, "least-conn")) {
+                options.socks_balance = SOCKS_UPSTREAMS_POLICY_LEAST_CONN;
+            }
+            else if (!strcmp(arg2, "source-hash")) {
+                options.socks_balance = SOCKS_UPSTREAMS_POLICY_SOURCE_HASH;
+            }
+            else {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--socks-check-interval")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.socks_check_interval = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
             i++;
         }
         else if (!strcmp(arg, "--username")) {
@@ -709,19 +1473,355 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--udpgw-recv-buffer-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udpgw_recv_buffer_size = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--udpgw-connections")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udpgw_num_connections = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--udpgw-transparent-dns")) {
             options.udpgw_transparent_dns = 1;
         }
-        else {
-            fprintf(stderr, "unknown option: %s\n", arg);
-            return 0;
+        #ifdef BADVPN_UDPGW_DGRAM
+        else if (!strcmp(arg, "--udpgw-dgram-server-ip")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.udpgw_dgram_server_ip = argv[i + 1];
+            i++;
         }
-    }
-    
-    if (options.help || options.version) {
+        else if (!strcmp(arg, "--udpgw-dgram-fec")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udpgw_dgram_fec = atoi(argv[i + 1])) < 0 || options.udpgw_dgram_fec > FECPROTO_MAX_GROUP_SIZE) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--dns-cache-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.dns_cache_size = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--socks5-udp")) {
+            options.socks5_udp = 1;
+        }
+        else if (!strcmp(arg, "--socks5-pipelining")) {
+            options.socks5_pipelining = 1;
+        }
+        else if (!strcmp(arg, "--socks-fastopen")) {
+            options.socks_fastopen = 1;
+        }
+        else if (!strcmp(arg, "--tcpgw-remote-server-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.tcpgw_remote_server_addr = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--tcpgw-connections")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcpgw_num_connections = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcpgw-window")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcpgw_window = atoi(argv[i + 1])) < TCPGW_INITIAL_WINDOW) {
+                fprintf(stderr, "%s: must be at least %d\n", arg, TCPGW_INITIAL_WINDOW);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--reactor-max-events")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.reactor_max_events = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--reactor-job-budget")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.reactor_job_budget = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--reactor-edge-triggered")) {
+            options.reactor_edge_triggered = 1;
+        }
+        #endif
+        #ifdef BADVPN_USE_IO_URING
+        else if (!strcmp(arg, "--io-uring-entries")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.io_uring_entries = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        #ifdef BADVPN_LINUX
+        else if (!strcmp(arg, "--tun-offload")) {
+            options.tun_offload = 1;
+        }
+        else if (!strcmp(arg, "--workers")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.workers = atoi(argv[i + 1])) <= 0 || options.workers > MAX_WORKERS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--cpu-affinity")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BCpuSet_InitParse(&options.cpu_affinity, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--worker-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BCpuSet_InitParse(&options.worker_cpus, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--buffer-arena")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.buffer_arena = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--tcp-mss")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_mss = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-wnd")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_wnd = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-snd-buf")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_snd_buf = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--max-tcp-connections")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.max_tcp_connections = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-idle-timeout")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_idle_timeout = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-half-close-timeout")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_half_close_timeout = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--max-tcp-buffer-memory")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            long long mem = atoll(argv[i + 1]);
+            if (mem <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            options.max_tcp_buffer_memory = mem;
+            i++;
+        }
+        else if (!strcmp(arg, "--no-checksum-check")) {
+            options.no_checksum_check = 1;
+        }
+        else if (!strcmp(arg, "--socks-buf")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.socks_buf_size = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--direct")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (options.num_direct_rules == MAX_DIRECT_RULES) {
+                fprintf(stderr, "%s: too many\n", arg);
+                return 0;
+            }
+            options.direct_rules[options.num_direct_rules++] = argv[i + 1];
+            i++;
+        }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--direct-socket-options")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BConnection_options_Parse(&options.direct_socket_options, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--socks-socket-options")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BConnection_options_Parse(&options.socks_socket_options, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--stats-listen-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.stats_listen_addr = argv[i + 1];
+            i++;
+        }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--stats-listen-unix")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.stats_listen_unix = argv[i + 1];
+            i++;
+        }
+        #endif
+        else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            return 0;
+        }
+    }
+    
+    if (options.help || options.version) {
         return 1;
     }
     
+    #ifndef BADVPN_USE_WINAPI
+    if (options.logger == LOGGER_TRACE && !options.logger_trace_file) {
+        fprintf(stderr, "--trace-file is required with --logger trace\n");
+        return 0;
+    }
+    #endif
+    
     if (!options.netif_ipaddr) {
         fprintf(stderr, "--netif-ipaddr is required\n");
         return 0;
@@ -732,7 +1832,7 @@ int parse_arguments (int argc, char *argv[])
         return 0;
     }
     
-    if (!options.socks_server_addr) {
+    if (options.num_socks_servers == 0) {
         fprintf(stderr, "--socks-server-addr is required\n");
         return 0;
     }
@@ -749,9 +1849,93 @@ int parse_arguments (int argc, char *argv[])
         }
     }
     
+    // tcpgw connections are shared, so they can't carry per-client usernames
+    if (options.tcpgw_remote_server_addr && options.append_source_to_username) {
+        fprintf(stderr, "--tcpgw-remote-server-addr cannot be used with --append-source-to-username\n");
+        return 0;
+    }
+    
+    #ifdef BADVPN_UDPGW_DGRAM
+    if (options.udpgw_dgram_server_ip && !options.udpgw_remote_server_addr) {
+        fprintf(stderr, "--udpgw-dgram-server-ip requires --udpgw-remote-server-addr\n");
+        return 0;
+    }
+    if (options.udpgw_dgram_fec > 0 && !options.udpgw_dgram_server_ip) {
+        fprintf(stderr, "--udpgw-dgram-fec requires --udpgw-dgram-server-ip\n");
+        return 0;
+    }
+    #endif
+    
+    // the DNS cache only sees transparent DNS queries
+    if (options.dns_cache_size > 0 && !options.udpgw_transparent_dns) {
+        fprintf(stderr, "--dns-cache-size requires --udpgw-transparent-dns\n");
+        return 0;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    if (options.stats_listen_addr && options.stats_listen_unix) {
+        fprintf(stderr, "--stats-listen-addr and --stats-listen-unix are mutually exclusive\n");
+        return 0;
+    }
+    #endif
+    
+    #ifdef BADVPN_LINUX
+    // all workers must open queues of the same device
+    if (options.workers > 1 && !options.tundev) {
+        fprintf(stderr, "--workers requires --tundev\n");
+        return 0;
+    }
+    #endif
+    
+    // lwip keeps the MSS in 16 bits, and needs room for the headers
+    if (options.tcp_mss < 536 || options.tcp_mss > UINT16_MAX - 40) {
+        fprintf(stderr, "--tcp-mss must be between 536 and %d\n", UINT16_MAX - 40);
+        return 0;
+    }
+    
+    // with window scaling, the window can be up to 0xFFFF << 14
+    if (options.tcp_wnd < options.tcp_mss || options.tcp_wnd > (UINT16_MAX << 14)) {
+        fprintf(stderr, "--tcp-wnd must be between the MSS and %d\n", UINT16_MAX << 14);
+        return 0;
+    }
+    
+    // lwip keeps the send queue length (4 * snd_buf / mss) in 16 bits
+    if (options.tcp_snd_buf < 2 * options.tcp_mss || (uint64_t)4 * options.tcp_snd_buf / options.tcp_mss > UINT16_MAX) {
+        fprintf(stderr, "--tcp-snd-buf must be at least twice the MSS and at most %d times the MSS\n", UINT16_MAX / 4);
+        return 0;
+    }
+    
     return 1;
 }
 
+int parse_socks_server (const char *str, BAddr *out_addr, int *out_weight)
+{
+    MemRef ref = MemRef_MakeCstr(str);
+    
+    // parse weight
+    *out_weight = 1;
+    size_t comma_pos;
+    if (MemRef_FindChar(ref, ',', &comma_pos)) {
+        uintmax_t weight;
+        if (!parse_unsigned_integer(MemRef_SubFrom(ref, comma_pos + 1), &weight) ||
+            weight == 0 || weight > SOCKS_UPSTREAMS_MAX_WEIGHT) {
+            return 0;
+        }
+        *out_weight = weight;
+        ref = MemRef_SubTo(ref, comma_pos);
+    }
+    
+    // resolve address
+    char *addr_str = MemRef_StrDup(ref);
+    if (!addr_str) {
+        return 0;
+    }
+    int res = BAddr_Parse2(out_addr, addr_str, NULL, 0, 0);
+    free(addr_str);
+    
+    return res;
+}
+
 int process_arguments (void)
 {
     ASSERT(!password_file_contents)
@@ -784,11 +1968,14 @@ int process_arguments (void)
         }
     }
     
-    // resolve SOCKS server address
-    if (!BAddr_Parse2(&socks_server_addr, options.socks_server_addr, NULL, 0, 0)) {
-        BLog(BLOG_ERROR, "socks server addr: BAddr_Parse2 failed");
-        return 0;
+    // resolve SOCKS server addresses and parse weights
+    for (int i = 0; i < options.num_socks_servers; i++) {
+        if (!parse_socks_server(options.socks_server_addrs[i], &socks_server_addrs[i], &socks_server_weights[i])) {
+            BLog(BLOG_ERROR, "socks server addr: incorrect: %s", options.socks_server_addrs[i]);
+            return 0;
+        }
     }
+    socks_server_addr = socks_server_addrs[0];
     
     // add none socks authentication method
     socks_auth_info[0] = BSocksClient_auth_none();
@@ -823,6 +2010,49 @@ int process_arguments (void)
         }
     }
     
+    #ifdef BADVPN_UDPGW_DGRAM
+    // resolve udpgw server IP for datagrams
+    if (options.udpgw_dgram_server_ip) {
+        if (!BIPAddr_Resolve(&udpgw_dgram_server_ip, options.udpgw_dgram_server_ip, 1)) {
+            BLog(BLOG_ERROR, "udpgw dgram server ip: BIPAddr_Resolve failed");
+            return 0;
+        }
+    }
+    #endif
+    
+    // resolve remote tcpgw server address
+    if (options.tcpgw_remote_server_addr) {
+        if (!BAddr_Parse2(&tcpgw_remote_server_addr, options.tcpgw_remote_server_addr, NULL, 0, 0)) {
+            BLog(BLOG_ERROR, "remote tcpgw server addr: BAddr_Parse2 failed");
+            return 0;
+        }
+    }
+    
+    // resolve statistics listen address
+    have_stats_server = 0;
+    if (options.stats_listen_addr) {
+        BAddr addr;
+        if (!BAddr_Parse(&addr, options.stats_listen_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "stats listen addr: BAddr_Parse failed");
+            return 0;
+        }
+        #ifdef BADVPN_LINUX
+        // workers listen on consecutive ports
+        if ((addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6) && ntoh16(BAddr_GetPort(&addr)) > UINT16_MAX - (options.workers - 1)) {
+            BLog(BLOG_ERROR, "stats listen addr: port too large for --workers");
+            return 0;
+        }
+        #endif
+        stats_listen_from = BLisCon_from_addr(addr);
+        have_stats_server = 1;
+    }
+    #ifndef BADVPN_USE_WINAPI
+    if (options.stats_listen_unix) {
+        stats_listen_from = BLisCon_from_unix(options.stats_listen_unix);
+        have_stats_server = 1;
+    }
+    #endif
+    
     return 1;
 }
 
@@ -860,6 +2090,27 @@ void lwip_init_job_hadler (void *unused)
     // NOTE: the device may fail during this, but there's no harm in not checking
     // for that at every step
     
+    // set lwip TCP parameters; use the smallest window scale which lets the
+    // window be advertised
+    lwip_custom_tcp_mss = options.tcp_mss;
+    lwip_custom_tcp_wnd = options.tcp_wnd;
+    lwip_custom_tcp_snd_buf = options.tcp_snd_buf;
+    lwip_custom_tcp_rcv_scale = 0;
+    while ((options.tcp_wnd >> lwip_custom_tcp_rcv_scale) > UINT16_MAX) {
+        lwip_custom_tcp_rcv_scale++;
+    }
+    
+    // limit the number of TCP PCBs, which include connections in
+    // TIME-WAIT and ones not yet accepted
+    lwip_custom_max_tcp_pcb = options.max_tcp_connections;
+    
+    // packets from the device come from the local stack, which may be trusted
+    // to checksum them
+    lwip_custom_tcp_checksum_check = !options.no_checksum_check;
+    
+    // have lwIP start the TCP timer when it registers a pcb
+    lwip_custom_tcp_timer_needed = tcp_timer_needed_handler;
+    
     // init lwip
     lwip_init();
     
@@ -947,18 +2198,44 @@ fail:
     }
 }
 
+void tcp_timer_needed_handler (void)
+{
+    if (BTimer_IsRunning(&tcp_timer)) {
+        return;
+    }
+    
+    BLog(BLOG_DEBUG, "TCP timer start");
+    
+    tcp_timer_next = btime_add(btime_gettime(), TCP_TMR_INTERVAL);
+    BReactor_SetTimerAbsolute(&ss, &tcp_timer, tcp_timer_next);
+}
+
 void tcp_timer_handler (void *unused)
 {
     ASSERT(!quitting)
     
     BLog(BLOG_DEBUG, "TCP timer");
     
-    // schedule next timer
-    // TODO: calculate timeout so we don't drift
-    BReactor_SetTimer(&ss, &tcp_timer);
-    
     tcp_tmr();
-    return;
+    
+    // free clients whose pcbs are done with their buffers
+    free_lingering_clients(0);
+    
+    // stop when no pcb needs the timer and no client waits for its pcb
+    if (!tcp_active_pcbs && !tcp_tw_pcbs && LinkedList1_IsEmpty(&lingering_clients)) {
+        BLog(BLOG_DEBUG, "TCP timer stop");
+        return;
+    }
+    
+    // schedule the next tick relative to the previous deadline so we don't
+    // drift; if we fell behind by more than an interval, skip the lost ticks
+    // rather than catching up in a burst
+    btime_t now = btime_gettime();
+    tcp_timer_next = btime_add(tcp_timer_next, TCP_TMR_INTERVAL);
+    if (tcp_timer_next <= now) {
+        tcp_timer_next = btime_add(now, TCP_TMR_INTERVAL);
+    }
+    BReactor_SetTimerAbsolute(&ss, &tcp_timer, tcp_timer_next);
 }
 
 void device_error_handler (void *unused)
@@ -971,48 +2248,93 @@ void device_error_handler (void *unused)
     return;
 }
 
-void device_read_handler_send (void *unused, uint8_t *data, int data_len)
+struct device_read_pbuf * device_read_pbuf_get (void)
+{
+    LinkedList1Node *node = LinkedList1_GetFirst(&device_read_free_list);
+    if (node) {
+        ASSERT(device_read_num_free > 0)
+        LinkedList1_Remove(&device_read_free_list, node);
+        device_read_num_free--;
+        return UPPER_OBJECT(node, struct device_read_pbuf, free_list_node);
+    }
+    
+    // pool is exhausted, lwip is holding on to the buffers
+    return (struct device_read_pbuf *)BAllocSize(bsize_add(bsize_fromsize(sizeof(struct device_read_pbuf)), bsize_fromint(DEVICE_READ_HEADROOM + device_read_mtu)));
+}
+
+void device_read_pbuf_free_func (struct pbuf *p)
+{
+    struct device_read_pbuf *buf = UPPER_OBJECT((struct pbuf_custom *)p, struct device_read_pbuf, p);
+    
+    // after we started tearing down, the pool may no longer exist
+    if (quitting || device_read_num_free >= DEVICE_READ_POOL_SIZE) {
+        BFree(buf);
+        return;
+    }
+    
+    LinkedList1_Prepend(&device_read_free_list, &buf->free_list_node);
+    device_read_num_free++;
+}
+
+void device_read_handler_done (void *unused, int data_len)
 {
     ASSERT(!quitting)
     ASSERT(data_len >= 0)
+    ASSERT(data_len <= device_read_mtu)
     
     BLog(BLOG_DEBUG, "device: received packet");
     
-    // accept packet
-    PacketPassInterface_Done(&device_read_interface);
+    stats.device_packets_in++;
+    stats.device_bytes_in += data_len;
+    
+    struct device_read_pbuf *buf = device_read_cur;
     
     // process UDP directly
-    if (process_device_udp_packet(data, data_len)) {
-        return;
+    if (process_device_udp_packet(buf->data + DEVICE_READ_HEADROOM, data_len)) {
+        goto out;
+    }
+    
+    // drop packets which lwip would drop anyway
+    if (prefilter_device_packet(buf->data + DEVICE_READ_HEADROOM, data_len)) {
+        goto out;
     }
     
-    // obtain pbuf
-    if (data_len > UINT16_MAX) {
+    // wrap buffer into pbuf
+    if (data_len > UINT16_MAX - DEVICE_READ_HEADROOM) {
         BLog(BLOG_WARNING, "device read: packet too large");
-        return;
+        goto out;
     }
-    struct pbuf *p = pbuf_alloc(PBUF_RAW, data_len, PBUF_POOL);
-    if (!p) {
-        BLog(BLOG_WARNING, "device read: pbuf_alloc failed");
-        return;
+    
+    // get a buffer for the next packet before handing this one to lwip
+    struct device_read_pbuf *next = device_read_pbuf_get();
+    if (!next) {
+        BLog(BLOG_WARNING, "device read: buffer allocation failed");
+        stats.device_read_nobuf++;
+        goto out;
     }
     
-    // write packet to pbuf
-    ASSERT_FORCE(pbuf_take(p, data, data_len) == ERR_OK)
+    buf->p.custom_free_function = device_read_pbuf_free_func;
+    struct pbuf *p = pbuf_alloced_custom(PBUF_LINK, data_len, PBUF_RAM, &buf->p, buf->data, DEVICE_READ_HEADROOM + data_len);
+    ASSERT_FORCE(p)
+    device_read_cur = next;
     
     // pass pbuf to input
     if (the_netif.input(p, &the_netif) != ERR_OK) {
         BLog(BLOG_WARNING, "device read: input failed");
         pbuf_free(p);
     }
+    
+out:
+    // receive next packet
+    PacketRecvInterface_Receiver_Recv(BTap_GetOutput(&device), device_read_cur->data + DEVICE_READ_HEADROOM);
 }
 
 int process_device_udp_packet (uint8_t *data, int data_len)
 {
     ASSERT(data_len >= 0)
     
-    // do nothing if we don't have udpgw
-    if (!options.udpgw_remote_server_addr) {
+    // do nothing if we have no way to forward UDP
+    if (!options.socks5_udp && !options.udpgw_remote_server_addr && options.num_direct_rules == 0) {
         goto fail;
     }
     
@@ -1045,11 +2367,13 @@ int process_device_udp_packet (uint8_t *data, int data_len)
             }
             
             // verify UDP checksum
-            uint16_t checksum_in_packet = udp_header.checksum;
-            udp_header.checksum = 0;
-            uint16_t checksum_computed = udp_checksum(&udp_header, data, data_len, ipv4_header.source_address, ipv4_header.destination_address);
-            if (checksum_in_packet != checksum_computed) {
-                goto fail;
+            if (!options.no_checksum_check) {
+                uint16_t checksum_in_packet = udp_header.checksum;
+                udp_header.checksum = 0;
+                uint16_t checksum_computed = udp_checksum(&udp_header, data, data_len, ipv4_header.source_address, ipv4_header.destination_address);
+                if (checksum_in_packet != checksum_computed) {
+                    goto fail;
+                }
             }
             
             BLog(BLOG_INFO, "UDP: from device %d bytes", data_len);
@@ -1089,11 +2413,13 @@ int process_device_udp_packet (uint8_t *data, int data_len)
             }
             
             // verify UDP checksum
-            uint16_t checksum_in_packet = udp_header.checksum;
-            udp_header.checksum = 0;
-            uint16_t checksum_computed = udp_ip6_checksum(&udp_header, data, data_len, ipv6_header.source_address, ipv6_header.destination_address);
-            if (checksum_in_packet != checksum_computed) {
-                goto fail;
+            if (!options.no_checksum_check) {
+                uint16_t checksum_in_packet = udp_header.checksum;
+                udp_header.checksum = 0;
+                uint16_t checksum_computed = udp_ip6_checksum(&udp_header, data, data_len, ipv6_header.source_address, ipv6_header.destination_address);
+                if (checksum_in_packet != checksum_computed) {
+                    goto fail;
+                }
             }
             
             BLog(BLOG_INFO, "UDP/IPv6: from device %d bytes", data_len);
@@ -1113,12 +2439,32 @@ int process_device_udp_packet (uint8_t *data, int data_len)
     
     // check payload length
     if (data_len > udp_mtu) {
-        BLog(BLOG_ERROR, "packet is too large, cannot send to udpgw");
+        BLog(BLOG_ERROR, "packet is too large, cannot forward");
         goto fail;
     }
     
-    // submit packet to udpgw
-    SocksUdpGwClient_SubmitPacket(&udpgw_client, local_addr, remote_addr, is_dns, data, data_len);
+    // send directly if the rules say so
+    if (!is_dns && options.num_direct_rules > 0 && DirectRules_Match(&direct_rules, remote_addr)) {
+        DirectUdpClient_SubmitPacket(&direct_udp_client, local_addr, remote_addr, data, data_len);
+        return 1;
+    }
+    
+    // the rest needs the proxy
+    if (!options.socks5_udp && !options.udpgw_remote_server_addr) {
+        goto fail;
+    }
+    
+    // answer DNS queries from the cache if possible
+    if (is_dns && have_dns_cache && DnsCache_HandleQuery(&dns_cache, local_addr, remote_addr, 0, data, data_len)) {
+        return 1;
+    }
+    
+    // submit packet through SOCKS5 if enabled, otherwise to udpgw
+    if (options.socks5_udp) {
+        SocksUdpClient_SubmitPacket(&socks_udp_client, local_addr, remote_addr, data, data_len);
+    } else {
+        SocksUdpGwClient_SubmitPacket(&udpgw_client, local_addr, remote_addr, is_dns, data, data_len);
+    }
     
     return 1;
     
@@ -1126,6 +2472,143 @@ fail:
     return 0;
 }
 
+int prefilter_device_packet (uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    
+    // return value 1 means the packet was dropped, 0 means it goes to lwip
+    
+    int is_ipv6;
+    ipX_addr_t local_ip;
+    ipX_addr_t remote_ip;
+    
+    uint8_t ip_version = 0;
+    if (data_len > 0) {
+        ip_version = (data[0] >> 4);
+    }
+    
+    switch (ip_version) {
+        case 4: {
+            // parse IPv4 header
+            struct ipv4_header ipv4_header;
+            if (!ipv4_check(data, data_len, &ipv4_header, &data, &data_len)) {
+                goto malformed;
+            }
+            
+            // lwip takes TCP for any address, the rest only for its own
+            if (ipv4_header.protocol != IPV4_PROTOCOL_TCP) {
+                if (ipv4_header.destination_address != netif_ipaddr.ipv4) {
+                    goto unhandled;
+                }
+                return 0;
+            }
+            
+            // leave fragments to reassembly
+            if ((ntoh16(ipv4_header.flags3_fragmentoffset13) & 0x3FFF)) {
+                return 0;
+            }
+            
+            // TCP to broadcast and multicast addresses is ignored
+            uint32_t dest = ntoh32(ipv4_header.destination_address);
+            if (dest == UINT32_C(0xFFFFFFFF) || (dest >> 28) == 0xE) {
+                goto unhandled;
+            }
+            
+            is_ipv6 = 0;
+            ip4_addr_set_u32(&local_ip.ip4, ipv4_header.destination_address);
+            ip4_addr_set_u32(&remote_ip.ip4, ipv4_header.source_address);
+        } break;
+        
+        case 6: {
+            // ignore if IPv6 support is disabled
+            if (!options.netif_ip6addr) {
+                goto unhandled;
+            }
+            
+            // parse IPv6 header
+            struct ipv6_header ipv6_header;
+            if (!ipv6_check(data, data_len, &ipv6_header, &data, &data_len)) {
+                goto malformed;
+            }
+            
+            // lwip takes TCP for any address, the rest only for its own and
+            // multicast addresses
+            int dest_multicast = (ipv6_header.destination_address[0] == 0xFF);
+            if (ipv6_header.next_header != IPV6_NEXT_TCP) {
+                if (!dest_multicast && memcmp(ipv6_header.destination_address, netif_ip6addr.bytes, 16)) {
+                    goto unhandled;
+                }
+                return 0;
+            }
+            
+            // TCP to multicast addresses is ignored
+            if (dest_multicast) {
+                goto unhandled;
+            }
+            
+            is_ipv6 = 1;
+            memcpy(local_ip.ip6.addr, ipv6_header.destination_address, 16);
+            memcpy(remote_ip.ip6.addr, ipv6_header.source_address, 16);
+        } break;
+        
+        default: {
+            goto unhandled;
+        } break;
+    }
+    
+    // parse TCP header
+    struct tcp_hdr tcphdr;
+    if (data_len < sizeof(tcphdr)) {
+        goto malformed;
+    }
+    memcpy(&tcphdr, data, sizeof(tcphdr));
+    u8_t flags = TCPH_FLAGS(&tcphdr);
+    
+    // a reset is ignored unless it's for an active connection; TIME-WAIT
+    // connections ignore it too
+    if ((flags & TCP_RST)) {
+        if (!tcp_pcb_hash_lookup(&tcp_active_pcbs, &local_ip, ntoh16(tcphdr.dest), &remote_ip, ntoh16(tcphdr.src), is_ipv6)) {
+            stats.tcp_drop_rst++;
+            return 1;
+        }
+        return 0;
+    }
+    
+    // a connection request is ignored while the listen backlog is full; a
+    // retransmitted SYN for a connection in the handshake is dropped as well,
+    // which is harmless since lwip retransmits its SYN-ACK
+    if ((flags & (TCP_SYN | TCP_ACK)) == TCP_SYN) {
+        struct tcp_pcb_listen *lpcb = (struct tcp_pcb_listen *)(is_ipv6 ? listener_ip6 : listener);
+        if (lpcb && lpcb->accepts_pending >= lpcb->backlog) {
+            stats.tcp_drop_syn++;
+            return 1;
+        }
+        
+        // at the connection limit, make room for a new connection by evicting
+        // clients ourselves, since lwip would pick one by segments received
+        // only; TIME-WAIT pcbs are still left to lwip to replace first, and a
+        // closing client may not have a pcb any more
+        if (options.max_tcp_connections > 0 && !tcp_tw_pcbs &&
+            !tcp_pcb_hash_lookup(&tcp_active_pcbs, &local_ip, ntoh16(tcphdr.dest), &remote_ip, ntoh16(tcphdr.src), is_ipv6)) {
+            while (lwip_custom_num_tcp_pcb >= options.max_tcp_connections) {
+                if (!client_evict(NULL)) {
+                    break;
+                }
+            }
+        }
+    }
+    
+    return 0;
+    
+malformed:
+    stats.device_drop_malformed++;
+    return 1;
+    
+unhandled:
+    stats.device_drop_unhandled++;
+    return 1;
+}
+
 err_t netif_init_func (struct netif *netif)
 {
     BLog(BLOG_DEBUG, "netif func init");
@@ -1162,23 +2645,62 @@ err_t common_netif_output (struct netif *netif, struct pbuf *p)
     if (!p->next) {
         if (p->len > BTap_GetMTU(&device)) {
             BLog(BLOG_WARNING, "netif func output: no space left");
+            stats.device_write_nospace++;
             goto out;
         }
         
+        stats.device_packets_out++;
+        stats.device_bytes_out += p->len;
+        
         SYNC_FROMHERE
         BTap_Send(&device, (uint8_t *)p->payload, p->len);
         SYNC_COMMIT
     } else {
+#ifndef BADVPN_USE_WINAPI
+        // gather the chain directly from the pbufs
+        struct iovec iov[BTAP_MAX_IOVCNT];
+        int iovcnt = 0;
+        int vlen = 0;
+        struct pbuf *q = p;
+        do {
+            if (q->len > BTap_GetMTU(&device) - vlen) {
+                BLog(BLOG_WARNING, "netif func output: no space left");
+                stats.device_write_nospace++;
+                goto out;
+            }
+            iov[iovcnt].iov_base = q->payload;
+            iov[iovcnt].iov_len = q->len;
+            iovcnt++;
+            vlen += q->len;
+        } while ((q = q->next) && iovcnt < BTAP_MAX_IOVCNT);
+        
+        if (!q) {
+            stats.device_packets_out++;
+            stats.device_bytes_out += vlen;
+            
+            SYNC_FROMHERE
+            BTap_SendV(&device, iov, iovcnt);
+            SYNC_COMMIT
+            goto out;
+        }
+        
+        // too many chunks, fall back to copying
+#endif
+        
         int len = 0;
         do {
             if (p->len > BTap_GetMTU(&device) - len) {
                 BLog(BLOG_WARNING, "netif func output: no space left");
+                stats.device_write_nospace++;
                 goto out;
             }
             memcpy(device_write_buf + len, p->payload, p->len);
             len += p->len;
         } while (p = p->next);
         
+        stats.device_packets_out++;
+        stats.device_bytes_out += len;
+        
         SYNC_FROMHERE
         BTap_Send(&device, device_write_buf, len);
         SYNC_COMMIT
@@ -1210,6 +2732,67 @@ err_t netif_input_func (struct pbuf *p, struct netif *inp)
     return ERR_OK;
 }
 
+int client_ring_size (int size_class)
+{
+    ASSERT(size_class >= 0)
+    ASSERT(size_class < num_client_ring_classes)
+    
+    // sizes double from the minimum, the largest is --socks-buf
+    if (size_class == num_client_ring_classes - 1) {
+        return options.socks_buf_size;
+    }
+    return (CLIENT_SOCKS_RECV_BUF_MIN_SIZE << size_class);
+}
+
+size_t client_bufs_chunk_objs (int obj_size)
+{
+    return bmax_int(1, CLIENT_BUFS_SLAB_CHUNK_SIZE / obj_size);
+}
+
+int init_client_bufs (void)
+{
+    // count ring sizes
+    num_client_ring_classes = 1;
+    while ((CLIENT_SOCKS_RECV_BUF_MIN_SIZE << (num_client_ring_classes - 1)) < options.socks_buf_size) {
+        if (num_client_ring_classes == CLIENT_BUF_MAX_CLASSES) {
+            BLog(BLOG_ERROR, "too many buffer sizes");
+            return 0;
+        }
+        num_client_ring_classes++;
+    }
+    
+    client_bufs_bytes = 0;
+    
+    if (!BSlab_Init(&client_send_bufs_slab, options.tcp_wnd, client_bufs_chunk_objs(options.tcp_wnd))) {
+        BLog(BLOG_ERROR, "BSlab_Init failed");
+        return 0;
+    }
+    
+    for (int i = 0; i < num_client_ring_classes; i++) {
+        int size = client_ring_size(i);
+        if (!BSlab_Init(&client_ring_slabs[i], size, client_bufs_chunk_objs(size))) {
+            BLog(BLOG_ERROR, "BSlab_Init failed");
+            while (i-- > 0) {
+                BSlab_Free(&client_ring_slabs[i]);
+            }
+            BSlab_Free(&client_send_bufs_slab);
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+void free_client_bufs (void)
+{
+    ASSERT(client_bufs_bytes == 0)
+    
+    for (int i = 0; i < num_client_ring_classes; i++) {
+        BSlab_Free(&client_ring_slabs[i]);
+    }
+    BSlab_Free(&client_send_bufs_slab);
+}
+
 void client_logfunc (struct tcp_client *client)
 {
     char local_addr_s[BADDR_MAX_PRINT_LEN];
@@ -1236,12 +2819,37 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
     struct tcp_pcb *this_listener = (PCB_ISIPV6(newpcb) ? listener_ip6 : listener);
     tcp_accepted(this_listener);
     
+    // make room under the buffer memory limit
+    if (!client_bufs_reserve(client_ring_size(0), NULL)) {
+        BLog(BLOG_ERROR, "listener accept: buffer memory limit reached");
+        stats.tcp_accept_failed++;
+        goto fail0;
+    }
+    
     // allocate client structure
-    struct tcp_client *client = (struct tcp_client *)malloc(sizeof(*client));
+    struct tcp_client *client = (struct tcp_client *)BSlab_Alloc(&clients_slab);
     if (!client) {
-        BLog(BLOG_ERROR, "listener accept: malloc failed");
+        BLog(BLOG_ERROR, "listener accept: BSlab_Alloc failed");
+        stats.tcp_accept_failed++;
+        goto fail0;
+    }
+    
+    // the buffer for data to SOCKS is allocated when there is data, and the
+    // one for data from SOCKS starts at the smallest size
+    client->buf = NULL;
+    struct client_ring *ring = &client->socks_recv_rings[0];
+    if (!(ring->buf = (uint8_t *)BSlab_Alloc(&client_ring_slabs[0]))) {
+        BLog(BLOG_ERROR, "listener accept: BSlab_Alloc failed");
+        stats.tcp_accept_failed++;
+        BSlab_Release(&clients_slab, client);
         goto fail0;
     }
+    client_bufs_bytes += client_ring_size(0);
+    ring->size_class = 0;
+    ring->start = 0;
+    ring->used = 0;
+    ring->tcp_pending = 0;
+    client->socks_recv_num_rings = 1;
     client->socks_username = NULL;
     
     SYNC_DECL
@@ -1265,15 +2873,65 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
         if (!client->socks_username) {
             goto fail1;
         }
-        socks_auth_info[1].password.username = client->socks_username;
-        socks_auth_info[1].password.username_len = strlen(client->socks_username);
+        socks_auth_info[1].password.username = client->socks_username;
+        socks_auth_info[1].password.username_len = strlen(client->socks_username);
+    }
+    
+    // a pipelined handshake needs a single authentication method, so offer
+    // only the password one if there is one
+    const struct BSocksClient_auth_info *auth_info = socks_auth_info;
+    size_t num_auth_info = socks_num_auth_info;
+    if (options.socks5_pipelining) {
+        auth_info = &socks_auth_info[socks_num_auth_info - 1];
+        num_auth_info = 1;
+    }
+    
+    // connect to the destination ourselves if the rules say so
+    client->use_tcpgw = 0;
+    client->use_direct = (options.num_direct_rules > 0 && DirectRules_Match(&direct_rules, addr));
+    
+    // otherwise open a stream over tcpgw if a connection to it is up, or
+    // connect through SOCKS directly
+    TcpMux *mux = NULL;
+    if (!client->use_direct && options.tcpgw_remote_server_addr) {
+        mux = SocksTcpGwClient_GetMux(&tcpgw_client);
+    }
+    
+    if (client->use_direct) {
+        // init connector
+        const struct BConnection_options *direct_opts = NULL;
+        #ifndef BADVPN_USE_WINAPI
+        direct_opts = &options.direct_socket_options;
+        #endif
+        if (!BConnector_InitFrom3(&client->direct_connector, BLisCon_from_addr(addr), 0, direct_opts, &ss,
+                                  client, (BConnector_handler)client_direct_connector_handler)) {
+            BLog(BLOG_ERROR, "listener accept: BConnector_InitFrom3 failed");
+            goto fail1;
+        }
+        client->direct_connected = 0;
+    }
+    else if (mux) {
+        // init tcpgw stream
+        if (!TcpMuxStream_Init(&client->tcpgw_stream, mux, addr, (TcpMuxStream_handler)client_tcpgw_handler, client)) {
+            BLog(BLOG_ERROR, "listener accept: TcpMuxStream_Init failed");
+            goto fail1;
+        }
+        client->use_tcpgw = 1;
     }
-    
-    // init SOCKS
-    if (!BSocksClient_Init(&client->socks_client, socks_server_addr, socks_auth_info, socks_num_auth_info,
-                           addr, (BSocksClient_handler)client_socks_handler, client, &ss)) {
-        BLog(BLOG_ERROR, "listener accept: BSocksClient_Init failed");
-        goto fail1;
+    else {
+        // pick SOCKS server
+        client->socks_server = SocksUpstreams_Acquire(&socks_upstreams, client->remote_addr);
+        
+        // init SOCKS
+        int socks_flags = (options.socks_fastopen ? BSOCKSCLIENT_FLAG_FASTOPEN : 0);
+        if (!BSocksClient_Init2(&client->socks_client, SocksUpstreams_GetAddr(&socks_upstreams, client->socks_server), auth_info, num_auth_info,
+                                addr, socks_flags, (BSocksClient_handler)client_socks_handler, client, &ss)) {
+            BLog(BLOG_ERROR, "listener accept: BSocksClient_Init2 failed");
+            SocksUpstreams_Release(&socks_upstreams, client->socks_server);
+            goto fail1;
+        }
+        BSocksClient_SetSocketOptions(&client->socks_client, &options.socks_socket_options);
+        BSocksClient_SetPipelined(&client->socks_client, options.socks5_pipelining);
     }
     
     // init dead vars
@@ -1282,16 +2940,26 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
     
     // add to linked list
     LinkedList1_Append(&tcp_clients, &client->list_node);
+    client->closing = 0;
+    client->active_tick = client_tick;
+    
+    // start aging clients
+    if (!BTimer_IsRunning(&client_timer)) {
+        BReactor_SetTimer(&ss, &client_timer);
+    }
     
     // increment counter
     ASSERT(num_clients >= 0)
     num_clients++;
+    stats.tcp_clients++;
+    BPROBE2(tun2socks_client_accept, client, num_clients);
     
     // set pcb
     client->pcb = newpcb;
     
     // set client not closed
     client->client_closed = 0;
+    client->linger_pcb = NULL;
     
     // setup handler argument
     tcp_arg(client->pcb, client);
@@ -1309,6 +2977,11 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
     
     client_log(client, BLOG_INFO, "accepted");
     
+    // a tcpgw stream can be used right away
+    if (client->use_tcpgw) {
+        client_socks_handler(client, BSOCKSCLIENT_EVENT_UP);
+    }
+    
     DEAD_ENTER(client->dead_client)
     SYNC_COMMIT
     DEAD_LEAVE2(client->dead_client)
@@ -1321,7 +2994,7 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
 fail1:
     SYNC_BREAK
     free(client->socks_username);
-    free(client);
+    client_release(client);
 fail0:
     return ERR_MEM;
 }
@@ -1341,6 +3014,7 @@ void client_handle_freed_client (struct tcp_client *client)
     // if we have data to be sent to SOCKS and can send it, keep sending
     if (client->buf_used > 0 && !client->socks_closed) {
         client_log(client, BLOG_INFO, "waiting untill buffered data is sent to SOCKS");
+        client_set_closing(client);
     } else {
         if (!client->socks_closed) {
             client_free_socks(client);
@@ -1365,6 +3039,11 @@ void client_free_client (struct tcp_client *client)
         client_log(client, BLOG_ERROR, "tcp_close failed (%d)", err);
         tcp_abort(client->pcb);
     }
+    else if (client->socks_up && client->socks_recv_tcp_pending > 0) {
+        // the pcb keeps sending queued data, which refers to socks_recv_buf;
+        // keep our memory around until it's done
+        client->linger_pcb = client->pcb;
+    }
     
     client_handle_freed_client(client);
 }
@@ -1397,14 +3076,15 @@ void client_free_socks (struct tcp_client *client)
     }
     
     // free SOCKS
-    BSocksClient_Free(&client->socks_client);
+    client_socks_free_connection(client);
     
     // set SOCKS closed
     client->socks_closed = 1;
     
     // if we have data to be sent to the client and we can send it, keep sending
-    if (client->socks_up && (client->socks_recv_buf_used >= 0 || client->socks_recv_tcp_pending > 0) && !client->client_closed) {
+    if (client->socks_up && client->socks_recv_buf_used > 0 && !client->client_closed) {
         client_log(client, BLOG_INFO, "waiting until buffered data is sent to client");
+        client_set_closing(client);
     } else {
         if (!client->client_closed) {
             client_free_client(client);
@@ -1436,7 +3116,7 @@ void client_murder (struct tcp_client *client)
     // free SOCKS
     if (!client->socks_closed) {
         // free SOCKS
-        BSocksClient_Free(&client->socks_client);
+        client_socks_free_connection(client);
         
         // set SOCKS closed
         client->socks_closed = 1;
@@ -1454,16 +3134,171 @@ void client_dealloc (struct tcp_client *client)
     // decrement counter
     ASSERT(num_clients > 0)
     num_clients--;
+    BPROBE2(tun2socks_client_close, client, num_clients);
     
     // remove client entry
-    LinkedList1_Remove(&tcp_clients, &client->list_node);
+    LinkedList1_Remove((client->closing ? &closing_clients : &tcp_clients), &client->list_node);
     
     // kill dead var
     DEAD_KILL(client->dead);
     
     // free memory
     free(client->socks_username);
-    free(client);
+    
+    // if the pcb may still be using our buffer, free memory later
+    if (client->linger_pcb) {
+        LinkedList1_Append(&lingering_clients, &client->list_node);
+        return;
+    }
+    
+    client_release(client);
+}
+
+void client_release (struct tcp_client *client)
+{
+    // release buffers
+    if (client->buf) {
+        BSlab_Release(&client_send_bufs_slab, client->buf);
+        client_bufs_bytes -= TCP_WND;
+    }
+    for (int i = 0; i < client->socks_recv_num_rings; i++) {
+        struct client_ring *r = &client->socks_recv_rings[i];
+        BSlab_Release(&client_ring_slabs[r->size_class], r->buf);
+        client_bufs_bytes -= client_ring_size(r->size_class);
+    }
+    
+    // release client
+    BSlab_Release(&clients_slab, client);
+}
+
+int client_linger_done (struct tcp_client *client)
+{
+    ASSERT(client->linger_pcb)
+    
+    // a pcb which is no longer active has freed its segments; pcb memory may
+    // have been reused by now, in which case we just wait for its queues
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        if (pcb == client->linger_pcb) {
+            return (!pcb->unsent && !pcb->unacked);
+        }
+    }
+    
+    return 1;
+}
+
+void free_lingering_clients (int force)
+{
+    LinkedList1Node *node = LinkedList1_GetFirst(&lingering_clients);
+    while (node) {
+        LinkedList1Node *next = LinkedList1Node_Next(node);
+        struct tcp_client *client = UPPER_OBJECT(node, struct tcp_client, list_node);
+        
+        if (force || client_linger_done(client)) {
+            LinkedList1_Remove(&lingering_clients, node);
+            client_release(client);
+        }
+        
+        node = next;
+    }
+}
+
+void client_touch (struct tcp_client *client)
+{
+    // move to the end of the list once per tick, which keeps it ordered by
+    // the last activity closely enough
+    if (client->active_tick == client_tick) {
+        return;
+    }
+    client->active_tick = client_tick;
+    
+    LinkedList1 *list = (client->closing ? &closing_clients : &tcp_clients);
+    LinkedList1_Remove(list, &client->list_node);
+    LinkedList1_Append(list, &client->list_node);
+}
+
+void client_set_closing (struct tcp_client *client)
+{
+    ASSERT(!client->closing)
+    
+    LinkedList1_Remove(&tcp_clients, &client->list_node);
+    LinkedList1_Append(&closing_clients, &client->list_node);
+    client->closing = 1;
+    client->active_tick = client_tick;
+}
+
+int client_evict (struct tcp_client *except)
+{
+    // closing clients go first, then the one active least recently
+    struct tcp_client *victim = NULL;
+    LinkedList1 *lists[] = {&closing_clients, &tcp_clients};
+    for (int i = 0; i < 2 && !victim; i++) {
+        for (LinkedList1Node *node = LinkedList1_GetFirst(lists[i]); node; node = LinkedList1Node_Next(node)) {
+            struct tcp_client *client = UPPER_OBJECT(node, struct tcp_client, list_node);
+            if (client != except) {
+                victim = client;
+                break;
+            }
+        }
+    }
+    
+    if (!victim) {
+        return 0;
+    }
+    
+    client_log(victim, BLOG_INFO, "evicted");
+    stats.tcp_evictions++;
+    client_murder(victim);
+    
+    return 1;
+}
+
+int client_bufs_reserve (int size, struct tcp_client *except)
+{
+    ASSERT(size > 0)
+    
+    // evict other clients until the buffer fits under the limit
+    while (options.max_tcp_buffer_memory > 0 && client_bufs_bytes + size > options.max_tcp_buffer_memory) {
+        if (!client_evict(except)) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+void client_expire (LinkedList1 *list, int timeout, uint64_t *counter)
+{
+    if (timeout == 0) {
+        return;
+    }
+    
+    LinkedList1Node *node;
+    while (node = LinkedList1_GetFirst(list)) {
+        struct tcp_client *client = UPPER_OBJECT(node, struct tcp_client, list_node);
+        if ((uint32_t)(client_tick - client->active_tick) < (uint32_t)timeout) {
+            break;
+        }
+        
+        client_log(client, BLOG_INFO, "timed out");
+        (*counter)++;
+        client_murder(client);
+    }
+}
+
+void client_timer_handler (void *unused)
+{
+    ASSERT(!quitting)
+    
+    client_tick++;
+    
+    // the timeouts are in seconds, which are ticks
+    client_expire(&tcp_clients, options.tcp_idle_timeout, &stats.tcp_idle_timeouts);
+    client_expire(&closing_clients, options.tcp_half_close_timeout, &stats.tcp_half_close_timeouts);
+    
+    // stop when there are no clients
+    if (num_clients > 0) {
+        BReactor_SetTimer(&ss, &client_timer);
+    }
 }
 
 void client_err_func (void *arg, err_t err)
@@ -1492,8 +3327,21 @@ err_t client_recv_func (void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t e
     
     ASSERT(p->tot_len > 0)
     
+    client_touch(client);
+    
+    // get a buffer if we released it; if there is no memory, lwIP keeps the
+    // data and offers it again later
+    if (!client->buf) {
+        ASSERT(client->buf_used == 0)
+        if (!client_bufs_reserve(TCP_WND, client) || !(client->buf = (uint8_t *)BSlab_Alloc(&client_send_bufs_slab))) {
+            client_log(client, BLOG_ERROR, "no memory for buffer");
+            return ERR_MEM;
+        }
+        client_bufs_bytes += TCP_WND;
+    }
+    
     // check if we have enough buffer
-    if (p->tot_len > sizeof(client->buf) - client->buf_used) {
+    if (p->tot_len > TCP_WND - client->buf_used) {
         client_log(client, BLOG_ERROR, "no buffer for data !?!");
         return ERR_MEM;
     }
@@ -1539,15 +3387,30 @@ void client_socks_handler (struct tcp_client *client, int event)
             
             client_log(client, BLOG_INFO, "SOCKS up");
             
+            // get interfaces
+            if (client->use_tcpgw) {
+                client->socks_send_if = TcpMuxStream_GetSendInterface(&client->tcpgw_stream);
+                client->socks_recv_if = TcpMuxStream_GetRecvInterface(&client->tcpgw_stream);
+            }
+            else if (client->use_direct) {
+                client->socks_send_if = BConnection_SendAsync_GetIf(&client->direct_con);
+                client->socks_recv_if = BConnection_RecvAsync_GetIf(&client->direct_con);
+            }
+            else {
+                client->socks_send_if = BSocksClient_GetSendInterface(&client->socks_client);
+                client->socks_recv_if = BSocksClient_GetRecvInterface(&client->socks_client);
+            }
+            
             // init sending
-            client->socks_send_if = BSocksClient_GetSendInterface(&client->socks_client);
             StreamPassInterface_Sender_Init(client->socks_send_if, (StreamPassInterface_handler_done)client_socks_send_handler_done, client);
             
             // init receiving
-            client->socks_recv_if = BSocksClient_GetRecvInterface(&client->socks_client);
             StreamRecvInterface_Receiver_Init(client->socks_recv_if, (StreamRecvInterface_handler_done)client_socks_recv_handler_done, client);
-            client->socks_recv_buf_used = -1;
+            client->socks_recv_buf_used = 0;
             client->socks_recv_tcp_pending = 0;
+            client->socks_recv_receiving = 0;
+            client->socks_recv_peak = 0;
+            client->socks_recv_shrink = 0;
             if (!client->client_closed) {
                 tcp_sent(client->pcb, client_sent_func);
             }
@@ -1579,6 +3442,88 @@ void client_socks_handler (struct tcp_client *client, int event)
     }
 }
 
+void client_tcpgw_handler (struct tcp_client *client, int event)
+{
+    ASSERT(client->use_tcpgw)
+    
+    // the stream behaves like a SOCKS connection which is already up
+    switch (event) {
+        case TCPMUXSTREAM_EVENT_ERROR: {
+            client_socks_handler(client, BSOCKSCLIENT_EVENT_ERROR);
+        } break;
+        
+        case TCPMUXSTREAM_EVENT_ERROR_CLOSED: {
+            client_socks_handler(client, BSOCKSCLIENT_EVENT_ERROR_CLOSED);
+        } break;
+        
+        default:
+            ASSERT(0);
+    }
+}
+
+void client_direct_connector_handler (struct tcp_client *client, int is_error)
+{
+    ASSERT(client->use_direct)
+    ASSERT(!client->direct_connected)
+    ASSERT(!client->socks_closed)
+    
+    if (is_error) {
+        client_log(client, BLOG_INFO, "direct connection failed");
+        goto fail0;
+    }
+    
+    // init connection
+    if (!BConnection_Init(&client->direct_con, BConnection_source_connector(&client->direct_connector), &ss,
+                          client, (BConnection_handler)client_direct_connection_handler)) {
+        client_log(client, BLOG_ERROR, "BConnection_Init failed");
+        goto fail0;
+    }
+    
+    // init I/O
+    BConnection_SendAsync_Init(&client->direct_con);
+    BConnection_RecvAsync_Init(&client->direct_con);
+    client->direct_connected = 1;
+    
+    // the connection behaves like a SOCKS connection which came up
+    client_socks_handler(client, BSOCKSCLIENT_EVENT_UP);
+    return;
+    
+fail0:
+    client_socks_handler(client, BSOCKSCLIENT_EVENT_ERROR);
+}
+
+void client_direct_connection_handler (struct tcp_client *client, int event)
+{
+    ASSERT(client->use_direct)
+    ASSERT(client->direct_connected)
+    ASSERT(client->socks_up)
+    
+    if (event == BCONNECTION_EVENT_RECVCLOSED) {
+        client_socks_handler(client, BSOCKSCLIENT_EVENT_ERROR_CLOSED);
+    } else {
+        client_socks_handler(client, BSOCKSCLIENT_EVENT_ERROR);
+    }
+}
+
+void client_socks_free_connection (struct tcp_client *client)
+{
+    if (client->use_tcpgw) {
+        TcpMuxStream_Free(&client->tcpgw_stream);
+    }
+    else if (client->use_direct) {
+        if (client->direct_connected) {
+            BConnection_RecvAsync_Free(&client->direct_con);
+            BConnection_SendAsync_Free(&client->direct_con);
+            BConnection_Free(&client->direct_con);
+        }
+        BConnector_Free(&client->direct_connector);
+    }
+    else {
+        BSocksClient_Free(&client->socks_client);
+        SocksUpstreams_Release(&socks_upstreams, client->socks_server);
+    }
+}
+
 void client_send_to_socks (struct tcp_client *client)
 {
     ASSERT(!client->socks_closed)
@@ -1597,20 +3542,34 @@ void client_socks_send_handler_done (struct tcp_client *client, int data_len)
     ASSERT(data_len > 0)
     ASSERT(data_len <= client->buf_used)
     
+    client_touch(client);
+    
     // remove sent data from buffer
     memmove(client->buf, client->buf + data_len, client->buf_used - data_len);
     client->buf_used -= data_len;
     
     if (!client->client_closed) {
-        // confirm sent data
-        tcp_recved(client->pcb, data_len);
+        // confirm sent data; tcp_recved takes a 16-bit length
+        int len = data_len;
+        while (len > 0) {
+            u16_t chunk = bmin_int(len, UINT16_MAX);
+            tcp_recved(client->pcb, chunk);
+            len -= chunk;
+        }
     }
     
     if (client->buf_used > 0) {
         // send any further data
         StreamPassInterface_Sender_Send(client->socks_send_if, client->buf, client->buf_used);
+        return;
     }
-    else if (client->client_closed) {
+    
+    // release the buffer until there is more data
+    BSlab_Release(&client_send_bufs_slab, client->buf);
+    client_bufs_bytes -= TCP_WND;
+    client->buf = NULL;
+    
+    if (client->client_closed) {
         // client was closed we've sent everything we had buffered; we're done with it
         client_log(client, BLOG_INFO, "removing after client went down");
         
@@ -1618,66 +3577,141 @@ void client_socks_send_handler_done (struct tcp_client *client, int data_len)
     }
 }
 
+int client_socks_recv_have_space (struct tcp_client *client)
+{
+    struct client_ring *r = &client->socks_recv_rings[client->socks_recv_num_rings - 1];
+    
+    return (r->used < client_ring_size(r->size_class));
+}
+
 void client_socks_recv_initiate (struct tcp_client *client)
 {
     ASSERT(!client->client_closed)
     ASSERT(!client->socks_closed)
     ASSERT(client->socks_up)
-    ASSERT(client->socks_recv_buf_used == -1)
+    ASSERT(!client->socks_recv_receiving)
+    ASSERT(client_socks_recv_have_space(client))
     
-    StreamRecvInterface_Receiver_Recv(client->socks_recv_if, client->socks_recv_buf, sizeof(client->socks_recv_buf));
+    // receive into the contiguous free space after the data in the newest ring
+    struct client_ring *r = &client->socks_recv_rings[client->socks_recv_num_rings - 1];
+    int size = client_ring_size(r->size_class);
+    int pos = (r->start + r->used) % size;
+    int avail = bmin_int(size - r->used, size - pos);
+    
+    StreamRecvInterface_Receiver_Recv(client->socks_recv_if, r->buf + pos, avail);
+    client->socks_recv_receiving = 1;
 }
 
 void client_socks_recv_handler_done (struct tcp_client *client, int data_len)
 {
     ASSERT(data_len > 0)
-    ASSERT(data_len <= sizeof(client->socks_recv_buf))
     ASSERT(!client->socks_closed)
     ASSERT(client->socks_up)
-    ASSERT(client->socks_recv_buf_used == -1)
+    ASSERT(client->socks_recv_receiving)
+    
+    client->socks_recv_receiving = 0;
     
     // if client was closed, stop receiving
     if (client->client_closed) {
         return;
     }
     
-    // set amount of data in buffer
-    client->socks_recv_buf_used = data_len;
-    client->socks_recv_buf_sent = 0;
-    client->socks_recv_waiting = 0;
+    client_touch(client);
+    
+    // add data to the newest ring
+    struct client_ring *r = &client->socks_recv_rings[client->socks_recv_num_rings - 1];
+    ASSERT(data_len <= client_ring_size(r->size_class) - r->used)
+    r->used += data_len;
+    client->socks_recv_buf_used += data_len;
+    if (client->socks_recv_buf_used > client->socks_recv_peak) {
+        client->socks_recv_peak = client->socks_recv_buf_used;
+    }
+    
+    // switch to a larger or smaller buffer if needed
+    client_socks_recv_resize(client);
     
     // send to client
     if (client_socks_recv_send_out(client) < 0) {
         return;
     }
     
-    // continue receiving if needed
-    if (client->socks_recv_buf_used == -1) {
+    // continue receiving if there is space
+    if (client_socks_recv_have_space(client)) {
         client_socks_recv_initiate(client);
     }
 }
 
-int client_socks_recv_send_out (struct tcp_client *client)
+void client_socks_recv_resize (struct tcp_client *client)
 {
-    ASSERT(!client->client_closed)
-    ASSERT(client->socks_up)
-    ASSERT(client->socks_recv_buf_used > 0)
-    ASSERT(client->socks_recv_buf_sent < client->socks_recv_buf_used)
-    ASSERT(!client->socks_recv_waiting)
+    ASSERT(!client->socks_recv_receiving)
     
-    // return value -1 means tcp_abort() was done,
-    // 0 means it wasn't and the client (pcb) is still up
+    // one switch at a time
+    if (client->socks_recv_num_rings > 1) {
+        return;
+    }
+    
+    struct client_ring *r = &client->socks_recv_rings[0];
+    
+    // a buffer which filled up limits the flow, so it grows; one which stayed
+    // mostly empty until it drained last time shrinks
+    int size_class;
+    if (r->used == client_ring_size(r->size_class) && r->size_class < num_client_ring_classes - 1) {
+        size_class = r->size_class + 1;
+    }
+    else if (client->socks_recv_shrink && r->size_class > 0) {
+        size_class = r->size_class - 1;
+    }
+    else {
+        return;
+    }
+    
+    client->socks_recv_shrink = 0;
+    
+    // don't grow beyond the buffer memory limit
+    if (size_class > r->size_class && options.max_tcp_buffer_memory > 0 &&
+        client_bufs_bytes + client_ring_size(size_class) > options.max_tcp_buffer_memory) {
+        return;
+    }
+    
+    // allocate the new ring; without memory, keep using the current one
+    uint8_t *buf = (uint8_t *)BSlab_Alloc(&client_ring_slabs[size_class]);
+    if (!buf) {
+        client_log(client, BLOG_WARNING, "no memory to resize buffer");
+        return;
+    }
+    client_bufs_bytes += client_ring_size(size_class);
+    
+    // new data goes to the new ring; the old one is released once the client
+    // has acknowledged the data in it
+    struct client_ring *nr = &client->socks_recv_rings[1];
+    nr->buf = buf;
+    nr->size_class = size_class;
+    nr->start = 0;
+    nr->used = 0;
+    nr->tcp_pending = 0;
+    client->socks_recv_num_rings = 2;
+}
+
+int client_socks_recv_queue_ring (struct tcp_client *client, struct client_ring *r)
+{
+    // return value -1 means tcp_abort() was done, 0 means not all data in the
+    // ring could be queued, 1 means it all was
     
-    do {
-        int to_write = bmin_int(client->socks_recv_buf_used - client->socks_recv_buf_sent, tcp_sndbuf(client->pcb));
+    int size = client_ring_size(r->size_class);
+    
+    // the data is queued by reference; it stays in the ring until acknowledged
+    while (r->tcp_pending < r->used) {
+        int pos = (r->start + r->tcp_pending) % size;
+        int to_write = bmin_int(r->used - r->tcp_pending, size - pos);
+        to_write = bmin_int(to_write, bmin_int(tcp_sndbuf(client->pcb), UINT16_MAX));
         if (to_write == 0) {
-            break;
+            return 0;
         }
         
-        err_t err = tcp_write(client->pcb, client->socks_recv_buf + client->socks_recv_buf_sent, to_write, TCP_WRITE_FLAG_COPY);
+        err_t err = tcp_write(client->pcb, r->buf + pos, to_write, 0);
         if (err != ERR_OK) {
             if (err == ERR_MEM) {
-                break;
+                return 0;
             }
             
             client_log(client, BLOG_INFO, "tcp_write failed (%d)", (int)err);
@@ -1686,9 +3720,32 @@ int client_socks_recv_send_out (struct tcp_client *client)
             return -1;
         }
         
-        client->socks_recv_buf_sent += to_write;
+        r->tcp_pending += to_write;
         client->socks_recv_tcp_pending += to_write;
-    } while (client->socks_recv_buf_sent < client->socks_recv_buf_used);
+    }
+    
+    return 1;
+}
+
+int client_socks_recv_send_out (struct tcp_client *client)
+{
+    ASSERT(!client->client_closed)
+    ASSERT(client->socks_up)
+    ASSERT(client->socks_recv_tcp_pending < client->socks_recv_buf_used)
+    
+    // return value -1 means tcp_abort() was done,
+    // 0 means it wasn't and the client (pcb) is still up
+    
+    // queue the rings in order
+    for (int i = 0; i < client->socks_recv_num_rings; i++) {
+        int res = client_socks_recv_queue_ring(client, &client->socks_recv_rings[i]);
+        if (res < 0) {
+            return -1;
+        }
+        if (res == 0) {
+            break;
+        }
+    }
     
     // start sending now
     err_t err = tcp_output(client->pcb);
@@ -1699,23 +3756,14 @@ int client_socks_recv_send_out (struct tcp_client *client)
         return -1;
     }
     
-    // more data to queue?
-    if (client->socks_recv_buf_sent < client->socks_recv_buf_used) {
-        if (client->socks_recv_tcp_pending == 0) {
-            client_log(client, BLOG_ERROR, "can't queue data, but all data was confirmed !?!");
-            
-            client_abort_client(client);
-            return -1;
-        }
+    // more data to queue? continue in client_sent_func
+    if (client->socks_recv_tcp_pending < client->socks_recv_buf_used && client->socks_recv_tcp_pending == 0) {
+        client_log(client, BLOG_ERROR, "can't queue data, but all data was confirmed !?!");
         
-        // set waiting, continue in client_sent_func
-        client->socks_recv_waiting = 1;
-        return 0;
+        client_abort_client(client);
+        return -1;
     }
     
-    // everything was queued
-    client->socks_recv_buf_used = -1;
-    
     return 0;
 }
 
@@ -1728,43 +3776,60 @@ err_t client_sent_func (void *arg, struct tcp_pcb *tpcb, u16_t len)
     ASSERT(len > 0)
     ASSERT(len <= client->socks_recv_tcp_pending)
     
-    // decrement pending
+    client_touch(client);
+    
     client->socks_recv_tcp_pending -= len;
+    client->socks_recv_buf_used -= len;
+    
+    // release acknowledged data, from the oldest ring first
+    int left = len;
+    while (left > 0) {
+        struct client_ring *r = &client->socks_recv_rings[0];
+        int amount = bmin_int(left, r->tcp_pending);
+        ASSERT(amount > 0)
+        r->tcp_pending -= amount;
+        r->used -= amount;
+        r->start = (r->start + amount) % client_ring_size(r->size_class);
+        left -= amount;
+        
+        // release an old ring once it's drained
+        if (r->used == 0 && client->socks_recv_num_rings > 1) {
+            BSlab_Release(&client_ring_slabs[r->size_class], r->buf);
+            client_bufs_bytes -= client_ring_size(r->size_class);
+            client->socks_recv_rings[0] = client->socks_recv_rings[1];
+            client->socks_recv_num_rings = 1;
+        }
+    }
+    
+    // when everything was acknowledged, decide whether the ring was too large
+    if (client->socks_recv_buf_used == 0) {
+        struct client_ring *r = &client->socks_recv_rings[client->socks_recv_num_rings - 1];
+        client->socks_recv_shrink = (client->socks_recv_peak <= client_ring_size(r->size_class) / 4);
+        client->socks_recv_peak = 0;
+    }
     
     // continue queuing
-    if (client->socks_recv_buf_used > 0) {
-        ASSERT(client->socks_recv_waiting)
-        ASSERT(client->socks_recv_buf_sent < client->socks_recv_buf_used)
-        
-        // set not waiting
-        client->socks_recv_waiting = 0;
-        
-        // possibly send more data
+    if (client->socks_recv_tcp_pending < client->socks_recv_buf_used) {
         if (client_socks_recv_send_out(client) < 0) {
             return ERR_ABRT;
         }
-        
-        // we just queued some data, so it can't have been confirmed yet
-        ASSERT(client->socks_recv_tcp_pending > 0)
-        
-        // continue receiving if needed
-        if (client->socks_recv_buf_used == -1 && !client->socks_closed) {
-            SYNC_DECL
-            SYNC_FROMHERE
-            client_socks_recv_initiate(client);
-            DEAD_ENTER(client->dead_client)
-            SYNC_COMMIT
-            DEAD_LEAVE2(client->dead_client)
-            if (DEAD_KILLED) {
-                return ERR_ABRT;
-            }
+    }
+    
+    // continue receiving if it was stopped because the ring was full
+    if (!client->socks_closed && !client->socks_recv_receiving && client_socks_recv_have_space(client)) {
+        SYNC_DECL
+        SYNC_FROMHERE
+        client_socks_recv_initiate(client);
+        DEAD_ENTER(client->dead_client)
+        SYNC_COMMIT
+        DEAD_LEAVE2(client->dead_client)
+        if (DEAD_KILLED) {
+            return ERR_ABRT;
         }
-        
-        return ERR_OK;
     }
     
     // have we sent everything after SOCKS was closed?
-    if (client->socks_closed && client->socks_recv_tcp_pending == 0) {
+    if (client->socks_closed && client->socks_recv_buf_used == 0) {
         client_log(client, BLOG_INFO, "removing after SOCKS went down");
         client_free_client(client);
         return ERR_ABRT;
@@ -1775,7 +3840,26 @@ err_t client_sent_func (void *arg, struct tcp_pcb *tpcb, u16_t len)
 
 void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
 {
-    ASSERT(options.udpgw_remote_server_addr)
+    ASSERT(options.socks5_udp || options.udpgw_remote_server_addr)
+    
+    // let the DNS cache see responses to transparent DNS queries
+    if (have_dns_cache && remote_addr.type == BADDR_TYPE_IPV4 &&
+        remote_addr.ipv4.ip == netif_ipaddr.ipv4 && remote_addr.ipv4.port == hton16(53)
+    ) {
+        DnsCache_HandleResponse(&dns_cache, data, data_len);
+    }
+    
+    udp_send_to_device(NULL, local_addr, remote_addr, data, data_len);
+}
+
+void dns_cache_handler_send (void *unused, BAddr local_addr, BAddr remote_addr, uint64_t tag, const uint8_t *data, int data_len)
+{
+    udp_send_to_device(NULL, local_addr, remote_addr, data, data_len);
+}
+
+void udp_send_to_device (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+    ASSERT(options.socks5_udp || options.udpgw_remote_server_addr || options.num_direct_rules > 0)
     ASSERT(local_addr.type == BADDR_TYPE_IPV4 || local_addr.type == BADDR_TYPE_IPV6)
     ASSERT(local_addr.type == remote_addr.type)
     ASSERT(data_len >= 0)
@@ -1784,7 +3868,7 @@ void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote
     
     switch (local_addr.type) {
         case BADDR_TYPE_IPV4: {
-            BLog(BLOG_INFO, "UDP: from udpgw %d bytes", data_len);
+            BLog(BLOG_INFO, "UDP: from forwarder %d bytes", data_len);
             
             if (data_len > UINT16_MAX - (sizeof(struct ipv4_header) + sizeof(struct udp_header)) ||
                 data_len > BTap_GetMTU(&device) - (int)(sizeof(struct ipv4_header) + sizeof(struct udp_header))
@@ -1823,10 +3907,10 @@ void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote
         } break;
         
         case BADDR_TYPE_IPV6: {
-            BLog(BLOG_INFO, "UDP/IPv6: from udpgw %d bytes", data_len);
+            BLog(BLOG_INFO, "UDP/IPv6: from forwarder %d bytes", data_len);
             
             if (!options.netif_ip6addr) {
-                BLog(BLOG_ERROR, "got IPv6 packet from udpgw but IPv6 is disabled");
+                BLog(BLOG_ERROR, "got IPv6 packet from forwarder but IPv6 is disabled");
                 return;
             }
             
@@ -1865,5 +3949,57 @@ void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote
     }
     
     // submit packet
+    stats.device_packets_out++;
+    stats.device_bytes_out += packet_length;
     BTap_Send(&device, device_write_buf, packet_length);
 }
+
+void stats_handler_report (void *unused, StatsServerReport *r)
+{
+    // count lwip PCBs
+    int num_active_pcbs = 0;
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        num_active_pcbs++;
+    }
+    int num_tw_pcbs = 0;
+    for (struct tcp_pcb *pcb = tcp_tw_pcbs; pcb; pcb = pcb->next) {
+        num_tw_pcbs++;
+    }
+    
+    int num_lingering = 0;
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&lingering_clients); node; node = LinkedList1Node_Next(node)) {
+        num_lingering++;
+    }
+    
+    StatsServerReport_Printf(r, "tun2socks_device_packets_in_total %"PRIu64"\n", stats.device_packets_in);
+    StatsServerReport_Printf(r, "tun2socks_device_bytes_in_total %"PRIu64"\n", stats.device_bytes_in);
+    StatsServerReport_Printf(r, "tun2socks_device_packets_out_total %"PRIu64"\n", stats.device_packets_out);
+    StatsServerReport_Printf(r, "tun2socks_device_bytes_out_total %"PRIu64"\n", stats.device_bytes_out);
+    StatsServerReport_Printf(r, "tun2socks_device_read_nobuf_total %"PRIu64"\n", stats.device_read_nobuf);
+    StatsServerReport_Printf(r, "tun2socks_device_write_nospace_total %"PRIu64"\n", stats.device_write_nospace);
+    StatsServerReport_Printf(r, "tun2socks_device_drop_malformed_total %"PRIu64"\n", stats.device_drop_malformed);
+    StatsServerReport_Printf(r, "tun2socks_device_drop_unhandled_total %"PRIu64"\n", stats.device_drop_unhandled);
+    StatsServerReport_Printf(r, "tun2socks_device_read_free_buffers %d\n", device_read_num_free);
+    StatsServerReport_Printf(r, "tun2socks_tcp_clients %d\n", num_clients);
+    StatsServerReport_Printf(r, "tun2socks_tcp_clients_total %"PRIu64"\n", stats.tcp_clients);
+    StatsServerReport_Printf(r, "tun2socks_tcp_clients_lingering %d\n", num_lingering);
+    StatsServerReport_Printf(r, "tun2socks_tcp_client_buffer_bytes %"PRIu64"\n", client_bufs_bytes);
+    StatsServerReport_Printf(r, "tun2socks_tcp_accept_failed_total %"PRIu64"\n", stats.tcp_accept_failed);
+    StatsServerReport_Printf(r, "tun2socks_tcp_drop_rst_total %"PRIu64"\n", stats.tcp_drop_rst);
+    StatsServerReport_Printf(r, "tun2socks_tcp_drop_syn_total %"PRIu64"\n", stats.tcp_drop_syn);
+    StatsServerReport_Printf(r, "tun2socks_tcp_idle_timeouts_total %"PRIu64"\n", stats.tcp_idle_timeouts);
+    StatsServerReport_Printf(r, "tun2socks_tcp_half_close_timeouts_total %"PRIu64"\n", stats.tcp_half_close_timeouts);
+    StatsServerReport_Printf(r, "tun2socks_tcp_evictions_total %"PRIu64"\n", stats.tcp_evictions);
+    StatsServerReport_Printf(r, "tun2socks_tcp_pcbs_active %d\n", num_active_pcbs);
+    StatsServerReport_Printf(r, "tun2socks_tcp_pcbs_time_wait %d\n", num_tw_pcbs);
+    
+    // hot-path metrics
+    BMetrics_Print(stats_print_metric, r);
+}
+
+void stats_print_metric (void *user, const char *line)
+{
+    StatsServerReport *r = (StatsServerReport *)user;
+    
+    StatsServerReport_Printf(r, "%s\n", line);
+}
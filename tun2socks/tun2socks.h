@@ -27,8 +27,45 @@
 // name of the program
 #define PROGRAM_NAME "tun2socks"
 
-// size of temporary buffer for passing data from the SOCKS server to TCP for sending
-#define CLIENT_SOCKS_RECV_BUF_SIZE 8192
+// default maximum size of ring buffer for data from the SOCKS server; data is queued
+// to TCP by reference, so it stays here until the client acknowledges it
+#define DEFAULT_CLIENT_SOCKS_RECV_BUF_SIZE 32768
+
+// initial size of the ring buffer for data from the SOCKS server; it doubles when it
+// fills up, up to the maximum, and halves when it stays mostly empty
+#define CLIENT_SOCKS_RECV_BUF_MIN_SIZE 2048
+
+// maximum number of ring buffer sizes
+#define CLIENT_BUF_MAX_CLASSES 24
+
+// bytes of client buffers of the same size allocated together, roughly
+#define CLIENT_BUFS_SLAB_CHUNK_SIZE 65536
+
+// number of clients allocated together
+#define CLIENTS_SLAB_CHUNK 8
+
+// interval of the timer which ages clients, in milliseconds; idle and
+// half-close timeouts count its ticks
+#define CLIENT_TIMER_INTERVAL 1000
+
+// default time in seconds a client with one side closed may go without
+// progress while the other side is sent what is left
+#define DEFAULT_TCP_HALF_CLOSE_TIMEOUT 60
+
+// default lwip TCP maximum segment size
+#define DEFAULT_TCP_MSS 1460
+
+// default lwip TCP receive window
+#define DEFAULT_TCP_WND (4 * DEFAULT_TCP_MSS)
+
+// default lwip TCP send buffer size
+#define DEFAULT_TCP_SND_BUF 16384
+
+// maximum number of worker processes
+#define MAX_WORKERS 64
+
+// number of free device read buffers to keep around for reuse
+#define DEVICE_READ_POOL_SIZE 16
 
 // maximum number of udpgw connections
 #define DEFAULT_UDPGW_MAX_CONNECTIONS 256
@@ -36,11 +73,53 @@
 // udpgw per-connection send buffer size, in number of packets
 #define DEFAULT_UDPGW_CONNECTION_BUFFER_SIZE 8
 
+// udpgw receive buffer size, in number of packets
+#define DEFAULT_UDPGW_RECV_BUFFER_SIZE 32
+
+// default number of parallel connections to udpgw
+#define DEFAULT_UDPGW_NUM_CONNECTIONS 1
+
 // udpgw reconnect time after connection fails
 #define UDPGW_RECONNECT_TIME 5000
 
+// default number of connections to tcpgw
+#define DEFAULT_TCPGW_NUM_CONNECTIONS 2
+
+// default per-stream receive window for tcpgw streams
+#define DEFAULT_TCPGW_WINDOW 65536
+
+// tcpgw reconnect time after connection fails
+#define TCPGW_RECONNECT_TIME 5000
+
 // udpgw keepalive sending interval
 #define UDPGW_KEEPALIVE_TIME 10000
 
+// maximum time to keep a DNS response in the cache, regardless of its TTL
+#define DNS_CACHE_MAX_TTL 3600000
+
+// time after which a DNS query in flight is no longer waited for
+#define DNS_CACHE_PENDING_TIMEOUT 2000
+
+// maximum number of SOCKS5 UDP associations
+#define DEFAULT_SOCKS_UDP_MAX_CONNECTIONS 256
+
+// time after which an idle SOCKS5 UDP association is closed
+#define SOCKS_UDP_IDLE_TIME 60000
+
+// maximum number of SOCKS servers
+#define MAX_SOCKS_SERVERS 16
+
+// default interval of SOCKS server health checks, in seconds
+#define DEFAULT_SOCKS_CHECK_INTERVAL 10
+
+// maximum number of --direct rules
+#define MAX_DIRECT_RULES 256
+
+// maximum number of sockets for UDP sent directly
+#define DEFAULT_DIRECT_UDP_MAX_CONNECTIONS 256
+
+// time after which an idle socket for UDP sent directly is closed
+#define DIRECT_UDP_IDLE_TIME 60000
+
 // option to override the destination addresses to give the SOCKS server
 //#define OVERRIDE_DEST_ADDR "10.111.0.2:2000"
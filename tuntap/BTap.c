@@ -31,12 +31,17 @@
 #include <stdio.h>
 
 #ifdef BADVPN_USE_WINAPI
+    #include <winsock2.h>
     #include <windows.h>
     #include <winioctl.h>
     #include <objbase.h>
     #include <wtypes.h>
     #include "wintap-common.h"
     #include <tuntap/tapwin32-funcs.h>
+    #ifdef BADVPN_USE_WINTUN
+        #include <iphlpapi.h>
+        #include <tuntap/wintun-funcs.h>
+    #endif
 #else
     #include <fcntl.h>
     #include <unistd.h>
@@ -56,7 +61,10 @@
     #endif
 #endif
 
+#include <misc/balloc.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
+#include <base/BPacketTrace.h>
 
 #include <tuntap/BTap.h>
 
@@ -64,6 +72,19 @@
 
 static void report_error (BTap *o);
 static void output_handler_recv (BTap *o, uint8_t *data);
+#ifdef BADVPN_USE_WINTUN
+static int init_wintun (BTap *o, enum BTap_dev_type dev_type, const char *device_name);
+static void wintun_receive (BTap *o);
+#endif
+#ifdef BADVPN_LINUX
+static void vnet_complete_packet (const struct virtio_net_hdr *hdr, uint8_t *data, int data_len);
+#endif
+#ifndef BADVPN_USE_WINAPI
+static int read_packet (BTap *o, uint8_t *data);
+static int write_packet (BTap *o, const struct iovec *iov, int iovcnt);
+static void send_packet (BTap *o, const struct iovec *iov, int iovcnt, int data_len);
+static void end_read_batch (BTap *o);
+#endif
 
 #ifdef BADVPN_USE_WINAPI
 
@@ -73,6 +94,8 @@ static void recv_olap_handler (BTap *o, int event, DWORD bytes)
     ASSERT(o->output_packet)
     ASSERT(event == BREACTOR_IOCP_EVENT_SUCCEEDED || event == BREACTOR_IOCP_EVENT_FAILED)
     
+    uint8_t *data = o->output_packet;
+    
     // set no output packet
     o->output_packet = NULL;
     
@@ -85,12 +108,314 @@ static void recv_olap_handler (BTap *o, int event, DWORD bytes)
     ASSERT(bytes >= 0)
     ASSERT(bytes <= o->frame_mtu)
     
+    BPacketTrace_Begin(BPACKETTRACE_SEND, data);
+    
     // done
     PacketRecvInterface_Done(&o->output, bytes);
 }
 
+#ifdef BADVPN_USE_WINTUN
+
+static VOID CALLBACK wintun_wait_callback (PVOID user, BOOLEAN timed_out)
+{
+    BTap *o = (BTap *)user;
+    
+    // runs in a thread pool thread; pass the wakeup to the reactor
+    InterlockedExchange(&o->wintun_posted, 1);
+    PostQueuedCompletionStatus(BReactor_GetIOCPHandle(o->reactor), 0, 0, &o->recv_olap.olap);
+}
+
+static void wintun_olap_handler (BTap *o, int event, DWORD bytes)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->use_wintun)
+    ASSERT(o->output_packet)
+    ASSERT(o->wintun_wait)
+    ASSERT(event == BREACTOR_IOCP_EVENT_SUCCEEDED || event == BREACTOR_IOCP_EVENT_FAILED)
+    
+    // the wait was for one signal only, release it
+    UnregisterWaitEx(o->wintun_wait, NULL);
+    o->wintun_wait = NULL;
+    
+    wintun_receive(o);
+}
+
+static int wintun_read_packet (BTap *o, uint8_t *data)
+{
+    while (1) {
+        DWORD size;
+        BYTE *packet = o->wintun.ReceivePacket(o->wintun_session, &size);
+        if (!packet) {
+            DWORD error = GetLastError();
+            if (error == ERROR_NO_MORE_ITEMS) {
+                return 0;
+            }
+            BLog(BLOG_ERROR, "WintunReceivePacket failed (%u)", (unsigned int)error);
+            return -1;
+        }
+        
+        // the interface MTU may have been raised since we looked at it
+        if (size == 0 || size > (DWORD)o->recv_mtu) {
+            BLog(BLOG_WARNING, "dropping packet of size %u", (unsigned int)size);
+            o->wintun.ReleaseReceivePacket(o->wintun_session, packet);
+            continue;
+        }
+        
+        memcpy(data, packet, size);
+        o->wintun.ReleaseReceivePacket(o->wintun_session, packet);
+        
+        return size;
+    }
+}
+
+void wintun_receive (BTap *o)
+{
+    ASSERT(o->use_wintun)
+    ASSERT(o->output_packet)
+    ASSERT(!o->wintun_wait)
+    
+    int bytes = wintun_read_packet(o, o->output_packet);
+    if (bytes < 0) {
+        o->output_packet = NULL;
+        report_error(o);
+        return;
+    }
+    
+    if (bytes == 0) {
+        // ring is empty, wait for the driver to signal more packets
+        o->wintun_posted = 0;
+        if (!RegisterWaitForSingleObject(&o->wintun_wait, o->wintun.GetReadWaitEvent(o->wintun_session), wintun_wait_callback, o, INFINITE, WT_EXECUTEONLYONCE)) {
+            BLog(BLOG_ERROR, "RegisterWaitForSingleObject failed (%u)", (unsigned int)GetLastError());
+            o->wintun_wait = NULL;
+            o->output_packet = NULL;
+            report_error(o);
+        }
+        return;
+    }
+    
+    uint8_t *data = o->output_packet;
+    
+    // set no output packet
+    o->output_packet = NULL;
+    
+    BPacketTrace_Begin(BPACKETTRACE_SEND, data);
+    
+    // done
+    PacketRecvInterface_Done(&o->output, bytes);
+}
+
+int init_wintun (BTap *o, enum BTap_dev_type dev_type, const char *device_name)
+{
+    if (dev_type != BTAP_DEV_TUN) {
+        BLog(BLOG_ERROR, "Wintun only supports TUN devices");
+        goto fail0;
+    }
+    
+    if (!device_name[0]) {
+        device_name = "BadVPN";
+    }
+    
+    // load API
+    if (!wintun_load(&o->wintun)) {
+        BLog(BLOG_ERROR, "failed to load wintun.dll");
+        goto fail0;
+    }
+    
+    // convert adapter name
+    LPWSTR wname;
+    if (!(wname = wintun_adapter_name(device_name))) {
+        BLog(BLOG_ERROR, "bad adapter name");
+        goto fail1;
+    }
+    
+    // open adapter, or create it
+    
+    BLog(BLOG_INFO, "Opening Wintun adapter %s", device_name);
+    
+    if (!(o->wintun_adapter = o->wintun.OpenAdapter(wname))) {
+        BLog(BLOG_INFO, "Creating Wintun adapter %s", device_name);
+        
+        if (!(o->wintun_adapter = o->wintun.CreateAdapter(wname, L"BadVPN", NULL))) {
+            BLog(BLOG_ERROR, "WintunCreateAdapter failed (%u)", (unsigned int)GetLastError());
+            BFree(wname);
+            goto fail1;
+        }
+    }
+    
+    BFree(wname);
+    
+    // get MTU; the adapter takes any IP packet, so use the interface's
+    
+    MIB_IPINTERFACE_ROW row;
+    InitializeIpInterfaceEntry(&row);
+    row.Family = AF_INET;
+    o->wintun.GetAdapterLUID(o->wintun_adapter, &row.InterfaceLuid);
+    
+    if (GetIpInterfaceEntry(&row) == NO_ERROR) {
+        o->frame_mtu = (row.NlMtu < WINTUN_MAX_IP_PACKET_SIZE ? row.NlMtu : WINTUN_MAX_IP_PACKET_SIZE);
+    } else {
+        BLog(BLOG_WARNING, "GetIpInterfaceEntry failed, assuming MTU 1500");
+        o->frame_mtu = 1500;
+    }
+    o->recv_mtu = o->frame_mtu;
+    
+    // start session
+    if (!(o->wintun_session = o->wintun.StartSession(o->wintun_adapter, WINTUN_RING_CAPACITY))) {
+        BLog(BLOG_ERROR, "WintunStartSession failed (%u)", (unsigned int)GetLastError());
+        goto fail2;
+    }
+    
+    BLog(BLOG_INFO, "Device opened");
+    
+    // init recv olap, which the read wait callback posts
+    BReactorIOCPOverlapped_Init(&o->recv_olap, o->reactor, o, (BReactorIOCPOverlapped_handler)wintun_olap_handler);
+    
+    o->wintun_wait = NULL;
+    o->wintun_posted = 0;
+    o->use_wintun = 1;
+    
+    return 1;
+    
+fail2:
+    o->wintun.CloseAdapter(o->wintun_adapter);
+fail1:
+    wintun_unload(&o->wintun);
+fail0:
+    return 0;
+}
+
+#endif
+
 #else
 
+#ifdef BADVPN_LINUX
+
+static void vnet_complete_packet (const struct virtio_net_hdr *hdr, uint8_t *data, int data_len)
+{
+    ASSERT(data_len >= 0)
+    
+    if (!(hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+        return;
+    }
+    
+    // the kernel left the transport checksum for us; the checksum field
+    // already contains the pseudo-header sum
+    int start = hdr->csum_start;
+    int offset = hdr->csum_offset;
+    if (start > data_len || offset > data_len - start - 2) {
+        BLog(BLOG_WARNING, "bad checksum offsets in virtio-net header");
+        return;
+    }
+    
+    uint32_t t = 0;
+    int i;
+    for (i = start; i + 1 < data_len; i += 2) {
+        t += ((uint32_t)data[i] << 8) | data[i + 1];
+    }
+    if (i < data_len) {
+        t += (uint32_t)data[i] << 8;
+    }
+    
+    while (t >> 16) {
+        t = (t & 0xFFFF) + (t >> 16);
+    }
+    t = ~t & 0xFFFF;
+    
+    data[start + offset] = t >> 8;
+    data[start + offset + 1] = t;
+}
+
+#endif
+
+static int read_packet (BTap *o, uint8_t *data)
+{
+#ifdef BADVPN_LINUX
+    if (o->vnet_hdr) {
+        struct virtio_net_hdr hdr;
+        struct iovec iov[2];
+        iov[0].iov_base = &hdr;
+        iov[0].iov_len = sizeof(hdr);
+        iov[1].iov_base = data;
+        iov[1].iov_len = o->recv_mtu;
+        
+        int bytes = readv(o->fd, iov, 2);
+        if (bytes <= 0) {
+            return bytes;
+        }
+        
+        // treat a truncated header like a zero return
+        if (bytes <= sizeof(hdr)) {
+            return 0;
+        }
+        bytes -= sizeof(hdr);
+        
+        vnet_complete_packet(&hdr, data, bytes);
+        
+        return bytes;
+    }
+#endif
+    
+    return read(o->fd, data, o->recv_mtu);
+}
+
+static int write_packet (BTap *o, const struct iovec *iov, int iovcnt)
+{
+    ASSERT(iovcnt >= 1)
+    ASSERT(iovcnt <= BTAP_MAX_IOVCNT)
+    
+#ifdef BADVPN_LINUX
+    if (o->vnet_hdr) {
+        // no offloads requested on packets we send
+        struct virtio_net_hdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+        
+        struct iovec hdr_iov[1 + BTAP_MAX_IOVCNT];
+        hdr_iov[0].iov_base = &hdr;
+        hdr_iov[0].iov_len = sizeof(hdr);
+        memcpy(hdr_iov + 1, iov, iovcnt * sizeof(iov[0]));
+        
+        int bytes = writev(o->fd, hdr_iov, 1 + iovcnt);
+        if (bytes < (int)sizeof(hdr)) {
+            return bytes;
+        }
+        
+        return bytes - sizeof(hdr);
+    }
+#endif
+    
+    if (iovcnt == 1) {
+        return write(o->fd, iov[0].iov_base, iov[0].iov_len);
+    }
+    
+    return writev(o->fd, iov, iovcnt);
+}
+
+static void send_packet (BTap *o, const struct iovec *iov, int iovcnt, int data_len)
+{
+    BMetrics_Count(BMETRICS_COUNTER_TAP_WRITES, 1);
+    
+    int bytes = write_packet(o, iov, iovcnt);
+    if (bytes < 0) {
+        // malformed packets will cause errors, ignore them and act like
+        // the packet was accepeted
+    } else {
+        if (bytes != data_len) {
+            BLog(BLOG_WARNING, "written %d expected %d", bytes, data_len);
+        }
+    }
+}
+
+static void end_read_batch (BTap *o)
+{
+    // the device would block, the packets read since the last time
+    // it did are one batch
+    if (o->read_batch > 0) {
+        BMetrics_Observe(BMETRICS_HISTOGRAM_TAP_READ_BATCH, o->read_batch);
+        o->read_batch = 0;
+    }
+}
+
 static void fd_handler (BTap *o, int events)
 {
     DebugObject_Access(&o->d_obj);
@@ -104,11 +429,12 @@ static void fd_handler (BTap *o, int events)
         ASSERT(o->output_packet)
         
         // try reading into the buffer
-        int bytes = read(o->fd, o->output_packet, o->frame_mtu);
+        int bytes = read_packet(o, o->output_packet);
         if (bytes <= 0) {
             // Treat zero return value the same as EAGAIN.
             // See: https://bugzilla.kernel.org/show_bug.cgi?id=96381
             if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+                end_read_batch(o);
                 // retry later
                 break;
             }
@@ -117,7 +443,9 @@ static void fd_handler (BTap *o, int events)
             return;
         }
         
-        ASSERT_FORCE(bytes <= o->frame_mtu)
+        ASSERT_FORCE(bytes <= o->recv_mtu)
+        
+        BPacketTrace_Begin(BPACKETTRACE_SEND, o->output_packet);
         
         // set no output packet
         o->output_packet = NULL;
@@ -126,11 +454,64 @@ static void fd_handler (BTap *o, int events)
         o->poll_events &= ~BREACTOR_READ;
         BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->poll_events);
         
+        o->read_batch++;
+        
         // inform receiver we finished the packet
         PacketRecvInterface_Done(&o->output, bytes);
     } while (0);
 }
 
+#ifdef BADVPN_USE_IO_URING
+
+static void recv_uring_handler (BTap *o, int result)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->output_packet)
+    
+    if (result <= 0) {
+        // See note about zero return in fd_handler.
+        if (result == 0 || result == -EAGAIN || result == -EWOULDBLOCK) {
+            end_read_batch(o);
+            // retry later in fd_handler
+            o->poll_events |= BREACTOR_READ;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->poll_events);
+            return;
+        }
+        // report fatal error
+        report_error(o);
+        return;
+    }
+    
+#ifdef BADVPN_LINUX
+    if (o->vnet_hdr) {
+        // treat a truncated header like a zero return
+        if (result <= sizeof(o->recv_vnet_hdr)) {
+            o->poll_events |= BREACTOR_READ;
+            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->poll_events);
+            return;
+        }
+        result -= sizeof(o->recv_vnet_hdr);
+        
+        vnet_complete_packet(&o->recv_vnet_hdr, o->output_packet, result);
+    }
+#endif
+    
+    ASSERT_FORCE(result <= o->recv_mtu)
+    
+    BPacketTrace_Begin(BPACKETTRACE_SEND, o->output_packet);
+    
+    // set no output packet
+    o->output_packet = NULL;
+    
+    o->read_batch++;
+    
+    // inform receiver we finished the packet
+    PacketRecvInterface_Done(&o->output, result);
+}
+
+#endif
+
 #endif
 
 void report_error (BTap *o)
@@ -147,6 +528,16 @@ void output_handler_recv (BTap *o, uint8_t *data)
     
 #ifdef BADVPN_USE_WINAPI
     
+#ifdef BADVPN_USE_WINTUN
+    if (o->use_wintun) {
+        // remember packet
+        o->output_packet = data;
+        
+        wintun_receive(o);
+        return;
+    }
+#endif
+    
     memset(&o->recv_olap.olap, 0, sizeof(o->recv_olap.olap));
     
     // read
@@ -161,11 +552,33 @@ void output_handler_recv (BTap *o, uint8_t *data)
     
 #else
     
+#ifdef BADVPN_USE_IO_URING
+    if (o->use_uring) {
+        // remember packet
+        o->output_packet = data;
+        
+        // submit read; completion comes to recv_uring_handler
+#ifdef BADVPN_LINUX
+        if (o->vnet_hdr) {
+            o->recv_iov[0].iov_base = &o->recv_vnet_hdr;
+            o->recv_iov[0].iov_len = sizeof(o->recv_vnet_hdr);
+            o->recv_iov[1].iov_base = data;
+            o->recv_iov[1].iov_len = o->recv_mtu;
+            BReactorIOUringOp_ReadV(&o->recv_uring_op, o->fd, o->recv_iov, 2);
+            return;
+        }
+#endif
+        BReactorIOUringOp_Read(&o->recv_uring_op, o->fd, data, o->recv_mtu);
+        return;
+    }
+#endif
+    
     // attempt read
-    int bytes = read(o->fd, data, o->frame_mtu);
+    int bytes = read_packet(o, data);
     if (bytes <= 0) {
         if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
             // See note about zero return in fd_handler.
+            end_read_batch(o);
             // retry later in fd_handler
             // remember packet
             o->output_packet = data;
@@ -179,7 +592,11 @@ void output_handler_recv (BTap *o, uint8_t *data)
         return;
     }
     
-    ASSERT_FORCE(bytes <= o->frame_mtu)
+    ASSERT_FORCE(bytes <= o->recv_mtu)
+    
+    BPacketTrace_Begin(BPACKETTRACE_SEND, data);
+    
+    o->read_batch++;
     
     PacketRecvInterface_Done(&o->output, bytes);
     
@@ -194,6 +611,7 @@ int BTap_Init (BTap *o, BReactor *reactor, char *devname, BTap_handler_error han
     init_data.dev_type = tun ? BTAP_DEV_TUN : BTAP_DEV_TAP;
     init_data.init_type = BTAP_INIT_STRING;
     init_data.init.string = devname;
+    init_data.flags = 0;
     
     return BTap_Init2(o, reactor, init_data, handler_error, handler_error_user);
 }
@@ -211,6 +629,11 @@ int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, BTa
     
     ASSERT(init_data.init_type == BTAP_INIT_STRING)
     
+    if ((init_data.flags & (BTAP_INIT_FLAG_MULTI_QUEUE|BTAP_INIT_FLAG_VNET_HDR))) {
+        BLog(BLOG_ERROR, "multi-queue devices and virtio-net headers not supported");
+        goto fail0;
+    }
+    
     // parse device specification
     
     if (!init_data.init.string) {
@@ -234,6 +657,23 @@ int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, BTa
         }
     }
     
+#ifdef BADVPN_USE_WINTUN
+    // use Wintun instead of TAP-Win32 if requested
+    
+    if (!strcmp(device_component_id, "wintun")) {
+        if (!init_wintun(o, init_data.dev_type, device_name)) {
+            goto fail1;
+        }
+        
+        free(device_name);
+        free(device_component_id);
+        
+        goto success;
+    }
+    
+    o->use_wintun = 0;
+#endif
+    
     // locate device path
     
     char device_path[TAPWIN32_MAX_REG_SIZE];
@@ -280,6 +720,7 @@ int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, BTa
     } else {
         o->frame_mtu = umtu + BTAP_ETHERNET_HEADER_LENGTH;
     }
+    o->recv_mtu = o->frame_mtu;
     
     // set connected
     
@@ -321,6 +762,12 @@ fail0:
     
     #if defined(BADVPN_LINUX) || defined(BADVPN_FREEBSD)
     
+    o->dev_type = init_data.dev_type;
+    o->init_flags = init_data.flags;
+    o->devname[0] = '\0';
+#ifdef BADVPN_LINUX
+    o->vnet_hdr = 0;
+#endif
     o->close_fd = (init_data.init_type != BTAP_INIT_FD);
     
     switch (init_data.init_type) {
@@ -328,6 +775,7 @@ fail0:
             ASSERT(init_data.init.fd.fd >= 0)
             ASSERT(init_data.init.fd.mtu >= 0)
             ASSERT(init_data.dev_type != BTAP_DEV_TAP || init_data.init.fd.mtu >= BTAP_ETHERNET_HEADER_LENGTH)
+            ASSERT(!(init_data.flags & (BTAP_INIT_FLAG_MULTI_QUEUE|BTAP_INIT_FLAG_VNET_HDR)))
             
             o->fd = init_data.init.fd.fd;
             o->frame_mtu = init_data.init.fd.mtu;
@@ -355,6 +803,17 @@ fail0:
             } else {
                 ifr.ifr_flags |= IFF_TAP;
             }
+            if ((init_data.flags & BTAP_INIT_FLAG_MULTI_QUEUE)) {
+                #ifdef IFF_MULTI_QUEUE
+                ifr.ifr_flags |= IFF_MULTI_QUEUE;
+                #else
+                BLog(BLOG_ERROR, "multi-queue devices not supported");
+                goto fail1;
+                #endif
+            }
+            if ((init_data.flags & BTAP_INIT_FLAG_VNET_HDR)) {
+                ifr.ifr_flags |= IFF_VNET_HDR;
+            }
             if (init_data.init.string) {
                 snprintf(ifr.ifr_name, IFNAMSIZ, "%s", init_data.init.string);
             }
@@ -364,6 +823,25 @@ fail0:
                 goto fail1;
             }
             
+            if ((init_data.flags & BTAP_INIT_FLAG_VNET_HDR)) {
+                int hdr_size = sizeof(struct virtio_net_hdr);
+                if (ioctl(o->fd, TUNSETVNETHDRSZ, &hdr_size) < 0) {
+                    BLog(BLOG_ERROR, "error setting virtio-net header size");
+                    goto fail1;
+                }
+                
+                // GSO packets must be accepted before the kernel will produce them
+                unsigned int offload = TUN_F_CSUM|TUN_F_TSO4|TUN_F_TSO6;
+                if (ioctl(o->fd, TUNSETOFFLOAD, offload) < 0) {
+                    BLog(BLOG_WARNING, "error enabling TCP segmentation offload");
+                    if (ioctl(o->fd, TUNSETOFFLOAD, TUN_F_CSUM) < 0) {
+                        BLog(BLOG_WARNING, "error enabling checksum offload");
+                    }
+                }
+                
+                o->vnet_hdr = 1;
+            }
+            
             strcpy(devname_real, ifr.ifr_name);
             
             #endif
@@ -375,6 +853,11 @@ fail0:
                 goto fail0;
             }
             
+            if ((init_data.flags & BTAP_INIT_FLAG_MULTI_QUEUE)) {
+                BLog(BLOG_ERROR, "multi-queue devices not supported");
+                goto fail0;
+            }
+            
             if (!init_data.init.string) {
                 BLog(BLOG_ERROR, "no device specified");
                 goto fail0;
@@ -428,11 +911,28 @@ fail0:
             }
             
             close(sock);
+            
+            // remember name, for opening more queues
+            strcpy(o->devname, devname_real);
+            
+            #ifdef BADVPN_LINUX
+            if (o->vnet_hdr) {
+                BLog(BLOG_INFO, "virtio-net headers enabled");
+            }
+            #endif
         } break;
         
         default: ASSERT(0);
     }
-        
+    
+    // with segmentation offload, packets can be as large as IP allows
+    o->recv_mtu = o->frame_mtu;
+    #ifdef BADVPN_LINUX
+    if (o->vnet_hdr) {
+        o->recv_mtu = UINT16_MAX + (o->dev_type == BTAP_DEV_TAP ? BTAP_ETHERNET_HEADER_LENGTH : 0);
+    }
+    #endif
+    
     // set non-blocking
     if (fcntl(o->fd, F_SETFL, O_NONBLOCK) < 0) {
         BLog(BLOG_ERROR, "cannot set non-blocking");
@@ -446,6 +946,15 @@ fail0:
         goto fail1;
     }
     o->poll_events = 0;
+    o->read_batch = 0;
+    
+#ifdef BADVPN_USE_IO_URING
+    // init io_uring read operation
+    o->use_uring = BReactor_HasIOUring(o->reactor);
+    if (o->use_uring) {
+        BReactorIOUringOp_Init(&o->recv_uring_op, o->reactor, o, (BReactorIOUringOp_handler)recv_uring_handler);
+    }
+#endif
     
     goto success;
     
@@ -460,7 +969,7 @@ fail0:
     
 success:
     // init output
-    PacketRecvInterface_Init(&o->output, o->frame_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, BReactor_PendingGroup(o->reactor));
+    PacketRecvInterface_Init(&o->output, o->recv_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, BReactor_PendingGroup(o->reactor));
     
     // set no output packet
     o->output_packet = NULL;
@@ -470,6 +979,25 @@ success:
     return 1;
 }
 
+int BTap_InitQueue (BTap *o, BTap *first, BReactor *reactor, BTap_handler_error handler_error, void *handler_error_user)
+{
+#ifdef BADVPN_LINUX
+    ASSERT((first->init_flags & BTAP_INIT_FLAG_MULTI_QUEUE))
+    ASSERT(first->devname[0])
+    
+    struct BTap_init_data init_data;
+    init_data.dev_type = first->dev_type;
+    init_data.init_type = BTAP_INIT_STRING;
+    init_data.init.string = first->devname;
+    init_data.flags = first->init_flags;
+    
+    return BTap_Init2(o, reactor, init_data, handler_error, handler_error_user);
+#else
+    BLog(BLOG_ERROR, "multi-queue devices not supported");
+    return 0;
+#endif
+}
+
 void BTap_Free (BTap *o)
 {
     DebugObject_Free(&o->d_obj);
@@ -480,6 +1008,32 @@ void BTap_Free (BTap *o)
     
 #ifdef BADVPN_USE_WINAPI
     
+#ifdef BADVPN_USE_WINTUN
+    if (o->use_wintun) {
+        if (o->wintun_wait) {
+            // wait for the callback to finish if it is running
+            UnregisterWaitEx(o->wintun_wait, INVALID_HANDLE_VALUE);
+            
+            // take the completion it may have posted
+            if (o->wintun_posted) {
+                BReactorIOCPOverlapped_Wait(&o->recv_olap, NULL, NULL);
+            }
+        }
+        
+        // free recv olap
+        BReactorIOCPOverlapped_Free(&o->recv_olap);
+        
+        // end session and close adapter
+        o->wintun.EndSession(o->wintun_session);
+        o->wintun.CloseAdapter(o->wintun_adapter);
+        
+        // unload API
+        wintun_unload(&o->wintun);
+        
+        return;
+    }
+#endif
+    
     // cancel I/O
     ASSERT_FORCE(CancelIo(o->device))
     
@@ -500,6 +1054,19 @@ void BTap_Free (BTap *o)
     
 #else
     
+#ifdef BADVPN_USE_IO_URING
+    if (o->use_uring) {
+        // wait receiving to finish
+        if (BReactorIOUringOp_IsBusy(&o->recv_uring_op)) {
+            BReactorIOUringOp_Cancel(&o->recv_uring_op);
+            BReactorIOUringOp_Wait(&o->recv_uring_op);
+        }
+        
+        // free io_uring read operation
+        BReactorIOUringOp_Free(&o->recv_uring_op);
+    }
+#endif
+    
     // free BFileDescriptor
     BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
     
@@ -527,6 +1094,29 @@ void BTap_Send (BTap *o, uint8_t *data, int data_len)
     
 #ifdef BADVPN_USE_WINAPI
     
+#ifdef BADVPN_USE_WINTUN
+    if (o->use_wintun) {
+        if (data_len == 0) {
+            return;
+        }
+        
+        // write directly into the send ring
+        BYTE *packet = o->wintun.AllocateSendPacket(o->wintun_session, data_len);
+        if (!packet) {
+            // with a full ring, drop the packet as a device would
+            DWORD error = GetLastError();
+            if (error != ERROR_BUFFER_OVERFLOW) {
+                BLog(BLOG_ERROR, "WintunAllocateSendPacket failed (%u)", (unsigned int)error);
+            }
+            return;
+        }
+        
+        memcpy(packet, data, data_len);
+        o->wintun.SendPacket(o->wintun_session, packet);
+        return;
+    }
+#endif
+    
     // ignore frames without an Ethernet header, or we get errors in WriteFile
     if (data_len < 14) {
         return;
@@ -559,19 +1149,35 @@ void BTap_Send (BTap *o, uint8_t *data, int data_len)
     
 #else
     
-    int bytes = write(o->fd, data, data_len);
-    if (bytes < 0) {
-        // malformed packets will cause errors, ignore them and act like
-        // the packet was accepeted
-    } else {
-        if (bytes != data_len) {
-            BLog(BLOG_WARNING, "written %d expected %d", bytes, data_len);
-        }
-    }
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = data_len;
+    
+    send_packet(o, &iov, 1, data_len);
     
 #endif
 }
 
+#ifndef BADVPN_USE_WINAPI
+
+void BTap_SendV (BTap *o, const struct iovec *iov, int iovcnt)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(iovcnt >= 1)
+    ASSERT(iovcnt <= BTAP_MAX_IOVCNT)
+    
+    int data_len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        data_len += iov[i].iov_len;
+    }
+    ASSERT(data_len <= o->frame_mtu)
+    
+    send_packet(o, iov, iovcnt, data_len);
+}
+
+#endif
+
 PacketRecvInterface * BTap_GetOutput (BTap *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -41,8 +41,16 @@
 #include <stdint.h>
 
 #ifdef BADVPN_USE_WINAPI
+#ifdef BADVPN_USE_WINTUN
+#include <tuntap/wintun-funcs.h>
+#endif
 #else
 #include <net/if.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef BADVPN_LINUX
+#include <linux/virtio_net.h>
 #endif
 
 #include <misc/debug.h>
@@ -53,6 +61,11 @@
 
 #define BTAP_ETHERNET_HEADER_LENGTH 14
 
+#define BTAP_MAX_IOVCNT 64
+
+#define BTAP_INIT_FLAG_MULTI_QUEUE (1 << 0)
+#define BTAP_INIT_FLAG_VNET_HDR (1 << 1)
+
 /**
  * Handler called when an error occurs on the device.
  * The object must be destroyed from the job context of this
@@ -67,6 +80,7 @@ typedef struct {
     BTap_handler_error handler_error;
     void *handler_error_user;
     int frame_mtu;
+    int recv_mtu;
     PacketRecvInterface output;
     uint8_t *output_packet;
     
@@ -74,11 +88,32 @@ typedef struct {
     HANDLE device;
     BReactorIOCPOverlapped send_olap;
     BReactorIOCPOverlapped recv_olap;
+#ifdef BADVPN_USE_WINTUN
+    int use_wintun;
+    struct wintun_api wintun;
+    WINTUN_ADAPTER_HANDLE wintun_adapter;
+    WINTUN_SESSION_HANDLE wintun_session;
+    HANDLE wintun_wait;
+    volatile LONG wintun_posted;
+#endif
 #else
+    int dev_type;
+    int init_flags;
+    char devname[IFNAMSIZ];
     int close_fd;
     int fd;
     BFileDescriptor bfd;
     int poll_events;
+    int read_batch;
+#ifdef BADVPN_LINUX
+    int vnet_hdr;
+    struct virtio_net_hdr recv_vnet_hdr;
+    struct iovec recv_iov[2];
+#endif
+#ifdef BADVPN_USE_IO_URING
+    int use_uring;
+    BReactorIOUringOp recv_uring_op;
+#endif
 #endif
     
     DebugError d_err;
@@ -119,6 +154,7 @@ enum BTap_init_type {
 struct BTap_init_data {
     enum BTap_dev_type dev_type;
     enum BTap_init_type init_type;
+    int flags;
     union {
         char *string;
         struct {
@@ -148,17 +184,53 @@ struct BTap_init_data {
  *                  a hardcoded default will be used instead. If device_name is empty,
  *                  the first device found with a matching component_id will be used.
  *                  Specifying NULL is equivalent to specifying ":".
+ *                  If built with BADVPN_USE_WINTUN and component_id is "wintun", a Wintun
+ *                  adapter with the name device_name is used through wintun.dll instead
+ *                  of a TAP-Win32 device; it is created if it does not exist (and removed
+ *                  again when the object is freed).
+ *                  Wintun only supports TUN devices, and ignores the addresses in the
+ *                  TUN specification.
  *                  For BTAP_INIT_FD, the device is initialized using a file descriptor.
  *                  In this case, init_data.init.fd.fd must be set to the file descriptor,
  *                  and init_data.init.fd.mtu must be set to the largest IP packet or
  *                  Ethernet frame supported, for a TUN or TAP device, respectively.
  *                  File descriptor initialization is not supported on Windows.
+ *                  init_data.flags is a bitmask of flags. If BTAP_INIT_FLAG_MULTI_QUEUE
+ *                  is set, the device is opened as a multi-queue device (Linux only,
+ *                  BTAP_INIT_STRING only), and more queues can be attached to it
+ *                  using {@link BTap_InitQueue}.
+ *                  If BTAP_INIT_FLAG_VNET_HDR is set, the device is opened with
+ *                  virtio-net headers and checksum and TCP segmentation offloads
+ *                  are enabled (Linux only, BTAP_INIT_STRING only). The kernel may
+ *                  then deliver TCP packets much larger than the device MTU;
+ *                  checksums which the kernel left for us are filled in before
+ *                  packets are passed on, and the headers are not visible to
+ *                  the user of this object.
  * @param handler_error error handler function
  * @param handler_error_user value passed to error handler
  * @return 1 on success, 0 on failure
  */
 int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, BTap_handler_error handler_error, void *handler_error_user) WARN_UNUSED;
 
+/**
+ * Opens another queue of a multi-queue device.
+ * The resulting object is used like any other {@link BTap}; packets sent to
+ * the device are distributed among its queues by the kernel. The queue may
+ * use a different reactor than the first queue, including one running in a
+ * different thread.
+ * Only supported on Linux.
+ *
+ * @param o the object
+ * @param first device which was initialized with BTAP_INIT_FLAG_MULTI_QUEUE.
+ *              Only its name and type are used, so it may be accessed
+ *              from another thread. It must not be freed before this object.
+ * @param reactor {@link BReactor} this queue lives in
+ * @param handler_error error handler function
+ * @param handler_error_user value passed to error handler
+ * @return 1 on success, 0 on failure
+ */
+int BTap_InitQueue (BTap *o, BTap *first, BReactor *reactor, BTap_handler_error handler_error, void *handler_error_user) WARN_UNUSED;
+
 /**
  * Frees the TAP device.
  *
@@ -184,9 +256,23 @@ int BTap_GetMTU (BTap *o);
  */
 void BTap_Send (BTap *o, uint8_t *data, int data_len);
 
+#ifndef BADVPN_USE_WINAPI
+/**
+ * Sends a packet to the device, gathering it from multiple buffers.
+ * Any errors will be reported via a job.
+ * 
+ * @param o the object
+ * @param iov buffers making up the packet, in order. The total length must be
+ *            <=MTU, as reported by {@link BTap_GetMTU}.
+ * @param iovcnt number of buffers. Must be >=1 and <=BTAP_MAX_IOVCNT.
+ */
+void BTap_SendV (BTap *o, const struct iovec *iov, int iovcnt);
+#endif
+
 /**
  * Returns a {@link PacketRecvInterface} for reading packets from the device.
- * The MTU of the interface will be {@link BTap_GetMTU}.
+ * The MTU of the interface will be {@link BTap_GetMTU}, or the maximum size
+ * of an IP packet if the device was opened with BTAP_INIT_FLAG_VNET_HDR.
  * 
  * @param o the object
  * @return output interface
@@ -0,0 +1,95 @@
+/**
+ * @file wintun-funcs.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <misc/debug.h>
+#include <misc/balloc.h>
+
+#include <tuntap/wintun-funcs.h>
+
+#define LOAD_FUNC(field, name) \
+    if (!(*(FARPROC *)&api->field = GetProcAddress(api->dll, name))) { \
+        DEBUG("missing function %s", name); \
+        goto fail1; \
+    }
+
+int wintun_load (struct wintun_api *api)
+{
+    // only look next to the program and in the system directory
+    if (!(api->dll = LoadLibraryExW(L"wintun.dll", NULL, LOAD_LIBRARY_SEARCH_APPLICATION_DIR | LOAD_LIBRARY_SEARCH_SYSTEM32))) {
+        DEBUG("LoadLibraryExW failed (%u)", (unsigned int)GetLastError());
+        goto fail0;
+    }
+    
+    LOAD_FUNC(CreateAdapter, "WintunCreateAdapter")
+    LOAD_FUNC(OpenAdapter, "WintunOpenAdapter")
+    LOAD_FUNC(CloseAdapter, "WintunCloseAdapter")
+    LOAD_FUNC(GetAdapterLUID, "WintunGetAdapterLUID")
+    LOAD_FUNC(StartSession, "WintunStartSession")
+    LOAD_FUNC(EndSession, "WintunEndSession")
+    LOAD_FUNC(GetReadWaitEvent, "WintunGetReadWaitEvent")
+    LOAD_FUNC(ReceivePacket, "WintunReceivePacket")
+    LOAD_FUNC(ReleaseReceivePacket, "WintunReleaseReceivePacket")
+    LOAD_FUNC(AllocateSendPacket, "WintunAllocateSendPacket")
+    LOAD_FUNC(SendPacket, "WintunSendPacket")
+    
+    return 1;
+    
+fail1:
+    ASSERT_FORCE(FreeLibrary(api->dll))
+fail0:
+    return 0;
+}
+
+void wintun_unload (struct wintun_api *api)
+{
+    ASSERT_FORCE(FreeLibrary(api->dll))
+}
+
+LPWSTR wintun_adapter_name (const char *name)
+{
+    int len = MultiByteToWideChar(CP_UTF8, 0, name, -1, NULL, 0);
+    if (len <= 0) {
+        return NULL;
+    }
+    
+    LPWSTR wname = (LPWSTR)BAllocArray(len, sizeof(WCHAR));
+    if (!wname) {
+        return NULL;
+    }
+    
+    if (MultiByteToWideChar(CP_UTF8, 0, name, -1, wname, len) != len) {
+        BFree(wname);
+        return NULL;
+    }
+    
+    return wname;
+}
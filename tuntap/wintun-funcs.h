@@ -0,0 +1,67 @@
+/**
+ * @file wintun-funcs.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Runtime loading of the Wintun API from wintun.dll.
+ */
+
+#ifndef BADVPN_TUNTAP_WINTUN_FUNCS_H
+#define BADVPN_TUNTAP_WINTUN_FUNCS_H
+
+#include <windows.h>
+#include <ifdef.h>
+
+// ring capacity of a session; a power of two between 128 KiB and 64 MiB
+#define WINTUN_RING_CAPACITY 0x400000
+
+#define WINTUN_MAX_IP_PACKET_SIZE 0xFFFF
+
+typedef void *WINTUN_ADAPTER_HANDLE;
+typedef void *WINTUN_SESSION_HANDLE;
+
+struct wintun_api {
+    HMODULE dll;
+    WINTUN_ADAPTER_HANDLE (WINAPI *CreateAdapter) (LPCWSTR name, LPCWSTR tunnel_type, const GUID *requested_guid);
+    WINTUN_ADAPTER_HANDLE (WINAPI *OpenAdapter) (LPCWSTR name);
+    void (WINAPI *CloseAdapter) (WINTUN_ADAPTER_HANDLE adapter);
+    void (WINAPI *GetAdapterLUID) (WINTUN_ADAPTER_HANDLE adapter, NET_LUID *luid);
+    WINTUN_SESSION_HANDLE (WINAPI *StartSession) (WINTUN_ADAPTER_HANDLE adapter, DWORD capacity);
+    void (WINAPI *EndSession) (WINTUN_SESSION_HANDLE session);
+    HANDLE (WINAPI *GetReadWaitEvent) (WINTUN_SESSION_HANDLE session);
+    BYTE * (WINAPI *ReceivePacket) (WINTUN_SESSION_HANDLE session, DWORD *packet_size);
+    void (WINAPI *ReleaseReceivePacket) (WINTUN_SESSION_HANDLE session, const BYTE *packet);
+    BYTE * (WINAPI *AllocateSendPacket) (WINTUN_SESSION_HANDLE session, DWORD packet_size);
+    void (WINAPI *SendPacket) (WINTUN_SESSION_HANDLE session, const BYTE *packet);
+};
+
+int wintun_load (struct wintun_api *api);
+void wintun_unload (struct wintun_api *api);
+LPWSTR wintun_adapter_name (const char *name);
+
+#endif
@@ -0,0 +1,582 @@
+/**
+ * @file NCDUdevDbReader.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <misc/balloc.h>
+#include <misc/read_file.h>
+#include <misc/concat_strings.h>
+#include <misc/string_begins_with.h>
+#include <misc/expstring.h>
+#include <base/BLog.h>
+
+#include <udevmonitor/NCDUdevDbReader.h>
+
+#include <generated/blog_channel_NCDUdevDbReader.h>
+
+#define DB_DIR "/run/udev/data/"
+
+// directories listing subsystems, and where the devices are within each subsystem
+static const struct {
+    const char *path;
+    const char *devices;
+} top_dirs[] = {
+    {"/sys/bus", "/devices"},
+    {"/sys/class", ""}
+};
+
+#define NUM_TOP_DIRS ((int)(sizeof(top_dirs) / sizeof(top_dirs[0])))
+
+static int is_dot_entry (const char *name)
+{
+    return (!strcmp(name, ".") || !strcmp(name, ".."));
+}
+
+static int next_line (const uint8_t **data, size_t *len, const char **out_line, size_t *out_len)
+{
+    if (*len == 0) {
+        return 0;
+    }
+    
+    const uint8_t *nl = memchr(*data, '\n', *len);
+    size_t line_len = (nl ? nl - *data : *len);
+    
+    *out_line = (const char *)*data;
+    *out_len = line_len;
+    
+    size_t consumed = (nl ? line_len + 1 : line_len);
+    *data += consumed;
+    *len -= consumed;
+    
+    return 1;
+}
+
+static int add_property_mem (NCDUdevDbReader *o, const char *name, size_t name_len, const char *prefix, const char *value, size_t value_len)
+{
+    size_t prefix_len = strlen(prefix);
+    
+    if (o->ready_num_properties == o->max_properties) {
+        BLog(BLOG_WARNING, "too many properties");
+        return 0;
+    }
+    
+    if (name_len + prefix_len + value_len + 2 > (size_t)(o->buf_size - o->buf_used)) {
+        BLog(BLOG_WARNING, "properties too long");
+        return 0;
+    }
+    
+    struct NCDUdevDbReader_property *prop = &o->ready_properties[o->ready_num_properties];
+    
+    // copy name
+    prop->name = o->buf + o->buf_used;
+    memcpy(prop->name, name, name_len);
+    prop->name[name_len] = '\0';
+    o->buf_used += name_len + 1;
+    
+    // copy value
+    prop->value = o->buf + o->buf_used;
+    memcpy(prop->value, prefix, prefix_len);
+    memcpy(prop->value + prefix_len, value, value_len);
+    prop->value[prefix_len + value_len] = '\0';
+    o->buf_used += prefix_len + value_len + 1;
+    
+    o->ready_num_properties++;
+    
+    return 1;
+}
+
+static int add_property (NCDUdevDbReader *o, const char *name, const char *value)
+{
+    return add_property_mem(o, name, strlen(name), "", value, strlen(value));
+}
+
+static int add_uevent (NCDUdevDbReader *o, const char *syspath, const char **out_major, const char **out_minor, const char **out_ifindex)
+{
+    char *uevent_path = concat_strings(2, syspath, "/uevent");
+    if (!uevent_path) {
+        BLog(BLOG_ERROR, "concat_strings failed");
+        return 0;
+    }
+    
+    uint8_t *file;
+    size_t file_len;
+    int res = read_file(uevent_path, &file, &file_len);
+    free(uevent_path);
+    if (!res) {
+        // not a device, or it went away
+        return 0;
+    }
+    
+    const uint8_t *data = file;
+    size_t len = file_len;
+    const char *line;
+    size_t line_len;
+    
+    while (next_line(&data, &len, &line, &line_len)) {
+        const char *eq = memchr(line, '=', line_len);
+        if (!eq || eq == line) {
+            continue;
+        }
+        
+        size_t name_len = eq - line;
+        const char *value = eq + 1;
+        size_t value_len = line_len - (name_len + 1);
+        
+        // the kernel gives device node names relative to /dev
+        const char *prefix = "";
+        if (name_len == 7 && !memcmp(line, "DEVNAME", 7) && !(value_len > 0 && value[0] == '/')) {
+            prefix = "/dev/";
+        }
+        
+        if (!add_property_mem(o, line, name_len, prefix, value, value_len)) {
+            goto fail;
+        }
+        
+        const char *added = o->ready_properties[o->ready_num_properties - 1].value;
+        
+        if (name_len == 5 && !memcmp(line, "MAJOR", 5)) {
+            *out_major = added;
+        }
+        else if (name_len == 5 && !memcmp(line, "MINOR", 5)) {
+            *out_minor = added;
+        }
+        else if (name_len == 7 && !memcmp(line, "IFINDEX", 7)) {
+            *out_ifindex = added;
+        }
+    }
+    
+    free(file);
+    return 1;
+    
+fail:
+    free(file);
+    return 0;
+}
+
+static int add_db (NCDUdevDbReader *o, const char *id)
+{
+    char *db_path = concat_strings(2, DB_DIR, id);
+    if (!db_path) {
+        BLog(BLOG_ERROR, "concat_strings failed");
+        return 0;
+    }
+    
+    uint8_t *file;
+    size_t file_len;
+    int res = read_file(db_path, &file, &file_len);
+    free(db_path);
+    if (!res) {
+        // not known to udev
+        return 1;
+    }
+    
+    ExpString devlinks;
+    if (!ExpString_Init(&devlinks)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail0;
+    }
+    
+    ExpString tags;
+    if (!ExpString_Init(&tags)) {
+        BLog(BLOG_ERROR, "ExpString_Init failed");
+        goto fail1;
+    }
+    
+    const uint8_t *data = file;
+    size_t len = file_len;
+    const char *line;
+    size_t line_len;
+    
+    while (next_line(&data, &len, &line, &line_len)) {
+        if (line_len < 2 || line[1] != ':') {
+            continue;
+        }
+        
+        const char *value = line + 2;
+        size_t value_len = line_len - 2;
+        
+        switch (line[0]) {
+            case 'E': {
+                const char *eq = memchr(value, '=', value_len);
+                if (!eq || eq == value) {
+                    break;
+                }
+                size_t name_len = eq - value;
+                if (!add_property_mem(o, value, name_len, "", eq + 1, value_len - (name_len + 1))) {
+                    goto fail2;
+                }
+            } break;
+            
+            case 'S': {
+                if ((ExpString_Length(&devlinks) > 0 && !ExpString_AppendChar(&devlinks, ' ')) ||
+                    !ExpString_Append(&devlinks, "/dev/") ||
+                    !ExpString_AppendBinary(&devlinks, (const uint8_t *)value, value_len)
+                ) {
+                    BLog(BLOG_ERROR, "ExpString_Append failed");
+                    goto fail2;
+                }
+            } break;
+            
+            case 'G': {
+                if ((ExpString_Length(&tags) == 0 && !ExpString_AppendChar(&tags, ':')) ||
+                    !ExpString_AppendBinary(&tags, (const uint8_t *)value, value_len) ||
+                    !ExpString_AppendChar(&tags, ':')
+                ) {
+                    BLog(BLOG_ERROR, "ExpString_Append failed");
+                    goto fail2;
+                }
+            } break;
+            
+            case 'I': {
+                if (!add_property_mem(o, "USEC_INITIALIZED", 16, "", value, value_len)) {
+                    goto fail2;
+                }
+            } break;
+        }
+    }
+    
+    if (ExpString_Length(&devlinks) > 0 && !add_property(o, "DEVLINKS", ExpString_Get(&devlinks))) {
+        goto fail2;
+    }
+    
+    if (ExpString_Length(&tags) > 0 && !add_property(o, "TAGS", ExpString_Get(&tags))) {
+        goto fail2;
+    }
+    
+    ExpString_Free(&tags);
+    ExpString_Free(&devlinks);
+    free(file);
+    return 1;
+    
+fail2:
+    ExpString_Free(&tags);
+fail1:
+    ExpString_Free(&devlinks);
+fail0:
+    free(file);
+    return 0;
+}
+
+static int read_device (NCDUdevDbReader *o, const char *path)
+{
+    ASSERT(o->subsys_name)
+    
+    int ret = 0;
+    
+    // reset properties
+    o->buf_used = 0;
+    o->ready_num_properties = 0;
+    
+    // resolve device path
+    char *syspath = realpath(path, NULL);
+    if (!syspath) {
+        BLog(BLOG_DEBUG, "realpath failed for %s", path);
+        goto out0;
+    }
+    if (!string_begins_with(syspath, "/sys/")) {
+        goto out1;
+    }
+    const char *devpath = syspath + 4;
+    const char *sysname = strrchr(syspath, '/') + 1;
+    
+    if (!add_property(o, "DEVPATH", devpath) || !add_property(o, "SUBSYSTEM", o->subsys_name)) {
+        goto out1;
+    }
+    
+    const char *major = NULL;
+    const char *minor = NULL;
+    const char *ifindex = NULL;
+    
+    if (!add_uevent(o, syspath, &major, &minor, &ifindex)) {
+        goto out1;
+    }
+    
+    // build udev database id of the device
+    char *id;
+    if (major && minor) {
+        id = concat_strings(4, (strcmp(o->subsys_name, "block") ? "c" : "b"), major, ":", minor);
+    } else if (ifindex) {
+        id = concat_strings(2, "n", ifindex);
+    } else {
+        id = concat_strings(4, "+", o->subsys_name, ":", sysname);
+    }
+    if (!id) {
+        BLog(BLOG_ERROR, "concat_strings failed");
+        goto out1;
+    }
+    
+    if (!add_db(o, id)) {
+        goto out2;
+    }
+    
+    ret = 1;
+    
+out2:
+    free(id);
+out1:
+    free(syspath);
+out0:
+    if (!ret) {
+        BLog(BLOG_DEBUG, "skipping %s", path);
+    }
+    return ret;
+}
+
+// returns 1 and the path of the next device, 0 when there are no more devices, -1 on error
+static int next_device (NCDUdevDbReader *o, char **out_path)
+{
+    while (1) {
+        if (o->dev_dir) {
+            struct dirent *e = readdir(o->dev_dir);
+            if (e) {
+                if (is_dot_entry(e->d_name)) {
+                    continue;
+                }
+                
+                char *path = concat_strings(6, top_dirs[o->top_index].path, "/", o->subsys_name, top_dirs[o->top_index].devices, "/", e->d_name);
+                if (!path) {
+                    BLog(BLOG_ERROR, "concat_strings failed");
+                    return -1;
+                }
+                
+                *out_path = path;
+                return 1;
+            }
+            
+            // finished subsystem
+            closedir(o->dev_dir);
+            o->dev_dir = NULL;
+            free(o->subsys_name);
+            o->subsys_name = NULL;
+        }
+        
+        if (o->subsys_dir) {
+            struct dirent *e = readdir(o->subsys_dir);
+            if (e) {
+                if (is_dot_entry(e->d_name)) {
+                    continue;
+                }
+                
+                if (!(o->subsys_name = strdup(e->d_name))) {
+                    BLog(BLOG_ERROR, "strdup failed");
+                    return -1;
+                }
+                
+                char *dir_path = concat_strings(4, top_dirs[o->top_index].path, "/", o->subsys_name, top_dirs[o->top_index].devices);
+                if (!dir_path) {
+                    BLog(BLOG_ERROR, "concat_strings failed");
+                    return -1;
+                }
+                
+                // subsystems without devices are fine
+                o->dev_dir = opendir(dir_path);
+                if (!o->dev_dir) {
+                    BLog(BLOG_DEBUG, "opendir failed for %s", dir_path);
+                    free(o->subsys_name);
+                    o->subsys_name = NULL;
+                }
+                
+                free(dir_path);
+                continue;
+            }
+            
+            // finished top directory
+            closedir(o->subsys_dir);
+            o->subsys_dir = NULL;
+            o->top_index++;
+        }
+        
+        if (o->top_index == NUM_TOP_DIRS) {
+            return 0;
+        }
+        
+        if (!(o->subsys_dir = opendir(top_dirs[o->top_index].path))) {
+            BLog(BLOG_ERROR, "opendir failed for %s", top_dirs[o->top_index].path);
+            return -1;
+        }
+    }
+}
+
+static void next_job_handler (NCDUdevDbReader *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    // set not ready
+    o->is_ready = 0;
+    
+    while (1) {
+        char *path;
+        int res = next_device(o, &path);
+        if (res < 0) {
+            DEBUGERROR(&o->d_err, o->handler_finished(o->user, 1));
+            return;
+        }
+        if (res == 0) {
+            BLog(BLOG_INFO, "finished");
+            DEBUGERROR(&o->d_err, o->handler_finished(o->user, 0));
+            return;
+        }
+        
+        int have_device = read_device(o, path);
+        free(path);
+        
+        if (have_device) {
+            break;
+        }
+    }
+    
+    // set ready
+    o->is_ready = 1;
+    
+    // report device
+    o->handler_event(o->user);
+    return;
+}
+
+int NCDUdevDbReader_Init (NCDUdevDbReader *o, BReactor *reactor, int buf_size, int max_properties, void *user,
+                          NCDUdevDbReader_handler_event handler_event,
+                          NCDUdevDbReader_handler_finished handler_finished)
+{
+    ASSERT(buf_size > 0)
+    ASSERT(max_properties >= 0)
+    
+    // init arguments
+    o->buf_size = buf_size;
+    o->max_properties = max_properties;
+    o->user = user;
+    o->handler_event = handler_event;
+    o->handler_finished = handler_finished;
+    
+    // check that sysfs is there, so the caller can fall back to something else
+    if (access(top_dirs[0].path, R_OK | X_OK) < 0) {
+        BLog(BLOG_ERROR, "cannot access %s", top_dirs[0].path);
+        goto fail0;
+    }
+    
+    // allocate buffer
+    if (!(o->buf = BAlloc(buf_size))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    
+    // allocate properties
+    if (!(o->ready_properties = BAllocArray(max_properties, sizeof(o->ready_properties[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
+    // init enumeration
+    o->top_index = 0;
+    o->subsys_dir = NULL;
+    o->dev_dir = NULL;
+    o->subsys_name = NULL;
+    
+    // set not ready
+    o->is_ready = 0;
+    
+    // start reading
+    BPending_Init(&o->next_job, BReactor_PendingGroup(reactor), (BPending_handler)next_job_handler, o);
+    BPending_Set(&o->next_job);
+    
+    DebugError_Init(&o->d_err, BReactor_PendingGroup(reactor));
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail1:
+    BFree(o->buf);
+fail0:
+    return 0;
+}
+
+void NCDUdevDbReader_Free (NCDUdevDbReader *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugError_Free(&o->d_err);
+    
+    // free job
+    BPending_Free(&o->next_job);
+    
+    // free enumeration
+    if (o->dev_dir) {
+        closedir(o->dev_dir);
+    }
+    if (o->subsys_dir) {
+        closedir(o->subsys_dir);
+    }
+    free(o->subsys_name);
+    
+    // free properties
+    BFree(o->ready_properties);
+    
+    // free buffer
+    BFree(o->buf);
+}
+
+void NCDUdevDbReader_AssertReady (NCDUdevDbReader *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+}
+
+void NCDUdevDbReader_Done (NCDUdevDbReader *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    
+    // schedule reading the next device
+    BPending_Set(&o->next_job);
+}
+
+int NCDUdevDbReader_GetNumProperties (NCDUdevDbReader *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    
+    return o->ready_num_properties;
+}
+
+void NCDUdevDbReader_GetProperty (NCDUdevDbReader *o, int index, const char **name, const char **value)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    ASSERT(index >= 0)
+    ASSERT(index < o->ready_num_properties)
+    
+    *name = o->ready_properties[index].name;
+    *value = o->ready_properties[index].value;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file NCDUdevDbReader.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BADVPN_UDEVMONITOR_NCDUDEVDBREADER_H
+#define BADVPN_UDEVMONITOR_NCDUDEVDBREADER_H
+
+#include <dirent.h>
+
+#include <misc/debug.h>
+#include <misc/debugerror.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <system/BReactor.h>
+
+typedef void (*NCDUdevDbReader_handler_event) (void *user);
+typedef void (*NCDUdevDbReader_handler_finished) (void *user, int is_error);
+
+struct NCDUdevDbReader_property {
+    char *name;
+    char *value;
+};
+
+/**
+ * Enumerates devices in sysfs and reports each as an event with the properties
+ * from its uevent file and its entry in the udev database, the same properties
+ * that "udevadm info --export-db" would print. Devices without a database
+ * entry are reported with their sysfs properties only. One device is read per
+ * job, and event data stays valid until the job scheduled by
+ * {@link NCDUdevDbReader_Done} runs. After the last device, the finished
+ * handler is called with is_error=0.
+ */
+typedef struct {
+    int buf_size;
+    int max_properties;
+    void *user;
+    NCDUdevDbReader_handler_event handler_event;
+    NCDUdevDbReader_handler_finished handler_finished;
+    BPending next_job;
+    int top_index;
+    DIR *subsys_dir;
+    DIR *dev_dir;
+    char *subsys_name;
+    char *buf;
+    int buf_used;
+    struct NCDUdevDbReader_property *ready_properties;
+    int ready_num_properties;
+    int is_ready;
+    DebugObject d_obj;
+    DebugError d_err;
+} NCDUdevDbReader;
+
+int NCDUdevDbReader_Init (NCDUdevDbReader *o, BReactor *reactor, int buf_size, int max_properties, void *user,
+                          NCDUdevDbReader_handler_event handler_event,
+                          NCDUdevDbReader_handler_finished handler_finished) WARN_UNUSED;
+void NCDUdevDbReader_Free (NCDUdevDbReader *o);
+void NCDUdevDbReader_AssertReady (NCDUdevDbReader *o);
+void NCDUdevDbReader_Done (NCDUdevDbReader *o);
+int NCDUdevDbReader_GetNumProperties (NCDUdevDbReader *o);
+void NCDUdevDbReader_GetProperty (NCDUdevDbReader *o, int index, const char **name, const char **value);
+
+#endif
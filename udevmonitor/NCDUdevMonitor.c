@@ -39,6 +39,10 @@
 #define PARSER_BUF_SIZE 16384
 #define PARSER_MAX_PROPERTIES 256
 
+#define BACKEND_NETLINK 1
+#define BACKEND_DB 2
+#define BACKEND_PROCESS 3
+
 static void report_error (NCDUdevMonitor *o)
 {
     ASSERT(!o->process_running)
@@ -100,17 +104,69 @@ static void parser_handler (NCDUdevMonitor *o)
     return;
 }
 
-int NCDUdevMonitor_Init (NCDUdevMonitor *o, BReactor *reactor, BProcessManager *manager, int mode, void *user,
-                         NCDUdevMonitor_handler_event handler_event,
-                         NCDUdevMonitor_handler_error handler_error)
+static void netlink_handler_event (NCDUdevMonitor *o)
 {
-    ASSERT(mode == NCDUDEVMONITOR_MODE_MONITOR_UDEV || mode == NCDUDEVMONITOR_MODE_INFO || mode == NCDUDEVMONITOR_MODE_MONITOR_KERNEL)
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->backend == BACKEND_NETLINK)
     
-    // init arguments
-    o->user = user;
-    o->handler_event = handler_event;
-    o->handler_error = handler_error;
+    o->handler_event(o->user);
+    return;
+}
+
+static void netlink_handler_error (NCDUdevMonitor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->backend == BACKEND_NETLINK)
     
+    DEBUGERROR(&o->d_err, o->handler_error(o->user, 1));
+}
+
+static void db_reader_handler_event (NCDUdevMonitor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->backend == BACKEND_DB)
+    
+    o->handler_event(o->user);
+    return;
+}
+
+static void db_reader_handler_finished (NCDUdevMonitor *o, int is_error)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->backend == BACKEND_DB)
+    
+    DEBUGERROR(&o->d_err, o->handler_error(o->user, is_error));
+}
+
+static int init_native (NCDUdevMonitor *o, BReactor *reactor, int mode)
+{
+    if (mode == NCDUDEVMONITOR_MODE_INFO) {
+        if (!NCDUdevDbReader_Init(&o->db_reader, reactor, PARSER_BUF_SIZE, PARSER_MAX_PROPERTIES, o,
+                                  (NCDUdevDbReader_handler_event)db_reader_handler_event,
+                                  (NCDUdevDbReader_handler_finished)db_reader_handler_finished
+        )) {
+            return 0;
+        }
+        
+        o->backend = BACKEND_DB;
+        return 1;
+    }
+    
+    int group = (mode == NCDUDEVMONITOR_MODE_MONITOR_KERNEL ? NCDUDEVNETLINKMONITOR_GROUP_KERNEL : NCDUDEVNETLINKMONITOR_GROUP_UDEV);
+    
+    if (!NCDUdevNetlinkMonitor_Init(&o->netlink, reactor, group, PARSER_BUF_SIZE, PARSER_MAX_PROPERTIES, o,
+                                    (NCDUdevNetlinkMonitor_handler_event)netlink_handler_event,
+                                    (NCDUdevNetlinkMonitor_handler_error)netlink_handler_error
+    )) {
+        return 0;
+    }
+    
+    o->backend = BACKEND_NETLINK;
+    return 1;
+}
+
+static int init_process (NCDUdevMonitor *o, BReactor *reactor, BProcessManager *manager, int mode)
+{
     // find programs
     char *stdbuf_exec = badvpn_find_program("stdbuf");
     char *udevadm_exec = badvpn_find_program("udevadm");
@@ -172,8 +228,7 @@ int NCDUdevMonitor_Init (NCDUdevMonitor *o, BReactor *reactor, BProcessManager *
     free(udevadm_exec);
     free(stdbuf_exec);
     
-    DebugError_Init(&o->d_err, BReactor_PendingGroup(reactor));
-    DebugObject_Init(&o->d_obj);
+    o->backend = BACKEND_PROCESS;
     return 1;
     
 fail2:
@@ -187,11 +242,46 @@ fail0:
     return 0;
 }
 
+int NCDUdevMonitor_Init (NCDUdevMonitor *o, BReactor *reactor, BProcessManager *manager, int mode, void *user,
+                         NCDUdevMonitor_handler_event handler_event,
+                         NCDUdevMonitor_handler_error handler_error)
+{
+    ASSERT(mode == NCDUDEVMONITOR_MODE_MONITOR_UDEV || mode == NCDUDEVMONITOR_MODE_INFO || mode == NCDUDEVMONITOR_MODE_MONITOR_KERNEL)
+    
+    // init arguments
+    o->user = user;
+    o->handler_event = handler_event;
+    o->handler_error = handler_error;
+    
+    // read netlink and the udev database directly, falling back to udevadm
+    // where that is not possible (e.g. no netlink access or no sysfs)
+    if (!init_native(o, reactor, mode)) {
+        BLog(BLOG_WARNING, "native backend unavailable, using udevadm");
+        
+        if (!init_process(o, reactor, manager, mode)) {
+            return 0;
+        }
+    }
+    
+    DebugError_Init(&o->d_err, BReactor_PendingGroup(reactor));
+    DebugObject_Init(&o->d_obj);
+    return 1;
+}
+
 void NCDUdevMonitor_Free (NCDUdevMonitor *o)
 {
     DebugObject_Free(&o->d_obj);
     DebugError_Free(&o->d_err);
     
+    switch (o->backend) {
+        case BACKEND_NETLINK:
+            NCDUdevNetlinkMonitor_Free(&o->netlink);
+            return;
+        case BACKEND_DB:
+            NCDUdevDbReader_Free(&o->db_reader);
+            return;
+    }
+    
     // free parser
     NCDUdevMonitorParser_Free(&o->parser);
     
@@ -209,42 +299,80 @@ void NCDUdevMonitor_Free (NCDUdevMonitor *o)
 
 void NCDUdevMonitor_Done (NCDUdevMonitor *o)
 {
-    DebugObject_Access(&o->d_obj);
-    DebugError_AssertNoError(&o->d_err);
-    NCDUdevMonitorParser_AssertReady(&o->parser);
+    NCDUdevMonitor_AssertReady(o);
     
-    NCDUdevMonitorParser_Done(&o->parser);
+    switch (o->backend) {
+        case BACKEND_NETLINK:
+            NCDUdevNetlinkMonitor_Done(&o->netlink);
+            break;
+        case BACKEND_DB:
+            NCDUdevDbReader_Done(&o->db_reader);
+            break;
+        default:
+            NCDUdevMonitorParser_Done(&o->parser);
+            break;
+    }
 }
 
 int NCDUdevMonitor_IsReadyEvent (NCDUdevMonitor *o)
 {
-    DebugObject_Access(&o->d_obj);
-    DebugError_AssertNoError(&o->d_err);
-    NCDUdevMonitorParser_AssertReady(&o->parser);
+    NCDUdevMonitor_AssertReady(o);
     
-    return NCDUdevMonitorParser_IsReadyEvent(&o->parser);
+    switch (o->backend) {
+        case BACKEND_NETLINK:
+            return NCDUdevNetlinkMonitor_IsReadyEvent(&o->netlink);
+        case BACKEND_DB:
+            return 0;
+        default:
+            return NCDUdevMonitorParser_IsReadyEvent(&o->parser);
+    }
 }
+
 void NCDUdevMonitor_AssertReady (NCDUdevMonitor *o)
 {
     DebugObject_Access(&o->d_obj);
     DebugError_AssertNoError(&o->d_err);
-    NCDUdevMonitorParser_AssertReady(&o->parser);
+    
+    switch (o->backend) {
+        case BACKEND_NETLINK:
+            NCDUdevNetlinkMonitor_AssertReady(&o->netlink);
+            break;
+        case BACKEND_DB:
+            NCDUdevDbReader_AssertReady(&o->db_reader);
+            break;
+        default:
+            NCDUdevMonitorParser_AssertReady(&o->parser);
+            break;
+    }
 }
 
 int NCDUdevMonitor_GetNumProperties (NCDUdevMonitor *o)
 {
-    DebugObject_Access(&o->d_obj);
-    DebugError_AssertNoError(&o->d_err);
-    NCDUdevMonitorParser_AssertReady(&o->parser);
+    NCDUdevMonitor_AssertReady(o);
     
-    return NCDUdevMonitorParser_GetNumProperties(&o->parser);
+    switch (o->backend) {
+        case BACKEND_NETLINK:
+            return NCDUdevNetlinkMonitor_GetNumProperties(&o->netlink);
+        case BACKEND_DB:
+            return NCDUdevDbReader_GetNumProperties(&o->db_reader);
+        default:
+            return NCDUdevMonitorParser_GetNumProperties(&o->parser);
+    }
 }
 
 void NCDUdevMonitor_GetProperty (NCDUdevMonitor *o, int index, const char **name, const char **value)
 {
-    DebugObject_Access(&o->d_obj);
-    DebugError_AssertNoError(&o->d_err);
-    NCDUdevMonitorParser_AssertReady(&o->parser);
+    NCDUdevMonitor_AssertReady(o);
     
-    NCDUdevMonitorParser_GetProperty(&o->parser, index, name, value);
+    switch (o->backend) {
+        case BACKEND_NETLINK:
+            NCDUdevNetlinkMonitor_GetProperty(&o->netlink, index, name, value);
+            break;
+        case BACKEND_DB:
+            NCDUdevDbReader_GetProperty(&o->db_reader, index, name, value);
+            break;
+        default:
+            NCDUdevMonitorParser_GetProperty(&o->parser, index, name, value);
+            break;
+    }
 }
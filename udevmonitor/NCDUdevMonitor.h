@@ -35,6 +35,8 @@
 #include <flow/StreamRecvConnector.h>
 #include <system/BInputProcess.h>
 #include <udevmonitor/NCDUdevMonitorParser.h>
+#include <udevmonitor/NCDUdevNetlinkMonitor.h>
+#include <udevmonitor/NCDUdevDbReader.h>
 
 #define NCDUDEVMONITOR_MODE_MONITOR_UDEV 0
 #define NCDUDEVMONITOR_MODE_INFO 1
@@ -47,6 +49,9 @@ typedef struct {
     void *user;
     NCDUdevMonitor_handler_event handler_event;
     NCDUdevMonitor_handler_error handler_error;
+    int backend;
+    NCDUdevNetlinkMonitor netlink;
+    NCDUdevDbReader db_reader;
     BInputProcess process;
     int process_running;
     int process_was_error;
@@ -42,17 +42,31 @@
 
 static uint8_t * find_end (uint8_t *buf, size_t len)
 {
-    while (len >= 2) {
-        if (buf[0] == '\n' && buf[1] == '\n') {
-            return (buf + 2);
+    uint8_t *end = buf + len;
+    
+    while (buf < end) {
+        uint8_t *nl = (uint8_t *)memchr(buf, '\n', end - buf);
+        if (!nl || end - nl < 2) {
+            break;
+        }
+        if (nl[1] == '\n') {
+            return (nl + 2);
         }
-        buf++;
-        len--;
+        buf = nl + 1;
     }
     
     return NULL;
 }
 
+static void consume_message (NCDUdevMonitorParser *o)
+{
+    ASSERT(o->ready_len <= o->buf_used - o->buf_start)
+    
+    // the message is skipped rather than shifted out of the buffer
+    o->buf_start += o->ready_len;
+    o->buf_scanned = o->buf_start;
+}
+
 static int parse_property (NCDUdevMonitorParser *o, char *data)
 {
     ASSERT(o->ready_num_properties >= 0)
@@ -87,14 +101,16 @@ static int parse_message (NCDUdevMonitorParser *o)
 {
     ASSERT(!o->is_ready)
     ASSERT(o->ready_len >= 2)
-    ASSERT(o->buf[o->ready_len - 2] == '\n')
-    ASSERT(o->buf[o->ready_len - 1] == '\n')
+    
+    uint8_t *msg = o->buf + o->buf_start;
+    ASSERT(msg[o->ready_len - 2] == '\n')
+    ASSERT(msg[o->ready_len - 1] == '\n')
     
     // zero terminate message (replacing the second newline)
-    o->buf[o->ready_len - 1] = '\0';
+    msg[o->ready_len - 1] = '\0';
     
     // start parsing
-    char *line = (char *)o->buf;
+    char *line = (char *)msg;
     int first_line = 1;
     
     // set is not ready event
@@ -173,13 +189,26 @@ static void process_data (NCDUdevMonitorParser *o)
     ASSERT(!o->is_ready)
     
     while (1) {
-        // look for end of event
-        uint8_t *c = find_end(o->buf, o->buf_used);
+        // look for end of event, past what has already been scanned
+        uint8_t *c = find_end(o->buf + o->buf_scanned, o->buf_used - o->buf_scanned);
         if (!c) {
+            // the last byte may be the first newline of the end
+            o->buf_scanned = (o->buf_used - 1 > o->buf_start ? o->buf_used - 1 : o->buf_start);
+            
+            // move the partial event to the start of the buffer; this is
+            // done once per read rather than once per event
+            if (o->buf_start > 0) {
+                memmove(o->buf, o->buf + o->buf_start, o->buf_used - o->buf_start);
+                o->buf_used -= o->buf_start;
+                o->buf_scanned -= o->buf_start;
+                o->buf_start = 0;
+            }
+            
             // check for out of buffer condition
             if (o->buf_used == o->buf_size) {
                 BLog(BLOG_ERROR, "out of buffer");
                 o->buf_used = 0;
+                o->buf_scanned = 0;
             }
             
             // receive more data
@@ -188,16 +217,15 @@ static void process_data (NCDUdevMonitorParser *o)
         }
         
         // remember message length
-        o->ready_len = c - o->buf;
+        o->ready_len = c - (o->buf + o->buf_start);
         
         // parse message
         if (parse_message(o)) {
             break;
         }
         
-        // shift buffer
-        memmove(o->buf, o->buf + o->ready_len, o->buf_used - o->ready_len);
-        o->buf_used -= o->ready_len;
+        // skip message
+        consume_message(o);
     }
     
     // call handler
@@ -225,9 +253,8 @@ static void done_job_handler (NCDUdevMonitorParser *o)
     DebugObject_Access(&o->d_obj);
     ASSERT(o->is_ready)
     
-    // shift buffer
-    memmove(o->buf, o->buf + o->ready_len, o->buf_used - o->ready_len);
-    o->buf_used -= o->ready_len;
+    // skip message
+    consume_message(o);
     
     // set not ready
     o->is_ready = 0;
@@ -272,6 +299,8 @@ int NCDUdevMonitorParser_Init (NCDUdevMonitorParser *o, StreamRecvInterface *inp
     }
     
     // set buffer position
+    o->buf_start = 0;
+    o->buf_scanned = 0;
     o->buf_used = 0;
     
     // set not ready
@@ -54,6 +54,8 @@ typedef struct {
     regex_t property_regex;
     BPending done_job;
     uint8_t *buf;
+    int buf_start;
+    int buf_scanned;
     int buf_used;
     int is_ready;
     int ready_len;
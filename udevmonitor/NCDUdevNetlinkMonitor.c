@@ -0,0 +1,453 @@
+/**
+ * @file NCDUdevNetlinkMonitor.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+
+#include <misc/balloc.h>
+#include <misc/nonblocking.h>
+#include <base/BLog.h>
+
+#include <udevmonitor/NCDUdevNetlinkMonitor.h>
+
+#include <generated/blog_channel_NCDUdevNetlinkMonitor.h>
+
+#define RCVBUF_SIZE (16 * 1024 * 1024)
+
+#define UDEV_MONITOR_MAGIC 0xfeedcafe
+
+// header prepended by udevd to messages it rebroadcasts
+struct udev_monitor_netlink_header {
+    char prefix[8];
+    uint32_t magic;
+    uint32_t header_size;
+    uint32_t properties_off;
+    uint32_t properties_len;
+    uint32_t filter_subsystem_hash;
+    uint32_t filter_devtype_hash;
+    uint32_t filter_tag_bloom_hi;
+    uint32_t filter_tag_bloom_lo;
+};
+
+static void report_error (NCDUdevNetlinkMonitor *o)
+{
+    // stop receiving
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, 0);
+    
+    DEBUGERROR(&o->d_err, o->handler_error(o->user));
+}
+
+static int parse_properties (NCDUdevNetlinkMonitor *o, char *data, size_t len)
+{
+    o->ready_num_properties = 0;
+    
+    char *end = data + len;
+    
+    while (data < end) {
+        // find end of entry
+        char *entry_end = memchr(data, '\0', end - data);
+        if (!entry_end) {
+            BLog(BLOG_WARNING, "unterminated property");
+            return 0;
+        }
+        
+        // split into name and value, skipping entries which are not properties
+        char *eq = strchr(data, '=');
+        if (eq && eq != data) {
+            if (o->ready_num_properties == o->max_properties) {
+                BLog(BLOG_WARNING, "too many properties");
+                return 0;
+            }
+            
+            *eq = '\0';
+            
+            struct NCDUdevNetlinkMonitor_property *prop = &o->ready_properties[o->ready_num_properties];
+            prop->name = data;
+            prop->value = eq + 1;
+            o->ready_num_properties++;
+            
+            // the kernel gives device node names relative to /dev, udev makes them absolute
+            if (!strcmp(prop->name, "DEVNAME") && prop->value[0] != '/') {
+                strcpy(o->devname_buf, "/dev/");
+                strcat(o->devname_buf, prop->value);
+                prop->value = o->devname_buf;
+            }
+        }
+        
+        data = entry_end + 1;
+    }
+    
+    return 1;
+}
+
+static int parse_message (NCDUdevNetlinkMonitor *o, size_t len)
+{
+    ASSERT(len < (size_t)o->buf_size)
+    
+    // zero terminate, so that a truncated last entry is still a string
+    o->buf[len] = '\0';
+    
+    if (o->group == NCDUDEVNETLINKMONITOR_GROUP_UDEV) {
+        struct udev_monitor_netlink_header header;
+        if (len < sizeof(header)) {
+            BLog(BLOG_WARNING, "message too short");
+            return 0;
+        }
+        memcpy(&header, o->buf, sizeof(header));
+        
+        if (memcmp(header.prefix, "libudev", 8) || ntohl(header.magic) != UDEV_MONITOR_MAGIC) {
+            BLog(BLOG_WARNING, "bad message header");
+            return 0;
+        }
+        
+        if (header.properties_off < sizeof(header) || header.properties_off > len ||
+            header.properties_len > len - header.properties_off) {
+            BLog(BLOG_WARNING, "bad properties location");
+            return 0;
+        }
+        
+        return parse_properties(o, o->buf + header.properties_off, header.properties_len);
+    }
+    
+    // kernel messages start with action@devpath, which is repeated in the properties
+    size_t head_len = strlen(o->buf);
+    if (head_len == len || !memchr(o->buf, '@', head_len)) {
+        BLog(BLOG_WARNING, "bad kernel message");
+        return 0;
+    }
+    
+    return parse_properties(o, o->buf + head_len + 1, len - (head_len + 1));
+}
+
+static void fd_handler (NCDUdevNetlinkMonitor *o, int events)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->is_ready)
+    
+    while (1) {
+        struct sockaddr_nl addr;
+        struct iovec iov;
+        struct msghdr msg;
+        union {
+            struct cmsghdr cmsg;
+            uint8_t data[CMSG_SPACE(sizeof(struct ucred))];
+        } control;
+        
+        // leave space for zero termination
+        iov.iov_base = o->buf;
+        iov.iov_len = o->buf_size - 1;
+        
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &addr;
+        msg.msg_namelen = sizeof(addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control;
+        msg.msg_controllen = sizeof(control);
+        
+        ssize_t res = recvmsg(o->fd, &msg, 0);
+        if (res < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS) {
+                // events were lost, the cache has to be rebuilt
+                BLog(BLOG_ERROR, "receive buffer overrun");
+            } else {
+                BLog(BLOG_ERROR, "recvmsg failed");
+            }
+            report_error(o);
+            return;
+        }
+        
+        if ((msg.msg_flags & MSG_TRUNC)) {
+            BLog(BLOG_WARNING, "message truncated, dropping");
+            continue;
+        }
+        
+        // check sender; kernel messages must come from the kernel itself
+        if (msg.msg_namelen < sizeof(addr) || addr.nl_groups != (1 << (o->group - 1)) ||
+            (o->group == NCDUDEVNETLINKMONITOR_GROUP_KERNEL && addr.nl_pid != 0)) {
+            BLog(BLOG_WARNING, "message from unexpected sender, dropping");
+            continue;
+        }
+        
+        // check credentials; only root may send uevents
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_CREDENTIALS ||
+            cmsg->cmsg_len < CMSG_LEN(sizeof(struct ucred))) {
+            BLog(BLOG_WARNING, "message without credentials, dropping");
+            continue;
+        }
+        struct ucred cred;
+        memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+        if (cred.uid != 0) {
+            BLog(BLOG_WARNING, "message from non-root sender, dropping");
+            continue;
+        }
+        
+        if (!parse_message(o, res)) {
+            continue;
+        }
+        
+        break;
+    }
+    
+    // stop receiving until the event is done
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, 0);
+    
+    // set ready
+    o->is_ready = 1;
+    o->ready_is_ready_event = 0;
+    
+    // report event
+    o->handler_event(o->user);
+    return;
+}
+
+static void ready_job_handler (NCDUdevNetlinkMonitor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->is_ready)
+    
+    // set ready
+    o->is_ready = 1;
+    o->ready_is_ready_event = 1;
+    o->ready_num_properties = 0;
+    
+    // report ready event
+    o->handler_event(o->user);
+    return;
+}
+
+static void done_job_handler (NCDUdevNetlinkMonitor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->is_ready)
+    
+    // set not ready
+    o->is_ready = 0;
+    
+    // continue receiving
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, BREACTOR_READ);
+}
+
+int NCDUdevNetlinkMonitor_Init (NCDUdevNetlinkMonitor *o, BReactor *reactor, int group, int buf_size, int max_properties, void *user,
+                                NCDUdevNetlinkMonitor_handler_event handler_event,
+                                NCDUdevNetlinkMonitor_handler_error handler_error)
+{
+    ASSERT(group == NCDUDEVNETLINKMONITOR_GROUP_KERNEL || group == NCDUDEVNETLINKMONITOR_GROUP_UDEV)
+    ASSERT(buf_size > 1)
+    ASSERT(max_properties >= 0)
+    
+    // init arguments
+    o->reactor = reactor;
+    o->group = group;
+    o->buf_size = buf_size;
+    o->max_properties = max_properties;
+    o->user = user;
+    o->handler_event = handler_event;
+    o->handler_error = handler_error;
+    
+    // allocate buffer
+    if (!(o->buf = BAlloc(buf_size))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail0;
+    }
+    
+    // allocate properties
+    if (!(o->ready_properties = BAllocArray(max_properties, sizeof(o->ready_properties[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    
+    // allocate buffer for an absolute DEVNAME, which is no longer than the message
+    if (!(o->devname_buf = BAlloc(buf_size + 5))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail1a;
+    }
+    
+    // create socket
+    if ((o->fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT)) < 0) {
+        BLog(BLOG_ERROR, "socket failed");
+        goto fail2;
+    }
+    
+    // set non-blocking
+    if (!badvpn_set_nonblocking(o->fd)) {
+        BLog(BLOG_ERROR, "badvpn_set_nonblocking failed");
+        goto fail3;
+    }
+    
+    // enlarge receive buffer, so that event bursts (e.g. coldplug) are not lost;
+    // forcing needs CAP_NET_ADMIN, otherwise we get what rmem_max allows
+    int rcvbuf = RCVBUF_SIZE;
+    if (setsockopt(o->fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0 &&
+        setsockopt(o->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+        BLog(BLOG_WARNING, "failed to set receive buffer size");
+    }
+    
+    // receive sender credentials
+    int one = 1;
+    if (setsockopt(o->fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) < 0) {
+        BLog(BLOG_ERROR, "setsockopt(SO_PASSCRED) failed");
+        goto fail3;
+    }
+    
+    // bind to multicast group
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = (1 << (group - 1));
+    if (bind(o->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        BLog(BLOG_ERROR, "bind failed");
+        goto fail3;
+    }
+    
+    // register with reactor; receiving starts after the ready event is done
+    BFileDescriptor_Init(&o->bfd, o->fd, (BFileDescriptor_handler)fd_handler, o);
+    if (!BReactor_AddFileDescriptor(o->reactor, &o->bfd)) {
+        BLog(BLOG_ERROR, "BReactor_AddFileDescriptor failed");
+        goto fail3;
+    }
+    
+    // init jobs
+    BPending_Init(&o->ready_job, BReactor_PendingGroup(o->reactor), (BPending_handler)ready_job_handler, o);
+    BPending_Init(&o->done_job, BReactor_PendingGroup(o->reactor), (BPending_handler)done_job_handler, o);
+    
+    // set not ready
+    o->is_ready = 0;
+    
+    // report ready event once we're listening
+    BPending_Set(&o->ready_job);
+    
+    DebugError_Init(&o->d_err, BReactor_PendingGroup(o->reactor));
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail3:
+    if (close(o->fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+fail2:
+    BFree(o->devname_buf);
+fail1a:
+    BFree(o->ready_properties);
+fail1:
+    BFree(o->buf);
+fail0:
+    return 0;
+}
+
+void NCDUdevNetlinkMonitor_Free (NCDUdevNetlinkMonitor *o)
+{
+    DebugObject_Free(&o->d_obj);
+    DebugError_Free(&o->d_err);
+    
+    // free jobs
+    BPending_Free(&o->done_job);
+    BPending_Free(&o->ready_job);
+    
+    // free socket
+    BReactor_RemoveFileDescriptor(o->reactor, &o->bfd);
+    if (close(o->fd) < 0) {
+        BLog(BLOG_ERROR, "close failed");
+    }
+    
+    // free DEVNAME buffer
+    BFree(o->devname_buf);
+    
+    // free properties
+    BFree(o->ready_properties);
+    
+    // free buffer
+    BFree(o->buf);
+}
+
+void NCDUdevNetlinkMonitor_AssertReady (NCDUdevNetlinkMonitor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+}
+
+void NCDUdevNetlinkMonitor_Done (NCDUdevNetlinkMonitor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    
+    // schedule done job
+    BPending_Set(&o->done_job);
+}
+
+int NCDUdevNetlinkMonitor_IsReadyEvent (NCDUdevNetlinkMonitor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    
+    return o->ready_is_ready_event;
+}
+
+int NCDUdevNetlinkMonitor_GetNumProperties (NCDUdevNetlinkMonitor *o)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    
+    return o->ready_num_properties;
+}
+
+void NCDUdevNetlinkMonitor_GetProperty (NCDUdevNetlinkMonitor *o, int index, const char **name, const char **value)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->is_ready)
+    ASSERT(index >= 0)
+    ASSERT(index < o->ready_num_properties)
+    
+    *name = o->ready_properties[index].name;
+    *value = o->ready_properties[index].value;
+}
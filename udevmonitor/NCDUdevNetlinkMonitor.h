@@ -0,0 +1,90 @@
+/**
+ * @file NCDUdevNetlinkMonitor.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BADVPN_UDEVMONITOR_NCDUDEVNETLINKMONITOR_H
+#define BADVPN_UDEVMONITOR_NCDUDEVNETLINKMONITOR_H
+
+#include <misc/debug.h>
+#include <misc/debugerror.h>
+#include <base/DebugObject.h>
+#include <base/BPending.h>
+#include <system/BReactor.h>
+
+#define NCDUDEVNETLINKMONITOR_GROUP_KERNEL 1
+#define NCDUDEVNETLINKMONITOR_GROUP_UDEV 2
+
+typedef void (*NCDUdevNetlinkMonitor_handler_event) (void *user);
+typedef void (*NCDUdevNetlinkMonitor_handler_error) (void *user);
+
+struct NCDUdevNetlinkMonitor_property {
+    char *name;
+    char *value;
+};
+
+/**
+ * Receives uevents directly from a NETLINK_KOBJECT_UEVENT socket, either as
+ * broadcast by the kernel or as rebroadcast by udevd after processing.
+ * Presents the same event interface as {@link NCDUdevMonitorParser}: the first
+ * event is a ready event, reported once the socket is bound, and every
+ * following event carries the properties of one uevent. Event data stays
+ * valid until the job scheduled by {@link NCDUdevNetlinkMonitor_Done} runs.
+ */
+typedef struct {
+    BReactor *reactor;
+    int group;
+    int buf_size;
+    int max_properties;
+    void *user;
+    NCDUdevNetlinkMonitor_handler_event handler_event;
+    NCDUdevNetlinkMonitor_handler_error handler_error;
+    int fd;
+    BFileDescriptor bfd;
+    BPending ready_job;
+    BPending done_job;
+    char *buf;
+    char *devname_buf;
+    struct NCDUdevNetlinkMonitor_property *ready_properties;
+    int is_ready;
+    int ready_is_ready_event;
+    int ready_num_properties;
+    DebugObject d_obj;
+    DebugError d_err;
+} NCDUdevNetlinkMonitor;
+
+int NCDUdevNetlinkMonitor_Init (NCDUdevNetlinkMonitor *o, BReactor *reactor, int group, int buf_size, int max_properties, void *user,
+                                NCDUdevNetlinkMonitor_handler_event handler_event,
+                                NCDUdevNetlinkMonitor_handler_error handler_error) WARN_UNUSED;
+void NCDUdevNetlinkMonitor_Free (NCDUdevNetlinkMonitor *o);
+void NCDUdevNetlinkMonitor_AssertReady (NCDUdevNetlinkMonitor *o);
+void NCDUdevNetlinkMonitor_Done (NCDUdevNetlinkMonitor *o);
+int NCDUdevNetlinkMonitor_IsReadyEvent (NCDUdevNetlinkMonitor *o);
+int NCDUdevNetlinkMonitor_GetNumProperties (NCDUdevNetlinkMonitor *o);
+void NCDUdevNetlinkMonitor_GetProperty (NCDUdevNetlinkMonitor *o, int index, const char **name, const char **value);
+
+#endif
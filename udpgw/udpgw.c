@@ -44,32 +44,56 @@
 #include <misc/balloc.h>
 #include <misc/compare.h>
 #include <misc/print_macros.h>
+#include <misc/hashfun.h>
+#include <misc/bslab.h>
 #include <structure/LinkedList1.h>
 #include <structure/BAVL.h>
+#include <structure/CHash.h>
 #include <base/BLog.h>
+#include <base/BMetrics.h>
 #include <system/BReactor.h>
 #include <system/BNetwork.h>
 #include <system/BConnection.h>
 #include <system/BDatagram.h>
 #include <system/BSignal.h>
+#include <system/BCpuSet.h>
 #include <flow/PacketProtoDecoder.h>
 #include <flow/PacketPassFairQueue.h>
 #include <flow/PacketStreamSender.h>
 #include <flow/PacketProtoFlow.h>
-#include <flow/SinglePacketBuffer.h>
+#include <flowextra/PacketPassRateLimiter.h>
+#include <flowextra/StatsServer.h>
+#include <dnscache/DnsCache.h>
+
+#ifdef BADVPN_UDPGW_DGRAM
+#include <misc/packed.h>
+#include <security/BRandom.h>
+#include <udpgw_dgram/UdpGwDgram.h>
+#endif
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
+#include <base/BLog_async.h>
+#include <base/BLog_trace.h>
 #include <arpa/nameser.h>
 #include <resolv.h>
 #endif
 
+#ifdef BADVPN_LINUX
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
 #include <udpgw/udpgw.h>
 
 #include <generated/blog_channel_udpgw.h>
 
 #define LOGGER_STDOUT 1
 #define LOGGER_SYSLOG 2
+#define LOGGER_TRACE 3
 
 #define DNS_UPDATE_TIME 2000
 
@@ -79,36 +103,62 @@ struct client {
     BTimer disconnect_timer;
     PacketProtoDecoder recv_decoder;
     PacketPassInterface recv_if;
+    PacketPassRateLimiter recv_limiter;
     PacketPassFairQueue send_queue;
+    PacketPassRateLimiter send_limiter;
     PacketStreamSender send_sender;
+    uint64_t num_packets_from;
+    uint64_t num_bytes_from;
+    uint64_t num_packets_to;
+    uint64_t num_bytes_to;
+    uint64_t num_dropped_to;
     BAVL connections_tree;
     LinkedList1 connections_list;
     int num_connections;
     LinkedList1 closing_connections_list;
     LinkedList1Node clients_list_node;
+    uint64_t id;
+    BAVLNode clients_tree_node;
+    PacketPassFairQueueFlow dns_qflow;
+    PacketProtoFlow dns_ppflow;
+    #ifdef BADVPN_UDPGW_DGRAM
+    int have_dgram;
+    uint32_t dgram_session_id;
+    BAVLNode dgram_sessions_tree_node;
+    UdpGwDgram dgram;
+    PacketPassInterface dgram_send_if;
+    PacketPassInterface dgram_recv_if;
+    BAddr dgram_addr;
+    btime_t dgram_last_recv;
+    int dgram_send_waiting;
+    const uint8_t *dgram_send_data;
+    int dgram_send_len;
+    LinkedList1Node dgram_send_waiting_list_node;
+    PacketPassFairQueueFlow dgram_offer_qflow;
+    struct dgram_offer_packet *dgram_offer;
+    #endif
+};
+
+struct remote_ports {
+    BAddr key;
+    size_t key_hash;
+    LinkedList1 connections_list;
+    int next_port_index;
+    int *free_ports;
+    int free_ports_capacity;
+    int num_free_ports;
+    struct remote_ports *hash_next;
 };
 
+#include "udpgw_hash.h"
+#include <structure/CHash_decl.h>
+
 struct connection {
-    struct client *client;
-    uint16_t conid;
-    BAddr addr;
-    BAddr orig_addr;
-    const uint8_t *first_data;
-    int first_data_len;
-    btime_t last_use_time;
-    int closing;
-    BPending first_job;
-    BufferWriter *send_if;
-    PacketProtoFlow send_ppflow;
-    PacketPassFairQueueFlow send_qflow;
+    // Fields used for every packet come first, so that a packet touches few
+    // cache lines of its connection. The tree lookup by conid also reads the
+    // tree node and conid of other connections, so those are at the front.
     union {
         struct {
-            BDatagram udp_dgram;
-            int local_port_index;
-            BufferWriter udp_send_writer;
-            PacketBuffer udp_send_buffer;
-            SinglePacketBuffer udp_recv_buffer;
-            PacketPassInterface udp_recv_if;
             BAVLNode connections_tree_node;
             LinkedList1Node connections_list_node;
         };
@@ -116,8 +166,51 @@ struct connection {
             LinkedList1Node closing_connections_list_node;
         };
     };
+    uint16_t conid;
+    int closing;
+    struct client *client;
+    BAddr orig_addr;
+    int dns;
+    btime_t last_use_time;
+    int local_port_index;
+    struct remote_ports *remote_ports;
+    LinkedList1Node remote_ports_list_node;
+    BufferWriter *send_if;
+    uint8_t *udp_recv_out;
+    LinkedList1 udp_send_queue;
+    int udp_send_queue_bytes;
+    // Fields used when the connection is set up or torn down, and the
+    // flow objects, which keep their own hot state.
+    BAddr addr;
+    const uint8_t *first_data;
+    int first_data_len;
+    BPending first_job;
+    PacketProtoFlow send_ppflow;
+    PacketPassFairQueueFlow send_qflow;
+    BDatagram udp_dgram;
+};
+
+// Datagram from a client waiting to be sent to UDP. These come from slabs
+// shared by all connections, so memory for them is only in use while there
+// is traffic.
+struct udp_send_packet {
+    LinkedList1Node queue_node;
+    BSlab *slab;
+    int len;
+    uint8_t data[];
 };
 
+#ifdef BADVPN_UDPGW_DGRAM
+// offer of the datagram transport, as sent to a client
+B_START_PACKED
+struct dgram_offer_packet {
+    struct packetproto_header pp;
+    struct udpgw_header udpgw;
+    struct udpgw_dgram_offer offer;
+} B_PACKED;
+B_END_PACKED
+#endif
+
 // command-line options
 struct {
     int help;
@@ -126,6 +219,9 @@ struct {
     #ifndef BADVPN_USE_WINAPI
     char *logger_syslog_facility;
     char *logger_syslog_ident;
+    int logger_async;
+    char *logger_trace_file;
+    int logger_trace_size;
     #endif
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
@@ -135,11 +231,30 @@ struct {
     int max_clients;
     int max_connections_for_client;
     int client_socket_sndbuf;
+    struct BConnection_options client_socket_options;
+    int client_send_coalesce;
+    int client_recv_buffer;
+    int client_rate;
+    int client_burst;
     int local_udp_num_ports;
     char *local_udp_addr;
     int local_udp_ip6_num_ports;
     char *local_udp_ip6_addr;
     int unique_local_ports;
+    int udp_batch;
+    int dns_cache_size;
+    #ifdef BADVPN_UDPGW_DGRAM
+    char *dgram_listen_addr;
+    #endif
+    char *stats_listen_addr;
+    #ifndef BADVPN_USE_WINAPI
+    char *stats_listen_unix;
+    #endif
+    #ifdef BADVPN_LINUX
+    int workers;
+    BCpuSet cpu_affinity;
+    BCpuSet worker_cpus;
+    #endif
 } options;
 
 // MTUs
@@ -156,10 +271,25 @@ BAddr local_udp_addr;
 // local UDP/IPv6 port range, if options.local_udp_ip6_num_ports>=0
 BAddr local_udp_ip6_addr;
 
+// local port usage for each remote address (or IP with options.unique_local_ports)
+RemotePortsHash remote_ports_hash;
+int num_remote_ports;
+
 // DNS forwarding
 BAddr dns_addr;
 btime_t last_dns_update_time;
 
+// DNS cache shared by all clients, if options.dns_cache_size>0
+int have_dns_cache;
+DnsCache dns_cache;
+uint64_t dns_cache_num_answers;
+
+#ifdef BADVPN_LINUX
+// worker processes, when running with --workers
+pid_t worker_pids[MAX_WORKERS];
+int worker_index;
+#endif
+
 // reactor
 BReactor ss;
 
@@ -171,8 +301,61 @@ int num_listeners;
 LinkedList1 clients_list;
 int num_clients;
 
+// clients by identifier, if have_dns_cache, for delivering answers to
+// queries which were held back
+BAVL clients_tree;
+uint64_t next_client_id;
+
+// memory for connections
+BSlab connections_slab;
+
+// memory for datagrams being sent to UDP, for small ones and for those
+// up to the UDP MTU
+BSlab udp_send_small_slab;
+BSlab udp_send_slab;
+
+// totals over all clients, including disconnected ones
+struct {
+    uint64_t num_clients;
+    uint64_t num_connections;
+    uint64_t num_packets_from;
+    uint64_t num_bytes_from;
+    uint64_t num_packets_to;
+    uint64_t num_bytes_to;
+    uint64_t num_dropped_to;
+} totals;
+
+#ifdef BADVPN_UDPGW_DGRAM
+// datagram transport, if options.dgram_listen_addr; its socket is gone
+// after an error, and clients then only use their streams
+BAddr dgram_listen_addr;
+int have_dgram;
+BDatagram dgram;
+uint16_t dgram_port;
+BAVL dgram_sessions_tree;
+uint8_t dgram_recv_buf[UDPGW_DGRAM_PACKET_MTU(FECPROTO_MAX_GROUP_SIZE)];
+BAddr dgram_recv_addr;
+struct client *dgram_recv_client;
+uint8_t dgram_send_buf[UDPGW_DGRAM_PACKET_MTU(FECPROTO_MAX_GROUP_SIZE)];
+int dgram_sending;
+LinkedList1 dgram_send_waiting_list;
+#endif
+
+// statistics server
+int have_stats_server;
+struct BLisCon_from stats_listen_from;
+#ifdef BADVPN_LINUX
+char stats_worker_unix[256];
+#endif
+StatsServer stats_server;
+
 static void print_help (const char *name);
 static void print_version (void);
+#ifdef BADVPN_LINUX
+static void kill_workers (void);
+static int run_workers (void);
+static void partition_ports (int *num_ports, BAddr *addr);
+#endif
 static int parse_arguments (int argc, char *argv[]);
 static int process_arguments (void);
 static void signal_handler (void *unused);
@@ -184,24 +367,69 @@ static void client_disconnect_timer_handler (struct client *client);
 static void client_connection_handler (struct client *client, int event);
 static void client_decoder_handler_error (struct client *client);
 static void client_recv_if_handler_send (struct client *client, uint8_t *data, int data_len);
+static void client_process_message (struct client *client, uint8_t *data, int data_len, int from_dgram);
+#ifdef BADVPN_UDPGW_DGRAM
+static int dgram_init (void);
+static void dgram_free (void);
+static void dgram_handler_event (void *unused, int event);
+static void dgram_recv_next (void);
+static void dgram_recv_handler_done (void *unused, int data_len);
+static void dgram_send_start (struct client *client, const uint8_t *data, int data_len);
+static void dgram_send_handler_done (void *unused);
+static int uint32_comparator (void *unused, uint32_t *v1, uint32_t *v2);
+static void client_dgram_init (struct client *client, const uint8_t *data, int data_len);
+static void client_dgram_free (struct client *client);
+static int client_dgram_active (struct client *client);
+static int client_dgram_send_message (struct client *client, const uint8_t *data, int data_len);
+static void client_dgram_send_if_handler_send (struct client *client, uint8_t *data, int data_len);
+static void client_dgram_recv_if_handler_send (struct client *client, uint8_t *data, int data_len);
+static void client_dgram_recv_input_handler_done (struct client *client);
+static void client_dgram_offer_handler_done (struct client *client);
+#endif
 static int get_local_num_ports (int addr_type);
 static BAddr get_local_addr (int addr_type);
-static uint8_t * build_port_usage_array_and_find_least_used_connection (BAddr remote_addr, struct connection **out_con);
-static void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, const uint8_t *data, int data_len);
+static size_t remote_key_hash (BAddr *key);
+static struct remote_ports * remote_ports_get (BAddr remote_addr);
+static void remote_ports_maybe_free (struct remote_ports *rp);
+static int remote_ports_alloc_port (struct remote_ports *rp);
+static struct connection * remote_ports_find_unused_connection (struct remote_ports *rp);
+static void connection_bind_local_port (struct connection *con);
+static void connection_release_local_port (struct connection *con);
+static void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, int dns, const uint8_t *data, int data_len);
 static void connection_free (struct connection *con);
 static void connection_logfunc (struct connection *con);
 static void connection_log (struct connection *con, int level, const char *fmt, ...);
 static void connection_free_udp (struct connection *con);
 static void connection_first_job_handler (struct connection *con);
-static void connection_send_to_client (struct connection *con, uint8_t flags, const uint8_t *data, int data_len);
+static int client_header_len (BAddr orig_addr);
+static void write_client_header (uint16_t conid, BAddr orig_addr, uint8_t flags, uint8_t *out);
+static int connection_client_header_len (struct connection *con);
+static void connection_write_client_header (struct connection *con, uint8_t flags, uint8_t *out);
 static int connection_send_to_udp (struct connection *con, const uint8_t *data, int data_len);
 static void connection_close (struct connection *con);
 static void connection_send_qflow_busy_handler (struct connection *con);
 static void connection_dgram_handler_event (struct connection *con, int event);
-static void connection_udp_recv_if_handler_send (struct connection *con, uint8_t *data, int data_len);
+static void connection_send_if_handler_ready (struct connection *con);
+static void connection_udp_recv_handler_done (struct connection *con, int data_len);
+static void connection_udp_send_next (struct connection *con);
+static void connection_udp_send_handler_done (struct connection *con);
 static struct connection * find_connection (struct client *client, uint16_t conid);
 static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2);
+static int uint64_comparator (void *unused, uint64_t *v1, uint64_t *v2);
 static void maybe_update_dns (void);
+static void dns_cache_handler_send (void *unused, BAddr local_addr, BAddr remote_addr, uint64_t tag, const uint8_t *data, int data_len);
+static void stats_handler_report (void *unused, StatsServerReport *r);
+static void stats_print_metric (void *user, const char *line);
+
+#include "udpgw_hash.h"
+#include <structure/CHash_impl.h>
+
+#define GROWARRAY_NAME FreePortsArray
+#define GROWARRAY_OBJECT_TYPE struct remote_ports
+#define GROWARRAY_ARRAY_MEMBER free_ports
+#define GROWARRAY_CAPACITY_MEMBER free_ports_capacity
+#define GROWARRAY_MAX_CAPACITY INT_MAX
+#include <misc/grow_array.h>
 
 int main (int argc, char **argv)
 {
@@ -242,11 +470,25 @@ int main (int argc, char **argv)
                 goto fail0;
             }
             break;
+        case LOGGER_TRACE:
+            if (!BLog_InitTrace(options.logger_trace_file, options.logger_trace_size)) {
+                fprintf(stderr, "Failed to initialize trace logger\n");
+                goto fail0;
+            }
+            break;
         #endif
         default:
             ASSERT(0);
     }
     
+    #ifndef BADVPN_USE_WINAPI
+    // write out logs from a separate thread
+    if (options.logger_async && !BLog_MakeAsync(BLOG_ASYNC_DEFAULT_BUFFER_SIZE)) {
+        fprintf(stderr, "Failed to start asynchronous logger\n");
+        goto fail1;
+    }
+    #endif
+    
     // configure logger channels
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
         if (options.loglevels[i] >= 0) {
@@ -271,6 +513,46 @@ int main (int argc, char **argv)
         goto fail1;
     }
     
+    #ifdef BADVPN_LINUX
+    // bind to CPUs before starting any workers, so that they inherit it
+    if (!BCpuSet_IsEmpty(&options.cpu_affinity) && !BCpuSet_BindThread(&options.cpu_affinity)) {
+        BLog(BLOG_ERROR, "BCpuSet_BindThread failed");
+        goto fail1;
+    }
+    
+    // with multiple workers, this process only supervises them; each worker
+    // has its own reactor and SO_REUSEPORT listeners, the kernel distributes
+    // clients among them, and a client stays with the worker that accepted it
+    if (options.workers > 1) {
+        if (run_workers() >= 0) {
+            goto fail1;
+        }
+        BLog(BLOG_NOTICE, "worker %d started", worker_index);
+        
+        // give each worker its own share of the local port ranges, so that
+        // workers never bind the same port for the same remote address
+        if (options.local_udp_num_ports >= 0) {
+            partition_ports(&options.local_udp_num_ports, &local_udp_addr);
+        }
+        if (options.local_udp_ip6_num_ports >= 0) {
+            partition_ports(&options.local_udp_ip6_num_ports, &local_udp_ip6_addr);
+        }
+        
+        // share the client limit among workers
+        options.max_clients = (options.max_clients + options.workers - 1) / options.workers;
+    }
+    
+    // bind to our own CPU before allocating anything large, so that our
+    // memory is placed on its NUMA node
+    if (!BCpuSet_IsEmpty(&options.worker_cpus)) {
+        if (!BCpuSet_BindThreadToIndex(&options.worker_cpus, worker_index)) {
+            BLog(BLOG_ERROR, "BCpuSet_BindThreadToIndex failed");
+            goto fail1;
+        }
+        BLog(BLOG_INFO, "bound to CPU %d", BCpuSet_GetCpu(&options.worker_cpus, worker_index));
+    }
+    #endif
+    
     // compute MTUs
     udpgw_mtu = udpgw_compute_mtu(options.udp_mtu);
     if (udpgw_mtu < 0 || udpgw_mtu > PACKETPROTO_MAXPAYLOAD) {
@@ -298,10 +580,57 @@ int main (int argc, char **argv)
         goto fail2;
     }
     
+    // init remote ports hash
+    if (!RemotePortsHash_Init(&remote_ports_hash, REMOTE_PORTS_HASH_INITIAL_BUCKETS)) {
+        BLog(BLOG_ERROR, "RemotePortsHash_Init failed");
+        goto fail2a;
+    }
+    num_remote_ports = 0;
+    
+    // init connections memory
+    if (!BSlab_Init(&connections_slab, sizeof(struct connection), CONNECTIONS_SLAB_CHUNK)) {
+        BLog(BLOG_ERROR, "BSlab_Init failed");
+        goto fail2b;
+    }
+    
+    // init memory for datagrams to UDP
+    if (!BSlab_Init(&udp_send_small_slab, sizeof(struct udp_send_packet) + UDP_SEND_SMALL_SIZE, UDP_SEND_SMALL_SLAB_CHUNK)) {
+        BLog(BLOG_ERROR, "BSlab_Init failed");
+        goto fail2c;
+    }
+    if (!BSlab_Init(&udp_send_slab, sizeof(struct udp_send_packet) + options.udp_mtu, UDP_SEND_SLAB_CHUNK)) {
+        BLog(BLOG_ERROR, "BSlab_Init failed");
+        goto fail2d;
+    }
+    
+    // init DNS cache
+    have_dns_cache = 0;
+    if (options.dns_cache_size > 0) {
+        if (!DnsCache_Init(&dns_cache, options.dns_cache_size, options.udp_mtu, DNS_CACHE_MAX_TTL, DNS_CACHE_PENDING_TIMEOUT, NULL, dns_cache_handler_send)) {
+            BLog(BLOG_ERROR, "DnsCache_Init failed");
+            goto fail2e;
+        }
+        have_dns_cache = 1;
+        dns_cache_num_answers = 0;
+    }
+    
+    #ifdef BADVPN_UDPGW_DGRAM
+    // init datagram transport
+    if (!dgram_init()) {
+        goto fail2f;
+    }
+    #endif
+    
     // initialize listeners
     num_listeners = 0;
+    int listener_flags = 0;
+    #ifdef BADVPN_LINUX
+    if (options.workers > 1) {
+        listener_flags |= BLISTENER_FLAG_REUSEPORT;
+    }
+    #endif
     while (num_listeners < num_listen_addrs) {
-        if (!BListener_Init(&listeners[num_listeners], listen_addrs[num_listeners], &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
+        if (!BListener_InitFrom2(&listeners[num_listeners], BLisCon_from_addr(listen_addrs[num_listeners]), listener_flags, &ss, &listeners[num_listeners], (BListener_handler)listener_handler)) {
             BLog(BLOG_ERROR, "Listener_Init failed");
             goto fail3;
         }
@@ -312,6 +641,36 @@ int main (int argc, char **argv)
     LinkedList1_Init(&clients_list);
     num_clients = 0;
     
+    // init clients tree
+    BAVL_Init(&clients_tree, OFFSET_DIFF(struct client, id, clients_tree_node), (BAVL_comparator)uint64_comparator, NULL);
+    next_client_id = 0;
+    
+    // init totals
+    memset(&totals, 0, sizeof(totals));
+    
+    // init statistics server
+    if (have_stats_server) {
+        #ifdef BADVPN_LINUX
+        // every worker has its own statistics, reachable at its own address
+        if (options.workers > 1) {
+            if (stats_listen_from.type == BLISCON_FROM_ADDR) {
+                BAddr *addr = &stats_listen_from.u.from_addr.addr;
+                BAddr_SetPort(addr, hton16(ntoh16(BAddr_GetPort(addr)) + worker_index));
+            } else {
+                snprintf(stats_worker_unix, sizeof(stats_worker_unix), "%s.%d", options.stats_listen_unix, worker_index);
+                stats_listen_from = BLisCon_from_unix(stats_worker_unix);
+            }
+        }
+        #endif
+        if (!StatsServer_Init(&stats_server, stats_listen_from, &ss, NULL, stats_handler_report)) {
+            BLog(BLOG_ERROR, "StatsServer_Init failed");
+            goto fail3;
+        }
+        
+        // record hot-path metrics for the reports
+        BMetrics_Enable();
+    }
+    
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
@@ -321,17 +680,45 @@ int main (int argc, char **argv)
         struct client *client = UPPER_OBJECT(LinkedList1_GetFirst(&clients_list), struct client, clients_list_node);
         client_free(client);
     }
+    // free statistics server
+    if (have_stats_server) {
+        StatsServer_Free(&stats_server);
+    }
 fail3:
     // free listeners
     while (num_listeners > 0) {
         num_listeners--;
         BListener_Free(&listeners[num_listeners]);
     }
+    #ifdef BADVPN_UDPGW_DGRAM
+    // free datagram transport
+    dgram_free();
+fail2f:
+    #endif
+    // free DNS cache
+    if (have_dns_cache) {
+        DnsCache_Free(&dns_cache);
+    }
+fail2e:
+    // free memory for datagrams to UDP
+    BSlab_Free(&udp_send_slab);
+fail2d:
+    BSlab_Free(&udp_send_small_slab);
+fail2c:
+    // free connections memory
+    BSlab_Free(&connections_slab);
+fail2b:
+    // free remote ports hash
+    ASSERT(num_remote_ports == 0)
+    RemotePortsHash_Free(&remote_ports_hash);
+fail2a:
     // finish signal handling
     BSignal_Finish();
 fail2:
     // free reactor
     BReactor_Free(&ss);
+    // free metrics
+    BMetrics_Free();
 fail1:
     // free logger
     BLog(BLOG_NOTICE, "exiting");
@@ -350,12 +737,19 @@ void print_help (const char *name)
         "    %s\n"
         "        [--help]\n"
         "        [--version]\n"
+        #ifdef BADVPN_USE_WINAPI
         "        [--logger <"LOGGERS_STRING">]\n"
-        #ifndef BADVPN_USE_WINAPI
+        #else
+        "        [--logger <"LOGGERS_STRING"/trace>]\n"
         "        (logger=syslog?\n"
         "            [--syslog-facility <string>]\n"
         "            [--syslog-ident <string>]\n"
         "        )\n"
+        "        (logger=trace?\n"
+        "            --trace-file <file>\n"
+        "            [--trace-size <bytes>]\n"
+        "        )\n"
+        "        [--logger-async]\n"
         #endif
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
@@ -364,14 +758,153 @@ void print_help (const char *name)
         "        [--max-clients <number>]\n"
         "        [--max-connections-for-client <number>]\n"
         "        [--client-socket-sndbuf <bytes / 0>]\n"
+        "        [--client-socket-options <options>]\n"
+        "        [--client-send-coalesce <bytes / 0>]\n"
+        "        [--client-recv-buffer <bytes>]\n"
+        "        [--client-rate-limit <bytes_per_second> <burst_bytes>]\n"
         "        [--local-udp-addrs <addr> <num_ports>]\n"
         "        [--local-udp-ip6-addrs <addr> <num_ports>]\n"
         "        [--unique-local-ports]\n"
+        "        [--udp-batch <number>]\n"
+        "        [--dns-cache-size <number>]\n"
+        #ifdef BADVPN_UDPGW_DGRAM
+        "        [--dgram-listen-addr <addr>]\n"
+        #endif
+        "        [--stats-listen-addr <addr>]\n"
+        #ifndef BADVPN_USE_WINAPI
+        "        [--stats-listen-unix <path>]\n"
+        #endif
+        #ifdef BADVPN_LINUX
+        "        [--workers <number>]\n"
+        "        [--cpu-affinity <cpu-list>]\n"
+        "        [--worker-cpus <cpu-list>]\n"
+        #endif
         "Address format is a.b.c.d:port (IPv4) or [addr]:port (IPv6).\n",
         name
     );
 }
 
+#ifdef BADVPN_LINUX
+
+void kill_workers (void)
+{
+    for (int i = 0; i < options.workers; i++) {
+        if (worker_pids[i] > 0) {
+            kill(worker_pids[i], SIGTERM);
+        }
+    }
+}
+
+int run_workers (void)
+{
+    ASSERT(options.workers > 1)
+    ASSERT(options.workers <= MAX_WORKERS)
+    
+    // returns -1 in a worker, which should continue starting up,
+    // and 1 (success) or 0 (failure) in the supervisor once all workers have exited
+    
+    // block the signals we wait for; workers get the original mask back
+    sigset_t sigs;
+    sigset_t old_sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &sigs, &old_sigs) < 0) {
+        BLog(BLOG_ERROR, "sigprocmask failed");
+        return 0;
+    }
+    
+    int ok = 1;
+    int terminating = 0;
+    int num_running = 0;
+    
+    for (int i = 0; i < options.workers; i++) {
+        worker_pids[i] = -1;
+    }
+    
+    // don't let workers inherit buffered output
+    fflush(stdout);
+    fflush(stderr);
+    
+    for (int i = 0; i < options.workers; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            BLog(BLOG_ERROR, "fork failed");
+            ok = 0;
+            terminating = 1;
+            kill_workers();
+            break;
+        }
+        if (pid == 0) {
+            sigprocmask(SIG_SETMASK, &old_sigs, NULL);
+            worker_index = i;
+            return -1;
+        }
+        worker_pids[i] = pid;
+        num_running++;
+    }
+    
+    while (num_running > 0) {
+        int sig = sigwaitinfo(&sigs, NULL);
+        if (sig < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            BLog(BLOG_ERROR, "sigwaitinfo failed");
+            ok = 0;
+            kill_workers();
+            break;
+        }
+        
+        if (sig != SIGCHLD) {
+            if (!terminating) {
+                BLog(BLOG_NOTICE, "termination requested");
+                terminating = 1;
+                kill_workers();
+            }
+            continue;
+        }
+        
+        // reap exited workers; if one exits on its own, stop the others
+        pid_t pid;
+        while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+            for (int i = 0; i < options.workers; i++) {
+                if (worker_pids[i] == pid) {
+                    worker_pids[i] = -1;
+                    num_running--;
+                    if (!terminating) {
+                        BLog(BLOG_ERROR, "worker %d exited", i);
+                        ok = 0;
+                        terminating = 1;
+                        kill_workers();
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    
+    sigprocmask(SIG_SETMASK, &old_sigs, NULL);
+    
+    return ok;
+}
+
+void partition_ports (int *num_ports, BAddr *addr)
+{
+    ASSERT(*num_ports >= options.workers)
+    
+    // split the range into contiguous parts, the first ones one port larger
+    int part = *num_ports / options.workers;
+    int extra = *num_ports % options.workers;
+    int start = worker_index * part + (worker_index < extra ? worker_index : extra);
+    
+    BAddr_SetPort(addr, hton16(ntoh16(BAddr_GetPort(addr)) + (uint16_t)start));
+    *num_ports = part + (worker_index < extra);
+}
+
+#endif
+
 void print_version (void)
 {
     printf(GLOBAL_PRODUCT_NAME" "PROGRAM_NAME" "GLOBAL_VERSION"\n"GLOBAL_COPYRIGHT_NOTICE"\n");
@@ -389,6 +922,9 @@ int parse_arguments (int argc, char *argv[])
     #ifndef BADVPN_USE_WINAPI
     options.logger_syslog_facility = "daemon";
     options.logger_syslog_ident = argv[0];
+    options.logger_async = 0;
+    options.logger_trace_file = NULL;
+    options.logger_trace_size = BLOG_TRACE_DEFAULT_RING_SIZE;
     #endif
     options.loglevel = -1;
     for (int i = 0; i < BLOG_NUM_CHANNELS; i++) {
@@ -399,9 +935,28 @@ int parse_arguments (int argc, char *argv[])
     options.max_clients = DEFAULT_MAX_CLIENTS;
     options.max_connections_for_client = DEFAULT_MAX_CONNECTIONS_FOR_CLIENT;
     options.client_socket_sndbuf = CLIENT_DEFAULT_SOCKET_SEND_BUFFER;
+    BConnection_options_Init(&options.client_socket_options);
+    options.client_send_coalesce = CLIENT_DEFAULT_SEND_COALESCE;
+    options.client_recv_buffer = CLIENT_DEFAULT_RECV_BUFFER;
+    options.client_rate = 0;
+    options.client_burst = 0;
     options.local_udp_num_ports = -1;
     options.local_udp_ip6_num_ports = -1;
     options.unique_local_ports = 0;
+    options.udp_batch = 1;
+    options.dns_cache_size = 0;
+    #ifdef BADVPN_UDPGW_DGRAM
+    options.dgram_listen_addr = NULL;
+    #endif
+    options.stats_listen_addr = NULL;
+    #ifndef BADVPN_USE_WINAPI
+    options.stats_listen_unix = NULL;
+    #endif
+    #ifdef BADVPN_LINUX
+    options.workers = 1;
+    BCpuSet_Init(&options.cpu_affinity);
+    BCpuSet_Init(&options.worker_cpus);
+    #endif
     
     int i;
     for (i = 1; i < argc; i++) {
@@ -425,6 +980,9 @@ int parse_arguments (int argc, char *argv[])
             else if (!strcmp(arg2, "syslog")) {
                 options.logger = LOGGER_SYSLOG;
             }
+            else if (!strcmp(arg2, "trace")) {
+                options.logger = LOGGER_TRACE;
+            }
             #endif
             else {
                 fprintf(stderr, "%s: wrong argument\n", arg);
@@ -449,6 +1007,28 @@ int parse_arguments (int argc, char *argv[])
             options.logger_syslog_ident = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--logger-async")) {
+            options.logger_async = 1;
+        }
+        else if (!strcmp(arg, "--trace-file")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.logger_trace_file = argv[i + 1];
+            i++;
+        }
+        else if (!strcmp(arg, "--trace-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.logger_trace_size = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         #endif
         else if (!strcmp(arg, "--loglevel")) {
             if (1 >= argc - i) {
@@ -536,6 +1116,50 @@ int parse_arguments (int argc, char *argv[])
             }
             i++;
         }
+        else if (!strcmp(arg, "--client-socket-options")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BConnection_options_Parse(&options.client_socket_options, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--client-rate-limit")) {
+            if (2 >= argc - i) {
+                fprintf(stderr, "%s: requires two arguments\n", arg);
+                return 0;
+            }
+            if ((options.client_rate = atoi(argv[i + 1])) <= 0 || (options.client_burst = atoi(argv[i + 2])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i += 2;
+        }
+        else if (!strcmp(arg, "--client-send-coalesce")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.client_send_coalesce = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--client-recv-buffer")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.client_recv_buffer = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--local-udp-addrs")) {
             if (2 >= argc - i) {
                 fprintf(stderr, "%s: requires two arguments\n", arg);
@@ -563,36 +1187,199 @@ int parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--unique-local-ports")) {
             options.unique_local_ports = 1;
         }
-        else {
-            fprintf(stderr, "unknown option: %s\n", arg);
-            return 0;
-        }
-    }
-    
-    if (options.help || options.version) {
-        return 1;
-    }
-    
-    return 1;
-}
-
-int process_arguments (void)
-{
-    // resolve listen addresses
-    num_listen_addrs = 0;
-    while (num_listen_addrs < options.num_listen_addrs) {
-        if (!BAddr_Parse(&listen_addrs[num_listen_addrs], options.listen_addrs[num_listen_addrs], NULL, 0)) {
-            BLog(BLOG_ERROR, "listen addr: BAddr_Parse failed");
-            return 0;
+        else if (!strcmp(arg, "--udp-batch")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.udp_batch = atoi(argv[i + 1])) <= 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
         }
-        num_listen_addrs++;
-    }
-    
-    // resolve local UDP address
-    if (options.local_udp_num_ports >= 0) {
-        if (!BAddr_Parse(&local_udp_addr, options.local_udp_addr, NULL, 0)) {
-            BLog(BLOG_ERROR, "local udp addr: BAddr_Parse failed");
-            return 0;
+        else if (!strcmp(arg, "--dns-cache-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.dns_cache_size = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #ifdef BADVPN_UDPGW_DGRAM
+        else if (!strcmp(arg, "--dgram-listen-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.dgram_listen_addr = argv[i + 1];
+            i++;
+        }
+        #endif
+        else if (!strcmp(arg, "--stats-listen-addr")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.stats_listen_addr = argv[i + 1];
+            i++;
+        }
+        #ifndef BADVPN_USE_WINAPI
+        else if (!strcmp(arg, "--stats-listen-unix")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            options.stats_listen_unix = argv[i + 1];
+            i++;
+        }
+        #endif
+        #ifdef BADVPN_LINUX
+        else if (!strcmp(arg, "--workers")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.workers = atoi(argv[i + 1])) <= 0 || options.workers > MAX_WORKERS) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--cpu-affinity")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BCpuSet_InitParse(&options.cpu_affinity, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--worker-cpus")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if (!BCpuSet_InitParse(&options.worker_cpus, argv[i + 1])) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
+        #endif
+        else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            return 0;
+        }
+    }
+    
+    if (options.help || options.version) {
+        return 1;
+    }
+    
+    #ifndef BADVPN_USE_WINAPI
+    if (options.logger == LOGGER_TRACE && !options.logger_trace_file) {
+        fprintf(stderr, "--trace-file is required with --logger trace\n");
+        return 0;
+    }
+    #endif
+    
+    #ifndef BADVPN_USE_WINAPI
+    if (options.stats_listen_addr && options.stats_listen_unix) {
+        fprintf(stderr, "--stats-listen-addr and --stats-listen-unix are mutually exclusive\n");
+        return 0;
+    }
+    #endif
+    
+    #ifdef BADVPN_UDPGW_DGRAM
+    // datagrams would bypass the rate limiters
+    if (options.dgram_listen_addr && options.client_rate > 0) {
+        fprintf(stderr, "--dgram-listen-addr cannot be used with --client-rate-limit\n");
+        return 0;
+    }
+    #endif
+    
+    #ifdef BADVPN_LINUX
+    // each worker gets its own part of the local port ranges
+    if ((options.local_udp_num_ports >= 0 && options.local_udp_num_ports < options.workers) ||
+        (options.local_udp_ip6_num_ports >= 0 && options.local_udp_ip6_num_ports < options.workers)
+    ) {
+        fprintf(stderr, "local port ranges must have at least --workers ports\n");
+        return 0;
+    }
+    #endif
+    
+    return 1;
+}
+
+int process_arguments (void)
+{
+    // resolve listen addresses
+    num_listen_addrs = 0;
+    while (num_listen_addrs < options.num_listen_addrs) {
+        if (!BAddr_Parse(&listen_addrs[num_listen_addrs], options.listen_addrs[num_listen_addrs], NULL, 0)) {
+            BLog(BLOG_ERROR, "listen addr: BAddr_Parse failed");
+            return 0;
+        }
+        num_listen_addrs++;
+    }
+    
+    // resolve statistics listen address
+    have_stats_server = 0;
+    if (options.stats_listen_addr) {
+        BAddr addr;
+        if (!BAddr_Parse(&addr, options.stats_listen_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "stats listen addr: BAddr_Parse failed");
+            return 0;
+        }
+        #ifdef BADVPN_LINUX
+        // workers listen on consecutive ports
+        if ((addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6) && ntoh16(BAddr_GetPort(&addr)) > UINT16_MAX - (options.workers - 1)) {
+            BLog(BLOG_ERROR, "stats listen addr: port too large for --workers");
+            return 0;
+        }
+        #endif
+        stats_listen_from = BLisCon_from_addr(addr);
+        have_stats_server = 1;
+    }
+    #ifndef BADVPN_USE_WINAPI
+    if (options.stats_listen_unix) {
+        stats_listen_from = BLisCon_from_unix(options.stats_listen_unix);
+        have_stats_server = 1;
+    }
+    #endif
+    
+    #ifdef BADVPN_UDPGW_DGRAM
+    // resolve datagram listen address
+    if (options.dgram_listen_addr) {
+        if (!BAddr_Parse(&dgram_listen_addr, options.dgram_listen_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "dgram listen addr: BAddr_Parse failed");
+            return 0;
+        }
+        if (dgram_listen_addr.type != BADDR_TYPE_IPV4 && dgram_listen_addr.type != BADDR_TYPE_IPV6) {
+            BLog(BLOG_ERROR, "dgram listen addr: must be an IP address");
+            return 0;
+        }
+        #ifdef BADVPN_LINUX
+        // workers listen on consecutive ports
+        if (ntoh16(BAddr_GetPort(&dgram_listen_addr)) > UINT16_MAX - (options.workers - 1)) {
+            BLog(BLOG_ERROR, "dgram listen addr: port too large for --workers");
+            return 0;
+        }
+        #endif
+    }
+    #endif
+    
+    // resolve local UDP address
+    if (options.local_udp_num_ports >= 0) {
+        if (!BAddr_Parse(&local_udp_addr, options.local_udp_addr, NULL, 0)) {
+            BLog(BLOG_ERROR, "local udp addr: BAddr_Parse failed");
+            return 0;
         }
         if (local_udp_addr.type != BADDR_TYPE_IPV4) {
             BLog(BLOG_ERROR, "local udp addr: must be an IPv4 address");
@@ -650,31 +1437,62 @@ void listener_handler (BListener *listener)
         }
     }
     
+    // apply socket options
+    if (!BConnection_SetOptions(&client->con, &options.client_socket_options)) {
+        BLog(BLOG_WARNING, "BConnection_SetOptions failed");
+    }
+    
     // init connection interfaces
     BConnection_SendAsync_Init(&client->con);
     BConnection_RecvAsync_Init(&client->con);
     
     // init disconnect timer
-    BTimer_Init(&client->disconnect_timer, CLIENT_DISCONNECT_TIMEOUT, (BTimer_handler)client_disconnect_timer_handler, client);
+    BTimer_InitCoarse(&client->disconnect_timer, CLIENT_DISCONNECT_TIMEOUT, (BTimer_handler)client_disconnect_timer_handler, client);
     BReactor_SetTimer(&ss, &client->disconnect_timer);
     
     // init recv interface
     PacketPassInterface_Init(&client->recv_if, udpgw_mtu, (PacketPassInterface_handler_send)client_recv_if_handler_send, client, BReactor_PendingGroup(&ss));
     
-    // init recv decoder
-    if (!PacketProtoDecoder_Init(&client->recv_decoder, BConnection_RecvAsync_GetIf(&client->con), &client->recv_if, BReactor_PendingGroup(&ss), client,
+    // init recv limiter; it holds back reading from the client when exhausted
+    PacketPassInterface *recv_output = &client->recv_if;
+    if (options.client_rate > 0) {
+        PacketPassRateLimiter_Init(&client->recv_limiter, recv_output, options.client_rate, options.client_burst, &ss);
+        recv_output = PacketPassRateLimiter_GetInput(&client->recv_limiter);
+    }
+    
+    // init recv decoder, with a buffer for as many packets as fit in the configured size
+    int recv_packets = options.client_recv_buffer / pp_mtu;
+    if (recv_packets < 1) {
+        recv_packets = 1;
+    }
+    if (!PacketProtoDecoder_Init2(&client->recv_decoder, BConnection_RecvAsync_GetIf(&client->con), recv_output, recv_packets, BReactor_PendingGroup(&ss), client,
         (PacketProtoDecoder_handler_error)client_decoder_handler_error
     )) {
-        BLog(BLOG_ERROR, "PacketProtoDecoder_Init failed");
+        BLog(BLOG_ERROR, "PacketProtoDecoder_Init2 failed");
         goto fail2;
     }
     
-    // init send sender
-    PacketStreamSender_Init(&client->send_sender, BConnection_SendAsync_GetIf(&client->con), pp_mtu, BReactor_PendingGroup(&ss));
+    // init send sender, gathering packets ready at the same time into one write
+    int coalesce = options.client_send_coalesce;
+    if (coalesce > 0 && coalesce < pp_mtu) {
+        coalesce = pp_mtu;
+    }
+    if (!PacketStreamSender_Init2(&client->send_sender, BConnection_SendAsync_GetIf(&client->con), pp_mtu, coalesce, BReactor_PendingGroup(&ss))) {
+        BLog(BLOG_ERROR, "PacketStreamSender_Init2 failed");
+        goto fail2a;
+    }
     
-    // init send queue
-    if (!PacketPassFairQueue_Init(&client->send_queue, PacketStreamSender_GetInput(&client->send_sender), BReactor_PendingGroup(&ss), 0, 1)) {
-        BLog(BLOG_ERROR, "PacketPassFairQueue_Init failed");
+    // init send limiter; when exhausted, packets wait in the connections'
+    // send queue flows
+    PacketPassInterface *send_output = PacketStreamSender_GetInput(&client->send_sender);
+    if (options.client_rate > 0) {
+        PacketPassRateLimiter_Init(&client->send_limiter, send_output, options.client_rate, options.client_burst, &ss);
+        send_output = PacketPassRateLimiter_GetInput(&client->send_limiter);
+    }
+    
+    // init send queue; a client may have many connections, so use the cheaper scheduling
+    if (!PacketPassFairQueue_Init2(&client->send_queue, send_output, BReactor_PendingGroup(&ss), 0, 1, FAIRQUEUE_MODE_DRR)) {
+        BLog(BLOG_ERROR, "PacketPassFairQueue_Init2 failed");
         goto fail3;
     }
     
@@ -690,18 +1508,53 @@ void listener_handler (BListener *listener)
     // init closing connections list
     LinkedList1_Init(&client->closing_connections_list);
     
+    // init counters
+    client->num_packets_from = 0;
+    client->num_bytes_from = 0;
+    client->num_packets_to = 0;
+    client->num_bytes_to = 0;
+    client->num_dropped_to = 0;
+    
+    // init flow for DNS answers from the cache, and make the client findable
+    // for answers to queries which were held back
+    if (have_dns_cache) {
+        PacketPassFairQueueFlow_Init(&client->dns_qflow, &client->send_queue);
+        if (!PacketProtoFlow_Init(&client->dns_ppflow, udpgw_mtu, CLIENT_DNS_BUFFER_SIZE, PacketPassFairQueueFlow_GetInput(&client->dns_qflow), BReactor_PendingGroup(&ss))) {
+            BLog(BLOG_ERROR, "PacketProtoFlow_Init failed");
+            goto fail4;
+        }
+        client->id = next_client_id++;
+        ASSERT_EXECUTE(BAVL_Insert(&clients_tree, &client->clients_tree_node, NULL))
+    }
+    
+    #ifdef BADVPN_UDPGW_DGRAM
+    // no datagram transport until the client asks for it
+    client->have_dgram = 0;
+    #endif
+    
     // insert to clients list
     LinkedList1_Append(&clients_list, &client->clients_list_node);
     num_clients++;
+    totals.num_clients++;
     
     client_log(client, BLOG_INFO, "connected");
     
     return;
     
+fail4:
+    PacketPassFairQueueFlow_Free(&client->dns_qflow);
+    PacketPassFairQueue_Free(&client->send_queue);
 fail3:
+    if (options.client_rate > 0) {
+        PacketPassRateLimiter_Free(&client->send_limiter);
+    }
     PacketStreamSender_Free(&client->send_sender);
+fail2a:
     PacketProtoDecoder_Free(&client->recv_decoder);
 fail2:
+    if (options.client_rate > 0) {
+        PacketPassRateLimiter_Free(&client->recv_limiter);
+    }
     PacketPassInterface_Free(&client->recv_if);
     BReactor_RemoveTimer(&ss, &client->disconnect_timer);
     BConnection_RecvAsync_Free(&client->con);
@@ -715,9 +1568,36 @@ fail0:
 
 void client_free (struct client *client)
 {
+    // report counters
+    client_log(client, BLOG_INFO, "from client %"PRIu64" packets %"PRIu64" bytes, to client %"PRIu64" packets %"PRIu64" bytes %"PRIu64" dropped",
+               client->num_packets_from, client->num_bytes_from, client->num_packets_to, client->num_bytes_to, client->num_dropped_to);
+    if (options.client_rate > 0) {
+        client_log(client, BLOG_INFO, "rate limited %"PRIu64" packets from client, %"PRIu64" packets to client",
+                   PacketPassRateLimiter_GetNumDelayed(&client->recv_limiter), PacketPassRateLimiter_GetNumDelayed(&client->send_limiter));
+    }
+    
+    // add counters to totals
+    totals.num_packets_from += client->num_packets_from;
+    totals.num_bytes_from += client->num_bytes_from;
+    totals.num_packets_to += client->num_packets_to;
+    totals.num_bytes_to += client->num_bytes_to;
+    totals.num_dropped_to += client->num_dropped_to;
+    
     // allow freeing send queue flows
     PacketPassFairQueue_PrepareFree(&client->send_queue);
     
+    // free flow for DNS answers
+    if (have_dns_cache) {
+        BAVL_Remove(&clients_tree, &client->clients_tree_node);
+        PacketProtoFlow_Free(&client->dns_ppflow);
+        PacketPassFairQueueFlow_Free(&client->dns_qflow);
+    }
+    
+    #ifdef BADVPN_UDPGW_DGRAM
+    // free datagram transport
+    client_dgram_free(client);
+    #endif
+    
     // free connections
     while (!LinkedList1_IsEmpty(&client->connections_list)) {
         struct connection *con = UPPER_OBJECT(LinkedList1_GetFirst(&client->connections_list), struct connection, connections_list_node);
@@ -737,12 +1617,22 @@ void client_free (struct client *client)
     // free send queue
     PacketPassFairQueue_Free(&client->send_queue);
     
+    // free send limiter
+    if (options.client_rate > 0) {
+        PacketPassRateLimiter_Free(&client->send_limiter);
+    }
+    
     // free send sender
     PacketStreamSender_Free(&client->send_sender);
     
     // free recv decoder
     PacketProtoDecoder_Free(&client->recv_decoder);
     
+    // free recv limiter
+    if (options.client_rate > 0) {
+        PacketPassRateLimiter_Free(&client->recv_limiter);
+    }
+    
     // free recv interface
     PacketPassInterface_Free(&client->recv_if);
     
@@ -812,6 +1702,17 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
     // accept packet
     PacketPassInterface_Done(&client->recv_if);
     
+    // update counters
+    client->num_packets_from++;
+    client->num_bytes_from += data_len;
+    
+    client_process_message(client, data, data_len, 0);
+}
+
+void client_process_message (struct client *client, uint8_t *data, int data_len, int from_dgram)
+{
+    ASSERT(data_len >= 0)
+    
     // parse header
     if (data_len < sizeof(struct udpgw_header)) {
         client_log(client, BLOG_ERROR, "missing header");
@@ -830,6 +1731,28 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
     // if this is keepalive, ignore any payload
     if ((flags & UDPGW_CLIENT_FLAG_KEEPALIVE)) {
         client_log(client, BLOG_DEBUG, "received keepalive");
+        
+        #ifdef BADVPN_UDPGW_DGRAM
+        // answer datagrams, so the client knows they get through both ways
+        if (from_dgram) {
+            struct udpgw_header reply;
+            reply.flags = htol8(UDPGW_CLIENT_FLAG_KEEPALIVE);
+            reply.conid = htol16(0);
+            client_dgram_send_message(client, (uint8_t *)&reply, sizeof(reply));
+        }
+        #endif
+        return;
+    }
+    
+    // handle request for the datagram transport
+    if ((flags & UDPGW_CLIENT_FLAG_DGRAM)) {
+        #ifdef BADVPN_UDPGW_DGRAM
+        if (!from_dgram) {
+            client_dgram_init(client, data, data_len);
+        }
+        #else
+        client_log(client, BLOG_INFO, "datagram transport requested, but not supported");
+        #endif
         return;
     }
     
@@ -863,6 +1786,15 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
         return;
     }
     
+    // answer DNS queries from the cache if possible; the client and conid go
+    // along with the query so that an answer can find its way back later
+    if ((flags & UDPGW_CLIENT_FLAG_DNS) && have_dns_cache) {
+        maybe_update_dns();
+        if (dns_addr.type != BADDR_TYPE_NONE && DnsCache_HandleQuery(&dns_cache, client->addr, orig_addr, (client->id << 16) | conid, data, data_len)) {
+            return;
+        }
+    }
+    
     // find connection
     struct connection *con = find_connection(client, conid);
     ASSERT(!con || !con->closing)
@@ -885,6 +1817,7 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
         
         // if this is DNS, replace actual address, but keep still remember the orig_addr
         BAddr addr = orig_addr;
+        int dns = 0;
         if ((flags & UDPGW_CLIENT_FLAG_DNS)) {
             maybe_update_dns();
             if (dns_addr.type == BADDR_TYPE_NONE) {
@@ -892,17 +1825,437 @@ void client_recv_if_handler_send (struct client *client, uint8_t *data, int data
             } else {
                 client_log(client, BLOG_DEBUG, "received DNS");
                 addr = dns_addr;
+                dns = 1;
             }
         }
         
         // create new connection
-        connection_init(client, conid, addr, orig_addr, data, data_len);
+        connection_init(client, conid, addr, orig_addr, dns, data, data_len);
     } else {
         // submit packet to existing connection
         connection_send_to_udp(con, data, data_len);
     }
 }
 
+#ifdef BADVPN_UDPGW_DGRAM
+
+int dgram_init (void)
+{
+    have_dgram = 0;
+    
+    if (!options.dgram_listen_addr) {
+        return 1;
+    }
+    
+    BAddr addr = dgram_listen_addr;
+    #ifdef BADVPN_LINUX
+    // every worker has its own socket, and offers its own port to its clients
+    if (options.workers > 1) {
+        BAddr_SetPort(&addr, hton16(ntoh16(BAddr_GetPort(&addr)) + worker_index));
+    }
+    #endif
+    
+    // init socket
+    if (!BDatagram_Init(&dgram, addr.type, &ss, NULL, (BDatagram_handler)dgram_handler_event)) {
+        BLog(BLOG_ERROR, "BDatagram_Init failed");
+        goto fail0;
+    }
+    
+    // bind socket
+    if (!BDatagram_Bind(&dgram, addr)) {
+        BLog(BLOG_ERROR, "BDatagram_Bind failed");
+        goto fail1;
+    }
+    
+    // remember the port to offer, which the system chooses if it is zero
+    BAddr local_addr;
+    if (!BDatagram_GetLocalAddr(&dgram, &local_addr)) {
+        local_addr = addr;
+    }
+    dgram_port = BAddr_GetPort(&local_addr);
+    
+    // datagrams are kept small, so never let the system fragment them
+    if (!BDatagram_SetDontFragment(&dgram)) {
+        BLog(BLOG_WARNING, "BDatagram_SetDontFragment failed");
+    }
+    
+    // init sending
+    BDatagram_SendAsync_Init(&dgram, sizeof(dgram_send_buf));
+    PacketPassInterface_Sender_Init(BDatagram_SendAsync_GetIf(&dgram), (PacketPassInterface_handler_done)dgram_send_handler_done, NULL);
+    dgram_sending = 0;
+    LinkedList1_Init(&dgram_send_waiting_list);
+    
+    // init receiving
+    BDatagram_RecvAsync_Init(&dgram, sizeof(dgram_recv_buf));
+    PacketRecvInterface_Receiver_Init(BDatagram_RecvAsync_GetIf(&dgram), (PacketRecvInterface_handler_done)dgram_recv_handler_done, NULL);
+    dgram_recv_client = NULL;
+    
+    // init sessions tree
+    BAVL_Init(&dgram_sessions_tree, OFFSET_DIFF(struct client, dgram_session_id, dgram_sessions_tree_node), (BAVL_comparator)uint32_comparator, NULL);
+    
+    have_dgram = 1;
+    
+    // start receiving
+    dgram_recv_next();
+    
+    BLog(BLOG_NOTICE, "datagram transport on port %"PRIu16, ntoh16(dgram_port));
+    
+    return 1;
+    
+fail1:
+    BDatagram_Free(&dgram);
+fail0:
+    return 0;
+}
+
+void dgram_free (void)
+{
+    if (!have_dgram) {
+        return;
+    }
+    ASSERT(BAVL_IsEmpty(&dgram_sessions_tree))
+    
+    // free socket
+    BDatagram_RecvAsync_Free(&dgram);
+    BDatagram_SendAsync_Free(&dgram);
+    BDatagram_Free(&dgram);
+}
+
+void dgram_handler_event (void *unused, int event)
+{
+    ASSERT(have_dgram)
+    
+    BLog(BLOG_ERROR, "datagram transport socket error, clients will only use their streams");
+    
+    // drop datagrams waiting to be sent
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&dgram_send_waiting_list))) {
+        struct client *client = UPPER_OBJECT(node, struct client, dgram_send_waiting_list_node);
+        LinkedList1_Remove(&dgram_send_waiting_list, &client->dgram_send_waiting_list_node);
+        client->dgram_send_waiting = 0;
+        PacketPassInterface_Done(&client->dgram_send_if);
+    }
+    
+    // a session may still have a received datagram
+    dgram_recv_client = NULL;
+    
+    // free socket
+    BDatagram_RecvAsync_Free(&dgram);
+    BDatagram_SendAsync_Free(&dgram);
+    BDatagram_Free(&dgram);
+    
+    have_dgram = 0;
+}
+
+void dgram_recv_next (void)
+{
+    ASSERT(have_dgram)
+    ASSERT(!dgram_recv_client)
+    
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&dgram), dgram_recv_buf);
+}
+
+void dgram_recv_handler_done (void *unused, int data_len)
+{
+    ASSERT(have_dgram)
+    ASSERT(!dgram_recv_client)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= sizeof(dgram_recv_buf))
+    
+    // find session
+    uint32_t session_id;
+    if (!UdpGwDgram_ParseSessionId(dgram_recv_buf, data_len, &session_id)) {
+        BLog(BLOG_DEBUG, "datagram too short");
+        goto next;
+    }
+    BAVLNode *tree_node = BAVL_LookupExact(&dgram_sessions_tree, &session_id);
+    if (!tree_node) {
+        BLog(BLOG_DEBUG, "datagram for unknown session");
+        goto next;
+    }
+    struct client *client = UPPER_OBJECT(tree_node, struct client, dgram_sessions_tree_node);
+    ASSERT(client->have_dgram)
+    
+    // check length against the session's FEC
+    PacketPassInterface *input = UdpGwDgram_GetRecvInput(&client->dgram);
+    if (data_len > PacketPassInterface_GetMTU(input)) {
+        client_log(client, BLOG_DEBUG, "datagram too long");
+        goto next;
+    }
+    
+    // remember the source, which becomes the client's address if the
+    // datagram turns out to be authentic
+    BIPAddr local_addr;
+    if (!BDatagram_GetLastReceiveAddrs(&dgram, &dgram_recv_addr, &local_addr)) {
+        goto next;
+    }
+    
+    // pass datagram to session; receiving continues once it is done with it
+    dgram_recv_client = client;
+    PacketPassInterface_Sender_Send(input, dgram_recv_buf, data_len);
+    return;
+    
+next:
+    dgram_recv_next();
+}
+
+void dgram_send_start (struct client *client, const uint8_t *data, int data_len)
+{
+    ASSERT(have_dgram)
+    ASSERT(!dgram_sending)
+    ASSERT(client->have_dgram)
+    ASSERT(client->dgram_addr.type != BADDR_TYPE_NONE)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= sizeof(dgram_send_buf))
+    
+    // copy the datagram, so the client is free to go away while it is sent
+    memcpy(dgram_send_buf, data, data_len);
+    
+    // send it to the client's address
+    BIPAddr local_addr;
+    BIPAddr_InitInvalid(&local_addr);
+    BDatagram_SetSendAddrs(&dgram, client->dgram_addr, local_addr);
+    PacketPassInterface_Sender_Send(BDatagram_SendAsync_GetIf(&dgram), dgram_send_buf, data_len);
+    dgram_sending = 1;
+    
+    // let the client's session continue
+    PacketPassInterface_Done(&client->dgram_send_if);
+}
+
+void dgram_send_handler_done (void *unused)
+{
+    ASSERT(have_dgram)
+    ASSERT(dgram_sending)
+    
+    dgram_sending = 0;
+    
+    // send for the next client in line; each has at most one datagram
+    // waiting, so clients take turns
+    LinkedList1Node *node = LinkedList1_GetFirst(&dgram_send_waiting_list);
+    if (node) {
+        struct client *client = UPPER_OBJECT(node, struct client, dgram_send_waiting_list_node);
+        LinkedList1_Remove(&dgram_send_waiting_list, &client->dgram_send_waiting_list_node);
+        client->dgram_send_waiting = 0;
+        dgram_send_start(client, client->dgram_send_data, client->dgram_send_len);
+    }
+}
+
+int uint32_comparator (void *unused, uint32_t *v1, uint32_t *v2)
+{
+    return B_COMPARE(*v1, *v2);
+}
+
+void client_dgram_init (struct client *client, const uint8_t *data, int data_len)
+{
+    if (!have_dgram) {
+        client_log(client, BLOG_INFO, "datagram transport requested, but not available");
+        goto fail0;
+    }
+    
+    if (client->have_dgram) {
+        client_log(client, BLOG_ERROR, "datagram transport requested again");
+        goto fail0;
+    }
+    
+    // parse request
+    struct udpgw_dgram_request request;
+    if (data_len < sizeof(request)) {
+        client_log(client, BLOG_ERROR, "missing datagram transport request");
+        goto fail0;
+    }
+    memcpy(&request, data, sizeof(request));
+    int fec_group_size = ltoh8(request.fec_group_size);
+    if (fec_group_size > FECPROTO_MAX_GROUP_SIZE) {
+        fec_group_size = FECPROTO_MAX_GROUP_SIZE;
+    }
+    
+    // allocate offer
+    if (!(client->dgram_offer = (struct dgram_offer_packet *)malloc(sizeof(*client->dgram_offer)))) {
+        client_log(client, BLOG_ERROR, "malloc failed");
+        goto fail0;
+    }
+    
+    // choose an unused session ID and a key
+    do {
+        BRandom_randomize((uint8_t *)&client->dgram_session_id, sizeof(client->dgram_session_id));
+    } while (BAVL_LookupExact(&dgram_sessions_tree, &client->dgram_session_id));
+    uint8_t key[UDPGW_DGRAM_KEY_SIZE];
+    BRandom_randomize(key, sizeof(key));
+    
+    // init session interfaces
+    PacketPassInterface_Init(&client->dgram_send_if, UDPGW_DGRAM_PACKET_MTU(fec_group_size), (PacketPassInterface_handler_send)client_dgram_send_if_handler_send, client, BReactor_PendingGroup(&ss));
+    PacketPassInterface_Init(&client->dgram_recv_if, UDPGW_DGRAM_MAX_MESSAGE, (PacketPassInterface_handler_send)client_dgram_recv_if_handler_send, client, BReactor_PendingGroup(&ss));
+    
+    // init session
+    if (!UdpGwDgram_Init(&client->dgram, 1, client->dgram_session_id, key, fec_group_size, CLIENT_DGRAM_SEND_BUFFER, &client->dgram_send_if, &client->dgram_recv_if,
+                         &ss, client, (BLog_logfunc)client_logfunc)) {
+        client_log(client, BLOG_ERROR, "UdpGwDgram_Init failed");
+        goto fail1;
+    }
+    PacketPassInterface_Sender_Init(UdpGwDgram_GetRecvInput(&client->dgram), (PacketPassInterface_handler_done)client_dgram_recv_input_handler_done, client);
+    
+    // insert to sessions tree
+    ASSERT_EXECUTE(BAVL_Insert(&dgram_sessions_tree, &client->dgram_sessions_tree_node, NULL))
+    
+    // no address until an authentic datagram arrives
+    BAddr_InitNone(&client->dgram_addr);
+    client->dgram_send_waiting = 0;
+    
+    // build offer
+    client->dgram_offer->pp.len = htol16(sizeof(client->dgram_offer->udpgw) + sizeof(client->dgram_offer->offer));
+    client->dgram_offer->udpgw.flags = htol8(UDPGW_CLIENT_FLAG_DGRAM);
+    client->dgram_offer->udpgw.conid = htol16(0);
+    client->dgram_offer->offer.session_id = htol32(client->dgram_session_id);
+    client->dgram_offer->offer.port = dgram_port;
+    client->dgram_offer->offer.fec_group_size = htol8(fec_group_size);
+    memcpy(client->dgram_offer->offer.key, key, sizeof(key));
+    
+    // send offer
+    PacketPassFairQueueFlow_Init(&client->dgram_offer_qflow, &client->send_queue);
+    PacketPassInterface_Sender_Init(PacketPassFairQueueFlow_GetInput(&client->dgram_offer_qflow), (PacketPassInterface_handler_done)client_dgram_offer_handler_done, client);
+    PacketPassInterface_Sender_Send(PacketPassFairQueueFlow_GetInput(&client->dgram_offer_qflow), (uint8_t *)client->dgram_offer, sizeof(*client->dgram_offer));
+    
+    client->have_dgram = 1;
+    
+    client_log(client, BLOG_INFO, "datagram transport offered, FEC group size %d", fec_group_size);
+    
+    return;
+    
+fail1:
+    PacketPassInterface_Free(&client->dgram_recv_if);
+    PacketPassInterface_Free(&client->dgram_send_if);
+    free(client->dgram_offer);
+fail0:
+    return;
+}
+
+void client_dgram_free (struct client *client)
+{
+    if (!client->have_dgram) {
+        return;
+    }
+    
+    if (have_dgram) {
+        // stop waiting to send
+        if (client->dgram_send_waiting) {
+            LinkedList1_Remove(&dgram_send_waiting_list, &client->dgram_send_waiting_list_node);
+        }
+        
+        // go on receiving if the session had a datagram
+        if (dgram_recv_client == client) {
+            dgram_recv_client = NULL;
+            dgram_recv_next();
+        }
+    }
+    
+    // remove from sessions tree
+    BAVL_Remove(&dgram_sessions_tree, &client->dgram_sessions_tree_node);
+    
+    // free offer queue flow
+    PacketPassFairQueueFlow_Free(&client->dgram_offer_qflow);
+    
+    // free session
+    UdpGwDgram_Free(&client->dgram);
+    
+    // free session interfaces
+    PacketPassInterface_Free(&client->dgram_recv_if);
+    PacketPassInterface_Free(&client->dgram_send_if);
+    
+    // free offer
+    free(client->dgram_offer);
+}
+
+int client_dgram_active (struct client *client)
+{
+    return client->have_dgram && have_dgram && client->dgram_addr.type != BADDR_TYPE_NONE &&
+           BReactor_GetTime(&ss) < btime_add(client->dgram_last_recv, UDPGW_DGRAM_TIMEOUT);
+}
+
+int client_dgram_send_message (struct client *client, const uint8_t *data, int data_len)
+{
+    ASSERT(client->have_dgram)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= UDPGW_DGRAM_MAX_MESSAGE)
+    
+    BufferWriter *input = UdpGwDgram_GetSendInput(&client->dgram);
+    
+    uint8_t *out;
+    if (!BufferWriter_StartPacket(input, &out)) {
+        return 0;
+    }
+    memcpy(out, data, data_len);
+    BufferWriter_EndPacket(input, data_len);
+    
+    return 1;
+}
+
+void client_dgram_send_if_handler_send (struct client *client, uint8_t *data, int data_len)
+{
+    ASSERT(client->have_dgram)
+    ASSERT(!client->dgram_send_waiting)
+    
+    // drop the datagram if there is nowhere to send it
+    if (!have_dgram || client->dgram_addr.type == BADDR_TYPE_NONE) {
+        PacketPassInterface_Done(&client->dgram_send_if);
+        return;
+    }
+    
+    // wait for the socket if it is sending for another client
+    if (dgram_sending) {
+        client->dgram_send_data = data;
+        client->dgram_send_len = data_len;
+        client->dgram_send_waiting = 1;
+        LinkedList1_Append(&dgram_send_waiting_list, &client->dgram_send_waiting_list_node);
+        return;
+    }
+    
+    dgram_send_start(client, data, data_len);
+}
+
+void client_dgram_recv_if_handler_send (struct client *client, uint8_t *data, int data_len)
+{
+    ASSERT(client->have_dgram)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= UDPGW_DGRAM_MAX_MESSAGE)
+    
+    // accept packet
+    PacketPassInterface_Done(&client->dgram_recv_if);
+    
+    // the datagram this came from is authentic, so reply to where it came from
+    if (dgram_recv_client == client) {
+        client->dgram_addr = dgram_recv_addr;
+    }
+    client->dgram_last_recv = BReactor_GetTime(&ss);
+    
+    // update counters
+    client->num_packets_from++;
+    client->num_bytes_from += data_len;
+    
+    client_process_message(client, data, data_len, 1);
+}
+
+void client_dgram_recv_input_handler_done (struct client *client)
+{
+    ASSERT(client->have_dgram)
+    
+    // the socket may have failed in the meantime
+    if (!have_dgram) {
+        return;
+    }
+    ASSERT(dgram_recv_client == client)
+    
+    // receive next datagram
+    dgram_recv_client = NULL;
+    dgram_recv_next();
+}
+
+void client_dgram_offer_handler_done (struct client *client)
+{
+    ASSERT(client->have_dgram)
+}
+
+#endif
+
 int get_local_num_ports (int addr_type)
 {
     switch (addr_type) {
@@ -923,67 +2276,243 @@ BAddr get_local_addr (int addr_type)
     }
 }
 
-uint8_t * build_port_usage_array_and_find_least_used_connection (BAddr remote_addr, struct connection **out_con)
+size_t remote_key_hash (BAddr *key)
+{
+    switch (key->type) {
+        case BADDR_TYPE_IPV4: {
+            uint8_t buf[6];
+            memcpy(buf, &key->ipv4.ip, 4);
+            memcpy(buf + 4, &key->ipv4.port, 2);
+            return badvpn_djb2_hash_bin(buf, sizeof(buf));
+        } break;
+        case BADDR_TYPE_IPV6: {
+            uint8_t buf[18];
+            memcpy(buf, key->ipv6.ip, 16);
+            memcpy(buf + 16, &key->ipv6.port, 2);
+            return badvpn_djb2_hash_bin(buf, sizeof(buf));
+        } break;
+        default:
+            ASSERT(0);
+            return 0;
+    }
+}
+
+struct remote_ports * remote_ports_get (BAddr remote_addr)
 {
     ASSERT(remote_addr.type == BADDR_TYPE_IPV4 || remote_addr.type == BADDR_TYPE_IPV6)
-    ASSERT(get_local_num_ports(remote_addr.type) >= 0)
     
-    int local_num_ports = get_local_num_ports(remote_addr.type);
+    // with unique local ports, connections conflict if they have the same remote IP
+    if (options.unique_local_ports) {
+        BAddr_SetPort(&remote_addr, 0);
+    }
+    
+    // lookup existing entry
+    struct remote_ports *rp = RemotePortsHash_Lookup(&remote_ports_hash, 0, &remote_addr).ptr;
+    if (rp) {
+        return rp;
+    }
+    
+    // grow hash to keep chains short
+    if (num_remote_ports >= remote_ports_hash.num_buckets) {
+        if (!RemotePortsHash_MultiplyBuckets(&remote_ports_hash, 0, 1)) {
+            BLog(BLOG_WARNING, "RemotePortsHash_MultiplyBuckets failed");
+        }
+    }
     
-    // allocate port usage array
-    uint8_t *port_usage = (uint8_t *)BAllocSize(bsize_fromint(local_num_ports));
-    if (!port_usage) {
+    // allocate structure
+    rp = (struct remote_ports *)malloc(sizeof(*rp));
+    if (!rp) {
+        BLog(BLOG_ERROR, "malloc failed");
         return NULL;
     }
     
-    // zero array
-    memset(port_usage, 0, local_num_ports);
+    // init key
+    rp->key = remote_addr;
+    rp->key_hash = remote_key_hash(&rp->key);
+    
+    // init connections list
+    LinkedList1_Init(&rp->connections_list);
+    
+    // no ports handed out yet
+    rp->next_port_index = 0;
+    FreePortsArray_InitEmpty(rp);
+    rp->num_free_ports = 0;
+    
+    // insert to hash
+    RemotePortsHashRef ref = {rp, rp};
+    ASSERT_EXECUTE(RemotePortsHash_Insert(&remote_ports_hash, 0, ref, NULL))
+    num_remote_ports++;
+    
+    return rp;
+}
+
+void remote_ports_maybe_free (struct remote_ports *rp)
+{
+    // keep while any connection is using a port
+    if (!LinkedList1_IsEmpty(&rp->connections_list)) {
+        return;
+    }
+    
+    // remove from hash
+    RemotePortsHashRef ref = {rp, rp};
+    RemotePortsHash_Remove(&remote_ports_hash, 0, ref);
+    num_remote_ports--;
+    
+    // free free ports array
+    FreePortsArray_Free(rp);
+    
+    // free structure
+    free(rp);
+}
+
+int remote_ports_alloc_port (struct remote_ports *rp)
+{
+    int local_num_ports = get_local_num_ports(rp->key.type);
+    
+    // prefer ports which were used before and released
+    if (rp->num_free_ports > 0) {
+        return rp->free_ports[--rp->num_free_ports];
+    }
+    
+    // all ports taken
+    if (rp->next_port_index >= local_num_ports) {
+        return -1;
+    }
+    
+    // make sure the port will fit into the free ports array when released,
+    // so that releasing never needs to allocate
+    if (rp->next_port_index == rp->free_ports_capacity && !FreePortsArray_DoubleUpLimit(rp, local_num_ports)) {
+        BLog(BLOG_ERROR, "FreePortsArray_DoubleUpLimit failed");
+        return -1;
+    }
+    
+    return rp->next_port_index++;
+}
+
+struct connection * remote_ports_find_unused_connection (struct remote_ports *rp)
+{
+    // the list is ordered by last use time, least recently used first
+    for (LinkedList1Node *ln = LinkedList1_GetFirst(&rp->connections_list); ln; ln = LinkedList1Node_Next(ln)) {
+        struct connection *con = UPPER_OBJECT(ln, struct connection, remote_ports_list_node);
+        ASSERT(con->remote_ports == rp)
+        ASSERT(con->local_port_index >= 0)
+        ASSERT(!con->closing)
+        
+        if (!PacketPassFairQueueFlow_IsBusy(&con->send_qflow)) {
+            return con;
+        }
+    }
+    
+    return NULL;
+}
+
+void connection_bind_local_port (struct connection *con)
+{
+    ASSERT(get_local_num_ports(con->addr.type) >= 0)
+    ASSERT(con->local_port_index == -1)
+    
+    // set SO_REUSEADDR
+    if (!BDatagram_SetReuseAddr(&con->udp_dgram, 1)) {
+        client_log(con->client, BLOG_ERROR, "set SO_REUSEADDR failed");
+        goto failed;
+    }
+    
+    // get port usage for the remote address
+    struct remote_ports *rp = remote_ports_get(con->addr);
+    if (!rp) {
+        goto failed;
+    }
     
-    struct connection *least_con = NULL;
+    // get starting local address
+    BAddr local_addr = get_local_addr(con->addr.type);
     
-    // flag inappropriate ports (those with the same remote address)
-    for (LinkedList1Node *ln = LinkedList1_GetFirst(&clients_list); ln; ln = LinkedList1Node_Next(ln)) {
-        struct client *client = UPPER_OBJECT(ln, struct client, clients_list_node);
+    int port_index;
+    int num_bind_failed = 0;
+    int closed_unused = 0;
+    
+    while (1) {
+        // get a port not used for the remote address
+        port_index = remote_ports_alloc_port(rp);
         
-        for (LinkedList1Node *ln2 = LinkedList1_GetFirst(&client->connections_list); ln2; ln2 = LinkedList1Node_Next(ln2)) {
-            struct connection *con = UPPER_OBJECT(ln2, struct connection, connections_list_node);
-            ASSERT(con->client == client)
-            ASSERT(!con->closing)
-            
-            if (con->addr.type != remote_addr.type || con->local_port_index < 0) {
-                continue;
+        if (port_index < 0) {
+            // try closing an unused connection with the same remote address,
+            // once, and take its port
+            struct connection *unused_con;
+            if (closed_unused || !(unused_con = remote_ports_find_unused_connection(rp))) {
+                break;
             }
-            ASSERT(con->local_port_index < local_num_ports)
             
-            if (options.unique_local_ports) {
-                BIPAddr ip1;
-                BIPAddr ip2;
-                BAddr_GetIPAddr(&con->addr, &ip1);
-                BAddr_GetIPAddr(&remote_addr, &ip2);
-                if (!BIPAddr_Compare(&ip1, &ip2)) {
-                    continue;
-                }
-            } else {
-                if (!BAddr_Compare(&con->addr, &remote_addr)) {
-                    continue;
-                }
-            }
+            BLog(BLOG_INFO, "closing connection for its remote address");
             
-            port_usage[con->local_port_index] = 1;
+            // return ports we failed to bind to, so they survive if the
+            // remote ports entry goes away below
+            rp->num_free_ports += num_bind_failed;
+            num_bind_failed = 0;
             
-            if (!PacketPassFairQueueFlow_IsBusy(&con->send_qflow)) {
-                if (!least_con || con->last_use_time < least_con->last_use_time) {
-                    least_con = con;
-                }
+            // close the offending connection, releasing its port
+            connection_close(unused_con);
+            closed_unused = 1;
+            
+            // get port usage again, it was freed if that was the last connection
+            if (!(rp = remote_ports_get(con->addr))) {
+                goto failed;
             }
+            continue;
+        }
+        
+        BAddr bind_addr = local_addr;
+        BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)port_index));
+        if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
+            break;
         }
+        
+        // set the port aside so we don't pick it again now; it fits
+        // because the array has room for all ports handed out
+        rp->free_ports[rp->num_free_ports + num_bind_failed] = port_index;
+        num_bind_failed++;
+    }
+    
+    // return ports we failed to bind to
+    rp->num_free_ports += num_bind_failed;
+    
+    if (port_index < 0) {
+        remote_ports_maybe_free(rp);
+        goto failed;
+    }
+    
+    // remember which port we're using
+    con->local_port_index = port_index;
+    con->remote_ports = rp;
+    LinkedList1_Append(&rp->connections_list, &con->remote_ports_list_node);
+    return;
+    
+failed:
+    client_log(con->client, BLOG_WARNING, "failed to bind to any local address; proceeding regardless");
+}
+
+void connection_release_local_port (struct connection *con)
+{
+    if (con->local_port_index < 0) {
+        return;
     }
     
-    *out_con = least_con;
-    return port_usage;
+    struct remote_ports *rp = con->remote_ports;
+    ASSERT(con->local_port_index < rp->next_port_index)
+    ASSERT(rp->num_free_ports < rp->free_ports_capacity)
+    
+    // return port to free ports
+    rp->free_ports[rp->num_free_ports++] = con->local_port_index;
+    
+    // remove from remote's connections list
+    LinkedList1_Remove(&rp->connections_list, &con->remote_ports_list_node);
+    
+    // free remote ports if unused
+    remote_ports_maybe_free(rp);
+    
+    con->local_port_index = -1;
 }
 
-void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, const uint8_t *data, int data_len)
+void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, int dns, const uint8_t *data, int data_len)
 {
     ASSERT(client->num_connections < options.max_connections_for_client)
     ASSERT(!find_connection(client, conid))
@@ -994,9 +2523,9 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     ASSERT(data_len <= options.udp_mtu)
     
     // allocate structure
-    struct connection *con = (struct connection *)malloc(sizeof(*con));
+    struct connection *con = (struct connection *)BSlab_Alloc(&connections_slab);
     if (!con) {
-        client_log(client, BLOG_ERROR, "malloc failed");
+        client_log(client, BLOG_ERROR, "BSlab_Alloc failed");
         goto fail0;
     }
     
@@ -1005,11 +2534,12 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     con->conid = conid;
     con->addr = addr;
     con->orig_addr = orig_addr;
+    con->dns = dns;
     con->first_data = data;
     con->first_data_len = data_len;
     
     // set last use time
-    con->last_use_time = btime_gettime();
+    con->last_use_time = BReactor_GetTime(&ss);
     
     // set not closing
     con->closing = 0;
@@ -1028,6 +2558,10 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     }
     con->send_if = PacketProtoFlow_GetInput(&con->send_ppflow);
     
+    // receive from UDP whenever there is space for a packet to the client;
+    // the first time will be once the flow has become ready
+    BufferWriter_SetReadyHandler(con->send_if, (BufferWriter_handler_ready)connection_send_if_handler_ready, con);
+    
     // init UDP dgram
     if (!BDatagram_Init(&con->udp_dgram, addr.type, &ss, con, (BDatagram_handler)connection_dgram_handler_event)) {
         client_log(client, BLOG_ERROR, "BDatagram_Init failed");
@@ -1036,100 +2570,41 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     
     con->local_port_index = -1;
     
-    int local_num_ports = get_local_num_ports(addr.type);
+    // bind to a local port if a port range is configured
+    if (get_local_num_ports(addr.type) >= 0) {
+        connection_bind_local_port(con);
+    }
     
-    if (local_num_ports >= 0) {
-        // build port usage array, find least used connection
-        struct connection *least_con;
-        uint8_t *port_usage = build_port_usage_array_and_find_least_used_connection(addr, &least_con);
-        if (!port_usage) {
-            client_log(client, BLOG_ERROR, "build_port_usage_array failed");
-            goto failed;
-        }
-        
-        // set SO_REUSEADDR
-        if (!BDatagram_SetReuseAddr(&con->udp_dgram, 1)) {
-            client_log(client, BLOG_ERROR, "set SO_REUSEADDR failed");
-            goto failed;
-        }
-        
-        // get starting local address
-        BAddr local_addr = get_local_addr(addr.type);
-        
-        // try different ports
-        for (int i = 0; i < local_num_ports; i++) {
-            // skip inappropriate ports
-            if (port_usage[i]) {
-                continue;
-            }
-            
-            BAddr bind_addr = local_addr;
-            BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)i));
-            if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
-                // remember which port we're using
-                con->local_port_index = i;
-                goto cont;
-            }
-        }
-        
-        // try closing an unused connection with the same remote addr
-        if (!least_con) {
-            goto failed;
-        }
-        
-        ASSERT(least_con->addr.type == addr.type)
-        ASSERT(least_con->local_port_index >= 0)
-        ASSERT(least_con->local_port_index < local_num_ports)
-        ASSERT(!PacketPassFairQueueFlow_IsBusy(&least_con->send_qflow))
-        
-        int i = least_con->local_port_index;
+    // connect UDP dgram to the remote address, so the system keeps the route
+    // instead of looking it up for every datagram
+    if (!BDatagram_Connect(&con->udp_dgram, addr)) {
+        client_log(client, BLOG_WARNING, "BDatagram_Connect failed; sending unconnected");
         
-        BLog(BLOG_INFO, "closing connection for its remote address");
-        
-        // close the offending connection
-        connection_close(least_con);
-        
-        // try binding to its port
-        BAddr bind_addr = local_addr;
-        BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)i));
-        if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
-            // remember which port we're using
-            con->local_port_index = i;
-            goto cont;
-        }
-        
-    failed:
-        client_log(client, BLOG_WARNING, "failed to bind to any local address; proceeding regardless");
-    cont:;
-        BFree(port_usage);
+        // set UDP dgram send address
+        BIPAddr ipaddr;
+        BIPAddr_InitInvalid(&ipaddr);
+        BDatagram_SetSendAddrs(&con->udp_dgram, addr, ipaddr);
     }
     
-    // set UDP dgram send address
-    BIPAddr ipaddr;
-    BIPAddr_InitInvalid(&ipaddr);
-    BDatagram_SetSendAddrs(&con->udp_dgram, addr, ipaddr);
-    
     // init UDP dgram interfaces
-    BDatagram_SendAsync_Init(&con->udp_dgram, options.udp_mtu);
-    BDatagram_RecvAsync_Init(&con->udp_dgram, options.udp_mtu);
-    
-    // init UDP writer
-    BufferWriter_Init(&con->udp_send_writer, options.udp_mtu, BReactor_PendingGroup(&ss));
-    
-    // init UDP buffer
-    if (!PacketBuffer_Init(&con->udp_send_buffer, BufferWriter_GetOutput(&con->udp_send_writer), BDatagram_SendAsync_GetIf(&con->udp_dgram), CONNECTION_UDP_BUFFER_SIZE, BReactor_PendingGroup(&ss))) {
-        client_log(client, BLOG_ERROR, "PacketBuffer_Init failed");
+    if (!BDatagram_SendAsync_Init2(&con->udp_dgram, options.udp_mtu, options.udp_batch)) {
+        client_log(client, BLOG_ERROR, "BDatagram_SendAsync_Init2 failed");
+        goto fail3;
+    }
+    if (!BDatagram_RecvAsync_Init2(&con->udp_dgram, options.udp_mtu, options.udp_batch)) {
+        client_log(client, BLOG_ERROR, "BDatagram_RecvAsync_Init2 failed");
         goto fail4;
     }
     
-    // init UDP recv interface
-    PacketPassInterface_Init(&con->udp_recv_if, options.udp_mtu, (PacketPassInterface_handler_send)connection_udp_recv_if_handler_send, con, BReactor_PendingGroup(&ss));
+    // init UDP sending
+    PacketPassInterface_Sender_Init(BDatagram_SendAsync_GetIf(&con->udp_dgram), (PacketPassInterface_handler_done)connection_udp_send_handler_done, con);
+    LinkedList1_Init(&con->udp_send_queue);
+    con->udp_send_queue_bytes = 0;
     
-    // init UDP recv buffer
-    if (!SinglePacketBuffer_Init(&con->udp_recv_buffer, BDatagram_RecvAsync_GetIf(&con->udp_dgram), &con->udp_recv_if, BReactor_PendingGroup(&ss))) {
-        client_log(client, BLOG_ERROR, "SinglePacketBuffer_Init failed");
-        goto fail5;
-    }
+    // init UDP receiving; datagrams are received directly into the
+    // client's packet buffer, behind the room for the header
+    PacketRecvInterface_Receiver_Init(BDatagram_RecvAsync_GetIf(&con->udp_dgram), (PacketRecvInterface_handler_done)connection_udp_recv_handler_done, con);
+    con->udp_recv_out = NULL;
     
     // insert to client's connections tree
     ASSERT_EXECUTE(BAVL_Insert(&client->connections_tree, &con->connections_tree_node, NULL))
@@ -1139,25 +2614,23 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     
     // increment number of connections
     client->num_connections++;
+    totals.num_connections++;
     
     connection_log(con, BLOG_DEBUG, "initialized");
     
     return;
     
-fail5:
-    PacketPassInterface_Free(&con->udp_recv_if);
-    PacketBuffer_Free(&con->udp_send_buffer);
 fail4:
-    BufferWriter_Free(&con->udp_send_writer);
-    BDatagram_RecvAsync_Free(&con->udp_dgram);
     BDatagram_SendAsync_Free(&con->udp_dgram);
+fail3:
+    connection_release_local_port(con);
     BDatagram_Free(&con->udp_dgram);
 fail2:
     PacketProtoFlow_Free(&con->send_ppflow);
 fail1:
     PacketPassFairQueueFlow_Free(&con->send_qflow);
     BPending_Free(&con->first_job);
-    free(con);
+    BSlab_Release(&connections_slab, con);
 fail0:
     return;
 }
@@ -1194,7 +2667,7 @@ void connection_free (struct connection *con)
     BPending_Free(&con->first_job);
     
     // free structure
-    free(con);
+    BSlab_Release(&connections_slab, con);
 }
 
 void connection_logfunc (struct connection *con)
@@ -1218,22 +2691,21 @@ void connection_log (struct connection *con, int level, const char *fmt, ...)
 
 void connection_free_udp (struct connection *con)
 {
-    // free UDP receive buffer
-    SinglePacketBuffer_Free(&con->udp_recv_buffer);
-    
-    // free UDP receive interface
-    PacketPassInterface_Free(&con->udp_recv_if);
-    
-    // free UDP buffer
-    PacketBuffer_Free(&con->udp_send_buffer);
-    
-    // free UDP writer
-    BufferWriter_Free(&con->udp_send_writer);
-    
     // free UDP dgram interfaces
     BDatagram_RecvAsync_Free(&con->udp_dgram);
     BDatagram_SendAsync_Free(&con->udp_dgram);
     
+    // release datagrams waiting to be sent
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&con->udp_send_queue))) {
+        struct udp_send_packet *pkt = UPPER_OBJECT(node, struct udp_send_packet, queue_node);
+        LinkedList1_Remove(&con->udp_send_queue, &pkt->queue_node);
+        BSlab_Release(pkt->slab, pkt);
+    }
+    
+    // release local port
+    connection_release_local_port(con);
+    
     // free UDP dgram
     BDatagram_Free(&con->udp_dgram);
 }
@@ -1245,62 +2717,63 @@ void connection_first_job_handler (struct connection *con)
     connection_send_to_udp(con, con->first_data, con->first_data_len);
 }
 
-void connection_send_to_client (struct connection *con, uint8_t flags, const uint8_t *data, int data_len)
+int client_header_len (BAddr orig_addr)
 {
-    ASSERT(data_len >= 0)
-    ASSERT(data_len <= options.udp_mtu)
-    
-    size_t addr_len = (con->orig_addr.type == BADDR_TYPE_IPV6) ? sizeof(struct udpgw_addr_ipv6) :
-                      (con->orig_addr.type == BADDR_TYPE_IPV4) ? sizeof(struct udpgw_addr_ipv4) : 0;
-    if (data_len > udpgw_mtu - (int)(sizeof(struct udpgw_header) + addr_len)) {
-        connection_log(con, BLOG_WARNING, "packet is too large, cannot send to client");
-        return;
-    }
-    
-    // get buffer location
-    uint8_t *out;
-    if (!BufferWriter_StartPacket(con->send_if, &out)) {
-        connection_log(con, BLOG_ERROR, "out of client buffer");
-        return;
+    switch (orig_addr.type) {
+        case BADDR_TYPE_IPV4:
+            return sizeof(struct udpgw_header) + sizeof(struct udpgw_addr_ipv4);
+        case BADDR_TYPE_IPV6:
+            return sizeof(struct udpgw_header) + sizeof(struct udpgw_addr_ipv6);
+        default:
+            ASSERT(0);
+            return 0;
     }
+}
+
+void write_client_header (uint16_t conid, BAddr orig_addr, uint8_t flags, uint8_t *out)
+{
     int out_pos = 0;
     
-    if (con->orig_addr.type == BADDR_TYPE_IPV6) {
+    if (orig_addr.type == BADDR_TYPE_IPV6) {
         flags |= UDPGW_CLIENT_FLAG_IPV6;
     }
     
     // write header
     struct udpgw_header header;
     header.flags = htol8(flags);
-    header.conid = htol16(con->conid);
+    header.conid = htol16(conid);
     memcpy(out + out_pos, &header, sizeof(header));
     out_pos += sizeof(header);
     
     // write address
-    switch (con->orig_addr.type) {
+    switch (orig_addr.type) {
         case BADDR_TYPE_IPV4: {
             struct udpgw_addr_ipv4 addr_ipv4;
-            addr_ipv4.addr_ip = con->orig_addr.ipv4.ip;
-            addr_ipv4.addr_port = con->orig_addr.ipv4.port;
+            addr_ipv4.addr_ip = orig_addr.ipv4.ip;
+            addr_ipv4.addr_port = orig_addr.ipv4.port;
             memcpy(out + out_pos, &addr_ipv4, sizeof(addr_ipv4));
             out_pos += sizeof(addr_ipv4);
         } break;
         case BADDR_TYPE_IPV6: {
             struct udpgw_addr_ipv6 addr_ipv6;
-            memcpy(addr_ipv6.addr_ip, con->orig_addr.ipv6.ip, sizeof(addr_ipv6.addr_ip));
-            addr_ipv6.addr_port = con->orig_addr.ipv6.port;
+            memcpy(addr_ipv6.addr_ip, orig_addr.ipv6.ip, sizeof(addr_ipv6.addr_ip));
+            addr_ipv6.addr_port = orig_addr.ipv6.port;
             memcpy(out + out_pos, &addr_ipv6, sizeof(addr_ipv6));
             out_pos += sizeof(addr_ipv6);
         } break;
     }
     
-    // write message
-    memcpy(out + out_pos, data, data_len);
-    out_pos += data_len;
-    
-    // submit written message
-    ASSERT(out_pos <= udpgw_mtu)
-    BufferWriter_EndPacket(con->send_if, out_pos);
+    ASSERT(out_pos == client_header_len(orig_addr))
+}
+
+int connection_client_header_len (struct connection *con)
+{
+    return client_header_len(con->orig_addr);
+}
+
+void connection_write_client_header (struct connection *con, uint8_t flags, uint8_t *out)
+{
+    write_client_header(con->conid, con->orig_addr, flags, out);
 }
 
 int connection_send_to_udp (struct connection *con, const uint8_t *data, int data_len)
@@ -1313,24 +2786,53 @@ int connection_send_to_udp (struct connection *con, const uint8_t *data, int dat
     connection_log(con, BLOG_DEBUG, "from client %d bytes", data_len);
     
     // set last use time
-    con->last_use_time = btime_gettime();
+    con->last_use_time = BReactor_GetTime(&ss);
     
     // move connection to front
     LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
     LinkedList1_Append(&client->connections_list, &con->connections_list_node);
     
-    // get buffer location
-    uint8_t *out;
-    if (!BufferWriter_StartPacket(&con->udp_send_writer, &out)) {
+    // move connection to front of remote's connections list
+    if (con->local_port_index >= 0) {
+        LinkedList1_Remove(&con->remote_ports->connections_list, &con->remote_ports_list_node);
+        LinkedList1_Append(&con->remote_ports->connections_list, &con->remote_ports_list_node);
+    }
+    
+    // choose buffer size
+    BSlab *slab = &udp_send_slab;
+    int size = options.udp_mtu;
+    if (data_len <= UDP_SEND_SMALL_SIZE && UDP_SEND_SMALL_SIZE < options.udp_mtu) {
+        slab = &udp_send_small_slab;
+        size = UDP_SEND_SMALL_SIZE;
+    }
+    
+    // limit how much buffer one connection can have queued
+    int was_empty = LinkedList1_IsEmpty(&con->udp_send_queue);
+    if (!was_empty && size > CONNECTION_UDP_BUFFER_SIZE * options.udp_mtu - con->udp_send_queue_bytes) {
         connection_log(con, BLOG_ERROR, "out of UDP buffer");
         return 0;
     }
     
+    // get buffer
+    struct udp_send_packet *pkt = (struct udp_send_packet *)BSlab_Alloc(slab);
+    if (!pkt) {
+        connection_log(con, BLOG_ERROR, "BSlab_Alloc failed");
+        return 0;
+    }
+    pkt->slab = slab;
+    
     // write message
-    memcpy(out, data, data_len);
+    memcpy(pkt->data, data, data_len);
+    pkt->len = data_len;
     
-    // submit written message
-    BufferWriter_EndPacket(&con->udp_send_writer, data_len);
+    // queue message
+    LinkedList1_Append(&con->udp_send_queue, &pkt->queue_node);
+    con->udp_send_queue_bytes += size;
+    
+    // send it now if nothing else is being sent
+    if (was_empty) {
+        connection_udp_send_next(con);
+    }
     
     return 1;
 }
@@ -1394,27 +2896,104 @@ void connection_dgram_handler_event (struct connection *con, int event)
     connection_close(con);
 }
 
-void connection_udp_recv_if_handler_send (struct connection *con, uint8_t *data, int data_len)
+void connection_send_if_handler_ready (struct connection *con)
+{
+    ASSERT(!con->udp_recv_out)
+    
+    // the UDP dgram is gone once closing
+    if (con->closing) {
+        return;
+    }
+    
+    // get buffer location
+    uint8_t *out;
+    int res = BufferWriter_StartPacket(con->send_if, &out);
+    ASSERT_FORCE(res)
+    con->udp_recv_out = out;
+    
+    // receive the datagram behind the header; the client MTU has room for
+    // the header with any address and a whole datagram
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&con->udp_dgram), out + connection_client_header_len(con));
+}
+
+void connection_udp_recv_handler_done (struct connection *con, int data_len)
 {
     struct client *client = con->client;
     ASSERT(!con->closing)
+    ASSERT(con->udp_recv_out)
     ASSERT(data_len >= 0)
     ASSERT(data_len <= options.udp_mtu)
     
     connection_log(con, BLOG_DEBUG, "from UDP %d bytes", data_len);
     
     // set last use time
-    con->last_use_time = btime_gettime();
+    con->last_use_time = BReactor_GetTime(&ss);
     
     // move connection to front
     LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
     LinkedList1_Append(&client->connections_list, &con->connections_list_node);
     
-    // accept packet
-    PacketPassInterface_Done(&con->udp_recv_if);
+    // move connection to front of remote's connections list
+    if (con->local_port_index >= 0) {
+        LinkedList1_Remove(&con->remote_ports->connections_list, &con->remote_ports_list_node);
+        LinkedList1_Append(&con->remote_ports->connections_list, &con->remote_ports_list_node);
+    }
+    
+    // let the DNS cache see responses from the DNS server, which may also
+    // answer queries held back for this one
+    if (con->dns && have_dns_cache) {
+        DnsCache_HandleResponse(&dns_cache, con->udp_recv_out + connection_client_header_len(con), data_len);
+    }
+    
+    // write header in front of the datagram
+    connection_write_client_header(con, 0, con->udp_recv_out);
+    int out_len = connection_client_header_len(con) + data_len;
+    ASSERT(out_len <= udpgw_mtu)
+    
+    // update counters
+    client->num_packets_to++;
+    client->num_bytes_to += out_len;
+    
+    #ifdef BADVPN_UDPGW_DGRAM
+    // send the message as a datagram if the client is reachable that way,
+    // and receive the next one into the same place
+    if (out_len <= UDPGW_DGRAM_MAX_MESSAGE && client_dgram_active(client) && client_dgram_send_message(client, con->udp_recv_out, out_len)) {
+        PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&con->udp_dgram), con->udp_recv_out + connection_client_header_len(con));
+        return;
+    }
+    #endif
+    
+    // submit written message; receiving continues once the
+    // client's packet buffer has space again
+    con->udp_recv_out = NULL;
+    BufferWriter_EndPacket(con->send_if, out_len);
+}
+
+void connection_udp_send_next (struct connection *con)
+{
+    ASSERT(!con->closing)
+    ASSERT(!LinkedList1_IsEmpty(&con->udp_send_queue))
+    
+    struct udp_send_packet *pkt = UPPER_OBJECT(LinkedList1_GetFirst(&con->udp_send_queue), struct udp_send_packet, queue_node);
+    
+    PacketPassInterface_Sender_Send(BDatagram_SendAsync_GetIf(&con->udp_dgram), pkt->data, pkt->len);
+}
+
+void connection_udp_send_handler_done (struct connection *con)
+{
+    ASSERT(!con->closing)
+    ASSERT(!LinkedList1_IsEmpty(&con->udp_send_queue))
     
-    // send packet to client
-    connection_send_to_client(con, 0, data, data_len);
+    // release sent datagram
+    struct udp_send_packet *pkt = UPPER_OBJECT(LinkedList1_GetFirst(&con->udp_send_queue), struct udp_send_packet, queue_node);
+    LinkedList1_Remove(&con->udp_send_queue, &pkt->queue_node);
+    con->udp_send_queue_bytes -= (pkt->slab == &udp_send_small_slab) ? UDP_SEND_SMALL_SIZE : options.udp_mtu;
+    BSlab_Release(pkt->slab, pkt);
+    
+    // send next datagram
+    if (!LinkedList1_IsEmpty(&con->udp_send_queue)) {
+        connection_udp_send_next(con);
+    }
 }
 
 struct connection * find_connection (struct client *client, uint16_t conid)
@@ -1435,6 +3014,11 @@ int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2)
     return B_COMPARE(*v1, *v2);
 }
 
+int uint64_comparator (void *unused, uint64_t *v1, uint64_t *v2)
+{
+    return B_COMPARE(*v1, *v2);
+}
+
 void maybe_update_dns (void)
 {
 #ifndef BADVPN_USE_WINAPI
@@ -1471,3 +3055,114 @@ fail:
     BAddr_InitNone(&dns_addr);
 #endif
 }
+
+void dns_cache_handler_send (void *unused, BAddr local_addr, BAddr remote_addr, uint64_t tag, const uint8_t *data, int data_len)
+{
+    ASSERT(have_dns_cache)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= options.udp_mtu)
+    
+    // find client; it may be gone if its query was held back
+    uint64_t client_id = tag >> 16;
+    uint16_t conid = tag & 0xFFFF;
+    BAVLNode *tree_node = BAVL_LookupExact(&clients_tree, &client_id);
+    if (!tree_node) {
+        return;
+    }
+    struct client *client = UPPER_OBJECT(tree_node, struct client, clients_tree_node);
+    
+    client_log(client, BLOG_DEBUG, "DNS answer from cache");
+    
+    int out_len = client_header_len(remote_addr) + data_len;
+    ASSERT(out_len <= udpgw_mtu)
+    
+    // send over the datagram transport if the client is reachable that way,
+    // otherwise over the stream
+    BufferWriter *writer = PacketProtoFlow_GetInput(&client->dns_ppflow);
+    #ifdef BADVPN_UDPGW_DGRAM
+    if (out_len <= UDPGW_DGRAM_MAX_MESSAGE && client_dgram_active(client)) {
+        writer = UdpGwDgram_GetSendInput(&client->dgram);
+    }
+    #endif
+    
+    // drop the answer if there's no space, like any datagram
+    uint8_t *out;
+    if (!BufferWriter_StartPacket(writer, &out)) {
+        client->num_dropped_to++;
+        return;
+    }
+    write_client_header(conid, remote_addr, 0, out);
+    memcpy(out + client_header_len(remote_addr), data, data_len);
+    BufferWriter_EndPacket(writer, out_len);
+    
+    // update counters
+    client->num_packets_to++;
+    client->num_bytes_to += out_len;
+    dns_cache_num_answers++;
+}
+
+void stats_handler_report (void *unused, StatsServerReport *r)
+{
+    // global counters; totals are updated when a client disconnects,
+    // so add the counters of connected clients
+    uint64_t num_connections = 0;
+    uint64_t num_packets_from = totals.num_packets_from;
+    uint64_t num_bytes_from = totals.num_bytes_from;
+    uint64_t num_packets_to = totals.num_packets_to;
+    uint64_t num_bytes_to = totals.num_bytes_to;
+    uint64_t num_dropped_to = totals.num_dropped_to;
+    
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&clients_list); node; node = LinkedList1Node_Next(node)) {
+        struct client *client = UPPER_OBJECT(node, struct client, clients_list_node);
+        num_connections += client->num_connections;
+        num_packets_from += client->num_packets_from;
+        num_bytes_from += client->num_bytes_from;
+        num_packets_to += client->num_packets_to;
+        num_bytes_to += client->num_bytes_to;
+        num_dropped_to += client->num_dropped_to;
+    }
+    
+    StatsServerReport_Printf(r, "udpgw_clients %d\n", num_clients);
+    StatsServerReport_Printf(r, "udpgw_clients_total %"PRIu64"\n", totals.num_clients);
+    StatsServerReport_Printf(r, "udpgw_connections %"PRIu64"\n", num_connections);
+    StatsServerReport_Printf(r, "udpgw_connections_total %"PRIu64"\n", totals.num_connections);
+    StatsServerReport_Printf(r, "udpgw_remote_addresses %d\n", num_remote_ports);
+    StatsServerReport_Printf(r, "udpgw_packets_from_clients_total %"PRIu64"\n", num_packets_from);
+    StatsServerReport_Printf(r, "udpgw_bytes_from_clients_total %"PRIu64"\n", num_bytes_from);
+    StatsServerReport_Printf(r, "udpgw_packets_to_clients_total %"PRIu64"\n", num_packets_to);
+    StatsServerReport_Printf(r, "udpgw_bytes_to_clients_total %"PRIu64"\n", num_bytes_to);
+    StatsServerReport_Printf(r, "udpgw_dropped_to_clients_total %"PRIu64"\n", num_dropped_to);
+    if (have_dns_cache) {
+        StatsServerReport_Printf(r, "udpgw_dns_cache_answers_total %"PRIu64"\n", dns_cache_num_answers);
+    }
+    
+    // per-client counters
+    for (LinkedList1Node *node = LinkedList1_GetFirst(&clients_list); node; node = LinkedList1Node_Next(node)) {
+        struct client *client = UPPER_OBJECT(node, struct client, clients_list_node);
+        
+        char addr[BADDR_MAX_PRINT_LEN];
+        BAddr_Print(&client->addr, addr);
+        
+        StatsServerReport_Printf(r, "udpgw_client_connections{client=\"%s\"} %d\n", addr, client->num_connections);
+        StatsServerReport_Printf(r, "udpgw_client_send_queue{client=\"%s\"} %d\n", addr, PacketPassFairQueue_GetNumQueued(&client->send_queue));
+        StatsServerReport_Printf(r, "udpgw_client_packets_from_total{client=\"%s\"} %"PRIu64"\n", addr, client->num_packets_from);
+        StatsServerReport_Printf(r, "udpgw_client_bytes_from_total{client=\"%s\"} %"PRIu64"\n", addr, client->num_bytes_from);
+        StatsServerReport_Printf(r, "udpgw_client_packets_to_total{client=\"%s\"} %"PRIu64"\n", addr, client->num_packets_to);
+        StatsServerReport_Printf(r, "udpgw_client_bytes_to_total{client=\"%s\"} %"PRIu64"\n", addr, client->num_bytes_to);
+        StatsServerReport_Printf(r, "udpgw_client_dropped_to_total{client=\"%s\"} %"PRIu64"\n", addr, client->num_dropped_to);
+        if (options.client_rate > 0) {
+            StatsServerReport_Printf(r, "udpgw_client_rate_limited_from_total{client=\"%s\"} %"PRIu64"\n", addr, PacketPassRateLimiter_GetNumDelayed(&client->recv_limiter));
+            StatsServerReport_Printf(r, "udpgw_client_rate_limited_to_total{client=\"%s\"} %"PRIu64"\n", addr, PacketPassRateLimiter_GetNumDelayed(&client->send_limiter));
+        }
+    }
+    
+    // hot-path metrics
+    BMetrics_Print(stats_print_metric, r);
+}
+
+void stats_print_metric (void *user, const char *line)
+{
+    StatsServerReport *r = (StatsServerReport *)user;
+    
+    StatsServerReport_Printf(r, "%s\n", line);
+}
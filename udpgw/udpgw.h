@@ -36,17 +36,57 @@
 // connection buffer size for sending to client, in packets
 #define CONNECTION_CLIENT_BUFFER_SIZE 1
 
-// connection buffer size for sending to UDP, in packets
+// connection buffer size for sending to UDP, in packets of the UDP MTU
 #define CONNECTION_UDP_BUFFER_SIZE 1
 
+// datagrams to UDP up to this size get a small buffer instead of one of the
+// UDP MTU; the connection buffer size above counts the buffer sizes
+#define UDP_SEND_SMALL_SIZE 1536
+
+// number of buffers for datagrams to UDP allocated together; these are
+// shared by all connections
+#define UDP_SEND_SMALL_SLAB_CHUNK 64
+#define UDP_SEND_SLAB_CHUNK 16
+
 // maximum number of clients
 #define DEFAULT_MAX_CLIENTS 3
 
+// maximum number of worker processes
+#define MAX_WORKERS 64
+
 // maximum connections for client
 #define DEFAULT_MAX_CONNECTIONS_FOR_CLIENT 256
 
 // how long after nothing has been received to disconnect a client
 #define CLIENT_DISCONNECT_TIMEOUT 20000
 
+// initial number of buckets in the hash of remote addresses with local ports
+// in use; it grows as needed
+#define REMOTE_PORTS_HASH_INITIAL_BUCKETS 256
+
+// number of connection structures allocated together
+#define CONNECTIONS_SLAB_CHUNK 64
+
 // SO_SNDBFUF socket option for clients, 0 to not set
 #define CLIENT_DEFAULT_SOCKET_SEND_BUFFER 1048576
+
+// how many bytes of packets to gather into one write to a client, 0 to write
+// each packet separately; at least one packet always fits
+#define CLIENT_DEFAULT_SEND_COALESCE 65536
+
+// how many bytes of packets from a client to take in with one read; at least
+// one packet always fits
+#define CLIENT_DEFAULT_RECV_BUFFER 65536
+
+// maximum time to keep a DNS response in the cache, regardless of its TTL
+#define DNS_CACHE_MAX_TTL 3600000
+
+// time after which a DNS query in flight is no longer waited for
+#define DNS_CACHE_PENDING_TIMEOUT 2000
+
+// number of DNS answers from the cache to buffer for sending to a client
+#define CLIENT_DNS_BUFFER_SIZE 8
+
+// number of datagrams to buffer for sending to a client over the datagram
+// transport
+#define CLIENT_DGRAM_SEND_BUFFER 32
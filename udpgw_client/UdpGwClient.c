@@ -31,45 +31,89 @@
 
 #include <misc/offset.h>
 #include <misc/byteorder.h>
-#include <misc/compare.h>
+#include <misc/balloc.h>
+#include <misc/hashfun.h>
 #include <base/BLog.h>
 
 #include <udpgw_client/UdpGwClient.h>
 
 #include <generated/blog_channel_UdpGwClient.h>
 
-static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2);
-static int conaddr_comparator (void *unused, struct UdpGwClient_conaddr *v1, struct UdpGwClient_conaddr *v2);
+static size_t conaddr_hash (const struct UdpGwClient_conaddr *conaddr);
+static int conaddr_equal (const struct UdpGwClient_conaddr *v1, const struct UdpGwClient_conaddr *v2);
 static void free_server (UdpGwClient *o);
 static void decoder_handler_error (UdpGwClient *o);
 static void recv_interface_handler_send (UdpGwClient *o, uint8_t *data, int data_len);
+static void process_message (UdpGwClient *o, uint8_t *data, int data_len, int from_dgram);
 static void send_monitor_handler (UdpGwClient *o);
 static void keepalive_if_handler_done (UdpGwClient *o);
+#ifdef BADVPN_UDPGW_DGRAM
+static void dgram_logfunc (UdpGwClient *o);
+static void dgram_request (UdpGwClient *o);
+static void dgram_request_if_handler_done (UdpGwClient *o);
+static void dgram_handle_offer (UdpGwClient *o, const uint8_t *data, int data_len);
+static void dgram_free_session (UdpGwClient *o);
+static void dgram_fall_back (UdpGwClient *o);
+static void dgram_send_keepalive (UdpGwClient *o);
+static void dgram_handler_event (UdpGwClient *o, int event);
+static void dgram_timer_handler (UdpGwClient *o);
+static void dgram_recv_if_handler_send (UdpGwClient *o, uint8_t *data, int data_len);
+#endif
 static struct UdpGwClient_connection * find_connection_by_conaddr (UdpGwClient *o, struct UdpGwClient_conaddr conaddr);
 static struct UdpGwClient_connection * find_connection_by_conid (UdpGwClient *o, uint16_t conid);
 static uint16_t find_unused_conid (UdpGwClient *o);
 static void connection_init (UdpGwClient *o, struct UdpGwClient_conaddr conaddr, uint8_t flags, const uint8_t *data, int data_len);
 static void connection_free (struct UdpGwClient_connection *con);
 static void connection_first_job_handler (struct UdpGwClient_connection *con);
+static int connection_header_len (struct UdpGwClient_connection *con);
 static void connection_send (struct UdpGwClient_connection *con, uint8_t flags, const uint8_t *data, int data_len);
 static struct UdpGwClient_connection * reuse_connection (UdpGwClient *o, struct UdpGwClient_conaddr conaddr);
 
-static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2)
+#include "UdpGwClient_hash.h"
+#include <structure/CHash_impl.h>
+
+static size_t conaddr_hash (const struct UdpGwClient_conaddr *conaddr)
 {
-    return B_COMPARE(*v1, *v2);
+    // hash only the meaningful parts of the addresses, not the padding
+    uint8_t buf[2 * 18];
+    size_t len = 0;
+    
+    const BAddr *addrs[2] = {&conaddr->remote_addr, &conaddr->local_addr};
+    for (int i = 0; i < 2; i++) {
+        switch (addrs[i]->type) {
+            case BADDR_TYPE_IPV4: {
+                memcpy(buf + len, &addrs[i]->ipv4.ip, 4);
+                memcpy(buf + len + 4, &addrs[i]->ipv4.port, 2);
+                len += 6;
+            } break;
+            case BADDR_TYPE_IPV6: {
+                memcpy(buf + len, addrs[i]->ipv6.ip, 16);
+                memcpy(buf + len + 16, &addrs[i]->ipv6.port, 2);
+                len += 18;
+            } break;
+            default: ASSERT(0);
+        }
+    }
+    
+    return badvpn_djb2_hash_bin(buf, len);
 }
 
-static int conaddr_comparator (void *unused, struct UdpGwClient_conaddr *v1, struct UdpGwClient_conaddr *v2)
+static int conaddr_equal (const struct UdpGwClient_conaddr *v1, const struct UdpGwClient_conaddr *v2)
 {
-    int r = BAddr_CompareOrder(&v1->remote_addr, &v2->remote_addr);
-    if (r) {
-        return r;
-    }
-    return BAddr_CompareOrder(&v1->local_addr, &v2->local_addr);
+    return BAddr_Compare((BAddr *)&v1->remote_addr, (BAddr *)&v2->remote_addr) &&
+           BAddr_Compare((BAddr *)&v1->local_addr, (BAddr *)&v2->local_addr);
 }
 
 static void free_server (UdpGwClient *o)
 {
+    #ifdef BADVPN_UDPGW_DGRAM
+    // forget datagram transport
+    if (o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_PROBING || o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_UP) {
+        dgram_free_session(o);
+    }
+    o->dgram_state = UDPGW_CLIENT_DGRAM_STATE_NONE;
+    #endif
+    
     // disconnect send connector
     PacketPassConnector_DisconnectOutput(&o->send_connector);
     
@@ -105,6 +149,13 @@ static void recv_interface_handler_send (UdpGwClient *o, uint8_t *data, int data
     // accept packet
     PacketPassInterface_Done(&o->recv_if);
     
+    process_message(o, data, data_len, 0);
+}
+
+static void process_message (UdpGwClient *o, uint8_t *data, int data_len, int from_dgram)
+{
+    ASSERT(data_len >= 0)
+    
     // check header
     if (data_len < sizeof(struct udpgw_header)) {
         BLog(BLOG_ERROR, "missing header");
@@ -117,6 +168,22 @@ static void recv_interface_handler_send (UdpGwClient *o, uint8_t *data, int data
     uint8_t flags = ltoh8(header.flags);
     uint16_t conid = ltoh16(header.conid);
     
+    // keepalives only matter for the datagram transport, which has seen
+    // a message already
+    if ((flags & UDPGW_CLIENT_FLAG_KEEPALIVE)) {
+        return;
+    }
+    
+    // handle offer of the datagram transport
+    if ((flags & UDPGW_CLIENT_FLAG_DGRAM)) {
+        #ifdef BADVPN_UDPGW_DGRAM
+        if (!from_dgram) {
+            dgram_handle_offer(o, data, data_len);
+        }
+        #endif
+        return;
+    }
+    
     // parse address
     BAddr remote_addr;
     if ((flags & UDPGW_CLIENT_FLAG_IPV6)) {
@@ -195,24 +262,246 @@ static void keepalive_if_handler_done (UdpGwClient *o)
     o->keepalive_sending = 0;
 }
 
-static struct UdpGwClient_connection * find_connection_by_conaddr (UdpGwClient *o, struct UdpGwClient_conaddr conaddr)
+#ifdef BADVPN_UDPGW_DGRAM
+
+static void dgram_logfunc (UdpGwClient *o)
 {
-    BAVLNode *tree_node = BAVL_LookupExact(&o->connections_tree_by_conaddr, &conaddr);
-    if (!tree_node) {
-        return NULL;
+    BLog_Append("datagram transport: ");
+}
+
+static void dgram_request (UdpGwClient *o)
+{
+    ASSERT(o->dgram_enabled)
+    ASSERT(o->have_server)
+    ASSERT(o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_NONE)
+    
+    // send request, unless the one for the previous server is still queued,
+    // in which case that goes to this server
+    if (!o->dgram_request_sending) {
+        PacketPassInterface_Sender_Send(o->dgram_request_if, (uint8_t *)&o->dgram_request_packet, sizeof(o->dgram_request_packet));
+        o->dgram_request_sending = 1;
     }
     
-    return UPPER_OBJECT(tree_node, struct UdpGwClient_connection, connections_tree_by_conaddr_node);
+    // wait for offer
+    o->dgram_state = UDPGW_CLIENT_DGRAM_STATE_REQUESTED;
+}
+
+static void dgram_request_if_handler_done (UdpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->dgram_request_sending)
+    
+    o->dgram_request_sending = 0;
+}
+
+static void dgram_handle_offer (UdpGwClient *o, const uint8_t *data, int data_len)
+{
+    ASSERT(o->have_server)
+    
+    if (o->dgram_state != UDPGW_CLIENT_DGRAM_STATE_REQUESTED) {
+        BLog(BLOG_ERROR, "unexpected datagram transport offer");
+        return;
+    }
+    
+    // parse offer
+    struct udpgw_dgram_offer offer;
+    if (data_len < sizeof(offer)) {
+        BLog(BLOG_ERROR, "missing datagram transport offer");
+        goto fail0;
+    }
+    memcpy(&offer, data, sizeof(offer));
+    int fec_group_size = ltoh8(offer.fec_group_size);
+    if (fec_group_size > FECPROTO_MAX_GROUP_SIZE) {
+        BLog(BLOG_ERROR, "bad FEC group size in datagram transport offer");
+        goto fail0;
+    }
+    int packet_mtu = UDPGW_DGRAM_PACKET_MTU(fec_group_size);
+    
+    // init socket
+    BAddr addr = BAddr_MakeFromIpaddrAndPort(o->dgram_server_ip, offer.port);
+    if (!BDatagram_Init(&o->dgram, addr.type, o->reactor, o, (BDatagram_handler)dgram_handler_event)) {
+        BLog(BLOG_ERROR, "BDatagram_Init failed");
+        goto fail0;
+    }
+    if (!BDatagram_Connect(&o->dgram, addr)) {
+        BLog(BLOG_ERROR, "BDatagram_Connect failed");
+        goto fail1;
+    }
+    
+    // datagrams are kept small, so never let the system fragment them
+    if (!BDatagram_SetDontFragment(&o->dgram)) {
+        BLog(BLOG_WARNING, "BDatagram_SetDontFragment failed");
+    }
+    
+    // init socket interfaces
+    BDatagram_SendAsync_Init(&o->dgram, packet_mtu);
+    BDatagram_RecvAsync_Init(&o->dgram, packet_mtu);
+    
+    // init receive interface
+    PacketPassInterface_Init(&o->dgram_recv_if, UDPGW_DGRAM_MAX_MESSAGE, (PacketPassInterface_handler_send)dgram_recv_if_handler_send, o, BReactor_PendingGroup(o->reactor));
+    
+    // init session
+    if (!UdpGwDgram_Init(&o->dgram_session, 0, ltoh32(offer.session_id), offer.key, fec_group_size, UDPGW_CLIENT_DGRAM_SEND_BUFFER,
+                         BDatagram_SendAsync_GetIf(&o->dgram), &o->dgram_recv_if, o->reactor, o, (BLog_logfunc)dgram_logfunc)) {
+        BLog(BLOG_ERROR, "UdpGwDgram_Init failed");
+        goto fail2;
+    }
+    
+    // init receive buffer
+    if (!SinglePacketBuffer_Init(&o->dgram_recv_buffer, BDatagram_RecvAsync_GetIf(&o->dgram), UdpGwDgram_GetRecvInput(&o->dgram_session), BReactor_PendingGroup(o->reactor))) {
+        BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed");
+        goto fail3;
+    }
+    
+    BLog(BLOG_INFO, "datagram transport offered, probing");
+    
+    // probe until the server answers
+    o->dgram_state = UDPGW_CLIENT_DGRAM_STATE_PROBING;
+    o->dgram_probes = 1;
+    dgram_send_keepalive(o);
+    BReactor_SetTimerAfter(o->reactor, &o->dgram_timer, UDPGW_CLIENT_DGRAM_PROBE_INTERVAL);
+    return;
+    
+fail3:
+    UdpGwDgram_Free(&o->dgram_session);
+fail2:
+    PacketPassInterface_Free(&o->dgram_recv_if);
+    BDatagram_RecvAsync_Free(&o->dgram);
+    BDatagram_SendAsync_Free(&o->dgram);
+fail1:
+    BDatagram_Free(&o->dgram);
+fail0:
+    o->dgram_state = UDPGW_CLIENT_DGRAM_STATE_FAILED;
+}
+
+static void dgram_free_session (UdpGwClient *o)
+{
+    ASSERT(o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_PROBING || o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_UP)
+    
+    // free timer
+    BReactor_RemoveTimer(o->reactor, &o->dgram_timer);
+    
+    // free receive buffer
+    SinglePacketBuffer_Free(&o->dgram_recv_buffer);
+    
+    // free session
+    UdpGwDgram_Free(&o->dgram_session);
+    
+    // free receive interface
+    PacketPassInterface_Free(&o->dgram_recv_if);
+    
+    // free socket
+    BDatagram_RecvAsync_Free(&o->dgram);
+    BDatagram_SendAsync_Free(&o->dgram);
+    BDatagram_Free(&o->dgram);
+}
+
+static void dgram_fall_back (UdpGwClient *o)
+{
+    // send everything over the stream until the next server connection
+    dgram_free_session(o);
+    o->dgram_state = UDPGW_CLIENT_DGRAM_STATE_FAILED;
+}
+
+static void dgram_send_keepalive (UdpGwClient *o)
+{
+    ASSERT(o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_PROBING || o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_UP)
+    
+    BufferWriter *input = UdpGwDgram_GetSendInput(&o->dgram_session);
+    
+    // skip it if messages are being sent anyway
+    uint8_t *out;
+    if (!BufferWriter_StartPacket(input, &out)) {
+        return;
+    }
+    
+    struct udpgw_header header;
+    header.flags = htol8(UDPGW_CLIENT_FLAG_KEEPALIVE);
+    header.conid = htol16(0);
+    memcpy(out, &header, sizeof(header));
+    
+    BufferWriter_EndPacket(input, sizeof(header));
+}
+
+static void dgram_handler_event (UdpGwClient *o, int event)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_PROBING || o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_UP)
+    
+    BLog(BLOG_ERROR, "datagram transport socket error, using stream only");
+    
+    dgram_fall_back(o);
+}
+
+static void dgram_timer_handler (UdpGwClient *o)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_PROBING || o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_UP)
+    
+    if (o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_PROBING) {
+        // give up if the server never answered
+        if (o->dgram_probes == UDPGW_CLIENT_DGRAM_PROBES) {
+            BLog(BLOG_WARNING, "datagram transport not answering, using stream only");
+            dgram_fall_back(o);
+            return;
+        }
+        
+        // probe again
+        o->dgram_probes++;
+        dgram_send_keepalive(o);
+        BReactor_SetTimerAfter(o->reactor, &o->dgram_timer, UDPGW_CLIENT_DGRAM_PROBE_INTERVAL);
+        return;
+    }
+    
+    // give up if datagrams stopped getting through
+    if (BReactor_GetTime(o->reactor) >= btime_add(o->dgram_last_recv, UDPGW_DGRAM_TIMEOUT)) {
+        BLog(BLOG_WARNING, "datagram transport timed out, using stream only");
+        dgram_fall_back(o);
+        return;
+    }
+    
+    // keep it alive
+    dgram_send_keepalive(o);
+    BReactor_SetTimerAfter(o->reactor, &o->dgram_timer, UDPGW_DGRAM_KEEPALIVE_INTERVAL);
+}
+
+static void dgram_recv_if_handler_send (UdpGwClient *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_PROBING || o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_UP)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= UDPGW_DGRAM_MAX_MESSAGE)
+    
+    // accept packet
+    PacketPassInterface_Done(&o->dgram_recv_if);
+    
+    o->dgram_last_recv = BReactor_GetTime(o->reactor);
+    
+    // the server answered, start using datagrams
+    if (o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_PROBING) {
+        BLog(BLOG_INFO, "datagram transport up");
+        o->dgram_state = UDPGW_CLIENT_DGRAM_STATE_UP;
+        BReactor_SetTimerAfter(o->reactor, &o->dgram_timer, UDPGW_DGRAM_KEEPALIVE_INTERVAL);
+    }
+    
+    process_message(o, data, data_len, 1);
+}
+
+#endif
+
+static struct UdpGwClient_connection * find_connection_by_conaddr (UdpGwClient *o, struct UdpGwClient_conaddr conaddr)
+{
+    return UdpGwClient__Hash_Lookup(&o->connections_hash, 0, &conaddr).ptr;
 }
 
 static struct UdpGwClient_connection * find_connection_by_conid (UdpGwClient *o, uint16_t conid)
 {
-    BAVLNode *tree_node = BAVL_LookupExact(&o->connections_tree_by_conid, &conid);
-    if (!tree_node) {
+    // conid's are only allocated below max_connections, but the server may send anything
+    if (conid >= o->max_connections) {
         return NULL;
     }
     
-    return UPPER_OBJECT(tree_node, struct UdpGwClient_connection, connections_tree_by_conid_node);
+    return o->connections_by_conid[conid];
 }
 
 static uint16_t find_unused_conid (UdpGwClient *o)
@@ -249,6 +538,7 @@ static void connection_init (UdpGwClient *o, struct UdpGwClient_conaddr conaddr,
     // init arguments
     con->client = o;
     con->conaddr = conaddr;
+    con->conaddr_hash = conaddr_hash(&con->conaddr);
     con->first_flags = flags;
     con->first_data = data;
     con->first_data_len = data_len;
@@ -270,11 +560,12 @@ static void connection_init (UdpGwClient *o, struct UdpGwClient_conaddr conaddr,
     }
     con->send_if = PacketProtoFlow_GetInput(&con->send_ppflow);
     
-    // insert to connections tree by conaddr
-    ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node, NULL))
+    // insert to connections hash
+    UdpGwClient__HashRef ref = {con, con};
+    ASSERT_EXECUTE(UdpGwClient__Hash_Insert(&o->connections_hash, 0, ref, NULL))
     
-    // insert to connections tree by conid
-    ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree_by_conid, &con->connections_tree_by_conid_node, NULL))
+    // insert to connections array by conid
+    o->connections_by_conid[con->conid] = con;
     
     // insert to connections list
     LinkedList1_Append(&o->connections_list, &con->connections_list_node);
@@ -303,11 +594,12 @@ static void connection_free (struct UdpGwClient_connection *con)
     // remove from connections list
     LinkedList1_Remove(&o->connections_list, &con->connections_list_node);
     
-    // remove from connections tree by conid
-    BAVL_Remove(&o->connections_tree_by_conid, &con->connections_tree_by_conid_node);
+    // remove from connections array by conid
+    o->connections_by_conid[con->conid] = NULL;
     
-    // remove from connections tree by conaddr
-    BAVL_Remove(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node);
+    // remove from connections hash
+    UdpGwClient__HashRef ref = {con, con};
+    UdpGwClient__Hash_Remove(&o->connections_hash, 0, ref);
     
     // free PacketProtoFlow
     PacketProtoFlow_Free(&con->send_ppflow);
@@ -327,6 +619,19 @@ static void connection_first_job_handler (struct UdpGwClient_connection *con)
     connection_send(con, UDPGW_CLIENT_FLAG_REBIND|con->first_flags, con->first_data, con->first_data_len);
 }
 
+static int connection_header_len (struct UdpGwClient_connection *con)
+{
+    switch (con->conaddr.remote_addr.type) {
+        case BADDR_TYPE_IPV4:
+            return sizeof(struct udpgw_header) + sizeof(struct udpgw_addr_ipv4);
+        case BADDR_TYPE_IPV6:
+            return sizeof(struct udpgw_header) + sizeof(struct udpgw_addr_ipv6);
+        default:
+            ASSERT(0);
+            return 0;
+    }
+}
+
 static void connection_send (struct UdpGwClient_connection *con, uint8_t flags, const uint8_t *data, int data_len)
 {
     UdpGwClient *o = con->client;
@@ -334,11 +639,26 @@ static void connection_send (struct UdpGwClient_connection *con, uint8_t flags,
     ASSERT(data_len >= 0)
     ASSERT(data_len <= o->udp_mtu)
     
-    // get buffer location
+    BufferWriter *writer = NULL;
     uint8_t *out;
-    if (!BufferWriter_StartPacket(con->send_if, &out)) {
-        BLog(BLOG_ERROR, "out of buffer");
-        return;
+    
+    #ifdef BADVPN_UDPGW_DGRAM
+    // send as a datagram if the datagram transport is up and has room
+    if (o->dgram_state == UDPGW_CLIENT_DGRAM_STATE_UP && connection_header_len(con) + data_len <= UDPGW_DGRAM_MAX_MESSAGE) {
+        BufferWriter *dgram_writer = UdpGwDgram_GetSendInput(&o->dgram_session);
+        if (BufferWriter_StartPacket(dgram_writer, &out)) {
+            writer = dgram_writer;
+        }
+    }
+    #endif
+    
+    // otherwise get buffer location in the stream
+    if (!writer) {
+        writer = con->send_if;
+        if (!BufferWriter_StartPacket(writer, &out)) {
+            BLog(BLOG_ERROR, "out of buffer");
+            return;
+        }
     }
     int out_pos = 0;
     
@@ -376,7 +696,8 @@ static void connection_send (struct UdpGwClient_connection *con, uint8_t flags,
     out_pos += data_len;
     
     // submit packet to buffer
-    BufferWriter_EndPacket(con->send_if, out_pos);
+    ASSERT(out_pos == connection_header_len(con) + data_len)
+    BufferWriter_EndPacket(writer, out_pos);
 }
 
 static struct UdpGwClient_connection * reuse_connection (UdpGwClient *o, struct UdpGwClient_conaddr conaddr)
@@ -387,19 +708,21 @@ static struct UdpGwClient_connection * reuse_connection (UdpGwClient *o, struct
     // get least recently used connection
     struct UdpGwClient_connection *con = UPPER_OBJECT(LinkedList1_GetFirst(&o->connections_list), struct UdpGwClient_connection, connections_list_node);
     
-    // remove from connections tree by conaddr
-    BAVL_Remove(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node);
+    // remove from connections hash
+    UdpGwClient__HashRef ref = {con, con};
+    UdpGwClient__Hash_Remove(&o->connections_hash, 0, ref);
     
     // set new conaddr
     con->conaddr = conaddr;
+    con->conaddr_hash = conaddr_hash(&con->conaddr);
     
-    // insert to connections tree by conaddr
-    ASSERT_EXECUTE(BAVL_Insert(&o->connections_tree_by_conaddr, &con->connections_tree_by_conaddr_node, NULL))
+    // insert to connections hash
+    ASSERT_EXECUTE(UdpGwClient__Hash_Insert(&o->connections_hash, 0, ref, NULL))
     
     return con;
 }
 
-int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time, BReactor *reactor, void *user,
+int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, int recv_buffer_size, btime_t keepalive_time, BReactor *reactor, void *user,
                       UdpGwClient_handler_servererror handler_servererror,
                       UdpGwClient_handler_received handler_received)
 {
@@ -408,11 +731,13 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     ASSERT(udpgw_compute_mtu(udp_mtu) <= PACKETPROTO_MAXPAYLOAD)
     ASSERT(max_connections > 0)
     ASSERT(send_buffer_size > 0)
+    ASSERT(recv_buffer_size > 0)
     
     // init arguments
     o->udp_mtu = udp_mtu;
     o->max_connections = max_connections;
     o->send_buffer_size = send_buffer_size;
+    o->recv_buffer_size = recv_buffer_size;
     o->keepalive_time = keepalive_time;
     o->reactor = reactor;
     o->user = user;
@@ -428,11 +753,20 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     o->udpgw_mtu = udpgw_compute_mtu(o->udp_mtu);
     o->pp_mtu = o->udpgw_mtu + sizeof(struct packetproto_header);
     
-    // init connections tree by conaddr
-    BAVL_Init(&o->connections_tree_by_conaddr, OFFSET_DIFF(struct UdpGwClient_connection, conaddr, connections_tree_by_conaddr_node), (BAVL_comparator)conaddr_comparator, NULL);
+    // init connections hash; there are never more connections than buckets
+    if (!UdpGwClient__Hash_Init(&o->connections_hash, o->max_connections)) {
+        BLog(BLOG_ERROR, "UdpGwClient__Hash_Init failed");
+        goto fail0;
+    }
     
-    // init connections tree by conid
-    BAVL_Init(&o->connections_tree_by_conid, OFFSET_DIFF(struct UdpGwClient_connection, conid, connections_tree_by_conid_node), (BAVL_comparator)uint16_comparator, NULL);
+    // init connections array by conid
+    if (!(o->connections_by_conid = (struct UdpGwClient_connection **)BAllocArray(o->max_connections, sizeof(o->connections_by_conid[0])))) {
+        BLog(BLOG_ERROR, "BAllocArray failed");
+        goto fail1;
+    }
+    for (int i = 0; i < o->max_connections; i++) {
+        o->connections_by_conid[i] = NULL;
+    }
     
     // init connections list
     LinkedList1_Init(&o->connections_list);
@@ -451,7 +785,7 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     
     // init send queue
     if (!PacketPassFairQueue_Init(&o->send_queue, PacketPassInactivityMonitor_GetInput(&o->send_monitor), BReactor_PendingGroup(o->reactor), 0, 1)) {
-        goto fail0;
+        goto fail2;
     }
     
     // construct keepalive packet
@@ -469,15 +803,34 @@ int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send
     // set not sending keepalive
     o->keepalive_sending = 0;
     
+    #ifdef BADVPN_UDPGW_DGRAM
+    // init datagram transport request queue flow
+    PacketPassFairQueueFlow_Init(&o->dgram_request_qflow, &o->send_queue);
+    o->dgram_request_if = PacketPassFairQueueFlow_GetInput(&o->dgram_request_qflow);
+    PacketPassInterface_Sender_Init(o->dgram_request_if, (PacketPassInterface_handler_done)dgram_request_if_handler_done, o);
+    o->dgram_request_sending = 0;
+    
+    // init datagram transport timer
+    BTimer_Init(&o->dgram_timer, 0, (BTimer_handler)dgram_timer_handler, o);
+    
+    // datagram transport is not used unless enabled
+    o->dgram_enabled = 0;
+    o->dgram_state = UDPGW_CLIENT_DGRAM_STATE_NONE;
+    #endif
+    
     // set have no server
     o->have_server = 0;
     
     DebugObject_Init(&o->d_obj);
     return 1;
     
-fail0:
+fail2:
     PacketPassInactivityMonitor_Free(&o->send_monitor);
     PacketPassConnector_Free(&o->send_connector);
+    BFree(o->connections_by_conid);
+fail1:
+    UdpGwClient__Hash_Free(&o->connections_hash);
+fail0:
     return 0;
 }
 
@@ -499,6 +852,11 @@ void UdpGwClient_Free (UdpGwClient *o)
         free_server(o);
     }
     
+    #ifdef BADVPN_UDPGW_DGRAM
+    // free datagram transport request queue flow
+    PacketPassFairQueueFlow_Free(&o->dgram_request_qflow);
+    #endif
+    
     // free keepalive queue flow
     PacketPassFairQueueFlow_Free(&o->keepalive_qflow);
     
@@ -510,6 +868,12 @@ void UdpGwClient_Free (UdpGwClient *o)
     
     // free send connector
     PacketPassConnector_Free(&o->send_connector);
+    
+    // free connections array by conid
+    BFree(o->connections_by_conid);
+    
+    // free connections hash
+    UdpGwClient__Hash_Free(&o->connections_hash);
 }
 
 void UdpGwClient_SubmitPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len)
@@ -529,7 +893,7 @@ void UdpGwClient_SubmitPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_ad
     struct UdpGwClient_connection *con = find_connection_by_conaddr(o, conaddr);
     
     uint8_t flags = 0;
-
+    
     if (is_dns) {
         // route to remote DNS server instead of provided address
         flags |= UDPGW_CLIENT_FLAG_DNS;
@@ -562,9 +926,9 @@ int UdpGwClient_ConnectServer (UdpGwClient *o, StreamPassInterface *send_if, Str
     // init receive interface
     PacketPassInterface_Init(&o->recv_if, o->udpgw_mtu, (PacketPassInterface_handler_send)recv_interface_handler_send, o, BReactor_PendingGroup(o->reactor));
     
-    // init receive decoder
-    if (!PacketProtoDecoder_Init(&o->recv_decoder, recv_if, &o->recv_if, BReactor_PendingGroup(o->reactor), o, (PacketProtoDecoder_handler_error)decoder_handler_error)) {
-        BLog(BLOG_ERROR, "PacketProtoDecoder_Init failed");
+    // init receive decoder, buffering many packets so one read can yield all of them
+    if (!PacketProtoDecoder_Init2(&o->recv_decoder, recv_if, &o->recv_if, o->recv_buffer_size, BReactor_PendingGroup(o->reactor), o, (PacketProtoDecoder_handler_error)decoder_handler_error)) {
+        BLog(BLOG_ERROR, "PacketProtoDecoder_Init2 failed");
         goto fail1;
     }
     
@@ -577,6 +941,13 @@ int UdpGwClient_ConnectServer (UdpGwClient *o, StreamPassInterface *send_if, Str
     // set have server
     o->have_server = 1;
     
+    #ifdef BADVPN_UDPGW_DGRAM
+    // ask this server for the datagram transport
+    if (o->dgram_enabled) {
+        dgram_request(o);
+    }
+    #endif
+    
     return 1;
     
 fail1:
@@ -595,3 +966,30 @@ void UdpGwClient_DisconnectServer (UdpGwClient *o)
     // set have no server
     o->have_server = 0;
 }
+
+#ifdef BADVPN_UDPGW_DGRAM
+
+void UdpGwClient_EnableDatagram (UdpGwClient *o, BIPAddr server_ip, int fec_group_size)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->dgram_enabled)
+    ASSERT(!BIPAddr_IsInvalid(&server_ip))
+    ASSERT(fec_group_size >= 0)
+    ASSERT(fec_group_size <= FECPROTO_MAX_GROUP_SIZE)
+    
+    o->dgram_enabled = 1;
+    o->dgram_server_ip = server_ip;
+    
+    // construct request packet
+    o->dgram_request_packet.pp.len = htol16(sizeof(o->dgram_request_packet.udpgw) + sizeof(o->dgram_request_packet.request));
+    o->dgram_request_packet.udpgw.flags = htol8(UDPGW_CLIENT_FLAG_DGRAM);
+    o->dgram_request_packet.udpgw.conid = htol16(0);
+    o->dgram_request_packet.request.fec_group_size = htol8(fec_group_size);
+    
+    // ask the current server, if any
+    if (o->have_server) {
+        dgram_request(o);
+    }
+}
+
+#endif
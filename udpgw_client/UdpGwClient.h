@@ -34,7 +34,7 @@
 #include <protocol/udpgw_proto.h>
 #include <misc/debug.h>
 #include <misc/packed.h>
-#include <structure/BAVL.h>
+#include <structure/CHash.h>
 #include <structure/LinkedList1.h>
 #include <base/DebugObject.h>
 #include <system/BAddr.h>
@@ -46,6 +46,28 @@
 #include <flow/PacketPassConnector.h>
 #include <flowextra/PacketPassInactivityMonitor.h>
 
+#ifdef BADVPN_UDPGW_DGRAM
+#include <system/BDatagram.h>
+#include <flow/SinglePacketBuffer.h>
+#include <udpgw_dgram/UdpGwDgram.h>
+#endif
+
+#ifdef BADVPN_UDPGW_DGRAM
+// how often to probe for the datagram transport, and how many times before
+// staying with the stream
+#define UDPGW_CLIENT_DGRAM_PROBE_INTERVAL 1000
+#define UDPGW_CLIENT_DGRAM_PROBES 5
+
+// number of datagrams to buffer for sending over the datagram transport
+#define UDPGW_CLIENT_DGRAM_SEND_BUFFER 32
+
+#define UDPGW_CLIENT_DGRAM_STATE_NONE 0
+#define UDPGW_CLIENT_DGRAM_STATE_REQUESTED 1
+#define UDPGW_CLIENT_DGRAM_STATE_PROBING 2
+#define UDPGW_CLIENT_DGRAM_STATE_UP 3
+#define UDPGW_CLIENT_DGRAM_STATE_FAILED 4
+#endif
+
 typedef void (*UdpGwClient_handler_servererror) (void *user);
 typedef void (*UdpGwClient_handler_received) (void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
 
@@ -56,10 +78,31 @@ struct UdpGwClient__keepalive_packet {
 } B_PACKED;
 B_END_PACKED
 
+#ifdef BADVPN_UDPGW_DGRAM
+B_START_PACKED
+struct UdpGwClient__dgram_request_packet {
+    struct packetproto_header pp;
+    struct udpgw_header udpgw;
+    struct udpgw_dgram_request request;
+} B_PACKED;
+B_END_PACKED
+#endif
+
+struct UdpGwClient_conaddr {
+    BAddr local_addr;
+    BAddr remote_addr;
+};
+
+struct UdpGwClient_connection;
+
+#include "UdpGwClient_hash.h"
+#include <structure/CHash_decl.h>
+
 typedef struct {
     int udp_mtu;
     int max_connections;
     int send_buffer_size;
+    int recv_buffer_size;
     btime_t keepalive_time;
     BReactor *reactor;
     void *user;
@@ -67,8 +110,8 @@ typedef struct {
     UdpGwClient_handler_received handler_received;
     int udpgw_mtu;
     int pp_mtu;
-    BAVL connections_tree_by_conaddr;
-    BAVL connections_tree_by_conid;
+    UdpGwClient__Hash connections_hash;
+    struct UdpGwClient_connection **connections_by_conid;
     LinkedList1 connections_list;
     int num_connections;
     int next_conid;
@@ -83,17 +126,29 @@ typedef struct {
     PacketStreamSender send_sender;
     PacketProtoDecoder recv_decoder;
     PacketPassInterface recv_if;
+    #ifdef BADVPN_UDPGW_DGRAM
+    int dgram_enabled;
+    BIPAddr dgram_server_ip;
+    struct UdpGwClient__dgram_request_packet dgram_request_packet;
+    PacketPassInterface *dgram_request_if;
+    PacketPassFairQueueFlow dgram_request_qflow;
+    int dgram_request_sending;
+    int dgram_state;
+    BTimer dgram_timer;
+    int dgram_probes;
+    btime_t dgram_last_recv;
+    BDatagram dgram;
+    UdpGwDgram dgram_session;
+    PacketPassInterface dgram_recv_if;
+    SinglePacketBuffer dgram_recv_buffer;
+    #endif
     DebugObject d_obj;
 } UdpGwClient;
 
-struct UdpGwClient_conaddr {
-    BAddr local_addr;
-    BAddr remote_addr;
-};
-
 struct UdpGwClient_connection {
     UdpGwClient *client;
     struct UdpGwClient_conaddr conaddr;
+    size_t conaddr_hash;
     uint8_t first_flags;
     const uint8_t *first_data;
     int first_data_len;
@@ -102,17 +157,19 @@ struct UdpGwClient_connection {
     BufferWriter *send_if;
     PacketProtoFlow send_ppflow;
     PacketPassFairQueueFlow send_qflow;
-    BAVLNode connections_tree_by_conaddr_node;
-    BAVLNode connections_tree_by_conid_node;
+    struct UdpGwClient_connection *connections_hash_next;
     LinkedList1Node connections_list_node;
 };
 
-int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, btime_t keepalive_time, BReactor *reactor, void *user,
+int UdpGwClient_Init (UdpGwClient *o, int udp_mtu, int max_connections, int send_buffer_size, int recv_buffer_size, btime_t keepalive_time, BReactor *reactor, void *user,
                       UdpGwClient_handler_servererror handler_servererror,
                       UdpGwClient_handler_received handler_received) WARN_UNUSED;
 void UdpGwClient_Free (UdpGwClient *o);
 void UdpGwClient_SubmitPacket (UdpGwClient *o, BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len);
 int UdpGwClient_ConnectServer (UdpGwClient *o, StreamPassInterface *send_if, StreamRecvInterface *recv_if) WARN_UNUSED;
 void UdpGwClient_DisconnectServer (UdpGwClient *o);
+#ifdef BADVPN_UDPGW_DGRAM
+void UdpGwClient_EnableDatagram (UdpGwClient *o, BIPAddr server_ip, int fec_group_size);
+#endif
 
 #endif
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME UdpGwClient__Hash
+#define CHASH_PARAM_ENTRY struct UdpGwClient_connection
+#define CHASH_PARAM_LINK struct UdpGwClient_connection *
+#define CHASH_PARAM_KEY const struct UdpGwClient_conaddr *
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((struct UdpGwClient_connection *)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->conaddr_hash)
+#define CHASH_PARAM_KEYHASH(arg, key) conaddr_hash((key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) conaddr_equal(&(entry1).ptr->conaddr, &(entry2).ptr->conaddr)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) conaddr_equal((key1), &(entry2).ptr->conaddr)
+#define CHASH_PARAM_ENTRY_NEXT connections_hash_next
@@ -0,0 +1,336 @@
+/**
+ * @file UdpGwDgram.c
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <misc/byteorder.h>
+#include <misc/balloc.h>
+
+#include "UdpGwDgram.h"
+
+#include <generated/blog_channel_UdpGwDgram.h>
+
+#define SessionLog(_o, ...) BLog_LogViaFunc((_o)->logfunc, (_o)->user, BLOG_CURRENT_CHANNEL, __VA_ARGS__)
+
+// number of most recent sequence numbers the receiver remembers
+#define REPLAY_WINDOW 64
+
+static void make_nonce (uint8_t *nonce, uint32_t direction, uint64_t seq)
+{
+    uint32_t d = htol32(direction);
+    uint64_t s = htol64(seq);
+    memcpy(nonce, &d, sizeof(d));
+    memcpy(nonce + sizeof(d), &s, sizeof(s));
+}
+
+static int replay_check (UdpGwDgram *o, uint64_t seq)
+{
+    if (!o->recv_have_seq || seq > o->recv_top_seq) {
+        return 1;
+    }
+    
+    uint64_t diff = o->recv_top_seq - seq;
+    if (diff >= REPLAY_WINDOW) {
+        return 0;
+    }
+    
+    return !(o->recv_window & ((uint64_t)1 << diff));
+}
+
+static void replay_update (UdpGwDgram *o, uint64_t seq)
+{
+    ASSERT(replay_check(o, seq))
+    
+    if (!o->recv_have_seq) {
+        o->recv_have_seq = 1;
+        o->recv_top_seq = seq;
+        o->recv_window = 1;
+        return;
+    }
+    
+    if (seq > o->recv_top_seq) {
+        uint64_t shift = seq - o->recv_top_seq;
+        o->recv_window = (shift >= REPLAY_WINDOW ? 0 : o->recv_window << shift) | 1;
+        o->recv_top_seq = seq;
+    } else {
+        o->recv_window |= (uint64_t)1 << (o->recv_top_seq - seq);
+    }
+}
+
+static void seal_if_handler_recv (UdpGwDgram *o, uint8_t *data)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(!o->send_seal_out)
+    
+    // receive the message behind the room for the header
+    o->send_seal_out = data;
+    PacketRecvInterface_Receiver_Recv(o->send_seal_input, data + sizeof(struct udpgw_dgram_header));
+}
+
+static void seal_input_handler_done (UdpGwDgram *o, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(o->send_seal_out)
+    
+    uint8_t *out = o->send_seal_out;
+    uint64_t seq = o->send_seq++;
+    
+    // write header
+    struct udpgw_dgram_header header;
+    header.session_id = htol32(o->session_id);
+    header.seq = htol64(seq);
+    memcpy(out, &header, sizeof(header));
+    
+    // encrypt in place, appending the tag
+    uint8_t nonce[BAEAD_NONCE_SIZE];
+    make_nonce(nonce, o->send_direction, seq);
+    BAEAD_Seal(&o->send_aead, nonce, out + sizeof(header), data_len, out + sizeof(header));
+    
+    // finish datagram
+    o->send_seal_out = NULL;
+    PacketRecvInterface_Done(&o->send_seal_if, sizeof(header) + data_len + UDPGW_DGRAM_TAG_SIZE);
+}
+
+static void recv_if_handler_send (UdpGwDgram *o, uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= PacketPassInterface_GetMTU(&o->recv_if))
+    
+    // parse header
+    if (data_len < sizeof(struct udpgw_dgram_header) + UDPGW_DGRAM_TAG_SIZE) {
+        SessionLog(o, BLOG_DEBUG, "datagram too short");
+        goto drop;
+    }
+    struct udpgw_dgram_header header;
+    memcpy(&header, data, sizeof(header));
+    uint64_t seq = ltoh64(header.seq);
+    
+    // check session
+    if (ltoh32(header.session_id) != o->session_id) {
+        SessionLog(o, BLOG_DEBUG, "datagram for another session");
+        goto drop;
+    }
+    
+    // check for replay before spending time on decryption
+    if (!replay_check(o, seq)) {
+        SessionLog(o, BLOG_DEBUG, "duplicate or old datagram");
+        goto drop;
+    }
+    
+    // verify and decrypt
+    int in_len = data_len - sizeof(header);
+    uint8_t nonce[BAEAD_NONCE_SIZE];
+    make_nonce(nonce, o->recv_direction, seq);
+    if (!BAEAD_Open(&o->recv_aead, nonce, data + sizeof(header), in_len, o->recv_buf)) {
+        SessionLog(o, BLOG_DEBUG, "datagram failed authentication");
+        goto drop;
+    }
+    
+    // only remember authentic sequence numbers
+    replay_update(o, seq);
+    
+    // pass message on
+    PacketPassInterface_Sender_Send(o->recv_output, o->recv_buf, in_len - UDPGW_DGRAM_TAG_SIZE);
+    return;
+    
+drop:
+    PacketPassInterface_Done(&o->recv_if);
+}
+
+static void recv_output_handler_done (UdpGwDgram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    PacketPassInterface_Done(&o->recv_if);
+}
+
+int UdpGwDgram_Init (UdpGwDgram *o, int is_server, uint32_t session_id, const uint8_t *key, int fec_group_size, int send_buffer_packets,
+                     PacketPassInterface *send_output, PacketPassInterface *recv_output, BReactor *reactor, void *user, BLog_logfunc logfunc)
+{
+    ASSERT(is_server == 0 || is_server == 1)
+    ASSERT(fec_group_size >= 0)
+    ASSERT(fec_group_size <= FECPROTO_MAX_GROUP_SIZE)
+    ASSERT(send_buffer_packets > 0)
+    ASSERT(PacketPassInterface_GetMTU(send_output) >= UDPGW_DGRAM_PACKET_MTU(fec_group_size))
+    ASSERT(PacketPassInterface_GetMTU(recv_output) == UDPGW_DGRAM_MAX_MESSAGE)
+    ASSERT(BAEAD_TAG_SIZE == UDPGW_DGRAM_TAG_SIZE)
+    ASSERT(BAEAD_CIPHER_AES128_GCM_KEY_SIZE == UDPGW_DGRAM_KEY_SIZE)
+    
+    // init arguments
+    o->user = user;
+    o->logfunc = logfunc;
+    o->session_id = session_id;
+    o->fec_group_size = fec_group_size;
+    
+    // the client sends with direction 0, the server with direction 1
+    o->send_direction = is_server;
+    o->recv_direction = !is_server;
+    
+    BPendingGroup *pg = BReactor_PendingGroup(reactor);
+    int payload_mtu = (fec_group_size > 0 ? sizeof(struct fecproto_header) : 0) + UDPGW_DGRAM_MAX_MESSAGE;
+    
+    // init ciphers
+    if (!BAEAD_Init(&o->send_aead, BAEAD_MODE_ENCRYPT, BAEAD_CIPHER_AES128_GCM, key)) {
+        SessionLog(o, BLOG_ERROR, "BAEAD_Init failed");
+        goto fail0;
+    }
+    if (!BAEAD_Init(&o->recv_aead, BAEAD_MODE_DECRYPT, BAEAD_CIPHER_AES128_GCM, key)) {
+        SessionLog(o, BLOG_ERROR, "BAEAD_Init failed");
+        goto fail1;
+    }
+    
+    // init send writer
+    BufferWriter_Init(&o->send_writer, UDPGW_DGRAM_MAX_MESSAGE, pg);
+    o->send_seal_input = BufferWriter_GetOutput(&o->send_writer);
+    
+    // init send FEC
+    if (fec_group_size > 0) {
+        if (!FECEncoder_Init(&o->send_fec, reactor, o->send_seal_input, fec_group_size, UDPGW_DGRAM_FEC_FLUSH_LATENCY)) {
+            SessionLog(o, BLOG_ERROR, "FECEncoder_Init failed");
+            goto fail2;
+        }
+        o->send_seal_input = FECEncoder_GetOutput(&o->send_fec);
+    }
+    
+    // init sealing
+    PacketRecvInterface_Receiver_Init(o->send_seal_input, (PacketRecvInterface_handler_done)seal_input_handler_done, o);
+    PacketRecvInterface_Init(&o->send_seal_if, UDPGW_DGRAM_PACKET_MTU(fec_group_size), (PacketRecvInterface_handler_recv)seal_if_handler_recv, o, pg);
+    o->send_seal_out = NULL;
+    o->send_seq = 0;
+    
+    // init send buffer
+    if (!PacketBuffer_Init(&o->send_buffer, &o->send_seal_if, send_output, send_buffer_packets, pg)) {
+        SessionLog(o, BLOG_ERROR, "PacketBuffer_Init failed");
+        goto fail3;
+    }
+    
+    // allocate receive buffer
+    if (!(o->recv_buf = (uint8_t *)BAlloc(payload_mtu + UDPGW_DGRAM_TAG_SIZE))) {
+        SessionLog(o, BLOG_ERROR, "BAlloc failed");
+        goto fail4;
+    }
+    
+    // init receive FEC
+    o->recv_output = recv_output;
+    if (fec_group_size > 0) {
+        if (!FECDecoder_Init(&o->recv_fec, o->recv_output, pg, user, logfunc)) {
+            SessionLog(o, BLOG_ERROR, "FECDecoder_Init failed");
+            goto fail5;
+        }
+        o->recv_output = FECDecoder_GetInput(&o->recv_fec);
+    }
+    PacketPassInterface_Sender_Init(o->recv_output, (PacketPassInterface_handler_done)recv_output_handler_done, o);
+    
+    // init receive input
+    PacketPassInterface_Init(&o->recv_if, UDPGW_DGRAM_PACKET_MTU(fec_group_size), (PacketPassInterface_handler_send)recv_if_handler_send, o, pg);
+    
+    // nothing received yet
+    o->recv_have_seq = 0;
+    
+    DebugObject_Init(&o->d_obj);
+    return 1;
+    
+fail5:
+    BFree(o->recv_buf);
+fail4:
+    PacketBuffer_Free(&o->send_buffer);
+fail3:
+    PacketRecvInterface_Free(&o->send_seal_if);
+    if (fec_group_size > 0) {
+        FECEncoder_Free(&o->send_fec);
+    }
+fail2:
+    BufferWriter_Free(&o->send_writer);
+    BAEAD_Free(&o->recv_aead);
+fail1:
+    BAEAD_Free(&o->send_aead);
+fail0:
+    return 0;
+}
+
+void UdpGwDgram_Free (UdpGwDgram *o)
+{
+    DebugObject_Free(&o->d_obj);
+    
+    // free receive input
+    PacketPassInterface_Free(&o->recv_if);
+    
+    // free receive FEC
+    if (o->fec_group_size > 0) {
+        FECDecoder_Free(&o->recv_fec);
+    }
+    
+    // free receive buffer
+    BFree(o->recv_buf);
+    
+    // free send buffer
+    PacketBuffer_Free(&o->send_buffer);
+    
+    // free sealing
+    PacketRecvInterface_Free(&o->send_seal_if);
+    
+    // free send FEC
+    if (o->fec_group_size > 0) {
+        FECEncoder_Free(&o->send_fec);
+    }
+    
+    // free send writer
+    BufferWriter_Free(&o->send_writer);
+    
+    // free ciphers
+    BAEAD_Free(&o->recv_aead);
+    BAEAD_Free(&o->send_aead);
+}
+
+BufferWriter * UdpGwDgram_GetSendInput (UdpGwDgram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->send_writer;
+}
+
+PacketPassInterface * UdpGwDgram_GetRecvInput (UdpGwDgram *o)
+{
+    DebugObject_Access(&o->d_obj);
+    
+    return &o->recv_if;
+}
+
+int UdpGwDgram_ParseSessionId (const uint8_t *data, int data_len, uint32_t *out_session_id)
+{
+    struct udpgw_dgram_header header;
+    if (data_len < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    
+    *out_session_id = ltoh32(header.session_id);
+    return 1;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file UdpGwDgram.h
+ * @author Ambroz Bizjak <ambrop7@gmail.com>
+ * 
+ * @section LICENSE
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * @section DESCRIPTION
+ * 
+ * One end of a udpgw datagram transport session (see udpgw_proto.h).
+ */
+
+#ifndef BADVPN_UDPGW_DGRAM_UDPGWDGRAM_H
+#define BADVPN_UDPGW_DGRAM_UDPGWDGRAM_H
+
+#include <stdint.h>
+
+#include <protocol/udpgw_proto.h>
+#include <protocol/fecproto.h>
+#include <misc/debug.h>
+#include <base/DebugObject.h>
+#include <base/BLog.h>
+#include <system/BReactor.h>
+#include <security/BAEAD.h>
+#include <flow/BufferWriter.h>
+#include <flow/PacketBuffer.h>
+#include <flowextra/FECEncoder.h>
+#include <flowextra/FECDecoder.h>
+
+// how long the FEC encoder waits for more messages before finishing a group
+#define UDPGW_DGRAM_FEC_FLUSH_LATENCY 20
+
+/**
+ * Size of the datagrams of a session, given the FEC group size.
+ */
+#define UDPGW_DGRAM_PACKET_MTU(_fec_group_size) \
+    (sizeof(struct udpgw_dgram_header) + ((_fec_group_size) > 0 ? sizeof(struct fecproto_header) : 0) + \
+     UDPGW_DGRAM_MAX_MESSAGE + UDPGW_DGRAM_TAG_SIZE)
+
+/**
+ * One end of a udpgw datagram transport session.
+ * 
+ * Messages written to the send input (a {@link BufferWriter}) are sealed into
+ * datagrams, with FEC parity datagrams in between if FEC is used, which are
+ * buffered and sent to the send output.
+ * Datagrams passed to the receive input are authenticated, checked against
+ * replays and decrypted, and the messages in them passed to the receive output,
+ * including those recovered with FEC. Datagrams which do not check out are
+ * dropped.
+ */
+typedef struct {
+    void *user;
+    BLog_logfunc logfunc;
+    uint32_t session_id;
+    int fec_group_size;
+    uint32_t send_direction;
+    uint32_t recv_direction;
+    BAEAD send_aead;
+    BAEAD recv_aead;
+    uint64_t send_seq;
+    BufferWriter send_writer;
+    FECEncoder send_fec;
+    PacketRecvInterface *send_seal_input;
+    PacketRecvInterface send_seal_if;
+    uint8_t *send_seal_out;
+    PacketBuffer send_buffer;
+    PacketPassInterface recv_if;
+    PacketPassInterface *recv_output;
+    FECDecoder recv_fec;
+    int recv_have_seq;
+    uint64_t recv_top_seq;
+    uint64_t recv_window;
+    uint8_t *recv_buf;
+    DebugObject d_obj;
+} UdpGwDgram;
+
+/**
+ * Initializes the object.
+ * {@link BLog_Init} must have been done.
+ * 
+ * @param o the object
+ * @param is_server whether this is the server end, which determines the
+ *                  nonces used in each direction
+ * @param session_id session identifier, as in the offer
+ * @param key key of UDPGW_DGRAM_KEY_SIZE bytes, as in the offer
+ * @param fec_group_size number of messages covered by a FEC parity datagram,
+ *                       or 0 for no FEC. Must be >=0 and <=FECPROTO_MAX_GROUP_SIZE.
+ * @param send_buffer_packets number of datagrams to buffer for sending. Must be >0.
+ * @param send_output output for datagrams. Its MTU must be
+ *                    >=UDPGW_DGRAM_PACKET_MTU(fec_group_size).
+ * @param recv_output output for received messages. Its MTU must be
+ *                    UDPGW_DGRAM_MAX_MESSAGE.
+ * @param reactor reactor we live in
+ * @param user argument to logfunc
+ * @param logfunc function which prepends the log prefix using {@link BLog_Append}
+ * @return 1 on success, 0 on failure
+ */
+int UdpGwDgram_Init (UdpGwDgram *o, int is_server, uint32_t session_id, const uint8_t *key, int fec_group_size, int send_buffer_packets,
+                     PacketPassInterface *send_output, PacketPassInterface *recv_output, BReactor *reactor, void *user, BLog_logfunc logfunc) WARN_UNUSED;
+
+/**
+ * Frees the object.
+ * 
+ * @param o the object
+ */
+void UdpGwDgram_Free (UdpGwDgram *o);
+
+/**
+ * Returns the send input, for messages of up to UDPGW_DGRAM_MAX_MESSAGE bytes.
+ * 
+ * @param o the object
+ * @return send input
+ */
+BufferWriter * UdpGwDgram_GetSendInput (UdpGwDgram *o);
+
+/**
+ * Returns the receive input, for datagrams.
+ * Its MTU is UDPGW_DGRAM_PACKET_MTU(fec_group_size).
+ * 
+ * @param o the object
+ * @return receive input
+ */
+PacketPassInterface * UdpGwDgram_GetRecvInput (UdpGwDgram *o);
+
+/**
+ * Returns the session identifier of a received datagram.
+ * 
+ * @param data datagram
+ * @param data_len length of the datagram
+ * @param out_session_id the session identifier is stored here
+ * @return 1 on success, 0 if the datagram is too short to have one
+ */
+int UdpGwDgram_ParseSessionId (const uint8_t *data, int data_len, uint32_t *out_session_id);
+
+#endif